@@ -0,0 +1,119 @@
+/* Flow struct layout and hash chain walk benchmark.
+ *
+ * Prints the size of Flow, the cache line each hot member is on and
+ * times a walk over hash chains comparing the lookup key, the way
+ * FlowCompare() does it.
+ *
+ * Build from the src/ dir of a configured tree:
+ *   gcc -O2 -DHAVE_CONFIG_H -I. ../benches/flow-layout.c -o flow-layout
+ * Run:
+ *   ./flow-layout [flows] [chain length]
+ */
+
+#include "suricata-common.h"
+#include "flow.h"
+
+#include <time.h>
+
+#define LINE(m) (offsetof(Flow, m) / CLS)
+#define SHOW(m) \
+    printf("  %-24s offset %4zu  line %zu\n", #m, offsetof(Flow, m), LINE(m))
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* same checks as CMP_FLOW, without the Packet */
+static inline int KeyMatch(const Flow *f, const Flow *k)
+{
+    return (f->src.address.address_un_data32[0] == k->src.address.address_un_data32[0] &&
+            f->dst.address.address_un_data32[0] == k->dst.address.address_un_data32[0] &&
+            f->sp == k->sp && f->dp == k->dp &&
+            f->proto == k->proto && f->recursion_level == k->recursion_level &&
+            f->vlan_id[0] == k->vlan_id[0] && f->vlan_id[1] == k->vlan_id[1] &&
+            f->vni == k->vni);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t nflows = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t chain = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    if (nflows == 0 || chain == 0)
+        return 1;
+
+    printf("sizeof(Flow) %zu (%zu cache lines of %d)\n",
+            sizeof(Flow), (sizeof(Flow) + CLS - 1) / CLS, CLS);
+    printf("hot members:\n");
+    SHOW(src);
+    SHOW(dst);
+    SHOW(sp);
+    SHOW(dp);
+    SHOW(vni);
+    SHOW(hnext);
+    SHOW(flow_hash);
+    SHOW(lastts);
+    SHOW(flow_state_sc_atomic__);
+    SHOW(use_cnt_sc_atomic__);
+    SHOW(flags);
+    SHOW(protoctx);
+    printf("cold members:\n");
+    SHOW(startts);
+    SHOW(todstbytecnt);
+    SHOW(tenant_id);
+    SHOW(probing_parser_toserver_alproto_masks);
+
+    Flow *flows = aligned_alloc(CLS, nflows * sizeof(Flow));
+    size_t *order = malloc(nflows * sizeof(size_t));
+    if (flows == NULL || order == NULL)
+        return 1;
+    memset(flows, 0, nflows * sizeof(Flow));
+
+    /* link the flows into chains in random order, so each step of a
+     * walk is a cache miss like in a large flow table */
+    size_t i;
+    for (i = 0; i < nflows; i++)
+        order[i] = i;
+    srand(1);
+    for (i = nflows - 1; i > 0; i--) {
+        size_t j = (size_t)rand() % (i + 1);
+        size_t t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+    for (i = 0; i < nflows; i++) {
+        Flow *f = &flows[order[i]];
+        f->src.address.address_un_data32[0] = (uint32_t)i;
+        f->dst.address.address_un_data32[0] = (uint32_t)~i;
+        f->sp = (Port)i;
+        f->dp = 80;
+        f->proto = IPPROTO_TCP;
+        f->hnext = ((i + 1) % chain && i + 1 < nflows) ? &flows[order[i + 1]] : NULL;
+    }
+
+    /* look up the last flow of each chain */
+    size_t found = 0;
+    double start = Now();
+    for (i = 0; i < nflows; i += chain) {
+        size_t last = (i + chain - 1 < nflows) ? i + chain - 1 : nflows - 1;
+        const Flow *key = &flows[order[last]];
+        const Flow *f = &flows[order[i]];
+        while (f != NULL) {
+            if (KeyMatch(f, key)) {
+                found++;
+                break;
+            }
+            f = f->hnext;
+        }
+    }
+    double elapsed = Now() - start;
+
+    printf("walked %zu chains of %zu: %.1f ns per flow visited\n",
+            found, chain, elapsed * 1e9 / nflows);
+    printf("memory for %zu flows: %.1f MiB\n", nflows,
+            (double)(nflows * sizeof(Flow)) / (1024 * 1024));
+
+    free(order);
+    free(flows);
+    return 0;
+}
@@ -80,7 +80,7 @@ class SuricataCompleter:
 
 class SuricataSC:
     def __init__(self, sck_path, verbose=False):
-        self.cmd_list=['shutdown','quit','pcap-file','pcap-file-number','pcap-file-list','iface-list','iface-stat','register-tenant','unregister-tenant','register-tenant-handler','unregister-tenant-handler']
+        self.cmd_list=['shutdown','quit','pcap-file','pcap-file-continuous','pcap-file-number','pcap-file-list','pcap-interrupt','iface-list','iface-stat','register-tenant','unregister-tenant','register-tenant-handler','unregister-tenant-handler','host-os-policy-add']
         self.sck_path = sck_path
         self.verbose = verbose
 
@@ -175,7 +175,7 @@ class SuricataSC:
     def parse_command(self, command):
         arguments = None
         if command.split(' ', 2)[0] in self.cmd_list:
-            if "pcap-file " in command:
+            if "pcap-file " in command or "pcap-file-continuous " in command:
                 try:
                     parts = command.split(' ');
                 except:
@@ -184,7 +184,7 @@ class SuricataSC:
                 tenant = None
                 if len(parts) > 3:
                     tenant = parts[3]
-                if cmd != "pcap-file":
+                if cmd != "pcap-file" and cmd != "pcap-file-continuous":
                     raise SuricataCommandException("Invalid command '%s'" % (command))
                 else:
                     arguments = {}
@@ -202,6 +202,17 @@ class SuricataSC:
                 else:
                     arguments = {}
                     arguments["iface"] = iface
+            elif "host-os-policy-add" in command:
+                try:
+                    [cmd, policy, address] = command.split(' ', 2)
+                except:
+                    raise SuricataCommandException("Arguments to command '%s' is missing" % (command))
+                if cmd != "host-os-policy-add":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                else:
+                    arguments = {}
+                    arguments["policy"] = policy
+                    arguments["address"] = address
             elif "conf-get" in command:
                 try:
                     [cmd, variable] = command.split(' ', 1)
@@ -267,6 +278,34 @@ class SuricataSC:
                     arguments = {}
                     arguments["id"] = int(tenantid)
                     arguments["filename"] = filename
+            elif "profiling-rules-start" in command:
+                parts = command.split(' ')
+                if parts[0] != "profiling-rules-start":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                cmd = parts[0]
+                arguments = {}
+                if len(parts) > 1:
+                    arguments["rate"] = int(parts[1])
+                if len(parts) > 2:
+                    arguments["mode"] = parts[2]
+            elif "profiling-rules-dump" in command:
+                parts = command.split(' ')
+                if parts[0] != "profiling-rules-dump":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                cmd = parts[0]
+                arguments = {}
+                if len(parts) > 1:
+                    arguments["limit"] = int(parts[1])
+            elif "detect-memuse" in command:
+                parts = command.split(' ')
+                if parts[0] != "detect-memuse":
+                    raise SuricataCommandException("Invalid command '%s'" % (command))
+                cmd = parts[0]
+                arguments = {}
+                if len(parts) > 1:
+                    arguments["limit"] = int(parts[1])
+                if len(parts) > 2:
+                    arguments["tenant-id"] = int(parts[2])
             elif "reload-tenant" in command:
                 try:
                     [cmd, tenantid, filename] = command.split(' ', 2)
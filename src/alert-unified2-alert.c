@@ -78,6 +78,12 @@
 /**< Minimum log file limit in MB. */
 #define MIN_LIMIT 1 * 1024 * 1024
 
+/**< Default size of the per thread record batch. */
+#define DEFAULT_BUFFER_SIZE 256 * 1024
+
+/**< Default max time in ms a record waits in the batch. */
+#define DEFAULT_FLUSH_INTERVAL 1000
+
 /* Default Sensor ID value */
 static uint32_t sensor_id = 0;
 
@@ -184,6 +190,8 @@ typedef struct Unified2AlertFileCtx_ {
     LogFileCtx *file_ctx;
     HttpXFFCfg *xff_cfg;
     uint32_t flags; /**< flags for all alerts */
+    uint32_t buffer_size; /**< batch size, 0 to write per packet */
+    uint32_t flush_interval; /**< max batch age in ms, 0 for none */
 } Unified2AlertFileCtx;
 
 #define UNIFIED2_ALERT_FLAGS_EMIT_PACKET (1 << 0)
@@ -211,12 +219,20 @@ typedef struct Unified2AlertThread_ {
     uint8_t xff_flags; /**< XFF flags for the current alert */
     uint32_t xff_ip[4]; /**< The XFF reported IP address for the current alert */
     uint32_t event_id;
+    uint8_t *batch; /**< complete events not yet written to the file */
+    uint32_t batch_len;
+    uint32_t batch_size; /**< allocated size of batch */
+    uint32_t batch_alerts; /**< alerts in the batch */
 } Unified2AlertThread;
 
 #define UNIFIED2_PACKET_SIZE        (sizeof(Unified2Packet) - 4)
 
 SC_ATOMIC_DECLARE(unsigned int, unified2_event_id);  /**< Atomic counter, to link relative event */
 
+/** packet time at which this thread's batch is due, tv_sec 0 if empty.
+ *  Thread local so Unified2Condition can see it. */
+static __thread struct timeval unified2_flush_due = { 0, 0 };
+
 /** prototypes */
 //TmEcode Unified2Alert (ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 TmEcode Unified2AlertThreadInit(ThreadVars *, void *, void **);
@@ -291,30 +307,121 @@ int Unified2AlertRotateFile(ThreadVars *t, Unified2AlertThread *aun)
 }
 
 /**
- * \brief Wrapper for fwrite
+ * \brief Add the current record to the thread's batch
  *
- * This function is basically a wrapper for fwrite which take
- * in charge a size counter.
+ * The batch grows if a single event doesn't fit, so the records of an
+ * event are always written out together.
  *
  * \return 1 in case of success
  */
 static int Unified2Write(Unified2AlertThread *aun)
 {
-    int ret;
+    if (aun->batch_len + aun->length > aun->batch_size) {
+        uint32_t size = aun->batch_size * 2;
+        while (size < aun->batch_len + aun->length)
+            size *= 2;
+
+        uint8_t *ptr = SCRealloc(aun->batch, size);
+        if (unlikely(ptr == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error: growing unified2 batch "
+                    "to %"PRIu32" bytes failed", size);
+            return -1;
+        }
+        aun->batch = ptr;
+        aun->batch_size = size;
+    }
 
-    ret = fwrite(aun->data, aun->length, 1, aun->unified2alert_ctx->file_ctx->fp);
-    if (ret != 1) {
+    memcpy(aun->batch + aun->batch_len, aun->data, aun->length);
+    aun->batch_len += aun->length;
+    return 1;
+}
+
+/**
+ * \brief Write the thread's batch to the file
+ *
+ * The batch only holds complete events, so the file is rotated here
+ * before it is written if it would go over the limit. The file lock is
+ * held for a single fwrite.
+ *
+ * \retval 0 on success
+ * \retval -1 on failure, the batch is dropped
+ */
+static int Unified2BatchFlush(Unified2AlertThread *aun)
+{
+    LogFileCtx *file_ctx = aun->unified2alert_ctx->file_ctx;
+    int ret = 0;
+
+    unified2_flush_due.tv_sec = 0;
+    if (aun->batch_len == 0)
+        return 0;
+
+    SCMutexLock(&file_ctx->fp_mutex);
+    if (file_ctx->size_current > 0 &&
+        (file_ctx->size_current + aun->batch_len) > file_ctx->size_limit) {
+        if (Unified2AlertRotateFile(NULL, aun) < 0) {
+            ret = -1;
+            goto end;
+        }
+    }
+
+    if (file_ctx->fp == NULL ||
+        fwrite(aun->batch, aun->batch_len, 1, file_ctx->fp) != 1) {
         SCLogError(SC_ERR_FWRITE, "Error: fwrite failed: %s", strerror(errno));
-        return -1;
+        ret = -1;
+        goto end;
     }
+    fflush(file_ctx->fp);
+    file_ctx->size_current += aun->batch_len;
 
-    aun->unified2alert_ctx->file_ctx->size_current += aun->length;
-    return 1;
+end:
+    file_ctx->alerts += aun->batch_alerts;
+    SCMutexUnlock(&file_ctx->fp_mutex);
+
+    aun->batch_len = 0;
+    aun->batch_alerts = 0;
+    return ret;
+}
+
+/**
+ * \brief Write the batch if it is full or too old
+ *
+ * Age is measured in packet time, the first packet after the interval
+ * passed writes the batch even if it has no alerts itself.
+ */
+static int Unified2BatchCheck(Unified2AlertThread *aun, const Packet *p)
+{
+    Unified2AlertFileCtx *ctx = aun->unified2alert_ctx;
+
+    if (aun->batch_len == 0)
+        return 0;
+
+    if (aun->batch_len >= ctx->buffer_size)
+        return Unified2BatchFlush(aun);
+
+    if (ctx->flush_interval > 0) {
+        if (unified2_flush_due.tv_sec == 0) {
+            unified2_flush_due.tv_sec = p->ts.tv_sec + ctx->flush_interval / 1000;
+            unified2_flush_due.tv_usec = p->ts.tv_usec +
+                (ctx->flush_interval % 1000) * 1000;
+            if (unified2_flush_due.tv_usec >= 1000000) {
+                unified2_flush_due.tv_sec++;
+                unified2_flush_due.tv_usec -= 1000000;
+            }
+        } else if (timercmp(&p->ts, &unified2_flush_due, >=)) {
+            return Unified2BatchFlush(aun);
+        }
+    }
+    return 0;
 }
 
 int Unified2Condition(ThreadVars *tv, const Packet *p) {
-    if (likely(p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG)))
+    if (likely(p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG))) {
+        /* let the logger write out a batch that waited long enough */
+        if (unified2_flush_due.tv_sec != 0 &&
+            timercmp(&p->ts, &unified2_flush_due, >=))
+            return TRUE;
         return FALSE;
+    }
     return TRUE;
 }
 
@@ -370,10 +477,12 @@ int Unified2Logger(ThreadVars *t, void *data, const Packet *p)
         ret = Unified2IPv4TypeAlert (t, p, data);
     } else if(PKT_IS_IPV6(p)) {
         ret = Unified2IPv6TypeAlert (t, p, data);
-    } else {
-        /* we're only supporting IPv4 and IPv6 */
-        return TM_ECODE_OK;
     }
+    /* we're only supporting IPv4 and IPv6, but other packets can still
+     * write out a pending batch */
+
+    if (Unified2BatchCheck(aun, p) < 0)
+        ret = -1;
 
     if (ret != 0) {
         return TM_ECODE_FAILED;
@@ -679,7 +788,7 @@ error:
  *  Barnyard2 doesn't like DLT_RAW + IPv6, so if we don't have an ethernet
  *  header, we create a fake one.
  *
- *  No need to lock here, since it's already locked.
+ *  No need to lock here, records go to the thread's batch.
  *
  *  \param aun thread local data
  *  \param p Packet
@@ -936,19 +1045,10 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
         phdr->classification_id = htonl(pa->s->class);
         phdr->priority_id = htonl(pa->s->prio);
 
-        SCMutexLock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
-        if ((aun->unified2alert_ctx->file_ctx->size_current + length) >
-              aun->unified2alert_ctx->file_ctx->size_limit) {
-            if (Unified2AlertRotateFile(t,aun) < 0) {
-                aun->unified2alert_ctx->file_ctx->alerts += i;
-                SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
-                return -1;
-            }
-        }
+        /* drop a partial event from the batch on error */
+        uint32_t batch_len = aun->batch_len;
 
         if (Unified2Write(aun) != 1) {
-            aun->unified2alert_ctx->file_ctx->alerts += i;
-            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
             return -1;
         }
 
@@ -961,14 +1061,10 @@ static int Unified2IPv6TypeAlert(ThreadVars *t, const Packet *p, void *data)
             (pa->flags & (PACKET_ALERT_FLAG_STATE_MATCH|PACKET_ALERT_FLAG_STREAM_MATCH) ? 1 : 0) : 0;
         ret = Unified2PacketTypeAlert(aun, p, phdr->event_id, stream);
         if (ret != 1) {
-            SCLogError(SC_ERR_FWRITE, "Error: fwrite failed: %s", strerror(errno));
-            aun->unified2alert_ctx->file_ctx->alerts += i;
-            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+            aun->batch_len = batch_len;
             return -1;
         }
-        fflush(aun->unified2alert_ctx->file_ctx->fp);
-        aun->unified2alert_ctx->file_ctx->alerts++;
-        SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+        aun->batch_alerts++;
     }
 
     return 0;
@@ -1113,21 +1209,11 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
         phdr->classification_id = htonl(pa->s->class);
         phdr->priority_id = htonl(pa->s->prio);
 
-        /* check and enforce the filesize limit */
-        SCMutexLock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
-
-        if ((aun->unified2alert_ctx->file_ctx->size_current + length) >
-              aun->unified2alert_ctx->file_ctx->size_limit) {
-            if (Unified2AlertRotateFile(tv,aun) < 0) {
-                aun->unified2alert_ctx->file_ctx->alerts += i;
-                SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
-                return -1;
-            }
-        }
+        /* drop a partial event from the batch on error, the filesize
+         * limit is enforced when the batch is written */
+        uint32_t batch_len = aun->batch_len;
 
         if (Unified2Write(aun) != 1) {
-            aun->unified2alert_ctx->file_ctx->alerts += i;
-            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
             return -1;
         }
 
@@ -1135,21 +1221,15 @@ static int Unified2IPv4TypeAlert (ThreadVars *tv, const Packet *p, void *data)
         aun->length = 0;
         aun->offset = 0;
 
-        /* Write the alert (it doesn't lock inside, since we
-         * already locked here for rotation check)
-         */
+        /* Write the packet record to the batch as well */
         int stream = (gphdr.protocol == IPPROTO_TCP) ?
             (pa->flags & (PACKET_ALERT_FLAG_STATE_MATCH|PACKET_ALERT_FLAG_STREAM_MATCH) ? 1 : 0) : 0;
         ret = Unified2PacketTypeAlert(aun, p, event_id, stream);
         if (ret != 1) {
-            aun->unified2alert_ctx->file_ctx->alerts += i;
-            SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+            aun->batch_len = batch_len;
             return -1;
         }
-
-        fflush(aun->unified2alert_ctx->file_ctx->fp);
-        aun->unified2alert_ctx->file_ctx->alerts++;
-        SCMutexUnlock(&aun->unified2alert_ctx->file_ctx->fp_mutex);
+        aun->batch_alerts++;
     }
 
     return 0;
@@ -1189,6 +1269,15 @@ TmEcode Unified2AlertThreadInit(ThreadVars *t, void *initdata, void **data)
     aun->datalen = sizeof(Unified2AlertFileHeader) + sizeof(Unified2Packet) +
                     IPV4_MAXPACKET_LEN + sizeof(Unified2ExtraDataHdr) + sizeof(Unified2ExtraData);
 
+    /* room for a full batch plus the event that fills it up */
+    aun->batch_size = aun->unified2alert_ctx->buffer_size + aun->datalen;
+    aun->batch = SCMalloc(aun->batch_size);
+    if (aun->batch == NULL) {
+        SCFree(aun->data);
+        SCFree(aun);
+        return TM_ECODE_FAILED;
+    }
+
     *data = (void *)aun;
 
     return TM_ECODE_OK;
@@ -1219,6 +1308,12 @@ TmEcode Unified2AlertThreadDeinit(ThreadVars *t, void *data)
 
     }
 
+    (void)Unified2BatchFlush(aun);
+    if (aun->batch != NULL) {
+        SCFree(aun->batch);
+        aun->batch = NULL;
+    }
+
     if (aun->data != NULL) {
         SCFree(aun->data);
         aun->data = NULL;
@@ -1312,6 +1407,30 @@ OutputCtx *Unified2AlertInitCtx(ConfNode *conf)
         }
     }
 
+    uint32_t buffer_size = DEFAULT_BUFFER_SIZE;
+    intmax_t flush_interval = DEFAULT_FLUSH_INTERVAL;
+    if (conf != NULL) {
+        const char *s_buffer_size = ConfNodeLookupChildValue(conf, "buffer-size");
+        if (s_buffer_size != NULL &&
+            ParseSizeStringU32(s_buffer_size, &buffer_size) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Failed to initialize "
+                    "unified2 output, invalid buffer-size: %s", s_buffer_size);
+            exit(EXIT_FAILURE);
+        }
+        if (buffer_size > file_ctx->size_limit / 2) {
+            buffer_size = file_ctx->size_limit / 2;
+            SCLogInfo("unified2-alert \"buffer-size\" capped to half the "
+                    "limit: %"PRIu32, buffer_size);
+        }
+        if (ConfGetChildValueInt(conf, "flush-interval", &flush_interval) &&
+            (flush_interval < 0 || flush_interval > 3600000)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Failed to initialize "
+                    "unified2 output, invalid flush-interval: %"PRIdMAX,
+                    flush_interval);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     ret = Unified2AlertOpenFileCtx(file_ctx, filename);
     if (ret < 0)
         goto error;
@@ -1339,6 +1458,8 @@ OutputCtx *Unified2AlertInitCtx(ConfNode *conf)
     unified2alert_ctx->file_ctx = file_ctx;
     unified2alert_ctx->xff_cfg = xff_cfg;
     unified2alert_ctx->flags = flags;
+    unified2alert_ctx->buffer_size = buffer_size;
+    unified2alert_ctx->flush_interval = (uint32_t)flush_interval;
     output_ctx->data = unified2alert_ctx;
     output_ctx->DeInit = Unified2AlertDeInitCtx;
 
@@ -1467,6 +1588,12 @@ static int Unified2Test01(void)
     memset(&pq, 0, sizeof(PacketQueue));
     memset(&s, 0, sizeof(Signature));
 
+    p->alerts.alerts = SCCalloc(1, sizeof(PacketAlert));
+    if (unlikely(p->alerts.alerts == NULL)) {
+        PacketFree(p);
+        return 0;
+    }
+    p->alerts.size = 1;
     p->alerts.cnt++;
     p->alerts.alerts[p->alerts.cnt-1].s = &s;
     p->alerts.alerts[p->alerts.cnt-1].s->id = 1;
@@ -1506,13 +1633,13 @@ static int Unified2Test01(void)
     Unified2AlertDeInitCtx(oc);
 
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 1;
 
 end:
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 0;
 }
@@ -1558,6 +1685,12 @@ static int Unified2Test02(void)
     memset(&pq, 0, sizeof(PacketQueue));
     memset(&s, 0, sizeof(Signature));
 
+    p->alerts.alerts = SCCalloc(1, sizeof(PacketAlert));
+    if (unlikely(p->alerts.alerts == NULL)) {
+        PacketFree(p);
+        return 0;
+    }
+    p->alerts.size = 1;
     p->alerts.cnt++;
     p->alerts.alerts[p->alerts.cnt-1].s = &s;
     p->alerts.alerts[p->alerts.cnt-1].s->id = 1;
@@ -1596,13 +1729,13 @@ static int Unified2Test02(void)
     Unified2AlertDeInitCtx(oc);
 
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 1;
 
 end:
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 0;
 }
@@ -1655,6 +1788,12 @@ static int Unified2Test03(void)
     memset(&pq, 0, sizeof(PacketQueue));
     memset(&s, 0, sizeof(Signature));
 
+    p->alerts.alerts = SCCalloc(1, sizeof(PacketAlert));
+    if (unlikely(p->alerts.alerts == NULL)) {
+        PacketFree(p);
+        return 0;
+    }
+    p->alerts.size = 1;
     p->alerts.cnt++;
     p->alerts.alerts[p->alerts.cnt-1].s = &s;
     p->alerts.alerts[p->alerts.cnt-1].s->id = 1;
@@ -1700,7 +1839,7 @@ static int Unified2Test03(void)
     }
 
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 1;
 
@@ -1712,7 +1851,7 @@ end:
         pkt = PacketDequeue(&pq);
     }
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 0;
 }
@@ -1752,6 +1891,12 @@ static int Unified2Test04(void)
     memset(&pq, 0, sizeof(PacketQueue));
     memset(&s, 0, sizeof(Signature));
 
+    p->alerts.alerts = SCCalloc(1, sizeof(PacketAlert));
+    if (unlikely(p->alerts.alerts == NULL)) {
+        PacketFree(p);
+        return 0;
+    }
+    p->alerts.size = 1;
     p->alerts.cnt++;
     p->alerts.alerts[p->alerts.cnt-1].s = &s;
     p->alerts.alerts[p->alerts.cnt-1].s->id = 1;
@@ -1790,13 +1935,13 @@ static int Unified2Test04(void)
     Unified2AlertDeInitCtx(oc);
 
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 1;
 
 end:
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 0;
 }
@@ -1840,6 +1985,12 @@ static int Unified2Test05(void)
     memset(&pq, 0, sizeof(PacketQueue));
     memset(&s, 0, sizeof(Signature));
 
+    p->alerts.alerts = SCCalloc(1, sizeof(PacketAlert));
+    if (unlikely(p->alerts.alerts == NULL)) {
+        PacketFree(p);
+        return 0;
+    }
+    p->alerts.size = 1;
     p->alerts.cnt++;
     p->alerts.alerts[p->alerts.cnt-1].s = &s;
     p->alerts.alerts[p->alerts.cnt-1].s->id = 1;
@@ -1880,13 +2031,13 @@ static int Unified2Test05(void)
     Unified2AlertDeInitCtx(oc);
 
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 1;
 
 end:
     PACKET_RECYCLE(p);
-    SCFree(p);
+    PacketFree(p);
     FlowShutdown();
     return 0;
 }
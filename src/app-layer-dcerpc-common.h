@@ -172,6 +172,8 @@ typedef struct DCERPCRequest_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
     uint8_t first_request_seen;
@@ -182,6 +184,8 @@ typedef struct DCERPCResponse_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
 } DCERPCResponse;
@@ -244,5 +248,11 @@ int32_t DCERPCParser(DCERPC *, uint8_t *, uint32_t);
 void hexdump(const void *buf, size_t len);
 void printUUID(char *type, DCERPCUuidEntry *uuid);
 
+void DCERPCEnableStubData(void);
+void DCERPCStubDataConfigure(void);
+int DCERPCStubDataAppend(uint8_t **buffer, uint32_t *buffer_len,
+        uint32_t *buffer_size, uint8_t *fresh,
+        const uint8_t *input, uint32_t input_len);
+
 #endif /* __APP_LAYER_DCERPC_COMMON_H__ */
 
@@ -55,20 +55,22 @@ static uint32_t FragmentDataParser(Flow *f, void *dcerpcudp_state,
 	DCERPCUDPState *sstate = (DCERPCUDPState *) dcerpcudp_state;
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
-    void *ptmp;
 
     /* request PDU.  Retrieve the request stub buffer */
     if (sstate->dcerpc.dcerpchdrudp.type == REQUEST) {
         stub_data_buffer = &sstate->dcerpc.dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &sstate->dcerpc.dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &sstate->dcerpc.dcerpcrequest.stub_data_buffer_size;
         stub_data_fresh = &sstate->dcerpc.dcerpcrequest.stub_data_fresh;
 
     /* response PDU.  Retrieve the response stub buffer */
     } else {
         stub_data_buffer = &sstate->dcerpc.dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &sstate->dcerpc.dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &sstate->dcerpc.dcerpcresponse.stub_data_buffer_size;
         stub_data_fresh = &sstate->dcerpc.dcerpcresponse.stub_data_fresh;
     }
 
@@ -85,21 +87,12 @@ static uint32_t FragmentDataParser(Flow *f, void *dcerpcudp_state,
         *stub_data_buffer_len = 0;
     }
 
-    ptmp = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
-    if (ptmp == NULL) {
-        SCFree(*stub_data_buffer);
-        *stub_data_buffer = NULL;
+    if (DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                stub_data_buffer_size, stub_data_fresh, input, stub_len) < 0) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
         SCReturnUInt(0);
     }
 
-    *stub_data_buffer = ptmp;
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
-
-    *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
-
    sstate->dcerpc.fraglenleft -= stub_len;
    sstate->dcerpc.bytesprocessed += stub_len;
 
@@ -799,11 +792,13 @@ static void DCERPCUDPStateFree(void *s)
         SCFree(sstate->dcerpc.dcerpcrequest.stub_data_buffer);
         sstate->dcerpc.dcerpcrequest.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcrequest.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (sstate->dcerpc.dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(sstate->dcerpc.dcerpcresponse.stub_data_buffer);
         sstate->dcerpc.dcerpcresponse.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcresponse.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcresponse.stub_data_buffer_size = 0;
     }
     SCFree(s);
 }
@@ -45,9 +45,12 @@
 #include "decode.h"
 #include "threads.h"
 
+#include "conf.h"
+
 #include "util-print.h"
 #include "util-pool.h"
 #include "util-debug.h"
+#include "util-misc.h"
 
 #include "flow-util.h"
 
@@ -1168,6 +1171,92 @@ static uint32_t DCERPCParseREQUEST(DCERPC *dcerpc, uint8_t *input, uint32_t inpu
     SCReturnUInt((uint32_t)(p - input));
 }
 
+/** smallest stub buffer allocation, grown by doubling from here */
+#define DCERPC_STUB_DATA_MIN_SIZE       256
+/** default app-layer.protocols.dcerpc.stub-data-max-size */
+#define DCERPC_STUB_DATA_DEFAULT_MAX    (1024 * 1024)
+
+/** set once a loaded rule inspects the stub data */
+static int dcerpc_stub_data_enabled = 0;
+static uint32_t dcerpc_stub_data_max = DCERPC_STUB_DATA_DEFAULT_MAX;
+
+/**
+ * \brief Sets a flag that informs the DCERPC parsers that some module in
+ *        the engine needs the stub data. Until then the stub data of
+ *        requests and responses is parsed over but not buffered.
+ * \initonly
+ */
+void DCERPCEnableStubData(void)
+{
+    dcerpc_stub_data_enabled = 1;
+}
+
+/** \brief read app-layer.protocols.dcerpc.stub-data-max-size */
+void DCERPCStubDataConfigure(void)
+{
+    ConfNode *p = ConfGetNode("app-layer.protocols.dcerpc.stub-data-max-size");
+    if (p != NULL) {
+        uint32_t value;
+        if (ParseSizeStringU32(p->val, &value) < 0 || value == 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid value for "
+                    "dcerpc stub-data-max-size %s", p->val);
+        } else {
+            dcerpc_stub_data_max = value;
+        }
+    }
+    SCLogConfig("DCERPC stub data buffered up to %u bytes",
+            dcerpc_stub_data_max);
+}
+
+/**
+ *  \brief add a stub fragment to the reassembled stub of a request or
+ *         response
+ *
+ *  The buffer grows by doubling, so that a PDU split over many fragments
+ *  isn't reallocated for each of them. Data beyond stub-data-max-size is
+ *  dropped, as is all of it while no rule inspects the stub data.
+ *
+ *  \retval 0 ok, also if the data was dropped
+ *  \retval -1 out of memory, the buffer is freed
+ */
+int DCERPCStubDataAppend(uint8_t **buffer, uint32_t *buffer_len,
+        uint32_t *buffer_size, uint8_t *fresh,
+        const uint8_t *input, uint32_t input_len)
+{
+    if (!dcerpc_stub_data_enabled || *buffer_len >= dcerpc_stub_data_max)
+        return 0;
+
+    uint32_t len = MIN(input_len, dcerpc_stub_data_max - *buffer_len);
+    uint32_t needed = *buffer_len + len;
+
+    if (needed > *buffer_size) {
+        uint32_t size = *buffer_size ? *buffer_size : DCERPC_STUB_DATA_MIN_SIZE;
+        while (size < needed) {
+            if (size > dcerpc_stub_data_max / 2) {
+                size = dcerpc_stub_data_max;
+                break;
+            }
+            size *= 2;
+        }
+
+        void *ptmp = SCRealloc(*buffer, size);
+        if (ptmp == NULL) {
+            SCFree(*buffer);
+            *buffer = NULL;
+            *buffer_len = 0;
+            *buffer_size = 0;
+            return -1;
+        }
+        *buffer = ptmp;
+        *buffer_size = size;
+    }
+
+    memcpy(*buffer + *buffer_len, input, len);
+    *buffer_len += len;
+    *fresh = 1;
+    return 0;
+}
+
 /** \internal
  *  \retval stub_len or 0 in case of error */
 static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_len)
@@ -1175,20 +1264,22 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
     SCEnter();
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
-    void *ptmp;
 
     /* request PDU.  Retrieve the request stub buffer */
     if (dcerpc->dcerpchdr.type == REQUEST) {
         stub_data_buffer = &dcerpc->dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcrequest.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcrequest.stub_data_fresh;
 
     /* response PDU.  Retrieve the response stub buffer */
     } else {
         stub_data_buffer = &dcerpc->dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcresponse.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcresponse.stub_data_fresh;
     }
 
@@ -1224,20 +1315,11 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
         dcerpc->pdu_fragged = 1;
     }
 
-    ptmp = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
-    if (ptmp == NULL) {
-        SCFree(*stub_data_buffer);
-        *stub_data_buffer = NULL;
+    if (DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                stub_data_buffer_size, stub_data_fresh, input, stub_len) < 0) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
         SCReturnUInt(0);
     }
-    *stub_data_buffer = ptmp;
-
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
-
-    *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
     /* To see the total reassembled stubdata */
     //hexdump(*stub_data_buffer, *stub_data_buffer_len);
 
@@ -1978,11 +2060,13 @@ void DCERPCCleanup(DCERPC *dcerpc)
         SCFree(dcerpc->dcerpcrequest.stub_data_buffer);
         dcerpc->dcerpcrequest.stub_data_buffer = NULL;
         dcerpc->dcerpcrequest.stub_data_buffer_len = 0;
+        dcerpc->dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (dcerpc->dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(dcerpc->dcerpcresponse.stub_data_buffer);
         dcerpc->dcerpcresponse.stub_data_buffer = NULL;
         dcerpc->dcerpcresponse.stub_data_buffer_len = 0;
+        dcerpc->dcerpcresponse.stub_data_buffer_size = 0;
     }
 }
 
@@ -2026,6 +2110,7 @@ void RegisterDCERPCParsers(void)
     }
 
     if (AppLayerParserConfParserEnabled("tcp", proto_name)) {
+        DCERPCStubDataConfigure();
         AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_DCERPC, STREAM_TOSERVER,
                                      DCERPCParseRequest);
         AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_DCERPC, STREAM_TOCLIENT,
@@ -6377,6 +6462,72 @@ end:
     return result;
 }
 
+/**
+ * \test stub buffer growth, the size cap and dropping the stub data
+ *       if no rule needs it.
+ */
+static int DCERPCParserTest20(void)
+{
+    uint8_t frag[600];
+    uint8_t *buf = NULL;
+    uint32_t len = 0, size = 0;
+    uint8_t fresh = 0;
+    int result = 0;
+    int enabled = dcerpc_stub_data_enabled;
+    uint32_t max = dcerpc_stub_data_max;
+
+    memset(frag, 0x41, sizeof(frag));
+
+    /* not buffered until a rule asks for it */
+    dcerpc_stub_data_enabled = 0;
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 100) != 0 ||
+        buf != NULL || len != 0 || fresh != 0) {
+        printf("stub data buffered while disabled: ");
+        goto end;
+    }
+
+    dcerpc_stub_data_enabled = 1;
+    dcerpc_stub_data_max = 1500;
+
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 100) != 0 ||
+        len != 100 || size != DCERPC_STUB_DATA_MIN_SIZE || fresh != 1) {
+        printf("len %u size %u fresh %u: ", len, size, fresh);
+        goto end;
+    }
+    /* 100 + 600 doubles twice */
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 600) != 0 ||
+        len != 700 || size != 4 * DCERPC_STUB_DATA_MIN_SIZE) {
+        printf("len %u size %u: ", len, size);
+        goto end;
+    }
+    /* fits the current allocation */
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 300) != 0 ||
+        len != 1000 || size != 4 * DCERPC_STUB_DATA_MIN_SIZE) {
+        printf("len %u size %u: ", len, size);
+        goto end;
+    }
+    /* truncated at the cap, the allocation doesn't go beyond it */
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 600) != 0 ||
+        len != 1500 || size != 1500) {
+        printf("len %u size %u: ", len, size);
+        goto end;
+    }
+    fresh = 0;
+    if (DCERPCStubDataAppend(&buf, &len, &size, &fresh, frag, 600) != 0 ||
+        len != 1500 || fresh != 0) {
+        printf("len %u fresh %u: ", len, fresh);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (buf != NULL)
+        SCFree(buf);
+    dcerpc_stub_data_enabled = enabled;
+    dcerpc_stub_data_max = max;
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DCERPCParserRegisterTests(void)
@@ -6401,6 +6552,7 @@ void DCERPCParserRegisterTests(void)
     UtRegisterTest("DCERPCParserTest17", DCERPCParserTest17);
     UtRegisterTest("DCERPCParserTest18", DCERPCParserTest18);
     UtRegisterTest("DCERPCParserTest19", DCERPCParserTest19);
+    UtRegisterTest("DCERPCParserTest20", DCERPCParserTest20);
 #endif /* UNITTESTS */
 
     return;
@@ -58,6 +58,7 @@
 
 #include "conf.h"
 #include "util-memcmp.h"
+#include "util-memcpy.h"
 #include "util-spm.h"
 #include "util-cuda.h"
 #include "util-debug.h"
@@ -101,6 +102,12 @@ typedef struct AppLayerProtoDetectProbingParser_ {
     uint8_t ipproto;
     AppLayerProtoDetectProbingParserPort *port;
 
+    /* port lookup built at prepare time: 256 blocks of 256 ports. A port
+     * without a block or entry uses the port 0 registration, port_any. */
+    AppLayerProtoDetectProbingParserPort **port_map[256];
+    AppLayerProtoDetectProbingParserPort *port_any;
+    int port_map_ready;
+
     struct AppLayerProtoDetectProbingParser_ *next;
 } AppLayerProtoDetectProbingParser;
 
@@ -110,6 +117,11 @@ typedef struct AppLayerProtoDetectPMSignature_ {
     /* \todo Change this into a non-pointer */
     DetectContentData *cd;
     struct AppLayerProtoDetectPMSignature_ *next;
+
+    /* prefix sigs: lowercase copy of the pattern if nocase and the
+     * next sig in the same prefix bucket */
+    uint8_t *prefix_lc;
+    struct AppLayerProtoDetectPMSignature_ *prefix_next;
 } AppLayerProtoDetectPMSignature;
 
 typedef struct AppLayerProtoDetectPMCtx_ {
@@ -123,6 +135,11 @@ typedef struct AppLayerProtoDetectPMCtx_ {
     AppLayerProtoDetectPMSignature **map;
     AppLayerProtoDetectPMSignature *head;
 
+    /** Sigs that can only match at the very start of the buffer, bucketed
+     *  by their lowercased first byte. These bypass the mpm completely. */
+    AppLayerProtoDetectPMSignature *prefix[256];
+    uint16_t prefix_cnt;
+
     /* \todo we don't need this except at setup time.  Get rid of it. */
     PatIntId max_pat_id;
     SigIntId max_sig_id;
@@ -204,6 +221,51 @@ static AppProto AppLayerProtoDetectPMMatchSignature(const AppLayerProtoDetectPMS
     SCReturnUInt(proto);
 }
 
+/** \internal
+ *  \brief Check if a sig can only match at offset 0 */
+static inline int AppLayerProtoDetectPMIsPrefixSig(const DetectContentData *cd)
+{
+    return (cd->offset == 0 && cd->depth == cd->content_len);
+}
+
+/** \internal
+ *  \brief Store a proto in the results if it's not there yet */
+static inline void AppLayerProtoDetectPMAddResult(AppProto proto, AppProto *pm_results,
+                                                  uint16_t *pm_matches, uint8_t *pm_results_bf)
+{
+    if (!(pm_results_bf[proto / 8] & (1 << (proto % 8)))) {
+        pm_results[(*pm_matches)++] = proto;
+        pm_results_bf[proto / 8] |= 1 << (proto % 8);
+    }
+}
+
+/** \internal
+ *  \brief Match the prefix sigs of the bucket for the first byte
+ *
+ *  Prefix sigs need only a compare at offset 0, done with the vectorized
+ *  SCMemcmp variants instead of an mpm scan plus spm verification. */
+static void AppLayerProtoDetectPMMatchPrefix(const AppLayerProtoDetectPMCtx *pm_ctx,
+                                            const uint8_t *buf, uint16_t buflen,
+                                            AppProto *pm_results, uint16_t *pm_matches,
+                                            uint8_t *pm_results_bf)
+{
+    const AppLayerProtoDetectPMSignature *s = pm_ctx->prefix[u8_tolower(buf[0])];
+    for ( ; s != NULL; s = s->prefix_next) {
+        const DetectContentData *cd = s->cd;
+        if (cd->content_len > buflen)
+            continue;
+
+        int r;
+        if (s->prefix_lc != NULL)
+            r = SCMemcmpLowercase(s->prefix_lc, buf, cd->content_len);
+        else
+            r = SCMemcmp(cd->content, buf, cd->content_len);
+        if (r == 0)
+            AppLayerProtoDetectPMAddResult(s->alproto, pm_results, pm_matches,
+                                           pm_results_bf);
+    }
+}
+
 /** \internal
  *  \brief Run Pattern Sigs against buffer
  *  \param pm_results[out] AppProto array of size ALPROTO_MAX */
@@ -234,13 +296,26 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
         pm_ctx = &alpd_ctx.ctx_ipp[f->protomap].ctx_pm[1];
         mpm_tctx = &tctx->mpm_tctx[f->protomap][1];
     }
-    if (pm_ctx->mpm_ctx.pattern_cnt == 0)
+    if (pm_ctx->max_sig_id == 0 || buflen == 0)
         goto end;
 
     searchlen = buflen;
     if (searchlen > pm_ctx->max_len)
         searchlen = pm_ctx->max_len;
 
+    /* alproto bit field */
+    uint8_t pm_results_bf[(ALPROTO_MAX / 8) + 1];
+    memset(pm_results_bf, 0, sizeof(pm_results_bf));
+
+    if (pm_ctx->prefix_cnt > 0) {
+        AppLayerProtoDetectPMMatchPrefix(pm_ctx, buf, searchlen,
+                                         pm_results, &pm_matches, pm_results_bf);
+    }
+
+    /* nothing left that needs a scan */
+    if (pm_ctx->mpm_ctx.pattern_cnt == 0)
+        goto end;
+
     uint32_t search_cnt = 0;
 
     /* do the mpm search */
@@ -251,10 +326,6 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
     if (search_cnt == 0)
         goto end;
 
-    /* alproto bit field */
-    uint8_t pm_results_bf[(ALPROTO_MAX / 8) + 1];
-    memset(pm_results_bf, 0, sizeof(pm_results_bf));
-
     /* loop through unique pattern id's. Can't use search_cnt here,
      * as that contains all matches, tctx->pmq.pattern_id_array_cnt
      * contains only *unique* matches. */
@@ -265,11 +336,9 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
                     tctx, buf, searchlen, ipproto);
 
             /* store each unique proto once */
-            if (proto != ALPROTO_UNKNOWN &&
-                !(pm_results_bf[proto / 8] & (1 << (proto % 8))) )
-            {
-                pm_results[pm_matches++] = proto;
-                pm_results_bf[proto / 8] |= 1 << (proto % 8);
+            if (proto != ALPROTO_UNKNOWN) {
+                AppLayerProtoDetectPMAddResult(proto, pm_results, &pm_matches,
+                                               pm_results_bf);
             }
             s = s->next;
         }
@@ -298,6 +367,15 @@ static AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectGetProbingParser
     if (pp == NULL)
         goto end;
 
+    if (pp->port_map_ready) {
+        AppLayerProtoDetectProbingParserPort **blk = pp->port_map[port >> 8];
+        if (blk != NULL && blk[port & 0xff] != NULL)
+            pp_port = blk[port & 0xff];
+        else
+            pp_port = pp->port_any;
+        goto end;
+    }
+
     pp_port = pp->port;
     while (pp_port != NULL) {
         if (pp_port->port == port || pp_port->port == 0) {
@@ -559,10 +637,60 @@ static AppLayerProtoDetectProbingParser *AppLayerProtoDetectProbingParserAlloc(v
     SCReturnPtr(p, "AppLayerProtoDetectProbingParser");
 }
 
+static void AppLayerProtoDetectProbingParserMapFree(AppLayerProtoDetectProbingParser *p)
+{
+    int i;
+    for (i = 0; i < 256; i++) {
+        if (p->port_map[i] != NULL) {
+            SCFree(p->port_map[i]);
+            p->port_map[i] = NULL;
+        }
+    }
+    p->port_any = NULL;
+    p->port_map_ready = 0;
+}
+
+/**
+ * \brief build the port lookup of each ipproto, so getting the parsers
+ *        of a port doesn't walk the port list
+ *
+ * The port list has the port 0 registration last, so each port maps to
+ * its own entry or to the port 0 one, as in the list walk.
+ */
+static int AppLayerProtoDetectProbingParserPrepareMaps(AppLayerProtoDetectProbingParser *pp)
+{
+    for ( ; pp != NULL; pp = pp->next) {
+        AppLayerProtoDetectProbingParserMapFree(pp);
+
+        AppLayerProtoDetectProbingParserPort *pt;
+        for (pt = pp->port; pt != NULL; pt = pt->next) {
+            if (pt->port == 0) {
+                if (pp->port_any == NULL)
+                    pp->port_any = pt;
+                continue;
+            }
+            AppLayerProtoDetectProbingParserPort ***blk = &pp->port_map[pt->port >> 8];
+            if (*blk == NULL) {
+                *blk = SCCalloc(256, sizeof(AppLayerProtoDetectProbingParserPort *));
+                if (*blk == NULL) {
+                    AppLayerProtoDetectProbingParserMapFree(pp);
+                    return -1;
+                }
+            }
+            if ((*blk)[pt->port & 0xff] == NULL)
+                (*blk)[pt->port & 0xff] = pt;
+        }
+        pp->port_map_ready = 1;
+    }
+    return 0;
+}
+
 static void AppLayerProtoDetectProbingParserFree(AppLayerProtoDetectProbingParser *p)
 {
     SCEnter();
 
+    AppLayerProtoDetectProbingParserMapFree(p);
+
     AppLayerProtoDetectProbingParserPort *pt = p->port;
     while (pt != NULL) {
         AppLayerProtoDetectProbingParserPort *pt_next = pt->next;
@@ -869,6 +997,8 @@ static void AppLayerProtoDetectInsertNewProbingParser(AppLayerProtoDetectProbing
         AppLayerProtoDetectProbingParserAppend(pp, new_pp);
         curr_pp = new_pp;
     }
+    /* the port list changes, use it until the next prepare */
+    AppLayerProtoDetectProbingParserMapFree(curr_pp);
 
     /* get the top level port pp */
     AppLayerProtoDetectProbingParserPort *curr_port = curr_pp->port;
@@ -1149,7 +1279,18 @@ static int AppLayerProtoDetectPMMapSignatures(AppLayerProtoDetectPMCtx *ctx)
         s->id = id++;
         SCLogDebug("s->id %u", s->id);
 
-        if (s->cd->flags & DETECT_CONTENT_NOCASE) {
+        if (AppLayerProtoDetectPMIsPrefixSig(s->cd)) {
+            if (s->cd->flags & DETECT_CONTENT_NOCASE) {
+                s->prefix_lc = SCMalloc(s->cd->content_len);
+                if (unlikely(s->prefix_lc == NULL))
+                    goto error;
+                memcpy_tolower(s->prefix_lc, s->cd->content, s->cd->content_len);
+            }
+            uint8_t b = u8_tolower(s->cd->content[0]);
+            s->prefix_next = ctx->prefix[b];
+            ctx->prefix[b] = s;
+            ctx->prefix_cnt++;
+        } else if (s->cd->flags & DETECT_CONTENT_NOCASE) {
             mpm_ret = MpmAddPatternCI(&ctx->mpm_ctx,
                                       s->cd->content, s->cd->content_len,
                                       0, 0, s->cd->id, s->id, 0);
@@ -1183,6 +1324,10 @@ static int AppLayerProtoDetectPMPrepareMpm(AppLayerProtoDetectPMCtx *ctx)
     int ret = 0;
     MpmCtx *mpm_ctx = &ctx->mpm_ctx;
 
+    /* all sigs are prefix sigs */
+    if (mpm_ctx->pattern_cnt == 0)
+        goto end;
+
     if (mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx) < 0)
         goto error;
 
@@ -1200,6 +1345,8 @@ static void AppLayerProtoDetectPMFreeSignature(AppLayerProtoDetectPMSignature *s
         SCReturn;
     if (sig->cd)
         DetectContentFree(sig->cd);
+    if (sig->prefix_lc)
+        SCFree(sig->prefix_lc);
     SCFree(sig);
     SCReturn;
 }
@@ -1359,6 +1506,9 @@ int AppLayerProtoDetectPrepareState(void)
         }
     }
 
+    if (AppLayerProtoDetectProbingParserPrepareMaps(alpd_ctx.ctx_pp) < 0)
+        goto error;
+
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         AppLayerProtoDetectPrintProbingParsers(alpd_ctx.ctx_pp);
@@ -3757,6 +3907,110 @@ static int AppLayerProtoDetectTest20(void)
     return result;
 }
 
+/** \test prefix sigs are matched without the mpm, others still through it */
+static int AppLayerProtoDetectTest21(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    Flow f;
+    AppProto pm_results[ALPROTO_MAX];
+    memset(&f, 0x00, sizeof(f));
+    f.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+
+    AppLayerProtoDetectPMRegisterPatternCI(IPPROTO_TCP, ALPROTO_HTTP, "GET|20|", 4, 0, STREAM_TOSERVER);
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_SMB, "|ff|SMB", 8, 4, STREAM_TOSERVER);
+    AppLayerProtoDetectPrepareState();
+
+    AppLayerProtoDetectPMCtx *pm_ctx = &alpd_ctx.ctx_ipp[FLOW_PROTO_TCP].ctx_pm[0];
+    FAIL_IF_NOT(pm_ctx->prefix_cnt == 1);
+    FAIL_IF_NULL(pm_ctx->prefix['g']);
+    FAIL_IF_NOT(pm_ctx->mpm_ctx.pattern_cnt == 1);
+
+    AppLayerProtoDetectThreadCtx *alpd_tctx = AppLayerProtoDetectGetCtxThread();
+    FAIL_IF_NULL(alpd_tctx);
+
+    uint8_t http[] = "gEt / HTTP/1.0\r\n";
+    uint32_t cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, http, sizeof(http) - 1,
+                                                 STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pm_results[0] == ALPROTO_HTTP);
+
+    /* only at the start */
+    uint8_t nothttp[] = " GET / HTTP/1.0\r\n";
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, nothttp, sizeof(nothttp) - 1,
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 0);
+
+    uint8_t smb[] = { 0x00, 0x00, 0x00, 0x85, 0xff, 'S', 'M', 'B', 0x72 };
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, smb, sizeof(smb),
+                                        STREAM_TOSERVER, IPPROTO_TCP, pm_results);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pm_results[0] == ALPROTO_SMB);
+
+    AppLayerProtoDetectDestroyCtxThread(alpd_tctx);
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
+/** \test the port map returns what the port list walk does, and a
+ *        registration after prepare goes back to the list */
+static int AppLayerProtoDetectTest22(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80", ALPROTO_HTTP,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "0", ALPROTO_SMTP,
+                                  12, 0, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "445", ALPROTO_SMB,
+                                  5, 6, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "53", ALPROTO_DNS,
+                                  12, 0, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+
+    const uint16_t ports[] = { 0, 53, 80, 81, 445, 65535 };
+    const AppLayerProtoDetectProbingParserPort *before[2][6];
+    uint32_t i;
+    for (i = 0; i < 6; i++) {
+        before[0][i] = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                IPPROTO_TCP, ports[i]);
+        before[1][i] = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                IPPROTO_UDP, ports[i]);
+    }
+
+    FAIL_IF(AppLayerProtoDetectProbingParserPrepareMaps(alpd_ctx.ctx_pp) != 0);
+    FAIL_IF_NOT(alpd_ctx.ctx_pp->port_map_ready);
+
+    for (i = 0; i < 6; i++) {
+        FAIL_IF(before[0][i] != AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                    IPPROTO_TCP, ports[i]));
+        FAIL_IF(before[1][i] != AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                    IPPROTO_UDP, ports[i]));
+    }
+    /* no wildcard for udp */
+    FAIL_IF_NOT_NULL(before[1][2]);
+    FAIL_IF_NULL(before[0][3]);
+    FAIL_IF(before[0][3]->port != 0);
+    FAIL_IF(before[0][4]->port != 445);
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "8080", ALPROTO_HTTP,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    const AppLayerProtoDetectProbingParserPort *pt =
+        AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_TCP, 8080);
+    FAIL_IF_NULL(pt);
+    FAIL_IF(pt->port != 8080);
+
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
 
 void AppLayerProtoDetectUnittestsRegister(void)
 {
@@ -3782,6 +4036,8 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
     UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
+    UtRegisterTest("AppLayerProtoDetectTest21", AppLayerProtoDetectTest21);
+    UtRegisterTest("AppLayerProtoDetectTest22", AppLayerProtoDetectTest22);
 
     SCReturn;
 }
@@ -30,6 +30,7 @@
 #endif
 #include "util-memcmp.h"
 #include "util-atomic.h"
+#include "util-arena.h"
 
 typedef struct DNSConfig_ {
     uint32_t request_flood;
@@ -214,6 +215,38 @@ void *DNSGetTx(void *alstate, uint64_t tx_id)
     return NULL;
 }
 
+/**
+ *  \brief walk the tx list in one pass, resuming at the tx returned last
+ */
+AppLayerGetTxIterTuple DNSGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    DNSState *dns_state = (DNSState *)alstate;
+    AppLayerGetTxIterTuple tuple = { NULL, 0, 0 };
+    DNSTransaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&dns_state->tx_list);
+    else if (tx->tx_num - 1 < min_tx_id)
+        tx = TAILQ_NEXT(tx, next);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        uint64_t tx_id = tx->tx_num - 1;
+        if (tx_id < min_tx_id)
+            continue;
+        if (tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = tx;
+        tuple.tx_ptr = tx;
+        tuple.tx_id = tx_id;
+        tuple.has_next = (TAILQ_NEXT(tx, next) != NULL);
+        break;
+    }
+    return tuple;
+}
+
 uint64_t DNSGetTxCnt(void *alstate)
 {
     DNSState *dns_state = (DNSState *)alstate;
@@ -280,13 +313,13 @@ static DNSTransaction *DNSTransactionAlloc(DNSState *state, const uint16_t tx_id
     if (DNSCheckMemcap(sizeof(DNSTransaction), state) < 0)
         return NULL;
 
-    DNSTransaction *tx = SCMalloc(sizeof(DNSTransaction));
+    /* tx_num of the new tx is at most transaction_max + 1 */
+    DNSTransaction *tx = TxArenaAlloc(&state->arena,
+            state->transaction_max + 1, sizeof(DNSTransaction));
     if (unlikely(tx == NULL))
         return NULL;
     DNSIncrMemcap(sizeof(DNSTransaction), state);
 
-    memset(tx, 0x00, sizeof(DNSTransaction));
-
     TAILQ_INIT(&tx->query_list);
     TAILQ_INIT(&tx->answer_list);
     TAILQ_INIT(&tx->authority_list);
@@ -297,6 +330,10 @@ static DNSTransaction *DNSTransactionAlloc(DNSState *state, const uint16_t tx_id
 
 /** \internal
  *  \brief Free a DNS TX
+ *
+ *  The tx and its entries live in the state's arena, so the memory
+ *  itself is handed back by TxArenaRelease.
+ *
  *  \param tx DNS TX to free */
 static void DNSTransactionFree(DNSTransaction *tx, DNSState *state)
 {
@@ -306,19 +343,16 @@ static void DNSTransactionFree(DNSTransaction *tx, DNSState *state)
     while ((q = TAILQ_FIRST(&tx->query_list))) {
         TAILQ_REMOVE(&tx->query_list, q, next);
         DNSDecrMemcap((sizeof(DNSQueryEntry) + q->len), state);
-        SCFree(q);
     }
 
     DNSAnswerEntry *a = NULL;
     while ((a = TAILQ_FIRST(&tx->answer_list))) {
         TAILQ_REMOVE(&tx->answer_list, a, next);
         DNSDecrMemcap((sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len), state);
-        SCFree(a);
     }
     while ((a = TAILQ_FIRST(&tx->authority_list))) {
         TAILQ_REMOVE(&tx->authority_list, a, next);
         DNSDecrMemcap((sizeof(DNSAnswerEntry) + a->fqdn_len + a->data_len), state);
-        SCFree(a);
     }
 
     AppLayerDecoderEventsFreeEvents(&tx->decoder_events);
@@ -333,7 +367,6 @@ static void DNSTransactionFree(DNSTransaction *tx, DNSState *state)
         state->iter = NULL;
 
     DNSDecrMemcap(sizeof(DNSTransaction), state);
-    SCFree(tx);
     SCReturn;
 }
 
@@ -368,6 +401,11 @@ void DNSStateTransactionFree(void *state, uint64_t tx_id)
 
         TAILQ_REMOVE(&dns_state->tx_list, tx, next);
         DNSTransactionFree(tx, state);
+
+        /* tx_num is non-decreasing in the list, so the head is the
+         * oldest tx still holding arena memory */
+        tx = TAILQ_FIRST(&dns_state->tx_list);
+        TxArenaRelease(&dns_state->arena, tx ? tx->tx_num : UINT64_MAX);
         break;
     }
     SCReturn;
@@ -447,11 +485,15 @@ void DNSStateFree(void *s)
             TAILQ_REMOVE(&dns_state->tx_list, tx, next);
             DNSTransactionFree(tx, dns_state);
         }
-
-        if (dns_state->buffer != NULL) {
-            DNSDecrMemcap(0xffff, dns_state); /** TODO update if/once we alloc
-                                               *  in a smarter way */
-            SCFree(dns_state->buffer);
+        TxArenaFree(&dns_state->arena);
+
+        int i;
+        for (i = 0; i < 2; i++) {
+            DNSTcpBuffer *buf = &dns_state->tcp_buffer[i];
+            if (buf->data != NULL) {
+                DNSDecrMemcap(buf->size, dns_state);
+                SCFree(buf->data);
+            }
         }
 
         BUG_ON(dns_state->tx_with_detect_state_cnt > 0);
@@ -583,7 +625,8 @@ void DNSStoreQueryInState(DNSState *dns_state, const uint8_t *fqdn, const uint16
 
     if (DNSCheckMemcap((sizeof(DNSQueryEntry) + fqdn_len), dns_state) < 0)
         return;
-    DNSQueryEntry *q = SCMalloc(sizeof(DNSQueryEntry) + fqdn_len);
+    DNSQueryEntry *q = TxArenaAlloc(&dns_state->arena, tx->tx_num,
+            sizeof(DNSQueryEntry) + fqdn_len);
     if (unlikely(q == NULL))
         return;
     DNSIncrMemcap((sizeof(DNSQueryEntry) + fqdn_len), dns_state);
@@ -614,7 +657,8 @@ void DNSStoreAnswerInState(DNSState *dns_state, const int rtype, const uint8_t *
 
     if (DNSCheckMemcap((sizeof(DNSAnswerEntry) + fqdn_len + data_len), dns_state) < 0)
         return;
-    DNSAnswerEntry *q = SCMalloc(sizeof(DNSAnswerEntry) + fqdn_len + data_len);
+    DNSAnswerEntry *q = TxArenaAlloc(&dns_state->arena, tx->tx_num,
+            sizeof(DNSAnswerEntry) + fqdn_len + data_len);
     if (unlikely(q == NULL))
         return;
     DNSIncrMemcap((sizeof(DNSAnswerEntry) + fqdn_len + data_len), dns_state);
@@ -668,6 +712,35 @@ void DNSStoreAnswerInState(DNSState *dns_state, const int rtype, const uint8_t *
  *  \retval 0 on error/no buffer
  *  \retval size size of fqdn
  */
+/**
+ *  \brief Skip over an uncompressed name without copying it
+ *
+ *  \param data start of the name
+ *
+ *  \retval ptr to the first byte after the name or NULL if the input
+ *          is too short
+ */
+const uint8_t *DNSSkipName(const uint8_t * const input, const uint32_t input_len,
+        const uint8_t *data)
+{
+    if (input + input_len < data + 1) {
+        SCLogDebug("input buffer too small for len");
+        return NULL;
+    }
+
+    while (*data != 0) {
+        uint8_t length = *data;
+        data++;
+
+        if (input + input_len < data + length + 1) {
+            SCLogDebug("input buffer too small for domain of len %u", length);
+            return NULL;
+        }
+        data += length;
+    }
+    return data + 1;
+}
+
 static uint16_t DNSResponseGetNameByOffset(const uint8_t * const input, const uint32_t input_len,
         const uint16_t offset, uint8_t *fqdn, const size_t fqdn_size)
 {
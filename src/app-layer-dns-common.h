@@ -29,6 +29,7 @@
 #include "flow.h"
 #include "queue.h"
 #include "util-byte.h"
+#include "util-arena.h"
 
 #define DNS_MAX_SIZE 256
 
@@ -207,6 +208,16 @@ typedef struct DNSTransaction_ {
     DetectEngineState *de_state;
 } DNSTransaction;
 
+/** \brief partial DNS TCP record of one direction */
+typedef struct DNSTcpBuffer_ {
+    uint8_t *data;
+    uint32_t size;              /**< allocated size of data */
+    uint16_t offset;            /**< bytes of the record we have */
+    uint16_t record_len;        /**< 0 if no record is in progress */
+    uint8_t len_byte;           /**< first byte of a split length field */
+    uint8_t len_byte_set;
+} DNSTcpBuffer;
+
 /** \brief Per flow DNS state container */
 typedef struct DNSState_ {
     TAILQ_HEAD(, DNSTransaction_) tx_list;  /**< transaction list */
@@ -221,10 +232,10 @@ typedef struct DNSState_ {
     uint16_t events;
     uint16_t givenup;
 
-    /* used by TCP only */
-    uint16_t offset;
-    uint16_t record_len;
-    uint8_t *buffer;
+    /* used by TCP only: partial records, [0] toserver, [1] toclient */
+    DNSTcpBuffer tcp_buffer[2];
+
+    TxArena arena;                          /**< txs and their entries */
 } DNSState;
 
 #define DNS_CONFIG_DEFAULT_REQUEST_FLOOD 500
@@ -252,6 +263,9 @@ int DNSStateGetEventInfo(const char *event_name,
 void DNSAppLayerRegisterGetEventInfo(uint8_t ipproto, AppProto alproto);
 
 void *DNSGetTx(void *alstate, uint64_t tx_id);
+AppLayerGetTxIterTuple DNSGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state);
 uint64_t DNSGetTxCnt(void *alstate);
 void DNSSetTxLogged(void *alstate, void *tx, uint32_t logger);
 int DNSGetTxLogged(void *alstate, void *tx, uint32_t logger);
@@ -281,6 +295,8 @@ void DNSStoreAnswerInState(DNSState *dns_state, const int rtype, const uint8_t *
         const uint16_t fqdn_len, const uint16_t type, const uint16_t class, const uint16_t ttl,
         const uint8_t *data, const uint16_t data_len, const uint16_t tx_id);
 
+const uint8_t *DNSSkipName(const uint8_t * const input, const uint32_t input_len,
+        const uint8_t *data);
 const uint8_t *DNSReponseParse(DNSState *dns_state, const DNSHeader * const dns_header,
         const uint16_t num, const DnsListEnum list, const uint8_t * const input,
         const uint32_t input_len, const uint8_t *data);
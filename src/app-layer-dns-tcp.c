@@ -148,38 +148,129 @@ bad_data:
     SCReturnInt(-1);
 }
 
-static int BufferData(DNSState *dns_state, uint8_t *data, uint16_t len)
+/** \internal
+ *  \brief add data to the partial record of a direction
+ *
+ *  The buffer is sized to the record, rounded up to 4k, instead of always
+ *  being 64k. It's kept for the next partial record of the direction.
+ */
+static int BufferData(DNSState *dns_state, DNSTcpBuffer *buf,
+                      const uint8_t *data, uint32_t len)
 {
-    if (dns_state->buffer == NULL) {
-        if (DNSCheckMemcap(0xffff, dns_state) < 0)
+    if (buf->size < buf->record_len) {
+        BUG_ON(buf->offset != 0);
+
+        const uint32_t size = ((uint32_t)buf->record_len + 4095) & ~4095U;
+        if (buf->data != NULL) {
+            DNSDecrMemcap(buf->size, dns_state);
+            SCFree(buf->data);
+            buf->data = NULL;
+            buf->size = 0;
+        }
+        if (DNSCheckMemcap(size, dns_state) < 0)
             return -1;
-
-        /** \todo be smarter about this, like use a pool or several pools for
-         *        chunks of various sizes */
-        dns_state->buffer = SCMalloc(0xffff);
-        if (dns_state->buffer == NULL) {
+        buf->data = SCMalloc(size);
+        if (buf->data == NULL)
             return -1;
-        }
-        DNSIncrMemcap(0xffff, dns_state);
+        DNSIncrMemcap(size, dns_state);
+        buf->size = size;
     }
 
-    if ((uint32_t)len + (uint32_t)dns_state->offset > (uint32_t)dns_state->record_len) {
-        SCLogDebug("oh my, we have more data than the max record size. What do we do. WHAT DO WE DOOOOO!");
+    if (len + (uint32_t)buf->offset > (uint32_t)buf->record_len) {
+        SCLogDebug("more data than the record size");
 #ifdef DEBUG
         BUG_ON(1);
 #endif
-        len = dns_state->record_len - dns_state->offset;
+        len = buf->record_len - buf->offset;
     }
 
-    memcpy(dns_state->buffer + dns_state->offset, data, len);
-    dns_state->offset += len;
+    memcpy(buf->data + buf->offset, data, len);
+    buf->offset += len;
     return 0;
 }
 
-static void BufferReset(DNSState *dns_state)
+static void BufferReset(DNSTcpBuffer *buf)
 {
-    dns_state->record_len = 0;
-    dns_state->offset = 0;
+    buf->record_len = 0;
+    buf->offset = 0;
+}
+
+typedef int (*DNSTCPParseDataFunc)(Flow *, DNSState *, const uint8_t *,
+        const uint32_t);
+
+/** \internal
+ *  \brief split the input in length prefixed DNS records and parse them
+ *
+ *  Records that are complete in the input are parsed straight from it.
+ *  Only a record cut off at the end of the input is buffered.
+ *
+ *  \param min_len minimal valid record length
+ *
+ *  \retval 1 ok
+ *  \retval -1 error
+ */
+static int DNSTCPParseRecords(Flow *f, DNSState *dns_state, DNSTcpBuffer *buf,
+        const uint8_t *input, uint32_t input_len,
+        DNSTCPParseDataFunc ParseData, uint16_t min_len)
+{
+    /* complete the buffered record first */
+    if (buf->record_len > 0) {
+        const uint32_t need = buf->record_len - buf->offset;
+        const uint32_t len = MIN(need, input_len);
+        if (BufferData(dns_state, buf, input, len) < 0) {
+            BufferReset(buf);
+            return -1;
+        }
+        input += len;
+        input_len -= len;
+        if (buf->offset < buf->record_len)
+            return 1;
+
+        int r = ParseData(f, dns_state, buf->data, buf->record_len);
+        BufferReset(buf);
+        if (r < 0)
+            return -1;
+    }
+
+    while (input_len > 0) {
+        /* the 2 byte record length may itself be split */
+        uint16_t len;
+        if (buf->len_byte_set) {
+            len = (uint16_t)(buf->len_byte << 8 | input[0]);
+            buf->len_byte_set = 0;
+            input++;
+            input_len--;
+        } else if (input_len == 1) {
+            buf->len_byte = input[0];
+            buf->len_byte_set = 1;
+            return 1;
+        } else {
+            len = (uint16_t)(input[0] << 8 | input[1]);
+            input += 2;
+            input_len -= 2;
+        }
+        SCLogDebug("record len %u, input_len %u", len, input_len);
+
+        if (len < min_len) {
+            /* bogus len, doesn't fit even basic dns header */
+            return -1;
+        }
+
+        if (len <= input_len) {
+            if (ParseData(f, dns_state, input, len) < 0)
+                return -1;
+            input += len;
+            input_len -= len;
+        } else {
+            buf->record_len = len;
+            if (BufferData(dns_state, buf, input, input_len) < 0) {
+                BufferReset(buf);
+                return -1;
+            }
+            return 1;
+        }
+    }
+    return 1;
 }
 
 static int DNSRequestParseData(Flow *f, DNSState *dns_state, const uint8_t *input, const uint32_t input_len)
@@ -293,67 +384,9 @@ static int DNSTCPRequestParse(Flow *f, void *dstate,
         goto insufficient_data;
     }
 
-next_record:
-    /* if this is the beginning of a record, we need at least the header */
-    if (dns_state->offset == 0 && input_len < sizeof(DNSTcpHeader)) {
-        SCLogDebug("ilen too small, hoped for at least %"PRIuMAX, (uintmax_t)sizeof(DNSTcpHeader));
-        goto insufficient_data;
-    }
-    SCLogDebug("input_len %u offset %u record %u",
-            input_len, dns_state->offset, dns_state->record_len);
-
-    /* this is the first data of this record */
-    if (dns_state->offset == 0) {
-        DNSTcpHeader *dns_tcp_header = (DNSTcpHeader *)input;
-        SCLogDebug("DNS %p", dns_tcp_header);
-
-        if (ntohs(dns_tcp_header->len) < sizeof(DNSHeader)) {
-            /* bogus len, doesn't fit even basic dns header */
-            goto bad_data;
-        } else if (ntohs(dns_tcp_header->len) == (input_len-2)) {
-            /* we have all data, so process w/o buffering */
-            if (DNSRequestParseData(f, dns_state, input+2, input_len-2) < 0)
-                goto bad_data;
-
-        } else if ((input_len-2) > ntohs(dns_tcp_header->len)) {
-            /* we have all data, so process w/o buffering */
-            if (DNSRequestParseData(f, dns_state, input+2, ntohs(dns_tcp_header->len)) < 0)
-                goto bad_data;
-
-            /* treat the rest of the data as a (potential) new record */
-            input += ntohs(dns_tcp_header->len);
-            input_len -= ntohs(dns_tcp_header->len);
-            goto next_record;
-        } else {
-            /* not enough data, store record length and buffer */
-            dns_state->record_len = ntohs(dns_tcp_header->len);
-            BufferData(dns_state, input+2, input_len-2);
-        }
-    } else if (input_len + dns_state->offset < dns_state->record_len) {
-        /* we don't have the full record yet, buffer */
-        BufferData(dns_state, input, input_len);
-    } else if (input_len > (uint32_t)(dns_state->record_len - dns_state->offset)) {
-        /* more data than expected, we may have another record coming up */
-        uint16_t need = (dns_state->record_len - dns_state->offset);
-        BufferData(dns_state, input, need);
-        int r = DNSRequestParseData(f, dns_state, dns_state->buffer, dns_state->record_len);
-        BufferReset(dns_state);
-        if (r < 0)
-            goto bad_data;
-
-        /* treat the rest of the data as a (potential) new record */
-        input += need;
-        input_len -= need;
-        goto next_record;
-    } else {
-        /* implied exactly the amount of data we want
-         * add current to buffer, then inspect buffer */
-        BufferData(dns_state, input, input_len);
-        int r = DNSRequestParseData(f, dns_state, dns_state->buffer, dns_state->record_len);
-        BufferReset(dns_state);
-        if (r < 0)
-            goto bad_data;
-    }
+    if (DNSTCPParseRecords(f, dns_state, &dns_state->tcp_buffer[0],
+                input, input_len, DNSRequestParseData, sizeof(DNSHeader)) < 0)
+        goto bad_data;
 
     SCReturnInt(1);
 insufficient_data:
@@ -382,47 +415,12 @@ static int DNSReponseParseData(Flow *f, DNSState *dns_state, const uint8_t *inpu
     uint16_t q;
     const uint8_t *data = input + sizeof(DNSHeader);
     for (q = 0; q < ntohs(dns_header->questions); q++) {
-        uint8_t fqdn[DNS_MAX_SIZE];
-        uint16_t fqdn_offset = 0;
-
-        if (input + input_len < data + 1) {
-            SCLogDebug("input buffer too small for len field");
+        /* the queries are stored from the request, so only skip over the
+         * name here */
+        data = DNSSkipName(input, input_len, data);
+        if (data == NULL)
             goto insufficient_data;
-        }
-        SCLogDebug("qry length %u", *data);
 
-        while (*data != 0) {
-            uint8_t length = *data;
-            data++;
-
-            if (length > 0) {
-                if (input + input_len < data + length) {
-                    SCLogDebug("input buffer too small for domain of len %u", length);
-                    goto insufficient_data;
-                }
-                //PrintRawDataFp(stdout, data, length);
-
-                if ((size_t)(fqdn_offset + length + 1) < sizeof(fqdn)) {
-                    memcpy(fqdn + fqdn_offset, data, length);
-                    fqdn_offset += length;
-                    fqdn[fqdn_offset++] = '.';
-                }
-            }
-
-            data += length;
-
-            if (input + input_len < data + 1) {
-                SCLogDebug("input buffer too small for len field");
-                goto insufficient_data;
-            }
-
-            SCLogDebug("length %u", *data);
-        }
-        if (fqdn_offset) {
-            fqdn_offset--;
-        }
-
-        data++;
         if (input + input_len < data + sizeof(DNSQueryTrailer)) {
             SCLogDebug("input buffer too small for DNSQueryTrailer");
             goto insufficient_data;
@@ -483,8 +481,9 @@ insufficient_data:
  *
  *  Parses a DNS TCP record and fills the DNS state
  *
- *  As TCP records can be 64k we'll have to buffer the data. Streaming parsing
- *  would have been _very_ tricky due to the way names are compressed in DNS
+ *  As TCP records can be 64k a record that isn't complete in the input is
+ *  buffered. Streaming parsing would have been _very_ tricky due to the way
+ *  names are compressed in DNS
  *
  */
 static int DNSTCPResponseParse(Flow *f, void *dstate,
@@ -507,66 +506,10 @@ static int DNSTCPResponseParse(Flow *f, void *dstate,
         goto insufficient_data;
     }
 
-next_record:
-    /* if this is the beginning of a record, we need at least the header */
-    if (dns_state->offset == 0 &&  input_len < sizeof(DNSTcpHeader)) {
-        SCLogDebug("ilen too small, hoped for at least %"PRIuMAX, (uintmax_t)sizeof(DNSTcpHeader));
-        goto insufficient_data;
-    }
-    SCLogDebug("input_len %u offset %u record %u",
-            input_len, dns_state->offset, dns_state->record_len);
-
-    /* this is the first data of this record */
-    if (dns_state->offset == 0) {
-        DNSTcpHeader *dns_tcp_header = (DNSTcpHeader *)input;
-        SCLogDebug("DNS %p", dns_tcp_header);
-
-        if (ntohs(dns_tcp_header->len) == 0) {
-            goto bad_data;
-        } else if (ntohs(dns_tcp_header->len) == (input_len-2)) {
-            /* we have all data, so process w/o buffering */
-            if (DNSReponseParseData(f, dns_state, input+2, input_len-2) < 0)
-                goto bad_data;
-
-        } else if ((input_len-2) > ntohs(dns_tcp_header->len)) {
-            /* we have all data, so process w/o buffering */
-            if (DNSReponseParseData(f, dns_state, input+2, ntohs(dns_tcp_header->len)) < 0)
-                goto bad_data;
-
-            /* treat the rest of the data as a (potential) new record */
-            input += ntohs(dns_tcp_header->len);
-            input_len -= ntohs(dns_tcp_header->len);
-            goto next_record;
-        } else {
-            /* not enough data, store record length and buffer */
-            dns_state->record_len = ntohs(dns_tcp_header->len);
-            BufferData(dns_state, input+2, input_len-2);
-        }
-    } else if (input_len + dns_state->offset < dns_state->record_len) {
-        /* we don't have the full record yet, buffer */
-        BufferData(dns_state, input, input_len);
-    } else if (input_len > (uint32_t)(dns_state->record_len - dns_state->offset)) {
-        /* more data than expected, we may have another record coming up */
-        uint16_t need = (dns_state->record_len - dns_state->offset);
-        BufferData(dns_state, input, need);
-        int r = DNSReponseParseData(f, dns_state, dns_state->buffer, dns_state->record_len);
-        BufferReset(dns_state);
-        if (r < 0)
-            goto bad_data;
+    if (DNSTCPParseRecords(f, dns_state, &dns_state->tcp_buffer[1],
+                input, input_len, DNSReponseParseData, 1) < 0)
+        goto bad_data;
 
-        /* treat the rest of the data as a (potential) new record */
-        input += need;
-        input_len -= need;
-        goto next_record;
-    } else {
-        /* implied exactly the amount of data we want
-         * add current to buffer, then inspect buffer */
-        BufferData(dns_state, input, input_len);
-        int r = DNSReponseParseData(f, dns_state, dns_state->buffer, dns_state->record_len);
-        BufferReset(dns_state);
-        if (r < 0)
-            goto bad_data;
-    }
     SCReturnInt(1);
 insufficient_data:
     SCReturnInt(-1);
@@ -661,6 +604,7 @@ void RegisterDNSTCPParsers(void)
                                                DNSGetTxDetectState, DNSSetTxDetectState);
 
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_DNS, DNSGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_DNS, DNSGetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_DNS, DNSGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_DNS, DNSGetTxLogged,
                                           DNSSetTxLogged);
@@ -673,14 +617,66 @@ void RegisterDNSTCPParsers(void)
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
     }
+#ifdef UNITTESTS
+    AppLayerParserRegisterProtocolUnittests(IPPROTO_TCP, ALPROTO_DNS, DNSTCPParserRegisterTests);
+#endif
 
     return;
 }
 
 /* UNITTESTS */
 #ifdef UNITTESTS
+
+/** \test records split at every position, including in the length field,
+ *        and several records in one chunk */
+static int DNSTCPParserTest01(void)
+{
+    /* query example.com A, tx id 0x0100 + record number */
+    uint8_t rec[] = { 0x00, 0x1d, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01,
+                      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x65,
+                      0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63,
+                      0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01 };
+    uint8_t input[sizeof(rec) * 3];
+    int i;
+    for (i = 0; i < 3; i++) {
+        memcpy(input + i * sizeof(rec), rec, sizeof(rec));
+        input[i * sizeof(rec) + 3] = (uint8_t)i;
+    }
+
+    uint32_t split;
+    for (split = 1; split < sizeof(input); split++) {
+        DNSState *dns_state = DNSStateAlloc();
+        FAIL_IF_NULL(dns_state);
+
+        FAIL_IF(DNSTCPRequestParse(NULL, dns_state, NULL, input, split, NULL) != 1);
+        FAIL_IF(DNSTCPRequestParse(NULL, dns_state, NULL, input + split,
+                    sizeof(input) - split, NULL) != 1);
+        FAIL_IF(dns_state->transaction_max != 3);
+        FAIL_IF(dns_state->tcp_buffer[0].record_len != 0);
+        FAIL_IF(dns_state->tcp_buffer[0].len_byte_set);
+        /* only a partial record gets a buffer, sized to it */
+        FAIL_IF(dns_state->tcp_buffer[0].size > 4096);
+
+        DNSStateFree(dns_state);
+    }
+    PASS;
+}
+
+/** \test bogus record length */
+static int DNSTCPParserTest02(void)
+{
+    uint8_t input[] = { 0x00, 0x02, 0x01, 0x00 };
+
+    DNSState *dns_state = DNSStateAlloc();
+    FAIL_IF_NULL(dns_state);
+    FAIL_IF(DNSTCPRequestParse(NULL, dns_state, NULL, input, sizeof(input), NULL) != -1);
+    DNSStateFree(dns_state);
+    PASS;
+}
+
 void DNSTCPParserRegisterTests(void)
 {
-//    UtRegisterTest("DNSTCPParserTest01", DNSTCPParserTest01, 1);
+    UtRegisterTest("DNSTCPParserTest01", DNSTCPParserTest01);
+    UtRegisterTest("DNSTCPParserTest02", DNSTCPParserTest02);
 }
 #endif
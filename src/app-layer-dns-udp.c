@@ -206,48 +206,12 @@ static int DNSUDPResponseParse(Flow *f, void *dstate,
     uint16_t q;
     const uint8_t *data = input + sizeof(DNSHeader);
     for (q = 0; q < ntohs(dns_header->questions); q++) {
-        uint8_t fqdn[DNS_MAX_SIZE];
-        uint16_t fqdn_offset = 0;
-
-        if (input + input_len < data + 1) {
-            SCLogDebug("input buffer too small for len");
+        /* the queries are stored from the request, so only skip over the
+         * name here */
+        data = DNSSkipName(input, input_len, data);
+        if (data == NULL)
             goto insufficient_data;
-        }
-        SCLogDebug("qry length %u", *data);
-
-        while (*data != 0) {
-            uint8_t length = *data;
-            data++;
-
-            if (length == 0)
-                break;
-
-            if (input + input_len < data + length) {
-                SCLogDebug("input buffer too small for domain of len %u", length);
-                goto insufficient_data;
-            }
-            //PrintRawDataFp(stdout, data, length);
-
-            if ((size_t)(fqdn_offset + length + 1) < sizeof(fqdn)) {
-                memcpy(fqdn + fqdn_offset, data, length);
-                fqdn_offset += length;
-                fqdn[fqdn_offset++] = '.';
-            }
-
-            data += length;
 
-            if (input + input_len < data + 1) {
-                SCLogDebug("input buffer too small for len");
-                goto insufficient_data;
-            }
-
-            SCLogDebug("length %u", *data);
-        }
-        if (fqdn_offset) {
-            fqdn_offset--;
-        }
-
-        data++;
         if (input + input_len < data + sizeof(DNSQueryTrailer)) {
             SCLogDebug("input buffer too small for DNSQueryTrailer");
             goto insufficient_data;
@@ -418,6 +382,8 @@ void RegisterDNSUDPParsers(void)
 
         AppLayerParserRegisterGetTx(IPPROTO_UDP, ALPROTO_DNS,
                                     DNSGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_UDP, ALPROTO_DNS,
+                                            DNSGetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_UDP, ALPROTO_DNS,
                                        DNSGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_UDP, ALPROTO_DNS, DNSGetTxLogged,
@@ -627,6 +593,48 @@ end:
     return (result);
 }
 
+/** \test tx iterator skips freed txs and honours the id range */
+static int DNSUDPParserTest06 (void)
+{
+    DNSState *dns_state = DNSStateAlloc();
+    FAIL_IF_NULL(dns_state);
+
+    const uint8_t fqdn[] = "www.suricata-ids.org";
+    uint16_t i;
+    for (i = 0; i < 5; i++) {
+        DNSStoreQueryInState(dns_state, fqdn, sizeof(fqdn) - 1, 1, 1, 0x10 + i);
+    }
+    FAIL_IF(DNSGetTxCnt(dns_state) != 5);
+
+    DNSStateTransactionFree(dns_state, 1);
+
+    AppLayerGetTxIteratorFunc IterFunc = DNSGetTxIterator;
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    const uint64_t expect[] = { 0, 2, 3, 4 };
+    uint64_t tx_id = 0;
+    for (i = 0; i < 4; i++) {
+        AppLayerGetTxIterTuple ires = IterFunc(IPPROTO_UDP, ALPROTO_DNS,
+                dns_state, tx_id, 5, &state);
+        FAIL_IF_NULL(ires.tx_ptr);
+        FAIL_IF(ires.tx_id != expect[i]);
+        FAIL_IF(ires.tx_ptr != DNSGetTx(dns_state, ires.tx_id));
+        FAIL_IF(ires.has_next != (i < 3));
+        tx_id = ires.tx_id + 1;
+    }
+    AppLayerGetTxIterTuple ires = IterFunc(IPPROTO_UDP, ALPROTO_DNS,
+            dns_state, tx_id, 5, &state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    /* tx 1 is gone, so nothing in [1, 2) */
+    memset(&state, 0, sizeof(state));
+    ires = IterFunc(IPPROTO_UDP, ALPROTO_DNS, dns_state, 1, 2, &state);
+    FAIL_IF_NOT_NULL(ires.tx_ptr);
+
+    DNSStateFree(dns_state);
+    PASS;
+}
 
 void DNSUDPParserRegisterTests(void)
 {
@@ -635,5 +643,6 @@ void DNSUDPParserRegisterTests(void)
     UtRegisterTest("DNSUDPParserTest03", DNSUDPParserTest03);
     UtRegisterTest("DNSUDPParserTest04", DNSUDPParserTest04);
     UtRegisterTest("DNSUDPParserTest05", DNSUDPParserTest05);
+    UtRegisterTest("DNSUDPParserTest06", DNSUDPParserTest06);
 }
 #endif
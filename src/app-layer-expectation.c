@@ -0,0 +1,279 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Table of expected flows.
+ *
+ * An expectation is the ip proto, vlan, the addresses of both sides and the
+ * port the new flow connects to. The source port is not known in advance,
+ * so it's not part of it. Each expectation is used by one flow only, and
+ * expires APP_LAYER_EXPECTATION_TIMEOUT seconds after it was created.
+ *
+ * Expectations are rare compared to new flows, so the table is behind a
+ * single lock, and a counter lets the lookup for a new flow return without
+ * taking it while the table is empty.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "flow.h"
+#include "threads.h"
+#include "stream.h"
+#include "app-layer-expectation.h"
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+
+#define EXPECTATION_HASH_SIZE   1024
+
+typedef struct Expectation_ {
+    FlowAddress src;    /**< side that opens the flow */
+    FlowAddress dst;    /**< side it connects to */
+    Port dp;
+    uint8_t proto;
+    uint16_t vlan_id;
+    AppProto alproto;
+    uint32_t expire;    /**< packet time in seconds */
+    struct Expectation_ *next;
+} Expectation;
+
+static Expectation *expectation_hash[EXPECTATION_HASH_SIZE];
+static SCMutex expectation_lock = SCMUTEX_INITIALIZER;
+static uint32_t expectation_cnt = 0;
+/** number of expectations, read without the lock */
+SC_ATOMIC_DECLARE(uint32_t, app_layer_expectations);
+
+void AppLayerExpectationSetup(void)
+{
+    SC_ATOMIC_INIT(app_layer_expectations);
+}
+
+static uint32_t ExpectationHash(const FlowAddress *dst, Port dp, uint8_t proto)
+{
+    uint32_t h = hashword(dst->addr_data32, 4, ((uint32_t)dp << 8) | proto);
+    return h % EXPECTATION_HASH_SIZE;
+}
+
+/** \internal \brief unlink and free an entry, the lock is held */
+static void ExpectationRemove(Expectation **pe)
+{
+    Expectation *e = *pe;
+    *pe = e->next;
+    SCFree(e);
+    expectation_cnt--;
+    (void)SC_ATOMIC_SUB(app_layer_expectations, 1);
+}
+
+/** \internal \brief drop the expired entries of a bucket, the lock is held */
+static void ExpectationPruneBucket(uint32_t idx, uint32_t now)
+{
+    Expectation **pe = &expectation_hash[idx];
+    while (*pe != NULL) {
+        if ((*pe)->expire <= now)
+            ExpectationRemove(pe);
+        else
+            pe = &(*pe)->next;
+    }
+}
+
+/** \brief free all expectations */
+void AppLayerExpectationClean(void)
+{
+    uint32_t i;
+
+    SCMutexLock(&expectation_lock);
+    for (i = 0; i < EXPECTATION_HASH_SIZE; i++) {
+        while (expectation_hash[i] != NULL)
+            ExpectationRemove(&expectation_hash[i]);
+    }
+    SCMutexUnlock(&expectation_lock);
+}
+
+/**
+ *  \brief expect a flow announced in flow 'f'
+ *
+ *  \param direction STREAM_TOSERVER if the client of 'f' opens the new flow
+ *                   to the server of 'f', STREAM_TOCLIENT for the reverse
+ *  \param dp port the new flow connects to
+ *  \param alproto protocol to give the new flow
+ *  \param ts time of the packet announcing it
+ *
+ *  \retval 0 ok
+ *  \retval -1 table full or out of memory
+ */
+int AppLayerExpectationCreate(const Flow *f, uint8_t direction, Port dp,
+        AppProto alproto, const struct timeval *ts)
+{
+    const uint32_t now = (uint32_t)ts->tv_sec;
+
+    Expectation *e = SCCalloc(1, sizeof(*e));
+    if (unlikely(e == NULL))
+        return -1;
+
+    if (direction & STREAM_TOSERVER) {
+        e->src = f->src;
+        e->dst = f->dst;
+    } else {
+        e->src = f->dst;
+        e->dst = f->src;
+    }
+    e->dp = dp;
+    e->proto = f->proto;
+    e->vlan_id = f->vlan_id[0];
+    e->alproto = alproto;
+    e->expire = now + APP_LAYER_EXPECTATION_TIMEOUT;
+
+    const uint32_t idx = ExpectationHash(&e->dst, dp, e->proto);
+
+    SCMutexLock(&expectation_lock);
+    ExpectationPruneBucket(idx, now);
+    if (expectation_cnt >= APP_LAYER_EXPECTATION_MAX) {
+        uint32_t i;
+        for (i = 0; i < EXPECTATION_HASH_SIZE; i++)
+            ExpectationPruneBucket(i, now);
+        if (expectation_cnt >= APP_LAYER_EXPECTATION_MAX) {
+            SCMutexUnlock(&expectation_lock);
+            SCFree(e);
+            return -1;
+        }
+    }
+    e->next = expectation_hash[idx];
+    expectation_hash[idx] = e;
+    expectation_cnt++;
+    (void)SC_ATOMIC_ADD(app_layer_expectations, 1);
+    SCMutexUnlock(&expectation_lock);
+
+    SCLogDebug("expecting flow to port %u for %u", dp, alproto);
+    return 0;
+}
+
+/**
+ *  \brief get the protocol expected for a new flow, the expectation is
+ *         used up
+ *
+ *  \param f new flow, initialized from its first packet
+ *  \param ts time of that packet
+ *
+ *  \retval alproto the protocol or ALPROTO_UNKNOWN
+ */
+AppProto AppLayerExpectationGetProto(const Flow *f, const struct timeval *ts)
+{
+    if (SC_ATOMIC_GET(app_layer_expectations) == 0)
+        return ALPROTO_UNKNOWN;
+
+    const uint32_t now = (uint32_t)ts->tv_sec;
+    const uint32_t idx = ExpectationHash(&f->dst, f->dp, f->proto);
+    AppProto alproto = ALPROTO_UNKNOWN;
+
+    SCMutexLock(&expectation_lock);
+    Expectation **pe = &expectation_hash[idx];
+    while (*pe != NULL) {
+        Expectation *e = *pe;
+        if (e->expire <= now) {
+            ExpectationRemove(pe);
+            continue;
+        }
+        if (e->dp == f->dp && e->proto == f->proto &&
+            e->vlan_id == f->vlan_id[0] &&
+            memcmp(&e->dst, &f->dst, sizeof(e->dst)) == 0 &&
+            memcmp(&e->src, &f->src, sizeof(e->src)) == 0)
+        {
+            alproto = e->alproto;
+            ExpectationRemove(pe);
+            break;
+        }
+        pe = &e->next;
+    }
+    SCMutexUnlock(&expectation_lock);
+
+    return alproto;
+}
+
+#ifdef UNITTESTS
+static void ExpectationTestFlow(Flow *f, uint32_t src, uint32_t dst,
+        Port sp, Port dp)
+{
+    memset(f, 0x00, sizeof(*f));
+    f->proto = IPPROTO_TCP;
+    f->flags |= FLOW_IPV4;
+    f->src.addr_data32[0] = src;
+    f->dst.addr_data32[0] = dst;
+    f->sp = sp;
+    f->dp = dp;
+}
+
+/** \test an expectation is used by the first matching flow only */
+static int AppLayerExpectationTest01(void)
+{
+    Flow ctrl, f;
+    struct timeval ts = { 1000, 0 };
+
+    AppLayerExpectationClean();
+    ExpectationTestFlow(&ctrl, 0x01010101, 0x02020202, 40000, 21);
+    FAIL_IF(AppLayerExpectationCreate(&ctrl, STREAM_TOSERVER, 5000,
+                ALPROTO_FTP, &ts) != 0);
+
+    /* wrong port, wrong direction */
+    ExpectationTestFlow(&f, 0x01010101, 0x02020202, 40001, 5001);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_UNKNOWN);
+    ExpectationTestFlow(&f, 0x02020202, 0x01010101, 40001, 5000);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_UNKNOWN);
+
+    ExpectationTestFlow(&f, 0x01010101, 0x02020202, 40001, 5000);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_FTP);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_UNKNOWN);
+    FAIL_IF(SC_ATOMIC_GET(app_layer_expectations) != 0);
+
+    /* the server of the control flow connects back */
+    FAIL_IF(AppLayerExpectationCreate(&ctrl, STREAM_TOCLIENT, 6000,
+                ALPROTO_FTP, &ts) != 0);
+    ExpectationTestFlow(&f, 0x02020202, 0x01010101, 20, 6000);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_FTP);
+
+    AppLayerExpectationClean();
+    PASS;
+}
+
+/** \test expired expectations are not used and get removed */
+static int AppLayerExpectationTest02(void)
+{
+    Flow ctrl, f;
+    struct timeval ts = { 1000, 0 };
+
+    AppLayerExpectationClean();
+    ExpectationTestFlow(&ctrl, 0x01010101, 0x02020202, 40000, 21);
+    FAIL_IF(AppLayerExpectationCreate(&ctrl, STREAM_TOSERVER, 5000,
+                ALPROTO_FTP, &ts) != 0);
+
+    ts.tv_sec += APP_LAYER_EXPECTATION_TIMEOUT;
+    ExpectationTestFlow(&f, 0x01010101, 0x02020202, 40001, 5000);
+    FAIL_IF(AppLayerExpectationGetProto(&f, &ts) != ALPROTO_UNKNOWN);
+    FAIL_IF(SC_ATOMIC_GET(app_layer_expectations) != 0);
+
+    AppLayerExpectationClean();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void AppLayerExpectationRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerExpectationTest01", AppLayerExpectationTest01);
+    UtRegisterTest("AppLayerExpectationTest02", AppLayerExpectationTest02);
+#endif /* UNITTESTS */
+}
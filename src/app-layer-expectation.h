@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Expected flows: a parser that sees a session announce another one, like
+ * an FTP data connection, registers it here. The new flow then gets its
+ * app layer protocol when it is created, and protocol detection is skipped.
+ */
+
+#ifndef __APP_LAYER_EXPECTATION_H__
+#define __APP_LAYER_EXPECTATION_H__
+
+/** seconds an expectation waits for its flow */
+#define APP_LAYER_EXPECTATION_TIMEOUT   60
+/** max expectations waiting at any time */
+#define APP_LAYER_EXPECTATION_MAX       65536
+
+void AppLayerExpectationSetup(void);
+void AppLayerExpectationClean(void);
+
+int AppLayerExpectationCreate(const Flow *f, uint8_t direction, Port dp,
+        AppProto alproto, const struct timeval *ts);
+AppProto AppLayerExpectationGetProto(const Flow *f, const struct timeval *ts);
+
+void AppLayerExpectationRegisterTests(void);
+
+#endif /* __APP_LAYER_EXPECTATION_H__ */
@@ -43,12 +43,20 @@
 #include "app-layer.h"
 #include "app-layer-protos.h"
 #include "app-layer-parser.h"
+#include "app-layer-expectation.h"
 #include "app-layer-ftp.h"
 
 #include "util-spm.h"
 #include "util-unittest.h"
 #include "util-debug.h"
 #include "util-memcmp.h"
+#include "util-file.h"
+
+/** bytes of ftp-data kept for file_data inspection */
+#define FTPDATA_CONTENT_INSPECT_WINDOW 4096
+#define FTPDATA_FILE_BLOCK_SIZE 65536
+
+static StreamingBufferConfig ftpdata_sbcfg = STREAMING_BUFFER_CONFIG_INITIALIZER;
 
 static int FTPGetLineForDirection(FtpState *state, FtpLineState *line_state)
 {
@@ -189,6 +197,8 @@ static int FTPParseRequestCommand(void *ftp_state, uint8_t *input,
     if (input_len >= 4) {
         if (SCMemcmpLowercase("port", input, 4) == 0) {
             fstate->command = FTP_COMMAND_PORT;
+        } else if (SCMemcmpLowercase("eprt", input, 4) == 0) {
+            fstate->command = FTP_COMMAND_EPRT;
         }
 
         /* else {
@@ -199,6 +209,113 @@ static int FTPParseRequestCommand(void *ftp_state, uint8_t *input,
     return 1;
 }
 
+/**
+ * \brief parse the "h1,h2,h3,h4,p1,p2" of PORT and a 227 reply
+ *
+ * \retval 0 ok, port set
+ * \retval -1 not valid
+ */
+static int FTPParsePortNumbers(const uint8_t *input, uint32_t input_len,
+                               uint16_t *port)
+{
+    uint32_t v[6];
+    uint32_t cur = 0;
+    int n = 0, digits = 0;
+    uint32_t i;
+
+    for (i = 0; i < input_len; i++) {
+        const uint8_t c = input[i];
+        if (c >= '0' && c <= '9') {
+            cur = cur * 10 + (c - '0');
+            if (cur > 255)
+                return -1;
+            digits++;
+        } else if (c == ',') {
+            if (digits == 0 || n == 5)
+                return -1;
+            v[n++] = cur;
+            cur = 0;
+            digits = 0;
+        } else {
+            break;
+        }
+    }
+    if (digits == 0 || n != 5)
+        return -1;
+    v[5] = cur;
+
+    *port = (uint16_t)(v[4] << 8 | v[5]);
+    return (*port != 0) ? 0 : -1;
+}
+
+/**
+ * \brief parse the "|af|addr|port|" of EPRT, or "|||port|" of a 229 reply
+ *
+ * \param input starts at the first delimiter
+ *
+ * \retval 0 ok, port set
+ * \retval -1 not valid
+ */
+static int FTPParseExtendedPort(const uint8_t *input, uint32_t input_len,
+                                uint16_t *port)
+{
+    uint32_t i, cur = 0;
+    int delims = 0, digits = 0;
+
+    if (input_len == 0)
+        return -1;
+    const uint8_t d = input[0];
+    if (d < 33 || d > 126 || (d >= '0' && d <= '9'))
+        return -1;
+
+    for (i = 0; i < input_len; i++) {
+        if (input[i] == d) {
+            if (++delims == 4)
+                break;
+        } else if (delims == 3) {
+            if (input[i] < '0' || input[i] > '9')
+                return -1;
+            cur = cur * 10 + (input[i] - '0');
+            if (cur > 65535)
+                return -1;
+            digits++;
+        }
+    }
+    if (delims != 4 || digits == 0 || cur == 0)
+        return -1;
+
+    *port = (uint16_t)cur;
+    return 0;
+}
+
+/**
+ * \brief expect the data connection announced on the control connection
+ *
+ * \param direction STREAM_TOSERVER for passive mode, the client connects
+ *                  to the server. STREAM_TOCLIENT for active mode.
+ */
+static void FTPSetDataExpectation(Flow *f, uint8_t direction, uint16_t port)
+{
+    SCLogDebug("ftp-data expected on port %u", port);
+    if (AppLayerExpectationCreate(f, direction, port, ALPROTO_FTPDATA,
+                &f->lastts) != 0) {
+        SCLogDebug("no ftp-data expectation");
+    }
+}
+
+/** \internal \brief offset of the first byte of 'c' in the line, or 'len' */
+static uint32_t FTPLineFind(const uint8_t *line, uint32_t len, uint32_t offset,
+                            int digit, uint8_t c)
+{
+    for ( ; offset < len; offset++) {
+        if (digit && line[offset] >= '0' && line[offset] <= '9')
+            break;
+        if (!digit && line[offset] == c)
+            break;
+    }
+    return offset;
+}
+
 /**
  * \brief This function is called to retrieve a ftp request
  * \param ftp_state the ftp state structure for the parser
@@ -249,6 +366,23 @@ static int FTPParseRequest(Flow *f, void *ftp_state,
             memcpy(state->port_line, state->current_line,
                    state->current_line_len);
             state->port_line_len = state->current_line_len;
+
+            uint16_t port;
+            uint32_t o = FTPLineFind(state->current_line,
+                    state->current_line_len, 4, 1, 0);
+            if (FTPParsePortNumbers(state->current_line + o,
+                        state->current_line_len - o, &port) == 0) {
+                FTPSetDataExpectation(f, STREAM_TOCLIENT, port);
+            }
+        } else if (state->command == FTP_COMMAND_EPRT) {
+            uint16_t port;
+            uint32_t o = FTPLineFind(state->current_line,
+                    state->current_line_len, 4, 0, ' ') + 1;
+            if (o < state->current_line_len &&
+                FTPParseExtendedPort(state->current_line + o,
+                        state->current_line_len - o, &port) == 0) {
+                FTPSetDataExpectation(f, STREAM_TOCLIENT, port);
+            }
         }
     }
 
@@ -268,9 +402,206 @@ static int FTPParseResponse(Flow *f, void *ftp_state, AppLayerParserState *pstat
                             uint8_t *input, uint32_t input_len,
                             void *local_data)
 {
+    FtpState *state = (FtpState *)ftp_state;
+
+    if (input == NULL || input_len == 0)
+        return 1;
+
+    state->input = input;
+    state->input_len = input_len;
+    /* toclient stream */
+    state->direction = 1;
+
+    /* the passive mode replies tell where the client will connect to */
+    while (FTPGetLine(state) >= 0) {
+        const uint8_t *line = state->current_line;
+        const uint32_t len = state->current_line_len;
+        uint16_t port;
+
+        if (len < 4)
+            continue;
+        if (memcmp(line, "227", 3) == 0) {
+            uint32_t o = FTPLineFind(line, len, 4, 1, 0);
+            if (FTPParsePortNumbers(line + o, len - o, &port) == 0)
+                FTPSetDataExpectation(f, STREAM_TOSERVER, port);
+        } else if (memcmp(line, "229", 3) == 0) {
+            uint32_t o = FTPLineFind(line, len, 4, 0, '(') + 1;
+            if (o < len && FTPParseExtendedPort(line + o, len - o, &port) == 0)
+                FTPSetDataExpectation(f, STREAM_TOSERVER, port);
+        }
+    }
+
     return 1;
 }
 
+/**
+ * \brief check if anything needs the files of the ftp-data flow in
+ *        'direction'
+ *
+ * \retval 1 yes, or we can't tell yet
+ * \retval 0 no
+ */
+static int FTPDataFilesNeeded(const Flow *f, uint8_t direction)
+{
+    uint32_t unneeded;
+
+    if (direction & STREAM_TOSERVER) {
+        unneeded = FLOW_FILE_NO_STORE_TS|FLOW_FILE_NO_MAGIC_TS|
+            FLOW_FILE_NO_MD5_TS|FLOW_FILE_NO_SIZE_TS|FLOW_FILE_NO_DATA_TS;
+    } else {
+        unneeded = FLOW_FILE_NO_STORE_TC|FLOW_FILE_NO_MAGIC_TC|
+            FLOW_FILE_NO_MD5_TC|FLOW_FILE_NO_SIZE_TC|FLOW_FILE_NO_DATA_TC;
+    }
+
+    if (FileForceTracking() || FileForceFilestore() ||
+            FileForceMagic() || FileForceHash())
+        return 1;
+
+    return ((f->flags & unneeded) != unneeded);
+}
+
+static uint16_t FTPDataFileFlags(const Flow *f, uint8_t direction)
+{
+    uint16_t flags = 0;
+
+    if (direction & STREAM_TOSERVER) {
+        if (f->flags & FLOW_FILE_NO_STORE_TS)
+            flags |= FILE_NOSTORE;
+        if (f->flags & FLOW_FILE_NO_MAGIC_TS)
+            flags |= FILE_NOMAGIC;
+        if (f->flags & FLOW_FILE_NO_MD5_TS)
+            flags |= FILE_NOMD5;
+    } else {
+        if (f->flags & FLOW_FILE_NO_STORE_TC)
+            flags |= FILE_NOSTORE;
+        if (f->flags & FLOW_FILE_NO_MAGIC_TC)
+            flags |= FILE_NOMAGIC;
+        if (f->flags & FLOW_FILE_NO_MD5_TC)
+            flags |= FILE_NOMD5;
+    }
+    return flags;
+}
+
+/**
+ * \brief the data of a ftp-data flow is one file, in the direction the
+ *        first data is seen in
+ *
+ * The control connection may name the file only after the data connection
+ * is set up, so the file is named "ftp-data".
+ */
+static int FTPDataParse(Flow *f, FtpDataState *state, AppLayerParserState *pstate,
+                        uint8_t *input, uint32_t input_len, uint8_t direction)
+{
+    SCEnter();
+    const int eof = AppLayerParserStateIssetFlag(pstate, APP_LAYER_PARSER_EOF);
+
+    if (state->direction == 0) {
+        if (input == NULL || input_len == 0)
+            SCReturnInt(1);
+        state->direction = direction;
+
+        if (!FTPDataFilesNeeded(f, direction))
+            SCReturnInt(1);
+
+        state->files = FileContainerAlloc();
+        if (state->files == NULL)
+            SCReturnInt(-1);
+        if (FileOpenFile(state->files, &ftpdata_sbcfg,
+                    (const uint8_t *)"ftp-data", 8, input, input_len,
+                    FTPDataFileFlags(f, direction)) == NULL) {
+            SCLogDebug("FileOpenFile() failed");
+            SCReturnInt(-1);
+        }
+        input_len = 0;
+    }
+
+    if (state->files == NULL || state->file_closed || direction != state->direction)
+        SCReturnInt(1);
+
+    if (input != NULL && input_len > 0) {
+        int ret = FileAppendData(state->files, input, input_len);
+        if (ret == -2) {
+            SCLogDebug("FileAppendData() - file no longer being extracted");
+        } else if (ret < 0) {
+            SCLogDebug("FileAppendData() failed: %d", ret);
+        }
+    }
+    if (eof) {
+        (void)FileCloseFile(state->files, NULL, 0, 0);
+        state->file_closed = 1;
+    }
+    FilePrune(state->files);
+
+    SCReturnInt(1);
+}
+
+static int FTPDataParseRequest(Flow *f, void *ftp_state,
+                               AppLayerParserState *pstate,
+                               uint8_t *input, uint32_t input_len,
+                               void *local_data)
+{
+    return FTPDataParse(f, ftp_state, pstate, input, input_len, STREAM_TOSERVER);
+}
+
+static int FTPDataParseResponse(Flow *f, void *ftp_state,
+                                AppLayerParserState *pstate,
+                                uint8_t *input, uint32_t input_len,
+                                void *local_data)
+{
+    return FTPDataParse(f, ftp_state, pstate, input, input_len, STREAM_TOCLIENT);
+}
+
+static void *FTPDataStateAlloc(void)
+{
+    return SCCalloc(1, sizeof(FtpDataState));
+}
+
+static void FTPDataStateFree(void *s)
+{
+    FtpDataState *state = (FtpDataState *)s;
+    if (state->files != NULL)
+        FileContainerFree(state->files);
+    SCFree(state);
+}
+
+static FileContainer *FTPDataStateGetFiles(void *s, uint8_t direction)
+{
+    FtpDataState *state = (FtpDataState *)s;
+    if (state == NULL || !(direction & state->direction))
+        return NULL;
+    return state->files;
+}
+
+static void FTPDataStateTruncate(void *s, uint8_t direction)
+{
+    FileContainer *fc = FTPDataStateGetFiles(s, direction);
+    if (fc != NULL)
+        FileTruncateAllOpenFiles(fc);
+}
+
+/** \brief ftp-data is only parsed in the flows the ftp parser expects, it's
+ *         not detected */
+static void RegisterFTPDataParser(void)
+{
+    AppLayerProtoDetectRegisterProtocol(ALPROTO_FTPDATA, "ftp-data");
+
+    AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_FTPDATA, STREAM_TOSERVER,
+                                 FTPDataParseRequest);
+    AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_FTPDATA, STREAM_TOCLIENT,
+                                 FTPDataParseResponse);
+    AppLayerParserRegisterStateFuncs(IPPROTO_TCP, ALPROTO_FTPDATA,
+                                     FTPDataStateAlloc, FTPDataStateFree);
+    AppLayerParserRegisterParserAcceptableDataDirection(IPPROTO_TCP,
+            ALPROTO_FTPDATA, STREAM_TOSERVER | STREAM_TOCLIENT);
+    AppLayerParserRegisterGetFilesFunc(IPPROTO_TCP, ALPROTO_FTPDATA,
+                                       FTPDataStateGetFiles);
+    AppLayerParserRegisterTruncateFunc(IPPROTO_TCP, ALPROTO_FTPDATA,
+                                       FTPDataStateTruncate);
+
+    ftpdata_sbcfg.buf_size = FTPDATA_CONTENT_INSPECT_WINDOW;
+    ftpdata_sbcfg.block_size = FTPDATA_FILE_BLOCK_SIZE;
+}
+
 #ifdef DEBUG
 static SCMutex ftp_state_mem_lock = SCMUTEX_INITIALIZER;
 static uint64_t ftp_state_memuse = 0;
@@ -351,6 +682,8 @@ void RegisterFTPParsers(void)
                                      FTPParseResponse);
         AppLayerParserRegisterStateFuncs(IPPROTO_TCP, ALPROTO_FTP, FTPStateAlloc, FTPStateFree);
         AppLayerParserRegisterParserAcceptableDataDirection(IPPROTO_TCP, ALPROTO_FTP, STREAM_TOSERVER | STREAM_TOCLIENT);
+
+        RegisterFTPDataParser();
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -668,6 +1001,66 @@ end:
 }
 #endif /* UNITTESTS */
 
+/** \test the PASV, EPSV and EPRT replies and commands set up the
+ *        expectations of the data connections */
+static int FTPParserTest11(void)
+{
+    Flow f, data;
+    TcpSession ssn;
+    uint8_t reply1[] = "227 Entering Passive Mode (10,0,0,2,19,137).\r\n"
+                       "229 Entering Extended Passive Mode (|||6446|)\r\n";
+    uint8_t request1[] = "EPRT |1|10.0.0.1|6275|\r\n";
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.src.addr_data32[0] = 0x0100000a;
+    f.dst.addr_data32[0] = 0x0200000a;
+    f.sp = 40000;
+    f.dp = 21;
+    f.lastts.tv_sec = 1000;
+
+    memset(&data, 0, sizeof(data));
+    data.proto = IPPROTO_TCP;
+
+    StreamTcpInitConfig(TRUE);
+    AppLayerExpectationClean();
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_FTP, STREAM_TOCLIENT,
+            reply1, sizeof(reply1) - 1);
+    FAIL_IF(r != 0);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_FTP, STREAM_TOSERVER,
+            request1, sizeof(request1) - 1);
+    FAIL_IF(r != 0);
+    SCMutexUnlock(&f.m);
+
+    /* passive: the client connects to the server */
+    data.src = f.src;
+    data.dst = f.dst;
+    data.dp = 19 * 256 + 137;
+    FAIL_IF(AppLayerExpectationGetProto(&data, &f.lastts) != ALPROTO_FTPDATA);
+    data.dp = 6446;
+    FAIL_IF(AppLayerExpectationGetProto(&data, &f.lastts) != ALPROTO_FTPDATA);
+    /* active: the server connects to the client */
+    data.dp = 6275;
+    FAIL_IF(AppLayerExpectationGetProto(&data, &f.lastts) != ALPROTO_UNKNOWN);
+    data.src = f.dst;
+    data.dst = f.src;
+    FAIL_IF(AppLayerExpectationGetProto(&data, &f.lastts) != ALPROTO_FTPDATA);
+
+    AppLayerExpectationClean();
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
 void FTPParserRegisterTests(void)
 {
 #ifdef UNITTESTS
@@ -676,6 +1069,7 @@ void FTPParserRegisterTests(void)
     UtRegisterTest("FTPParserTest06", FTPParserTest06);
     UtRegisterTest("FTPParserTest07", FTPParserTest07);
     UtRegisterTest("FTPParserTest10", FTPParserTest10);
+    UtRegisterTest("FTPParserTest11", FTPParserTest11);
 #endif /* UNITTESTS */
 }
 
@@ -24,6 +24,8 @@
 #ifndef __APP_LAYER_FTP_H__
 #define __APP_LAYER_FTP_H__
 
+#include "util-file.h"
+
 typedef enum {
     FTP_COMMAND_UNKNOWN = 0,
     FTP_COMMAND_ABOR,
@@ -70,7 +72,9 @@ typedef enum {
     FTP_COMMAND_SYST,
     FTP_COMMAND_TYPE,
     FTP_COMMAND_UMASK,
-    FTP_COMMAND_USER
+    FTP_COMMAND_USER,
+    FTP_COMMAND_EPRT,
+    FTP_COMMAND_EPSV
     /** \todo more if missing.. */
 } FtpRequestCommand;
 typedef uint32_t FtpRequestCommandArgOfs;
@@ -125,6 +129,14 @@ typedef struct FtpState_ {
     uint8_t *port_line;
 } FtpState;
 
+/** ftp-data state, one file in the direction the data is sent */
+typedef struct FtpDataState_ {
+    FileContainer *files;
+    /** STREAM_TOSERVER or STREAM_TOCLIENT, 0 until data is seen */
+    uint8_t direction;
+    uint8_t file_closed;
+} FtpDataState;
+
 void RegisterFTPParsers(void);
 void FTPParserRegisterTests(void);
 void FTPAtExitPrintStats(void);
@@ -123,6 +123,22 @@ int HtpBodyAppendChunk(const HTPCfgDir *hcfg, HtpBody *body,
     SCReturnInt(0);
 }
 
+/**
+ * \brief Account for a chunk of body without buffering it
+ *
+ * Used if only the file handling needs the body, which gets the data
+ * straight from libhtp.
+ *
+ * \param body pointer to the HtpBody
+ * \param len length of the chunk
+ */
+void HtpBodySkipChunk(HtpBody *body, uint32_t len)
+{
+    body->content_len_so_far += len;
+    /* nothing for detection to inspect */
+    body->body_inspected = body->content_len_so_far;
+}
+
 /**
  * \brief Print the information and chunks of a Body
  * \param body pointer to the HtpBody holding the list
@@ -160,6 +176,12 @@ void HtpBodyFree(HtpBody *body)
 {
     SCEnter();
 
+    if (body->mpm_ids != NULL) {
+        SCFree(body->mpm_ids);
+        body->mpm_ids = NULL;
+        body->mpm_ids_cnt = body->mpm_ids_size = 0;
+    }
+
     if (body->first == NULL)
         return;
 
@@ -29,6 +29,7 @@
 #define __APP_LAYER_HTP_BODY_H__
 
 int HtpBodyAppendChunk(const HTPCfgDir *, HtpBody *, const uint8_t *, uint32_t);
+void HtpBodySkipChunk(HtpBody *, uint32_t);
 void HtpBodyPrint(HtpBody *);
 void HtpBodyFree(HtpBody *);
 void HtpBodyPrune(HtpState *, HtpBody *, int);
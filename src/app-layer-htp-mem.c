@@ -34,7 +34,10 @@
 
 #include "conf.h"
 #include "util-mem.h"
+#include "util-mem-tag.h"
 #include "util-misc.h"
+#include "util-memcap.h"
+#include "util-file.h"
 
 #include "app-layer-htp-mem.h"
 
@@ -43,6 +46,33 @@ uint64_t htp_config_memcap = 0;
 SC_ATOMIC_DECLARE(uint64_t, htp_memuse);
 SC_ATOMIC_DECLARE(uint64_t, htp_memcap);
 
+/* set by the memcap policy: don't buffer bodies for inspection */
+SC_ATOMIC_DECLARE(int, htp_body_shed);
+
+static uint64_t HTPMemcap(void)
+{
+    return htp_config_memcap;
+}
+
+/** \internal
+ *  \brief memcap policy: stop buffering bodies at degrade, stop hashing
+ *         files as well at critical */
+static void HTPMemcapShed(int level, int prev)
+{
+    SC_ATOMIC_SET(htp_body_shed, level >= MEMCAP_LEVEL_DEGRADE);
+    FileHashShed(level >= MEMCAP_LEVEL_CRITICAL);
+}
+
+/** \brief check if body buffering is shed under memcap pressure
+ *
+ *  Bodies are then only tracked, not buffered. Multipart bodies are still
+ *  buffered as the file extraction needs them.
+ */
+int HTPBodyShed(void)
+{
+    return SC_ATOMIC_GET(htp_body_shed);
+}
+
 void HTPParseMemcap()
 {
     char *conf_val;
@@ -64,6 +94,9 @@ void HTPParseMemcap()
 
     SC_ATOMIC_INIT(htp_memuse);
     SC_ATOMIC_INIT(htp_memcap);
+    SC_ATOMIC_INIT(htp_body_shed);
+
+    MemcapPolicyRegister("http", HTPMemuseGlobalCounter, HTPMemcap, HTPMemcapShed);
 }
 
 void HTPIncrMemuse(uint64_t size)
@@ -111,7 +144,7 @@ void *HTPMalloc(size_t size)
     if (HTPCheckMemcap((uint32_t)size) == 0)
         return NULL;
 
-    ptr = SCMalloc(size);
+    ptr = SCMallocTag(MEM_TAG_HTTP, size);
 
     if (unlikely(ptr == NULL))
         return NULL;
@@ -128,7 +161,7 @@ void *HTPCalloc(size_t n, size_t size)
     if (HTPCheckMemcap((uint32_t)(n * size)) == 0)
         return NULL;
 
-    ptr = SCCalloc(n, size);
+    ptr = SCCallocTag(MEM_TAG_HTTP, n, size);
 
     if (unlikely(ptr == NULL))
         return NULL;
@@ -145,7 +178,7 @@ void *HTPRealloc(void *ptr, size_t orig_size, size_t size)
     if (HTPCheckMemcap((uint32_t)(size - orig_size)) == 0)
         return NULL;
 
-    rptr = SCRealloc(ptr, size);
+    rptr = SCReallocTag(MEM_TAG_HTTP, ptr, size);
     if (rptr == NULL)
         return NULL;
 
@@ -156,7 +189,7 @@ void *HTPRealloc(void *ptr, size_t orig_size, size_t size)
 
 void HTPFree(void *ptr, size_t size)
 {
-    SCFree(ptr);
+    SCFreeTag(MEM_TAG_HTTP, ptr);
 
     HTPDecrMemuse((uint64_t)size);
 }
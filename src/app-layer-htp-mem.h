@@ -25,3 +25,4 @@ void HTPFree(void *ptr, size_t size);
 
 uint64_t HTPMemuseGlobalCounter(void);
 uint64_t HTPMemcapGlobalCounter(void);
+int HTPBodyShed(void);
@@ -312,6 +312,10 @@ static void HtpTxUserDataFree(HtpState *state, HtpTxUserData *htud)
             HTPFree(htud->request_headers_raw, htud->request_headers_raw_len);
         if (htud->response_headers_raw)
             HTPFree(htud->response_headers_raw, htud->response_headers_raw_len);
+        if (htud->request_headers_norm.buffer)
+            HTPFree(htud->request_headers_norm.buffer, htud->request_headers_norm.size);
+        if (htud->response_headers_norm.buffer)
+            HTPFree(htud->response_headers_norm.buffer, htud->response_headers_norm.size);
         AppLayerDecoderEventsFreeEvents(&htud->decoder_events);
         if (htud->boundary)
             HTPFree(htud->boundary, htud->boundary_len);
@@ -423,7 +427,8 @@ void AppLayerHtpEnableRequestBodyCallback(void)
 {
     SCEnter();
 
-    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_REQUEST_BODY);
+    SC_ATOMIC_OR(htp_config_flags,
+            HTP_REQUIRE_REQUEST_BODY|HTP_REQUIRE_REQUEST_BODY_BUFFER);
     SCReturn;
 }
 
@@ -436,10 +441,30 @@ void AppLayerHtpEnableResponseBodyCallback(void)
 {
     SCEnter();
 
-    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_RESPONSE_BODY);
+    SC_ATOMIC_OR(htp_config_flags,
+            HTP_REQUIRE_RESPONSE_BODY|HTP_REQUIRE_RESPONSE_BODY_BUFFER);
     SCReturn;
 }
 
+/** bytes of the request and response bodies the rules inspect, set
+ *  with detect.inspection-depth auto. 0 for no limit. */
+static SC_ATOMIC_DECLARE(uint32_t, htp_inspect_depth_ts);
+static SC_ATOMIC_DECLARE(uint32_t, htp_inspect_depth_tc);
+
+/**
+ * \brief Sets how far into the bodies the detection engine inspects, the
+ *        rest of a body is not buffered. The body_limit settings still
+ *        apply to the file handling.
+ *
+ * \param request request body depth, 0 for no limit
+ * \param response response body depth, 0 for no limit
+ */
+void AppLayerHtpSetBodyInspectDepth(uint32_t request, uint32_t response)
+{
+    SC_ATOMIC_SET(htp_inspect_depth_ts, request);
+    SC_ATOMIC_SET(htp_inspect_depth_tc, response);
+}
+
 /**
  * \brief Sets a flag that informs the HTP app layer that some module in the
  *        engine needs the http request multi part header.
@@ -449,9 +474,10 @@ void AppLayerHtpEnableResponseBodyCallback(void)
 void AppLayerHtpNeedMultipartHeader(void)
 {
     SCEnter();
-    AppLayerHtpEnableRequestBodyCallback();
-
-    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_REQUEST_MULTIPART);
+    /* multipart bodies are always buffered, as the parser reassembles
+     * them from the body buffer */
+    SC_ATOMIC_OR(htp_config_flags,
+            HTP_REQUIRE_REQUEST_BODY|HTP_REQUIRE_REQUEST_MULTIPART);
     SCReturn;
 }
 
@@ -465,10 +491,11 @@ void AppLayerHtpNeedFileInspection(void)
 {
     SCEnter();
     AppLayerHtpNeedMultipartHeader();
-    AppLayerHtpEnableRequestBodyCallback();
-    AppLayerHtpEnableResponseBodyCallback();
 
-    SC_ATOMIC_OR(htp_config_flags, HTP_REQUIRE_REQUEST_FILE);
+    /* the file handling gets the body data from libhtp directly, so this
+     * doesn't require the bodies to be buffered */
+    SC_ATOMIC_OR(htp_config_flags,
+            HTP_REQUIRE_REQUEST_BODY|HTP_REQUIRE_RESPONSE_BODY|HTP_REQUIRE_REQUEST_FILE);
     SCReturn;
 }
 
@@ -1686,6 +1713,27 @@ end:
     return -1;
 }
 
+/** \internal
+ *  \brief Check if a body chunk needs to be added to the tx body buffer
+ *
+ *  If only the file handling wants the body it's not buffered. A body
+ *  that started out unbuffered stays that way, so that the buffer offsets
+ *  keep matching the body offsets if buffering is enabled later on by a
+ *  rule reload. Data past the depth the rules inspect isn't buffered. */
+static int HtpBodyNeedsBuffer(const HtpBody *body, uint32_t flag)
+{
+    if (body->sb == NULL && body->content_len_so_far > 0)
+        return 0;
+
+    /* past what the rules inspect */
+    uint32_t depth = (flag == HTP_REQUIRE_REQUEST_BODY_BUFFER) ?
+        SC_ATOMIC_GET(htp_inspect_depth_ts) : SC_ATOMIC_GET(htp_inspect_depth_tc);
+    if (depth != 0 && body->content_len_so_far >= depth)
+        return 0;
+
+    return (SC_ATOMIC_GET(htp_config_flags) & flag) ? 1 : 0;
+}
+
 /**
  * \brief Function callback to append chunks for Requests
  * \param d pointer to the htp_tx_data_t structure (a chunk from htp lib)
@@ -1765,7 +1813,14 @@ int HTPCallbackRequestBodyData(htp_tx_data_t *d)
         }
         SCLogDebug("len %u", len);
 
-        HtpBodyAppendChunk(&hstate->cfg->request, &tx_ud->request_body, d->data, len);
+        if (tx_ud->request_body_type == HTP_BODY_REQUEST_MULTIPART ||
+            (HtpBodyNeedsBuffer(&tx_ud->request_body, HTP_REQUIRE_REQUEST_BODY_BUFFER) &&
+             !HTPBodyShed()))
+        {
+            HtpBodyAppendChunk(&hstate->cfg->request, &tx_ud->request_body, d->data, len);
+        } else {
+            HtpBodySkipChunk(&tx_ud->request_body, len);
+        }
 
         const uint8_t *chunks_buffer = NULL;
         uint32_t chunks_buffer_len = 0;
@@ -1861,7 +1916,11 @@ int HTPCallbackResponseBodyData(htp_tx_data_t *d)
         }
         SCLogDebug("len %u", len);
 
-        HtpBodyAppendChunk(&hstate->cfg->response, &tx_ud->response_body, d->data, len);
+        if (HtpBodyNeedsBuffer(&tx_ud->response_body, HTP_REQUIRE_RESPONSE_BODY_BUFFER) &&
+                !HTPBodyShed())
+            HtpBodyAppendChunk(&hstate->cfg->response, &tx_ud->response_body, d->data, len);
+        else
+            HtpBodySkipChunk(&tx_ud->response_body, len);
 
         HtpResponseBodyHandle(hstate, tx_ud, d->tx, (uint8_t *)d->data, (uint32_t)d->len);
     } else {
@@ -2130,6 +2189,8 @@ static void HTPConfigSetDefaultsPhase1(HTPCfgRec *cfg_prec)
     cfg_prec->request.inspect_window = HTP_CONFIG_DEFAULT_REQUEST_INSPECT_WINDOW;
     cfg_prec->response.inspect_min_size = HTP_CONFIG_DEFAULT_RESPONSE_INSPECT_MIN_SIZE;
     cfg_prec->response.inspect_window = HTP_CONFIG_DEFAULT_RESPONSE_INSPECT_WINDOW;
+    cfg_prec->request.sbcfg.block_size = HTP_CONFIG_DEFAULT_FILE_BLOCK_SIZE;
+    cfg_prec->response.sbcfg.block_size = HTP_CONFIG_DEFAULT_FILE_BLOCK_SIZE;
 #ifndef AFLFUZZ_NO_RANDOM
     cfg_prec->randomize = HTP_CONFIG_DEFAULT_RANDOMIZE;
 #else
@@ -2348,6 +2409,16 @@ static void HTPConfigParseParameters(HTPCfgRec *cfg_prec, ConfNode *s,
                 exit(EXIT_FAILURE);
             }
 
+        } else if (strcasecmp("file-buffer-block-size", p->name) == 0) {
+            uint32_t block_size = 0;
+            if (ParseSizeStringU32(p->val, &block_size) < 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing file-buffer-block-size "
+                           "from conf file - %s.  Killing engine", p->val);
+                exit(EXIT_FAILURE);
+            }
+            cfg_prec->request.sbcfg.block_size = block_size;
+            cfg_prec->response.sbcfg.block_size = block_size;
+
         } else if (strcasecmp("response-body-decompress-layer-limit", p->name) == 0) {
             uint32_t value = 2;
             if (ParseSizeStringU32(p->val, &value) < 0) {
@@ -2783,6 +2854,8 @@ void RegisterHTPParsers(void)
         AppLayerParserRegisterParser(IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOCLIENT,
                                      HTPHandleResponseData);
         SC_ATOMIC_INIT(htp_config_flags);
+        SC_ATOMIC_INIT(htp_inspect_depth_ts);
+        SC_ATOMIC_INIT(htp_inspect_depth_tc);
         AppLayerParserRegisterParserAcceptableDataDirection(IPPROTO_TCP, ALPROTO_HTTP, STREAM_TOSERVER);
         HTPConfigure();
     } else {
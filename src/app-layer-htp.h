@@ -50,6 +50,7 @@
 #define HTP_CONFIG_DEFAULT_RESPONSE_INSPECT_WINDOW      4096U
 #define HTP_CONFIG_DEFAULT_FIELD_LIMIT_SOFT             9000U
 #define HTP_CONFIG_DEFAULT_FIELD_LIMIT_HARD             18000U
+#define HTP_CONFIG_DEFAULT_FILE_BLOCK_SIZE              65536U
 
 #define HTP_CONFIG_DEFAULT_RANDOMIZE                    1
 #define HTP_CONFIG_DEFAULT_RANDOMIZE_RANGE              10
@@ -184,6 +185,19 @@ typedef struct HtpBody_ {
     uint64_t body_parsed;
     /* inspection tracker */
     uint64_t body_inspected;
+
+    /* detect: sids the body mpm found so far, so that a new chunk only
+     * needs its new data scanned. Only valid for the detect engine and
+     * mpm ctx that produced them. */
+    SigIntId *mpm_ids;
+    uint32_t mpm_ids_cnt;
+    uint32_t mpm_ids_size;
+    uint32_t mpm_de_ctx_id;
+    const void *mpm_ctx;
+    /* body offset the cached ids were collected from */
+    uint64_t mpm_start;
+    /* body offset the mpm has scanned up to */
+    uint64_t mpm_scanned;
 } HtpBody;
 
 #define HTP_CONTENTTYPE_SET     0x01    /**< We have the content type */
@@ -202,6 +216,15 @@ typedef struct HtpBody_ {
 #define HTP_RULE_NEED_TYPE          HTP_TX_HAS_TYPE
 #define HTP_RULE_NEED_FILECONTENT   HTP_TX_HAS_FILECONTENT
 
+/** header buffer as inspected by http_header, built on demand by the
+ *  detection engine */
+typedef struct HtpHeaderBuffer_ {
+    uint8_t *buffer;
+    uint32_t len;
+    uint32_t size;          /**< allocated size */
+    size_t header_cnt;      /**< number of headers the buffer was built from */
+} HtpHeaderBuffer;
+
 /** Now the Body Chunks will be stored per transaction, at
   * the tx user data */
 typedef struct HtpTxUserData_ {
@@ -222,6 +245,9 @@ typedef struct HtpTxUserData_ {
     uint32_t request_headers_raw_len;
     uint32_t response_headers_raw_len;
 
+    HtpHeaderBuffer request_headers_norm;
+    HtpHeaderBuffer response_headers_norm;
+
     AppLayerDecoderEvents *decoder_events;          /**< per tx events */
 
     /** Holds the boundary identificator string if any (used on
@@ -268,6 +294,12 @@ typedef struct HtpState_ {
 #define HTP_REQUIRE_REQUEST_FILE        (1 << 2)
 /** part of the engine needs the request body (e.g. file_data keyword) */
 #define HTP_REQUIRE_RESPONSE_BODY       (1 << 3)
+/** part of the engine needs the request body buffered in the tx, not
+ *  just passed on to the file handling (e.g. http_client_body keyword) */
+#define HTP_REQUIRE_REQUEST_BODY_BUFFER (1 << 4)
+/** part of the engine needs the response body buffered in the tx, not
+ *  just passed on to the file handling (e.g. file_data keyword) */
+#define HTP_REQUIRE_RESPONSE_BODY_BUFFER (1 << 5)
 
 SC_ATOMIC_DECLARE(uint32_t, htp_config_flags);
 
@@ -287,6 +319,7 @@ void HTPStateFree(void *);
 void AppLayerHtpEnableRequestBodyCallback(void);
 void AppLayerHtpEnableResponseBodyCallback(void);
 void AppLayerHtpNeedFileInspection(void);
+void AppLayerHtpSetBodyInspectDepth(uint32_t request, uint32_t response);
 void AppLayerHtpPrintStats(void);
 
 void HTPConfigure(void);
@@ -41,6 +41,7 @@
 #include "util-enum.h"
 #include "util-mem.h"
 #include "util-misc.h"
+#include "util-hash-lookup3.h"
 
 #include "stream.h"
 
@@ -249,6 +250,38 @@ void *ModbusGetTx(void *alstate, uint64_t tx_id) {
     return NULL;
 }
 
+/**
+ *  \brief walk the tx list in one pass, resuming at the tx returned last
+ */
+static AppLayerGetTxIterTuple ModbusGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    ModbusState *modbus = (ModbusState *) alstate;
+    AppLayerGetTxIterTuple tuple = { NULL, 0, 0 };
+    ModbusTransaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&modbus->tx_list);
+    else if (tx->tx_num - 1 < min_tx_id)
+        tx = TAILQ_NEXT(tx, next);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        uint64_t tx_id = tx->tx_num - 1;
+        if (tx_id < min_tx_id)
+            continue;
+        if (tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = tx;
+        tuple.tx_ptr = tx;
+        tuple.tx_id = tx_id;
+        tuple.has_next = (TAILQ_NEXT(tx, next) != NULL);
+        break;
+    }
+    return tuple;
+}
+
 void ModbusSetTxLogged(void *alstate, void *vtx, uint32_t logger)
 {
     ModbusTransaction *tx = (ModbusTransaction *)vtx;
@@ -303,6 +336,9 @@ static ModbusTransaction *ModbusTxFindByTransaction(const ModbusState   *modbus,
  *  \brief Allocate a Modbus Transaction and
  *          add it into Transaction list of Modbus State
  *
+ *  Txs freed earlier on the state are reused before allocating, so a
+ *  long lived poller flow runs without allocations.
+ *
  *  \param  modbus Pointer to Modbus state structure
  *
  *  \retval Pointer to Transaction or NULL pointer
@@ -310,9 +346,13 @@ static ModbusTransaction *ModbusTxFindByTransaction(const ModbusState   *modbus,
 static ModbusTransaction *ModbusTxAlloc(ModbusState *modbus) {
     ModbusTransaction *tx;
 
-    tx = (ModbusTransaction *) SCCalloc(1, sizeof(ModbusTransaction));
-    if (unlikely(tx == NULL))
-        return NULL;
+    if (modbus->tx_pool_cnt > 0) {
+        tx = modbus->tx_pool[--modbus->tx_pool_cnt];
+    } else {
+        tx = (ModbusTransaction *) SCCalloc(1, sizeof(ModbusTransaction));
+        if (unlikely(tx == NULL))
+            return NULL;
+    }
 
     modbus->transaction_max++;
     modbus->unreplied_cnt++;
@@ -354,6 +394,77 @@ static void ModbusTxFree(ModbusTransaction *tx) {
     SCReturn;
 }
 
+/** \internal
+ *  \brief Release a Modbus Transaction into the pool of its state, or free
+ *         it if the pool is full. The data buffer is kept for reuse.
+ */
+static void ModbusTxRecycle(ModbusState *modbus, ModbusTransaction *tx) {
+    if (modbus->tx_pool_cnt >= MODBUS_TX_POOL_SIZE) {
+        ModbusTxFree(tx);
+        return;
+    }
+
+    AppLayerDecoderEventsFreeEvents(&tx->decoder_events);
+    if (tx->de_state != NULL)
+        DetectEngineStateFree(tx->de_state);
+
+    uint16_t *data = tx->data;
+    uint16_t data_size = tx->data_size;
+    memset(tx, 0, sizeof(*tx));
+    tx->data = data;
+    tx->data_size = data_size;
+
+    modbus->tx_pool[modbus->tx_pool_cnt++] = tx;
+}
+
+/** \internal
+ *  \brief Get room for cnt values in the data buffer of a transaction
+ *
+ *  \retval 0 ok, -1 out of memory
+ */
+static int ModbusTxDataAlloc(ModbusTransaction *tx, uint16_t cnt) {
+    if (cnt > tx->data_size) {
+        uint16_t *ptmp = SCRealloc(tx->data, cnt * sizeof(uint16_t));
+        if (unlikely(ptmp == NULL))
+            return -1;
+        tx->data = ptmp;
+        tx->data_size = cnt;
+    }
+    memset(tx->data, 0, cnt * sizeof(uint16_t));
+    tx->data_cnt = cnt;
+    return 0;
+}
+
+/** \internal
+ *  \brief Fill in the compact summary of a parsed request
+ */
+static void ModbusTxSummarize(ModbusTransaction *tx) {
+    ModbusTxSummary *s = &tx->summary;
+    uint8_t type = tx->type;
+
+    memset(s, 0, sizeof(*s));
+    s->function = tx->function;
+    s->category = tx->category;
+    s->type     = type;
+
+    /* In the PDU, Coils and Registers are addressed starting at zero */
+    if (type & MODBUS_TYP_READ) {
+        s->read_start = (uint32_t)tx->read.address + 1;
+        s->read_end = s->read_start +
+            (tx->read.quantity ? tx->read.quantity - 1 : 0);
+    }
+    if (type & MODBUS_TYP_WRITE) {
+        s->write_start = (uint32_t)tx->write.address + 1;
+        s->write_end = s->write_start;
+        if ((type & MODBUS_TYP_MULTIPLE) && tx->write.quantity > 0)
+            s->write_end += tx->write.quantity - 1;
+
+        if (tx->data_cnt > 0)
+            s->value_hash = hashlittle(tx->data,
+                    tx->data_cnt * sizeof(uint16_t), 0);
+    }
+}
+
 /**
  *  \brief Modbus transaction cleanup callback
  */
@@ -389,7 +500,7 @@ void ModbusStateTxFree(void *state, uint64_t tx_id) {
             modbus->givenup = 0;
 
         TAILQ_REMOVE(&modbus->tx_list, tx, next);
-        ModbusTxFree(tx);
+        ModbusTxRecycle(modbus, tx);
         break;
     }
     SCReturn;
@@ -731,8 +842,7 @@ static int ModbusParseWriteRequest(ModbusTransaction   *tx,
 
     if (type & MODBUS_TYP_COILS) {
         /* Output value (data block) unit is count */
-        tx->data = (uint16_t *) SCCalloc(1, count * sizeof(uint16_t));
-        if (unlikely(tx->data == NULL))
+        if (ModbusTxDataAlloc(tx, count) < 0)
             SCReturnInt(-1);
 
         if (type & MODBUS_TYP_SINGLE) {
@@ -753,8 +863,7 @@ static int ModbusParseWriteRequest(ModbusTransaction   *tx,
         }
     } else {
         /* Registers value (data block) unit is quantity */
-        tx->data = (uint16_t *) SCCalloc(1, quantity * sizeof(uint16_t));
-        if (unlikely(tx->data == NULL))
+        if (ModbusTxDataAlloc(tx, quantity) < 0)
             SCReturnInt(-1);
 
         for (i = 0; i < quantity; i++) {
@@ -800,7 +909,7 @@ static void ModbusParseWriteResponse(ModbusTransaction   *tx,
 
     if (type & MODBUS_TYP_SINGLE) {
         /* Check if Outputs/Registers value has been stored */
-        if (tx->data != NULL)
+        if (tx->data_cnt > 0)
         {
             /* Outputs/Registers value (2 bytes) */
             if (ModbusExtractUint16(modbus, &word, input, input_len, offset))
@@ -831,7 +940,7 @@ static void ModbusParseWriteResponse(ModbusTransaction   *tx,
             goto error;
     } else {
         /* Check if And_Mask and Or_Mask values have been stored */
-        if (tx->data != NULL)
+        if (tx->data_cnt >= 2)
         {
             /* And_Mask value (2 bytes) */
             if (ModbusExtractUint16(modbus, &word, input, input_len, offset))
@@ -1284,6 +1393,7 @@ static int ModbusParseRequest(Flow                  *f,
 
         /* Extract MODBUS PDU and fill Transaction Context */
         ModbusParseRequestPDU(tx, modbus, adu, adu_len);
+        ModbusTxSummarize(tx);
 
         /* Update input line and remaining input length of the command */
         input       += adu_len;
@@ -1395,6 +1505,8 @@ static void ModbusStateFree(void *state)
         TAILQ_FOREACH_SAFE(tx, &modbus->tx_list, next, ttx) {
             ModbusTxFree(tx);
         }
+        while (modbus->tx_pool_cnt > 0)
+            ModbusTxFree(modbus->tx_pool[--modbus->tx_pool_cnt]);
 
         SCFree(state);
     }
@@ -1494,6 +1606,7 @@ void RegisterModbusParsers(void)
                                                ModbusGetTxDetectState, ModbusSetTxDetectState);
 
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTxIterator);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_MODBUS, ModbusGetTxLogged,
                                           ModbusSetTxLogged);
@@ -3077,6 +3190,94 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+
+/** \test Summary of a request and reuse of a freed transaction. */
+static int ModbusParserTest17(void) {
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    Flow f;
+    TcpSession ssn;
+
+    int result = 0;
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    f.protoctx  = (void *)&ssn;
+    f.proto     = IPPROTO_TCP;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_MODBUS, STREAM_TOSERVER,
+                                writeMultipleRegistersReq,
+                                sizeof(writeMultipleRegistersReq));
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_MODBUS, STREAM_TOCLIENT,
+                            writeMultipleRegistersRsp,
+                            sizeof(writeMultipleRegistersRsp));
+    if (r != 0) {
+        printf("toclient chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    ModbusState *modbus_state = f.alstate;
+    if (modbus_state == NULL) {
+        printf("no modbus state: ");
+        goto end;
+    }
+
+    ModbusTransaction *tx = ModbusGetTx(modbus_state, 0);
+    if (tx == NULL || tx->summary.function != 16 ||
+        tx->summary.read_start != 0 ||
+        tx->summary.write_start != 2 || tx->summary.write_end != 3 ||
+        tx->summary.value_hash == 0 || tx->data_cnt != 2) {
+        printf("unexpected summary: ");
+        goto end;
+    }
+
+    ModbusStateTxFree(modbus_state, 0);
+    if (modbus_state->tx_pool_cnt != 1 || modbus_state->tx_pool[0] != tx) {
+        printf("tx not in the pool: ");
+        goto end;
+    }
+
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_MODBUS, STREAM_TOSERVER,
+                            readCoilsReq, sizeof(readCoilsReq));
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    ModbusTransaction *tx2 = ModbusGetTx(modbus_state, 1);
+    if (tx2 != tx || modbus_state->tx_pool_cnt != 0) {
+        printf("tx not reused: ");
+        goto end;
+    }
+    if (tx2->data_cnt != 0 || tx2->summary.function != 1 ||
+        tx2->summary.read_start != 0x7891 ||
+        tx2->summary.read_end != 0x7891 + 18 ||
+        tx2->summary.write_start != 0 || tx2->summary.value_hash != 0) {
+        printf("unexpected summary for the reused tx: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
 #endif /* UNITTESTS */
 
 void ModbusParserRegisterTests(void) {
@@ -3113,5 +3314,7 @@ void ModbusParserRegisterTests(void) {
                    ModbusParserTest15);
     UtRegisterTest("ModbusParserTest16 - Modbus invalid Write single register request",
                    ModbusParserTest16);
+    UtRegisterTest("ModbusParserTest17 - Modbus tx summary and reuse",
+                   ModbusParserTest17);
 #endif /* UNITTESTS */
 }
@@ -79,6 +79,24 @@ enum {
 #define MODBUS_TYP_READ_WRITE_MULTIPLE  (MODBUS_TYP_READ | MODBUS_TYP_WRITE | MODBUS_TYP_MULTIPLE)
 
 /* Modbus Transaction Structure, request/response. */
+/** txs kept per state for reuse once they are freed */
+#define MODBUS_TX_POOL_SIZE             16
+
+/** compact form of a request, computed once it is parsed and used by the
+ *  detection and the logger. Addresses are the 1-based numbers used by
+ *  the modbus keyword, inclusive. */
+typedef struct ModbusTxSummary_ {
+    uint8_t     function;
+    uint8_t     category;
+    uint8_t     type;
+    uint8_t     pad;
+    uint32_t    read_start;     /**< 0 if nothing is read */
+    uint32_t    read_end;
+    uint32_t    write_start;    /**< 0 if nothing is written */
+    uint32_t    write_end;
+    uint32_t    value_hash;     /**< hash of the written values, 0 if none */
+} ModbusTxSummary;
+
 typedef struct ModbusTransaction_ {
     struct ModbusState_ *modbus;
 
@@ -107,6 +125,10 @@ typedef struct ModbusTransaction_ {
         };
     };
     uint16_t    *data;  /**< to store data to write, bit is converted in 16bits. */
+    uint16_t    data_cnt;   /**< values in use in data */
+    uint16_t    data_size;  /**< values allocated in data, kept on reuse */
+
+    ModbusTxSummary summary;
 
     AppLayerDecoderEvents *decoder_events;  /**< per tx events */
     DetectEngineState *de_state;
@@ -122,6 +144,9 @@ typedef struct ModbusState_ {
     uint32_t                            unreplied_cnt;  /**< number of unreplied requests */
     uint16_t                            events;
     uint8_t                             givenup;    /**< bool indicating flood. */
+    uint8_t                             tx_pool_cnt;
+    /** freed txs ready for reuse */
+    ModbusTransaction                   *tx_pool[MODBUS_TX_POOL_SIZE];
 } ModbusState;
 
 void RegisterModbusParsers(void);
@@ -0,0 +1,472 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+/**
+ * \file
+ *
+ * Offload of app-layer parsing of selected protocols to helper threads.
+ *
+ * For the configured protocols the worker doesn't call the parser on
+ * stream data of an established session, but queues a copy of it on the
+ * flow and moves on to the next packet. A helper thread takes the flow,
+ * locks it and runs the chunks through the parser one by one, releasing
+ * the flow lock in between so that the worker is held up at most one
+ * chunk when the next packet of the flow arrives.
+ *
+ * The worker drains the queue itself, in order, before parsing data that
+ * ends the stream (EOF, gap, depth), when too much is pending and on the
+ * flow end pseudo packets. Transactions parsed by a helper are inspected
+ * with the next packet of the flow.
+ *
+ * While chunks are queued the flow holds a use_cnt reference for the
+ * helper, so it is not timed out under it.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "flow.h"
+#include "flow-storage.h"
+#include "app-layer.h"
+#include "app-layer-parser.h"
+#include "app-layer-offload.h"
+#include "util-debug.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#define APP_LAYER_OFFLOAD_THREADS_DEFAULT   1
+#define APP_LAYER_OFFLOAD_THREADS_MAX       64
+#define APP_LAYER_OFFLOAD_PENDING_DEFAULT   32
+
+typedef struct AppLayerOffloadChunk_ {
+    struct AppLayerOffloadChunk_ *next;
+    AppProto alproto;
+    uint8_t flags;
+    uint32_t len;
+    uint8_t data[];
+} AppLayerOffloadChunk;
+
+/** per flow queue, in flow storage */
+typedef struct AppLayerOffloadFlow_ {
+    SCMutex m;
+    Flow *f;
+    AppLayerOffloadChunk *head;
+    AppLayerOffloadChunk *tail;
+    uint32_t pending;
+
+    /** on the run queue or with a helper, reference on f held */
+    int scheduled;
+    struct AppLayerOffloadFlow_ *next;
+} AppLayerOffloadFlow;
+
+typedef struct AppLayerOffload_ {
+    int enabled;
+    uint8_t protos[ALPROTO_MAX];
+    uint32_t max_pending;
+    int storage_id;
+
+    /** run queue of flows with pending chunks */
+    SCMutex m;
+    SCCondT cond;
+    AppLayerOffloadFlow *head;
+    AppLayerOffloadFlow *tail;
+    int stop;
+
+    int threads;
+    int running;
+    pthread_t *tids;
+
+    SC_ATOMIC_DECLARE(uint64_t, chunks);
+} AppLayerOffload;
+
+static AppLayerOffload g_offload;
+
+static void OffloadFlowFree(void *ptr)
+{
+    AppLayerOffloadFlow *of = ptr;
+    AppLayerOffloadChunk *c = of->head;
+    while (c != NULL) {
+        AppLayerOffloadChunk *next = c->next;
+        SCFree(c);
+        c = next;
+    }
+    SCMutexDestroy(&of->m);
+    SCFree(of);
+}
+
+static void OffloadFlowEnqueue(AppLayerOffloadFlow *of, AppLayerOffloadChunk *c)
+{
+    c->next = NULL;
+    if (of->tail != NULL)
+        of->tail->next = c;
+    else
+        of->head = c;
+    of->tail = c;
+    of->pending++;
+}
+
+static AppLayerOffloadChunk *OffloadFlowDequeue(AppLayerOffloadFlow *of)
+{
+    AppLayerOffloadChunk *c = of->head;
+    if (c == NULL)
+        return NULL;
+    of->head = c->next;
+    if (of->head == NULL)
+        of->tail = NULL;
+    of->pending--;
+    c->next = NULL;
+    return c;
+}
+
+/** \internal
+ *  \brief run a chunk through the parser
+ *  \note flow is locked */
+static void OffloadParse(AppLayerParserThreadCtx *alp_tctx, Flow *f,
+        AppLayerOffloadChunk *c)
+{
+    /* app layer may have been disabled or changed meanwhile */
+    if (f->alproto == c->alproto && f->alparser != NULL) {
+        (void)AppLayerParserParse(alp_tctx, f, c->alproto, c->flags,
+                c->data, c->len);
+    }
+    SCFree(c);
+}
+
+static void *OffloadThread(void *arg)
+{
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    if (alp_tctx == NULL)
+        return NULL;
+
+    UtilSignalBlock(SIGUSR2);
+
+    while (1) {
+        SCMutexLock(&g_offload.m);
+        while (!g_offload.stop && g_offload.head == NULL)
+            SCCondWait(&g_offload.cond, &g_offload.m);
+        AppLayerOffloadFlow *of = g_offload.head;
+        if (of == NULL) {
+            SCMutexUnlock(&g_offload.m);
+            break;
+        }
+        g_offload.head = of->next;
+        if (g_offload.head == NULL)
+            g_offload.tail = NULL;
+        SCMutexUnlock(&g_offload.m);
+        of->next = NULL;
+
+        Flow *f = of->f;
+        while (1) {
+            FLOWLOCK_WRLOCK(f);
+            SCMutexLock(&of->m);
+            AppLayerOffloadChunk *c = OffloadFlowDequeue(of);
+            if (c == NULL) {
+                of->scheduled = 0;
+                SCMutexUnlock(&of->m);
+                FLOWLOCK_UNLOCK(f);
+                /* of may be gone once the reference is dropped */
+                FlowDecrUsecnt(f);
+                break;
+            }
+            SCMutexUnlock(&of->m);
+
+            OffloadParse(alp_tctx, f, c);
+            FLOWLOCK_UNLOCK(f);
+            (void)SC_ATOMIC_ADD(g_offload.chunks, 1);
+        }
+    }
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    return NULL;
+}
+
+void AppLayerOffloadInitCtx(void)
+{
+    memset(&g_offload, 0, sizeof(g_offload));
+    g_offload.storage_id = -1;
+    g_offload.threads = APP_LAYER_OFFLOAD_THREADS_DEFAULT;
+    g_offload.max_pending = APP_LAYER_OFFLOAD_PENDING_DEFAULT;
+    SC_ATOMIC_INIT(g_offload.chunks);
+
+    ConfNode *conf = ConfGetNode("app-layer.offload");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return;
+
+    const char *val = ConfNodeLookupChildValue(conf, "threads");
+    intmax_t threads;
+    if (val != NULL) {
+        if (ConfGetChildValueInt(conf, "threads", &threads) != 1 ||
+            threads < 1 || threads > APP_LAYER_OFFLOAD_THREADS_MAX)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid app-layer.offload."
+                    "threads \"%s\", must be 1-%d", val,
+                    APP_LAYER_OFFLOAD_THREADS_MAX);
+            return;
+        }
+        g_offload.threads = (int)threads;
+    }
+
+    val = ConfNodeLookupChildValue(conf, "max-pending");
+    intmax_t max_pending;
+    if (val != NULL) {
+        if (ConfGetChildValueInt(conf, "max-pending", &max_pending) != 1 ||
+            max_pending < 1 || max_pending > UINT16_MAX)
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid app-layer.offload."
+                    "max-pending \"%s\"", val);
+            return;
+        }
+        g_offload.max_pending = (uint32_t)max_pending;
+    }
+
+    int cnt = 0;
+    ConfNode *protos = ConfNodeLookupChild(conf, "protocols");
+    if (protos != NULL) {
+        ConfNode *p;
+        TAILQ_FOREACH(p, &protos->head, next) {
+            AppProto alproto = AppLayerGetProtoByName(p->val);
+            if (alproto == ALPROTO_UNKNOWN) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "app-layer.offload: "
+                        "unknown protocol \"%s\"", p->val);
+                continue;
+            }
+            g_offload.protos[alproto] = 1;
+            cnt++;
+        }
+    }
+    if (cnt == 0) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "app-layer.offload "
+                "enabled but no protocols configured, disabling");
+        return;
+    }
+
+    g_offload.storage_id = FlowStorageRegister("app-layer-offload",
+            sizeof(void *), NULL, OffloadFlowFree);
+    if (g_offload.storage_id < 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "app-layer offload storage "
+                "registration failed, offload disabled");
+        return;
+    }
+    g_offload.enabled = 1;
+}
+
+/** \brief start the helper threads. Called once the runmode is set up,
+ *         so after any fork of the process. */
+int AppLayerOffloadStart(void)
+{
+    if (!g_offload.enabled)
+        return 0;
+
+    SCMutexInit(&g_offload.m, NULL);
+    SCCondInit(&g_offload.cond, NULL);
+    g_offload.tids = SCCalloc(g_offload.threads, sizeof(pthread_t));
+    if (g_offload.tids == NULL)
+        return -1;
+
+    int i;
+    for (i = 0; i < g_offload.threads; i++) {
+        if (pthread_create(&g_offload.tids[i], NULL, OffloadThread, NULL) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "creating app-layer offload "
+                    "thread failed: %s", strerror(errno));
+            break;
+        }
+        g_offload.running++;
+    }
+    if (g_offload.running == 0) {
+        SCFree(g_offload.tids);
+        g_offload.tids = NULL;
+        return -1;
+    }
+    SCLogConfig("app-layer offload: %d parser thread(s), max %u pending "
+            "chunks per flow", g_offload.running, g_offload.max_pending);
+    return 0;
+}
+
+/** \brief stop the helpers. They finish the queued flows first. Called
+ *         after the workers are gone and before the flows are freed. */
+void AppLayerOffloadShutdown(void)
+{
+    if (g_offload.running == 0)
+        return;
+
+    SCMutexLock(&g_offload.m);
+    g_offload.stop = 1;
+    pthread_cond_broadcast(&g_offload.cond);
+    SCMutexUnlock(&g_offload.m);
+
+    int i;
+    for (i = 0; i < g_offload.running; i++)
+        pthread_join(g_offload.tids[i], NULL);
+
+    SCLogPerf("app-layer offload: %"PRIu64" chunks parsed by helpers",
+            SC_ATOMIC_GET(g_offload.chunks));
+
+    SCFree(g_offload.tids);
+    g_offload.tids = NULL;
+    g_offload.running = 0;
+    SCMutexDestroy(&g_offload.m);
+    SCCondDestroy(&g_offload.cond);
+}
+
+/**
+ *  \brief parse the chunks queued on a flow inline, in order
+ *
+ *  \param f *locked* flow
+ */
+void AppLayerOffloadDrain(AppLayerParserThreadCtx *alp_tctx, Flow *f)
+{
+    if (!g_offload.enabled)
+        return;
+
+    AppLayerOffloadFlow *of = FlowGetStorageById(f, g_offload.storage_id);
+    if (of == NULL)
+        return;
+
+    while (1) {
+        SCMutexLock(&of->m);
+        AppLayerOffloadChunk *c = OffloadFlowDequeue(of);
+        SCMutexUnlock(&of->m);
+        if (c == NULL)
+            break;
+        OffloadParse(alp_tctx, f, c);
+    }
+}
+
+/**
+ *  \brief hand stream data of a flow to the helpers
+ *
+ *  \param f *locked* flow
+ *
+ *  \retval 1 data queued, don't parse it
+ *  \retval 0 parse inline, anything queued before has been parsed
+ */
+int AppLayerOffloadSubmit(AppLayerParserThreadCtx *alp_tctx, Flow *f,
+        uint8_t flags, uint8_t *data, uint32_t data_len)
+{
+    if (!g_offload.enabled || g_offload.running == 0 ||
+            !g_offload.protos[f->alproto])
+        return 0;
+
+    AppLayerOffloadFlow *of = FlowGetStorageById(f, g_offload.storage_id);
+    if (of == NULL) {
+        of = SCCalloc(1, sizeof(*of));
+        if (of == NULL)
+            return 0;
+        SCMutexInit(&of->m, NULL);
+        of->f = f;
+        FlowSetStorageById(f, g_offload.storage_id, of);
+    }
+
+    /* the parser has to see the end of the stream in order */
+    if ((flags & (STREAM_EOF|STREAM_GAP|STREAM_DEPTH)) || data_len == 0 ||
+            of->pending >= g_offload.max_pending) {
+        AppLayerOffloadDrain(alp_tctx, f);
+        return 0;
+    }
+
+    AppLayerOffloadChunk *c = SCMalloc(sizeof(*c) + data_len);
+    if (unlikely(c == NULL)) {
+        AppLayerOffloadDrain(alp_tctx, f);
+        return 0;
+    }
+    c->alproto = f->alproto;
+    c->flags = flags;
+    c->len = data_len;
+    memcpy(c->data, data, data_len);
+
+    SCMutexLock(&of->m);
+    OffloadFlowEnqueue(of, c);
+    if (!of->scheduled) {
+        of->scheduled = 1;
+        FlowIncrUsecnt(f);
+
+        SCMutexLock(&g_offload.m);
+        of->next = NULL;
+        if (g_offload.tail != NULL)
+            g_offload.tail->next = of;
+        else
+            g_offload.head = of;
+        g_offload.tail = of;
+        SCCondSignal(&g_offload.cond);
+        SCMutexUnlock(&g_offload.m);
+    }
+    SCMutexUnlock(&of->m);
+    return 1;
+}
+
+/****************************** Unittests ******************************/
+
+#ifdef UNITTESTS
+
+/** \test chunks come out of the flow queue in order and the pending
+ *        count follows them */
+static int AppLayerOffloadTest01(void)
+{
+    AppLayerOffloadFlow *of = SCCalloc(1, sizeof(*of));
+    FAIL_IF_NULL(of);
+    SCMutexInit(&of->m, NULL);
+
+    uint32_t i;
+    for (i = 0; i < 3; i++) {
+        AppLayerOffloadChunk *c = SCMalloc(sizeof(*c) + 1);
+        FAIL_IF_NULL(c);
+        c->alproto = ALPROTO_SMTP;
+        c->flags = STREAM_TOSERVER;
+        c->len = 1;
+        c->data[0] = (uint8_t)i;
+        OffloadFlowEnqueue(of, c);
+    }
+    FAIL_IF_NOT(of->pending == 3);
+
+    AppLayerOffloadChunk *c = OffloadFlowDequeue(of);
+    FAIL_IF_NULL(c);
+    FAIL_IF_NOT(c->data[0] == 0);
+    SCFree(c);
+    c = OffloadFlowDequeue(of);
+    FAIL_IF_NULL(c);
+    FAIL_IF_NOT(c->data[0] == 1);
+    SCFree(c);
+    FAIL_IF_NOT(of->pending == 1);
+
+    /* the storage free function takes what's left */
+    OffloadFlowFree(of);
+    PASS;
+}
+
+/** \test without offload configured everything is parsed inline */
+static int AppLayerOffloadTest02(void)
+{
+    Flow f;
+    uint8_t buf[] = "HELO x\r\n";
+
+    memset(&f, 0, sizeof(f));
+    f.alproto = ALPROTO_SMTP;
+    FAIL_IF(g_offload.enabled);
+    FAIL_IF_NOT(AppLayerOffloadSubmit(NULL, &f, STREAM_TOSERVER, buf,
+                sizeof(buf) - 1) == 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void AppLayerOffloadRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerOffloadTest01", AppLayerOffloadTest01);
+    UtRegisterTest("AppLayerOffloadTest02", AppLayerOffloadTest02);
+#endif
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+/**
+ * \file
+ *
+ * Offload of app-layer parsing of selected protocols to helper threads.
+ */
+
+#ifndef __APP_LAYER_OFFLOAD_H__
+#define __APP_LAYER_OFFLOAD_H__
+
+#include "flow.h"
+#include "app-layer-parser.h"
+
+void AppLayerOffloadInitCtx(void);
+int AppLayerOffloadStart(void);
+void AppLayerOffloadShutdown(void);
+
+int AppLayerOffloadSubmit(AppLayerParserThreadCtx *alp_tctx, Flow *f,
+        uint8_t flags, uint8_t *data, uint32_t data_len);
+void AppLayerOffloadDrain(AppLayerParserThreadCtx *alp_tctx, Flow *f);
+
+void AppLayerOffloadRegisterTests(void);
+
+#endif /* __APP_LAYER_OFFLOAD_H__ */
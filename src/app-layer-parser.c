@@ -103,6 +103,7 @@ typedef struct AppLayerParserProtoCtx_
     int (*StateGetProgress)(void *alstate, uint8_t direction);
     uint64_t (*StateGetTxCnt)(void *alstate);
     void *(*StateGetTx)(void *alstate, uint64_t tx_id);
+    AppLayerGetTxIteratorFunc StateGetTxIterator;
     int (*StateGetProgressCompletionStatus)(uint8_t direction);
     int (*StateGetEventInfo)(const char *event_name,
                              int *event_id, AppLayerEventType *event_type);
@@ -140,6 +141,8 @@ struct AppLayerParserState_ {
      * we don't need a var per direction since we don't log a transaction
      * unless we have the entire transaction. */
     uint64_t log_id;
+    /* Disruption flags of both directions at the last tx log pass. */
+    uint8_t log_disruption;
 
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
@@ -157,6 +160,7 @@ AppLayerParserState *AppLayerParserStateAlloc(void)
     if (pstate == NULL)
         goto end;
     memset(pstate, 0, sizeof(*pstate));
+    pstate->flags = APP_LAYER_PARSER_LOG_PENDING;
 
  end:
     SCReturnPtr(pstate, "AppLayerParserState");
@@ -469,6 +473,50 @@ void AppLayerParserRegisterGetTx(uint8_t ipproto, AppProto alproto,
     SCReturn;
 }
 
+void AppLayerParserRegisterGetTxIterator(uint8_t ipproto, AppProto alproto,
+                      AppLayerGetTxIteratorFunc Func)
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].
+        StateGetTxIterator = Func;
+
+    SCReturn;
+}
+
+/**
+ * \brief tx iterator for parsers that don't register one: GetTx per id
+ */
+static AppLayerGetTxIterTuple AppLayerDefaultGetTxIterator(
+        const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state)
+{
+    AppLayerGetTxIterTuple no_tuple = { NULL, 0, 0 };
+    uint64_t tx_id;
+
+    for (tx_id = min_tx_id; tx_id < max_tx_id; tx_id++) {
+        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, tx_id);
+        if (tx != NULL) {
+            AppLayerGetTxIterTuple tuple = {
+                .tx_ptr = tx,
+                .tx_id = tx_id,
+                .has_next = (tx_id + 1 < max_tx_id),
+            };
+            return tuple;
+        }
+    }
+    return no_tuple;
+}
+
+AppLayerGetTxIteratorFunc AppLayerGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto)
+{
+    AppLayerGetTxIteratorFunc Func =
+        alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].StateGetTxIterator;
+    return Func ? Func : AppLayerDefaultGetTxIterator;
+}
+
 void AppLayerParserRegisterGetStateProgressCompletionStatus(AppProto alproto,
     int (*StateGetProgressCompletionStatus)(uint8_t direction))
 {
@@ -584,6 +632,32 @@ void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate)
     SCReturn;
 }
 
+/**
+ *  \brief check if the tx logger has to look at the txs of this state
+ *
+ *  Txs only move towards being logged when the parser runs on them or
+ *  when a stream disruption (depth, gap) forces their progress. If
+ *  neither happened since the last log pass nothing new can be logged.
+ *
+ *  \param disruption FlowGetDisruptionFlags() of both directions
+ */
+int AppLayerParserTxLogPending(AppLayerParserState *pstate, uint8_t disruption)
+{
+    if (pstate == NULL)
+        return 1;
+    return ((pstate->flags & APP_LAYER_PARSER_LOG_PENDING) ||
+            pstate->log_disruption != disruption);
+}
+
+/** \brief mark all txs of the state as looked at by the tx logger */
+void AppLayerParserTxLogUpdate(AppLayerParserState *pstate, uint8_t disruption)
+{
+    if (pstate == NULL)
+        return;
+    pstate->flags &= ~APP_LAYER_PARSER_LOG_PENDING;
+    pstate->log_disruption = disruption;
+}
+
 uint64_t AppLayerParserGetTransactionInspectId(AppLayerParserState *pstate, uint8_t direction)
 {
     SCEnter();
@@ -604,18 +678,23 @@ void AppLayerParserSetTransactionInspectId(AppLayerParserState *pstate,
     uint64_t total_txs = AppLayerParserGetTxCnt(ipproto, alproto, alstate);
     uint64_t idx = AppLayerParserGetTransactionInspectId(pstate, flags);
     int state_done_progress = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
-    void *tx;
-    int state_progress;
-
-    for (; idx < total_txs; idx++) {
-        tx = AppLayerParserGetTx(ipproto, alproto, alstate, idx);
-        if (tx == NULL)
-            continue;
-        state_progress = AppLayerParserGetStateProgress(ipproto, alproto, tx, flags);
-        if (state_progress >= state_done_progress)
-            continue;
-        else
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(ipproto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (idx < total_txs) {
+        AppLayerGetTxIterTuple ires = IterFunc(ipproto, alproto, alstate,
+                idx, total_txs, &state);
+        if (ires.tx_ptr == NULL) {
+            idx = total_txs;
+            break;
+        }
+        idx = ires.tx_id;
+        int state_progress = AppLayerParserGetStateProgress(ipproto, alproto,
+                ires.tx_ptr, flags);
+        if (state_progress < state_done_progress)
             break;
+        idx++;
     }
     pstate->inspect_id[direction] = idx;
 
@@ -712,18 +791,23 @@ uint64_t AppLayerTransactionGetActiveLogOnly(Flow *f, uint8_t flags)
     uint64_t total_txs = AppLayerParserGetTxCnt(f->proto, f->alproto, f->alstate);
     uint64_t idx = AppLayerParserGetTransactionInspectId(f->alparser, flags);
     int state_done_progress = AppLayerParserGetStateProgressCompletionStatus(f->alproto, flags);
-    void *tx;
-    int state_progress;
-
-    for (; idx < total_txs; idx++) {
-        tx = AppLayerParserGetTx(f->proto, f->alproto, f->alstate, idx);
-        if (tx == NULL)
-            continue;
-        state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto, tx, flags);
-        if (state_progress >= state_done_progress)
-            continue;
-        else
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (idx < total_txs) {
+        AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto, f->alstate,
+                idx, total_txs, &state);
+        if (ires.tx_ptr == NULL) {
+            idx = total_txs;
             break;
+        }
+        idx = ires.tx_id;
+        int state_progress = AppLayerParserGetStateProgress(f->proto, f->alproto,
+                ires.tx_ptr, flags);
+        if (state_progress < state_done_progress)
+            break;
+        idx++;
     }
     SCLogDebug("returning %"PRIu64, idx);
     return idx;
@@ -921,6 +1005,8 @@ int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alp
 
         if (f->alstate != NULL)
             AppLayerParserStreamTruncated(f->proto, alproto, f->alstate, flags);
+        if (f->alparser != NULL)
+            AppLayerParserStateSetFlag(f->alparser, APP_LAYER_PARSER_LOG_PENDING);
         goto error;
     }
 
@@ -934,6 +1020,7 @@ int AppLayerParserParse(AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alp
     pstate->version++;
     SCLogDebug("app layer parser state version incremented to %"PRIu8,
                pstate->version);
+    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_LOG_PENDING);
 
     if (flags & STREAM_EOF)
         AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_EOF);
@@ -1023,7 +1110,8 @@ void AppLayerParserSetEOF(AppLayerParserState *pstate)
     if (pstate == NULL)
         goto end;
 
-    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_EOF);
+    AppLayerParserStateSetFlag(pstate,
+            APP_LAYER_PARSER_EOF|APP_LAYER_PARSER_LOG_PENDING);
     /* increase version so we will inspect it one more time
      * with the EOF flags now set */
     pstate->version++;
@@ -1575,6 +1663,46 @@ static int AppLayerParserTest02(void)
     return result;
 }
 
+/**
+ * \test Test that the tx logger is only told to look at updated states.
+ */
+static int AppLayerParserTest03(void)
+{
+    int result = 0;
+    AppLayerParserState *pstate = AppLayerParserStateAlloc();
+    if (pstate == NULL)
+        goto end;
+
+    if (!AppLayerParserTxLogPending(pstate, 0)) {
+        printf("new state should be pending: ");
+        goto end;
+    }
+    AppLayerParserTxLogUpdate(pstate, 0);
+    if (AppLayerParserTxLogPending(pstate, 0)) {
+        printf("state should no longer be pending: ");
+        goto end;
+    }
+    if (!AppLayerParserTxLogPending(pstate, STREAM_DEPTH)) {
+        printf("disruption change should make it pending: ");
+        goto end;
+    }
+    AppLayerParserTxLogUpdate(pstate, STREAM_DEPTH);
+    if (AppLayerParserTxLogPending(pstate, STREAM_DEPTH)) {
+        printf("state should no longer be pending: ");
+        goto end;
+    }
+    AppLayerParserSetEOF(pstate);
+    if (!AppLayerParserTxLogPending(pstate, STREAM_DEPTH)) {
+        printf("eof should make it pending: ");
+        goto end;
+    }
+
+    result = 1;
+ end:
+    if (pstate != NULL)
+        AppLayerParserStateFree(pstate);
+    return result;
+}
 
 void AppLayerParserRegisterUnittests(void)
 {
@@ -1595,6 +1723,7 @@ void AppLayerParserRegisterUnittests(void)
 
     UtRegisterTest("AppLayerParserTest01", AppLayerParserTest01);
     UtRegisterTest("AppLayerParserTest02", AppLayerParserTest02);
+    UtRegisterTest("AppLayerParserTest03", AppLayerParserTest03);
 
     SCReturn;
 }
@@ -33,6 +33,7 @@
 #define APP_LAYER_PARSER_NO_INSPECTION          0x02
 #define APP_LAYER_PARSER_NO_REASSEMBLY          0x04
 #define APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD  0x08
+#define APP_LAYER_PARSER_LOG_PENDING           0x10
 
 
 /***** transaction handling *****/
@@ -98,6 +99,33 @@ int AppLayerParserConfParserEnabled(const char *ipproto,
 
 /***** Parser related registration *****/
 
+/** \brief cursor for a tx iterator, zeroed by the caller before the first
+ *         call and otherwise only used by the iterator itself */
+typedef struct AppLayerGetTxIterState_ {
+    union {
+        void *ptr;
+        uint64_t u64;
+    } un;
+} AppLayerGetTxIterState;
+
+/** \brief tx returned by a tx iterator, tx_ptr is NULL if there is none */
+typedef struct AppLayerGetTxIterTuple_ {
+    void *tx_ptr;
+    uint64_t tx_id;
+    int has_next;   /**< there may be txs after this one */
+} AppLayerGetTxIterTuple;
+
+/**
+ * \brief return the first active tx with an id in [min_tx_id, max_tx_id)
+ *
+ * Called with increasing min_tx_id with the same state to walk the txs
+ * in one pass, or with a copy of it to look ahead.
+ */
+typedef AppLayerGetTxIterTuple (*AppLayerGetTxIteratorFunc)
+       (const uint8_t ipproto, const AppProto alproto,
+        void *alstate, uint64_t min_tx_id, uint64_t max_tx_id,
+        AppLayerGetTxIterState *state);
+
 /**
  * \brief Register app layer parser for the protocol.
  *
@@ -139,6 +167,8 @@ void AppLayerParserRegisterGetTxCnt(uint8_t ipproto, AppProto alproto,
                          uint64_t (*StateGetTxCnt)(void *alstate));
 void AppLayerParserRegisterGetTx(uint8_t ipproto, AppProto alproto,
                       void *(StateGetTx)(void *alstate, uint64_t tx_id));
+void AppLayerParserRegisterGetTxIterator(uint8_t ipproto, AppProto alproto,
+                      AppLayerGetTxIteratorFunc Func);
 void AppLayerParserRegisterGetStateProgressCompletionStatus(AppProto alproto,
     int (*StateGetStateProgressCompletionStatus)(uint8_t direction));
 void AppLayerParserRegisterGetEventInfo(uint8_t ipproto, AppProto alproto,
@@ -158,6 +188,8 @@ void AppLayerParserDestroyProtocolParserLocalStorage(uint8_t ipproto, AppProto a
 
 uint64_t AppLayerParserGetTransactionLogId(AppLayerParserState *pstate);
 void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate);
+int AppLayerParserTxLogPending(AppLayerParserState *pstate, uint8_t disruption);
+void AppLayerParserTxLogUpdate(AppLayerParserState *pstate, uint8_t disruption);
 void AppLayerParserSetTxLogged(uint8_t ipproto, AppProto alproto, void *alstate,
                                void *tx, uint32_t logger);
 int AppLayerParserGetTxLogged(uint8_t ipproto, AppProto alproto, void *alstate,
@@ -177,6 +209,8 @@ int AppLayerParserGetStateProgress(uint8_t ipproto, AppProto alproto,
                         void *alstate, uint8_t direction);
 uint64_t AppLayerParserGetTxCnt(uint8_t ipproto, AppProto alproto, void *alstate);
 void *AppLayerParserGetTx(uint8_t ipproto, AppProto alproto, void *alstate, uint64_t tx_id);
+AppLayerGetTxIteratorFunc AppLayerGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto);
 int AppLayerParserGetStateProgressCompletionStatus(AppProto alproto, uint8_t direction);
 int AppLayerParserGetEventInfo(uint8_t ipproto, AppProto alproto, const char *event_name,
                     int *event_id, AppLayerEventType *event_type);
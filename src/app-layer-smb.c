@@ -28,6 +28,7 @@
 #include "debug.h"
 #include "decode.h"
 #include "threads.h"
+#include "flow-util.h"
 
 #include "util-print.h"
 #include "util-pool.h"
@@ -77,6 +78,7 @@ static uint32_t SMBParseWriteAndX(Flow *f, void *smb_state,
     switch (sstate->andx.andxbytesprocessed) {
         case 0:
             sstate->andx.paddingparsed = 0;
+            sstate->andx.datatype = SMB_ANDX_DATA_UNKNOWN;
             if (input_len >= 28) {
                 sstate->andx.andxcommand = *p;
                 sstate->andx.andxoffset = *(p + 2);
@@ -275,6 +277,7 @@ static uint32_t SMBParseReadAndX(Flow *f, void *smb_state,
     switch (sstate->andx.andxbytesprocessed) {
         case 0:
             sstate->andx.paddingparsed = 0;
+            sstate->andx.datatype = SMB_ANDX_DATA_UNKNOWN;
             if (input_len >= 24) {
                 sstate->andx.andxcommand = *p;
                 sstate->andx.andxoffset = *(p + 2);
@@ -414,6 +417,7 @@ static uint32_t SMBParseTransact(Flow *f, void *smb_state,
     switch (sstate->andx.andxbytesprocessed) {
         case 0:
             sstate->andx.paddingparsed = 0;
+            sstate->andx.datatype = SMB_ANDX_DATA_UNKNOWN;
             if (input_len >= 26) {
                 sstate->andx.datalength = *(p + 22);
                 sstate->andx.datalength |= *(p + 23) << 8;
@@ -656,6 +660,21 @@ static uint32_t PaddingParser(void *smb_state, AppLayerParserState *pstate,
     SCReturnUInt((uint32_t)(p - input));
 }
 
+/**
+ * \brief Check if the start of the data looks like a DCERPC header
+ *
+ * Named pipe data is DCERPC, everything else (file reads and writes)
+ * isn't. DCERPC PDUs start with version 5.0 or 5.1.
+ */
+static int SMBDataIsDCERPC(const uint8_t *input, uint32_t input_len)
+{
+    if (input[0] != 5)
+        return 0;
+    if (input_len > 1 && input[1] != 0 && input[1] != 1)
+        return 0;
+    return 1;
+}
+
 /**
  * \brief Parse WriteAndX and ReadAndX Data
  * \retval -1 f DCERPCParser does not validate
@@ -827,6 +846,27 @@ static uint32_t SMBParseByteCount(Flow *f, void *smb_state,
             }
         }
 
+        if (sstate->andx.datalength && input_len &&
+                sstate->andx.datatype == SMB_ANDX_DATA_UNKNOWN) {
+            /* a dcerpc pdu may continue in a next read or write */
+            if (sstate->dcerpc.bytesprocessed == 0 &&
+                    SMBDataIsDCERPC(input + parsed, input_len) == 0)
+                sstate->andx.datatype = SMB_ANDX_DATA_OTHER;
+            else
+                sstate->andx.datatype = SMB_ANDX_DATA_DCERPC;
+        }
+
+        /* file data: skip it in one go, there is nothing for the dcerpc
+         * parser in it */
+        if (sstate->andx.datatype == SMB_ANDX_DATA_OTHER && input_len) {
+            uint32_t skip = MIN(input_len, sstate->bytecount.bytecountleft);
+            sstate->bytecount.bytecountleft -= skip;
+            sstate->bytesprocessed += skip;
+            SCLogDebug("skipped %u bytes of file data, %u left", skip,
+                    sstate->bytecount.bytecountleft);
+            SCReturnUInt(parsed + skip);
+        }
+
         if (sstate->andx.datalength && input_len) {
 		/* Uncomment the next line to help debug DCERPC over SMB */
 		//hexdump(f, input + parsed, input_len);
@@ -2682,6 +2722,84 @@ end:
     return result;
 }
 
+/** \test file data in a WriteAndX is skipped without losing sync */
+static int SMBParserTest11(void)
+{
+    Flow f;
+    /* WriteAndX of 72 bytes at data offset 0x40, DCERPC bind as data */
+    uint8_t smbbuf[] = {
+    0x00, 0x00, 0x00, 0x88, 0xff, 0x53, 0x4d, 0x42,
+    0x2f, 0x00, 0x00, 0x00, 0x00, 0x18, 0x07, 0xc8,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x7c, 0x05,
+    0x00, 0x08, 0x00, 0x00, 0x0e, 0xff, 0x00, 0x00,
+    0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0x08, 0x00, 0x48, 0x00, 0x00,
+    0x00, 0x48, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x49, 0x00, 0xab, 0x05, 0x00, 0x0b, 0x03,
+    0x10, 0x00, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0xd0, 0x16, 0xd0, 0x16,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x00, 0x78, 0x56, 0x34, 0x12,
+    0x34, 0x12, 0xcd, 0xab, 0xef, 0x00, 0x01, 0x23,
+    0x45, 0x67, 0x89, 0xab, 0x01, 0x00, 0x00, 0x00,
+    0x04, 0x5d, 0x88, 0x8a, 0xeb, 0x1c, 0xc9, 0x11,
+    0x9f, 0xe8, 0x08, 0x00, 0x2b, 0x10, 0x48, 0x60,
+    0x02, 0x00, 0x00, 0x00 };
+    uint8_t filebuf[sizeof(smbbuf)];
+    TcpSession ssn;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+    int r;
+
+    /* same write, file data instead of the bind */
+    memcpy(filebuf, smbbuf, sizeof(smbbuf));
+    memset(filebuf + 68, 'A', sizeof(filebuf) - 68);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.alproto = ALPROTO_SMB;
+
+    StreamTcpInitConfig(TRUE);
+
+    /* file data split over two segments */
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_SMB,
+            STREAM_TOSERVER|STREAM_START, filebuf, 100);
+    SCMutexUnlock(&f.m);
+    FAIL_IF(r != 0);
+
+    SMBState *smb_state = f.alstate;
+    FAIL_IF_NULL(smb_state);
+    FAIL_IF(smb_state->andx.datatype != SMB_ANDX_DATA_OTHER);
+
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_SMB, STREAM_TOSERVER,
+            filebuf + 100, sizeof(filebuf) - 100);
+    SCMutexUnlock(&f.m);
+    FAIL_IF(r != 0);
+    FAIL_IF(smb_state->bytesprocessed != 0);
+    FAIL_IF(smb_state->dcerpc_present != 0);
+
+    /* next pdu is parsed from its start */
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_SMB, STREAM_TOSERVER,
+            smbbuf, sizeof(smbbuf));
+    SCMutexUnlock(&f.m);
+    FAIL_IF(r != 0);
+    FAIL_IF(smb_state->andx.datatype != SMB_ANDX_DATA_DCERPC);
+    FAIL_IF(smb_state->dcerpc_present != 1);
+    FAIL_IF(smb_state->dcerpc.dcerpchdr.type != BIND);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
 #endif
 
 void SMBParserRegisterTests(void)
@@ -2697,6 +2815,7 @@ void SMBParserRegisterTests(void)
     UtRegisterTest("SMBParserTest08", SMBParserTest08);
     UtRegisterTest("SMBParserTest09", SMBParserTest09);
     UtRegisterTest("SMBParserTest10", SMBParserTest10);
+    UtRegisterTest("SMBParserTest11", SMBParserTest11);
 #endif
 }
 
@@ -73,8 +73,13 @@ typedef struct SMBAndX_ {
     uint16_t datalength;
     uint16_t datalengthhigh;
     uint64_t dataoffset;
+    uint8_t datatype;   /**< SMB_ANDX_DATA_*, set on the first data byte */
 } SMBAndX;
 
+#define SMB_ANDX_DATA_UNKNOWN   0
+#define SMB_ANDX_DATA_DCERPC    1
+#define SMB_ANDX_DATA_OTHER     2   /**< file data, skipped */
+
 typedef struct SMBState_ {
     NBSSHdr nbss;
     uint16_t transaction_id;
@@ -229,7 +229,7 @@ SCEnumCharMap smtp_reply_map[ ] = {
 };
 
 /* Create SMTP config structure */
-SMTPConfig smtp_config = { 0, { 0, 0, 0, 0, 0 }, 0, 0, 0, STREAMING_BUFFER_CONFIG_INITIALIZER};
+SMTPConfig smtp_config = { 0, 0, { 0, 0, 0, 0, 0 }, 0, 0, 0, STREAMING_BUFFER_CONFIG_INITIALIZER};
 
 static SMTPString *SMTPStringAlloc(void);
 
@@ -280,6 +280,11 @@ static void SMTPConfigure(void) {
         if (ret) {
             smtp_config.mime_config.body_md5 = val;
         }
+
+        ret = ConfGetChildValueBool(config, "skip-unneeded-attachments", &val);
+        if (ret) {
+            smtp_config.skip_unneeded_attachments = val;
+        }
     }
 
     /* Pass mime config data to MimeDec API */
@@ -399,6 +404,28 @@ static void FlagDetectStateNewFile(SMTPTransaction *tx)
     }
 }
 
+/** \internal
+ *  \brief check if anything needs the content of the attachments in the
+ *         toserver direction of the flow
+ *
+ *  The FLOW_FILE_NO_* flags are set by the detection engine based on the
+ *  rules that apply to the flow.
+ *
+ *  \retval 1 yes, or we can't tell yet
+ *  \retval 0 no
+ */
+static int SMTPAttachmentsNeeded(const Flow *f)
+{
+    const uint32_t unneeded = FLOW_FILE_NO_STORE_TS|FLOW_FILE_NO_MAGIC_TS|
+        FLOW_FILE_NO_MD5_TS|FLOW_FILE_NO_SIZE_TS|FLOW_FILE_NO_DATA_TS;
+
+    if (FileForceTracking() || FileForceFilestore() ||
+            FileForceMagic() || FileForceHash())
+        return 1;
+
+    return ((f->flags & unneeded) != unneeded);
+}
+
 int SMTPProcessDataChunk(const uint8_t *chunk, uint32_t len,
         MimeDecParseState *state)
 {
@@ -1168,6 +1195,9 @@ static int SMTPProcessRequest(SMTPState *state, Flow *f,
                             "allocate data");
                     return MIME_DEC_ERR_MEM;
                 }
+                if (smtp_config.skip_unneeded_attachments) {
+                    tx->mime_state->skip_attachments = !SMTPAttachmentsNeeded(f);
+                }
 
                 /* Add new MIME message to end of list */
                 if (tx->msg_head == NULL) {
@@ -1571,6 +1601,37 @@ static void *SMTPStateGetTx(void *state, uint64_t id)
 
 }
 
+/**
+ *  \brief walk the tx list in one pass, resuming at the tx returned last
+ */
+static AppLayerGetTxIterTuple SMTPGetTxIterator(const uint8_t ipproto,
+        const AppProto alproto, void *alstate, uint64_t min_tx_id,
+        uint64_t max_tx_id, AppLayerGetTxIterState *state)
+{
+    SMTPState *smtp_state = alstate;
+    AppLayerGetTxIterTuple tuple = { NULL, 0, 0 };
+    SMTPTransaction *tx = state->un.ptr;
+
+    if (tx == NULL)
+        tx = TAILQ_FIRST(&smtp_state->tx_list);
+    else if (tx->tx_id < min_tx_id)
+        tx = TAILQ_NEXT(tx, next);
+
+    for ( ; tx != NULL; tx = TAILQ_NEXT(tx, next)) {
+        if (tx->tx_id < min_tx_id)
+            continue;
+        if (tx->tx_id >= max_tx_id)
+            break;
+
+        state->un.ptr = tx;
+        tuple.tx_ptr = tx;
+        tuple.tx_id = tx->tx_id;
+        tuple.has_next = (TAILQ_NEXT(tx, next) != NULL);
+        break;
+    }
+    return tuple;
+}
+
 static void SMTPStateSetTxLogged(void *state, void *vtx, uint32_t logger)
 {
     SMTPTransaction *tx = vtx;
@@ -1683,6 +1744,7 @@ void RegisterSMTPParsers(void)
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetAlstateProgress);
         AppLayerParserRegisterGetTxCnt(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxCnt);
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTx);
+        AppLayerParserRegisterGetTxIterator(IPPROTO_TCP, ALPROTO_SMTP, SMTPGetTxIterator);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_SMTP, SMTPStateGetTxLogged,
                                           SMTPStateSetTxLogged);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_SMTP,
@@ -91,6 +91,8 @@ typedef struct SMTPTransaction_ {
 typedef struct SMTPConfig {
 
     int decode_mime;
+    int skip_unneeded_attachments;  /**< don't decode attachments no rule,
+                                     *   file store or logger needs */
     MimeDecConfig mime_config;
     uint32_t content_limit;
     uint32_t content_inspect_min_size;
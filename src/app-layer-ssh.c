@@ -51,6 +51,7 @@
 
 #include "util-byte.h"
 #include "util-memcmp.h"
+#include "util-bytes-simd.h"
 
 /** \internal
  *  \brief Function to parse the SSH version string of the client
@@ -336,11 +337,9 @@ again:
 
 static int EnoughData(uint8_t *input, uint32_t input_len)
 {
-    uint32_t u;
-    for (u = 0; u < input_len; u++) {
-        if (input[u] == '\r' || input[u] == '\n')
-            return TRUE;
-    }
+    static const uint8_t eol[] = { '\r', '\n' };
+    if (BytesFindAny(input, input_len, eol, sizeof(eol)) != NULL)
+        return TRUE;
     return FALSE;
 }
 
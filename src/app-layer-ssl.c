@@ -77,8 +77,14 @@ SCEnumCharMap tls_decoder_event_table[ ] = {
     { NULL,                          -1 },
 };
 
+enum SslConfigEncryptHandling {
+    SSL_CNF_ENC_HANDLE_DEFAULT = 0, /**< disable raw content, continue tracking */
+    SSL_CNF_ENC_HANDLE_BYPASS = 1,  /**< skip processing of flow, header only tracking */
+};
+
 typedef struct SslConfig_ {
     int no_reassemble;
+    enum SslConfigEncryptHandling encrypt_mode;
 } SslConfig;
 
 SslConfig ssl_config;
@@ -230,13 +236,180 @@ int SSLGetAlstateProgress(void *tx, uint8_t direction)
     return TLS_STATE_IN_PROGRESS;
 }
 
-static int SSLv3ParseHandshakeType(SSLState *ssl_state, uint8_t *input,
-                                   uint32_t input_len)
+enum {
+    SSL_CERT_STATE_LIST_LEN = 0,
+    SSL_CERT_STATE_CERT_LEN,
+    SSL_CERT_STATE_CERT_DATA,
+    SSL_CERT_STATE_DONE,
+};
+
+/** \internal
+ *  \brief drop the chain entries and cert_input pointing into a trec
+ *         buffer that is about to be freed */
+static void SSLCertsForgetBuffer(SSLState *ssl_state, const uint8_t *buf,
+                                 uint32_t buf_len)
+{
+    SSLStateConnp *server = &ssl_state->server_connp;
+    SSLCertsChain *item, *titem;
+
+    TAILQ_FOREACH_SAFE(item, &server->certs, next, titem) {
+        if (item->cert_data >= buf && item->cert_data < buf + buf_len) {
+            TAILQ_REMOVE(&server->certs, item, next);
+            SCFree(item);
+        }
+    }
+    if (server->cert_input >= buf && server->cert_input < buf + buf_len) {
+        server->cert_input = NULL;
+        server->cert_input_len = 0;
+    }
+}
+
+/** \internal
+ *  \brief reset the certificate parser for a new Certificate message
+ *
+ *  The buffer is sized to the message once, the certificates never
+ *  take more than that.
+ */
+static int SSLv3CertificateStart(SSLState *ssl_state)
+{
+    SSLStateConnp *connp = ssl_state->curr_connp;
+
+    connp->cert_state = SSL_CERT_STATE_LIST_LEN;
+    connp->cert_hdr_len = 0;
+    connp->certs_len = 0;
+    connp->cert_len = 0;
+    connp->cert_pos = 0;
+    connp->trec_used = 0;
+    connp->cert_cnt = 0;
+
+    if (connp->trec_len >= connp->message_length)
+        return 0;
+
+    if (connp->trec != NULL) {
+        SSLCertsForgetBuffer(ssl_state, connp->trec, connp->trec_len);
+        SCFree(connp->trec);
+        connp->trec_len = 0;
+    }
+    connp->trec = SCMalloc(connp->message_length);
+    if (unlikely(connp->trec == NULL))
+        return -1;
+    connp->trec_len = connp->message_length;
+    return 0;
+}
+
+/** \internal
+ *  \brief parse a Certificate handshake message as it comes in
+ *
+ *  Only the 3 byte length fields are buffered across fragments. The
+ *  certificates are collected in trec, as the chain keeps pointing to
+ *  them, and decoded as soon as each one is complete.
+ *
+ *  \retval the number of bytes parsed or -1 on error
+ */
+static int SSLv3ParseCertificate(SSLState *ssl_state, TlsCertCache *cache,
+                                 uint8_t *input, uint32_t input_len)
+{
+    SSLStateConnp *connp = ssl_state->curr_connp;
+
+    /* only consume the current record and message */
+    uint32_t record_end = connp->record_length + SSLV3_RECORD_HDR_LEN;
+    if (record_end < connp->bytes_processed ||
+        connp->message_length < connp->trec_pos) {
+        SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_SSL_RECORD);
+        return -1;
+    }
+    uint32_t write_len = MIN(input_len, record_end - connp->bytes_processed);
+    write_len = MIN(write_len, connp->message_length - connp->trec_pos);
+
+    if (connp->trec_pos == 0) {
+        if (SSLv3CertificateStart(ssl_state) != 0) {
+            /* error, skip packet */
+            connp->bytes_processed += input_len;
+            return -1;
+        }
+    }
+
+    uint32_t off = 0;
+    while (off < write_len) {
+        switch (connp->cert_state) {
+            case SSL_CERT_STATE_LIST_LEN:
+            case SSL_CERT_STATE_CERT_LEN:
+                connp->cert_hdr[connp->cert_hdr_len++] = input[off++];
+                if (connp->cert_hdr_len < 3)
+                    break;
+                connp->cert_hdr_len = 0;
+
+                uint32_t len = connp->cert_hdr[0] << 16 |
+                               connp->cert_hdr[1] << 8 | connp->cert_hdr[2];
+                if (connp->cert_state == SSL_CERT_STATE_LIST_LEN) {
+                    if (len + 3 > connp->message_length) {
+                        SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
+                        return -1;
+                    }
+                    connp->certs_len = len;
+                    connp->cert_state = len ? SSL_CERT_STATE_CERT_LEN :
+                                              SSL_CERT_STATE_DONE;
+                } else {
+                    /* current certificate length should be greater than zero */
+                    if (len == 0 || len + 3 > connp->certs_len) {
+                        SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
+                        return -1;
+                    }
+                    connp->cert_len = len;
+                    connp->cert_pos = 0;
+                    connp->cert_state = SSL_CERT_STATE_CERT_DATA;
+                }
+                break;
+
+            case SSL_CERT_STATE_CERT_DATA: {
+                uint32_t n = MIN(write_len - off, connp->cert_len - connp->cert_pos);
+                uint8_t *cert = connp->trec + connp->trec_used;
+                memcpy(cert + connp->cert_pos, input + off, n);
+                connp->cert_pos += n;
+                off += n;
+                if (connp->cert_pos < connp->cert_len)
+                    break;
+
+                if (DecodeTLSHandshakeServerCertificate(ssl_state, cache, cert,
+                            connp->cert_len, connp->cert_cnt) != 0)
+                    return -1;
+
+                connp->trec_used += connp->cert_len;
+                connp->certs_len -= connp->cert_len + 3;
+                connp->cert_cnt++;
+                connp->cert_state = connp->certs_len ? SSL_CERT_STATE_CERT_LEN :
+                                                       SSL_CERT_STATE_DONE;
+                break;
+            }
+
+            case SSL_CERT_STATE_DONE:
+            default:
+                /* skip whatever follows the list */
+                off = write_len;
+                break;
+        }
+    }
+
+    connp->trec_pos += write_len;
+    connp->bytes_processed += write_len;
+
+    if (connp->trec_pos == connp->message_length) {
+        if (connp->cert_state != SSL_CERT_STATE_DONE)
+            SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
+
+        connp->trec_pos = 0;
+        connp->handshake_type = 0;
+        connp->hs_bytes_processed = 0;
+        connp->message_length = 0;
+    }
+    return (int)write_len;
+}
+
+static int SSLv3ParseHandshakeType(SSLState *ssl_state, TlsCertCache *cache,
+                                   uint8_t *input, uint32_t input_len)
 {
-    void *ptmp;
     uint8_t *initial_input = input;
     uint32_t parsed = 0;
-    int rc;
 
     if (input_len == 0) {
         return 0;
@@ -383,88 +556,8 @@ end:
             break;
 
         case SSLV3_HS_CERTIFICATE:
-            if (ssl_state->curr_connp->trec == NULL) {
-                ssl_state->curr_connp->trec_len =
-                        2 * ssl_state->curr_connp->record_length +
-                        SSLV3_RECORD_HDR_LEN + 1;
-                ssl_state->curr_connp->trec =
-                        SCMalloc(ssl_state->curr_connp->trec_len);
-            }
-            if (ssl_state->curr_connp->trec_pos + input_len >=
-                    ssl_state->curr_connp->trec_len) {
-                ssl_state->curr_connp->trec_len =
-                        ssl_state->curr_connp->trec_len + 2 * input_len + 1;
-                ptmp = SCRealloc(ssl_state->curr_connp->trec,
-                        ssl_state->curr_connp->trec_len);
-
-                if (unlikely(ptmp == NULL)) {
-                    SCFree(ssl_state->curr_connp->trec);
-                }
-
-                ssl_state->curr_connp->trec = ptmp;
-            }
-            if (unlikely(ssl_state->curr_connp->trec == NULL)) {
-                ssl_state->curr_connp->trec_len = 0;
-                /* error, skip packet */
-                parsed += input_len;
-                ssl_state->curr_connp->bytes_processed += input_len;
-                return -1;
-            }
-
-            uint32_t write_len = 0;
-            if ((ssl_state->curr_connp->bytes_processed + input_len) >
-                    ssl_state->curr_connp->record_length +
-                    (SSLV3_RECORD_HDR_LEN)) {
-                if ((ssl_state->curr_connp->record_length +
-                        SSLV3_RECORD_HDR_LEN) <
-                        ssl_state->curr_connp->bytes_processed) {
-                    SSLSetEvent(ssl_state,
-                            TLS_DECODER_EVENT_INVALID_SSL_RECORD);
-                    return -1;
-                }
-                write_len = (ssl_state->curr_connp->record_length +
-                        SSLV3_RECORD_HDR_LEN) -
-                        ssl_state->curr_connp->bytes_processed;
-            } else {
-                write_len = input_len;
-            }
-
-            memcpy(ssl_state->curr_connp->trec +
-                    ssl_state->curr_connp->trec_pos, initial_input, write_len);
-            ssl_state->curr_connp->trec_pos += write_len;
+            return SSLv3ParseCertificate(ssl_state, cache, input, input_len);
 
-            rc = DecodeTLSHandshakeServerCertificate(ssl_state,
-                    ssl_state->curr_connp->trec,
-                    ssl_state->curr_connp->trec_pos);
-
-            if (rc > 0) {
-                /* do not return normally if the packet was fragmented:
-                   we would return the size of the _entire_ message,
-                   while we expect only the number of bytes parsed bytes
-                   from the _current_ fragment */
-                if (write_len < (ssl_state->curr_connp->trec_pos - rc)) {
-                    SSLSetEvent(ssl_state,
-                            TLS_DECODER_EVENT_INVALID_SSL_RECORD);
-                    return -1;
-                }
-
-                uint32_t diff = write_len -
-                        (ssl_state->curr_connp->trec_pos - rc);
-                ssl_state->curr_connp->bytes_processed += diff;
-
-                ssl_state->curr_connp->trec_pos = 0;
-                ssl_state->curr_connp->handshake_type = 0;
-                ssl_state->curr_connp->hs_bytes_processed = 0;
-                ssl_state->curr_connp->message_length = 0;
-
-                return diff;
-            } else {
-                ssl_state->curr_connp->bytes_processed += write_len;
-                parsed += write_len;
-                return parsed;
-            }
-
-            break;
         case SSLV3_HS_HELLO_REQUEST:
         case SSLV3_HS_CERTIFICATE_REQUEST:
         case SSLV3_HS_CERTIFICATE_VERIFY:
@@ -522,8 +615,8 @@ end:
     }
 }
 
-static int SSLv3ParseHandshakeProtocol(SSLState *ssl_state, uint8_t *input,
-                                       uint32_t input_len)
+static int SSLv3ParseHandshakeProtocol(SSLState *ssl_state, TlsCertCache *cache,
+                                       uint8_t *input, uint32_t input_len)
 {
     uint8_t *initial_input = input;
     int retval;
@@ -576,7 +669,7 @@ static int SSLv3ParseHandshakeProtocol(SSLState *ssl_state, uint8_t *input,
             /* fall through */
     }
 
-    retval = SSLv3ParseHandshakeType(ssl_state, input, input_len);
+    retval = SSLv3ParseHandshakeType(ssl_state, cache, input, input_len);
     if (retval < 0) {
         return retval;
     }
@@ -1114,8 +1207,8 @@ static int SSLv2Decode(uint8_t direction, SSLState *ssl_state,
 }
 
 static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
-                       AppLayerParserState *pstate, uint8_t *input,
-                       uint32_t input_len)
+                       AppLayerParserState *pstate, TlsCertCache *cache,
+                       uint8_t *input, uint32_t input_len)
 {
     int retval = 0;
     uint32_t parsed = 0;
@@ -1169,13 +1262,17 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
         case SSLV3_APPLICATION_PROTOCOL:
             if ((ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
                     (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
-                /*
-                AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
-                if (ssl_config.no_reassemble == 1)
+                if (ssl_config.encrypt_mode == SSL_CNF_ENC_HANDLE_BYPASS) {
+                    /* stop parsing and reassembly, the session is only
+                     * tracked at the tcp header level from here on */
+                    AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
                     AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
-                */
-                AppLayerParserStateSetFlag(pstate,
-                        APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
+                    SCLogDebug("TLS bypass: no reassembly & inspection has been set");
+                } else {
+                    /* keep parsing the records, e.g. for heartbleed detection */
+                    AppLayerParserStateSetFlag(pstate,
+                            APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD);
+                }
             }
 
             /* if we see (encrypted) aplication data, then this means the
@@ -1194,7 +1291,8 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
                 return -1;
             }
 
-            retval = SSLv3ParseHandshakeProtocol(ssl_state, input + parsed, input_len);
+            retval = SSLv3ParseHandshakeProtocol(ssl_state, cache,
+                    input + parsed, input_len);
             if (retval < 0) {
                 SSLSetEvent(ssl_state,
                         TLS_DECODER_EVENT_INVALID_HANDSHAKE_MESSAGE);
@@ -1289,10 +1387,12 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
  * \todo On reaching an inconsistent state, check if the input has
  *  another new record, instead of just returning after the reset
  *
+ * \param cache per thread parsed certificate cache or NULL
+ *
  * \retval >=0 On success.
  */
 static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserState *pstate,
-                     uint8_t *input, uint32_t ilen)
+                     TlsCertCache *cache, uint8_t *input, uint32_t ilen)
 {
     SSLState *ssl_state = (SSLState *)alstate;
     int retval = 0;
@@ -1353,8 +1453,8 @@ static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserSt
                     /* we will keep it this way till our record parser tells
                        us what exact version this is */
                     ssl_state->curr_connp->version = TLS_VERSION_UNKNOWN;
-                    retval = SSLv3Decode(direction, ssl_state, pstate, input,
-                                         input_len);
+                    retval = SSLv3Decode(direction, ssl_state, pstate, cache,
+                                         input, input_len);
                     if (retval < 0) {
                         SCLogDebug("Error parsing SSLv3.x. Reseting parser "
                                    "state. Let's get outta here");
@@ -1395,8 +1495,8 @@ static int SSLDecode(Flow *f, uint8_t direction, void *alstate, AppLayerParserSt
                 } else {
                     SCLogDebug("Continuing parsing SSLv3.x record from where we "
                                "previously left off");
-                    retval = SSLv3Decode(direction, ssl_state, pstate, input,
-                                         input_len);
+                    retval = SSLv3Decode(direction, ssl_state, pstate, cache,
+                                         input, input_len);
                     if (retval < 0) {
                         SCLogDebug("Error parsing SSLv3.x.  Reseting parser "
                                    "state.  Let's get outta here");
@@ -1438,14 +1538,28 @@ int SSLParseClientRecord(Flow *f, void *alstate, AppLayerParserState *pstate,
                          uint8_t *input, uint32_t input_len,
                          void *local_data)
 {
-    return SSLDecode(f, 0 /* toserver */, alstate, pstate, input, input_len);
+    return SSLDecode(f, 0 /* toserver */, alstate, pstate, local_data,
+                     input, input_len);
 }
 
 int SSLParseServerRecord(Flow *f, void *alstate, AppLayerParserState *pstate,
                          uint8_t *input, uint32_t input_len,
                          void *local_data)
 {
-    return SSLDecode(f, 1 /* toclient */, alstate, pstate, input, input_len);
+    return SSLDecode(f, 1 /* toclient */, alstate, pstate, local_data,
+                     input, input_len);
+}
+
+/** \brief per thread cache of the certificates parsed before, NULL if
+ *         app-layer.protocols.tls.cert-cache-size is 0 */
+static void *SSLLocalStorageAlloc(void)
+{
+    return TlsCertCacheAlloc(TlsCertCacheGetSize());
+}
+
+static void SSLLocalStorageFree(void *ptr)
+{
+    TlsCertCacheFree(ptr);
 }
 
 /**
@@ -1761,6 +1875,9 @@ void RegisterSSLParsers(void)
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_TLS,
                                                                SSLGetAlstateProgressCompletionStatus);
 
+        AppLayerParserRegisterLocalStorageFunc(IPPROTO_TCP, ALPROTO_TLS,
+                SSLLocalStorageAlloc, SSLLocalStorageFree);
+
         /* Get the value of no reassembly option from the config file */
         if (ConfGetNode("app-layer.protocols.tls.no-reassemble") == NULL) {
             if (ConfGetBool("tls.no-reassemble", &ssl_config.no_reassemble) != 1)
@@ -1769,6 +1886,24 @@ void RegisterSSLParsers(void)
             if (ConfGetBool("app-layer.protocols.tls.no-reassemble", &ssl_config.no_reassemble) != 1)
                 ssl_config.no_reassemble = 1;
         }
+
+        /* how to handle the encrypted part of the session */
+        char *enc_handle = NULL;
+        if (ConfGet("app-layer.protocols.tls.encrypt-handling", &enc_handle) == 1 &&
+                enc_handle != NULL) {
+            if (strcasecmp(enc_handle, "bypass") == 0) {
+                ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_BYPASS;
+            } else if (strcasecmp(enc_handle, "default") == 0) {
+                ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_DEFAULT;
+            } else {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "invalid value \"%s\" for "
+                        "app-layer.protocols.tls.encrypt-handling, using \"default\"",
+                        enc_handle);
+                ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_DEFAULT;
+            }
+        }
+        SCLogConfig("tls: encrypted traffic handling: %s",
+                ssl_config.encrypt_mode == SSL_CNF_ENC_HANDLE_BYPASS ? "bypass" : "default");
     } else {
         SCLogInfo("Parsed disabled for %s protocol. Protocol detection"
                   "still on.", proto_name);
@@ -4566,6 +4701,130 @@ end:
     return result;
 }
 
+/**
+ * \test With encrypt-handling bypass the session is no longer parsed or
+ *       reassembled once both sides exchanged encrypted data.
+ */
+static int SSLParserTest26(void)
+{
+    Flow f;
+    uint8_t tlsbuf[] = { 0x16, 0x03, 0x01, 0x00, 0x01, 0x00 };
+    uint32_t tlslen = sizeof(tlsbuf);
+    TcpSession ssn;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.alproto = ALPROTO_TLS;
+
+    StreamTcpInitConfig(TRUE);
+
+    enum SslConfigEncryptHandling mode_backup = ssl_config.encrypt_mode;
+    ssl_config.encrypt_mode = SSL_CNF_ENC_HANDLE_BYPASS;
+
+    /* change cipher spec both ways */
+    tlsbuf[0] = 0x14;
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf, tlslen);
+    FAIL_IF(r != 0);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_TLS, STREAM_TOCLIENT, tlsbuf, tlslen);
+    FAIL_IF(r != 0);
+    FAIL_IF(f.flags & FLOW_NOPAYLOAD_INSPECTION);
+
+    /* application data */
+    tlsbuf[0] = 0x17;
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_TLS, STREAM_TOSERVER, tlsbuf, tlslen);
+    FAIL_IF(r != 0);
+
+    SSLState *ssl_state = f.alstate;
+    FAIL_IF_NULL(ssl_state);
+    FAIL_IF_NOT(ssl_state->flags & SSL_AL_FLAG_HANDSHAKE_DONE);
+
+    FAIL_IF_NOT(AppLayerParserStateIssetFlag(f.alparser, APP_LAYER_PARSER_NO_INSPECTION));
+    FAIL_IF_NOT(f.flags & FLOW_NOPAYLOAD_INSPECTION);
+    FAIL_IF_NOT(ssn.client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
+    FAIL_IF_NOT(ssn.server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
+
+    ssl_config.encrypt_mode = mode_backup;
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
+/** \test the certificate cache hits on equal bytes only and replaces
+ *        the least recently used entry */
+static int SSLParserCertCacheTest01(void)
+{
+    uint8_t c1[] = "certificate one";
+    uint8_t c2[] = "certificate two";
+    uint8_t c3[] = "certificate 3";
+    uint8_t c1b[] = "certificate onf";
+
+    TlsCertCache *cache = TlsCertCacheAlloc(2);
+    FAIL_IF_NULL(cache);
+
+    FAIL_IF_NOT_NULL(TlsCertCacheLookup(cache, c1, sizeof(c1)));
+    FAIL_IF_NULL(TlsCertCacheAdd(cache, c1, sizeof(c1), "CN=one", "CN=ca"));
+    FAIL_IF_NULL(TlsCertCacheAdd(cache, c2, sizeof(c2), "CN=two", NULL));
+
+    TlsCertCacheEntry *e = TlsCertCacheLookup(cache, c1, sizeof(c1));
+    FAIL_IF_NULL(e);
+    FAIL_IF(strcmp(e->subject, "CN=one") != 0);
+    FAIL_IF(strcmp(e->issuerdn, "CN=ca") != 0);
+    FAIL_IF_NOT_NULL(TlsCertCacheLookup(cache, c1b, sizeof(c1b)));
+    FAIL_IF_NOT_NULL(TlsCertCacheLookup(cache, c1, sizeof(c1) - 1));
+
+    /* c2 is the least recently used now */
+    FAIL_IF_NULL(TlsCertCacheAdd(cache, c3, sizeof(c3), "CN=3", NULL));
+    FAIL_IF_NOT_NULL(TlsCertCacheLookup(cache, c2, sizeof(c2)));
+    FAIL_IF_NULL(TlsCertCacheLookup(cache, c1, sizeof(c1)));
+    FAIL_IF_NULL(TlsCertCacheLookup(cache, c3, sizeof(c3)));
+    FAIL_IF(cache->hits != 3);
+
+    TlsCertCacheFree(cache);
+    FAIL_IF_NOT_NULL(TlsCertCacheAlloc(0));
+    PASS;
+}
+
+/** \test Certificate message fed one byte at a time */
+static int SSLParserCertIncrementalTest01(void)
+{
+    /* not DER, only the framing is checked */
+    uint8_t msg[] = {
+        0x0b, 0x00, 0x00, 0x11,             /* certificate, len 17 */
+        0x00, 0x00, 0x0e,                   /* certificates len 14 */
+        0x00, 0x00, 0x04, 'a', 'b', 'c', 'd',
+        0x00, 0x00, 0x04, 'e', 'f', 'g', 'h',
+    };
+    uint32_t i;
+
+    SSLState *ssl_state = SSLStateAlloc();
+    FAIL_IF_NULL(ssl_state);
+    SSLStateConnp *connp = &ssl_state->server_connp;
+    ssl_state->curr_connp = connp;
+    connp->record_length = sizeof(msg);
+    connp->bytes_processed = SSLV3_RECORD_HDR_LEN;
+
+    for (i = 0; i < sizeof(msg); i++) {
+        FAIL_IF(SSLv3ParseHandshakeProtocol(ssl_state, NULL, &msg[i], 1) != 1);
+    }
+
+    FAIL_IF(connp->cert_cnt != 2);
+    FAIL_IF(connp->trec_used != 8);
+    FAIL_IF(connp->trec_len != 17);
+    FAIL_IF(memcmp(connp->trec, "abcdefgh", 8) != 0);
+    FAIL_IF(connp->handshake_type != 0);
+    FAIL_IF(connp->trec_pos != 0);
+    FAIL_IF(connp->bytes_processed != sizeof(msg) + SSLV3_RECORD_HDR_LEN);
+
+    SSLStateFree(ssl_state);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SSLParserRegisterTests(void)
@@ -4598,9 +4857,14 @@ void SSLParserRegisterTests(void)
     UtRegisterTest("SSLParserTest23", SSLParserTest23);
     UtRegisterTest("SSLParserTest24", SSLParserTest24);
     UtRegisterTest("SSLParserTest25", SSLParserTest25);
+    UtRegisterTest("SSLParserTest26", SSLParserTest26);
 
     UtRegisterTest("SSLParserMultimsgTest01", SSLParserMultimsgTest01);
     UtRegisterTest("SSLParserMultimsgTest02", SSLParserMultimsgTest02);
+
+    UtRegisterTest("SSLParserCertCacheTest01", SSLParserCertCacheTest01);
+    UtRegisterTest("SSLParserCertIncrementalTest01",
+                   SSLParserCertIncrementalTest01);
 #endif /* UNITTESTS */
 
     return;
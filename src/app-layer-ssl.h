@@ -158,11 +158,25 @@ typedef struct SSLStateConnp_ {
 
     uint32_t cert_log_flag;
 
-    /* buffer for the tls record.
-     * We use a malloced buffer, if the record is fragmented */
+    /* the certificates of the Certificate message. Sized to the message
+     * when it starts, the chain points into it. */
     uint8_t *trec;
     uint32_t trec_len;
+    /* no of bytes of the current handshake message parsed so far */
     uint32_t trec_pos;
+
+    /* Certificate message parser state, see SSLv3ParseCertificate() */
+    uint8_t cert_state;
+    uint8_t cert_hdr_len;
+    uint8_t cert_hdr[3];
+    /* bytes left in the certificate list */
+    uint32_t certs_len;
+    /* length of the certificate being collected, and bytes collected */
+    uint32_t cert_len;
+    uint32_t cert_pos;
+    /* bytes of trec in use and no of certificates seen */
+    uint32_t trec_used;
+    uint32_t cert_cnt;
 } SSLStateConnp;
 
 /**
@@ -46,6 +46,8 @@
 #include "util-decode-der.h"
 #include "util-decode-der-get.h"
 #include "util-crypt.h"
+#include "util-hash-lookup3.h"
+#include "conf.h"
 
 #define SSLV3_RECORD_LEN 5
 
@@ -80,139 +82,290 @@ static void TLSCertificateErrCodeToWarning(SSLState *ssl_state,
     };
 }
 
-int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input,
-                                        uint32_t input_len)
+/** \brief size of the per thread cache of parsed certificates,
+ *         app-layer.protocols.tls.cert-cache-size, 0 if disabled */
+uint32_t TlsCertCacheGetSize(void)
 {
-    uint32_t certificates_length, cur_cert_length;
-    int i;
-    Asn1Generic *cert;
-    char buffer[256];
-    int rc;
-    int parsed;
-    uint8_t *start_data;
-    uint32_t errcode = 0;
+    intmax_t size = TLS_CERT_CACHE_DEFAULT_SIZE;
+    if (ConfGetInt("app-layer.protocols.tls.cert-cache-size", &size) == 1) {
+        if (size < 0)
+            size = 0;
+        else if (size > TLS_CERT_CACHE_MAX_SIZE)
+            size = TLS_CERT_CACHE_MAX_SIZE;
+    }
+    return (uint32_t)size;
+}
 
-    if (input_len < 3)
-        return 1;
+TlsCertCache *TlsCertCacheAlloc(uint32_t size)
+{
+    if (size == 0)
+        return NULL;
 
-    certificates_length = input[0]<<16 | input[1]<<8 | input[2];
-    /* check if the message is complete */
-    if (input_len < certificates_length + 3)
-        return 0;
+    TlsCertCache *cache = SCCalloc(1, sizeof(*cache));
+    if (unlikely(cache == NULL))
+        return NULL;
+    cache->entries = SCCalloc(size, sizeof(TlsCertCacheEntry));
+    if (unlikely(cache->entries == NULL)) {
+        SCFree(cache);
+        return NULL;
+    }
+    cache->size = size;
+    return cache;
+}
 
-    start_data = input;
-    input += 3;
-    parsed = 3;
+static void TlsCertCacheEntryClear(TlsCertCacheEntry *e)
+{
+    if (e->data != NULL)
+        SCFree(e->data);
+    if (e->subject != NULL)
+        SCFree(e->subject);
+    if (e->issuerdn != NULL)
+        SCFree(e->issuerdn);
+    if (e->fingerprint != NULL)
+        SCFree(e->fingerprint);
+    memset(e, 0x00, sizeof(*e));
+}
 
-    i = 0;
-    while (certificates_length > 0) {
-        if ((uint32_t)(input + 3 - start_data) > (uint32_t)input_len) {
-            SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
-            return -1;
-        }
+void TlsCertCacheFree(TlsCertCache *cache)
+{
+    if (cache == NULL)
+        return;
 
-        cur_cert_length = input[0]<<16 | input[1]<<8 | input[2];
-        input += 3;
-        parsed += 3;
+    uint32_t i;
+    for (i = 0; i < cache->size; i++) {
+        TlsCertCacheEntry *e = &cache->entries[i];
+        if (e->len != 0)
+            TlsCertCacheEntryClear(e);
+    }
+    SCFree(cache->entries);
+    SCFree(cache);
+}
 
-        /* current certificate length should be greater than zero */
-        if (cur_cert_length == 0) {
-            SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
-            return -1;
-        }
+/**
+ *  \brief look up a certificate by its DER bytes
+ *
+ *  The entries are found by a hash of the bytes, which are then compared
+ *  in full.
+ *
+ *  \retval e the entry, now the most recently used, or NULL
+ */
+TlsCertCacheEntry *TlsCertCacheLookup(TlsCertCache *cache,
+        const uint8_t *data, uint32_t len)
+{
+    if (len == 0 || len > TLS_CERT_CACHE_MAX_LEN)
+        return NULL;
 
-        if (input - start_data + cur_cert_length > input_len) {
-            SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
-            return -1;
+    const uint32_t hash = hashlittle_safe(data, len, 0);
+    uint32_t i;
+    for (i = 0; i < cache->size; i++) {
+        TlsCertCacheEntry *e = &cache->entries[i];
+        if (e->hash == hash && e->len == len &&
+            memcmp(e->data, data, len) == 0)
+        {
+            e->last_used = ++cache->tick;
+            cache->hits++;
+            return e;
         }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+/**
+ *  \brief add a certificate, replacing the least recently used one if
+ *         the cache is full
+ *
+ *  \param subject subject DN or NULL
+ *  \param issuerdn issuer DN or NULL
+ *
+ *  \retval e the new entry or NULL
+ */
+TlsCertCacheEntry *TlsCertCacheAdd(TlsCertCache *cache, const uint8_t *data,
+        uint32_t len, const char *subject, const char *issuerdn)
+{
+    if (len == 0 || len > TLS_CERT_CACHE_MAX_LEN)
+        return NULL;
+
+    TlsCertCacheEntry *e = &cache->entries[0];
+    uint32_t i;
+    for (i = 0; i < cache->size && e->len != 0; i++) {
+        TlsCertCacheEntry *c = &cache->entries[i];
+        if (c->len == 0 || c->last_used < e->last_used)
+            e = c;
+    }
+    if (e->len != 0)
+        TlsCertCacheEntryClear(e);
+
+    e->data = SCMalloc(len);
+    if (unlikely(e->data == NULL))
+        return NULL;
+    memcpy(e->data, data, len);
+    if (subject != NULL) {
+        e->subject = SCStrdup(subject);
+        if (unlikely(e->subject == NULL))
+            goto error;
+    }
+    if (issuerdn != NULL) {
+        e->issuerdn = SCStrdup(issuerdn);
+        if (unlikely(e->issuerdn == NULL))
+            goto error;
+    }
+    e->hash = hashlittle_safe(data, len, 0);
+    e->len = len;
+    e->last_used = ++cache->tick;
+    return e;
+
+error:
+    TlsCertCacheEntryClear(e);
+    return NULL;
+}
+
+/** \internal
+ *  \brief sha1 fingerprint of a certificate, as hex pairs split by ':'
+ *
+ *  \retval fp the fingerprint to free, or NULL
+ */
+static char *TLSCertificateFingerprint(const uint8_t *input, uint32_t input_len)
+{
+    int hash_len = 20;
+    int out_len = 60;
+    char out[out_len];
+    char *p = out;
+    int j = 0;
+
+    unsigned char *hash = ComputeSHA1((unsigned char *)input, (int)input_len);
+    if (hash == NULL)
+        return NULL;
+
+    for (j = 0; j < hash_len; j++, p += 3) {
+        snprintf(p, 4, j == hash_len - 1 ? "%02x" : "%02x:", hash[j]);
+    }
+    SCFree(hash);
+    return SCStrdup(out);
+}
+
+/**
+ *  \brief decode a single certificate of a Certificate handshake message
+ *
+ *  The certificates are passed one by one as the message is parsed, so
+ *  the message doesn't have to be reassembled first. The chain and
+ *  cert_input keep pointers to input, so it must stay valid for the
+ *  lifetime of the state.
+ *
+ *  \param cache per thread cache of parsed certificates, or NULL. On a
+ *               hit the DER decoding and fingerprinting are skipped.
+ *  \param input the DER encoded certificate
+ *  \param idx position of the certificate in the chain, 0 for the
+ *             server certificate
+ *
+ *  \retval 0 ok, -1 error
+ */
+int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, TlsCertCache *cache,
+                                        uint8_t *input, uint32_t input_len,
+                                        uint32_t idx)
+{
+    Asn1Generic *cert;
+    char subject_buf[256];
+    char issuer_buf[256];
+    int rc;
+    uint32_t errcode = 0;
+
+    /* current certificate length should be greater than zero */
+    if (input_len == 0) {
+        SSLSetEvent(ssl_state, TLS_DECODER_EVENT_INVALID_CERTIFICATE);
+        return -1;
+    }
 
-        cert = DecodeDer(input, cur_cert_length, &errcode);
+    /* only certificates that decoded without errors are cached, so a
+     * hit sets no events */
+    const char *subject = NULL;
+    const char *issuerdn = NULL;
+    TlsCertCacheEntry *ce = NULL;
+    int decoded = 0;
+
+    if (cache != NULL)
+        ce = TlsCertCacheLookup(cache, input, input_len);
+    if (ce != NULL) {
+        subject = ce->subject;
+        issuerdn = ce->issuerdn;
+        decoded = 1;
+    } else {
+        cert = DecodeDer(input, input_len, &errcode);
         if (cert == NULL) {
             TLSCertificateErrCodeToWarning(ssl_state, errcode);
-        }
-
-        if (cert != NULL) {
-            rc = Asn1DerGetSubjectDN(cert, buffer, sizeof(buffer), &errcode);
+        } else {
+            decoded = 1;
 
+            rc = Asn1DerGetSubjectDN(cert, subject_buf, sizeof(subject_buf), &errcode);
             if (rc != 0) {
                 TLSCertificateErrCodeToWarning(ssl_state, errcode);
             } else {
-                SSLCertsChain *ncert;
-                //SCLogInfo("TLS Cert %d: %s\n", i, buffer);
-
-                if (i == 0) {
-                    if (ssl_state->server_connp.cert0_subject == NULL)
-                        ssl_state->server_connp.cert0_subject = SCStrdup(buffer);
-                    if (ssl_state->server_connp.cert0_subject == NULL) {
-                        DerFree(cert);
-                        return -1;
-                    }
-                }
-
-                ncert = (SSLCertsChain *)SCMalloc(sizeof(SSLCertsChain));
-                if (ncert == NULL) {
-                    DerFree(cert);
-                    return -1;
-                }
-
-                memset(ncert, 0, sizeof(*ncert));
-                ncert->cert_data = input;
-                ncert->cert_len = cur_cert_length;
-                TAILQ_INSERT_TAIL(&ssl_state->server_connp.certs, ncert, next);
+                subject = subject_buf;
             }
 
-            rc = Asn1DerGetIssuerDN(cert, buffer, sizeof(buffer), &errcode);
+            rc = Asn1DerGetIssuerDN(cert, issuer_buf, sizeof(issuer_buf), &errcode);
             if (rc != 0) {
                 TLSCertificateErrCodeToWarning(ssl_state, errcode);
             } else {
-                //SCLogInfo("TLS IssuerDN %d: %s\n", i, buffer);
-                if (i == 0) {
-                    if (ssl_state->server_connp.cert0_issuerdn == NULL)
-                        ssl_state->server_connp.cert0_issuerdn = SCStrdup(buffer);
-                    if (ssl_state->server_connp.cert0_issuerdn == NULL) {
-                        DerFree(cert);
-                        return -1;
-                    }
-                }
+                issuerdn = issuer_buf;
             }
 
             DerFree(cert);
 
-            if (i == 0 && ssl_state->server_connp.cert0_fingerprint == NULL) {
-                int msg_len = cur_cert_length;
-                int hash_len = 20;
-                int out_len = 60;
-                char out[out_len];
-                unsigned char *hash;
-                hash = ComputeSHA1((unsigned char *) input, (int) msg_len);
-                char *p = out;
-                int j = 0;
-
-                if (hash == NULL) {
-                    // TODO maybe an event here?
-                } else {
-                    for (j = 0; j < hash_len; j++, p += 3) {
-                        snprintf(p, 4, j == hash_len - 1 ? "%02x" : "%02x:",
-                                hash[j]);
-                    }
-                    SCFree(hash);
-                    ssl_state->server_connp.cert0_fingerprint = SCStrdup(out);
-                    if (ssl_state->server_connp.cert0_fingerprint == NULL) {
-                        // TODO do we need an event here?
-                    }
-                }
-
-                ssl_state->server_connp.cert_input = input;
-                ssl_state->server_connp.cert_input_len = cur_cert_length;
-            }
+            if (cache != NULL && subject != NULL && issuerdn != NULL)
+                ce = TlsCertCacheAdd(cache, input, input_len,
+                        subject, issuerdn);
+        }
+    }
+
+    if (subject != NULL) {
+        SSLCertsChain *ncert;
+        //SCLogInfo("TLS Cert %d: %s\n", idx, subject);
+
+        if (idx == 0) {
+            if (ssl_state->server_connp.cert0_subject == NULL)
+                ssl_state->server_connp.cert0_subject = SCStrdup(subject);
+            if (ssl_state->server_connp.cert0_subject == NULL)
+                return -1;
+        }
+
+        ncert = (SSLCertsChain *)SCMalloc(sizeof(SSLCertsChain));
+        if (ncert == NULL)
+            return -1;
+
+        memset(ncert, 0, sizeof(*ncert));
+        ncert->cert_data = input;
+        ncert->cert_len = input_len;
+        TAILQ_INSERT_TAIL(&ssl_state->server_connp.certs, ncert, next);
+    }
+
+    if (issuerdn != NULL) {
+        //SCLogInfo("TLS IssuerDN %d: %s\n", idx, issuerdn);
+        if (idx == 0) {
+            if (ssl_state->server_connp.cert0_issuerdn == NULL)
+                ssl_state->server_connp.cert0_issuerdn = SCStrdup(issuerdn);
+            if (ssl_state->server_connp.cert0_issuerdn == NULL)
+                return -1;
+        }
+    }
+
+    if (decoded && idx == 0 && ssl_state->server_connp.cert0_fingerprint == NULL) {
+        if (ce != NULL && ce->fingerprint == NULL)
+            ce->fingerprint = TLSCertificateFingerprint(input, input_len);
+
+        if (ce != NULL && ce->fingerprint != NULL) {
+            ssl_state->server_connp.cert0_fingerprint = SCStrdup(ce->fingerprint);
+        } else {
+            ssl_state->server_connp.cert0_fingerprint =
+                TLSCertificateFingerprint(input, input_len);
+        }
+        if (ssl_state->server_connp.cert0_fingerprint == NULL) {
+            // TODO do we need an event here?
         }
 
-        i++;
-        certificates_length -= (cur_cert_length + 3);
-        parsed += cur_cert_length;
-        input += cur_cert_length;
+        ssl_state->server_connp.cert_input = input;
+        ssl_state->server_connp.cert_input_len = input_len;
     }
 
-    return parsed;
+    return 0;
 }
-
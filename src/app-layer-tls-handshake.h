@@ -35,6 +35,42 @@
 #ifndef __APP_LAYER_TLS_HANDSHAKE_H__
 #define __APP_LAYER_TLS_HANDSHAKE_H__
 
-int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, uint8_t *input, uint32_t input_len);
+/** default and max entries of the parsed certificate cache */
+#define TLS_CERT_CACHE_DEFAULT_SIZE 64
+#define TLS_CERT_CACHE_MAX_SIZE     4096
+/** larger certificates are not cached */
+#define TLS_CERT_CACHE_MAX_LEN      16384
+
+/** \brief a certificate seen before, with the fields parsed from it */
+typedef struct TlsCertCacheEntry_ {
+    uint32_t hash;          /**< hash of the DER bytes */
+    uint32_t len;           /**< 0 for a free entry */
+    uint8_t *data;          /**< the DER bytes */
+    char *subject;
+    char *issuerdn;
+    char *fingerprint;      /**< set once needed for a first certificate */
+    uint64_t last_used;
+} TlsCertCacheEntry;
+
+/** \brief LRU cache of certificates, not locked, one per thread */
+typedef struct TlsCertCache_ {
+    TlsCertCacheEntry *entries;
+    uint32_t size;
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+} TlsCertCache;
+
+uint32_t TlsCertCacheGetSize(void);
+TlsCertCache *TlsCertCacheAlloc(uint32_t size);
+void TlsCertCacheFree(TlsCertCache *cache);
+TlsCertCacheEntry *TlsCertCacheLookup(TlsCertCache *cache,
+        const uint8_t *data, uint32_t len);
+TlsCertCacheEntry *TlsCertCacheAdd(TlsCertCache *cache, const uint8_t *data,
+        uint32_t len, const char *subject, const char *issuerdn);
+
+int DecodeTLSHandshakeServerCertificate(SSLState *ssl_state, TlsCertCache *cache,
+                                        uint8_t *input, uint32_t input_len,
+                                        uint32_t idx);
 
 #endif /* __APP_LAYER_TLS_HANDSHAKE_H__ */
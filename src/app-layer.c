@@ -30,6 +30,8 @@
 #include "app-layer-parser.h"
 #include "app-layer-protos.h"
 #include "app-layer-detect-proto.h"
+#include "app-layer-expectation.h"
+#include "app-layer-offload.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-inline.h"
@@ -139,12 +141,17 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         }
 #endif
 
-        PACKET_PROFILING_APP_PD_START(app_tctx);
-        *alproto = AppLayerProtoDetectGetProto(app_tctx->alpd_tctx,
-                                f,
-                                data, data_len,
-                                IPPROTO_TCP, flags);
-        PACKET_PROFILING_APP_PD_END(app_tctx);
+        /* an expected flow got its protocol when it was created */
+        if (f->alproto != ALPROTO_UNKNOWN && *alproto_otherdir == ALPROTO_UNKNOWN) {
+            *alproto = f->alproto;
+        } else {
+            PACKET_PROFILING_APP_PD_START(app_tctx);
+            *alproto = AppLayerProtoDetectGetProto(app_tctx->alpd_tctx,
+                                    f,
+                                    data, data_len,
+                                    IPPROTO_TCP, flags);
+            PACKET_PROFILING_APP_PD_END(app_tctx);
+        }
 
         if (*alproto != ALPROTO_UNKNOWN) {
             if (*alproto_otherdir != ALPROTO_UNKNOWN && *alproto_otherdir != *alproto) {
@@ -440,6 +447,9 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         /* if we don't have a data object here we are not getting it
          * a start msg should have gotten us one */
         if (f->alproto != ALPROTO_UNKNOWN) {
+            if (AppLayerOffloadSubmit(app_tctx->alp_tctx, f, flags,
+                        data, data_len) == 1)
+                goto end;
             PACKET_PROFILING_APP_START(app_tctx, f->alproto);
             r = AppLayerParserParse(app_tctx->alp_tctx, f, f->alproto, flags, data, data_len);
             PACKET_PROFILING_APP_END(app_tctx, f->alproto);
@@ -455,6 +465,17 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCReturnInt(r);
 }
 
+/**
+ *  \brief Parse what's queued on the flow for the offload helpers, so
+ *         that detection of the last packets of a flow sees it.
+ *
+ *  \param f *locked* flow
+ */
+void AppLayerHandleOffloaded(AppLayerThreadCtx *app_tctx, Flow *f)
+{
+    AppLayerOffloadDrain(app_tctx->alp_tctx, f);
+}
+
 /**
  *  \brief Handle a app layer UDP message
  *
@@ -572,6 +593,7 @@ int AppLayerSetup(void)
 
     AppLayerProtoDetectSetup();
     AppLayerParserSetup();
+    AppLayerExpectationSetup();
 
     AppLayerParserRegisterProtocolParsers();
     AppLayerProtoDetectPrepareState();
@@ -585,6 +607,7 @@ int AppLayerDeSetup(void)
 
     AppLayerProtoDetectDeSetup();
     AppLayerParserDeSetup();
+    AppLayerExpectationClean();
 
     SCReturnInt(0);
 }
@@ -53,6 +53,12 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
 int AppLayerHandleUdp(ThreadVars *tv, AppLayerThreadCtx *app_tctx,
                       Packet *p, Flow *f);
 
+/**
+ * \brief Parses the stream data still queued for the app-layer
+ *        offload helpers.
+ */
+void AppLayerHandleOffloaded(AppLayerThreadCtx *app_tctx, Flow *f);
+
 /***** Utility *****/
 
 /**
@@ -41,6 +41,7 @@
 #include "output.h"
 #include "output-stats.h"
 #include "output-json-stats.h"
+#include "output-metrics.h"
 
 /* Time interval for syncing the local counters with the global ones */
 #define STATS_WUT_TTS 3
@@ -110,6 +111,11 @@ static int stats_loggers_active = 1;
 
 static uint16_t counters_global_id = 0;
 
+/** max number of times the stats thread rereads the counters of a thread
+ *  that is syncing, after that the values of the counters may be a mix of
+ *  the two syncs, but each value is consistent */
+#define STATS_READ_RETRIES 16
+
 static void StatsPublicThreadContextInit(StatsPublicThreadContext *t)
 {
     SCMutexInit(&t->m, NULL);
@@ -242,12 +248,13 @@ static void StatsInitCtx(void)
     if (!OutputStatsLoggersRegistered()) {
         stats_loggers_active = 0;
 
-        /* if the unix command socket is enabled we do the background
-         * stats sync just in case someone runs 'dump-counters' */
+        /* if the unix command socket or the metrics endpoint are enabled
+         * we keep the counters synced, the stats table is then only
+         * built when requested. */
         int unix_socket = 0;
         if (ConfGetBool("unix-command.enabled", &unix_socket) != 1)
             unix_socket = 0;
-        if (unix_socket == 0) {
+        if (unix_socket == 0 && !MetricsEnabled()) {
             SCLogWarning(SC_WARN_NO_STATS_LOGGERS, "stats are enabled but no loggers are active");
             stats_enabled = FALSE;
             SCReturn;
@@ -381,9 +388,12 @@ static void *StatsMgmtThread(void *arg)
         SCCtrlCondTimedwait(tv_local->ctrl_cond, tv_local->ctrl_mutex, &cond_time);
         SCCtrlMutexUnlock(tv_local->ctrl_mutex);
 
-        SCMutexLock(&stats_table_mutex);
-        StatsOutput(tv_local);
-        SCMutexUnlock(&stats_table_mutex);
+        /* without loggers the table is built on request */
+        if (stats_loggers_active) {
+            SCMutexLock(&stats_table_mutex);
+            StatsOutput(tv_local);
+            SCMutexUnlock(&stats_table_mutex);
+        }
 
         if (TmThreadsCheckFlag(tv_local, THV_KILL)) {
             run = 0;
@@ -598,6 +608,28 @@ static void StatsCopyCounterValue(StatsLocalCounter *pcae)
     return;
 }
 
+/** \internal
+ *  \brief start reading the counter values of a thread
+ *
+ *  \retval seq sequence to pass to StatsReadRetry()
+ */
+static inline uint32_t StatsReadBegin(const StatsPublicThreadContext *pctx)
+{
+    uint32_t seq = *(volatile const uint32_t *)&pctx->seq;
+    __sync_synchronize();
+    return seq;
+}
+
+/** \internal
+ *  \retval 1 the thread synced while we read, read again
+ *  \retval 0 the values read are of a single sync
+ */
+static inline int StatsReadRetry(const StatsPublicThreadContext *pctx, uint32_t seq)
+{
+    __sync_synchronize();
+    return (seq & 1) || seq != *(volatile const uint32_t *)&pctx->seq;
+}
+
 /**
  * \brief The output interface for the Stats API
  */
@@ -668,28 +700,35 @@ static int StatsOutput(ThreadVars *tv)
         memset(&thread_table, 0x00,
                 max_id * sizeof(struct CountersMergeTable));
 
+        /* the lock only keeps the thread from freeing the counters,
+         * the values are protected by the seqlock */
         SCMutexLock(&sts->ctx->m);
-        pc = sts->ctx->head;
-        while (pc != NULL) {
-            SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
-                    pc->name, pc->id, pc->gid, pc->value);
+        uint32_t seq;
+        int tries = 0;
+        do {
+            seq = StatsReadBegin(sts->ctx);
+            pc = sts->ctx->head;
+            while (pc != NULL) {
+                SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
+                        pc->name, pc->id, pc->gid, pc->value);
+
+                thread_table[pc->gid].type = pc->type;
+                switch (pc->type) {
+                    case STATS_TYPE_FUNC:
+                        if (pc->Func != NULL)
+                            thread_table[pc->gid].value = pc->Func();
+                        break;
+                    case STATS_TYPE_AVERAGE:
+                    default:
+                        thread_table[pc->gid].value = pc->value;
+                        break;
+                }
+                thread_table[pc->gid].updates = pc->updates;
+                table[pc->gid].name = pc->name;
 
-            thread_table[pc->gid].type = pc->type;
-            switch (pc->type) {
-                case STATS_TYPE_FUNC:
-                    if (pc->Func != NULL)
-                        thread_table[pc->gid].value = pc->Func();
-                    break;
-                case STATS_TYPE_AVERAGE:
-                default:
-                    thread_table[pc->gid].value = pc->value;
-                    break;
+                pc = pc->next;
             }
-            thread_table[pc->gid].updates = pc->updates;
-            table[pc->gid].name = pc->name;
-
-            pc = pc->next;
-        }
+        } while (StatsReadRetry(sts->ctx, seq) && ++tries < STATS_READ_RETRIES);
         SCMutexUnlock(&sts->ctx->m);
 
         /* update merge table */
@@ -733,6 +772,7 @@ static int StatsOutput(ThreadVars *tv)
             r->value = 0;
             r->name = table[c].name;
             r->tm_name = sts->name;
+            r->gauge = (e->type != STATS_TYPE_NORMAL);
 
             switch (e->type) {
                 case STATS_TYPE_AVERAGE:
@@ -757,6 +797,7 @@ static int StatsOutput(ThreadVars *tv)
         table[x].pvalue = table[x].value;
         table[x].value = 0;
         table[x].tm_name = "Total";
+        table[x].gauge = (merge_table[x].type != STATS_TYPE_NORMAL);
 
         struct CountersMergeTable *m = &merge_table[x];
         switch (m->type) {
@@ -775,6 +816,8 @@ static int StatsOutput(ThreadVars *tv)
         }
     }
 
+    gettimeofday(&stats_table.ts, NULL);
+
     /* invoke logger(s) */
     if (stats_loggers_active) {
         OutputStatsLog(tv, td, &stats_table);
@@ -792,6 +835,9 @@ TmEcode StatsOutputCounterSocket(json_t *cmd,
     TmEcode r = TM_ECODE_OK;
 
     SCMutexLock(&stats_table_mutex);
+    if (stats_ctx != NULL && !stats_loggers_active) {
+        StatsOutput(NULL);
+    }
     if (stats_table.start_time == 0) {
         r = TM_ECODE_FAILED;
         message = json_string("stats not yet synchronized");
@@ -805,6 +851,28 @@ TmEcode StatsOutputCounterSocket(json_t *cmd,
 }
 #endif /* BUILD_UNIX_SOCKET */
 
+/** \brief run Callback on the stats table
+ *
+ *  The table is locked while Callback runs. If no stats loggers are
+ *  active the table is only updated here, on request.
+ *
+ *  \retval r return value of Callback or -1 if the table isn't set up yet
+ */
+int StatsTableRun(int (*Callback)(const StatsTable *, void *), void *data)
+{
+    int r = -1;
+
+    SCMutexLock(&stats_table_mutex);
+    if (stats_ctx != NULL && !stats_loggers_active) {
+        StatsOutput(NULL);
+    }
+    if (stats_table.start_time != 0) {
+        r = Callback(&stats_table, data);
+    }
+    SCMutexUnlock(&stats_table_mutex);
+    return r;
+}
+
 /**
  * \brief Initializes the perf counter api.  Things are hard coded currently.
  *        More work to be done when we implement multiple interfaces
@@ -873,6 +941,8 @@ void StatsSpawnThreads(void)
         exit(EXIT_FAILURE);
     }
 
+    MetricsSpawnThread();
+
     SCReturn;
 }
 
@@ -1108,10 +1178,14 @@ static int StatsGetCounterArrayRange(uint16_t s_id, uint16_t e_id,
         return -1;
     }
 
-    if ( (pca->head = SCMalloc(sizeof(StatsLocalCounter) * (e_id - s_id  + 2))) == NULL) {
+    /* the array is written for each counter update, so don't let it share
+     * a cache line with data of other threads */
+    size_t size = sizeof(StatsLocalCounter) * (e_id - s_id  + 2);
+    size = ((size + CLS - 1) / CLS) * CLS;
+    if ( (pca->head = SCMallocAligned(size, CLS)) == NULL) {
         return -1;
     }
-    memset(pca->head, 0, sizeof(StatsLocalCounter) * (e_id - s_id  + 2));
+    memset(pca->head, 0, size);
 
     pc = pctx->head;
     while (pc->id != s_id)
@@ -1177,11 +1251,15 @@ int StatsUpdateCounterArray(StatsPrivateThreadContext *pca, StatsPublicThreadCon
 
     pcae = pca->head;
 
-    SCMutexLock(&pctx->m);
+    /* only this thread writes the values, so instead of locking out the
+     * stats thread make it retry if it read during the copy */
+    pctx->seq++;
+    __sync_synchronize();
     for (i = 1; i <= pca->size; i++) {
         StatsCopyCounterValue(&pcae[i]);
     }
-    SCMutexUnlock(&pctx->m);
+    __sync_synchronize();
+    pctx->seq++;
 
     pctx->perf_flag = 0;
 
@@ -1245,7 +1323,7 @@ void StatsReleasePrivateThreadContext(StatsPrivateThreadContext *pca)
 {
     if (pca != NULL) {
         if (pca->head != NULL) {
-            SCFree(pca->head);
+            SCFreeAligned(pca->head);
             pca->head = NULL;
             pca->size = 0;
         }
@@ -1519,6 +1597,36 @@ static int StatsTestCounterValues11()
     return result;
 }
 
+static int StatsTestSeqLock12(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    FAIL_IF(((uintptr_t)tv.perf_private_ctx.head % CLS) != 0);
+
+    uint32_t seq = StatsReadBegin(&tv.perf_public_ctx);
+    FAIL_IF(StatsReadRetry(&tv.perf_public_ctx, seq));
+
+    StatsAddUI64(&tv, id, 10);
+    tv.perf_public_ctx.perf_flag = 1;
+    FAIL_IF_NOT(StatsSyncSignalled(&tv));
+    StatsSyncCountersIfSignalled(&tv);
+    FAIL_IF(StatsSyncSignalled(&tv));
+
+    /* a sync happened since the read started */
+    FAIL_IF_NOT(StatsReadRetry(&tv.perf_public_ctx, seq));
+    seq = StatsReadBegin(&tv.perf_public_ctx);
+    FAIL_IF(seq & 1);
+    FAIL_IF(tv.perf_public_ctx.head->value != 10);
+    FAIL_IF(StatsReadRetry(&tv.perf_public_ctx, seq));
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+    PASS;
+}
+
 #endif
 
 void StatsRegisterTests()
@@ -1535,5 +1643,6 @@ void StatsRegisterTests()
     UtRegisterTest("StatsTestUpdateGlobalCounter10",
                    StatsTestUpdateGlobalCounter10);
     UtRegisterTest("StatsTestCounterValues11", StatsTestCounterValues11);
+    UtRegisterTest("StatsTestSeqLock12", StatsTestSeqLock12);
 #endif
 }
@@ -62,13 +62,18 @@ typedef struct StatsPublicThreadContext_ {
     /* flag set by the wakeup thread, to inform the client threads to sync */
     uint32_t perf_flag;
 
+    /* seqlock for the counter values: odd while the owning thread copies
+     * its private counters in, readers retry if it changed while reading */
+    uint32_t seq;
+
     /* pointer to the head of a list of counters assigned under this context */
     StatsCounter *head;
 
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
 
-    /* mutex to prevent simultaneous access during update_counter/output_stat */
+    /* mutex to prevent the counter list from being freed while the stats
+     * thread reads it. Not taken by the owning thread on sync. */
     SCMutex m;
 } StatsPublicThreadContext;
 
@@ -126,15 +131,21 @@ void StatsIncr(struct ThreadVars_ *, uint16_t);
 /* utility functions */
 int StatsUpdateCounterArray(StatsPrivateThreadContext *, StatsPublicThreadContext *);
 uint64_t StatsGetLocalCounterValue(struct ThreadVars_ *, uint16_t);
+struct StatsTable_;
+int StatsTableRun(int (*Callback)(const struct StatsTable_ *, void *), void *data);
 int StatsSetupPrivate(struct ThreadVars_ *);
 void StatsThreadCleanup(struct ThreadVars_ *);
 
 #define StatsSyncCounters(tv) \
     StatsUpdateCounterArray(&(tv)->perf_private_ctx, &(tv)->perf_public_ctx);  \
 
+/** single relaxed load of the sync flag, the check is done per packet */
+#define StatsSyncSignalled(tv) \
+    (*(volatile uint32_t *)&(tv)->perf_public_ctx.perf_flag == 1)
+
 #define StatsSyncCountersIfSignalled(tv)                                       \
     do {                                                                        \
-        if ((tv)->perf_public_ctx.perf_flag == 1) {                             \
+        if (unlikely(StatsSyncSignalled((tv)))) {                               \
             StatsUpdateCounterArray(&(tv)->perf_private_ctx,                   \
                                      &(tv)->perf_public_ctx);                   \
         }                                                                       \
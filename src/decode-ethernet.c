@@ -35,9 +35,116 @@
 #include "decode-ethernet.h"
 #include "decode-events.h"
 
+#include "flow.h"
+
 #include "util-unittest.h"
 #include "util-debug.h"
 
+/** \internal
+ *  \brief straight line decoding of the common Eth/[VLAN]/IPv4|IPv6/TCP|UDP
+ *         packets
+ *
+ *  Called once the ethernet header length has been checked. All checks
+ *  are done on the raw data before anything is set in the packet, so if
+ *  the packet is not one of the handled shapes the generic decoders start
+ *  from a clean state. IPv4 options, fragments and IPv6 extension headers
+ *  are left to the generic decoders. TCP with options and all of UDP
+ *  (tunnels) are handed to DecodeTCP/DecodeUDP once the lower layers are
+ *  done.
+ *
+ *  \retval 1 packet decoded
+ *  \retval 0 not handled, use the generic decoders
+ */
+static int DecodeEthernetFast(ThreadVars *tv, DecodeThreadVars *dtv,
+        Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    uint16_t l3_off = ETHERNET_HEADER_LEN;
+    uint16_t type = ntohs(p->ethh->eth_type);
+    VLANHdr *vlanh = NULL;
+
+    if (type == ETHERNET_TYPE_VLAN && p->vlan_idx == 0) {
+        vlanh = (VLANHdr *)(pkt + ETHERNET_HEADER_LEN);
+        l3_off += VLAN_HEADER_LEN;
+        if (unlikely(len < l3_off))
+            return 0;
+        type = GET_VLAN_PROTO(vlanh);
+    }
+
+    uint8_t *l3 = pkt + l3_off;
+    uint8_t *l4;
+    uint16_t l4_len;
+    uint8_t proto;
+
+    if (type == ETHERNET_TYPE_IP) {
+        /* one check covers the ip header and the smallest l4 header */
+        if (unlikely(len < l3_off + IPV4_HEADER_LEN + UDP_HEADER_LEN))
+            return 0;
+        IPV4Hdr *ip4h = (IPV4Hdr *)l3;
+        uint16_t iplen = ntohs(IPV4_GET_RAW_IPLEN(ip4h));
+        proto = IPV4_GET_RAW_IPPROTO(ip4h);
+        /* version 4, no options, not a fragment, not truncated */
+        if (ip4h->ip_verhl != 0x45 ||
+            (ntohs(IPV4_GET_RAW_IPOFFSET(ip4h)) & 0x3fff) != 0 ||
+            iplen < IPV4_HEADER_LEN || iplen > len - l3_off ||
+            (proto != IPPROTO_TCP && proto != IPPROTO_UDP))
+            return 0;
+        l4 = l3 + IPV4_HEADER_LEN;
+        l4_len = iplen - IPV4_HEADER_LEN;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        if (unlikely(len < l3_off + IPV6_HEADER_LEN + UDP_HEADER_LEN))
+            return 0;
+        IPV6Hdr *ip6h = (IPV6Hdr *)l3;
+        proto = IPV6_GET_RAW_NH(ip6h);
+        l4_len = IPV6_GET_RAW_PLEN(ip6h);
+        if (IP_GET_RAW_VER(l3) != 6 ||
+            l4_len > len - l3_off - IPV6_HEADER_LEN ||
+            (proto != IPPROTO_TCP && proto != IPPROTO_UDP))
+            return 0;
+        l4 = l3 + IPV6_HEADER_LEN;
+    } else {
+        return 0;
+    }
+
+    /* from here on the packet is ours */
+    if (vlanh != NULL) {
+        StatsIncr(tv, dtv->counter_vlan);
+        p->vlanh[0] = vlanh;
+        if (dtv->vlan_disabled == 0)
+            p->vlan_id[0] = GET_VLAN_ID(vlanh);
+        p->vlan_idx = 1;
+    }
+    if (type == ETHERNET_TYPE_IP) {
+        StatsIncr(tv, dtv->counter_ipv4);
+        p->ip4h = (IPV4Hdr *)l3;
+        SET_IPV4_SRC_ADDR(p, &p->src);
+        SET_IPV4_DST_ADDR(p, &p->dst);
+        p->proto = proto;
+    } else {
+        StatsIncr(tv, dtv->counter_ipv6);
+        p->ip6h = (IPV6Hdr *)l3;
+        SET_IPV6_SRC_ADDR(p, &p->src);
+        SET_IPV6_DST_ADDR(p, &p->dst);
+        IPV6_SET_L4PROTO(p, proto);
+    }
+
+    if (proto == IPPROTO_TCP && l4_len >= TCP_HEADER_LEN &&
+        TCP_GET_RAW_OFFSET((TCPHdr *)l4) == (TCP_HEADER_LEN >> 2)) {
+        StatsIncr(tv, dtv->counter_tcp);
+        p->tcph = (TCPHdr *)l4;
+        SET_TCP_SRC_PORT(p, &p->sp);
+        SET_TCP_DST_PORT(p, &p->dp);
+        p->proto = IPPROTO_TCP;
+        p->payload = l4 + TCP_HEADER_LEN;
+        p->payload_len = l4_len - TCP_HEADER_LEN;
+        FlowSetupPacket(p);
+    } else if (proto == IPPROTO_TCP) {
+        DecodeTCP(tv, dtv, p, l4, l4_len, pq);
+    } else {
+        DecodeUDP(tv, dtv, p, l4, l4_len, pq);
+    }
+    return 1;
+}
+
 int DecodeEthernet(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
                    uint8_t *pkt, uint16_t len, PacketQueue *pq)
 {
@@ -52,6 +159,9 @@ int DecodeEthernet(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     if (unlikely(p->ethh == NULL))
         return TM_ECODE_FAILED;
 
+    if (likely(DecodeEthernetFast(tv, dtv, p, pkt, len, pq) == 1))
+        return TM_ECODE_OK;
+
     SCLogDebug("p %p pkt %p ether type %04x", p, pkt, ntohs(p->ethh->eth_type));
 
     switch (ntohs(p->ethh->eth_type)) {
@@ -134,6 +244,55 @@ static int DecodeEthernetTest01 (void)
     SCFree(p);
     return 1;
 }
+
+/** \test the fast path sets up the packet like the generic decoders */
+static int DecodeEthernetTest02 (void)
+{
+    /* VLAN 10, IPv4 TCP without options, 4 bytes of payload */
+    uint8_t raw_eth[] = {
+        0x00, 0x10, 0x94, 0x55, 0x00, 0x01, 0x00, 0x10,
+        0x94, 0x56, 0x00, 0x01, 0x81, 0x00, 0x00, 0x0a,
+        0x08, 0x00, 0x45, 0x00, 0x00, 0x2c, 0x00, 0x01,
+        0x40, 0x00, 0x40, 0x06, 0x00, 0x00, 0x0a, 0x00,
+        0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, 0x04, 0xd2,
+        0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+        0x00, 0x00, 0x50, 0x18, 0x10, 0x00, 0x00, 0x00,
+        0x00, 0x00, 'a', 'b', 'c', 'd' };
+
+    Packet *p1 = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF_NULL(p2);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&tv,  0, sizeof(ThreadVars));
+    memset(p1, 0, SIZE_OF_PACKET);
+    memset(p2, 0, SIZE_OF_PACKET);
+
+    FAIL_IF(DecodeEthernet(&tv, &dtv, p1, raw_eth, sizeof(raw_eth), NULL) != TM_ECODE_OK);
+
+    /* generic decoders on the same data */
+    p2->ethh = (EthernetHdr *)raw_eth;
+    DecodeVLAN(&tv, &dtv, p2, raw_eth + ETHERNET_HEADER_LEN,
+            sizeof(raw_eth) - ETHERNET_HEADER_LEN, NULL);
+
+    FAIL_IF_NOT(PKT_IS_IPV4(p1) && PKT_IS_TCP(p1));
+    FAIL_IF(p1->vlan_idx != 1 || p1->vlan_id[0] != 10);
+    FAIL_IF(p1->vlan_idx != p2->vlan_idx || p1->vlan_id[0] != p2->vlan_id[0]);
+    FAIL_IF(p1->ip4h != p2->ip4h || p1->tcph != p2->tcph);
+    FAIL_IF(CMP_ADDR(&p1->src, &p2->src) == 0 || CMP_ADDR(&p1->dst, &p2->dst) == 0);
+    FAIL_IF(p1->sp != 1234 || p1->sp != p2->sp || p1->dp != p2->dp);
+    FAIL_IF(p1->proto != p2->proto);
+    FAIL_IF(p1->payload != p2->payload || p1->payload_len != 4);
+    FAIL_IF(p1->payload_len != p2->payload_len);
+    FAIL_IF(p1->flags != p2->flags || p1->flow_hash != p2->flow_hash);
+
+    SCFree(p1);
+    SCFree(p2);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 
@@ -145,6 +304,7 @@ void DecodeEthernetRegisterTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("DecodeEthernetTest01", DecodeEthernetTest01);
+    UtRegisterTest("DecodeEthernetTest02", DecodeEthernetTest02);
 #endif /* UNITTESTS */
 }
 /**
@@ -178,6 +178,15 @@ const struct DecodeEvents_ DEvents[] = {
     { "decoder.erspan.unsupported_version", ERSPAN_UNSUPPORTED_VERSION, },
     { "decoder.erspan.too_many_vlan_layers", ERSPAN_TOO_MANY_VLAN_LAYERS, },
 
+    /* VXLAN events */
+    { "decoder.vxlan.pkt_too_small", VXLAN_PKT_TOO_SMALL, },
+    { "decoder.vxlan.invalid_flags", VXLAN_INVALID_FLAGS, },
+
+    /* Geneve events */
+    { "decoder.geneve.pkt_too_small", GENEVE_PKT_TOO_SMALL, },
+    { "decoder.geneve.unsupported_version", GENEVE_UNSUPPORTED_VERSION, },
+    { "decoder.geneve.unknown_payload_type", GENEVE_UNKNOWN_PAYLOAD_TYPE, },
+
     /* STREAM EVENTS */
     { "stream.3whs_ack_in_wrong_dir", STREAM_3WHS_ACK_IN_WRONG_DIR, },
     { "stream.3whs_async_wrong_seq", STREAM_3WHS_ASYNC_WRONG_SEQ, },
@@ -187,6 +187,15 @@ enum {
     ERSPAN_UNSUPPORTED_VERSION,
     ERSPAN_TOO_MANY_VLAN_LAYERS,
 
+    /* VXLAN events */
+    VXLAN_PKT_TOO_SMALL,
+    VXLAN_INVALID_FLAGS,
+
+    /* Geneve events */
+    GENEVE_PKT_TOO_SMALL,
+    GENEVE_UNSUPPORTED_VERSION,
+    GENEVE_UNKNOWN_PAYLOAD_TYPE,
+
     /* END OF DECODE EVENTS ON SINGLE PACKET */
     DECODE_EVENT_PACKET_MAX,
 
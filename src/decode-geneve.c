@@ -0,0 +1,222 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decodes Geneve. The outer UDP packet sets up the inner
+ * packet, DecodeGeneve is the DecodeTunnel handler for it. Options are
+ * skipped, not inspected.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "decode-events.h"
+#include "pkt-var.h"
+#include "decode-geneve.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+static int g_geneve_enabled = 1;
+static uint16_t g_geneve_port = GENEVE_DEFAULT_PORT;
+
+/** \brief read the decoder.geneve settings */
+void DecodeGeneveConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.geneve.enabled", &enabled) == 1)
+        g_geneve_enabled = enabled;
+
+    intmax_t port = 0;
+    if (ConfGetInt("decoder.geneve.port", &port) == 1) {
+        if (port <= 0 || port > 65535) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid decoder.geneve.port "
+                    "%"PRIdMAX", using %u", port, GENEVE_DEFAULT_PORT);
+        } else {
+            g_geneve_port = (uint16_t)port;
+        }
+    }
+
+    if (g_geneve_enabled)
+        SCLogConfig("Geneve decoding enabled on udp port %u", g_geneve_port);
+}
+
+/**
+ * \brief Check a UDP payload for Geneve and set up the inner packet
+ *
+ * \retval TM_ECODE_OK payload was handled as Geneve
+ * \retval TM_ECODE_FAILED not Geneve, handle as regular UDP
+ */
+int DecodeGeneveUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (!g_geneve_enabled || p->dp != g_geneve_port)
+        return TM_ECODE_FAILED;
+
+    if (len < sizeof(GeneveHdr)) {
+        ENGINE_SET_EVENT(p, GENEVE_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+    const GeneveHdr *hdr = (const GeneveHdr *)pkt;
+    if (GENEVE_GET_VERSION(hdr) != 0) {
+        ENGINE_SET_EVENT(p, GENEVE_UNSUPPORTED_VERSION);
+        return TM_ECODE_FAILED;
+    }
+    if (len < sizeof(GeneveHdr) + GENEVE_GET_OPTLEN(hdr)) {
+        ENGINE_SET_EVENT(p, GENEVE_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+    switch (ntohs(hdr->proto)) {
+        case GENEVE_PROTO_ETHERNET:
+        case ETHERNET_TYPE_IP:
+        case ETHERNET_TYPE_IPV6:
+            break;
+        default:
+            ENGINE_SET_EVENT(p, GENEVE_UNKNOWN_PAYLOAD_TYPE);
+            return TM_ECODE_FAILED;
+    }
+
+    if (pq == NULL)
+        return TM_ECODE_FAILED;
+
+    if (PacketTunnelDecapInPlace(tv, dtv, p, pkt, len,
+                DECODE_TUNNEL_TYPE_GENEVE, DECODE_TUNNEL_GENEVE, pq))
+        return TM_ECODE_OK;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len,
+            DECODE_TUNNEL_GENEVE, pq);
+    if (tp == NULL)
+        return TM_ECODE_FAILED;
+
+    PKT_SET_SRC(tp, PKT_SRC_DECODER_GENEVE);
+    PacketEnqueue(pq, tp);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Function to decode Geneve packets
+ *
+ * Runs on the inner packet, which starts with the Geneve header.
+ */
+int DecodeGeneve(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    StatsIncr(tv, dtv->counter_geneve);
+
+    if (len < sizeof(GeneveHdr)) {
+        ENGINE_SET_EVENT(p, GENEVE_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+    const GeneveHdr *hdr = (const GeneveHdr *)pkt;
+    uint16_t hlen = sizeof(GeneveHdr) + GENEVE_GET_OPTLEN(hdr);
+    if (len < hlen) {
+        ENGINE_SET_EVENT(p, GENEVE_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+
+    p->vni = GENEVE_GET_VNI(hdr);
+    SCLogDebug("Geneve: vni %u proto %04x options %u", p->vni,
+            ntohs(hdr->proto), GENEVE_GET_OPTLEN(hdr));
+
+    switch (ntohs(hdr->proto)) {
+        case GENEVE_PROTO_ETHERNET:
+            return DecodeEthernet(tv, dtv, p, pkt + hlen, len - hlen, pq);
+        case ETHERNET_TYPE_IP:
+            return DecodeIPV4(tv, dtv, p, pkt + hlen, len - hlen, pq);
+        case ETHERNET_TYPE_IPV6:
+            return DecodeIPV6(tv, dtv, p, pkt + hlen, len - hlen, pq);
+        default:
+            ENGINE_SET_EVENT(p, GENEVE_UNKNOWN_PAYLOAD_TYPE);
+            return TM_ECODE_FAILED;
+    }
+}
+
+#ifdef UNITTESTS
+/** \test ipv4/udp to 6081/geneve vni 0x010203, 4 bytes of options,
+ *        ipv4 payload/udp 53 -> 53 */
+static int DecodeGeneveTest01(void)
+{
+    uint8_t raw[] = {
+        0x45, 0x00, 0x00, 0x44, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        0xc0, 0x00, 0x17, 0xc1, 0x00, 0x30, 0x00, 0x00,
+        /* geneve: optlen 1, proto ipv4, vni, one option word */
+        0x01, 0x00, 0x08, 0x00, 0x01, 0x02, 0x03, 0x00,
+        0x01, 0x02, 0x80, 0x00,
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x02, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01,
+        0xc0, 0xa8, 0x01, 0x02,
+        0x00, 0x35, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00
+    };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(pq.len == 1);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF_NOT(tp->vni == 0x010203);
+    FAIL_IF_NOT(PKT_IS_IPV4(tp));
+    FAIL_IF_NOT(PKT_IS_UDP(tp));
+    FAIL_IF_NOT(tp->sp == 53 && tp->dp == 53);
+    PacketFree(tp);
+    PACKET_RECYCLE(p);
+
+    /* unknown payload type: regular udp */
+    PacketCopyData(p, raw, sizeof(raw));
+    GET_PKT_DATA(p)[20 + 8 + 2] = 0x12;
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(pq.len == 0);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p, GENEVE_UNKNOWN_PAYLOAD_TYPE));
+
+    PacketFree(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DecodeGeneveRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeGeneveTest01", DecodeGeneveTest01);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,52 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __DECODE_GENEVE_H__
+#define __DECODE_GENEVE_H__
+
+#include "decode.h"
+#include "threadvars.h"
+
+#define GENEVE_DEFAULT_PORT     6081
+
+/** protocol type for an ethernet frame payload */
+#define GENEVE_PROTO_ETHERNET   0x6558
+
+typedef struct GeneveHdr_ {
+    uint8_t ver_optlen;     /**< 2 bits version, 6 bits options length
+                             *   in 4 byte words */
+    uint8_t flags;
+    uint16_t proto;
+    uint8_t vni[3];
+    uint8_t res;
+} __attribute__((__packed__)) GeneveHdr;
+
+#define GENEVE_GET_VERSION(hdr) ((hdr)->ver_optlen >> 6)
+#define GENEVE_GET_OPTLEN(hdr)  (((hdr)->ver_optlen & 0x3f) * 4)
+#define GENEVE_GET_VNI(hdr) \
+    (((uint32_t)(hdr)->vni[0] << 16) | ((uint32_t)(hdr)->vni[1] << 8) | (hdr)->vni[2])
+
+void DecodeGeneveConfig(void);
+int DecodeGeneveUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq);
+void DecodeGeneveRegisterTests(void);
+
+#endif /* __DECODE_GENEVE_H__ */
@@ -39,6 +39,28 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 
+/**
+ * \brief Hand the GRE payload to a pseudo packet, or decode it in place
+ *        if the decoder.tunnel policy says so
+ */
+static void DecodeGREInner(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, enum DecodeTunnelProto proto, PacketQueue *pq)
+{
+    if (pq == NULL)
+        return;
+
+    enum DecodeTunnelType type = (proto == DECODE_TUNNEL_ERSPAN) ?
+        DECODE_TUNNEL_TYPE_ERSPAN : DECODE_TUNNEL_TYPE_GRE;
+    if (PacketTunnelDecapInPlace(tv, dtv, p, pkt, len, type, proto, pq))
+        return;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len, proto, pq);
+    if (tp != NULL) {
+        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
+        PacketEnqueue(pq,tp);
+    }
+}
+
 /**
  * \brief Function to decode GRE packets
  */
@@ -199,79 +221,43 @@ int DecodeGRE(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, ui
     {
         case ETHERNET_TYPE_IP:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_IPV4, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_IPV4, pq);
                 break;
             }
 
         case GRE_PROTO_PPP:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_PPP, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_PPP, pq);
                 break;
             }
 
         case ETHERNET_TYPE_IPV6:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_IPV6, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_IPV6, pq);
                 break;
             }
 
         case ETHERNET_TYPE_VLAN:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_VLAN, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_VLAN, pq);
                 break;
             }
 
         case ETHERNET_TYPE_ERSPAN:
         {
-            if (pq != NULL) {
-                Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                        len - header_len, DECODE_TUNNEL_ERSPAN, pq);
-                if (tp != NULL) {
-                    PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                    PacketEnqueue(pq,tp);
-                }
-            }
+            DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                    DECODE_TUNNEL_ERSPAN, pq);
             break;
         }
 
         case ETHERNET_TYPE_BRIDGE:
             {
-                if (pq != NULL) {
-                    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                            len - header_len, DECODE_TUNNEL_ETHERNET, pq);
-                    if (tp != NULL) {
-                        PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                        PacketEnqueue(pq,tp);
-                    }
-                }
+                DecodeGREInner(tv, dtv, p, pkt + header_len, len - header_len,
+                        DECODE_TUNNEL_ETHERNET, pq);
                 break;
             }
 
@@ -593,6 +593,11 @@ int DecodeIPV4(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
         case IPPROTO_IPV6:
             {
                 if (pq != NULL) {
+                    if (PacketTunnelDecapInPlace(tv, dtv, p, pkt + IPV4_GET_HLEN(p),
+                            IPV4_GET_IPLEN(p) - IPV4_GET_HLEN(p),
+                            DECODE_TUNNEL_TYPE_IPIP, DECODE_TUNNEL_IPV6, pq))
+                        break;
+
                     /* spawn off tunnel packet */
                     Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + IPV4_GET_HLEN(p),
                             IPV4_GET_IPLEN(p) - IPV4_GET_HLEN(p),
@@ -1628,6 +1633,68 @@ end:
     return result;
 }
 
+/**
+ * \test IPv6 in IPv4 is decapsulated into a pseudo packet by default
+ *       and into the packet itself with the in-place policy.
+ */
+static int DecodeIPV4TunnelInPlaceTest01(void)
+{
+    uint8_t raw[] = {
+        /* ipv4, proto 41 */
+        0x45, 0x00, 0x00, 0x50, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x29, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01,
+        0xc0, 0xa8, 0x01, 0x02,
+        /* ipv6, tcp */
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x14, 0x06, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        /* tcp syn 1234 -> 80 */
+        0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x20, 0x00,
+        0x00, 0x00, 0x00, 0x00
+    };
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+
+    /* default: inner packet is a pseudo packet, outer one stays ipv4 */
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(PKT_IS_IPV4(p));
+    FAIL_IF_NOT(pq.len == 1);
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF_NOT(PKT_IS_IPV6(tp));
+    FAIL_IF_NOT(PKT_IS_TCP(tp));
+    PacketFree(tp);
+    PACKET_RECYCLE(p);
+
+    /* in place: the packet itself is the ipv6/tcp one */
+    dtv.tunnel_inplace = (1 << DECODE_TUNNEL_TYPE_IPIP);
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+    FAIL_IF_NOT(pq.len == 0);
+    FAIL_IF(PKT_IS_IPV4(p));
+    FAIL_IF_NOT(PKT_IS_IPV6(p));
+    FAIL_IF_NOT((uint8_t *)p->ip6h == GET_PKT_DATA(p) + 20);
+    FAIL_IF_NOT(PKT_IS_TCP(p));
+    FAIL_IF_NOT(p->proto == IPPROTO_TCP);
+    FAIL_IF_NOT(p->sp == 1234 && p->dp == 80);
+    FAIL_IF_NOT(p->recursion_level == 1);
+
+    PacketFree(p);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DecodeIPV4RegisterTests(void)
@@ -1671,6 +1738,8 @@ void DecodeIPV4RegisterTests(void)
     UtRegisterTest("DecodeIPV4DefragTest01", DecodeIPV4DefragTest01);
     UtRegisterTest("DecodeIPV4DefragTest02", DecodeIPV4DefragTest02);
     UtRegisterTest("DecodeIPV4DefragTest03", DecodeIPV4DefragTest03);
+    UtRegisterTest("DecodeIPV4TunnelInPlaceTest01",
+                   DecodeIPV4TunnelInPlaceTest01);
 #endif /* UNITTESTS */
 }
 /**
@@ -60,6 +60,11 @@ static void DecodeIPv4inIPv6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, u
     }
     if (IP_GET_RAW_VER(pkt) == 4) {
         if (pq != NULL) {
+            if (PacketTunnelDecapInPlace(tv, dtv, p, pkt, plen,
+                        DECODE_TUNNEL_TYPE_IPIP, DECODE_TUNNEL_IPV4, pq)) {
+                StatsIncr(tv, dtv->counter_ipv4inipv6);
+                return;
+            }
             Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, plen, DECODE_TUNNEL_IPV4, pq);
             if (tp != NULL) {
                 PKT_SET_SRC(tp, PKT_SRC_DECODER_IPV6);
@@ -88,6 +93,11 @@ static int DecodeIP6inIP6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint
     }
     if (IP_GET_RAW_VER(pkt) == 6) {
         if (unlikely(pq != NULL)) {
+            if (PacketTunnelDecapInPlace(tv, dtv, p, pkt, plen,
+                        DECODE_TUNNEL_TYPE_IPIP, DECODE_TUNNEL_IPV6, pq)) {
+                StatsIncr(tv, dtv->counter_ipv6inipv6);
+                return TM_ECODE_OK;
+            }
             Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, plen, DECODE_TUNNEL_IPV6, pq);
             if (tp != NULL) {
                 PKT_SET_SRC(tp, PKT_SRC_DECODER_IPV6);
@@ -642,6 +652,10 @@ int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
         case IPPROTO_HIP:
         case IPPROTO_SHIM6:
             DecodeIPV6ExtHdrs(tv, dtv, p, pkt + IPV6_HEADER_LEN, IPV6_GET_PLEN(p), pq);
+            /* tunnel after the ext hdrs was decapsulated in place: the
+             * packet is the inner one now and has been fully decoded */
+            if (unlikely(p->ip6h != (IPV6Hdr *)pkt))
+                return TM_ECODE_OK;
             break;
         case IPPROTO_ICMP:
             ENGINE_SET_EVENT(p,IPV6_WITH_ICMPV4);
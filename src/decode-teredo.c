@@ -89,6 +89,11 @@ int DecodeTeredo(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt,
                 IPV6_GET_RAW_PLEN(thdr) + (start - pkt)) {
             if (pq != NULL) {
                 int blen = len - (start - pkt);
+                if (PacketTunnelDecapInPlace(tv, dtv, p, start, blen,
+                            DECODE_TUNNEL_TYPE_TEREDO, DECODE_TUNNEL_IPV6, pq)) {
+                    StatsIncr(tv, dtv->counter_teredo);
+                    return TM_ECODE_OK;
+                }
                 /* spawn off tunnel packet */
                 Packet *tp = PacketTunnelPktSetup(tv, dtv, p, start, blen,
                                                   DECODE_TUNNEL_IPV6, pq);
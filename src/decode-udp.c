@@ -34,6 +34,8 @@
 #include "decode.h"
 #include "decode-udp.h"
 #include "decode-teredo.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "decode-events.h"
 #include "util-unittest.h"
 #include "util-debug.h"
@@ -82,10 +84,14 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, ui
     SCLogDebug("UDP sp: %" PRIu32 " -> dp: %" PRIu32 " - HLEN: %" PRIu32 " LEN: %" PRIu32 "",
         UDP_GET_SRC_PORT(p), UDP_GET_DST_PORT(p), UDP_HEADER_LEN, p->payload_len);
 
-    if (unlikely(DecodeTeredo(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
-        /* Here we have a Teredo packet and don't need to handle app
-         * layer */
-        FlowSetupPacket(p);
+    if (DecodeVXLANUDP(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK ||
+        DecodeGeneveUDP(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK ||
+        unlikely(DecodeTeredo(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
+        /* Here we have a tunnel packet and don't need to handle app
+         * layer. If it was decapsulated in place, the inner layers did
+         * their own flow setup. */
+        if (PKT_IS_UDP(p))
+            FlowSetupPacket(p);
         return TM_ECODE_OK;
     }
 
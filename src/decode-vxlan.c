@@ -0,0 +1,290 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Decodes VXLAN (RFC 7348). The outer UDP packet sets up the inner
+ * packet, DecodeVXLAN is the DecodeTunnel handler for it.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "decode-events.h"
+#include "pkt-var.h"
+#include "decode-vxlan.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+static int g_vxlan_enabled = 1;
+static uint16_t g_vxlan_port = VXLAN_DEFAULT_PORT;
+
+/** \brief read the decoder.vxlan settings */
+void DecodeVXLANConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("decoder.vxlan.enabled", &enabled) == 1)
+        g_vxlan_enabled = enabled;
+
+    intmax_t port = 0;
+    if (ConfGetInt("decoder.vxlan.port", &port) == 1) {
+        if (port <= 0 || port > 65535) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid decoder.vxlan.port "
+                    "%"PRIdMAX", using %u", port, VXLAN_DEFAULT_PORT);
+        } else {
+            g_vxlan_port = (uint16_t)port;
+        }
+    }
+
+    if (g_vxlan_enabled)
+        SCLogConfig("VXLAN decoding enabled on udp port %u", g_vxlan_port);
+}
+
+/** \brief get the VXLAN udp port, 0 if VXLAN decoding is disabled */
+uint16_t DecodeVXLANGetPort(void)
+{
+    return g_vxlan_enabled ? g_vxlan_port : 0;
+}
+
+/**
+ * \brief Check a UDP payload for VXLAN and set up the inner packet
+ *
+ * \retval TM_ECODE_OK payload was handled as VXLAN
+ * \retval TM_ECODE_FAILED not VXLAN, handle as regular UDP
+ */
+int DecodeVXLANUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    if (!g_vxlan_enabled || p->dp != g_vxlan_port)
+        return TM_ECODE_FAILED;
+
+    if (len < sizeof(VXLANHdr)) {
+        ENGINE_SET_EVENT(p, VXLAN_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+    const VXLANHdr *hdr = (const VXLANHdr *)pkt;
+    if (!(hdr->flags & VXLAN_FLAG_I)) {
+        ENGINE_SET_EVENT(p, VXLAN_INVALID_FLAGS);
+        return TM_ECODE_FAILED;
+    }
+
+    if (pq == NULL)
+        return TM_ECODE_FAILED;
+
+    if (PacketTunnelDecapInPlace(tv, dtv, p, pkt, len,
+                DECODE_TUNNEL_TYPE_VXLAN, DECODE_TUNNEL_VXLAN, pq))
+        return TM_ECODE_OK;
+
+    Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len,
+            DECODE_TUNNEL_VXLAN, pq);
+    if (tp == NULL)
+        return TM_ECODE_FAILED;
+
+    PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
+    PacketEnqueue(pq, tp);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Function to decode VXLAN packets
+ *
+ * Runs on the inner packet, which starts with the VXLAN header.
+ */
+int DecodeVXLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    StatsIncr(tv, dtv->counter_vxlan);
+
+    if (len < sizeof(VXLANHdr)) {
+        ENGINE_SET_EVENT(p, VXLAN_PKT_TOO_SMALL);
+        return TM_ECODE_FAILED;
+    }
+
+    const VXLANHdr *hdr = (const VXLANHdr *)pkt;
+    p->vni = VXLAN_GET_VNI(hdr);
+    SCLogDebug("VXLAN: vni %u", p->vni);
+
+    return DecodeEthernet(tv, dtv, p, pkt + sizeof(VXLANHdr), len - sizeof(VXLANHdr), pq);
+}
+
+#ifdef UNITTESTS
+/** ipv4/udp to 4789/vxlan vni 42/ethernet/ipv4/tcp syn 1234 -> 80 */
+static uint8_t vxlan_test_pkt[] = {
+    0x45, 0x00, 0x00, 0x5a, 0x00, 0x01, 0x00, 0x00,
+    0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+    0x0a, 0x00, 0x00, 0x02,
+    0xc0, 0x00, 0x12, 0xb5, 0x00, 0x46, 0x00, 0x00,
+    0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a, 0x00,
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x11,
+    0x22, 0x33, 0x44, 0x66, 0x08, 0x00,
+    0x45, 0x00, 0x00, 0x28, 0x00, 0x02, 0x00, 0x00,
+    0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01,
+    0xc0, 0xa8, 0x01, 0x02,
+    0x04, 0xd2, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x50, 0x02, 0x20, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+/** offset of the vni in vxlan_test_pkt */
+#define VXLAN_TEST_VNI_OFFSET   (20 + 8 + 6)
+
+/** \test inner packet is set up as a pseudo packet carrying the vni */
+static int DecodeVXLANTest01(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    PacketCopyData(p, vxlan_test_pkt, sizeof(vxlan_test_pkt));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF_NOT(p->vni == 0);
+    FAIL_IF_NOT(pq.len == 1);
+
+    Packet *tp = PacketDequeue(&pq);
+    FAIL_IF_NULL(tp);
+    FAIL_IF_NOT(tp->vni == 42);
+    FAIL_IF_NOT(PKT_IS_IPV4(tp));
+    FAIL_IF_NOT(PKT_IS_TCP(tp));
+    FAIL_IF_NOT(tp->sp == 1234 && tp->dp == 80);
+    FAIL_IF_NOT(tp->recursion_level == 1);
+
+    PacketFree(tp);
+    PacketFree(p);
+    PASS;
+}
+
+/** \test the vni is part of the flow hash */
+static int DecodeVXLANTest02(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    uint32_t hash[3];
+    uint8_t vni[3] = { 42, 43, 42 };
+    int i;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    for (i = 0; i < 3; i++) {
+        PacketCopyData(p, vxlan_test_pkt, sizeof(vxlan_test_pkt));
+        GET_PKT_DATA(p)[VXLAN_TEST_VNI_OFFSET] = vni[i];
+        DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+        Packet *tp = PacketDequeue(&pq);
+        FAIL_IF_NULL(tp);
+        FAIL_IF_NOT(tp->vni == vni[i]);
+        hash[i] = tp->flow_hash;
+        PacketFree(tp);
+        PACKET_RECYCLE(p);
+    }
+    FAIL_IF(hash[0] == hash[1]);
+    FAIL_IF_NOT(hash[0] == hash[2]);
+
+    PacketFree(p);
+    PASS;
+}
+
+/** \test in place decapsulation */
+static int DecodeVXLANTest03(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+    dtv.tunnel_inplace = (1 << DECODE_TUNNEL_TYPE_VXLAN);
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    PacketCopyData(p, vxlan_test_pkt, sizeof(vxlan_test_pkt));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF_NOT(pq.len == 0);
+    FAIL_IF_NOT(p->vni == 42);
+    FAIL_IF(PKT_IS_UDP(p));
+    FAIL_IF_NOT(PKT_IS_TCP(p));
+    FAIL_IF_NOT((uint8_t *)p->ip4h == GET_PKT_DATA(p) + 50);
+    FAIL_IF_NOT(p->sp == 1234 && p->dp == 80);
+
+    PacketFree(p);
+    PASS;
+}
+
+/** \test no I flag: regular udp */
+static int DecodeVXLANTest04(void)
+{
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    PacketCopyData(p, vxlan_test_pkt, sizeof(vxlan_test_pkt));
+    GET_PKT_DATA(p)[20 + 8] = 0x00;
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    FAIL_IF_NOT(pq.len == 0);
+    FAIL_IF_NOT(PKT_IS_UDP(p));
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p, VXLAN_INVALID_FLAGS));
+
+    PacketFree(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DecodeVXLANRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeVXLANTest01", DecodeVXLANTest01);
+    UtRegisterTest("DecodeVXLANTest02", DecodeVXLANTest02);
+    UtRegisterTest("DecodeVXLANTest03", DecodeVXLANTest03);
+    UtRegisterTest("DecodeVXLANTest04", DecodeVXLANTest04);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
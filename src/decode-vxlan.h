@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __DECODE_VXLAN_H__
+#define __DECODE_VXLAN_H__
+
+#include "decode.h"
+#include "threadvars.h"
+
+#define VXLAN_DEFAULT_PORT      4789
+
+/** 'I' flag: the VNI is valid. Must be set. */
+#define VXLAN_FLAG_I            0x08
+
+typedef struct VXLANHdr_ {
+    uint8_t flags;
+    uint8_t res[3];
+    uint8_t vni[3];
+    uint8_t res2;
+} __attribute__((__packed__)) VXLANHdr;
+
+#define VXLAN_GET_VNI(hdr) \
+    (((uint32_t)(hdr)->vni[0] << 16) | ((uint32_t)(hdr)->vni[1] << 8) | (hdr)->vni[2])
+
+void DecodeVXLANConfig(void);
+uint16_t DecodeVXLANGetPort(void);
+int DecodeVXLANUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, PacketQueue *pq);
+void DecodeVXLANRegisterTests(void);
+
+#endif /* __DECODE_VXLAN_H__ */
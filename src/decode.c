@@ -51,6 +51,8 @@
 #include "suricata.h"
 #include "conf.h"
 #include "decode.h"
+#include "flow.h"
+#include "flow-hash.h"
 #include "util-debug.h"
 #include "util-mem.h"
 #include "app-layer-detect-proto.h"
@@ -65,6 +67,8 @@
 
 #include "output.h"
 #include "output-flow.h"
+#include "defrag-hash.h"
+#include "util-bench.h"
 
 int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         uint8_t *pkt, uint16_t len, PacketQueue *pq, enum DecodeTunnelProto proto)
@@ -82,6 +86,10 @@ int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
             return DecodeEthernet(tv, dtv, p, pkt, len, pq);
         case DECODE_TUNNEL_ERSPAN:
             return DecodeERSPAN(tv, dtv, p, pkt, len, pq);
+        case DECODE_TUNNEL_VXLAN:
+            return DecodeVXLAN(tv, dtv, p, pkt, len, pq);
+        case DECODE_TUNNEL_GENEVE:
+            return DecodeGeneve(tv, dtv, p, pkt, len, pq);
         default:
             SCLogInfo("FIXME: DecodeTunnel: protocol %" PRIu32 " not supported.", proto);
             break;
@@ -118,11 +126,6 @@ void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
             }
         }
     }
-#ifdef __SC_CUDA_SUPPORT__
-    if (dtv->cuda_vars.mpm_is_cuda)
-        CudaBufferPacket(&dtv->cuda_vars, p);
-#endif
-
 }
 
 /**
@@ -148,6 +151,42 @@ Packet *PacketGetFromAlloc(void)
     return p;
 }
 
+/**
+ * \brief Get a malloced packet with a separate direct data buffer
+ *
+ * The buffer starts at 'size' bytes and grows to fit the data copied
+ * in. It stays with the packet when it's recycled, so a pool packet only
+ * ever holds as much as the capture of its thread copies into it, and
+ * nothing for zero copy captures. Used for the packet pools, where
+ * max-pending-packets packets with default_packet_size each would be a
+ * lot of unused memory with jumbo frames.
+ *
+ * \retval p packet, NULL on error
+ */
+Packet *PacketGetFromAllocWithDataSize(uint32_t size)
+{
+    Packet *p = SCMalloc(sizeof(Packet));
+    if (unlikely(p == NULL)) {
+        return NULL;
+    }
+    memset(p, 0, sizeof(Packet));
+
+    size = MAX(size, 1);
+    p->direct_data = SCMalloc(size);
+    if (unlikely(p->direct_data == NULL)) {
+        SCFree(p);
+        return NULL;
+    }
+    p->direct_size = size;
+
+    PACKET_INITIALIZE(p);
+    p->ReleasePacket = PacketFree;
+    p->flags |= PKT_ALLOC;
+
+    PACKET_PROFILING_START(p);
+    return p;
+}
+
 /**
  * \brief Return a packet to where it was allocated.
  */
@@ -159,6 +198,36 @@ void PacketFreeOrRelease(Packet *p)
         PacketPoolReturnPacket(p);
 }
 
+/**
+ *  \brief Stop inspecting the flow of a packet
+ *
+ *  Offers the flow to the capture method first, so the remaining packets
+ *  of the flow don't even reach us. If the capture method can't or won't
+ *  do it, the flow is bypassed locally: its packets still update the flow
+ *  counters but skip stream tracking, app layer and detection.
+ *
+ *  \param p packet with a locked flow
+ */
+void PacketBypassCallback(Packet *p)
+{
+    if (p->flow == NULL)
+        return;
+
+    int state = SC_ATOMIC_GET(p->flow->flow_state);
+    if (FLOW_IS_BYPASSED(state))
+        return;
+
+    if (p->BypassPacketsFlow && p->BypassPacketsFlow(p)) {
+        SCLogDebug("flow %p bypassed by the capture method", p->flow);
+        SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_CAPTURE_BYPASSED);
+    } else {
+        SCLogDebug("flow %p bypassed locally", p->flow);
+        SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_LOCAL_BYPASSED);
+    }
+    /* the flow is timed out by its bypass state now */
+    FBTIMEOUT_RESET_FLOW(p->flow);
+}
+
 /**
  *  \brief Get a packet. We try to get a packet from the packetpool first, but
  *         if that is empty we alloc a packet that is free'd again after
@@ -193,6 +262,32 @@ inline int PacketCallocExtPkt(Packet *p, int datalen)
     return 0;
 }
 
+/**
+ *  \brief Make sure the direct data holds 'size' bytes
+ *
+ *  Grows the separate direct data buffer of a pool packet, keeping its
+ *  contents. It grows to default_packet_size at once, then to the max
+ *  packet size, so a copying capture reallocates a packet at most twice.
+ *
+ *  \retval 0 ok, -1 the direct data can't hold 'size' bytes
+ */
+int PacketReserveDirectData(Packet *p, uint32_t size)
+{
+    if (size <= GET_PKT_DIRECT_MAX_SIZE(p))
+        return 0;
+    if (p->direct_data == NULL || size > MAX_PAYLOAD_SIZE)
+        return -1;
+
+    uint32_t new_size = (size <= default_packet_size) ?
+        default_packet_size : MAX_PAYLOAD_SIZE;
+    uint8_t *d = SCRealloc(p->direct_data, new_size);
+    if (unlikely(d == NULL))
+        return -1;
+    p->direct_data = d;
+    p->direct_size = new_size;
+    return 0;
+}
+
 /**
  *  \brief Copy data to Packet payload at given offset
  *
@@ -216,9 +311,16 @@ inline int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datale
 
     /* Do we have already an packet with allocated data */
     if (! p->ext_pkt) {
-        if (offset + datalen <= (int)default_packet_size) {
+        if (offset + datalen <= (int)GET_PKT_DIRECT_MAX_SIZE(p)) {
             /* data will fit in memory allocated with packet */
             memcpy(GET_PKT_DIRECT_DATA(p) + offset, data, datalen);
+        } else if (p->direct_data != NULL) {
+            /* separate direct data, grow it */
+            if (PacketReserveDirectData(p, offset + datalen) < 0) {
+                SET_PKT_LEN(p, 0);
+                return -1;
+            }
+            memcpy(GET_PKT_DIRECT_DATA(p) + offset, data, datalen);
         } else {
             /* here we need a dynamic allocation */
             p->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
@@ -237,6 +339,30 @@ inline int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datale
     return 0;
 }
 
+/**
+ *  \brief Make sure the packet buffer can hold size bytes
+ *
+ *  For pseudo packets whose final size is known before the data is
+ *  copied in. Setting up the extended buffer first saves moving the
+ *  direct buffer over once the packet grows past it.
+ *
+ *  Sizes past MAX_PAYLOAD_SIZE are left to PacketCopyDataOffset to reject.
+ *
+ *  \retval 0 ok, -1 out of memory
+ */
+int PacketReserveData(Packet *p, uint32_t size)
+{
+    if (p->ext_pkt != NULL || size <= GET_PKT_DIRECT_MAX_SIZE(p))
+        return 0;
+    if (p->direct_data != NULL)
+        return (size > MAX_PAYLOAD_SIZE) ? 0 : PacketReserveDirectData(p, size);
+
+    p->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+    if (unlikely(p->ext_pkt == NULL))
+        return -1;
+    return 0;
+}
+
 /**
  *  \brief Copy data to Packet payload and set packet length
  *
@@ -281,6 +407,8 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     p->ts.tv_usec = parent->ts.tv_usec;
     p->datalink = DLT_RAW;
     p->tenant_id = parent->tenant_id;
+    p->vni = parent->vni;
+    p->job_id = parent->job_id;
 
     /* set the root ptr to the lowest layer */
     if (parent->root != NULL)
@@ -316,6 +444,67 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     SCReturnPtr(p, "Packet");
 }
 
+/**
+ *  \brief Decode the inner packet of a tunnel in the packet itself
+ *
+ *  Alternative to PacketTunnelPktSetup for the tunnel types set to
+ *  'in-place' in decoder.tunnel. The outer layers are forgotten and the
+ *  inner headers are decoded into the same packet, so it is handled as
+ *  if it was captured without the encapsulation. Layer state is reset
+ *  the same way a pseudo packet would start out.
+ *
+ *  \param type tunnel type to check the policy for
+ *  \param proto protocol of the tunneled packet
+ *
+ *  \retval 1 decapsulated in place
+ *  \retval 0 not decapsulated, caller should set up a pseudo packet
+ */
+int PacketTunnelDecapInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, enum DecodeTunnelType type,
+        enum DecodeTunnelProto proto, PacketQueue *pq)
+{
+    if (!(dtv->tunnel_inplace & (1 << type)))
+        return 0;
+
+    /* an outer fragment still needs its own headers for defrag */
+    if (p->ip6h != NULL && IPV6_EXTHDR_ISSET_FH(p))
+        return 0;
+
+    if (p->ip4h != NULL) {
+        CLEAR_IPV4_PACKET(p);
+    }
+    if (p->ip6h != NULL) {
+        CLEAR_IPV6_PACKET(p);
+    }
+    if (p->udph != NULL) {
+        CLEAR_UDP_PACKET(p);
+    }
+    CLEAR_ADDR(&p->src);
+    CLEAR_ADDR(&p->dst);
+    p->sp = 0;
+    p->dp = 0;
+    p->proto = 0;
+    p->payload = NULL;
+    p->payload_len = 0;
+
+    p->ethh = NULL;
+    p->ppph = NULL;
+    p->pppoesh = NULL;
+    p->pppoedh = NULL;
+    p->greh = NULL;
+    p->vlanh[0] = NULL;
+    p->vlanh[1] = NULL;
+    p->vlan_id[0] = 0;
+    p->vlan_id[1] = 0;
+    p->vlan_idx = 0;
+
+    /* keep the flows apart from those of the same ips outside the tunnel */
+    p->recursion_level++;
+
+    (void)DecodeTunnel(tv, dtv, p, pkt, len, pq, proto);
+    return 1;
+}
+
 /**
  *  \brief Setup a pseudo packet (reassembled frags)
  *
@@ -360,6 +549,8 @@ Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t
     p->vlan_id[0] = parent->vlan_id[0];
     p->vlan_id[1] = parent->vlan_id[1];
     p->vlan_idx = parent->vlan_idx;
+    p->vni = parent->vni;
+    p->job_id = parent->job_id;
 
     SCReturnPtr(p, "Packet");
 }
@@ -411,6 +602,8 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_avg_pkt_size = StatsRegisterAvgCounter("decoder.avg_pkt_size", tv);
     dtv->counter_max_pkt_size = StatsRegisterMaxCounter("decoder.max_pkt_size", tv);
     dtv->counter_erspan = StatsRegisterMaxCounter("decoder.erspan", tv);
+    dtv->counter_vxlan = StatsRegisterCounter("decoder.vxlan", tv);
+    dtv->counter_geneve = StatsRegisterCounter("decoder.geneve", tv);
     dtv->counter_flow_memcap = StatsRegisterCounter("flow.memcap", tv);
 
     dtv->counter_defrag_ipv4_fragments =
@@ -478,6 +671,7 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     if ( (dtv = SCMalloc(sizeof(DecodeThreadVars))) == NULL)
         return NULL;
     memset(dtv, 0, sizeof(DecodeThreadVars));
+    dtv->numa_node = -1;
 
     dtv->app_tctx = AppLayerGetCtxThread(tv);
 
@@ -494,6 +688,27 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
     }
     SCLogDebug("vlan tracking is %s", dtv->vlan_disabled == 0 ? "enabled" : "disabled");
 
+    static const char *tunnel_names[DECODE_TUNNEL_TYPE_MAX] = {
+        "gre", "erspan", "teredo", "ipip", "vxlan", "geneve",
+    };
+    int type;
+    for (type = 0; type < DECODE_TUNNEL_TYPE_MAX; type++) {
+        char name[64];
+        char *policy = NULL;
+        snprintf(name, sizeof(name), "decoder.tunnel.%s", tunnel_names[type]);
+        if (ConfGet(name, &policy) != 1 || policy == NULL)
+            continue;
+
+        if (strcasecmp(policy, "in-place") == 0) {
+            dtv->tunnel_inplace |= (1 << type);
+        } else if (strcasecmp(policy, "pseudo") != 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value '%s' for %s, "
+                    "using 'pseudo'", policy, name);
+        }
+        SCLogDebug("%s tunnels are decapsulated %s", tunnel_names[type],
+                (dtv->tunnel_inplace & (1 << type)) ? "in place" : "into pseudo packets");
+    }
+
     return dtv;
 }
 
@@ -506,6 +721,8 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
+        DefragTrackerCacheFlush();
+
         SCFree(dtv);
     }
 }
@@ -548,6 +765,12 @@ const char *PktSrcToString(enum PktSrcEnum pkt_src)
         case PKT_SRC_DECODER_TEREDO:
             pkt_src_str = "teredo tunnel";
             break;
+        case PKT_SRC_DECODER_VXLAN:
+            pkt_src_str = "vxlan tunnel";
+            break;
+        case PKT_SRC_DECODER_GENEVE:
+            pkt_src_str = "geneve tunnel";
+            break;
         case PKT_SRC_DEFRAG:
             pkt_src_str = "defrag";
             break;
@@ -631,6 +854,51 @@ int DecoderParseDataFromFile(char *filename, DecoderFunc Decoder) {
 }
 #endif /* AFLFUZZ_DECODER */
 
+#ifdef BENCHMARKS
+/** \internal
+ *  \brief decode ethernet frames down to the transport layer */
+static int DecodeBenchEthernet(BenchCtx *b)
+{
+    const BenchCorpus *c = BenchCorpusGet("frames");
+    if (c == NULL || c->cnt == 0)
+        return 0;
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    DecodeRegisterPerfCounters(&dtv, &tv);
+    StatsSetupPrivate(&tv);
+
+    Packet *p = PacketGetFromAlloc();
+    if (p == NULL) {
+        StatsThreadCleanup(&tv);
+        return 0;
+    }
+
+    b->bytes = c->size / c->cnt;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        const BenchBuffer *buf = &c->bufs[n % c->cnt];
+        DecodeEthernet(&tv, &dtv, p, buf->buf, buf->len, NULL);
+        PACKET_RECYCLE(p);
+    }
+    BenchTimerStop(b);
+
+    PacketFree(p);
+    StatsThreadCleanup(&tv);
+    return 1;
+}
+#endif /* BENCHMARKS */
+
+void DecodeRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    BenchRegister("decode/ethernet/frames", DecodeBenchEthernet, NULL);
+#endif /* BENCHMARKS */
+}
+
 /**
  * @}
  */
@@ -31,11 +31,7 @@
 #include "threadvars.h"
 #include "decode-events.h"
 #include "flow-worker.h"
-
-#ifdef __SC_CUDA_SUPPORT__
-#include "util-cuda-buffer.h"
-#include "util-cuda-vars.h"
-#endif /* __SC_CUDA_SUPPORT__ */
+#include "util-mpm-offload.h"
 
 typedef enum {
     CHECKSUM_VALIDATION_DISABLE,
@@ -51,6 +47,8 @@ enum PktSrcEnum {
     PKT_SRC_DECODER_IPV4,
     PKT_SRC_DECODER_IPV6,
     PKT_SRC_DECODER_TEREDO,
+    PKT_SRC_DECODER_VXLAN,
+    PKT_SRC_DECODER_GENEVE,
     PKT_SRC_DEFRAG,
     PKT_SRC_STREAM_TCP_STREAM_END_PSEUDO,
     PKT_SRC_FFR,
@@ -63,9 +61,13 @@ enum PktSrcEnum {
 #include "source-af-packet.h"
 #include "source-mpipe.h"
 #include "source-netmap.h"
+#include "source-af-xdp.h"
+#include "source-dpdk.h"
 
 #include "action-globals.h"
 
+#include "util-checksum-simd.h"
+
 #include "decode-erspan.h"
 #include "decode-ethernet.h"
 #include "decode-gre.h"
@@ -212,9 +214,13 @@ typedef struct Address_ {
 #define GET_TCP_DST_PORT(p)  ((p)->dp)
 
 #define GET_PKT_LEN(p) ((p)->pktlen)
-#define GET_PKT_DATA(p) ((((p)->ext_pkt) == NULL ) ? (uint8_t *)((p) + 1) : (p)->ext_pkt)
-#define GET_PKT_DIRECT_DATA(p) (uint8_t *)((p) + 1)
-#define GET_PKT_DIRECT_MAX_SIZE(p) (default_packet_size)
+#define GET_PKT_DATA(p) ((((p)->ext_pkt) == NULL ) ? GET_PKT_DIRECT_DATA(p) : (p)->ext_pkt)
+/* direct data: after the Packet, or in a separate buffer for the pool
+ * packets, see PacketGetFromAllocWithDataSize() */
+#define GET_PKT_DIRECT_DATA(p) \
+    (((p)->direct_data != NULL) ? (p)->direct_data : (uint8_t *)((p) + 1))
+#define GET_PKT_DIRECT_MAX_SIZE(p) \
+    (((p)->direct_data != NULL) ? (p)->direct_size : default_packet_size)
 
 #define SET_PKT_LEN(p, len) do { \
     (p)->pktlen = (len); \
@@ -275,14 +281,40 @@ typedef struct PacketAlert_ {
 /** alert is in a tx, tx_id set */
 #define PACKET_ALERT_FLAG_TX            0x08
 
+/** default for detect.packet-alert-max, the max alerts per packet */
 #define PACKET_ALERT_MAX 15
 
+/** summary of a window of identical alerts that were aggregated, see
+ *  detect.alert-aggregation */
+typedef struct PacketAlertAggregate_ {
+    const struct Signature_ *s;
+    Address src;
+    Address dst;
+    Port sp;                /**< of the first alert */
+    Port dp;
+    uint8_t proto;
+    uint32_t count;         /**< alerts in the window, incl. the logged one */
+    struct timeval first;
+    struct timeval last;
+} PacketAlertAggregate;
+
+/** max aggregation summaries attached to a single packet */
+#define PACKET_ALERT_AGG_MAX 4
+
 typedef struct PacketAlerts_ {
     uint16_t cnt;
-    PacketAlert alerts[PACKET_ALERT_MAX];
+    /** number of alerts the alerts array has room for */
+    uint16_t size;
+    /** allocated on the first alert and kept when the packet is
+     *  recycled, ordered by PacketAlertFinalize() */
+    PacketAlert *alerts;
     /* single pa used when we're dropping,
      * so we can log it out in the drop log. */
     PacketAlert drop;
+    /** aggregation windows that closed while handling this packet, to
+     *  be logged with it. Allocated on first use like alerts. */
+    uint16_t agg_cnt;
+    PacketAlertAggregate *agg;
 } PacketAlerts;
 
 /** number of decoder events we support per packet. Power of 2 minus 1
@@ -376,6 +408,12 @@ struct PacketQueue_;
  */
 typedef struct Packet_
 {
+    /* The first cache lines hold what decode, flow lookup, stream and
+     * detect touch for every packet. Per capture method data, the
+     * protocol vars, alerts, events and the tunnel bookkeeping follow
+     * after that, so the common path touches as few lines as possible.
+     * Keep this split in mind when adding members. */
+
     /* Addresses, Ports and protocol
      * these are on top so we can use
      * the Packet as a hash key */
@@ -404,47 +442,57 @@ typedef struct Packet_
     /* Pkt Flags */
     uint32_t flags;
 
-    struct Flow_ *flow;
+    /** VXLAN/Geneve network id of the tunnel the packet came out of,
+     *  part of the flow tuple so overlapping tenant address space is
+     *  kept apart. 0 outside of such tunnels. */
+    uint32_t vni;
+
+    /** unix socket pcap job the packet was read for, part of the flow
+     *  tuple so concurrent jobs don't share flows. 0 if none. */
+    uint32_t job_id;
 
     /* raw hash value for looking up the flow, will need to modulated to the
      * hash size still */
     uint32_t flow_hash;
 
+    struct Flow_ *flow;
+
     struct timeval ts;
 
-    union {
-        /* nfq stuff */
-#ifdef HAVE_NFLOG
-        NFLOGPacketVars nflog_v;
-#endif /* HAVE_NFLOG */
-#ifdef NFQ
-        NFQPacketVars nfq_v;
-#endif /* NFQ */
-#ifdef IPFW
-        IPFWPacketVars ipfw_v;
-#endif /* IPFW */
-#ifdef AF_PACKET
-        AFPPacketVars afp_v;
-#endif
-#ifdef HAVE_MPIPE
-        /* tilegx mpipe stuff */
-        MpipePacketVars mpipe_v;
-#endif
-#ifdef HAVE_NETMAP
-        NetmapPacketVars netmap_v;
-#endif
+    /* ptr to the payload of the packet
+     * with it's length. */
+    uint8_t *payload;
+    uint16_t payload_len;
 
-        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
-        PcapPacketVars pcap_v;
-    };
+    /* IPS action to take */
+    uint8_t action;
 
-    /** The release function for packet structure and data */
-    void (*ReleasePacket)(struct Packet_ *);
+    uint8_t pkt_src;
 
-    /* pkt vars */
-    PktVar *pktvar;
+    /* storage: set to pointer to heap and extended via allocation if necessary */
+    uint32_t pktlen;
+    uint8_t *ext_pkt;
+    /** separate direct data buffer, kept when the packet is recycled and
+     *  grown when a copy doesn't fit. NULL: the direct data follows the
+     *  Packet and has default_packet_size bytes */
+    uint8_t *direct_data;
+    uint32_t direct_size;
 
     /* header pointers */
+    IPV4Hdr *ip4h;
+
+    IPV6Hdr *ip6h;
+
+    TCPHdr *tcph;
+
+    UDPHdr *udph;
+
+    SCTPHdr *sctph;
+
+    ICMPV4Hdr *icmpv4h;
+
+    ICMPV6Hdr *icmpv6h;
+
     EthernetHdr *ethh;
 
     /* Checksum for IP packets. */
@@ -452,9 +500,44 @@ typedef struct Packet_
     /* Check sum for TCP, UDP or ICMP packets */
     int32_t level4_comp_csum;
 
-    IPV4Hdr *ip4h;
+    /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
+    uint32_t tenant_id;
 
-    IPV6Hdr *ip6h;
+    /** data linktype in host order */
+    int datalink;
+
+    /* tunnel/encapsulation handling */
+    struct Packet_ *root; /* in case of tunnel this is a ptr
+                           * to the 'real' packet, the one we
+                           * need to set the verdict on --
+                           * It should always point to the lowest
+                           * packet in a encapsulated packet */
+
+    /* double linked list ptrs */
+    struct Packet_ *next;
+    struct Packet_ *prev;
+
+    /* The Packet pool from which this packet was allocated. Used when returning
+     * the packet to its owner's stack. If NULL, then allocated with malloc.
+     */
+    struct PktPool_ *pool;
+
+    /** The release function for packet structure and data */
+    void (*ReleasePacket)(struct Packet_ *);
+
+    /* Incoming interface */
+    struct LiveDevice_ *livedev;
+
+    /* pkt vars */
+    PktVar *pktvar;
+
+    AppLayerDecoderEvents *app_layer_events;
+
+    struct Host_ *host_src;
+    struct Host_ *host_dst;
+
+    /** packet number in the pcap file, matches wireshark */
+    uint64_t pcap_cnt;
 
     /* IPv4 and IPv6 are mutually exclusive */
     union {
@@ -472,15 +555,7 @@ typedef struct Packet_
         ICMPV6Vars icmpv6vars;
     };
 
-    TCPHdr *tcph;
-
-    UDPHdr *udph;
-
-    SCTPHdr *sctph;
-
-    ICMPV4Hdr *icmpv4h;
-
-    ICMPV6Hdr *icmpv6h;
+    /* end of the hot part */
 
     PPPHdr *ppph;
     PPPOESessionHdr *pppoesh;
@@ -490,55 +565,54 @@ typedef struct Packet_
 
     VLANHdr *vlanh[2];
 
-    /* ptr to the payload of the packet
-     * with it's length. */
-    uint8_t *payload;
-    uint16_t payload_len;
-
-    /* IPS action to take */
-    uint8_t action;
-
-    uint8_t pkt_src;
-
-    /* storage: set to pointer to heap and extended via allocation if necessary */
-    uint32_t pktlen;
-    uint8_t *ext_pkt;
-
-    /* Incoming interface */
-    struct LiveDevice_ *livedev;
-
-    PacketAlerts alerts;
-
-    struct Host_ *host_src;
-    struct Host_ *host_dst;
-
-    /** packet number in the pcap file, matches wireshark */
-    uint64_t pcap_cnt;
-
-
     /* engine events */
     PacketEngineEvents events;
 
-    AppLayerDecoderEvents *app_layer_events;
+    /* alerts: the count is first, so the common no alert case only
+     * touches a single line of it */
+    PacketAlerts alerts;
 
-    /* double linked list ptrs */
-    struct Packet_ *next;
-    struct Packet_ *prev;
+    union {
+        /* nfq stuff */
+#ifdef HAVE_NFLOG
+        NFLOGPacketVars nflog_v;
+#endif /* HAVE_NFLOG */
+#ifdef NFQ
+        NFQPacketVars nfq_v;
+#endif /* NFQ */
+#ifdef IPFW
+        IPFWPacketVars ipfw_v;
+#endif /* IPFW */
+#ifdef AF_PACKET
+        AFPPacketVars afp_v;
+#endif
+#ifdef HAVE_MPIPE
+        /* tilegx mpipe stuff */
+        MpipePacketVars mpipe_v;
+#endif
+#ifdef HAVE_NETMAP
+        NetmapPacketVars netmap_v;
+#endif
+#ifdef HAVE_AF_XDP
+        AFXDPPacketVars afxdp_v;
+#endif
+#ifdef HAVE_DPDK
+        DPDKPacketVars dpdk_v;
+#endif
 
-    /** data linktype in host order */
-    int datalink;
+        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
+        PcapPacketVars pcap_v;
+    };
+
+    /** Optional capture method function to not receive the remaining
+     *  packets of the flow of this packet anymore. Returns 1 on success.
+     *  Set by the capture method like ReleasePacket. */
+    int (*BypassPacketsFlow)(struct Packet_ *);
 
     /* used to hold flowbits only if debuglog is enabled */
     int debuglog_flowbits_names_len;
     const char **debuglog_flowbits_names;
 
-    /* tunnel/encapsulation handling */
-    struct Packet_ *root; /* in case of tunnel this is a ptr
-                           * to the 'real' packet, the one we
-                           * need to set the verdict on --
-                           * It should always point to the lowest
-                           * packet in a encapsulated packet */
-
     /** mutex to protect access to:
      *  - tunnel_rtv_cnt
      *  - tunnel_tpr_cnt
@@ -549,20 +623,12 @@ typedef struct Packet_
     /* tunnel packet ref count */
     uint16_t tunnel_tpr_cnt;
 
-    /** tenant id for this packet, if any. If 0 then no tenant was assigned. */
-    uint32_t tenant_id;
-
-    /* The Packet pool from which this packet was allocated. Used when returning
-     * the packet to its owner's stack. If NULL, then allocated with malloc.
-     */
-    struct PktPool_ *pool;
-
 #ifdef PROFILING
     PktProfiling *profile;
 #endif
-#ifdef __SC_CUDA_SUPPORT__
-    CudaPacketVars cuda_pkt_vars;
-#endif
+
+    /* payload mpm handed to the offload backend */
+    MpmOffloadJob mpm_offload;
 }
 #ifdef HAVE_MPIPE
     /* mPIPE requires packet buffers to be aligned to 128 byte boundaries. */
@@ -575,6 +641,9 @@ Packet;
 #define MAX_PAYLOAD_SIZE (IPV6_HEADER_LEN + 65536 + 28)
 uint32_t default_packet_size;
 #define SIZE_OF_PACKET (default_packet_size + sizeof(Packet))
+/** initial direct data of the pool packets. Enough for the pseudo packets,
+ *  zero copy captures never use more */
+#define PACKET_POOL_DIRECT_SIZE 256
 
 typedef struct PacketQueue_ {
     Packet *top;
@@ -595,6 +664,10 @@ typedef struct DecodeThreadVars_
 
     int vlan_disabled;
 
+    /** bitmask of tunnel types (1 << DECODE_TUNNEL_TYPE_*) that are
+     *  decapsulated in place instead of through a pseudo packet */
+    uint8_t tunnel_inplace;
+
     /** stats/counters */
     uint16_t counter_pkts;
     uint16_t counter_bytes;
@@ -625,6 +698,8 @@ typedef struct DecodeThreadVars_
     uint16_t counter_ipv4inipv6;
     uint16_t counter_ipv6inipv6;
     uint16_t counter_erspan;
+    uint16_t counter_vxlan;
+    uint16_t counter_geneve;
 
     /** frag stats - defrag runs in the context of the decoder. */
     uint16_t counter_defrag_ipv4_fragments;
@@ -642,9 +717,12 @@ typedef struct DecodeThreadVars_
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
-#ifdef __SC_CUDA_SUPPORT__
-    CudaThreadVars cuda_vars;
-#endif
+    /* flow hash partition owned by this thread, NULL unless
+     * flow.thread-local is enabled */
+    struct FlowHashPartition_ *flow_part;
+
+    /* NUMA node of the thread if flows are kept per node, -1 otherwise */
+    int numa_node;
 } DecodeThreadVars;
 
 typedef struct CaptureStats_ {
@@ -680,25 +758,12 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
 /**
  *  \brief Initialize a packet structure for use.
  */
-#ifdef __SC_CUDA_SUPPORT__
-#include "util-cuda-handlers.h"
-#include "util-mpm.h"
-
-#define PACKET_INITIALIZE(p) do {                                       \
-        memset((p), 0x00, SIZE_OF_PACKET);                              \
-        SCMutexInit(&(p)->tunnel_mutex, NULL);                          \
-        PACKET_RESET_CHECKSUMS((p));                                    \
-        (p)->livedev = NULL;                                            \
-        SCMutexInit(&(p)->cuda_pkt_vars.cuda_mutex, NULL);            \
-        SCCondInit(&(p)->cuda_pkt_vars.cuda_cond, NULL);                \
-    } while (0)
-#else
 #define PACKET_INITIALIZE(p) {         \
     SCMutexInit(&(p)->tunnel_mutex, NULL); \
     PACKET_RESET_CHECKSUMS((p)); \
     (p)->livedev = NULL; \
+    MpmOffloadJobInit(&(p)->mpm_offload); \
 }
-#endif
 
 #define PACKET_RELEASE_REFS(p) do {              \
         FlowDeReference(&((p)->flow));          \
@@ -710,6 +775,9 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
  *  \brief Recycle a packet structure for reuse.
  */
 #define PACKET_REINIT(p) do {             \
+        if ((p)->mpm_offload.state != MPM_OFFLOAD_IDLE) { \
+            MpmOffloadPacketRelease((p));       \
+        }                                       \
         CLEAR_ADDR(&(p)->src);                  \
         CLEAR_ADDR(&(p)->dst);                  \
         (p)->sp = 0;                            \
@@ -720,9 +788,12 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->flags = (p)->flags & PKT_ALLOC;    \
         (p)->flowflags = 0;                     \
         (p)->pkt_src = 0;                       \
+        (p)->BypassPacketsFlow = NULL;          \
         (p)->vlan_id[0] = 0;                    \
         (p)->vlan_id[1] = 0;                    \
         (p)->vlan_idx = 0;                      \
+        (p)->vni = 0;                           \
+        (p)->job_id = 0;                        \
         (p)->ts.tv_sec = 0;                     \
         (p)->ts.tv_usec = 0;                    \
         (p)->datalink = 0;                      \
@@ -764,6 +835,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->pktlen = 0;                        \
         (p)->alerts.cnt = 0;                    \
         (p)->alerts.drop.action = 0;            \
+        (p)->alerts.agg_cnt = 0;                \
         (p)->pcap_cnt = 0;                      \
         (p)->tunnel_rtv_cnt = 0;                \
         (p)->tunnel_tpr_cnt = 0;                \
@@ -791,7 +863,18 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
             PktVarFree((p)->pktvar);            \
         }                                       \
         PACKET_FREE_EXTDATA((p));               \
+        if ((p)->direct_data != NULL) {         \
+            SCFree((p)->direct_data);           \
+        }                                       \
+        if ((p)->alerts.alerts != NULL) {       \
+            SCFree((p)->alerts.alerts);         \
+        }                                       \
+        if ((p)->alerts.agg != NULL) {          \
+            SCFree((p)->alerts.agg);            \
+        }                                       \
         SCMutexDestroy(&(p)->tunnel_mutex);     \
+        MpmOffloadPacketRelease((p));           \
+        MpmOffloadJobDeinit(&(p)->mpm_offload); \
         AppLayerDecoderEventsFreeEvents(&(p)->app_layer_events); \
         PACKET_PROFILING_RESET((p));            \
     } while (0)
@@ -872,22 +955,43 @@ enum DecodeTunnelProto {
     DECODE_TUNNEL_IPV4,
     DECODE_TUNNEL_IPV6,
     DECODE_TUNNEL_PPP,
+    DECODE_TUNNEL_VXLAN,
+    DECODE_TUNNEL_GENEVE,
+};
+
+/** tunnel types for the decoder.tunnel decapsulation policy */
+enum DecodeTunnelType {
+    DECODE_TUNNEL_TYPE_GRE = 0,
+    DECODE_TUNNEL_TYPE_ERSPAN,
+    DECODE_TUNNEL_TYPE_TEREDO,
+    DECODE_TUNNEL_TYPE_IPIP,    /**< ipv4/ipv6 in ipv4/ipv6 */
+    DECODE_TUNNEL_TYPE_VXLAN,
+    DECODE_TUNNEL_TYPE_GENEVE,
+    DECODE_TUNNEL_TYPE_MAX,
 };
 
 Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *parent,
                              uint8_t *pkt, uint16_t len, enum DecodeTunnelProto proto, PacketQueue *pq);
+int PacketTunnelDecapInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+        uint8_t *pkt, uint16_t len, enum DecodeTunnelType type,
+        enum DecodeTunnelProto proto, PacketQueue *pq);
 Packet *PacketDefragPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t proto);
 void PacketDefragPktSetupParent(Packet *parent);
 void DecodeRegisterPerfCounters(DecodeThreadVars *, ThreadVars *);
+void DecodeRegisterBenchmarks(void);
 Packet *PacketGetFromQueueOrAlloc(void);
 Packet *PacketGetFromAlloc(void);
+Packet *PacketGetFromAllocWithDataSize(uint32_t size);
 void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p);
 void PacketFree(Packet *p);
 void PacketFreeOrRelease(Packet *p);
+void PacketBypassCallback(Packet *p);
 int PacketCallocExtPkt(Packet *p, int datalen);
 int PacketCopyData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketSetData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datalen);
+int PacketReserveData(Packet *p, uint32_t size);
+int PacketReserveDirectData(Packet *p, uint32_t size);
 const char *PktSrcToString(enum PktSrcEnum pkt_src);
 
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *);
@@ -915,6 +1019,8 @@ int DecodeGRE(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, P
 int DecodeVLAN(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeMPLS(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 int DecodeERSPAN(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
+int DecodeVXLAN(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
+int DecodeGeneve(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
 
 void AddressDebugPrint(Address *);
 
@@ -1064,6 +1170,10 @@ int DecoderParseDataFromFile(char *filename, DecoderFunc Decoder);
  *  flow engine: Packet::flow_hash will be set */
 #define PKT_WANTS_FLOW                  (1<<22)
 
+/** packet is a TCP segment coalesced by the NIC or kernel (GRO/LRO), so
+ *  larger than what was on the wire */
+#define PKT_COALESCED                   (1<<23)
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) ((p)->flags & PKT_PSEUDO_STREAM_END)
 
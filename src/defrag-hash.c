@@ -23,7 +23,9 @@
 #include "util-random.h"
 #include "util-byte.h"
 #include "util-misc.h"
-#include "util-hash-lookup3.h"
+#include "util-memcap.h"
+#include "util-hash-fast.h"
+#include "util-hugepages.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
@@ -41,6 +43,57 @@ void DefragTrackerMoveToSpare(DefragTracker *h)
     (void) SC_ATOMIC_SUB(defragtracker_counter, 1);
 }
 
+#ifdef TLS
+/** number of spare trackers a thread takes from the spare queue at once */
+#define DEFRAG_TRACKER_CACHE_BATCH  16
+
+/** per thread stash of spare trackers. Under the cluster runmodes all
+ *  fragments of an ip pair end up in the same thread, so the hash rows
+ *  are effectively thread owned already. The spare queue is the one
+ *  lock all packet threads hit for each new tracker. */
+typedef struct DefragTrackerCache_ {
+    DefragTracker *list;
+    uint32_t len;
+} DefragTrackerCache;
+
+static __thread DefragTrackerCache tracker_cache = { NULL, 0 };
+
+static DefragTracker *DefragTrackerCacheGet(void)
+{
+    if (tracker_cache.list == NULL) {
+        tracker_cache.list = DefragTrackerDequeueBatch(&defragtracker_spare_q,
+                DEFRAG_TRACKER_CACHE_BATCH, &tracker_cache.len);
+        if (tracker_cache.list == NULL)
+            return NULL;
+    }
+
+    DefragTracker *dt = tracker_cache.list;
+    tracker_cache.list = dt->lnext;
+    tracker_cache.len--;
+    dt->lnext = NULL;
+    return dt;
+}
+
+/** \brief hand the trackers stashed by the calling thread back to the
+ *         spare queue. Called on thread exit. */
+void DefragTrackerCacheFlush(void)
+{
+    while (tracker_cache.list != NULL) {
+        DefragTracker *dt = tracker_cache.list;
+        tracker_cache.list = dt->lnext;
+        dt->lnext = NULL;
+        DefragTrackerEnqueue(&defragtracker_spare_q, dt);
+    }
+    tracker_cache.len = 0;
+}
+#else
+#define DefragTrackerCacheGet() DefragTrackerDequeue(&defragtracker_spare_q)
+
+void DefragTrackerCacheFlush(void)
+{
+}
+#endif /* TLS */
+
 DefragTracker *DefragTrackerAlloc(void)
 {
     if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
@@ -94,6 +147,8 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p)
     }
     dt->vlan_id[0] = p->vlan_id[0];
     dt->vlan_id[1] = p->vlan_id[1];
+    dt->vni = p->vni;
+    dt->job_id = p->job_id;
     dt->policy = DefragGetOsPolicy(p);
     dt->host_timeout = DefragPolicyGetHostTimeout(p);
     dt->remove = 0;
@@ -119,6 +174,17 @@ void DefragTrackerClearMemory(DefragTracker *dt)
 #define DEFRAG_DEFAULT_MEMCAP 16777216
 #define DEFRAG_DEFAULT_PREALLOC 1000
 
+/** \brief memory used by the defrag trackers, for the stats */
+uint64_t DefragGetMemuse(void)
+{
+    return (uint64_t)SC_ATOMIC_GET(defrag_memuse);
+}
+
+static uint64_t DefragGetMemcap(void)
+{
+    return defrag_config.memcap;
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void DefragInitConfig(char quiet)
@@ -133,10 +199,10 @@ void DefragInitConfig(char quiet)
     DefragTrackerQueueInit(&defragtracker_spare_q);
 
 #ifndef AFLFUZZ_NO_RANDOM
-    unsigned int seed = RandomTimePreseed();
     /* set defaults */
-    defrag_config.hash_rand   = (int)(DEFRAG_DEFAULT_HASHSIZE * (rand_r(&seed) / RAND_MAX + 1.0));
+    defrag_config.hash_rand   = HashFastRandomSeed();
 #endif
+    defrag_config.hash_algo   = HashFastGetAlgo();
     defrag_config.hash_size   = DEFRAG_DEFAULT_HASHSIZE;
     defrag_config.memcap      = DEFRAG_DEFAULT_MEMCAP;
     defrag_config.prealloc    = DEFRAG_DEFAULT_PREALLOC;
@@ -190,7 +256,7 @@ void DefragInitConfig(char quiet)
                 (uintmax_t)sizeof(DefragTrackerHashRow));
         exit(EXIT_FAILURE);
     }
-    defragtracker_hash = SCCalloc(defrag_config.hash_size, sizeof(DefragTrackerHashRow));
+    defragtracker_hash = HugePagesAlloc(defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     if (unlikely(defragtracker_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -203,6 +269,12 @@ void DefragInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
 
+    if (ExpiryTableInit(&defragtracker_expiry, defrag_config.hash_size) != 0) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    (void) SC_ATOMIC_ADD(defrag_memuse, ExpiryTableMemuse(&defragtracker_expiry));
+
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the defrag hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -242,6 +314,7 @@ void DefragInitConfig(char quiet)
                 SC_ATOMIC_GET(defrag_memuse), defrag_config.memcap);
     }
 
+    MemcapPolicyRegister("defrag", DefragGetMemuse, DefragGetMemcap, NULL);
     return;
 }
 
@@ -260,6 +333,9 @@ void DefragHashShutdown(void)
 
     DefragTrackerPrintStats();
 
+    /* trackers the main thread stashed, e.g. in the unittests */
+    DefragTrackerCacheFlush();
+
     /* free spare queue */
     while((dt = DefragTrackerDequeue(&defragtracker_spare_q))) {
         BUG_ON(SC_ATOMIC_GET(dt->use_cnt) > 0);
@@ -279,10 +355,12 @@ void DefragHashShutdown(void)
 
             DRLOCK_DESTROY(&defragtracker_hash[u]);
         }
-        SCFree(defragtracker_hash);
+        HugePagesFree(defragtracker_hash);
         defragtracker_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
+    (void) SC_ATOMIC_SUB(defrag_memuse, ExpiryTableMemuse(&defragtracker_expiry));
+    ExpiryTableFree(&defragtracker_expiry);
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
@@ -364,7 +442,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
+        uint32_t hash = HashFastWords(defrag_config.hash_algo, dhk.u32, 4, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
@@ -391,7 +469,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[0] = p->vlan_id[0];
         dhk.vlan_id[1] = p->vlan_id[1];
 
-        uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
+        uint32_t hash = HashFastWords(defrag_config.hash_algo, dhk.u32, 10, defrag_config.hash_rand);
         key = hash % defrag_config.hash_size;
     } else
         key = 0;
@@ -408,7 +486,9 @@ static inline uint32_t DefragHashGetKey(Packet *p)
        CMP_ADDR(&(d1)->dst_addr, &(d2)->src))) && \
      (d1)->id == (id) && \
      (d1)->vlan_id[0] == (d2)->vlan_id[0] && \
-     (d1)->vlan_id[1] == (d2)->vlan_id[1])
+     (d1)->vlan_id[1] == (d2)->vlan_id[1] && \
+     (d1)->vni == (d2)->vni && \
+     (d1)->job_id == (d2)->job_id)
 
 static inline int DefragTrackerCompare(DefragTracker *t, Packet *p)
 {
@@ -434,8 +514,8 @@ static DefragTracker *DefragTrackerGetNew(Packet *p)
 {
     DefragTracker *dt = NULL;
 
-    /* get a tracker from the spare queue */
-    dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    /* get a tracker from our stash or the spare queue */
+    dt = DefragTrackerCacheGet();
     if (dt == NULL) {
         /* If we reached the max memcap, we get a used tracker */
         if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
@@ -492,6 +572,8 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
     /* get our hash bucket and lock it */
     DefragTrackerHashRow *hb = &defragtracker_hash[key];
     DRLOCK_LOCK(hb);
+    /* the tracker is used, have its row checked at the next timeout pass */
+    ExpiryArm(&defragtracker_expiry, key, 0);
 
     /* see if the bucket already has a tracker */
     if (hb->head == NULL) {
@@ -597,6 +679,7 @@ DefragTracker *DefragLookupTrackerFromHash (Packet *p)
         DRLOCK_UNLOCK(hb);
         return dt;
     }
+    ExpiryArm(&defragtracker_expiry, key, 0);
 
     /* ok, we have a tracker in the bucket. Let's find out if it is our tracker */
     dt = hb->head;
@@ -26,6 +26,7 @@
 
 #include "decode.h"
 #include "defrag.h"
+#include "util-expiry.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define DRLOCK_SPIN
@@ -63,6 +64,8 @@ typedef struct DefragTrackerHashRow_ {
 
 /** defrag tracker hash table */
 DefragTrackerHashRow *defragtracker_hash;
+/** when the rows of defragtracker_hash need a timeout check */
+ExpiryTable defragtracker_expiry;
 
 #define DEFRAG_VERBOSE    0
 #define DEFRAG_QUIET      1
@@ -70,6 +73,7 @@ DefragTrackerHashRow *defragtracker_hash;
 typedef struct DefragConfig_ {
     uint64_t memcap;
     uint32_t hash_rand;
+    int hash_algo;          /**< HashFastAlgo */
     uint32_t hash_size;
     uint32_t prealloc;
 } DefragConfig;
@@ -91,6 +95,7 @@ SC_ATOMIC_DECLARE(unsigned int,defragtracker_prune_idx);
 
 void DefragInitConfig(char quiet);
 void DefragHashShutdown(void);
+uint64_t DefragGetMemuse(void);
 
 DefragTracker *DefragLookupTrackerFromHash (Packet *);
 DefragTracker *DefragGetTrackerFromHash (Packet *);
@@ -98,6 +103,7 @@ void DefragTrackerRelease(DefragTracker *);
 void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
+void DefragTrackerCacheFlush(void);
 
 #endif /* __DEFRAG_HASH_H__ */
 
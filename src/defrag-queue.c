@@ -133,6 +133,39 @@ DefragTracker *DefragTrackerDequeue (DefragTrackerQueue *q)
     return dt;
 }
 
+/**
+ *  \brief remove up to max trackers from the queue under a single lock
+ *
+ *  \retval list of trackers linked through lnext, NULL if empty
+ */
+DefragTracker *DefragTrackerDequeueBatch(DefragTrackerQueue *q, uint32_t max,
+        uint32_t *cnt)
+{
+    DefragTracker *list = NULL;
+    uint32_t n = 0;
+
+    DQLOCK_LOCK(q);
+    while (n < max && q->bot != NULL) {
+        DefragTracker *dt = q->bot;
+        q->bot = dt->lprev;
+        if (q->bot != NULL)
+            q->bot->lnext = NULL;
+        else
+            q->top = NULL;
+        if (q->len > 0)
+            q->len--;
+
+        dt->lprev = NULL;
+        dt->lnext = list;
+        list = dt;
+        n++;
+    }
+    DQLOCK_UNLOCK(q);
+
+    *cnt = n;
+    return list;
+}
+
 uint32_t DefragTrackerQueueLen(DefragTrackerQueue *q)
 {
     uint32_t len;
@@ -59,23 +59,49 @@ static int DefragTrackerTimedOut(DefragTracker *dt, struct timeval *ts)
     return 1;
 }
 
+/** \internal
+ *  \brief when a tracker that didn't time out needs to be checked again
+ *
+ *  \param dt *LOCKED* tracker
+ */
+static uint32_t DefragTrackerNextTimeout(DefragTracker *dt, struct timeval *ts)
+{
+    uint32_t next = (uint32_t)ts->tv_sec + 1;
+
+    if (SC_ATOMIC_GET(dt->use_cnt) > 0 || dt->remove)
+        return next;
+
+    /* timed out once ts is past dt->timeout */
+    return MAX(next, (uint32_t)dt->timeout.tv_sec + 1);
+}
+
 /**
  *  \internal
  *
  *  \brief check all trackers in a hash row for timing out
  *
- *  \param hb tracker hash row *LOCKED*
- *  \param dt last tracker in the hash row
+ *  \param row hash row to check
  *  \param ts timestamp
+ *  \param cnt[out] incremented for each timed out tracker
  *
- *  \retval cnt timed out tracker
+ *  \retval next time the row needs to be checked, EXPIRY_NEVER if empty
  */
-static uint32_t DefragTrackerHashRowTimeout(DefragTrackerHashRow *hb, DefragTracker *dt, struct timeval *ts)
+static uint32_t DefragTrackerHashRowTimeout(uint32_t row, struct timeval *ts,
+        uint32_t *cnt)
 {
-    uint32_t cnt = 0;
+    DefragTrackerHashRow *hb = &defragtracker_hash[row];
+    const uint32_t retry = (uint32_t)ts->tv_sec + 1;
+    uint32_t next = EXPIRY_NEVER;
+
+    if (DRLOCK_TRYLOCK(hb) != 0)
+        return retry;
 
-    do {
+    /* defrag hash bucket is now locked */
+
+    DefragTracker *dt = hb->tail;
+    while (dt != NULL) {
         if (SCMutexTrylock(&dt->lock) != 0) {
+            next = MIN(next, retry);
             dt = dt->hprev;
             continue;
         }
@@ -107,47 +133,29 @@ static uint32_t DefragTrackerHashRowTimeout(DefragTrackerHashRow *hb, DefragTrac
             /* move to spare list */
             DefragTrackerMoveToSpare(dt);
 
-            cnt++;
+            (*cnt)++;
         } else {
+            next = MIN(next, DefragTrackerNextTimeout(dt, ts));
             SCMutexUnlock(&dt->lock);
         }
 
         dt = next_dt;
-    } while (dt != NULL);
+    }
 
-    return cnt;
+    DRLOCK_UNLOCK(hb);
+    return next;
 }
 
 /**
  *  \brief time out tracker from the hash
  *
+ *  Only the rows that defragtracker_expiry has due are checked.
+ *
  *  \param ts timestamp
  *
  *  \retval cnt number of timed out tracker
  */
 uint32_t DefragTimeoutHash(struct timeval *ts)
 {
-    uint32_t idx = 0;
-    uint32_t cnt = 0;
-
-    for (idx = 0; idx < defrag_config.hash_size; idx++) {
-        DefragTrackerHashRow *hb = &defragtracker_hash[idx];
-
-        if (DRLOCK_TRYLOCK(hb) != 0)
-            continue;
-
-        /* defrag hash bucket is now locked */
-
-        if (hb->tail == NULL) {
-            DRLOCK_UNLOCK(hb);
-            continue;
-        }
-
-        /* we have a tracker, or more than one */
-        cnt += DefragTrackerHashRowTimeout(hb, hb->tail, ts);
-        DRLOCK_UNLOCK(hb);
-    }
-
-    return cnt;
+    return ExpiryTimeout(&defragtracker_expiry, ts, DefragTrackerHashRowTimeout);
 }
-
@@ -64,6 +64,8 @@
 
 #define DEFAULT_DEFRAG_HASH_SIZE 0xffff
 #define DEFAULT_DEFRAG_POOL_SIZE 0xffff
+/** frags moved between the pool and a thread at once */
+#define DEFRAG_POOL_BATCH 16
 
 /**
  * Default timeout (in seconds) before a defragmentation tracker will
@@ -151,18 +153,13 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
 
-    /* Lock the frag pool as we'll be return items to it. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-
     while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
         TAILQ_REMOVE(&tracker->frags, frag, next);
 
         /* Don't SCFree the frag, just give it back to its pool. */
         DefragFragReset(frag);
-        PoolReturn(defrag_context->frag_pool, frag);
+        PoolDepotReturn(defrag_context->frag_pool, frag);
     }
-
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
 }
 
 /**
@@ -192,19 +189,14 @@ DefragContextNew(void)
         frag_pool_size = DEFAULT_DEFRAG_POOL_SIZE;
     }
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
-    dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
-        sizeof(Frag),
+    dc->frag_pool = PoolDepotInit(DEFRAG_POOL_BATCH,
+        frag_pool_size, frag_pool_prealloc, sizeof(Frag),
         NULL, DefragFragInit, dc, NULL, NULL);
     if (dc->frag_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Defrag: Failed to initialize fragment pool.");
         exit(EXIT_FAILURE);
     }
-    if (SCMutexInit(&dc->frag_pool_lock, NULL) != 0) {
-        SCLogError(SC_ERR_MUTEX,
-            "Defrag: Failed to initialize frag pool mutex.");
-        exit(EXIT_FAILURE);
-    }
 
     /* Set the default timeout. */
     intmax_t timeout;
@@ -241,7 +233,7 @@ DefragContextDestroy(DefragContext *dc)
     if (dc == NULL)
         return;
 
-    PoolFree(dc->frag_pool);
+    PoolDepotFree(dc->frag_pool);
     SCFree(dc);
 }
 
@@ -263,6 +255,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
      * fragments are inserted if frag_offset order. */
     Frag *frag;
     int len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -283,6 +276,8 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
@@ -296,6 +291,12 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->recursion_level = p->recursion_level;
 
+    /* size the buffer up front so the fragments are copied straight
+     * into their final place */
+    Frag *first = TAILQ_FIRST(&tracker->frags);
+    if (PacketReserveData(rp, first->ip_hdr_offset + first->hlen + end) == -1)
+        goto error_remove_tracker;
+
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int hlen = 0;
@@ -385,6 +386,7 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
      * fragments are inserted if frag_offset order. */
     Frag *frag;
     int len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -405,12 +407,13 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
@@ -418,6 +421,12 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
 
+    /* size the buffer up front so the fragments are copied straight
+     * into their final place */
+    Frag *first = TAILQ_FIRST(&tracker->frags);
+    if (PacketReserveData(rp, first->frag_hdr_offset + end) == -1)
+        goto error_remove_tracker;
+
     int unfragmentable_len = 0;
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
@@ -714,9 +723,7 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    Frag *new = PoolDepotGet(defrag_context->frag_pool);
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -727,9 +734,7 @@ insert:
     }
     new->pkt = SCMalloc(GET_PKT_LEN(p));
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        PoolDepotReturn(defrag_context->frag_pool, new);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -1555,7 +1560,8 @@ DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned back to the pool. */
-    if (defrag_context->frag_pool->outstanding != 0) {
+    PoolDepotThreadFlush();
+    if (defrag_context->frag_pool->pool->outstanding != 0) {
         goto end;
     }
 
@@ -1683,8 +1689,9 @@ IPV6DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned to the pool. */
-    if (defrag_context->frag_pool->outstanding != 0) {
-        printf("defrag_context->frag_pool->outstanding %u: ", defrag_context->frag_pool->outstanding);
+    PoolDepotThreadFlush();
+    if (defrag_context->frag_pool->pool->outstanding != 0) {
+        printf("defrag_context->frag_pool->outstanding %u: ", defrag_context->frag_pool->pool->outstanding);
         goto end;
     }
 
@@ -2201,7 +2208,7 @@ DefragIPv4NoDataTest(void)
 
     /* The fragment should have been ignored so no fragments should
      * have been allocated from the pool. */
-    if (dc->frag_pool->outstanding != 0)
+    if (dc->frag_pool->pool->outstanding != 0)
         return 0;
 
     ret = 1;
@@ -2242,7 +2249,7 @@ DefragIPv4TooLargeTest(void)
 
     /* The fragment should have been ignored so no fragments should have
      * been allocated from the pool. */
-    if (dc->frag_pool->outstanding != 0)
+    if (dc->frag_pool->pool->outstanding != 0)
         return 0;
 
     ret = 1;
@@ -2544,6 +2551,48 @@ end:
     return retval;
 }
 
+/**
+ * Reassembled packet larger than the packet's direct buffer: all
+ * fragments have to end up in the extended buffer.
+ */
+static int DefragIPv4LargeReassemblyTest(void)
+{
+    Packet *frags[4];
+    int ip_id = 13;
+    int i, j;
+
+    DefragInit();
+
+    for (i = 0; i < 4; i++) {
+        frags[i] = BuildTestPacket(ip_id, i * 75, i < 3, 'A' + i, 600);
+        FAIL_IF_NULL(frags[i]);
+    }
+
+    /* middle fragments first, so the first fragment isn't the one
+     * to set up the packet */
+    FAIL_IF_NOT_NULL(Defrag(NULL, NULL, frags[2], NULL));
+    FAIL_IF_NOT_NULL(Defrag(NULL, NULL, frags[1], NULL));
+    FAIL_IF_NOT_NULL(Defrag(NULL, NULL, frags[3], NULL));
+    Packet *p = Defrag(NULL, NULL, frags[0], NULL);
+    FAIL_IF_NULL(p);
+
+    /* pool packets grow their direct data, others get ext data */
+    FAIL_IF(p->ext_pkt == NULL && GET_PKT_DIRECT_MAX_SIZE(p) < 20 + 4 * 600);
+    FAIL_IF_NOT(IPV4_GET_IPLEN(p) == 20 + 4 * 600);
+    FAIL_IF_NOT(GET_PKT_LEN(p) == 20 + 4 * 600);
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 600; j++) {
+            FAIL_IF_NOT(GET_PKT_DATA(p)[20 + i * 600 + j] == 'A' + i);
+        }
+    }
+
+    for (i = 0; i < 4; i++)
+        SCFree(frags[i]);
+    PacketFree(p);
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void
@@ -2563,6 +2612,8 @@ DefragRegisterTests(void)
 
     UtRegisterTest("DefragIPv4NoDataTest", DefragIPv4NoDataTest);
     UtRegisterTest("DefragIPv4TooLargeTest", DefragIPv4TooLargeTest);
+    UtRegisterTest("DefragIPv4LargeReassemblyTest",
+                   DefragIPv4LargeReassemblyTest);
 
     UtRegisterTest("IPV6DefragInOrderSimpleTest", IPV6DefragInOrderSimpleTest);
     UtRegisterTest("IPV6DefragReverseSimpleTest", IPV6DefragReverseSimpleTest);
@@ -25,14 +25,14 @@
 #define __DEFRAG_H__
 
 #include "util-pool.h"
+#include "util-pool-depot.h"
 
 /**
  * A context for an instance of a fragmentation re-assembler, in case
  * we ever need more than one.
  */
 typedef struct DefragContext_ {
-    Pool *frag_pool; /**< Pool of fragments. */
-    SCMutex frag_pool_lock;
+    PoolDepot *frag_pool; /**< Pool of fragments. */
 
     time_t timeout; /**< Default timeout. */
 } DefragContext;
@@ -81,6 +81,9 @@ typedef struct DefragTracker_ {
 
     uint16_t vlan_id[2]; /**< VLAN ID tracker applies to. */
 
+    uint32_t vni; /**< VXLAN/Geneve network id tracker applies to. */
+    uint32_t job_id; /**< unix socket pcap job tracker applies to. */
+
     uint32_t id; /**< IP ID for this tracker.  32 bits for IPv6, 16
                   * for IPv4. */
 
@@ -28,6 +28,6 @@ typedef struct DetectBase64Decode_ {
 
 void DetectBase64DecodeRegister(void);
 int DetectBase64DecodeDoMatch(DetectEngineThreadCtx *, Signature *,
-    const SigMatch *, uint8_t *, uint32_t);
+    const SigMatchData *, uint8_t *, uint32_t);
 
 #endif /* __DETECT_BASE64_DECODE_H__ */
@@ -0,0 +1,134 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the bypass keyword: stop inspecting the flow of a packet
+ * matching the signature.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-bypass.h"
+
+#include "flow.h"
+#include "flow-util.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+static int DetectBypassMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *,
+        Signature *, const SigMatchCtx *);
+static int DetectBypassSetup(DetectEngineCtx *, Signature *, char *);
+static void DetectBypassRegisterTests(void);
+
+void DetectBypassRegister(void)
+{
+    sigmatch_table[DETECT_BYPASS].name = "bypass";
+    sigmatch_table[DETECT_BYPASS].desc = "stop inspecting the flow once the signature matched";
+    sigmatch_table[DETECT_BYPASS].Match = DetectBypassMatch;
+    sigmatch_table[DETECT_BYPASS].Setup = DetectBypassSetup;
+    sigmatch_table[DETECT_BYPASS].Free  = NULL;
+    sigmatch_table[DETECT_BYPASS].RegisterTests = DetectBypassRegisterTests;
+
+    sigmatch_table[DETECT_BYPASS].flags |= SIGMATCH_NOOPT;
+}
+
+static int DetectBypassSetup(DetectEngineCtx *de_ctx, Signature *s, char *str)
+{
+    if (str != NULL && strlen(str) > 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "bypass has no value");
+        return -1;
+    }
+
+    SigMatch *sm = SigMatchAlloc();
+    if (sm == NULL)
+        return -1;
+
+    sm->type = DETECT_BYPASS;
+    sm->ctx = NULL;
+    SigMatchAppendSMToList(s, sm, DETECT_SM_LIST_POSTMATCH);
+
+    return 0;
+}
+
+/** \internal
+ *  \brief post-match func bypassing the flow of the packet
+ */
+static int DetectBypassMatch(ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
+        Packet *p, Signature *s, const SigMatchCtx *ctx)
+{
+    PacketBypassCallback(p);
+    return 1;
+}
+
+#ifdef UNITTESTS
+/** \test a match bypasses the flow locally if the capture can't */
+static int DetectBypassTest01(void)
+{
+    uint8_t *buf = (uint8_t *)"big download";
+    uint16_t buflen = strlen((char *)buf);
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    Flow f;
+
+    memset(&f, 0, sizeof(Flow));
+    FLOW_INITIALIZE(&f);
+    SC_ATOMIC_SET(f.flow_state, FLOW_STATE_ESTABLISHED);
+
+    p->flowflags |= FLOW_PKT_ESTABLISHED;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flow = &f;
+    p->flags |= PKT_HAS_FLOW;
+
+    char sig[] = "alert tcp any any -> any any "
+            "(content:\"download\"; bypass; sid:1;)";
+    FAIL_IF_NOT(UTHPacketMatchSigMpm(p, sig, MPM_AC) == 1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(f.flow_state) == FLOW_STATE_LOCAL_BYPASSED);
+
+    UTHFreePacket(p);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
+/** \test bypass doesn't take a value */
+static int DetectBypassTest02(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"download\"; bypass:yes; sid:1;)");
+    FAIL_IF_NOT_NULL(s);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+static void DetectBypassRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectBypassTest01", DetectBypassTest01);
+    UtRegisterTest("DetectBypassTest02", DetectBypassTest02);
+#endif /* UNITTESTS */
+}
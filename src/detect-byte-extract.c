@@ -112,12 +112,12 @@ void DetectByteExtractRegister(void)
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
-int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, SigMatch *sm,
+int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, const SigMatchData *smd,
                              Signature *s, uint8_t *payload,
                              uint16_t payload_len, uint64_t *value,
                              uint8_t endian)
 {
-    DetectByteExtractData *data = (DetectByteExtractData *)sm->ctx;
+    DetectByteExtractData *data = (DetectByteExtractData *)smd->ctx;
     uint8_t *ptr = NULL;
     int32_t len = 0;
     uint64_t val = 0;
@@ -161,8 +161,8 @@ int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, SigMatch *sm,
 
     /* Extract the byte data */
     if (data->flags & DETECT_BYTE_EXTRACT_FLAG_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = ByteDecode(data->decoder, BYTE_BIG_ENDIAN, data->base,
+                              data->nbytes, ptr, &val);
         if (extbytes <= 0) {
             /* strtoull() return 0 if there is no numeric value in data string */
             if (val == 0) {
@@ -177,7 +177,8 @@ int DetectByteExtractDoMatch(DetectEngineThreadCtx *det_ctx, SigMatch *sm,
     } else {
         int endianness = (endian == DETECT_BYTE_EXTRACT_ENDIAN_BIG) ?
                           BYTE_BIG_ENDIAN : BYTE_LITTLE_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteDecode(data->decoder, endianness, 0, data->nbytes,
+                              ptr, &val);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_INVALID_NUM_BYTES, "Error extracting %d bytes "
                    "of numeric data: %d\n", data->nbytes, extbytes);
@@ -498,6 +499,8 @@ static inline DetectByteExtractData *DetectByteExtractParse(char *arg)
             bed->endian = DETECT_BYTE_EXTRACT_ENDIAN_DEFAULT;
     }
 
+    bed->decoder = ByteDecodeSelect(bed->flags & DETECT_BYTE_EXTRACT_FLAG_STRING,
+                                    bed->base, bed->nbytes);
     return bed;
  error:
     if (bed != NULL)
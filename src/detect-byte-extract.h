@@ -45,7 +45,8 @@ typedef struct DetectByteExtractData_ {
     uint8_t local_id;
 
     uint8_t nbytes;
-    int16_t pad;
+    uint8_t decoder;    /**< BYTE_DECODE_* for the extraction */
+    uint8_t pad;
     int32_t offset;
     const char *name;
     uint8_t flags;
@@ -65,7 +66,7 @@ void DetectByteExtractFree(void *);
 int DetectByteExtractMatch(ThreadVars *, DetectEngineThreadCtx *,
                            Packet *, Signature *, SigMatch *);
 SigMatch *DetectByteExtractRetrieveSMVar(const char *, Signature *);
-int DetectByteExtractDoMatch(DetectEngineThreadCtx *, SigMatch *, Signature *,
+int DetectByteExtractDoMatch(DetectEngineThreadCtx *, const SigMatchData *, Signature *,
                              uint8_t *, uint16_t, uint64_t *, uint8_t);
 
 #endif /* __DETECT_BYTEEXTRACT_H__ */
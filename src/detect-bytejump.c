@@ -131,8 +131,8 @@ int DetectBytejumpDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
 
     /* Extract the byte data */
     if (flags & DETECT_BYTEJUMP_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = ByteDecode(data->decoder, BYTE_BIG_ENDIAN, data->base,
+                              data->nbytes, ptr, &val);
         if(extbytes <= 0) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of string data: %d", data->nbytes, extbytes);
@@ -141,7 +141,8 @@ int DetectBytejumpDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     }
     else {
         int endianness = (flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteDecode(data->decoder, endianness, 0, data->nbytes,
+                              ptr, &val);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of numeric data: %d", data->nbytes, extbytes);
@@ -240,8 +241,8 @@ int DetectBytejumpMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
 
     /* Extract the byte data */
     if (data->flags & DETECT_BYTEJUMP_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = ByteDecode(data->decoder, BYTE_BIG_ENDIAN, data->base,
+                              data->nbytes, ptr, &val);
         if(extbytes <= 0) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of string data: %d", data->nbytes, extbytes);
@@ -250,7 +251,8 @@ int DetectBytejumpMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     }
     else {
         int endianness = (data->flags & DETECT_BYTEJUMP_LITTLE) ? BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteDecode(data->decoder, endianness, 0, data->nbytes,
+                              ptr, &val);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_BYTE_EXTRACT_FAILED,"Error extracting %d bytes "
                    "of numeric data: %d", data->nbytes, extbytes);
@@ -487,6 +489,8 @@ DetectBytejumpData *DetectBytejumpParse(char *optstr, char **offset)
 
     /* This is max 23 so it will fit in a byte (see above) */
     data->nbytes = (uint8_t)nbytes;
+    data->decoder = ByteDecodeSelect(data->flags & DETECT_BYTEJUMP_STRING,
+                                     data->base, data->nbytes);
 
     return data;
 
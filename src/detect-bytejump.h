@@ -44,6 +44,7 @@ typedef struct DetectBytejumpData_ {
     uint8_t nbytes;                   /**< Number of bytes to compare */
     uint8_t base;                     /**< String value base (oct|dec|hex) */
     uint8_t flags;                    /**< Flags (big|little|relative|string) */
+    uint8_t decoder;                  /**< BYTE_DECODE_* for the extraction */
     uint32_t multiplier;              /**< Multiplier for nbytes (multiplier n)*/
     int32_t offset;                   /**< Offset in payload to extract value */
     int32_t post_offset;              /**< Offset to adjust post-jump */
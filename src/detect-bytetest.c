@@ -145,8 +145,8 @@ int DetectBytetestDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s, const Si
 
     /* Extract the byte data */
     if (flags & DETECT_BYTETEST_STRING) {
-        extbytes = ByteExtractStringUint64(&val, data->base,
-                                           data->nbytes, (const char *)ptr);
+        extbytes = ByteDecode(data->decoder, BYTE_BIG_ENDIAN, data->base,
+                              data->nbytes, ptr, &val);
         if (extbytes <= 0) {
             /* strtoull() return 0 if there is no numeric value in data string */
             if (val == 0) {
@@ -165,7 +165,8 @@ int DetectBytetestDoMatch(DetectEngineThreadCtx *det_ctx, Signature *s, const Si
     else {
         int endianness = (flags & DETECT_BYTETEST_LITTLE) ?
                           BYTE_LITTLE_ENDIAN : BYTE_BIG_ENDIAN;
-        extbytes = ByteExtractUint64(&val, endianness, data->nbytes, ptr);
+        extbytes = ByteDecode(data->decoder, endianness, 0, data->nbytes,
+                              ptr, &val);
         if (extbytes != data->nbytes) {
             SCLogError(SC_ERR_INVALID_NUM_BYTES, "Error extracting %d bytes "
                    "of numeric data: %d\n", data->nbytes, extbytes);
@@ -411,6 +412,8 @@ DetectBytetestData *DetectBytetestParse(char *optstr, char **value, char **offse
 
     /* This is max 23 so it will fit in a byte (see above) */
     data->nbytes = (uint8_t)nbytes;
+    data->decoder = ByteDecodeSelect(data->flags & DETECT_BYTETEST_STRING,
+                                     data->base, data->nbytes);
 
     for (i = 0; i < (ret - 1); i++){
         if (args[i] != NULL) SCFree(args[i]);
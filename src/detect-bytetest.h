@@ -54,6 +54,7 @@ typedef struct DetectBytetestData_ {
     uint8_t op;                       /**< Operator used to compare */
     uint8_t base;                     /**< String value base (oct|dec|hex) */
     uint8_t flags;                    /**< Flags (big|little|relative|string) */
+    uint8_t decoder;                  /**< BYTE_DECODE_* for the extraction */
     int32_t offset;                   /**< Offset in payload */
     uint64_t value;                   /**< Value to compare against */
 } DetectBytetestData;
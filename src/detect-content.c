@@ -60,6 +60,7 @@ void DetectContentRegister (void)
     sigmatch_table[DETECT_CONTENT].Match = NULL;
     sigmatch_table[DETECT_CONTENT].Setup = DetectContentSetup;
     sigmatch_table[DETECT_CONTENT].Free  = DetectContentFree;
+    sigmatch_table[DETECT_CONTENT].Memuse = DetectContentMemuse;
     sigmatch_table[DETECT_CONTENT].RegisterTests = DetectContentRegisterTests;
 
     sigmatch_table[DETECT_CONTENT].flags |= SIGMATCH_PAYLOAD;
@@ -430,6 +431,13 @@ void DetectContentFree(void *ptr)
     SCReturn;
 }
 
+/** \brief bytes used by a content, the spm ctx not included */
+size_t DetectContentMemuse(const SigMatchCtx *ctx)
+{
+    const DetectContentData *cd = (const DetectContentData *)ctx;
+    return sizeof(*cd) + cd->content_len + cd->replace_len;
+}
+
 #ifdef UNITTESTS /* UNITTESTS */
 
 /**
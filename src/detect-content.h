@@ -112,5 +112,6 @@ int DetectContentSetup(DetectEngineCtx *de_ctx, Signature *s, char *contentstr);
 void DetectContentPrint(DetectContentData *);
 
 void DetectContentFree(void *);
+size_t DetectContentMemuse(const SigMatchCtx *);
 
 #endif /* __DETECT_CONTENT_H__ */
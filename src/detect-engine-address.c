@@ -445,6 +445,212 @@ int DetectAddressJoin(DetectEngineCtx *de_ctx, DetectAddress *target,
     return -1;
 }
 
+/** address as a 128 bit number in host order, most significant word
+ *  first, so both families sort and step the same way */
+typedef struct AddressKey_ {
+    uint32_t w[4];
+} AddressKey;
+
+/** range start (+1) or the address after a range end (-1) */
+typedef struct AddressEvent_ {
+    AddressKey key;
+    int delta;
+} AddressEvent;
+
+static void AddressKeySet(AddressKey *k, const Address *a)
+{
+    if (a->family == AF_INET) {
+        k->w[0] = k->w[1] = k->w[2] = 0;
+        k->w[3] = ntohl(a->addr_data32[0]);
+    } else {
+        int i;
+        for (i = 0; i < 4; i++)
+            k->w[i] = ntohl(a->addr_data32[i]);
+    }
+}
+
+static void AddressKeyGet(const AddressKey *k, Address *a, int family)
+{
+    memset(a, 0x00, sizeof(*a));
+    a->family = family;
+    if (family == AF_INET) {
+        a->addr_data32[0] = htonl(k->w[3]);
+    } else {
+        int i;
+        for (i = 0; i < 4; i++)
+            a->addr_data32[i] = htonl(k->w[i]);
+    }
+}
+
+static int AddressKeyCmp(const AddressKey *a, const AddressKey *b)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (a->w[i] != b->w[i])
+            return a->w[i] < b->w[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/** \retval 1 the key wrapped around */
+static int AddressKeyInc(AddressKey *k)
+{
+    int i;
+    for (i = 3; i >= 0; i--) {
+        if (++k->w[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void AddressKeyDec(AddressKey *k)
+{
+    int i;
+    for (i = 3; i >= 0; i--) {
+        if (k->w[i]-- != 0)
+            return;
+    }
+}
+
+static int AddressEventCmp(const void *a, const void *b)
+{
+    return AddressKeyCmp(&((const AddressEvent *)a)->key,
+                         &((const AddressEvent *)b)->key);
+}
+
+/**
+ * \internal
+ * \brief Turn a list of possibly overlapping ranges of one family into
+ *        the sorted list of non-overlapping ranges DetectAddressInsert
+ *        builds: the ranges are cut at every start and end, the parts
+ *        nothing covers are left out and doubles are merged.
+ *
+ *        Inserting one by one walks the list and recurses on every cut, so
+ *        it's quadratic in the number of ranges. Here the range ends are
+ *        sorted once and swept, keeping a count of the ranges covering the
+ *        current position.
+ *
+ * \param head list to replace, its members are freed
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure, the list is left as it was.
+ */
+static int DetectAddressListSweep(DetectAddress **head, int family)
+{
+    DetectAddress *ad;
+    uint32_t cnt = 0;
+
+    for (ad = *head; ad != NULL; ad = ad->next)
+        cnt++;
+    if (cnt == 0)
+        return 0;
+
+    AddressEvent *ev = SCMalloc(2 * cnt * sizeof(*ev));
+    if (unlikely(ev == NULL))
+        return -1;
+
+    /* an end event for the last address of the space can't be stored,
+     * the ranges ending there are still active when the sweep ends */
+    uint32_t n = 0;
+    for (ad = *head; ad != NULL; ad = ad->next) {
+        AddressKeySet(&ev[n].key, &ad->ip);
+        ev[n++].delta = 1;
+        AddressKeySet(&ev[n].key, &ad->ip2);
+        if (AddressKeyInc(&ev[n].key) == 0)
+            ev[n++].delta = -1;
+    }
+    qsort(ev, n, sizeof(*ev), AddressEventCmp);
+
+    DetectAddress *new_head = NULL, *tail = NULL;
+    int active = 0;
+    uint32_t i = 0;
+    while (i < n) {
+        AddressKey start = ev[i].key;
+        while (i < n && AddressKeyCmp(&ev[i].key, &start) == 0)
+            active += ev[i++].delta;
+        if (active == 0)
+            continue;
+
+        AddressKey end;
+        if (i < n) {
+            end = ev[i].key;
+            AddressKeyDec(&end);
+        } else {
+            memset(&end, 0xff, sizeof(end));
+        }
+
+        ad = DetectAddressInit();
+        if (ad == NULL) {
+            DetectAddressCleanupList(new_head);
+            SCFree(ev);
+            return -1;
+        }
+        AddressKeyGet(&start, &ad->ip, family);
+        AddressKeyGet(&end, &ad->ip2, family);
+
+        ad->prev = tail;
+        if (tail != NULL)
+            tail->next = ad;
+        else
+            new_head = ad;
+        tail = ad;
+    }
+    SCFree(ev);
+
+    DetectAddressCleanupList(*head);
+    *head = new_head;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Add a range to the head without sorting or cutting, for the
+ *        parser that adds many and sweeps them once with
+ *        DetectAddressHeadSweep. 'any' still goes through
+ *        DetectAddressInsert.
+ *
+ * \retval  1 On successfully adding it.
+ * \retval  0 Not added, memory of ad is freed.
+ * \retval -1 On error.
+ */
+static int DetectAddressAppend(DetectAddressHead *gh, DetectAddress *ad)
+{
+    DetectAddress **head;
+
+    if (ad->flags & ADDRESS_FLAG_ANY)
+        return DetectAddressInsert(NULL, gh, ad);
+    else if (ad->ip.family == AF_INET)
+        head = &gh->ipv4_head;
+    else if (ad->ip.family == AF_INET6)
+        head = &gh->ipv6_head;
+    else
+        return -1;
+
+    ad->prev = NULL;
+    ad->next = *head;
+    if (*head != NULL)
+        (*head)->prev = ad;
+    *head = ad;
+    return 1;
+}
+
+/**
+ * \internal
+ * \brief Sort and cut the ipv4 and ipv6 ranges added by
+ *        DetectAddressAppend.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+static int DetectAddressHeadSweep(DetectAddressHead *gh)
+{
+    if (DetectAddressListSweep(&gh->ipv4_head, AF_INET) < 0)
+        return -1;
+    if (DetectAddressListSweep(&gh->ipv6_head, AF_INET6) < 0)
+        return -1;
+    return 0;
+}
+
 /**
  * \internal
  * \brief Creates a cidr ipv6 netblock, based on the cidr netblock value.
@@ -700,6 +906,14 @@ error:
     return NULL;
 }
 
+static int DetectAddressSetupAdd(DetectAddressHead *gh, DetectAddress *ad,
+        int defer)
+{
+    if (defer)
+        return DetectAddressAppend(gh, ad);
+    return DetectAddressInsert(NULL, gh, ad);
+}
+
 /**
  * \brief Setup a single address string, parse it and add the resulting
  *        Address-Range(s) to the AddessHead(DetectAddressHead instance).
@@ -708,11 +922,12 @@ error:
  *           resulting Address-Range(s) from the parsed ip string has to
  *           be added.
  * \param s  Pointer to the ip address string to be parsed.
+ * \param defer add the range(s) unsorted, for DetectAddressHeadSweep
  *
  * \retval  0 On success.
  * \retval -1 On failure.
  */
-int DetectAddressSetup(DetectAddressHead *gh, char *s)
+static int DetectAddressSetupDo(DetectAddressHead *gh, char *s, int defer)
 {
     DetectAddress *ad = NULL;
     DetectAddress *ad2 = NULL;
@@ -744,14 +959,14 @@ int DetectAddressSetup(DetectAddressHead *gh, char *s)
         /* normally a 'not' will result in two ad's unless the 'not' is on the start or end
          * of the address space (e.g. 0.0.0.0 or 255.255.255.255). */
         if (ad2 != NULL) {
-            if (DetectAddressInsert(NULL, gh, ad2) < 0) {
+            if (DetectAddressSetupAdd(gh, ad2, defer) < 0) {
                 SCLogDebug("DetectAddressInsert failed");
                 goto error;
             }
         }
     }
 
-    r = DetectAddressInsert(NULL, gh, ad);
+    r = DetectAddressSetupAdd(gh, ad, defer);
     if (r < 0) {
         SCLogDebug("DetectAddressInsert failed");
         goto error;
@@ -768,7 +983,7 @@ int DetectAddressSetup(DetectAddressHead *gh, char *s)
 
         BUG_ON(ad->ip.family == 0);
 
-        if (DetectAddressInsert(NULL, gh, ad) < 0) {
+        if (DetectAddressSetupAdd(gh, ad, defer) < 0) {
             SCLogDebug("DetectAddressInsert failed");
             goto error;
         }
@@ -778,7 +993,7 @@ int DetectAddressSetup(DetectAddressHead *gh, char *s)
 
         BUG_ON(ad->ip.family == 0);
 
-        if (DetectAddressInsert(NULL, gh, ad) < 0) {
+        if (DetectAddressSetupAdd(gh, ad, defer) < 0) {
             SCLogDebug("DetectAddressInsert failed");
             goto error;
         }
@@ -791,6 +1006,18 @@ error:
     return -1;
 }
 
+/**
+ * \brief Setup a single address string, parse it and insert the resulting
+ *        Address-Range(s) into the AddessHead(DetectAddressHead instance).
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int DetectAddressSetup(DetectAddressHead *gh, char *s)
+{
+    return DetectAddressSetupDo(gh, s, 0);
+}
+
 /**
  * \brief Parses an address string and updates the 2 address heads with the
  *        address data.
@@ -810,6 +1037,9 @@ error:
  * \param negate Flag that indicates if the received address string is negated
  *               or not.  0 if it is not, 1 it it is.
  *
+ * The ipv4 and ipv6 ranges are added to gh and ghn unsorted, they are
+ * sorted and cut by DetectAddressHeadSweep, see DetectAddressMergeNot.
+ *
  * \retval  0 On successfully parsing.
  * \retval -1 On failure.
  */
@@ -912,7 +1142,7 @@ static int DetectAddressParse2(const DetectEngineCtx *de_ctx,
                             goto error;
                         }
                         DetectAddressPrint(tmp_ad2);
-                        DetectAddressInsert(NULL, ghn, tmp_ad2);
+                        DetectAddressAppend(ghn, tmp_ad2);
                     }
 
                     /* insert the IPv6 addresses into the negated list */
@@ -924,7 +1154,7 @@ static int DetectAddressParse2(const DetectEngineCtx *de_ctx,
                             goto error;
                         }
                         DetectAddressPrint(tmp_ad2);
-                        DetectAddressInsert(NULL, ghn, tmp_ad2);
+                        DetectAddressAppend(ghn, tmp_ad2);
                     }
 
                     DetectAddressHeadCleanup(&tmp_gh);
@@ -976,11 +1206,11 @@ static int DetectAddressParse2(const DetectEngineCtx *de_ctx,
 
                 if (!((negate + n_set) % 2)) {
                     SCLogDebug("DetectAddressSetup into gh, %s", address);
-                    if (DetectAddressSetup(gh, address) < 0)
+                    if (DetectAddressSetupDo(gh, address, 1) < 0)
                         goto error;
                 } else {
                     SCLogDebug("DetectAddressSetup into ghn, %s", address);
-                    if (DetectAddressSetup(ghn, address) < 0)
+                    if (DetectAddressSetupDo(ghn, address, 1) < 0)
                         goto error;
                 }
                 n_set = 0;
@@ -1031,13 +1261,13 @@ static int DetectAddressParse2(const DetectEngineCtx *de_ctx,
             } else {
                 if (!((negate + n_set) % 2)) {
                     SCLogDebug("DetectAddressSetup into gh, %s", address);
-                    if (DetectAddressSetup(gh, address) < 0) {
+                    if (DetectAddressSetupDo(gh, address, 1) < 0) {
                         SCLogDebug("DetectAddressSetup gh fail");
                         goto error;
                     }
                 } else {
                     SCLogDebug("DetectAddressSetup into ghn, %s", address);
-                    if (DetectAddressSetup(ghn, address) < 0) {
+                    if (DetectAddressSetupDo(ghn, address, 1) < 0) {
                         SCLogDebug("DetectAddressSetup ghn fail");
                         goto error;
                     }
@@ -1089,6 +1319,8 @@ static int DetectAddressIsCompleteIPSpace(DetectAddressHead *gh)
 /**
  * \brief Merge the + and the - list (+ positive match, - 'not' match)
  *
+ *        The lists may be unsorted, as DetectAddressParse2 leaves them.
+ *
  * \param gh  Pointer to the address head containing the non-NOT groups.
  * \param ghn Pointer to the address head containing the NOT groups.
  *
@@ -1104,6 +1336,9 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
     SCLogDebug("gh->ipv4_head %p, ghn->ipv4_head %p", gh->ipv4_head,
                ghn->ipv4_head);
 
+    if (DetectAddressHeadSweep(ghn) < 0)
+        goto error;
+
     /* check if the negated list covers the entire ip space. If so
      * the user screwed up the rules/vars. */
     if (DetectAddressIsCompleteIPSpace(ghn) == 1) {
@@ -1131,7 +1366,8 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
         }
     }
 
-    /* step 1: insert our ghn members into the gh list */
+    /* step 1: add our ghn members to the gh list and cut it at their
+     * ends */
     for (ag = ghn->ipv4_head; ag != NULL; ag = ag->next) {
         /* work with a copy of the ad so we can easily clean up the ghn group
          * later. */
@@ -1141,11 +1377,7 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
             goto error;
         }
 
-        r = DetectAddressInsert(NULL, gh, ad);
-        if (r < 0) {
-            SCLogDebug("DetectAddressInsert failed");
-            goto error;
-        }
+        DetectAddressAppend(gh, ad);
     }
     /* ... and the same for ipv6 */
     for (ag = ghn->ipv6_head; ag != NULL; ag = ag->next) {
@@ -1157,12 +1389,11 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
             goto error;
         }
 
-        r = DetectAddressInsert(NULL, gh, ad);
-        if (r < 0) {
-            SCLogDebug("DetectAddressInsert failed");
-            goto error;
-        }
+        DetectAddressAppend(gh, ad);
     }
+    if (DetectAddressHeadSweep(gh) < 0)
+        goto error;
+
 #ifdef DEBUG
     DetectAddress *tmp_ad;
     for (tmp_ad = gh->ipv6_head; tmp_ad; tmp_ad = tmp_ad->next) {
@@ -1172,18 +1403,24 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
     int ipv4_applied = 0;
     int ipv6_applied = 0;
 
-    /* step 2: pull the address blocks that match our 'not' blocks */
+    /* step 2: pull the address blocks that match our 'not' blocks. Both
+     * lists are sorted and gh is cut at the ghn ends, so the blocks a
+     * 'not' covers follow each other and come after those of the 'not'
+     * before it. */
+    ag2 = gh->ipv4_head;
     for (ag = ghn->ipv4_head; ag != NULL; ag = ag->next) {
         SCLogDebug("ag %p", ag);
         DetectAddressPrint(ag);
 
         int applied = 0;
-        for (ag2 = gh->ipv4_head; ag2 != NULL; ) {
+        while (ag2 != NULL) {
             SCLogDebug("ag2 %p", ag2);
             DetectAddressPrint(ag2);
 
             r = DetectAddressCmp(ag, ag2);
-            /* XXX more ??? */
+            if (r == ADDRESS_LT)
+                break;
+
             if (r == ADDRESS_EQ || r == ADDRESS_EB) {
                 if (ag2->prev == NULL)
                     gh->ipv4_head = ag2->next;
@@ -1208,11 +1445,15 @@ int DetectAddressMergeNot(DetectAddressHead *gh, DetectAddressHead *ghn)
         }
     }
     /* ... and the same for ipv6 */
+    ag2 = gh->ipv6_head;
     for (ag = ghn->ipv6_head; ag != NULL; ag = ag->next) {
         int applied = 0;
-        for (ag2 = gh->ipv6_head; ag2 != NULL; ) {
+        while (ag2 != NULL) {
             r = DetectAddressCmp(ag, ag2);
-            if (r == ADDRESS_EQ || r == ADDRESS_EB) { /* XXX more ??? */
+            if (r == ADDRESS_LT)
+                break;
+
+            if (r == ADDRESS_EQ || r == ADDRESS_EB) {
                 if (ag2->prev == NULL)
                     gh->ipv6_head = ag2->next;
                 else
@@ -1325,6 +1566,9 @@ int DetectAddressTestConfVars(void)
 
         CleanVariableResolveList(&var_list);
 
+        if (DetectAddressHeadSweep(ghn) < 0)
+            goto error;
+
         if (DetectAddressIsCompleteIPSpace(ghn)) {
             SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
                        "address var - \"%s\" has the complete IP space negated "
@@ -4808,6 +5052,80 @@ int AddressConfVarsTest05(void)
     return result;
 }
 
+/** \test the sweep gives the same list as inserting one by one */
+static int AddressSweepTest01(void)
+{
+    char *addrs[] = { "10.0.0.0/8", "10.1.0.0/16", "10.1.2.3", "!10.1.2.4",
+        "10.1.2.4-10.1.2.20", "10.1.2.10-10.1.3.0", "10.1.0.0/16",
+        "192.168.0.0/24", "255.255.255.0/24", "255.255.255.255",
+        "0.0.0.0", "2001::/16", "2001::1-2001::10", "!2001::5",
+        "ffff::/16", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ff00/120", NULL };
+    DetectAddressHead gh_insert = { NULL, NULL, NULL };
+    DetectAddressHead gh_sweep = { NULL, NULL, NULL };
+    int i;
+
+    for (i = 0; addrs[i] != NULL; i++) {
+        FAIL_IF(DetectAddressSetup(&gh_insert, addrs[i]) < 0);
+        FAIL_IF(DetectAddressSetupDo(&gh_sweep, addrs[i], 1) < 0);
+    }
+    FAIL_IF(DetectAddressHeadSweep(&gh_sweep) < 0);
+
+    DetectAddress *a = gh_insert.ipv4_head, *b = gh_sweep.ipv4_head;
+    int cnt = 0;
+    for ( ; a != NULL && b != NULL; a = a->next, b = b->next, cnt++) {
+        FAIL_IF(DetectAddressCmp(a, b) != ADDRESS_EQ);
+        FAIL_IF(b->next != NULL && b->next->prev != b);
+    }
+    FAIL_IF(a != NULL || b != NULL);
+    FAIL_IF(cnt < 10);
+
+    a = gh_insert.ipv6_head;
+    b = gh_sweep.ipv6_head;
+    for (cnt = 0; a != NULL && b != NULL; a = a->next, b = b->next, cnt++)
+        FAIL_IF(DetectAddressCmp(a, b) != ADDRESS_EQ);
+    FAIL_IF(a != NULL || b != NULL);
+    FAIL_IF(cnt < 5);
+
+    DetectAddressHeadCleanup(&gh_insert);
+    DetectAddressHeadCleanup(&gh_sweep);
+    PASS;
+}
+
+/** \test negations over a var with many blocks */
+static int AddressSweepTest02(void)
+{
+    char str[8192] = "[";
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        char block[32];
+        snprintf(block, sizeof(block), "%s10.%d.0.0/16", i ? "," : "", i);
+        strlcat(str, block, sizeof(str));
+    }
+    strlcat(str, ",![10.3.0.0/16,10.7.1.0/24]]", sizeof(str));
+
+    DetectAddressHead *gh = DetectAddressHeadInit();
+    FAIL_IF_NULL(gh);
+    FAIL_IF(DetectAddressParse(NULL, gh, str) < 0);
+
+    UTHValidateDetectAddressHeadRange expect[] = {
+        { "10.0.0.0", "10.0.255.255" },
+        { "10.1.0.0", "10.1.255.255" },
+        { "10.2.0.0", "10.2.255.255" },
+        { "10.4.0.0", "10.4.255.255" },
+    };
+    int cnt = 0;
+    DetectAddress *ad;
+    for (ad = gh->ipv4_head; ad != NULL; ad = ad->next)
+        cnt++;
+    /* 10.7/16 is cut in two around 10.7.1/24 */
+    FAIL_IF(cnt != 256);
+    FAIL_IF_NOT(UTHValidateDetectAddressHead(gh, 4, expect));
+
+    DetectAddressHeadFree(gh);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectAddressTests(void)
@@ -5010,5 +5328,7 @@ void DetectAddressTests(void)
     UtRegisterTest("AddressConfVarsTest03 ", AddressConfVarsTest03);
     UtRegisterTest("AddressConfVarsTest04 ", AddressConfVarsTest04);
     UtRegisterTest("AddressConfVarsTest05 ", AddressConfVarsTest05);
+    UtRegisterTest("AddressSweepTest01", AddressSweepTest01);
+    UtRegisterTest("AddressSweepTest02", AddressSweepTest02);
 #endif /* UNITTESTS */
 }
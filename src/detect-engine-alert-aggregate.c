@@ -0,0 +1,350 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aggregation of identical alerts before output.
+ *
+ * Runs after PacketAlertFinalize(), so it applies to all alert loggers
+ * and doesn't need rule changes like threshold does. Alerts with the
+ * same signature, source, destination, destination port and protocol
+ * are folded into a window of detect.alert-aggregation.window seconds,
+ * counted from the first alert. The first alert of a window is logged as
+ * usual, the others are removed from the packet. When the window closes
+ * and more than one alert was seen, its summary (count, first, last) is
+ * attached to the packet being handled at that time, for the loggers
+ * that support it.
+ *
+ * The windows are kept in a bounded per thread table. Windows are closed
+ * when the next matching alert comes in after the window, when the entry
+ * is needed for a new window, or by a small sweep done on every packet.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-alert.h"
+#include "detect-engine-alert-aggregate.h"
+#include "counters.h"
+#include "util-hash-lookup3.h"
+#include "util-debug.h"
+
+/** entries per bucket */
+#define ALERT_AGG_WAYS  4
+/** entries checked for expiry per packet */
+#define ALERT_AGG_SWEEP 8
+
+typedef struct AlertAggregateTable_ {
+    /** buckets * ALERT_AGG_WAYS entries, s is NULL for unused ones */
+    PacketAlertAggregate *entries;
+    uint32_t buckets;
+    uint32_t window;
+    uint32_t sweep_idx;
+} AlertAggregateTable;
+
+/** \brief read detect.alert-aggregation into the de_ctx */
+void AlertAggregateConfig(DetectEngineCtx *de_ctx)
+{
+    int enabled = 0;
+    intmax_t value;
+
+    de_ctx->alert_agg_window = 0;
+    de_ctx->alert_agg_size = ALERT_AGG_DEFAULT_SIZE;
+
+    if (ConfGetBool("detect.alert-aggregation.enabled", &enabled) != 1 ||
+        !enabled)
+        return;
+
+    uint32_t window = ALERT_AGG_DEFAULT_WINDOW;
+    if (ConfGetInt("detect.alert-aggregation.window", &value) == 1) {
+        if (value < 1 || value > 86400) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "detect.alert-aggregation.window: %"PRIdMAX", using %u",
+                    value, ALERT_AGG_DEFAULT_WINDOW);
+        } else {
+            window = (uint32_t)value;
+        }
+    }
+    if (ConfGetInt("detect.alert-aggregation.table-size", &value) == 1) {
+        if (value < ALERT_AGG_WAYS || value > (1 << 24)) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "detect.alert-aggregation.table-size: %"PRIdMAX", using %u",
+                    value, ALERT_AGG_DEFAULT_SIZE);
+        } else {
+            de_ctx->alert_agg_size = (uint32_t)value;
+        }
+    }
+    de_ctx->alert_agg_window = window;
+
+    SCLogConfig("alert aggregation: %u second windows, %u entries per thread",
+            de_ctx->alert_agg_window, de_ctx->alert_agg_size);
+}
+
+int AlertAggregateThreadInit(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx)
+{
+    if (de_ctx->alert_agg_window == 0)
+        return 0;
+
+    AlertAggregateTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL))
+        return -1;
+
+    t->buckets = de_ctx->alert_agg_size / ALERT_AGG_WAYS;
+    t->window = de_ctx->alert_agg_window;
+    t->entries = SCCalloc(t->buckets * ALERT_AGG_WAYS, sizeof(*t->entries));
+    if (unlikely(t->entries == NULL)) {
+        SCFree(t);
+        return -1;
+    }
+    det_ctx->alert_agg = t;
+    return 0;
+}
+
+void AlertAggregateThreadDeinit(DetectEngineThreadCtx *det_ctx)
+{
+    AlertAggregateTable *t = det_ctx->alert_agg;
+    if (t == NULL)
+        return;
+
+    SCFree(t->entries);
+    SCFree(t);
+    det_ctx->alert_agg = NULL;
+}
+
+static inline uint32_t AlertAggregateHash(const Signature *s, const Packet *p)
+{
+    uint32_t key[10];
+
+    key[0] = s->num;
+    key[1] = ((uint32_t)p->proto << 16) | p->dp;
+    memcpy(&key[2], p->src.addr_data32, 16);
+    memcpy(&key[6], p->dst.addr_data32, 16);
+    return hashword(key, 10, 0);
+}
+
+static inline int AlertAggregateMatch(const PacketAlertAggregate *e,
+        const Signature *s, const Packet *p)
+{
+    return (e->s == s && e->dp == p->dp && e->proto == p->proto &&
+            e->src.family == p->src.family &&
+            memcmp(e->src.addr_data32, p->src.addr_data32, 16) == 0 &&
+            memcmp(e->dst.addr_data32, p->dst.addr_data32, 16) == 0);
+}
+
+/** \internal
+ *  \brief close the window of entry 'e'
+ *
+ *  If it aggregated more than the logged alert, its summary is added to
+ *  the packet. If the packet has no room left the summary is lost.
+ */
+static void AlertAggregateClose(Packet *p, PacketAlertAggregate *e)
+{
+    if (e->count > 1) {
+        if (p->alerts.agg == NULL) {
+            p->alerts.agg = SCMalloc(PACKET_ALERT_AGG_MAX * sizeof(*p->alerts.agg));
+        }
+        if (p->alerts.agg != NULL && p->alerts.agg_cnt < PACKET_ALERT_AGG_MAX) {
+            p->alerts.agg[p->alerts.agg_cnt++] = *e;
+        }
+    }
+    e->s = NULL;
+}
+
+static inline int AlertAggregateExpired(const AlertAggregateTable *t,
+        const PacketAlertAggregate *e, const Packet *p)
+{
+    return (p->ts.tv_sec - e->first.tv_sec >= (time_t)t->window);
+}
+
+/** \internal
+ *  \brief close some expired windows, so their summaries don't wait for
+ *         the next matching alert */
+static void AlertAggregateSweep(AlertAggregateTable *t, Packet *p)
+{
+    const uint32_t n = t->buckets * ALERT_AGG_WAYS;
+    uint32_t i;
+
+    for (i = 0; i < ALERT_AGG_SWEEP; i++) {
+        if (p->alerts.agg_cnt >= PACKET_ALERT_AGG_MAX)
+            break;
+
+        PacketAlertAggregate *e = &t->entries[t->sweep_idx];
+        if (++t->sweep_idx == n)
+            t->sweep_idx = 0;
+
+        if (e->s != NULL && AlertAggregateExpired(t, e, p))
+            AlertAggregateClose(p, e);
+    }
+}
+
+/** \internal
+ *  \brief start a new window for the alert of signature 's' */
+static void AlertAggregateStart(PacketAlertAggregate *e, const Signature *s,
+        const Packet *p)
+{
+    e->s = s;
+    COPY_ADDRESS(&p->src, &e->src);
+    COPY_ADDRESS(&p->dst, &e->dst);
+    e->sp = p->sp;
+    e->dp = p->dp;
+    e->proto = p->proto;
+    e->count = 1;
+    e->first = p->ts;
+    e->last = p->ts;
+}
+
+/** \brief fold the packet's alerts into the aggregation windows
+ *
+ *  Alerts that fall in an open window are removed from the packet.
+ */
+void AlertAggregatePacket(DetectEngineThreadCtx *det_ctx, Packet *p)
+{
+    AlertAggregateTable *t = det_ctx->alert_agg;
+    uint32_t aggregated = 0;
+
+    p->alerts.agg_cnt = 0;
+    AlertAggregateSweep(t, p);
+
+    if (p->alerts.cnt == 0 || !(PKT_IS_IPV4(p) || PKT_IS_IPV6(p)))
+        return;
+
+    uint16_t i = 0;
+    while (i < p->alerts.cnt) {
+        const Signature *s = p->alerts.alerts[i].s;
+        PacketAlertAggregate *bucket = &t->entries[
+            (AlertAggregateHash(s, p) % t->buckets) * ALERT_AGG_WAYS];
+        PacketAlertAggregate *victim = NULL;
+        int w;
+
+        for (w = 0; w < ALERT_AGG_WAYS; w++) {
+            PacketAlertAggregate *e = &bucket[w];
+            if (e->s == NULL) {
+                if (victim == NULL || victim->s != NULL)
+                    victim = e;
+                continue;
+            }
+            if (AlertAggregateMatch(e, s, p))
+                break;
+            /* evict the least recently updated if there is no free way */
+            if (victim == NULL || (victim->s != NULL &&
+                    timercmp(&e->last, &victim->last, <)))
+                victim = e;
+        }
+
+        if (w < ALERT_AGG_WAYS) {
+            PacketAlertAggregate *e = &bucket[w];
+            if (!AlertAggregateExpired(t, e, p)) {
+                e->count++;
+                e->last = p->ts;
+                PacketAlertRemove(p, i);
+                aggregated++;
+                continue;
+            }
+            victim = e;
+        }
+
+        if (victim->s != NULL)
+            AlertAggregateClose(p, victim);
+        AlertAggregateStart(victim, s, p);
+        i++;
+    }
+
+    if (aggregated > 0 && det_ctx->tv != NULL)
+        StatsAddUI64(det_ctx->tv, det_ctx->counter_alerts_aggregated, aggregated);
+}
+
+#ifdef UNITTESTS
+#include "detect-parse.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+/** \test duplicates within the window are removed, the summary comes
+ *        with the first alert after it */
+static int AlertAggregateTest01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    Packet *p = UTHBuildPacketReal((uint8_t *)"A", 1, IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.2", 1024, 80);
+    FAIL_IF_NULL(p);
+    Packet *p2 = UTHBuildPacketReal((uint8_t *)"A", 1, IPPROTO_TCP,
+            "1.1.1.1", "2.2.2.3", 1024, 80);
+    FAIL_IF_NULL(p2);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->alert_agg_window = 60;
+    de_ctx->alert_agg_size = 16;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"A\"; sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx->alert_agg);
+
+    /* first one is logged */
+    p->ts.tv_sec = 1000;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 1);
+
+    /* then folded into the window */
+    p->ts.tv_sec = 1010;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 0);
+    p->ts.tv_sec = 1020;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 0);
+
+    /* other destination is another window */
+    p2->ts.tv_sec = 1030;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 1) == 1);
+
+    /* window is over: logged again and the summary is attached */
+    p->ts.tv_sec = 1060;
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1) == 1);
+    FAIL_IF_NOT(p->alerts.agg_cnt == 1);
+    FAIL_IF_NOT(p->alerts.agg[0].count == 3);
+    FAIL_IF_NOT(p->alerts.agg[0].first.tv_sec == 1000);
+    FAIL_IF_NOT(p->alerts.agg[0].last.tv_sec == 1020);
+    FAIL_IF_NOT(p->alerts.agg[0].s->id == 1);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void AlertAggregateRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AlertAggregateTest01", AlertAggregateTest01);
+#endif /* UNITTESTS */
+}
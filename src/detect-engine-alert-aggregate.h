@@ -0,0 +1,40 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aggregation of identical alerts before output
+ */
+
+#ifndef __DETECT_ENGINE_ALERT_AGGREGATE_H__
+#define __DETECT_ENGINE_ALERT_AGGREGATE_H__
+
+#define ALERT_AGG_DEFAULT_WINDOW    60
+#define ALERT_AGG_DEFAULT_SIZE      4096
+
+void AlertAggregateConfig(DetectEngineCtx *de_ctx);
+
+int AlertAggregateThreadInit(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx);
+void AlertAggregateThreadDeinit(DetectEngineThreadCtx *det_ctx);
+
+void AlertAggregatePacket(DetectEngineThreadCtx *det_ctx, Packet *p);
+
+void AlertAggregateRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_ALERT_AGGREGATE_H__ */
@@ -28,6 +28,7 @@
 #include "flow-private.h"
 
 #include "util-profiling.h"
+#include "counters.h"
 
 /** tag signature we use for tag alerts */
 static Signature g_tag_signature;
@@ -168,7 +169,7 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
         return 0;
     }
 
-    for (i = pos; i <= p->alerts.cnt - 1; i++) {
+    for (i = pos; i + 1 < p->alerts.cnt; i++) {
         memcpy(&p->alerts.alerts[i], &p->alerts.alerts[i + 1], sizeof(PacketAlert));
     }
 
@@ -178,7 +179,34 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
     return match;
 }
 
+/** \internal
+ *  \brief make room for more alerts in the packet
+ *
+ *  The array starts small and doubles up to max. It stays with the
+ *  packet, so recycled packets only allocate again if they get more
+ *  alerts than any packet before.
+ *
+ *  \retval 0 ok
+ *  \retval -1 no memory
+ */
+static int PacketAlertGrow(Packet *p, uint16_t max)
+{
+    uint32_t size = p->alerts.size ? (uint32_t)p->alerts.size * 2 : 4;
+    if (size > max)
+        size = max;
+
+    PacketAlert *ptmp = SCRealloc(p->alerts.alerts, size * sizeof(PacketAlert));
+    if (ptmp == NULL)
+        return -1;
+
+    p->alerts.alerts = ptmp;
+    p->alerts.size = (uint16_t)size;
+    return 0;
+}
+
 /** \brief append a signature match to a packet
+ *
+ *  Alerts are ordered by PacketAlertFinalize() instead of here.
  *
  *  \param det_ctx thread detection engine ctx
  *  \param s the signature that matched
@@ -188,37 +216,27 @@ int PacketAlertRemove(Packet *p, uint16_t pos)
  */
 int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, Signature *s, Packet *p, uint64_t tx_id, uint8_t flags)
 {
-    int i = 0;
-
-    if (p->alerts.cnt == PACKET_ALERT_MAX)
+    uint16_t max = det_ctx->de_ctx->packet_alert_max;
+    if (max == 0)
+        max = PACKET_ALERT_MAX;
+
+    if (p->alerts.cnt >= max ||
+        (p->alerts.cnt == p->alerts.size && PacketAlertGrow(p, max) != 0))
+    {
+        SCLogDebug("no room for sid %"PRIu32, s->id);
+        if (det_ctx->tv != NULL)
+            StatsIncr(det_ctx->tv, det_ctx->counter_alerts_overflow);
         return 0;
+    }
 
     SCLogDebug("sid %"PRIu32"", s->id);
 
-    /* It should be usually the last, so check it before iterating */
-    if (p->alerts.cnt == 0 || (p->alerts.cnt > 0 &&
-                               p->alerts.alerts[p->alerts.cnt - 1].num < s->num)) {
-        /* We just add it */
-        p->alerts.alerts[p->alerts.cnt].num = s->num;
-        p->alerts.alerts[p->alerts.cnt].action = s->action;
-        p->alerts.alerts[p->alerts.cnt].flags = flags;
-        p->alerts.alerts[p->alerts.cnt].s = s;
-        p->alerts.alerts[p->alerts.cnt].tx_id = tx_id;
-    } else {
-        /* We need to make room for this s->num
-         (a bit ugly with memcpy but we are planning changes here)*/
-        for (i = p->alerts.cnt - 1; i >= 0 && p->alerts.alerts[i].num > s->num; i--) {
-            memcpy(&p->alerts.alerts[i + 1], &p->alerts.alerts[i], sizeof(PacketAlert));
-        }
-
-        i++; /* The right place to store the alert */
-
-        p->alerts.alerts[i].num = s->num;
-        p->alerts.alerts[i].action = s->action;
-        p->alerts.alerts[i].flags = flags;
-        p->alerts.alerts[i].s = s;
-        p->alerts.alerts[i].tx_id = tx_id;
-    }
+    PacketAlert *pa = &p->alerts.alerts[p->alerts.cnt];
+    pa->num = s->num;
+    pa->action = s->action;
+    pa->flags = flags;
+    pa->s = s;
+    pa->tx_id = tx_id;
 
     /* Update the count */
     p->alerts.cnt++;
@@ -226,6 +244,30 @@ int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, Signature *s, Packet *p, u
     return 0;
 }
 
+/** \internal
+ *  \brief order the alerts by signature num, which is the action
+ *         priority/order. Alerts are mostly appended in order, so an
+ *         insertion sort is close to a single pass.
+ */
+static void PacketAlertSort(Packet *p)
+{
+    PacketAlert * const alerts = p->alerts.alerts;
+    uint16_t i;
+
+    for (i = 1; i < p->alerts.cnt; i++) {
+        if (alerts[i - 1].num <= alerts[i].num)
+            continue;
+
+        PacketAlert tmp = alerts[i];
+        uint16_t j = i;
+        while (j > 0 && alerts[j - 1].num > tmp.num) {
+            alerts[j] = alerts[j - 1];
+            j--;
+        }
+        alerts[j] = tmp;
+    }
+}
+
 /**
  * \brief Check the threshold of the sigs that match, set actions, break on pass action
  *        This function iterate the packet alerts array, removing those that didn't match
@@ -242,6 +284,8 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     Signature *s = NULL;
     SigMatch *sm = NULL;
 
+    PacketAlertSort(p);
+
     while (i < p->alerts.cnt) {
         SCLogDebug("Sig->num: %"PRIu16, p->alerts.alerts[i].num);
         s = de_ctx->sig_array[p->alerts.alerts[i].num];
@@ -324,6 +368,10 @@ void PacketAlertFinalize(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
         }
     }
 
+    /* remembered for conditional pcap logging */
+    if (p->alerts.cnt > 0 && p->flow != NULL)
+        p->flow->flags |= FLOW_HAS_ALERTS;
+
     /* At this point, we should have all the new alerts. Now check the tag
      * keyword context for sessions and hosts */
     if (!(p->flags & PKT_PSEUDO_STREAM_END))
@@ -35,6 +35,11 @@
 #include "detect-flow.h"
 #include "detect-flags.h"
 #include "util-print.h"
+#include "util-hashlist.h"
+#include "util-memcmp.h"
+#include "util-mpm.h"
+#include "decode.h"
+#include "counters.h"
 
 static int rule_warnings_only = 0;
 static FILE *rule_engine_analysis_FD = NULL;
@@ -943,3 +948,680 @@ void EngineAnalysisRules(const Signature *s, const char *line)
     }
     return;
 }
+
+/*
+ * Fast pattern profile
+ *
+ * Replays a pcap through a single mpm holding the fast patterns and the
+ * other positive contents of all rules and reports the rules whose fast
+ * pattern is weak, too common on the replayed traffic or missing. Each
+ * packet payload is scanned as a whole: offset/depth and the buffer the
+ * content is for are ignored, so the hit rates are an upper bound for
+ * the app layer lists.
+ */
+
+#define FP_PROFILE_WEAK_STRENGTH        16
+#define FP_PROFILE_MAX_RULES_DEFAULT    100
+#define FP_PROFILE_COMMON_DEFAULT       1.0
+
+#define FP_PROFILE_ISSUE_MISSING    0x01
+#define FP_PROFILE_ISSUE_WEAK       0x02
+#define FP_PROFILE_ISSUE_COMMON     0x04
+
+/** unique pattern of the rule set */
+typedef struct FpProfilePattern_ {
+    uint8_t *content;
+    uint16_t content_len;
+    uint8_t nocase;
+    uint32_t id;
+    uint64_t last_pkt;      /**< last packet the pattern was found in */
+    uint64_t last_cand;     /**< last packet the fp rules were counted for */
+    uint64_t hits;          /**< number of packets the pattern was found in */
+    uint32_t *fp_rules;     /**< rules using the pattern as fast pattern */
+    uint32_t fp_rules_cnt;
+} FpProfilePattern;
+
+typedef struct FpProfileRule_ {
+    const Signature *s;
+    FpProfilePattern *fp;   /**< NULL if the rule has no usable fast pattern */
+    int fp_list;
+    FpProfilePattern **others;  /**< the other positive contents */
+    int *others_list;
+    uint16_t others_cnt;
+    uint16_t keywords;      /**< keywords to verify per candidate */
+    uint64_t candidates;    /**< packets the fast pattern was found in */
+    uint64_t confirmed;     /**< candidates with all other contents present */
+    uint64_t cost;
+    uint8_t issues;
+} FpProfileRule;
+
+typedef struct FpProfileCtx_ {
+    uint16_t mpm_matcher;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    HashListTable *hash;
+    FpProfilePattern **patterns;    /**< by id, owned by the hash */
+    uint32_t patterns_cnt;
+    uint32_t patterns_size;
+    FpProfileRule *rules;
+    uint32_t rules_cnt;
+    uint64_t packets;               /**< packets with payload */
+} FpProfileCtx;
+
+static uint32_t FpProfilePatternHash(HashListTable *ht, void *data, uint16_t len)
+{
+    const FpProfilePattern *p = data;
+    uint32_t hash = p->nocase;
+    uint16_t u;
+    for (u = 0; u < p->content_len; u++)
+        hash = hash * 31 + (p->nocase ? u8_tolower(p->content[u]) : p->content[u]);
+    return hash % ht->array_size;
+}
+
+static char FpProfilePatternCompare(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const FpProfilePattern *p1 = data1;
+    const FpProfilePattern *p2 = data2;
+    if (p1->nocase != p2->nocase || p1->content_len != p2->content_len)
+        return 0;
+    if (p1->nocase)
+        return SCMemcmpLowercase(p1->content, p2->content, p1->content_len) == 0;
+    return SCMemcmp(p1->content, p2->content, p1->content_len) == 0;
+}
+
+static void FpProfilePatternFree(void *data)
+{
+    FpProfilePattern *p = data;
+    if (p->fp_rules != NULL)
+        SCFree(p->fp_rules);
+    SCFree(p->content);
+    SCFree(p);
+}
+
+/** \internal
+ *  \brief get the pattern from the ctx, adding it if it's new */
+static FpProfilePattern *FpProfileGetPattern(FpProfileCtx *ctx,
+        const uint8_t *content, uint16_t content_len, uint8_t nocase)
+{
+    FpProfilePattern lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.content = (uint8_t *)content;
+    lookup.content_len = content_len;
+    lookup.nocase = nocase;
+
+    FpProfilePattern *p = HashListTableLookup(ctx->hash, &lookup, 0);
+    if (p != NULL)
+        return p;
+
+    if (ctx->patterns_cnt == ctx->patterns_size) {
+        uint32_t size = ctx->patterns_size ? ctx->patterns_size * 2 : 1024;
+        FpProfilePattern **ptrs = SCRealloc(ctx->patterns, size * sizeof(*ptrs));
+        if (unlikely(ptrs == NULL))
+            return NULL;
+        ctx->patterns = ptrs;
+        ctx->patterns_size = size;
+    }
+
+    p = SCCalloc(1, sizeof(*p));
+    if (unlikely(p == NULL))
+        return NULL;
+    p->content = SCMalloc(content_len);
+    if (unlikely(p->content == NULL)) {
+        SCFree(p);
+        return NULL;
+    }
+    memcpy(p->content, content, content_len);
+    p->content_len = content_len;
+    p->nocase = nocase;
+    p->id = ctx->patterns_cnt;
+
+    if (HashListTableAdd(ctx->hash, p, 0) != 0) {
+        FpProfilePatternFree(p);
+        return NULL;
+    }
+    ctx->patterns[ctx->patterns_cnt++] = p;
+
+    /* the pattern id doubles as 'sid', so the matches in the pmq are
+     * the pattern ids */
+    if (nocase)
+        MpmAddPatternCI(&ctx->mpm_ctx, p->content, content_len, 0, 0, p->id, p->id, 0);
+    else
+        MpmAddPatternCS(&ctx->mpm_ctx, p->content, content_len, 0, 0, p->id, p->id, 0);
+    return p;
+}
+
+/** \internal
+ *  \brief add a rule: its fast pattern and other positive contents */
+static int FpProfileAddRule(FpProfileCtx *ctx, FpProfileRule *r, const Signature *s)
+{
+    uint32_t rule_id = r - ctx->rules;
+    r->s = s;
+    r->fp_list = -1;
+
+    const DetectContentData *fp_cd = NULL;
+    if (s->mpm_sm != NULL) {
+        fp_cd = (DetectContentData *)s->mpm_sm->ctx;
+        /* a negated fast pattern doesn't filter the rule */
+        if (fp_cd->flags & DETECT_CONTENT_NEGATED)
+            fp_cd = NULL;
+    }
+
+    int list;
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        const SigMatch *sm;
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+            r->keywords++;
+            if (sm->type != DETECT_CONTENT || sm == s->mpm_sm)
+                continue;
+            const DetectContentData *cd = (DetectContentData *)sm->ctx;
+            if (cd->flags & DETECT_CONTENT_NEGATED)
+                continue;
+            r->others_cnt++;
+        }
+    }
+
+    if (r->others_cnt > 0) {
+        r->others = SCCalloc(r->others_cnt, sizeof(*r->others));
+        r->others_list = SCCalloc(r->others_cnt, sizeof(*r->others_list));
+        if (unlikely(r->others == NULL || r->others_list == NULL))
+            return -1;
+
+        uint16_t i = 0;
+        for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+            const SigMatch *sm;
+            for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+                if (sm->type != DETECT_CONTENT || sm == s->mpm_sm)
+                    continue;
+                const DetectContentData *cd = (DetectContentData *)sm->ctx;
+                if (cd->flags & DETECT_CONTENT_NEGATED)
+                    continue;
+                r->others[i] = FpProfileGetPattern(ctx, cd->content, cd->content_len,
+                        (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0);
+                if (r->others[i] == NULL)
+                    return -1;
+                r->others_list[i++] = list;
+            }
+        }
+    }
+
+    if (fp_cd == NULL)
+        return 0;
+
+    const uint8_t *content = fp_cd->content;
+    uint16_t content_len = fp_cd->content_len;
+    if (fp_cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP) {
+        content += fp_cd->fp_chop_offset;
+        content_len = fp_cd->fp_chop_len;
+    }
+    r->fp = FpProfileGetPattern(ctx, content, content_len,
+            (fp_cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0);
+    if (r->fp == NULL)
+        return -1;
+    r->fp_list = SigMatchListSMBelongsTo(s, s->mpm_sm);
+
+    uint32_t *fp_rules = SCRealloc(r->fp->fp_rules,
+            (r->fp->fp_rules_cnt + 1) * sizeof(*fp_rules));
+    if (unlikely(fp_rules == NULL))
+        return -1;
+    fp_rules[r->fp->fp_rules_cnt++] = rule_id;
+    r->fp->fp_rules = fp_rules;
+    return 0;
+}
+
+static void FpProfileCtxFree(FpProfileCtx *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    uint32_t i;
+    if (ctx->rules != NULL) {
+        for (i = 0; i < ctx->rules_cnt; i++) {
+            if (ctx->rules[i].others != NULL)
+                SCFree(ctx->rules[i].others);
+            if (ctx->rules[i].others_list != NULL)
+                SCFree(ctx->rules[i].others_list);
+        }
+        SCFree(ctx->rules);
+    }
+    if (ctx->patterns != NULL)
+        SCFree(ctx->patterns);
+    if (ctx->hash != NULL)
+        HashListTableFree(ctx->hash);
+
+    PmqFree(&ctx->pmq);
+    if (mpm_table[ctx->mpm_matcher].DestroyThreadCtx != NULL)
+        mpm_table[ctx->mpm_matcher].DestroyThreadCtx(NULL, &ctx->mpm_thread_ctx);
+    mpm_table[ctx->mpm_matcher].DestroyCtx(&ctx->mpm_ctx);
+    SCFree(ctx);
+}
+
+static FpProfileCtx *FpProfileCtxInit(const DetectEngineCtx *de_ctx)
+{
+    FpProfileCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+
+    ctx->mpm_matcher = de_ctx->mpm_matcher;
+    MpmInitCtx(&ctx->mpm_ctx, ctx->mpm_matcher);
+    MpmInitThreadCtx(&ctx->mpm_thread_ctx, ctx->mpm_matcher);
+    if (PmqSetup(&ctx->pmq) != 0)
+        goto error;
+
+    ctx->hash = HashListTableInit(4096, FpProfilePatternHash,
+            FpProfilePatternCompare, FpProfilePatternFree);
+    if (ctx->hash == NULL)
+        goto error;
+
+    const Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next)
+        ctx->rules_cnt++;
+    if (ctx->rules_cnt == 0)
+        return ctx;
+
+    ctx->rules = SCCalloc(ctx->rules_cnt, sizeof(*ctx->rules));
+    if (unlikely(ctx->rules == NULL))
+        goto error;
+
+    uint32_t i = 0;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (FpProfileAddRule(ctx, &ctx->rules[i++], s) != 0)
+            goto error;
+    }
+
+    if (ctx->patterns_cnt > 0)
+        mpm_table[ctx->mpm_matcher].Prepare(&ctx->mpm_ctx);
+    return ctx;
+
+error:
+    FpProfileCtxFree(ctx);
+    return NULL;
+}
+
+/** \internal
+ *  \brief scan a payload, count the pattern hits and the candidates */
+static void FpProfileScan(FpProfileCtx *ctx, const uint8_t *buf, uint16_t buflen)
+{
+    if (buflen == 0)
+        return;
+
+    const uint64_t pkt = ++ctx->packets;
+    if (ctx->patterns_cnt == 0)
+        return;
+
+    PmqReset(&ctx->pmq);
+    (void)mpm_table[ctx->mpm_matcher].Search(&ctx->mpm_ctx, &ctx->mpm_thread_ctx,
+            &ctx->pmq, buf, buflen);
+
+    uint32_t i;
+    for (i = 0; i < ctx->pmq.rule_id_array_cnt; i++) {
+        FpProfilePattern *p = ctx->patterns[ctx->pmq.rule_id_array[i]];
+        if (p->last_pkt != pkt) {
+            p->last_pkt = pkt;
+            p->hits++;
+        }
+    }
+
+    /* all hits are marked, now the rules using them as fast pattern can
+     * be checked for their other contents */
+    for (i = 0; i < ctx->pmq.rule_id_array_cnt; i++) {
+        FpProfilePattern *p = ctx->patterns[ctx->pmq.rule_id_array[i]];
+        if (p->last_cand == pkt)
+            continue;
+        p->last_cand = pkt;
+
+        uint32_t r;
+        for (r = 0; r < p->fp_rules_cnt; r++) {
+            FpProfileRule *rule = &ctx->rules[p->fp_rules[r]];
+            rule->candidates++;
+
+            uint16_t o;
+            for (o = 0; o < rule->others_cnt; o++) {
+                if (rule->others[o]->last_pkt != pkt)
+                    break;
+            }
+            if (o == rule->others_cnt)
+                rule->confirmed++;
+        }
+    }
+}
+
+/** \internal
+ *  \brief pick the other content that was found least, if it beats the
+ *         current fast pattern
+ *
+ *  \retval idx index in rule::others or -1 if there is no better one
+ */
+static int FpProfileSuggest(const FpProfileRule *r)
+{
+    int best = -1;
+    uint16_t o;
+    for (o = 0; o < r->others_cnt; o++) {
+        const FpProfilePattern *p = r->others[o];
+        if (r->fp != NULL && p->hits >= r->fp->hits)
+            continue;
+        if (best == -1 || p->hits < r->others[best]->hits ||
+                (p->hits == r->others[best]->hits &&
+                 PatternStrength(p->content, p->content_len) >
+                 PatternStrength(r->others[best]->content, r->others[best]->content_len)))
+        {
+            best = o;
+        }
+    }
+    return best;
+}
+
+/** \internal
+ *  \brief set the cost and issues of the rules
+ *
+ *  The cost is the number of keyword verifications the rule took, rules
+ *  without fast pattern are verified for each packet. */
+static void FpProfileRate(FpProfileCtx *ctx, double common)
+{
+    uint32_t i;
+    for (i = 0; i < ctx->rules_cnt; i++) {
+        FpProfileRule *r = &ctx->rules[i];
+        r->issues = 0;
+
+        if (r->fp == NULL) {
+            r->issues |= FP_PROFILE_ISSUE_MISSING;
+            r->cost = ctx->packets * r->keywords;
+            continue;
+        }
+
+        r->cost = r->candidates * r->keywords;
+        if (PatternStrength(r->fp->content, r->fp->content_len) < FP_PROFILE_WEAK_STRENGTH)
+            r->issues |= FP_PROFILE_ISSUE_WEAK;
+        if (ctx->packets > 0 &&
+                (double)r->fp->hits * 100.0 / (double)ctx->packets >= common)
+            r->issues |= FP_PROFILE_ISSUE_COMMON;
+    }
+}
+
+static int FpProfileRuleCompare(const void *a, const void *b)
+{
+    const FpProfileRule *r1 = *(const FpProfileRule **)a;
+    const FpProfileRule *r2 = *(const FpProfileRule **)b;
+    if (r1->cost != r2->cost)
+        return r1->cost > r2->cost ? -1 : 1;
+    return r1->s->id < r2->s->id ? -1 : (r1->s->id > r2->s->id);
+}
+
+static void FpProfilePrintPattern(FILE *fp, const char *label, int list,
+        const FpProfilePattern *p, uint64_t packets)
+{
+    fprintf(fp, "    %s: %s \"", label, DetectSigmatchListEnumToString(list));
+    PrintRawUriFp(fp, p->content, p->content_len);
+    fprintf(fp, "\"%s, strength %u, found in %"PRIu64" packets (%.2f%%)\n",
+            p->nocase ? " nocase" : "",
+            PatternStrength(p->content, p->content_len), p->hits,
+            packets ? (double)p->hits * 100.0 / (double)packets : 0.0);
+}
+
+static void FpProfileReport(FpProfileCtx *ctx, FILE *fp, const char *pcap,
+        uint32_t max_rules, double common)
+{
+    uint32_t i, cnt = 0;
+    FpProfileRule **ranked = SCCalloc(ctx->rules_cnt + 1, sizeof(*ranked));
+    if (unlikely(ranked == NULL))
+        return;
+    for (i = 0; i < ctx->rules_cnt; i++) {
+        if (ctx->rules[i].issues != 0)
+            ranked[cnt++] = &ctx->rules[i];
+    }
+    qsort(ranked, cnt, sizeof(*ranked), FpProfileRuleCompare);
+
+    fprintf(fp, "Pcap: %s\n", pcap);
+    fprintf(fp, "Packets with payload: %"PRIu64"\n", ctx->packets);
+    fprintf(fp, "Rules: %u, unique patterns: %u\n", ctx->rules_cnt, ctx->patterns_cnt);
+    fprintf(fp, "Rules with issues: %u, listing the %u costliest\n",
+            cnt, MIN(cnt, max_rules));
+    fprintf(fp, "Issues: missing (no fast pattern), weak (strength below %u), "
+            "common (found in %.2f%% of the packets or more)\n",
+            FP_PROFILE_WEAK_STRENGTH, common);
+    fprintf(fp, "Patterns are counted anywhere in the packet payload\n\n");
+
+    for (i = 0; i < cnt && i < max_rules; i++) {
+        const FpProfileRule *r = ranked[i];
+        fprintf(fp, "== Sid: %u ==\n", r->s->id);
+        fprintf(fp, "    Issues:%s%s%s\n",
+                (r->issues & FP_PROFILE_ISSUE_MISSING) ? " missing" : "",
+                (r->issues & FP_PROFILE_ISSUE_WEAK) ? " weak" : "",
+                (r->issues & FP_PROFILE_ISSUE_COMMON) ? " common" : "");
+        if (r->fp != NULL) {
+            FpProfilePrintPattern(fp, "Fast pattern", r->fp_list, r->fp, ctx->packets);
+            fprintf(fp, "    Candidates: %"PRIu64", all contents present in %"PRIu64
+                    " (%.2f%% false positives)\n", r->candidates, r->confirmed,
+                    r->candidates ? (double)(r->candidates - r->confirmed) * 100.0 /
+                    (double)r->candidates : 0.0);
+        } else {
+            fprintf(fp, "    Fast pattern: none, rule is inspected for every packet\n");
+        }
+        fprintf(fp, "    Keywords per candidate: %u, estimated cost: %"PRIu64"\n",
+                r->keywords, r->cost);
+
+        int best = FpProfileSuggest(r);
+        if (best >= 0) {
+            FpProfilePrintPattern(fp, "Suggested fast pattern",
+                    r->others_list[best], r->others[best], ctx->packets);
+        }
+        fprintf(fp, "\n");
+    }
+    SCFree(ranked);
+}
+
+/** \internal
+ *  \brief decode the packets of a pcap and scan their payloads */
+static int FpProfileReplay(FpProfileCtx *ctx, const char *pcap)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, uint8_t *, uint16_t, PacketQueue *);
+
+    pcap_t *handle = pcap_open_offline(pcap, errbuf);
+    if (handle == NULL) {
+        SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "fast pattern profile: opening %s "
+                "failed: %s", pcap, errbuf);
+        return -1;
+    }
+
+    int datalink = pcap_datalink(handle);
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            Decoder = DecodeSll;
+            break;
+        case LINKTYPE_ETHERNET:
+            Decoder = DecodeEthernet;
+            break;
+        case LINKTYPE_PPP:
+            Decoder = DecodePPP;
+            break;
+        case LINKTYPE_RAW:
+            Decoder = DecodeRaw;
+            break;
+        case LINKTYPE_NULL:
+            Decoder = DecodeNull;
+            break;
+        default:
+            SCLogError(SC_ERR_UNIMPLEMENTED, "fast pattern profile: datalink "
+                    "type %d not supported", datalink);
+            pcap_close(handle);
+            return -1;
+    }
+
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    strlcpy(tv.name, "FpProfile", sizeof(tv.name));
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(&tv);
+    if (dtv == NULL) {
+        pcap_close(handle);
+        return -1;
+    }
+    DecodeRegisterPerfCounters(dtv, &tv);
+    StatsSetupPrivate(&tv);
+
+    PacketQueue pq;
+    memset(&pq, 0, sizeof(pq));
+
+    struct pcap_pkthdr *hdr;
+    const u_char *data;
+    int r;
+    while ((r = pcap_next_ex(handle, &hdr, &data)) == 1) {
+        Packet *p = PacketGetFromAlloc();
+        if (unlikely(p == NULL))
+            break;
+        p->datalink = datalink;
+        p->ts.tv_sec = hdr->ts.tv_sec;
+        p->ts.tv_usec = hdr->ts.tv_usec;
+        if (PacketCopyData(p, (uint8_t *)data, hdr->caplen) == 0) {
+            (void)Decoder(&tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+            FpProfileScan(ctx, p->payload, p->payload_len);
+        }
+
+        /* tunneled and reassembled packets */
+        Packet *extra;
+        while ((extra = PacketDequeue(&pq)) != NULL) {
+            FpProfileScan(ctx, extra->payload, extra->payload_len);
+            PacketFreeOrRelease(extra);
+        }
+        PacketFreeOrRelease(p);
+    }
+    if (r == -1) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "fast pattern profile: reading %s "
+                "failed: %s", pcap, pcap_geterr(handle));
+    }
+
+    StatsThreadCleanup(&tv);
+    DecodeThreadVarsFree(&tv, dtv);
+    pcap_close(handle);
+    return 0;
+}
+
+/**
+ * \brief Profile the fast patterns of the loaded rules on a pcap
+ *
+ * Runs if engine-analysis.fast-pattern-profile.pcap is set and writes a
+ * ranked list of the rules with a missing, weak or common fast pattern
+ * to rules_fast_pattern_profile.txt in the log dir.
+ *
+ * \retval 0 done or not enabled, -1 on error
+ */
+int EngineAnalysisFastPatternProfile(const DetectEngineCtx *de_ctx)
+{
+    ConfNode *conf = ConfGetNode("engine-analysis.fast-pattern-profile");
+    if (conf == NULL)
+        return 0;
+
+    const char *pcap = ConfNodeLookupChildValue(conf, "pcap");
+    if (pcap == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "engine-analysis.fast-pattern-profile "
+                "needs a pcap");
+        return -1;
+    }
+
+    intmax_t max_rules = FP_PROFILE_MAX_RULES_DEFAULT;
+    if (ConfGetChildValueInt(conf, "max-rules", &max_rules) == 1 &&
+            (max_rules < 0 || max_rules > UINT32_MAX)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "engine-analysis.fast-pattern-profile."
+                "max-rules out of range, using %d", FP_PROFILE_MAX_RULES_DEFAULT);
+        max_rules = FP_PROFILE_MAX_RULES_DEFAULT;
+    }
+    double common = FP_PROFILE_COMMON_DEFAULT;
+    const char *val = ConfNodeLookupChildValue(conf, "common-threshold");
+    if (val != NULL)
+        common = atof(val);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", ConfigGetLogDirectory(),
+             "rules_fast_pattern_profile.txt");
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    FpProfileCtx *ctx = FpProfileCtxInit(de_ctx);
+    if (ctx == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    SCLogInfo("profiling %u fast patterns and contents on %s",
+            ctx->patterns_cnt, pcap);
+    int r = FpProfileReplay(ctx, pcap);
+    if (r == 0) {
+        FpProfileRate(ctx, common);
+        FpProfileReport(ctx, fp, pcap, (uint32_t)max_rules, common);
+        SCLogInfo("Engine-Analysis for fast pattern profile printed to file - %s",
+                path);
+    }
+
+    FpProfileCtxFree(ctx);
+    fclose(fp);
+    return r;
+}
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+/** \test weak and common fast pattern, with a better content to suggest */
+static int FpProfileTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"GET\"; fast_pattern; content:\"xyzzy\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(content:\"plugh-magic\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(flags:S; sid:3;)"));
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+
+    FpProfileCtx *ctx = FpProfileCtxInit(de_ctx);
+    FAIL_IF_NULL(ctx);
+    FAIL_IF(ctx->rules_cnt != 3);
+    FAIL_IF(ctx->patterns_cnt != 3);
+
+    uint8_t buf1[] = "GET /index.html HTTP/1.1\r\n";
+    uint8_t buf2[] = "GET /xyzzy HTTP/1.1\r\n";
+    uint8_t buf3[] = "POST /plugh-magic HTTP/1.1\r\n";
+    FpProfileScan(ctx, buf1, sizeof(buf1) - 1);
+    FpProfileScan(ctx, buf1, sizeof(buf1) - 1);
+    FpProfileScan(ctx, buf2, sizeof(buf2) - 1);
+    FpProfileScan(ctx, buf3, sizeof(buf3) - 1);
+    FAIL_IF(ctx->packets != 4);
+
+    FpProfileRate(ctx, 50.0);
+
+    const FpProfileRule *r = NULL;
+    uint32_t i;
+    for (i = 0; i < ctx->rules_cnt; i++) {
+        r = &ctx->rules[i];
+        if (r->s->id == 1) {
+            FAIL_IF(r->candidates != 3);
+            FAIL_IF(r->confirmed != 1);
+            FAIL_IF(r->issues != (FP_PROFILE_ISSUE_WEAK|FP_PROFILE_ISSUE_COMMON));
+            FAIL_IF(FpProfileSuggest(r) != 0);
+        } else if (r->s->id == 2) {
+            FAIL_IF(r->candidates != 1);
+            FAIL_IF(r->issues != 0);
+            FAIL_IF(FpProfileSuggest(r) != -1);
+        } else {
+            FAIL_IF(r->issues != FP_PROFILE_ISSUE_MISSING);
+            FAIL_IF(r->cost != 4);
+        }
+    }
+
+    FpProfileCtxFree(ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void EngineAnalysisRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FpProfileTest01", FpProfileTest01);
+#endif /* UNITTESTS */
+}
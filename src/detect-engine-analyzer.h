@@ -39,4 +39,7 @@ void EngineAnalysisFP(Signature *s, char *line);
 void EngineAnalysisRules(const Signature *s, const char *line);
 void EngineAnalysisRulesFailure(char *line, char *file, int lineno);
 
+int EngineAnalysisFastPatternProfile(const DetectEngineCtx *de_ctx);
+void EngineAnalysisRegisterTests(void);
+
 #endif /* __DETECT_ENGINE_ANALYZER_H__ */
@@ -0,0 +1,625 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast pattern selection from production feedback
+ *
+ * On one in 'sample-rate' packets the detect threads count, per rule, if
+ * its fast pattern hit (the rule is in the pmq) and if the rule matched.
+ * When an engine is freed, on reload or shutdown, the counts are merged
+ * per pattern into the stats file, which accumulates over runs. A pattern
+ * is keyed by its buffer, its case sensitivity and its bytes. Rules that
+ * share a fast pattern in one run count once, with the highest counts of
+ * those rules.
+ *
+ * The next engine build loads the file. RetrieveFPForSig() then avoids
+ * "hot" patterns: patterns that hit on more than 'max-hit-rate' of the
+ * sampled packets while the rule matched on less than half of the hits,
+ * if the rule has another eligible content. Only patterns that were used
+ * as a fast pattern have counts, so a hot pattern is replaced by the next
+ * best static choice, which is measured in the following run.
+ *
+ * File format, one pattern per line:
+ *   <list> <nocase> <hex bytes> <sampled packets> <hits> <confirms>
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-fp-feedback.h"
+#include "detect-content.h"
+#include "util-hashlist.h"
+#include "util-hash-lookup3.h"
+#include "util-conf.h"
+#include "util-path.h"
+#include "util-memcmp.h"
+#include "util-debug.h"
+
+#define FP_FEEDBACK_DEFAULT_FILE        "fast-pattern-stats.log"
+#define FP_FEEDBACK_DEFAULT_RATE        1000
+#define FP_FEEDBACK_DEFAULT_MIN_SAMPLES 10000
+#define FP_FEEDBACK_DEFAULT_MAX_HIT     0.01
+#define FP_FEEDBACK_HASH_SIZE           4096
+/** longest pattern kept in the file */
+#define FP_FEEDBACK_MAX_PATTERN         1024
+
+typedef struct FPFeedbackEntry_ {
+    char *list;             /**< DetectListToString() name */
+    uint8_t nocase;
+    uint16_t content_len;
+    uint8_t *content;
+    uint64_t packets;
+    uint64_t hits;
+    uint64_t confirms;
+} FPFeedbackEntry;
+
+/** \brief fast pattern feedback of an engine */
+typedef struct DetectFPFeedback_ {
+    char path[PATH_MAX];
+    uint32_t sample_rate;
+    uint64_t min_samples;
+    double max_hit_rate;
+
+    /** patterns from the stats file, used by RetrieveFPForSig() */
+    HashListTable *table;
+
+    /** counts merged from the threads, indexed by signature num */
+    SCMutex lock;
+    uint64_t packets;
+    uint64_t *hits;
+    uint64_t *confirms;
+    uint32_t sig_cnt;
+} DetectFPFeedback;
+
+/** serializes the read-merge-write of the stats file between engines */
+static SCMutex g_fp_feedback_file_lock = SCMUTEX_INITIALIZER;
+
+static uint32_t FPFeedbackHashFunc(HashListTable *ht, void *data, uint16_t datalen)
+{
+    const FPFeedbackEntry *e = (const FPFeedbackEntry *)data;
+    uint32_t hash = hashlittle(e->content, e->content_len, e->nocase);
+    hash = hashlittle(e->list, strlen(e->list), hash);
+    return hash % ht->array_size;
+}
+
+static char FPFeedbackCompareFunc(void *data1, uint16_t len1, void *data2,
+        uint16_t len2)
+{
+    const FPFeedbackEntry *e1 = (const FPFeedbackEntry *)data1;
+    const FPFeedbackEntry *e2 = (const FPFeedbackEntry *)data2;
+
+    if (e1->nocase != e2->nocase || e1->content_len != e2->content_len)
+        return 0;
+    if (strcmp(e1->list, e2->list) != 0)
+        return 0;
+    return SCMemcmp(e1->content, e2->content, e1->content_len) == 0;
+}
+
+static void FPFeedbackFreeFunc(void *data)
+{
+    FPFeedbackEntry *e = (FPFeedbackEntry *)data;
+    if (e == NULL)
+        return;
+    SCFree(e->list);
+    SCFree(e->content);
+    SCFree(e);
+}
+
+static HashListTable *FPFeedbackTableInit(void)
+{
+    return HashListTableInit(FP_FEEDBACK_HASH_SIZE, FPFeedbackHashFunc,
+            FPFeedbackCompareFunc, FPFeedbackFreeFunc);
+}
+
+/** \internal
+ *  \brief get the entry for a pattern, adding it with zero counts if it
+ *         is not in the table yet */
+static FPFeedbackEntry *FPFeedbackGet(HashListTable *ht, const char *list,
+        uint8_t nocase, const uint8_t *content, uint16_t content_len)
+{
+    FPFeedbackEntry lookup = { (char *)list, nocase, content_len,
+        (uint8_t *)content, 0, 0, 0 };
+    FPFeedbackEntry *e = HashListTableLookup(ht, &lookup, 0);
+    if (e != NULL)
+        return e;
+
+    e = SCCalloc(1, sizeof(*e));
+    if (unlikely(e == NULL))
+        return NULL;
+    e->list = SCStrdup(list);
+    e->content = SCMalloc(content_len ? content_len : 1);
+    if (e->list == NULL || e->content == NULL) {
+        FPFeedbackFreeFunc(e);
+        return NULL;
+    }
+    memcpy(e->content, content, content_len);
+    e->content_len = content_len;
+    e->nocase = nocase;
+    if (HashListTableAdd(ht, e, 0) != 0) {
+        FPFeedbackFreeFunc(e);
+        return NULL;
+    }
+    return e;
+}
+
+static int FPFeedbackHexDecode(const char *hex, uint8_t *out, size_t size)
+{
+    size_t len = strlen(hex);
+    size_t i;
+
+    if (len % 2 != 0 || len / 2 > size)
+        return -1;
+    for (i = 0; i < len / 2; i++) {
+        unsigned int b;
+        if (!isxdigit((unsigned char)hex[2 * i]) ||
+                !isxdigit((unsigned char)hex[2 * i + 1]) ||
+                sscanf(hex + 2 * i, "%2x", &b) != 1)
+            return -1;
+        out[i] = (uint8_t)b;
+    }
+    return (int)(len / 2);
+}
+
+/** \internal
+ *  \brief read a stats file into 'ht', adding to the counts in it
+ *  \retval number of patterns read, -1 if the file can't be opened */
+static int FPFeedbackLoad(HashListTable *ht, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    char line[4096];
+    char list[64];
+    char hex[2 * FP_FEEDBACK_MAX_PATTERN + 1];
+    uint8_t content[FP_FEEDBACK_MAX_PATTERN];
+    int cnt = 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned int nocase;
+        uint64_t packets, hits, confirms;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%63s %u %2048s %"SCNu64" %"SCNu64" %"SCNu64,
+                    list, &nocase, hex, &packets, &hits, &confirms) != 6) {
+            SCLogDebug("skipping malformed line in %s", path);
+            continue;
+        }
+        int len = FPFeedbackHexDecode(hex, content, sizeof(content));
+        if (len <= 0)
+            continue;
+
+        FPFeedbackEntry *e = FPFeedbackGet(ht, list, nocase ? 1 : 0,
+                content, (uint16_t)len);
+        if (e == NULL)
+            break;
+        e->packets += packets;
+        e->hits += hits;
+        e->confirms += confirms;
+        cnt++;
+    }
+    fclose(fp);
+    return cnt;
+}
+
+/** \internal
+ *  \brief write 'ht' to 'path' through a temp file */
+static int FPFeedbackWrite(HashListTable *ht, const char *path)
+{
+    char tmp[PATH_MAX];
+    int r = snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    if (r < 0 || (size_t)r >= sizeof(tmp))
+        return -1;
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open %s: %s", tmp,
+                strerror(errno));
+        return -1;
+    }
+
+    int ok = (fprintf(fp, "# list nocase pattern packets hits confirms\n") > 0);
+    HashListTableBucket *b;
+    for (b = HashListTableGetListHead(ht); b != NULL && ok;
+            b = HashListTableGetListNext(b)) {
+        const FPFeedbackEntry *e = HashListTableGetListData(b);
+        uint16_t i;
+
+        if (e->content_len > FP_FEEDBACK_MAX_PATTERN)
+            continue;
+        ok = (fprintf(fp, "%s %u ", e->list, e->nocase) > 0);
+        for (i = 0; i < e->content_len && ok; i++)
+            ok = (fprintf(fp, "%02x", e->content[i]) > 0);
+        if (ok) {
+            ok = (fprintf(fp, " %"PRIu64" %"PRIu64" %"PRIu64"\n",
+                        e->packets, e->hits, e->confirms) > 0);
+        }
+    }
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    if (!ok || rename(tmp, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write %s: %s", path,
+                strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief merge the counts of the engine into the stats file */
+static void FPFeedbackStore(const DetectEngineCtx *de_ctx, DetectFPFeedback *fb)
+{
+    if (fb->packets == 0 || fb->hits == NULL)
+        return;
+
+    HashListTable *run = FPFeedbackTableInit();
+    if (run == NULL)
+        return;
+
+    /* per pattern: the highest counts of the rules using it */
+    const Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->mpm_sm == NULL || s->num >= fb->sig_cnt)
+            continue;
+        int list = SigMatchListSMBelongsTo(s, s->mpm_sm);
+        if (list < 0)
+            continue;
+        const DetectContentData *cd = (const DetectContentData *)s->mpm_sm->ctx;
+        FPFeedbackEntry *e = FPFeedbackGet(run, DetectListToString(list),
+                (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0,
+                cd->content, cd->content_len);
+        if (e == NULL)
+            break;
+        e->packets = fb->packets;
+        if (fb->hits[s->num] > e->hits)
+            e->hits = fb->hits[s->num];
+        if (fb->confirms[s->num] > e->confirms)
+            e->confirms = fb->confirms[s->num];
+    }
+
+    SCMutexLock(&g_fp_feedback_file_lock);
+    HashListTable *file = FPFeedbackTableInit();
+    if (file != NULL) {
+        (void)FPFeedbackLoad(file, fb->path);
+
+        uint32_t cnt = 0;
+        HashListTableBucket *b;
+        for (b = HashListTableGetListHead(run); b != NULL;
+                b = HashListTableGetListNext(b)) {
+            const FPFeedbackEntry *re = HashListTableGetListData(b);
+            FPFeedbackEntry *e = FPFeedbackGet(file, re->list, re->nocase,
+                    re->content, re->content_len);
+            if (e == NULL)
+                break;
+            e->packets += re->packets;
+            e->hits += re->hits;
+            e->confirms += re->confirms;
+            cnt++;
+        }
+        if (FPFeedbackWrite(file, fb->path) == 0) {
+            SCLogPerf("fast pattern feedback: %u patterns, %"PRIu64" sampled "
+                    "packets written to %s", cnt, fb->packets, fb->path);
+        }
+        HashListTableFree(file);
+    }
+    SCMutexUnlock(&g_fp_feedback_file_lock);
+
+    HashListTableFree(run);
+}
+
+/**
+ * \brief set up fast pattern feedback for an engine, if enabled
+ *
+ * Reads detect.fast-pattern-feedback and loads the stats file.
+ *
+ * \retval 0 ok or disabled
+ * \retval -1 error
+ */
+int DetectFPFeedbackInit(DetectEngineCtx *de_ctx)
+{
+    int enabled = 0;
+    if (ConfGetBool("detect.fast-pattern-feedback.enabled", &enabled) != 1 ||
+            !enabled)
+        return 0;
+
+    DetectFPFeedback *fb = SCCalloc(1, sizeof(*fb));
+    if (unlikely(fb == NULL))
+        return -1;
+    SCMutexInit(&fb->lock, NULL);
+    fb->sample_rate = FP_FEEDBACK_DEFAULT_RATE;
+    fb->min_samples = FP_FEEDBACK_DEFAULT_MIN_SAMPLES;
+    fb->max_hit_rate = FP_FEEDBACK_DEFAULT_MAX_HIT;
+
+    char *filename = FP_FEEDBACK_DEFAULT_FILE;
+    (void)ConfGet("detect.fast-pattern-feedback.filename", &filename);
+    if (PathIsAbsolute(filename)) {
+        strlcpy(fb->path, filename, sizeof(fb->path));
+    } else {
+        snprintf(fb->path, sizeof(fb->path), "%s/%s",
+                ConfigGetLogDirectory(), filename);
+    }
+
+    intmax_t val = 0;
+    if (ConfGetInt("detect.fast-pattern-feedback.sample-rate", &val) == 1) {
+        if (val <= 0 || val > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.fast-pattern-feedback.sample-rate %"PRIdMAX
+                    ", using %u", val, FP_FEEDBACK_DEFAULT_RATE);
+        } else {
+            fb->sample_rate = (uint32_t)val;
+        }
+    }
+    if (ConfGetInt("detect.fast-pattern-feedback.min-samples", &val) == 1 &&
+            val >= 0) {
+        fb->min_samples = (uint64_t)val;
+    }
+    double dval = 0;
+    if (ConfGetDouble("detect.fast-pattern-feedback.max-hit-rate", &dval) == 1) {
+        if (dval <= 0.0 || dval > 1.0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.fast-pattern-feedback.max-hit-rate %f, using %f",
+                    dval, FP_FEEDBACK_DEFAULT_MAX_HIT);
+        } else {
+            fb->max_hit_rate = dval;
+        }
+    }
+
+    fb->table = FPFeedbackTableInit();
+    if (fb->table == NULL) {
+        SCMutexDestroy(&fb->lock);
+        SCFree(fb);
+        return -1;
+    }
+    SCMutexLock(&g_fp_feedback_file_lock);
+    int cnt = FPFeedbackLoad(fb->table, fb->path);
+    SCMutexUnlock(&g_fp_feedback_file_lock);
+    if (cnt >= 0) {
+        SCLogConfig("fast pattern feedback: %d patterns loaded from %s, "
+                "sampling 1 in %u packets", cnt, fb->path, fb->sample_rate);
+    } else {
+        SCLogConfig("fast pattern feedback: no stats in %s yet, sampling "
+                "1 in %u packets", fb->path, fb->sample_rate);
+    }
+
+    de_ctx->fp_feedback = fb;
+    return 0;
+}
+
+/** \brief write the counts of the engine to the stats file and free */
+void DetectFPFeedbackFree(DetectEngineCtx *de_ctx)
+{
+    DetectFPFeedback *fb = de_ctx->fp_feedback;
+    if (fb == NULL)
+        return;
+
+    FPFeedbackStore(de_ctx, fb);
+
+    if (fb->table != NULL)
+        HashListTableFree(fb->table);
+    if (fb->hits != NULL)
+        SCFree(fb->hits);
+    if (fb->confirms != NULL)
+        SCFree(fb->confirms);
+    SCMutexDestroy(&fb->lock);
+    SCFree(fb);
+    de_ctx->fp_feedback = NULL;
+}
+
+/**
+ * \brief check the observed frequency of a content as fast pattern
+ *
+ * \param list sm list of the content
+ * \param rate set to the hit rate if the pattern has enough samples
+ *
+ * \retval 1 the pattern hits often without the rule matching
+ * \retval 0 not hot, or not enough samples (rate is then set to -1)
+ */
+int DetectFPFeedbackIsHot(const DetectEngineCtx *de_ctx, int list,
+        const DetectContentData *cd, double *rate)
+{
+    *rate = -1.0;
+
+    const DetectFPFeedback *fb = de_ctx ? de_ctx->fp_feedback : NULL;
+    if (fb == NULL || fb->table == NULL)
+        return 0;
+
+    FPFeedbackEntry lookup = { (char *)DetectListToString(list),
+        (cd->flags & DETECT_CONTENT_NOCASE) ? 1 : 0, cd->content_len,
+        cd->content, 0, 0, 0 };
+    const FPFeedbackEntry *e = HashListTableLookup(fb->table, &lookup, 0);
+    if (e == NULL || e->packets == 0 || e->packets < fb->min_samples)
+        return 0;
+
+    *rate = (double)e->hits / (double)e->packets;
+    return (*rate > fb->max_hit_rate && e->confirms * 2 < e->hits);
+}
+
+/** \brief set up the sampling of a detect thread */
+int DetectFPFeedbackThreadInit(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx)
+{
+    const DetectFPFeedback *fb = de_ctx->fp_feedback;
+    if (fb == NULL || de_ctx->sig_array_len == 0)
+        return 0;
+
+    det_ctx->fp_feedback = SCCalloc(de_ctx->sig_array_len,
+            sizeof(DetectFPFeedbackCounter));
+    if (det_ctx->fp_feedback == NULL)
+        return -1;
+    det_ctx->fp_feedback_rate = fb->sample_rate;
+    det_ctx->fp_feedback_countdown = fb->sample_rate;
+    return 0;
+}
+
+/** \brief add the counts of a detect thread to its engine */
+void DetectFPFeedbackThreadDeinit(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->fp_feedback == NULL)
+        return;
+
+    DetectFPFeedback *fb = det_ctx->de_ctx ? det_ctx->de_ctx->fp_feedback : NULL;
+    if (fb != NULL && det_ctx->fp_feedback_pkts > 0) {
+        const uint32_t sig_cnt = det_ctx->de_ctx->sig_array_len;
+        uint32_t i;
+
+        SCMutexLock(&fb->lock);
+        if (fb->hits == NULL) {
+            fb->hits = SCCalloc(sig_cnt, sizeof(uint64_t));
+            fb->confirms = SCCalloc(sig_cnt, sizeof(uint64_t));
+            if (fb->hits == NULL || fb->confirms == NULL) {
+                if (fb->hits != NULL)
+                    SCFree(fb->hits);
+                if (fb->confirms != NULL)
+                    SCFree(fb->confirms);
+                fb->hits = fb->confirms = NULL;
+            } else {
+                fb->sig_cnt = sig_cnt;
+            }
+        }
+        if (fb->hits != NULL) {
+            for (i = 0; i < fb->sig_cnt; i++) {
+                fb->hits[i] += det_ctx->fp_feedback[i].hits;
+                fb->confirms[i] += det_ctx->fp_feedback[i].confirms;
+            }
+            fb->packets += det_ctx->fp_feedback_pkts;
+        }
+        SCMutexUnlock(&fb->lock);
+    }
+
+    SCFree(det_ctx->fp_feedback);
+    det_ctx->fp_feedback = NULL;
+}
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+static DetectFPFeedback *FPFeedbackTestSetup(DetectEngineCtx *de_ctx)
+{
+    DetectFPFeedback *fb = SCCalloc(1, sizeof(*fb));
+    if (fb == NULL)
+        return NULL;
+    SCMutexInit(&fb->lock, NULL);
+    fb->sample_rate = 1;
+    fb->min_samples = 100;
+    fb->max_hit_rate = FP_FEEDBACK_DEFAULT_MAX_HIT;
+    fb->table = FPFeedbackTableInit();
+    if (fb->table == NULL) {
+        SCFree(fb);
+        return NULL;
+    }
+    de_ctx->fp_feedback = fb;
+    return fb;
+}
+
+/** \test a hot pattern is not used as fast pattern if the rule has
+ *        another content, an explicit fast_pattern is kept */
+static int DetectFPFeedbackTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    DetectFPFeedback *fb = FPFeedbackTestSetup(de_ctx);
+    FAIL_IF_NULL(fb);
+    /* the user agent prefix hits on most packets, rarely confirmed */
+    FPFeedbackEntry *e = FPFeedbackGet(fb->table,
+            DetectListToString(DETECT_SM_LIST_PMATCH), 0,
+            (const uint8_t *)"User-Agent: ", 12);
+    FAIL_IF_NULL(e);
+    e->packets = 1000;
+    e->hits = 800;
+    e->confirms = 1;
+
+    Signature *s1 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"User-Agent: \"; content:\"evil\"; sid:1;)");
+    FAIL_IF_NULL(s1);
+    Signature *s2 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"User-Agent: \"; fast_pattern; content:\"evil\"; sid:2;)");
+    FAIL_IF_NULL(s2);
+    Signature *s3 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"User-Agent: \"; sid:3;)");
+    FAIL_IF_NULL(s3);
+
+    RetrieveFPForSig(de_ctx, s1);
+    RetrieveFPForSig(de_ctx, s2);
+    RetrieveFPForSig(de_ctx, s3);
+
+    FAIL_IF_NULL(s1->mpm_sm);
+    DetectContentData *cd = (DetectContentData *)s1->mpm_sm->ctx;
+    FAIL_IF(cd->content_len != 4 || memcmp(cd->content, "evil", 4) != 0);
+
+    FAIL_IF_NULL(s2->mpm_sm);
+    cd = (DetectContentData *)s2->mpm_sm->ctx;
+    FAIL_IF(cd->content_len != 12);
+
+    /* only content, so still used */
+    FAIL_IF_NULL(s3->mpm_sm);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/** \test stats file round trip, counts add up over runs */
+static int DetectFPFeedbackTest02(void)
+{
+    char path[] = "/tmp/suricata-fp-feedback-XXXXXX";
+    int fd = mkstemp(path);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    HashListTable *ht = FPFeedbackTableInit();
+    FAIL_IF_NULL(ht);
+    FPFeedbackEntry *e = FPFeedbackGet(ht, "DETECT_SM_LIST_PMATCH", 1,
+            (const uint8_t *)"\x00\x00", 2);
+    FAIL_IF_NULL(e);
+    e->packets = 10;
+    e->hits = 5;
+    e->confirms = 1;
+    FAIL_IF(FPFeedbackWrite(ht, path) != 0);
+
+    HashListTable *ht2 = FPFeedbackTableInit();
+    FAIL_IF_NULL(ht2);
+    FAIL_IF(FPFeedbackLoad(ht2, path) != 1);
+    FAIL_IF(FPFeedbackLoad(ht2, path) != 1);
+    e = FPFeedbackGet(ht2, "DETECT_SM_LIST_PMATCH", 1,
+            (const uint8_t *)"\x00\x00", 2);
+    FAIL_IF_NULL(e);
+    FAIL_IF(e->packets != 20 || e->hits != 10 || e->confirms != 2);
+
+    HashListTableFree(ht);
+    HashListTableFree(ht2);
+    unlink(path);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectFPFeedbackRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectFPFeedbackTest01", DetectFPFeedbackTest01);
+    UtRegisterTest("DetectFPFeedbackTest02", DetectFPFeedbackTest02);
+#endif /* UNITTESTS */
+}
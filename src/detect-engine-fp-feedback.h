@@ -0,0 +1,74 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Fast pattern selection from production feedback
+ */
+
+#ifndef __DETECT_ENGINE_FP_FEEDBACK_H__
+#define __DETECT_ENGINE_FP_FEEDBACK_H__
+
+/** per thread, per signature counters of the sampled packets */
+typedef struct DetectFPFeedbackCounter_ {
+    uint32_t hits;      /**< fast pattern hit, rule was a candidate */
+    uint32_t confirms;  /**< rule matched */
+} DetectFPFeedbackCounter;
+
+int DetectFPFeedbackInit(DetectEngineCtx *de_ctx);
+void DetectFPFeedbackFree(DetectEngineCtx *de_ctx);
+
+int DetectFPFeedbackIsHot(const DetectEngineCtx *de_ctx, int list,
+        const DetectContentData *cd, double *rate);
+
+int DetectFPFeedbackThreadInit(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx);
+void DetectFPFeedbackThreadDeinit(DetectEngineThreadCtx *det_ctx);
+
+/** \brief decide if the packet is sampled and count the rules whose fast
+ *         pattern hit. Call after the pmq is sorted. */
+static inline void DetectFPFeedbackSamplePmq(DetectEngineThreadCtx *det_ctx)
+{
+    if (--det_ctx->fp_feedback_countdown > 0) {
+        det_ctx->fp_feedback_sampled = 0;
+        return;
+    }
+    det_ctx->fp_feedback_countdown = det_ctx->fp_feedback_rate;
+    det_ctx->fp_feedback_sampled = 1;
+    det_ctx->fp_feedback_pkts++;
+
+    const SigIntId *ids = det_ctx->pmq.rule_id_array;
+    const uint32_t cnt = det_ctx->pmq.rule_id_array_cnt;
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        /* sorted, so duplicates are next to each other */
+        if (i > 0 && ids[i] == ids[i - 1])
+            continue;
+        det_ctx->fp_feedback[ids[i]].hits++;
+    }
+}
+
+/** \brief count a match of signature 's' on a sampled packet */
+#define DETECT_FP_FEEDBACK_CONFIRM(det_ctx, s) do {             \
+        if (unlikely((det_ctx)->fp_feedback_sampled))           \
+            (det_ctx)->fp_feedback[(s)->num].confirms++;        \
+    } while (0)
+
+void DetectFPFeedbackRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_FP_FEEDBACK_H__ */
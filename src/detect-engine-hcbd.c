@@ -61,6 +61,7 @@
 #include "conf-yaml-loader.h"
 
 #include "util-validate.h"
+#include "util-load-shed.h"
 
 #define BUFFER_STEP 50
 
@@ -110,6 +111,10 @@ static const uint8_t *DetectEngineHCBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
     *buffer_len = 0;
     *stream_start_offset = 0;
 
+    /* overloaded: bodies are not inspected */
+    if (det_ctx->load_shed_level >= LOAD_SHED_BODY)
+        return NULL;
+
     if (det_ctx->hcbd_buffers_list_len == 0) {
         /* get the inspect id to use as a 'base id' */
         uint64_t base_inspect_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
@@ -212,18 +217,124 @@ static const uint8_t *DetectEngineHCBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
     return buffer;
 }
 
+static int HttpBodyMpmIdCompare(const void *a, const void *b)
+{
+    SigIntId x = *(const SigIntId *)a;
+    SigIntId y = *(const SigIntId *)b;
+    return (x > y) - (x < y);
+}
+
+/** \internal
+ *  \brief replace the body's cached sids by the unique ids in 'ids'
+ *  \retval -1 on memory error, cache is left invalid */
+static int HttpBodyMpmCacheUpdate(HtpBody *body, const SigIntId *ids, uint32_t cnt)
+{
+    if (cnt > body->mpm_ids_size) {
+        void *ptmp = SCRealloc(body->mpm_ids, cnt * sizeof(SigIntId));
+        if (ptmp == NULL)
+            return -1;
+        body->mpm_ids = ptmp;
+        body->mpm_ids_size = cnt;
+    }
+    if (cnt == 0) {
+        body->mpm_ids_cnt = 0;
+        return 0;
+    }
+
+    memcpy(body->mpm_ids, ids, cnt * sizeof(SigIntId));
+    qsort(body->mpm_ids, cnt, sizeof(SigIntId), HttpBodyMpmIdCompare);
+
+    uint32_t i, u = 0;
+    for (i = 1; i < cnt; i++) {
+        if (body->mpm_ids[i] != body->mpm_ids[u])
+            body->mpm_ids[++u] = body->mpm_ids[i];
+    }
+    body->mpm_ids_cnt = u + 1;
+    return 0;
+}
+
+/**
+ *  \brief Run the mpm over a http body inspect window.
+ *
+ *  The windows of consecutive chunks overlap, so instead of rescanning the
+ *  whole window the sids found in the part we've already scanned are taken
+ *  from the body's cache, and only the new data (plus maxlen - 1 bytes of
+ *  overlap for patterns straddling the old end) is scanned. The cache is
+ *  dropped and the window fully scanned if it belongs to another engine or
+ *  mpm ctx, if the mpm enforces offset/depth, or if the window has moved
+ *  more than its own size since the cache was started.
+ *
+ *  \param offset body offset of the start of buffer
+ *
+ *  \retval ret number of matches
+ */
+uint32_t DetectEngineHttpBodyMpmSearch(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, HtpBody *body,
+        const uint8_t *buffer, uint32_t buffer_len, uint64_t offset)
+{
+    PatternMatcherQueue *pmq = &det_ctx->pmq;
+    const uint32_t first = pmq->rule_id_array_cnt;
+    const uint64_t end = offset + buffer_len;
+    uint64_t scan_from = offset;
+    uint32_t ret = 0;
+
+    if (body->mpm_de_ctx_id == det_ctx->de_ctx->id &&
+        body->mpm_ctx == mpm_ctx &&
+        !(mpm_ctx->flags & MPMCTX_FLAGS_BOUNDED) &&
+        body->mpm_start <= offset &&
+        offset - body->mpm_start <= buffer_len &&
+        body->mpm_scanned > offset && body->mpm_scanned <= end)
+    {
+        MpmAddSids(pmq, body->mpm_ids, body->mpm_ids_cnt);
+        ret = body->mpm_ids_cnt;
+
+        uint32_t overlap = mpm_ctx->maxlen ? mpm_ctx->maxlen - 1 : 0;
+        if (body->mpm_scanned - offset > overlap)
+            scan_from = body->mpm_scanned - overlap;
+    } else {
+        body->mpm_ids_cnt = 0;
+        body->mpm_de_ctx_id = det_ctx->de_ctx->id;
+        body->mpm_ctx = mpm_ctx;
+        body->mpm_start = offset;
+    }
+
+    uint32_t scan_len = (uint32_t)(end - scan_from);
+    if (scan_len >= mpm_ctx->minlen) {
+        if (det_ctx->mpm_offload_jobs != NULL) {
+            MpmOffloadJob *job = &det_ctx->mpm_offload_jobs[0];
+            job->mpm_ctx = mpm_ctx;
+            job->buf = buffer + (scan_from - offset);
+            job->len = scan_len;
+            ret += MpmOffloadSearch(&det_ctx->mtcu, pmq, &job, 1);
+        } else {
+            ret += mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, &det_ctx->mtcu,
+                    pmq, buffer + (scan_from - offset), scan_len);
+        }
+    }
+
+    if (HttpBodyMpmCacheUpdate(body, pmq->rule_id_array + first,
+                pmq->rule_id_array_cnt - first) < 0) {
+        /* next chunk will get a full scan */
+        body->mpm_de_ctx_id = 0;
+    }
+    body->mpm_scanned = end;
+    return ret;
+}
+
 /** \brief Http client body pattern match -- searches for one pattern per
  *         signature.
  *
  *  \param det_ctx  Detection engine thread ctx.
+ *  \param htp_body Body tracker holding the mpm cache.
  *  \param body     The request body to inspect.
  *  \param body_len Body length.
+ *  \param offset   Body offset of the start of body.
  *
  *  \retval ret Number of matches.
  */
 static inline uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
-        const uint8_t *body, const uint32_t body_len,
-        const uint8_t flags)
+        HtpBody *htp_body, const uint8_t *body, const uint32_t body_len,
+        const uint64_t offset, const uint8_t flags)
 {
     SCEnter();
 
@@ -232,11 +343,8 @@ static inline uint32_t HttpClientBodyPatternSearch(DetectEngineThreadCtx *det_ct
     DEBUG_VALIDATE_BUG_ON(flags & STREAM_TOCLIENT);
     DEBUG_VALIDATE_BUG_ON(det_ctx->sgh->mpm_hcbd_ctx_ts == NULL);
 
-    if (body_len >= det_ctx->sgh->mpm_hcbd_ctx_ts->minlen) {
-        ret = mpm_table[det_ctx->sgh->mpm_hcbd_ctx_ts->mpm_type].
-            Search(det_ctx->sgh->mpm_hcbd_ctx_ts, &det_ctx->mtcu,
-                    &det_ctx->pmq, body, body_len);
-    }
+    ret = DetectEngineHttpBodyMpmSearch(det_ctx, det_ctx->sgh->mpm_hcbd_ctx_ts,
+            htp_body, body, body_len, offset);
 
     SCReturnUInt(ret);
 }
@@ -258,7 +366,9 @@ int DetectEngineRunHttpClientBodyMpm(DetectEngineCtx *de_ctx,
     if (buffer_len == 0)
         goto end;
 
-    cnt = HttpClientBodyPatternSearch(det_ctx, (uint8_t *)buffer, buffer_len, flags);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    cnt = HttpClientBodyPatternSearch(det_ctx, &htud->request_body,
+            buffer, buffer_len, stream_start_offset, flags);
 
  end:
     return cnt;
@@ -285,7 +395,7 @@ int DetectEngineInspectHttpClientBody(ThreadVars *tv,
     det_ctx->buffer_offset = 0;
     det_ctx->discontinue_matching = 0;
     det_ctx->inspection_recursion_counter = 0;
-    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_HCBDMATCH],
+    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_arrays[DETECT_SM_LIST_HCBDMATCH],
                                           f,
                                           (uint8_t *)buffer,
                                           buffer_len,
@@ -1060,6 +1170,61 @@ libhtp:\n\
     return RunTest(steps, sig, yaml);
 }
 
+/** \test pattern straddling two chunks, found by the partial scan of the
+ *        second chunk */
+static int DetectEngineHttpClientBodyTest32(void)
+{
+    const char yaml[] = "\
+%YAML 1.1\n\
+---\n\
+libhtp:\n\
+\n\
+  default-config:\n\
+    personality: IDS\n\
+    request-body-limit: 0\n\
+    response-body-limit: 0\n\
+\n\
+    request-body-inspect-window: 4096\n\
+    response-body-inspect-window: 4096\n\
+    request-body-minimal-inspect-size: 0\n\
+    response-body-minimal-inspect-size: 0\n\
+";
+    struct TestSteps steps[] = {
+        {   (const uint8_t *)"GET /index.html HTTP/1.1\r\n"
+            "Host: www.openinfosecfoundation.org\r\n"
+            "Content-Type: text/html\r\n"
+            "Content-Length: 27\r\n"
+            "\r\n"
+            "This is dummy mess",
+            0, STREAM_TOSERVER, 0 },
+        {   (const uint8_t *)"age body2",
+            0, STREAM_TOSERVER, 1 },
+        {   NULL, 0, 0, 0 },
+    };
+
+    const char *sig = "alert http any any -> any any (content:\"dummy\"; http_client_body; content:\"message\"; http_client_body; sid:1;)";
+    return RunTest(steps, sig, yaml);
+}
+
+/** \test body mpm id cache keeps the unique sorted ids */
+static int DetectEngineHttpClientBodyTest33(void)
+{
+    HtpBody body;
+    memset(&body, 0, sizeof(body));
+    SigIntId ids[] = { 7, 3, 7, 1, 3, 9 };
+
+    FAIL_IF(HttpBodyMpmCacheUpdate(&body, ids, 6) != 0);
+    FAIL_IF(body.mpm_ids_cnt != 4);
+    FAIL_IF(body.mpm_ids[0] != 1 || body.mpm_ids[1] != 3);
+    FAIL_IF(body.mpm_ids[2] != 7 || body.mpm_ids[3] != 9);
+
+    FAIL_IF(HttpBodyMpmCacheUpdate(&body, ids, 0) != 0);
+    FAIL_IF(body.mpm_ids_cnt != 0);
+
+    SCFree(body.mpm_ids);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpClientBodyRegisterTests(void)
@@ -1129,6 +1294,10 @@ void DetectEngineHttpClientBodyRegisterTests(void)
                    DetectEngineHttpClientBodyTest30);
     UtRegisterTest("DetectEngineHttpClientBodyTest31",
                    DetectEngineHttpClientBodyTest31);
+    UtRegisterTest("DetectEngineHttpClientBodyTest32",
+                   DetectEngineHttpClientBodyTest32);
+    UtRegisterTest("DetectEngineHttpClientBodyTest33",
+                   DetectEngineHttpClientBodyTest33);
 #endif /* UNITTESTS */
 
     return;
@@ -39,6 +39,10 @@ int DetectEngineInspectHttpClientBody(ThreadVars *tv,
                                       void *tx, uint64_t tx_id);
 void DetectEngineCleanHCBDBuffers(DetectEngineThreadCtx *);
 
+uint32_t DetectEngineHttpBodyMpmSearch(DetectEngineThreadCtx *det_ctx,
+        const MpmCtx *mpm_ctx, HtpBody *body,
+        const uint8_t *buffer, uint32_t buffer_len, uint64_t offset);
+
 void DetectEngineHttpClientBodyRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HCBD_H__ */
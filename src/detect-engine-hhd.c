@@ -56,50 +56,19 @@
 #include "util-unittest-helper.h"
 #include "app-layer.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-mem.h"
 #include "app-layer-protos.h"
 
 #include "util-validate.h"
 
-#define BUFFER_STEP 50
-
-static inline int HHDCreateSpace(DetectEngineThreadCtx *det_ctx, uint64_t size)
-{
-    if (size >= (USHRT_MAX - BUFFER_STEP))
-        return -1;
-
-    void *ptmp;
-    if (size > det_ctx->hhd_buffers_size) {
-        ptmp = SCRealloc(det_ctx->hhd_buffers,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint8_t *));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers);
-            det_ctx->hhd_buffers = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers = ptmp;
-
-        memset(det_ctx->hhd_buffers + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint8_t *));
-        ptmp = SCRealloc(det_ctx->hhd_buffers_len,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint32_t));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers_len);
-            det_ctx->hhd_buffers_len = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers_len = ptmp;
-
-        memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint32_t));
-        det_ctx->hhd_buffers_size += BUFFER_STEP;
-    }
-    memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_list_len, 0, (size - det_ctx->hhd_buffers_list_len) * sizeof(uint32_t));
-
-    return 0;
-}
-
+/** \internal
+ *  \brief Get the normalized header buffer of a tx direction
+ *
+ *  The buffer is built the first time some sig or mpm needs it and then
+ *  kept in the tx user data, so that it's serialized once per tx direction
+ *  instead of once per packet. It's rebuilt if headers were added since,
+ *  e.g. by trailers.
+ */
 static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
                                               DetectEngineCtx *de_ctx,
                                               DetectEngineThreadCtx *det_ctx,
@@ -107,65 +76,42 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
                                               uint8_t flags,
                                               uint32_t *buffer_len)
 {
-    uint8_t *headers_buffer = NULL;
-    int index = 0;
     *buffer_len = 0;
 
-    if (det_ctx->hhd_buffers_list_len == 0) {
-        /* get the inspect id to use as a 'base id' */
-        uint64_t base_inspect_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
-        BUG_ON(base_inspect_id > tx_id);
-        /* see how many space we need for the current tx_id */
-        uint64_t txs = (tx_id - base_inspect_id) + 1;
-        if (HHDCreateSpace(det_ctx, txs) < 0)
-            goto end;
-
-        index = (tx_id - base_inspect_id);
-        det_ctx->hhd_start_tx_id = base_inspect_id;
-        det_ctx->hhd_buffers_list_len = txs;
-    } else {
-        /* tx fits in our current buffers */
-        if ((tx_id - det_ctx->hhd_start_tx_id) < det_ctx->hhd_buffers_list_len) {
-            /* if we previously reassembled, return that buffer */
-            if (det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)] != 0) {
-                *buffer_len = det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)];
-                return det_ctx->hhd_buffers[(tx_id - det_ctx->hhd_start_tx_id)];
-            }
-            /* otherwise fall through */
-        } else {
-            /* not enough space, lets expand */
-            uint64_t txs = (tx_id - det_ctx->hhd_start_tx_id) + 1;
-            if (HHDCreateSpace(det_ctx, txs) < 0)
-                goto end;
-
-            det_ctx->hhd_buffers_list_len = txs;
-        }
-        index = (tx_id - det_ctx->hhd_start_tx_id);
-    }
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    if (htud == NULL)
+        return NULL;
 
     htp_table_t *headers;
+    HtpHeaderBuffer *hb;
     if (flags & STREAM_TOSERVER) {
         if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags) <= HTP_REQUEST_HEADERS)
-            goto end;
+            return NULL;
         headers = tx->request_headers;
+        hb = &htud->request_headers_norm;
     } else {
         if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags) <= HTP_RESPONSE_HEADERS)
-            goto end;
+            return NULL;
         headers = tx->response_headers;
+        hb = &htud->response_headers_norm;
     }
     if (headers == NULL)
-        goto end;
+        return NULL;
+
+    const size_t no_of_headers = htp_table_size(headers);
+    if (hb->buffer != NULL && hb->header_cnt == no_of_headers) {
+        *buffer_len = hb->len;
+        return hb->buffer;
+    }
 
+    /* first pass: size of the buffer. The extra 4 bytes are for ": " and
+     * "\r\n" */
     htp_header_t *h = NULL;
-    headers_buffer = det_ctx->hhd_buffers[index];
     size_t headers_buffer_len = 0;
-    size_t i = 0;
-
-    size_t no_of_headers = htp_table_size(headers);
-    for (; i < no_of_headers; i++) {
+    size_t i;
+    for (i = 0; i < no_of_headers; i++) {
         h = htp_table_get_index(headers, i, NULL);
         size_t size1 = bstr_size(h->name);
-        size_t size2 = bstr_size(h->value);
 
         if (flags & STREAM_TOSERVER) {
             if (size1 == 6 &&
@@ -178,39 +124,54 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
                 continue;
             }
         }
+        headers_buffer_len += size1 + bstr_size(h->value) + 4;
+    }
+    if (headers_buffer_len == 0 || headers_buffer_len > UINT32_MAX)
+        return NULL;
+
+    uint8_t *headers_buffer = HTPRealloc(hb->buffer, hb->size, headers_buffer_len);
+    if (unlikely(headers_buffer == NULL)) {
+        if (hb->buffer != NULL)
+            HTPFree(hb->buffer, hb->size);
+        memset(hb, 0x00, sizeof(*hb));
+        return NULL;
+    }
+    hb->buffer = headers_buffer;
+    hb->size = (uint32_t)headers_buffer_len;
 
-        /* the extra 4 bytes if for ": " and "\r\n" */
-        uint8_t *new_headers_buffer = SCRealloc(headers_buffer, headers_buffer_len + size1 + size2 + 4);
-        if (unlikely(new_headers_buffer == NULL)) {
-            if (headers_buffer != NULL) {
-                SCFree(headers_buffer);
-                headers_buffer = NULL;
+    /* second pass: fill it */
+    uint8_t *ptr = headers_buffer;
+    for (i = 0; i < no_of_headers; i++) {
+        h = htp_table_get_index(headers, i, NULL);
+        size_t size1 = bstr_size(h->name);
+        size_t size2 = bstr_size(h->value);
+
+        if (flags & STREAM_TOSERVER) {
+            if (size1 == 6 &&
+                SCMemcmpLowercase("cookie", bstr_ptr(h->name), 6) == 0) {
+                continue;
+            }
+        } else {
+            if (size1 == 10 &&
+                SCMemcmpLowercase("set-cookie", bstr_ptr(h->name), 10) == 0) {
+                continue;
             }
-            det_ctx->hhd_buffers[index] = NULL;
-            det_ctx->hhd_buffers_len[index] = 0;
-            goto end;
         }
-        headers_buffer = new_headers_buffer;
-
-        memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->name), size1);
-        headers_buffer_len += size1;
-        headers_buffer[headers_buffer_len] = ':';
-        headers_buffer[headers_buffer_len + 1] = ' ';
-        headers_buffer_len += 2;
-        memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->value), size2);
-        headers_buffer_len += size2 + 2;
-        /* \r */
-        headers_buffer[headers_buffer_len - 2] = '\r';
-        /* \n */
-        headers_buffer[headers_buffer_len - 1] = '\n';
-    }
-
-    /* store the buffers.  We will need it for further inspection */
-    det_ctx->hhd_buffers[index] = headers_buffer;
-    det_ctx->hhd_buffers_len[index] = headers_buffer_len;
-
-    *buffer_len = (uint32_t)headers_buffer_len;
- end:
+
+        memcpy(ptr, bstr_ptr(h->name), size1);
+        ptr += size1;
+        *ptr++ = ':';
+        *ptr++ = ' ';
+        memcpy(ptr, bstr_ptr(h->value), size2);
+        ptr += size2;
+        *ptr++ = '\r';
+        *ptr++ = '\n';
+    }
+
+    hb->len = (uint32_t)headers_buffer_len;
+    hb->header_cnt = no_of_headers;
+
+    *buffer_len = hb->len;
     return headers_buffer;
 }
 
@@ -292,7 +253,7 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
     det_ctx->buffer_offset = 0;
     det_ctx->discontinue_matching = 0;
     det_ctx->inspection_recursion_counter = 0;
-    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_HHDMATCH],
+    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_arrays[DETECT_SM_LIST_HHDMATCH],
                                           f,
                                           buffer,
                                           buffer_len,
@@ -312,20 +273,6 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
     return DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
 }
 
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx)
-{
-    if (det_ctx->hhd_buffers_list_len != 0) {
-        int i;
-        for (i = 0; i < det_ctx->hhd_buffers_list_len; i++) {
-            det_ctx->hhd_buffers_len[i] = 0;
-        }
-        det_ctx->hhd_buffers_list_len = 0;
-    }
-    det_ctx->hhd_start_tx_id = 0;
-
-    return;
-}
-
 /***********************************Unittests**********************************/
 
 #ifdef UNITTESTS
@@ -3859,6 +3806,66 @@ end:
     return result;
 }
 
+/**
+ * \test Test that the header buffer is built once and kept in the tx.
+ */
+static int DetectEngineHttpHeaderTest34(void)
+{
+    TcpSession ssn;
+    Flow f;
+    uint8_t http_buf[] =
+        "GET /index.html HTTP/1.0\r\n"
+        "Host: www.example.org\r\n"
+        "Cookie: dummy\r\n"
+        "User-Agent: test\r\n\r\n";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf, http_len);
+    SCMutexUnlock(&f.m);
+    FAIL_IF(r != 0);
+
+    HtpState *http_state = f.alstate;
+    FAIL_IF_NULL(http_state);
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    FAIL_IF_NULL(tx);
+
+    uint32_t len1 = 0, len2 = 0;
+    uint8_t *buf1 = DetectEngineHHDGetBufferForTX(tx, 0, NULL, NULL, &f,
+            http_state, STREAM_TOSERVER, &len1);
+    FAIL_IF_NULL(buf1);
+    uint8_t expected[] = "Host: www.example.org\r\nUser-Agent: test\r\n";
+    FAIL_IF_NOT(len1 == sizeof(expected) - 1);
+    FAIL_IF_NOT(memcmp(buf1, expected, len1) == 0);
+
+    uint8_t *buf2 = DetectEngineHHDGetBufferForTX(tx, 0, NULL, NULL, &f,
+            http_state, STREAM_TOSERVER, &len2);
+    FAIL_IF_NOT(buf1 == buf2);
+    FAIL_IF_NOT(len1 == len2);
+
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    FAIL_IF_NULL(htud);
+    FAIL_IF_NOT(htud->request_headers_norm.buffer == buf1);
+
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpHeaderRegisterTests(void)
@@ -3935,6 +3942,8 @@ void DetectEngineHttpHeaderRegisterTests(void)
                    DetectEngineHttpHeaderTest32);
     UtRegisterTest("DetectEngineHttpHeaderTest33",
                    DetectEngineHttpHeaderTest33);
+    UtRegisterTest("DetectEngineHttpHeaderTest34",
+                   DetectEngineHttpHeaderTest34);
 
 #endif /* UNITTESTS */
 
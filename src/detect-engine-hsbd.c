@@ -42,6 +42,7 @@
 #include "detect-parse.h"
 #include "detect-engine-state.h"
 #include "detect-engine-content-inspection.h"
+#include "detect-engine-hcbd.h"
 
 #include "flow-util.h"
 #include "util-debug.h"
@@ -63,6 +64,7 @@
 #include "conf-yaml-loader.h"
 
 #include "util-validate.h"
+#include "util-load-shed.h"
 
 #define BUFFER_STEP 50
 
@@ -109,6 +111,10 @@ static const uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
     *buffer_len = 0;
     *stream_start_offset = 0;
 
+    /* overloaded: bodies are not inspected */
+    if (det_ctx->load_shed_level >= LOAD_SHED_BODY)
+        return NULL;
+
     if (det_ctx->hsbd_buffers_list_len == 0) {
         /* get the inspect id to use as a 'base id' */
         uint64_t base_inspect_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
@@ -221,14 +227,16 @@ static const uint8_t *DetectEngineHSBDGetBufferForTX(htp_tx_t *tx, uint64_t tx_i
  *         signature.
  *
  *  \param det_ctx  Detection engine thread ctx.
+ *  \param htp_body Body tracker holding the mpm cache.
  *  \param body     The request body to inspect.
  *  \param body_len Body length.
+ *  \param offset   Body offset of the start of body.
  *
  *  \retval ret Number of matches.
  */
 static inline uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *det_ctx,
-        const uint8_t *body, const uint32_t body_len,
-        const uint8_t flags)
+        HtpBody *htp_body, const uint8_t *body, const uint32_t body_len,
+        const uint64_t offset, const uint8_t flags)
 {
     SCEnter();
 
@@ -237,11 +245,8 @@ static inline uint32_t HttpServerBodyPatternSearch(DetectEngineThreadCtx *det_ct
     DEBUG_VALIDATE_BUG_ON(!(flags & STREAM_TOCLIENT));
     DEBUG_VALIDATE_BUG_ON(det_ctx->sgh->mpm_hsbd_ctx_tc == NULL);
 
-    if (body_len >= det_ctx->sgh->mpm_hsbd_ctx_tc->minlen) {
-        ret = mpm_table[det_ctx->sgh->mpm_hsbd_ctx_tc->mpm_type].
-            Search(det_ctx->sgh->mpm_hsbd_ctx_tc, &det_ctx->mtcu,
-                    &det_ctx->pmq, body, body_len);
-    }
+    ret = DetectEngineHttpBodyMpmSearch(det_ctx, det_ctx->sgh->mpm_hsbd_ctx_tc,
+            htp_body, body, body_len, offset);
 
     SCReturnUInt(ret);
 }
@@ -263,7 +268,9 @@ int DetectEngineRunHttpServerBodyMpm(DetectEngineCtx *de_ctx,
     if (buffer_len == 0)
         goto end;
 
-    cnt = HttpServerBodyPatternSearch(det_ctx, (uint8_t *)buffer, buffer_len, flags);
+    HtpTxUserData *htud = (HtpTxUserData *)htp_tx_get_user_data(tx);
+    cnt = HttpServerBodyPatternSearch(det_ctx, &htud->response_body,
+            buffer, buffer_len, stream_start_offset, flags);
 
  end:
     return cnt;
@@ -291,7 +298,7 @@ int DetectEngineInspectHttpServerBody(ThreadVars *tv,
     det_ctx->buffer_offset = 0;
     det_ctx->discontinue_matching = 0;
     det_ctx->inspection_recursion_counter = 0;
-    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_FILEDATA],
+    int r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_arrays[DETECT_SM_LIST_FILEDATA],
                                           f,
                                           (uint8_t *)buffer,
                                           buffer_len,
@@ -139,7 +139,7 @@ int DetectEngineInspectHttpStatCode(ThreadVars *tv,
     det_ctx->buffer_offset = 0;
     det_ctx->inspection_recursion_counter = 0;
     int r = DetectEngineContentInspection(de_ctx, det_ctx, s,
-                                          s->sm_lists[DETECT_SM_LIST_HSCDMATCH],
+                                          s->sm_arrays[DETECT_SM_LIST_HSCDMATCH],
                                           f,
                                           (uint8_t *)bstr_ptr(tx->response_status),
                                           bstr_len(tx->response_status),
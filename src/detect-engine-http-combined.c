@@ -0,0 +1,262 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup httplayer
+ *
+ * @{
+ */
+
+
+/** \file
+ *
+ * \brief Combined mpm of the small http request buffers
+ *
+ * With detect.mpm.http-combined the fast patterns of http_uri,
+ * http_raw_uri, http_method, http_host, http_raw_host, http_user_agent
+ * and http_cookie are in one mpm ctx per rule group. A tx's buffers are
+ * searched with one MpmSearchVector() call instead of one search per
+ * buffer, with Hyperscan in one hs_scan_vector() call.
+ *
+ * A pattern can then match in another buffer than its own, or across two
+ * buffers, and offset and depth are not applied. This only adds rules to
+ * inspect, the inspection of the rule still checks the right buffer.
+ * Rules with a negated fast pattern are always inspected, so these are
+ * not affected.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-parse.h"
+
+#include "flow-util.h"
+#include "util-debug.h"
+#include "flow.h"
+
+#include "stream-tcp.h"
+
+#include "app-layer-parser.h"
+
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "app-layer.h"
+#include "app-layer-htp.h"
+#include "app-layer-protos.h"
+
+#include "detect-engine-http-combined.h"
+#include "util-validate.h"
+
+static inline void HttpCombinedAdd(const uint8_t **bufs, uint32_t *lens,
+        uint32_t *cnt, const bstr *b)
+{
+    if (b == NULL || bstr_len(b) == 0)
+        return;
+    bufs[*cnt] = (const uint8_t *)bstr_ptr(b);
+    lens[*cnt] = bstr_len(b);
+    (*cnt)++;
+}
+
+static inline void HttpCombinedAddHeader(const uint8_t **bufs, uint32_t *lens,
+        uint32_t *cnt, htp_table_t *headers, const char *name)
+{
+    htp_header_t *h = (htp_header_t *)htp_table_get_c(headers, name);
+    if (h != NULL)
+        HttpCombinedAdd(bufs, lens, cnt, h->value);
+}
+
+/**
+ *  \brief search the small request buffers of a tx the parser is done with
+ *
+ *  The request line buffers are searched once the request line is parsed,
+ *  the header ones once the headers are, as their own prefilters do.
+ *
+ *  \retval cnt match count
+ */
+uint32_t DetectEngineRunHttpCombinedMpm(DetectEngineThreadCtx *det_ctx,
+                                        void *txv, const int tx_progress)
+{
+    const MpmCtx *mpm_ctx = det_ctx->sgh->mpm_http_ctx_ts;
+    htp_tx_t *tx = (htp_tx_t *)txv;
+    const uint8_t *bufs[HTTP_COMBINED_MAX_BUFFERS];
+    uint32_t lens[HTTP_COMBINED_MAX_BUFFERS];
+    uint32_t cnt = 0;
+
+    DEBUG_VALIDATE_BUG_ON(mpm_ctx == NULL);
+
+    if (tx_progress > HTP_REQUEST_LINE) {
+        HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+        if (tx_ud != NULL)
+            HttpCombinedAdd(bufs, lens, &cnt, tx_ud->request_uri_normalized);
+        HttpCombinedAdd(bufs, lens, &cnt, tx->request_uri);
+        HttpCombinedAdd(bufs, lens, &cnt, tx->request_method);
+    }
+
+    if (tx_progress >= HTP_REQUEST_HEADERS) {
+        HttpCombinedAdd(bufs, lens, &cnt, tx->request_hostname);
+        if (tx->parsed_uri != NULL && tx->parsed_uri->hostname != NULL) {
+            HttpCombinedAdd(bufs, lens, &cnt, tx->parsed_uri->hostname);
+        } else if (tx->request_headers != NULL) {
+            HttpCombinedAddHeader(bufs, lens, &cnt, tx->request_headers, "Host");
+        }
+        if (tx->request_headers != NULL) {
+            HttpCombinedAddHeader(bufs, lens, &cnt, tx->request_headers, "User-Agent");
+            HttpCombinedAddHeader(bufs, lens, &cnt, tx->request_headers, "Cookie");
+        }
+    }
+
+    if (cnt == 0)
+        return 0;
+
+    return MpmSearchVector(mpm_ctx, &det_ctx->mtcu, &det_ctx->pmq,
+            bufs, lens, cnt);
+}
+
+#ifdef UNITTESTS
+/** \test rules on the combined buffers only alert on their own buffer */
+static int DetectEngineHttpCombinedTest01(void)
+{
+    TcpSession ssn;
+    Packet *p = NULL;
+    ThreadVars th_v;
+    DetectEngineCtx *de_ctx = NULL;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Flow f;
+    uint8_t http_buf[] =
+        "GET /index.html HTTP/1.0\r\n"
+        "User-Agent: CONNECT\r\n"
+        "Cookie: monster\r\n"
+        "Host: www.onetwothreefourfivesixseven.org\r\n\r\n";
+    uint32_t http_len = sizeof(http_buf) - 1;
+    int result = 0;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    p->flow = &f;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    p->flowflags |= FLOW_PKT_ESTABLISHED;
+    p->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_http_combined = 1;
+
+    if (DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"CONNECT\"; http_user_agent; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"/index\"; http_uri; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"CONNECT\"; http_uri; sid:3;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"index\"; http_uri; offset:5; sid:4;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+                "(content:\"monster\"; http_cookie; sid:5;)") == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+
+    uint32_t i, combined = 0;
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL || !(sgh->flags & SIG_GROUP_HEAD_MPM_HTTP_TS))
+            continue;
+        if (sgh->flags & (SIG_GROUP_HEAD_MPM_URI|SIG_GROUP_HEAD_MPM_HUAD|
+                    SIG_GROUP_HEAD_MPM_HCD)) {
+            printf("per buffer mpm set up as well: ");
+            goto end;
+        }
+        combined++;
+    }
+    if (combined == 0) {
+        printf("no group with the combined mpm: ");
+        goto end;
+    }
+
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http_buf, http_len);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        SCMutexUnlock(&f.m);
+        goto end;
+    }
+    SCMutexUnlock(&f.m);
+
+    if (f.alstate == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+
+    if (!PacketAlertCheck(p, 1) || !PacketAlertCheck(p, 2) ||
+        !PacketAlertCheck(p, 5)) {
+        printf("sid 1, 2 or 5 didn't match but should have: ");
+        goto end;
+    }
+    if (PacketAlertCheck(p, 3) || PacketAlertCheck(p, 4)) {
+        printf("sid 3 or 4 matched but shouldn't have: ");
+        goto end;
+    }
+
+    result = 1;
+
+end:
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p, 1);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void DetectEngineHttpCombinedRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectEngineHttpCombinedTest01",
+                   DetectEngineHttpCombinedTest01);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
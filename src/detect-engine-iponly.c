@@ -479,12 +479,12 @@ static void SigNumArrayPrint(void *tmp)
     uint32_t u;
 
     for (u = 0; u < sna->size; u++) {
-        uint8_t bitarray = sna->array[u];
+        uint64_t bitarray = sna->array[u];
         uint8_t i = 0;
 
-        for (; i < 8; i++) {
+        for (; i < 64; i++) {
             if (bitarray & 0x01)
-                printf(", %"PRIu32"", u * 8 + i);
+                printf(", %"PRIu32"", u * 64 + i);
             else
                 printf(", ");
 
@@ -493,6 +493,15 @@ static void SigNumArrayPrint(void *tmp)
     }
 }
 
+/** \internal
+ *  \brief number of 64 bit words needed for a bit per sig num, rounded
+ *         up so the arrays can be ANDed in blocks of SIGNUM_BLOCK words */
+static inline uint32_t SigNumArrayWords(const DetectEngineIPOnlyCtx *io_ctx)
+{
+    uint32_t words = io_ctx->max_idx / 64 + 1;
+    return (words + SIGNUM_BLOCK - 1) & ~(SIGNUM_BLOCK - 1);
+}
+
 /**
  * \brief This function creates a new SigNumArray with the
  *        size fixed to the io_ctx->max_idx
@@ -512,13 +521,13 @@ static SigNumArray *SigNumArrayNew(DetectEngineCtx *de_ctx,
     }
     memset(new, 0, sizeof(SigNumArray));
 
-    new->array = SCMalloc(io_ctx->max_idx / 8 + 1);
+    new->size = SigNumArrayWords(io_ctx);
+    new->array = SCMallocAligned(new->size * sizeof(uint64_t), SIGNUM_ALIGN);
     if (new->array == NULL) {
        exit(EXIT_FAILURE);
     }
 
-    memset(new->array, 0, io_ctx->max_idx / 8 + 1);
-    new->size = io_ctx->max_idx / 8 + 1;
+    memset(new->array, 0, new->size * sizeof(uint64_t));
 
     SCLogDebug("max idx= %u", io_ctx->max_idx);
 
@@ -545,12 +554,12 @@ static SigNumArray *SigNumArrayCopy(SigNumArray *orig)
     memset(new, 0, sizeof(SigNumArray));
     new->size = orig->size;
 
-    new->array = SCMalloc(orig->size);
+    new->array = SCMallocAligned(orig->size * sizeof(uint64_t), SIGNUM_ALIGN);
     if (new->array == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    memcpy(new->array, orig->array, orig->size);
+    memcpy(new->array, orig->array, orig->size * sizeof(uint64_t));
     return new;
 }
 
@@ -566,7 +575,7 @@ static void SigNumArrayFree(void *tmp)
         return;
 
     if (sna->array != NULL)
-        SCFree(sna->array);
+        SCFreeAligned(sna->array);
 
     SCFree(sna);
 }
@@ -871,13 +880,14 @@ void DetectEngineIPOnlyThreadInit(DetectEngineCtx *de_ctx,
                                   DetectEngineIPOnlyThreadCtx *io_tctx)
 {
     /* initialize the signature bitarray */
-    io_tctx->sig_match_size = de_ctx->io_ctx.max_idx / 8 + 1;
-    io_tctx->sig_match_array = SCMalloc(io_tctx->sig_match_size);
+    io_tctx->sig_match_size = SigNumArrayWords(&de_ctx->io_ctx);
+    io_tctx->sig_match_array = SCMallocAligned(io_tctx->sig_match_size *
+            sizeof(uint64_t), SIGNUM_ALIGN);
     if (io_tctx->sig_match_array == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    memset(io_tctx->sig_match_array, 0, io_tctx->sig_match_size);
+    memset(io_tctx->sig_match_array, 0, io_tctx->sig_match_size * sizeof(uint64_t));
 }
 
 /**
@@ -903,6 +913,11 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
     if (io_ctx == NULL)
         return;
 
+    SCLpmIPV4Free(io_ctx->lpm_ipv4src);
+    io_ctx->lpm_ipv4src = NULL;
+    SCLpmIPV4Free(io_ctx->lpm_ipv4dst);
+    io_ctx->lpm_ipv4dst = NULL;
+
     if (io_ctx->tree_ipv4src != NULL)
         SCRadixReleaseRadixTree(io_ctx->tree_ipv4src);
     io_ctx->tree_ipv4src = NULL;
@@ -932,7 +947,7 @@ void IPOnlyDeinit(DetectEngineCtx *de_ctx, DetectEngineIPOnlyCtx *io_ctx)
  */
 void DetectEngineIPOnlyThreadDeinit(DetectEngineIPOnlyThreadCtx *io_tctx)
 {
-    SCFree(io_tctx->sig_match_array);
+    SCFreeAligned(io_tctx->sig_match_array);
 }
 
 static inline
@@ -977,7 +992,11 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     void *user_data_src = NULL, *user_data_dst = NULL;
 
     if (p->src.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
+        if (io_ctx->lpm_ipv4src != NULL)
+            user_data_src = SCLpmIPV4Lookup(io_ctx->lpm_ipv4src,
+                                            (uint8_t *)&GET_IPV4_SRC_ADDR_U32(p));
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_SRC_ADDR_U32(p),
                                               io_ctx->tree_ipv4src, &user_data_src);
     } else if (p->src.family == AF_INET6) {
         (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_SRC_ADDR(p),
@@ -985,7 +1004,11 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     }
 
     if (p->dst.family == AF_INET) {
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
+        if (io_ctx->lpm_ipv4dst != NULL)
+            user_data_dst = SCLpmIPV4Lookup(io_ctx->lpm_ipv4dst,
+                                            (uint8_t *)&GET_IPV4_DST_ADDR_U32(p));
+        else
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&GET_IPV4_DST_ADDR_U32(p),
                                               io_ctx->tree_ipv4dst, &user_data_dst);
     } else if (p->dst.family == AF_INET6) {
         (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)&GET_IPV6_DST_ADDR(p),
@@ -998,99 +1021,107 @@ void IPOnlyMatchPacket(ThreadVars *tv,
     if (src == NULL || dst == NULL)
         return;
 
-    uint32_t u;
-    for (u = 0; u < src->size; u++) {
-        SCLogDebug("And %"PRIu8" & %"PRIu8, src->array[u], dst->array[u]);
-
-        /* The final results will be at io_tctx */
-        io_tctx->sig_match_array[u] = dst->array[u] & src->array[u];
-
-        /* We have to move the logic of the signature checking
-         * to the main detect loop, in order to apply the
-         * priority of actions (pass, drop, reject, alert) */
-        if (io_tctx->sig_match_array[u] != 0) {
-            /* We have a match :) Let's see from which signum's */
-            uint8_t bitarray = io_tctx->sig_match_array[u];
-            uint8_t i = 0;
-
-            for (; i < 8; i++, bitarray = bitarray >> 1) {
-                if (bitarray & 0x01) {
-                    Signature *s = de_ctx->sig_array[u * 8 + i];
-
-                    if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
-                    if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
-                        SCLogDebug("ip version didn't match");
-                        continue;
-                    }
+    /* AND the sets a block at a time. The arrays are aligned and padded
+     * to whole blocks, so the compiler can vectorize the inner loop. Most
+     * blocks are empty, those are skipped with a single test. */
+    const uint64_t *sa = __builtin_assume_aligned(src->array, SIGNUM_ALIGN);
+    const uint64_t *da = __builtin_assume_aligned(dst->array, SIGNUM_ALIGN);
+    uint64_t *ma = __builtin_assume_aligned(io_tctx->sig_match_array, SIGNUM_ALIGN);
+    uint32_t b;
+    for (b = 0; b < src->size; b += SIGNUM_BLOCK) {
+        uint64_t any = 0;
+        uint32_t u;
+        for (u = b; u < b + SIGNUM_BLOCK; u++) {
+            ma[u] = sa[u] & da[u];
+            any |= ma[u];
+        }
+        if (any == 0)
+            continue;
 
-                    if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
-                        SCLogDebug("proto didn't match");
-                        continue;
-                    }
+        for (u = b; u < b + SIGNUM_BLOCK; u++) {
+            /* We have to move the logic of the signature checking
+             * to the main detect loop, in order to apply the
+             * priority of actions (pass, drop, reject, alert) */
+            uint64_t bitarray = ma[u];
+            while (bitarray != 0) {
+                const uint32_t signum = u * 64 + __builtin_ctzll(bitarray);
+                bitarray &= bitarray - 1;
 
-                    /* check the source & dst port in the sig */
-                    if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
-                        if (!(s->flags & SIG_FLAG_DP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
-                            if (dport == NULL) {
-                                SCLogDebug("dport didn't match.");
-                                continue;
-                            }
+                Signature *s = de_ctx->sig_array[signum];
+
+                if ((s->proto.flags & DETECT_PROTO_IPV4) && !PKT_IS_IPV4(p)) {
+                    SCLogDebug("ip version didn't match");
+                    continue;
+                }
+                if ((s->proto.flags & DETECT_PROTO_IPV6) && !PKT_IS_IPV6(p)) {
+                    SCLogDebug("ip version didn't match");
+                    continue;
+                }
+
+                if (DetectProtoContainsProto(&s->proto, IP_GET_IPPROTO(p)) == 0) {
+                    SCLogDebug("proto didn't match");
+                    continue;
+                }
+
+                /* check the source & dst port in the sig */
+                if (p->proto == IPPROTO_TCP || p->proto == IPPROTO_UDP || p->proto == IPPROTO_SCTP) {
+                    if (!(s->flags & SIG_FLAG_DP_ANY)) {
+                        if (p->flags & PKT_IS_FRAGMENT)
+                            continue;
+
+                        DetectPort *dport = DetectPortLookupGroup(s->dp,p->dp);
+                        if (dport == NULL) {
+                            SCLogDebug("dport didn't match.");
+                            continue;
                         }
-                        if (!(s->flags & SIG_FLAG_SP_ANY)) {
-                            if (p->flags & PKT_IS_FRAGMENT)
-                                continue;
-
-                            DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
-                            if (sport == NULL) {
-                                SCLogDebug("sport didn't match.");
-                                continue;
-                            }
+                    }
+                    if (!(s->flags & SIG_FLAG_SP_ANY)) {
+                        if (p->flags & PKT_IS_FRAGMENT)
+                            continue;
+
+                        DetectPort *sport = DetectPortLookupGroup(s->sp,p->sp);
+                        if (sport == NULL) {
+                            SCLogDebug("sport didn't match.");
+                            continue;
                         }
-                    } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
-                        SCLogDebug("port-less protocol and sig needs ports");
-                        continue;
                     }
+                } else if ((s->flags & (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) != (SIG_FLAG_DP_ANY|SIG_FLAG_SP_ANY)) {
+                    SCLogDebug("port-less protocol and sig needs ports");
+                    continue;
+                }
 
-                    if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
-                        continue;
-                    }
+                if (!IPOnlyMatchCompatSMs(tv, det_ctx, s, p)) {
+                    continue;
+                }
 
-                    SCLogDebug("Signum %"PRIu16" match (sid: %"PRIu16", msg: %s)",
-                               u * 8 + i, s->id, s->msg);
+                SCLogDebug("Signum %"PRIu32" match (sid: %"PRIu32", msg: %s)",
+                           signum, s->id, s->msg);
 
-                    if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
-                        KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
-                        SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
+                if (s->sm_arrays[DETECT_SM_LIST_POSTMATCH] != NULL) {
+                    KEYWORD_PROFILING_SET_LIST(det_ctx, DETECT_SM_LIST_POSTMATCH);
+                    SigMatchData *smd = s->sm_arrays[DETECT_SM_LIST_POSTMATCH];
 
-                        SCLogDebug("running match functions, sm %p", smd);
+                    SCLogDebug("running match functions, sm %p", smd);
 
-                        if (smd != NULL) {
-                            while (1) {
-                                KEYWORD_PROFILING_START;
-                                (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
-                                KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
-                                if (smd->is_last)
-                                    break;
-                                smd++;
-                            }
+                    if (smd != NULL) {
+                        while (1) {
+                            KEYWORD_PROFILING_START;
+                            (void)sigmatch_table[smd->type].Match(tv, det_ctx, p, s, smd->ctx);
+                            KEYWORD_PROFILING_END(det_ctx, smd->type, 1);
+                            if (smd->is_last)
+                                break;
+                            smd++;
                         }
                     }
-                    if (!(s->flags & SIG_FLAG_NOALERT)) {
-                        if (s->action & ACTION_DROP)
-                            PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
-                        else
-                            PacketAlertAppend(det_ctx, s, p, 0, 0);
-                    } else {
-                        /* apply actions for noalert/rule suppressed as well */
-                        DetectSignatureApplyActions(p, s);
-                    }
+                }
+                if (!(s->flags & SIG_FLAG_NOALERT)) {
+                    if (s->action & ACTION_DROP)
+                        PacketAlertAppend(det_ctx, s, p, 0, PACKET_ALERT_FLAG_DROP_FLOW);
+                    else
+                        PacketAlertAppend(det_ctx, s, p, 0, 0);
+                } else {
+                    /* apply actions for noalert/rule suppressed as well */
+                    DetectSignatureApplyActions(p, s);
                 }
             }
         }
@@ -1153,14 +1184,14 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
+                    uint64_t tmp = 1ULL << (src->signum % 64);
 
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        sna->array[src->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        sna->array[src->signum / 64] |= tmp;
 
                     if (src->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&src->ip[0],
@@ -1181,14 +1212,14 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     sna = SigNumArrayCopy((SigNumArray *) user_data);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
+                    uint64_t tmp = 1ULL << (src->signum % 64);
 
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        sna->array[src->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        sna->array[src->signum / 64] |= tmp;
 
                     if (src->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&src->ip[0],
@@ -1214,14 +1245,14 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                 SigNumArray *sna = (SigNumArray *)user_data;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (src->signum % 8);
+                uint64_t tmp = 1ULL << (src->signum % 64);
 
                 if (src->negated > 0)
                     /* Unset it */
-                    sna->array[src->signum / 8] &= ~tmp;
+                    sna->array[src->signum / 64] &= ~tmp;
                 else
                     /* Set it */
-                    sna->array[src->signum / 8] |= tmp;
+                    sna->array[src->signum / 64] |= tmp;
             }
         } else if (src->family == AF_INET6) {
             SCLogDebug("To IPv6");
@@ -1247,14 +1278,14 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
+                    uint64_t tmp = 1ULL << (src->signum % 64);
 
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        sna->array[src->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        sna->array[src->signum / 64] |= tmp;
 
                     if (src->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&src->ip[0],
@@ -1272,13 +1303,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     sna = SigNumArrayCopy((SigNumArray *)user_data);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (src->signum % 8);
+                    uint64_t tmp = 1ULL << (src->signum % 64);
                     if (src->negated > 0)
                         /* Unset it */
-                        sna->array[src->signum / 8] &= ~tmp;
+                        sna->array[src->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[src->signum / 8] |= tmp;
+                        sna->array[src->signum / 64] |= tmp;
 
                     if (src->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&src->ip[0],
@@ -1296,13 +1327,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                 SigNumArray *sna = (SigNumArray *)user_data;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (src->signum % 8);
+                uint64_t tmp = 1ULL << (src->signum % 64);
                 if (src->negated > 0)
                     /* Unset it */
-                    sna->array[src->signum / 8] &= ~tmp;
+                    sna->array[src->signum / 64] &= ~tmp;
                 else
                     /* Set it */
-                    sna->array[src->signum / 8] |= tmp;
+                    sna->array[src->signum / 64] |= tmp;
             }
         }
         IPOnlyCIDRItem *tmpaux = src;
@@ -1349,13 +1380,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /** Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
+                    uint64_t tmp = 1ULL << (dst->signum % 64);
                     if (dst->negated > 0)
                         /** Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        sna->array[dst->signum / 64] &= ~tmp;
                     else
                         /** Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        sna->array[dst->signum / 64] |= tmp;
 
                     if (dst->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&dst->ip[0],
@@ -1376,13 +1407,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     sna = SigNumArrayCopy((SigNumArray *) user_data);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
+                    uint64_t tmp = 1ULL << (dst->signum % 64);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        sna->array[dst->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        sna->array[dst->signum / 64] |= tmp;
 
                     if (dst->netmask == 32)
                         node = SCRadixAddKeyIPV4((uint8_t *)&dst->ip[0],
@@ -1403,13 +1434,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                 SigNumArray *sna = (SigNumArray *)user_data;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (dst->signum % 8);
+                uint64_t tmp = 1ULL << (dst->signum % 64);
                 if (dst->negated > 0)
                     /* Unset it */
-                    sna->array[dst->signum / 8] &= ~tmp;
+                    sna->array[dst->signum / 64] &= ~tmp;
                 else
                     /* Set it */
-                    sna->array[dst->signum / 8] |= tmp;
+                    sna->array[dst->signum / 64] |= tmp;
             }
         } else if (dst->family == AF_INET6) {
             SCLogDebug("To IPv6");
@@ -1437,13 +1468,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     SigNumArray *sna = SigNumArrayNew(de_ctx, &de_ctx->io_ctx);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
+                    uint64_t tmp = 1ULL << (dst->signum % 64);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        sna->array[dst->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        sna->array[dst->signum / 64] |= tmp;
 
                     if (dst->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&dst->ip[0],
@@ -1462,13 +1493,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                     sna = SigNumArrayCopy((SigNumArray *)user_data);
 
                     /* Update the sig */
-                    uint8_t tmp = 1 << (dst->signum % 8);
+                    uint64_t tmp = 1ULL << (dst->signum % 64);
                     if (dst->negated > 0)
                         /* Unset it */
-                        sna->array[dst->signum / 8] &= ~tmp;
+                        sna->array[dst->signum / 64] &= ~tmp;
                     else
                         /* Set it */
-                        sna->array[dst->signum / 8] |= tmp;
+                        sna->array[dst->signum / 64] |= tmp;
 
                     if (dst->netmask == 128)
                         node = SCRadixAddKeyIPV6((uint8_t *)&dst->ip[0],
@@ -1487,13 +1518,13 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
                 SigNumArray *sna = (SigNumArray *)user_data;
 
                 /* Update the sig */
-                uint8_t tmp = 1 << (dst->signum % 8);
+                uint64_t tmp = 1ULL << (dst->signum % 64);
                 if (dst->negated > 0)
                     /* Unset it */
-                    sna->array[dst->signum / 8] &= ~tmp;
+                    sna->array[dst->signum / 64] &= ~tmp;
                 else
                     /* Set it */
-                    sna->array[dst->signum / 8] |= tmp;
+                    sna->array[dst->signum / 64] |= tmp;
             }
         }
         IPOnlyCIDRItem *tmpaux = dst;
@@ -1501,6 +1532,10 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
         SCFree(tmpaux);
     }
 
+    /* the trees are final now, compile the ipv4 ones for faster lookups */
+    de_ctx->io_ctx.lpm_ipv4src = SCLpmIPV4CompileRadix(de_ctx->io_ctx.tree_ipv4src);
+    de_ctx->io_ctx.lpm_ipv4dst = SCLpmIPV4CompileRadix(de_ctx->io_ctx.tree_ipv4dst);
+
     /* print all the trees: for debuggin it might print too much info
     SCLogDebug("Radix tree src ipv4:");
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv4src);
@@ -2279,6 +2314,40 @@ int IPOnlyTestSig17(void)
     return result;
 }
 
+/**
+ * \brief Unittest for sig nums spread over several words and blocks of the
+ *        bit arrays.
+ */
+static int IPOnlyTestSig18(void)
+{
+    uint8_t *buf = (uint8_t *)"Hi all!";
+    uint16_t buflen = strlen((char *)buf);
+    uint8_t numpkts = 1;
+    Packet *p[1];
+    char sigbuf[300][128];
+    char *sigs[300];
+    uint32_t sid[300];
+    uint32_t results[300];
+    int i;
+
+    p[0] = UTHBuildPacketSrcDst((uint8_t *)buf, buflen, IPPROTO_TCP, "10.0.0.1", "10.0.0.2");
+
+    /* every 31st rule matches, the rest is for other addresses */
+    for (i = 0; i < 300; i++) {
+        snprintf(sigbuf[i], sizeof(sigbuf[i]), "alert ip %s any -> any any "
+                "(msg:\"Testing src ip\"; sid:%d;)",
+                (i % 31 == 0) ? "10.0.0.1" : "192.168.0.1", i + 1);
+        sigs[i] = sigbuf[i];
+        sid[i] = i + 1;
+        results[i] = (i % 31 == 0) ? 1 : 0;
+    }
+
+    int result = UTHGenericTest(p, numpkts, sigs, sid, (uint32_t *) results, 300);
+
+    UTHFreePackets(p, numpkts);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void IPOnlyRegisterTests(void)
@@ -2314,6 +2383,7 @@ void IPOnlyRegisterTests(void)
     UtRegisterTest("IPOnlyTestSig16", IPOnlyTestSig16);
 
     UtRegisterTest("IPOnlyTestSig17", IPOnlyTestSig17);
+    UtRegisterTest("IPOnlyTestSig18", IPOnlyTestSig18);
 #endif
 
     return;
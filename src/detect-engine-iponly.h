@@ -30,9 +30,13 @@
  * which signatures apply to this addres
  * at IP Only we store SigNumArrays at the radix trees
  */
+/** alignment and number of 64 bit words the bit arrays are processed in */
+#define SIGNUM_ALIGN    32
+#define SIGNUM_BLOCK    4
+
 typedef struct SigNumArray_ {
-    uint8_t *array; /* bit array of sig nums */
-    uint32_t size;  /* size in bytes of the array */
+    uint64_t *array; /* bit array of sig nums */
+    uint32_t size;   /* size in 64 bit words of the array */
 } SigNumArray;
 
 void IPOnlyCIDRListFree(IPOnlyCIDRItem *tmphead);
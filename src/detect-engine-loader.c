@@ -107,6 +107,115 @@ int DetectLoadersSync(void)
     return 0;
 }
 
+/** \internal
+ *  \brief shared state of a DetectLoaderRunTasks() call */
+typedef struct DetectLoaderBatch_ {
+    LoaderFunc Func;
+    void **ctxs;
+    uint32_t cnt;
+    uint32_t next;  /**< next ctx to hand out, protected by m */
+    int result;     /**< or'd results, protected by m */
+    SCMutex m;
+} DetectLoaderBatch;
+
+typedef struct DetectLoaderBatchWorker_ {
+    DetectLoaderBatch *batch;
+    int id;
+    pthread_t t;
+} DetectLoaderBatchWorker;
+
+static void *DetectLoaderBatchRun(void *arg)
+{
+    DetectLoaderBatchWorker *w = (DetectLoaderBatchWorker *)arg;
+    DetectLoaderBatch *batch = w->batch;
+
+    while (1) {
+        SCMutexLock(&batch->m);
+        uint32_t i = batch->next;
+        if (i < batch->cnt)
+            batch->next++;
+        SCMutexUnlock(&batch->m);
+
+        if (i >= batch->cnt)
+            break;
+
+        int r = batch->Func(batch->ctxs[i], w->id);
+
+        SCMutexLock(&batch->m);
+        batch->result |= r;
+        SCMutexUnlock(&batch->m);
+    }
+    return NULL;
+}
+
+static void *DetectLoaderBatchThread(void *arg)
+{
+    /* block usr2. usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+    return DetectLoaderBatchRun(arg);
+}
+
+/** \brief run Func for each of the ctxs on up to 'threads' threads and
+ *         wait for all of them to complete
+ *
+ *  Unlike DetectLoaderQueueTask() this doesn't need the loader threads,
+ *  so it can be used outside of multi-tenancy and from within a loader
+ *  task. The calling thread takes part in the work. Tasks are handed out
+ *  in array order, but may complete in any order.
+ *
+ *  \param threads max threads to use, <= 1 runs the tasks inline
+ *  \retval result 0 for ok, -1 for errors */
+int DetectLoaderRunTasks(int threads, LoaderFunc Func, void **ctxs, uint32_t cnt)
+{
+    DetectLoaderBatch batch;
+    memset(&batch, 0x00, sizeof(batch));
+    batch.Func = Func;
+    batch.ctxs = ctxs;
+    batch.cnt = cnt;
+    SCMutexInit(&batch.m, NULL);
+
+    if (threads < 1)
+        threads = 1;
+    if ((uint32_t)threads > cnt)
+        threads = (int)cnt;
+
+    DetectLoaderBatchWorker *workers = NULL;
+    int spawned = 0;
+    if (threads > 1) {
+        workers = SCCalloc(threads, sizeof(DetectLoaderBatchWorker));
+    }
+    if (workers != NULL) {
+        /* worker 0 is the calling thread */
+        int i;
+        for (i = 1; i < threads; i++) {
+            workers[i].batch = &batch;
+            workers[i].id = i;
+            if (pthread_create(&workers[i].t, NULL,
+                        DetectLoaderBatchThread, &workers[i]) != 0) {
+                SCLogWarning(SC_ERR_THREAD_CREATE, "failed to create "
+                        "loader thread, using %d threads", i);
+                break;
+            }
+            spawned++;
+        }
+    }
+
+    DetectLoaderBatchWorker self = { &batch, 0, 0 };
+    (void)DetectLoaderBatchRun(&self);
+
+    int i;
+    for (i = 1; i <= spawned; i++) {
+        pthread_join(workers[i].t, NULL);
+    }
+    if (workers != NULL)
+        SCFree(workers);
+
+    SCLogDebug("%u tasks done using %d threads", cnt, spawned + 1);
+
+    SCMutexDestroy(&batch.m);
+    return batch.result ? -1 : 0;
+}
+
 static void DetectLoaderInit(DetectLoaderControl *loader)
 {
     memset(loader, 0x00, sizeof(*loader));
@@ -48,6 +48,7 @@ typedef struct DetectLoaderControl_ {
 
 int DetectLoaderQueueTask(int loader_id, LoaderFunc Func, void *func_ctx);
 int DetectLoadersSync(void);
+int DetectLoaderRunTasks(int threads, LoaderFunc Func, void **ctxs, uint32_t cnt);
 void DetectLoadersInit(void);
 
 void TmThreadContinueDetectLoaderThreads();
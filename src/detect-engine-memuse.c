@@ -0,0 +1,616 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory attribution of a detection engine
+ *
+ * Walks the signatures, the signature group heads and the mpm stores of
+ * a built engine and attributes their memory:
+ *
+ * - per signature: the Signature, its SigMatch lists and match arrays and
+ *   the keyword ctxs of keywords that implement SigTableElmt::Memuse
+ * - per group head: the head, its match and non-mpm arrays, the prefilter
+ *   engines and its share of the mpm ctxs it uses (a ctx used by n heads
+ *   counts for 1/n to each)
+ * - per mpm algorithm and per buffer: the mpm ctxs, as accounted by the
+ *   algorithms in MpmCtx::memory_size
+ *
+ * Memory that is allocated per thread (mpm scratch, pcre jit stacks) is
+ * not included.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-parse.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-memuse.h"
+#include "detect-pcre.h"
+#include "util-hashlist.h"
+#include "util-mpm.h"
+#include "util-debug.h"
+
+#ifdef HAVE_LIBJANSSON
+#include <jansson.h>
+#endif
+
+/** default number of signatures and groups listed in the json */
+#define MEMUSE_DEFAULT_LIMIT    20
+
+typedef struct MemuseSig_ {
+    const Signature *s;
+    uint64_t bytes;
+} MemuseSig;
+
+typedef struct MemuseSgh_ {
+    const SigGroupHead *sgh;
+    uint64_t bytes;         /**< own allocations */
+    uint64_t mpm_bytes;     /**< share of the mpm ctxs */
+} MemuseSgh;
+
+/** a mpm ctx and the number of heads using it */
+typedef struct MemuseMpm_ {
+    const MpmCtx *ctx;
+    uint32_t sghs;
+} MemuseMpm;
+
+typedef struct MemuseCounter_ {
+    uint32_t cnt;
+    uint32_t patterns;
+    uint64_t bytes;
+} MemuseCounter;
+
+typedef struct Memuse_ {
+    MemuseSig *sigs;
+    uint32_t sigs_cnt;
+    uint64_t sig_bytes;
+    uint64_t sigmatch_bytes;    /**< SigMatch lists and arrays */
+    uint64_t keyword_bytes;     /**< keyword ctxs, pcre included */
+    uint64_t pcre_bytes;
+    uint32_t keywords_unaccounted;  /**< keyword ctxs without Memuse */
+
+    MemuseSgh *sghs;
+    uint32_t sghs_cnt;
+    uint64_t sgh_bytes;
+
+    HashListTable *mpm_hash;
+    uint32_t mpm_cnt;
+    uint64_t mpm_bytes;
+    uint64_t mpm_shared_bytes;  /**< shared with the previous engine */
+    MemuseCounter mpm_algo[MPM_TABLE_SIZE];
+    MemuseCounter mpm_buffer[MPM_STORE_BUFFERS];
+} Memuse;
+
+static uint32_t MemuseMpmHash(HashListTable *ht, void *data, uint16_t len)
+{
+    const MemuseMpm *m = data;
+    return (uint32_t)(((uintptr_t)m->ctx >> 4) % ht->array_size);
+}
+
+static char MemuseMpmCompare(void *data1, uint16_t len1, void *data2, uint16_t len2)
+{
+    const MemuseMpm *m1 = data1;
+    const MemuseMpm *m2 = data2;
+    return m1->ctx == m2->ctx;
+}
+
+static void MemuseMpmFree(void *data)
+{
+    SCFree(data);
+}
+
+/** \internal
+ *  \brief get the entry of a mpm ctx, adding it if it's new
+ *
+ *  \param added set to 1 if the entry was added */
+static MemuseMpm *MemuseMpmGet(Memuse *mu, const MpmCtx *ctx, int *added)
+{
+    MemuseMpm lookup = { ctx, 0 };
+    MemuseMpm *m = HashListTableLookup(mu->mpm_hash, &lookup, 0);
+    *added = 0;
+    if (m != NULL)
+        return m;
+
+    m = SCCalloc(1, sizeof(*m));
+    if (unlikely(m == NULL))
+        return NULL;
+    m->ctx = ctx;
+    if (HashListTableAdd(mu->mpm_hash, m, 0) != 0) {
+        SCFree(m);
+        return NULL;
+    }
+
+    mu->mpm_cnt++;
+    mu->mpm_bytes += ctx->memory_size;
+    /* only read for the report, so no need for the reuse lock */
+    if (ctx->shared_cnt > 0)
+        mu->mpm_shared_bytes += ctx->memory_size;
+    if (ctx->mpm_type < MPM_TABLE_SIZE) {
+        mu->mpm_algo[ctx->mpm_type].cnt++;
+        mu->mpm_algo[ctx->mpm_type].patterns += ctx->pattern_cnt;
+        mu->mpm_algo[ctx->mpm_type].bytes += ctx->memory_size;
+    }
+    *added = 1;
+    return m;
+}
+
+static uint64_t MemuseSignature(Memuse *mu, const Signature *s)
+{
+    uint64_t bytes = sizeof(*s);
+    if (s->msg != NULL)
+        bytes += strlen(s->msg) + 1;
+    bytes += (s->addr_dst_match4_cnt + s->addr_src_match4_cnt) * sizeof(DetectMatchAddressIPv4);
+    bytes += (s->addr_dst_match6_cnt + s->addr_src_match6_cnt) * sizeof(DetectMatchAddressIPv6);
+
+    int list;
+    for (list = 0; list < DETECT_SM_LIST_MAX; list++) {
+        const SigMatch *sm;
+        for (sm = s->sm_lists[list]; sm != NULL; sm = sm->next) {
+            uint64_t smb = sizeof(SigMatch);
+            if (s->sm_arrays[list] != NULL)
+                smb += sizeof(SigMatchData);
+            mu->sigmatch_bytes += smb;
+            bytes += smb;
+
+            if (sm->ctx == NULL)
+                continue;
+            if (sigmatch_table[sm->type].Memuse == NULL) {
+                mu->keywords_unaccounted++;
+                continue;
+            }
+            uint64_t kwb = sigmatch_table[sm->type].Memuse(sm->ctx);
+            mu->keyword_bytes += kwb;
+            if (sm->type == DETECT_PCRE)
+                mu->pcre_bytes += kwb;
+            bytes += kwb;
+        }
+    }
+    return bytes;
+}
+
+/** max number of mpm ctxs of a head: packet, stream and app layer */
+#define MEMUSE_SGH_MPMS 17
+
+/** \internal
+ *  \brief the mpm ctxs of a head
+ *
+ *  The ts view of the app layer union covers all of its slots, so the
+ *  tc ctxs are listed as well. */
+static int MemuseSghMpmCtxs(const SigGroupHead *sgh, const MpmCtx **ctxs)
+{
+    const MpmCtx *all[] = {
+        sgh->mpm_packet_ctx, sgh->mpm_stream_ctx, sgh->mpm_packet_only_ctx,
+        sgh->mpm_uri_ctx_ts, sgh->mpm_hcbd_ctx_ts, sgh->mpm_hhd_ctx_ts,
+        sgh->mpm_hrhd_ctx_ts, sgh->mpm_hmd_ctx_ts, sgh->mpm_hcd_ctx_ts,
+        sgh->mpm_hrud_ctx_ts, sgh->mpm_huad_ctx_ts, sgh->mpm_hhhd_ctx_ts,
+        sgh->mpm_hrhhd_ctx_ts, sgh->mpm_dnsquery_ctx_ts, sgh->mpm_tlssni_ctx_ts,
+        sgh->mpm_smtp_filedata_ctx_ts, sgh->mpm_http_ctx_ts,
+    };
+    int cnt = 0;
+    size_t i;
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (all[i] == NULL)
+            continue;
+        int j;
+        for (j = 0; j < cnt && ctxs[j] != all[i]; j++)
+            ;
+        if (j == cnt)
+            ctxs[cnt++] = all[i];
+    }
+    return cnt;
+}
+
+static uint64_t MemuseSghOwn(const SigGroupHead *sgh)
+{
+    uint64_t bytes = sizeof(*sgh);
+    bytes += sgh->sig_cnt * sizeof(Signature *);
+    bytes += (sgh->non_mpm_other_store_cnt + sgh->non_mpm_syn_store_cnt) *
+        (sizeof(SignatureMask) + sizeof(SigIntId));
+    if (sgh->alproto_sgh != NULL)
+        bytes += ALPROTO_MAX * sizeof(SigGroupHead *);
+
+    const PrefilterEngine *e;
+    for (e = sgh->engines; e != NULL; e = e->next)
+        bytes += sizeof(*e);
+    return bytes;
+}
+
+static void MemuseFree(Memuse *mu)
+{
+    if (mu->sigs != NULL)
+        SCFree(mu->sigs);
+    if (mu->sghs != NULL)
+        SCFree(mu->sghs);
+    if (mu->mpm_hash != NULL)
+        HashListTableFree(mu->mpm_hash);
+}
+
+static int MemuseCollect(const DetectEngineCtx *de_ctx, Memuse *mu)
+{
+    memset(mu, 0, sizeof(*mu));
+
+    mu->mpm_hash = HashListTableInit(4096, MemuseMpmHash, MemuseMpmCompare,
+            MemuseMpmFree);
+    if (mu->mpm_hash == NULL)
+        return -1;
+
+    const Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next)
+        mu->sigs_cnt++;
+    mu->sigs = SCCalloc(mu->sigs_cnt + 1, sizeof(*mu->sigs));
+    mu->sghs = SCCalloc(de_ctx->sgh_array_cnt + 1, sizeof(*mu->sghs));
+    if (unlikely(mu->sigs == NULL || mu->sghs == NULL))
+        goto error;
+
+    uint32_t i = 0;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next, i++) {
+        mu->sigs[i].s = s;
+        mu->sigs[i].bytes = MemuseSignature(mu, s);
+        mu->sig_bytes += mu->sigs[i].bytes;
+    }
+
+    /* the mpm stores know the buffer of their ctx */
+    HashListTableBucket *htb;
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL)
+            continue;
+        int added;
+        if (MemuseMpmGet(mu, ms->mpm_ctx, &added) == NULL)
+            goto error;
+        int id = MpmStoreGetBufferId(ms);
+        if (added && id >= 0) {
+            mu->mpm_buffer[id].cnt++;
+            mu->mpm_buffer[id].patterns += ms->mpm_ctx->pattern_cnt;
+            mu->mpm_buffer[id].bytes += ms->mpm_ctx->memory_size;
+        }
+    }
+
+    /* count the heads per ctx, then hand out the shares */
+    const MpmCtx *ctxs[MEMUSE_SGH_MPMS];
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL)
+            continue;
+        int cnt = MemuseSghMpmCtxs(sgh, ctxs);
+        int c, added;
+        for (c = 0; c < cnt; c++) {
+            MemuseMpm *m = MemuseMpmGet(mu, ctxs[c], &added);
+            if (m == NULL)
+                goto error;
+            m->sghs++;
+        }
+    }
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL)
+            continue;
+        MemuseSgh *ms = &mu->sghs[mu->sghs_cnt++];
+        ms->sgh = sgh;
+        ms->bytes = MemuseSghOwn(sgh);
+        mu->sgh_bytes += ms->bytes;
+
+        int cnt = MemuseSghMpmCtxs(sgh, ctxs);
+        int c, added;
+        for (c = 0; c < cnt; c++) {
+            const MemuseMpm *m = MemuseMpmGet(mu, ctxs[c], &added);
+            if (m != NULL && m->sghs > 0)
+                ms->mpm_bytes += m->ctx->memory_size / m->sghs;
+        }
+    }
+    return 0;
+
+error:
+    MemuseFree(mu);
+    return -1;
+}
+
+static uint64_t MemuseTotal(const Memuse *mu)
+{
+    return mu->sig_bytes + mu->sgh_bytes + mu->mpm_bytes;
+}
+
+#ifdef HAVE_LIBJANSSON
+static int MemuseSigCompare(const void *a, const void *b)
+{
+    const MemuseSig *s1 = a;
+    const MemuseSig *s2 = b;
+    if (s1->bytes != s2->bytes)
+        return s1->bytes > s2->bytes ? -1 : 1;
+    return 0;
+}
+
+static int MemuseSghCompare(const void *a, const void *b)
+{
+    const MemuseSgh *s1 = a;
+    const MemuseSgh *s2 = b;
+    uint64_t t1 = s1->bytes + s1->mpm_bytes;
+    uint64_t t2 = s2->bytes + s2->mpm_bytes;
+    if (t1 != t2)
+        return t1 > t2 ? -1 : 1;
+    return 0;
+}
+
+static json_t *MemuseCounterJson(const MemuseCounter *c)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+    json_object_set_new(js, "ctxs", json_integer(c->cnt));
+    json_object_set_new(js, "patterns", json_integer(c->patterns));
+    json_object_set_new(js, "bytes", json_integer(c->bytes));
+    return js;
+}
+
+/**
+ * \brief memory report of an engine as json
+ *
+ * \param limit number of signatures and groups to list, costliest first
+ */
+json_t *DetectEngineMemuseJson(const DetectEngineCtx *de_ctx, uint32_t limit)
+{
+    Memuse mu;
+    if (MemuseCollect(de_ctx, &mu) != 0)
+        return NULL;
+
+    json_t *js = json_object();
+    json_t *jsigs = json_object();
+    json_t *jsghs = json_object();
+    json_t *jmpm = json_object();
+    json_t *jalgo = json_object();
+    json_t *jbuf = json_object();
+    json_t *jtopsigs = json_array();
+    json_t *jtopsghs = json_array();
+    if (js == NULL || jsigs == NULL || jsghs == NULL || jmpm == NULL ||
+            jalgo == NULL || jbuf == NULL || jtopsigs == NULL || jtopsghs == NULL) {
+        json_decref(js);
+        json_decref(jsigs);
+        json_decref(jsghs);
+        json_decref(jmpm);
+        json_decref(jalgo);
+        json_decref(jbuf);
+        json_decref(jtopsigs);
+        json_decref(jtopsghs);
+        MemuseFree(&mu);
+        return NULL;
+    }
+
+    json_object_set_new(js, "tenant_id", json_integer(de_ctx->tenant_id));
+    json_object_set_new(js, "bytes", json_integer(MemuseTotal(&mu)));
+
+    uint32_t i;
+    qsort(mu.sigs, mu.sigs_cnt, sizeof(*mu.sigs), MemuseSigCompare);
+    for (i = 0; i < mu.sigs_cnt && i < limit; i++) {
+        json_t *jsig = json_object();
+        if (jsig == NULL)
+            break;
+        json_object_set_new(jsig, "gid", json_integer(mu.sigs[i].s->gid));
+        json_object_set_new(jsig, "sid", json_integer(mu.sigs[i].s->id));
+        json_object_set_new(jsig, "rev", json_integer(mu.sigs[i].s->rev));
+        json_object_set_new(jsig, "bytes", json_integer(mu.sigs[i].bytes));
+        json_array_append_new(jtopsigs, jsig);
+    }
+    json_object_set_new(jsigs, "count", json_integer(mu.sigs_cnt));
+    json_object_set_new(jsigs, "bytes", json_integer(mu.sig_bytes));
+    json_object_set_new(jsigs, "sigmatch_bytes", json_integer(mu.sigmatch_bytes));
+    json_object_set_new(jsigs, "keyword_bytes", json_integer(mu.keyword_bytes));
+    json_object_set_new(jsigs, "pcre_bytes", json_integer(mu.pcre_bytes));
+    json_object_set_new(jsigs, "keywords_unaccounted", json_integer(mu.keywords_unaccounted));
+    json_object_set_new(jsigs, "top", jtopsigs);
+    json_object_set_new(js, "signatures", jsigs);
+
+    qsort(mu.sghs, mu.sghs_cnt, sizeof(*mu.sghs), MemuseSghCompare);
+    for (i = 0; i < mu.sghs_cnt && i < limit; i++) {
+        const MemuseSgh *ms = &mu.sghs[i];
+        json_t *jsgh = json_object();
+        if (jsgh == NULL)
+            break;
+        json_object_set_new(jsgh, "id", json_integer(ms->sgh->id));
+        json_object_set_new(jsgh, "signatures", json_integer(ms->sgh->sig_cnt));
+        json_object_set_new(jsgh, "non_mpm", json_integer(ms->sgh->non_mpm_other_store_cnt));
+        json_object_set_new(jsgh, "bytes", json_integer(ms->bytes));
+        json_object_set_new(jsgh, "mpm_bytes", json_integer(ms->mpm_bytes));
+        json_array_append_new(jtopsghs, jsgh);
+    }
+    json_object_set_new(jsghs, "count", json_integer(mu.sghs_cnt));
+    json_object_set_new(jsghs, "bytes", json_integer(mu.sgh_bytes));
+    json_object_set_new(jsghs, "top", jtopsghs);
+    json_object_set_new(js, "groups", jsghs);
+
+    for (i = 0; i < MPM_TABLE_SIZE; i++) {
+        if (mu.mpm_algo[i].cnt == 0 || mpm_table[i].name == NULL)
+            continue;
+        json_t *jc = MemuseCounterJson(&mu.mpm_algo[i]);
+        if (jc != NULL)
+            json_object_set_new(jalgo, mpm_table[i].name, jc);
+    }
+    for (i = 0; i < MPM_STORE_BUFFERS; i++) {
+        if (mu.mpm_buffer[i].cnt == 0)
+            continue;
+        char name[64];
+        MpmStoreBufferIdToName(i, name, sizeof(name));
+        json_t *jc = MemuseCounterJson(&mu.mpm_buffer[i]);
+        if (jc != NULL)
+            json_object_set_new(jbuf, name, jc);
+    }
+    json_object_set_new(jmpm, "ctxs", json_integer(mu.mpm_cnt));
+    json_object_set_new(jmpm, "bytes", json_integer(mu.mpm_bytes));
+    json_object_set_new(jmpm, "shared_bytes", json_integer(mu.mpm_shared_bytes));
+    json_object_set_new(jmpm, "algorithms", jalgo);
+    json_object_set_new(jmpm, "buffers", jbuf);
+    json_object_set_new(js, "mpm", jmpm);
+
+    MemuseFree(&mu);
+    return js;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief unix socket command 'detect-memuse'
+ *
+ * Optional arguments: 'tenant-id' and 'limit', the number of signatures
+ * and groups to list.
+ */
+TmEcode DetectEngineMemuseCommand(json_t *cmd, json_t *answer, void *data)
+{
+    uint32_t limit = MEMUSE_DEFAULT_LIMIT;
+    json_t *jarg = json_object_get(cmd, "limit");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 0) {
+            json_object_set_new(answer, "message", json_string("invalid limit"));
+            return TM_ECODE_FAILED;
+        }
+        if (json_integer_value(jarg) < UINT32_MAX)
+            limit = (uint32_t)json_integer_value(jarg);
+    }
+
+    DetectEngineCtx *de_ctx = NULL;
+    jarg = json_object_get(cmd, "tenant-id");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg)) {
+            json_object_set_new(answer, "message", json_string("invalid tenant-id"));
+            return TM_ECODE_FAILED;
+        }
+        de_ctx = DetectEngineGetByTenantId((int)json_integer_value(jarg));
+    } else {
+        de_ctx = DetectEngineGetCurrent();
+    }
+    if (de_ctx == NULL) {
+        json_object_set_new(answer, "message", json_string("no detection engine"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *js = DetectEngineMemuseJson(de_ctx, limit);
+    DetectEngineDeReference(&de_ctx);
+    if (js == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+#endif /* HAVE_LIBJANSSON */
+
+/**
+ * \brief log the memory use of a freshly built engine
+ *
+ * If detect.memuse-report is enabled, the full json report is written to
+ * detect-memuse.json in the log dir as well, replaced on each reload.
+ */
+void DetectEngineMemuseReport(const DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->flags & DE_QUIET)
+        return;
+
+    Memuse mu;
+    if (MemuseCollect(de_ctx, &mu) != 0)
+        return;
+
+    SCLogPerf("detect engine (tenant %d) uses %"PRIu64" KiB: signatures "
+            "%"PRIu64" KiB (pcre %"PRIu64" KiB), groups %"PRIu64" KiB, "
+            "mpm %"PRIu64" KiB in %u ctxs (%"PRIu64" KiB shared with the "
+            "previous engine)", de_ctx->tenant_id, MemuseTotal(&mu) / 1024,
+            mu.sig_bytes / 1024, mu.pcre_bytes / 1024, mu.sgh_bytes / 1024,
+            mu.mpm_bytes / 1024, mu.mpm_cnt, mu.mpm_shared_bytes / 1024);
+    MemuseFree(&mu);
+
+#ifdef HAVE_LIBJANSSON
+    int enabled = 0;
+    if (ConfGetBool("detect.memuse-report", &enabled) != 1 || !enabled)
+        return;
+
+    char path[PATH_MAX];
+    if (de_ctx->tenant_id > 0) {
+        snprintf(path, sizeof(path), "%s/detect-memuse-%d.json",
+                ConfigGetLogDirectory(), de_ctx->tenant_id);
+    } else {
+        snprintf(path, sizeof(path), "%s/detect-memuse.json",
+                ConfigGetLogDirectory());
+    }
+
+    json_t *js = DetectEngineMemuseJson(de_ctx, UINT32_MAX);
+    if (js == NULL)
+        return;
+    if (json_dump_file(js, path, JSON_INDENT(2)) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "writing detect memuse report to %s "
+                "failed", path);
+    }
+    json_decref(js);
+#endif
+}
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+static int DetectEngineMemuseTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"abcdefgh\"; pcre:\"/ab[cd]+/\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"ijkl\"; sid:2;)"));
+    FAIL_IF(SigGroupBuild(de_ctx) != 0);
+
+    Memuse mu;
+    FAIL_IF(MemuseCollect(de_ctx, &mu) != 0);
+    FAIL_IF(mu.sigs_cnt != 2);
+    FAIL_IF(mu.pcre_bytes == 0);
+    FAIL_IF(mu.keyword_bytes <= mu.pcre_bytes);
+    FAIL_IF(mu.sghs_cnt == 0);
+    FAIL_IF(mu.mpm_cnt == 0);
+    FAIL_IF(mu.mpm_bytes == 0);
+
+    /* the shares of the heads add up to the ctxs they use */
+    uint64_t share = 0;
+    uint32_t i;
+    for (i = 0; i < mu.sghs_cnt; i++)
+        share += mu.sghs[i].mpm_bytes;
+    FAIL_IF(share > mu.mpm_bytes);
+    FAIL_IF(share == 0);
+
+    uint64_t sig1 = 0, sig2 = 0;
+    for (i = 0; i < mu.sigs_cnt; i++) {
+        if (mu.sigs[i].s->id == 1)
+            sig1 = mu.sigs[i].bytes;
+        else
+            sig2 = mu.sigs[i].bytes;
+    }
+    FAIL_IF(sig1 <= sig2);
+
+    MemuseFree(&mu);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DetectEngineMemuseRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectEngineMemuseTest01", DetectEngineMemuseTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,38 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory attribution of a detection engine
+ */
+
+#ifndef __DETECT_ENGINE_MEMUSE_H__
+#define __DETECT_ENGINE_MEMUSE_H__
+
+void DetectEngineMemuseReport(const DetectEngineCtx *de_ctx);
+
+#ifdef HAVE_LIBJANSSON
+json_t *DetectEngineMemuseJson(const DetectEngineCtx *de_ctx, uint32_t limit);
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DetectEngineMemuseCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+#endif
+
+void DetectEngineMemuseRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_MEMUSE_H__ */
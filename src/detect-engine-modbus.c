@@ -52,17 +52,15 @@
  *
  *  \param  value   Modbus value context (min, max and mode)
  *  \param  min     Minimum value to compare
- *  \param  inter   Interval or maximum (min + inter) value to compare
+ *  \param  max     Maximum value to compare
  *
  *  \retval 1 match or 0 no match
  */
 static int DetectEngineInspectModbusValueMatch(DetectModbusValue    *value,
-                                               uint16_t             min,
-                                               uint16_t             inter)
+                                               uint32_t             min,
+                                               uint32_t             max)
 {
     SCEnter();
-    uint16_t max = min + inter;
-
     int ret = 0;
 
     switch (value->mode) {
@@ -105,7 +103,11 @@ static int DetectEngineInspectModbusData(ModbusTransaction  *tx,
                                          DetectModbusValue  *data)
 {
     SCEnter();
-    uint16_t offset, value = 0, type = tx->type;
+    uint32_t offset;
+    uint16_t value = 0, type = tx->summary.type;
+
+    if (tx->data_cnt == 0)
+        SCReturnInt(0);
 
     if (type & MODBUS_TYP_SINGLE) {
         /* Output/Register(s) Value */
@@ -114,25 +116,19 @@ static int DetectEngineInspectModbusData(ModbusTransaction  *tx,
         else
             value = tx->data[0];
     } else if (type & MODBUS_TYP_MULTIPLE) {
-        int i, size = (int) sizeof(tx->data);
-
-        offset = address - (tx->write.address + 1);
+        offset = address - tx->summary.write_start;
 
         /* In case of Coils, offset is in bit (convert in byte) */
         if (type & MODBUS_TYP_COILS)
             offset >>= 3;
 
-        for (i=0; i< size; i++) {
-            /* Select the correct register/coils amongst the output value */
-            if (!(offset--)) {
-                value = tx->data[i];
-                break;
-            }
-        }
+        /* Select the correct register/coils amongst the output value */
+        if (offset < tx->data_cnt)
+            value = tx->data[offset];
 
         /* In case of Coils,  offset is now in the bit is the rest of previous convert */
         if (type & MODBUS_TYP_COILS) {
-            offset  = (address - (tx->write.address + 1)) & 0x7;
+            offset  = (address - tx->summary.write_start) & 0x7;
             value   = (value >> offset) & 0x1;
         }
     } else {
@@ -163,22 +159,13 @@ static int DetectEngineInspectModbusAddress(ModbusTransaction   *tx,
 
     /* Check if read/write address of request is at/in the address range of signature */
     if (access == MODBUS_TYP_READ) {
-        /* In the PDU Coils are addresses starting at zero */
-        /* therefore Coils numbered 1-16 are addressed as 0-15 */
         ret = DetectEngineInspectModbusValueMatch(address,
-                                                  tx->read.address + 1,
-                                                  tx->read.quantity - 1);
+                                                  tx->summary.read_start,
+                                                  tx->summary.read_end);
     } else {
-        /* In the PDU Registers are addresses starting at zero */
-        /* therefore Registers numbered 1-16 are addressed as 0-15 */
-        if (tx->type & MODBUS_TYP_SINGLE)
-            ret = DetectEngineInspectModbusValueMatch(address,
-                                                      tx->write.address + 1,
-                                                      0);
-        else
-            ret = DetectEngineInspectModbusValueMatch(address,
-                                                      tx->write.address + 1,
-                                                      tx->write.quantity - 1);
+        ret = DetectEngineInspectModbusValueMatch(address,
+                                                  tx->summary.write_start,
+                                                  tx->summary.write_end);
     }
 
     SCReturnInt(ret);
@@ -208,6 +195,7 @@ int DetectEngineInspectModbus(ThreadVars            *tv,
 {
     SCEnter();
     ModbusTransaction   *tx = (ModbusTransaction *)txv;
+    const ModbusTxSummary *summary = &tx->summary;
     SigMatch            *sm = s->sm_lists[DETECT_SM_LIST_MODBUS_MATCH];
     DetectModbus        *modbus = (DetectModbus *) sm->ctx;
 
@@ -220,7 +208,7 @@ int DetectEngineInspectModbus(ThreadVars            *tv,
 
     if (modbus->type == MODBUS_TYP_NONE) {
         if (modbus->category == MODBUS_CAT_NONE) {
-            if (modbus->function == tx->function) {
+            if (modbus->function == summary->function) {
                 if (modbus->subfunction != NULL) {
                     SCLogDebug("looking for Modbus server function %d and subfunction %d",
                                 modbus->function, *(modbus->subfunction));
@@ -232,13 +220,14 @@ int DetectEngineInspectModbus(ThreadVars            *tv,
             }
         } else {
             SCLogDebug("looking for Modbus category function %d", modbus->category);
-            ret = (tx->category & modbus->category)? 1 : 0;
+            ret = (summary->category & modbus->category)? 1 : 0;
         }
     } else {
         uint8_t access      = modbus->type & MODBUS_TYP_ACCESS_MASK;
         uint8_t function    = modbus->type & MODBUS_TYP_ACCESS_FUNCTION_MASK;
 
-        if ((access & tx->type) && ((function == MODBUS_TYP_NONE) || (function & tx->type))) {
+        if ((access & summary->type) &&
+            ((function == MODBUS_TYP_NONE) || (function & summary->type))) {
             if (modbus->address != NULL) {
                 ret = DetectEngineInspectModbusAddress(tx, modbus->address, access);
 
@@ -35,6 +35,7 @@
 #include "detect-engine-siggroup.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-iponly.h"
+#include "detect-engine-loader.h"
 #include "detect-parse.h"
 #include "util-mpm.h"
 #include "util-memcmp.h"
@@ -52,6 +53,7 @@
 #include "stream.h"
 
 #include "util-enum.h"
+#include "detect-engine-fp-feedback.h"
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-validate.h"
@@ -64,6 +66,8 @@ const char *builtin_mpms[] = {
     "toserver UDP packet",
     "toclient UDP packet",
     "other IP packet",
+    "toserver TCP packet only",
+    "toclient TCP packet only",
 
     NULL };
 
@@ -111,37 +115,189 @@ AppLayerMpms app_mpms[] = {
     { NULL, 0, 0, 0, 0, 0, }
 };
 
+/** the small toserver http buffers that go into the combined ctx of
+ *  detect.mpm.http-combined */
+static const int http_combined_lists[] = {
+    DETECT_SM_LIST_UMATCH,
+    DETECT_SM_LIST_HRUDMATCH,
+    DETECT_SM_LIST_HMDMATCH,
+    DETECT_SM_LIST_HHHDMATCH,
+    DETECT_SM_LIST_HRHHDMATCH,
+    DETECT_SM_LIST_HUADMATCH,
+    DETECT_SM_LIST_HCDMATCH,
+    -1,
+};
+
+static AppLayerMpms http_combined_mpm = {
+    "http_combined", MPM_CTX_FACTORY_UNIQUE_CONTEXT, SIG_FLAG_TOSERVER,
+    MPM_STORE_LIST_HTTP_TS, SIG_GROUP_HEAD_MPM_HTTP_TS, -1 };
+
+static int MpmListIsHttpCombined(const int sm_list)
+{
+    int i;
+    for (i = 0; http_combined_lists[i] != -1; i++) {
+        if (http_combined_lists[i] == sm_list)
+            return 1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief check if patterns of 'list' go into a store for 'store_list' */
+static inline int MpmStoreListMatches(const int store_list, const int list)
+{
+    if (store_list == MPM_STORE_LIST_HTTP_TS)
+        return MpmListIsHttpCombined(list);
+    return (store_list == list);
+}
+
+static void DetectMpmInitializeAppMpm(DetectEngineCtx *de_ctx, AppLayerMpms *am)
+{
+    /* default to whatever the global setting is */
+    int shared = (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE);
+
+    /* see if we use a unique or shared mpm ctx for this type */
+    int confshared = 0;
+    char confstring[256] = "detect.mpm.";
+    strlcat(confstring, am->name, sizeof(confstring));
+    strlcat(confstring, ".shared", sizeof(confstring));
+    if (ConfGetBool(confstring, &confshared) == 1)
+        shared = confshared;
+
+    if (shared == 0) {
+        if (!(de_ctx->flags & DE_QUIET)) {
+            SCLogPerf("using unique mpm ctx' for %s", am->name);
+        }
+        am->sgh_mpm_context = MPM_CTX_FACTORY_UNIQUE_CONTEXT;
+    } else {
+        if (!(de_ctx->flags & DE_QUIET)) {
+            SCLogPerf("using shared mpm ctx' for %s", am->name);
+        }
+        am->sgh_mpm_context = MpmFactoryRegisterMpmCtxProfile(de_ctx, am->name);
+    }
+
+    SCLogDebug("AppLayer MPM %s: %u", am->name, am->sgh_mpm_context);
+}
+
 void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx)
 {
     int i;
     for (i = 0; i < APP_MPMS_MAX; i++) {
-        AppLayerMpms *am = &app_mpms[i];
+        DetectMpmInitializeAppMpm(de_ctx, &app_mpms[i]);
+    }
+    if (de_ctx->mpm_http_combined)
+        DetectMpmInitializeAppMpm(de_ctx, &http_combined_mpm);
+}
 
-        /* default to whatever the global setting is */
-        int shared = (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE);
+/**
+ *  \brief prepare a mpm ctx, or queue it for DetectMpmPrepareQueued() if
+ *         the matcher supports preparing ctxs concurrently
+ */
+/**
+ *  \brief switch a ctx with only a few patterns over to the small set
+ *         matcher before it is prepared
+ *
+ *  Only done for the matchers that keep their patterns in the generic
+ *  init hash, so the patterns added so far can be handed over as is.
+ */
+static void MpmSwitchToSmall(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
+{
+    if (de_ctx->mpm_small_max == 0 || mpm_ctx->pattern_cnt == 0 ||
+        mpm_ctx->pattern_cnt > de_ctx->mpm_small_max ||
+        mpm_ctx->init_hash == NULL || mpm_ctx->mpm_type == MPM_TEDDY)
+        return;
+#ifdef __SC_CUDA_SUPPORT__
+    if (mpm_ctx->mpm_type == MPM_AC_CUDA)
+        return;
+#endif
 
-        /* see if we use a unique or shared mpm ctx for this type */
-        int confshared = 0;
-        char confstring[256] = "detect.mpm.";
-        strlcat(confstring, am->name, sizeof(confstring));
-        strlcat(confstring, ".shared", sizeof(confstring));
-        if (ConfGetBool(confstring, &confshared) == 1)
-            shared = confshared;
+    MpmPattern **init_hash = mpm_ctx->init_hash;
+    mpm_ctx->init_hash = NULL;
+    mpm_table[mpm_ctx->mpm_type].DestroyCtx(mpm_ctx);
+    mpm_ctx->ctx = NULL;
 
-        if (shared == 0) {
-            if (!(de_ctx->flags & DE_QUIET)) {
-                SCLogPerf("using unique mpm ctx' for %s", am->name);
-            }
-            am->sgh_mpm_context = MPM_CTX_FACTORY_UNIQUE_CONTEXT;
-        } else {
-            if (!(de_ctx->flags & DE_QUIET)) {
-                SCLogPerf("using shared mpm ctx' for %s", am->name);
-            }
-            am->sgh_mpm_context = MpmFactoryRegisterMpmCtxProfile(de_ctx, am->name);
+    mpm_ctx->mpm_type = MPM_TEDDY;
+    mpm_ctx->init_hash = init_hash;
+    mpm_table[MPM_TEDDY].InitCtx(mpm_ctx);
+    SCLogDebug("mpm_ctx %p with %u patterns switched to %s", mpm_ctx,
+            mpm_ctx->pattern_cnt, mpm_table[MPM_TEDDY].name);
+}
+
+static void MpmPrepare(DetectEngineCtx *de_ctx, MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx == NULL)
+        return;
+
+    MpmSwitchToSmall(de_ctx, mpm_ctx);
+
+    if (mpm_table[mpm_ctx->mpm_type].Prepare == NULL)
+        return;
+
+    if (de_ctx->build_threads > 1 &&
+        (mpm_table[mpm_ctx->mpm_type].flags & MPM_FLAG_PREPARE_THREADSAFE))
+    {
+        if (de_ctx->mpm_prepare_queue_cnt == de_ctx->mpm_prepare_queue_size) {
+            uint32_t size = de_ctx->mpm_prepare_queue_size ?
+                de_ctx->mpm_prepare_queue_size * 2 : 64;
+            MpmCtx **queue = SCRealloc(de_ctx->mpm_prepare_queue,
+                    size * sizeof(MpmCtx *));
+            if (queue == NULL)
+                goto inline_prepare;
+            de_ctx->mpm_prepare_queue = queue;
+            de_ctx->mpm_prepare_queue_size = size;
         }
+        de_ctx->mpm_prepare_queue[de_ctx->mpm_prepare_queue_cnt++] = mpm_ctx;
+        return;
+    }
+
+inline_prepare:
+    mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+}
+
+static int MpmPrepareTask(void *ctx, int loader_id)
+{
+    MpmCtx *mpm_ctx = (MpmCtx *)ctx;
+    SCLogDebug("loader %d preparing mpm_ctx %p (%u patterns)",
+            loader_id, mpm_ctx, mpm_ctx->pattern_cnt);
+    return mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx) == 0 ? 0 : 1;
+}
+
+/**
+ *  \brief prepare all mpm ctxs queued by MpmPrepare() in parallel
+ *
+ *  Returns when all of them are done, so that the rest of the engine
+ *  setup sees the same state as with serial preparation.
+ *
+ *  \retval 0 ok
+ *  \retval -1 one or more ctxs failed to prepare
+ */
+int DetectMpmPrepareQueued(DetectEngineCtx *de_ctx)
+{
+    int r = 0;
+
+    if (de_ctx->mpm_prepare_queue_cnt > 0) {
+        SCLogPerf("preparing %u mpm contexts using up to %d threads",
+                de_ctx->mpm_prepare_queue_cnt, de_ctx->build_threads);
 
-        SCLogDebug("AppLayer MPM %s: %u", am->name, am->sgh_mpm_context);
+        r = DetectLoaderRunTasks(de_ctx->build_threads, MpmPrepareTask,
+                (void **)de_ctx->mpm_prepare_queue,
+                de_ctx->mpm_prepare_queue_cnt);
+        if (r != 0) {
+            SCLogError(SC_ERR_INITIALIZATION, "preparing mpm contexts failed");
+        }
     }
+
+    DetectMpmPrepareQueueFree(de_ctx);
+    return r;
+}
+
+void DetectMpmPrepareQueueFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_prepare_queue != NULL)
+        SCFree(de_ctx->mpm_prepare_queue);
+    de_ctx->mpm_prepare_queue = NULL;
+    de_ctx->mpm_prepare_queue_cnt = 0;
+    de_ctx->mpm_prepare_queue_size = 0;
 }
 
 /**
@@ -159,13 +315,17 @@ void DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx)
         if (am->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
         {
             MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, am->sgh_mpm_context, dir);
-            if (mpm_ctx != NULL) {
-                if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-                    mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-                }
-            }
+            MpmPrepare(de_ctx, mpm_ctx);
         }
     }
+
+    if (de_ctx->mpm_http_combined &&
+        http_combined_mpm.sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+    {
+        MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx,
+                http_combined_mpm.sgh_mpm_context, 1);
+        MpmPrepare(de_ctx, mpm_ctx);
+    }
 }
 
 static int32_t SetupBuiltinMpm(DetectEngineCtx *de_ctx, const char *name)
@@ -211,42 +371,28 @@ void DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx)
 
     if (de_ctx->sgh_mpm_context_proto_tcp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
     }
 
     if (de_ctx->sgh_mpm_context_proto_udp_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_udp_packet, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
     }
 
     if (de_ctx->sgh_mpm_context_proto_other_packet != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_proto_other_packet, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
     }
 
     if (de_ctx->sgh_mpm_context_stream != MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 0);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
         mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, de_ctx->sgh_mpm_context_stream, 1);
-        if (mpm_table[de_ctx->mpm_matcher].Prepare != NULL) {
-            mpm_table[de_ctx->mpm_matcher].Prepare(mpm_ctx);
-        }
+        MpmPrepare(de_ctx, mpm_ctx);
     }
 }
 
@@ -317,6 +463,32 @@ int SignatureHasStreamContent(const Signature *s)
     SCReturnInt(1);
 }
 
+/**
+ *  \brief check if the fast pattern of a signature is added the same way
+ *         to the packet and the stream mpm, so that a stream search over
+ *         data containing a packet's payload finds all its packet matches
+ *
+ *  Offset and depth are relative to the start of the buffer, which differs
+ *  between the packet and the stream, so bounded patterns don't qualify.
+ *
+ *  \retval 1 true
+ *  \retval 0 false
+ */
+int SignatureMpmCoveredByStream(const Signature *s)
+{
+    if (s->mpm_sm == NULL)
+        return 0;
+    if (SigMatchListSMBelongsTo(s, s->mpm_sm) != DETECT_SM_LIST_PMATCH)
+        return 0;
+    if (SignatureHasPacketContent(s) == 0 || SignatureHasStreamContent(s) == 0)
+        return 0;
+
+    const DetectContentData *cd = (const DetectContentData *)s->mpm_sm->ctx;
+    if (cd->offset != 0 || cd->depth != 0)
+        return 0;
+    return 1;
+}
+
 
 /**
  *  \brief  Function to return the multi pattern matcher algorithm to be
@@ -346,7 +518,8 @@ uint16_t PatternMatchDefaultMatcher(void)
                 goto done;
             }
             for (u = 0; u < MPM_TABLE_SIZE; u++) {
-                if (mpm_table[u].name == NULL)
+                if (mpm_table[u].name == NULL ||
+                    (mpm_table[u].flags & MPM_FLAG_SMALL_ONLY))
                     continue;
 
                 if (strcmp(mpm_table[u].name, mpm_algo) == 0) {
@@ -465,13 +638,17 @@ uint32_t PatternStrength(uint8_t *pat, uint16_t patlen)
     return s;
 }
 
+/**
+ *  \param bounded 0 to leave out the offset and depth of the pattern, for
+ *                 ctxs not searched one buffer at a time
+ */
 static void PopulateMpmHelperAddPatternToPktCtx(MpmCtx *mpm_ctx,
                                                 const DetectContentData *cd,
                                                 const Signature *s, uint8_t flags,
-                                                int chop)
+                                                int chop, int bounded)
 {
-    uint16_t pat_offset = cd->offset;
-    uint16_t pat_depth = cd->depth;
+    uint16_t pat_offset = bounded ? cd->offset : 0;
+    uint16_t pat_depth = bounded ? cd->depth : 0;
 
     /* recompute offset/depth to cope with chop */
     if (chop && (pat_depth || pat_offset)) {
@@ -541,7 +718,26 @@ static void SetMpm(Signature *s, SigMatch *mpm_sm)
     return;
 }
 
-void RetrieveFPForSig(Signature *s)
+static inline int RetrieveFPIsHot(const DetectEngineCtx *de_ctx, int list,
+        const DetectContentData *cd)
+{
+    double rate;
+    return DetectFPFeedbackIsHot(de_ctx, list, cd, &rate);
+}
+
+/**
+ *  \brief pick the fast pattern of a signature
+ *
+ *  An explicit fast_pattern is used as is. Otherwise the content comes
+ *  from the highest priority buffer, preferring not negated contents,
+ *  the longest and then the strongest pattern. With fast pattern
+ *  feedback enabled, patterns observed to hit often without the rule
+ *  matching are left out if there is another candidate. If all are
+ *  like that, the one with the lowest hit rate is used.
+ *
+ *  \param de_ctx engine for the feedback stats, may be NULL
+ */
+void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s)
 {
     if (s->mpm_sm != NULL)
         return;
@@ -615,8 +811,41 @@ void RetrieveFPForSig(Signature *s)
 
     BUG_ON(count_final_sm_list == 0);
 
-    int max_len = 0;
     int i;
+
+    /* production feedback: leave out the hot patterns, unless all are */
+    int avoid_hot = 0;
+    if (de_ctx != NULL && de_ctx->fp_feedback != NULL) {
+        int cnt = 0, hot = 0;
+        double rate, min_rate = 0.0;
+        SigMatch *coldest_sm = NULL;
+
+        for (i = 0; i < count_final_sm_list; i++) {
+            for (sm = s->sm_lists[final_sm_list[i]]; sm != NULL; sm = sm->next) {
+                if (sm->type != DETECT_CONTENT)
+                    continue;
+                DetectContentData *cd = (DetectContentData *)sm->ctx;
+                if ((cd->flags & DETECT_CONTENT_NEGATED) && skip_negated_content)
+                    continue;
+                cnt++;
+                if (DetectFPFeedbackIsHot(de_ctx, final_sm_list[i], cd, &rate)) {
+                    hot++;
+                    if (coldest_sm == NULL || rate < min_rate) {
+                        coldest_sm = sm;
+                        min_rate = rate;
+                    }
+                }
+            }
+        }
+        if (hot > 0 && hot == cnt) {
+            SCLogDebug("sig %u: all fast pattern candidates are hot", s->id);
+            SetMpm(s, coldest_sm);
+            return;
+        }
+        avoid_hot = (hot > 0);
+    }
+
+    int max_len = 0;
     for (i = 0; i < count_final_sm_list; i++) {
         for (sm = s->sm_lists[final_sm_list[i]]; sm != NULL; sm = sm->next) {
             if (sm->type != DETECT_CONTENT)
@@ -627,6 +856,8 @@ void RetrieveFPForSig(Signature *s)
              * non-negated content present in the sig */
             if ((cd->flags & DETECT_CONTENT_NEGATED) && skip_negated_content)
                 continue;
+            if (avoid_hot && RetrieveFPIsHot(de_ctx, final_sm_list[i], cd))
+                continue;
             if (max_len < cd->content_len)
                 max_len = cd->content_len;
         }
@@ -644,6 +875,8 @@ void RetrieveFPForSig(Signature *s)
                 continue;
             if (cd->content_len != max_len)
                 continue;
+            if (avoid_hot && RetrieveFPIsHot(de_ctx, final_sm_list[i], cd))
+                continue;
 
             if (mpm_sm == NULL) {
                 mpm_sm = sm;
@@ -729,11 +962,39 @@ static char MpmStoreCompareFunc(void *data1, uint16_t len1, void *data2,
     return 1;
 }
 
+/** protects MpmCtx::shared_cnt of the ctxs shared between engines */
+static SCMutex mpm_reuse_lock = SCMUTEX_INITIALIZER;
+/** prepared unique mpm ctxs of all engines by fingerprint, flagged with
+ *  MPMCTX_FLAGS_SHARED. Protected by mpm_reuse_lock. */
+static HashTable *mpm_share_table = NULL;
+
+/** \internal
+ *  \brief drop a reference to a possibly shared unique mpm ctx
+ *  \retval 1 ctx is still used by another engine
+ *  \retval 0 caller has to free the ctx */
+static int MpmStoreCtxUnshare(MpmCtx *mpm_ctx)
+{
+    int shared = 0;
+    SCMutexLock(&mpm_reuse_lock);
+    if (mpm_ctx->shared_cnt > 0) {
+        mpm_ctx->shared_cnt--;
+        shared = 1;
+    } else if (mpm_ctx->flags & MPMCTX_FLAGS_SHARED) {
+        /* last user, so other engines can't pick it up anymore */
+        if (mpm_share_table != NULL)
+            HashTableRemove(mpm_share_table, mpm_ctx, 0);
+        mpm_ctx->flags &= ~MPMCTX_FLAGS_SHARED;
+    }
+    SCMutexUnlock(&mpm_reuse_lock);
+    return shared;
+}
+
 static void MpmStoreFreeFunc(void *ptr)
 {
     MpmStore *ms = ptr;
     if (ms != NULL) {
-        if (ms->mpm_ctx != NULL && !ms->mpm_ctx->global)
+        if (ms->mpm_ctx != NULL && !ms->mpm_ctx->global &&
+            MpmStoreCtxUnshare(ms->mpm_ctx) == 0)
         {
             SCLogDebug("destroying mpm_ctx %p", ms->mpm_ctx);
             mpm_table[ms->mpm_ctx->mpm_type].DestroyCtx(ms->mpm_ctx);
@@ -851,6 +1112,44 @@ void MpmStoreReportStats(const DetectEngineCtx *de_ctx)
     }
 }
 
+/** \brief get the buffer of a store as an id below MPM_STORE_BUFFERS
+ *
+ *  \retval id or -1 if unknown
+ */
+int MpmStoreGetBufferId(const MpmStore *ms)
+{
+    if (ms->buffer < MPMB_MAX)
+        return ms->buffer;
+    if (ms->sm_list == MPM_STORE_LIST_HTTP_TS)
+        return MPM_STORE_BUFFER_HTTP_TS;
+
+    int i;
+    for (i = 0; i < APP_MPMS_MAX; i++) {
+        if (ms->sm_list == app_mpms[i].sm_list &&
+            ms->direction == app_mpms[i].direction)
+            return MPMB_MAX + i;
+    }
+    return -1;
+}
+
+/** \brief name of a buffer id, e.g. 'toserver TCP packet' or
+ *         'toclient http_header' */
+void MpmStoreBufferIdToName(int id, char *name, size_t size)
+{
+    if (id >= 0 && id < MPMB_MAX) {
+        strlcpy(name, builtin_mpms[id], size);
+    } else if (id == MPM_STORE_BUFFER_HTTP_TS) {
+        snprintf(name, size, "toserver %s", http_combined_mpm.name);
+    } else if (id >= MPMB_MAX && id < MPM_STORE_BUFFER_HTTP_TS) {
+        const AppLayerMpms *am = &app_mpms[id - MPMB_MAX];
+        snprintf(name, size, "%s %s",
+                am->direction == SIG_FLAG_TOSERVER ? "toserver" : "toclient",
+                am->name);
+    } else {
+        strlcpy(name, "unknown", size);
+    }
+}
+
 /**
  * \brief Frees the hash table - DetectEngineCtx->mpm_hash_table, allocated by
  *        MpmStoreInit() function.
@@ -867,7 +1166,224 @@ void MpmStoreFree(DetectEngineCtx *de_ctx)
     return;
 }
 
-void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
+static uint32_t MpmStoreReuseHashFunc(HashTable *ht, void *data, uint16_t datalen)
+{
+    const MpmCtx *mpm_ctx = (MpmCtx *)data;
+    return (uint32_t)(mpm_ctx->fingerprint ^ (mpm_ctx->fingerprint >> 32)) %
+        ht->array_size;
+}
+
+static char MpmStoreReuseCompareFunc(void *data1, uint16_t len1,
+                                     void *data2, uint16_t len2)
+{
+    const MpmCtx *a = (MpmCtx *)data1;
+    const MpmCtx *b = (MpmCtx *)data2;
+
+    return (a->fingerprint == b->fingerprint &&
+            a->mpm_type == b->mpm_type &&
+            a->pattern_cnt == b->pattern_cnt &&
+            a->minlen == b->minlen &&
+            a->maxlen == b->maxlen &&
+            a->max_pat_id == b->max_pat_id);
+}
+
+/** \internal
+ *  \brief compare for the process wide share table
+ *
+ *  The lookup key is a ctx that is not prepared yet, while the ctxs in
+ *  the table are. So the type may differ if the small set matcher took
+ *  over, and prepare may have set MPMCTX_FLAGS_BOUNDED. */
+static char MpmStoreShareCompareFunc(void *data1, uint16_t len1,
+                                     void *data2, uint16_t len2)
+{
+    const MpmCtx *a = (MpmCtx *)data1;
+    const MpmCtx *b = (MpmCtx *)data2;
+
+    return (a->fingerprint == b->fingerprint &&
+            (a->mpm_type == b->mpm_type ||
+             a->mpm_type == MPM_TEDDY || b->mpm_type == MPM_TEDDY) &&
+            (a->flags & MPMCTX_FLAGS_STREAM) == (b->flags & MPMCTX_FLAGS_STREAM) &&
+            a->pattern_cnt == b->pattern_cnt &&
+            a->minlen == b->minlen &&
+            a->maxlen == b->maxlen &&
+            a->max_pat_id == b->max_pat_id);
+}
+
+/** \internal
+ *  \brief replace the ms ctx with an identical prepared one of any other
+ *          engine, e.g. another tenant loaded with the same rules
+ *  \retval 1 ctx shared
+ *  \retval 0 ms has to be prepared */
+static int MpmStoreShare(DetectEngineCtx *de_ctx, MpmStore *ms)
+{
+    if (!de_ctx->mpm_share)
+        return 0;
+
+    MpmCtx *shared_ctx = NULL;
+    SCMutexLock(&mpm_reuse_lock);
+    if (mpm_share_table != NULL) {
+        shared_ctx = HashTableLookup(mpm_share_table, ms->mpm_ctx, 0);
+        if (shared_ctx != NULL)
+            shared_ctx->shared_cnt++;
+    }
+    SCMutexUnlock(&mpm_reuse_lock);
+
+    if (shared_ctx == NULL)
+        return 0;
+
+    SCLogDebug("sharing mpm_ctx %p with %u patterns", shared_ctx,
+            shared_ctx->pattern_cnt);
+
+    mpm_table[ms->mpm_ctx->mpm_type].DestroyCtx(ms->mpm_ctx);
+    SCFree(ms->mpm_ctx);
+    ms->mpm_ctx = shared_ctx;
+    de_ctx->mpm_share_cnt++;
+    return 1;
+}
+
+/**
+ *  \brief add the prepared unique mpm ctxs of an engine to the process
+ *         wide share table
+ *
+ *  Called once all ctxs are prepared, so other engines never see one
+ *  that is still being built. If an identical ctx is already in the
+ *  table, e.g. from a tenant built at the same time, ours stays private.
+ */
+void MpmStoreSharePublish(DetectEngineCtx *de_ctx)
+{
+    if (!de_ctx->mpm_share || de_ctx->mpm_hash_table == NULL)
+        return;
+
+    uint32_t added = 0;
+    SCMutexLock(&mpm_reuse_lock);
+    if (mpm_share_table == NULL) {
+        mpm_share_table = HashTableInit(4096, MpmStoreReuseHashFunc,
+                                        MpmStoreShareCompareFunc, NULL);
+        if (mpm_share_table == NULL) {
+            SCMutexUnlock(&mpm_reuse_lock);
+            return;
+        }
+    }
+
+    HashListTableBucket *htb = NULL;
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL || ms->mpm_ctx->global ||
+            ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT ||
+            (ms->mpm_ctx->flags & MPMCTX_FLAGS_SHARED))
+            continue;
+        if (HashTableLookup(mpm_share_table, ms->mpm_ctx, 0) != NULL)
+            continue;
+        if (HashTableAdd(mpm_share_table, ms->mpm_ctx, 0) != 0)
+            break;
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_SHARED;
+        added++;
+    }
+    SCMutexUnlock(&mpm_reuse_lock);
+
+    if (!(de_ctx->flags & DE_QUIET)) {
+        SCLogPerf("shared %u unique mpm contexts of other engines, "
+                "offering %u new ones", de_ctx->mpm_share_cnt, added);
+    }
+}
+
+/** \brief free the process wide share table at shutdown */
+void MpmStoreShareTableFree(void)
+{
+    SCMutexLock(&mpm_reuse_lock);
+    if (mpm_share_table != NULL) {
+        HashTableFree(mpm_share_table);
+        mpm_share_table = NULL;
+    }
+    SCMutexUnlock(&mpm_reuse_lock);
+}
+
+/** \internal
+ *  \brief index the unique mpm ctxs of the engine we're replacing */
+static int MpmStoreReuseTableInit(DetectEngineCtx *de_ctx)
+{
+    const DetectEngineCtx *old_de_ctx = de_ctx->mpm_reuse_de_ctx;
+
+    if (old_de_ctx->mpm_hash_table == NULL ||
+        old_de_ctx->mpm_matcher != de_ctx->mpm_matcher)
+        return -1;
+
+    de_ctx->mpm_reuse_table = HashTableInit(4096, MpmStoreReuseHashFunc,
+                                            MpmStoreReuseCompareFunc, NULL);
+    if (de_ctx->mpm_reuse_table == NULL)
+        return -1;
+
+    HashListTableBucket *htb = NULL;
+    for (htb = HashListTableGetListHead(old_de_ctx->mpm_hash_table);
+            htb != NULL;
+            htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms == NULL || ms->mpm_ctx == NULL || ms->mpm_ctx->global ||
+            ms->sgh_mpm_context != MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+            continue;
+        if (HashTableLookup(de_ctx->mpm_reuse_table, ms->mpm_ctx, 0) != NULL)
+            continue;
+        if (HashTableAdd(de_ctx->mpm_reuse_table, ms->mpm_ctx, 0) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief replace the ms ctx with an identical one from the engine we're
+ *          replacing, so it doesn't have to be prepared again
+ *  \retval 1 ctx reused
+ *  \retval 0 ms has to be prepared */
+static int MpmStoreReuse(DetectEngineCtx *de_ctx, MpmStore *ms)
+{
+    if (de_ctx->mpm_reuse_de_ctx == NULL)
+        return 0;
+
+    if (de_ctx->mpm_reuse_table == NULL) {
+        if (MpmStoreReuseTableInit(de_ctx) != 0) {
+            MpmStoreReuseTableFree(de_ctx);
+            de_ctx->mpm_reuse_de_ctx = NULL;
+            return 0;
+        }
+    }
+
+    MpmCtx *old_ctx = HashTableLookup(de_ctx->mpm_reuse_table, ms->mpm_ctx, 0);
+    if (old_ctx == NULL)
+        return 0;
+
+    SCMutexLock(&mpm_reuse_lock);
+    old_ctx->shared_cnt++;
+    SCMutexUnlock(&mpm_reuse_lock);
+
+    SCLogDebug("reusing mpm_ctx %p with %u patterns", old_ctx,
+            old_ctx->pattern_cnt);
+
+    mpm_table[ms->mpm_ctx->mpm_type].DestroyCtx(ms->mpm_ctx);
+    SCFree(ms->mpm_ctx);
+    ms->mpm_ctx = old_ctx;
+    de_ctx->mpm_reuse_cnt++;
+    return 1;
+}
+
+/** \brief release the reuse lookup once the mpm stores are set up */
+void MpmStoreReuseTableFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->mpm_reuse_table != NULL) {
+        HashTableFree(de_ctx->mpm_reuse_table);
+        de_ctx->mpm_reuse_table = NULL;
+
+        if (!(de_ctx->flags & DE_QUIET)) {
+            SCLogPerf("reused %u unique mpm contexts of the previous engine",
+                    de_ctx->mpm_reuse_cnt);
+        }
+    }
+}
+
+void MpmStoreSetup(DetectEngineCtx *de_ctx, MpmStore *ms)
 {
     const Signature *s = NULL;
     uint32_t sig;
@@ -881,6 +1397,7 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
             /* TS is 1 */
             case MPMB_TCP_PKT_TS:
             case MPMB_TCP_STREAM_TS:
+            case MPMB_TCP_PKT_ONLY_TS:
             case MPMB_UDP_TS:
                 dir = 1;
                 break;
@@ -890,6 +1407,7 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
             case MPMB_UDP_TC:
             case MPMB_TCP_STREAM_TC:
             case MPMB_TCP_PKT_TC:
+            case MPMB_TCP_PKT_ONLY_TC:
             case MPMB_OTHERIP:          /**< use 0 for other */
                 dir = 0;
                 break;
@@ -910,6 +1428,13 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         return;
 
     MpmInitCtx(ms->mpm_ctx, de_ctx->mpm_matcher);
+    if (ms->buffer == MPMB_TCP_STREAM_TS || ms->buffer == MPMB_TCP_STREAM_TC)
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_STREAM;
+    /* the combined buffers are searched together, so offset and depth
+     * can't be applied */
+    const int bounded = (ms->sm_list != MPM_STORE_LIST_HTTP_TS);
+    if (!bounded)
+        ms->mpm_ctx->flags |= MPMCTX_FLAGS_VECTOR;
 
     /* add the patterns */
     for (sig = 0; sig < (ms->sid_array_size * 8); sig++) {
@@ -922,7 +1447,7 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
             int list = SigMatchListSMBelongsTo(s, s->mpm_sm);
             if (list < 0)
                 continue;
-            if (list != ms->sm_list)
+            if (!MpmStoreListMatches(ms->sm_list, list))
                 continue;
             if ((s->flags & ms->direction) == 0)
                 continue;
@@ -946,7 +1471,8 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
 
             if (!skip) {
                 PopulateMpmHelperAddPatternToPktCtx(ms->mpm_ctx,
-                        cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP));
+                        cd, s, 0, (cd->flags & DETECT_CONTENT_FAST_PATTERN_CHOP),
+                        bounded);
             }
         }
     }
@@ -955,10 +1481,11 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
     } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
-            }
+        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+            MpmStoreReuse(de_ctx, ms) == 0 &&
+            MpmStoreShare(de_ctx, ms) == 0)
+        {
+            MpmPrepare(de_ctx, ms->mpm_ctx);
         }
     }
 }
@@ -995,6 +1522,12 @@ MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
         case MPMB_OTHERIP:
             sgh_mpm_context = de_ctx->sgh_mpm_context_proto_other_packet;
             break;
+        case MPMB_TCP_PKT_ONLY_TS:
+        case MPMB_TCP_PKT_ONLY_TC:
+            /* a subset of the packet patterns of this sgh, can't be
+             * added to a shared ctx */
+            sgh_mpm_context = MPM_CTX_FACTORY_UNIQUE_CONTEXT;
+            break;
         default:
             break;
     }
@@ -1002,12 +1535,14 @@ MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
     switch(buf) {
         case MPMB_TCP_PKT_TS:
         case MPMB_TCP_STREAM_TS:
+        case MPMB_TCP_PKT_ONLY_TS:
         case MPMB_UDP_TS:
             direction = SIG_FLAG_TOSERVER;
             break;
 
         case MPMB_TCP_PKT_TC:
         case MPMB_TCP_STREAM_TC:
+        case MPMB_TCP_PKT_ONLY_TC:
         case MPMB_UDP_TC:
             direction = SIG_FLAG_TOCLIENT;
             break;
@@ -1053,6 +1588,15 @@ MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
                     cnt++;
                 }
                 break;
+            case MPMB_TCP_PKT_ONLY_TS:
+            case MPMB_TCP_PKT_ONLY_TC:
+                if (SignatureHasPacketContent(s) == 1 &&
+                    SignatureMpmCoveredByStream(s) == 0)
+                {
+                    sids_array[s->num / 8] |= 1 << (s->num % 8);
+                    cnt++;
+                }
+                break;
             case MPMB_UDP_TS:
             case MPMB_UDP_TC:
                 sids_array[s->num / 8] |= 1 << (s->num % 8);
@@ -1126,7 +1670,7 @@ MpmStore *MpmStorePrepareBuffer2(DetectEngineCtx *de_ctx, SigGroupHead *sgh, App
         if ((s->flags & am->direction) == 0)
             continue;
 
-        if (list != am->sm_list)
+        if (!MpmStoreListMatches(am->sm_list, list))
             continue;
 
         sids_array[s->num / 8] |= 1 << (s->num % 8);
@@ -1227,6 +1771,40 @@ void MpmStoreFixup(SigGroupHead *sgh)
 #undef SET_TC
 }
 
+/** \internal
+ *  \brief set up the packet only mpm of a tcp sgh for detect.mpm.stream-dedup
+ */
+static void PatternMatchPrepareGroupDedup(DetectEngineCtx *de_ctx,
+        SigGroupHead *sh, enum MpmBuiltinBuffers buf)
+{
+    if (!de_ctx->mpm_stream_dedup ||
+        sh->mpm_packet_ctx == NULL || sh->mpm_stream_ctx == NULL)
+        return;
+
+    uint32_t covered = 0, uncovered = 0;
+    uint32_t sig;
+    for (sig = 0; sig < sh->sig_cnt; sig++) {
+        const Signature *s = sh->match_array[sig];
+        if (s == NULL || SignatureHasPacketContent(s) == 0)
+            continue;
+        if (SignatureMpmCoveredByStream(s))
+            covered++;
+        else
+            uncovered++;
+    }
+    if (covered == 0)
+        return;
+
+    MpmStore *mpm_store = NULL;
+    if (uncovered > 0) {
+        mpm_store = MpmStorePrepareBuffer(de_ctx, sh, buf);
+        if (mpm_store == NULL)
+            return;
+    }
+    sh->mpm_packet_only_ctx = mpm_store ? mpm_store->mpm_ctx : NULL;
+    sh->flags |= SIG_GROUP_HEAD_MPM_PACKET_DEDUP;
+}
+
 /** \brief Prepare the pattern matcher ctx in a sig group head.
  *
  */
@@ -1251,6 +1829,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                 if (sh->mpm_stream_ctx)
                     sh->flags |= SIG_GROUP_HEAD_MPM_STREAM;
             }
+            PatternMatchPrepareGroupDedup(de_ctx, sh, MPMB_TCP_PKT_ONLY_TS);
         }
         if (SGH_DIRECTION_TC(sh)) {
             mpm_store = MpmStorePrepareBuffer(de_ctx, sh, MPMB_TCP_PKT_TC);
@@ -1268,6 +1847,7 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
                 if (sh->mpm_stream_ctx)
                     sh->flags |= SIG_GROUP_HEAD_MPM_STREAM;
             }
+            PatternMatchPrepareGroupDedup(de_ctx, sh, MPMB_TCP_PKT_ONLY_TC);
        }
     } else if (SGH_PROTO(sh, IPPROTO_UDP)) {
         if (SGH_DIRECTION_TS(sh)) {
@@ -1302,8 +1882,24 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
         }
     }
 
+    /* the small http request buffers in one ctx */
+    const MpmCtx *http_ctx = NULL;
+    if (de_ctx->mpm_http_combined && SGH_PROTO(sh, IPPROTO_TCP) &&
+        SGH_DIRECTION_TS(sh))
+    {
+        mpm_store = MpmStorePrepareBuffer2(de_ctx, sh, &http_combined_mpm);
+        if (mpm_store != NULL)
+            http_ctx = mpm_store->mpm_ctx;
+    }
+
     AppLayerMpms *a = app_mpms;
     while (a->name != NULL) {
+        if (http_ctx != NULL && a->direction == SIG_FLAG_TOSERVER &&
+            MpmListIsHttpCombined(a->sm_list))
+        {
+            a++;
+            continue;
+        }
         mpm_store = MpmStorePrepareBuffer2(de_ctx, sh, a);
         if (mpm_store != NULL) {
             sh->init->app_mpms[a->id] = mpm_store->mpm_ctx;
@@ -1314,6 +1910,11 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
     }
 
     MpmStoreFixup(sh);
+
+    if (http_ctx != NULL) {
+        sh->mpm_http_ctx_ts = http_ctx;
+        sh->flags |= SIG_GROUP_HEAD_MPM_HTTP_TS;
+    }
     return 0;
 }
 
@@ -1346,7 +1947,7 @@ int DetectSetFastPatternAndItsId(DetectEngineCtx *de_ctx)
      * true size, since duplicates are removed below, but counted here.
      */
     for (s = de_ctx->sig_list; s != NULL; s = s->next) {
-        RetrieveFPForSig(s);
+        RetrieveFPForSig(de_ctx, s);
         if (s->mpm_sm != NULL) {
             DetectContentData *cd = (DetectContentData *)s->mpm_sm->ctx;
             struct_total_size += sizeof(DetectFPAndItsId);
@@ -36,12 +36,15 @@ void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx);
 void DetectMpmPrepareAppMpms(DetectEngineCtx *de_ctx);
 void DetectMpmInitializeBuiltinMpms(DetectEngineCtx *de_ctx);
 void DetectMpmPrepareBuiltinMpms(DetectEngineCtx *de_ctx);
+int DetectMpmPrepareQueued(DetectEngineCtx *de_ctx);
+void DetectMpmPrepareQueueFree(DetectEngineCtx *de_ctx);
 
 uint32_t PatternStrength(uint8_t *, uint16_t);
 
 uint16_t PatternMatchDefaultMatcher(void);
 uint32_t PacketPatternSearchWithStreamCtx(DetectEngineThreadCtx *, Packet *);
 uint32_t PacketPatternSearch(DetectEngineThreadCtx *, Packet *);
+uint32_t PacketOnlyPatternSearch(DetectEngineThreadCtx *, Packet *);
 uint32_t StreamPatternSearch(DetectEngineThreadCtx *, Packet *, StreamMsg *, uint8_t);
 uint32_t DnsQueryPatternSearch(DetectEngineThreadCtx *det_ctx, uint8_t *buffer, uint32_t buffer_len, uint8_t flags);
 
@@ -64,12 +67,25 @@ void DbgPrintSearchStats();
 
 int SignatureHasPacketContent(const Signature *);
 int SignatureHasStreamContent(const Signature *);
+int SignatureMpmCoveredByStream(const Signature *);
 
-void RetrieveFPForSig(Signature *s);
+void RetrieveFPForSig(const DetectEngineCtx *de_ctx, Signature *s);
 
 int MpmStoreInit(DetectEngineCtx *);
 void MpmStoreFree(DetectEngineCtx *);
+void MpmStoreReuseTableFree(DetectEngineCtx *de_ctx);
+void MpmStoreSharePublish(DetectEngineCtx *de_ctx);
+void MpmStoreShareTableFree(void);
 void MpmStoreReportStats(const DetectEngineCtx *de_ctx);
+
+/** pseudo list of the store of the combined http request buffers */
+#define MPM_STORE_LIST_HTTP_TS      DETECT_SM_LIST_MAX
+/** buffer id of that store */
+#define MPM_STORE_BUFFER_HTTP_TS    (MPMB_MAX + APP_MPMS_MAX)
+/** number of buffer ids of MpmStoreGetBufferId() */
+#define MPM_STORE_BUFFERS (MPMB_MAX + APP_MPMS_MAX + 1)
+int MpmStoreGetBufferId(const MpmStore *ms);
+void MpmStoreBufferIdToName(int id, char *name, size_t size);
 MpmStore *MpmStorePrepareBuffer(DetectEngineCtx *de_ctx, SigGroupHead *sgh, enum MpmBuiltinBuffers buf);
 
 /**
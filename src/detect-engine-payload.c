@@ -34,6 +34,7 @@
 #include "detect-engine-content-inspection.h"
 
 #include "stream.h"
+#include "stream-tcp-private.h"
 
 #include "util-debug.h"
 #include "util-print.h"
@@ -79,15 +80,58 @@ uint32_t StreamPatternSearch(DetectEngineThreadCtx *det_ctx, const Packet *p,
     SCEnter();
 
     uint32_t ret = 0;
+    const MpmCtx *mpm_ctx = det_ctx->sgh->mpm_stream_ctx;
 
     //PrintRawDataFp(stdout, smsg->data.data, smsg->data.data_len);
 
+    /* with a stream mode capable mpm keep the matcher state in the
+     * TcpStream, so that data is not rescanned when smsgs overlap */
+    void **state = NULL;
+    if ((mpm_ctx->flags & MPMCTX_FLAGS_STREAM) &&
+        mpm_table[mpm_ctx->mpm_type].SearchStream != NULL &&
+        p->flow != NULL && p->flow->protoctx != NULL)
+    {
+        TcpSession *ssn = (TcpSession *)p->flow->protoctx;
+        TcpStream *stream = (flags & STREAM_TOSERVER) ? &ssn->client : &ssn->server;
+        state = &stream->mpm_state;
+    }
+
+    /* without matcher state the smsgs are independent, so they can all be
+     * handed to the offload backend at once */
+    if (state == NULL && det_ctx->mpm_offload_jobs != NULL) {
+        MpmOffloadJob *jobs[DETECT_MPM_OFFLOAD_BATCH];
+        uint32_t cnt = 0;
+
+        for ( ; smsg != NULL; smsg = smsg->next) {
+            if (smsg->data_len < mpm_ctx->minlen)
+                continue;
+            MpmOffloadJob *job = &det_ctx->mpm_offload_jobs[cnt];
+            job->mpm_ctx = mpm_ctx;
+            job->buf = smsg->data;
+            job->len = smsg->data_len;
+            jobs[cnt++] = job;
+            if (cnt == DETECT_MPM_OFFLOAD_BATCH) {
+                ret += MpmOffloadSearch(&det_ctx->mtcs, &det_ctx->pmq, jobs, cnt);
+                cnt = 0;
+            }
+        }
+        if (cnt > 0)
+            ret += MpmOffloadSearch(&det_ctx->mtcs, &det_ctx->pmq, jobs, cnt);
+        SCReturnInt(ret);
+    }
+
     uint32_t r;
     for ( ; smsg != NULL; smsg = smsg->next) {
-        if (smsg->data_len >= det_ctx->sgh->mpm_stream_ctx->minlen) {
-            r = mpm_table[det_ctx->sgh->mpm_stream_ctx->mpm_type].
-                Search(det_ctx->sgh->mpm_stream_ctx, &det_ctx->mtcs,
-                        &det_ctx->pmq, smsg->data, smsg->data_len);
+        if (smsg->data_len >= mpm_ctx->minlen) {
+            if (state != NULL) {
+                r = mpm_table[mpm_ctx->mpm_type].
+                    SearchStream(mpm_ctx, &det_ctx->mtcs, &det_ctx->pmq,
+                            state, smsg->seq, smsg->data, smsg->data_len);
+            } else {
+                r = mpm_table[mpm_ctx->mpm_type].
+                    Search(mpm_ctx, &det_ctx->mtcs,
+                            &det_ctx->pmq, smsg->data, smsg->data_len);
+            }
             if (r > 0) {
                 ret += r;
             }
@@ -117,23 +161,51 @@ uint32_t PacketPatternSearch(DetectEngineThreadCtx *det_ctx, Packet *p)
     if (p->payload_len < mpm_ctx->minlen)
         SCReturnInt(0);
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (p->cuda_pkt_vars.cuda_mpm_enabled && p->pkt_src == PKT_SRC_WIRE) {
-        ret = SCACCudaPacketResultsProcessing(p, mpm_ctx, &det_ctx->pmq);
-    } else {
-        ret = mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
-                                                  &det_ctx->mtc,
-                                                  &det_ctx->pmq,
-                                                  p->payload,
-                                                  p->payload_len);
-    }
-#else
+    /* searched by the offload backend from the flow worker, if it was for
+     * this ctx */
+    if (MpmOffloadPacketResult(p, mpm_ctx, &det_ctx->pmq, &ret) == 1)
+        SCReturnInt(ret);
+
+    ret = mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
+                                              &det_ctx->mtc,
+                                              &det_ctx->pmq,
+                                              p->payload,
+                                              p->payload_len);
+
+    SCReturnInt(ret);
+}
+
+/** \brief Pattern match the packet payload for the patterns the stream
+ *         mpm didn't cover, see SIG_GROUP_HEAD_MPM_PACKET_DEDUP.
+ *
+ *  \param det_ctx detection engine thread ctx
+ *  \param p packet to inspect, its payload was covered by the stream mpm
+ *
+ *  \retval ret number of matches
+ */
+uint32_t PacketOnlyPatternSearch(DetectEngineThreadCtx *det_ctx, Packet *p)
+{
+    SCEnter();
+
+    uint32_t ret = 0;
+
+    /* a search for the full packet ctx that was done already is a superset */
+    if (det_ctx->sgh->mpm_packet_ctx != NULL &&
+        MpmOffloadPacketResult(p, det_ctx->sgh->mpm_packet_ctx,
+                               &det_ctx->pmq, &ret) == 1)
+        SCReturnInt(ret);
+
+    const MpmCtx *mpm_ctx = det_ctx->sgh->mpm_packet_only_ctx;
+    if (mpm_ctx == NULL)
+        SCReturnInt(0);
+    if (p->payload_len < mpm_ctx->minlen)
+        SCReturnInt(0);
+
     ret = mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx,
                                               &det_ctx->mtc,
                                               &det_ctx->pmq,
                                               p->payload,
                                               p->payload_len);
-#endif
 
     SCReturnInt(ret);
 }
@@ -166,7 +238,7 @@ int DetectEngineInspectPacketPayload(DetectEngineCtx *de_ctx,
     det_ctx->replist = NULL;
     //det_ctx->flags |= DETECT_ENGINE_THREAD_CTX_INSPECTING_PACKET;
 
-    r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_PMATCH],
+    r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_arrays[DETECT_SM_LIST_PMATCH],
                                       f, p->payload, p->payload_len, 0,
                                       DETECT_ENGINE_CONTENT_INSPECTION_MODE_PAYLOAD, p);
     //r = DoInspectPacketPayload(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_PMATCH], p, f, p->payload, p->payload_len);
@@ -210,7 +282,7 @@ int DetectEngineInspectStreamPayload(DetectEngineCtx *de_ctx,
     det_ctx->inspection_recursion_counter = 0;
     //det_ctx->flags |= DETECT_ENGINE_THREAD_CTX_INSPECTING_STREAM;
 
-    r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_lists[DETECT_SM_LIST_PMATCH],
+    r = DetectEngineContentInspection(de_ctx, det_ctx, s, s->sm_arrays[DETECT_SM_LIST_PMATCH],
                                       f, payload, payload_len, 0,
                                       DETECT_ENGINE_CONTENT_INSPECTION_MODE_STREAM, NULL);
 
@@ -1165,6 +1237,44 @@ end:
     return result;
 }
 
+/**
+ * \test detect.mpm.stream-dedup: the packet only mpm holds the patterns
+ *       the stream mpm doesn't have or applies differently.
+ */
+static int PayloadTestMpmStreamDedup01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_stream_dedup = 1;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"covered\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"bounded\"; depth:20; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"packet\"; flow:only_packet; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"stream\"; flow:only_stream; sid:4;)"));
+    SigGroupBuild(de_ctx);
+
+    uint32_t i, dedup = 0;
+    for (i = 0; i < de_ctx->sgh_array_cnt; i++) {
+        const SigGroupHead *sgh = de_ctx->sgh_array[i];
+        if (sgh == NULL || !(sgh->flags & SIG_GROUP_HEAD_MPM_PACKET_DEDUP))
+            continue;
+        FAIL_IF_NULL(sgh->mpm_packet_ctx);
+        FAIL_IF_NULL(sgh->mpm_packet_only_ctx);
+        FAIL_IF(sgh->mpm_packet_ctx->pattern_cnt != 3);
+        FAIL_IF(sgh->mpm_packet_only_ctx->pattern_cnt != 2);
+        dedup++;
+    }
+    FAIL_IF(dedup == 0);
+
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void PayloadRegisterTests(void)
@@ -1206,6 +1316,8 @@ void PayloadRegisterTests(void)
     UtRegisterTest("PayloadTestSig32", PayloadTestSig32);
     UtRegisterTest("PayloadTestSig33", PayloadTestSig33);
     UtRegisterTest("PayloadTestSig34", PayloadTestSig34);
+    UtRegisterTest("PayloadTestMpmStreamDedup01",
+                   PayloadTestMpmStreamDedup01);
 #endif /* UNITTESTS */
 
     return;
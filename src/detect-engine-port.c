@@ -328,6 +328,128 @@ error:
     return -1;
 }
 
+/** start of a port range or the port after its end */
+typedef struct PortEvent_ {
+    uint32_t pos;
+    uint32_t idx;   /**< ports array index */
+    int start;
+} PortEvent;
+
+static int PortEventCmp(const void *a, const void *b)
+{
+    const PortEvent *ea = a;
+    const PortEvent *eb = b;
+    if (ea->pos != eb->pos)
+        return ea->pos < eb->pos ? -1 : 1;
+    return 0;
+}
+
+/**
+ * \brief Build the sorted, non-overlapping list of a set of possibly
+ *        overlapping ports, every part getting the sigs of all the ports
+ *        covering it.
+ *
+ *        This is the list inserting a copy of each port with
+ *        DetectPortInsert gives, but that walks the list and recurses on
+ *        every cut, which is quadratic in the number of ports. Here the
+ *        range ends are sorted once and swept, keeping the set of ports
+ *        covering the current position.
+ *
+ * \param de_ctx Pointer to the current detection engine context
+ * \param ports array of ports, not changed
+ * \param cnt number of ports
+ * \param head set to the new list
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int DetectPortSweep(DetectEngineCtx *de_ctx, DetectPort **ports, uint32_t cnt,
+                    DetectPort **head)
+{
+    DetectPort *list = NULL, *tail = NULL;
+    PortEvent *ev = NULL;
+    uint32_t *active = NULL;    /**< indexes of the covering ports */
+    uint32_t *active_pos = NULL;
+    uint32_t active_cnt = 0;
+    uint32_t i, n = 0;
+
+    *head = NULL;
+    if (cnt == 0)
+        return 0;
+
+    ev = SCMalloc(2 * cnt * sizeof(*ev));
+    active = SCMalloc(cnt * sizeof(*active));
+    active_pos = SCMalloc(cnt * sizeof(*active_pos));
+    if (unlikely(ev == NULL || active == NULL || active_pos == NULL))
+        goto error;
+
+    for (i = 0; i < cnt; i++) {
+        ev[n].pos = ports[i]->port;
+        ev[n].idx = i;
+        ev[n++].start = 1;
+        ev[n].pos = (uint32_t)ports[i]->port2 + 1;
+        ev[n].idx = i;
+        ev[n++].start = 0;
+    }
+    qsort(ev, n, sizeof(*ev), PortEventCmp);
+
+    i = 0;
+    while (i < n) {
+        const uint32_t pos = ev[i].pos;
+        for ( ; i < n && ev[i].pos == pos; i++) {
+            const uint32_t idx = ev[i].idx;
+            if (ev[i].start) {
+                active_pos[idx] = active_cnt;
+                active[active_cnt++] = idx;
+            } else {
+                const uint32_t last = active[--active_cnt];
+                active[active_pos[idx]] = last;
+                active_pos[last] = active_pos[idx];
+            }
+        }
+        /* every start has its end, so there is a next position */
+        if (active_cnt == 0)
+            continue;
+
+        DetectPort *dp = DetectPortInit();
+        if (dp == NULL)
+            goto error;
+        dp->port = (uint16_t)pos;
+        dp->port2 = (uint16_t)(ev[i].pos - 1);
+
+        uint32_t a;
+        for (a = 0; a < active_cnt; a++) {
+            if (SigGroupHeadCopySigs(de_ctx, ports[active[a]]->sh, &dp->sh) < 0) {
+                DetectPortFree(dp);
+                goto error;
+            }
+        }
+
+        dp->prev = tail;
+        if (tail != NULL)
+            tail->next = dp;
+        else
+            list = dp;
+        tail = dp;
+    }
+
+    SCFree(ev);
+    SCFree(active);
+    SCFree(active_pos);
+    *head = list;
+    return 0;
+
+error:
+    if (ev != NULL)
+        SCFree(ev);
+    if (active != NULL)
+        SCFree(active);
+    if (active_pos != NULL)
+        SCFree(active_pos);
+    DetectPortCleanupList(list);
+    return -1;
+}
+
 /**
  * \brief Function that cuts port groups and merge them
  *
@@ -818,6 +940,87 @@ DetectPortLookupGroup(DetectPort *dp, uint16_t port)
     return NULL;
 }
 
+/**
+ * \brief Flatten a DetectPort list into a lookup table
+ *
+ * The list must be sorted and its ranges must not overlap, which is what
+ * DetectPortInsert produces. If that is not the case the table is left
+ * empty and the caller should keep using DetectPortLookupGroup.
+ *
+ * \param t table to set up, will be cleared first
+ * \param list DetectPort list to flatten
+ *
+ * \retval 0 on success or if the list can't be flattened
+ * \retval -1 on memory allocation error
+ */
+int DetectPortLookupTableSetup(DetectPortLookupTable *t, const DetectPort *list)
+{
+    const DetectPort *p;
+    uint32_t cnt = 0;
+
+    memset(t, 0, sizeof(*t));
+
+    for (p = list; p != NULL; p = p->next) {
+        if (p->next != NULL && p->next->port <= p->port2) {
+            SCLogDebug("port list not sorted or overlapping, not flattening");
+            return 0;
+        }
+        cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    /* one allocation: sh array first for alignment, then the port arrays */
+    uint8_t *mem = SCMalloc(cnt * (sizeof(SigGroupHead *) + 2 * sizeof(uint16_t)));
+    if (unlikely(mem == NULL))
+        return -1;
+
+    t->sh = (SigGroupHead **)mem;
+    t->port2 = (uint16_t *)(mem + cnt * sizeof(SigGroupHead *));
+    t->port = t->port2 + cnt;
+
+    uint32_t i = 0;
+    for (p = list; p != NULL; p = p->next, i++) {
+        t->port[i] = p->port;
+        t->port2[i] = p->port2;
+        t->sh[i] = p->sh;
+    }
+    t->cnt = cnt;
+    return 0;
+}
+
+void DetectPortLookupTableFree(DetectPortLookupTable *t)
+{
+    /* port and port2 live in the same allocation as sh */
+    if (t->sh != NULL)
+        SCFree(t->sh);
+    memset(t, 0, sizeof(*t));
+}
+
+/**
+ * \brief Lookup the sgh for a port in a table set up by
+ *        DetectPortLookupTableSetup
+ *
+ * \retval sgh or NULL if no range contains the port
+ */
+SigGroupHead *DetectPortLookupTableGet(const DetectPortLookupTable *t,
+                                       uint16_t port)
+{
+    /* find the first range that ends at or after port */
+    uint32_t lo = 0, hi = t->cnt;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (t->port2[mid] < port)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < t->cnt && t->port[lo] <= port)
+        return t->sh[lo];
+    return NULL;
+}
+
 /**
  * \brief Function to join the source group to the target and its members
  *
@@ -2686,6 +2889,101 @@ static int PortTestMatchDoubleNegation(void)
     return result;
 }
 
+/** \test flattened lookup table gives the same result as the list walk */
+static int PortTestLookupTable01(void)
+{
+    int result = 0;
+    DetectPort *head = NULL, *p;
+    DetectPortLookupTable t;
+    uintptr_t i = 1;
+    uint32_t port;
+
+    memset(&t, 0, sizeof(t));
+
+    if (DetectPortParse(NULL, &head, "[1:10,20,30:40,1000:65535]") != 0)
+        goto end;
+
+    /* fake sgh ptrs, flagged as copies so the cleanup doesn't free them */
+    for (p = head; p != NULL; p = p->next, i++) {
+        p->sh = (SigGroupHead *)i;
+        p->flags |= PORT_SIGGROUPHEAD_COPY;
+    }
+
+    if (DetectPortLookupTableSetup(&t, head) != 0 || t.cnt != 4)
+        goto end;
+
+    for (port = 0; port <= 65535; port++) {
+        p = DetectPortLookupGroup(head, (uint16_t)port);
+        SigGroupHead *sh = DetectPortLookupTableGet(&t, (uint16_t)port);
+        if (sh != (p ? p->sh : NULL)) {
+            printf("port %u: table %p, list %p: ", port, sh, p ? p->sh : NULL);
+            goto end;
+        }
+    }
+
+    if (DetectPortLookupTableGet(&t, 15) != NULL ||
+        DetectPortLookupTableGet(&t, 20) != (SigGroupHead *)2)
+        goto end;
+
+    result = 1;
+end:
+    DetectPortLookupTableFree(&t);
+    DetectPortCleanupList(head);
+    return result;
+}
+
+/**
+ * \test the sweep gives the same list and sigs as inserting one by one
+ */
+static int PortTestSweep01(void)
+{
+    const struct { uint16_t port, port2; } ranges[] = {
+        { 80, 80 }, { 1, 1024 }, { 0, 65535 }, { 80, 90 }, { 65535, 65535 },
+        { 1000, 2000 }, { 2000, 2000 }, { 0, 0 }, { 90, 1000 }, };
+    const uint32_t cnt = sizeof(ranges) / sizeof(ranges[0]);
+    DetectPort *ports[cnt];
+    Signature s[cnt];
+    DetectPort *inserted = NULL, *swept = NULL;
+    uint32_t i;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    memset(s, 0x00, sizeof(s));
+
+    for (i = 0; i < cnt; i++) {
+        s[i].num = i;
+        ports[i] = DetectPortInit();
+        FAIL_IF_NULL(ports[i]);
+        ports[i]->port = ranges[i].port;
+        ports[i]->port2 = ranges[i].port2;
+        SigGroupHeadAppendSig(de_ctx, &ports[i]->sh, &s[i]);
+        FAIL_IF(DetectPortInsertCopy(de_ctx, &inserted, ports[i]) < 0);
+    }
+    FAIL_IF(DetectPortSweep(de_ctx, ports, cnt, &swept) < 0);
+
+    DetectPort *a = inserted, *b = swept;
+    for ( ; a != NULL && b != NULL; a = a->next, b = b->next) {
+        FAIL_IF(a->port != b->port || a->port2 != b->port2);
+        FAIL_IF(b->next != NULL && b->next->prev != b);
+        FAIL_IF(memcmp(a->sh->init->sig_array, b->sh->init->sig_array,
+                    a->sh->init->sig_size) != 0);
+    }
+    FAIL_IF(a != NULL || b != NULL);
+
+    /* 0, 1-79, 80, 81-89, 90, 91-999, 1000, 1001-1024, 1025-1999, 2000,
+     * 2001-65534, 65535 */
+    for (i = 0, b = swept; b != NULL; b = b->next)
+        i++;
+    FAIL_IF(i != 12);
+
+    DetectPortCleanupList(inserted);
+    DetectPortCleanupList(swept);
+    for (i = 0; i < cnt; i++)
+        DetectPortFree(ports[i]);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DetectPortTests(void)
@@ -2733,6 +3031,8 @@ void DetectPortTests(void)
     UtRegisterTest("PortTestMatchReal18", PortTestMatchReal18);
     UtRegisterTest("PortTestMatchReal19", PortTestMatchReal19);
     UtRegisterTest("PortTestMatchDoubleNegation", PortTestMatchDoubleNegation);
+    UtRegisterTest("PortTestLookupTable01", PortTestLookupTable01);
+    UtRegisterTest("PortTestSweep01", PortTestSweep01);
 
 
 #endif /* UNITTESTS */
@@ -31,10 +31,16 @@ DetectPort *DetectPortCopy(DetectEngineCtx *, DetectPort *);
 DetectPort *DetectPortCopySingle(DetectEngineCtx *, DetectPort *);
 int DetectPortInsertCopy(DetectEngineCtx *,DetectPort **, DetectPort *);
 int DetectPortInsert(DetectEngineCtx *,DetectPort **, DetectPort *);
+int DetectPortSweep(DetectEngineCtx *, DetectPort **, uint32_t, DetectPort **);
 void DetectPortCleanupList (DetectPort *head);
 
 DetectPort *DetectPortLookupGroup(DetectPort *dp, uint16_t port);
 
+int DetectPortLookupTableSetup(DetectPortLookupTable *t, const DetectPort *list);
+void DetectPortLookupTableFree(DetectPortLookupTable *t);
+struct SigGroupHead_ *DetectPortLookupTableGet(const DetectPortLookupTable *t,
+                                               uint16_t port);
+
 int DetectPortJoin(DetectEngineCtx *,DetectPort *target, DetectPort *source);
 
 void DetectPortPrint(DetectPort *);
@@ -0,0 +1,324 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Prefilter engines for rules without a fast pattern.
+ *
+ * Rules that have no mpm are normally on the sgh non-mpm list and get
+ * inspected for every packet. If such a rule has a keyword in its packet
+ * match list that supports prefiltering, that keyword is selected as the
+ * rule's prefilter_sm and the rule is left off the non-mpm list. The
+ * keyword instead builds an engine per sgh that only adds the rule ids
+ * whose keyword can match the packet to the pmq, where they are merged
+ * with the mpm results.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "debug.h"
+
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-prefilter.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+int PrefilterAppendEngine(SigGroupHead *sgh, PrefilterFunc PrefilterFunc,
+        void *pectx, void (*FreeFunc)(void *pectx))
+{
+    if (sgh == NULL || PrefilterFunc == NULL || pectx == NULL)
+        return -1;
+
+    PrefilterEngine *e = SCMalloc(sizeof(*e));
+    if (e == NULL)
+        return -1;
+    memset(e, 0x00, sizeof(*e));
+
+    e->Prefilter = PrefilterFunc;
+    e->pectx = pectx;
+    e->Free = FreeFunc;
+
+    if (sgh->engines == NULL) {
+        sgh->engines = e;
+    } else {
+        PrefilterEngine *t = sgh->engines;
+        while (t->next != NULL)
+            t = t->next;
+        t->next = e;
+    }
+    return 0;
+}
+
+void PrefilterFreeEngines(SigGroupHead *sgh)
+{
+    PrefilterEngine *e = sgh->engines;
+    while (e != NULL) {
+        PrefilterEngine *next = e->next;
+        if (e->Free && e->pectx)
+            e->Free(e->pectx);
+        SCFree(e);
+        e = next;
+    }
+    sgh->engines = NULL;
+}
+
+/**
+ * \brief pick a prefilter keyword for each rule that has no mpm
+ *
+ * The first keyword in the packet match list that supports it is used.
+ * Runs after the fast patterns have been selected.
+ */
+void PrefilterSelectForSignatures(DetectEngineCtx *de_ctx)
+{
+    Signature *s;
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        s->prefilter_sm = NULL;
+
+        /* ip-only and decoder event only rules don't use a sgh */
+        if (s->mpm_sm != NULL ||
+            (s->flags & SIG_FLAG_IPONLY) ||
+            (s->init_flags & SIG_FLAG_INIT_DEONLY))
+            continue;
+
+        SigMatch *sm;
+        for (sm = s->sm_lists[DETECT_SM_LIST_MATCH]; sm != NULL; sm = sm->next) {
+            const SigTableElmt *st = &sigmatch_table[sm->type];
+            if (st->SetupPrefilter == NULL)
+                continue;
+            if (st->SupportsPrefilter != NULL && !st->SupportsPrefilter(s))
+                continue;
+
+            SCLogDebug("rule %u uses %s as prefilter", s->id, st->name);
+            s->prefilter_sm = sm;
+            break;
+        }
+    }
+}
+
+/**
+ * \brief set up the prefilter engines of all keywords for a sgh
+ *
+ * Keywords are expected to not add an engine if none of the sgh's rules
+ * uses them as prefilter.
+ */
+int PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    int i;
+    for (i = 0; i < DETECT_TBLSIZE; i++) {
+        if (sigmatch_table[i].SetupPrefilter == NULL)
+            continue;
+        if (sigmatch_table[i].SetupPrefilter(sgh) != 0) {
+            SCLogError(SC_ERR_INITIALIZATION, "setting up the %s prefilter "
+                    "engine failed", sigmatch_table[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void PrefilterPacketU8HashFree(void *pectx)
+{
+    PrefilterPacketU8Hash *h = (PrefilterPacketU8Hash *)pectx;
+    int v;
+    for (v = 0; v < 256; v++) {
+        if (h->sids[v] != NULL)
+            SCFree(h->sids[v]);
+    }
+    SCFree(h);
+}
+
+/**
+ * \brief set up an engine for a keyword inspecting a single byte header
+ *        field, like ttl or the tcp flags
+ *
+ * For each of the 256 possible values the list of rules that can match
+ * is precomputed, so the runtime cost is a single lookup.
+ *
+ * \param sm_type keyword type the rules use as prefilter_sm
+ * \param Compare keyword match logic for a single value
+ * \param Match engine function: gets the value from the packet and calls
+ *              PrefilterPacketU8HashAddSids
+ */
+int PrefilterSetupPacketHeaderU8Hash(SigGroupHead *sgh, int sm_type,
+        PrefilterU8CompareFunc Compare, PrefilterFunc Match)
+{
+    uint32_t sig;
+    uint32_t total = 0;
+    int v;
+
+    PrefilterPacketU8Hash *h = SCMalloc(sizeof(*h));
+    if (h == NULL)
+        return -1;
+    memset(h, 0x00, sizeof(*h));
+
+    /* first pass: count the rules per value */
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->prefilter_sm == NULL || s->prefilter_sm->type != sm_type)
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (Compare((uint8_t)v, s->prefilter_sm->ctx)) {
+                h->cnt[v]++;
+                total++;
+            }
+        }
+    }
+
+    if (total == 0) {
+        /* either no rule uses this keyword or none of them can match.
+         * In both cases no engine is needed: the rules would never be
+         * matched anyway. */
+        SCFree(h);
+        return 0;
+    }
+
+    for (v = 0; v < 256; v++) {
+        if (h->cnt[v] == 0)
+            continue;
+        h->sids[v] = SCMalloc(h->cnt[v] * sizeof(SigIntId));
+        if (h->sids[v] == NULL)
+            goto error;
+        h->cnt[v] = 0;
+    }
+
+    /* second pass: fill the arrays. Rules are in match_array order, so
+     * each array is sorted by num. */
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->prefilter_sm == NULL || s->prefilter_sm->type != sm_type)
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (Compare((uint8_t)v, s->prefilter_sm->ctx)) {
+                h->sids[v][h->cnt[v]++] = s->num;
+            }
+        }
+    }
+
+    if (PrefilterAppendEngine(sgh, Match, h, PrefilterPacketU8HashFree) != 0)
+        goto error;
+    return 0;
+
+error:
+    PrefilterPacketU8HashFree(h);
+    return -1;
+}
+
+/**
+ * \brief run the prefilter engines of a sgh
+ *
+ * Rule ids are appended to det_ctx::pmq, so the caller has to sort it
+ * afterwards.
+ */
+void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
+        Packet *p)
+{
+    const PrefilterEngine *e;
+    for (e = sgh->engines; e != NULL; e = e->next) {
+        e->Prefilter(det_ctx, p, e->pectx);
+    }
+}
+
+#ifdef UNITTESTS
+/** \test rules without mpm use their header keyword as prefilter and
+ *        still match as before */
+static int PrefilterTest01(void)
+{
+    int result = 0;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    Packet *p = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(flags:S; sid:1;)");
+    if (s == NULL)
+        goto end;
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(flags:A; sid:2;)");
+    if (s == NULL)
+        goto end;
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(ttl:<10; flags:S; sid:3;)");
+    if (s == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->prefilter_sm == NULL) {
+            printf("sid %u has no prefilter keyword: ", s->id);
+            goto end;
+        }
+    }
+    /* ttl is the first keyword of sid 3 */
+    if (de_ctx->sig_list->next->next->prefilter_sm->type != DETECT_TTL) {
+        printf("sid 3 should use ttl: ");
+        goto end;
+    }
+
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    if (p == NULL)
+        goto end;
+    p->tcph->th_flags = TH_SYN;
+    p->ip4h->ip_ttl = 5;
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (!PacketAlertCheck(p, 1) || PacketAlertCheck(p, 2) ||
+        !PacketAlertCheck(p, 3)) {
+        printf("unexpected alerts: ");
+        goto end;
+    }
+    if (det_ctx->sgh == NULL || det_ctx->sgh->engines == NULL ||
+        det_ctx->non_mpm_store_cnt != 0) {
+        printf("rules should only be on the prefilter engines: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p != NULL)
+        UTHFreePacket(p);
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void PrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PrefilterTest01", PrefilterTest01);
+#endif /* UNITTESTS */
+}
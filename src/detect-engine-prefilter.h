@@ -0,0 +1,76 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Prefilter engines for rules without a fast pattern. Keywords register
+ * SetupPrefilter in their sigmatch_table entry and add one or more
+ * engines to each sgh. At runtime the engines add the ids of the rules
+ * that can match to the pmq, next to the mpm results.
+ */
+
+#ifndef __DETECT_ENGINE_PREFILTER_H__
+#define __DETECT_ENGINE_PREFILTER_H__
+
+typedef void (*PrefilterFunc)(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx);
+
+typedef struct PrefilterEngine_ {
+    /** engine specific data, like a hash of rule ids */
+    void *pectx;
+
+    PrefilterFunc Prefilter;
+    void (*Free)(void *pectx);
+
+    struct PrefilterEngine_ *next;
+} PrefilterEngine;
+
+/** compare function for the single byte header field engines:
+ *  \retval 1 if a packet with 'value' would match the keyword ctx */
+typedef int (*PrefilterU8CompareFunc)(uint8_t value, const SigMatchCtx *ctx);
+
+/** rule ids per possible value of a single byte header field */
+typedef struct PrefilterPacketU8Hash_ {
+    uint32_t cnt[256];
+    SigIntId *sids[256];
+} PrefilterPacketU8Hash;
+
+int PrefilterAppendEngine(SigGroupHead *sgh, PrefilterFunc PrefilterFunc,
+        void *pectx, void (*FreeFunc)(void *pectx));
+void PrefilterFreeEngines(SigGroupHead *sgh);
+
+void PrefilterSelectForSignatures(DetectEngineCtx *de_ctx);
+int PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+
+int PrefilterSetupPacketHeaderU8Hash(SigGroupHead *sgh, int sm_type,
+        PrefilterU8CompareFunc Compare, PrefilterFunc Match);
+
+/** \brief add the rule ids stored for 'value' to the pmq */
+static inline void PrefilterPacketU8HashAddSids(DetectEngineThreadCtx *det_ctx,
+        const void *pectx, uint8_t value)
+{
+    const PrefilterPacketU8Hash *h = (const PrefilterPacketU8Hash *)pectx;
+    MpmAddSids(&det_ctx->pmq, h->sids[value], h->cnt[value]);
+}
+
+void Prefilter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh,
+        Packet *p);
+
+void PrefilterRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_PREFILTER_H__ */
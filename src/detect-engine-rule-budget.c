@@ -0,0 +1,405 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per signature CPU budget: disable rules that are too slow
+ *
+ * On one in 'sample-rate' packets the detect threads time the inspection
+ * of every signature. Once a thread has 'min-samples' timed inspections
+ * of a signature it looks at the average. If that is over 'max-ticks',
+ * the signature is disabled for 'disable-time' seconds of packet time,
+ * or until it is enabled again through the unix socket if that is 0.
+ * Counts are per thread, so a thread only judges what it saw itself.
+ *
+ * The state belongs to the detect engine, a reload starts with all
+ * signatures enabled.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-rule-budget.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#define RULE_BUDGET_DEFAULT_RATE        100
+#define RULE_BUDGET_DEFAULT_MIN_SAMPLES 1000
+#define RULE_BUDGET_DEFAULT_MAX_TICKS   1000000
+#define RULE_BUDGET_DEFAULT_TIME        600
+
+int DetectRuleBudgetInit(DetectEngineCtx *de_ctx)
+{
+    int enabled = 0;
+    if (ConfGetBool("detect.rule-budget.enabled", &enabled) != 1 || !enabled)
+        return 0;
+
+    DetectRuleBudget *rb = SCCalloc(1, sizeof(*rb));
+    if (unlikely(rb == NULL))
+        return -1;
+    SCMutexInit(&rb->lock, NULL);
+    SC_ATOMIC_INIT(rb->disabled_cnt);
+    rb->sample_rate = RULE_BUDGET_DEFAULT_RATE;
+    rb->min_samples = RULE_BUDGET_DEFAULT_MIN_SAMPLES;
+    rb->max_ticks = RULE_BUDGET_DEFAULT_MAX_TICKS;
+    rb->disable_time = RULE_BUDGET_DEFAULT_TIME;
+
+    intmax_t val = 0;
+    if (ConfGetInt("detect.rule-budget.sample-rate", &val) == 1) {
+        if (val <= 0 || val > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.rule-budget.sample-rate %"PRIdMAX", using %u",
+                    val, RULE_BUDGET_DEFAULT_RATE);
+        } else {
+            rb->sample_rate = (uint32_t)val;
+        }
+    }
+    if (ConfGetInt("detect.rule-budget.min-samples", &val) == 1) {
+        if (val <= 0 || val > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.rule-budget.min-samples %"PRIdMAX", using %u",
+                    val, RULE_BUDGET_DEFAULT_MIN_SAMPLES);
+        } else {
+            rb->min_samples = (uint32_t)val;
+        }
+    }
+    if (ConfGetInt("detect.rule-budget.max-ticks", &val) == 1) {
+        if (val <= 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.rule-budget.max-ticks %"PRIdMAX", using %u",
+                    val, RULE_BUDGET_DEFAULT_MAX_TICKS);
+        } else {
+            rb->max_ticks = (uint64_t)val;
+        }
+    }
+    if (ConfGetInt("detect.rule-budget.disable-time", &val) == 1) {
+        if (val < 0 || val >= UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid "
+                    "detect.rule-budget.disable-time %"PRIdMAX", using %u",
+                    val, RULE_BUDGET_DEFAULT_TIME);
+        } else {
+            rb->disable_time = (uint32_t)val;
+        }
+    }
+
+    SCLogConfig("rule budget: timing 1 in %u packets, disabling rules over "
+            "%"PRIu64" ticks per inspection after %u samples for %u seconds",
+            rb->sample_rate, rb->max_ticks, rb->min_samples, rb->disable_time);
+
+    de_ctx->rule_budget = rb;
+    return 0;
+}
+
+void DetectRuleBudgetFree(DetectEngineCtx *de_ctx)
+{
+    DetectRuleBudget *rb = de_ctx->rule_budget;
+    if (rb == NULL)
+        return;
+
+    if (rb->disabled_until != NULL)
+        SCFree(rb->disabled_until);
+    if (rb->disabled_ticks != NULL)
+        SCFree(rb->disabled_ticks);
+    SCMutexDestroy(&rb->lock);
+    SC_ATOMIC_DESTROY(rb->disabled_cnt);
+    SCFree(rb);
+    de_ctx->rule_budget = NULL;
+}
+
+/** \brief set up the thread counters, the first thread sets up the
+ *         per signature state of the engine */
+int DetectRuleBudgetThreadInit(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx)
+{
+    DetectRuleBudget *rb = de_ctx->rule_budget;
+    if (rb == NULL || de_ctx->sig_array_len == 0)
+        return 0;
+
+    SCMutexLock(&rb->lock);
+    if (rb->disabled_until == NULL) {
+        rb->disabled_until = SCCalloc(de_ctx->sig_array_len, sizeof(uint32_t));
+        rb->disabled_ticks = SCCalloc(de_ctx->sig_array_len, sizeof(uint64_t));
+        if (rb->disabled_until == NULL || rb->disabled_ticks == NULL) {
+            if (rb->disabled_until != NULL)
+                SCFree(rb->disabled_until);
+            if (rb->disabled_ticks != NULL)
+                SCFree(rb->disabled_ticks);
+            rb->disabled_until = NULL;
+            rb->disabled_ticks = NULL;
+            SCMutexUnlock(&rb->lock);
+            return -1;
+        }
+        rb->sig_cnt = de_ctx->sig_array_len;
+    }
+    SCMutexUnlock(&rb->lock);
+
+    det_ctx->rule_budget = SCCalloc(de_ctx->sig_array_len,
+            sizeof(DetectRuleBudgetCounter));
+    if (det_ctx->rule_budget == NULL)
+        return -1;
+    det_ctx->rule_budget_rate = rb->sample_rate;
+    det_ctx->rule_budget_countdown = rb->sample_rate;
+    det_ctx->rule_budget_min_samples = rb->min_samples;
+    return 0;
+}
+
+void DetectRuleBudgetThreadDeinit(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->rule_budget != NULL) {
+        SCFree(det_ctx->rule_budget);
+        det_ctx->rule_budget = NULL;
+    }
+}
+
+/** \internal
+ *  \brief disable signature 's'
+ *  \param now packet time in seconds */
+static void RuleBudgetDisable(DetectRuleBudget *rb, const Signature *s,
+        uint64_t ticks, uint32_t now)
+{
+    SCMutexLock(&rb->lock);
+    if (rb->disabled_until[s->num] == 0) {
+        uint32_t until = RULE_BUDGET_DISABLED_FOREVER;
+        if (rb->disable_time > 0 &&
+                (uint64_t)now + rb->disable_time < RULE_BUDGET_DISABLED_FOREVER)
+            until = now + rb->disable_time;
+        rb->disabled_ticks[s->num] = ticks;
+        rb->disabled_until[s->num] = until;
+        (void)SC_ATOMIC_ADD(rb->disabled_cnt, 1);
+
+        if (rb->disable_time > 0) {
+            SCLogWarning(SC_WARN_RULE_BUDGET, "rule budget: disabling "
+                    "signature %"PRIu32" for %u seconds, %"PRIu64" ticks "
+                    "per inspection (max %"PRIu64")", s->id, rb->disable_time,
+                    ticks, rb->max_ticks);
+        } else {
+            SCLogWarning(SC_WARN_RULE_BUDGET, "rule budget: disabling "
+                    "signature %"PRIu32", %"PRIu64" ticks per inspection "
+                    "(max %"PRIu64")", s->id, ticks, rb->max_ticks);
+        }
+    }
+    SCMutexUnlock(&rb->lock);
+}
+
+/** \brief judge the cost of signature 's' once the thread has
+ *         min-samples timed inspections of it */
+void DetectRuleBudgetCheck(DetectEngineThreadCtx *det_ctx,
+        const Signature *s, const Packet *p)
+{
+    DetectRuleBudgetCounter *c = &det_ctx->rule_budget[s->num];
+    DetectRuleBudget *rb = det_ctx->de_ctx->rule_budget;
+
+    const uint64_t avg = c->ticks / c->checks;
+    if (avg > rb->max_ticks)
+        RuleBudgetDisable(rb, s, avg, (uint32_t)p->ts.tv_sec);
+
+    c->ticks = 0;
+    c->checks = 0;
+}
+
+/** \brief enable a signature whose disable time is up */
+void DetectRuleBudgetExpire(DetectRuleBudget *rb, const Signature *s)
+{
+    SCMutexLock(&rb->lock);
+    if (rb->disabled_until[s->num] != 0) {
+        rb->disabled_until[s->num] = 0;
+        (void)SC_ATOMIC_SUB(rb->disabled_cnt, 1);
+        SCLogNotice("rule budget: signature %"PRIu32" enabled again", s->id);
+    }
+    SCMutexUnlock(&rb->lock);
+}
+
+#ifdef HAVE_LIBJANSSON
+#ifdef BUILD_UNIX_SOCKET
+static DetectEngineCtx *RuleBudgetGetEngine(json_t *cmd, json_t *answer)
+{
+    DetectEngineCtx *de_ctx = NULL;
+    json_t *jarg = json_object_get(cmd, "tenant-id");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg)) {
+            json_object_set_new(answer, "message", json_string("invalid tenant-id"));
+            return NULL;
+        }
+        de_ctx = DetectEngineGetByTenantId((int)json_integer_value(jarg));
+    } else {
+        de_ctx = DetectEngineGetCurrent();
+    }
+    if (de_ctx == NULL) {
+        json_object_set_new(answer, "message", json_string("no detection engine"));
+        return NULL;
+    }
+    if (de_ctx->rule_budget == NULL || de_ctx->rule_budget->disabled_until == NULL) {
+        json_object_set_new(answer, "message", json_string("rule budget not enabled"));
+        DetectEngineDeReference(&de_ctx);
+        return NULL;
+    }
+    return de_ctx;
+}
+
+/** \brief unix socket: list the disabled signatures */
+TmEcode DetectRuleBudgetListCommand(json_t *cmd, json_t *answer, void *data)
+{
+    DetectEngineCtx *de_ctx = RuleBudgetGetEngine(cmd, answer);
+    if (de_ctx == NULL)
+        return TM_ECODE_FAILED;
+    DetectRuleBudget *rb = de_ctx->rule_budget;
+
+    json_t *js = json_array();
+    if (js == NULL) {
+        DetectEngineDeReference(&de_ctx);
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+
+    SCMutexLock(&rb->lock);
+    uint32_t i;
+    for (i = 0; i < rb->sig_cnt; i++) {
+        if (rb->disabled_until[i] == 0 || de_ctx->sig_array[i] == NULL)
+            continue;
+        json_t *jsig = json_object();
+        if (jsig == NULL)
+            break;
+        json_object_set_new(jsig, "id", json_integer(de_ctx->sig_array[i]->id));
+        json_object_set_new(jsig, "gid", json_integer(de_ctx->sig_array[i]->gid));
+        json_object_set_new(jsig, "ticks", json_integer(rb->disabled_ticks[i]));
+        if (rb->disabled_until[i] != RULE_BUDGET_DISABLED_FOREVER)
+            json_object_set_new(jsig, "until", json_integer(rb->disabled_until[i]));
+        json_array_append_new(js, jsig);
+    }
+    SCMutexUnlock(&rb->lock);
+
+    DetectEngineDeReference(&de_ctx);
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+
+/** \brief unix socket: enable a signature the budget disabled, by sid */
+TmEcode DetectRuleBudgetEnableCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jarg = json_object_get(cmd, "id");
+    if (!json_is_integer(jarg)) {
+        json_object_set_new(answer, "message", json_string("id is not an integer"));
+        return TM_ECODE_FAILED;
+    }
+    const json_int_t sid = json_integer_value(jarg);
+
+    DetectEngineCtx *de_ctx = RuleBudgetGetEngine(cmd, answer);
+    if (de_ctx == NULL)
+        return TM_ECODE_FAILED;
+    DetectRuleBudget *rb = de_ctx->rule_budget;
+
+    int cnt = 0;
+    SCMutexLock(&rb->lock);
+    uint32_t i;
+    for (i = 0; i < rb->sig_cnt; i++) {
+        const Signature *s = de_ctx->sig_array[i];
+        if (s == NULL || (json_int_t)s->id != sid || rb->disabled_until[i] == 0)
+            continue;
+        rb->disabled_until[i] = 0;
+        (void)SC_ATOMIC_SUB(rb->disabled_cnt, 1);
+        cnt++;
+    }
+    SCMutexUnlock(&rb->lock);
+    DetectEngineDeReference(&de_ctx);
+
+    if (cnt == 0) {
+        json_object_set_new(answer, "message", json_string("signature is not disabled"));
+        return TM_ECODE_FAILED;
+    }
+    SCLogNotice("rule budget: signature %"PRIu64" enabled through the unix "
+            "socket", (uint64_t)sid);
+    json_object_set_new(answer, "message", json_string("done"));
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+
+/** \test a slow signature is disabled, and enabled again after the
+ *        disable time */
+static int DetectRuleBudgetTest01(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any (content:\"a\"; sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+    de_ctx->sig_list->num = 0;
+    de_ctx->sig_array_len = 1;
+
+    DetectRuleBudget *rb = SCCalloc(1, sizeof(*rb));
+    FAIL_IF_NULL(rb);
+    SCMutexInit(&rb->lock, NULL);
+    SC_ATOMIC_INIT(rb->disabled_cnt);
+    rb->sample_rate = 1;
+    rb->min_samples = 2;
+    rb->max_ticks = 100;
+    rb->disable_time = 10;
+    de_ctx->rule_budget = rb;
+
+    DetectEngineThreadCtx det_ctx;
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    det_ctx.de_ctx = de_ctx;
+    FAIL_IF(DetectRuleBudgetThreadInit(de_ctx, &det_ctx) != 0);
+    FAIL_IF_NULL(det_ctx.rule_budget);
+
+    Packet *p = UTHBuildPacket((uint8_t *)"a", 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 1000;
+    const Signature *s = de_ctx->sig_list;
+
+    /* cheap inspections */
+    det_ctx.rule_budget[0].ticks = 150;
+    det_ctx.rule_budget[0].checks = 2;
+    DetectRuleBudgetCheck(&det_ctx, s, p);
+    FAIL_IF(DetectRuleBudgetIsDisabled(rb, s, p));
+    FAIL_IF(det_ctx.rule_budget[0].checks != 0);
+
+    /* expensive inspections */
+    det_ctx.rule_budget[0].ticks = 1000;
+    det_ctx.rule_budget[0].checks = 2;
+    DetectRuleBudgetCheck(&det_ctx, s, p);
+    FAIL_IF_NOT(DetectRuleBudgetIsDisabled(rb, s, p));
+    FAIL_IF(rb->disabled_ticks[0] != 500);
+    FAIL_IF(SC_ATOMIC_GET(rb->disabled_cnt) != 1);
+
+    p->ts.tv_sec = 1009;
+    FAIL_IF_NOT(DetectRuleBudgetIsDisabled(rb, s, p));
+    p->ts.tv_sec = 1010;
+    FAIL_IF(DetectRuleBudgetIsDisabled(rb, s, p));
+    FAIL_IF(SC_ATOMIC_GET(rb->disabled_cnt) != 0);
+
+    UTHFreePacket(p);
+    DetectRuleBudgetThreadDeinit(&det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void DetectRuleBudgetRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectRuleBudgetTest01", DetectRuleBudgetTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,123 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per signature CPU budget: disable rules that are too slow
+ */
+
+#ifndef __DETECT_ENGINE_RULE_BUDGET_H__
+#define __DETECT_ENGINE_RULE_BUDGET_H__
+
+#include "util-cpu.h"
+
+/** disabled until re-enabled through the unix socket */
+#define RULE_BUDGET_DISABLED_FOREVER    UINT32_MAX
+
+/** \brief rule budget of an engine */
+typedef struct DetectRuleBudget_ {
+    uint32_t sample_rate;
+    uint32_t min_samples;
+    uint64_t max_ticks;     /**< max avg ticks per inspection */
+    uint32_t disable_time;  /**< seconds, 0 for until re-enabled */
+
+    /** protects the state changes below, the detect threads read
+     *  disabled_until without it */
+    SCMutex lock;
+    uint32_t sig_cnt;
+    /** per signature num: 0 enabled, else packet time (sec) until which
+     *  the signature is disabled */
+    uint32_t *disabled_until;
+    /** avg ticks per inspection that disabled the signature */
+    uint64_t *disabled_ticks;
+    SC_ATOMIC_DECLARE(uint32_t, disabled_cnt);
+} DetectRuleBudget;
+
+/** per thread, per signature cost of the sampled inspections */
+typedef struct DetectRuleBudgetCounter_ {
+    uint64_t ticks;
+    uint32_t checks;
+} DetectRuleBudgetCounter;
+
+int DetectRuleBudgetInit(DetectEngineCtx *de_ctx);
+void DetectRuleBudgetFree(DetectEngineCtx *de_ctx);
+
+int DetectRuleBudgetThreadInit(DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx);
+void DetectRuleBudgetThreadDeinit(DetectEngineThreadCtx *det_ctx);
+
+void DetectRuleBudgetCheck(DetectEngineThreadCtx *det_ctx,
+        const Signature *s, const Packet *p);
+void DetectRuleBudgetExpire(DetectRuleBudget *rb, const Signature *s);
+
+/** \brief decide if the packet's inspections are timed */
+static inline void DetectRuleBudgetSamplePacket(DetectEngineThreadCtx *det_ctx)
+{
+    if (--det_ctx->rule_budget_countdown > 0) {
+        det_ctx->rule_budget_sampled = 0;
+        return;
+    }
+    det_ctx->rule_budget_countdown = det_ctx->rule_budget_rate;
+    det_ctx->rule_budget_sampled = 1;
+}
+
+/** \brief check if signature 's' is disabled, re-enables it if its time
+ *         is up */
+static inline int DetectRuleBudgetIsDisabled(DetectRuleBudget *rb,
+        const Signature *s, const Packet *p)
+{
+    if (likely(SC_ATOMIC_GET(rb->disabled_cnt) == 0))
+        return 0;
+
+    const uint32_t until = rb->disabled_until[s->num];
+    if (until == 0)
+        return 0;
+    if (until == RULE_BUDGET_DISABLED_FOREVER ||
+            (uint32_t)p->ts.tv_sec < until)
+        return 1;
+
+    DetectRuleBudgetExpire(rb, s);
+    return 0;
+}
+
+#define DETECT_RULE_BUDGET_START(det_ctx) do {                  \
+        if (unlikely((det_ctx)->rule_budget_sampled))           \
+            (det_ctx)->rule_budget_start = UtilCpuGetTicks();   \
+    } while (0)
+
+/** \brief add the cost of the inspection of 's', if it was timed */
+#define DETECT_RULE_BUDGET_END(det_ctx, s, p) do {                          \
+        if (unlikely((det_ctx)->rule_budget_start != 0)) {                  \
+            DetectRuleBudgetCounter *_c = &(det_ctx)->rule_budget[(s)->num];\
+            _c->ticks += UtilCpuGetTicks() - (det_ctx)->rule_budget_start;  \
+            (det_ctx)->rule_budget_start = 0;                               \
+            if (++_c->checks >= (det_ctx)->rule_budget_min_samples)         \
+                DetectRuleBudgetCheck((det_ctx), (s), (p));                 \
+        }                                                                   \
+    } while (0)
+
+#ifdef HAVE_LIBJANSSON
+#ifdef BUILD_UNIX_SOCKET
+TmEcode DetectRuleBudgetListCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode DetectRuleBudgetEnableCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+#endif
+
+void DetectRuleBudgetRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_RULE_BUDGET_H__ */
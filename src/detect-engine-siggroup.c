@@ -36,6 +36,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
@@ -134,6 +135,27 @@ error:
     return NULL;
 }
 
+/** \internal
+ *  \brief alloc the id and mask arrays of a non-mpm store in one block,
+ *         ids first as they are the larger type */
+static void SigGroupHeadNonMpmStoreAlloc(SignatureNonMpmStore *store, uint32_t cnt)
+{
+    uint8_t *mem = SCMalloc(cnt * (sizeof(SigIntId) + sizeof(SignatureMask)));
+    BUG_ON(mem == NULL);
+    memset(mem, 0, cnt * (sizeof(SigIntId) + sizeof(SignatureMask)));
+
+    store->id = (SigIntId *)mem;
+    store->mask = (SignatureMask *)(mem + cnt * sizeof(SigIntId));
+}
+
+static void SigGroupHeadNonMpmStoreFree(SignatureNonMpmStore *store)
+{
+    if (store->id != NULL)
+        SCFree(store->id);
+    store->id = NULL;
+    store->mask = NULL;
+}
+
 /**
  * \brief Free a SigGroupHead and its members.
  *
@@ -151,16 +173,17 @@ void SigGroupHeadFree(SigGroupHead *sgh)
         sgh->match_array = NULL;
     }
 
-    if (sgh->non_mpm_other_store_array != NULL) {
-        SCFree(sgh->non_mpm_other_store_array);
-        sgh->non_mpm_other_store_array = NULL;
-        sgh->non_mpm_other_store_cnt = 0;
-    }
+    PrefilterFreeEngines(sgh);
+
+    SigGroupHeadNonMpmStoreFree(&sgh->non_mpm_other_store);
+    sgh->non_mpm_other_store_cnt = 0;
+    SigGroupHeadNonMpmStoreFree(&sgh->non_mpm_syn_store);
+    sgh->non_mpm_syn_store_cnt = 0;
 
-    if (sgh->non_mpm_syn_store_array != NULL) {
-        SCFree(sgh->non_mpm_syn_store_array);
-        sgh->non_mpm_syn_store_array = NULL;
-        sgh->non_mpm_syn_store_cnt = 0;
+    /* the groups themselves are in the sgh_array */
+    if (sgh->alproto_sgh != NULL) {
+        SCFree(sgh->alproto_sgh);
+        sgh->alproto_sgh = NULL;
     }
 
     sgh->sig_cnt = 0;
@@ -475,6 +498,8 @@ void SigGroupHeadPrintSigs(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
  * \brief Create an array with all the internal ids of the sigs that this
  *        sig group head will check for.
  *
+ *  Also updates de_ctx::sgh_sig_cnt_max to track the largest sgh.
+ *
  * \param de_ctx  Pointer to the detection engine context.
  * \param sgh     Pointer to the SigGroupHead.
  * \param max_idx The maximum value of the sid in the SigGroupHead arg.
@@ -500,6 +525,9 @@ int SigGroupHeadBuildMatchArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
 
     memset(sgh->match_array,0, sgh->sig_cnt * sizeof(Signature *));
 
+    if (sgh->sig_cnt > de_ctx->sgh_sig_cnt_max)
+        de_ctx->sgh_sig_cnt_max = sgh->sig_cnt;
+
     for (sig = 0; sig < max_idx + 1; sig++) {
         if (!(sgh->init->sig_array[(sig / 8)] & (1 << (sig % 8))) )
             continue;
@@ -515,6 +543,110 @@ int SigGroupHeadBuildMatchArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
     return 0;
 }
 
+/**
+ *  \internal
+ *  \brief see if a signature can match a flow of app layer protocol
+ *         'alproto', the same check as the one in SigMatchSignatures()
+ */
+static int SignatureMatchesAlproto(const Signature *s, const AppProto alproto)
+{
+    if (!(s->flags & SIG_FLAG_APPLAYER) || s->alproto == ALPROTO_UNKNOWN ||
+        s->alproto == alproto)
+        return 1;
+    if (s->alproto == ALPROTO_DCERPC &&
+        (alproto == ALPROTO_SMB || alproto == ALPROTO_SMB2))
+        return 1;
+    return 0;
+}
+
+/**
+ *  \brief Build the per app layer protocol groups of a sgh.
+ *
+ *  For each protocol its rules are for, the sgh gets a group with its rules
+ *  minus those for other protocols. Flows of other protocols, and those
+ *  with the protocol not yet known, use the group without any app layer
+ *  protocol rules. A group with all the rules of the sgh is the sgh itself.
+ *
+ *  The new groups are added to the sgh_array.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to split
+ *
+ *  \retval 0 ok, also if the sgh needs no split
+ *  \retval -1 error
+ */
+int SigGroupHeadBuildAlprotoGroups(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    uint8_t need[ALPROTO_MAX];
+    uint32_t max_idx = 0;
+    uint32_t sig;
+    int have = 0;
+
+    memset(need, 0x00, sizeof(need));
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+        if (s->num > max_idx)
+            max_idx = s->num;
+        if (!(s->flags & SIG_FLAG_APPLAYER) || s->alproto == ALPROTO_UNKNOWN ||
+            s->alproto >= ALPROTO_MAX)
+            continue;
+        need[s->alproto] = 1;
+        if (s->alproto == ALPROTO_DCERPC) {
+            need[ALPROTO_SMB] = 1;
+            need[ALPROTO_SMB2] = 1;
+        }
+        have = 1;
+    }
+    if (!have)
+        return 0;
+    need[ALPROTO_UNKNOWN] = 1;
+
+    sgh->alproto_sgh = SCCalloc(ALPROTO_MAX, sizeof(SigGroupHead *));
+    if (sgh->alproto_sgh == NULL)
+        return -1;
+
+    AppProto a;
+    for (a = 0; a < ALPROTO_MAX; a++) {
+        if (!need[a])
+            continue;
+
+        SigGroupHead *asgh = SigGroupHeadAlloc(de_ctx, sgh->init->sig_size);
+        if (asgh == NULL)
+            return -1;
+        memcpy(asgh->init->protos, sgh->init->protos, sizeof(asgh->init->protos));
+        asgh->init->direction = sgh->init->direction;
+
+        for (sig = 0; sig < sgh->sig_cnt; sig++) {
+            const Signature *s = sgh->match_array[sig];
+            if (s != NULL && SignatureMatchesAlproto(s, a))
+                asgh->init->sig_array[s->num / 8] |= 1 << (s->num % 8);
+        }
+        SigGroupHeadSetSigCnt(asgh, max_idx);
+
+        if (asgh->sig_cnt == sgh->sig_cnt) {
+            SigGroupHeadFree(asgh);
+            sgh->alproto_sgh[a] = sgh;
+            continue;
+        }
+        if (SigGroupHeadBuildMatchArray(de_ctx, asgh, max_idx) != 0) {
+            SigGroupHeadFree(asgh);
+            return -1;
+        }
+        SigGroupHeadStore(de_ctx, asgh);
+        sgh->alproto_sgh[a] = asgh;
+        SCLogDebug("sgh %p alproto %u: %u of %u sigs", sgh, a,
+                asgh->sig_cnt, sgh->sig_cnt);
+    }
+
+    for (a = 0; a < ALPROTO_MAX; a++) {
+        if (sgh->alproto_sgh[a] == NULL)
+            sgh->alproto_sgh[a] = sgh->alproto_sgh[ALPROTO_UNKNOWN];
+    }
+    return 0;
+}
+
 /**
  *  \brief Set the need md5 flag in the sgh.
  *
@@ -607,6 +739,154 @@ void SigGroupHeadSetFilesizeFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/**
+ *  \brief Set the need file data flag in the sgh.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetFiledataFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if (SignatureIsFiledataInspecting(s)) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVEFILEDATA;
+            break;
+        }
+    }
+
+    return;
+}
+
+/**
+ *  \brief Set the raw stream flag in the sgh if any of its signatures
+ *         inspects the reassembled stream.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetRawStreamFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if (SignatureHasStreamContent(s)) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVERAWSTREAM;
+            break;
+        }
+    }
+
+    return;
+}
+
+/**
+ *  \internal
+ *  \brief get how far into its buffer a list of matches can look
+ *
+ *  A content with a depth is bounded, as is a relative content with a
+ *  within after a bounded one. Anything else, like pcre or a content
+ *  without a limit, can look at the whole buffer.
+ *
+ *  \retval depth bytes from the start of the buffer, 0 for an empty list
+ *  \retval SIG_GROUP_HEAD_DEPTH_UNLIMITED no limit
+ */
+static uint32_t SigMatchListInspectDepth(const SigMatch *sm)
+{
+    int64_t prev_end = 0;
+    int64_t max = 0;
+
+    for ( ; sm != NULL; sm = sm->next) {
+        if (sm->type != DETECT_CONTENT)
+            return SIG_GROUP_HEAD_DEPTH_UNLIMITED;
+
+        const DetectContentData *cd = (const DetectContentData *)sm->ctx;
+        int64_t end;
+        if (cd->flags & (DETECT_CONTENT_DISTANCE|DETECT_CONTENT_WITHIN)) {
+            if (!(cd->flags & DETECT_CONTENT_WITHIN) ||
+                (cd->flags & (DETECT_CONTENT_DISTANCE_BE|DETECT_CONTENT_WITHIN_BE)))
+                return SIG_GROUP_HEAD_DEPTH_UNLIMITED;
+            end = prev_end + cd->distance + cd->within;
+        } else if ((cd->flags & DETECT_CONTENT_DEPTH) &&
+                   !(cd->flags & (DETECT_CONTENT_DEPTH_BE|DETECT_CONTENT_OFFSET_BE))) {
+            end = cd->depth;
+        } else {
+            return SIG_GROUP_HEAD_DEPTH_UNLIMITED;
+        }
+        if (end < cd->content_len)
+            end = cd->content_len;
+        if (end >= SIG_GROUP_HEAD_DEPTH_UNLIMITED)
+            return SIG_GROUP_HEAD_DEPTH_UNLIMITED;
+
+        prev_end = end;
+        if (end > max)
+            max = end;
+    }
+    return (uint32_t)max;
+}
+
+/** \internal \brief merge the depth of a signature into a group's */
+static inline void SigGroupHeadMergeDepth(uint32_t *depth, uint32_t sig_depth)
+{
+    if (sig_depth > *depth)
+        *depth = sig_depth;
+}
+
+/**
+ *  \brief Set how far into the raw stream and the http bodies the
+ *         signatures of the sgh inspect.
+ *
+ *  Only with detect.inspection-depth auto, otherwise the depths stay 0
+ *  and the configured limits apply as is.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the depths in
+ */
+void SigGroupHeadSetInspectDepths(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    Signature *s = NULL;
+    uint32_t sig = 0;
+
+    if (sgh == NULL || !de_ctx->inspection_depth_auto)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        if (SignatureHasStreamContent(s)) {
+            SigGroupHeadMergeDepth(&sgh->stream_inspect_depth,
+                    SigMatchListInspectDepth(s->sm_lists[DETECT_SM_LIST_PMATCH]));
+        }
+        SigGroupHeadMergeDepth(&sgh->request_body_depth,
+                SigMatchListInspectDepth(s->sm_lists[DETECT_SM_LIST_HCBDMATCH]));
+        SigGroupHeadMergeDepth(&sgh->response_body_depth,
+                SigMatchListInspectDepth(s->sm_lists[DETECT_SM_LIST_FILEDATA]));
+    }
+
+    SCLogDebug("sgh %p stream %u request body %u response body %u", sgh,
+            sgh->stream_inspect_depth, sgh->request_body_depth,
+            sgh->response_body_depth);
+    return;
+}
+
 /**
  *  \brief Set the need magic flag in the sgh.
  *
@@ -663,6 +943,34 @@ void SigGroupHeadSetFilestoreCount(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/**
+ *  \brief Set the mask bits all sigs of the sgh have in common.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the mask in
+ */
+void SigGroupHeadSetMaskCommon(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    SignatureMask mask = (SignatureMask)~0;
+    uint32_t sig = 0;
+    int have = 0;
+
+    if (sgh == NULL)
+        return;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        mask &= s->mask;
+        have = 1;
+    }
+
+    sgh->mask_common = have ? mask : 0;
+    return;
+}
+
 /** \brief build an array of rule id's for sigs with no mpm
  *  Also updated de_ctx::non_mpm_store_cnt_max to track the highest cnt
  */
@@ -676,13 +984,18 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     if (sgh == NULL)
         return 0;
 
-    BUG_ON(sgh->non_mpm_other_store_array != NULL);
+    BUG_ON(sgh->non_mpm_other_store.id != NULL);
 
     for (sig = 0; sig < sgh->sig_cnt; sig++) {
         s = sgh->match_array[sig];
         if (s == NULL)
             continue;
 
+        /* rules with a prefilter keyword are handled by the sgh's
+         * prefilter engines */
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 non_mpm++;
@@ -692,21 +1005,15 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     }
 
     if (non_mpm == 0 && non_mpm_syn == 0) {
-        sgh->non_mpm_other_store_array = NULL;
-        sgh->non_mpm_syn_store_array = NULL;
         return 0;
     }
 
     if (non_mpm > 0) {
-        sgh->non_mpm_other_store_array = SCMalloc(non_mpm * sizeof(SignatureNonMpmStore));
-        BUG_ON(sgh->non_mpm_other_store_array == NULL);
-        memset(sgh->non_mpm_other_store_array, 0, non_mpm * sizeof(SignatureNonMpmStore));
+        SigGroupHeadNonMpmStoreAlloc(&sgh->non_mpm_other_store, non_mpm);
     }
 
     if (non_mpm_syn > 0) {
-        sgh->non_mpm_syn_store_array = SCMalloc(non_mpm_syn * sizeof(SignatureNonMpmStore));
-        BUG_ON(sgh->non_mpm_syn_store_array == NULL);
-        memset(sgh->non_mpm_syn_store_array, 0, non_mpm_syn * sizeof(SignatureNonMpmStore));
+        SigGroupHeadNonMpmStoreAlloc(&sgh->non_mpm_syn_store, non_mpm_syn);
     }
 
     for (sig = 0; sig < sgh->sig_cnt; sig++) {
@@ -714,19 +1021,24 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         if (s == NULL)
             continue;
 
+        /* rules with a prefilter keyword are handled by the sgh's
+         * prefilter engines */
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 BUG_ON(sgh->non_mpm_other_store_cnt >= non_mpm);
-                BUG_ON(sgh->non_mpm_other_store_array == NULL);
-                sgh->non_mpm_other_store_array[sgh->non_mpm_other_store_cnt].id = s->num;
-                sgh->non_mpm_other_store_array[sgh->non_mpm_other_store_cnt].mask = s->mask;
+                BUG_ON(sgh->non_mpm_other_store.id == NULL);
+                sgh->non_mpm_other_store.id[sgh->non_mpm_other_store_cnt] = s->num;
+                sgh->non_mpm_other_store.mask[sgh->non_mpm_other_store_cnt] = s->mask;
                 sgh->non_mpm_other_store_cnt++;
             }
 
             BUG_ON(sgh->non_mpm_syn_store_cnt >= non_mpm_syn);
-            BUG_ON(sgh->non_mpm_syn_store_array == NULL);
-            sgh->non_mpm_syn_store_array[sgh->non_mpm_syn_store_cnt].id = s->num;
-            sgh->non_mpm_syn_store_array[sgh->non_mpm_syn_store_cnt].mask = s->mask;
+            BUG_ON(sgh->non_mpm_syn_store.id == NULL);
+            sgh->non_mpm_syn_store.id[sgh->non_mpm_syn_store_cnt] = s->num;
+            sgh->non_mpm_syn_store.mask[sgh->non_mpm_syn_store_cnt] = s->mask;
             sgh->non_mpm_syn_store_cnt++;
         }
     }
@@ -1273,6 +1585,110 @@ end:
     UTHFreePackets(&p, 1);
     return result;
 }
+
+/** \test per app layer protocol groups */
+static int SigGroupHeadTest12(void)
+{
+    int result = 0;
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    DetectEngineThreadCtx *det_ctx = NULL;
+    ThreadVars th_v;
+
+    memset(&th_v, 0, sizeof(ThreadVars));
+
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 80);
+    if (de_ctx == NULL || p == NULL)
+        goto end;
+    de_ctx->grouping_alproto = 1;
+
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any (content:\"abc\"; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert http any any -> any any (content:\"def\"; sid:2;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tls any any -> any any (content:\"ghi\"; sid:3;)") == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigGroupHead *sgh = SigMatchSignaturesGetSgh(de_ctx, det_ctx, p);
+    if (sgh == NULL || sgh->sig_cnt != 3 || sgh->alproto_sgh == NULL) {
+        printf("no app layer groups: ");
+        goto end;
+    }
+
+    SigGroupHead *none = sgh->alproto_sgh[ALPROTO_UNKNOWN];
+    SigGroupHead *http = sgh->alproto_sgh[ALPROTO_HTTP];
+    if (none == NULL || none->sig_cnt != 1 ||
+        !SigGroupHeadContainsSigId(de_ctx, none, 1)) {
+        printf("group without protocol: ");
+        goto end;
+    }
+    if (http == NULL || http->sig_cnt != 2 ||
+        !SigGroupHeadContainsSigId(de_ctx, http, 2) ||
+        SigGroupHeadContainsSigId(de_ctx, http, 3)) {
+        printf("http group: ");
+        goto end;
+    }
+    if (sgh->alproto_sgh[ALPROTO_TLS] == NULL ||
+        !SigGroupHeadContainsSigId(de_ctx, sgh->alproto_sgh[ALPROTO_TLS], 3) ||
+        sgh->alproto_sgh[ALPROTO_DNS] != none ||
+        sgh->alproto_sgh[ALPROTO_FAILED] != none) {
+        printf("other groups: ");
+        goto end;
+    }
+    /* the groups are prepared like the others */
+    if (http->mpm_stream_ctx == NULL && http->mpm_packet_ctx == NULL) {
+        printf("http group has no mpm: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    if (de_ctx != NULL) {
+        SigCleanSignatures(de_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    UTHFreePackets(&p, 1);
+    return result;
+}
+
+/** \test mask bits the rules of a group share */
+static int SigGroupHeadTest13(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 80);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 81);
+    FAIL_IF_NULL(p1);
+    FAIL_IF_NULL(p2);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 (content:\"abc\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 (flow:established; content:\"def\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 (content:\"abc\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 (dsize:0; sid:4;)"));
+    SigGroupBuild(de_ctx);
+
+    /* only the payload is required by both */
+    SigGroupHead *sgh = SigMatchSignaturesGetSgh(de_ctx, NULL, p1);
+    FAIL_IF_NULL(sgh);
+    FAIL_IF_NOT(sgh->sig_cnt == 2);
+    FAIL_IF_NOT(sgh->mask_common == SIG_MASK_REQUIRE_PAYLOAD);
+
+    /* payload and no payload: nothing in common */
+    sgh = SigMatchSignaturesGetSgh(de_ctx, NULL, p2);
+    FAIL_IF_NULL(sgh);
+    FAIL_IF_NOT(sgh->sig_cnt == 2);
+    FAIL_IF_NOT(sgh->mask_common == 0);
+
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
 #endif
 
 void SigGroupHeadRegisterTests(void)
@@ -1285,5 +1701,7 @@ void SigGroupHeadRegisterTests(void)
     UtRegisterTest("SigGroupHeadTest09", SigGroupHeadTest09);
     UtRegisterTest("SigGroupHeadTest10", SigGroupHeadTest10);
     UtRegisterTest("SigGroupHeadTest11", SigGroupHeadTest11);
+    UtRegisterTest("SigGroupHeadTest12", SigGroupHeadTest12);
+    UtRegisterTest("SigGroupHeadTest13", SigGroupHeadTest13);
 #endif
 }
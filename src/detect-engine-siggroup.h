@@ -67,8 +67,13 @@ void SigGroupHeadPrintSigs(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
 void SigGroupHeadStore(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFilemagicFlag(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFilestoreCount(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadSetMaskCommon(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFileMd5Flag(DetectEngineCtx *, SigGroupHead *);
 void SigGroupHeadSetFilesizeFlag(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadSetFiledataFlag(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadSetRawStreamFlag(DetectEngineCtx *, SigGroupHead *);
+void SigGroupHeadSetInspectDepths(DetectEngineCtx *, SigGroupHead *);
+int SigGroupHeadBuildAlprotoGroups(DetectEngineCtx *, SigGroupHead *);
 uint16_t SigGroupHeadGetMinMpmSize(DetectEngineCtx *de_ctx,
                                    SigGroupHead *sgh, int list);
 
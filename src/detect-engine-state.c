@@ -136,6 +136,66 @@ static DeStateStoreFlowRules *DeStateStoreFlowRulesAlloc(void)
     return d;
 }
 
+/** \internal
+ *  \brief set the bit of a sig in the bitmap of a direction, growing it
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory, the bitmap is dropped and lookups scan
+ */
+static int DeStateSigBitSet(DetectEngineStateDirection *dir_state, SigIntId num)
+{
+    uint32_t byte = num / 8;
+
+    if (byte >= dir_state->sig_bits_size) {
+        uint32_t size = dir_state->sig_bits_size ? dir_state->sig_bits_size : 64;
+        while (size <= byte)
+            size *= 2;
+
+        uint8_t *ptmp = SCRealloc(dir_state->sig_bits, size);
+        if (unlikely(ptmp == NULL)) {
+            SCFree(dir_state->sig_bits);
+            dir_state->sig_bits = NULL;
+            dir_state->sig_bits_size = 0;
+            return -1;
+        }
+        memset(ptmp + dir_state->sig_bits_size, 0, size - dir_state->sig_bits_size);
+        dir_state->sig_bits = ptmp;
+        dir_state->sig_bits_size = size;
+    }
+    dir_state->sig_bits[byte] |= (1 << (num % 8));
+    return 0;
+}
+
+/** \internal
+ *  \brief build the bitmap of a direction from its stored items */
+static void DeStateSigBitsBuild(DetectEngineStateDirection *dir_state)
+{
+    DeStateStore *tx_store = dir_state->head;
+    SigIntId store_cnt;
+    SigIntId state_cnt = 0;
+
+    for (; tx_store != NULL; tx_store = tx_store->next) {
+        for (store_cnt = 0;
+             store_cnt < DE_STATE_CHUNK_SIZE && state_cnt < dir_state->cnt;
+             store_cnt++, state_cnt++)
+        {
+            if (DeStateSigBitSet(dir_state, tx_store->store[store_cnt].sid) < 0)
+                return;
+        }
+    }
+}
+
+/** \internal
+ *  \brief forget the stored sigs of a direction, keeping the memory */
+static void DeStateDirectionReset(DetectEngineStateDirection *dir_state)
+{
+    dir_state->cnt = 0;
+    dir_state->filestore_cnt = 0;
+    dir_state->flags = 0;
+    if (dir_state->sig_bits != NULL)
+        memset(dir_state->sig_bits, 0, dir_state->sig_bits_size);
+}
+
 static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIntId num)
 {
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
@@ -143,6 +203,12 @@ static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIn
     SigIntId store_cnt;
     SigIntId state_cnt = 0;
 
+    if (dir_state->sig_bits != NULL) {
+        uint32_t byte = num / 8;
+        return (byte < dir_state->sig_bits_size &&
+                (dir_state->sig_bits[byte] & (1 << (num % 8))));
+    }
+
     for (; tx_store != NULL; tx_store = tx_store->next) {
         SCLogDebug("tx_store %p", tx_store);
         for (store_cnt = 0;
@@ -163,42 +229,45 @@ static int DeStateSearchState(DetectEngineState *state, uint8_t direction, SigIn
 
 static void DeStateSignatureAppend(DetectEngineState *state, Signature *s, uint32_t inspect_flags, uint8_t direction)
 {
-    int jump = 0;
-    int i = 0;
     DetectEngineStateDirection *dir_state = &state->dir_state[direction & STREAM_TOSERVER ? 0 : 1];
+    SigIntId idx = dir_state->cnt % DE_STATE_CHUNK_SIZE;
+    DeStateStore *store;
 
 #ifdef DEBUG_VALIDATION
     BUG_ON(DeStateSearchState(state, direction, s->num));
 #endif
-    DeStateStore *store = dir_state->head;
+
+    /* the chunk of the new item: the last one used, or the one after it
+     * if that is full. Chunks left over from before a reset are reused. */
+    if (dir_state->cnt == 0)
+        store = dir_state->head;
+    else if (idx == 0)
+        store = dir_state->cur->next;
+    else
+        store = dir_state->cur;
 
     if (store == NULL) {
         store = DeStateStoreAlloc();
-        if (store != NULL) {
+        if (store == NULL)
+            return;
+        if (dir_state->head == NULL)
             dir_state->head = store;
-            dir_state->tail = store;
-        }
-    } else {
-        jump = dir_state->cnt / DE_STATE_CHUNK_SIZE;
-        for (i = 0; i < jump; i++) {
-            store = store->next;
-        }
-        if (store == NULL) {
-            store = DeStateStoreAlloc();
-            if (store != NULL) {
-                dir_state->tail->next = store;
-                dir_state->tail = store;
-            }
-        }
+        else
+            dir_state->tail->next = store;
+        dir_state->tail = store;
     }
+    dir_state->cur = store;
 
-    if (store == NULL)
-        return;
-
-    SigIntId idx = dir_state->cnt++ % DE_STATE_CHUNK_SIZE;
+    dir_state->cnt++;
     store->store[idx].sid = s->num;
     store->store[idx].flags = inspect_flags;
 
+    if (dir_state->sig_bits != NULL) {
+        DeStateSigBitSet(dir_state, s->num);
+    } else if (dir_state->cnt == DE_STATE_BITMAP_MIN_CNT) {
+        DeStateSigBitsBuild(dir_state);
+    }
+
     return;
 }
 
@@ -296,6 +365,8 @@ void DetectEngineStateFree(DetectEngineState *state)
             SCFree(store);
             store = store_next;
         }
+        if (state->dir_state[i].sig_bits != NULL)
+            SCFree(state->dir_state[i].sig_bits);
     }
     SCFree(state);
 
@@ -346,8 +417,17 @@ static int HasStoredSigs(Flow *f, uint8_t flags)
         uint64_t inspect_tx_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
         uint64_t total_txs = AppLayerParserGetTxCnt(f->proto, alproto, alstate);
 
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+        AppLayerGetTxIterState iter_state;
+        memset(&iter_state, 0, sizeof(iter_state));
+
         for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
-            void *inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id);
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+                    inspect_tx_id, total_txs, &iter_state);
+            if (ires.tx_ptr == NULL)
+                break;
+            inspect_tx_id = ires.tx_id;
+            void *inspect_tx = ires.tx_ptr;
             if (inspect_tx != NULL) {
                 DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, alproto, inspect_tx);
                 if (tx_de_state == NULL) {
@@ -513,12 +593,19 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
 
         SCLogDebug("starting: start tx %u, packet %u", (uint)tx_id, (uint)p->pcap_cnt);
 
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+        AppLayerGetTxIterState iter_state;
+        memset(&iter_state, 0, sizeof(iter_state));
+
         for (; tx_id < total_txs; tx_id++) {
             int total_matches = 0;
-            void *tx = AppLayerParserGetTx(f->proto, alproto, alstate, tx_id);
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+                    tx_id, total_txs, &iter_state);
+            if (ires.tx_ptr == NULL)
+                break;
+            tx_id = ires.tx_id;
+            void *tx = ires.tx_ptr;
             SCLogDebug("tx %p", tx);
-            if (tx == NULL)
-                continue;
             det_ctx->tx_id = tx_id;
             det_ctx->tx_id_set = 1;
 
@@ -581,9 +668,11 @@ int DeStateDetectStartDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
              * a sig to the 'no inspect array'. */
             int next_tx_no_progress = 0;
             if (!TxIsLast(tx_id, total_txs)) {
-                void *next_tx = AppLayerParserGetTx(f->proto, alproto, alstate, tx_id+1);
-                if (next_tx != NULL) {
-                    int c = AppLayerParserGetStateProgress(f->proto, alproto, next_tx, flags);
+                AppLayerGetTxIterState peek_state = iter_state;
+                AppLayerGetTxIterTuple next = IterFunc(f->proto, alproto, alstate,
+                        tx_id + 1, tx_id + 2, &peek_state);
+                if (next.tx_ptr != NULL) {
+                    int c = AppLayerParserGetStateProgress(f->proto, alproto, next.tx_ptr, flags);
                     if (c == 0) {
                         next_tx_no_progress = 1;
                     }
@@ -1028,10 +1117,19 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
         inspect_tx_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
         total_txs = AppLayerParserGetTxCnt(f->proto, alproto, alstate);
 
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, alproto);
+        AppLayerGetTxIterState iter_state;
+        memset(&iter_state, 0, sizeof(iter_state));
+
         for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
             int inspect_tx_inprogress = 0;
             int next_tx_no_progress = 0;
-            void *inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id);
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, alproto, alstate,
+                    inspect_tx_id, total_txs, &iter_state);
+            if (ires.tx_ptr == NULL)
+                break;
+            inspect_tx_id = ires.tx_id;
+            void *inspect_tx = ires.tx_ptr;
             if (inspect_tx != NULL) {
                 int a = AppLayerParserGetStateProgress(f->proto, alproto, inspect_tx, flags);
                 int b = AppLayerParserGetStateProgressCompletionStatus(alproto, flags);
@@ -1054,9 +1152,11 @@ void DeStateDetectContinueDetection(ThreadVars *tv, DetectEngineCtx *de_ctx,
                 /* see if we need to consider the next tx in our decision to add
                  * a sig to the 'no inspect array'. */
                 if (!TxIsLast(inspect_tx_id, total_txs)) {
-                    void *next_inspect_tx = AppLayerParserGetTx(f->proto, alproto, alstate, inspect_tx_id+1);
-                    if (next_inspect_tx != NULL) {
-                        int c = AppLayerParserGetStateProgress(f->proto, alproto, next_inspect_tx, flags);
+                    AppLayerGetTxIterState peek_state = iter_state;
+                    AppLayerGetTxIterTuple next = IterFunc(f->proto, alproto, alstate,
+                            inspect_tx_id + 1, inspect_tx_id + 2, &peek_state);
+                    if (next.tx_ptr != NULL) {
+                        int c = AppLayerParserGetStateProgress(f->proto, alproto, next.tx_ptr, flags);
                         if (c == 0) {
                             next_tx_no_progress = 1;
                         }
@@ -1174,21 +1274,25 @@ void DetectEngineStateResetTxs(Flow *f)
 
         uint64_t total_txs = AppLayerParserGetTxCnt(f->proto, f->alproto, alstate);
 
+        AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(f->proto, f->alproto);
+        AppLayerGetTxIterState iter_state;
+        memset(&iter_state, 0, sizeof(iter_state));
+
         for ( ; inspect_tx_id < total_txs; inspect_tx_id++) {
-            void *inspect_tx = AppLayerParserGetTx(f->proto, f->alproto, alstate, inspect_tx_id);
+            AppLayerGetTxIterTuple ires = IterFunc(f->proto, f->alproto, alstate,
+                    inspect_tx_id, total_txs, &iter_state);
+            if (ires.tx_ptr == NULL)
+                break;
+            inspect_tx_id = ires.tx_id;
+            void *inspect_tx = ires.tx_ptr;
             if (inspect_tx != NULL) {
                 DetectEngineState *tx_de_state = AppLayerParserGetTxDetectState(f->proto, f->alproto, inspect_tx);
                 if (tx_de_state == NULL) {
                     continue;
                 }
 
-                tx_de_state->dir_state[0].cnt = 0;
-                tx_de_state->dir_state[0].filestore_cnt = 0;
-                tx_de_state->dir_state[0].flags = 0;
-
-                tx_de_state->dir_state[1].cnt = 0;
-                tx_de_state->dir_state[1].filestore_cnt = 0;
-                tx_de_state->dir_state[1].flags = 0;
+                DeStateDirectionReset(&tx_de_state->dir_state[0]);
+                DeStateDirectionReset(&tx_de_state->dir_state[1]);
             }
         }
     }
@@ -1340,6 +1444,69 @@ end:
     return result;
 }
 
+/** \test lookups through the bitmap of a large store, and its reset */
+static int DeStateTest04(void)
+{
+    int result = 0;
+    SigIntId i;
+
+    DetectEngineState *state = DetectEngineStateAlloc();
+    if (state == NULL) {
+        printf("d == NULL: ");
+        goto end;
+    }
+    DetectEngineStateDirection *dir_state = &state->dir_state[0];
+
+    Signature s;
+    memset(&s, 0x00, sizeof(s));
+
+    for (i = 0; i < 200; i++) {
+        s.num = i * 7;
+        DeStateSignatureAppend(state, &s, 0, STREAM_TOSERVER);
+    }
+    if (dir_state->cnt != 200 || dir_state->sig_bits == NULL) {
+        printf("cnt %u sig_bits %p: ", dir_state->cnt, dir_state->sig_bits);
+        goto end;
+    }
+    for (i = 0; i < 200 * 7; i++) {
+        if (DeStateSearchState(state, STREAM_TOSERVER, i) != (i % 7 == 0)) {
+            printf("lookup of %u failed: ", i);
+            goto end;
+        }
+    }
+    if (DeStateSearchState(state, STREAM_TOCLIENT, 7)) {
+        printf("found in the other direction: ");
+        goto end;
+    }
+
+    DeStateStore *tail = dir_state->tail;
+    DeStateDirectionReset(dir_state);
+    if (DeStateSearchState(state, STREAM_TOSERVER, 7)) {
+        printf("found after reset: ");
+        goto end;
+    }
+
+    /* the chunks are reused */
+    for (i = 0; i < 200; i++) {
+        s.num = i;
+        DeStateSignatureAppend(state, &s, 0, STREAM_TOSERVER);
+    }
+    if (dir_state->tail != tail || dir_state->cnt != 200 ||
+        dir_state->head->store[1].sid != 1 ||
+        !DeStateSearchState(state, STREAM_TOSERVER, 199) ||
+        DeStateSearchState(state, STREAM_TOSERVER, 200 * 7 - 7)) {
+        printf("unexpected state after reuse: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (state != NULL) {
+        DetectEngineStateFree(state);
+    }
+    return result;
+}
+
 static int DeStateSigTest01(void)
 {
     int result = 0;
@@ -2355,6 +2522,7 @@ void DeStateRegisterTests(void)
     UtRegisterTest("DeStateTest01", DeStateTest01);
     UtRegisterTest("DeStateTest02", DeStateTest02);
     UtRegisterTest("DeStateTest03", DeStateTest03);
+    UtRegisterTest("DeStateTest04", DeStateTest04);
     UtRegisterTest("DeStateSigTest01", DeStateSigTest01);
     UtRegisterTest("DeStateSigTest02", DeStateSigTest02);
     UtRegisterTest("DeStateSigTest03", DeStateSigTest03);
@@ -125,9 +125,18 @@ typedef struct DeStateStore_ {
     struct DeStateStore_ *next;
 } DeStateStore;
 
+/** stored sigs from which a direction also gets a bitmap over Signature::num
+ *  for lookups, below that the store is scanned */
+#define DE_STATE_BITMAP_MIN_CNT         DE_STATE_CHUNK_SIZE
+
 typedef struct DetectEngineStateDirection_ {
     DeStateStore *head;
     DeStateStore *tail;
+    DeStateStore *cur;      /**< chunk of the last item, chunks are reused
+                             *   from head after a reset */
+    uint8_t *sig_bits;      /**< bitmap of the stored sigs, NULL for small
+                             *   stores */
+    uint32_t sig_bits_size; /**< in bytes */
     SigIntId cnt;
     uint16_t filestore_cnt;
     uint8_t flags;
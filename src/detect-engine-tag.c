@@ -23,6 +23,11 @@
  *
  * Implements a global context to store data related to hosts flagged
  * tag keyword
+ *
+ * Tagged hosts are rare, so a packet's hosts are only looked up in the
+ * host table if a small counting filter, indexed by a hash of the
+ * address, says a host of that hash has tags. The filter counts the
+ * hosts with a non-empty tag list per bucket.
  */
 
 #include "suricata-common.h"
@@ -36,6 +41,7 @@
 #include "host.h"
 #include "host-storage.h"
 #include "flow-storage.h"
+#include "util-hash-lookup3.h"
 
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -48,11 +54,57 @@ SC_ATOMIC_DECLARE(unsigned int, num_tags);  /**< Atomic counter, to know if we
 static int host_tag_id = -1;                /**< Host storage id for tags */
 static int flow_tag_id = -1;                /**< Flow storage id for tags */
 
+#define TAG_HOST_FILTER_SIZE 16384
+/** hosts with tags, per hash bucket of their address */
+static uint32_t tag_host_filter[TAG_HOST_FILTER_SIZE];
+SC_ATOMIC_DECLARE(unsigned int, num_tagged_hosts);
+
+static inline uint32_t TagHostFilterIdx(const Address *a)
+{
+    return hashword(a->addr_data32, 4, (uint32_t)a->family) % TAG_HOST_FILTER_SIZE;
+}
+
+/** \internal \brief check if a host with this address may have tags */
+static inline int TagHostFilterCheck(const Address *a)
+{
+    return SC_ATOMIC_GET(num_tagged_hosts) != 0 &&
+        SCAtomicFetchAndAdd(&tag_host_filter[TagHostFilterIdx(a)], 0) != 0;
+}
+
+/** \internal \brief set the tag list of a host, keeping the filter
+ *         updated when the host gets its first tag or loses the last */
+static void TagHostSetList(Host *host, DetectTagDataEntry *list)
+{
+    const DetectTagDataEntry *old = HostGetStorageById(host, host_tag_id);
+    if (old == NULL && list != NULL) {
+        (void)SCAtomicFetchAndAdd(&tag_host_filter[TagHostFilterIdx(&host->a)], 1);
+        (void) SC_ATOMIC_ADD(num_tagged_hosts, 1);
+    } else if (old != NULL && list == NULL) {
+        /* 'old' may be freed already, only compare it */
+        (void)SCAtomicFetchAndSub(&tag_host_filter[TagHostFilterIdx(&host->a)], 1);
+        (void) SC_ATOMIC_SUB(num_tagged_hosts, 1);
+    }
+    HostSetStorageById(host, host_tag_id, list);
+}
+
+/** \internal \brief host storage free, for a host freed with its tags */
+static void TagHostListFree(void *ptr)
+{
+    DetectTagDataEntry *list = ptr;
+    if (list != NULL) {
+        (void)SCAtomicFetchAndSub(&tag_host_filter[list->host_filter_idx], 1);
+        (void) SC_ATOMIC_SUB(num_tagged_hosts, 1);
+    }
+    DetectTagDataListFree(ptr);
+}
+
 void TagInitCtx(void)
 {
     SC_ATOMIC_INIT(num_tags);
+    SC_ATOMIC_INIT(num_tagged_hosts);
+    memset(tag_host_filter, 0x00, sizeof(tag_host_filter));
 
-    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, DetectTagDataListFree);
+    host_tag_id = HostStorageRegister("tag", sizeof(void *), NULL, TagHostListFree);
     if (host_tag_id == -1) {
         SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for tag");
         exit(EXIT_FAILURE);
@@ -76,6 +128,7 @@ void TagDestroyCtx(void)
     BUG_ON(SC_ATOMIC_GET(num_tags) != 0);
 #endif
     SC_ATOMIC_DESTROY(num_tags);
+    SC_ATOMIC_DESTROY(num_tagged_hosts);
 }
 
 /** \brief Reset the tagging engine context
@@ -206,7 +259,8 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
         /* get a new tde as the one we have is on the stack */
         DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
         if (new_tde != NULL) {
-            HostSetStorageById(host, host_tag_id, new_tde);
+            new_tde->host_filter_idx = TagHostFilterIdx(&host->a);
+            TagHostSetList(host, new_tde);
             (void) SC_ATOMIC_ADD(num_tags, 1);
             SCLogDebug("host tag added");
         }
@@ -240,9 +294,10 @@ int TagHashAddTag(DetectTagDataEntry *tde, Packet *p)
             DetectTagDataEntry *new_tde = DetectTagDataCopy(tde);
             if (new_tde != NULL) {
                 (void) SC_ATOMIC_ADD(num_tags, 1);
+                new_tde->host_filter_idx = TagHostFilterIdx(&host->a);
 
                 new_tde->next = tag;
-                HostSetStorageById(host, host_tag_id, new_tde);
+                TagHostSetList(host, new_tde);
             }
         } else if (num_tags == DETECT_TAG_MAX_TAGS) {
             SCLogDebug("Max tags for sessions reached (%"PRIu16")", num_tags);
@@ -419,7 +474,7 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
+                            TagHostSetList(host, iter);
                             continue;
                         }
                     } else if (flag_added == 0) {
@@ -445,7 +500,7 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
+                            TagHostSetList(host, iter);
                             continue;
                         }
                     } else if (flag_added == 0) {
@@ -475,7 +530,7 @@ void TagHandlePacketHost(Host *host, Packet *p)
                             iter = iter->next;
                             SCFree(tde);
                             (void) SC_ATOMIC_SUB(num_tags, 1);
-                            HostSetStorageById(host, host_tag_id, iter);
+                            TagHostSetList(host, iter);
                             continue;
                         }
                     } else if (flag_added == 0) {
@@ -517,19 +572,24 @@ void TagHandlePacket(DetectEngineCtx *de_ctx,
         TagHandlePacketFlow(p->flow, p);
     }
 
-    Host *src = HostLookupHostFromHash(&p->src);
-    if (src) {
-        if (TagHostHasTag(src)) {
-            TagHandlePacketHost(src,p);
+    /* only look up the hosts that may have tags */
+    if (TagHostFilterCheck(&p->src)) {
+        Host *src = HostLookupHostFromHash(&p->src);
+        if (src) {
+            if (TagHostHasTag(src)) {
+                TagHandlePacketHost(src,p);
+            }
+            HostRelease(src);
         }
-        HostRelease(src);
     }
-    Host *dst = HostLookupHostFromHash(&p->dst);
-    if (dst) {
-        if (TagHostHasTag(dst)) {
-            TagHandlePacketHost(dst,p);
+    if (TagHostFilterCheck(&p->dst)) {
+        Host *dst = HostLookupHostFromHash(&p->dst);
+        if (dst) {
+            if (TagHostHasTag(dst)) {
+                TagHandlePacketHost(dst,p);
+            }
+            HostRelease(dst);
         }
-        HostRelease(dst);
     }
     SCReturn;
 }
@@ -574,7 +634,7 @@ int TagTimeoutCheck(Host *host, struct timeval *tv)
             SCFree(tde);
             (void) SC_ATOMIC_SUB(num_tags, 1);
         } else {
-            HostSetStorageById(host, host_tag_id, tmp->next);
+            TagHostSetList(host, tmp->next);
 
             tde = tmp;
             tmp = tde->next;
@@ -586,6 +646,20 @@ int TagTimeoutCheck(Host *host, struct timeval *tv)
     return retval;
 }
 
+/** \brief time at which TagTimeoutCheck() will have removed all tags of
+ *         the host, unless they are seen again
+ *  \retval expire, 0 if there are none */
+uint32_t TagHostGetExpire(Host *host)
+{
+    uint32_t expire = 0;
+    DetectTagDataEntry *tde = HostGetStorageById(host, host_tag_id);
+    for ( ; tde != NULL; tde = tde->next) {
+        if (tde->last_ts + TAG_MAX_LAST_TIME_SEEN + 1 > expire)
+            expire = tde->last_ts + TAG_MAX_LAST_TIME_SEEN + 1;
+    }
+    return expire;
+}
+
 #ifdef UNITTESTS
 
 /**
@@ -1495,6 +1569,56 @@ end:
     return result;
 }
 
+/**
+ * \test the tagged host filter follows the hosts getting and losing tags
+ */
+static int DetectTagTestHostFilter01(void)
+{
+    StorageInit();
+    TagInitCtx();
+    StorageFinalize();
+    HostInitConfig(1);
+
+    Packet *p = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.5",
+            "192.168.1.1", 41424, 80);
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 1000;
+
+    FAIL_IF(TagHostFilterCheck(&p->src));
+    FAIL_IF(TagHostFilterCheck(&p->dst));
+
+    DetectTagDataEntry tde;
+    memset(&tde, 0x00, sizeof(tde));
+    tde.sid = 1;
+    tde.gid = 1;
+    tde.flags = TAG_ENTRY_FLAG_DIR_SRC;
+    tde.metric = DETECT_TAG_METRIC_PACKET;
+    tde.count = 10;
+    tde.first_ts = tde.last_ts = 1000;
+    FAIL_IF(TagHashAddTag(&tde, p) != 0);
+    /* a second tag on the same host doesn't count it twice */
+    tde.sid = 2;
+    FAIL_IF(TagHashAddTag(&tde, p) != 0);
+
+    FAIL_IF_NOT(TagHostFilterCheck(&p->src));
+    FAIL_IF(SC_ATOMIC_GET(num_tagged_hosts) != 1);
+
+    /* both tags time out */
+    Host *h = HostLookupHostFromHash(&p->src);
+    FAIL_IF_NULL(h);
+    struct timeval tv = { 1000 + TAG_MAX_LAST_TIME_SEEN + 1, 0 };
+    FAIL_IF(TagTimeoutCheck(h, &tv) != 1);
+    HostRelease(h);
+
+    FAIL_IF(TagHostFilterCheck(&p->src));
+    FAIL_IF(SC_ATOMIC_GET(num_tagged_hosts) != 0);
+
+    UTHFreePacket(p);
+    HostShutdown();
+    TagDestroyCtx();
+    StorageCleanup();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1510,6 +1634,7 @@ void DetectEngineTagRegisterTests(void)
     UtRegisterTest("DetectTagTestPacket05", DetectTagTestPacket05);
     UtRegisterTest("DetectTagTestPacket06", DetectTagTestPacket06);
     UtRegisterTest("DetectTagTestPacket07", DetectTagTestPacket07);
+    UtRegisterTest("DetectTagTestHostFilter01", DetectTagTestHostFilter01);
 #endif /* UNITTESTS */
 }
 
@@ -53,6 +53,7 @@ void TagDestroyCtx(void);
 void TagRestartCtx(void);
 
 int TagTimeoutCheck(Host *, struct timeval *);
+uint32_t TagHostGetExpire(Host *);
 
 int TagHostHasTag(Host *host);
 
@@ -64,27 +64,243 @@
 #include "util-debug.h"
 
 #include "util-var-name.h"
+#include "util-hash-lookup3.h"
+#include "util-random.h"
+#include "util-misc.h"
+#include "util-state-sync.h"
+#include "conf.h"
 #include "tm-threads.h"
 
-static int threshold_id = -1; /**< host storage id for thresholds */
+/* by_src/by_dst state is kept in a table keyed by (sid, gid, address),
+ * split in shards with their own lock. Alerts of different rules or
+ * addresses don't contend, and no host lock is needed. */
+
+/** entry in the by_src/by_dst table */
+typedef struct ThresholdEntry_ {
+    DetectThresholdEntry tsh;       /**< counters, must be first */
+    Address addr;                   /**< tracked address */
+    struct ThresholdEntry_ *hnext;
+} ThresholdEntry;
+
+#define THRESHOLD_SHARDS            64
+#define THRESHOLD_DEFAULT_HASHSIZE  16384
+#define THRESHOLD_DEFAULT_MEMCAP    (16 * 1024 * 1024)
+
+typedef struct ThresholdShard_ {
+    SCMutex lock;
+    ThresholdEntry **buckets;
+} __attribute__((aligned(CLS))) ThresholdShard;
+
+static struct {
+    ThresholdShard shards[THRESHOLD_SHARDS];
+    uint32_t buckets;       /**< buckets per shard */
+    uint32_t hash_rand;
+    uint64_t memcap;
+    int initialized;
+} th_table;
+
+SC_ATOMIC_DECLARE(uint64_t, th_memuse);
+
+/** \brief set up the by_src/by_dst threshold table
+ *
+ *  Sized by detect.thresholds.hash-size (total buckets) and limited by
+ *  detect.thresholds.memcap. */
+void ThresholdInit(void)
+{
+    if (th_table.initialized)
+        return;
+
+    intmax_t hash_size = THRESHOLD_DEFAULT_HASHSIZE;
+    uint64_t memcap = THRESHOLD_DEFAULT_MEMCAP;
+    const char *str = NULL;
 
-int ThresholdHostStorageId(void)
+    if (ConfGetInt("detect.thresholds.hash-size", &hash_size) == 1 &&
+            hash_size < THRESHOLD_SHARDS) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "detect.thresholds.hash-size "
+                "%"PRIdMAX" too small, minimum is %d", hash_size, THRESHOLD_SHARDS);
+        exit(EXIT_FAILURE);
+    }
+    if (ConfGet("detect.thresholds.memcap", (char **)&str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "invalid detect.thresholds.memcap "
+                    "\"%s\"", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    th_table.buckets = (uint32_t)(hash_size / THRESHOLD_SHARDS);
+#ifndef AFLFUZZ_NO_RANDOM
+    unsigned int seed = RandomTimePreseed();
+    th_table.hash_rand = (uint32_t)rand_r(&seed);
+#endif
+    th_table.memcap = memcap;
+    SC_ATOMIC_INIT(th_memuse);
+
+    int i;
+    for (i = 0; i < THRESHOLD_SHARDS; i++) {
+        ThresholdShard *sh = &th_table.shards[i];
+        SCMutexInit(&sh->lock, NULL);
+        sh->buckets = SCCalloc(th_table.buckets, sizeof(ThresholdEntry *));
+        if (sh->buckets == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate threshold table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    th_table.initialized = 1;
+
+    SCLogConfig("threshold table: %d shards of %u buckets, memcap %"PRIu64,
+            THRESHOLD_SHARDS, th_table.buckets, memcap);
+}
+
+/** \brief free all by_src/by_dst threshold state */
+void ThresholdsClear(void)
 {
-    return threshold_id;
+    if (!th_table.initialized)
+        return;
+
+    int i;
+    for (i = 0; i < THRESHOLD_SHARDS; i++) {
+        ThresholdShard *sh = &th_table.shards[i];
+        SCMutexLock(&sh->lock);
+        uint32_t b;
+        for (b = 0; b < th_table.buckets; b++) {
+            ThresholdEntry *e = sh->buckets[b];
+            while (e != NULL) {
+                ThresholdEntry *next = e->hnext;
+                SCFree(e);
+                (void) SC_ATOMIC_SUB(th_memuse, sizeof(ThresholdEntry));
+                e = next;
+            }
+            sh->buckets[b] = NULL;
+        }
+        SCMutexUnlock(&sh->lock);
+    }
 }
 
-void ThresholdInit(void)
+void ThresholdShutdown(void)
 {
-    threshold_id = HostStorageRegister("threshold", sizeof(void *), NULL, ThresholdListFree);
-    if (threshold_id == -1) {
-        SCLogError(SC_ERR_HOST_INIT, "Can't initiate host storage for thresholding");
-        exit(EXIT_FAILURE);
+    if (!th_table.initialized)
+        return;
+
+    ThresholdsClear();
+
+    int i;
+    for (i = 0; i < THRESHOLD_SHARDS; i++) {
+        SCFree(th_table.shards[i].buckets);
+        th_table.shards[i].buckets = NULL;
+        SCMutexDestroy(&th_table.shards[i].lock);
+    }
+    SC_ATOMIC_DESTROY(th_memuse);
+    th_table.initialized = 0;
+}
+
+static inline uint32_t ThresholdHash(const Address *a, uint32_t sid, uint32_t gid)
+{
+    uint32_t key[6] = { a->addr_data32[0], a->addr_data32[1],
+        a->addr_data32[2], a->addr_data32[3], sid, gid };
+    return hashword(key, 6, th_table.hash_rand);
+}
+
+/** \internal
+ *  \brief get the shard and bucket for a key. Returns the shard locked. */
+static ThresholdShard *ThresholdGetBucket(const Address *a, uint32_t sid,
+        uint32_t gid, ThresholdEntry ***bucket)
+{
+    uint32_t hash = ThresholdHash(a, sid, gid);
+    ThresholdShard *sh = &th_table.shards[hash % THRESHOLD_SHARDS];
+    SCMutexLock(&sh->lock);
+    *bucket = &sh->buckets[(hash / THRESHOLD_SHARDS) % th_table.buckets];
+    return sh;
+}
+
+static inline int ThresholdEntryTimedOut(const ThresholdEntry *e, uint32_t ts)
+{
+    return (ts - e->tsh.tv_sec1) > e->tsh.seconds;
+}
+
+/** \internal
+ *  \brief find the entry for a key, unlinking timed out entries found on
+ *         the way. Bucket's shard must be locked. */
+static DetectThresholdEntry *ThresholdBucketLookup(ThresholdEntry **bucket,
+        const Address *a, uint32_t sid, uint32_t gid, uint32_t ts)
+{
+    ThresholdEntry **pe = bucket;
+    while (*pe != NULL) {
+        ThresholdEntry *e = *pe;
+        if (e->tsh.sid == sid && e->tsh.gid == gid &&
+                CMP_ADDR(&e->addr, a)) {
+            return &e->tsh;
+        }
+        if (ThresholdEntryTimedOut(e, ts)) {
+            *pe = e->hnext;
+            SCFree(e);
+            (void) SC_ATOMIC_SUB(th_memuse, sizeof(ThresholdEntry));
+            continue;
+        }
+        pe = &e->hnext;
     }
+    return NULL;
 }
 
-int ThresholdHostHasThreshold(Host *host)
+/** \brief look up the by_src/by_dst state of a rule for an address
+ *
+ *  \warning the entry is returned unlocked, only for inspection when
+ *           no other thread uses the table (unittests, debugging)
+ */
+DetectThresholdEntry *ThresholdLookupEntry(const Address *a, uint32_t sid, uint32_t gid)
 {
-    return HostGetStorageById(host, threshold_id) ? 1 : 0;
+    ThresholdEntry **bucket = NULL;
+    ThresholdShard *sh = ThresholdGetBucket(a, sid, gid, &bucket);
+    DetectThresholdEntry *e = NULL;
+    ThresholdEntry *te;
+    for (te = *bucket; te != NULL; te = te->hnext) {
+        if (te->tsh.sid == sid && te->tsh.gid == gid && CMP_ADDR(&te->addr, a)) {
+            e = &te->tsh;
+            break;
+        }
+    }
+    SCMutexUnlock(&sh->lock);
+    return e;
+}
+
+/** \brief remove the timed out by_src/by_dst entries
+ *
+ *  Called by the flow manager. Busy shards are skipped, they're tried
+ *  again on the next run.
+ *
+ *  \retval cnt number of entries removed
+ */
+uint32_t ThresholdsTimeoutHash(struct timeval *ts)
+{
+    uint32_t cnt = 0;
+
+    if (!th_table.initialized || SC_ATOMIC_GET(th_memuse) == 0)
+        return 0;
+
+    int i;
+    for (i = 0; i < THRESHOLD_SHARDS; i++) {
+        ThresholdShard *sh = &th_table.shards[i];
+        if (SCMutexTrylock(&sh->lock) != 0)
+            continue;
+
+        uint32_t b;
+        for (b = 0; b < th_table.buckets; b++) {
+            ThresholdEntry **pe = &sh->buckets[b];
+            while (*pe != NULL) {
+                ThresholdEntry *e = *pe;
+                if (ThresholdEntryTimedOut(e, (uint32_t)ts->tv_sec)) {
+                    *pe = e->hnext;
+                    SCFree(e);
+                    (void) SC_ATOMIC_SUB(th_memuse, sizeof(ThresholdEntry));
+                    cnt++;
+                    continue;
+                }
+                pe = &e->hnext;
+            }
+        }
+        SCMutexUnlock(&sh->lock);
+    }
+    return cnt;
 }
 
 /**
@@ -130,54 +346,6 @@ DetectThresholdData *SigGetThresholdTypeIter(Signature *sig, Packet *p, SigMatch
     return NULL;
 }
 
-/**
- * \brief Remove timeout threshold hash elements
- *
- * \param de_ctx Dectection Context
- *
- */
-
-int ThresholdTimeoutCheck(Host *host, struct timeval *tv)
-{
-    DetectThresholdEntry *tde = NULL;
-    DetectThresholdEntry *tmp = NULL;
-    DetectThresholdEntry *prev = NULL;
-    int retval = 1;
-
-    tmp = HostGetStorageById(host, threshold_id);
-    if (tmp == NULL)
-         return 1;
-
-    prev = NULL;
-    while (tmp != NULL) {
-        if ((tv->tv_sec - tmp->tv_sec1) <= tmp->seconds) {
-            prev = tmp;
-            tmp = tmp->next;
-            retval = 0;
-            continue;
-        }
-
-        /* timed out */
-
-        if (prev != NULL) {
-            prev->next = tmp->next;
-
-            tde = tmp;
-            tmp = tde->next;
-
-            SCFree(tde);
-        } else {
-            HostSetStorageById(host, threshold_id, tmp->next);
-            tde = tmp;
-            tmp = tde->next;
-
-            SCFree(tde);
-        }
-    }
-
-    return retval;
-}
-
 static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdData *td, Packet *p, uint32_t sid, uint32_t gid)
 {
     SCEnter();
@@ -186,6 +354,7 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
     if (unlikely(ste == NULL)) {
         SCReturnPtr(NULL, "DetectThresholdEntry");
     }
+    memset(ste, 0, sizeof(*ste));
 
     ste->sid = sid;
     ste->gid = gid;
@@ -197,16 +366,68 @@ static inline DetectThresholdEntry *DetectThresholdEntryAlloc(DetectThresholdDat
     SCReturnPtr(ste, "DetectThresholdEntry");
 }
 
-static DetectThresholdEntry *ThresholdHostLookupEntry(Host *h, uint32_t sid, uint32_t gid)
+/** \internal
+ *  \brief allocate a by_src/by_dst entry and add it to its bucket
+ *
+ *  \retval e the entry's counters or NULL if over the memcap */
+static DetectThresholdEntry *ThresholdEntryAdd(ThresholdEntry **bucket,
+        const Address *a, DetectThresholdData *td, uint32_t sid, uint32_t gid)
 {
-    DetectThresholdEntry *e;
+    if (SC_ATOMIC_GET(th_memuse) + sizeof(ThresholdEntry) > th_table.memcap)
+        return NULL;
 
-    for (e = HostGetStorageById(h, threshold_id); e != NULL; e = e->next) {
-        if (e->sid == sid && e->gid == gid)
-            break;
-    }
+    ThresholdEntry *e = SCMalloc(sizeof(ThresholdEntry));
+    if (unlikely(e == NULL))
+        return NULL;
+    memset(e, 0, sizeof(*e));
+    (void) SC_ATOMIC_ADD(th_memuse, sizeof(ThresholdEntry));
+
+    e->tsh.sid = sid;
+    e->tsh.gid = gid;
+    e->tsh.track = td->track;
+    e->tsh.seconds = td->seconds;
+    COPY_ADDRESS(a, &e->addr);
+
+    e->hnext = *bucket;
+    *bucket = e;
+    return &e->tsh;
+}
 
-    return e;
+/** \brief add the hits another sensor saw to a by_src/by_dst entry
+ *
+ *  Used by state sync. Only the counters are updated, whether to alert
+ *  is decided when the next local packet hits the rule.
+ */
+void ThresholdAddRemoteHits(const Address *a, uint32_t sid, uint32_t gid,
+        uint32_t seconds, int track, uint32_t hits, uint32_t ts)
+{
+    if (!th_table.initialized)
+        return;
+
+    ThresholdEntry **bucket = NULL;
+    ThresholdShard *sh = ThresholdGetBucket(a, sid, gid, &bucket);
+
+    DetectThresholdEntry *e = ThresholdBucketLookup(bucket, a, sid, gid, ts);
+    if (e != NULL) {
+        if ((ts - e->tv_sec1) < e->seconds) {
+            e->current_count += hits;
+        } else {
+            e->tv_sec1 = ts;
+            e->current_count = hits;
+        }
+    } else {
+        DetectThresholdData td;
+        memset(&td, 0, sizeof(td));
+        td.seconds = seconds;
+        td.track = (uint8_t)track;
+
+        e = ThresholdEntryAdd(bucket, a, &td, sid, gid);
+        if (e != NULL) {
+            e->current_count = hits;
+            e->tv_sec1 = ts;
+        }
+    }
+    SCMutexUnlock(&sh->lock);
 }
 
 int ThresholdHandlePacketSuppress(Packet *p, DetectThresholdData *td, uint32_t sid, uint32_t gid)
@@ -249,11 +470,16 @@ int ThresholdHandlePacketSuppress(Packet *p, DetectThresholdData *td, uint32_t s
  *  \retval 1 normal match
  *  \retval 0 no match
  */
-int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint32_t sid, uint32_t gid)
+static int ThresholdHandlePacketAddr(const Address *a, Packet *p,
+        DetectThresholdData *td, uint32_t sid, uint32_t gid)
 {
     int ret = 0;
 
-    DetectThresholdEntry *lookup_tsh = ThresholdHostLookupEntry(h, sid, gid);
+    ThresholdEntry **bucket = NULL;
+    ThresholdShard *sh = ThresholdGetBucket(a, sid, gid, &bucket);
+
+    DetectThresholdEntry *lookup_tsh = ThresholdBucketLookup(bucket, a, sid, gid,
+            (uint32_t)p->ts.tv_sec);
     SCLogDebug("lookup_tsh %p sid %u gid %u", lookup_tsh, sid, gid);
 
     switch(td->type)   {
@@ -277,7 +503,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     ret = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdEntryAdd(bucket, a, td, sid, gid);
                 if (e == NULL) {
                     break;
                 }
@@ -286,9 +512,6 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 e->current_count = 1;
 
                 ret = 1;
-
-                e->next = HostGetStorageById(h, threshold_id);
-                HostSetStorageById(h, threshold_id, e);
             }
             break;
         }
@@ -312,16 +535,13 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 if (td->count == 1)  {
                     ret = 1;
                 } else {
-                    DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                    DetectThresholdEntry *e = ThresholdEntryAdd(bucket, a, td, sid, gid);
                     if (e == NULL) {
                         break;
                     }
 
                     e->current_count = 1;
                     e->tv_sec1 = p->ts.tv_sec;
-
-                    e->next = HostGetStorageById(h, threshold_id);
-                    HostSetStorageById(h, threshold_id, e);
                 }
             }
             break;
@@ -352,7 +572,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     }
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdEntryAdd(bucket, a, td, sid, gid);
                 if (e == NULL) {
                     break;
                 }
@@ -360,9 +580,6 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 e->current_count = 1;
                 e->tv_sec1 = p->ts.tv_sec;
 
-                e->next = HostGetStorageById(h, threshold_id);
-                HostSetStorageById(h, threshold_id, e);
-
                 /* for the first match we return 1 to
                  * indicate we should alert */
                 if (td->count == 1)  {
@@ -395,7 +612,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     lookup_tsh->current_count = 1;
                 }
             } else {
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdEntryAdd(bucket, a, td, sid, gid);
                 if (e == NULL) {
                     break;
                 }
@@ -403,9 +620,6 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 e->current_count = 1;
                 e->tv_sec1 = p->ts.tv_sec;
                 e->tv_usec1 = p->ts.tv_usec;
-
-                e->next = HostGetStorageById(h, threshold_id);
-                HostSetStorageById(h, threshold_id, e);
             }
             break;
         }
@@ -484,7 +698,7 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                     ret = 1;
                 }
 
-                DetectThresholdEntry *e = DetectThresholdEntryAlloc(td, p, sid, gid);
+                DetectThresholdEntry *e = ThresholdEntryAdd(bucket, a, td, sid, gid);
                 if (e == NULL) {
                     break;
                 }
@@ -492,9 +706,6 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
                 e->current_count = 1;
                 e->tv_sec1 = p->ts.tv_sec;
                 e->tv_timeout = 0;
-
-                e->next = HostGetStorageById(h, threshold_id);
-                HostSetStorageById(h, threshold_id, e);
             }
             break;
         }
@@ -503,6 +714,10 @@ int ThresholdHandlePacketHost(Host *h, Packet *p, DetectThresholdData *td, uint3
             SCLogError(SC_ERR_INVALID_VALUE, "type %d is not supported", td->type);
     }
 
+    SCMutexUnlock(&sh->lock);
+
+    if (unlikely(state_sync_flags & STATE_SYNC_THRESHOLDS))
+        StateSyncThresholdHit(a, sid, gid, td->seconds, td->track);
     return ret;
 }
 
@@ -617,17 +832,9 @@ int PacketAlertThreshold(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx
     if (td->type == TYPE_SUPPRESS) {
         ret = ThresholdHandlePacketSuppress(p,td,s->id,s->gid);
     } else if (td->track == TRACK_SRC) {
-        Host *src = HostGetHostFromHash(&p->src);
-        if (src) {
-            ret = ThresholdHandlePacketHost(src,p,td,s->id,s->gid);
-            HostRelease(src);
-        }
+        ret = ThresholdHandlePacketAddr(&p->src,p,td,s->id,s->gid);
     } else if (td->track == TRACK_DST) {
-        Host *dst = HostGetHostFromHash(&p->dst);
-        if (dst) {
-            ret = ThresholdHandlePacketHost(dst,p,td,s->id,s->gid);
-            HostRelease(dst);
-        }
+        ret = ThresholdHandlePacketAddr(&p->dst,p,td,s->id,s->gid);
     } else if (td->track == TRACK_RULE) {
         SCMutexLock(&de_ctx->ths_ctx.threshold_table_lock);
         ret = ThresholdHandlePacketRule(de_ctx,p,td,s);
@@ -665,25 +872,6 @@ void ThresholdContextDestroy(DetectEngineCtx *de_ctx)
     SCMutexDestroy(&de_ctx->ths_ctx.threshold_table_lock);
 }
 
-/**
- * \brief this function will free all the entries of a list
- *        DetectTagDataEntry
- *
- * \param td pointer to DetectTagDataEntryList
- */
-void ThresholdListFree(void *ptr)
-{
-    if (ptr != NULL) {
-        DetectThresholdEntry *entry = ptr;
-
-        while (entry != NULL) {
-            DetectThresholdEntry *next_entry = entry->next;
-            SCFree(entry);
-            entry = next_entry;
-        }
-    }
-}
-
 /**
  * @}
  */
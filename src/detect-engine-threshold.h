@@ -29,9 +29,12 @@
 #include "host.h"
 
 void ThresholdInit(void);
-
-int ThresholdHostStorageId(void);
-int ThresholdHostHasThreshold(Host *);
+void ThresholdShutdown(void);
+void ThresholdsClear(void);
+uint32_t ThresholdsTimeoutHash(struct timeval *);
+DetectThresholdEntry *ThresholdLookupEntry(const Address *, uint32_t, uint32_t);
+void ThresholdAddRemoteHits(const Address *, uint32_t, uint32_t, uint32_t,
+        int, uint32_t, uint32_t);
 
 DetectThresholdData *SigGetThresholdTypeIter(Signature *, Packet *, SigMatch **, int list);
 int PacketAlertThreshold(DetectEngineCtx *, DetectEngineThreadCtx *,
@@ -40,7 +43,4 @@ int PacketAlertThreshold(DetectEngineCtx *, DetectEngineThreadCtx *,
 void ThresholdHashInit(DetectEngineCtx *);
 void ThresholdContextDestroy(DetectEngineCtx *);
 
-int ThresholdTimeoutCheck(Host *, struct timeval *);
-void ThresholdListFree(void *ptr);
-
 #endif /* __DETECT_ENGINE_THRESHOLD_H__ */
@@ -137,7 +137,7 @@ int DetectEngineInspectTlsSni(ThreadVars *tv, DetectEngineCtx *de_ctx,
     buffer_len = strlen(ssl_state->client_connp.sni);
 
     cnt = DetectEngineContentInspection(de_ctx, det_ctx, s,
-            s->sm_lists[DETECT_SM_LIST_TLSSNI_MATCH],
+            s->sm_arrays[DETECT_SM_LIST_TLSSNI_MATCH],
             f, buffer, buffer_len, 0,
             DETECT_ENGINE_CONTENT_INSPECTION_MODE_TLSSNI, NULL);
 
@@ -41,6 +41,9 @@
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-fp-feedback.h"
+#include "detect-engine-rule-budget.h"
+#include "detect-engine-alert-aggregate.h"
 #include "detect-engine-hcbd.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-tag.h"
@@ -81,21 +84,25 @@
 #include "util-error.h"
 #include "util-hash.h"
 #include "util-byte.h"
+#include "util-cpu.h"
 #include "util-debug.h"
 #include "util-unittest.h"
 #include "util-action.h"
 #include "util-magic.h"
 #include "util-signal.h"
 #include "util-spm.h"
+#include "util-mpm-teddy.h"
 
 #include "util-var-name.h"
+#include "util-affinity.h"
+#include "util-load-shed.h"
 
 #include "tm-threads.h"
+#include "tm-queuehandlers.h"
+#include "tmqh-flow.h"
 #include "runmodes.h"
 
-#ifdef PROFILING
 #include "util-profiling.h"
-#endif
 
 #include "reputation.h"
 
@@ -110,9 +117,8 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *);
 
 static DetectEngineMasterCtx g_master_de_ctx = { SCMUTEX_INITIALIZER, 0, NULL, NULL, TENANT_SELECTOR_UNKNOWN, NULL,};
 
-static uint32_t TenantIdHash(HashTable *h, void *data, uint16_t data_len);
-static char TenantIdCompare(void *d1, uint16_t d1_len, void *d2, uint16_t d2_len);
-static void TenantIdFree(void *d);
+void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx);
+static void TenantCtxMapFreeAll(TenantCtxMap *m);
 static uint32_t DetectEngineTentantGetIdFromVlanId(const void *ctx, const Packet *p);
 static uint32_t DetectEngineTentantGetIdFromPcap(const void *ctx, const Packet *p);
 
@@ -613,12 +619,123 @@ static void InjectPackets(ThreadVars **detect_tvs,
     }
 }
 
+/** \internal
+ *  \brief a det_ctx to build for a detect thread during reload */
+typedef struct DetectReloadThreadTask_ {
+    ThreadVars *tv;
+    DetectEngineCtx *de_ctx;
+    int numa_node;      /**< node of the detect thread, -1 if unknown */
+    DetectEngineThreadCtx *det_ctx;
+} DetectReloadThreadTask;
+
+/** \internal
+ *  \brief write to each page of a buffer, so the page faults are taken
+ *         here and not by the detect thread after the swap */
+static void DetectEnginePrewarmBuffer(void *ptr, size_t len)
+{
+    volatile uint8_t *p = ptr;
+    size_t o;
+    if (p == NULL)
+        return;
+    for (o = 0; o < len; o += 4096)
+        p[o] = 0;
+    if (len > 0)
+        p[len - 1] = 0;
+}
+
+/** \internal
+ *  \brief pre-touch the per packet buffers of a new det_ctx
+ *
+ *  Only buffers whose contents are reset before use are written to. */
+static void DetectEngineThreadCtxPrewarm(DetectEngineThreadCtx *det_ctx)
+{
+    DetectEnginePrewarmBuffer(det_ctx->match_array,
+            det_ctx->match_array_len * sizeof(Signature *));
+    DetectEnginePrewarmBuffer(det_ctx->de_state_sig_array,
+            det_ctx->de_state_sig_array_len);
+    DetectEnginePrewarmBuffer(det_ctx->pmq_bitmap,
+            det_ctx->pmq_bitmap_words * sizeof(uint64_t));
+    DetectEnginePrewarmBuffer(det_ctx->pmq.rule_id_array,
+            det_ctx->pmq.rule_id_array_size * sizeof(SigIntId));
+    if (det_ctx->non_mpm_id_array != NULL) {
+        DetectEnginePrewarmBuffer(det_ctx->non_mpm_id_array,
+                det_ctx->non_mpm_id_array_size * sizeof(SigIntId));
+    }
+    DetectEnginePrewarmBuffer(det_ctx->base64_decoded,
+            det_ctx->base64_decoded_len_max);
+}
+
+/** \internal
+ *  \brief loader task: build and pre-touch the det_ctx of one detect
+ *         thread, with its memory preferably on the thread's NUMA node */
+static int DetectEngineReloadThreadTask(void *vctx, int loader_id)
+{
+    DetectReloadThreadTask *t = (DetectReloadThreadTask *)vctx;
+
+    if (t->numa_node >= 0)
+        (void)AffinitySetPreferredNumaNode(t->numa_node);
+
+    t->det_ctx = DetectEngineThreadCtxInitForReload(t->tv, t->de_ctx, 1);
+    if (t->det_ctx != NULL) {
+        DetectEngineThreadCtxPrewarm(t->det_ctx);
+        SCLogDebug("loader %d created new det_ctx %p for %s (node %d)",
+                loader_id, t->det_ctx, t->tv->name, t->numa_node);
+    }
+
+    if (t->numa_node >= 0)
+        (void)AffinitySetPreferredNumaNode(-1);
+
+    return t->det_ctx != NULL ? 0 : -1;
+}
+
+/** \internal
+ *  \brief wait for the packet threads that read a flow queue but don't
+ *         run detect, like the worker output threads, to finish the
+ *         packets they have been handed so far. The alerts of those
+ *         packets may reference the signatures of the old engine.
+ */
+static void DetectEngineReloadWaitOutputThreads(void)
+{
+    uint16_t qids[256];
+    int cnt = 0;
+    int i;
+
+    SCMutexLock(&tv_root_lock);
+    ThreadVars *tv = tv_root[TVT_PPT];
+    while (tv && cnt < (int)(sizeof(qids) / sizeof(qids[0]))) {
+        if (tv->inq != NULL &&
+            tv->tmqh_in == tmqh_table[TMQH_FLOW].InHandler)
+        {
+            int detect = 0;
+            TmSlot *slots = tv->tm_slots;
+            for ( ; slots != NULL; slots = slots->slot_next) {
+                if (TmModuleGetById(slots->tm_id)->flags & TM_FLAG_DETECT_TM) {
+                    detect = 1;
+                    break;
+                }
+            }
+            if (!detect)
+                qids[cnt++] = tv->inq->id;
+        }
+        tv = tv->next;
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    for (i = 0; i < cnt; i++)
+        TmqhFlowWaitDone(qids[i]);
+}
+
 /** \internal
  *  \brief Update detect threads with new detect engine
  *
  *  Atomically update each detect thread with a new thread context
  *  that is associated to the new detection engine(s).
  *
+ *  The new thread contexts are all built first, in parallel on up to
+ *  detect.build-threads threads and with their memory pre-touched on the
+ *  NUMA node of their detect thread. tv_root_lock is only held to find
+ *  the threads and for the swap itself.
+ *
  *  If called in unix socket mode, it's possible that we don't have
  *  detect threads yet.
  *
@@ -671,9 +788,12 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
     DetectEngineThreadCtx *old_det_ctx[no_of_detect_tvs];
     DetectEngineThreadCtx *new_det_ctx[no_of_detect_tvs];
     ThreadVars *detect_tvs[no_of_detect_tvs];
+    DetectReloadThreadTask tasks[no_of_detect_tvs];
+    void *task_ptrs[no_of_detect_tvs];
     memset(old_det_ctx, 0x00, (no_of_detect_tvs * sizeof(DetectEngineThreadCtx *)));
     memset(new_det_ctx, 0x00, (no_of_detect_tvs * sizeof(DetectEngineThreadCtx *)));
     memset(detect_tvs, 0x00, (no_of_detect_tvs * sizeof(ThreadVars *)));
+    memset(tasks, 0x00, (no_of_detect_tvs * sizeof(DetectReloadThreadTask)));
 
     /* start the process of swapping detect threads ctxs */
 
@@ -699,31 +819,44 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
             old_det_ctx[i] = FlowWorkerGetDetectCtxPtr(SC_ATOMIC_GET(slots->slot_data));
             detect_tvs[i] = tv;
 
-            new_det_ctx[i] = DetectEngineThreadCtxInitForReload(tv, new_de_ctx, 1);
-            if (new_det_ctx[i] == NULL) {
-                SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
-                           "failure in live rule swap.  Let's get out of here");
-                SCMutexUnlock(&tv_root_lock);
-                goto error;
-            }
-            SCLogDebug("live rule swap created new det_ctx - %p and de_ctx "
-                       "- %p\n", new_det_ctx[i], new_de_ctx);
+            tasks[i].tv = tv;
+            tasks[i].de_ctx = new_de_ctx;
+            tasks[i].numa_node = FlowWorkerGetNumaNode(SC_ATOMIC_GET(slots->slot_data));
+            task_ptrs[i] = &tasks[i];
             i++;
             break;
         }
 
         tv = tv->next;
     }
+    SCMutexUnlock(&tv_root_lock);
     BUG_ON(i != no_of_detect_tvs);
 
+    /* build the new det_ctxs in parallel, without holding the lock */
+    int r = DetectLoaderRunTasks(new_de_ctx->build_threads,
+            DetectEngineReloadThreadTask, task_ptrs, (uint32_t)no_of_detect_tvs);
+    for (i = 0; i < no_of_detect_tvs; i++) {
+        new_det_ctx[i] = tasks[i].det_ctx;
+    }
+    if (r != 0) {
+        SCLogError(SC_ERR_LIVE_RULE_SWAP, "Detect engine thread init "
+                   "failure in live rule swap.  Let's get out of here");
+        goto error;
+    }
+    if (suricata_ctl_flags != 0) {
+        goto error;
+    }
+
     /* atomicly replace the det_ctx data */
     i = 0;
+    SCMutexLock(&tv_root_lock);
     tv = tv_root[TVT_PPT];
     while (tv) {
         /* find the correct slot */
         TmSlot *slots = tv->tm_slots;
         while (slots != NULL) {
             if (suricata_ctl_flags != 0) {
+                SCMutexUnlock(&tv_root_lock);
                 return -1;
             }
 
@@ -732,6 +865,7 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
                 slots = slots->slot_next;
                 continue;
             }
+            BUG_ON(i >= no_of_detect_tvs || detect_tvs[i] != tv);
             SCLogDebug("swapping new det_ctx - %p with older one - %p",
                        new_det_ctx[i], SC_ATOMIC_GET(slots->slot_data));
             FlowWorkerReplaceDetectCtx(SC_ATOMIC_GET(slots->slot_data), new_det_ctx[i++]);
@@ -794,6 +928,9 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         }
     }
 
+    /* packets detect is done with may still wait for their outputs */
+    DetectEngineReloadWaitOutputThreads();
+
     /* free all the ctxs */
     for (i = 0; i < no_of_detect_tvs; i++) {
         SCLogDebug("Freeing old_det_ctx - %p used by detect",
@@ -801,8 +938,6 @@ static int DetectEngineReloadThreads(DetectEngineCtx *new_de_ctx)
         DetectEngineThreadCtxDeinit(NULL, old_det_ctx[i]);
     }
 
-    SRepReloadComplete();
-
     SCLogNotice("rule reload complete");
     return 1;
 
@@ -840,6 +975,35 @@ static DetectEngineCtx *DetectEngineCtxInitReal(int minimal, const char *prefix)
 
     de_ctx->mpm_matcher = PatternMatchDefaultMatcher();
     de_ctx->spm_matcher = SinglePatternMatchDefaultMatcher();
+
+    intmax_t small_max = 32;
+    if (ConfGetInt("detect.mpm.small-max-patterns", &small_max) == 1) {
+        if (small_max < 0)
+            small_max = 0;
+        else if (small_max > TEDDY_MAX_PATTERNS)
+            small_max = TEDDY_MAX_PATTERNS;
+    }
+    de_ctx->mpm_small_max = (uint32_t)small_max;
+
+    /* share identical mpm ctxs with the other engines, e.g. tenants */
+    de_ctx->mpm_share = 1;
+    (void)ConfGetBool("detect.mpm.share", &de_ctx->mpm_share);
+    if (run_mode == RUNMODE_UNITTEST)
+        de_ctx->mpm_share = 0;
+
+    /* scan the small http request buffers in one go, by default if the
+     * mpm can do so in one call */
+    de_ctx->mpm_http_combined = (mpm_table[de_ctx->mpm_matcher].SearchVector != NULL);
+    char *http_combined = NULL;
+    if (ConfGet("detect.mpm.http-combined", &http_combined) == 1 &&
+            http_combined != NULL && strcasecmp(http_combined, "auto") != 0) {
+        de_ctx->mpm_http_combined = ConfValIsTrue(http_combined);
+    }
+    if (run_mode == RUNMODE_UNITTEST)
+        de_ctx->mpm_http_combined = 0;
+
+    /* skip the packet mpm for the patterns the stream mpm covered */
+    (void)ConfGetBool("detect.mpm.stream-dedup", &de_ctx->mpm_stream_dedup);
     SCLogConfig("pattern matchers: MPM: %s, SPM: %s",
         mpm_table[de_ctx->mpm_matcher].name,
         spm_table[de_ctx->spm_matcher].name);
@@ -861,6 +1025,13 @@ static DetectEngineCtx *DetectEngineCtxInitReal(int minimal, const char *prefix)
     /* init iprep... ignore errors for now */
     (void)SRepInit(de_ctx);
 
+    if (DetectFPFeedbackInit(de_ctx) != 0) {
+        goto error;
+    }
+    if (DetectRuleBudgetInit(de_ctx) != 0) {
+        goto error;
+    }
+
 #ifdef PROFILING
     SCProfilingKeywordInitCounters(de_ctx);
     de_ctx->profile_match_logging_threshold = UINT_MAX; // disabled
@@ -927,11 +1098,11 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     if (de_ctx == NULL)
         return;
 
-#ifdef PROFILING
     if (de_ctx->profile_ctx != NULL) {
         SCProfilingRuleDestroyCtx(de_ctx->profile_ctx);
         de_ctx->profile_ctx = NULL;
     }
+#ifdef PROFILING
     if (de_ctx->profile_keyword_ctx != NULL) {
         SCProfilingKeywordDestroyCtx(de_ctx);//->profile_keyword_ctx);
 //        de_ctx->profile_keyword_ctx = NULL;
@@ -941,11 +1112,17 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     }
 #endif
 
+    /* stores the counts, needs the signatures */
+    DetectFPFeedbackFree(de_ctx);
+    DetectRuleBudgetFree(de_ctx);
+
     /* Normally the hashes are freed elsewhere, but
      * to be sure look at them again here.
      */
     SigGroupHeadHashFree(de_ctx);
     MpmStoreFree(de_ctx);
+    DetectMpmPrepareQueueFree(de_ctx);
+    MpmStoreReuseTableFree(de_ctx);
     DetectParseDupSigHashFree(de_ctx);
     SCSigSignatureOrderingModuleCleanup(de_ctx);
     ThresholdContextDestroy(de_ctx);
@@ -1045,6 +1222,7 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
         /* for now, since we still haven't implemented any intelligence into
          * understanding the patterns and distributing mpm_ctx across sgh */
         if (de_ctx->mpm_matcher == MPM_AC || de_ctx->mpm_matcher == MPM_AC_TILE ||
+            de_ctx->mpm_matcher == MPM_AC_BAND ||
 #ifdef BUILD_HYPERSCAN
             de_ctx->mpm_matcher == MPM_HS ||
 #endif
@@ -1083,6 +1261,29 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
         de_ctx->sgh_mpm_context = ENGINE_SGH_MPM_FACTORY_CONTEXT_FULL;
     }
 
+    /* detect.build-threads: threads used to prepare the mpm ctxs */
+    char *build_threads = NULL;
+    de_ctx->build_threads = 1;
+    if (ConfGet("detect.build-threads", &build_threads) != 1 ||
+        strcmp(build_threads, "auto") == 0)
+    {
+        de_ctx->build_threads = (int)UtilCpuGetNumProcessorsOnline();
+    } else {
+        int32_t t = 0;
+        if (ByteExtractStringInt32(&t, 10, strlen(build_threads),
+                    build_threads) <= 0 || t < 1 || t > 1024)
+        {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value "
+                    "for detect.build-threads: %s", build_threads);
+            exit(EXIT_FAILURE);
+        }
+        de_ctx->build_threads = t;
+    }
+    if (de_ctx->build_threads < 1)
+        de_ctx->build_threads = 1;
+    SCLogDebug("using %d threads to build the detection engine",
+            de_ctx->build_threads);
+
     /* parse profile custom-values */
     opt = NULL;
     switch (profile) {
@@ -1217,6 +1418,36 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
     SCLogDebug("de_ctx->inspection_recursion_limit: %d",
                de_ctx->inspection_recursion_limit);
 
+    de_ctx->packet_alert_max = PACKET_ALERT_MAX;
+    if (ConfGetInt("detect.packet-alert-max", &value) == 1) {
+        if (value < 1 || value > UINT16_MAX) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "detect.packet-alert-max: %"PRIdMAX", using %u",
+                    value, PACKET_ALERT_MAX);
+        } else {
+            de_ctx->packet_alert_max = (uint16_t)value;
+        }
+    }
+    SCLogDebug("de_ctx->packet_alert_max: %u", de_ctx->packet_alert_max);
+
+    AlertAggregateConfig(de_ctx);
+
+    char *inspection_depth = NULL;
+    if (ConfGet("detect.inspection-depth", &inspection_depth) == 1 &&
+            inspection_depth != NULL) {
+        if (strcasecmp(inspection_depth, "auto") == 0) {
+            de_ctx->inspection_depth_auto = 1;
+        } else if (strcasecmp(inspection_depth, "full") != 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value for "
+                    "detect.inspection-depth: \"%s\", using \"full\"",
+                    inspection_depth);
+        }
+    }
+    SCLogDebug("de_ctx->inspection_depth_auto: %d", de_ctx->inspection_depth_auto);
+
+    /* split groups by app layer protocol */
+    (void)ConfGetBool("detect.grouping.app-layer", &de_ctx->grouping_alproto);
+
     /* parse port grouping whitelisting settings */
 
     char *ports = NULL;
@@ -1285,6 +1516,10 @@ void DetectEngineResetMaxSigId(DetectEngineCtx *de_ctx)
     de_ctx->signum = 0;
 }
 
+/** keyword_ctxs_array value of a keyword whose InitFunc failed, so it's
+ *  not retried for every packet */
+#define DETECT_KEYWORD_CTX_FAILED ((void *)-1)
+
 static int DetectEngineThreadCtxInitKeywords(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
 {
     if (de_ctx->keyword_id > 0) {
@@ -1298,16 +1533,8 @@ static int DetectEngineThreadCtxInitKeywords(DetectEngineCtx *de_ctx, DetectEngi
 
         det_ctx->keyword_ctxs_size = de_ctx->keyword_id;
 
-        DetectEngineThreadKeywordCtxItem *item = de_ctx->keyword_list;
-        while (item) {
-            det_ctx->keyword_ctxs_array[item->id] = item->InitFunc(item->data);
-            if (det_ctx->keyword_ctxs_array[item->id] == NULL) {
-                SCLogError(SC_ERR_DETECT_PREPARE, "setting up thread local detect ctx "
-                        "for keyword \"%s\" failed", item->name);
-                return TM_ECODE_FAILED;
-            }
-            item = item->next;
-        }
+        /* the keyword ctxs themselves are set up on first use, see
+         * DetectThreadCtxGetKeywordThreadCtx() */
     }
     return TM_ECODE_OK;
 }
@@ -1317,7 +1544,8 @@ static void DetectEngineThreadCtxDeinitKeywords(DetectEngineCtx *de_ctx, DetectE
     if (de_ctx->keyword_id > 0) {
         DetectEngineThreadKeywordCtxItem *item = de_ctx->keyword_list;
         while (item) {
-            if (det_ctx->keyword_ctxs_array[item->id] != NULL)
+            if (det_ctx->keyword_ctxs_array[item->id] != NULL &&
+                det_ctx->keyword_ctxs_array[item->id] != DETECT_KEYWORD_CTX_FAILED)
                 item->FreeFunc(det_ctx->keyword_ctxs_array[item->id]);
 
             item = item->next;
@@ -1328,6 +1556,133 @@ static void DetectEngineThreadCtxDeinitKeywords(DetectEngineCtx *de_ctx, DetectE
     }
 }
 
+/** \internal
+ *  \brief grow the scratch array sizes of det_ctx so they fit de_ctx
+ *
+ *  The scratch arrays only hold data of the packet that is being
+ *  inspected, so a thread can use one set for all its tenants.
+ */
+static void ThreadCtxScratchSize(const DetectEngineCtx *de_ctx,
+        DetectEngineThreadCtx *det_ctx)
+{
+    /* sized to the max of our sgh settings. A max setting of 0 implies that all
+     * sgh's have: sgh->non_mpm_store_cnt == 0 */
+    det_ctx->non_mpm_id_array_size = MAX(det_ctx->non_mpm_id_array_size,
+            de_ctx->non_mpm_store_cnt_max);
+
+    /* indexed by signature num */
+    det_ctx->pmq_bitmap_words = MAX(det_ctx->pmq_bitmap_words,
+            (de_ctx->sig_array_len + 63) / 64);
+    det_ctx->de_state_sig_array_len = MAX(det_ctx->de_state_sig_array_len,
+            de_ctx->sig_array_len);
+
+    /* holds the unique sigs of a single sgh. With a single mpm ctx shared
+     * by all sgh's the pmq can hold any sig, so then size for all of them. */
+    uint32_t match_array_len = de_ctx->sgh_sig_cnt_max;
+    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE ||
+        match_array_len == 0 || match_array_len > de_ctx->sig_array_len)
+        match_array_len = de_ctx->sig_array_len;
+    det_ctx->match_array_len = MAX(det_ctx->match_array_len, match_array_len);
+
+    /* byte_extract storage */
+    det_ctx->bj_values_len = MAX(det_ctx->bj_values_len,
+            (uint32_t)de_ctx->byte_extract_max_local_id + 1);
+
+    det_ctx->base64_decoded_len_max = MAX(det_ctx->base64_decoded_len_max,
+            (int)de_ctx->base64_decode_max_len);
+}
+
+/** \internal
+ *  \brief allocate the scratch arrays using the sizes set by
+ *         ThreadCtxScratchSize()
+ */
+static TmEcode ThreadCtxScratchAlloc(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->non_mpm_id_array_size > 0) {
+        det_ctx->non_mpm_id_array = SCCalloc(det_ctx->non_mpm_id_array_size,
+                sizeof(SigIntId));
+        if (det_ctx->non_mpm_id_array == NULL)
+            return TM_ECODE_FAILED;
+    }
+    if (det_ctx->pmq_bitmap_words > 0) {
+        det_ctx->pmq_bitmap = SCCalloc(det_ctx->pmq_bitmap_words, sizeof(uint64_t));
+        if (det_ctx->pmq_bitmap == NULL)
+            return TM_ECODE_FAILED;
+    }
+    if (det_ctx->de_state_sig_array_len > 0) {
+        det_ctx->de_state_sig_array = SCCalloc(det_ctx->de_state_sig_array_len,
+                sizeof(uint8_t));
+        if (det_ctx->de_state_sig_array == NULL)
+            return TM_ECODE_FAILED;
+    }
+    if (det_ctx->match_array_len > 0) {
+        det_ctx->match_array = SCCalloc(det_ctx->match_array_len,
+                sizeof(Signature *));
+        if (det_ctx->match_array == NULL)
+            return TM_ECODE_FAILED;
+    }
+    det_ctx->bj_values = SCMalloc(sizeof(*det_ctx->bj_values) *
+            det_ctx->bj_values_len);
+    if (det_ctx->bj_values == NULL)
+        return TM_ECODE_FAILED;
+
+    /* Allocate space for base64 decoded data. */
+    if (det_ctx->base64_decoded_len_max > 0) {
+        det_ctx->base64_decoded = SCMalloc(det_ctx->base64_decoded_len_max);
+        if (det_ctx->base64_decoded == NULL)
+            return TM_ECODE_FAILED;
+        det_ctx->base64_decoded_len = 0;
+    }
+    return TM_ECODE_OK;
+}
+
+/** \internal
+ *  \brief free the scratch arrays, unless they are borrowed */
+static void ThreadCtxScratchFree(DetectEngineThreadCtx *det_ctx)
+{
+    if (!det_ctx->scratch_shared) {
+        if (det_ctx->non_mpm_id_array != NULL)
+            SCFree(det_ctx->non_mpm_id_array);
+        if (det_ctx->pmq_bitmap != NULL)
+            SCFree(det_ctx->pmq_bitmap);
+        if (det_ctx->de_state_sig_array != NULL)
+            SCFree(det_ctx->de_state_sig_array);
+        if (det_ctx->match_array != NULL)
+            SCFree(det_ctx->match_array);
+        if (det_ctx->bj_values != NULL)
+            SCFree(det_ctx->bj_values);
+        if (det_ctx->base64_decoded != NULL)
+            SCFree(det_ctx->base64_decoded);
+    }
+    det_ctx->non_mpm_id_array = NULL;
+    det_ctx->pmq_bitmap = NULL;
+    det_ctx->de_state_sig_array = NULL;
+    det_ctx->match_array = NULL;
+    det_ctx->bj_values = NULL;
+    det_ctx->base64_decoded = NULL;
+}
+
+/** \internal
+ *  \brief let a tenant ctx use the scratch arrays of the multi tenant ctx
+ */
+static void ThreadCtxScratchShare(const DetectEngineThreadCtx *det_ctx,
+        DetectEngineThreadCtx *tenant_det_ctx)
+{
+    tenant_det_ctx->non_mpm_id_array = det_ctx->non_mpm_id_array;
+    tenant_det_ctx->non_mpm_id_array_size = det_ctx->non_mpm_id_array_size;
+    tenant_det_ctx->pmq_bitmap = det_ctx->pmq_bitmap;
+    tenant_det_ctx->pmq_bitmap_words = det_ctx->pmq_bitmap_words;
+    tenant_det_ctx->de_state_sig_array = det_ctx->de_state_sig_array;
+    tenant_det_ctx->de_state_sig_array_len = det_ctx->de_state_sig_array_len;
+    tenant_det_ctx->match_array = det_ctx->match_array;
+    tenant_det_ctx->match_array_len = det_ctx->match_array_len;
+    tenant_det_ctx->bj_values = det_ctx->bj_values;
+    tenant_det_ctx->bj_values_len = det_ctx->bj_values_len;
+    tenant_det_ctx->base64_decoded = det_ctx->base64_decoded;
+    tenant_det_ctx->base64_decoded_len_max = det_ctx->base64_decoded_len_max;
+    tenant_det_ctx->scratch_shared = 1;
+}
+
 /** NOTE: master MUST be locked before calling this */
 static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThreadCtx *det_ctx)
 {
@@ -1337,7 +1692,9 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
     uint32_t map_cnt = 0;
     int max_tenant_id = 0;
     DetectEngineCtx *list = master->list;
-    HashTable *mt_det_ctxs_hash = NULL;
+    TenantCtxMap *mt_det_ctxs_hash = NULL;
+    DetectEngineThreadCtx **mt_det_ctxs = NULL;
+    uint32_t *vlan_map = NULL;
 
     if (master->tenant_selector == TENANT_SELECTOR_UNKNOWN) {
         SCLogError(SC_ERR_MT_NO_SELECTOR, "no tenant selector set: "
@@ -1354,10 +1711,15 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
         tcnt++;
     }
 
-    mt_det_ctxs_hash = HashTableInit(tcnt * 2, TenantIdHash, TenantIdCompare, TenantIdFree);
+    mt_det_ctxs_hash = SCMalloc(sizeof(*mt_det_ctxs_hash));
     if (mt_det_ctxs_hash == NULL) {
         goto error;
     }
+    if (TenantCtxMapInit(mt_det_ctxs_hash, tcnt) != 0) {
+        SCFree(mt_det_ctxs_hash);
+        mt_det_ctxs_hash = NULL;
+        goto error;
+    }
 
     if (max_tenant_id == 0) {
         SCLogInfo("no tenants left, or none registered yet");
@@ -1390,6 +1752,26 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
                 map = map->next;
             }
 
+            /* vlan ids are 12 bits, so map them directly. Keep the first
+             * mapping of an id, like the linear search did. */
+            if (master->tenant_selector == TENANT_SELECTOR_VLAN) {
+                vlan_map = SCCalloc(DETECT_ENGINE_MT_VLAN_IDS, sizeof(uint32_t));
+                if (vlan_map == NULL)
+                    goto error;
+                uint32_t x;
+                for (x = 0; x < map_cnt; x++) {
+                    uint32_t vlan_id = map_array[x].traffic_id;
+                    if (vlan_id < DETECT_ENGINE_MT_VLAN_IDS &&
+                        vlan_map[vlan_id] == 0)
+                        vlan_map[vlan_id] = map_array[x].tenant_id;
+                }
+            }
+        }
+
+        if (max_tenant_id <= DETECT_ENGINE_MT_ARRAY_MAX) {
+            mt_det_ctxs = SCCalloc(max_tenant_id, sizeof(DetectEngineThreadCtx *));
+            if (mt_det_ctxs == NULL)
+                goto error;
         }
 
         /* set up hash for tenant lookup */
@@ -1400,9 +1782,33 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
                 DetectEngineThreadCtx *mt_det_ctx = DetectEngineThreadCtxInitForReload(tv, list, 0);
                 if (mt_det_ctx == NULL)
                     goto error;
-                if (HashTableAdd(mt_det_ctxs_hash, mt_det_ctx, 0) != 0) {
+                uint32_t tenant_id = list->tenant_id;
+                if (TenantCtxMapAdd(mt_det_ctxs_hash, &tenant_id, &mt_det_ctx) != 0) {
+                    DetectEngineThreadCtxFree(mt_det_ctx);
                     goto error;
                 }
+                if (mt_det_ctxs != NULL)
+                    mt_det_ctxs[list->tenant_id] = mt_det_ctx;
+
+                ThreadCtxScratchSize(list, det_ctx);
+            }
+            list = list->next;
+        }
+
+        /* a thread inspects one tenant at a time, so all tenant ctxs use
+         * our scratch arrays, resized for the largest tenant */
+        ThreadCtxScratchFree(det_ctx);
+        if (ThreadCtxScratchAlloc(det_ctx) != TM_ECODE_OK)
+            goto error;
+
+        list = master->list;
+        while (list) {
+            if (list->tenant_id != 0) {
+                uint32_t tenant_id = list->tenant_id;
+                DetectEngineThreadCtx **tenant =
+                    TenantCtxMapLookup(mt_det_ctxs_hash, &tenant_id);
+                if (tenant != NULL)
+                    ThreadCtxScratchShare(det_ctx, *tenant);
             }
             list = list->next;
         }
@@ -1410,11 +1816,13 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
 
     det_ctx->mt_det_ctxs_hash = mt_det_ctxs_hash;
     mt_det_ctxs_hash = NULL;
+    det_ctx->mt_det_ctxs = mt_det_ctxs;
 
     det_ctx->mt_det_ctxs_cnt = max_tenant_id;
 
     det_ctx->tenant_array = map_array;
     det_ctx->tenant_array_size = map_array_size;
+    det_ctx->tenant_vlan_map = vlan_map;
 
     switch (master->tenant_selector) {
         case TENANT_SELECTOR_UNKNOWN:
@@ -1434,16 +1842,24 @@ static TmEcode DetectEngineThreadCtxInitForMT(ThreadVars *tv, DetectEngineThread
 error:
     if (map_array != NULL)
         SCFree(map_array);
+    if (vlan_map != NULL)
+        SCFree(vlan_map);
+    if (mt_det_ctxs != NULL)
+        SCFree(mt_det_ctxs);
     if (mt_det_ctxs_hash != NULL)
-        HashTableFree(mt_det_ctxs_hash);
+        TenantCtxMapFreeAll(mt_det_ctxs_hash);
 
     return TM_ECODE_FAILED;
 }
 
 /** \internal
  *  \brief Helper for DetectThread setup functions
+ *
+ *  \param scratch allocate the scratch arrays. Tenant ctxs get them
+ *         from their multi tenant ctx instead.
  */
-static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
+static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx,
+        int scratch)
 {
     PatternMatchThreadPrepare(&det_ctx->mtc, de_ctx->mpm_matcher);
     PatternMatchThreadPrepare(&det_ctx->mtcs, de_ctx->mpm_matcher);
@@ -1451,60 +1867,47 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
 
     PmqSetup(&det_ctx->pmq);
 
+    if (MpmOffloadEnabled()) {
+        det_ctx->mpm_offload_jobs = SCCalloc(DETECT_MPM_OFFLOAD_BATCH,
+                sizeof(MpmOffloadJob));
+        if (det_ctx->mpm_offload_jobs == NULL)
+            return TM_ECODE_FAILED;
+        int i;
+        for (i = 0; i < DETECT_MPM_OFFLOAD_BATCH; i++)
+            MpmOffloadJobInit(&det_ctx->mpm_offload_jobs[i]);
+    }
+
     det_ctx->spm_thread_ctx = SpmMakeThreadCtx(de_ctx->spm_global_thread_ctx);
     if (det_ctx->spm_thread_ctx == NULL) {
         return TM_ECODE_FAILED;
     }
 
-    /* sized to the max of our sgh settings. A max setting of 0 implies that all
-     * sgh's have: sgh->non_mpm_store_cnt == 0 */
-    if (de_ctx->non_mpm_store_cnt_max > 0) {
-        det_ctx->non_mpm_id_array =  SCCalloc(de_ctx->non_mpm_store_cnt_max, sizeof(SigIntId));
-        BUG_ON(det_ctx->non_mpm_id_array == NULL);
-    }
-
-    /* IP-ONLY */
-    DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
-
-    /* DeState */
-    if (de_ctx->sig_array_len > 0) {
-        det_ctx->de_state_sig_array_len = de_ctx->sig_array_len;
-        det_ctx->de_state_sig_array = SCMalloc(det_ctx->de_state_sig_array_len * sizeof(uint8_t));
-        if (det_ctx->de_state_sig_array == NULL) {
+    /* tenant ctxs get the scratch arrays of their multi tenant ctx,
+     * see DetectEngineThreadCtxInitForMT() */
+    if (scratch) {
+        ThreadCtxScratchSize(de_ctx, det_ctx);
+        if (ThreadCtxScratchAlloc(det_ctx) != TM_ECODE_OK) {
             return TM_ECODE_FAILED;
         }
-        memset(det_ctx->de_state_sig_array, 0,
-               det_ctx->de_state_sig_array_len * sizeof(uint8_t));
+    }
 
-        det_ctx->match_array_len = de_ctx->sig_array_len;
-        det_ctx->match_array = SCMalloc(det_ctx->match_array_len * sizeof(Signature *));
-        if (det_ctx->match_array == NULL) {
-            return TM_ECODE_FAILED;
-        }
-        memset(det_ctx->match_array, 0,
-               det_ctx->match_array_len * sizeof(Signature *));
+    if (DetectFPFeedbackThreadInit(de_ctx, det_ctx) != 0) {
+        return TM_ECODE_FAILED;
     }
 
-    /* byte_extract storage */
-    det_ctx->bj_values = SCMalloc(sizeof(*det_ctx->bj_values) *
-                                  (de_ctx->byte_extract_max_local_id + 1));
-    if (det_ctx->bj_values == NULL) {
+    if (DetectRuleBudgetThreadInit(de_ctx, det_ctx) != 0) {
         return TM_ECODE_FAILED;
     }
 
-    /* Allocate space for base64 decoded data. */
-    if (de_ctx->base64_decode_max_len) {
-        det_ctx->base64_decoded = SCMalloc(de_ctx->base64_decode_max_len);
-        if (det_ctx->base64_decoded == NULL) {
-            return TM_ECODE_FAILED;
-        }
-        det_ctx->base64_decoded_len_max = de_ctx->base64_decode_max_len;
-        det_ctx->base64_decoded_len = 0;
+    if (AlertAggregateThreadInit(de_ctx, det_ctx) != 0) {
+        return TM_ECODE_FAILED;
     }
 
+    /* IP-ONLY */
+    DetectEngineIPOnlyThreadInit(de_ctx,&det_ctx->io_ctx);
+
     DetectEngineThreadCtxInitKeywords(de_ctx, det_ctx);
 #ifdef PROFILING
-    SCProfilingRuleThreadSetup(de_ctx->profile_ctx, det_ctx);
     SCProfilingKeywordThreadSetup(de_ctx->profile_keyword_ctx, det_ctx);
     SCProfilingSghThreadSetup(de_ctx->profile_sgh_ctx, det_ctx);
 #endif
@@ -1535,6 +1938,27 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     /* first register the counter. In delayed detect mode we exit right after if the
      * rules haven't been loaded yet. */
     uint16_t counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    uint16_t counter_alerts_overflow =
+        StatsRegisterCounter("detect.alert_queue_overflow", tv);
+    uint16_t counter_alerts_aggregated =
+        StatsRegisterCounter("detect.alert_aggregated", tv);
+    uint16_t counter_mpm_dedup =
+        StatsRegisterCounter("detect.mpm_stream_dedup", tv);
+    uint16_t counter_mpm_dedup_bytes =
+        StatsRegisterCounter("detect.mpm_stream_dedup_bytes", tv);
+    uint16_t counter_sgh_skipped =
+        StatsRegisterCounter("detect.sgh_skipped", tv);
+    uint16_t counter_load_shed_raw_stream = 0;
+    uint16_t counter_load_shed_body = 0;
+    uint16_t counter_load_shed_flow = 0;
+    if (load_shed_enabled) {
+        counter_load_shed_raw_stream =
+            StatsRegisterCounter("detect.load_shed.raw_stream", tv);
+        counter_load_shed_body =
+            StatsRegisterCounter("detect.load_shed.body", tv);
+        counter_load_shed_flow =
+            StatsRegisterCounter("detect.load_shed.flow", tv);
+    }
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1563,7 +1987,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     }
 
     if (det_ctx->de_ctx->minimal == 0) {
-        if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
+        if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx, 1) != TM_ECODE_OK) {
             DetectEngineThreadCtxDeinit(tv, det_ctx);
             return TM_ECODE_FAILED;
         }
@@ -1571,6 +1995,14 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
 
     /** alert counter setup */
     det_ctx->counter_alerts = counter_alerts;
+    det_ctx->counter_alerts_overflow = counter_alerts_overflow;
+    det_ctx->counter_alerts_aggregated = counter_alerts_aggregated;
+    det_ctx->counter_mpm_dedup = counter_mpm_dedup;
+    det_ctx->counter_mpm_dedup_bytes = counter_mpm_dedup_bytes;
+    det_ctx->counter_sgh_skipped = counter_sgh_skipped;
+    det_ctx->counter_load_shed_raw_stream = counter_load_shed_raw_stream;
+    det_ctx->counter_load_shed_body = counter_load_shed_body;
+    det_ctx->counter_load_shed_flow = counter_load_shed_flow;
 #ifdef PROFILING
     det_ctx->counter_mpm_list = counter_mpm_list;
     det_ctx->counter_nonmpm_list = counter_nonmpm_list;
@@ -1614,8 +2046,8 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
         return NULL;
     }
 
-    /* most of the init happens here */
-    if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx) != TM_ECODE_OK) {
+    /* most of the init happens here. mt is 0 only for the tenant ctxs */
+    if (ThreadCtxDoInit(det_ctx->de_ctx, det_ctx, mt) != TM_ECODE_OK) {
         DetectEngineDeReference(&det_ctx->de_ctx);
         SCFree(det_ctx);
         return NULL;
@@ -1623,6 +2055,24 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_alerts_overflow =
+        StatsRegisterCounter("detect.alert_queue_overflow", tv);
+    det_ctx->counter_alerts_aggregated =
+        StatsRegisterCounter("detect.alert_aggregated", tv);
+    det_ctx->counter_mpm_dedup =
+        StatsRegisterCounter("detect.mpm_stream_dedup", tv);
+    det_ctx->counter_mpm_dedup_bytes =
+        StatsRegisterCounter("detect.mpm_stream_dedup_bytes", tv);
+    det_ctx->counter_sgh_skipped =
+        StatsRegisterCounter("detect.sgh_skipped", tv);
+    if (load_shed_enabled) {
+        det_ctx->counter_load_shed_raw_stream =
+            StatsRegisterCounter("detect.load_shed.raw_stream", tv);
+        det_ctx->counter_load_shed_body =
+            StatsRegisterCounter("detect.load_shed.body", tv);
+        det_ctx->counter_load_shed_flow =
+            StatsRegisterCounter("detect.load_shed.flow", tv);
+    }
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -1647,15 +2097,23 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
 void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 {
-    int i;
-
     if (det_ctx->tenant_array != NULL) {
         SCFree(det_ctx->tenant_array);
         det_ctx->tenant_array = NULL;
     }
+    if (det_ctx->tenant_vlan_map != NULL) {
+        SCFree(det_ctx->tenant_vlan_map);
+        det_ctx->tenant_vlan_map = NULL;
+    }
+    if (det_ctx->mt_det_ctxs != NULL) {
+        SCFree(det_ctx->mt_det_ctxs);
+        det_ctx->mt_det_ctxs = NULL;
+    }
+
+    SRepThreadRelease(det_ctx);
 
-#ifdef PROFILING
     SCProfilingRuleThreadCleanup(det_ctx);
+#ifdef PROFILING
     SCProfilingKeywordThreadCleanup(det_ctx);
     SCProfilingSghThreadCleanup(det_ctx);
 #endif
@@ -1671,32 +2129,21 @@ void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 
     PmqFree(&det_ctx->pmq);
 
+    if (det_ctx->mpm_offload_jobs != NULL) {
+        int i;
+        for (i = 0; i < DETECT_MPM_OFFLOAD_BATCH; i++)
+            MpmOffloadJobDeinit(&det_ctx->mpm_offload_jobs[i]);
+        SCFree(det_ctx->mpm_offload_jobs);
+    }
+
     if (det_ctx->spm_thread_ctx != NULL) {
         SpmDestroyThreadCtx(det_ctx->spm_thread_ctx);
     }
 
-    if (det_ctx->non_mpm_id_array != NULL)
-        SCFree(det_ctx->non_mpm_id_array);
-
-    if (det_ctx->de_state_sig_array != NULL)
-        SCFree(det_ctx->de_state_sig_array);
-    if (det_ctx->match_array != NULL)
-        SCFree(det_ctx->match_array);
-
-    if (det_ctx->bj_values != NULL)
-        SCFree(det_ctx->bj_values);
-
-    /* HHD temp storage */
-    for (i = 0; i < det_ctx->hhd_buffers_size; i++) {
-        if (det_ctx->hhd_buffers[i] != NULL)
-            SCFree(det_ctx->hhd_buffers[i]);
-    }
-    if (det_ctx->hhd_buffers)
-        SCFree(det_ctx->hhd_buffers);
-    det_ctx->hhd_buffers = NULL;
-    if (det_ctx->hhd_buffers_len)
-        SCFree(det_ctx->hhd_buffers_len);
-    det_ctx->hhd_buffers_len = NULL;
+    ThreadCtxScratchFree(det_ctx);
+    DetectFPFeedbackThreadDeinit(det_ctx);
+    DetectRuleBudgetThreadDeinit(det_ctx);
+    AlertAggregateThreadDeinit(det_ctx);
 
     /* HSBD */
     if (det_ctx->hsbd != NULL) {
@@ -1716,11 +2163,6 @@ void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         SCFree(det_ctx->smtp);
     }
 
-    /* Decoded base64 data. */
-    if (det_ctx->base64_decoded != NULL) {
-        SCFree(det_ctx->base64_decoded);
-    }
-
     if (det_ctx->de_ctx != NULL) {
         DetectEngineThreadCtxDeinitKeywords(det_ctx->de_ctx, det_ctx);
 #ifdef UNITTESTS
@@ -1743,7 +2185,7 @@ TmEcode DetectEngineThreadCtxDeinit(ThreadVars *tv, void *data)
     }
 
     if (det_ctx->mt_det_ctxs_hash != NULL) {
-        HashTableFree(det_ctx->mt_det_ctxs_hash);
+        TenantCtxMapFreeAll(det_ctx->mt_det_ctxs_hash);
         det_ctx->mt_det_ctxs_hash = NULL;
     }
     DetectEngineThreadCtxFree(det_ctx);
@@ -1806,7 +2248,34 @@ int DetectRegisterThreadCtxFuncs(DetectEngineCtx *de_ctx, const char *name, void
     return item->id;
 }
 
+/** \internal
+ *  \brief set up a thread local keyword ctx on its first use
+ *
+ *  Most threads only ever see the keywords of a few tenants and rule
+ *  groups, so the ctxs are not all created with the det_ctx.
+ */
+static void *DetectThreadCtxInitKeywordThreadCtx(DetectEngineThreadCtx *det_ctx, int id)
+{
+    DetectEngineThreadKeywordCtxItem *item = det_ctx->de_ctx->keyword_list;
+    while (item != NULL && item->id != id)
+        item = item->next;
+    if (item == NULL)
+        return NULL;
+
+    void *ctx = item->InitFunc(item->data);
+    if (ctx == NULL) {
+        SCLogError(SC_ERR_DETECT_PREPARE, "setting up thread local detect ctx "
+                "for keyword \"%s\" failed", item->name);
+        det_ctx->keyword_ctxs_array[id] = DETECT_KEYWORD_CTX_FAILED;
+        return NULL;
+    }
+    det_ctx->keyword_ctxs_array[id] = ctx;
+    return ctx;
+}
+
 /** \brief Retrieve thread local keyword ctx by id
+ *
+ *  The ctx is created on the first call for a det_ctx.
  *
  *  \param det_ctx detection engine thread ctx to retrieve the ctx from
  *  \param id id of the ctx returned by DetectRegisterThreadCtxInitFunc at
@@ -1816,10 +2285,16 @@ int DetectRegisterThreadCtxFuncs(DetectEngineCtx *de_ctx, const char *name, void
  */
 void *DetectThreadCtxGetKeywordThreadCtx(DetectEngineThreadCtx *det_ctx, int id)
 {
-    if (id < 0 || id > det_ctx->keyword_ctxs_size || det_ctx->keyword_ctxs_array == NULL)
+    if (id < 0 || id >= det_ctx->keyword_ctxs_size || det_ctx->keyword_ctxs_array == NULL)
         return NULL;
 
-    return det_ctx->keyword_ctxs_array[id];
+    void *ctx = det_ctx->keyword_ctxs_array[id];
+    if (likely(ctx != NULL)) {
+        if (unlikely(ctx == DETECT_KEYWORD_CTX_FAILED))
+            return NULL;
+        return ctx;
+    }
+    return DetectThreadCtxInitKeywordThreadCtx(det_ctx, id);
 }
 
 /** \brief Check if detection is enabled
@@ -1854,11 +2329,41 @@ DetectEngineCtx *DetectEngineGetCurrent(void)
     return master->list;
 }
 
+/** \brief reload the ip reputation of all detect engines
+ *
+ *  The rules are not touched, each engine gets a new reputation
+ *  snapshot that the detect threads switch to on their own.
+ *
+ *  \retval 0 ok
+ *  \retval -1 reloading failed for one or more engines
+ */
+int DetectEngineReloadReputation(void)
+{
+    DetectEngineMasterCtx *master = &g_master_de_ctx;
+    int r = 0;
+
+    SCMutexLock(&master->lock);
+    DetectEngineCtx *de_ctx = master->list;
+    while (de_ctx) {
+        if (!de_ctx->minimal && de_ctx->srepCIDR_ctx != NULL) {
+            if (SRepReload(de_ctx) < 0)
+                r = -1;
+        }
+        de_ctx = de_ctx->next;
+    }
+    SCMutexUnlock(&master->lock);
+
+    if (r == 0)
+        SCLogNotice("reputation reload complete");
+    return r;
+}
+
 DetectEngineCtx *DetectEngineReference(DetectEngineCtx *de_ctx)
 {
     if (de_ctx == NULL)
         return NULL;
-    de_ctx->ref_cnt++;
+    /* det_ctxs are built in parallel on reload */
+    (void)SCAtomicFetchAndAdd(&de_ctx->ref_cnt, 1);
     return de_ctx;
 }
 
@@ -1972,11 +2477,14 @@ static int DetectEngineMultiTenantReloadTenant(uint32_t tenant_id, const char *f
 
     new_de_ctx->tenant_id = tenant_id;
     new_de_ctx->loader_id = old_de_ctx->loader_id;
+    new_de_ctx->mpm_reuse_de_ctx = old_de_ctx;
 
     if (SigLoadSignatures(new_de_ctx, NULL, 0) < 0) {
         SCLogError(SC_ERR_NO_RULES_LOADED, "Loading signatures failed.");
+        new_de_ctx->mpm_reuse_de_ctx = NULL;
         goto error;
     }
+    new_de_ctx->mpm_reuse_de_ctx = NULL;
 
     DetectEngineAddToMaster(new_de_ctx);
 
@@ -2275,7 +2783,13 @@ static uint32_t DetectEngineTentantGetIdFromVlanId(const void *ctx, const Packet
 
     vlan_id = p->vlan_id[0];
 
-    if (det_ctx == NULL || det_ctx->tenant_array == NULL || det_ctx->tenant_array_size == 0)
+    if (det_ctx == NULL)
+        return 0;
+
+    if (det_ctx->tenant_vlan_map != NULL)
+        return det_ctx->tenant_vlan_map[vlan_id & (DETECT_ENGINE_MT_VLAN_IDS - 1)];
+
+    if (det_ctx->tenant_array == NULL || det_ctx->tenant_array_size == 0)
         return 0;
 
     /* not very efficient, but for now we're targeting only limited amounts.
@@ -2419,7 +2933,7 @@ DetectEngineCtx *DetectEngineGetByTenantId(int tenant_id)
 void DetectEngineDeReference(DetectEngineCtx **de_ctx)
 {
     BUG_ON((*de_ctx)->ref_cnt == 0);
-    (*de_ctx)->ref_cnt--;
+    (void)SCAtomicFetchAndSub(&(*de_ctx)->ref_cnt, 1);
     *de_ctx = NULL;
 }
 
@@ -2587,17 +3101,22 @@ int DetectEngineReload(SCInstance *suri)
         DetectEngineDeReference(&old_de_ctx);
         return -1;
     }
+    /* reuse the mpm ctxs the new rules have in common with the old ones */
+    new_de_ctx->mpm_reuse_de_ctx = old_de_ctx;
     if (SigLoadSignatures(new_de_ctx,
                           suri->sig_file, suri->sig_file_exclusive) != 0) {
+        new_de_ctx->mpm_reuse_de_ctx = NULL;
         DetectEngineCtxFree(new_de_ctx);
         DetectEngineDeReference(&old_de_ctx);
         return -1;
     }
+    new_de_ctx->mpm_reuse_de_ctx = NULL;
     SCThresholdConfInitContext(new_de_ctx, NULL);
     SCLogDebug("set up new_de_ctx %p", new_de_ctx);
 
     /* add to master */
     DetectEngineAddToMaster(new_de_ctx);
+    MpmOffloadSetDetectEngine(new_de_ctx);
 
     /* move to old free list */
     DetectEngineMoveToFreeList(old_de_ctx);
@@ -2615,22 +3134,17 @@ int DetectEngineReload(SCInstance *suri)
     return 0;
 }
 
-static uint32_t TenantIdHash(HashTable *h, void *data, uint16_t data_len)
-{
-    DetectEngineThreadCtx *det_ctx = (DetectEngineThreadCtx *)data;
-    return det_ctx->tenant_id % h->array_size;
-}
-
-static char TenantIdCompare(void *d1, uint16_t d1_len, void *d2, uint16_t d2_len)
-{
-    DetectEngineThreadCtx *det1 = (DetectEngineThreadCtx *)d1;
-    DetectEngineThreadCtx *det2 = (DetectEngineThreadCtx *)d2;
-    return (det1->tenant_id == det2->tenant_id);
-}
-
-static void TenantIdFree(void *d)
+/** \internal
+ *  \brief free the map and the tenant det_ctxs it owns */
+static void TenantCtxMapFreeAll(TenantCtxMap *m)
 {
-    DetectEngineThreadCtxFree(d);
+    TenantCtxMapEntry *e;
+    uint32_t iter = 0;
+    while ((e = TenantCtxMapNext(m, &iter)) != NULL) {
+        DetectEngineThreadCtxFree(e->val);
+    }
+    TenantCtxMapFree(m);
+    SCFree(m);
 }
 
 int DetectEngineMTApply(void)
@@ -3298,6 +3812,186 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test reload reuses the unique mpm ctxs of unchanged rules */
+static int DetectEngineTest10(void)
+{
+    DetectEngineCtx *de_ctx1 = NULL, *de_ctx2 = NULL;
+    int result = 0;
+
+    de_ctx1 = DetectEngineCtxInit();
+    if (de_ctx1 == NULL)
+        goto end;
+    de_ctx1->flags |= DE_QUIET;
+
+    if (DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any "
+                "(content:\"abcd\"; sid:1;)") == NULL)
+        goto end;
+    if (DetectEngineAppendSig(de_ctx1, "alert tcp any any -> any any "
+                "(content:\"GET\"; http_method; sid:2;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx1);
+
+    de_ctx2 = DetectEngineCtxInit();
+    if (de_ctx2 == NULL)
+        goto end;
+    de_ctx2->flags |= DE_QUIET;
+    de_ctx2->mpm_reuse_de_ctx = de_ctx1;
+
+    if (DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"abcd\"; sid:1;)") == NULL)
+        goto end;
+    if (DetectEngineAppendSig(de_ctx2, "alert tcp any any -> any any "
+                "(content:\"GET\"; http_method; sid:2;)") == NULL)
+        goto end;
+    SigGroupBuild(de_ctx2);
+    de_ctx2->mpm_reuse_de_ctx = NULL;
+
+    if (de_ctx2->mpm_reuse_cnt == 0) {
+        printf("no mpm ctx reused: ");
+        goto end;
+    }
+
+    /* the old engine goes first, as on a reload */
+    DetectEngineCtxFree(de_ctx1);
+    de_ctx1 = NULL;
+
+    result = 1;
+end:
+    if (de_ctx1 != NULL)
+        DetectEngineCtxFree(de_ctx1);
+    if (de_ctx2 != NULL)
+        DetectEngineCtxFree(de_ctx2);
+    return result;
+}
+
+static DetectEngineCtx *DetectEngineTest11Build(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return NULL;
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_share = 1;
+
+    if (DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"abcd\"; sid:1;)") == NULL ||
+        DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(content:\"GET\"; http_method; sid:2;)") == NULL)
+    {
+        DetectEngineCtxFree(de_ctx);
+        return NULL;
+    }
+    SigGroupBuild(de_ctx);
+    return de_ctx;
+}
+
+/** \test engines built independently, like tenants, share their mpm ctxs
+ *         for as long as one of them is alive */
+static int DetectEngineTest11(void)
+{
+    DetectEngineCtx *de_ctx1 = NULL, *de_ctx2 = NULL, *de_ctx3 = NULL;
+    int result = 0;
+
+    de_ctx1 = DetectEngineTest11Build();
+    if (de_ctx1 == NULL)
+        goto end;
+    if (de_ctx1->mpm_share_cnt != 0) {
+        printf("first engine shared %u ctxs: ", de_ctx1->mpm_share_cnt);
+        goto end;
+    }
+
+    de_ctx2 = DetectEngineTest11Build();
+    if (de_ctx2 == NULL)
+        goto end;
+    if (de_ctx2->mpm_share_cnt == 0) {
+        printf("no mpm ctx shared: ");
+        goto end;
+    }
+
+    /* de_ctx2 keeps the ctxs of de_ctx1 available */
+    DetectEngineCtxFree(de_ctx1);
+    de_ctx1 = NULL;
+
+    de_ctx3 = DetectEngineTest11Build();
+    if (de_ctx3 == NULL)
+        goto end;
+    if (de_ctx3->mpm_share_cnt != de_ctx2->mpm_share_cnt) {
+        printf("shared %u ctxs, expected %u: ", de_ctx3->mpm_share_cnt,
+                de_ctx2->mpm_share_cnt);
+        goto end;
+    }
+
+    DetectEngineCtxFree(de_ctx2);
+    de_ctx2 = NULL;
+    DetectEngineCtxFree(de_ctx3);
+    de_ctx3 = NULL;
+
+    /* all users are gone, so nothing is left to share */
+    de_ctx1 = DetectEngineTest11Build();
+    if (de_ctx1 == NULL)
+        goto end;
+    if (de_ctx1->mpm_share_cnt != 0) {
+        printf("shared %u ctxs of freed engines: ", de_ctx1->mpm_share_cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (de_ctx1 != NULL)
+        DetectEngineCtxFree(de_ctx1);
+    if (de_ctx2 != NULL)
+        DetectEngineCtxFree(de_ctx2);
+    if (de_ctx3 != NULL)
+        DetectEngineCtxFree(de_ctx3);
+    return result;
+}
+
+/** \test vlan to tenant lookup through the direct map and the list */
+static int DetectEngineTest12(void)
+{
+    DetectEngineTenantMapping map_array[2] = {
+        { .tenant_id = 1, .traffic_id = 10 },
+        { .tenant_id = 2, .traffic_id = 4095 },
+    };
+    DetectEngineThreadCtx det_ctx;
+    Packet p;
+    int result = 0;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&p, 0, sizeof(p));
+    det_ctx.tenant_array = map_array;
+    det_ctx.tenant_array_size = 2;
+
+    uint32_t *vlan_map = SCCalloc(DETECT_ENGINE_MT_VLAN_IDS, sizeof(uint32_t));
+    if (vlan_map == NULL)
+        return 0;
+    vlan_map[10] = 1;
+    vlan_map[4095] = 2;
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        det_ctx.tenant_vlan_map = pass ? vlan_map : NULL;
+
+        p.vlan_idx = 0;
+        if (DetectEngineTentantGetIdFromVlanId(&det_ctx, &p) != 0)
+            goto end;
+        p.vlan_idx = 1;
+        p.vlan_id[0] = 10;
+        if (DetectEngineTentantGetIdFromVlanId(&det_ctx, &p) != 1)
+            goto end;
+        p.vlan_id[0] = 4095;
+        if (DetectEngineTentantGetIdFromVlanId(&det_ctx, &p) != 2)
+            goto end;
+        p.vlan_id[0] = 11;
+        if (DetectEngineTentantGetIdFromVlanId(&det_ctx, &p) != 0)
+            goto end;
+    }
+
+    result = 1;
+end:
+    SCFree(vlan_map);
+    return result;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -3313,6 +4007,9 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest07", DetectEngineTest07);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
+    UtRegisterTest("DetectEngineTest11", DetectEngineTest11);
+    UtRegisterTest("DetectEngineTest12", DetectEngineTest12);
 #endif
 
     return;
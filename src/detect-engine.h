@@ -27,6 +27,11 @@
 #include "detect.h"
 #include "tm-threads.h"
 #include "flow-private.h"
+#include "util-hash-map.h"
+
+/** tenant id to the tenant's det_ctx, for sparse tenant ids */
+HASH_MAP_DEFINE(TenantCtxMap, uint32_t, DetectEngineThreadCtx *,
+        HashMapHashU32, HashMapCompareU32)
 
 typedef struct DetectEngineAppInspectionEngine_ {
     uint8_t ipproto;
@@ -78,6 +83,7 @@ void DetectEngineDeReference(DetectEngineCtx **de_ctx);
 int DetectEngineReload(SCInstance *suri);
 int DetectEngineEnabled(void);
 int DetectEngineMTApply(void);
+int DetectEngineReloadReputation(void);
 int DetectEngineMultiTenantEnabled(void);
 int DetectEngineMultiTenantSetup(void);
 
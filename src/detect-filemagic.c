@@ -96,11 +96,10 @@ int FilemagicGlobalLookup(File *file)
 
     const uint8_t *data = NULL;
     uint32_t data_len = 0;
-    uint64_t offset = 0;
 
-    StreamingBufferGetData(file->sb,
-                           &data, &data_len, &offset);
-    if (offset == 0) {
+    /* the head of the file is all that is needed, so don't make the
+     * whole buffer contiguous */
+    if (StreamingBufferGetBlockAtOffset(file->sb, &data, &data_len, 0)) {
         if (FileSize(file) >= FILEMAGIC_MIN_SIZE) {
             file->magic = MagicGlobalLookup(data, data_len);
         } else if (file->state >= FILE_STATE_CLOSED) {
@@ -119,7 +118,7 @@ int FilemagicGlobalLookup(File *file)
  *  \retval -1 error
  *  \retval 0 ok
  */
-int FilemagicThreadLookup(magic_t *ctx, File *file)
+int FilemagicThreadLookup(MagicThreadCtx *ctx, File *file)
 {
     if (ctx == NULL || file == NULL || FileSize(file) == 0) {
         SCReturnInt(-1);
@@ -127,15 +126,14 @@ int FilemagicThreadLookup(magic_t *ctx, File *file)
 
     const uint8_t *data = NULL;
     uint32_t data_len = 0;
-    uint64_t offset = 0;
 
-    StreamingBufferGetData(file->sb,
-                           &data, &data_len, &offset);
-    if (offset == 0) {
+    /* the head of the file is all that is needed, so don't make the
+     * whole buffer contiguous */
+    if (StreamingBufferGetBlockAtOffset(file->sb, &data, &data_len, 0)) {
         if (FileSize(file) >= FILEMAGIC_MIN_SIZE) {
-            file->magic = MagicThreadLookup(ctx, data, data_len);
+            file->magic = MagicThreadCtxLookup(ctx, data, data_len);
         } else if (file->state >= FILE_STATE_CLOSED) {
-            file->magic = MagicThreadLookup(ctx, data, data_len);
+            file->magic = MagicThreadCtxLookup(ctx, data, data_len);
         }
     }
     SCReturnInt(0);
@@ -174,7 +172,7 @@ static int DetectFilemagicMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     }
 
     if (file->magic == NULL) {
-        FilemagicThreadLookup(&tfilemagic->ctx, file);
+        FilemagicThreadLookup(tfilemagic->ctx, file);
     }
 
     if (file->magic != NULL) {
@@ -262,8 +260,6 @@ error:
 
 static void *DetectFilemagicThreadInit(void *data)
 {
-    char *filename = NULL;
-    FILE *fd = NULL;
     DetectFilemagicData *filemagic = (DetectFilemagicData *)data;
     BUG_ON(filemagic == NULL);
 
@@ -274,50 +270,20 @@ static void *DetectFilemagicThreadInit(void *data)
     }
     memset(t, 0x00, sizeof(DetectFilemagicThreadData));
 
-    t->ctx = magic_open(0);
+    t->ctx = MagicThreadCtxInit();
     if (t->ctx == NULL) {
-        SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s", magic_error(t->ctx));
-        goto error;
-    }
-
-    (void)ConfGet("magic-file", &filename);
-    if (filename != NULL) {
-        if (strlen(filename) == 0) {
-            /* set filename to NULL on *nix systems so magic_load uses system default path (see man libmagic) */
-            SCLogInfo("using system default magic-file");
-            filename = NULL;
-        }
-        else {
-            SCLogInfo("using magic-file %s", filename);
-
-            if ( (fd = fopen(filename, "r")) == NULL) {
-                SCLogWarning(SC_ERR_FOPEN, "Error opening file: \"%s\": %s", filename, strerror(errno));
-                goto error;
-            }
-            fclose(fd);
-        }
-    }
-
-    if (magic_load(t->ctx, filename) != 0) {
-        SCLogError(SC_ERR_MAGIC_LOAD, "magic_load failed: %s", magic_error(t->ctx));
-        goto error;
+        SCFree(t);
+        return NULL;
     }
 
     return (void *)t;
-
-error:
-    if (t->ctx)
-        magic_close(t->ctx);
-    SCFree(t);
-    return NULL;
 }
 
 static void DetectFilemagicThreadFree(void *ctx)
 {
     if (ctx != NULL) {
         DetectFilemagicThreadData *t = (DetectFilemagicThreadData *)ctx;
-        if (t->ctx)
-            magic_close(t->ctx);
+        MagicThreadCtxFree(t->ctx);
         SCFree(t);
     }
 }
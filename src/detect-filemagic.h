@@ -25,10 +25,10 @@
 #define __DETECT_FILEMAGIC_H__
 
 #include "util-spm-bm.h"
-#include <magic.h>
+#include "util-magic.h"
 
 typedef struct DetectFilemagicThreadData {
-    magic_t ctx;
+    MagicThreadCtx *ctx;
 } DetectFilemagicThreadData;
 
 typedef struct DetectFilemagicData {
@@ -42,5 +42,6 @@ typedef struct DetectFilemagicData {
 /* prototypes */
 void DetectFilemagicRegister (void);
 int FilemagicGlobalLookup(File *file);
+int FilemagicThreadLookup(MagicThreadCtx *ctx, File *file);
 
 #endif /* __DETECT_FILEMAGIC_H__ */
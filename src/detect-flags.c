@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-engine-prefilter.h"
 
 #include "flow-var.h"
 #include "decode-events.h"
@@ -59,6 +60,7 @@ static pcre_extra *parse_regex_study;
 static int DetectFlagsMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, const SigMatchCtx *);
 static int DetectFlagsSetup (DetectEngineCtx *, Signature *, char *);
 static void DetectFlagsFree(void *);
+static int PrefilterSetupTcpFlags(SigGroupHead *sgh);
 
 /**
  * \brief Registration function for flags: keyword
@@ -71,10 +73,53 @@ void DetectFlagsRegister (void)
     sigmatch_table[DETECT_FLAGS].Setup = DetectFlagsSetup;
     sigmatch_table[DETECT_FLAGS].Free  = DetectFlagsFree;
     sigmatch_table[DETECT_FLAGS].RegisterTests = FlagsRegisterTests;
+    sigmatch_table[DETECT_FLAGS].SetupPrefilter = PrefilterSetupTcpFlags;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int FlagsMatch(const uint8_t pflags, const uint8_t modifier,
+                             const uint8_t dflags, const uint8_t iflags)
+{
+    if (!dflags && pflags) {
+        if(modifier == MODIFIER_NOT) {
+            return 1;
+        }
+
+        return 0;
+    }
+
+    const uint8_t flags = pflags & iflags;
+
+    switch (modifier) {
+        case MODIFIER_ANY:
+            if ((flags & dflags) > 0) {
+                return 1;
+            }
+            return 0;
+
+        case MODIFIER_PLUS:
+            if (((flags & dflags) == dflags)) {
+                return 1;
+            }
+            return 0;
+
+        case MODIFIER_NOT:
+            if ((flags & dflags) != dflags) {
+                return 1;
+            }
+            return 0;
+
+        default:
+            SCLogDebug("flags %"PRIu8" and de->flags %"PRIu8"", flags, dflags);
+            if (flags == dflags) {
+                return 1;
+            }
+    }
+
+    return 0;
+}
+
 /**
  * \internal
  * \brief This function is used to match flags on a packet with those passed via flags:
@@ -101,43 +146,30 @@ static int DetectFlagsMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Pack
 
     flags = p->tcph->th_flags;
 
-    if (!de->flags && flags) {
-        if(de->modifier == MODIFIER_NOT) {
-            SCReturnInt(1);
-        }
-
-        SCReturnInt(0);
-    }
-
-    flags &= de->ignored_flags;
+    SCReturnInt(FlagsMatch(flags, de->modifier, de->flags, de->ignored_flags));
+}
 
-    switch (de->modifier) {
-        case MODIFIER_ANY:
-            if ((flags & de->flags) > 0) {
-                SCReturnInt(1);
-            }
-            SCReturnInt(0);
+/* prefilter */
 
-        case MODIFIER_PLUS:
-            if (((flags & de->flags) == de->flags)) {
-                SCReturnInt(1);
-            }
-            SCReturnInt(0);
+static void PrefilterPacketFlagsMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p)) {
+        return;
+    }
 
-        case MODIFIER_NOT:
-            if ((flags & de->flags) != de->flags) {
-                SCReturnInt(1);
-            }
-            SCReturnInt(0);
+    PrefilterPacketU8HashAddSids(det_ctx, pectx, p->tcph->th_flags);
+}
 
-        default:
-            SCLogDebug("flags %"PRIu8" and de->flags %"PRIu8"",flags,de->flags);
-            if (flags == de->flags) {
-                SCReturnInt(1);
-            }
-    }
+static int PrefilterTcpFlagsCompare(uint8_t value, const SigMatchCtx *ctx)
+{
+    const DetectFlagsData *de = (const DetectFlagsData *)ctx;
+    return FlagsMatch(value, de->modifier, de->flags, de->ignored_flags);
+}
 
-    SCReturnInt(0);
+static int PrefilterSetupTcpFlags(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_FLAGS,
+            PrefilterTcpFlagsCompare, PrefilterPacketFlagsMatch);
 }
 
 /**
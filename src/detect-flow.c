@@ -40,13 +40,20 @@
 #include "util-unittest-helper.h"
 #include "util-debug.h"
 
-/**
- * \brief Regex for parsing our flow options
- */
-#define PARSE_REGEX  "^\\s*([A-z_]+)\\s*(?:,\\s*([A-z_]+))?\\s*(?:,\\s*([A-z_]+))?\\s*$"
-
-static pcre *parse_regex;
-static pcre_extra *parse_regex_study;
+/** max number of options of a flow keyword */
+#define DETECT_FLOW_MAX_OPTIONS 3
+
+static const DetectParseFlag flow_options[] = {
+    { "established", DETECT_FLOW_FLAG_ESTABLISHED },
+    { "stateless", DETECT_FLOW_FLAG_STATELESS },
+    { "to_client", DETECT_FLOW_FLAG_TOCLIENT },
+    { "from_server", DETECT_FLOW_FLAG_TOCLIENT },
+    { "to_server", DETECT_FLOW_FLAG_TOSERVER },
+    { "from_client", DETECT_FLOW_FLAG_TOSERVER },
+    { "only_stream", DETECT_FLOW_FLAG_ONLYSTREAM },
+    { "no_stream", DETECT_FLOW_FLAG_NOSTREAM },
+    { NULL, 0 },
+};
 
 int DetectFlowMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, const SigMatchCtx *);
 static int DetectFlowSetup (DetectEngineCtx *, Signature *, char *);
@@ -65,8 +72,6 @@ void DetectFlowRegister (void)
     sigmatch_table[DETECT_FLOW].Setup = DetectFlowSetup;
     sigmatch_table[DETECT_FLOW].Free  = DetectFlowFree;
     sigmatch_table[DETECT_FLOW].RegisterTests = DetectFlowRegisterTests;
-
-    DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
 /*
@@ -131,6 +136,27 @@ int DetectFlowMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, S
     SCReturnInt(ret);
 }
 
+/** \internal
+ *  \brief the flag that can't be combined with flag */
+static uint32_t DetectFlowConflictingFlag(uint32_t flag)
+{
+    switch (flag) {
+        case DETECT_FLOW_FLAG_ESTABLISHED:
+            return DETECT_FLOW_FLAG_STATELESS;
+        case DETECT_FLOW_FLAG_STATELESS:
+            return DETECT_FLOW_FLAG_ESTABLISHED;
+        case DETECT_FLOW_FLAG_TOCLIENT:
+            return DETECT_FLOW_FLAG_TOSERVER;
+        case DETECT_FLOW_FLAG_TOSERVER:
+            return DETECT_FLOW_FLAG_TOCLIENT;
+        case DETECT_FLOW_FLAG_ONLYSTREAM:
+            return DETECT_FLOW_FLAG_NOSTREAM;
+        case DETECT_FLOW_FLAG_NOSTREAM:
+            return DETECT_FLOW_FLAG_ONLYSTREAM;
+    }
+    return 0;
+}
+
 /**
  * \brief This function is used to parse flow options passed via flow: keyword
  *
@@ -142,43 +168,8 @@ int DetectFlowMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, S
 DetectFlowData *DetectFlowParse (char *flowstr)
 {
     DetectFlowData *fd = NULL;
-    char *args[3] = {NULL,NULL,NULL};
-#define MAX_SUBSTRINGS 30
-    int ret = 0, res = 0;
-    int ov[MAX_SUBSTRINGS];
-    char str1[16] = "", str2[16] = "", str3[16] = "";
-
-    ret = pcre_exec(parse_regex, parse_regex_study, flowstr, strlen(flowstr), 0, 0, ov, MAX_SUBSTRINGS);
-    if (ret < 1 || ret > 4) {
-        SCLogError(SC_ERR_PCRE_MATCH, "parse error, ret %" PRId32 ", string %s", ret, flowstr);
-        goto error;
-    }
-
-    if (ret > 1) {
-        res = pcre_copy_substring((char *)flowstr, ov, MAX_SUBSTRINGS, 1, str1, sizeof(str1));
-        if (res < 0) {
-            SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_copy_substring failed");
-            goto error;
-        }
-        args[0] = (char *)str1;
-
-        if (ret > 2) {
-            res = pcre_copy_substring((char *)flowstr, ov, MAX_SUBSTRINGS, 2, str2, sizeof(str2));
-            if (res < 0) {
-                SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_copy_substring failed");
-                goto error;
-            }
-            args[1] = (char *)str2;
-        }
-        if (ret > 3) {
-            res = pcre_copy_substring((char *)flowstr, ov, MAX_SUBSTRINGS, 3, str3, sizeof(str3));
-            if (res < 0) {
-                SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_copy_substring failed");
-                goto error;
-            }
-            args[2] = (char *)str3;
-        }
-    }
+    DetectParseLexer lex;
+    DetectParseToken tok;
 
     fd = SCMalloc(sizeof(DetectFlowData));
     if (unlikely(fd == NULL))
@@ -186,72 +177,36 @@ DetectFlowData *DetectFlowParse (char *flowstr)
     fd->flags = 0;
     fd->match_cnt = 0;
 
-    int i;
-    for (i = 0; i < (ret - 1); i++) {
-        if (args[i]) {
-            /* inspect our options and set the flags */
-            if (strcasecmp(args[i], "established") == 0) {
-                if (fd->flags & DETECT_FLOW_FLAG_ESTABLISHED) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "DETECT_FLOW_FLAG_ESTABLISHED flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_STATELESS) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "DETECT_FLOW_FLAG_STATELESS already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_ESTABLISHED;
-            } else if (strcasecmp(args[i], "stateless") == 0) {
-                if (fd->flags & DETECT_FLOW_FLAG_STATELESS) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "DETECT_FLOW_FLAG_STATELESS flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_ESTABLISHED) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set DETECT_FLOW_FLAG_STATELESS, DETECT_FLOW_FLAG_ESTABLISHED already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_STATELESS;
-            } else if (strcasecmp(args[i], "to_client") == 0 || strcasecmp(args[i], "from_server") == 0) {
-                if (fd->flags & DETECT_FLOW_FLAG_TOCLIENT) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set DETECT_FLOW_FLAG_TOCLIENT flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_TOSERVER) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set to_client, DETECT_FLOW_FLAG_TOSERVER already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_TOCLIENT;
-            } else if (strcasecmp(args[i], "to_server") == 0 || strcasecmp(args[i], "from_client") == 0){
-                if (fd->flags & DETECT_FLOW_FLAG_TOSERVER) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set DETECT_FLOW_FLAG_TOSERVER flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_TOCLIENT) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set to_server, DETECT_FLOW_FLAG_TO_CLIENT flag already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_TOSERVER;
-            } else if (strcasecmp(args[i], "only_stream") == 0) {
-                if (fd->flags & DETECT_FLOW_FLAG_ONLYSTREAM) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set only_stream flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_NOSTREAM) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set only_stream flag, DETECT_FLOW_FLAG_NOSTREAM already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_ONLYSTREAM;
-            } else if (strcasecmp(args[i], "no_stream") == 0) {
-                if (fd->flags & DETECT_FLOW_FLAG_NOSTREAM) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set no_stream flag is already set");
-                    goto error;
-                } else if (fd->flags & DETECT_FLOW_FLAG_ONLYSTREAM) {
-                    SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set no_stream flag, DETECT_FLOW_FLAG_ONLYSTREAM already set");
-                    goto error;
-                }
-                fd->flags |= DETECT_FLOW_FLAG_NOSTREAM;
-            } else {
-                SCLogError(SC_ERR_INVALID_VALUE, "invalid flow option \"%s\"", args[i]);
-                goto error;
-            }
-
-            fd->match_cnt++;
-            //printf("args[%" PRId32 "]: %s match_cnt: %" PRId32 " flags: 0x%02X\n", i, args[i], fd->match_cnt, fd->flags);
+    DetectParseLexerInit(&lex, flowstr, ',');
+    while (DetectParseLexerNext(&lex, &tok)) {
+        uint32_t flag = 0;
+
+        if (fd->match_cnt == DETECT_FLOW_MAX_OPTIONS) {
+            SCLogError(SC_ERR_INVALID_VALUE, "too many flow options in \"%s\"", flowstr);
+            goto error;
+        }
+        /* inspect our options and set the flags */
+        if (DetectParseTokenFlag(&tok, flow_options, &flag) != 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "invalid flow option \"%.*s\"",
+                    (int)tok.len, tok.str);
+            goto error;
         }
+        if (fd->flags & flag) {
+            SCLogError(SC_ERR_FLAGS_MODIFIER, "flow option \"%.*s\" is already set",
+                    (int)tok.len, tok.str);
+            goto error;
+        } else if (fd->flags & DetectFlowConflictingFlag(flag)) {
+            SCLogError(SC_ERR_FLAGS_MODIFIER, "cannot set flow option \"%.*s\", "
+                    "it conflicts with an earlier option", (int)tok.len, tok.str);
+            goto error;
+        }
+
+        fd->flags |= flag;
+        fd->match_cnt++;
+    }
+    if (fd->match_cnt == 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "no flow options in \"%s\"", flowstr);
+        goto error;
     }
     return fd;
 
@@ -45,10 +45,6 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 
-#define PARSE_REGEX         "([a-z]+)(?:,\\s*([^\\s]*))?"
-static pcre *parse_regex;
-static pcre_extra *parse_regex_study;
-
 int DetectFlowbitMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, const SigMatchCtx *);
 static int DetectFlowbitSetup (DetectEngineCtx *, Signature *, char *);
 void DetectFlowbitFree (void *);
@@ -65,8 +61,6 @@ void DetectFlowbitsRegister (void)
     sigmatch_table[DETECT_FLOWBITS].RegisterTests = FlowBitsRegisterTests;
     /* this is compatible to ip-only signatures */
     sigmatch_table[DETECT_FLOWBITS].flags |= SIGMATCH_IPONLY_COMPAT;
-
-    DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
 
@@ -157,34 +151,33 @@ int DetectFlowbitMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p
 static int DetectFlowbitParse(char *str, char *cmd, int cmd_len, char *name,
     int name_len)
 {
-    const int max_substrings = 30;
-    int count, rc;
-    int ov[max_substrings];
-
-    count = pcre_exec(parse_regex, parse_regex_study, str, strlen(str), 0, 0,
-        ov, max_substrings);
-    if (count != 2 && count != 3) {
-        SCLogError(SC_ERR_PCRE_MATCH,
-            "\"%s\" is not a valid setting for flowbits.", str);
-        return 0;
-    }
+    DetectParseLexer lex;
+    DetectParseToken tok;
+    uint32_t i;
 
-    rc = pcre_copy_substring((char *)str, ov, max_substrings, 1, cmd, cmd_len);
-    if (rc < 0) {
-        SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_copy_substring failed");
-        return 0;
-    }
+    DetectParseLexerInit(&lex, str, ',');
+    if (!DetectParseLexerNext(&lex, &tok) || tok.len == 0 ||
+        DetectParseTokenCopy(&tok, cmd, cmd_len) != 0)
+        goto error;
 
-    if (count == 3) {
-        rc = pcre_copy_substring((char *)str, ov, max_substrings, 2, name,
-            name_len);
-        if (rc < 0) {
-            SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_copy_substring failed");
-            return 0;
+    /* the name is everything after the first comma */
+    if (DetectParseLexerRest(&lex, &tok)) {
+        if (tok.len == 0)
+            goto error;
+        for (i = 0; i < tok.len; i++) {
+            if (isspace((unsigned char)tok.str[i]))
+                goto error;
         }
+        if (DetectParseTokenCopy(&tok, name, name_len) != 0)
+            goto error;
     }
 
     return 1;
+
+error:
+    SCLogError(SC_ERR_INVALID_VALUE,
+        "\"%s\" is not a valid setting for flowbits.", str);
+    return 0;
 }
 
 int DetectFlowbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
@@ -238,6 +231,7 @@ int DetectFlowbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
         goto error;
 
     cd->idx = VariableNameGetIdx(de_ctx, fb_name, VAR_TYPE_FLOW_BIT);
+    FlowBitRegisterIdx(cd->idx);
     cd->cmd = fb_cmd;
 
     SCLogDebug("idx %" PRIu32 ", cmd %s, name %s",
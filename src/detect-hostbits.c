@@ -46,6 +46,7 @@
 #include "util-var-name.h"
 #include "util-unittest.h"
 #include "util-debug.h"
+#include "util-state-sync.h"
 
 /*
     hostbits:isset,bitname;
@@ -85,6 +86,19 @@ void DetectHostbitsRegister (void)
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+/** \internal
+ *  \brief replicate a bit change to the other sensors. Host is locked. */
+static void DetectHostbitSync(Host *h, const DetectXbitsData *fd, uint32_t ts)
+{
+    if (likely(!(state_sync_flags & STATE_SYNC_HOSTBITS)) || fd->name == NULL)
+        return;
+
+    /* a toggle is sent as the state it resulted in */
+    int set = (fd->cmd == DETECT_XBITS_CMD_UNSET) ? 0 :
+        HostBitIsset(h, fd->idx, ts);
+    StateSyncHostBit(&h->a, fd->name, set, fd->expire);
+}
+
 static int DetectHostbitMatchToggle (Packet *p, const DetectXbitsData *fd)
 {
     switch (fd->tracker) {
@@ -98,6 +112,7 @@ static int DetectHostbitMatchToggle (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_src);
 
             HostBitToggle(p->host_src,fd->idx,p->ts.tv_sec + fd->expire);
+            DetectHostbitSync(p->host_src, fd, p->ts.tv_sec);
             HostUnlock(p->host_src);
             break;
         case DETECT_XBITS_TRACK_IPDST:
@@ -110,6 +125,7 @@ static int DetectHostbitMatchToggle (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_dst);
 
             HostBitToggle(p->host_dst,fd->idx,p->ts.tv_sec + fd->expire);
+            DetectHostbitSync(p->host_dst, fd, p->ts.tv_sec);
             HostUnlock(p->host_dst);
             break;
     }
@@ -129,6 +145,7 @@ static int DetectHostbitMatchUnset (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_src);
 
             HostBitUnset(p->host_src,fd->idx);
+            DetectHostbitSync(p->host_src, fd, p->ts.tv_sec);
             HostUnlock(p->host_src);
             break;
         case DETECT_XBITS_TRACK_IPDST:
@@ -140,6 +157,7 @@ static int DetectHostbitMatchUnset (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_dst);
 
             HostBitUnset(p->host_dst,fd->idx);
+            DetectHostbitSync(p->host_dst, fd, p->ts.tv_sec);
             HostUnlock(p->host_dst);
             break;
     }
@@ -158,6 +176,7 @@ static int DetectHostbitMatchSet (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_src);
 
             HostBitSet(p->host_src,fd->idx,p->ts.tv_sec + fd->expire);
+            DetectHostbitSync(p->host_src, fd, p->ts.tv_sec);
             HostUnlock(p->host_src);
             break;
         case DETECT_XBITS_TRACK_IPDST:
@@ -169,6 +188,7 @@ static int DetectHostbitMatchSet (Packet *p, const DetectXbitsData *fd)
                 HostLock(p->host_dst);
 
             HostBitSet(p->host_dst,fd->idx, p->ts.tv_sec + fd->expire);
+            DetectHostbitSync(p->host_dst, fd, p->ts.tv_sec);
             HostUnlock(p->host_dst);
             break;
     }
@@ -385,6 +405,12 @@ int DetectHostbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
     cd->tracker = hb_dir;
     cd->type = VAR_TYPE_HOST_BIT;
     cd->expire = 300;
+    cd->name = NULL;
+    if (fb_cmd != DETECT_XBITS_CMD_ISSET && fb_cmd != DETECT_XBITS_CMD_ISNOTSET) {
+        cd->name = SCStrdup(fb_name);
+        if (unlikely(cd->name == NULL))
+            goto error;
+    }
 
     SCLogDebug("idx %" PRIu32 ", cmd %s, name %s",
         cd->idx, fb_cmd_str, strlen(fb_name) ? fb_name : "(none)");
@@ -419,7 +445,7 @@ int DetectHostbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
 
 error:
     if (cd != NULL)
-        SCFree(cd);
+        DetectHostbitFree(cd);
     if (sm != NULL)
         SCFree(sm);
     return -1;
@@ -432,6 +458,8 @@ void DetectHostbitFree (void *ptr)
     if (fd == NULL)
         return;
 
+    if (fd->name != NULL)
+        SCFree(fd->name);
     SCFree(fd);
 }
 
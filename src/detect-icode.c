@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-icode.h"
 
@@ -49,6 +50,7 @@ int DetectICodeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectICodeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectICodeRegisterTests(void);
 void DetectICodeFree(void *);
+static int PrefilterSetupICode(SigGroupHead *sgh);
 
 
 /**
@@ -63,10 +65,27 @@ void DetectICodeRegister (void)
     sigmatch_table[DETECT_ICODE].Setup = DetectICodeSetup;
     sigmatch_table[DETECT_ICODE].Free = DetectICodeFree;
     sigmatch_table[DETECT_ICODE].RegisterTests = DetectICodeRegisterTests;
+    sigmatch_table[DETECT_ICODE].SetupPrefilter = PrefilterSetupICode;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int ICodeMatch(const uint8_t picode, const uint8_t mode,
+                             const uint8_t dcode1, const uint8_t dcode2)
+{
+    switch (mode) {
+        case DETECT_ICODE_EQ:
+            return picode == dcode1;
+        case DETECT_ICODE_LT:
+            return picode < dcode1;
+        case DETECT_ICODE_GT:
+            return picode > dcode1;
+        case DETECT_ICODE_RN:
+            return (picode >= dcode1 && picode <= dcode2);
+    }
+    return 0;
+}
+
 /**
  * \brief This function is used to match icode rule option set on a packet with those passed via icode:
  *
@@ -80,7 +99,6 @@ void DetectICodeRegister (void)
  */
 int DetectICodeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
 {
-    int ret = 0;
     uint8_t picode;
     const DetectICodeData *icd = (const DetectICodeData *)ctx;
 
@@ -93,25 +111,42 @@ int DetectICodeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         picode = ICMPV6_GET_CODE(p);
     } else {
         /* Packet not ICMPv4 nor ICMPv6 */
-        return ret;
+        return 0;
     }
 
-    switch(icd->mode) {
-        case DETECT_ICODE_EQ:
-            ret = (picode == icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_LT:
-            ret = (picode < icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_GT:
-            ret = (picode > icd->code1) ? 1 : 0;
-            break;
-        case DETECT_ICODE_RN:
-            ret = (picode >= icd->code1 && picode <= icd->code2) ? 1 : 0;
-            break;
+    return ICodeMatch(picode, icd->mode, icd->code1, icd->code2);
+}
+
+/* prefilter */
+
+static void PrefilterPacketICodeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    uint8_t picode;
+
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_ICMPV4(p)) {
+        picode = ICMPV4_GET_CODE(p);
+    } else if (PKT_IS_ICMPV6(p)) {
+        picode = ICMPV6_GET_CODE(p);
+    } else {
+        return;
     }
 
-    return ret;
+    PrefilterPacketU8HashAddSids(det_ctx, pectx, picode);
+}
+
+static int PrefilterICodeCompare(uint8_t value, const SigMatchCtx *ctx)
+{
+    const DetectICodeData *icd = (const DetectICodeData *)ctx;
+    return ICodeMatch(value, icd->mode, icd->code1, icd->code2);
+}
+
+static int PrefilterSetupICode(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_ICODE,
+            PrefilterICodeCompare, PrefilterPacketICodeMatch);
 }
 
 /**
@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-itype.h"
 
@@ -49,6 +50,7 @@ int DetectITypeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectITypeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectITypeRegisterTests(void);
 void DetectITypeFree(void *);
+static int PrefilterSetupIType(SigGroupHead *sgh);
 
 
 /**
@@ -63,10 +65,27 @@ void DetectITypeRegister (void)
     sigmatch_table[DETECT_ITYPE].Setup = DetectITypeSetup;
     sigmatch_table[DETECT_ITYPE].Free = DetectITypeFree;
     sigmatch_table[DETECT_ITYPE].RegisterTests = DetectITypeRegisterTests;
+    sigmatch_table[DETECT_ITYPE].SetupPrefilter = PrefilterSetupIType;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int ITypeMatch(const uint8_t pitype, const uint8_t mode,
+                             const uint8_t dtype1, const uint8_t dtype2)
+{
+    switch (mode) {
+        case DETECT_ITYPE_EQ:
+            return pitype == dtype1;
+        case DETECT_ITYPE_LT:
+            return pitype < dtype1;
+        case DETECT_ITYPE_GT:
+            return pitype > dtype1;
+        case DETECT_ITYPE_RN:
+            return (pitype > dtype1 && pitype < dtype2);
+    }
+    return 0;
+}
+
 /**
  * \brief This function is used to match itype rule option set on a packet with those passed via itype:
  *
@@ -80,7 +99,6 @@ void DetectITypeRegister (void)
  */
 int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
 {
-    int ret = 0;
     uint8_t pitype;
     const DetectITypeData *itd = (const DetectITypeData *)ctx;
 
@@ -93,25 +111,42 @@ int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         pitype = ICMPV6_GET_TYPE(p);
     } else {
         /* Packet not ICMPv4 nor ICMPv6 */
-        return ret;
+        return 0;
     }
 
-    switch(itd->mode) {
-        case DETECT_ITYPE_EQ:
-            ret = (pitype == itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_LT:
-            ret = (pitype < itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_GT:
-            ret = (pitype > itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_RN:
-            ret = (pitype > itd->type1 && pitype < itd->type2) ? 1 : 0;
-            break;
+    return ITypeMatch(pitype, itd->mode, itd->type1, itd->type2);
+}
+
+/* prefilter */
+
+static void PrefilterPacketITypeMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    uint8_t pitype;
+
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_ICMPV4(p)) {
+        pitype = ICMPV4_GET_TYPE(p);
+    } else if (PKT_IS_ICMPV6(p)) {
+        pitype = ICMPV6_GET_TYPE(p);
+    } else {
+        return;
     }
 
-    return ret;
+    PrefilterPacketU8HashAddSids(det_ctx, pectx, pitype);
+}
+
+static int PrefilterITypeCompare(uint8_t value, const SigMatchCtx *ctx)
+{
+    const DetectITypeData *itd = (const DetectITypeData *)ctx;
+    return ITypeMatch(value, itd->mode, itd->type1, itd->type2);
+}
+
+static int PrefilterSetupIType(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_ITYPE,
+            PrefilterITypeCompare, PrefilterPacketITypeMatch);
 }
 
 /**
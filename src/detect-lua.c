@@ -31,6 +31,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-content.h"
 
 #include "detect-engine.h"
 #include "detect-engine-mpm.h"
@@ -291,7 +292,7 @@ void LuaDumpStack(lua_State *state)
     }
 }
 
-int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch *sm,
+int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, const SigMatchData *smd,
         uint8_t *buffer, uint32_t buffer_len, uint32_t offset,
         Flow *f)
 {
@@ -301,7 +302,7 @@ int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch
     if (buffer == NULL || buffer_len == 0)
         SCReturnInt(0);
 
-    DetectLuaData *luajit = (DetectLuaData *)sm->ctx;
+    DetectLuaData *luajit = (DetectLuaData *)smd->ctx;
     if (luajit == NULL)
         SCReturnInt(0);
 
@@ -326,13 +327,14 @@ int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch
     lua_settable(tluajit->luastate, -3);
 
     lua_pushstring (tluajit->luastate, luajit->buffername); /* stack at -2 */
-    LuaPushStringBuffer(tluajit->luastate, (const uint8_t *)buffer, (size_t)buffer_len);
+    LuaPushBuffer(tluajit->luastate, (const uint8_t *)buffer, (size_t)buffer_len);
     lua_settable(tluajit->luastate, -3);
 
     int retval = lua_pcall(tluajit->luastate, 1, 1, 0);
     if (retval != 0) {
         SCLogInfo("failed to run script: %s", lua_tostring(tluajit->luastate, -1));
     }
+    LuaBufferViewsInvalidate(tluajit->luastate);
 
     /* process returns from script */
     if (lua_gettop(tluajit->luastate) > 0) {
@@ -449,12 +451,12 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
 
     if ((tluajit->flags & DATATYPE_PAYLOAD) && p->payload_len) {
         lua_pushliteral(tluajit->luastate, "payload"); /* stack at -2 */
-        LuaPushStringBuffer (tluajit->luastate, (const uint8_t *)p->payload, (size_t)p->payload_len); /* stack at -3 */
+        LuaPushBuffer(tluajit->luastate, (const uint8_t *)p->payload, (size_t)p->payload_len); /* stack at -3 */
         lua_settable(tluajit->luastate, -3);
     }
     if ((tluajit->flags & DATATYPE_PACKET) && GET_PKT_LEN(p)) {
         lua_pushliteral(tluajit->luastate, "packet"); /* stack at -2 */
-        LuaPushStringBuffer (tluajit->luastate, (const uint8_t *)GET_PKT_DATA(p), (size_t)GET_PKT_LEN(p)); /* stack at -3 */
+        LuaPushBuffer(tluajit->luastate, (const uint8_t *)GET_PKT_DATA(p), (size_t)GET_PKT_LEN(p)); /* stack at -3 */
         lua_settable(tluajit->luastate, -3);
     }
     if (tluajit->alproto == ALPROTO_HTTP) {
@@ -472,7 +474,7 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
                 if ((tluajit->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
                     lua_pushliteral(tluajit->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tluajit->luastate,
+                    LuaPushBuffer(tluajit->luastate,
                                      (const uint8_t *)bstr_ptr(tx->request_line),
                                      bstr_len(tx->request_line));
                     lua_settable(tluajit->luastate, -3);
@@ -485,6 +487,7 @@ static int DetectLuaMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx,
     if (retval != 0) {
         SCLogInfo("failed to run script: %s", lua_tostring(tluajit->luastate, -1));
     }
+    LuaBufferViewsInvalidate(tluajit->luastate);
 
     /* process returns from script */
     if (lua_gettop(tluajit->luastate) > 0) {
@@ -575,7 +578,7 @@ static int DetectLuaAppMatchCommon (ThreadVars *t, DetectEngineThreadCtx *det_ct
                 if ((tluajit->flags & DATATYPE_HTTP_REQUEST_LINE) && tx->request_line != NULL &&
                     bstr_len(tx->request_line) > 0) {
                     lua_pushliteral(tluajit->luastate, "http.request_line"); /* stack at -2 */
-                    LuaPushStringBuffer(tluajit->luastate,
+                    LuaPushBuffer(tluajit->luastate,
                                      (const uint8_t *)bstr_ptr(tx->request_line),
                                      bstr_len(tx->request_line));
                     lua_settable(tluajit->luastate, -3);
@@ -588,6 +591,7 @@ static int DetectLuaAppMatchCommon (ThreadVars *t, DetectEngineThreadCtx *det_ct
     if (retval != 0) {
         SCLogInfo("failed to run script: %s", lua_tostring(tluajit->luastate, -1));
     }
+    LuaBufferViewsInvalidate(tluajit->luastate);
 
     /* process returns from script */
     if (lua_gettop(tluajit->luastate) > 0) {
@@ -708,6 +712,7 @@ static void *DetectLuaThreadInit(void *data)
     luaL_openlibs(t->luastate);
 
     LuaRegisterExtensions(t->luastate);
+    LuaRegisterBufferViews(t->luastate, luajit->buffer_views);
 
     lua_pushinteger(t->luastate, (lua_Integer)(luajit->sid));
     lua_setglobal(t->luastate, "SCRuleSid");
@@ -1033,6 +1038,10 @@ static int DetectLuaSetupPrime(DetectEngineCtx *de_ctx, DetectLuaData *ld)
 
             ld->flags |= DATATYPE_SMTP;
 
+        } else if (strcmp(k, "buffer.view") == 0 && strcmp(v, "true") == 0) {
+            ld->buffer_views = 1;
+        } else if (strcmp(k, "prefilter") == 0 && strcmp(v, "true") == 0) {
+            ld->prefilter = 1;
         } else {
             SCLogError(SC_ERR_LUA_ERROR, "unsupported data type %s", k);
             goto error;
@@ -1072,12 +1081,6 @@ static int DetectLuaSetup (DetectEngineCtx *de_ctx, Signature *s, char *str)
         goto error;
     }
 
-    luajit->thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "luajit",
-            DetectLuaThreadInit, (void *)luajit,
-            DetectLuaThreadFree, 0);
-    if (luajit->thread_ctx_id == -1)
-        goto error;
-
     if (luajit->alproto != ALPROTO_UNKNOWN) {
         if (s->alproto != ALPROTO_UNKNOWN && luajit->alproto != s->alproto) {
             goto error;
@@ -1151,10 +1154,36 @@ error:
     return -1;
 }
 
+/** \internal \brief check if the rule has a content that can be its
+ *         fast pattern */
+static int DetectLuaSigHasPrefilter(const Signature *s)
+{
+    int i;
+    const SigMatch *sm;
+
+    for (i = 0; i < DETECT_SM_LIST_MAX; i++) {
+        for (sm = s->sm_lists[i]; sm != NULL; sm = sm->next) {
+            if (sm->type != DETECT_CONTENT)
+                continue;
+            const DetectContentData *cd = (const DetectContentData *)sm->ctx;
+            if (!(cd->flags & DETECT_CONTENT_NEGATED))
+                return 1;
+        }
+    }
+    return 0;
+}
+
 /** \brief post-sig parse function to set the sid,rev,gid into the
  *         ctx, as this isn't available yet during parsing.
+ *
+ *  Scripts with needs["prefilter"] only run once the rule's fast pattern
+ *  matched, so the rule needs a content for it. The thread ctx is
+ *  registered last, so a rule failing here doesn't leave it behind.
+ *
+ *  \retval 0 ok
+ *  \retval -1 a script needs a prefilter the rule doesn't have, or error
  */
-void DetectLuaPostSetup(Signature *s)
+int DetectLuaPostSetup(DetectEngineCtx *de_ctx, Signature *s)
 {
     int i;
     SigMatch *sm;
@@ -1168,8 +1197,21 @@ void DetectLuaPostSetup(Signature *s)
             ld->sid = s->id;
             ld->rev = s->rev;
             ld->gid = s->gid;
+
+            if (ld->prefilter && !DetectLuaSigHasPrefilter(s)) {
+                SCLogError(SC_ERR_INVALID_SIGNATURE, "lua script %s needs a "
+                        "prefilter, but the rule has no content for a fast "
+                        "pattern", ld->filename);
+                return -1;
+            }
+
+            ld->thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "luajit",
+                    DetectLuaThreadInit, (void *)ld, DetectLuaThreadFree, 0);
+            if (ld->thread_ctx_id == -1)
+                return -1;
         }
     }
+    return 0;
 }
 
 /**
@@ -2084,6 +2126,98 @@ end:
     return result;
 }
 
+/** \test payload as a buffer view, stale views and the prefilter need */
+static int LuaMatchTest07(void)
+{
+    const char script[] =
+        "function init (args)\n"
+        "   local needs = {}\n"
+        "   needs[\"payload\"] = tostring(true)\n"
+        "   needs[\"buffer.view\"] = tostring(true)\n"
+        "   needs[\"prefilter\"] = tostring(true)\n"
+        "   return needs\n"
+        "end\n"
+        "\n"
+        "function match(args)\n"
+        "   local b = args[\"payload\"]\n"
+        "   if type(b) ~= \"userdata\" then return 0 end\n"
+        "   if old ~= nil and pcall(function() return old:len() end) then\n"
+        "       return 0\n"
+        "   end\n"
+        "   old = b\n"
+        "   local s, e = b:find(\"openinfosecfoundation\")\n"
+        "   if s == nil then return 0 end\n"
+        "   if b:sub(s, e) ~= \"openinfosecfoundation\" then return 0 end\n"
+        "   if #b ~= b:len() or b:byte(1) ~= 80 then return 0 end\n"
+        "   return 1\n"
+        "end\n"
+        "return 0\n";
+    char sig[] = "alert tcp any any -> any any (flow:to_server; content:\"POST\"; "
+        "luajit:unittest; sid:1;)";
+    uint8_t httpbuf1[] =
+        "POST / HTTP/1.1\r\n"
+        "Host: www.emergingthreats.net\r\n\r\n";
+    uint8_t httpbuf2[] =
+        "POST / HTTP/1.1\r\n"
+        "Host: www.openinfosecfoundation.org\r\n\r\n";
+    TcpSession ssn;
+    Flow f;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx;
+
+    ut_script = script;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    Packet *p1 = UTHBuildPacket(httpbuf1, sizeof(httpbuf1) - 1, IPPROTO_TCP);
+    Packet *p2 = UTHBuildPacket(httpbuf2, sizeof(httpbuf2) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p1);
+    FAIL_IF_NULL(p2);
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+
+    p1->flow = &f;
+    p1->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p1->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+    p2->flow = &f;
+    p2->flowflags |= FLOW_PKT_TOSERVER|FLOW_PKT_ESTABLISHED;
+    p2->flags |= PKT_HAS_FLOW|PKT_STREAM_EST;
+
+    StreamTcpInitConfig(TRUE);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    /* no content for a fast pattern */
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+                "(flow:to_server; luajit:unittest; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sig));
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p1);
+    FAIL_IF(PacketAlertCheck(p1, 1));
+
+    /* the script gets a new view and can't use the one it kept */
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 1));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    PASS;
+}
+
 #endif
 
 void DetectLuaRegisterTests(void)
@@ -2095,6 +2229,7 @@ void DetectLuaRegisterTests(void)
     UtRegisterTest("LuaMatchTest04", LuaMatchTest04);
     UtRegisterTest("LuaMatchTest05", LuaMatchTest05);
     UtRegisterTest("LuaMatchTest06", LuaMatchTest06);
+    UtRegisterTest("LuaMatchTest07", LuaMatchTest07);
 #endif
 }
 
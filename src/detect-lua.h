@@ -46,6 +46,8 @@ typedef struct DetectLuaData {
     uint32_t flags;
     AppProto alproto;
     char *buffername; /* buffer name in case of a single buffer */
+    int buffer_views; /* pass buffers as views, not copies */
+    int prefilter;    /* rule must have a fast pattern to run the script */
     uint16_t flowint[DETECT_LUAJIT_MAX_FLOWINTS];
     uint16_t flowints;
     uint16_t flowvar[DETECT_LUAJIT_MAX_FLOWVARS];
@@ -59,7 +61,7 @@ typedef struct DetectLuaData {
 
 /* prototypes */
 void DetectLuaRegister (void);
-int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch *sm,
+int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, const SigMatchData *smd,
         uint8_t *buffer, uint32_t buffer_len, uint32_t offset,
         Flow *f);
 
@@ -67,6 +69,6 @@ int DetectLuaMatchBuffer(DetectEngineThreadCtx *det_ctx, Signature *s, SigMatch
 int DetectLuajitSetupStatesPool(int num, int reloads);
 #endif /* HAVE_LUAJIT */
 
-void DetectLuaPostSetup(Signature *s);
+int DetectLuaPostSetup(DetectEngineCtx *de_ctx, Signature *s);
 
 #endif /* __DETECT_FILELUAJIT_H__ */
@@ -64,10 +64,12 @@
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
 #include "util-debug.h"
+#include "util-byte.h"
 #include "string.h"
 #include "detect-parse.h"
 #include "detect-engine-iponly.h"
 #include "app-layer-detect-proto.h"
+#include "app-layer-dcerpc-common.h"
 
 extern int sc_set_caps;
 
@@ -633,6 +635,76 @@ error:
     return -1;
 }
 
+/**
+ *  \brief call Callback with the value of each 'keyword' option of a rule
+ *
+ *  Only splits the rule the way SigInit does, no keyword is set up and
+ *  de_ctx is not touched. Used for work that can be done ahead of the
+ *  serial rule parsing. Stops quietly on anything SigInit would reject.
+ *
+ *  \retval number of values passed to Callback
+ */
+int SigParseOptionValues(const char *sigstr, const char *keyword,
+        void (*Callback)(const char *value, void *data), void *data)
+{
+    int ov[MAX_SUBSTRINGS];
+    char optname[64];
+    int cnt = 0;
+
+    char *optstr = SCMalloc(DETECT_MAX_RULE_SIZE);
+    char *rest = SCMalloc(DETECT_MAX_RULE_SIZE);
+    char *optvalue = SCMalloc(DETECT_MAX_RULE_SIZE);
+    if (optstr == NULL || rest == NULL || optvalue == NULL)
+        goto end;
+
+    int ret = pcre_exec(config_pcre, config_pcre_extra, sigstr, strlen(sigstr),
+            0, 0, ov, MAX_SUBSTRINGS);
+    if (ret != 9 || pcre_copy_substring(sigstr, ov, MAX_SUBSTRINGS, 8,
+                optstr, DETECT_MAX_RULE_SIZE) < 0)
+        goto end;
+
+    while (strlen(optstr) > 0) {
+        ret = pcre_exec(option_pcre, option_pcre_extra, optstr, strlen(optstr),
+                0, 0, ov, MAX_SUBSTRINGS);
+        if (ret != 2 && ret != 3 && ret != 4)
+            break;
+        if (pcre_copy_substring(optstr, ov, MAX_SUBSTRINGS, 1, optname,
+                    sizeof(optname)) < 0)
+            break;
+        SigTableElmt *st = SigTableGet(optname);
+        if (st == NULL)
+            break;
+
+        optvalue[0] = '\0';
+        if ((ret == 3 && !(st->flags & SIGMATCH_NOOPT)) || ret == 4) {
+            if (pcre_copy_substring(optstr, ov, MAX_SUBSTRINGS, 2, optvalue,
+                        DETECT_MAX_RULE_SIZE) < 0)
+                break;
+        }
+        if (strlen(optvalue) > 0 && strcmp(st->name, keyword) == 0) {
+            Callback(optvalue, data);
+            cnt++;
+        }
+
+        /* like SigParseOptions, only ret 4 means more options follow */
+        if (ret != 4 || pcre_copy_substring(optstr, ov, MAX_SUBSTRINGS, 3,
+                    rest, DETECT_MAX_RULE_SIZE) < 0)
+            break;
+        char *swap = optstr;
+        optstr = rest;
+        rest = swap;
+    }
+
+end:
+    if (optstr != NULL)
+        SCFree(optstr);
+    if (rest != NULL)
+        SCFree(rest);
+    if (optvalue != NULL)
+        SCFree(optvalue);
+    return cnt;
+}
+
 /** \brief Parse address string and update signature
  *
  *  \retval 0 ok, -1 error
@@ -1419,7 +1491,8 @@ int SigValidate(DetectEngineCtx *de_ctx, Signature *s)
     }
 
 #ifdef HAVE_LUA
-    DetectLuaPostSetup(s);
+    if (DetectLuaPostSetup(de_ctx, s) < 0)
+        SCReturnInt(0);
 #endif
 
 #ifdef DEBUG
@@ -1508,8 +1581,10 @@ static Signature *SigInitHelper(DetectEngineCtx *de_ctx, char *sigstr,
 
     if (sig->sm_lists[DETECT_SM_LIST_UMATCH])
         sig->flags |= SIG_FLAG_STATE_MATCH;
-    if (sig->sm_lists[DETECT_SM_LIST_DMATCH])
+    if (sig->sm_lists[DETECT_SM_LIST_DMATCH]) {
         sig->flags |= SIG_FLAG_STATE_MATCH;
+        DCERPCEnableStubData();
+    }
     if (sig->sm_lists[DETECT_SM_LIST_AMATCH])
         sig->flags |= SIG_FLAG_STATE_MATCH;
     if (sig->sm_lists[DETECT_SM_LIST_HRLMATCH])
@@ -2024,6 +2099,187 @@ void DetectSetupParseRegexes(const char *parse_str,
     return;
 }
 
+/* option lexer: splits keyword option strings in place, for keywords that
+ * don't need a regex and its allocations to parse their options */
+
+static inline int DetectParseIsSpace(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static void DetectParseTokenTrim(DetectParseToken *tok)
+{
+    while (tok->len > 0 && DetectParseIsSpace(tok->str[0])) {
+        tok->str++;
+        tok->len--;
+    }
+    while (tok->len > 0 && DetectParseIsSpace(tok->str[tok->len - 1]))
+        tok->len--;
+}
+
+/**
+ *  \brief set up a lexer splitting str on sep
+ *
+ *  str is not copied, it has to outlive the lexer and its tokens.
+ */
+void DetectParseLexerInit(DetectParseLexer *lex, const char *str, char sep)
+{
+    lex->str = str;
+    lex->len = str ? (uint32_t)strlen(str) : 0;
+    lex->pos = 0;
+    lex->sep = sep;
+
+    /* a blank string has no tokens, rather than one empty one */
+    DetectParseToken all = { lex->str, lex->len };
+    DetectParseTokenTrim(&all);
+    lex->done = (all.len == 0);
+}
+
+/**
+ *  \brief get the next token, with surrounding whitespace stripped
+ *
+ *  Empty tokens, e.g. in "a,,b" or "a,", are returned with len 0 so that
+ *  the keyword can reject them.
+ *
+ *  \retval 1 tok is set
+ *  \retval 0 no more tokens
+ */
+int DetectParseLexerNext(DetectParseLexer *lex, DetectParseToken *tok)
+{
+    if (lex->done)
+        return 0;
+
+    const char *start = lex->str + lex->pos;
+    const char *end = memchr(start, lex->sep, lex->len - lex->pos);
+    if (end == NULL) {
+        tok->str = start;
+        tok->len = lex->len - lex->pos;
+        lex->pos = lex->len;
+        lex->done = 1;
+    } else {
+        tok->str = start;
+        tok->len = (uint32_t)(end - start);
+        lex->pos += tok->len + 1;
+    }
+    DetectParseTokenTrim(tok);
+    return 1;
+}
+
+/**
+ *  \brief get all of the input not returned yet as one token, with
+ *         surrounding whitespace stripped
+ *
+ *  \retval 1 tok is set
+ *  \retval 0 no input left
+ */
+int DetectParseLexerRest(DetectParseLexer *lex, DetectParseToken *tok)
+{
+    if (lex->done)
+        return 0;
+
+    tok->str = lex->str + lex->pos;
+    tok->len = lex->len - lex->pos;
+    lex->pos = lex->len;
+    lex->done = 1;
+    DetectParseTokenTrim(tok);
+    return 1;
+}
+
+/**
+ *  \brief split a "name value" token on its first whitespace
+ *
+ *  \retval 0 ok, value may be empty
+ *  \retval -1 empty token
+ */
+int DetectParseTokenSplit(const DetectParseToken *tok, DetectParseToken *name,
+        DetectParseToken *value)
+{
+    uint32_t i = 0;
+
+    if (tok->len == 0)
+        return -1;
+    while (i < tok->len && !DetectParseIsSpace(tok->str[i]))
+        i++;
+
+    name->str = tok->str;
+    name->len = i;
+    value->str = tok->str + i;
+    value->len = tok->len - i;
+    DetectParseTokenTrim(value);
+    return 0;
+}
+
+/** \retval 1 if tok is str, case sensitive */
+int DetectParseTokenIs(const DetectParseToken *tok, const char *str)
+{
+    size_t len = strlen(str);
+    return (tok->len == len && memcmp(tok->str, str, len) == 0);
+}
+
+/** \retval 1 if tok is str, ignoring case */
+int DetectParseTokenIsNoCase(const DetectParseToken *tok, const char *str)
+{
+    size_t len = strlen(str);
+    return (tok->len == len && strncasecmp(tok->str, str, len) == 0);
+}
+
+/**
+ *  \brief look up a token in a flag table, ignoring case
+ *
+ *  \param table names and flags, terminated by an entry with name NULL
+ *
+ *  \retval 0 found, flag is set
+ *  \retval -1 tok is not in the table
+ */
+int DetectParseTokenFlag(const DetectParseToken *tok,
+        const DetectParseFlag *table, uint32_t *flag)
+{
+    for ( ; table->name != NULL; table++) {
+        if (DetectParseTokenIsNoCase(tok, table->name)) {
+            *flag = table->flag;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ *  \brief convert a token of only decimal digits to an uint32_t
+ *
+ *  \retval 0 ok
+ *  \retval -1 not a number or out of range
+ */
+int DetectParseTokenToUint32(const DetectParseToken *tok, uint32_t *res)
+{
+    uint32_t i;
+
+    if (tok->len == 0 || tok->len > 10)
+        return -1;
+    for (i = 0; i < tok->len; i++) {
+        if (!isdigit((unsigned char)tok->str[i]))
+            return -1;
+    }
+    if (ByteExtractStringUint32(res, 10, (uint16_t)tok->len, tok->str) !=
+            (int)tok->len)
+        return -1;
+    return 0;
+}
+
+/**
+ *  \brief copy a token into a 0 terminated buffer
+ *
+ *  \retval 0 ok
+ *  \retval -1 buffer too small
+ */
+int DetectParseTokenCopy(const DetectParseToken *tok, char *buf, size_t size)
+{
+    if (size == 0 || tok->len >= size)
+        return -1;
+    memcpy(buf, tok->str, tok->len);
+    buf[tok->len] = '\0';
+    return 0;
+}
+
 #ifdef AFLFUZZ_RULES
 #include "util-reference-config.h"
 int RuleParseDataFromFile(char *filename)
@@ -3577,6 +3833,69 @@ end:
     return result;
 }
 
+/** \test option lexer splitting, trimming and conversions */
+static int DetectParseLexerTest01(void)
+{
+    DetectParseLexer lex;
+    DetectParseToken tok, name, value;
+    uint32_t u32 = 0;
+    char buf[8];
+
+    DetectParseLexerInit(&lex, "  ", ',');
+    FAIL_IF(DetectParseLexerNext(&lex, &tok));
+
+    DetectParseLexerInit(&lex, " a , bc,,count 10 ,", ',');
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(DetectParseTokenIs(&tok, "a"));
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(DetectParseTokenIsNoCase(&tok, "BC"));
+    FAIL_IF(DetectParseTokenIs(&tok, "BC"));
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(tok.len == 0);
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(DetectParseTokenSplit(&tok, &name, &value) == 0);
+    FAIL_IF_NOT(DetectParseTokenIs(&name, "count"));
+    FAIL_IF_NOT(DetectParseTokenToUint32(&value, &u32) == 0);
+    FAIL_IF_NOT(u32 == 10);
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(tok.len == 0);
+    FAIL_IF(DetectParseLexerNext(&lex, &tok));
+
+    DetectParseLexerInit(&lex, "set, a,b ", ',');
+    FAIL_IF_NOT(DetectParseLexerNext(&lex, &tok));
+    FAIL_IF_NOT(DetectParseLexerRest(&lex, &tok));
+    FAIL_IF_NOT(DetectParseTokenIs(&tok, "a,b"));
+    FAIL_IF_NOT(DetectParseTokenCopy(&tok, buf, sizeof(buf)) == 0);
+    FAIL_IF(strcmp(buf, "a,b") != 0);
+    FAIL_IF(DetectParseLexerRest(&lex, &tok));
+
+    char *bad[] = { "", "1a", "-1", "4294967296", "12345678901" };
+    uint32_t i;
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        tok.str = bad[i];
+        tok.len = strlen(bad[i]);
+        FAIL_IF_NOT(DetectParseTokenToUint32(&tok, &u32) == -1);
+    }
+    tok.str = "4294967295";
+    tok.len = 10;
+    FAIL_IF_NOT(DetectParseTokenToUint32(&tok, &u32) == 0);
+    FAIL_IF_NOT(u32 == UINT32_MAX);
+
+    static const DetectParseFlag table[] = {
+        { "one", 0x01 }, { "two", 0x02 }, { NULL, 0 },
+    };
+    tok.str = "TWO";
+    tok.len = 3;
+    FAIL_IF_NOT(DetectParseTokenFlag(&tok, table, &u32) == 0);
+    FAIL_IF_NOT(u32 == 0x02);
+    tok.len = 2;
+    FAIL_IF_NOT(DetectParseTokenFlag(&tok, table, &u32) == -1);
+    tok.len = 3;
+    FAIL_IF_NOT(DetectParseTokenCopy(&tok, buf, 3) == -1);
+
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SigParseRegisterTests(void)
@@ -3631,5 +3950,6 @@ void SigParseRegisterTests(void)
     UtRegisterTest("SigParseTestAppLayerTLS01", SigParseTestAppLayerTLS01);
     UtRegisterTest("SigParseTestAppLayerTLS02", SigParseTestAppLayerTLS02);
     UtRegisterTest("SigParseTestAppLayerTLS03", SigParseTestAppLayerTLS03);
+    UtRegisterTest("DetectParseLexerTest01", DetectParseLexerTest01);
 #endif /* UNITTESTS */
 }
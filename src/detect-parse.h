@@ -59,6 +59,8 @@ int SigMatchListSMBelongsTo(const Signature *, const SigMatch *);
 
 int DetectParseDupSigHashInit(DetectEngineCtx *);
 void DetectParseDupSigHashFree(DetectEngineCtx *);
+int SigParseOptionValues(const char *sigstr, const char *keyword,
+        void (*Callback)(const char *value, void *data), void *data);
 
 int DetectEngineContentModifierBufferSetup(DetectEngineCtx *de_ctx, Signature *s, char *arg,
                                            uint8_t sm_type, uint8_t sm_list,
@@ -67,6 +69,39 @@ int DetectEngineContentModifierBufferSetup(DetectEngineCtx *de_ctx, Signature *s
 const char *DetectListToHumanString(int list);
 const char *DetectListToString(int list);
 
+/** view on a part of a keyword option string, not 0 terminated */
+typedef struct DetectParseToken_ {
+    const char *str;
+    uint32_t len;
+} DetectParseToken;
+
+/** splits a keyword option string on a separator without copying */
+typedef struct DetectParseLexer_ {
+    const char *str;
+    uint32_t len;
+    uint32_t pos;
+    char sep;
+    int done;
+} DetectParseLexer;
+
+/** name of a keyword option and the flag it sets */
+typedef struct DetectParseFlag_ {
+    const char *name;
+    uint32_t flag;
+} DetectParseFlag;
+
+void DetectParseLexerInit(DetectParseLexer *lex, const char *str, char sep);
+int DetectParseLexerNext(DetectParseLexer *lex, DetectParseToken *tok);
+int DetectParseLexerRest(DetectParseLexer *lex, DetectParseToken *tok);
+int DetectParseTokenSplit(const DetectParseToken *tok, DetectParseToken *name,
+        DetectParseToken *value);
+int DetectParseTokenIs(const DetectParseToken *tok, const char *str);
+int DetectParseTokenIsNoCase(const DetectParseToken *tok, const char *str);
+int DetectParseTokenFlag(const DetectParseToken *tok,
+        const DetectParseFlag *table, uint32_t *flag);
+int DetectParseTokenToUint32(const DetectParseToken *tok, uint32_t *res);
+int DetectParseTokenCopy(const DetectParseToken *tok, char *buf, size_t size);
+
 /* parse regex setup and free util funcs */
 
 void DetectSetupParseRegexes(const char *parse_str,
@@ -40,6 +40,7 @@
 #include "detect-engine-sigorder.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-state.h"
+#include "detect-engine-loader.h"
 
 #include "util-var-name.h"
 #include "util-unittest-helper.h"
@@ -47,6 +48,8 @@
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-pool.h"
+#include "util-misc.h"
+#include "util-hash-lookup3.h"
 
 #include "conf.h"
 #include "app-layer.h"
@@ -67,6 +70,34 @@
 static int pcre_match_limit = 0;
 static int pcre_match_limit_recursion = 0;
 
+#ifdef PCRE_HAVE_JIT_EXEC
+/* the jit stack starts out at the size of the default machine stack pcre
+ * uses and may grow up to the configured max */
+#define SC_JIT_STACK_START              (32 * 1024)
+#define SC_JIT_STACK_MAX_DEFAULT        (1024 * 1024)
+
+static uint32_t pcre_jit_stack_max = SC_JIT_STACK_MAX_DEFAULT;
+
+/** per detect thread data shared by all pcre keywords */
+typedef struct DetectPcreThreadCtx_ {
+    pcre_jit_stack *jit_stack;
+} DetectPcreThreadCtx;
+#endif
+
+#ifdef BUILD_HYPERSCAN
+#include <hs.h>
+
+/* Regexes hyperscan supports are also compiled into a hyperscan database.
+ * It is scanned first: a miss is final, and so is a hit when it is an
+ * exact compile and nothing after the pcre keyword needs the match
+ * offsets. pcre only runs for captures and relative matching. */
+static int pcre_hyperscan = 1;
+
+/** scratch big enough for all the databases, cloned per detect thread */
+static hs_scratch_t *pcre_hs_scratch = NULL;
+static SCMutex pcre_hs_scratch_lock = SCMUTEX_INITIALIZER;
+#endif
+
 static pcre *parse_regex;
 static pcre_extra *parse_regex_study;
 static pcre *parse_capture_regex;
@@ -77,6 +108,7 @@ int DetectPcreALMatchCookie(ThreadVars *t, DetectEngineThreadCtx *det_ctx, Flow
 int DetectPcreALMatchMethod(ThreadVars *t, DetectEngineThreadCtx *det_ctx, Flow *f, uint8_t flags, void *state, Signature *s, SigMatch *m);
 static int DetectPcreSetup (DetectEngineCtx *, Signature *, char *);
 void DetectPcreFree(void *);
+static size_t DetectPcreMemuse(const SigMatchCtx *);
 void DetectPcreRegisterTests(void);
 
 void DetectPcreRegister (void)
@@ -89,6 +121,7 @@ void DetectPcreRegister (void)
     sigmatch_table[DETECT_PCRE].alproto = ALPROTO_HTTP;
     sigmatch_table[DETECT_PCRE].Setup = DetectPcreSetup;
     sigmatch_table[DETECT_PCRE].Free  = DetectPcreFree;
+    sigmatch_table[DETECT_PCRE].Memuse = DetectPcreMemuse;
     sigmatch_table[DETECT_PCRE].RegisterTests  = DetectPcreRegisterTests;
 
     sigmatch_table[DETECT_PCRE].flags |= SIGMATCH_PAYLOAD;
@@ -123,6 +156,28 @@ void DetectPcreRegister (void)
         }
     }
 
+#ifdef PCRE_HAVE_JIT_EXEC
+    char *jit_stack_max = NULL;
+    if (ConfGet("pcre.jit-stack-max", &jit_stack_max) == 1 && jit_stack_max != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(jit_stack_max, &size) < 0 || size > UINT32_MAX) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing pcre.jit-stack-max "
+                       "from conf file - %s.  Killing engine", jit_stack_max);
+            exit(EXIT_FAILURE);
+        }
+        pcre_jit_stack_max = (uint32_t)size;
+        SCLogConfig("Using PCRE jit-stack-max setting of: %u", pcre_jit_stack_max);
+    }
+#endif
+
+#ifdef BUILD_HYPERSCAN
+    int hyperscan = 1;
+    if (ConfGetBool("pcre.hyperscan", &hyperscan) == 1 && !hyperscan) {
+        SCLogConfig("Not using hyperscan for pcre keywords");
+        pcre_hyperscan = 0;
+    }
+#endif
+
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 
     /* setup the capture regex, as it needs PCRE_UNGREEDY we do it manually */
@@ -146,12 +201,39 @@ void DetectPcreRegister (void)
     return;
 }
 
+#ifdef BUILD_HYPERSCAN
+static int DetectPcreHSMatchEvent(unsigned int id, unsigned long long from,
+        unsigned long long to, unsigned int flags, void *ctx)
+{
+    *(int *)ctx = 1;
+    return 1; /* terminate matching */
+}
+
+/** \internal
+ *  \retval 1 match, 0 no match, -1 not scanned */
+static inline int DetectPcreHSScan(DetectEngineThreadCtx *det_ctx,
+        const DetectPcreData *pe, const uint8_t *ptr, uint32_t len)
+{
+    hs_scratch_t *scratch = DetectThreadCtxGetKeywordThreadCtx(det_ctx,
+            pe->hs_thread_ctx_id);
+    if (scratch == NULL)
+        return -1;
+
+    int found = 0;
+    hs_error_t err = hs_scan(pe->hs_db, (const char *)ptr, len, 0, scratch,
+            DetectPcreHSMatchEvent, &found);
+    if (err != HS_SUCCESS && err != HS_SCAN_TERMINATED)
+        return -1;
+    return found;
+}
+#endif
+
 /**
  * \brief Match a regex on a single payload.
  *
  * \param det_ctx     Thread detection ctx.
  * \param s           Signature.
- * \param sm          Sig match to match against.
+ * \param smd         Sig match to match against.
  * \param p           Packet to set PktVars if any.
  * \param f           Flow to set FlowVars if any.
  * \param payload     Payload to inspect.
@@ -161,7 +243,7 @@ void DetectPcreRegister (void)
  * \retval  0 No match.
  */
 int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
-                           SigMatch *sm, Packet *p, Flow *f, uint8_t *payload,
+                           const SigMatchData *smd, Packet *p, Flow *f, uint8_t *payload,
                            uint32_t payload_len)
 {
     SCEnter();
@@ -172,7 +254,7 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
     uint16_t len = 0;
     uint16_t capture_len = 0;
 
-    DetectPcreData *pe = (DetectPcreData *)sm->ctx;
+    DetectPcreData *pe = (DetectPcreData *)smd->ctx;
 
     if (pe->flags & DETECT_PCRE_RELATIVE) {
         ptr = payload + det_ctx->buffer_offset;
@@ -187,7 +269,36 @@ int DetectPcrePayloadMatch(DetectEngineThreadCtx *det_ctx, Signature *s,
         start_offset = (payload + det_ctx->pcre_match_start_offset - ptr);
     }
 
+#ifdef BUILD_HYPERSCAN
+    /* looking for a next match of the regex is left to pcre */
+    if (pe->hs_db != NULL && start_offset == 0) {
+        int r = DetectPcreHSScan(det_ctx, pe, ptr, len);
+        if (r == 0) {
+            SCReturnInt((pe->flags & DETECT_PCRE_NEGATE) ? 1 : 0);
+        }
+        if (r == 1 && pe->hs_exact) {
+            if (pe->flags & DETECT_PCRE_NEGATE) {
+                SCReturnInt(0);
+            }
+            /* offsets and captures of the match are only known to pcre */
+            if (pe->capidx == 0 && smd->is_last) {
+                SCReturnInt(1);
+            }
+        }
+    }
+#endif
+
     /* run the actual pcre detection */
+#ifdef PCRE_HAVE_JIT_EXEC
+    DetectPcreThreadCtx *tctx = NULL;
+    if (pe->flags & DETECT_PCRE_JIT)
+        tctx = DetectThreadCtxGetKeywordThreadCtx(det_ctx, pe->thread_ctx_id);
+    if (tctx != NULL && tctx->jit_stack != NULL) {
+        /* skips pcre_exec's sanity checks and uses our own stack */
+        ret = pcre_jit_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0,
+                            ov, MAX_SUBSTRINGS, tctx->jit_stack);
+    } else
+#endif
     ret = pcre_exec(pe->re, pe->sd, (char *)ptr, len, start_offset, 0, ov, MAX_SUBSTRINGS);
     SCLogDebug("ret %d (negating %s)", ret, (pe->flags & DETECT_PCRE_NEGATE) ? "set" : "not set");
 
@@ -275,9 +386,408 @@ static int DetectPcreHasUpperCase(const char *re)
     return 0;
 }
 
-static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr, int *sm_list)
+/** \internal
+ *  \brief compile and study a regex the way all pcre keywords are
+ *
+ *  \param jit set to 1 if the re was jit compiled
+ *
+ *  \retval 0 ok
+ *  \retval -1 compile failed, eb and eo describe the error
+ *  \retval -2 study failed, eb describes the error
+ */
+static int DetectPcreCompile(const char *re, int opts, pcre **compiled,
+        pcre_extra **sd, int *jit, const char **eb, int *eo)
 {
     int ec;
+
+    *sd = NULL;
+    *jit = 0;
+
+    /* Try to compile as if all (...) groups had been meant as (?:...),
+     * which is the common case in most rules.
+     * If we fail because a capture group is later referenced (e.g., \1),
+     * PCRE will let us know.
+     */
+    *compiled = pcre_compile2(re, opts | PCRE_NO_AUTO_CAPTURE, &ec, eb, eo, NULL);
+    if (*compiled == NULL && ec == 15) { // reference to non-existent subpattern
+        *compiled = pcre_compile(re, opts, eb, eo, NULL);
+    }
+    if (*compiled == NULL)
+        return -1;
+
+#ifdef PCRE_HAVE_JIT
+    *sd = pcre_study(*compiled, PCRE_STUDY_JIT_COMPILE, eb);
+#else
+    *sd = pcre_study(*compiled, 0, eb);
+#endif
+    if (*eb != NULL) {
+        if (*sd != NULL)
+            pcre_free_study(*sd);
+        pcre_free(*compiled);
+        *sd = NULL;
+        *compiled = NULL;
+        return -2;
+    }
+#ifdef PCRE_HAVE_JIT
+    int ret = pcre_fullinfo(*compiled, *sd, PCRE_INFO_JIT, jit);
+    if (ret != 0 || *jit != 1)
+        *jit = 0;
+#endif
+    return 0;
+}
+
+/** regex compiled ahead by DetectPcrePrecompile(), taken by the first
+ *  pcre keyword with the same re and opts */
+typedef struct DetectPcrePrecompiled_ {
+    char *re;
+    int opts;
+    pcre *compiled;
+    pcre_extra *sd;
+    int jit;
+    /** more entries with the same re and opts */
+    struct DetectPcrePrecompiled_ *next;
+} DetectPcrePrecompiled;
+
+typedef struct DetectPcrePrecompileList_ {
+    DetectPcrePrecompiled **array;
+    uint32_t cnt;
+    uint32_t size;
+} DetectPcrePrecompileList;
+
+static void DetectPcrePrecompiledFreeOne(DetectPcrePrecompiled *p)
+{
+    if (p->re != NULL)
+        SCFree(p->re);
+    if (p->sd != NULL)
+        pcre_free_study(p->sd);
+    if (p->compiled != NULL)
+        pcre_free(p->compiled);
+    SCFree(p);
+}
+
+static uint32_t DetectPcrePrecompiledHashFunc(HashListTable *ht, void *data,
+        uint16_t datalen)
+{
+    const DetectPcrePrecompiled *p = (const DetectPcrePrecompiled *)data;
+    return hashlittle(p->re, strlen(p->re), (uint32_t)p->opts) % ht->array_size;
+}
+
+static char DetectPcrePrecompiledCompareFunc(void *data1, uint16_t len1,
+        void *data2, uint16_t len2)
+{
+    const DetectPcrePrecompiled *p1 = (const DetectPcrePrecompiled *)data1;
+    const DetectPcrePrecompiled *p2 = (const DetectPcrePrecompiled *)data2;
+    return (p1->opts == p2->opts && strcmp(p1->re, p2->re) == 0);
+}
+
+static void DetectPcrePrecompiledHashFree(void *data)
+{
+    DetectPcrePrecompiled *p = (DetectPcrePrecompiled *)data;
+    while (p != NULL) {
+        DetectPcrePrecompiled *next = p->next;
+        DetectPcrePrecompiledFreeOne(p);
+        p = next;
+    }
+}
+
+/** \internal
+ *  \brief get the re and the options it is compiled with from a pcre
+ *         keyword value, as DetectPcreParse() does
+ *
+ *  \retval 0 ok
+ *  \retval -1 not a valid value, left to DetectPcreParse() to report
+ */
+static int DetectPcreParseRe(const char *regexstr, char *re, size_t re_size,
+        int *opts)
+{
+    int ov[MAX_SUBSTRINGS];
+    char op_str[64] = "";
+    size_t slen = strlen(regexstr) + 1;
+    size_t pos = 0;
+
+    while (pos < slen && isspace((unsigned char)regexstr[pos])) {
+        pos++;
+    }
+    if (regexstr[pos] == '!')
+        pos++;
+
+    int ret = pcre_exec(parse_regex, parse_regex_study, regexstr + pos, slen-pos,
+                    0, 0, ov, MAX_SUBSTRINGS);
+    if (ret <= 0)
+        return -1;
+    if (pcre_copy_substring(regexstr + pos, ov, MAX_SUBSTRINGS, 1, re, re_size) < 0)
+        return -1;
+    if (ret > 2 && pcre_copy_substring(regexstr + pos, ov, MAX_SUBSTRINGS, 2,
+                op_str, sizeof(op_str)) < 0)
+        return -1;
+
+    *opts = 0;
+    for (char *op = op_str; *op; op++) {
+        switch (*op) {
+            case 'A':
+                *opts |= PCRE_ANCHORED;
+                break;
+            case 'E':
+                *opts |= PCRE_DOLLAR_ENDONLY;
+                break;
+            case 'G':
+                *opts |= PCRE_UNGREEDY;
+                break;
+            case 'i':
+                *opts |= PCRE_CASELESS;
+                break;
+            case 'm':
+                *opts |= PCRE_MULTILINE;
+                break;
+            case 's':
+                *opts |= PCRE_DOTALL;
+                break;
+            case 'x':
+                *opts |= PCRE_EXTENDED;
+                break;
+        }
+    }
+    return 0;
+}
+
+static void DetectPcrePrecompileAdd(const char *value, void *data)
+{
+    DetectPcrePrecompileList *list = (DetectPcrePrecompileList *)data;
+    size_t re_size = strlen(value) + 1;
+    char re[re_size];
+    int opts = 0;
+
+    if (DetectPcreParseRe(value, re, re_size, &opts) != 0)
+        return;
+
+    if (list->cnt == list->size) {
+        uint32_t size = list->size ? list->size * 2 : 256;
+        DetectPcrePrecompiled **array = SCRealloc(list->array,
+                size * sizeof(DetectPcrePrecompiled *));
+        if (array == NULL)
+            return;
+        list->array = array;
+        list->size = size;
+    }
+
+    DetectPcrePrecompiled *p = SCCalloc(1, sizeof(*p));
+    if (unlikely(p == NULL))
+        return;
+    p->re = SCStrdup(re);
+    if (unlikely(p->re == NULL)) {
+        SCFree(p);
+        return;
+    }
+    p->opts = opts;
+    list->array[list->cnt++] = p;
+}
+
+static int DetectPcrePrecompileTask(void *ctx, int loader_id)
+{
+    DetectPcrePrecompiled *p = (DetectPcrePrecompiled *)ctx;
+    const char *eb = NULL;
+    int eo = 0;
+
+    /* errors are reported when the keyword is parsed */
+    (void)DetectPcreCompile(p->re, p->opts, &p->compiled, &p->sd, &p->jit,
+            &eb, &eo);
+    return 0;
+}
+
+/**
+ *  \brief compile the regexes of all pcre keywords of a set of rules in
+ *         parallel, ahead of the serial parsing of the rules
+ *
+ *  Compiling, studying and jit compiling is where most of the rule
+ *  parsing time of pcre heavy rulesets goes and it touches no shared
+ *  state. The results are kept in de_ctx->pcre_precompiled for
+ *  DetectPcreParse() to take, anything it doesn't take is freed by
+ *  DetectPcrePrecompiledFree().
+ *
+ *  Does nothing unless detect.build-threads is more than 1.
+ *
+ *  \retval number of regexes compiled
+ */
+uint32_t DetectPcrePrecompile(DetectEngineCtx *de_ctx, char **sigs, uint32_t cnt)
+{
+    DetectPcrePrecompileList list = { NULL, 0, 0 };
+    uint32_t compiled = 0;
+
+    if (de_ctx->build_threads <= 1 || de_ctx->pcre_precompiled != NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        SigParseOptionValues(sigs[i], "pcre", DetectPcrePrecompileAdd, &list);
+    }
+    if (list.cnt == 0)
+        goto end;
+
+    de_ctx->pcre_precompiled = HashListTableInit(4096,
+            DetectPcrePrecompiledHashFunc, DetectPcrePrecompiledCompareFunc,
+            DetectPcrePrecompiledHashFree);
+    if (de_ctx->pcre_precompiled == NULL)
+        goto end;
+
+    SCLogDebug("compiling %u pcre keywords using up to %d threads",
+            list.cnt, de_ctx->build_threads);
+    (void)DetectLoaderRunTasks(de_ctx->build_threads, DetectPcrePrecompileTask,
+            (void **)list.array, list.cnt);
+
+    for (uint32_t i = 0; i < list.cnt; i++) {
+        DetectPcrePrecompiled *p = list.array[i];
+        list.array[i] = NULL;
+        if (p->compiled == NULL) {
+            DetectPcrePrecompiledFreeOne(p);
+            continue;
+        }
+
+        DetectPcrePrecompiled *head = HashListTableLookup(de_ctx->pcre_precompiled,
+                p, sizeof(*p));
+        if (head != NULL) {
+            p->next = head->next;
+            head->next = p;
+        } else if (HashListTableAdd(de_ctx->pcre_precompiled, p, sizeof(*p)) != 0) {
+            DetectPcrePrecompiledFreeOne(p);
+            continue;
+        }
+        compiled++;
+    }
+
+end:
+    for (uint32_t i = 0; i < list.cnt; i++) {
+        if (list.array[i] != NULL)
+            DetectPcrePrecompiledFreeOne(list.array[i]);
+    }
+    if (list.array != NULL)
+        SCFree(list.array);
+    return compiled;
+}
+
+void DetectPcrePrecompiledFree(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->pcre_precompiled != NULL) {
+        HashListTableFree(de_ctx->pcre_precompiled);
+        de_ctx->pcre_precompiled = NULL;
+    }
+}
+
+/** \internal
+ *  \brief take the precompiled regex for re and opts, if any
+ *  \retval 0 found, ownership of compiled and sd moves to the caller
+ *  \retval -1 not found
+ */
+static int DetectPcrePrecompiledTake(DetectEngineCtx *de_ctx, char *re,
+        int opts, pcre **compiled, pcre_extra **sd, int *jit)
+{
+    if (de_ctx->pcre_precompiled == NULL)
+        return -1;
+
+    DetectPcrePrecompiled lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.re = re;
+    lookup.opts = opts;
+
+    DetectPcrePrecompiled *head = HashListTableLookup(de_ctx->pcre_precompiled,
+            &lookup, sizeof(lookup));
+    if (head == NULL)
+        return -1;
+
+    /* the head stays in the hash, so it is taken last */
+    DetectPcrePrecompiled *p = head->next ? head->next : head;
+    if (p->compiled == NULL)
+        return -1;
+
+    *compiled = p->compiled;
+    *sd = p->sd;
+    *jit = p->jit;
+    p->compiled = NULL;
+    p->sd = NULL;
+
+    if (p != head) {
+        head->next = p->next;
+        DetectPcrePrecompiledFreeOne(p);
+    }
+    return 0;
+}
+
+#ifdef BUILD_HYPERSCAN
+/** \internal
+ *  \brief compile the regex into a hyperscan database if hyperscan
+ *         supports it
+ *
+ *  If the exact compile fails, e.g. on back references, a prefilter
+ *  compile is tried: it matches a superset of what the regex matches.
+ */
+static void DetectPcreHSCompile(DetectPcreData *pd, const char *re, int opts)
+{
+    if (!pcre_hyperscan)
+        return;
+    /* no hyperscan equivalent */
+    if (opts & (PCRE_ANCHORED|PCRE_DOLLAR_ENDONLY|PCRE_EXTENDED))
+        return;
+
+    unsigned int flags = HS_FLAG_SINGLEMATCH;
+    if (opts & PCRE_CASELESS)
+        flags |= HS_FLAG_CASELESS;
+    if (opts & PCRE_MULTILINE)
+        flags |= HS_FLAG_MULTILINE;
+    if (opts & PCRE_DOTALL)
+        flags |= HS_FLAG_DOTALL;
+
+    hs_database_t *db = NULL;
+    hs_compile_error_t *compile_err = NULL;
+    int exact = 1;
+    if (hs_compile(re, flags, HS_MODE_BLOCK, NULL, &db,
+                &compile_err) != HS_SUCCESS) {
+        hs_free_compile_error(compile_err);
+        compile_err = NULL;
+        exact = 0;
+        if (hs_compile(re, flags | HS_FLAG_PREFILTER, HS_MODE_BLOCK, NULL, &db,
+                    &compile_err) != HS_SUCCESS) {
+            SCLogDebug("hyperscan can't compile \"%s\": %s", re,
+                    compile_err ? compile_err->message : "unknown error");
+            hs_free_compile_error(compile_err);
+            return;
+        }
+    }
+
+    SCMutexLock(&pcre_hs_scratch_lock);
+    hs_error_t err = hs_alloc_scratch(db, &pcre_hs_scratch);
+    SCMutexUnlock(&pcre_hs_scratch_lock);
+    if (err != HS_SUCCESS) {
+        SCLogDebug("hs_alloc_scratch failed for \"%s\"", re);
+        hs_free_database(db);
+        return;
+    }
+
+    SCLogDebug("\"%s\" compiled with hyperscan (%s)", re,
+            exact ? "exact" : "prefilter");
+    pd->hs_db = db;
+    pd->hs_exact = exact;
+}
+
+static void *DetectPcreHSThreadInit(void *data)
+{
+    hs_scratch_t *scratch = NULL;
+    SCMutexLock(&pcre_hs_scratch_lock);
+    hs_error_t err = hs_clone_scratch(pcre_hs_scratch, &scratch);
+    SCMutexUnlock(&pcre_hs_scratch_lock);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "unable to clone hyperscan scratch for pcre");
+        return NULL;
+    }
+    return scratch;
+}
+
+static void DetectPcreHSThreadFree(void *ctx)
+{
+    if (ctx != NULL)
+        hs_free_scratch((hs_scratch_t *)ctx);
+}
+#endif /* BUILD_HYPERSCAN */
+
+static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr, int *sm_list)
+{
     const char *eb;
     int eo;
     int opts = 0;
@@ -334,6 +844,8 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
     if (unlikely(pd == NULL))
         goto error;
     memset(pd, 0, sizeof(DetectPcreData));
+    pd->thread_ctx_id = -1;
+    pd->hs_thread_ctx_id = -1;
 
     if (negate)
         pd->flags |= DETECT_PCRE_NEGATE;
@@ -490,45 +1002,34 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
         }
     }
 
-    /* Try to compile as if all (...) groups had been meant as (?:...),
-     * which is the common case in most rules.
-     * If we fail because a capture group is later referenced (e.g., \1),
-     * PCRE will let us know.
-     */
-    pd->re = pcre_compile2(re, opts | PCRE_NO_AUTO_CAPTURE, &ec, &eb, &eo, NULL);
-    if (pd->re == NULL && ec == 15) { // reference to non-existent subpattern
-        pd->re = pcre_compile(re, opts, &eb, &eo, NULL);
-    }
-
-    if(pd->re == NULL)  {
-        SCLogError(SC_ERR_PCRE_COMPILE, "pcre compile of \"%s\" failed at offset %" PRId32 ": %s", regexstr, eo, eb);
-        goto error;
+    int jit = 0;
+    if (DetectPcrePrecompiledTake(de_ctx, re, opts, &pd->re, &pd->sd, &jit) != 0) {
+        ret = DetectPcreCompile(re, opts, &pd->re, &pd->sd, &jit, &eb, &eo);
+        if (ret == -1) {
+            SCLogError(SC_ERR_PCRE_COMPILE, "pcre compile of \"%s\" failed at offset %" PRId32 ": %s", regexstr, eo, eb);
+            goto error;
+        } else if (ret == -2) {
+            SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
+            goto error;
+        }
     }
 #ifdef PCRE_HAVE_JIT
-    pd->sd = pcre_study(pd->re, PCRE_STUDY_JIT_COMPILE, &eb);
-    if(eb != NULL)  {
-        SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
-        goto error;
-    }
-
-    int jit = 0;
-    ret = pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_JIT, &jit);
-    if (ret != 0 || jit != 1) {
+    if (jit != 1) {
         /* warning, so we won't print the sig after this. Adding
          * file and line to the message so the admin can figure
          * out what sig this is about */
         SCLogDebug("PCRE JIT compiler does not support: %s. "
                 "Falling back to regular PCRE handling (%s:%d)",
                 regexstr, de_ctx->rule_file, de_ctx->rule_line);
-    }
-#else
-    pd->sd = pcre_study(pd->re, 0, &eb);
-    if(eb != NULL)  {
-        SCLogError(SC_ERR_PCRE_STUDY, "pcre study failed : %s", eb);
-        goto error;
+    } else {
+        pd->flags |= DETECT_PCRE_JIT;
     }
 #endif /*PCRE_HAVE_JIT*/
 
+#ifdef BUILD_HYPERSCAN
+    DetectPcreHSCompile(pd, re, opts);
+#endif
+
     if (pd->sd == NULL)
         pd->sd = (pcre_extra *) SCCalloc(1,sizeof(pcre_extra));
 
@@ -559,12 +1060,7 @@ static DetectPcreData *DetectPcreParse (DetectEngineCtx *de_ctx, char *regexstr,
     return pd;
 
 error:
-    if (pd != NULL && pd->re != NULL)
-        pcre_free(pd->re);
-    if (pd != NULL && pd->sd != NULL)
-        pcre_free_study(pd->sd);
-    if (pd)
-        SCFree(pd);
+    DetectPcreFree(pd);
     return NULL;
 }
 
@@ -638,6 +1134,35 @@ error:
     return -1;
 }
 
+#ifdef PCRE_HAVE_JIT_EXEC
+static void *DetectPcreThreadInit(void *data)
+{
+    const uint32_t max = *(uint32_t *)data;
+
+    DetectPcreThreadCtx *tctx = SCMalloc(sizeof(DetectPcreThreadCtx));
+    if (unlikely(tctx == NULL))
+        return NULL;
+    memset(tctx, 0, sizeof(*tctx));
+
+    /* without a stack pcre_exec with its default stack is used */
+    tctx->jit_stack = pcre_jit_stack_alloc(MIN(SC_JIT_STACK_START, max), max);
+    if (tctx->jit_stack == NULL) {
+        SCLogDebug("pcre_jit_stack_alloc failed");
+    }
+    return tctx;
+}
+
+static void DetectPcreThreadFree(void *ctx)
+{
+    DetectPcreThreadCtx *tctx = (DetectPcreThreadCtx *)ctx;
+    if (tctx == NULL)
+        return;
+    if (tctx->jit_stack != NULL)
+        pcre_jit_stack_free(tctx->jit_stack);
+    SCFree(tctx);
+}
+#endif
+
 static int DetectPcreSetup (DetectEngineCtx *de_ctx, Signature *s, char *regexstr)
 {
     SCEnter();
@@ -652,6 +1177,26 @@ static int DetectPcreSetup (DetectEngineCtx *de_ctx, Signature *s, char *regexst
     if (DetectPcreParseCapture(regexstr, de_ctx, pd) < 0)
         goto error;
 
+#ifdef PCRE_HAVE_JIT_EXEC
+    /* one jit stack per thread, shared by all pcre keywords */
+    if ((pd->flags & DETECT_PCRE_JIT) && pcre_jit_stack_max > 0) {
+        pd->thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "pcre",
+                DetectPcreThreadInit, (void *)&pcre_jit_stack_max,
+                DetectPcreThreadFree, 1);
+        if (pd->thread_ctx_id == -1)
+            goto error;
+    }
+#endif
+#ifdef BUILD_HYPERSCAN
+    /* one scratch per thread, shared by all pcre keywords */
+    if (pd->hs_db != NULL) {
+        pd->hs_thread_ctx_id = DetectRegisterThreadCtxFuncs(de_ctx, "pcre-hs",
+                DetectPcreHSThreadInit, NULL, DetectPcreHSThreadFree, 1);
+        if (pd->hs_thread_ctx_id == -1)
+            goto error;
+    }
+#endif
+
     if (parsed_sm_list == DETECT_SM_LIST_UMATCH ||
         parsed_sm_list == DETECT_SM_LIST_HRUDMATCH ||
         parsed_sm_list == DETECT_SM_LIST_HCBDMATCH ||
@@ -789,11 +1334,43 @@ void DetectPcreFree(void *ptr)
         pcre_free(pd->re);
     if (pd->sd != NULL)
         pcre_free_study(pd->sd);
+#ifdef BUILD_HYPERSCAN
+    if (pd->hs_db != NULL)
+        hs_free_database((hs_database_t *)pd->hs_db);
+#endif
 
     SCFree(pd);
     return;
 }
 
+/** \internal
+ *  \brief bytes used by the compiled and studied regex */
+static size_t DetectPcreMemuse(const SigMatchCtx *ctx)
+{
+    const DetectPcreData *pd = (const DetectPcreData *)ctx;
+    size_t size = sizeof(*pd);
+    size_t s = 0;
+
+    if (pd->capname != NULL)
+        size += strlen(pd->capname) + 1;
+    if (pd->re != NULL && pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_SIZE, &s) == 0)
+        size += s;
+    s = 0;
+    if (pd->sd != NULL && pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_STUDYSIZE, &s) == 0)
+        size += s;
+#ifdef PCRE_INFO_JITSIZE
+    s = 0;
+    if (pd->sd != NULL && pcre_fullinfo(pd->re, pd->sd, PCRE_INFO_JITSIZE, &s) == 0)
+        size += s;
+#endif
+#ifdef BUILD_HYPERSCAN
+    s = 0;
+    if (pd->hs_db != NULL && hs_database_size(pd->hs_db, &s) == HS_SUCCESS)
+        size += s;
+#endif
+    return size;
+}
+
 #ifdef UNITTESTS /* UNITTESTS */
 
 /**
@@ -4015,6 +4592,183 @@ end:
     return result;
 }
 
+/**
+ * \test jit compiled pcre's get the per thread jit stack and still match
+ *       on a long repeat
+ */
+static int DetectPcreJitStackTest01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t buf[4001];
+    uint16_t i;
+
+    for (i = 0; i < sizeof(buf) - 1; i += 2) {
+        buf[i] = 'a';
+        buf[i + 1] = 'b';
+    }
+    buf[sizeof(buf) - 1] = 'c';
+
+    memset(&th_v, 0, sizeof(th_v));
+    Packet *p = UTHBuildPacket(buf, sizeof(buf), IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/^(?:ab)+c$/\"; sid:1;)");
+    FAIL_IF_NULL(s);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+#ifdef PCRE_HAVE_JIT_EXEC
+    DetectPcreData *pd = (DetectPcreData *)s->sm_lists[DETECT_SM_LIST_PMATCH]->ctx;
+    if (pd->flags & DETECT_PCRE_JIT) {
+        DetectPcreThreadCtx *tctx =
+            DetectThreadCtxGetKeywordThreadCtx(det_ctx, pd->thread_ctx_id);
+        FAIL_IF_NULL(tctx);
+        FAIL_IF_NULL(tctx->jit_stack);
+    }
+#endif
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+
+/** \test regexes hyperscan takes give the same verdicts as with pcre */
+static int DetectPcreHyperscanTest01(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t buf[] = "xxabbbcxx aa";
+
+    memset(&th_v, 0, sizeof(th_v));
+    Packet *p = UTHBuildPacket(buf, sizeof(buf) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s1 = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/ab+c/\"; sid:1;)");
+    FAIL_IF_NULL(s1);
+    /* back reference: hyperscan can only prefilter */
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/(a)\\1/\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/(c)\\1/\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:!\"/ab+c/\"; sid:4;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/ab+c/\"; content:\"aa\"; distance:0; sid:5;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any any "
+            "(pcre:\"/ab+c/\"; content:\"xx\"; distance:0; within:2; sid:6;)"));
+
+#ifdef BUILD_HYPERSCAN
+    if (pcre_hyperscan) {
+        DetectPcreData *pd = (DetectPcreData *)s1->sm_lists[DETECT_SM_LIST_PMATCH]->ctx;
+        FAIL_IF_NULL(pd->hs_db);
+        FAIL_IF_NOT(pd->hs_exact);
+    }
+#endif
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF_NOT(PacketAlertCheck(p, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p, 2));
+    FAIL_IF(PacketAlertCheck(p, 3));
+    FAIL_IF(PacketAlertCheck(p, 4));
+    FAIL_IF_NOT(PacketAlertCheck(p, 5));
+    FAIL_IF_NOT(PacketAlertCheck(p, 6));
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+
+/**
+ * \brief Test that precompiled regexes are taken by the pcre keywords
+ *        they were compiled for, and only once.
+ */
+static int DetectPcrePrecompileTest01(void)
+{
+    char *sigs[] = {
+        "alert tcp any any -> any any (pcre:\"/a.c/i\"; sid:1;)",
+        "alert tcp any any -> any any (content:\"x\"; pcre:\"/a.c/i\"; sid:2;)",
+        "alert tcp any any -> any any (pcre:!\"/xyz/R\"; sid:3;)",
+        "alert tcp any any -> any any (pcre:\"/(/\"; sid:4;)",
+        "alert tcp any any -> any any (content:\"pcre\"; sid:5;)",
+    };
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->build_threads = 1;
+    FAIL_IF_NOT(DetectPcrePrecompile(de_ctx, sigs, 5) == 0);
+    FAIL_IF_NOT_NULL(de_ctx->pcre_precompiled);
+
+    /* the invalid regex of sid 4 is left to the keyword parser */
+    de_ctx->build_threads = 2;
+    FAIL_IF_NOT(DetectPcrePrecompile(de_ctx, sigs, 5) == 3);
+    FAIL_IF_NULL(de_ctx->pcre_precompiled);
+
+    DetectPcrePrecompiled lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.re = "a.c";
+    lookup.opts = PCRE_CASELESS;
+    DetectPcrePrecompiled *head = HashListTableLookup(de_ctx->pcre_precompiled,
+            &lookup, sizeof(lookup));
+    FAIL_IF_NULL(head);
+    FAIL_IF_NULL(head->next);
+    pcre *first = head->next->compiled;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, sigs[0]);
+    FAIL_IF_NULL(s);
+    DetectPcreData *pd = (DetectPcreData *)s->sm_lists_tail[DETECT_SM_LIST_PMATCH]->ctx;
+    FAIL_IF_NOT(pd->re == first);
+    FAIL_IF_NOT(pd->flags & DETECT_PCRE_CASELESS);
+    FAIL_IF_NOT(pd->sd->flags & PCRE_EXTRA_MATCH_LIMIT);
+    FAIL_IF_NOT_NULL(head->next);
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, sigs[1]));
+    FAIL_IF_NOT_NULL(head->compiled);
+    FAIL_IF_NOT_NULL(head->sd);
+
+    s = DetectEngineAppendSig(de_ctx, sigs[2]);
+    FAIL_IF_NULL(s);
+    pd = (DetectPcreData *)s->sm_lists_tail[DETECT_SM_LIST_PMATCH]->ctx;
+    FAIL_IF_NOT(pd->flags & DETECT_PCRE_NEGATE);
+
+    FAIL_IF_NOT_NULL(DetectEngineAppendSig(de_ctx, sigs[3]));
+
+    /* used up, so the next keyword compiles its own */
+    s = DetectEngineAppendSig(de_ctx,
+            "alert tcp any any -> any any (pcre:\"/a.c/i\"; sid:6;)");
+    FAIL_IF_NULL(s);
+    pd = (DetectPcreData *)s->sm_lists_tail[DETECT_SM_LIST_PMATCH]->ctx;
+    FAIL_IF_NULL(pd->re);
+
+    DetectPcrePrecompiledFree(de_ctx);
+    FAIL_IF_NOT_NULL(de_ctx->pcre_precompiled);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 /**
  * \brief Test parsing of pcre's with the W modifier set.
  */
@@ -4148,6 +4902,9 @@ void DetectPcreRegisterTests(void)
                    DetectPcreFlowvarCapture03);
 
     UtRegisterTest("DetectPcreParseHttpHost", DetectPcreParseHttpHost);
+    UtRegisterTest("DetectPcreJitStackTest01", DetectPcreJitStackTest01);
+    UtRegisterTest("DetectPcreHyperscanTest01", DetectPcreHyperscanTest01);
+    UtRegisterTest("DetectPcrePrecompileTest01", DetectPcrePrecompileTest01);
 
 #endif /* UNITTESTS */
 }
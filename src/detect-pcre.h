@@ -32,6 +32,7 @@
 #define DETECT_PCRE_MATCH_LIMIT         0x00020
 #define DETECT_PCRE_RELATIVE_NEXT       0x00040
 #define DETECT_PCRE_NEGATE              0x00080
+#define DETECT_PCRE_JIT                 0x00100 /**< re is jit compiled */
 
 typedef struct DetectPcreData_ {
     /* pcre options */
@@ -41,14 +42,27 @@ typedef struct DetectPcreData_ {
     uint16_t flags;
     uint16_t capidx;
     char *capname;
+    /** id of the per thread ctx holding the jit stack */
+    int thread_ctx_id;
+    /** hyperscan database of the regex (hs_database_t), NULL if hyperscan
+     *  isn't used for it */
+    void *hs_db;
+    /** hs_db matches exactly what the regex does. If not, it matches a
+     *  superset and only its misses are final */
+    int hs_exact;
+    /** id of the per thread ctx holding the hyperscan scratch */
+    int hs_thread_ctx_id;
 } DetectPcreData;
 
 /* prototypes */
-int DetectPcrePayloadMatch(DetectEngineThreadCtx *, Signature *, SigMatch *, Packet *, Flow *, uint8_t *, uint32_t);
+int DetectPcrePayloadMatch(DetectEngineThreadCtx *, Signature *, const SigMatchData *, Packet *, Flow *, uint8_t *, uint32_t);
 int DetectPcrePacketPayloadMatch(DetectEngineThreadCtx *, Packet *, Signature *, SigMatch *);
 int DetectPcrePayloadDoMatch(DetectEngineThreadCtx *, Signature *, SigMatch *,
                              Packet *, uint8_t *, uint16_t);
 void DetectPcreRegister (void);
 
+uint32_t DetectPcrePrecompile(DetectEngineCtx *de_ctx, char **sigs, uint32_t cnt);
+void DetectPcrePrecompiledFree(DetectEngineCtx *de_ctx);
+
 #endif /* __DETECT_PCRE_H__ */
 
@@ -59,11 +59,6 @@
 #include "util-cpu.h"
 #endif
 
-#define PARSE_REGEX "^\\s*(track|type|count|seconds)\\s+(limit|both|threshold|by_dst|by_src|\\d+)\\s*,\\s*(track|type|count|seconds)\\s+(limit|both|threshold|by_dst|by_src|\\d+)\\s*,\\s*(track|type|count|seconds)\\s+(limit|both|threshold|by_dst|by_src|\\d+)\\s*,\\s*(track|type|count|seconds)\\s+(limit|both|threshold|by_dst|by_src|\\d+)\\s*"
-
-static pcre *parse_regex;
-static pcre_extra *parse_regex_study;
-
 static int DetectThresholdMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, const SigMatchCtx *);
 static int DetectThresholdSetup(DetectEngineCtx *, Signature *, char *);
 static void DetectThresholdFree(void *);
@@ -83,8 +78,6 @@ void DetectThresholdRegister(void)
     sigmatch_table[DETECT_THRESHOLD].RegisterTests = ThresholdRegisterTests;
     /* this is compatible to ip-only signatures */
     sigmatch_table[DETECT_THRESHOLD].flags |= SIGMATCH_IPONLY_COMPAT;
-
-    DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
 static int DetectThresholdMatch(ThreadVars *thv, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
@@ -104,49 +97,10 @@ static int DetectThresholdMatch(ThreadVars *thv, DetectEngineThreadCtx *det_ctx,
 static DetectThresholdData *DetectThresholdParse(char *rawstr)
 {
     DetectThresholdData *de = NULL;
-#define MAX_SUBSTRINGS 30
-    int ret = 0, res = 0;
-    int ov[MAX_SUBSTRINGS];
-    const char *str_ptr = NULL;
-    char *args[9] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-    char *copy_str = NULL, *threshold_opt = NULL;
-    int second_found = 0, count_found = 0;
+    DetectParseLexer lex;
+    DetectParseToken tok, name, value;
+    int count_found = 0, second_found = 0;
     int type_found = 0, track_found = 0;
-    int second_pos = 0, count_pos = 0;
-    uint16_t pos = 0;
-    int i = 0;
-
-    copy_str = SCStrdup(rawstr);
-    if (unlikely(copy_str == NULL)) {
-        goto error;
-    }
-
-    char *saveptr = NULL;
-    for (pos = 0, threshold_opt = strtok_r(copy_str,",", &saveptr);
-         pos < strlen(copy_str) && threshold_opt != NULL;
-         pos++, threshold_opt = strtok_r(NULL,"," , &saveptr))
-    {
-        if(strstr(threshold_opt,"count"))
-            count_found++;
-        if(strstr(threshold_opt,"second"))
-            second_found++;
-        if(strstr(threshold_opt,"type"))
-            type_found++;
-        if(strstr(threshold_opt,"track"))
-            track_found++;
-    }
-    SCFree(copy_str);
-    copy_str = NULL;
-
-    if(count_found != 1 || second_found != 1 || type_found != 1 || track_found != 1)
-        goto error;
-
-    ret = pcre_exec(parse_regex, parse_regex_study, rawstr, strlen(rawstr), 0, 0, ov, MAX_SUBSTRINGS);
-
-    if (ret < 5) {
-        SCLogError(SC_ERR_PCRE_MATCH, "pcre_exec parse error, ret %" PRId32 ", string %s", ret, rawstr);
-        goto error;
-    }
 
     de = SCMalloc(sizeof(DetectThresholdData));
     if (unlikely(de == NULL))
@@ -154,56 +108,51 @@ static DetectThresholdData *DetectThresholdParse(char *rawstr)
 
     memset(de,0,sizeof(DetectThresholdData));
 
-    for (i = 0; i < (ret - 1); i++) {
-
-        res = pcre_get_substring((char *)rawstr, ov, MAX_SUBSTRINGS,i + 1, &str_ptr);
-
-        if (res < 0) {
-            SCLogError(SC_ERR_PCRE_GET_SUBSTRING, "pcre_get_substring failed");
-            goto error;
+    DetectParseLexerInit(&lex, rawstr, ',');
+    while (DetectParseLexerNext(&lex, &tok)) {
+        if (DetectParseTokenSplit(&tok, &name, &value) != 0 || value.len == 0)
+            goto parse_error;
+
+        if (DetectParseTokenIs(&name, "type")) {
+            if (DetectParseTokenIs(&value, "limit"))
+                de->type = TYPE_LIMIT;
+            else if (DetectParseTokenIs(&value, "both"))
+                de->type = TYPE_BOTH;
+            else if (DetectParseTokenIs(&value, "threshold"))
+                de->type = TYPE_THRESHOLD;
+            else
+                goto parse_error;
+            type_found++;
+        } else if (DetectParseTokenIs(&name, "track")) {
+            if (DetectParseTokenIs(&value, "by_dst"))
+                de->track = TRACK_DST;
+            else if (DetectParseTokenIs(&value, "by_src"))
+                de->track = TRACK_SRC;
+            else
+                goto parse_error;
+            track_found++;
+        } else if (DetectParseTokenIs(&name, "count")) {
+            if (DetectParseTokenToUint32(&value, &de->count) != 0)
+                goto parse_error;
+            count_found++;
+        } else if (DetectParseTokenIs(&name, "seconds")) {
+            if (DetectParseTokenToUint32(&value, &de->seconds) != 0)
+                goto parse_error;
+            second_found++;
+        } else {
+            goto parse_error;
         }
-
-        args[i] = (char *)str_ptr;
-
-        if (strncasecmp(args[i],"limit",strlen("limit")) == 0)
-            de->type = TYPE_LIMIT;
-        if (strncasecmp(args[i],"both",strlen("both")) == 0)
-            de->type = TYPE_BOTH;
-        if (strncasecmp(args[i],"threshold",strlen("threshold")) == 0)
-            de->type = TYPE_THRESHOLD;
-        if (strncasecmp(args[i],"by_dst",strlen("by_dst")) == 0)
-            de->track = TRACK_DST;
-        if (strncasecmp(args[i],"by_src",strlen("by_src")) == 0)
-            de->track = TRACK_SRC;
-        if (strncasecmp(args[i],"count",strlen("count")) == 0)
-            count_pos = i+1;
-        if (strncasecmp(args[i],"seconds",strlen("seconds")) == 0)
-            second_pos = i+1;
     }
 
-    if (args[count_pos] == NULL || args[second_pos] == NULL) {
-        goto error;
-    }
-
-    if (ByteExtractStringUint32(&de->count, 10, strlen(args[count_pos]),
-                args[count_pos]) <= 0) {
-        goto error;
-    }
-
-    if (ByteExtractStringUint32(&de->seconds, 10, strlen(args[second_pos]),
-                args[second_pos]) <= 0) {
-        goto error;
-    }
+    if(count_found != 1 || second_found != 1 || type_found != 1 || track_found != 1)
+        goto parse_error;
 
-    for (i = 0; i < (ret - 1); i++){
-        if (args[i] != NULL) SCFree(args[i]);
-    }
     return de;
 
+parse_error:
+    SCLogError(SC_ERR_INVALID_VALUE, "invalid threshold options \"%s\", "
+            "need type, track, count and seconds once each", rawstr);
 error:
-    for (i = 0; i < (ret - 1); i++){
-        if (args[i] != NULL) SCFree(args[i]);
-    }
     if (de != NULL)
         SCFree(de);
     return NULL;
@@ -603,19 +552,11 @@ static int DetectThresholdTestSig3(void)
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
 
-    Host *host = HostLookupHostFromHash(&p->dst);
-    if (host == NULL) {
-        printf("host not found: ");
+    if (ThresholdLookupEntry(&p->dst, 10, 1) == NULL) {
+        printf("no threshold for dst: ");
         goto cleanup;
     }
 
-    if (!(ThresholdHostHasThreshold(host))) {
-        HostRelease(host);
-        printf("host has no threshold: ");
-        goto cleanup;
-    }
-    HostRelease(host);
-
     TimeSetIncrementTime(200);
     TimeGet(&p->ts);
 
@@ -623,16 +564,8 @@ static int DetectThresholdTestSig3(void)
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
     SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
 
-    host = HostLookupHostFromHash(&p->dst);
-    if (host == NULL) {
-        printf("host not found: ");
-        goto cleanup;
-    }
-    HostRelease(host);
-
-    lookup_tsh = HostGetStorageById(host, ThresholdHostStorageId());
+    lookup_tsh = ThresholdLookupEntry(&p->dst, 10, 1);
     if (lookup_tsh == NULL) {
-        HostRelease(host);
         printf("lookup_tsh is NULL: ");
         goto cleanup;
     }
@@ -1471,6 +1404,93 @@ end:
     return result;
 }
 
+/**
+ * \test two by_src rules on the same address keep their own state and
+ *       the state is removed once timed out.
+ */
+static int DetectThresholdTestSig13(void)
+{
+    Packet *p = NULL;
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx;
+    int result = 0;
+    int alerts10 = 0;
+    int alerts11 = 0;
+
+    HostInitConfig(HOST_QUIET);
+
+    memset(&th_v, 0, sizeof(th_v));
+
+    p = UTHBuildPacketReal((uint8_t *)"A",1,IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx,"alert tcp any any -> any 80 (threshold: type limit, track by_src, count 1, seconds 60; sid:10;)");
+    if (de_ctx->sig_list == NULL) {
+        goto end;
+    }
+    de_ctx->sig_list->next = SigInit(de_ctx,"alert tcp any any -> any 80 (threshold: type limit, track by_src, count 2, seconds 60; sid:11;)");
+    if (de_ctx->sig_list->next == NULL) {
+        goto end;
+    }
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    TimeGet(&p->ts);
+
+    int i;
+    for (i = 0; i < 3; i++) {
+        SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+        alerts10 += PacketAlertCheck(p, 10);
+        alerts11 += PacketAlertCheck(p, 11);
+    }
+
+    if (alerts10 != 1 || alerts11 != 2) {
+        printf("alerts %d/%d != 1/2: ", alerts10, alerts11);
+        goto cleanup;
+    }
+
+    if (ThresholdLookupEntry(&p->src, 10, 1) == NULL ||
+        ThresholdLookupEntry(&p->src, 11, 1) == NULL) {
+        printf("missing threshold entry: ");
+        goto cleanup;
+    }
+    if (ThresholdLookupEntry(&p->dst, 10, 1) != NULL) {
+        printf("entry for dst: ");
+        goto cleanup;
+    }
+
+    struct timeval ts = p->ts;
+    ts.tv_sec += 61;
+    if (ThresholdsTimeoutHash(&ts) != 2) {
+        printf("expected 2 entries to time out: ");
+        goto cleanup;
+    }
+    if (ThresholdLookupEntry(&p->src, 10, 1) != NULL) {
+        printf("entry not removed: ");
+        goto cleanup;
+    }
+
+    result = 1;
+
+cleanup:
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void*)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+end:
+    UTHFreePackets(&p, 1);
+    HostShutdown();
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void ThresholdRegisterTests(void)
@@ -1494,6 +1514,7 @@ void ThresholdRegisterTests(void)
     UtRegisterTest("DetectThresholdTestSig10", DetectThresholdTestSig10);
     UtRegisterTest("DetectThresholdTestSig11", DetectThresholdTestSig11);
     UtRegisterTest("DetectThresholdTestSig12", DetectThresholdTestSig12);
+    UtRegisterTest("DetectThresholdTestSig13", DetectThresholdTestSig13);
 #endif /* UNITTESTS */
 }
 
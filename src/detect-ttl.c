@@ -29,6 +29,7 @@
 
 #include "detect.h"
 #include "detect-parse.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-ttl.h"
 #include "util-debug.h"
@@ -46,6 +47,7 @@ int DetectTtlMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *
 static int DetectTtlSetup (DetectEngineCtx *, Signature *, char *);
 void DetectTtlFree (void *);
 void DetectTtlRegisterTests (void);
+static int PrefilterSetupTtl(SigGroupHead *sgh);
 
 /**
  * \brief Registration function for ttl: keyword
@@ -60,11 +62,27 @@ void DetectTtlRegister(void)
     sigmatch_table[DETECT_TTL].Setup = DetectTtlSetup;
     sigmatch_table[DETECT_TTL].Free = DetectTtlFree;
     sigmatch_table[DETECT_TTL].RegisterTests = DetectTtlRegisterTests;
+    sigmatch_table[DETECT_TTL].SetupPrefilter = PrefilterSetupTtl;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
     return;
 }
 
+static inline int TtlMatch(const uint8_t pttl, const uint8_t mode,
+                           const uint8_t dttl1, const uint8_t dttl2)
+{
+    if (mode == DETECT_TTL_EQ && pttl == dttl1)
+        return 1;
+    else if (mode == DETECT_TTL_LT && pttl < dttl1)
+        return 1;
+    else if (mode == DETECT_TTL_GT && pttl > dttl1)
+        return 1;
+    else if (mode == DETECT_TTL_RA && (pttl > dttl1 && pttl < dttl2))
+        return 1;
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match TTL rule option on a packet with those passed via ttl:
  *
@@ -79,7 +97,6 @@ void DetectTtlRegister(void)
 int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, const SigMatchCtx *ctx)
 {
 
-    int ret = 0;
     uint8_t pttl;
     const DetectTtlData *ttld = (const DetectTtlData *)ctx;
 
@@ -92,19 +109,42 @@ int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
         pttl = IPV6_GET_HLIM(p);
     } else {
         SCLogDebug("Packet is of not IPv4 or IPv6");
-        return ret;
+        return 0;
     }
 
-    if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
-        ret = 1;
+    return TtlMatch(pttl, ttld->mode, ttld->ttl1, ttld->ttl2);
+}
+
+/* prefilter */
+
+static void PrefilterPacketTtlMatch(DetectEngineThreadCtx *det_ctx, Packet *p, const void *pectx)
+{
+    uint8_t pttl;
 
-    return ret;
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_IPV4(p)) {
+        pttl = IPV4_GET_IPTTL(p);
+    } else if (PKT_IS_IPV6(p)) {
+        pttl = IPV6_GET_HLIM(p);
+    } else {
+        return;
+    }
+
+    PrefilterPacketU8HashAddSids(det_ctx, pectx, pttl);
+}
+
+static int PrefilterTtlCompare(uint8_t value, const SigMatchCtx *ctx)
+{
+    const DetectTtlData *ttld = (const DetectTtlData *)ctx;
+    return TtlMatch(value, ttld->mode, ttld->ttl1, ttld->ttl2);
+}
+
+static int PrefilterSetupTtl(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_TTL,
+            PrefilterTtlCompare, PrefilterPacketTtlMatch);
 }
 
 /**
@@ -48,6 +48,7 @@
 #include "util-var-name.h"
 #include "util-unittest.h"
 #include "util-debug.h"
+#include "util-state-sync.h"
 
 /*
     xbits:set,bitname,track ip_pair,expire 60
@@ -77,6 +78,19 @@ void DetectXbitsRegister (void)
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+/** \internal
+ *  \brief replicate a bit change to the other sensors. Pair is locked. */
+static void DetectIPPairbitSync(Packet *p, IPPair *pair, const DetectXbitsData *fd)
+{
+    if (likely(!(state_sync_flags & STATE_SYNC_XBITS)) || fd->name == NULL)
+        return;
+
+    /* a toggle is sent as the state it resulted in */
+    int set = (fd->cmd == DETECT_XBITS_CMD_UNSET) ? 0 :
+        IPPairBitIsset(pair, fd->idx, p->ts.tv_sec);
+    StateSyncIPPairBit(&p->src, &p->dst, fd->name, set, fd->expire);
+}
+
 static int DetectIPPairbitMatchToggle (Packet *p, const DetectXbitsData *fd)
 {
     IPPair *pair = IPPairGetIPPairFromHash(&p->src, &p->dst);
@@ -84,6 +98,7 @@ static int DetectIPPairbitMatchToggle (Packet *p, const DetectXbitsData *fd)
         return 0;
 
     IPPairBitToggle(pair,fd->idx,p->ts.tv_sec + fd->expire);
+    DetectIPPairbitSync(p, pair, fd);
     IPPairRelease(pair);
     return 1;
 }
@@ -96,6 +111,7 @@ static int DetectIPPairbitMatchUnset (Packet *p, const DetectXbitsData *fd)
         return 1;
 
     IPPairBitUnset(pair,fd->idx);
+    DetectIPPairbitSync(p, pair, fd);
     IPPairRelease(pair);
     return 1;
 }
@@ -107,6 +123,7 @@ static int DetectIPPairbitMatchSet (Packet *p, const DetectXbitsData *fd)
         return 0;
 
     IPPairBitSet(pair, fd->idx, p->ts.tv_sec + fd->expire);
+    DetectIPPairbitSync(p, pair, fd);
     IPPairRelease(pair);
     return 1;
 }
@@ -292,6 +309,12 @@ int DetectXbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
     cd->tracker = hb_dir;
     cd->type = var_type;
     cd->expire = expire;
+    cd->name = NULL;
+    if (fb_cmd != DETECT_XBITS_CMD_ISSET && fb_cmd != DETECT_XBITS_CMD_ISNOTSET) {
+        cd->name = SCStrdup(fb_name);
+        if (unlikely(cd->name == NULL))
+            goto error;
+    }
 
     SCLogDebug("idx %" PRIu32 ", cmd %s, name %s",
         cd->idx, fb_cmd_str, strlen(fb_name) ? fb_name : "(none)");
@@ -326,7 +349,7 @@ int DetectXbitSetup (DetectEngineCtx *de_ctx, Signature *s, char *rawstr)
 
 error:
     if (cd != NULL)
-        SCFree(cd);
+        DetectXbitFree(cd);
     if (sm != NULL)
         SCFree(sm);
     return -1;
@@ -339,6 +362,8 @@ void DetectXbitFree (void *ptr)
     if (fd == NULL)
         return;
 
+    if (fd->name != NULL)
+        SCFree(fd->name);
     SCFree(fd);
 }
 
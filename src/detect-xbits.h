@@ -44,6 +44,8 @@ typedef struct DetectXbitsData_ {
     uint32_t expire;
     /** data type: host/ippair/flow used for sig sorting in sigorder */
     enum VarTypes type;
+    /** bit name, for state sync as the idx is local to the detect engine */
+    char *name;
 } DetectXbitsData;
 
 /* prototypes */
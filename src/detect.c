@@ -41,6 +41,7 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
 #include "detect-engine-iponly.h"
 #include "detect-engine-threshold.h"
 
@@ -106,12 +107,15 @@
 #include "detect-filestore.h"
 #include "detect-filemagic.h"
 #include "detect-filemd5.h"
+#include "detect-filesha1.h"
+#include "detect-filesha256.h"
 #include "detect-filesize.h"
 #include "detect-dsize.h"
 #include "detect-flowvar.h"
 #include "detect-flowint.h"
 #include "detect-pktvar.h"
 #include "detect-noalert.h"
+#include "detect-bypass.h"
 #include "detect-flowbits.h"
 #include "detect-hostbits.h"
 #include "detect-xbits.h"
@@ -146,8 +150,13 @@
 #include "detect-engine-hsmd.h"
 #include "detect-engine-hscd.h"
 #include "detect-engine-hua.h"
+#include "detect-engine-http-combined.h"
 #include "detect-engine-hhhd.h"
 #include "detect-engine-hrhhd.h"
+#include "detect-engine-memuse.h"
+#include "detect-engine-fp-feedback.h"
+#include "detect-engine-rule-budget.h"
+#include "detect-engine-alert-aggregate.h"
 #include "detect-byte-extract.h"
 #include "detect-file-data.h"
 #include "detect-pkt-data.h"
@@ -187,6 +196,7 @@
 
 #include "stream-tcp.h"
 #include "stream-tcp-inline.h"
+#include "stream-tcp-reassemble.h"
 
 #include "util-var-name.h"
 #include "util-classification-config.h"
@@ -201,6 +211,7 @@
 #include "util-validate.h"
 #include "util-optimize.h"
 #include "util-path.h"
+#include "util-load-shed.h"
 #include "util-mpm-ac.h"
 #include "runmodes.h"
 
@@ -284,6 +295,11 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
     char line[DETECT_MAX_RULE_SIZE] = "";
     size_t offset = 0;
     int lineno = 0, multiline = 0;
+    /* the rules of the file and the line each starts at */
+    char **sigs = NULL;
+    int *sig_lines = NULL;
+    uint32_t sig_cnt = 0, sig_size = 0;
+    uint32_t i;
 
     (*goodsigs) = 0;
     (*badsigs) = 0;
@@ -325,38 +341,88 @@ static int DetectLoadSigFile(DetectEngineCtx *de_ctx, char *sig_file,
         /* Reset offset. */
         offset = 0;
 
+        if (sig_cnt == sig_size) {
+            uint32_t size = sig_size ? sig_size * 2 : 1024;
+            char **ptmp = SCRealloc(sigs, size * sizeof(char *));
+            int *ltmp = ptmp ? SCRealloc(sig_lines, size * sizeof(int)) : NULL;
+            if (ptmp != NULL)
+                sigs = ptmp;
+            if (ltmp == NULL)
+                goto error;
+            sig_lines = ltmp;
+            sig_size = size;
+        }
+        sigs[sig_cnt] = SCStrdup(line);
+        if (sigs[sig_cnt] == NULL)
+            goto error;
+        sig_lines[sig_cnt++] = lineno - multiline;
+        multiline = 0;
+    }
+    fclose(fp);
+    fp = NULL;
+
+    /* the regexes don't depend on the order, so they can be compiled in
+     * parallel. The rules themselves are parsed in file order, so sids,
+     * var names and duplicate handling stay the same as before. */
+    if (DetectPcrePrecompile(de_ctx, sigs, sig_cnt) > 0) {
+        SCLogDebug("precompiled the pcre keywords of %s", sig_file);
+    }
+
+    for (i = 0; i < sig_cnt; i++) {
+        char *sigstr = sigs[i];
+        int sigline = sig_lines[i];
+
         de_ctx->rule_file = sig_file;
-        de_ctx->rule_line = lineno - multiline;
+        de_ctx->rule_line = sigline;
 
-        sig = DetectEngineAppendSig(de_ctx, line);
+        sig = DetectEngineAppendSig(de_ctx, sigstr);
         if (sig != NULL) {
             if (rule_engine_analysis_set || fp_engine_analysis_set) {
-                RetrieveFPForSig(sig);
+                RetrieveFPForSig(de_ctx, sig);
                 if (fp_engine_analysis_set) {
-                    EngineAnalysisFP(sig, line);
+                    EngineAnalysisFP(sig, sigstr);
                 }
                 if (rule_engine_analysis_set) {
-                    EngineAnalysisRules(sig, line);
+                    EngineAnalysisRules(sig, sigstr);
                 }
             }
             SCLogDebug("signature %"PRIu32" loaded", sig->id);
             good++;
         } else {
             SCLogError(SC_ERR_INVALID_SIGNATURE, "error parsing signature \"%s\" from "
-                 "file %s at line %"PRId32"", line, sig_file, lineno - multiline);
+                 "file %s at line %"PRId32"", sigstr, sig_file, sigline);
 
             if (rule_engine_analysis_set) {
-                EngineAnalysisRulesFailure(line, sig_file, lineno - multiline);
+                EngineAnalysisRulesFailure(sigstr, sig_file, sigline);
             }
             bad++;
         }
-        multiline = 0;
     }
-    fclose(fp);
+    DetectPcrePrecompiledFree(de_ctx);
+
+    for (i = 0; i < sig_cnt; i++)
+        SCFree(sigs[i]);
+    if (sigs != NULL)
+        SCFree(sigs);
+    if (sig_lines != NULL)
+        SCFree(sig_lines);
 
     *goodsigs = good;
     *badsigs = bad;
     return 0;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for the rules "
+            "of %s", sig_file);
+    if (fp != NULL)
+        fclose(fp);
+    for (i = 0; i < sig_cnt; i++)
+        SCFree(sigs[i]);
+    if (sigs != NULL)
+        SCFree(sigs);
+    if (sig_lines != NULL)
+        SCFree(sig_lines);
+    return -1;
 }
 
 /**
@@ -590,19 +656,27 @@ SigGroupHead *SigMatchSignaturesGetSgh(DetectEngineCtx *de_ctx, DetectEngineThre
                 de_ctx->flow_gh[1].tcp, de_ctx->flow_gh[0].tcp, de_ctx->flow_gh[f].tcp);
         uint16_t port = f ? p->dp : p->sp;
         SCLogDebug("tcp port %u -> %u:%u", port, p->sp, p->dp);
-        DetectPort *sghport = DetectPortLookupGroup(list, port);
-        if (sghport != NULL)
-            sgh = sghport->sh;
-        SCLogDebug("TCP list %p, port %u, direction %s, sghport %p, sgh %p",
-                list, port, f ? "toserver" : "toclient", sghport, sgh);
+        if (de_ctx->flow_gh[f].tcp_table.sh != NULL) {
+            sgh = DetectPortLookupTableGet(&de_ctx->flow_gh[f].tcp_table, port);
+        } else {
+            DetectPort *sghport = DetectPortLookupGroup(list, port);
+            if (sghport != NULL)
+                sgh = sghport->sh;
+        }
+        SCLogDebug("TCP list %p, port %u, direction %s, sgh %p",
+                list, port, f ? "toserver" : "toclient", sgh);
     } else if (proto == IPPROTO_UDP) {
         DetectPort *list = de_ctx->flow_gh[f].udp;
         uint16_t port = f ? p->dp : p->sp;
-        DetectPort *sghport = DetectPortLookupGroup(list, port);
-        if (sghport != NULL)
-            sgh = sghport->sh;
-        SCLogDebug("UDP list %p, port %u, direction %s, sghport %p, sgh %p",
-                list, port, f ? "toserver" : "toclient", sghport, sgh);
+        if (de_ctx->flow_gh[f].udp_table.sh != NULL) {
+            sgh = DetectPortLookupTableGet(&de_ctx->flow_gh[f].udp_table, port);
+        } else {
+            DetectPort *sghport = DetectPortLookupGroup(list, port);
+            if (sghport != NULL)
+                sgh = sghport->sh;
+        }
+        SCLogDebug("UDP list %p, port %u, direction %s, sgh %p",
+                list, port, f ? "toserver" : "toclient", sgh);
     } else {
         sgh = de_ctx->flow_gh[f].sgh[proto];
     }
@@ -845,6 +919,82 @@ static void QuickSortSigIntId(SigIntId *sids, uint32_t n)
     QuickSortSigIntId(l, sids + n - l);
 }
 
+/** minimal number of pmq entries to consider the bitmap sort */
+#define PMQ_BITMAP_SORT_MIN_CNT     64
+/** max bitmap words to scan per pmq entry. Above this the ids are too
+ *  sparse and the quicksort is used. */
+#define PMQ_BITMAP_SORT_MAX_DENSITY 4
+
+/** \internal
+ *  \brief sort and dedup the pmq using the thread's signature bitmap
+ *
+ *  Each id sets its bit, then the words between the lowest and highest
+ *  id are scanned and turned back into a sorted list. This is linear in
+ *  the number of ids and doesn't degrade on the many duplicates a long
+ *  buffer with common patterns produces.
+ *
+ *  \retval 1 sorted
+ *  \retval 0 not used, ids too sparse */
+static int DetectPrefilterSortPmqBitmap(DetectEngineThreadCtx *det_ctx)
+{
+    SigIntId *ids = det_ctx->pmq.rule_id_array;
+    const uint32_t cnt = det_ctx->pmq.rule_id_array_cnt;
+    uint64_t *bitmap = det_ctx->pmq_bitmap;
+    SigIntId min = ids[0], max = ids[0];
+    uint32_t i;
+
+    for (i = 1; i < cnt; i++) {
+        if (ids[i] < min)
+            min = ids[i];
+        else if (ids[i] > max)
+            max = ids[i];
+    }
+
+    const uint32_t lo = min / 64;
+    const uint32_t hi = max / 64;
+    BUG_ON(hi >= det_ctx->pmq_bitmap_words);
+    if ((hi - lo + 1) > cnt * PMQ_BITMAP_SORT_MAX_DENSITY)
+        return 0;
+
+    for (i = 0; i < cnt; i++) {
+        bitmap[ids[i] / 64] |= (1ULL << (ids[i] % 64));
+    }
+
+    /* collect and clear the bitmap for the next use */
+    uint32_t out = 0;
+    uint32_t w;
+    for (w = lo; w <= hi; w++) {
+        uint64_t word = bitmap[w];
+        if (word == 0)
+            continue;
+        bitmap[w] = 0;
+
+        do {
+            ids[out++] = (SigIntId)(w * 64 + __builtin_ctzll(word));
+            word &= word - 1;
+        } while (word != 0);
+    }
+    det_ctx->pmq.rule_id_array_cnt = out;
+    return 1;
+}
+
+/** \internal
+ *  \brief sort the pmq so it can be merged with the non-mpm list
+ *  NOTE due to merging of 'stream' pmqs and prefilter engines we *MAY*
+ *  have duplicate entries. */
+static inline void DetectPrefilterSortPmq(DetectEngineThreadCtx *det_ctx)
+{
+    if (det_ctx->pmq.rule_id_array_cnt < 2)
+        return;
+
+    if (det_ctx->pmq.rule_id_array_cnt >= PMQ_BITMAP_SORT_MIN_CNT &&
+        det_ctx->pmq_bitmap != NULL &&
+        DetectPrefilterSortPmqBitmap(det_ctx) == 1)
+        return;
+
+    QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
+}
+
 #define SMS_USE_FLOW_SGH        0x01
 #define SMS_USED_PM             0x02
 
@@ -862,6 +1012,23 @@ static void QuickSortSigIntId(SigIntId *sids, uint32_t n)
  * \param has_state    Bool indicating we have (al)state
  * \param sms_runflags Used to store state by detection engine.
  */
+/** \internal
+ *  \brief check if one of the smsgs holds all of the packet's payload
+ *
+ *  The smsgs are of the packet's direction, see SigMatchSignaturesGetSmsg().
+ */
+static inline int DetectSmsgsCoverPayload(const Packet *p, const StreamMsg *smsg)
+{
+    const uint32_t seq = TCP_GET_SEQ(p);
+    const uint32_t end = seq + p->payload_len;
+
+    for ( ; smsg != NULL; smsg = smsg->next) {
+        if (SEQ_LEQ(smsg->seq, seq) && SEQ_GEQ(smsg->seq + smsg->data_len, end))
+            return 1;
+    }
+    return 0;
+}
+
 static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
         DetectEngineThreadCtx *det_ctx, StreamMsg *smsg, Packet *p,
         const uint8_t flags, const AppProto alproto,
@@ -869,6 +1036,8 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
 {
     SCEnter();
 
+    int stream_covered = 0;
+
     /* have a look at the reassembled stream (if any) */
     if (p->flowflags & FLOW_PKT_ESTABLISHED) {
         SCLogDebug("p->flowflags & FLOW_PKT_ESTABLISHED");
@@ -898,6 +1067,12 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
                 if (p->flowflags & FLOW_PKT_TOSERVER) {
                     tx_progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags);
 
+                    if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_HTTP_TS) {
+                        PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_HTTP);
+                        DetectEngineRunHttpCombinedMpm(det_ctx, tx, tx_progress);
+                        PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM_HTTP);
+                    }
+
                     if (tx_progress > HTP_REQUEST_LINE) {
                         if (det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_URI) {
                             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_URI);
@@ -1072,6 +1247,10 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_STREAM);
             StreamPatternSearch(det_ctx, p, smsg, flags);
             PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM_STREAM);
+
+            if ((det_ctx->sgh->flags & SIG_GROUP_HEAD_MPM_PACKET_DEDUP) &&
+                p->payload_len > 0)
+                stream_covered = DetectSmsgsCoverPayload(p, smsg);
         } else {
             SCLogDebug("smsg NULL or no stream mpm for this sgh");
         }
@@ -1092,7 +1271,16 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
                     det_ctx->sgh, det_ctx->sgh->sig_cnt);
 
             PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM_PACKET);
-            PacketPatternSearch(det_ctx, p);
+            if (stream_covered) {
+                /* the stream mpm found the patterns it shares with the
+                 * packet mpm already */
+                PacketOnlyPatternSearch(det_ctx, p);
+                StatsIncr(det_ctx->tv, det_ctx->counter_mpm_dedup);
+                StatsAddUI64(det_ctx->tv, det_ctx->counter_mpm_dedup_bytes,
+                        (uint64_t)p->payload_len);
+            } else {
+                PacketPatternSearch(det_ctx, p);
+            }
             PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM_PACKET);
 
             *sms_runflags |= SMS_USED_PM;
@@ -1128,12 +1316,6 @@ static inline void DetectMpmPrefilter(DetectEngineCtx *de_ctx,
             }
         }
     }
-
-    /* Sort the rule list to lets look at pmq.
-     * NOTE due to merging of 'stream' pmqs we *MAY* have duplicate entries */
-    if (det_ctx->pmq.rule_id_array_cnt > 1) {
-        QuickSortSigIntId(det_ctx->pmq.rule_id_array, det_ctx->pmq.rule_id_array_cnt);
-    }
 }
 
 #ifdef DEBUG
@@ -1152,13 +1334,10 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
 #define MALLOC_JUMP 5
 
     int i = 0;
+    uint16_t idx = 0;
 
-    GenericVar *gv = p->flow->flowvar;
-
-    while (gv != NULL) {
+    while (FlowBitGetNext(p->flow, &idx))
         i++;
-        gv = gv->next;
-    }
     if (i == 0)
         return;
 
@@ -1173,15 +1352,9 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
            sizeof(char *) * p->debuglog_flowbits_names_len);
 
     i = 0;
-    gv = p->flow->flowvar;
-    while (gv != NULL) {
-        if (gv->type != DETECT_FLOWBITS) {
-            gv = gv->next;
-            continue;
-        }
-
-        FlowBit *fb = (FlowBit *) gv;
-        char *name = VariableIdxGetName(de_ctx, fb->idx, VAR_TYPE_FLOW_BIT);
+    idx = 0;
+    while (FlowBitGetNext(p->flow, &idx)) {
+        char *name = VariableIdxGetName(de_ctx, idx, VAR_TYPE_FLOW_BIT);
         if (name != NULL) {
             p->debuglog_flowbits_names[i] = SCStrdup(name);
             if (p->debuglog_flowbits_names[i] == NULL) {
@@ -1206,8 +1379,6 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
                    p->debuglog_flowbits_names_len - MALLOC_JUMP,
                    0, sizeof(char *) * MALLOC_JUMP);
         }
-
-        gv = gv->next;
     }
 
     return;
@@ -1215,15 +1386,24 @@ static void AlertDebugLogModeSyncFlowbitsNamesToPacketStruct(Packet *p, DetectEn
 
 static inline void DetectPrefilterBuildNonMpmList(DetectEngineThreadCtx *det_ctx, SignatureMask mask)
 {
-    uint32_t x = 0;
-    for (x = 0; x < det_ctx->non_mpm_store_cnt; x++) {
-        /* only if the mask matches this rule can possibly match,
-         * so build the non_mpm array only for match candidates */
-        SignatureMask rule_mask = det_ctx->non_mpm_store_ptr[x].mask;
-        if ((rule_mask & mask) == rule_mask) {
-            det_ctx->non_mpm_id_array[det_ctx->non_mpm_id_cnt++] = det_ctx->non_mpm_store_ptr[x].id;
-        }
+    const SignatureMask *rule_mask = det_ctx->non_mpm_store_ptr->mask;
+    const SigIntId *rule_id = det_ctx->non_mpm_store_ptr->id;
+    SigIntId *id_array = det_ctx->non_mpm_id_array;
+    const uint32_t store_cnt = det_ctx->non_mpm_store_cnt;
+    uint32_t cnt = 0;
+    uint32_t x;
+
+    /* only if the mask matches this rule can possibly match,
+     * so build the non_mpm array only for match candidates.
+     *
+     * The loop is branch free: every id is written to the next free
+     * slot, and the slot is only kept if the mask matched. The array
+     * is sized for the largest store, so the overwrite is always safe. */
+    for (x = 0; x < store_cnt; x++) {
+        id_array[cnt] = rule_id[x];
+        cnt += ((rule_mask[x] & mask) == rule_mask[x]);
     }
+    det_ctx->non_mpm_id_cnt = cnt;
 }
 
 /** \internal
@@ -1232,16 +1412,53 @@ static inline void DetectPrefilterBuildNonMpmList(DetectEngineThreadCtx *det_ctx
 static inline void DetectPrefilterSetNonMpmList(const Packet *p, DetectEngineThreadCtx *det_ctx)
 {
     if ((p->proto == IPPROTO_TCP) && (p->tcph != NULL) && (p->tcph->th_flags & TH_SYN)) {
-        det_ctx->non_mpm_store_ptr = det_ctx->sgh->non_mpm_syn_store_array;
+        det_ctx->non_mpm_store_ptr = &det_ctx->sgh->non_mpm_syn_store;
         det_ctx->non_mpm_store_cnt = det_ctx->sgh->non_mpm_syn_store_cnt;
     } else {
-        det_ctx->non_mpm_store_ptr = det_ctx->sgh->non_mpm_other_store_array;
+        det_ctx->non_mpm_store_ptr = &det_ctx->sgh->non_mpm_other_store;
         det_ctx->non_mpm_store_cnt = det_ctx->sgh->non_mpm_other_store_cnt;
     }
     SCLogDebug("sgh non_mpm ptr %p cnt %u (syn %p/%u, other %p/%u)",
             det_ctx->non_mpm_store_ptr, det_ctx->non_mpm_store_cnt,
-            det_ctx->sgh->non_mpm_syn_store_array, det_ctx->sgh->non_mpm_syn_store_cnt,
-            det_ctx->sgh->non_mpm_other_store_array, det_ctx->sgh->non_mpm_other_store_cnt);
+            det_ctx->sgh->non_mpm_syn_store.id, det_ctx->sgh->non_mpm_syn_store_cnt,
+            det_ctx->sgh->non_mpm_other_store.id, det_ctx->sgh->non_mpm_other_store_cnt);
+}
+
+/** \internal
+ *  \brief no rules inspect the raw stream of a direction of the flow, stop
+ *         creating stream msgs for it
+ *
+ *  \param f locked flow
+ *  \param direction 0 toserver, 1 toclient
+ */
+static inline void DetectDisableRawStream(Flow *f, char direction)
+{
+    if (f->proto != IPPROTO_TCP || f->protoctx == NULL)
+        return;
+
+    SCLogDebug("disabling raw stream reassembly for flow %s",
+            direction ? "toclient" : "toserver");
+    StreamTcpReassembleSkipRaw((TcpSession *)f->protoctx, direction);
+}
+
+/**
+ *  \brief the rules inspect only the start of the raw stream of a
+ *         direction of the flow, stop creating stream msgs past it
+ *
+ *  \param f locked flow
+ *  \param direction 0 toserver, 1 toclient
+ *  \param depth SigGroupHead::stream_inspect_depth
+ */
+static inline void DetectSetRawStreamDepth(Flow *f, char direction, uint32_t depth)
+{
+    if (depth == 0 || depth == SIG_GROUP_HEAD_DEPTH_UNLIMITED)
+        return;
+    if (f->proto != IPPROTO_TCP || f->protoctx == NULL)
+        return;
+
+    SCLogDebug("raw stream reassembly depth %u for flow %s", depth,
+            direction ? "toclient" : "toserver");
+    StreamTcpReassembleSetRawDepth((TcpSession *)f->protoctx, direction, depth);
 }
 
 /**
@@ -1255,9 +1472,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     uint8_t sms_runflags = 0;   /* function flags */
     uint8_t alert_flags = 0;
     AppProto alproto = ALPROTO_UNKNOWN;
-#ifdef PROFILING
     int smatch = 0; /* signature match: 1, no match: 0 */
-#endif
     uint8_t flow_flags = 0; /* flow/state flags */
     StreamMsg *smsg = NULL;
     Signature *s = NULL;
@@ -1276,6 +1491,9 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     det_ctx->filestore_cnt = 0;
 
     det_ctx->base64_decoded_len = 0;
+    det_ctx->load_shed_level = LoadShedLevel();
+
+    RULE_PROFILING_SAMPLE(det_ctx, p);
 
     /* No need to perform any detection on this packet, if the the given flag is set.*/
     if (p->flags & PKT_NOPACKET_INSPECTION) {
@@ -1324,6 +1542,7 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
                 pflow->de_ctx_id = de_ctx->id;
                 GenericVarFree(pflow->flowvar);
                 pflow->flowvar = NULL;
+                FlowBitClearAll(pflow);
 
                 DetectEngineStateReset(pflow->de_state,
                         (STREAM_TOSERVER|STREAM_TOCLIENT));
@@ -1352,6 +1571,12 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
                 PACKET_PROFILING_DETECT_END(p, PROF_DETECT_GETSGH);
 
                 smsg = SigMatchSignaturesGetSmsg(pflow, p, flow_flags);
+                /* overloaded: drop the raw stream chunks uninspected */
+                if (smsg != NULL && det_ctx->load_shed_level >= LOAD_SHED_RAW_STREAM) {
+                    StreamMsgReturnListToPool(smsg);
+                    smsg = NULL;
+                    StatsIncr(th_v, det_ctx->counter_load_shed_raw_stream);
+                }
 #if 0
                 StreamMsg *tmpsmsg = smsg;
                 while (tmpsmsg) {
@@ -1438,6 +1663,9 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
         PACKET_PROFILING_DETECT_END(p, PROF_DETECT_GETSGH);
     }
 
+    /* the flow keeps the full group, its settings cover all the rules */
+    SigGroupHead *flow_sgh = det_ctx->sgh;
+
     /* if we didn't get a sig group head, we
      * have nothing to do.... */
     if (det_ctx->sgh == NULL) {
@@ -1445,12 +1673,36 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
         goto end;
     }
 
+    if (det_ctx->load_shed_level > LOAD_SHED_NONE && (p->flags & PKT_HAS_FLOW)) {
+        /* overloaded: no detection at all for low priority flows */
+        if (det_ctx->load_shed_level >= LOAD_SHED_LOW_PRIORITY &&
+                LoadShedFlowIsLowPriority(pflow)) {
+            SCLogDebug("load shedding: skipping low priority flow");
+            StatsIncr(th_v, det_ctx->counter_load_shed_flow);
+            goto end;
+        }
+        /* the body buffer getters return nothing at this level */
+        if (det_ctx->load_shed_level >= LOAD_SHED_BODY &&
+                alproto == ALPROTO_HTTP && has_state) {
+            StatsIncr(th_v, det_ctx->counter_load_shed_body);
+        }
+    }
+
+    /* rules for other app layer protocols can't match, use the group
+     * without them */
+    if (det_ctx->sgh->alproto_sgh != NULL && alproto < ALPROTO_MAX) {
+        det_ctx->sgh = det_ctx->sgh->alproto_sgh[alproto];
+        SCLogDebug("alproto %u: sgh %p", alproto, det_ctx->sgh);
+    }
+
     DetectPrefilterSetNonMpmList(p, det_ctx);
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_STATEFUL);
     /* stateful app layer detection */
     if ((p->flags & PKT_HAS_FLOW) && has_state) {
-        memset(det_ctx->de_state_sig_array, 0x00, det_ctx->de_state_sig_array_len);
+        /* the array can be shared with larger tenants, only the part
+         * indexed by our sigs is used */
+        memset(det_ctx->de_state_sig_array, 0x00, de_ctx->sig_array_len);
         int has_inspectable_state = DeStateFlowHasInspectableState(pflow, alproto, alversion, flow_flags);
         if (has_inspectable_state == 1) {
             /* initialize to 0(DE_STATE_MATCH_HAS_NEW_STATE) */
@@ -1467,6 +1719,16 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     SignatureMask mask = 0;
     PacketCreateMask(p, &mask, alproto, has_state, smsg, app_decoder_events);
 
+    /* none of the rules of the group can match this packet, e.g. an
+     * empty ACK against payload rules: skip the prefilter and the rules.
+     * Stateful rules were continued above. */
+    if ((mask & det_ctx->sgh->mask_common) != det_ctx->sgh->mask_common) {
+        SCLogDebug("packet mask %04x lacks sgh common mask %04x", mask,
+                det_ctx->sgh->mask_common);
+        StatsIncr(th_v, det_ctx->counter_sgh_skipped);
+        goto end;
+    }
+
     /* build and prefilter non_mpm list against the mask of the packet */
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_NONMPMLIST);
     det_ctx->non_mpm_id_cnt = 0;
@@ -1478,7 +1740,18 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
     /* run the mpm for each type */
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_MPM);
     DetectMpmPrefilter(de_ctx, det_ctx, smsg, p, flow_flags, alproto, has_state, &sms_runflags);
+
+    /* run the prefilter engines of the rules without mpm */
+    if (det_ctx->sgh->engines != NULL) {
+        Prefilter(det_ctx, det_ctx->sgh, p);
+    }
+
+    /* sort the mpm and prefilter results for the merge with the non-mpm
+     * list. Done here once, as DetectMpmPrefilter has multiple exits. */
+    DetectPrefilterSortPmq(det_ctx);
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_MPM);
+    if (unlikely(det_ctx->fp_feedback != NULL))
+        DetectFPFeedbackSamplePmq(det_ctx);
 #ifdef PROFILING
     if (th_v) {
         StatsAddUI64(th_v, det_ctx->counter_mpm_list,
@@ -1522,12 +1795,16 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
         next_sflags = next_s->flags;
     }
 
+    DetectRuleBudget *rule_budget = NULL;
+    if (unlikely(det_ctx->rule_budget != NULL)) {
+        rule_budget = de_ctx->rule_budget;
+        DetectRuleBudgetSamplePacket(det_ctx);
+    }
+
     while (match_cnt--) {
         RULE_PROFILING_START(p);
         state_alert = 0;
-#ifdef PROFILING
         smatch = 0;
-#endif
 
         s = next_s;
         sflags = next_sflags;
@@ -1539,6 +1816,12 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
 
         SCLogDebug("inspecting signature id %"PRIu32"", s->id);
 
+        if (unlikely(rule_budget != NULL)) {
+            if (DetectRuleBudgetIsDisabled(rule_budget, s, p))
+                goto next;
+            DETECT_RULE_BUDGET_START(det_ctx);
+        }
+
         if ((s->mask & mask) != s->mask)
             goto next;
 
@@ -1752,9 +2035,8 @@ int SigMatchSignatures(ThreadVars *th_v, DetectEngineCtx *de_ctx, DetectEngineTh
             alert_flags |= PACKET_ALERT_FLAG_STATE_MATCH;
         }
 
-#ifdef PROFILING
         smatch = 1;
-#endif
+        DETECT_FP_FEEDBACK_CONFIRM(det_ctx, s);
 
         SigMatchSignaturesRunPostMatch(th_v, de_ctx, det_ctx, p, s);
 
@@ -1771,6 +2053,7 @@ next:
         DetectFlowvarProcessList(det_ctx, pflow);
         DetectReplaceFree(det_ctx);
         RULE_PROFILING_END(det_ctx, s, smatch, p);
+        DETECT_RULE_BUDGET_END(det_ctx, s, p);
 
         det_ctx->flags = 0;
         continue;
@@ -1778,10 +2061,6 @@ next:
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_RULES);
 
 end:
-#ifdef __SC_CUDA_SUPPORT__
-    CudaReleasePacket(p);
-#endif
-
     /* see if we need to increment the inspect_id and reset the de_state */
     if (has_state && AppLayerParserProtocolSupportsTxs(p->proto, alproto)) {
         PACKET_PROFILING_DETECT_START(p, PROF_DETECT_STATEFUL);
@@ -1798,6 +2077,9 @@ end:
     if (p->alerts.cnt > 0) {
         StatsAddUI64(th_v, det_ctx->counter_alerts, (uint64_t)p->alerts.cnt);
     }
+    if (det_ctx->alert_agg != NULL) {
+        AlertAggregatePacket(det_ctx, p);
+    }
     PACKET_PROFILING_DETECT_END(p, PROF_DETECT_ALERT);
 
     PACKET_PROFILING_DETECT_START(p, PROF_DETECT_CLEANUP);
@@ -1806,7 +2088,6 @@ end:
 
     DetectEngineCleanHCBDBuffers(det_ctx);
     DetectEngineCleanHSBDBuffers(det_ctx);
-    DetectEngineCleanHHDBuffers(det_ctx);
     DetectEngineCleanSMTPBuffers(det_ctx);
 
     /* store the found sgh (or NULL) in the flow to save us from looking it
@@ -1822,7 +2103,7 @@ end:
         if (!(sms_runflags & SMS_USE_FLOW_SGH)) {
             if ((p->flowflags & FLOW_PKT_TOSERVER) && !(pflow->flags & FLOW_SGH_TOSERVER)) {
                 /* first time we see this toserver sgh, store it */
-                pflow->sgh_toserver = det_ctx->sgh;
+                pflow->sgh_toserver = flow_sgh;
                 pflow->flags |= FLOW_SGH_TOSERVER;
 
                 /* see if this sgh requires us to consider file storing */
@@ -1838,11 +2119,12 @@ end:
                     FileDisableMagic(pflow, STREAM_TOSERVER);
                 }
 
-                /* see if this sgh requires us to consider file md5 */
-                if (!FileForceMd5() && (pflow->sgh_toserver == NULL ||
-                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILEMD5)))
+                /* see if this sgh requires us to consider file hashes,
+                 * forced hashes are kept */
+                if (pflow->sgh_toserver == NULL ||
+                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILEMD5))
                 {
-                    SCLogDebug("disabling md5 for flow");
+                    SCLogDebug("disabling hashing for flow");
                     FileDisableMd5(pflow, STREAM_TOSERVER);
                 }
 
@@ -1853,8 +2135,26 @@ end:
                     SCLogDebug("disabling filesize for flow");
                     FileDisableFilesize(pflow, STREAM_TOSERVER);
                 }
+
+                /* see if this sgh inspects file data */
+                if (pflow->sgh_toserver == NULL ||
+                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEFILEDATA))
+                {
+                    SCLogDebug("disabling file data inspection for flow");
+                    FileDisableFiledata(pflow, STREAM_TOSERVER);
+                }
+
+                /* without stream rules, don't build stream msgs */
+                if (pflow->sgh_toserver == NULL ||
+                            !(pflow->sgh_toserver->flags & SIG_GROUP_HEAD_HAVERAWSTREAM))
+                {
+                    DetectDisableRawStream(pflow, 0);
+                } else {
+                    DetectSetRawStreamDepth(pflow, 0,
+                            pflow->sgh_toserver->stream_inspect_depth);
+                }
             } else if ((p->flowflags & FLOW_PKT_TOCLIENT) && !(pflow->flags & FLOW_SGH_TOCLIENT)) {
-                pflow->sgh_toclient = det_ctx->sgh;
+                pflow->sgh_toclient = flow_sgh;
                 pflow->flags |= FLOW_SGH_TOCLIENT;
 
                 if (pflow->sgh_toclient == NULL || pflow->sgh_toclient->filestore_cnt == 0) {
@@ -1869,11 +2169,12 @@ end:
                     FileDisableMagic(pflow, STREAM_TOCLIENT);
                 }
 
-                /* check if this flow needs md5, if not disable it */
-                if (!FileForceMd5() && (pflow->sgh_toclient == NULL ||
-                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILEMD5)))
+                /* check if this flow needs hashes, if not disable them.
+                 * Forced hashes are kept. */
+                if (pflow->sgh_toclient == NULL ||
+                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILEMD5))
                 {
-                    SCLogDebug("disabling md5 for flow");
+                    SCLogDebug("disabling hashing for flow");
                     FileDisableMd5(pflow, STREAM_TOCLIENT);
                 }
 
@@ -1884,6 +2185,24 @@ end:
                     SCLogDebug("disabling filesize for flow");
                     FileDisableFilesize(pflow, STREAM_TOCLIENT);
                 }
+
+                /* see if this sgh inspects file data */
+                if (pflow->sgh_toclient == NULL ||
+                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEFILEDATA))
+                {
+                    SCLogDebug("disabling file data inspection for flow");
+                    FileDisableFiledata(pflow, STREAM_TOCLIENT);
+                }
+
+                /* without stream rules, don't build stream msgs */
+                if (pflow->sgh_toclient == NULL ||
+                            !(pflow->sgh_toclient->flags & SIG_GROUP_HEAD_HAVERAWSTREAM))
+                {
+                    DetectDisableRawStream(pflow, 1);
+                } else {
+                    DetectSetRawStreamDepth(pflow, 1,
+                            pflow->sgh_toclient->stream_inspect_depth);
+                }
             }
         }
 
@@ -1913,12 +2232,14 @@ void DetectSignatureApplyActions(Packet *p, const Signature *s)
 
 /* tm module api functions */
 
-static DetectEngineThreadCtx *GetTenantById(HashTable *h, uint32_t id)
+static DetectEngineThreadCtx *GetTenantById(const DetectEngineThreadCtx *det_ctx,
+                                            uint32_t id)
 {
-    /* technically we need to pass a DetectEngineThreadCtx struct with the
-     * tentant_id member. But as that member is the first in the struct, we
-     * can use the id directly. */
-    return HashTableLookup(h, &id, 0);
+    if (det_ctx->mt_det_ctxs != NULL)
+        return det_ctx->mt_det_ctxs[id];
+
+    DetectEngineThreadCtx **tenant = TenantCtxMapLookup(det_ctx->mt_det_ctxs_hash, &id);
+    return tenant ? *tenant : NULL;
 }
 
 static void DetectFlow(ThreadVars *tv,
@@ -1997,11 +2318,23 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQue
     if (det_ctx->mt_det_ctxs_cnt > 0 && det_ctx->TenantGetId != NULL)
     {
         uint32_t tenant_id = p->tenant_id;
+        DetectEngineThreadCtx *mt_det_ctx = NULL;
+        /* the tenant is resolved on the first packet and stored in the
+         * flow. Only trust it if the tenant is still registered. */
+        if (tenant_id == 0 && p->flow != NULL && p->flow->tenant_id > 0 &&
+            p->flow->tenant_id < det_ctx->mt_det_ctxs_cnt)
+        {
+            mt_det_ctx = GetTenantById(det_ctx, p->flow->tenant_id);
+            if (mt_det_ctx != NULL)
+                tenant_id = p->flow->tenant_id;
+        }
         if (tenant_id == 0)
             tenant_id = det_ctx->TenantGetId(det_ctx, p);
         if (tenant_id > 0 && tenant_id < det_ctx->mt_det_ctxs_cnt) {
             p->tenant_id = tenant_id;
-            det_ctx = GetTenantById(det_ctx->mt_det_ctxs_hash, tenant_id);
+            if (mt_det_ctx == NULL)
+                mt_det_ctx = GetTenantById(det_ctx, tenant_id);
+            det_ctx = mt_det_ctx;
             if (det_ctx == NULL)
                 return TM_ECODE_OK;
             de_ctx = det_ctx->de_ctx;
@@ -2122,7 +2455,8 @@ int SignatureIsFilemagicInspecting(Signature *s)
 }
 
 /**
- *  \brief Check if a signature contains the filemd5 keyword.
+ *  \brief Check if a signature contains the filemd5, filesha1 or
+ *         filesha256 keyword.
  *
  *  \param s signature
  *
@@ -2134,7 +2468,7 @@ int SignatureIsFileMd5Inspecting(Signature *s)
     if (s == NULL)
         return 0;
 
-    if (s->file_flags & FILE_SIG_NEED_MD5)
+    if (s->file_flags & (FILE_SIG_NEED_MD5|FILE_SIG_NEED_SHA1|FILE_SIG_NEED_SHA256))
         return 1;
 
     return 0;
@@ -2159,6 +2493,25 @@ int SignatureIsFilesizeInspecting(Signature *s)
     return 0;
 }
 
+/**
+ *  \brief Check if a signature inspects the file_data buffer.
+ *
+ *  \param s signature
+ *
+ *  \retval 0 no
+ *  \retval 1 yes
+ */
+int SignatureIsFiledataInspecting(Signature *s)
+{
+    if (s == NULL)
+        return 0;
+
+    if (s->sm_lists[DETECT_SM_LIST_FILEDATA] != NULL)
+        return 1;
+
+    return 0;
+}
+
 /** \brief Test is a initialized signature is IP only
  *  \param de_ctx detection engine ctx
  *  \param s the signature
@@ -3414,17 +3767,28 @@ static DetectPort *RulesGroupByPorts(DetectEngineCtx *de_ctx, int ipproto, uint3
         s = s->next;
     }
 
-    /* step 2: create a list of DetectPort objects */
+    /* step 2: create a list of non-overlapping DetectPort objects */
     HashListTableBucket *htb = NULL;
+    uint32_t ports_cnt = 0;
     for (htb = HashListTableGetListHead(de_ctx->dport_hash_table);
             htb != NULL;
             htb = HashListTableGetListNext(htb))
     {
-        DetectPort *p = HashListTableGetListData(htb);
-        DetectPort *tmp = DetectPortCopySingle(de_ctx, p);
-        BUG_ON(tmp == NULL);
-        int r = DetectPortInsert(de_ctx, &list , tmp);
+        ports_cnt++;
+    }
+    if (ports_cnt > 0) {
+        DetectPort **ports = SCMalloc(ports_cnt * sizeof(DetectPort *));
+        BUG_ON(ports == NULL);
+        uint32_t i = 0;
+        for (htb = HashListTableGetListHead(de_ctx->dport_hash_table);
+                htb != NULL;
+                htb = HashListTableGetListNext(htb))
+        {
+            ports[i++] = HashListTableGetListData(htb);
+        }
+        int r = DetectPortSweep(de_ctx, ports, ports_cnt, &list);
         BUG_ON(r == -1);
+        SCFree(ports);
     }
     DetectPortHashFree(de_ctx);
     de_ctx->dport_hash_table = NULL;
@@ -3830,6 +4194,16 @@ int SigAddressPrepareStage2(DetectEngineCtx *de_ctx)
     de_ctx->flow_gh[1].udp = RulesGroupByPorts(de_ctx, IPPROTO_UDP, SIG_FLAG_TOSERVER);
     de_ctx->flow_gh[0].udp = RulesGroupByPorts(de_ctx, IPPROTO_UDP, SIG_FLAG_TOCLIENT);
 
+    /* flatten the port lists for the packet path lookups */
+    int f;
+    for (f = 0; f < FLOW_STATES; f++) {
+        if (DetectPortLookupTableSetup(&de_ctx->flow_gh[f].tcp_table,
+                    de_ctx->flow_gh[f].tcp) != 0 ||
+            DetectPortLookupTableSetup(&de_ctx->flow_gh[f].udp_table,
+                    de_ctx->flow_gh[f].udp) != 0)
+            return -1;
+    }
+
     /* Setup the other IP Protocols (so not TCP/UDP) */
     RulesGroupByProto(de_ctx);
 
@@ -3889,6 +4263,8 @@ int SigAddressCleanupStage1(DetectEngineCtx *de_ctx)
         }
 
         /* free lookup lists */
+        DetectPortLookupTableFree(&de_ctx->flow_gh[f].tcp_table);
+        DetectPortLookupTableFree(&de_ctx->flow_gh[f].udp_table);
         DetectPortCleanupList(de_ctx->flow_gh[f].tcp);
         de_ctx->flow_gh[f].tcp = NULL;
         DetectPortCleanupList(de_ctx->flow_gh[f].udp);
@@ -3979,6 +4355,24 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
 
     uint32_t cnt = 0;
     uint32_t idx = 0;
+    uint32_t request_body_depth = 0;
+    uint32_t response_body_depth = 0;
+
+    /* add the per app layer protocol groups to the array first, so they
+     * are prepared below like the others */
+    if (de_ctx->grouping_alproto) {
+        const uint32_t sgh_array_cnt = de_ctx->sgh_array_cnt;
+        for (idx = 0; idx < sgh_array_cnt; idx++) {
+            SigGroupHead *sgh = de_ctx->sgh_array[idx];
+            if (sgh == NULL)
+                continue;
+            if (SigGroupHeadBuildAlprotoGroups(de_ctx, sgh) != 0)
+                SCReturnInt(-1);
+        }
+        SCLogConfig("app layer protocol groups: %u",
+                de_ctx->sgh_array_cnt - sgh_array_cnt);
+    }
+
     for (idx = 0; idx < de_ctx->sgh_array_cnt; idx++) {
         SigGroupHead *sgh = de_ctx->sgh_array[idx];
         if (sgh == NULL)
@@ -3989,10 +4383,20 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
         SigGroupHeadSetFilemagicFlag(de_ctx, sgh);
         SigGroupHeadSetFileMd5Flag(de_ctx, sgh);
         SigGroupHeadSetFilesizeFlag(de_ctx, sgh);
+        SigGroupHeadSetFiledataFlag(de_ctx, sgh);
+        SigGroupHeadSetRawStreamFlag(de_ctx, sgh);
+        SigGroupHeadSetInspectDepths(de_ctx, sgh);
+        if (sgh->request_body_depth > request_body_depth)
+            request_body_depth = sgh->request_body_depth;
+        if (sgh->response_body_depth > response_body_depth)
+            response_body_depth = sgh->response_body_depth;
         SigGroupHeadSetFilestoreCount(de_ctx, sgh);
         SCLogDebug("filestore count %u", sgh->filestore_cnt);
+        SigGroupHeadSetMaskCommon(de_ctx, sgh);
 
         BUG_ON(PatternMatchPrepareGroup(de_ctx, sgh) != 0);
+        if (PrefilterSetupRuleGroup(de_ctx, sgh) != 0)
+            SCReturnInt(-1);
         SigGroupHeadBuildNonMpmArray(de_ctx, sgh);
 
         sgh->id = idx;
@@ -4000,6 +4404,21 @@ int SigAddressPrepareStage4(DetectEngineCtx *de_ctx)
     }
     SCLogPerf("Unique rule groups: %u", cnt);
 
+    /* the http bodies are buffered per tx, before the flow's sgh's are
+     * known, so their limit is the deepest of all groups. Tenants share
+     * the parser, so only the main engine sets it. */
+    if (de_ctx->tenant_id == 0) {
+        if (request_body_depth == SIG_GROUP_HEAD_DEPTH_UNLIMITED)
+            request_body_depth = 0;
+        if (response_body_depth == SIG_GROUP_HEAD_DEPTH_UNLIMITED)
+            response_body_depth = 0;
+        if (request_body_depth || response_body_depth) {
+            SCLogConfig("http body inspection depth: request %u, response %u",
+                    request_body_depth, response_body_depth);
+        }
+        AppLayerHtpSetBodyInspectDepth(request_body_depth, response_body_depth);
+    }
+
     MpmStoreReportStats(de_ctx);
 
     if (de_ctx->decoder_event_sgh != NULL) {
@@ -4098,6 +4517,8 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
     if (DetectSetFastPatternAndItsId(de_ctx) < 0)
         return -1;
 
+    PrefilterSelectForSignatures(de_ctx);
+
     SigInitStandardMpmFactoryContexts(de_ctx);
 
     if (SigAddressPrepareStage1(de_ctx) != 0) {
@@ -4118,42 +4539,17 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
         exit(EXIT_FAILURE);
     }
+    MpmStoreReuseTableFree(de_ctx);
 
-    if (de_ctx->sgh_mpm_context == ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE) {
-#ifdef __SC_CUDA_SUPPORT__
-        if (PatternMatchDefaultMatcher() == MPM_AC_CUDA) {
-            /* setting it to default.  You've gotta remove it once you fix the state table thing */
-            SCACConstructBoth16and32StateTables();
-
-            MpmCudaConf *conf = CudaHandlerGetCudaProfile("mpm");
-            CUcontext cuda_context = CudaHandlerModuleGetContext(MPM_AC_CUDA_MODULE_NAME, conf->device_id);
-            if (cuda_context == 0) {
-                SCLogError(SC_ERR_FATAL, "cuda context is NULL.");
-                exit(EXIT_FAILURE);
-            }
-            int r = SCCudaCtxPushCurrent(cuda_context);
-            if (r < 0) {
-                SCLogError(SC_ERR_FATAL, "context push failed.");
-                exit(EXIT_FAILURE);
-            }
-        }
-#endif
-#ifdef __SC_CUDA_SUPPORT__
-        if (PatternMatchDefaultMatcher() == MPM_AC_CUDA) {
-            int r = SCCudaCtxPopCurrent(NULL);
-            if (r < 0) {
-                SCLogError(SC_ERR_FATAL, "cuda context pop failure.");
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        /* too late to call this either ways.  Should be called post ac goto.
-         * \todo Support this. */
-        DetermineCudaStateTableSize(de_ctx);
-#endif
-    }
+    MpmOffloadPrepareStart(de_ctx);
     DetectMpmPrepareBuiltinMpms(de_ctx);
     DetectMpmPrepareAppMpms(de_ctx);
+    if (DetectMpmPrepareQueued(de_ctx) != 0) {
+        SCLogError(SC_ERR_DETECT_PREPARE, "initializing the detection engine failed");
+        exit(EXIT_FAILURE);
+    }
+    MpmOffloadPrepareEnd(de_ctx);
+    MpmStoreSharePublish(de_ctx);
 
 //    DetectAddressPrintMemory();
 //    DetectPortPrintMemory();
@@ -4163,9 +4559,8 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
         exit(EXIT_FAILURE);
     }
 
-#ifdef PROFILING
     SCProfilingRuleInitCounters(de_ctx);
-#endif
+    DetectEngineMemuseReport(de_ctx);
     return 0;
 }
 
@@ -4325,6 +4720,7 @@ void SigTableSetup(void)
     DetectFlowintRegister();
     DetectPktvarRegister();
     DetectNoalertRegister();
+    DetectBypassRegister();
     DetectFlowbitsRegister();
     DetectHostbitsRegister();
     DetectXbitsRegister();
@@ -4374,6 +4770,8 @@ void SigTableSetup(void)
     DetectFilestoreRegister();
     DetectFilemagicRegister();
     DetectFileMd5Register();
+    DetectFileSha1Register();
+    DetectFileSha256Register();
     DetectFilesizeRegister();
     DetectAppLayerEventRegister();
     DetectHttpUARegister();
@@ -9217,6 +9615,73 @@ end:
     return result;
 }
 
+/** \test alerts beyond packet-alert-max are counted, the rest is
+ *        stored in signature order */
+static int SigTestDetectAlertMax(void)
+{
+    Packet *p = NULL;
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    char sig[128];
+    int result = 0;
+    int i;
+
+    memset(&tv, 0, sizeof(tv));
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL) {
+        goto end;
+    }
+    de_ctx->flags |= DE_QUIET;
+
+    for (i = 1; i <= 20; i++) {
+        snprintf(sig, sizeof(sig), "alert tcp any any -> any any "
+                "(content:\"boo\"; sid:%d;)", i);
+        if (DetectEngineAppendSig(de_ctx, sig) == NULL) {
+            goto end;
+        }
+    }
+
+    SigGroupBuild(de_ctx);
+    strlcpy(tv.name, "detect_test", sizeof(tv.name));
+    DetectEngineThreadCtxInit(&tv, de_ctx, (void *)&det_ctx);
+    StatsSetupPrivate(&tv);
+
+    p = UTHBuildPacket((uint8_t *)"boo", strlen("boo"), IPPROTO_TCP);
+    Detect(&tv, p, det_ctx, NULL, NULL);
+    if (p->alerts.cnt != PACKET_ALERT_MAX ||
+        StatsGetLocalCounterValue(&tv, det_ctx->counter_alerts_overflow) != 5) {
+        printf("expected %u alerts and 5 overflows, got %u: ",
+                PACKET_ALERT_MAX, p->alerts.cnt);
+        goto end;
+    }
+
+    de_ctx->packet_alert_max = 20;
+    Detect(&tv, p, det_ctx, NULL, NULL);
+    if (p->alerts.cnt != 20) {
+        printf("expected 20 alerts, got %u: ", p->alerts.cnt);
+        goto end;
+    }
+    for (i = 1; i < p->alerts.cnt; i++) {
+        if (p->alerts.alerts[i - 1].num >= p->alerts.alerts[i].num) {
+            printf("alerts not ordered at %d: ", i);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    UTHFreePackets(&p, 1);
+    if (de_ctx != NULL) {
+        SigGroupCleanup(de_ctx);
+        SigCleanSignatures(de_ctx);
+        if (det_ctx != NULL)
+            DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+        DetectEngineCtxFree(de_ctx);
+    }
+    return result;
+}
+
 /** \test test if the engine set flag to drop pkts of a flow that
  *        triggered a drop action on IPS mode */
 static int SigTestDropFlow01(void)
@@ -10076,6 +10541,122 @@ end:
     ConfRestoreContextBackup();
     return result;
 }
+
+/** \test pmq sort: dense ids use the bitmap and get deduplicated, sparse
+ *        ids are quicksorted */
+/** \test packets the rules of their group can't match are skipped,
+ *        the others still get inspected */
+static int SigTestSghSkip01(void)
+{
+    ThreadVars tv;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    uint8_t payload[] = "abc";
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    Packet *p1 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 80);
+    Packet *p2 = UTHBuildPacketReal(NULL, 0, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 81);
+    Packet *p3 = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP, "192.168.1.1", "1.2.3.4", 60000, 80);
+    FAIL_IF_NULL(p1);
+    FAIL_IF_NULL(p2);
+    FAIL_IF_NULL(p3);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 (content:\"abc\"; sid:1;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 (pcre:\"/^a/\"; sid:2;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 (content:\"abc\"; sid:3;)"));
+    FAIL_IF_NULL(DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 81 (dsize:0; sid:4;)"));
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&tv, (void *)de_ctx, (void *)&det_ctx);
+    FAIL_IF_NULL(det_ctx);
+
+    /* empty packet against payload rules only */
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p1);
+    FAIL_IF(p1->alerts.cnt != 0);
+
+    /* the group has a rule for empty packets */
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p2);
+    FAIL_IF_NOT(PacketAlertCheck(p2, 4));
+    FAIL_IF(PacketAlertCheck(p2, 3));
+
+    SigMatchSignatures(&tv, de_ctx, det_ctx, p3);
+    FAIL_IF_NOT(PacketAlertCheck(p3, 1));
+    FAIL_IF_NOT(PacketAlertCheck(p3, 2));
+
+    DetectEngineThreadCtxDeinit(&tv, (void *)det_ctx);
+    SigCleanSignatures(de_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p1, 1);
+    UTHFreePackets(&p2, 1);
+    UTHFreePackets(&p3, 1);
+    PASS;
+}
+
+static int DetectPrefilterSortPmqTest01(void)
+{
+    int result = 0;
+    DetectEngineThreadCtx det_ctx;
+    uint8_t seen[512];
+    uint32_t i, x = 1;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(seen, 0, sizeof(seen));
+    PmqSetup(&det_ctx.pmq);
+    det_ctx.pmq_bitmap_words = 2048;
+    det_ctx.pmq_bitmap = SCCalloc(det_ctx.pmq_bitmap_words, sizeof(uint64_t));
+    if (det_ctx.pmq_bitmap == NULL)
+        goto end;
+
+    /* dense with duplicates */
+    for (i = 0; i < 300; i++) {
+        x = x * 1103515245 + 12345;
+        SigIntId id = (x >> 16) % 512;
+        seen[id] = 1;
+        MpmAddSids(&det_ctx.pmq, &id, 1);
+    }
+    DetectPrefilterSortPmq(&det_ctx);
+
+    uint32_t unique = 0;
+    for (i = 0; i < 512; i++)
+        unique += seen[i];
+    if (det_ctx.pmq.rule_id_array_cnt != unique)
+        goto end;
+    for (i = 0; i < det_ctx.pmq.rule_id_array_cnt; i++) {
+        if (!seen[det_ctx.pmq.rule_id_array[i]])
+            goto end;
+        if (i > 0 && det_ctx.pmq.rule_id_array[i] <= det_ctx.pmq.rule_id_array[i - 1])
+            goto end;
+    }
+    for (i = 0; i < det_ctx.pmq_bitmap_words; i++) {
+        if (det_ctx.pmq_bitmap[i] != 0)
+            goto end;
+    }
+
+    /* sparse: falls back to the quicksort, which keeps duplicates */
+    PmqReset(&det_ctx.pmq);
+    for (i = 0; i < 100; i++) {
+        SigIntId id = (i % 2) ? 100000 - i : i;
+        MpmAddSids(&det_ctx.pmq, &id, 1);
+        MpmAddSids(&det_ctx.pmq, &id, 1);
+    }
+    DetectPrefilterSortPmq(&det_ctx);
+    if (det_ctx.pmq.rule_id_array_cnt != 200)
+        goto end;
+    for (i = 1; i < det_ctx.pmq.rule_id_array_cnt; i++) {
+        if (det_ctx.pmq.rule_id_array[i] < det_ctx.pmq.rule_id_array[i - 1])
+            goto end;
+    }
+
+    result = 1;
+end:
+    if (det_ctx.pmq_bitmap != NULL)
+        SCFree(det_ctx.pmq_bitmap);
+    PmqFree(&det_ctx.pmq);
+    return result;
+}
 #endif /* UNITTESTS */
 
 void SigRegisterTests(void)
@@ -10179,6 +10760,7 @@ void SigRegisterTests(void)
     UtRegisterTest("SigTestDepthOffset01", SigTestDepthOffset01);
 
     UtRegisterTest("SigTestDetectAlertCounter", SigTestDetectAlertCounter);
+    UtRegisterTest("SigTestDetectAlertMax", SigTestDetectAlertMax);
 
     UtRegisterTest("SigTestDropFlow01", SigTestDropFlow01);
     UtRegisterTest("SigTestDropFlow02", SigTestDropFlow02);
@@ -10192,6 +10774,8 @@ void SigRegisterTests(void)
 
     UtRegisterTest("SigTestPorts01", SigTestPorts01);
     UtRegisterTest("SigTestBug01", SigTestBug01);
+    UtRegisterTest("DetectPrefilterSortPmqTest01", DetectPrefilterSortPmqTest01);
+    UtRegisterTest("SigTestSghSkip01", SigTestSghSkip01);
 
 #if 0
     DetectSimdRegisterTests();
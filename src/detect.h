@@ -33,12 +33,14 @@
 
 #include "packet-queue.h"
 #include "util-mpm.h"
+#include "util-mpm-offload.h"
 #include "util-spm.h"
 #include "util-hash.h"
 #include "util-hashlist.h"
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-radix-tree.h"
+#include "util-lpm-ipv4.h"
 #include "util-file.h"
 #include "reputation.h"
 
@@ -243,6 +245,16 @@ typedef struct DetectPort_ {
     struct DetectPort_ *next;
 } DetectPort;
 
+/** \brief flat copy of a sorted, non-overlapping DetectPort list, used for
+ *         the per packet port to sgh lookup. The arrays are laid out
+ *         separately so the binary search only touches port2. */
+typedef struct DetectPortLookupTable_ {
+    uint32_t cnt;
+    uint16_t *port2;                /**< range ends, ascending */
+    uint16_t *port;                 /**< range starts */
+    struct SigGroupHead_ **sh;
+} DetectPortLookupTable;
+
 /* Signature flags */
 #define SIG_FLAG_SRC_ANY                (1)  /**< source is any */
 #define SIG_FLAG_DST_ANY                (1<<1)  /**< destination is any */
@@ -308,6 +320,8 @@ typedef struct DetectPort_ {
 #define FILE_SIG_NEED_FILECONTENT   0x10
 #define FILE_SIG_NEED_MD5           0x20
 #define FILE_SIG_NEED_SIZE          0x40
+#define FILE_SIG_NEED_SHA1          0x80
+#define FILE_SIG_NEED_SHA256        0x100
 
 /* Detection Engine flags */
 #define DE_QUIET           0x01     /**< DE is quiet (esp for unittests) */
@@ -367,7 +381,7 @@ typedef struct Signature_ {
 
     /** inline -- action */
     uint8_t action;
-    uint8_t file_flags;
+    uint16_t file_flags;
 
     /** addresses, ports and proto this sig matches on */
     DetectProto proto;
@@ -394,9 +408,7 @@ typedef struct Signature_ {
     /** port settings for this signature */
     DetectPort *sp, *dp;
 
-#ifdef PROFILING
-    uint16_t profiling_id;
-#endif
+    uint32_t profiling_id;
     /** number of sigmatches in the match and pmatch list */
     uint16_t sm_cnt;
 
@@ -431,6 +443,8 @@ typedef struct Signature_ {
     SigMatch *dsize_sm;
     /* the fast pattern added from this signature */
     SigMatch *mpm_sm;
+    /* keyword used as prefilter if the signature has no mpm */
+    SigMatch *prefilter_sm;
 
     /* SigMatch list used for adding content and friends. E.g. file_data; */
     int list;
@@ -471,8 +485,8 @@ typedef struct DetectFlowvarList_ {
 } DetectFlowvarList;
 
 typedef struct DetectEngineIPOnlyThreadCtx_ {
-    uint8_t *sig_match_array; /* bit array of sig nums */
-    uint32_t sig_match_size;  /* size in bytes of the array */
+    uint64_t *sig_match_array; /* bit array of sig nums */
+    uint32_t sig_match_size;   /* size in 64 bit words of the array */
 } DetectEngineIPOnlyThreadCtx;
 
 /** \brief IP only rules matching ctx. */
@@ -484,6 +498,8 @@ typedef struct DetectEngineIPOnlyCtx_ {
     /* Lookup trees */
     SCRadixTree *tree_ipv4src, *tree_ipv4dst;
     SCRadixTree *tree_ipv6src, *tree_ipv6dst;
+    /* compiled from the ipv4 trees, NULL if the trees are used */
+    SCLpmIPV4 *lpm_ipv4src, *lpm_ipv4dst;
 
     /* Used to build the radix trees */
     IPOnlyCIDRItem *ip_src, *ip_dst;
@@ -507,6 +523,9 @@ typedef struct DetectEngineIPOnlyCtx_ {
 typedef struct DetectEngineLookupFlow_ {
     DetectPort *tcp;
     DetectPort *udp;
+    /* flattened versions of the tcp and udp lists */
+    DetectPortLookupTable tcp_table;
+    DetectPortLookupTable udp_table;
     struct SigGroupHead_ *sgh[256];
 } DetectEngineLookupFlow;
 
@@ -548,7 +567,8 @@ typedef struct DetectEngineCtx_ {
     /* version of the srep data */
     uint32_t srep_version;
 
-    /* reputation for netblocks */
+    /* reputation for hosts and netblocks, replaced on reputation
+     * reload, see SRepReload() */
     SRepCIDRTree *srepCIDR_ctx;
 
     Signature **sig_array;
@@ -561,6 +581,10 @@ typedef struct DetectEngineCtx_ {
      *  used to alloc det_ctx::non_mpm_id_array */
     uint32_t non_mpm_store_cnt_max;
 
+    /** Maximum sig_cnt of all our sgh's, used to alloc
+     *  det_ctx::match_array */
+    uint32_t sgh_sig_cnt_max;
+
     /* used by the signature ordering module */
     struct SCSigOrderFunc_ *sc_sig_order_funcs;
 
@@ -568,6 +592,10 @@ typedef struct DetectEngineCtx_ {
     HashTable *class_conf_ht;
     /* hash table used for holding the reference config info */
     HashTable *reference_conf_ht;
+    /** frozen name lookups of the above, set up once the files are
+     *  loaded. They point to the entries owned by the hash tables. */
+    struct ROHashMap_ *class_conf_ro;
+    struct ROHashMap_ *reference_conf_ro;
 
     /* main sigs */
     DetectEngineLookupFlow flow_gh[FLOW_STATES];
@@ -579,8 +607,32 @@ typedef struct DetectEngineCtx_ {
 
     HashListTable *mpm_hash_table;
 
-    HashListTable *variable_names;
-    HashListTable *variable_idxs;
+    /** mpm ctxs waiting to be prepared in parallel during SigGroupBuild */
+    MpmCtx **mpm_prepare_queue;
+    uint32_t mpm_prepare_queue_cnt;
+    uint32_t mpm_prepare_queue_size;
+    /** threads to use for preparing the mpm ctxs, 1 to not use threads */
+    int build_threads;
+
+    /** engine being replaced by this one on a reload. Its unique mpm
+     *  ctxs are reused when the patterns are unchanged. Only set while
+     *  building, the caller holds a reference. */
+    struct DetectEngineCtx_ *mpm_reuse_de_ctx;
+    /** fingerprint lookup of mpm_reuse_de_ctx's ctxs */
+    HashTable *mpm_reuse_table;
+    uint32_t mpm_reuse_cnt;
+    /** share identical unique mpm ctxs with all other engines, e.g.
+     *  the other tenants */
+    int mpm_share;
+    uint32_t mpm_share_cnt;
+
+    /** pcre keywords of the rule file being loaded, compiled ahead in
+     *  parallel. Only set inside DetectLoadSigFile(). */
+    HashListTable *pcre_precompiled;
+
+    /** name to idx and idx to name maps of util-var-name.c */
+    struct VariableNameMap_ *variable_names;
+    struct VariableIdxMap_ *variable_idxs;
     uint16_t variable_names_idx;
 
     /* hash table used to cull out duplicate sigs */
@@ -590,6 +642,9 @@ typedef struct DetectEngineCtx_ {
     ThresholdCtx ths_ctx;
 
     uint16_t mpm_matcher; /**< mpm matcher this ctx uses */
+    /** ctxs with up to this many patterns use the small set matcher,
+     *  0 to disable */
+    uint32_t mpm_small_max;
     uint16_t spm_matcher; /**< spm matcher this ctx uses */
 
     /* spm thread context prototype, built as spm matchers are constructed and
@@ -611,6 +666,36 @@ typedef struct DetectEngineCtx_ {
     /* maximum recursion depth for content inspection */
     int inspection_recursion_limit;
 
+    /** max alerts stored per packet, detect.packet-alert-max */
+    uint16_t packet_alert_max;
+
+    /** detect.alert-aggregation: window in seconds (0 disables) and
+     *  entries of the per thread table */
+    uint32_t alert_agg_window;
+    uint32_t alert_agg_size;
+
+    /** detect.inspection-depth is "auto": limit raw reassembly and body
+     *  buffering to what the rules inspect */
+    int inspection_depth_auto;
+
+    /** detect.grouping.app-layer: per app layer protocol groups */
+    int grouping_alproto;
+
+    /** detect.mpm.http-combined: one mpm ctx for the small http request
+     *  buffers, searched in one MpmSearchVector() call per tx */
+    int mpm_http_combined;
+
+    /** detect.mpm.stream-dedup: don't search a tcp packet's payload for
+     *  patterns the stream mpm already searched it for */
+    int mpm_stream_dedup;
+
+    /** detect.fast-pattern-feedback: observed fast pattern frequencies,
+     *  NULL if disabled */
+    struct DetectFPFeedback_ *fp_feedback;
+
+    /** detect.rule-budget: per signature cpu budget, NULL if disabled */
+    struct DetectRuleBudget_ *rule_budget;
+
     /* conf parameter that limits the length of the http request body inspected */
     int hcbd_buffer_limit;
     /* conf parameter that limits the length of the http response body inspected */
@@ -650,8 +735,8 @@ typedef struct DetectEngineCtx_ {
 
     int detect_luajit_instances;
 
-#ifdef PROFILING
     struct SCProfileDetectCtx_ *profile_ctx;
+#ifdef PROFILING
     struct SCProfileKeywordDetectCtx_ *profile_keyword_ctx;
     struct SCProfileKeywordDetectCtx_ *profile_keyword_ctx_per_list[DETECT_SM_LIST_MAX];
     struct SCProfileSghDetectCtx_ *profile_sgh_ctx;
@@ -712,9 +797,14 @@ typedef struct FiledataReassembledBody_ {
 
 #define DETECT_FILESTORE_MAX 15
 
+/** max buffers handed to the mpm offload backend at once */
+#define DETECT_MPM_OFFLOAD_BATCH 16
+
+/** \brief non-mpm rules of a sgh, stored as parallel arrays so that the
+ *         prefilter loop only streams through the masks */
 typedef struct SignatureNonMpmStore_ {
-    SigIntId id;
-    SignatureMask mask;
+    SignatureMask *mask;
+    SigIntId *id;
 } SignatureNonMpmStore;
 
 /**
@@ -729,17 +819,51 @@ typedef struct DetectEngineThreadCtx_ {
     ThreadVars *tv;
 
     SigIntId *non_mpm_id_array;
+    uint32_t non_mpm_id_array_size;
     uint32_t non_mpm_id_cnt; // size is cnt * sizeof(uint32_t)
 
+    /** one bit per signature num, used to sort and dedup large pmq's.
+     *  All zero between uses. */
+    uint64_t *pmq_bitmap;
+    uint32_t pmq_bitmap_words;
+
+    /** fast pattern feedback counters, indexed by signature num. NULL if
+     *  the feedback is disabled */
+    struct DetectFPFeedbackCounter_ *fp_feedback;
+    uint32_t fp_feedback_rate;
+    uint32_t fp_feedback_countdown;
+    uint64_t fp_feedback_pkts;
+    /** current packet is sampled */
+    int fp_feedback_sampled;
+
+    /** rule budget cost counters, indexed by signature num. NULL if the
+     *  rule budget is disabled */
+    struct DetectRuleBudgetCounter_ *rule_budget;
+    uint32_t rule_budget_rate;
+    uint32_t rule_budget_countdown;
+    uint32_t rule_budget_min_samples;
+    /** inspections of the current packet are timed */
+    int rule_budget_sampled;
+    /** ticks at the start of the timed inspection, 0 if none */
+    uint64_t rule_budget_start;
+
     uint32_t mt_det_ctxs_cnt;
+    /** tenant det_ctxs indexed by tenant id, mt_det_ctxs_cnt entries. NULL
+     *  if the ids are too sparse, then mt_det_ctxs_hash is used. The hash
+     *  owns the det_ctxs. */
     struct DetectEngineThreadCtx_ **mt_det_ctxs;
-    HashTable *mt_det_ctxs_hash;
+    struct TenantCtxMap_ *mt_det_ctxs_hash;
 
     struct DetectEngineTenantMapping_ *tenant_array;
     uint32_t tenant_array_size;
+    /** vlan id to tenant id, DETECT_ENGINE_MT_VLAN_IDS entries */
+    uint32_t *tenant_vlan_map;
 
     uint32_t (*TenantGetId)(const void *, const Packet *p);
 
+    /** reputation snapshot in use by this thread, holds a reference */
+    SRepCIDRTree *srep;
+
     /* detection engine variables */
 
     /** offset into the payload of the last match by:
@@ -765,12 +889,6 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t hcbd_buffers_size;
     uint16_t hcbd_buffers_list_len;
 
-    uint8_t **hhd_buffers;
-    uint32_t *hhd_buffers_len;
-    uint16_t hhd_buffers_size;
-    uint16_t hhd_buffers_list_len;
-    uint64_t hhd_start_tx_id;
-
     FiledataReassembledBody *smtp;
     uint64_t smtp_start_tx_id;
     uint16_t smtp_buffers_size;
@@ -778,6 +896,27 @@ typedef struct DetectEngineThreadCtx_ {
 
     /** id for alert counter */
     uint16_t counter_alerts;
+    /** id for the counter of alerts dropped by packet-alert-max */
+    uint16_t counter_alerts_overflow;
+    /** id for the counter of alerts folded into an aggregation window */
+    uint16_t counter_alerts_aggregated;
+    /** ids for the counters of the load shedding steps */
+    uint16_t counter_load_shed_raw_stream;
+    uint16_t counter_load_shed_body;
+    uint16_t counter_load_shed_flow;
+    /** ids for the counters of packets and payload bytes the packet mpm
+     *  skipped as the stream mpm covered them */
+    uint16_t counter_mpm_dedup;
+    uint16_t counter_mpm_dedup_bytes;
+    /** id for the counter of packets whose group had no rule they could
+     *  match, see SigGroupHead::mask_common */
+    uint16_t counter_sgh_skipped;
+
+    /** load shedding level for the current packet */
+    int load_shed_level;
+
+    /** table of open alert aggregation windows, NULL if disabled */
+    struct AlertAggregateTable_ *alert_agg;
 #ifdef PROFILING
     uint16_t counter_mpm_list;
     uint16_t counter_nonmpm_list;
@@ -812,9 +951,15 @@ typedef struct DetectEngineThreadCtx_ {
     SigIntId de_state_sig_array_len;
     uint8_t *de_state_sig_array;
 
+    /** the scratch arrays (match_array, de_state_sig_array,
+     *  non_mpm_id_array, pmq_bitmap, bj_values and base64_decoded) are
+     *  owned by the multi tenant ctx of the thread and not freed with
+     *  this ctx. They are sized for the largest tenant. */
+    int scratch_shared;
+
     struct SigGroupHead_ *sgh;
 
-    SignatureNonMpmStore *non_mpm_store_ptr;
+    const SignatureNonMpmStore *non_mpm_store_ptr;
     uint32_t non_mpm_store_cnt;
 
     /** pointer to the current mpm ctx that is stored
@@ -824,6 +969,9 @@ typedef struct DetectEngineThreadCtx_ {
     MpmThreadCtx mtcu;  /**< thread ctx for uricontent mpm */
     MpmThreadCtx mtcs;  /**< thread ctx for stream mpm */
     PatternMatcherQueue pmq;
+    /** DETECT_MPM_OFFLOAD_BATCH jobs for the buffers that are searched in
+     *  batches, NULL if mpm offload is disabled */
+    MpmOffloadJob *mpm_offload_jobs;
 
     /** SPM thread context used for scanning. This has been cloned from the
      * prototype held by DetectEngineCtx. */
@@ -834,6 +982,7 @@ typedef struct DetectEngineThreadCtx_ {
 
     /* byte jump values */
     uint64_t *bj_values;
+    uint32_t bj_values_len;
 
     /* string to replace */
     DetectReplaceList *replist;
@@ -858,9 +1007,13 @@ typedef struct DetectEngineThreadCtx_ {
     int base64_decoded_len;
     int base64_decoded_len_max;
 
-#ifdef PROFILING
+    /** rule profiling, allocated once this thread samples a packet */
     struct SCProfileData_ *rule_perf_data;
-    int rule_perf_data_size;
+    uint32_t rule_perf_data_size;
+    uint32_t rule_perf_gen;         /**< profiling run the data belongs to */
+    uint32_t rule_perf_sample_cnt;
+    struct DetectEngineThreadCtx_ *rule_perf_next;
+#ifdef PROFILING
     struct SCProfileKeywordData_ *keyword_perf_data;
     struct SCProfileKeywordData_ *keyword_perf_data_per_list[DETECT_SM_LIST_MAX];
     int keyword_perf_list; /**< list we're currently inspecting, DETECT_SM_LIST_* */
@@ -897,6 +1050,15 @@ typedef struct SigTableElmt_ {
 
     void (*Free)(void *);
     void (*RegisterTests)(void);
+    /** optional: bytes used by the keyword ctx, for the memory report */
+    size_t (*Memuse)(const SigMatchCtx *);
+
+    /** optional check if the keyword can be the prefilter for this
+     *  signature. If not set, SetupPrefilter implies it can. */
+    int (*SupportsPrefilter)(const Signature *s);
+    /** add prefilter engine(s) to the sgh for the rules that use this
+     *  keyword as prefilter_sm */
+    int (*SetupPrefilter)(struct SigGroupHead_ *sgh);
 
     uint8_t flags;
     char *name;     /**< keyword name alias */
@@ -926,13 +1088,24 @@ typedef struct SigTableElmt_ {
 #define SIG_GROUP_HEAD_FREE             (1 << 16)
 #define SIG_GROUP_HEAD_MPM_PACKET       (1 << 17)
 #define SIG_GROUP_HEAD_MPM_STREAM       (1 << 18)
+#define SIG_GROUP_HEAD_HAVEFILEDATA     (1 << 19)
 
 #define SIG_GROUP_HEAD_HAVEFILEMAGIC    (1 << 20)
-#define SIG_GROUP_HEAD_HAVEFILEMD5      (1 << 21)
+#define SIG_GROUP_HEAD_HAVEFILEMD5      (1 << 21) /**< md5, sha1 or sha256 */
 #define SIG_GROUP_HEAD_HAVEFILESIZE     (1 << 22)
 #define SIG_GROUP_HEAD_MPM_DNSQUERY     (1 << 23)
 #define SIG_GROUP_HEAD_MPM_TLSSNI       (1 << 24)
 #define SIG_GROUP_HEAD_MPM_FD_SMTP      (1 << 25)
+/** sgh has rules inspecting the reassembled stream */
+#define SIG_GROUP_HEAD_HAVERAWSTREAM    (1 << 26)
+/** sgh has the combined mpm of the small http request buffers */
+#define SIG_GROUP_HEAD_MPM_HTTP_TS      (1 << 27)
+/** part of the packet mpm patterns is in the stream mpm as well, when the
+ *  stream mpm covered the payload only mpm_packet_only_ctx is searched */
+#define SIG_GROUP_HEAD_MPM_PACKET_DEDUP (1 << 28)
+
+/** SigGroupHead inspect depth of a buffer some rule inspects in full */
+#define SIG_GROUP_HEAD_DEPTH_UNLIMITED  UINT32_MAX
 
 #define APP_MPMS_MAX 19
 
@@ -944,6 +1117,10 @@ enum MpmBuiltinBuffers {
     MPMB_UDP_TS,
     MPMB_UDP_TC,
     MPMB_OTHERIP,
+    /* packet patterns not covered by the stream mpm, for
+     * detect.mpm.stream-dedup */
+    MPMB_TCP_PKT_ONLY_TS,
+    MPMB_TCP_PKT_ONLY_TC,
     MPMB_MAX,
 };
 
@@ -985,19 +1162,33 @@ typedef struct SigGroupHead_ {
     /* non mpm list excluding SYN rules */
     uint32_t non_mpm_other_store_cnt;
     uint32_t non_mpm_syn_store_cnt;
-    SignatureNonMpmStore *non_mpm_other_store_array; // size is non_mpm_store_cnt * sizeof(SignatureNonMpmStore)
+    SignatureNonMpmStore non_mpm_other_store; // arrays of non_mpm_other_store_cnt entries
     /* non mpm list including SYN rules */
-    SignatureNonMpmStore *non_mpm_syn_store_array; // size is non_mpm_syn_store_cnt * sizeof(SignatureNonMpmStore)
+    SignatureNonMpmStore non_mpm_syn_store; // arrays of non_mpm_syn_store_cnt entries
 
     /** the number of signatures in this sgh that have the filestore keyword
      *  set. */
     uint16_t filestore_cnt;
 
+    /** mask bits all signatures of this sgh require. A packet missing
+     *  one of them can't match any of them. */
+    SignatureMask mask_common;
+
     uint32_t id; /**< unique id used to index sgh_array for stats */
 
+    /** bytes from the start of the buffer the rules inspect, 0 if no rule
+     *  inspects it or SIG_GROUP_HEAD_DEPTH_UNLIMITED. Only set with
+     *  detect.inspection-depth auto. */
+    uint32_t stream_inspect_depth;
+    uint32_t request_body_depth;
+    uint32_t response_body_depth;
+
     /* pattern matcher instances */
     const MpmCtx *mpm_packet_ctx;
     const MpmCtx *mpm_stream_ctx;
+    /** packet patterns that are not in mpm_stream_ctx, see
+     *  SIG_GROUP_HEAD_MPM_PACKET_DEDUP. NULL if all are */
+    const MpmCtx *mpm_packet_only_ctx;
 
     union {
         struct {
@@ -1014,6 +1205,8 @@ typedef struct SigGroupHead_ {
             const MpmCtx *mpm_dnsquery_ctx_ts;
             const MpmCtx *mpm_tlssni_ctx_ts;
             const MpmCtx *mpm_smtp_filedata_ctx_ts;
+            /** combined ctx of the buffers of DetectEngineHttpCombinedMpm() */
+            const MpmCtx *mpm_http_ctx_ts;
         };
         struct {
             const MpmCtx *mpm_hsbd_ctx_tc;
@@ -1028,6 +1221,14 @@ typedef struct SigGroupHead_ {
     /** Array with sig ptrs... size is sig_cnt * sizeof(Signature *) */
     Signature **match_array;
 
+    /** ALPROTO_MAX groups, per app layer protocol the rules of this group
+     *  minus those for other protocols. NULL if none of its rules are for
+     *  an app layer protocol. The groups are in the sgh_array. */
+    struct SigGroupHead_ **alproto_sgh;
+
+    /** prefilter engines for rules without mpm */
+    struct PrefilterEngine_ *engines;
+
     /* ptr to our init data we only use at... init :) */
     SigGroupHeadInitData *init;
 
@@ -1054,6 +1255,11 @@ enum DetectEngineTenantSelectors
     TENANT_SELECTOR_VLAN,           /**< map vlan to tenant id */
 };
 
+/** max tenant id for which the tenant det_ctxs are kept in an array */
+#define DETECT_ENGINE_MT_ARRAY_MAX  65536
+/** number of 12 bit vlan ids */
+#define DETECT_ENGINE_MT_VLAN_IDS   4096
+
 typedef struct DetectEngineTenantMapping_ {
     uint32_t tenant_id;
 
@@ -1136,6 +1342,7 @@ enum {
     DETECT_FLOWINT,
     DETECT_PKTVAR,
     DETECT_NOALERT,
+    DETECT_BYPASS,
     DETECT_FLOWBITS,
     DETECT_HOSTBITS,
     DETECT_IPV4_CSUM,
@@ -1206,6 +1413,8 @@ enum {
     DETECT_FILESTORE,
     DETECT_FILEMAGIC,
     DETECT_FILEMD5,
+    DETECT_FILESHA1,
+    DETECT_FILESHA256,
     DETECT_FILESIZE,
 
     DETECT_L3PROTO,
@@ -1264,6 +1473,7 @@ int SignatureIsFilestoring(Signature *);
 int SignatureIsFilemagicInspecting(Signature *);
 int SignatureIsFileMd5Inspecting(Signature *);
 int SignatureIsFilesizeInspecting(Signature *);
+int SignatureIsFiledataInspecting(Signature *);
 
 int DetectRegisterThreadCtxFuncs(DetectEngineCtx *, const char *name, void *(*InitFunc)(void *), void *data, void (*FreeFunc)(void *), int);
 void *DetectThreadCtxGetKeywordThreadCtx(DetectEngineThreadCtx *, int);
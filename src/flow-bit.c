@@ -20,11 +20,10 @@
  *
  * \author Victor Julien <victor@inliniac.net>
  *
- * Implements per flow bits. Actually, not a bit,
- * but called that way because of Snort's flowbits.
- * It's a binary storage.
+ * Implements per flow bits. The bits are kept in a bitmap per flow,
+ * indexed by the name idx of the flowbit, so checking a bit doesn't
+ * have to walk a list.
  *
- * \todo move away from a linked list implementation
  * \todo use different datatypes, such as string, int, etc.
  * \todo have more than one instance of the same var, and be able to match on a
  *       specific one, or one all at a time. So if a certain capture matches
@@ -43,42 +42,69 @@
 #include "util-unittest.h"
 
 /* get the flowbit with idx from the flow */
-static FlowBit *FlowBitGet(Flow *f, uint16_t idx)
+/** highest flowbit idx seen at rule load, used to size new bitmaps so
+ *  that a flow's bitmap normally doesn't have to grow. Only a hint: it's
+ *  read without locking, the bitmap is grown if needed. */
+static uint16_t flowbits_max_idx = 0;
+
+#define FLOWBITS_WORD(idx) ((idx) / 64)
+#define FLOWBITS_MASK(idx) (1ULL << ((idx) % 64))
+
+/** \brief register a flowbit idx used by the rules
+ *
+ *  Called at rule load time, so the bitmaps can be allocated at their
+ *  final size. */
+void FlowBitRegisterIdx(uint16_t idx)
 {
-    GenericVar *gv = f->flowvar;
-    for ( ; gv != NULL; gv = gv->next) {
-        if (gv->type == DETECT_FLOWBITS && gv->idx == idx) {
-            return (FlowBit *)gv;
-        }
-    }
+    if (idx > flowbits_max_idx)
+        flowbits_max_idx = idx;
+}
+
+/** \internal
+ *  \brief get the flow's bitmap, make it big enough to hold 'idx' */
+static FlowBits *FlowBitsGrow(Flow *f, uint16_t idx)
+{
+    FlowBits *fbs = f->flowbits;
+    if (fbs != NULL && FLOWBITS_WORD(idx) < fbs->words)
+        return fbs;
+
+    uint16_t max = flowbits_max_idx;
+    if (idx > max)
+        max = idx;
+    const uint16_t words = FLOWBITS_WORD(max) + 1;
+    const uint16_t old_words = fbs ? fbs->words : 0;
+
+    FlowBits *new_fbs = SCRealloc(fbs, sizeof(FlowBits) + words * sizeof(uint64_t));
+    if (unlikely(new_fbs == NULL))
+        return NULL;
+    memset(&new_fbs->bits[old_words], 0, (words - old_words) * sizeof(uint64_t));
+    new_fbs->words = words;
+    f->flowbits = new_fbs;
+    return new_fbs;
+}
 
-    return NULL;
+static int FlowBitGet(const Flow *f, uint16_t idx)
+{
+    const FlowBits *fbs = f->flowbits;
+    if (fbs == NULL || FLOWBITS_WORD(idx) >= fbs->words)
+        return 0;
+    return (fbs->bits[FLOWBITS_WORD(idx)] & FLOWBITS_MASK(idx)) != 0;
 }
 
-/* add a flowbit to the flow */
 static void FlowBitAdd(Flow *f, uint16_t idx)
 {
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        fb = SCMalloc(sizeof(FlowBit));
-        if (unlikely(fb == NULL))
-            return;
-
-        fb->type = DETECT_FLOWBITS;
-        fb->idx = idx;
-        fb->next = NULL;
-        GenericVarAppend(&f->flowvar, (GenericVar *)fb);
-    }
+    FlowBits *fbs = FlowBitsGrow(f, idx);
+    if (unlikely(fbs == NULL))
+        return;
+    fbs->bits[FLOWBITS_WORD(idx)] |= FLOWBITS_MASK(idx);
 }
 
 static void FlowBitRemove(Flow *f, uint16_t idx)
 {
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL)
+    FlowBits *fbs = f->flowbits;
+    if (fbs == NULL || FLOWBITS_WORD(idx) >= fbs->words)
         return;
-
-    GenericVarRemove(&f->flowvar, (GenericVar *)fb);
-    FlowBitFree(fb);
+    fbs->bits[FLOWBITS_WORD(idx)] &= ~FLOWBITS_MASK(idx);
 }
 
 void FlowBitSetNoLock(Flow *f, uint16_t idx)
@@ -107,8 +133,7 @@ void FlowBitUnset(Flow *f, uint16_t idx)
 
 void FlowBitToggleNoLock(Flow *f, uint16_t idx)
 {
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
+    if (FlowBitGet(f, idx)) {
         FlowBitRemove(f, idx);
     } else {
         FlowBitAdd(f, idx);
@@ -124,26 +149,57 @@ void FlowBitToggle(Flow *f, uint16_t idx)
 
 int FlowBitIsset(Flow *f, uint16_t idx)
 {
-    int r = 0;
-
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb != NULL) {
-        r = 1;
-    }
-
-    return r;
+    return FlowBitGet(f, idx);
 }
 
 int FlowBitIsnotset(Flow *f, uint16_t idx)
 {
-    int r = 0;
+    return !FlowBitGet(f, idx);
+}
 
-    FlowBit *fb = FlowBitGet(f, idx);
-    if (fb == NULL) {
-        r = 1;
+/** \brief iterate over the set flowbits
+ *
+ *  \param idx [in/out] set to 0 to start, the idx of the set bit on return
+ *
+ *  \retval 1 a set bit was found, its idx is in 'idx'
+ *  \retval 0 no more set bits
+ */
+int FlowBitGetNext(const Flow *f, uint16_t *idx)
+{
+    const FlowBits *fbs = f->flowbits;
+    if (fbs == NULL)
+        return 0;
+
+    /* start after the last returned bit, idx 0 isn't a valid name idx */
+    uint32_t next = (uint32_t)*idx + 1;
+    uint32_t w = next / 64;
+    if (w >= fbs->words)
+        return 0;
+
+    uint64_t word = fbs->bits[w] & (~0ULL << (next % 64));
+    while (word == 0) {
+        if (++w >= fbs->words)
+            return 0;
+        word = fbs->bits[w];
     }
+    *idx = (uint16_t)(w * 64 + __builtin_ctzll(word));
+    return 1;
+}
 
-    return r;
+/** \brief clear all bits, keeping the bitmap for the flow's next use */
+void FlowBitClearAll(Flow *f)
+{
+    FlowBits *fbs = f->flowbits;
+    if (fbs != NULL)
+        memset(fbs->bits, 0, fbs->words * sizeof(uint64_t));
+}
+
+void FlowBitFreeAll(Flow *f)
+{
+    if (f->flowbits != NULL) {
+        SCFree(f->flowbits);
+        f->flowbits = NULL;
+    }
 }
 
 void FlowBitFree(FlowBit *fb)
@@ -155,7 +211,6 @@ void FlowBitFree(FlowBit *fb)
 }
 
 
-/* TESTS */
 #ifdef UNITTESTS
 static int FlowBitTest01 (void)
 {
@@ -166,11 +221,11 @@ static int FlowBitTest01 (void)
 
     FlowBitAdd(&f, 0);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb != NULL)
+    int fb = FlowBitGet(&f, 0);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -181,11 +236,11 @@ static int FlowBitTest02 (void)
     Flow f;
     memset(&f, 0, sizeof(Flow));
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL)
+    int fb = FlowBitGet(&f, 0);
+    if (!fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -198,23 +253,23 @@ static int FlowBitTest03 (void)
 
     FlowBitAdd(&f, 0);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL) {
-        printf("fb == NULL although it was just added: ");
+    int fb = FlowBitGet(&f, 0);
+    if (!fb) {
+        printf("!fb although it was just added: ");
         goto end;
     }
 
     FlowBitRemove(&f, 0);
 
-    fb = FlowBitGet(&f,0);
-    if (fb != NULL) {
-        printf("fb != NULL although it was just removed: ");
+    fb = FlowBitGet(&f, 0);
+    if (fb) {
+        printf("fb although it was just removed: ");
         goto end;
     } else {
         ret = 1;
     }
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -230,11 +285,11 @@ static int FlowBitTest04 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb != NULL)
+    int fb = FlowBitGet(&f, 0);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -250,11 +305,11 @@ static int FlowBitTest05 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,1);
-    if (fb != NULL)
+    int fb = FlowBitGet(&f, 1);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -270,11 +325,11 @@ static int FlowBitTest06 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,2);
-    if (fb != NULL)
+    int fb = FlowBitGet(&f, 2);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -290,11 +345,11 @@ static int FlowBitTest07 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,3);
-    if (fb != NULL)
+    int fb = FlowBitGet(&f, 3);
+    if (fb)
         ret = 1;
 
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -310,21 +365,21 @@ static int FlowBitTest08 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,0);
-    if (fb == NULL)
+    int fb = FlowBitGet(&f, 0);
+    if (!fb)
         goto end;
 
     FlowBitRemove(&f,0);
 
-    fb = FlowBitGet(&f,0);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitGet(&f, 0);
+    if (fb) {
+        printf("fb even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -340,21 +395,21 @@ static int FlowBitTest09 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,1);
-    if (fb == NULL)
+    int fb = FlowBitGet(&f, 1);
+    if (!fb)
         goto end;
 
     FlowBitRemove(&f,1);
 
-    fb = FlowBitGet(&f,1);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitGet(&f, 1);
+    if (fb) {
+        printf("fb even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -370,21 +425,21 @@ static int FlowBitTest10 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,2);
-    if (fb == NULL)
+    int fb = FlowBitGet(&f, 2);
+    if (!fb)
         goto end;
 
     FlowBitRemove(&f,2);
 
-    fb = FlowBitGet(&f,2);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitGet(&f, 2);
+    if (fb) {
+        printf("fb even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -400,21 +455,61 @@ static int FlowBitTest11 (void)
     FlowBitAdd(&f, 2);
     FlowBitAdd(&f, 3);
 
-    FlowBit *fb = FlowBitGet(&f,3);
-    if (fb == NULL)
+    int fb = FlowBitGet(&f, 3);
+    if (!fb)
         goto end;
 
     FlowBitRemove(&f,3);
 
-    fb = FlowBitGet(&f,3);
-    if (fb != NULL) {
-        printf("fb != NULL even though it was removed: ");
+    fb = FlowBitGet(&f, 3);
+    if (fb) {
+        printf("fb even though it was removed: ");
         goto end;
     }
 
     ret = 1;
 end:
-    GenericVarFree(f.flowvar);
+    FlowBitFreeAll(&f);
+    return ret;
+}
+
+/** \test bits beyond the initial size grow the bitmap, iterate them */
+static int FlowBitTest12 (void)
+{
+    int ret = 0;
+
+    Flow f;
+    memset(&f, 0, sizeof(Flow));
+
+    FlowBitAdd(&f, 3);
+    if (f.flowbits == NULL)
+        goto end;
+    FlowBitAdd(&f, 1000);
+    FlowBitAdd(&f, 64);
+
+    if (!FlowBitGet(&f, 3) || !FlowBitGet(&f, 64) || !FlowBitGet(&f, 1000))
+        goto end;
+    if (FlowBitGet(&f, 63) || FlowBitGet(&f, 999) || FlowBitGet(&f, 60000))
+        goto end;
+
+    uint16_t idx = 0;
+    if (!FlowBitGetNext(&f, &idx) || idx != 3)
+        goto end;
+    if (!FlowBitGetNext(&f, &idx) || idx != 64)
+        goto end;
+    if (!FlowBitGetNext(&f, &idx) || idx != 1000)
+        goto end;
+    if (FlowBitGetNext(&f, &idx))
+        goto end;
+
+    FlowBitClearAll(&f);
+    idx = 0;
+    if (FlowBitGetNext(&f, &idx))
+        goto end;
+
+    ret = 1;
+end:
+    FlowBitFreeAll(&f);
     return ret;
 }
 
@@ -434,6 +529,7 @@ void FlowBitRegisterTests(void)
     UtRegisterTest("FlowBitTest09", FlowBitTest09);
     UtRegisterTest("FlowBitTest10", FlowBitTest10);
     UtRegisterTest("FlowBitTest11", FlowBitTest11);
+    UtRegisterTest("FlowBitTest12", FlowBitTest12);
 #endif /* UNITTESTS */
 }
 
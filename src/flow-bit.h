@@ -27,6 +27,13 @@
 #include "flow.h"
 #include "util-var.h"
 
+/** per flow bitmap of the set flowbits, indexed by name idx */
+typedef struct FlowBits_ {
+    uint16_t words;     /**< size of bits in 64 bit words */
+    uint64_t bits[];
+} FlowBits;
+
+/** list node, only kept for GenericVar lists of older users */
 typedef struct FlowBit_ {
     uint8_t type; /* type, DETECT_FLOWBITS in this case */
     uint16_t idx; /* name idx */
@@ -38,6 +45,11 @@ typedef struct FlowBit_ {
 void FlowBitFree(FlowBit *);
 void FlowBitRegisterTests(void);
 
+void FlowBitRegisterIdx(uint16_t idx);
+int FlowBitGetNext(const Flow *f, uint16_t *idx);
+void FlowBitClearAll(Flow *f);
+void FlowBitFreeAll(Flow *f);
+
 void FlowBitSetNoLock(Flow *, uint16_t);
 void FlowBitSet(Flow *, uint16_t);
 void FlowBitUnsetNoLock(Flow *, uint16_t);
@@ -0,0 +1,1137 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Flow table checkpoint.
+ *
+ * At shutdown or on the 'flow-checkpoint' unix socket command the flows
+ * are written to a file: the tuple, times, counters and inspection flags,
+ * the flowbits and flowvars by name, and for established TCP sessions the
+ * sequence tracking of both streams. App layer state and stream data are
+ * not kept.
+ *
+ * At the next start the file is mapped and loaded into a table before the
+ * capture starts. A new flow matching an entry, in either direction, gets
+ * its direction, times, counters and vars back, and its TCP session is set
+ * up from the stored state when the first packet reaches the stream
+ * engine, instead of being picked up midstream (or not at all). The app
+ * layer sees the session as a midstream one. Entries no flow claimed
+ * within 'max-age' seconds of packet time are dropped.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "decode.h"
+#include "flow.h"
+#include "flow-private.h"
+#include "flow-hash.h"
+#include "flow-util.h"
+#include "flow-storage.h"
+#include "flow-bit.h"
+#include "flow-var.h"
+#include "flow-checkpoint.h"
+#include "stream-tcp-private.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "util-var-name.h"
+#include "util-conf.h"
+#include "util-hash-lookup3.h"
+#include "util-storage.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define FLOW_CHECKPOINT_MAGIC       0x53434650  /* "SCFP" */
+#define FLOW_CHECKPOINT_VERSION     1
+
+#define FLOW_CHECKPOINT_DEFAULT_FILENAME    "flow-checkpoint.bin"
+#define FLOW_CHECKPOINT_DEFAULT_MAX_AGE     600
+
+#define FLOW_CHECKPOINT_VAR_BIT     1
+#define FLOW_CHECKPOINT_VAR_INT     2
+#define FLOW_CHECKPOINT_VAR_STR     3
+
+/** flags that still hold for the flow after the restart */
+#define FLOW_CHECKPOINT_FLOW_FLAGS  (FLOW_NOPACKET_INSPECTION | \
+        FLOW_NOPAYLOAD_INSPECTION | FLOW_ACTION_DROP)
+#define FLOW_CHECKPOINT_SSN_FLAGS   (STREAMTCP_FLAG_TIMESTAMP | \
+        STREAMTCP_FLAG_SERVER_WSCALE | STREAMTCP_FLAG_ASYNC | \
+        STREAMTCP_FLAG_4WHS | STREAMTCP_FLAG_CLIENT_SACKOK | \
+        STREAMTCP_FLAG_SACKOK | STREAMTCP_FLAG_3WHS_CONFIRMED)
+#define FLOW_CHECKPOINT_STREAM_FLAGS (STREAMTCP_STREAM_FLAG_NOREASSEMBLY | \
+        STREAMTCP_STREAM_FLAG_DEPTH_REACHED | STREAMTCP_STREAM_FLAG_TIMESTAMP | \
+        STREAMTCP_STREAM_FLAG_ZERO_TIMESTAMP)
+
+typedef struct FlowCheckpointHeader_ {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   /**< sizeof(FlowCheckpointRecord) */
+    uint32_t cnt;           /**< number of records */
+    uint32_t checksum;      /**< hashlittle of the records */
+    uint64_t len;           /**< bytes of records */
+} FlowCheckpointHeader;
+
+typedef struct FlowCheckpointStream_ {
+    uint32_t isn;
+    uint32_t next_seq;
+    uint32_t last_ack;
+    uint32_t next_win;
+    uint32_t window;
+    uint32_t last_ts;
+    uint32_t last_pkt_ts;
+    uint16_t flags;
+    uint8_t wscale;
+    uint8_t os_policy;
+} FlowCheckpointStream;
+
+/** fixed part of a flow record, followed by vars_cnt vars */
+typedef struct FlowCheckpointRecord_ {
+    FlowAddress src, dst;
+    Port sp, dp;
+    uint8_t proto;
+    uint8_t recursion_level;
+    uint16_t vlan_id[2];
+    uint16_t vars_cnt;
+    uint32_t vni;
+    uint32_t flags;         /**< FLOW_IPV4/FLOW_IPV6, FLOW_CHECKPOINT_FLOW_FLAGS */
+    uint64_t startts_sec;
+    uint64_t lastts_sec;
+    uint32_t startts_usec;
+    uint32_t lastts_usec;
+    uint32_t todstpktcnt;
+    uint32_t tosrcpktcnt;
+    uint64_t todstbytecnt;
+    uint64_t tosrcbytecnt;
+
+    uint8_t tcp_state;      /**< TCP_NONE if no session was kept */
+    uint8_t pad;
+    uint16_t tcp_flags;
+    FlowCheckpointStream client, server;
+} FlowCheckpointRecord;
+
+/** var of a record, followed by the name and the string value */
+typedef struct FlowCheckpointVarHdr_ {
+    uint8_t type;           /**< FLOW_CHECKPOINT_VAR_* */
+    uint8_t name_len;
+    uint16_t value_len;     /**< string value length */
+    uint32_t value;         /**< int value */
+} FlowCheckpointVarHdr;
+
+/** var with its name resolved against the current detect engine */
+typedef struct FlowCheckpointVar_ {
+    uint8_t type;
+    uint16_t idx;
+    uint16_t value_len;
+    uint32_t value;
+    uint8_t *str;
+} FlowCheckpointVar;
+
+typedef struct FlowCheckpointEntry_ {
+    FlowCheckpointRecord rec;
+    uint16_t vars_cnt;
+    FlowCheckpointVar *vars;
+    struct FlowCheckpointEntry_ *next;
+} FlowCheckpointEntry;
+
+/** tcp state kept in the flow storage until the stream engine sets up
+ *  the session */
+typedef struct FlowCheckpointTcp_ {
+    uint8_t state;
+    uint16_t flags;
+    FlowCheckpointStream client, server;
+} FlowCheckpointTcp;
+
+typedef struct FlowCheckpointBuffer_ {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} FlowCheckpointBuffer;
+
+static struct {
+    int enabled;
+    int at_shutdown;
+    uint32_t max_age;
+    char path[PATH_MAX];
+} checkpoint_config = { 0, 1, FLOW_CHECKPOINT_DEFAULT_MAX_AGE, "" };
+
+static int checkpoint_storage_id = -1;
+
+/* table of the flows to restore, behind a single lock as it's only looked
+ * in for new flows and empties soon after the start */
+static FlowCheckpointEntry **restore_hash = NULL;
+static uint32_t restore_hash_size = 0;
+/** packet time after which the left over entries are dropped */
+static uint64_t restore_expire = 0;
+static SCMutex restore_lock = SCMUTEX_INITIALIZER;
+/** number of entries, read without the lock */
+SC_ATOMIC_DECLARE(uint32_t, restore_cnt);
+
+static void CheckpointTcpFree(void *ptr)
+{
+    SCFree(ptr);
+}
+
+static int CheckpointRegisterStorage(void)
+{
+    checkpoint_storage_id = FlowStorageRegister("flow-checkpoint",
+            sizeof(void *), NULL, CheckpointTcpFree);
+    return checkpoint_storage_id;
+}
+
+void FlowCheckpointInitCtx(void)
+{
+    SC_ATOMIC_INIT(restore_cnt);
+
+    ConfNode *conf = ConfGetNode("flow.checkpoint");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return;
+
+    int at_shutdown;
+    if (ConfGetChildValueBool(conf, "at-shutdown", &at_shutdown) == 1)
+        checkpoint_config.at_shutdown = at_shutdown;
+
+    intmax_t max_age;
+    if (ConfGetChildValueInt(conf, "max-age", &max_age) == 1) {
+        if (max_age <= 0 || max_age > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid flow.checkpoint."
+                    "max-age %"PRIdMAX", using %u", max_age,
+                    FLOW_CHECKPOINT_DEFAULT_MAX_AGE);
+        } else {
+            checkpoint_config.max_age = (uint32_t)max_age;
+        }
+    }
+
+    const char *filename = ConfNodeLookupChildValue(conf, "filename");
+    if (filename == NULL)
+        filename = FLOW_CHECKPOINT_DEFAULT_FILENAME;
+    strlcpy(checkpoint_config.path, filename, sizeof(checkpoint_config.path));
+
+    if (CheckpointRegisterStorage() < 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "flow checkpoint storage "
+                "registration failed, checkpoint disabled");
+        return;
+    }
+    checkpoint_config.enabled = 1;
+    SCLogConfig("flow checkpoint %s%s, max-age %us", checkpoint_config.path,
+            checkpoint_config.at_shutdown ? " at shutdown" : "",
+            checkpoint_config.max_age);
+}
+
+/** \internal
+ *  \brief make a relative filename relative to the log dir. Done at load
+ *         time, as a multi-process worker has its own log dir. */
+static void CheckpointSetPath(void)
+{
+    if (PathIsAbsolute(checkpoint_config.path))
+        return;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", ConfigGetLogDirectory(),
+            checkpoint_config.path);
+    strlcpy(checkpoint_config.path, path, sizeof(checkpoint_config.path));
+}
+
+static int CheckpointBufferAdd(FlowCheckpointBuffer *b, const void *data,
+        size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 65536;
+        while (size < b->len + len)
+            size *= 2;
+        uint8_t *ptr = SCRealloc(b->data, size);
+        if (unlikely(ptr == NULL))
+            return -1;
+        b->data = ptr;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static uint32_t CheckpointHash(const FlowAddress *src, const FlowAddress *dst,
+        Port sp, Port dp, uint8_t proto)
+{
+    /* same for both directions */
+    uint32_t k[5];
+    int i;
+    for (i = 0; i < 4; i++)
+        k[i] = src->addr_data32[i] ^ dst->addr_data32[i];
+    k[4] = ((uint32_t)(sp ^ dp) << 8) | proto;
+    return hashword(k, 5, 0);
+}
+
+static void CheckpointStreamSet(FlowCheckpointStream *s, const TcpStream *stream)
+{
+    s->isn = stream->isn;
+    s->next_seq = stream->next_seq;
+    s->last_ack = stream->last_ack;
+    s->next_win = stream->next_win;
+    s->window = stream->window;
+    s->last_ts = stream->last_ts;
+    s->last_pkt_ts = stream->last_pkt_ts;
+    s->flags = stream->flags & FLOW_CHECKPOINT_STREAM_FLAGS;
+    s->wscale = stream->wscale;
+    s->os_policy = stream->os_policy;
+}
+
+static void CheckpointStreamRestore(TcpStream *stream, const FlowCheckpointStream *s)
+{
+    stream->isn = s->isn;
+    stream->next_seq = s->next_seq;
+    stream->last_ack = s->last_ack;
+    stream->next_win = s->next_win;
+    stream->window = s->window;
+    stream->last_ts = s->last_ts;
+    stream->last_pkt_ts = s->last_pkt_ts;
+    stream->flags |= s->flags & FLOW_CHECKPOINT_STREAM_FLAGS;
+    stream->wscale = s->wscale;
+    stream->os_policy = s->os_policy;
+    /* the unacked data wasn't kept, reassemble from the first byte the
+     * other side hasn't acked, it's likely sent again */
+    STREAMTCP_SET_RA_BASE_SEQ(stream, s->last_ack - 1);
+}
+
+/**
+ * \internal
+ * \brief add a var with its name to the buffer
+ *
+ * \retval 1 added
+ * \retval 0 skipped, the engine doesn't know the idx
+ * \retval -1 out of memory
+ */
+static int CheckpointAddVar(FlowCheckpointBuffer *b, DetectEngineCtx *de_ctx,
+        uint8_t type, enum VarTypes var_type, uint16_t idx, uint32_t value,
+        const uint8_t *str, uint16_t str_len)
+{
+    char *name = VariableIdxGetName(de_ctx, idx, var_type);
+    if (name == NULL)
+        return 0;
+
+    int r = 0;
+    size_t name_len = strlen(name);
+    if (name_len > 0 && name_len <= UINT8_MAX) {
+        FlowCheckpointVarHdr h = { type, (uint8_t)name_len, str_len, value };
+        if (CheckpointBufferAdd(b, &h, sizeof(h)) == 0 &&
+            CheckpointBufferAdd(b, name, name_len) == 0 &&
+            (str_len == 0 || CheckpointBufferAdd(b, str, str_len) == 0))
+            r = 1;
+        else
+            r = -1;
+    }
+    SCFree(name);
+    return r;
+}
+
+/**
+ * \internal
+ * \brief add a flow to the buffer, the flow is locked
+ *
+ * \retval 1 added
+ * \retval 0 skipped
+ * \retval -1 out of memory
+ */
+static int CheckpointAddFlow(FlowCheckpointBuffer *b, DetectEngineCtx *de_ctx,
+        const Flow *f)
+{
+    const TcpSession *ssn = NULL;
+
+    if (f->flags & FLOW_TCP_REUSED)
+        return 0;
+    if (f->proto == IPPROTO_TCP) {
+        /* sessions before the handshake completed or after both sides
+         * closed aren't worth carrying over */
+        ssn = (const TcpSession *)f->protoctx;
+        if (ssn == NULL || ssn->state < TCP_ESTABLISHED ||
+            ssn->state == TCP_TIME_WAIT || ssn->state == TCP_LAST_ACK ||
+            ssn->state == TCP_CLOSED)
+            return 0;
+    }
+
+    FlowCheckpointRecord rec;
+    memset(&rec, 0x00, sizeof(rec));
+    rec.src = f->src;
+    rec.dst = f->dst;
+    rec.sp = f->sp;
+    rec.dp = f->dp;
+    rec.proto = f->proto;
+    rec.recursion_level = f->recursion_level;
+    rec.vlan_id[0] = f->vlan_id[0];
+    rec.vlan_id[1] = f->vlan_id[1];
+    rec.vni = f->vni;
+    rec.flags = f->flags & (FLOW_IPV4 | FLOW_IPV6 | FLOW_CHECKPOINT_FLOW_FLAGS);
+    rec.startts_sec = (uint64_t)f->startts.tv_sec;
+    rec.startts_usec = (uint32_t)f->startts.tv_usec;
+    rec.lastts_sec = (uint64_t)f->lastts.tv_sec;
+    rec.lastts_usec = (uint32_t)f->lastts.tv_usec;
+    rec.todstpktcnt = f->todstpktcnt;
+    rec.tosrcpktcnt = f->tosrcpktcnt;
+    rec.todstbytecnt = f->todstbytecnt;
+    rec.tosrcbytecnt = f->tosrcbytecnt;
+    if (ssn != NULL) {
+        rec.tcp_state = ssn->state;
+        rec.tcp_flags = ssn->flags & FLOW_CHECKPOINT_SSN_FLAGS;
+        CheckpointStreamSet(&rec.client, &ssn->client);
+        CheckpointStreamSet(&rec.server, &ssn->server);
+    }
+
+    const size_t rec_offset = b->len;
+    if (CheckpointBufferAdd(b, &rec, sizeof(rec)) < 0)
+        return -1;
+
+    /* vars go by name, the idx can differ in the next engine */
+    if (de_ctx == NULL)
+        return 1;
+
+    uint16_t vars_cnt = 0;
+    uint16_t idx = 0;
+    int r;
+    while (vars_cnt < UINT16_MAX && FlowBitGetNext(f, &idx)) {
+        r = CheckpointAddVar(b, de_ctx, FLOW_CHECKPOINT_VAR_BIT,
+                VAR_TYPE_FLOW_BIT, idx, 0, NULL, 0);
+        if (r < 0)
+            return -1;
+        vars_cnt += r;
+    }
+    const GenericVar *gv;
+    for (gv = f->flowvar; gv != NULL && vars_cnt < UINT16_MAX; gv = gv->next) {
+        if (gv->type != DETECT_FLOWVAR)
+            continue;
+        const FlowVar *fv = (const FlowVar *)gv;
+        if (fv->datatype == FLOWVAR_TYPE_INT) {
+            r = CheckpointAddVar(b, de_ctx, FLOW_CHECKPOINT_VAR_INT,
+                    VAR_TYPE_FLOW_INT, fv->idx, fv->data.fv_int.value, NULL, 0);
+        } else if (fv->datatype == FLOWVAR_TYPE_STR) {
+            r = CheckpointAddVar(b, de_ctx, FLOW_CHECKPOINT_VAR_STR,
+                    VAR_TYPE_FLOW_VAR, fv->idx, 0, fv->data.fv_str.value,
+                    fv->data.fv_str.value_len);
+        } else {
+            continue;
+        }
+        if (r < 0)
+            return -1;
+        vars_cnt += r;
+    }
+    memcpy(b->data + rec_offset + offsetof(FlowCheckpointRecord, vars_cnt),
+            &vars_cnt, sizeof(vars_cnt));
+    return 1;
+}
+
+/**
+ * \brief write the flows of the flow hash to a checkpoint file
+ *
+ * Written to a temp file that is then renamed, so that an interrupted run
+ * never leaves a partial file.
+ *
+ * \param path file to write
+ * \param cnt set to the number of flows written
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int FlowCheckpointWrite(const char *path, uint32_t *cnt)
+{
+    FlowCheckpointBuffer b = { NULL, 0, 0 };
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    uint32_t n = 0;
+    uint32_t idx;
+    int r = 0;
+
+    *cnt = 0;
+    for (idx = 0; idx < flow_config.hash_size && r == 0; idx++) {
+        FlowBucket *fb = &flow_hash[idx];
+        FBLOCK_LOCK(fb);
+        Flow *f;
+        for (f = fb->head; f != NULL; f = f->hnext) {
+            FLOWLOCK_RDLOCK(f);
+            r = CheckpointAddFlow(&b, de_ctx, f);
+            FLOWLOCK_UNLOCK(f);
+            if (r < 0)
+                break;
+            n += r;
+            r = 0;
+        }
+        FBLOCK_UNLOCK(fb);
+    }
+    if (de_ctx != NULL)
+        DetectEngineDeReference(&de_ctx);
+    if (r < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "out of memory writing the flow "
+                "checkpoint");
+        goto error;
+    }
+
+    char tmp[PATH_MAX];
+    r = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (r < 0 || (size_t)r >= sizeof(tmp))
+        goto error;
+
+    FlowCheckpointHeader h;
+    memset(&h, 0x00, sizeof(h));
+    h.magic = FLOW_CHECKPOINT_MAGIC;
+    h.version = FLOW_CHECKPOINT_VERSION;
+    h.record_size = sizeof(FlowCheckpointRecord);
+    h.cnt = n;
+    h.len = b.len;
+    h.checksum = b.len ? hashlittle(b.data, b.len, 0) : 0;
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open %s: %s", tmp,
+                strerror(errno));
+        goto error;
+    }
+
+    int ok = (fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              (b.len == 0 || fwrite(b.data, b.len, 1, fp) == 1));
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    if (!ok || rename(tmp, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write %s: %s", path,
+                strerror(errno));
+        unlink(tmp);
+        goto error;
+    }
+
+    if (b.data != NULL)
+        SCFree(b.data);
+    *cnt = n;
+    return 0;
+
+error:
+    if (b.data != NULL)
+        SCFree(b.data);
+    return -1;
+}
+
+static void CheckpointEntryFree(FlowCheckpointEntry *e)
+{
+    uint16_t i;
+    for (i = 0; i < e->vars_cnt; i++) {
+        if (e->vars[i].str != NULL)
+            SCFree(e->vars[i].str);
+    }
+    if (e->vars != NULL)
+        SCFree(e->vars);
+    SCFree(e);
+}
+
+/** \internal \brief free the restore table, the lock is held */
+static void CheckpointTableFree(void)
+{
+    uint32_t i;
+
+    if (restore_hash == NULL)
+        return;
+    for (i = 0; i < restore_hash_size; i++) {
+        while (restore_hash[i] != NULL) {
+            FlowCheckpointEntry *e = restore_hash[i];
+            restore_hash[i] = e->next;
+            CheckpointEntryFree(e);
+        }
+    }
+    SCFree(restore_hash);
+    restore_hash = NULL;
+    restore_hash_size = 0;
+    SC_ATOMIC_SET(restore_cnt, 0);
+}
+
+/** \brief free the flows not restored */
+void FlowCheckpointFree(void)
+{
+    SCMutexLock(&restore_lock);
+    CheckpointTableFree();
+    SCMutexUnlock(&restore_lock);
+}
+
+/**
+ * \internal
+ * \brief read the vars of a record, keeping those the engine knows
+ *
+ * \retval bytes read or -1 if the data is truncated or out of memory
+ */
+static int64_t CheckpointReadVars(FlowCheckpointEntry *e, const uint8_t *data,
+        uint64_t len, DetectEngineCtx *de_ctx)
+{
+    uint64_t offset = 0;
+    uint16_t i;
+
+    if (e->rec.vars_cnt == 0)
+        return 0;
+    e->vars = SCCalloc(e->rec.vars_cnt, sizeof(FlowCheckpointVar));
+    if (unlikely(e->vars == NULL))
+        return -1;
+
+    for (i = 0; i < e->rec.vars_cnt; i++) {
+        FlowCheckpointVarHdr h;
+        if (len - offset < sizeof(h))
+            return -1;
+        memcpy(&h, data + offset, sizeof(h));
+        offset += sizeof(h);
+        if (len - offset < (uint64_t)h.name_len + h.value_len)
+            return -1;
+
+        char name[UINT8_MAX + 1];
+        memcpy(name, data + offset, h.name_len);
+        name[h.name_len] = '\0';
+        const uint8_t *str = data + offset + h.name_len;
+        offset += (uint64_t)h.name_len + h.value_len;
+
+        enum VarTypes var_type;
+        if (h.type == FLOW_CHECKPOINT_VAR_BIT)
+            var_type = VAR_TYPE_FLOW_BIT;
+        else if (h.type == FLOW_CHECKPOINT_VAR_INT)
+            var_type = VAR_TYPE_FLOW_INT;
+        else if (h.type == FLOW_CHECKPOINT_VAR_STR)
+            var_type = VAR_TYPE_FLOW_VAR;
+        else
+            continue;
+
+        /* names no rule uses anymore are dropped */
+        uint16_t idx = de_ctx ? VariableNameLookupIdx(de_ctx, name, var_type) : 0;
+        if (idx == 0)
+            continue;
+
+        FlowCheckpointVar *v = &e->vars[e->vars_cnt];
+        v->type = h.type;
+        v->idx = idx;
+        v->value = h.value;
+        if (h.type == FLOW_CHECKPOINT_VAR_STR) {
+            if (h.value_len == 0)
+                continue;
+            v->str = SCMalloc(h.value_len);
+            if (unlikely(v->str == NULL))
+                return -1;
+            memcpy(v->str, str, h.value_len);
+            v->value_len = h.value_len;
+        }
+        e->vars_cnt++;
+    }
+    return (int64_t)offset;
+}
+
+/**
+ * \internal
+ * \brief fill the restore table from the records of a checkpoint
+ *
+ * \retval 0 ok
+ * \retval -1 bad data or out of memory, the table is freed
+ */
+static int CheckpointLoadRecords(const uint8_t *data, uint64_t len,
+        uint32_t cnt, DetectEngineCtx *de_ctx)
+{
+    uint64_t offset = 0;
+    uint32_t i;
+
+    SCMutexLock(&restore_lock);
+    CheckpointTableFree();
+    restore_hash_size = MAX(cnt, 1024);
+    restore_hash = SCCalloc(restore_hash_size, sizeof(FlowCheckpointEntry *));
+    if (unlikely(restore_hash == NULL)) {
+        restore_hash_size = 0;
+        SCMutexUnlock(&restore_lock);
+        return -1;
+    }
+
+    restore_expire = 0;
+    for (i = 0; i < cnt; i++) {
+        if (len - offset < sizeof(FlowCheckpointRecord))
+            goto error;
+
+        FlowCheckpointEntry *e = SCCalloc(1, sizeof(*e));
+        if (unlikely(e == NULL))
+            goto error;
+        memcpy(&e->rec, data + offset, sizeof(e->rec));
+        offset += sizeof(e->rec);
+
+        int64_t r = CheckpointReadVars(e, data + offset, len - offset, de_ctx);
+        if (r < 0) {
+            CheckpointEntryFree(e);
+            goto error;
+        }
+        offset += (uint64_t)r;
+
+        const uint32_t idx = CheckpointHash(&e->rec.src, &e->rec.dst,
+                e->rec.sp, e->rec.dp, e->rec.proto) % restore_hash_size;
+        e->next = restore_hash[idx];
+        restore_hash[idx] = e;
+        (void)SC_ATOMIC_ADD(restore_cnt, 1);
+
+        restore_expire = MAX(restore_expire,
+                e->rec.lastts_sec + checkpoint_config.max_age);
+    }
+    SCMutexUnlock(&restore_lock);
+    return 0;
+
+error:
+    CheckpointTableFree();
+    SCMutexUnlock(&restore_lock);
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief load a checkpoint file into the restore table
+ *
+ * \retval cnt number of flows loaded
+ * \retval -1 no file or bad file
+ */
+static int64_t CheckpointLoadFile(const char *path, DetectEngineCtx *de_ctx)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            SCLogWarning(SC_ERR_FOPEN, "failed to open flow checkpoint %s: %s",
+                    path, strerror(errno));
+        }
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FlowCheckpointHeader)) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "flow checkpoint %s is truncated",
+                path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "failed to map flow checkpoint "
+                "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    FlowCheckpointHeader h;
+    memcpy(&h, map, sizeof(h));
+    const uint8_t *data = (const uint8_t *)map + sizeof(h);
+
+    int64_t r = -1;
+    if (h.magic != FLOW_CHECKPOINT_MAGIC || h.version != FLOW_CHECKPOINT_VERSION ||
+        h.record_size != sizeof(FlowCheckpointRecord) ||
+        h.len != (uint64_t)st.st_size - sizeof(h) ||
+        (h.len && hashlittle(data, (size_t)h.len, 0) != h.checksum))
+    {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "flow checkpoint %s was not "
+                "written by this version or is damaged, ignoring it", path);
+    } else if (CheckpointLoadRecords(data, h.len, h.cnt, de_ctx) != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "failed to load flow checkpoint "
+                "%s, ignoring it", path);
+    } else {
+        r = h.cnt;
+    }
+    munmap(map, (size_t)st.st_size);
+    return r;
+}
+
+/**
+ * \brief load the checkpoint, if there is one, before the capture starts
+ *
+ * The file is removed once loaded, so that the same flows aren't restored
+ * again after a later crash.
+ */
+void FlowCheckpointLoad(void)
+{
+    if (!checkpoint_config.enabled)
+        return;
+    CheckpointSetPath();
+
+    /* the var names are resolved against the engine of the rules that are
+     * about to inspect the flows */
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    int64_t cnt = CheckpointLoadFile(checkpoint_config.path, de_ctx);
+    if (de_ctx != NULL)
+        DetectEngineDeReference(&de_ctx);
+    if (cnt < 0)
+        return;
+
+    SCLogInfo("restoring %"PRId64" flows from %s", cnt, checkpoint_config.path);
+    if (unlink(checkpoint_config.path) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to remove flow checkpoint %s: %s",
+                checkpoint_config.path, strerror(errno));
+    }
+}
+
+/** \brief write the checkpoint at shutdown, after the capture stopped */
+void FlowCheckpointShutdown(void)
+{
+    if (!checkpoint_config.enabled || !checkpoint_config.at_shutdown)
+        return;
+
+    uint32_t cnt = 0;
+    if (FlowCheckpointWrite(checkpoint_config.path, &cnt) == 0) {
+        SCLogInfo("wrote %u flows to flow checkpoint %s", cnt,
+                checkpoint_config.path);
+    }
+}
+
+static int CheckpointMatch(const FlowCheckpointRecord *rec, const Flow *f,
+        int *reversed)
+{
+    if (rec->proto != f->proto || rec->recursion_level != f->recursion_level ||
+        rec->vlan_id[0] != f->vlan_id[0] || rec->vlan_id[1] != f->vlan_id[1] ||
+        rec->vni != f->vni ||
+        (rec->flags & (FLOW_IPV4 | FLOW_IPV6)) != (f->flags & (FLOW_IPV4 | FLOW_IPV6)))
+        return 0;
+
+    if (rec->sp == f->sp && rec->dp == f->dp &&
+        memcmp(&rec->src, &f->src, sizeof(rec->src)) == 0 &&
+        memcmp(&rec->dst, &f->dst, sizeof(rec->dst)) == 0)
+    {
+        *reversed = 0;
+        return 1;
+    }
+    if (rec->sp == f->dp && rec->dp == f->sp &&
+        memcmp(&rec->src, &f->dst, sizeof(rec->src)) == 0 &&
+        memcmp(&rec->dst, &f->src, sizeof(rec->dst)) == 0)
+    {
+        *reversed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void CheckpointApply(Flow *f, const FlowCheckpointEntry *e, int reversed)
+{
+    const FlowCheckpointRecord *rec = &e->rec;
+    uint16_t i;
+
+    /* keep the direction of the original flow, the first packet after
+     * the restart may well come from the server */
+    if (reversed) {
+        FlowAddress addr = f->src;
+        f->src = f->dst;
+        f->dst = addr;
+        Port port = f->sp;
+        f->sp = f->dp;
+        f->dp = port;
+    }
+
+    f->flags |= rec->flags & FLOW_CHECKPOINT_FLOW_FLAGS;
+    f->startts.tv_sec = (time_t)rec->startts_sec;
+    f->startts.tv_usec = (suseconds_t)rec->startts_usec;
+    f->todstpktcnt = rec->todstpktcnt;
+    f->tosrcpktcnt = rec->tosrcpktcnt;
+    f->todstbytecnt = rec->todstbytecnt;
+    f->tosrcbytecnt = rec->tosrcbytecnt;
+
+    for (i = 0; i < e->vars_cnt; i++) {
+        const FlowCheckpointVar *v = &e->vars[i];
+        if (v->type == FLOW_CHECKPOINT_VAR_BIT) {
+            FlowBitSetNoLock(f, v->idx);
+        } else if (v->type == FLOW_CHECKPOINT_VAR_INT) {
+            FlowVarAddIntNoLock(f, v->idx, v->value);
+        } else if (v->type == FLOW_CHECKPOINT_VAR_STR) {
+            uint8_t *str = SCMalloc(v->value_len);
+            if (unlikely(str == NULL))
+                continue;
+            memcpy(str, v->str, v->value_len);
+            FlowVarAddStrNoLock(f, v->idx, str, v->value_len);
+        }
+    }
+
+    if (rec->tcp_state != TCP_NONE && f->proto == IPPROTO_TCP &&
+        checkpoint_storage_id != -1)
+    {
+        FlowCheckpointTcp *t = SCMalloc(sizeof(*t));
+        if (unlikely(t == NULL))
+            return;
+        t->state = rec->tcp_state;
+        t->flags = rec->tcp_flags;
+        t->client = rec->client;
+        t->server = rec->server;
+        FlowSetStorageById(f, checkpoint_storage_id, t);
+    }
+}
+
+/**
+ * \brief restore a new flow from the checkpoint, if it was in it
+ *
+ * Called for a new, locked flow right after FlowInit. The flow may get
+ * its direction reversed.
+ */
+void FlowCheckpointRestoreFlow(Flow *f, const Packet *p)
+{
+    if (likely(SC_ATOMIC_GET(restore_cnt) == 0))
+        return;
+
+    const uint64_t now = (uint64_t)p->ts.tv_sec;
+    FlowCheckpointEntry *e = NULL;
+    int reversed = 0;
+
+    SCMutexLock(&restore_lock);
+    if (restore_hash == NULL) {
+        SCMutexUnlock(&restore_lock);
+        return;
+    }
+    if (now >= restore_expire) {
+        SCLogInfo("dropping the %u flows of the checkpoint that didn't "
+                "return", SC_ATOMIC_GET(restore_cnt));
+        CheckpointTableFree();
+        SCMutexUnlock(&restore_lock);
+        return;
+    }
+
+    const uint32_t idx = CheckpointHash(&f->src, &f->dst, f->sp, f->dp,
+            f->proto) % restore_hash_size;
+    FlowCheckpointEntry **pe = &restore_hash[idx];
+    while (*pe != NULL) {
+        if (CheckpointMatch(&(*pe)->rec, f, &reversed)) {
+            e = *pe;
+            *pe = e->next;
+            (void)SC_ATOMIC_SUB(restore_cnt, 1);
+            break;
+        }
+        pe = &(*pe)->next;
+    }
+    SCMutexUnlock(&restore_lock);
+
+    if (e == NULL)
+        return;
+    if (now <= e->rec.lastts_sec + checkpoint_config.max_age) {
+        SCLogDebug("flow %p restored from the checkpoint%s", f,
+                reversed ? ", reversed" : "");
+        CheckpointApply(f, e, reversed);
+    }
+    CheckpointEntryFree(e);
+}
+
+/** \brief see if a flow has a tcp session waiting to be restored */
+int FlowCheckpointHasTcp(const Flow *f)
+{
+    if (checkpoint_storage_id == -1)
+        return 0;
+    return FlowGetStorageById((Flow *)f, checkpoint_storage_id) != NULL;
+}
+
+/**
+ * \brief set up a new tcp session from the checkpoint
+ *
+ * The session is marked midstream, for the app layer that starts over.
+ *
+ * \retval state the tcp state to set, TCP_NONE if there was nothing to
+ *         restore
+ */
+uint8_t FlowCheckpointRestoreTcp(Flow *f, TcpSession *ssn)
+{
+    if (checkpoint_storage_id == -1)
+        return TCP_NONE;
+    FlowCheckpointTcp *t = FlowGetStorageById(f, checkpoint_storage_id);
+    if (t == NULL)
+        return TCP_NONE;
+
+    ssn->flags |= STREAMTCP_FLAG_MIDSTREAM | (t->flags & FLOW_CHECKPOINT_SSN_FLAGS);
+    CheckpointStreamRestore(&ssn->client, &t->client);
+    CheckpointStreamRestore(&ssn->server, &t->server);
+    const uint8_t state = t->state;
+
+    FlowSetStorageById(f, checkpoint_storage_id, NULL);
+    SCFree(t);
+    return state;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/** \brief unix socket command writing the checkpoint */
+TmEcode FlowCheckpointUnixCommand(json_t *cmd, json_t *answer, void *data)
+{
+    if (!checkpoint_config.enabled) {
+        json_object_set_new(answer, "message",
+                json_string("flow checkpoint is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+    /* the flow threads don't lock their part of the hash */
+    if (flow_config.thread_local) {
+        json_object_set_new(answer, "message",
+                json_string("not available with flow.thread-local, the "
+                    "checkpoint is written at shutdown"));
+        return TM_ECODE_FAILED;
+    }
+
+    uint32_t cnt = 0;
+    if (FlowCheckpointWrite(checkpoint_config.path, &cnt) != 0) {
+        json_object_set_new(answer, "message",
+                json_string("writing the flow checkpoint failed"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(jdata, "count", json_integer(cnt));
+    json_object_set_new(jdata, "filename", json_string(checkpoint_config.path));
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#ifdef UNITTESTS
+/** \test a tcp flow written to the buffer is restored on a flow seen
+ *        from the other side */
+static int FlowCheckpointTest01(void)
+{
+    StorageInit();
+    FAIL_IF(CheckpointRegisterStorage() < 0);
+    StorageFinalize();
+    SC_ATOMIC_INIT(restore_cnt);
+    uint32_t max_age = checkpoint_config.max_age;
+    checkpoint_config.max_age = 60;
+
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    f->proto = IPPROTO_TCP;
+    f->flags |= FLOW_IPV4 | FLOW_ACTION_DROP;
+    f->src.addr_data32[0] = 0x01020304;
+    f->dst.addr_data32[0] = 0x05060708;
+    f->sp = 40000;
+    f->dp = 80;
+    f->startts.tv_sec = 900;
+    f->lastts.tv_sec = 1000;
+    f->todstpktcnt = 10;
+    f->tosrcbytecnt = 5000;
+
+    TcpSession ssn;
+    memset(&ssn, 0x00, sizeof(ssn));
+    ssn.state = TCP_ESTABLISHED;
+    ssn.flags = STREAMTCP_FLAG_SACKOK | STREAMTCP_FLAG_MIDSTREAM_SYNACK;
+    ssn.client.isn = 100;
+    ssn.client.next_seq = 600;
+    ssn.client.last_ack = 500;
+    ssn.client.wscale = 7;
+    ssn.server.isn = 2000;
+    ssn.server.next_seq = 9000;
+    ssn.server.last_ack = 9000;
+    f->protoctx = &ssn;
+
+    FlowCheckpointBuffer b = { NULL, 0, 0 };
+    FAIL_IF(CheckpointAddFlow(&b, NULL, f) != 1);
+    /* not established yet */
+    ssn.state = TCP_SYN_RECV;
+    FAIL_IF(CheckpointAddFlow(&b, NULL, f) != 0);
+    f->protoctx = NULL;
+    FAIL_IF(CheckpointLoadRecords(b.data, b.len, 1, NULL) != 0);
+    FAIL_IF(SC_ATOMIC_GET(restore_cnt) != 1);
+    SCFree(b.data);
+
+    /* the new flow starts with a server packet */
+    Flow *nf = FlowAlloc();
+    FAIL_IF_NULL(nf);
+    nf->proto = IPPROTO_TCP;
+    nf->flags |= FLOW_IPV4;
+    nf->src = f->dst;
+    nf->dst = f->src;
+    nf->sp = 80;
+    nf->dp = 40000;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 1030;
+    FlowCheckpointRestoreFlow(nf, p);
+    FAIL_IF(SC_ATOMIC_GET(restore_cnt) != 0);
+
+    FAIL_IF(memcmp(&nf->src, &f->src, sizeof(nf->src)) != 0);
+    FAIL_IF(nf->sp != 40000 || nf->dp != 80);
+    FAIL_IF(!(nf->flags & FLOW_ACTION_DROP));
+    FAIL_IF(nf->startts.tv_sec != 900);
+    FAIL_IF(nf->todstpktcnt != 10 || nf->tosrcbytecnt != 5000);
+    FAIL_IF_NOT(FlowCheckpointHasTcp(nf));
+
+    TcpSession nssn;
+    memset(&nssn, 0x00, sizeof(nssn));
+    FAIL_IF(FlowCheckpointRestoreTcp(nf, &nssn) != TCP_ESTABLISHED);
+    FAIL_IF(FlowCheckpointHasTcp(nf));
+    FAIL_IF(nssn.flags != (STREAMTCP_FLAG_MIDSTREAM | STREAMTCP_FLAG_SACKOK));
+    FAIL_IF(nssn.client.isn != 100 || nssn.client.next_seq != 600);
+    FAIL_IF(nssn.client.ra_app_base_seq != 499 || nssn.client.wscale != 7);
+    FAIL_IF(nssn.server.last_ack != 9000);
+
+    SCFree(p);
+    FlowFree(nf);
+    FlowFree(f);
+    checkpoint_config.max_age = max_age;
+    checkpoint_storage_id = -1;
+    StorageCleanup();
+    PASS;
+}
+
+/** \test entries that didn't return in time are dropped */
+static int FlowCheckpointTest02(void)
+{
+    SC_ATOMIC_INIT(restore_cnt);
+    uint32_t max_age = checkpoint_config.max_age;
+    checkpoint_config.max_age = 60;
+
+    Flow f;
+    memset(&f, 0x00, sizeof(f));
+    f.proto = IPPROTO_UDP;
+    f.flags = FLOW_IPV4;
+    f.src.addr_data32[0] = 0x01020304;
+    f.dst.addr_data32[0] = 0x05060708;
+    f.sp = 5353;
+    f.dp = 53;
+    f.lastts.tv_sec = 1000;
+
+    FlowCheckpointBuffer b = { NULL, 0, 0 };
+    FAIL_IF(CheckpointAddFlow(&b, NULL, &f) != 1);
+    FAIL_IF(CheckpointLoadRecords(b.data, b.len, 1, NULL) != 0);
+    /* truncated data */
+    FAIL_IF(CheckpointLoadRecords(b.data, b.len - 1, 1, NULL) == 0);
+    FAIL_IF(SC_ATOMIC_GET(restore_cnt) != 0);
+    FAIL_IF(CheckpointLoadRecords(b.data, b.len, 1, NULL) != 0);
+    SCFree(b.data);
+
+    Flow nf;
+    memset(&nf, 0x00, sizeof(nf));
+    nf.proto = IPPROTO_UDP;
+    nf.flags = FLOW_IPV4;
+    nf.sp = 1;
+    nf.dp = 2;
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 1030;
+    /* no match, the entry stays */
+    FlowCheckpointRestoreFlow(&nf, p);
+    FAIL_IF(SC_ATOMIC_GET(restore_cnt) != 1);
+
+    p->ts.tv_sec = 1061;
+    FlowCheckpointRestoreFlow(&nf, p);
+    FAIL_IF(SC_ATOMIC_GET(restore_cnt) != 0);
+    FAIL_IF(restore_hash != NULL);
+
+    SCFree(p);
+    checkpoint_config.max_age = max_age;
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowCheckpointRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowCheckpointTest01", FlowCheckpointTest01);
+    UtRegisterTest("FlowCheckpointTest02", FlowCheckpointTest02);
+#endif /* UNITTESTS */
+}
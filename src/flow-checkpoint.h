@@ -0,0 +1,47 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Flow table checkpoint, to carry flows over a restart.
+ */
+
+#ifndef __FLOW_CHECKPOINT_H__
+#define __FLOW_CHECKPOINT_H__
+
+#include "flow.h"
+#include "stream-tcp-private.h"
+
+void FlowCheckpointInitCtx(void);
+void FlowCheckpointLoad(void);
+void FlowCheckpointShutdown(void);
+void FlowCheckpointFree(void);
+
+int FlowCheckpointWrite(const char *path, uint32_t *cnt);
+
+void FlowCheckpointRestoreFlow(Flow *f, const Packet *p);
+int FlowCheckpointHasTcp(const Flow *f);
+uint8_t FlowCheckpointRestoreTcp(Flow *f, TcpSession *ssn);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode FlowCheckpointUnixCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+void FlowCheckpointRegisterTests(void);
+
+#endif /* __FLOW_CHECKPOINT_H__ */
@@ -36,23 +36,28 @@
 #include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-checkpoint.h"
 #include "app-layer-parser.h"
+#include "app-layer-expectation.h"
 
 #include "util-time.h"
 #include "util-debug.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-fast.h"
 
 #include "conf.h"
+#include "runmodes.h"
 #include "output.h"
 #include "output-flow.h"
+#include "util-bench.h"
+#include "util-latency.h"
 
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
-static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv);
+static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p);
 
 /** \brief compare two raw ipv6 addrs
  *
@@ -86,8 +91,9 @@ typedef struct FlowHashKey4_ {
             uint16_t proto; /**< u16 so proto and recur add up to u32 */
             uint16_t recur; /**< u16 so proto and recur add up to u32 */
             uint16_t vlan_id[2];
+            uint32_t vni;
         };
-        const uint32_t u32[5];
+        const uint32_t u32[6];
     };
 } FlowHashKey4;
 
@@ -99,8 +105,9 @@ typedef struct FlowHashKey6_ {
             uint16_t proto; /**< u16 so proto and recur add up to u32 */
             uint16_t recur; /**< u16 so proto and recur add up to u32 */
             uint16_t vlan_id[2];
+            uint32_t vni;
         };
-        const uint32_t u32[11];
+        const uint32_t u32[12];
     };
 } FlowHashKey6;
 
@@ -114,12 +121,16 @@ typedef struct FlowHashKey6_ {
  *  destination address
  *  recursion level -- for tunnels, make sure different tunnel layers can
  *                     never get mixed up.
+ *  vni -- VXLAN/Geneve network id, tenants may use the same addresses
+ *  job_id -- unix socket pcap job, mixed into the seed
  *
  *  For ICMP we only consider UNREACHABLE errors atm.
  */
 static inline uint32_t FlowGetHash(const Packet *p)
 {
     uint32_t hash = 0;
+    /* concurrent pcap jobs use their own hash space */
+    const uint32_t seed = flow_config.hash_rand ^ p->job_id;
 
     if (p->ip4h != NULL) {
         if (p->tcph != NULL || p->udph != NULL) {
@@ -142,8 +153,9 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.vni = p->vni;
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashFastWords(flow_config.hash_algo, fhk.u32, 6, seed);
 
         } else if (ICMPV4_DEST_UNREACH_IS_VALID(p)) {
             uint32_t psrc = IPV4_GET_RAW_IPSRC_U32(ICMPV4_GET_EMB_IPV4(p));
@@ -167,8 +179,9 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.vni = p->vni;
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashFastWords(flow_config.hash_algo, fhk.u32, 6, seed);
 
         } else {
             FlowHashKey4 fhk;
@@ -185,8 +198,9 @@ static inline uint32_t FlowGetHash(const Packet *p)
             fhk.recur = (uint16_t)p->recursion_level;
             fhk.vlan_id[0] = p->vlan_id[0];
             fhk.vlan_id[1] = p->vlan_id[1];
+            fhk.vni = p->vni;
 
-            hash = hashword(fhk.u32, 5, flow_config.hash_rand);
+            hash = HashFastWords(flow_config.hash_algo, fhk.u32, 6, seed);
         }
     } else if (p->ip6h != NULL) {
         FlowHashKey6 fhk;
@@ -220,13 +234,212 @@ static inline uint32_t FlowGetHash(const Packet *p)
         fhk.recur = (uint16_t)p->recursion_level;
         fhk.vlan_id[0] = p->vlan_id[0];
         fhk.vlan_id[1] = p->vlan_id[1];
+        fhk.vni = p->vni;
 
-        hash = hashword(fhk.u32, 11, flow_config.hash_rand);
+        hash = HashFastWords(flow_config.hash_algo, fhk.u32, 12, seed);
     }
 
     return hash;
 }
 
+/** \brief calculate the flow hash from the raw bytes of an ethernet frame
+ *
+ *  For capture methods that balance packets over the threads themselves
+ *  (PF_RING ZC). The frame is walked like the decoder does it, through
+ *  VLAN and QinQ tags and into GRE (IP and ethernet payloads) and VXLAN
+ *  tunnels, and the innermost layer is hashed with the key, algorithm and
+ *  seed FlowGetHash() uses. So the same flow ends up on the same thread in
+ *  both directions and tunneled flows are spread by their inner addresses.
+ *
+ *  IPv4 fragments are hashed without ports so that all fragments of a
+ *  datagram meet in the same defrag tracker. ICMP errors and IPv6
+ *  extension headers are not followed.
+ *
+ *  \param pkt frame data
+ *  \param len frame length
+ *  \param use_vlan include the VLAN ids in the key (vlan.use-for-tracking)
+ *  \param vxlan_port udp port for VXLAN, 0 if VXLAN decoding is disabled
+ *
+ *  \retval hash flow hash, 0 if no IP layer was found
+ */
+uint32_t FlowGetHashRaw(const uint8_t *pkt, uint32_t len, int use_vlan,
+        uint16_t vxlan_port)
+{
+    uint16_t vlan_id[2] = { 0, 0 };
+    uint16_t vlan_idx = 0;
+    uint16_t recur = 0;
+    uint32_t vni = 0;
+    uint16_t type;
+
+    if (len < ETHERNET_HEADER_LEN)
+        return 0;
+    type = (uint16_t)((pkt[12] << 8) | pkt[13]);
+    pkt += ETHERNET_HEADER_LEN;
+    len -= ETHERNET_HEADER_LEN;
+
+    /* one iteration per layer: vlan tag, IP header or tunnel */
+    while (1) {
+        if (type == ETHERNET_TYPE_8021Q || type == ETHERNET_TYPE_8021AD ||
+                type == ETHERNET_TYPE_8021QINQ) {
+            if (len < 4)
+                return 0;
+            if (use_vlan && vlan_idx < 2)
+                vlan_id[vlan_idx++] = (uint16_t)(((pkt[0] << 8) | pkt[1]) & 0x0fff);
+            type = (uint16_t)((pkt[2] << 8) | pkt[3]);
+            pkt += 4;
+            len -= 4;
+            continue;
+        }
+
+        const uint8_t *l4;
+        uint32_t l4_len;
+        uint8_t proto;
+
+        if (type == ETHERNET_TYPE_IP) {
+            if (len < 20 || (pkt[0] >> 4) != 4)
+                return 0;
+            const uint32_t hlen = (pkt[0] & 0x0f) << 2;
+            if (hlen < 20 || len < hlen)
+                return 0;
+            proto = pkt[9];
+            l4 = pkt + hlen;
+            l4_len = len - hlen;
+
+            const uint16_t frag = (uint16_t)((pkt[6] << 8) | pkt[7]);
+            const int is_frag = (frag & 0x3fff) != 0;
+
+            if (!is_frag && proto == IPPROTO_GRE) {
+                goto gre;
+            } else if (!is_frag && proto == IPPROTO_UDP && vxlan_port != 0 &&
+                    l4_len >= UDP_HEADER_LEN + 8 + ETHERNET_HEADER_LEN &&
+                    ((l4[2] << 8) | l4[3]) == vxlan_port && (l4[8] & 0x08)) {
+                goto vxlan;
+            }
+
+            FlowHashKey4 fhk;
+            uint32_t src, dst;
+            memcpy(&src, pkt + 12, sizeof(src));
+            memcpy(&dst, pkt + 16, sizeof(dst));
+            if (src > dst) {
+                fhk.src = src;
+                fhk.dst = dst;
+            } else {
+                fhk.src = dst;
+                fhk.dst = src;
+            }
+            if (!is_frag && (proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+                    l4_len >= 4) {
+                const uint16_t sp = (uint16_t)((l4[0] << 8) | l4[1]);
+                const uint16_t dp = (uint16_t)((l4[2] << 8) | l4[3]);
+                if (sp > dp) {
+                    fhk.sp = sp;
+                    fhk.dp = dp;
+                } else {
+                    fhk.sp = dp;
+                    fhk.dp = sp;
+                }
+            } else {
+                fhk.sp = 0xfeed;
+                fhk.dp = 0xbeef;
+            }
+            fhk.proto = (uint16_t)proto;
+            fhk.recur = recur;
+            fhk.vlan_id[0] = vlan_id[0];
+            fhk.vlan_id[1] = vlan_id[1];
+            fhk.vni = vni;
+
+            return HashFastWords(flow_config.hash_algo, fhk.u32, 6, flow_config.hash_rand);
+
+        } else if (type == ETHERNET_TYPE_IPV6) {
+            if (len < IPV6_HEADER_LEN || (pkt[0] >> 4) != 6)
+                return 0;
+            proto = pkt[6];
+            l4 = pkt + IPV6_HEADER_LEN;
+            l4_len = len - IPV6_HEADER_LEN;
+
+            if (proto == IPPROTO_GRE) {
+                goto gre;
+            } else if (proto == IPPROTO_UDP && vxlan_port != 0 &&
+                    l4_len >= UDP_HEADER_LEN + 8 + ETHERNET_HEADER_LEN &&
+                    ((l4[2] << 8) | l4[3]) == vxlan_port && (l4[8] & 0x08)) {
+                goto vxlan;
+            }
+
+            FlowHashKey6 fhk;
+            uint32_t src[4], dst[4];
+            memcpy(src, pkt + 8, sizeof(src));
+            memcpy(dst, pkt + 24, sizeof(dst));
+            if (FlowHashRawAddressIPv6GtU32(src, dst)) {
+                memcpy(fhk.src, src, sizeof(src));
+                memcpy(fhk.dst, dst, sizeof(dst));
+            } else {
+                memcpy(fhk.src, dst, sizeof(dst));
+                memcpy(fhk.dst, src, sizeof(src));
+            }
+            uint16_t sp = 0, dp = 0;
+            if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) && l4_len >= 4) {
+                sp = (uint16_t)((l4[0] << 8) | l4[1]);
+                dp = (uint16_t)((l4[2] << 8) | l4[3]);
+            }
+            if (sp > dp) {
+                fhk.sp = sp;
+                fhk.dp = dp;
+            } else {
+                fhk.sp = dp;
+                fhk.dp = sp;
+            }
+            fhk.proto = (uint16_t)proto;
+            fhk.recur = recur;
+            fhk.vlan_id[0] = vlan_id[0];
+            fhk.vlan_id[1] = vlan_id[1];
+            fhk.vni = vni;
+
+            return HashFastWords(flow_config.hash_algo, fhk.u32, 12, flow_config.hash_rand);
+        }
+        return 0;
+
+    gre:
+        /* version 0 only, skip the optional fields */
+        if (l4_len < GRE_HDR_LEN || (l4[1] & 0x07) != 0 || (l4[0] & 0x40))
+            return 0;
+        {
+            uint32_t glen = GRE_HDR_LEN;
+            if (l4[0] & 0x80)
+                glen += 4;
+            if (l4[0] & 0x20)
+                glen += 4;
+            if (l4[0] & 0x10)
+                glen += 4;
+            if (l4_len < glen)
+                return 0;
+            type = (uint16_t)((l4[2] << 8) | l4[3]);
+            pkt = l4 + glen;
+            len = l4_len - glen;
+        }
+        if (type == ETHERNET_TYPE_BRIDGE) {
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            type = (uint16_t)((pkt[12] << 8) | pkt[13]);
+            pkt += ETHERNET_HEADER_LEN;
+            len -= ETHERNET_HEADER_LEN;
+        }
+        recur++;
+        continue;
+
+    vxlan:
+        vni = ((uint32_t)l4[UDP_HEADER_LEN + 4] << 16) |
+              ((uint32_t)l4[UDP_HEADER_LEN + 5] << 8) | l4[UDP_HEADER_LEN + 6];
+        pkt = l4 + UDP_HEADER_LEN + 8;
+        len = l4_len - (UDP_HEADER_LEN + 8);
+        type = (uint16_t)((pkt[12] << 8) | pkt[13]);
+        pkt += ETHERNET_HEADER_LEN;
+        len -= ETHERNET_HEADER_LEN;
+        recur++;
+    }
+
+    return 0;
+}
+
 /* Since two or more flows can have the same hash key, we need to compare
  * the flow with the current flow key. */
 #define CMP_FLOW(f1,f2) \
@@ -239,7 +452,9 @@ static inline uint32_t FlowGetHash(const Packet *p)
      (f1)->proto == (f2)->proto && \
      (f1)->recursion_level == (f2)->recursion_level && \
      (f1)->vlan_id[0] == (f2)->vlan_id[0] && \
-     (f1)->vlan_id[1] == (f2)->vlan_id[1])
+     (f1)->vlan_id[1] == (f2)->vlan_id[1] && \
+     (f1)->vni == (f2)->vni && \
+     (f1)->job_id == (f2)->job_id)
 
 /**
  *  \brief See if a ICMP packet belongs to a flow by comparing the embedded
@@ -264,7 +479,9 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->vni == p->vni &&
+                f->job_id == p->job_id)
         {
             return 1;
 
@@ -277,7 +494,9 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                f->vni == p->vni &&
+                f->job_id == p->job_id)
         {
             return 1;
         }
@@ -358,8 +577,16 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
         return NULL;
     }
 
-    /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    /* get a flow from the spare queue, preferring the flows local to
+     * our NUMA node */
+    const int numa_node = dtv ? dtv->numa_node : -1;
+    if (numa_node >= 0) {
+        f = FlowDequeue(&flow_spare_q_numa[numa_node]);
+        if (f == NULL)
+            f = FlowDequeue(&flow_spare_q);
+    } else {
+        f = FlowDequeue(&flow_spare_q);
+    }
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
@@ -373,7 +600,7 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
                 FlowWakeupFlowManagerThread();
             }
 
-            f = FlowGetUsedFlow(tv, dtv);
+            f = FlowGetUsedFlow(tv, dtv, p);
             if (f == NULL) {
                 /* max memcap reached, so increments the counter */
                 if (tv != NULL && dtv != NULL) {
@@ -394,6 +621,9 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
                 }
                 return NULL;
             }
+            /* allocated (and touched) by us, so it's local to our node */
+            if (numa_node >= 0)
+                f->numa_node = (uint8_t)numa_node;
 
             /* flow is initialized but *unlocked* */
         }
@@ -407,6 +637,70 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
     return f;
 }
 
+/** \internal
+ *  \brief give the flow a fingerprint slot in its bucket if one is free
+ *  \note bucket must be locked or owned, f->flow_hash set */
+static inline void FlowBucketAddTag(FlowBucket *fb, Flow *f)
+{
+    if (!flow_config.hash_fingerprints)
+        return;
+
+    int i;
+    for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        if (fb->tag[i] == 0) {
+            fb->tag[i] = FLOW_BUCKET_TAG(f->flow_hash);
+            f->flags |= FLOW_BUCKET_TAGGED;
+            return;
+        }
+    }
+    if (fb->untagged < UINT8_MAX)
+        fb->untagged++;
+}
+
+/** \brief forget the fingerprint of a flow that was taken out of its
+ *         bucket's list
+ *  \note bucket must be locked or owned, flow locked */
+void FlowBucketRemoveTag(FlowBucket *fb, Flow *f)
+{
+    if (!flow_config.hash_fingerprints)
+        return;
+
+    if (fb->head == NULL) {
+        memset(fb->tag, 0x00, sizeof(fb->tag));
+        fb->untagged = 0;
+    } else if (f->flags & FLOW_BUCKET_TAGGED) {
+        /* any slot with the same fingerprint will do */
+        const uint8_t tag = FLOW_BUCKET_TAG(f->flow_hash);
+        int i;
+        for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+            if (fb->tag[i] == tag) {
+                fb->tag[i] = 0;
+                break;
+            }
+        }
+    } else if (fb->untagged > 0 && fb->untagged < UINT8_MAX) {
+        fb->untagged--;
+    }
+    f->flags &= ~FLOW_BUCKET_TAGGED;
+}
+
+/** \internal
+ *  \brief check if the packet's flow may be in the bucket
+ *  \retval 0 it's not, no need to walk the list */
+static inline int FlowBucketMayHave(const FlowBucket *fb, const uint32_t hash)
+{
+    if (fb->untagged > 0)
+        return 1;
+
+    const uint8_t tag = FLOW_BUCKET_TAG(hash);
+    int i;
+    for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+        if (fb->tag[i] == tag)
+            return 1;
+    }
+    return 0;
+}
+
 static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
                              FlowBucket *fb, Flow *old_f,
                              const uint32_t hash, const Packet *p)
@@ -434,64 +728,79 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
 
     /* initialize and return */
     FlowInit(f, p);
+    f->alproto = AppLayerExpectationGetProto(f, &p->ts);
     f->flow_hash = hash;
     f->fb = fb;
+    FlowBucketAddTag(fb, f);
+    FBTIMEOUT_RESET(fb);
 
     f->thread_id = thread_id;
     return f;
 }
 
-/** \brief Get Flow for packet
- *
- * Hash retrieval function for flows. Looks up the hash bucket containing the
- * flow pointer. Then compares the packet with the found flow to see if it is
- * the flow we need. If it isn't, walk the list until the right flow is found.
- *
- * If the flow is not found or the bucket was emtpy, a new flow is taken from
- * the queue. FlowDequeue() will alloc new flows as long as we stay within our
- * memcap limit.
- *
- * The p->flow pointer is updated to point to the flow.
+/** \internal
+ *  \brief lock an existing flow, recording the wait if latency
+ *         tracking is enabled */
+static inline void FlowLockTimed(ThreadVars *tv, Flow *f)
+{
+    if (likely(!latency_enabled)) {
+        FLOWLOCK_WRLOCK(f);
+        return;
+    }
+
+    uint64_t start = UtilCpuGetTicks();
+    FLOWLOCK_WRLOCK(f);
+    LatencyThreadCtx *ctx = LatencyThreadCtxGet(tv);
+    if (ctx != NULL) {
+        uint64_t ns = LatencyTicksToNs(UtilCpuGetTicks() - start);
+        LatencyRecord(ctx, LATENCY_FLOW_LOCK, ns);
+        ctx->lock_ns += ns;
+    }
+}
+
+/** \internal
+ *  \brief Get Flow for packet from a bucket
  *
- *  \param tv thread vars
- *  \param dtv decode thread vars (for flow log api thread data)
+ *  The caller either holds the bucket lock or owns the bucket through a
+ *  FlowHashPartition.
  *
  *  \retval f *LOCKED* flow or NULL
  */
-Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+static inline Flow *FlowGetFlowFromBucket(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Packet *p, Flow **dest, FlowBucket *fb, const uint32_t hash)
 {
     Flow *f = NULL;
 
-    /* get our hash bucket and lock it */
-    const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
-
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
+    /* the fingerprints tell if the flow is not in the bucket, without
+     * touching the flows in it */
+    if (flow_config.hash_fingerprints && fb->head != NULL) {
+        if (!FlowBucketMayHave(fb, hash)) {
+            f = FlowGetNew(tv, dtv, p);
+            if (f == NULL) {
+                return NULL;
+            }
+
+            /* flow is locked, put it at the start of the list */
+            f->hnext = fb->head;
+            fb->head->hprev = f;
+            fb->head = f;
+            goto new_flow;
+        }
+    }
+
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
         f = FlowGetNew(tv, dtv, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
 
         /* flow is locked */
         fb->head = f;
         fb->tail = f;
-
-        /* got one, now lock, initialize and return */
-        FlowInit(f, p);
-        f->flow_hash = hash;
-        f->fb = fb;
-
-        /* update the last seen timestamp of this flow */
-        COPY_TIMESTAMP(&p->ts,&f->lastts);
-        FlowReference(dest, f);
-
-        FBLOCK_UNLOCK(fb);
-        return f;
+        goto new_flow;
     }
 
     /* ok, we have a flow in the bucket. Let's find out if it is our flow */
@@ -508,7 +817,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             if (f == NULL) {
                 f = pf->hnext = FlowGetNew(tv, dtv, p);
                 if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
                     return NULL;
                 }
                 fb->tail = f;
@@ -516,18 +824,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 /* flow is locked */
 
                 f->hprev = pf;
-
-                /* initialize and return */
-                FlowInit(f, p);
-                f->flow_hash = hash;
-                f->fb = fb;
-
-                /* update the last seen timestamp of this flow */
-                COPY_TIMESTAMP(&p->ts,&f->lastts);
-                FlowReference(dest, f);
-
-                FBLOCK_UNLOCK(fb);
-                return f;
+                goto new_flow;
             }
 
             if (FlowCompare(f, p) != 0) {
@@ -547,45 +844,125 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 f->hprev = NULL;
                 fb->head->hprev = f;
                 fb->head = f;
-
-                /* found our flow, lock & return */
-                FLOWLOCK_WRLOCK(f);
-                if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
-                    f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
-                    if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
-                        return NULL;
-                    }
-                }
-
-                /* update the last seen timestamp of this flow */
-                COPY_TIMESTAMP(&p->ts,&f->lastts);
-                FlowReference(dest, f);
-
-                FBLOCK_UNLOCK(fb);
-                return f;
+                goto found;
             }
         }
     }
 
+found:
     /* lock & return */
-    FLOWLOCK_WRLOCK(f);
+    FlowLockTimed(tv, f);
     if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
         f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
     }
 
+    /* the flow's segments and app layer state were released while it was
+     * idle, they are built up again from this packet on */
+    if (unlikely(f->hibernated))
+        f->hibernated = 0;
+
     /* update the last seen timestamp of this flow */
     COPY_TIMESTAMP(&p->ts,&f->lastts);
     FlowReference(dest, f);
+    return f;
 
+new_flow:
+    /* got one, now initialize and return */
+    FlowInit(f, p);
+    FlowCheckpointRestoreFlow(f, p);
+    f->alproto = AppLayerExpectationGetProto(f, &p->ts);
+    f->flow_hash = hash;
+    f->fb = fb;
+    FlowBucketAddTag(fb, f);
+    FBTIMEOUT_RESET(fb);
+
+    /* update the last seen timestamp of this flow */
+    COPY_TIMESTAMP(&p->ts,&f->lastts);
+    FlowReference(dest, f);
+    return f;
+}
+
+/** \brief Get Flow for packet
+ *
+ * Hash retrieval function for flows. Looks up the hash bucket containing the
+ * flow pointer. Then compares the packet with the found flow to see if it is
+ * the flow we need. If it isn't, walk the list until the right flow is found.
+ *
+ * If the flow is not found or the bucket was emtpy, a new flow is taken from
+ * the queue. FlowDequeue() will alloc new flows as long as we stay within our
+ * memcap limit.
+ *
+ * If the thread owns a hash partition (flow.thread-local) the bucket is
+ * taken from the partition and it is not locked.
+ *
+ * The p->flow pointer is updated to point to the flow.
+ *
+ *  \param tv thread vars
+ *  \param dtv decode thread vars (for flow log api thread data)
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+{
+    const uint32_t hash = p->flow_hash;
+
+    FlowHashPartition *fp = dtv ? dtv->flow_part : NULL;
+    if (fp != NULL && fp->size > 0) {
+        FlowBucket *fb = &flow_hash[fp->min + (hash % fp->size)];
+        return FlowGetFlowFromBucket(tv, dtv, p, dest, fb, hash);
+    }
+
+    /* get our hash bucket and lock it */
+    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FBLOCK_LOCK(fb);
+    Flow *f = FlowGetFlowFromBucket(tv, dtv, p, dest, fb, hash);
     FBLOCK_UNLOCK(fb);
     return f;
 }
 
+/** \internal
+ *  \brief get the bucket FlowGetFlowFromHash will use for the packet */
+static inline const FlowBucket *FlowHashGetBucket(const DecodeThreadVars *dtv,
+        const Packet *p)
+{
+    const uint32_t hash = p->flow_hash;
+    const FlowHashPartition *fp = dtv ? dtv->flow_part : NULL;
+
+    if (fp != NULL && fp->size > 0)
+        return &flow_hash[fp->min + (hash % fp->size)];
+    return &flow_hash[hash % flow_config.hash_size];
+}
+
+/** \brief prefetch the hash bucket the packet's flow lives in
+ *
+ *  Used when processing a batch of packets, so that the bucket is in
+ *  the cache by the time FlowGetFlowFromHash is called for the packet.
+ *  p->flow_hash needs to be set (PKT_WANTS_FLOW).
+ */
+void FlowHashPrefetchBucket(const DecodeThreadVars *dtv, const Packet *p)
+{
+    __builtin_prefetch(FlowHashGetBucket(dtv, p), 1, 3);
+}
+
+/** \brief prefetch the first flow in the packet's hash bucket
+ *
+ *  Should be called some time after FlowHashPrefetchBucket for the same
+ *  packet, so that reading the bucket doesn't stall. The bucket is read
+ *  w/o lock: the pointer is only used as a hint for the prefetch, which
+ *  doesn't fault on a stale address.
+ */
+void FlowHashPrefetchFlow(const DecodeThreadVars *dtv, const Packet *p)
+{
+    const FlowBucket *fb = FlowHashGetBucket(dtv, p);
+    const Flow *f = fb->head;
+    if (f != NULL) {
+        __builtin_prefetch(f, 0, 3);
+    }
+}
+
 /** \internal
  *  \brief Get a flow from the hash directly.
  *
@@ -596,40 +973,65 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  *  top each time since that would clear the top of the hash leading to longer
  *  and longer search times under high pressure (observed).
  *
+ *  If the thread owns a hash partition only that partition is walked. The
+ *  bucket of the packet is skipped as the caller is working on it.
+ *
  *  \param tv thread vars
  *  \param dtv decode thread vars (for flow log api thread data)
+ *  \param p packet we're getting a flow for
  *
  *  \retval f flow or NULL
  */
-static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
+static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
 {
-    uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
-    uint32_t cnt = flow_config.hash_size;
+    FlowHashPartition *fp = dtv ? dtv->flow_part : NULL;
+    const int owned = (fp != NULL && fp->size > 0);
+    uint32_t min = 0;
+    uint32_t size = flow_config.hash_size;
+    uint32_t skip = UINT32_MAX;
+    uint32_t idx;
+
+    if (owned) {
+        min = fp->min;
+        size = fp->size;
+        idx = fp->prune_idx % size;
+        skip = p->flow_hash % size;
+    } else {
+        idx = SC_ATOMIC_GET(flow_prune_idx) % size;
+    }
+    uint32_t cnt = size;
 
     while (cnt--) {
-        if (++idx >= flow_config.hash_size)
+        if (++idx >= size)
             idx = 0;
 
-        FlowBucket *fb = &flow_hash[idx];
+        FlowBucket *fb = &flow_hash[min + idx];
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        if (owned) {
+            if (idx == skip)
+                continue;
+        } else if (FBLOCK_TRYLOCK(fb) != 0) {
             continue;
+        }
 
         Flow *f = fb->tail;
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
+            if (!owned)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         if (FLOWLOCK_TRYWRLOCK(f) != 0) {
-            FBLOCK_UNLOCK(fb);
+            if (!owned)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         /** never prune a flow that is used by a packet or stream msg
          *  we are currently processing in one of the threads */
         if (SC_ATOMIC_GET(f->use_cnt) > 0) {
-            FBLOCK_UNLOCK(fb);
+            if (!owned)
+                FBLOCK_UNLOCK(fb);
             FLOWLOCK_UNLOCK(f);
             continue;
         }
@@ -643,11 +1045,13 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
             fb->head = f->hnext;
         if (fb->tail == f)
             fb->tail = f->hprev;
+        FlowBucketRemoveTag(fb, f);
 
         f->hnext = NULL;
         f->hprev = NULL;
         f->fb = NULL;
-        FBLOCK_UNLOCK(fb);
+        if (!owned)
+            FBLOCK_UNLOCK(fb);
 
         int state = SC_ATOMIC_GET(f->flow_state);
         if (state == FLOW_STATE_NEW)
@@ -656,6 +1060,8 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
         else if (state == FLOW_STATE_CLOSED)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+        else if (FLOW_IS_BYPASSED(state))
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
 
         f->flow_end_flags |= FLOW_END_FLAG_FORCED;
 
@@ -670,9 +1076,278 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
         FLOWLOCK_UNLOCK(f);
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
+        if (owned)
+            fp->prune_idx += (size - cnt);
+        else
+            (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
         return f;
     }
 
     return NULL;
 }
+
+/** list of registered hash partitions */
+static FlowHashPartition *flow_hash_parts = NULL;
+static uint32_t flow_hash_parts_cnt = 0;
+static int flow_hash_parts_active = 0;
+static SCMutex flow_hash_parts_lock = SCMUTEX_INITIALIZER;
+
+/** \brief register a hash partition for a flow worker thread
+ *
+ *  The partition is only assigned a range of the hash in
+ *  FlowHashPartitionsPostRunmodes(), until then (or if the partitioning
+ *  is not possible) the thread uses the shared, locked hash.
+ *
+ *  \retval fp partition or NULL if flow.thread-local is disabled
+ */
+FlowHashPartition *FlowHashPartitionRegister(void)
+{
+    if (!flow_config.thread_local)
+        return NULL;
+
+    FlowHashPartition *fp = SCMallocAligned(sizeof(*fp), CLS);
+    if (unlikely(fp == NULL))
+        return NULL;
+    memset(fp, 0, sizeof(*fp));
+    SC_ATOMIC_INIT(fp->timeout_req);
+    fp->numa_node = -1;
+
+    SCMutexLock(&flow_hash_parts_lock);
+    fp->next = flow_hash_parts;
+    flow_hash_parts = fp;
+    flow_hash_parts_cnt++;
+    SCMutexUnlock(&flow_hash_parts_lock);
+    return fp;
+}
+
+void FlowHashPartitionDeregister(FlowHashPartition *fp)
+{
+    if (fp == NULL)
+        return;
+
+    SCMutexLock(&flow_hash_parts_lock);
+    FlowHashPartition **pp = &flow_hash_parts;
+    while (*pp != NULL) {
+        if (*pp == fp) {
+            *pp = fp->next;
+            flow_hash_parts_cnt--;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    if (flow_hash_parts == NULL)
+        flow_hash_parts_active = 0;
+    SCMutexUnlock(&flow_hash_parts_lock);
+
+    SC_ATOMIC_DESTROY(fp->timeout_req);
+    SCFreeAligned(fp);
+}
+
+/** \brief divide the hash over the registered partitions
+ *
+ *  Called after all threads are initialized, but before they are
+ *  unpaused. Only the workers runmode guarantees that all packets of a
+ *  flow are handled by the same thread, so other runmodes fall back to
+ *  the shared hash.
+ */
+void FlowHashPartitionsPostRunmodes(void)
+{
+    if (!flow_config.thread_local)
+        return;
+
+    SCMutexLock(&flow_hash_parts_lock);
+    if (flow_hash_parts_cnt == 0)
+        goto end;
+
+    const char *runmode = RunmodeGetActive();
+    if (runmode == NULL || strcasecmp(runmode, "workers") != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "flow.thread-local is only "
+                "supported in the 'workers' runmode, using the shared "
+                "flow hash");
+        goto end;
+    }
+    if (flow_config.hash_size < flow_hash_parts_cnt) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "flow.hash-size %u too small to "
+                "partition over %u threads, using the shared flow hash",
+                flow_config.hash_size, flow_hash_parts_cnt);
+        goto end;
+    }
+
+    /* keep the partitions of a NUMA node next to each other, so that
+     * each node's workers own one contiguous part of the hash */
+    FlowHashPartition *sorted = NULL, *fp;
+    while (flow_hash_parts != NULL) {
+        fp = flow_hash_parts;
+        flow_hash_parts = fp->next;
+
+        FlowHashPartition **pp = &sorted;
+        while (*pp != NULL && (*pp)->numa_node <= fp->numa_node)
+            pp = &(*pp)->next;
+        fp->next = *pp;
+        *pp = fp;
+    }
+    flow_hash_parts = sorted;
+
+    const uint32_t managers = FlowManagerGetCount();
+    const uint32_t range = flow_config.hash_size / flow_hash_parts_cnt;
+    uint32_t min = 0, idx = 0;
+    for (fp = flow_hash_parts; fp != NULL; fp = fp->next, idx++) {
+        fp->min = min;
+        /* last partition gets the remainder */
+        fp->size = (fp->next == NULL) ? (flow_config.hash_size - min) : range;
+        min += fp->size;
+
+        /* with a manager per node, the node's manager serves it. Otherwise
+         * split the (sorted) partitions evenly over the managers. */
+        if (fp->numa_node >= 0 && managers == flow_config.numa_nodes)
+            fp->manager = (uint32_t)fp->numa_node;
+        else
+            fp->manager = (idx * managers) / flow_hash_parts_cnt;
+        SCLogDebug("partition %u: node %d buckets %u-%u manager %u", idx,
+                fp->numa_node, fp->min, fp->min + fp->size, fp->manager);
+    }
+    flow_hash_parts_active = 1;
+
+    SCLogConfig("flow hash partitioned over %u threads, %u buckets each, "
+            "%u flow manager shard(s)", flow_hash_parts_cnt, range, managers);
+end:
+    SCMutexUnlock(&flow_hash_parts_lock);
+}
+
+/** \retval 1 if the hash is owned by the flow worker partitions */
+int FlowHashPartitionsActive(void)
+{
+    return flow_hash_parts_active;
+}
+
+/** \brief ask the owner of each partition to time out its flows
+ *
+ *  Called by the flow manager instead of walking the hash itself. The
+ *  owner handles the request on its next packet.
+ *
+ *  \param manager 0 based flow manager shard, only its partitions are
+ *                 asked */
+void FlowHashPartitionsRequestTimeout(uint32_t manager)
+{
+    SCMutexLock(&flow_hash_parts_lock);
+    FlowHashPartition *fp;
+    for (fp = flow_hash_parts; fp != NULL; fp = fp->next) {
+        if (fp->manager == manager)
+            (void) SC_ATOMIC_ADD(fp->timeout_req, 1);
+    }
+    SCMutexUnlock(&flow_hash_parts_lock);
+}
+
+#ifdef BENCHMARKS
+typedef struct FlowHashBench_ {
+    uint32_t flows;         /**< flows in the table */
+    uint32_t hot_pct;       /**< % of lookups for the first 1/10th */
+} FlowHashBench;
+
+static const FlowHashBench flow_hash_benches[] = {
+    { 65536, 0 },
+    { 1048576, 0 },
+    { 1048576, 90 },
+};
+
+/** \internal
+ *  \brief give the packet the tuple of flow 'idx' */
+static void FlowHashBenchSetTuple(Packet *p, uint32_t idx)
+{
+    uint32_t src = htonl(0x0a000000 | (idx >> 4));
+    p->ip4h->s_ip_src.s_addr = src;
+    p->src.addr_data32[0] = src;
+    p->sp = (Port)(1024 + (idx & 0x0f));
+    p->flow_hash = FlowGetHash(p);
+}
+
+/** \internal
+ *  \brief look up existing flows in a table of 'flows' entries
+ *
+ *  The hash is sized for the flows, so this is the lookup cost with a
+ *  load factor of 1 including the cache misses of a big table. */
+static int FlowHashBenchLookup(BenchCtx *b)
+{
+    const FlowHashBench *fb = b->data;
+    char val[32];
+    int result = 0;
+
+    snprintf(val, sizeof(val), "%"PRIu64, (uint64_t)fb->flows * 2048);
+    ConfSetFinal("flow.memcap", val);
+    snprintf(val, sizeof(val), "%"PRIu32, fb->flows);
+    ConfSetFinal("flow.hash-size", val);
+    ConfSetFinal("flow.prealloc", val);
+    FlowInitConfig(FLOW_QUIET);
+
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(tv));
+    memset(&dtv, 0, sizeof(dtv));
+    DecodeRegisterPerfCounters(&dtv, &tv);
+    StatsSetupPrivate(&tv);
+
+    uint8_t frame[128];
+    uint32_t len = BenchBuildFrame(frame, sizeof(frame), IPPROTO_UDP,
+            0, htonl(0xc0a80001), 0, 53, (const uint8_t *)"x", 1);
+    Packet *p = PacketGetFromAlloc();
+    if (p == NULL)
+        goto end;
+    if (DecodeEthernet(&tv, &dtv, p, frame, len, NULL) != TM_ECODE_OK ||
+        p->ip4h == NULL || p->udph == NULL)
+        goto end;
+
+    /* create all flows outside of the timer */
+    uint32_t i;
+    for (i = 0; i < fb->flows; i++) {
+        FlowHashBenchSetTuple(p, i);
+        Flow *f = FlowGetFlowFromHash(&tv, &dtv, p, &p->flow);
+        if (f == NULL)
+            goto end;
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&p->flow);
+    }
+
+    uint32_t state = 1;
+    uint32_t hot = fb->flows / 10;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        uint32_t idx = BenchRandom(&state);
+        if (fb->hot_pct && (BenchRandom(&state) % 100) < fb->hot_pct)
+            idx %= hot;
+        else
+            idx %= fb->flows;
+
+        FlowHashBenchSetTuple(p, idx);
+        Flow *f = FlowGetFlowFromHash(&tv, &dtv, p, &p->flow);
+        if (unlikely(f == NULL))
+            break;
+        FLOWLOCK_UNLOCK(f);
+        FlowDeReference(&p->flow);
+    }
+    BenchTimerStop(b);
+    result = 1;
+end:
+    if (p != NULL)
+        PacketFree(p);
+    StatsThreadCleanup(&tv);
+    FlowShutdown();
+    return result;
+}
+#endif /* BENCHMARKS */
+
+/** \brief register lookup benchmarks for a few table sizes and key
+ *         distributions */
+void FlowHashRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    uint32_t i;
+    for (i = 0; i < sizeof(flow_hash_benches) / sizeof(flow_hash_benches[0]); i++) {
+        const FlowHashBench *fb = &flow_hash_benches[i];
+        char name[64];
+        snprintf(name, sizeof(name), "flow/lookup/%s/%"PRIu32"k",
+                fb->hot_pct ? "hot" : "uniform", fb->flows / 1024);
+        BenchRegister(name, FlowHashBenchLookup, fb);
+    }
+#endif /* BENCHMARKS */
+}
@@ -34,13 +34,33 @@
     #endif
 #endif
 
+/** flows per bucket with a fingerprint in the bucket itself */
+#define FLOW_BUCKET_TAGS 3
+
+/** fingerprint of a flow in its bucket, 1-255: the top hash bits, which
+ *  don't pick the bucket unless the table has over 16M buckets */
+#define FLOW_BUCKET_TAG(hash) ((uint8_t)(((hash) >> 24) % 255 + 1))
+
 /* flow hash bucket -- the hash is basically an array of these buckets.
  * Each bucket contains a flow or list of flows. All these flows have
  * the same hashkey (the hash is a chained hash). When doing modifications
- * to the list, the entire bucket is locked. */
+ * to the list, the entire bucket is locked.
+ *
+ * With 'flow.hash-fingerprints' up to FLOW_BUCKET_TAGS flows of a bucket
+ * have their fingerprint in tag[], in the padding in front of the lock.
+ * If the packet's fingerprint isn't there and all flows in the list have
+ * one (untagged == 0) the flow is not in the bucket, which is found w/o
+ * touching the flows. Flows with a slot have FLOW_BUCKET_TAGGED set. */
 typedef struct FlowBucket_ {
     Flow *head;
     Flow *tail;
+    /** earliest time (sec) a flow in the row can time out. The flow
+     *  manager skips the row until then. Reset to 0 by anything that
+     *  can make a flow time out sooner: a new flow, a state change. */
+    SC_ATOMIC_DECLARE(uint32_t, next_ts);
+    uint8_t tag[FLOW_BUCKET_TAGS];  /**< 0 for a free slot */
+    uint8_t untagged;       /**< flows in the list w/o a slot, sticks at
+                             *   UINT8_MAX until the bucket is empty */
 #ifdef FBLOCK_MUTEX
     SCMutex m;
 #elif defined FBLOCK_SPIN
@@ -59,18 +79,65 @@ typedef struct FlowBucket_ {
 #elif defined FBLOCK_MUTEX
     #define FBLOCK_INIT(fb) SCMutexInit(&(fb)->m, NULL)
     #define FBLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->m)
-    #define FBLOCK_LOCK(fb) SCMutexLock(&(fb)->m)
+    #define FBLOCK_LOCK(fb) SCMutexLockSite(&(fb)->m, LOCK_SITE_FLOW_BUCKET)
     #define FBLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FBLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->m)
 #else
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** have the flow manager check the row on its next pass */
+#define FBTIMEOUT_RESET(fb) SC_ATOMIC_SET((fb)->next_ts, 0)
+/** the manager is walking the row, see FlowManagerHashRowTimeout */
+#define FBTIMEOUT_WALKING 1
+/** a flow's timeout may have become shorter, have its row checked */
+#define FBTIMEOUT_RESET_FLOW(f) do {            \
+        if ((f)->fb != NULL)                    \
+            FBTIMEOUT_RESET((f)->fb);           \
+    } while (0)
+
+/** Slice of the flow hash owned by a single flow worker thread when
+ *  'flow.thread-local' is enabled. Only the owning thread modifies the
+ *  buckets in [min, min+size), so lookups don't need the bucket locks.
+ *  The flow manager doesn't walk the slice, but asks the owner to do
+ *  the timeout checks by bumping timeout_req. */
+typedef struct FlowHashPartition_ {
+    SC_ATOMIC_DECLARE(uint32_t, timeout_req);   /**< set by flow manager */
+    uint32_t timeout_done;                      /**< last request handled */
+
+    uint32_t min;           /**< first bucket owned by this partition */
+    uint32_t size;          /**< number of buckets, 0 if not active */
+    uint32_t prune_idx;     /**< FlowGetUsedFlow start offset */
+    int numa_node;          /**< node of the owner, -1 if unknown */
+    uint32_t manager;       /**< flow manager shard requesting timeouts */
+
+    struct FlowHashPartition_ *next;
+} __attribute__((aligned(CLS))) FlowHashPartition;
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+uint32_t FlowGetHashRaw(const uint8_t *pkt, uint32_t len, int use_vlan,
+        uint16_t vxlan_port);
+void FlowHashPrefetchBucket(const DecodeThreadVars *dtv, const Packet *p);
+void FlowHashPrefetchFlow(const DecodeThreadVars *dtv, const Packet *p);
+
+FlowHashPartition *FlowHashPartitionRegister(void);
+void FlowHashPartitionDeregister(FlowHashPartition *);
+void FlowHashPartitionsPostRunmodes(void);
+int FlowHashPartitionsActive(void);
+void FlowHashPartitionsRequestTimeout(uint32_t manager);
+
+/** \brief check if the flow manager has asked the owner of partition
+ *         'fp' to time out its flows */
+#define FlowHashPartitionTimeoutPending(fp) \
+    ((fp)->size > 0 && SC_ATOMIC_GET((fp)->timeout_req) != (fp)->timeout_done)
 
 void FlowDisableTcpReuseHandling(void);
 
+void FlowBucketRemoveTag(FlowBucket *fb, Flow *f);
+
+void FlowHashRegisterBenchmarks(void);
+
 #endif /* __FLOW_HASH_H__ */
 
@@ -64,14 +64,21 @@
 #include "host-timeout.h"
 #include "defrag-timeout.h"
 #include "ippair-timeout.h"
+#include "detect-engine-threshold.h"
 
 #include "output-flow.h"
 
+#include "util-memcap.h"
+#include "util-load-shed.h"
+#include "util-pool-depot.h"
+
 /* Run mode selected at suricata.c */
 extern int run_mode;
 
 /* multi flow mananger support */
 static uint32_t flowmgr_number = 1;
+/* packets preallocated for each flow manager's pseudo packets */
+static intmax_t flowmgr_pool_size = 0;
 /* atomic counter for flow managers, to assign instance id */
 SC_ATOMIC_DECLARE(uint32_t, flowmgr_cnt);
 
@@ -90,13 +97,6 @@ SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 #define FLOW_EMERG_MODE_UPDATE_DELAY_NSEC 100000
 #define NEW_FLOW_COUNT_COND 10
 
-typedef struct FlowTimeoutCounters_ {
-    uint32_t new;
-    uint32_t est;
-    uint32_t clo;
-    uint32_t tcp_reuse;
-} FlowTimeoutCounters;
-
 /**
  * \brief Used to disable flow manager thread(s).
  *
@@ -179,6 +179,8 @@ static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergenc
                 timeout = flow_proto[f->protomap].emerg_new_timeout;
                 break;
             case FLOW_STATE_ESTABLISHED:
+            case FLOW_STATE_LOCAL_BYPASSED:
+            case FLOW_STATE_CAPTURE_BYPASSED:
                 timeout = flow_proto[f->protomap].emerg_est_timeout;
                 break;
             case FLOW_STATE_CLOSED:
@@ -192,6 +194,8 @@ static inline uint32_t FlowGetFlowTimeout(const Flow *f, int state, int emergenc
                 timeout = flow_proto[f->protomap].new_timeout;
                 break;
             case FLOW_STATE_ESTABLISHED:
+            case FLOW_STATE_LOCAL_BYPASSED:
+            case FLOW_STATE_CAPTURE_BYPASSED:
                 timeout = flow_proto[f->protomap].est_timeout;
                 break;
             case FLOW_STATE_CLOSED:
@@ -246,6 +250,12 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
         return 0;
     }
 
+    /* a bypassed flow's stream state is stale, nothing to flush */
+    int state = SC_ATOMIC_GET(f->flow_state);
+    if (FLOW_IS_BYPASSED(state)) {
+        return 1;
+    }
+
     int server = 0, client = 0;
     if (!(f->flags & FLOW_TIMEOUT_REASSEMBLY_DONE) &&
             FlowForceReassemblyNeedReassembly(f, &server, &client) == 1) {
@@ -260,6 +270,75 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
     return 1;
 }
 
+/** \internal
+ *  \brief release the memory an idle flow holds, keeping what's needed
+ *         to track it once it sees traffic again
+ *
+ *  The TCP segments, reassembly buffers and stream msgs are returned if
+ *  they were fully processed. The app layer state is freed if all its
+ *  transactions are done, and app layer detection starts over with the
+ *  next data, as for a midstream session. The TCP session with its
+ *  sequence tracking, the flowbits and flowvars are kept.
+ *
+ *  The flow is locked and unused. Flows with data still to inspect are
+ *  left as they are until the next packet.
+ *
+ *  \retval 1 memory was released
+ *  \retval 0 nothing could be released
+ */
+static int FlowManagerFlowHibernate(Flow *f)
+{
+    /* from here on it's skipped until it sees a packet again */
+    f->hibernated = 1;
+
+    if (f->proto == IPPROTO_TCP) {
+        TcpSession *ssn = (TcpSession *)f->protoctx;
+        if (ssn == NULL)
+            return 0;
+        if (StreamNeedsReassembly(ssn, 0) != STREAM_HAS_UNPROCESSED_SEGMENTS_NONE ||
+            StreamNeedsReassembly(ssn, 1) != STREAM_HAS_UNPROCESSED_SEGMENTS_NONE)
+            return 0;
+    }
+
+    if (f->alstate != NULL && AppLayerParserProtocolSupportsTxs(f->proto, f->alproto)) {
+        uint64_t total_txs = AppLayerParserGetTxCnt(f->proto, f->alproto, f->alstate);
+        if (AppLayerParserGetTransactionActive(f->proto, f->alproto,
+                    f->alparser, STREAM_TOSERVER) < total_txs ||
+            AppLayerParserGetTransactionActive(f->proto, f->alproto,
+                    f->alparser, STREAM_TOCLIENT) < total_txs)
+            return 0;
+    }
+
+    if (f->proto == IPPROTO_TCP) {
+        /* all processed, the ra base seqs already point past the data */
+        StreamTcpSessionCleanup((TcpSession *)f->protoctx);
+    }
+
+    if (f->alstate != NULL) {
+        FlowCleanupAppLayer(f);
+        f->alproto = f->alproto_ts = f->alproto_tc = ALPROTO_UNKNOWN;
+        f->flags &= ~(FLOW_ALPROTO_DETECT_DONE |
+                FLOW_TS_PM_ALPROTO_DETECT_DONE | FLOW_TS_PP_ALPROTO_DETECT_DONE |
+                FLOW_TC_PM_ALPROTO_DETECT_DONE | FLOW_TC_PP_ALPROTO_DETECT_DONE);
+        f->probing_parser_toserver_alproto_masks = 0;
+        f->probing_parser_toclient_alproto_masks = 0;
+        f->data_al_so_far[0] = f->data_al_so_far[1] = 0;
+        if (f->proto == IPPROTO_TCP) {
+            TcpSession *ssn = (TcpSession *)f->protoctx;
+            StreamTcpResetStreamFlagAppProtoDetectionCompleted(&ssn->client);
+            StreamTcpResetStreamFlagAppProtoDetectionCompleted(&ssn->server);
+        }
+    }
+
+    /* the flow's detect state refers to the app layer state */
+    if (f->de_state != NULL) {
+        DetectEngineStateFlowFree(f->de_state);
+        f->de_state = NULL;
+    }
+    f->detect_alversion[0] = f->detect_alversion[1] = 0;
+    return 1;
+}
+
 /**
  *  \internal
  *
@@ -269,13 +348,18 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param wait wait for packets in the pool before handling a flow
+ *  \param next_ts[out] earliest time one of the remaining flows can
+ *                      time out
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters)
+        int emergency, FlowTimeoutCounters *counters, const int wait,
+        uint32_t *next_ts)
 {
     uint32_t cnt = 0;
+    uint32_t min_ts = UINT32_MAX;
 
     do {
         /* check flow timeout based on lastts and state. Both can be
@@ -287,13 +371,46 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* timeout logic goes here */
         if (FlowManagerFlowTimeout(f, state, ts, emergency) == 0) {
+            uint32_t due = (uint32_t)f->lastts.tv_sec +
+                FlowGetFlowTimeout(f, state, emergency) + 1;
+
+            /* idle established flows give up their memory before they
+             * time out */
+            if (flow_config.hibernate_timeout && !f->hibernated &&
+                state == FLOW_STATE_ESTABLISHED)
+            {
+                uint32_t idle = (uint32_t)f->lastts.tv_sec +
+                    flow_config.hibernate_timeout + 1;
+                if (idle > (uint32_t)ts->tv_sec) {
+                    if (idle < due)
+                        due = idle;
+                } else if (SC_ATOMIC_GET(f->use_cnt) > 0) {
+                    due = (uint32_t)ts->tv_sec;
+                } else {
+                    FLOWLOCK_WRLOCK(f);
+                    if (SC_ATOMIC_GET(f->use_cnt) > 0)
+                        due = (uint32_t)ts->tv_sec;
+                    else if (FlowManagerFlowHibernate(f) == 1)
+                        counters->hibernated++;
+                    FLOWLOCK_UNLOCK(f);
+                }
+            }
+
+            if (due < min_ts)
+                min_ts = due;
             f = f->hprev;
             continue;
         }
 
         /* before grabbing the flow lock, make sure we have at least
-         * 3 packets in the pool */
-        PacketPoolWaitForN(3);
+         * 3 packets in the pool. Don't wait for them: the packets are
+         * held by the workers, so leave the flow for the next pass. */
+        if (wait && !PacketPoolHasN(3)) {
+            counters->pool_deferred++;
+            min_ts = (uint32_t)ts->tv_sec;
+            f = f->hprev;
+            continue;
+        }
 
         FLOWLOCK_WRLOCK(f);
 
@@ -311,6 +428,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                 f->fb->head = f->hnext;
             if (f->fb->tail == f)
                 f->fb->tail = f->hprev;
+            FlowBucketRemoveTag(f->fb, f);
 
             f->hnext = NULL;
             f->hprev = NULL;
@@ -324,6 +442,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                 f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
             else if (state == FLOW_STATE_CLOSED)
                 f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+            else if (FLOW_IS_BYPASSED(state))
+                f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
 
             if (emergency)
                 f->flow_end_flags |= FLOW_END_FLAG_EMERGENCY;
@@ -346,6 +466,8 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
                     counters->new++;
                     break;
                 case FLOW_STATE_ESTABLISHED:
+                case FLOW_STATE_LOCAL_BYPASSED:
+                case FLOW_STATE_CAPTURE_BYPASSED:
                     counters->est++;
                     break;
                 case FLOW_STATE_CLOSED:
@@ -354,11 +476,52 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
             }
         } else {
             FLOWLOCK_UNLOCK(f);
+            /* in use or being flushed: look again next pass */
+            min_ts = (uint32_t)ts->tv_sec;
         }
 
         f = next_flow;
     } while (f != NULL);
 
+    *next_ts = min_ts;
+    return cnt;
+}
+
+/** \internal
+ *  \brief check if a hash row can be skipped as none of its flows can
+ *         have timed out yet. Ignored in emergency mode as the timeouts
+ *         are shorter then.
+ */
+static inline int FlowManagerHashRowSkip(FlowBucket *fb, struct timeval *ts,
+        int emergency)
+{
+    if (emergency)
+        return 0;
+    return (SC_ATOMIC_GET(fb->next_ts) > (uint32_t)ts->tv_sec);
+}
+
+/** \internal
+ *  \brief walk a hash row and record when it needs to be checked again
+ *
+ *  The row's next_ts is set to FBTIMEOUT_WALKING first. If a packet
+ *  thread resets it while we walk the row, the CAS fails and the row is
+ *  checked on the next pass.
+ */
+static uint32_t FlowManagerHashRowCheck(FlowBucket *fb, struct timeval *ts,
+        int emergency, FlowTimeoutCounters *counters, const int wait)
+{
+    uint32_t cnt = 0;
+    uint32_t next_ts = UINT32_MAX;
+
+    SC_ATOMIC_SET(fb->next_ts, FBTIMEOUT_WALKING);
+
+    if (fb->tail != NULL)
+        cnt = FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters,
+                wait, &next_ts);
+
+    /* in emergency mode the timeouts are shorter, so next_ts would be
+     * too early for normal mode. Harmless: it only causes a recheck. */
+    (void)SC_ATOMIC_CAS(&fb->next_ts, FBTIMEOUT_WALKING, next_ts);
     return cnt;
 }
 
@@ -381,28 +544,25 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
     uint32_t cnt = 0;
     int emergency = 0;
 
-    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+    if (SC_ATOMIC_GET(flow_flags) & (FLOW_EMERGENCY|FLOW_PRUNE_EARLY))
         emergency = 1;
 
     for (idx = hash_min; idx < hash_max; idx++) {
         FlowBucket *fb = &flow_hash[idx];
 
-        /* before grabbing the row lock, make sure we have at least
-         * 9 packets in the pool */
-        PacketPoolWaitForN(9);
+        /* nothing in this row can have timed out yet */
+        if (FlowManagerHashRowSkip(fb, ts, emergency)) {
+            counters->rows_skipped++;
+            continue;
+        }
 
         if (FBLOCK_TRYLOCK(fb) != 0)
             continue;
 
         /* flow hash bucket is now locked */
+        counters->rows_checked++;
+        cnt += FlowManagerHashRowCheck(fb, ts, emergency, counters, 1);
 
-        if (fb->tail == NULL)
-            goto next;
-
-        /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters);
-
-next:
         FBLOCK_UNLOCK(fb);
 
         if (try_cnt > 0 && cnt >= try_cnt)
@@ -412,6 +572,47 @@ next:
     return cnt;
 }
 
+/**
+ *  \brief time out flows from a hash partition
+ *
+ *  Called by the thread owning the partition after the flow manager
+ *  requested it. The buckets are not locked: only the owner modifies them.
+ *  We don't wait for packets in the pool, as the owner is the thread that
+ *  would return them. Pseudo packets are injected into the owner's own
+ *  stream queue and are processed with its next packet.
+ *
+ *  \param fp partition owned by the calling thread
+ *  \param ts timestamp
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flow
+ */
+uint32_t FlowTimeoutHashPartition(FlowHashPartition *fp, struct timeval *ts,
+        FlowTimeoutCounters *counters)
+{
+    uint32_t idx = 0;
+    uint32_t cnt = 0;
+    int emergency = 0;
+
+    fp->timeout_done = SC_ATOMIC_GET(fp->timeout_req);
+
+    if (SC_ATOMIC_GET(flow_flags) & (FLOW_EMERGENCY|FLOW_PRUNE_EARLY))
+        emergency = 1;
+
+    for (idx = fp->min; idx < fp->min + fp->size; idx++) {
+        FlowBucket *fb = &flow_hash[idx];
+        if (FlowManagerHashRowSkip(fb, ts, emergency)) {
+            counters->rows_skipped++;
+            continue;
+        }
+
+        counters->rows_checked++;
+        cnt += FlowManagerHashRowCheck(fb, ts, emergency, counters, 0);
+    }
+
+    return cnt;
+}
+
 /**
  *  \internal
  *
@@ -441,6 +642,7 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
             f->fb->head = f->hnext;
         if (f->fb->tail == f)
             f->fb->tail = f->hprev;
+        FlowBucketRemoveTag(f->fb, f);
 
         f->hnext = NULL;
         f->hprev = NULL;
@@ -451,6 +653,8 @@ static uint32_t FlowManagerHashRowCleanup(Flow *f)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_ESTABLISHED;
         else if (state == FLOW_STATE_CLOSED)
             f->flow_end_flags |= FLOW_END_FLAG_STATE_CLOSED;
+        else if (FLOW_IS_BYPASSED(state))
+            f->flow_end_flags |= FLOW_END_FLAG_STATE_BYPASSED;
 
         f->flow_end_flags |= FLOW_END_FLAG_SHUTDOWN;
 
@@ -507,6 +711,10 @@ typedef struct FlowManagerThreadData_ {
     uint16_t flow_emerg_mode_enter;
     uint16_t flow_emerg_mode_over;
     uint16_t flow_tcp_reuse;
+    uint16_t flow_mgr_rows_checked;
+    uint16_t flow_mgr_rows_skipped;
+    uint16_t flow_mgr_pool_deferred;
+    uint16_t flow_mgr_hibernated;
 } FlowManagerThreadData;
 
 static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
@@ -544,8 +752,21 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     ftd->flow_emerg_mode_enter = StatsRegisterCounter("flow.emerg_mode_entered", t);
     ftd->flow_emerg_mode_over = StatsRegisterCounter("flow.emerg_mode_over", t);
     ftd->flow_tcp_reuse = StatsRegisterCounter("flow.tcp_reuse", t);
+    ftd->flow_mgr_rows_checked = StatsRegisterCounter("flow_mgr.rows_checked", t);
+    ftd->flow_mgr_rows_skipped = StatsRegisterCounter("flow_mgr.rows_skipped", t);
+    ftd->flow_mgr_pool_deferred = StatsRegisterCounter("flow_mgr.pool_deferred", t);
+    ftd->flow_mgr_hibernated = StatsRegisterCounter("flow_mgr.hibernated", t);
+    if (ftd->instance == 1) {
+        MemcapPolicyRegisterCounters(t);
+        LoadShedRegisterCounters(t);
+    }
 
-    PacketPoolInit();
+    /* our own pool for the pseudo packets, so timeouts are not held
+     * up by the sizing of the capture pools */
+    if (flowmgr_pool_size > 0)
+        PacketPoolInitWithSize(flowmgr_pool_size);
+    else
+        PacketPoolInit();
     return TM_ECODE_OK;
 }
 
@@ -607,15 +828,21 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         /* Get the time */
         memset(&ts, 0, sizeof(ts));
         TimeGet(&ts);
+        TimeSetCoarse(&ts);
         SCLogDebug("ts %" PRIdMAX "", (intmax_t)ts.tv_sec);
 
         /* see if we still have enough spare flows */
         if (ftd->instance == 1)
             FlowUpdateSpareFlows();
 
-        /* try to time out flows */
+        /* try to time out flows. If the flow workers own the hash,
+         * ask them to do it. */
         FlowTimeoutCounters counters = { 0, 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        if (FlowHashPartitionsActive()) {
+            FlowHashPartitionsRequestTimeout(ftd->instance - 1);
+        } else {
+            FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        }
 
 
         if (ftd->instance == 1) {
@@ -623,6 +850,9 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
             //uint32_t hosts_pruned =
             HostTimeoutHash(&ts);
             IPPairTimeoutHash(&ts);
+            ThresholdsTimeoutHash(&ts);
+            MemcapPolicyCheck(th_v);
+            LoadShedCheck(th_v);
         }
 /*
         StatsAddUI64(th_v, flow_mgr_host_prune, (uint64_t)hosts_pruned);
@@ -635,11 +865,12 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         StatsAddUI64(th_v, ftd->flow_mgr_cnt_new, (uint64_t)counters.new);
         StatsAddUI64(th_v, ftd->flow_mgr_cnt_est, (uint64_t)counters.est);
         StatsAddUI64(th_v, ftd->flow_tcp_reuse, (uint64_t)counters.tcp_reuse);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_checked, (uint64_t)counters.rows_checked);
+        StatsAddUI64(th_v, ftd->flow_mgr_rows_skipped, (uint64_t)counters.rows_skipped);
+        StatsAddUI64(th_v, ftd->flow_mgr_pool_deferred, (uint64_t)counters.pool_deferred);
+        StatsAddUI64(th_v, ftd->flow_mgr_hibernated, (uint64_t)counters.hibernated);
 
-        uint32_t len = 0;
-        FQLOCK_LOCK(&flow_spare_q);
-        len = flow_spare_q.len;
-        FQLOCK_UNLOCK(&flow_spare_q);
+        uint32_t len = FlowSpareGetLen();
         StatsSetUI64(th_v, ftd->flow_mgr_spare, (uint64_t)len);
 
         /* Don't fear, FlowManagerThread is here...
@@ -701,6 +932,12 @@ static uint64_t FlowGetMemuse(void)
     return flow_memuse;
 }
 
+/** \brief number of flow manager threads, see FlowManagerThreadSpawn() */
+uint32_t FlowManagerGetCount(void)
+{
+    return flowmgr_number;
+}
+
 /** \brief spawn the flow manager thread */
 void FlowManagerThreadSpawn()
 {
@@ -708,7 +945,15 @@ void FlowManagerThreadSpawn()
     return;
 #endif
     intmax_t setting = 1;
-    (void)ConfGetInt("flow.managers", &setting);
+    char *managers = NULL;
+    if (ConfGet("flow.managers", &managers) == 1 && managers != NULL &&
+            strcasecmp(managers, "auto") == 0) {
+        /* one manager per NUMA node, serving that node's workers */
+        if (flow_config.numa_nodes > 0)
+            setting = flow_config.numa_nodes;
+    } else {
+        (void)ConfGetInt("flow.managers", &setting);
+    }
 
     if (setting < 1 || setting > 1024) {
         SCLogError(SC_ERR_INVALID_ARGUMENTS,
@@ -717,7 +962,19 @@ void FlowManagerThreadSpawn()
     }
     flowmgr_number = (uint32_t)setting;
 
-    SCLogConfig("using %u flow manager threads", flowmgr_number);
+    extern intmax_t max_pending_packets;
+    flowmgr_pool_size = max_pending_packets;
+    if (ConfGetInt("flow.manager-pool-size", &setting) == 1) {
+        if (setting < 9) {
+            SCLogError(SC_ERR_INVALID_ARGUMENTS, "invalid "
+                    "flow.manager-pool-size %"PRIdMAX", minimum is 9", setting);
+            exit(EXIT_FAILURE);
+        }
+        flowmgr_pool_size = setting;
+    }
+
+    SCLogConfig("using %u flow manager threads, %"PRIdMAX" pseudo packets "
+            "each", flowmgr_number, flowmgr_pool_size);
     SCCtrlCondInit(&flow_manager_ctrl_cond, NULL);
     SCCtrlMutexInit(&flow_manager_ctrl_mutex, NULL);
 
@@ -774,6 +1031,9 @@ static TmEcode FlowRecyclerThreadDeinit(ThreadVars *t, void *data)
     if (ftd->output_thread_data != NULL)
         OutputFlowLogThreadDeinit(t, ftd->output_thread_data);
 
+    /* segments of the flows we cleared are cached by this thread */
+    PoolDepotThreadFlush();
+
     SCFree(data);
     return TM_ECODE_OK;
 }
@@ -1278,6 +1538,165 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+/**
+ *  \test   Test timing out flows from a hash partition on request.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest06 (void)
+{
+    int result = 0;
+    FlowHashPartition fp;
+
+    FlowInitConfig(FLOW_QUIET);
+
+    memset(&fp, 0, sizeof(fp));
+    SC_ATOMIC_INIT(fp.timeout_req);
+    fp.min = 0;
+    fp.size = flow_config.hash_size;
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+    TimeSetIncrementTime(2000);
+
+    if (FlowHashPartitionTimeoutPending(&fp))
+        goto end;
+    (void) SC_ATOMIC_ADD(fp.timeout_req, 1);
+    if (!(FlowHashPartitionTimeoutPending(&fp)))
+        goto end;
+
+    struct timeval ts;
+    TimeGet(&ts);
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    uint32_t cnt = FlowTimeoutHashPartition(&fp, &ts, &counters);
+    if (cnt == 0 || flow_recycle_q.len != cnt)
+        goto end;
+    if (FlowHashPartitionTimeoutPending(&fp))
+        goto end;
+
+    result = 1;
+end:
+    SC_ATOMIC_DESTROY(fp.timeout_req);
+    FlowShutdown();
+    return result;
+}
+/**
+ *  \test  Test that the hash rows are only walked again once one of
+ *         their flows can time out.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int FlowMgrTest07 (void)
+{
+    int result = 0;
+    FlowHashPartition fp;
+
+    FlowInitConfig(FLOW_QUIET);
+
+    memset(&fp, 0, sizeof(fp));
+    SC_ATOMIC_INIT(fp.timeout_req);
+    fp.min = 0;
+    fp.size = flow_config.hash_size;
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+
+    struct timeval ts;
+    TimeGet(&ts);
+
+    /* first pass: rows with flows are walked, nothing is due */
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    if (FlowTimeoutHashPartition(&fp, &ts, &counters) != 0)
+        goto end;
+    if (counters.rows_checked == 0)
+        goto end;
+
+    /* second pass at the same time: every row is skipped */
+    memset(&counters, 0, sizeof(counters));
+    if (FlowTimeoutHashPartition(&fp, &ts, &counters) != 0)
+        goto end;
+    if (counters.rows_checked != 0 || counters.rows_skipped != fp.size)
+        goto end;
+
+    /* once the flows are due, they are timed out */
+    TimeSetIncrementTime(2000);
+    TimeGet(&ts);
+    memset(&counters, 0, sizeof(counters));
+    uint32_t cnt = FlowTimeoutHashPartition(&fp, &ts, &counters);
+    if (cnt == 0 || flow_recycle_q.len != cnt)
+        goto end;
+
+    result = 1;
+end:
+    SC_ATOMIC_DESTROY(fp.timeout_req);
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test  Test that an idle established flow is hibernated once, and only
+ *         if its segments were processed.
+ */
+static int FlowMgrTest08 (void)
+{
+    TcpSession ssn;
+    TcpSegment seg;
+    Flow f;
+    FlowBucket fb;
+    struct timeval ts;
+    uint32_t next_ts = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    flow_config.hibernate_timeout = 60;
+
+    memset(&ssn, 0, sizeof(TcpSession));
+    memset(&seg, 0, sizeof(TcpSegment));
+    memset(&f, 0, sizeof(Flow));
+    memset(&fb, 0, sizeof(FlowBucket));
+    FBLOCK_INIT(&fb);
+    FLOW_INITIALIZE(&f);
+
+    TimeGet(&ts);
+    f.proto = IPPROTO_TCP;
+    f.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f.protoctx = &ssn;
+    f.fb = &fb;
+    fb.head = fb.tail = &f;
+    ssn.state = TCP_ESTABLISHED;
+    SC_ATOMIC_SET(f.flow_state, FLOW_STATE_ESTABLISHED);
+
+    /* not idle long enough: due when it can hibernate */
+    f.lastts.tv_sec = ts.tv_sec - 30;
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    FAIL_IF(FlowManagerHashRowTimeout(&f, &ts, 0, &counters, 0, &next_ts) != 0);
+    FAIL_IF(counters.hibernated != 0 || f.hibernated);
+    FAIL_IF(next_ts != (uint32_t)f.lastts.tv_sec + 61);
+
+    /* unprocessed data is kept */
+    ssn.client.seg_list = ssn.client.seg_list_tail = &seg;
+    f.lastts.tv_sec = ts.tv_sec - 100;
+    FAIL_IF(FlowManagerHashRowTimeout(&f, &ts, 0, &counters, 0, &next_ts) != 0);
+    FAIL_IF(counters.hibernated != 0 || !f.hibernated);
+    FAIL_IF(ssn.client.seg_list != &seg);
+
+    /* a packet wakes it up, the next idle pass releases the memory */
+    f.hibernated = 0;
+    ssn.client.seg_list = ssn.client.seg_list_tail = NULL;
+    FAIL_IF(FlowManagerHashRowTimeout(&f, &ts, 0, &counters, 0, &next_ts) != 0);
+    FAIL_IF(counters.hibernated != 1 || !f.hibernated);
+    /* only once */
+    FAIL_IF(FlowManagerHashRowTimeout(&f, &ts, 0, &counters, 0, &next_ts) != 0);
+    FAIL_IF(counters.hibernated != 1);
+    FAIL_IF(fb.head != &f);
+
+    f.protoctx = NULL;
+    fb.head = fb.tail = NULL;
+    FBLOCK_DESTROY(&fb);
+    FLOW_DESTROY(&f);
+    FlowShutdown();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1296,5 +1715,11 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Timeout flows from a hash partition",
+                   FlowMgrTest06);
+    UtRegisterTest("FlowMgrTest07 -- Skip hash rows without flows due",
+                   FlowMgrTest07);
+    UtRegisterTest("FlowMgrTest08 -- Hibernate idle flows",
+                   FlowMgrTest08);
 #endif /* UNITTESTS */
 }
@@ -29,7 +29,22 @@ SCCtrlCondT flow_manager_ctrl_cond;
 SCCtrlMutex flow_manager_ctrl_mutex;
 #define FlowWakeupFlowManagerThread() SCCtrlCondSignal(&flow_manager_ctrl_cond)
 
+typedef struct FlowTimeoutCounters_ {
+    uint32_t new;
+    uint32_t est;
+    uint32_t clo;
+    uint32_t tcp_reuse;
+    uint32_t rows_checked;  /**< hash rows walked */
+    uint32_t rows_skipped;  /**< hash rows skipped, nothing due yet */
+    uint32_t pool_deferred; /**< flows left for later, no packets */
+    uint32_t hibernated;    /**< idle flows that had their memory released */
+} FlowTimeoutCounters;
+
+uint32_t FlowTimeoutHashPartition(struct FlowHashPartition_ *fp, struct timeval *ts,
+        FlowTimeoutCounters *counters);
+
 void FlowManagerThreadSpawn(void);
+uint32_t FlowManagerGetCount(void);
 void FlowDisableFlowManagerThread(void);
 void FlowMgrRegisterTests (void);
 
@@ -35,6 +35,9 @@
  *  flows for new flows and/or it's memcap limit it reached. In this state the
  *  flow engine with evaluate flows with lower timeout settings. */
 #define FLOW_EMERGENCY   0x01
+/** Memcap policy asks to prune flows early: the emergency timeouts are
+ *  used, but the engine is not in emergency mode. */
+#define FLOW_PRUNE_EARLY 0x02
 
 /* Flow Time out values */
 #define FLOW_DEFAULT_NEW_TIMEOUT 30
@@ -78,6 +81,9 @@ FlowProto flow_proto[FLOW_PROTO_MAX];
 /** spare/unused/prealloced flows live here */
 FlowQueue flow_spare_q;
 
+/** per NUMA node spare flows, used if flow_config.numa_nodes is set */
+FlowQueue flow_spare_q_numa[FLOW_NUMA_MAX_NODES];
+
 /** queue to pass flows to cleanup/log thread(s) */
 FlowQueue flow_recycle_q;
 
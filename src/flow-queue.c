@@ -145,24 +145,29 @@ Flow *FlowDequeue (FlowQueue *q)
  */
 void FlowMoveToSpare(Flow *f)
 {
+    /* flows owned by a NUMA node go back to that node's queue */
+    FlowQueue *q = &flow_spare_q;
+    if (f->numa_node < flow_config.numa_nodes)
+        q = &flow_spare_q_numa[f->numa_node];
+
     /* now put it in spare */
-    FQLOCK_LOCK(&flow_spare_q);
+    FQLOCK_LOCK(q);
 
     /* add to new queue (append) */
-    f->lprev = flow_spare_q.bot;
+    f->lprev = q->bot;
     if (f->lprev != NULL)
         f->lprev->lnext = f;
     f->lnext = NULL;
-    flow_spare_q.bot = f;
-    if (flow_spare_q.top == NULL)
-        flow_spare_q.top = f;
+    q->bot = f;
+    if (q->top == NULL)
+        q->top = f;
 
-    flow_spare_q.len++;
+    q->len++;
 #ifdef DBG_PERF
-    if (flow_spare_q.len > flow_spare_q.dbg_maxlen)
-        flow_spare_q.dbg_maxlen = flow_spare_q.len;
+    if (q->len > q->dbg_maxlen)
+        q->dbg_maxlen = q->len;
 #endif /* DBG_PERF */
 
-    FQLOCK_UNLOCK(&flow_spare_q);
+    FQLOCK_UNLOCK(q);
 }
 
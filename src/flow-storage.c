@@ -26,7 +26,7 @@
  */
 
 #include "suricata-common.h"
-#include "host-storage.h"
+#include "flow-storage.h"
 #include "flow-hash.h"
 #include "flow-util.h"
 #include "util-unittest.h"
@@ -36,16 +36,6 @@ unsigned int FlowStorageSize(void)
     return StorageGetSize(STORAGE_FLOW);
 }
 
-void *FlowGetStorageById(Flow *f, int id)
-{
-    return StorageGetById((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id);
-}
-
-int FlowSetStorageById(Flow *f, int id, void *ptr)
-{
-    return StorageSetById((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id, ptr);
-}
-
 void *FlowAllocStorageById(Flow *f, int id)
 {
     return StorageAllocByIdPrealloc((Storage *)((void *)f + sizeof(Flow)), STORAGE_FLOW, id);
@@ -66,6 +56,15 @@ int FlowStorageRegister(const char *name, const unsigned int size, void *(*Alloc
     return StorageRegister(STORAGE_FLOW, name, size, Alloc, Free);
 }
 
+int FlowStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *)) {
+    return StorageRegisterInline(STORAGE_FLOW, name, size, Free);
+}
+
+int FlowStorageGetOffset(int id)
+{
+    return StorageGetOffset(STORAGE_FLOW, id);
+}
+
 #ifdef UNITTESTS
 
 static void *StorageTestAlloc(unsigned int size)
@@ -286,11 +285,62 @@ error:
 }
 #endif
 
+/** \test inline storage is part of the flow memory, cleared on reuse */
+static int FlowStorageTest04(void)
+{
+    Flow *f = NULL;
+
+    StorageInit();
+
+    int id1 = FlowStorageRegister("test1", sizeof(void *), NULL, StorageTestFree);
+    if (id1 < 0)
+        goto error;
+    int id2 = FlowStorageRegisterInline("test2", 24, NULL);
+    if (id2 < 0)
+        goto error;
+
+    if (StorageFinalize() < 0)
+        goto error;
+    int off = FlowStorageGetOffset(id2);
+    if (off < 0)
+        goto error;
+
+    FlowInitConfig(FLOW_QUIET);
+    f = FlowAlloc();
+    if (f == NULL)
+        goto error;
+
+    uint8_t *data = FlowGetStorageByOffset(f, off);
+    if (data <= (uint8_t *)f || data + 24 > (uint8_t *)f + sizeof(Flow) + FlowStorageSize())
+        goto error;
+    if (data[0] != 0 || data[23] != 0)
+        goto error;
+    memset(data, 0xff, 24);
+
+    FlowClearMemory(f, 0);
+    if (data[0] != 0 || data[23] != 0)
+        goto error;
+
+    FlowFree(f);
+    FlowShutdown();
+    StorageCleanup();
+    return 1;
+error:
+    if (f != NULL) {
+        FlowClearMemory(f, 0);
+        FlowFree(f);
+    }
+    FlowShutdown();
+    StorageCleanup();
+    return 0;
+}
+
 void RegisterFlowStorageTests(void)
 {
 #ifdef UNITTESTS
     UtRegisterTest("FlowStorageTest01", FlowStorageTest01);
     UtRegisterTest("FlowStorageTest02", FlowStorageTest02);
     UtRegisterTest("FlowStorageTest03", FlowStorageTest03);
+    UtRegisterTest("FlowStorageTest04", FlowStorageTest04);
 #endif
 }
@@ -31,8 +31,26 @@
 
 unsigned int FlowStorageSize(void);
 
-void *FlowGetStorageById(Flow *h, int id);
-int FlowSetStorageById(Flow *h, int id, void *ptr);
+/** \brief the storage of a Flow, laid out right after it */
+#define FLOW_STORAGE(h) ((Storage *)((uint8_t *)(h) + sizeof(Flow)))
+
+static inline void *FlowGetStorageById(Flow *h, int id)
+{
+    return FLOW_STORAGE(h)[id];
+}
+
+static inline int FlowSetStorageById(Flow *h, int id, void *ptr)
+{
+    FLOW_STORAGE(h)[id] = ptr;
+    return 0;
+}
+
+/** \brief get inline storage by the offset from FlowStorageGetOffset() */
+static inline void *FlowGetStorageByOffset(Flow *h, unsigned int offset)
+{
+    return StorageGetByOffset(FLOW_STORAGE(h), offset);
+}
+
 void *FlowAllocStorageById(Flow *h, int id);
 
 void FlowFreeStorageById(Flow *h, int id);
@@ -41,5 +59,7 @@ void FlowFreeStorage(Flow *h);
 void RegisterFlowStorageTests(void);
 
 int FlowStorageRegister(const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *));
+int FlowStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *));
+int FlowStorageGetOffset(int id);
 
 #endif /* __FLOW_STORAGE_H__ */
@@ -81,6 +81,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
                                                            int dummy)
 {
     p->tenant_id = f->tenant_id;
+    p->job_id = f->job_id;
     p->datalink = DLT_RAW;
     p->proto = IPPROTO_TCP;
     FlowReference(&p->flow, f);
@@ -251,7 +252,7 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
     }
 
     memset(&p->ts, 0, sizeof(struct timeval));
-    TimeGet(&p->ts);
+    TimeGetCoarse(&p->ts);
 
     AppLayerParserSetEOF(f->alparser);
 
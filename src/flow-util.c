@@ -34,6 +34,7 @@
 
 #include "util-var.h"
 #include "util-debug.h"
+#include "util-mem-tag.h"
 #include "flow-storage.h"
 
 #include "detect.h"
@@ -57,7 +58,8 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    /* start on a cache line, so the lookup header is in a single line */
+    f = SCMallocAlignedTag(MEM_TAG_FLOW, size, CLS);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
@@ -65,6 +67,7 @@ Flow *FlowAlloc(void)
     memset(f, 0, size);
 
     FLOW_INITIALIZE(f);
+    f->numa_node = FLOW_NUMA_NODE_NONE;
     return f;
 }
 
@@ -77,7 +80,7 @@ Flow *FlowAlloc(void)
 void FlowFree(Flow *f)
 {
     FLOW_DESTROY(f);
-    SCFree(f);
+    SCFreeTag(MEM_TAG_FLOW, f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
@@ -132,6 +135,8 @@ void FlowInit(Flow *f, const Packet *p)
     f->recursion_level = p->recursion_level;
     f->vlan_id[0] = p->vlan_id[0];
     f->vlan_id[1] = p->vlan_id[1];
+    f->vni = p->vni;
+    f->job_id = p->job_id;
 
     if (PKT_IS_IPV4(p)) {
         FLOW_SET_IPV4_SRC_ADDR_FROM_PACKET(p, &f->src);
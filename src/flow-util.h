@@ -26,6 +26,7 @@
 
 #include "detect-engine-state.h"
 #include "tmqh-flow.h"
+#include "flow-bit.h"
 
 #define COPY_TIMESTAMP(src,dst) ((dst)->tv_sec = (src)->tv_sec, (dst)->tv_usec = (src)->tv_usec)
 
@@ -60,12 +61,15 @@
         (f)->thread_id = 0; \
         (f)->detect_alversion[0] = 0; \
         (f)->detect_alversion[1] = 0; \
+        (f)->hibernated = 0; \
+        (f)->load_shed = 0; \
         (f)->alparser = NULL; \
         (f)->alstate = NULL; \
         (f)->de_state = NULL; \
         (f)->sgh_toserver = NULL; \
         (f)->sgh_toclient = NULL; \
         (f)->flowvar = NULL; \
+        (f)->flowbits = NULL; \
         (f)->hnext = NULL; \
         (f)->hprev = NULL; \
         (f)->lnext = NULL; \
@@ -104,6 +108,8 @@
         (f)->thread_id = 0; \
         (f)->detect_alversion[0] = 0; \
         (f)->detect_alversion[1] = 0; \
+        (f)->hibernated = 0; \
+        (f)->load_shed = 0; \
         if ((f)->de_state != NULL) { \
             DetectEngineStateReset((f)->de_state, (STREAM_TOSERVER | STREAM_TOCLIENT)); \
         } \
@@ -111,6 +117,7 @@
         (f)->sgh_toclient = NULL; \
         GenericVarFree((f)->flowvar); \
         (f)->flowvar = NULL; \
+        FlowBitClearAll((f)); \
         RESET_COUNTERS((f)); \
     } while(0)
 
@@ -124,6 +131,7 @@
             DetectEngineStateFlowFree((f)->de_state); \
         } \
         GenericVarFree((f)->flowvar); \
+        FlowBitFreeAll((f)); \
     } while(0)
 
 /** \brief check if a memory alloc would fit in the memcap
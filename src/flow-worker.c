@@ -41,11 +41,19 @@
 #include "suricata.h"
 
 #include "decode.h"
+#include "flow-hash.h"
+#include "flow-private.h"
+#include "flow-manager.h"
 #include "stream-tcp.h"
 #include "app-layer.h"
 #include "detect-engine.h"
 
 #include "util-validate.h"
+#include "util-mpm-offload.h"
+#include "util-latency.h"
+#include "util-perf-event.h"
+#include "util-affinity.h"
+#include "util-dedup.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -64,6 +72,25 @@ typedef struct FlowWorkerThreadData_ {
 #endif
     PacketQueue pq;
 
+    /* counters for flow.thread-local timeout handling */
+    uint16_t flow_mgr_cnt_clo;
+    uint16_t flow_mgr_cnt_new;
+    uint16_t flow_mgr_cnt_est;
+    uint16_t flow_tcp_reuse;
+    uint16_t flow_mgr_hibernated;
+
+    /* batch mode counters */
+    uint16_t cnt_batches;
+    uint16_t cnt_batch_pkts;
+
+    /* packets of bypassed flows we skipped inspection for */
+    uint16_t cnt_bypassed_pkts;
+    uint16_t cnt_bypassed_bytes;
+
+    /* window of recent packets for duplicate suppression, NULL if off */
+    DedupThread *dedup;
+    uint16_t cnt_dedup_pkts;
+
 } FlowWorkerThreadData;
 
 /** \brief handle flow for packet
@@ -89,6 +116,38 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
+    /* claim our own part of the flow hash if enabled */
+    fw->dtv->flow_part = FlowHashPartitionRegister();
+    if (fw->dtv->flow_part != NULL) {
+        fw->flow_mgr_cnt_clo = StatsRegisterCounter("flow_mgr.closed_pruned", tv);
+        fw->flow_mgr_cnt_new = StatsRegisterCounter("flow_mgr.new_pruned", tv);
+        fw->flow_mgr_cnt_est = StatsRegisterCounter("flow_mgr.est_pruned", tv);
+        fw->flow_tcp_reuse = StatsRegisterCounter("flow.tcp_reuse", tv);
+        fw->flow_mgr_hibernated = StatsRegisterCounter("flow_mgr.hibernated", tv);
+    }
+
+    fw->cnt_batches = StatsRegisterCounter("flow_worker.batches", tv);
+    fw->cnt_batch_pkts = StatsRegisterCounter("flow_worker.batch_pkts", tv);
+    fw->cnt_bypassed_pkts = StatsRegisterCounter("flow_bypassed.local_pkts", tv);
+    fw->cnt_bypassed_bytes = StatsRegisterCounter("flow_bypassed.local_bytes", tv);
+
+    fw->dedup = DedupThreadInit();
+    if (fw->dedup != NULL)
+        fw->cnt_dedup_pkts = StatsRegisterCounter("decoder.dedup_suppressed", tv);
+
+    /* NUMA mode: we're running pinned, so use and prealloc flows on our
+     * node. ThreadInit runs in the worker thread itself. */
+    if (flow_config.numa_nodes > 0) {
+        int node = AffinityGetCurrentNumaNode();
+        if (node >= 0 && (uint32_t)node < flow_config.numa_nodes) {
+            fw->dtv->numa_node = node;
+            if (fw->dtv->flow_part != NULL)
+                fw->dtv->flow_part->numa_node = node;
+            FlowSparePreallocNuma(node);
+            SCLogPerf("%s: using flows local to NUMA node %d", tv->name, node);
+        }
+    }
+
     /* setup TCP */
     BUG_ON(StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK);
 
@@ -114,7 +173,10 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 {
     FlowWorkerThreadData *fw = data;
 
+    FlowHashPartitionDeregister(fw->dtv->flow_part);
+    fw->dtv->flow_part = NULL;
     DecodeThreadVarsFree(tv, fw->dtv);
+    DedupThreadFree(fw->dedup);
 
     /* free TCP */
     StreamTcpThreadDeinit(tv, (void *)fw->stream_thread);
@@ -140,16 +202,58 @@ static TmEcode FlowWorkerThreadDeinit(ThreadVars *tv, void *data)
 TmEcode Detect(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq);
 TmEcode StreamTcp (ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
+/** \internal
+ *  \brief time out the flows in our hash partition on request of the
+ *         flow manager
+ */
+static void FlowWorkerPartitionTimeout(ThreadVars *tv, FlowWorkerThreadData *fw)
+{
+    struct timeval ts;
+    memset(&ts, 0, sizeof(ts));
+    TimeGetCoarse(&ts);
+
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    FlowTimeoutHashPartition(fw->dtv->flow_part, &ts, &counters);
+
+    StatsAddUI64(tv, fw->flow_mgr_cnt_clo, (uint64_t)counters.clo);
+    StatsAddUI64(tv, fw->flow_mgr_cnt_new, (uint64_t)counters.new);
+    StatsAddUI64(tv, fw->flow_mgr_cnt_est, (uint64_t)counters.est);
+    StatsAddUI64(tv, fw->flow_tcp_reuse, (uint64_t)counters.tcp_reuse);
+    StatsAddUI64(tv, fw->flow_mgr_hibernated, (uint64_t)counters.hibernated);
+}
+
 TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, PacketQueue *unused)
 {
     FlowWorkerThreadData *fw = data;
     void *detect_thread = SC_ATOMIC_GET(fw->detect_thread);
+    LatencyPacketTimer lt = { .ctx = NULL };
+    PerfEventSample ps;
+    const int perf = PerfEventSampleStart(tv, &ps);
 
     SCLogDebug("packet %"PRIu64, p->pcap_cnt);
 
     /* update time */
     if (!(PKT_IS_PSEUDOPKT(p))) {
         TimeSetByThread(tv->id, &p->ts);
+        if (unlikely(latency_enabled))
+            LatencyPacketTimerStart(&lt, tv);
+    }
+
+    /* handle pending timeout request for our part of the flow hash. We
+     * hold no flow lock at this point. */
+    if (fw->dtv->flow_part != NULL &&
+            unlikely(FlowHashPartitionTimeoutPending(fw->dtv->flow_part))) {
+        FlowWorkerPartitionTimeout(tv, fw);
+        LATENCY_TIMER_SKIP(&lt);
+        if (unlikely(perf))
+            (void)PerfEventRead(tv->perf_event_ctx, &ps);
+    }
+
+    /* second copy of a packet from a broker or SPAN: not timed either */
+    if (fw->dedup != NULL && (p->flags & PKT_WANTS_FLOW) &&
+            DedupPacketIsDuplicate(fw->dedup, p)) {
+        StatsIncr(tv, fw->cnt_dedup_pkts);
+        return TM_ECODE_OK;
     }
 
     /* handle Flow */
@@ -164,6 +268,9 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
         /* Flow is now LOCKED */
 
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_FLOW);
+        LATENCY_TIMER_MARK(&lt, LATENCY_FLOW);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_FW(PROFILE_FLOWWORKER_FLOW));
 
     /* if PKT_WANTS_FLOW is not set, but PKT_HAS_FLOW is, then this is a
      * pseudo packet created by the flow manager. */
@@ -173,6 +280,17 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
 
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
 
+    /* bypassed flow: the flow counters are updated, skip the rest */
+    if (p->flow != NULL && FLOW_IS_BYPASSED(SC_ATOMIC_GET(p->flow->flow_state))) {
+        StatsIncr(tv, fw->cnt_bypassed_pkts);
+        StatsAddUI64(tv, fw->cnt_bypassed_bytes, GET_PKT_LEN(p));
+        goto unlock;
+    }
+
+    /* direction is known now, start on the payload mpm while the stream
+     * and app layer work on the packet */
+    MpmOffloadPacketSubmit(p);
+
     /* handle TCP and app layer */
     if (PKT_IS_TCP(p)) {
         SCLogDebug("packet %"PRIu64" is TCP", p->pcap_cnt);
@@ -181,6 +299,14 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_STREAM);
         StreamTcp(tv, p, fw->stream_thread, &fw->pq, NULL);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_STREAM);
+        LATENCY_TIMER_MARK(&lt, LATENCY_STREAM);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_FW(PROFILE_FLOWWORKER_STREAM));
+
+        /* the flow is ending: parse what the app-layer offload helpers
+         * didn't get to before inspecting its last packets */
+        if (PKT_IS_PSEUDOPKT(p) || fw->pq.len > 0)
+            AppLayerHandleOffloaded(fw->stream_thread->ra_ctx->app_tctx, p->flow);
 
         /* Packets here can safely access p->flow as it's locked */
         SCLogDebug("packet %"PRIu64": extra packets %u", p->pcap_cnt, fw->pq.len);
@@ -202,12 +328,19 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
              * by the other thread modules before packet 'p'. */
             PacketEnqueue(preq, x);
         }
+        /* detection of the stream end pseudo packets counts as detect */
+        LATENCY_TIMER_MARK(&lt, LATENCY_DETECT);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_FW(PROFILE_FLOWWORKER_DETECT));
 
     /* handle the app layer part of the UDP packet payload */
     } else if (p->flow && p->proto == IPPROTO_UDP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_APPLAYERUDP);
         AppLayerHandleUdp(tv, fw->stream_thread->ra_ctx->app_tctx, p, p->flow);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_APPLAYERUDP);
+        LATENCY_TIMER_MARK(&lt, LATENCY_APPLAYERUDP);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_FW(PROFILE_FLOWWORKER_APPLAYERUDP));
     }
 
     /* handle Detect */
@@ -218,6 +351,9 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
         Detect(tv, p, detect_thread, NULL, NULL);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
+        LATENCY_TIMER_MARK(&lt, LATENCY_DETECT);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_FW(PROFILE_FLOWWORKER_DETECT));
     }
 #if 0
     // Outputs
@@ -225,6 +361,11 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
     // StreamTcpPruneSession (from TmqhOutputPacketpool)
 #endif
 
+    /* bypassed packets are not timed, they'd only skew the histograms */
+    if (unlikely(lt.ctx != NULL))
+        LatencyPacketTimerEnd(&lt, tv, p, detect_thread);
+
+unlock:
     if (p->flow) {
         DEBUG_ASSERT_FLOW_LOCKED(p->flow);
         FLOWLOCK_UNLOCK(p->flow);
@@ -233,6 +374,40 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
     return TM_ECODE_OK;
 }
 
+/** distance in packets between the bucket and the flow prefetch */
+#define FLOW_WORKER_PREFETCH_AHEAD 4
+
+/** \brief prepare a vector of packets for FlowWorker
+ *
+ *  Called by TmThreadsSlotProcessPktBatch after all packets in the
+ *  vector have been decoded. Prefetches the flow hash buckets and then,
+ *  FLOW_WORKER_PREFETCH_AHEAD packets behind, the first flow of each
+ *  bucket, so that the lookups in FlowWorker don't each stall on a
+ *  cache miss. The flow lookups themselves are still done per packet,
+ *  as the flow lock is held from lookup until after detection and
+ *  packets in the same vector may belong to the same flow.
+ */
+static void FlowWorkerBatch(ThreadVars *tv, Packet **pkts, uint32_t cnt, void *data)
+{
+    FlowWorkerThreadData *fw = data;
+    uint32_t i;
+
+    for (i = 0; i < cnt + FLOW_WORKER_PREFETCH_AHEAD; i++) {
+        if (i < cnt && (pkts[i]->flags & PKT_WANTS_FLOW)) {
+            FlowHashPrefetchBucket(fw->dtv, pkts[i]);
+        }
+        if (i >= FLOW_WORKER_PREFETCH_AHEAD) {
+            const Packet *p = pkts[i - FLOW_WORKER_PREFETCH_AHEAD];
+            if (p->flags & PKT_WANTS_FLOW) {
+                FlowHashPrefetchFlow(fw->dtv, p);
+            }
+        }
+    }
+
+    StatsIncr(tv, fw->cnt_batches);
+    StatsAddUI64(tv, fw->cnt_batch_pkts, (uint64_t)cnt);
+}
+
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx)
 {
     FlowWorkerThreadData *fw = flow_worker;
@@ -247,6 +422,14 @@ void *FlowWorkerGetDetectCtxPtr(void *flow_worker)
     return SC_ATOMIC_GET(fw->detect_thread);
 }
 
+/** \brief NUMA node the worker's memory is local to, -1 outside of NUMA mode */
+int FlowWorkerGetNumaNode(void *flow_worker)
+{
+    FlowWorkerThreadData *fw = flow_worker;
+
+    return fw->dtv != NULL ? fw->dtv->numa_node : -1;
+}
+
 const char *ProfileFlowWorkerIdToString(enum ProfileFlowWorkerId fwi)
 {
     switch (fwi) {
@@ -270,6 +453,7 @@ void TmModuleFlowWorkerRegister (void)
     tmm_modules[TMM_FLOWWORKER].name = "FlowWorker";
     tmm_modules[TMM_FLOWWORKER].ThreadInit = FlowWorkerThreadInit;
     tmm_modules[TMM_FLOWWORKER].Func = FlowWorker;
+    tmm_modules[TMM_FLOWWORKER].FuncBatch = FlowWorkerBatch;
     tmm_modules[TMM_FLOWWORKER].ThreadDeinit = FlowWorkerThreadDeinit;
     tmm_modules[TMM_FLOWWORKER].cap_flags = 0;
     tmm_modules[TMM_FLOWWORKER].flags = TM_FLAG_STREAM_TM|TM_FLAG_DETECT_TM;
@@ -29,6 +29,7 @@ const char *ProfileFlowWorkerIdToString(enum ProfileFlowWorkerId fwi);
 
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx);
 void *FlowWorkerGetDetectCtxPtr(void *flow_worker);
+int FlowWorkerGetNumaNode(void *flow_worker);
 
 void TmModuleFlowWorkerRegister (void);
 
@@ -33,6 +33,7 @@
 
 #include "util-random.h"
 #include "util-time.h"
+#include "util-affinity.h"
 
 #include "flow.h"
 #include "flow-queue.h"
@@ -52,6 +53,7 @@
 #include "util-unittest-helper.h"
 #include "util-byte.h"
 #include "util-misc.h"
+#include "util-memcap.h"
 
 #include "util-debug.h"
 #include "util-privs.h"
@@ -61,6 +63,8 @@
 #include "stream.h"
 
 #include "app-layer-parser.h"
+#include "util-hugepages.h"
+#include "util-hash-fast.h"
 
 #define FLOW_DEFAULT_EMERGENCY_RECOVERY 30
 
@@ -110,11 +114,95 @@ void FlowCleanupAppLayer(Flow *f)
  *  \retval 1 if the queue was properly updated (or if it already was in good shape)
  *  \retval 0 otherwise.
  */
+/** \internal
+ *  \brief free flows from a spare queue until it's at most 'max' long */
+static void FlowSpareQueueTrim(FlowQueue *q, uint32_t max)
+{
+    uint32_t len;
+
+    FQLOCK_LOCK(q);
+    len = q->len;
+    FQLOCK_UNLOCK(q);
+
+    while (len-- > max) {
+        /* FlowDequeue locks the queue */
+        Flow *f = FlowDequeue(q);
+        if (f == NULL)
+            return;
+
+        FlowFree(f);
+    }
+}
+
+/** \brief get the number of spare flows in all spare queues */
+uint32_t FlowSpareGetLen(void)
+{
+    uint32_t len, u;
+
+    FQLOCK_LOCK(&flow_spare_q);
+    len = flow_spare_q.len;
+    FQLOCK_UNLOCK(&flow_spare_q);
+
+    for (u = 0; u < flow_config.numa_nodes; u++) {
+        FQLOCK_LOCK(&flow_spare_q_numa[u]);
+        len += flow_spare_q_numa[u].len;
+        FQLOCK_UNLOCK(&flow_spare_q_numa[u]);
+    }
+    return len;
+}
+
+/** \brief prealloc the spare flows of a NUMA node
+ *
+ *  Called by the flow worker threads after their cpu affinity is set,
+ *  so that the flows are first touched by a thread on the node that
+ *  will use them. Each node gets an equal share of flow.prealloc. The
+ *  first thread on a node does the work.
+ *
+ *  \param node NUMA node of the calling thread
+ */
+void FlowSparePreallocNuma(int node)
+{
+    if (node < 0 || (uint32_t)node >= flow_config.numa_nodes)
+        return;
+
+    FlowQueue *q = &flow_spare_q_numa[node];
+    const uint32_t share = flow_config.prealloc / flow_config.numa_nodes;
+
+    FQLOCK_LOCK(q);
+    uint32_t len = q->len;
+    FQLOCK_UNLOCK(q);
+
+    uint32_t i;
+    for (i = len; i < share; i++) {
+        Flow *f = FlowAlloc();
+        if (f == NULL) {
+            SCLogWarning(SC_ERR_FLOW_INIT, "preallocating flows for NUMA "
+                    "node %d failed after %u flows: memcap?", node, i);
+            break;
+        }
+        f->numa_node = (uint8_t)node;
+        FlowEnqueue(q, f);
+    }
+    SCLogDebug("NUMA node %d: %u spare flows", node, q->len);
+}
+
 int FlowUpdateSpareFlows(void)
 {
     SCEnter();
     uint32_t toalloc = 0, tofree = 0, len;
 
+    /* in NUMA mode flows are allocated by the workers, so that they are
+     * local to the worker's node. Here we only free the excess. */
+    if (flow_config.numa_nodes > 0) {
+        uint32_t u;
+        FlowSpareQueueTrim(&flow_spare_q, 0);
+        for (u = 0; u < flow_config.numa_nodes; u++) {
+            FlowSpareQueueTrim(&flow_spare_q_numa[u],
+                    flow_config.prealloc / flow_config.numa_nodes);
+        }
+        return 1;
+    }
+
     FQLOCK_LOCK(&flow_spare_q);
     len = flow_spare_q.len;
     FQLOCK_UNLOCK(&flow_spare_q);
@@ -252,7 +340,9 @@ void FlowHandlePacketUpdate(Flow *f, Packet *p)
         SCLogDebug("pkt %p FLOW_PKT_ESTABLISHED", p);
         p->flowflags |= FLOW_PKT_ESTABLISHED;
 
-        if (f->proto != IPPROTO_TCP) {
+        /* don't undo a bypass */
+        if (f->proto != IPPROTO_TCP &&
+                SC_ATOMIC_GET(f->flow_state) == FLOW_STATE_NEW) {
             SC_ATOMIC_SET(f->flow_state, FLOW_STATE_ESTABLISHED);
         }
     }
@@ -290,6 +380,27 @@ void FlowHandlePacket(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     return;
 }
 
+static uint64_t FlowMemuse(void)
+{
+    return (uint64_t)SC_ATOMIC_GET(flow_memuse);
+}
+
+static uint64_t FlowMemcap(void)
+{
+    return flow_config.memcap;
+}
+
+/** \internal
+ *  \brief memcap policy: from degrade on time out flows with the
+ *         emergency timeouts */
+static void FlowMemcapShed(int level, int prev)
+{
+    if (level >= MEMCAP_LEVEL_DEGRADE)
+        SC_ATOMIC_OR(flow_flags, FLOW_PRUNE_EARLY);
+    else
+        SC_ATOMIC_AND(flow_flags, ~FLOW_PRUNE_EARLY);
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void FlowInitConfig(char quiet)
@@ -304,10 +415,10 @@ void FlowInitConfig(char quiet)
     FlowQueueInit(&flow_recycle_q);
 
 #ifndef AFLFUZZ_NO_RANDOM
-    unsigned int seed = RandomTimePreseed();
     /* set defaults */
-    flow_config.hash_rand   = (int)( FLOW_DEFAULT_HASHSIZE * (rand_r(&seed) / RAND_MAX + 1.0));
+    flow_config.hash_rand   = HashFastRandomSeed();
 #endif
+    flow_config.hash_algo   = HashFastGetAlgo();
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.memcap      = FLOW_DEFAULT_MEMCAP;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
@@ -327,6 +438,39 @@ void FlowInitConfig(char quiet)
         flow_config.emergency_recovery = FLOW_DEFAULT_EMERGENCY_RECOVERY;
     }
 
+    int thread_local = 0;
+    if (ConfGetBool("flow.thread-local", &thread_local) == 1 && thread_local) {
+        flow_config.thread_local = 1;
+    }
+
+    if (ConfGetInt("flow.hibernate-timeout", &val) == 1) {
+        if (val >= 0 && val <= UINT32_MAX) {
+            flow_config.hibernate_timeout = (uint32_t)val;
+        } else {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.hibernate-timeout must be "
+                    "a number of seconds, hibernation disabled");
+        }
+    }
+
+    /* NUMA mode: keep spare flows per node */
+    if (AffinityNumaModeEnabled()) {
+        int nodes = AffinityGetNumaNodeCount();
+        if (nodes <= 1) {
+            SCLogConfig("threading.numa: system has a single NUMA node");
+        } else {
+            if (nodes > FLOW_NUMA_MAX_NODES) {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "%d NUMA nodes, only the "
+                        "first %d get local flows", nodes, FLOW_NUMA_MAX_NODES);
+                nodes = FLOW_NUMA_MAX_NODES;
+            }
+            flow_config.numa_nodes = (uint32_t)nodes;
+        }
+    }
+    uint32_t n;
+    for (n = 0; n < flow_config.numa_nodes; n++) {
+        FlowQueueInit(&flow_spare_q_numa[n]);
+    }
+
     /* Check if we have memcap and hash_size defined at config */
     char *conf_val;
     uint32_t configval = 0;
@@ -348,6 +492,9 @@ void FlowInitConfig(char quiet)
             flow_config.hash_size = configval;
         }
     }
+    int fingerprints = 0;
+    if (ConfGetBool("flow.hash-fingerprints", &fingerprints) == 1)
+        flow_config.hash_fingerprints = fingerprints ? 1 : 0;
     if ((ConfGet("flow.prealloc", &conf_val)) == 1)
     {
         if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
@@ -370,7 +517,7 @@ void FlowInitConfig(char quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCMallocAligned(flow_config.hash_size * sizeof(FlowBucket), CLS);
+    flow_hash = HugePagesAlloc(flow_config.hash_size * sizeof(FlowBucket));
     if (unlikely(flow_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -390,8 +537,9 @@ void FlowInitConfig(char quiet)
                   (uintmax_t)sizeof(FlowBucket));
     }
 
-    /* pre allocate flows */
-    for (i = 0; i < flow_config.prealloc; i++) {
+    /* pre allocate flows. In NUMA mode this is done by the workers,
+     * see FlowSparePreallocNuma */
+    for (i = 0; flow_config.numa_nodes == 0 && i < flow_config.prealloc; i++) {
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
                     "max flow memcap reached. Memcap %"PRIu64", "
@@ -418,6 +566,7 @@ void FlowInitConfig(char quiet)
 
     FlowInitFlowProto();
 
+    MemcapPolicyRegister("flow", FlowMemuse, FlowMemcap, FlowMemcapShed);
     return;
 }
 
@@ -444,6 +593,13 @@ void FlowShutdown(void)
     while((f = FlowDequeue(&flow_recycle_q))) {
         FlowFree(f);
     }
+    for (u = 0; u < flow_config.numa_nodes; u++) {
+        while((f = FlowDequeue(&flow_spare_q_numa[u]))) {
+            FlowFree(f);
+        }
+        FlowQueueDestroy(&flow_spare_q_numa[u]);
+    }
+    flow_config.numa_nodes = 0;
 
     /* clear and free the hash */
     if (flow_hash != NULL) {
@@ -463,7 +619,7 @@ void FlowShutdown(void)
 
             FBLOCK_DESTROY(&flow_hash[u]);
         }
-        SCFreeAligned(flow_hash);
+        HugePagesFree(flow_hash);
         flow_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
@@ -1071,6 +1227,104 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test the per NUMA node spare queues: node local prealloc,
+ *          flows returning to their own node's queue and trimming.
+ */
+static int FlowTest10 (void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FlowConfig backup;
+    memcpy(&backup, &flow_config, sizeof(FlowConfig));
+
+    /* fake a 2 node system */
+    FlowSpareQueueTrim(&flow_spare_q, 0);
+    flow_config.prealloc = 10;
+    flow_config.numa_nodes = 2;
+    FlowQueueInit(&flow_spare_q_numa[0]);
+    FlowQueueInit(&flow_spare_q_numa[1]);
+
+    FlowSparePreallocNuma(1);
+    FAIL_IF(flow_spare_q_numa[0].len != 0);
+    FAIL_IF(flow_spare_q_numa[1].len != 5);
+    FAIL_IF(FlowSpareGetLen() != 5);
+
+    /* not a valid node */
+    FlowSparePreallocNuma(2);
+    FAIL_IF(FlowSpareGetLen() != 5);
+
+    Flow *f = FlowDequeue(&flow_spare_q_numa[1]);
+    FAIL_IF_NULL(f);
+    FAIL_IF(f->numa_node != 1);
+    FlowMoveToSpare(f);
+    FAIL_IF(flow_spare_q_numa[1].len != 5);
+
+    /* flow w/o node goes into the global queue, which is then trimmed */
+    f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    FlowMoveToSpare(f);
+    FAIL_IF(flow_spare_q.len != 1);
+    FlowUpdateSpareFlows();
+    FAIL_IF(flow_spare_q.len != 0);
+    FAIL_IF(flow_spare_q_numa[1].len != 5);
+
+    FlowShutdown();
+    memcpy(&flow_config, &backup, sizeof(FlowConfig));
+    PASS;
+}
+
+/**
+ *  \test flows are found again and counted in the bucket fingerprints
+ *         when buckets hold more flows than there are fingerprint slots
+ */
+static int FlowTest11 (void)
+{
+    Flow *flows[32];
+    uint16_t i;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("flow.hash-size", "4");
+    ConfSet("flow.hash-fingerprints", "yes");
+    FlowInitConfig(FLOW_QUIET);
+    FAIL_IF(flow_config.hash_fingerprints != 1);
+
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < 32; i++) {
+            Packet *p = UTHBuildPacketSrcDstPorts(NULL, 0, IPPROTO_UDP,
+                    1024 + i, 53);
+            FAIL_IF_NULL(p);
+            FlowSetupPacket(p);
+            FlowHandlePacket(NULL, NULL, p);
+            FAIL_IF_NULL(p->flow);
+            if (pass == 0)
+                flows[i] = p->flow;
+            else
+                FAIL_IF(p->flow != flows[i]);
+            FLOWLOCK_UNLOCK(p->flow);
+            FlowDeReference(&p->flow);
+            UTHFreePacket(p);
+        }
+    }
+
+    uint32_t cnt = 0;
+    uint32_t u;
+    for (u = 0; u < flow_config.hash_size; u++) {
+        FlowBucket *fb = &flow_hash[u];
+        for (i = 0; i < FLOW_BUCKET_TAGS; i++) {
+            if (fb->tag[i] != 0)
+                cnt++;
+        }
+        cnt += fb->untagged;
+    }
+    FAIL_IF(cnt != 32);
+
+    FlowShutdown();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1088,6 +1342,8 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test NUMA node spare queues", FlowTest10);
+    UtRegisterTest("FlowTest11 -- Test hash bucket fingerprints", FlowTest11);
 
     FlowMgrRegisterTests();
     RegisterFlowStorageTests();
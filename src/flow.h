@@ -29,6 +29,7 @@
 #include "util-atomic.h"
 #include "detect-tag.h"
 #include "util-optimize.h"
+#include "util-lock-stats.h"
 
 /* Part of the flow structure, so we declare it here.
  * The actual declaration is in app-layer-parser.c */
@@ -65,6 +66,9 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** All packets in this flow should be dropped */
 #define FLOW_ACTION_DROP                  0x00000200
 
+/** no file_data inspection of files in this flow */
+#define FLOW_FILE_NO_DATA_TS              0x00000400
+
 /** Sgh for toserver direction set (even if it's NULL) */
 #define FLOW_SGH_TOSERVER                 0x00000800
 /** Sgh for toclient direction set (even if it's NULL) */
@@ -77,16 +81,20 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** alproto detect done.  Right now we need it only for udp */
 #define FLOW_ALPROTO_DETECT_DONE          0x00008000
 
-// vacany 1x
+#define FLOW_FILE_NO_DATA_TC              0x00010000
 
 /** Pattern matcher alproto detection done */
 #define FLOW_TS_PM_ALPROTO_DETECT_DONE    0x00020000
 /** Probing parser alproto detection done */
 #define FLOW_TS_PP_ALPROTO_DETECT_DONE    0x00040000
+/** a packet of this flow alerted */
+#define FLOW_HAS_ALERTS                   0x00080000
 /** Pattern matcher alproto detection done */
 #define FLOW_TC_PM_ALPROTO_DETECT_DONE    0x00100000
 /** Probing parser alproto detection done */
 #define FLOW_TC_PP_ALPROTO_DETECT_DONE    0x00200000
+/** flow has a fingerprint slot in its hash bucket */
+#define FLOW_BUCKET_TAGGED                0x00400000
 #define FLOW_TIMEOUT_REASSEMBLY_DONE      0x00800000
 /** even if the flow has files, don't store 'm */
 #define FLOW_FILE_NO_STORE_TS             0x01000000
@@ -97,7 +105,7 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 /** flow is ipv6 */
 #define FLOW_IPV6                         0x08000000
 
-/** no md5 on files in this flow */
+/** no md5, sha1 or sha256 on files in this flow */
 #define FLOW_FILE_NO_MD5_TS               0x10000000
 #define FLOW_FILE_NO_MD5_TC               0x20000000
 
@@ -182,6 +190,7 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #define FLOW_END_FLAG_TIMEOUT           0x10
 #define FLOW_END_FLAG_FORCED            0x20
 #define FLOW_END_FLAG_SHUTDOWN          0x40
+#define FLOW_END_FLAG_STATE_BYPASSED    0x80
 
 /** Mutex or RWLocks for the flow. */
 //#define FLOWLOCK_RWLOCK
@@ -204,8 +213,8 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 #elif defined FLOWLOCK_MUTEX
     #define FLOWLOCK_INIT(fb) SCMutexInit(&(fb)->m, NULL)
     #define FLOWLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->m)
-    #define FLOWLOCK_RDLOCK(fb) SCMutexLock(&(fb)->m)
-    #define FLOWLOCK_WRLOCK(fb) SCMutexLock(&(fb)->m)
+    #define FLOWLOCK_RDLOCK(fb) SCMutexLockSite(&(fb)->m, LOCK_SITE_FLOW)
+    #define FLOWLOCK_WRLOCK(fb) SCMutexLockSite(&(fb)->m, LOCK_SITE_FLOW)
     #define FLOWLOCK_TRYRDLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FLOWLOCK_TRYWRLOCK(fb) SCMutexTrylock(&(fb)->m)
     #define FLOWLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->m)
@@ -226,7 +235,9 @@ typedef struct AppLayerParserState_ AppLayerParserState;
 typedef struct FlowCnf_
 {
     uint32_t hash_rand;
+    int hash_algo;          /**< HashFastAlgo */
     uint32_t hash_size;
+    int hash_fingerprints;  /**< flow.hash-fingerprints, see FlowBucket */
     uint64_t memcap;
     uint32_t max_flows;
     uint32_t prealloc;
@@ -238,6 +249,16 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** partition the hash per flow worker thread (workers runmode) */
+    int thread_local;
+
+    /** number of NUMA nodes flows are kept per node for, 0 if disabled */
+    uint32_t numa_nodes;
+
+    /** seconds of idleness after which the flow manager releases an
+     *  established flow's segments and app layer state, 0 if disabled */
+    uint32_t hibernate_timeout;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -279,6 +300,11 @@ typedef unsigned short FlowStateType;
 /** Local Thread ID */
 typedef uint16_t FlowThreadId;
 
+/** max NUMA nodes with their own spare queue */
+#define FLOW_NUMA_MAX_NODES 8
+/** Flow::numa_node value for flows not owned by a node */
+#define FLOW_NUMA_NODE_NONE 0xff
+
 /**
  *  \brief Flow data structure.
  *
@@ -300,7 +326,9 @@ typedef uint16_t FlowThreadId;
 typedef struct Flow_
 {
     /* flow "header", used for hashing and flow lookup. Static after init,
-     * so safe to look at without lock */
+     * so safe to look at without lock. Together with hnext it fills the
+     * first cache line, so walking a hash chain touches one line per
+     * flow. Don't put anything here that is written per packet. */
     FlowAddress src, dst;
     union {
         Port sp;        /**< tcp/udp source port */
@@ -313,17 +341,33 @@ typedef struct Flow_
     uint8_t proto;
     uint8_t recursion_level;
     uint16_t vlan_id[2];
+    uint32_t vni;   /**< VXLAN/Geneve network id, 0 if none */
+    uint32_t job_id;    /**< unix socket pcap job, 0 if none */
+
+    /** hash list pointers, protected by fb->s */
+    struct Flow_ *hnext; /* hash list */
 
     /** flow hash - the flow hash before hash table size mod. */
     uint32_t flow_hash;
 
+    /** mapping to Flow's protocol specific protocols for timeouts
+        and state and free functions. */
+    uint8_t protomap;
+
+    /** NUMA node of the thread that allocated the flow, used to return
+     *  it to the right spare queue. FLOW_NUMA_NODE_NONE if unknown. */
+    uint8_t numa_node;
+
+    /** Thread ID for the stream/detect portion of this flow */
+    FlowThreadId thread_id;
+
+    /* end of flow "header" */
+
     /* time stamp of last update (last packet). Set/updated under the
      * flow and flow hash row locks, safe to read under either the
      * flow lock or flow hash row lock. */
     struct timeval lastts;
 
-    /* end of flow "header" */
-
     SC_ATOMIC_DECLARE(FlowStateType, flow_state);
 
     /** how many pkts and stream msgs are using the flow *right now*. This
@@ -334,49 +378,39 @@ typedef struct Flow_
      */
     SC_ATOMIC_DECLARE(FlowRefCount, use_cnt);
 
-    /** flow tenant id, used to setup flow timeout and stream pseudo
-     *  packets with the correct tenant id set */
-    uint32_t tenant_id;
-
-    uint32_t probing_parser_toserver_alproto_masks;
-    uint32_t probing_parser_toclient_alproto_masks;
-
     uint32_t flags;
 
-#ifdef FLOWLOCK_RWLOCK
-    SCRWLock r;
-#elif defined FLOWLOCK_MUTEX
-    SCMutex m;
-#else
-    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
-#endif
-
-    /** protocol specific data pointer, e.g. for TcpSession */
-    void *protoctx;
-
-    /** mapping to Flow's protocol specific protocols for timeouts
-        and state and free functions. */
-    uint8_t protomap;
+    AppProto alproto; /**< \brief application level protocol */
+    AppProto alproto_ts;
+    AppProto alproto_tc;
 
     uint8_t flow_end_flags;
     /* coccinelle: Flow:flow_end_flags:FLOW_END_FLAG_ */
 
-    AppProto alproto; /**< \brief application level protocol */
-    AppProto alproto_ts;
-    AppProto alproto_tc;
+    /** detect state 'alversion' inspected for both directions */
+    uint8_t detect_alversion[2];
 
-    uint32_t data_al_so_far[2];
+    /** set by the flow manager once the idle flow's memory was released,
+     *  cleared by the next packet. Written under both the flow and hash
+     *  row locks, like lastts. */
+    uint8_t hibernated;
 
-    /** detection engine ctx id used to inspect this flow. Set at initial
-     *  inspection. If it doesn't match the currently in use de_ctx, the
-     *  de_state and stored sgh ptrs are reset. */
-    uint32_t de_ctx_id;
+    /** low priority class of the load shedding, see util-load-shed.h */
+    uint8_t load_shed;
 
-    /** Thread ID for the stream/detect portion of this flow */
-    FlowThreadId thread_id;
+    /** protocol specific data pointer, e.g. for TcpSession */
+    void *protoctx;
 
-    /** detect state 'alversion' inspected for both directions */
-    uint8_t detect_alversion[2];
+    struct Flow_ *hprev;
+    struct FlowBucket_ *fb;
+
+#ifdef FLOWLOCK_RWLOCK
+    SCRWLock r;
+#elif defined FLOWLOCK_MUTEX
+    SCMutex m;
+#else
+    #error Enable FLOWLOCK_RWLOCK or FLOWLOCK_MUTEX
+#endif
 
     /** application level storage ptrs.
      *
@@ -394,13 +428,27 @@ typedef struct Flow_
      *  has been set. */
     struct SigGroupHead_ *sgh_toserver;
 
+    /** detection engine ctx id used to inspect this flow. Set at initial
+     *  inspection. If it doesn't match the currently in use de_ctx, the
+     *  de_state and stored sgh ptrs are reset. */
+    uint32_t de_ctx_id;
+
+    uint32_t data_al_so_far[2];
+
+    /* cold part: only used at flow setup, protocol detection, queueing
+     * and logging */
+
+    /** flow tenant id, used to setup flow timeout and stream pseudo
+     *  packets with the correct tenant id set */
+    uint32_t tenant_id;
+
+    uint32_t probing_parser_toserver_alproto_masks;
+    uint32_t probing_parser_toclient_alproto_masks;
+
     /* pointer to the var list */
     GenericVar *flowvar;
-
-    /** hash list pointers, protected by fb->s */
-    struct Flow_ *hnext; /* hash list */
-    struct Flow_ *hprev;
-    struct FlowBucket_ *fb;
+    /** set flowbits, see flow-bit.c */
+    struct FlowBits_ *flowbits;
 
     /** queue list pointers, protected by queue mutex */
     struct Flow_ *lnext; /* list */
@@ -417,8 +465,15 @@ enum {
     FLOW_STATE_NEW = 0,
     FLOW_STATE_ESTABLISHED,
     FLOW_STATE_CLOSED,
+    /** flow is bypassed by us: packets only update the flow counters */
+    FLOW_STATE_LOCAL_BYPASSED,
+    /** flow is bypassed by the capture method: we don't see its packets */
+    FLOW_STATE_CAPTURE_BYPASSED,
 };
 
+#define FLOW_IS_BYPASSED(state) \
+    ((state) == FLOW_STATE_LOCAL_BYPASSED || (state) == FLOW_STATE_CAPTURE_BYPASSED)
+
 typedef struct FlowProto_ {
     uint32_t new_timeout;
     uint32_t est_timeout;
@@ -449,6 +504,8 @@ void FlowUpdateQueue(Flow *);
 struct FlowQueue_;
 
 int FlowUpdateSpareFlows(void);
+uint32_t FlowSpareGetLen(void);
+void FlowSparePreallocNuma(int node);
 
 static inline void FlowSetNoPacketInspectionFlag(Flow *);
 static inline void FlowSetNoPayloadInspectionFlag(Flow *);
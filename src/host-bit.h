@@ -32,6 +32,7 @@ void HostBitRegisterTests(void);
 
 int HostHasHostBits(Host *host);
 int HostBitsTimedoutCheck(Host *h, struct timeval *ts);
+uint32_t HostBitsGetExpire(Host *h);
 
 void HostBitSet(Host *, uint16_t, uint32_t);
 void HostBitUnset(Host *, uint16_t);
@@ -39,7 +39,9 @@ unsigned int HostStorageSize(void)
  *
  * You have first to register the storage via HostStorageRegister() during
  * the init of your module. Then you can attach data via HostSetStorageById()
- * and access them via HostGetStorageById().
+ * and access them via HostGetStorageById(). Small fixed size data can be
+ * registered with HostStorageRegisterInline() instead, it then lives in the
+ * Host memory itself and is accessed with HostGetStorageByOffset().
  * @{
  */
 
@@ -61,29 +63,31 @@ int HostStorageRegister(const char *name, const unsigned int size, void *(*Alloc
 }
 
 /**
- * \brief Store a pointer in a given Host storage
+ * \brief Register a Host storage that is part of the Host memory
  *
- * \param h a pointer to the Host
- * \param id the id of the storage (return of HostStorageRegister() call)
- * \param ptr pointer to the data to store
+ * \param name the name of the storage
+ * \param size size of the data
+ * \param Free optional function to release what the data references
+ *
+ * \retval The ID of the newly register storage, pass it to
+ *         HostStorageGetOffset() after StorageFinalize()
  */
 
-int HostSetStorageById(Host *h, int id, void *ptr)
-{
-    return StorageSetById((Storage *)((void *)h + sizeof(Host)), STORAGE_HOST, id, ptr);
+int HostStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *)) {
+    return StorageRegisterInline(STORAGE_HOST, name, size, Free);
 }
 
 /**
- * \brief Get a value from a given Host storage
+ * \brief Get the offset of a Host storage for HostGetStorageByOffset()
  *
- * \param h a pointer to the Host
- * \param id the id of the storage (return of HostStorageRegister() call)
+ * \param id the id of the storage
  *
+ * \retval offset, constant once StorageFinalize() is done, or -1
  */
 
-void *HostGetStorageById(Host *h, int id)
+int HostStorageGetOffset(int id)
 {
-    return StorageGetById((Storage *)((void *)h + sizeof(Host)), STORAGE_HOST, id);
+    return StorageGetOffset(STORAGE_HOST, id);
 }
 
 /**
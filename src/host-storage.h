@@ -31,8 +31,29 @@
 
 unsigned int HostStorageSize(void);
 
-void *HostGetStorageById(Host *h, int id);
-int HostSetStorageById(Host *h, int id, void *ptr);
+/** \brief the storage of a Host, laid out right after it */
+#define HOST_STORAGE(h) ((Storage *)((uint8_t *)(h) + sizeof(Host)))
+
+/** \brief Get a value from a given Host storage
+ *  \param id the id of the storage (return of HostStorageRegister() call) */
+static inline void *HostGetStorageById(Host *h, int id)
+{
+    return HOST_STORAGE(h)[id];
+}
+
+/** \brief Store a pointer in a given Host storage */
+static inline int HostSetStorageById(Host *h, int id, void *ptr)
+{
+    HOST_STORAGE(h)[id] = ptr;
+    return 0;
+}
+
+/** \brief get inline storage by the offset from HostStorageGetOffset() */
+static inline void *HostGetStorageByOffset(Host *h, unsigned int offset)
+{
+    return StorageGetByOffset(HOST_STORAGE(h), offset);
+}
+
 void *HostAllocStorageById(Host *h, int id);
 
 void HostFreeStorageById(Host *h, int id);
@@ -41,5 +62,7 @@ void HostFreeStorage(Host *h);
 void RegisterHostStorageTests(void);
 
 int HostStorageRegister(const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *));
+int HostStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *));
+int HostStorageGetOffset(int id);
 
 #endif /* __HOST_STORAGE_H__ */
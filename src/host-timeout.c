@@ -29,7 +29,6 @@
 
 #include "host-bit.h"
 
-#include "reputation.h"
 
 uint32_t HostGetSpareCount(void)
 {
@@ -53,7 +52,6 @@ uint32_t HostGetActiveCount(void)
 static int HostHostTimedOut(Host *h, struct timeval *ts)
 {
     int tags = 0;
-    int thresholds = 0;
     int vars = 0;
 
     /** never prune a host that is used by a packet
@@ -62,47 +60,63 @@ static int HostHostTimedOut(Host *h, struct timeval *ts)
         return 0;
     }
 
-    if (h->iprep) {
-        if (SRepHostTimedOut(h) == 0)
-            return 0;
-
-        SCLogDebug("host %p reputation timed out", h);
-    }
-
     if (TagHostHasTag(h) && TagTimeoutCheck(h, ts) == 0) {
         tags = 1;
     }
-    if (ThresholdHostHasThreshold(h) && ThresholdTimeoutCheck(h, ts) == 0) {
-        thresholds = 1;
-    }
     if (HostHasHostBits(h) && HostBitsTimedoutCheck(h, ts) == 0) {
         vars = 1;
     }
 
-    if (tags || thresholds || vars)
+    if (tags || vars)
         return 0;
 
     SCLogDebug("host %p timed out", h);
     return 1;
 }
 
+/** \internal
+ *  \brief when a host that didn't time out needs to be checked again
+ *
+ *  \param h *LOCKED* host
+ */
+static uint32_t HostNextTimeout(Host *h, struct timeval *ts)
+{
+    uint32_t next = (uint32_t)ts->tv_sec + 1;
+
+    if (SC_ATOMIC_GET(h->use_cnt) > 0)
+        return next;
+
+    /* it lives until its last tag and hostbit are gone */
+    uint32_t expire = MAX(TagHostGetExpire(h), HostBitsGetExpire(h));
+    return MAX(next, expire);
+}
+
 /**
  *  \internal
  *
  *  \brief check all hosts in a hash row for timing out
  *
- *  \param hb host hash row *LOCKED*
- *  \param h last host in the hash row
+ *  \param row hash row to check
  *  \param ts timestamp
+ *  \param cnt[out] incremented for each timed out host
  *
- *  \retval cnt timed out hosts
+ *  \retval next time the row needs to be checked, EXPIRY_NEVER if empty
  */
-static uint32_t HostHashRowTimeout(HostHashRow *hb, Host *h, struct timeval *ts)
+static uint32_t HostHashRowTimeout(uint32_t row, struct timeval *ts, uint32_t *cnt)
 {
-    uint32_t cnt = 0;
+    HostHashRow *hb = &host_hash[row];
+    const uint32_t retry = (uint32_t)ts->tv_sec + 1;
+    uint32_t next = EXPIRY_NEVER;
+
+    if (HRLOCK_TRYLOCK(hb) != 0)
+        return retry;
+
+    /* host hash bucket is now locked */
 
-    do {
+    Host *h = hb->tail;
+    while (h != NULL) {
         if (SCMutexTrylock(&h->m) != 0) {
+            next = MIN(next, retry);
             h = h->hprev;
             continue;
         }
@@ -134,47 +148,29 @@ static uint32_t HostHashRowTimeout(HostHashRow *hb, Host *h, struct timeval *ts)
             /* move to spare list */
             HostMoveToSpare(h);
 
-            cnt++;
+            (*cnt)++;
         } else {
+            next = MIN(next, HostNextTimeout(h, ts));
             SCMutexUnlock(&h->m);
         }
 
         h = next_host;
-    } while (h != NULL);
+    }
 
-    return cnt;
+    HRLOCK_UNLOCK(hb);
+    return next;
 }
 
 /**
  *  \brief time out hosts from the hash
  *
+ *  Only the rows that host_expiry has due are checked.
+ *
  *  \param ts timestamp
  *
  *  \retval cnt number of timed out host
  */
 uint32_t HostTimeoutHash(struct timeval *ts)
 {
-    uint32_t idx = 0;
-    uint32_t cnt = 0;
-
-    for (idx = 0; idx < host_config.hash_size; idx++) {
-        HostHashRow *hb = &host_hash[idx];
-
-        if (HRLOCK_TRYLOCK(hb) != 0)
-            continue;
-
-        /* host hash bucket is now locked */
-
-        if (hb->tail == NULL) {
-            HRLOCK_UNLOCK(hb);
-            continue;
-        }
-
-        /* we have a host, or more than one */
-        cnt += HostHashRowTimeout(hb, hb->tail, ts);
-        HRLOCK_UNLOCK(hb);
-    }
-
-    return cnt;
+    return ExpiryTimeout(&host_expiry, ts, HostHashRowTimeout);
 }
-
@@ -33,6 +33,7 @@
 
 #include "util-random.h"
 #include "util-misc.h"
+#include "util-memcap.h"
 #include "util-byte.h"
 
 #include "host-queue.h"
@@ -41,7 +42,8 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-threshold.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-fast.h"
+#include "util-hugepages.h"
 
 static Host *HostGetUsedHost(void);
 
@@ -113,11 +115,6 @@ error:
 
 void HostClearMemory(Host *h)
 {
-    if (h->iprep != NULL) {
-        SCFree(h->iprep);
-        h->iprep = NULL;
-    }
-
     if (HostStorageSize() > 0)
         HostFreeStorage(h);
 }
@@ -126,6 +123,17 @@ void HostClearMemory(Host *h)
 #define HOST_DEFAULT_MEMCAP 16777216
 #define HOST_DEFAULT_PREALLOC 1000
 
+/** \brief memory used by the host table, for the stats */
+uint64_t HostGetMemuse(void)
+{
+    return (uint64_t)SC_ATOMIC_GET(host_memuse);
+}
+
+static uint64_t HostGetMemcap(void)
+{
+    return host_config.memcap;
+}
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void HostInitConfig(char quiet)
@@ -142,10 +150,10 @@ void HostInitConfig(char quiet)
     HostQueueInit(&host_spare_q);
 
 #ifndef AFLFUZZ_NO_RANDOM
-    unsigned int seed = RandomTimePreseed();
     /* set defaults */
-    host_config.hash_rand   = (int)( HOST_DEFAULT_HASHSIZE * (rand_r(&seed) / RAND_MAX + 1.0));
+    host_config.hash_rand   = HashFastRandomSeed();
 #endif
+    host_config.hash_algo   = HashFastGetAlgo();
     host_config.hash_size   = HOST_DEFAULT_HASHSIZE;
     host_config.memcap      = HOST_DEFAULT_MEMCAP;
     host_config.prealloc    = HOST_DEFAULT_PREALLOC;
@@ -196,7 +204,7 @@ void HostInitConfig(char quiet)
                 (uintmax_t)sizeof(HostHashRow));
         exit(EXIT_FAILURE);
     }
-    host_hash = SCMallocAligned(host_config.hash_size * sizeof(HostHashRow), CLS);
+    host_hash = HugePagesAlloc(host_config.hash_size * sizeof(HostHashRow));
     if (unlikely(host_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -209,6 +217,12 @@ void HostInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(host_memuse, (host_config.hash_size * sizeof(HostHashRow)));
 
+    if (ExpiryTableInit(&host_expiry, host_config.hash_size) != 0) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    (void) SC_ATOMIC_ADD(host_memuse, ExpiryTableMemuse(&host_expiry));
+
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the host hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -241,6 +255,7 @@ void HostInitConfig(char quiet)
                 SC_ATOMIC_GET(host_memuse), host_config.memcap);
     }
 
+    MemcapPolicyRegister("host", HostGetMemuse, HostGetMemcap, NULL);
     return;
 }
 
@@ -272,6 +287,8 @@ void HostShutdown(void)
         HostFree(h);
     }
 
+    ThresholdsClear();
+
     /* clear and free the hash */
     if (host_hash != NULL) {
         for (u = 0; u < host_config.hash_size; u++) {
@@ -284,10 +301,12 @@ void HostShutdown(void)
 
             HRLOCK_DESTROY(&host_hash[u]);
         }
-        SCFreeAligned(host_hash);
+        HugePagesFree(host_hash);
         host_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(host_memuse, host_config.hash_size * sizeof(HostHashRow));
+    (void) SC_ATOMIC_SUB(host_memuse, ExpiryTableMemuse(&host_expiry));
+    ExpiryTableFree(&host_expiry);
     HostQueueDestroy(&host_spare_q);
 
     SC_ATOMIC_DESTROY(host_prune_idx);
@@ -313,8 +332,8 @@ void HostCleanup(void)
             HostHashRow *hb = &host_hash[u];
             HRLOCK_LOCK(hb);
             while (h) {
-                if ((SC_ATOMIC_GET(h->use_cnt) > 0) && (h->iprep != NULL)) {
-                    /* iprep is attached to host only clear local storage */
+                if (SC_ATOMIC_GET(h->use_cnt) > 0) {
+                    /* host is in use, only clear local storage */
                     HostFreeStorage(h);
                     h = h->hnext;
                 } else {
@@ -338,6 +357,7 @@ void HostCleanup(void)
             HRLOCK_UNLOCK(hb);
         }
     }
+    ThresholdsClear();
 
     return;
 }
@@ -353,10 +373,10 @@ uint32_t HostGetKey(Address *a)
     uint32_t key;
 
     if (a->family == AF_INET) {
-        uint32_t hash = hashword(&a->addr_data32[0], 1, host_config.hash_rand);
+        uint32_t hash = HashFastWords(host_config.hash_algo, &a->addr_data32[0], 1, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else if (a->family == AF_INET6) {
-        uint32_t hash = hashword(a->addr_data32, 4, host_config.hash_rand);
+        uint32_t hash = HashFastWords(host_config.hash_algo, a->addr_data32, 4, host_config.hash_rand);
         key = hash % host_config.hash_size;
     } else
         key = 0;
@@ -467,6 +487,8 @@ Host *HostGetHostFromHash (Address *a)
     /* get our hash bucket and lock it */
     HostHashRow *hb = &host_hash[key];
     HRLOCK_LOCK(hb);
+    /* the host is used, have its row checked at the next timeout pass */
+    ExpiryArm(&host_expiry, key, 0);
 
     /* see if the bucket already has a host */
     if (hb->head == NULL) {
@@ -572,6 +594,7 @@ Host *HostLookupHostFromHash (Address *a)
         HRLOCK_UNLOCK(hb);
         return h;
     }
+    ExpiryArm(&host_expiry, key, 0);
 
     /* ok, we have a host in the bucket. Let's find out if it is our host */
     h = hb->head;
@@ -26,6 +26,8 @@
 
 #include "decode.h"
 #include "util-storage.h"
+#include "util-lock-stats.h"
+#include "util-expiry.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define HRLOCK_SPIN
@@ -48,7 +50,7 @@
     #define HRLOCK_TYPE SCMutex
     #define HRLOCK_INIT(fb) SCMutexInit(&(fb)->lock, NULL)
     #define HRLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->lock)
-    #define HRLOCK_LOCK(fb) SCMutexLock(&(fb)->lock)
+    #define HRLOCK_LOCK(fb) SCMutexLockSite(&(fb)->lock, LOCK_SITE_HASH_ROW)
     #define HRLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->lock)
     #define HRLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->lock)
 #else
@@ -65,9 +67,6 @@ typedef struct Host_ {
     /** use cnt, reference counter */
     SC_ATOMIC_DECLARE(unsigned int, use_cnt);
 
-    /** pointers to iprep storage */
-    void *iprep;
-
     /** storage api handle */
     Storage *storage;
 
@@ -88,6 +87,8 @@ typedef struct HostHashRow_ {
 
 /** host hash table */
 HostHashRow *host_hash;
+/** when the rows of host_hash need a timeout check */
+ExpiryTable host_expiry;
 
 #define HOST_VERBOSE    0
 #define HOST_QUIET      1
@@ -95,6 +96,7 @@ HostHashRow *host_hash;
 typedef struct HostConfig_ {
     uint64_t memcap;
     uint32_t hash_rand;
+    int hash_algo;          /**< HashFastAlgo */
     uint32_t hash_size;
     uint32_t prealloc;
 } HostConfig;
@@ -135,6 +137,7 @@ SC_ATOMIC_DECLARE(unsigned int,host_prune_idx);
 
 void HostInitConfig(char quiet);
 void HostShutdown(void);
+uint64_t HostGetMemuse(void);
 void HostCleanup(void);
 
 Host *HostLookupHostFromHash (Address *);
@@ -77,6 +77,22 @@ int IPPairBitsTimedoutCheck(IPPair *h, struct timeval *ts)
     return 1;
 }
 
+/** \brief time at which all xbits of the ippair have expired
+ *  \retval expire, 0 if there are none */
+uint32_t IPPairBitsGetExpire(IPPair *h)
+{
+    uint32_t expire = 0;
+    GenericVar *gv = IPPairGetStorageById(h, ippair_bit_id);
+    for ( ; gv != NULL; gv = gv->next) {
+        if (gv->type == DETECT_XBITS) {
+            XBit *xb = (XBit *)gv;
+            if (xb->expire > expire)
+                expire = xb->expire;
+        }
+    }
+    return expire;
+}
+
 /* get the bit with idx from the ippair */
 static XBit *IPPairBitGet(IPPair *h, uint16_t idx)
 {
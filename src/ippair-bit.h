@@ -32,6 +32,7 @@ void IPPairBitRegisterTests(void);
 
 int IPPairHasBits(IPPair *host);
 int IPPairBitsTimedoutCheck(IPPair *h, struct timeval *ts);
+uint32_t IPPairBitsGetExpire(IPPair *h);
 
 void IPPairBitSet(IPPair *, uint16_t, uint32_t);
 void IPPairBitUnset(IPPair *, uint16_t);
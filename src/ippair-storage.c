@@ -32,16 +32,6 @@ unsigned int IPPairStorageSize(void)
     return StorageGetSize(STORAGE_IPPAIR);
 }
 
-void *IPPairGetStorageById(IPPair *h, int id)
-{
-    return StorageGetById((Storage *)((void *)h + sizeof(IPPair)), STORAGE_IPPAIR, id);
-}
-
-int IPPairSetStorageById(IPPair *h, int id, void *ptr)
-{
-    return StorageSetById((Storage *)((void *)h + sizeof(IPPair)), STORAGE_IPPAIR, id, ptr);
-}
-
 void *IPPairAllocStorageById(IPPair *h, int id)
 {
     return StorageAllocByIdPrealloc((Storage *)((void *)h + sizeof(IPPair)), STORAGE_IPPAIR, id);
@@ -62,6 +52,15 @@ int IPPairStorageRegister(const char *name, const unsigned int size, void *(*All
     return StorageRegister(STORAGE_IPPAIR, name, size, Alloc, Free);
 }
 
+int IPPairStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *)) {
+    return StorageRegisterInline(STORAGE_IPPAIR, name, size, Free);
+}
+
+int IPPairStorageGetOffset(int id)
+{
+    return StorageGetOffset(STORAGE_IPPAIR, id);
+}
+
 #ifdef UNITTESTS
 
 static void *StorageTestAlloc(unsigned int size)
@@ -31,8 +31,26 @@
 
 unsigned int IPPairStorageSize(void);
 
-void *IPPairGetStorageById(IPPair *h, int id);
-int IPPairSetStorageById(IPPair *h, int id, void *ptr);
+/** \brief the storage of a IPPair, laid out right after it */
+#define IPPAIR_STORAGE(h) ((Storage *)((uint8_t *)(h) + sizeof(IPPair)))
+
+static inline void *IPPairGetStorageById(IPPair *h, int id)
+{
+    return IPPAIR_STORAGE(h)[id];
+}
+
+static inline int IPPairSetStorageById(IPPair *h, int id, void *ptr)
+{
+    IPPAIR_STORAGE(h)[id] = ptr;
+    return 0;
+}
+
+/** \brief get inline storage by the offset from IPPairStorageGetOffset() */
+static inline void *IPPairGetStorageByOffset(IPPair *h, unsigned int offset)
+{
+    return StorageGetByOffset(IPPAIR_STORAGE(h), offset);
+}
+
 void *IPPairAllocStorageById(IPPair *h, int id);
 
 void IPPairFreeStorageById(IPPair *h, int id);
@@ -41,5 +59,7 @@ void IPPairFreeStorage(IPPair *h);
 void RegisterIPPairStorageTests(void);
 
 int IPPairStorageRegister(const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *));
+int IPPairStorageRegisterInline(const char *name, const unsigned int size, void (*Free)(void *));
+int IPPairStorageGetOffset(int id);
 
 #endif /* __IPPAIR_STORAGE_H__ */
@@ -66,23 +66,47 @@ static int IPPairTimedOut(IPPair *h, struct timeval *ts)
     return 1;
 }
 
+/** \internal
+ *  \brief when an ippair that didn't time out needs to be checked again
+ *
+ *  \param h *LOCKED* ippair
+ */
+static uint32_t IPPairNextTimeout(IPPair *h, struct timeval *ts)
+{
+    uint32_t next = (uint32_t)ts->tv_sec + 1;
+
+    if (SC_ATOMIC_GET(h->use_cnt) > 0)
+        return next;
+
+    return MAX(next, IPPairBitsGetExpire(h));
+}
+
 /**
  *  \internal
  *
  *  \brief check all ippairs in a hash row for timing out
  *
- *  \param hb ippair hash row *LOCKED*
- *  \param h last ippair in the hash row
+ *  \param row hash row to check
  *  \param ts timestamp
+ *  \param cnt[out] incremented for each timed out ippair
  *
- *  \retval cnt timed out ippairs
+ *  \retval next time the row needs to be checked, EXPIRY_NEVER if empty
  */
-static uint32_t IPPairHashRowTimeout(IPPairHashRow *hb, IPPair *h, struct timeval *ts)
+static uint32_t IPPairHashRowTimeout(uint32_t row, struct timeval *ts, uint32_t *cnt)
 {
-    uint32_t cnt = 0;
+    IPPairHashRow *hb = &ippair_hash[row];
+    const uint32_t retry = (uint32_t)ts->tv_sec + 1;
+    uint32_t next = EXPIRY_NEVER;
+
+    if (HRLOCK_TRYLOCK(hb) != 0)
+        return retry;
 
-    do {
+    /* ippair hash bucket is now locked */
+
+    IPPair *h = hb->tail;
+    while (h != NULL) {
         if (SCMutexTrylock(&h->m) != 0) {
+            next = MIN(next, retry);
             h = h->hprev;
             continue;
         }
@@ -114,46 +138,29 @@ static uint32_t IPPairHashRowTimeout(IPPairHashRow *hb, IPPair *h, struct timeva
             /* move to spare list */
             IPPairMoveToSpare(h);
 
-            cnt++;
+            (*cnt)++;
         } else {
+            next = MIN(next, IPPairNextTimeout(h, ts));
             SCMutexUnlock(&h->m);
         }
 
         h = next_ippair;
-    } while (h != NULL);
+    }
 
-    return cnt;
+    HRLOCK_UNLOCK(hb);
+    return next;
 }
 
 /**
  *  \brief time out ippairs from the hash
  *
+ *  Only the rows that ippair_expiry has due are checked.
+ *
  *  \param ts timestamp
  *
  *  \retval cnt number of timed out ippair
  */
 uint32_t IPPairTimeoutHash(struct timeval *ts)
 {
-    uint32_t idx = 0;
-    uint32_t cnt = 0;
-
-    for (idx = 0; idx < ippair_config.hash_size; idx++) {
-        IPPairHashRow *hb = &ippair_hash[idx];
-
-        if (HRLOCK_TRYLOCK(hb) != 0)
-            continue;
-
-        /* ippair hash bucket is now locked */
-
-        if (hb->tail == NULL) {
-            HRLOCK_UNLOCK(hb);
-            continue;
-        }
-
-        /* we have a ippair, or more than one */
-        cnt += IPPairHashRowTimeout(hb, hb->tail, ts);
-        HRLOCK_UNLOCK(hb);
-    }
-
-    return cnt;
+    return ExpiryTimeout(&ippair_expiry, ts, IPPairHashRowTimeout);
 }
@@ -40,7 +40,8 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-threshold.h"
 
-#include "util-hash-lookup3.h"
+#include "util-hash-fast.h"
+#include "util-hugepages.h"
 
 static IPPair *IPPairGetUsedIPPair(void);
 
@@ -138,10 +139,10 @@ void IPPairInitConfig(char quiet)
     IPPairQueueInit(&ippair_spare_q);
 
 #ifndef AFLFUZZ_NO_RANDOM
-    unsigned int seed = RandomTimePreseed();
     /* set defaults */
-    ippair_config.hash_rand   = (int)( IPPAIR_DEFAULT_HASHSIZE * (rand_r(&seed) / RAND_MAX + 1.0));
+    ippair_config.hash_rand   = HashFastRandomSeed();
 #endif
+    ippair_config.hash_algo   = HashFastGetAlgo();
     ippair_config.hash_size   = IPPAIR_DEFAULT_HASHSIZE;
     ippair_config.memcap      = IPPAIR_DEFAULT_MEMCAP;
     ippair_config.prealloc    = IPPAIR_DEFAULT_PREALLOC;
@@ -192,7 +193,7 @@ void IPPairInitConfig(char quiet)
                 (uintmax_t)sizeof(IPPairHashRow));
         exit(EXIT_FAILURE);
     }
-    ippair_hash = SCMallocAligned(ippair_config.hash_size * sizeof(IPPairHashRow), CLS);
+    ippair_hash = HugePagesAlloc(ippair_config.hash_size * sizeof(IPPairHashRow));
     if (unlikely(ippair_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -205,6 +206,12 @@ void IPPairInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(ippair_memuse, (ippair_config.hash_size * sizeof(IPPairHashRow)));
 
+    if (ExpiryTableInit(&ippair_expiry, ippair_config.hash_size) != 0) {
+        SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+    (void) SC_ATOMIC_ADD(ippair_memuse, ExpiryTableMemuse(&ippair_expiry));
+
     if (quiet == FALSE) {
         SCLogConfig("allocated %llu bytes of memory for the ippair hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -280,10 +287,12 @@ void IPPairShutdown(void)
 
             HRLOCK_DESTROY(&ippair_hash[u]);
         }
-        SCFreeAligned(ippair_hash);
+        HugePagesFree(ippair_hash);
         ippair_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(ippair_memuse, ippair_config.hash_size * sizeof(IPPairHashRow));
+    (void) SC_ATOMIC_SUB(ippair_memuse, ExpiryTableMemuse(&ippair_expiry));
+    ExpiryTableFree(&ippair_expiry);
     IPPairQueueDestroy(&ippair_spare_q);
 
     SC_ATOMIC_DESTROY(ippair_prune_idx);
@@ -349,10 +358,10 @@ static uint32_t IPPairGetKey(Address *a, Address *b)
     uint32_t key;
 
     if (a->family == AF_INET) {
-        uint32_t hash = hashword(&a->addr_data32[0], 1, ippair_config.hash_rand);
+        uint32_t hash = HashFastWords(ippair_config.hash_algo, &a->addr_data32[0], 1, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else if (a->family == AF_INET6) {
-        uint32_t hash = hashword(a->addr_data32, 4, ippair_config.hash_rand);
+        uint32_t hash = HashFastWords(ippair_config.hash_algo, a->addr_data32, 4, ippair_config.hash_rand);
         key = hash % ippair_config.hash_size;
     } else
         key = 0;
@@ -464,6 +473,8 @@ IPPair *IPPairGetIPPairFromHash (Address *a, Address *b)
     /* get our hash bucket and lock it */
     IPPairHashRow *hb = &ippair_hash[key];
     HRLOCK_LOCK(hb);
+    /* the ippair is used, have its row checked at the next timeout pass */
+    ExpiryArm(&ippair_expiry, key, 0);
 
     /* see if the bucket already has a ippair */
     if (hb->head == NULL) {
@@ -569,6 +580,7 @@ IPPair *IPPairLookupIPPairFromHash (Address *a, Address *b)
         HRLOCK_UNLOCK(hb);
         return h;
     }
+    ExpiryArm(&ippair_expiry, key, 0);
 
     /* ok, we have a ippair in the bucket. Let's find out if it is our ippair */
     h = hb->head;
@@ -26,6 +26,8 @@
 
 #include "decode.h"
 #include "util-storage.h"
+#include "util-lock-stats.h"
+#include "util-expiry.h"
 
 /** Spinlocks or Mutex for the flow buckets. */
 //#define HRLOCK_SPIN
@@ -48,7 +50,7 @@
     #define HRLOCK_TYPE SCMutex
     #define HRLOCK_INIT(fb) SCMutexInit(&(fb)->lock, NULL)
     #define HRLOCK_DESTROY(fb) SCMutexDestroy(&(fb)->lock)
-    #define HRLOCK_LOCK(fb) SCMutexLock(&(fb)->lock)
+    #define HRLOCK_LOCK(fb) SCMutexLockSite(&(fb)->lock, LOCK_SITE_HASH_ROW)
     #define HRLOCK_TRYLOCK(fb) SCMutexTrylock(&(fb)->lock)
     #define HRLOCK_UNLOCK(fb) SCMutexUnlock(&(fb)->lock)
 #else
@@ -85,6 +87,8 @@ typedef struct IPPairHashRow_ {
 
 /** ippair hash table */
 IPPairHashRow *ippair_hash;
+/** when the rows of ippair_hash need a timeout check */
+ExpiryTable ippair_expiry;
 
 #define IPPAIR_VERBOSE    0
 #define IPPAIR_QUIET      1
@@ -92,6 +96,7 @@ IPPairHashRow *ippair_hash;
 typedef struct IPPairConfig_ {
     uint64_t memcap;
     uint32_t hash_rand;
+    int hash_algo;          /**< HashFastAlgo */
     uint32_t hash_size;
     uint32_t prealloc;
 } IPPairConfig;
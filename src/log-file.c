@@ -178,6 +178,19 @@ static void LogFileMetaGetSmtp(FILE *fp, const Packet *p, const File *ff)
  *  \internal
  *  \brief Write meta data on a single line json record
  */
+#ifdef HAVE_NSS
+static void LogFileWriteHash(FILE *fp, const char *name,
+        const uint8_t *hash, size_t hash_len)
+{
+    size_t x;
+    fprintf(fp, "\"%s\": \"", name);
+    for (x = 0; x < hash_len; x++) {
+        fprintf(fp, "%02x", hash[x]);
+    }
+    fprintf(fp, "\", ");
+}
+#endif
+
 static void LogFileWriteJsonRecord(LogFileLogThread *aft, const Packet *p, const File *ff, int ipver)
 {
     SCMutexLock(&aft->file_ctx->fp_mutex);
@@ -282,14 +295,12 @@ static void LogFileWriteJsonRecord(LogFileLogThread *aft, const Packet *p, const
         case FILE_STATE_CLOSED:
             fprintf(fp, "\"state\": \"CLOSED\", ");
 #ifdef HAVE_NSS
-            if (ff->flags & FILE_MD5) {
-                fprintf(fp, "\"md5\": \"");
-                size_t x;
-                for (x = 0; x < sizeof(ff->md5); x++) {
-                    fprintf(fp, "%02x", ff->md5[x]);
-                }
-                fprintf(fp, "\", ");
-            }
+            if (ff->flags & FILE_MD5)
+                LogFileWriteHash(fp, "md5", ff->md5, sizeof(ff->md5));
+            if (ff->flags & FILE_SHA1)
+                LogFileWriteHash(fp, "sha1", ff->sha1, sizeof(ff->sha1));
+            if (ff->flags & FILE_SHA256)
+                LogFileWriteHash(fp, "sha256", ff->sha256, sizeof(ff->sha256));
 #endif
             break;
         case FILE_STATE_TRUNCATED:
@@ -428,15 +439,7 @@ static OutputCtx *LogFileLogInitCtx(ConfNode *conf)
         SCLogInfo("forcing magic lookup for logged files");
     }
 
-    const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
-    if (force_md5 != NULL && ConfValIsTrue(force_md5)) {
-#ifdef HAVE_NSS
-        FileForceMd5Enable();
-        SCLogInfo("forcing md5 calculation for logged files");
-#else
-        SCLogInfo("md5 calculation requires linking against libnss");
-#endif
-    }
+    FileForceHashParseCfg(conf);
 
     FileForceTrackingEnable();
     SCReturnPtr(output_ctx, "OutputCtx");
@@ -56,12 +56,64 @@
 #include "app-layer-smtp.h"
 #include "util-decode-mime.h"
 #include "util-memcmp.h"
+#include "util-fmemopen.h"
+#include "util-misc.h"
+#include "util-signal.h"
 #include "stream-tcp-reassemble.h"
 
+#include <sys/uio.h>
+
 #define MODULE_NAME "LogFilestoreLog"
 
 static char g_logfile_base_dir[PATH_MAX] = "/tmp";
 
+/* writer threads: the logging threads queue jobs, the jobs of a file all
+ * go to writer file_id % writers_cnt so they are written in order. */
+#define FILESTORE_JOB_OPEN      1   /**< data: .meta contents */
+#define FILESTORE_JOB_DATA      2   /**< data: file data */
+#define FILESTORE_JOB_LOST      3   /**< data was not queued, memcap */
+#define FILESTORE_JOB_CLOSE     4   /**< data: .meta contents to append */
+
+#define FILESTORE_OVERFLOW_TRUNCATE 0   /**< keep the file up to the loss */
+#define FILESTORE_OVERFLOW_DROP     1   /**< remove the file */
+
+#define FILESTORE_META_MAX      8192
+#define FILESTORE_IOV_MAX       64
+
+typedef struct FilestoreJob_ {
+    struct FilestoreJob_ *next;
+    uint32_t file_id;
+    uint32_t len;
+    uint8_t type;
+    uint8_t data[];
+} FilestoreJob;
+
+typedef struct FilestoreLostId_ {
+    uint32_t file_id;
+    struct FilestoreLostId_ *next;
+} FilestoreLostId;
+
+typedef struct FilestoreWriter_ {
+    SCMutex m;
+    SCCondT cond;
+    FilestoreJob *head;
+    FilestoreJob *tail;
+    int stop;
+    pthread_t thread;
+    /** files that lost data, only used by the writer thread */
+    FilestoreLostId *lost;
+} FilestoreWriter;
+
+static struct {
+    FilestoreWriter *writers;   /**< NULL: write from the logging threads */
+    uint32_t writers_cnt;
+    uint64_t memcap;
+    int overflow;
+} g_filestore_async = { NULL, 0, 0, FILESTORE_OVERFLOW_TRUNCATE };
+
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_memuse);
+SC_ATOMIC_DECLARE(uint64_t, filestore_async_lost); /**< bytes not written */
+
 typedef struct LogFilestoreLogThread_ {
     LogFileCtx *file_ctx;
     /** LogFilestoreCtx has the pointer to the file and a mutex to allow multithreading */
@@ -166,77 +218,124 @@ static void LogFilestoreMetaGetSmtp(FILE *fp, const Packet *p, const File *ff)
     }
 }
 
-static void LogFilestoreLogCreateMetaFile(const Packet *p, const File *ff, char *filename, int ipver) {
-    char metafilename[PATH_MAX] = "";
-    snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
-    FILE *fp = fopen(metafilename, "w+");
-    if (fp != NULL) {
-        char timebuf[64];
+static void LogFilestoreLogPrintMetaOpen(FILE *fp, const Packet *p, const File *ff, int ipver)
+{
+    char timebuf[64];
 
-        CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
+    CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
-        fprintf(fp, "TIME:              %s\n", timebuf);
-        if (p->pcap_cnt > 0) {
-            fprintf(fp, "PCAP PKT NUM:      %"PRIu64"\n", p->pcap_cnt);
-        }
-
-        char srcip[46], dstip[46];
-        Port sp, dp;
-        switch (ipver) {
-            case AF_INET:
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
-                break;
-            case AF_INET6:
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
-                break;
-            default:
-                strlcpy(srcip, "<unknown>", sizeof(srcip));
-                strlcpy(dstip, "<unknown>", sizeof(dstip));
-                break;
-        }
-        sp = p->sp;
-        dp = p->dp;
-
-        fprintf(fp, "SRC IP:            %s\n", srcip);
-        fprintf(fp, "DST IP:            %s\n", dstip);
-        fprintf(fp, "PROTO:             %" PRIu32 "\n", p->proto);
-        if (PKT_IS_TCP(p) || PKT_IS_UDP(p)) {
-            fprintf(fp, "SRC PORT:          %" PRIu16 "\n", sp);
-            fprintf(fp, "DST PORT:          %" PRIu16 "\n", dp);
-        }
+    fprintf(fp, "TIME:              %s\n", timebuf);
+    if (p->pcap_cnt > 0) {
+        fprintf(fp, "PCAP PKT NUM:      %"PRIu64"\n", p->pcap_cnt);
+    }
 
-        fprintf(fp, "APP PROTO:         %s\n",
-                AppProtoToString(p->flow->alproto));
+    char srcip[46], dstip[46];
+    Port sp, dp;
+    switch (ipver) {
+        case AF_INET:
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+            break;
+        case AF_INET6:
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+            break;
+        default:
+            strlcpy(srcip, "<unknown>", sizeof(srcip));
+            strlcpy(dstip, "<unknown>", sizeof(dstip));
+            break;
+    }
+    sp = p->sp;
+    dp = p->dp;
+
+    fprintf(fp, "SRC IP:            %s\n", srcip);
+    fprintf(fp, "DST IP:            %s\n", dstip);
+    fprintf(fp, "PROTO:             %" PRIu32 "\n", p->proto);
+    if (PKT_IS_TCP(p) || PKT_IS_UDP(p)) {
+        fprintf(fp, "SRC PORT:          %" PRIu16 "\n", sp);
+        fprintf(fp, "DST PORT:          %" PRIu16 "\n", dp);
+    }
 
-        /* Only applicable to HTTP traffic */
-        if (p->flow->alproto == ALPROTO_HTTP) {
-            fprintf(fp, "HTTP URI:          ");
-            LogFilestoreMetaGetUri(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP HOST:         ");
-            LogFilestoreMetaGetHost(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP REFERER:      ");
-            LogFilestoreMetaGetReferer(fp, p, ff);
-            fprintf(fp, "\n");
-            fprintf(fp, "HTTP USER AGENT:   ");
-            LogFilestoreMetaGetUserAgent(fp, p, ff);
-            fprintf(fp, "\n");
-        } else if (p->flow->alproto == ALPROTO_SMTP) {
-            /* Only applicable to SMTP */
-            LogFilestoreMetaGetSmtp(fp, p, ff);
-        }
+    fprintf(fp, "APP PROTO:         %s\n",
+            AppProtoToString(p->flow->alproto));
 
-        fprintf(fp, "FILENAME:          ");
-        PrintRawUriFp(fp, ff->name, ff->name_len);
+    /* Only applicable to HTTP traffic */
+    if (p->flow->alproto == ALPROTO_HTTP) {
+        fprintf(fp, "HTTP URI:          ");
+        LogFilestoreMetaGetUri(fp, p, ff);
+        fprintf(fp, "\n");
+        fprintf(fp, "HTTP HOST:         ");
+        LogFilestoreMetaGetHost(fp, p, ff);
         fprintf(fp, "\n");
+        fprintf(fp, "HTTP REFERER:      ");
+        LogFilestoreMetaGetReferer(fp, p, ff);
+        fprintf(fp, "\n");
+        fprintf(fp, "HTTP USER AGENT:   ");
+        LogFilestoreMetaGetUserAgent(fp, p, ff);
+        fprintf(fp, "\n");
+    } else if (p->flow->alproto == ALPROTO_SMTP) {
+        /* Only applicable to SMTP */
+        LogFilestoreMetaGetSmtp(fp, p, ff);
+    }
 
+    fprintf(fp, "FILENAME:          ");
+    PrintRawUriFp(fp, ff->name, ff->name_len);
+    fprintf(fp, "\n");
+}
+
+static void LogFilestoreLogCreateMetaFile(const Packet *p, const File *ff, char *filename, int ipver) {
+    char metafilename[PATH_MAX] = "";
+    snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
+    FILE *fp = fopen(metafilename, "w+");
+    if (fp != NULL) {
+        LogFilestoreLogPrintMetaOpen(fp, p, ff, ipver);
         fclose(fp);
     }
 }
 
+#ifdef HAVE_NSS
+static void LogFilestoreLogPrintHash(FILE *fp, const char *prefix,
+        const uint8_t *hash, size_t hash_len)
+{
+    size_t x;
+    fprintf(fp, "%s", prefix);
+    for (x = 0; x < hash_len; x++) {
+        fprintf(fp, "%02x", hash[x]);
+    }
+    fprintf(fp, "\n");
+}
+#endif
+
+static void LogFilestoreLogPrintMetaClose(FILE *fp, const File *ff)
+{
+    fprintf(fp, "MAGIC:             %s\n",
+            ff->magic ? ff->magic : "<unknown>");
+
+    switch (ff->state) {
+        case FILE_STATE_CLOSED:
+            fprintf(fp, "STATE:             CLOSED\n");
+#ifdef HAVE_NSS
+            if (ff->flags & FILE_MD5)
+                LogFilestoreLogPrintHash(fp, "MD5:               ", ff->md5, sizeof(ff->md5));
+            if (ff->flags & FILE_SHA1)
+                LogFilestoreLogPrintHash(fp, "SHA1:              ", ff->sha1, sizeof(ff->sha1));
+            if (ff->flags & FILE_SHA256)
+                LogFilestoreLogPrintHash(fp, "SHA256:            ", ff->sha256, sizeof(ff->sha256));
+#endif
+            break;
+        case FILE_STATE_TRUNCATED:
+            fprintf(fp, "STATE:             TRUNCATED\n");
+            break;
+        case FILE_STATE_ERROR:
+            fprintf(fp, "STATE:             ERROR\n");
+            break;
+        default:
+            fprintf(fp, "STATE:             UNKNOWN\n");
+            break;
+    }
+    fprintf(fp, "SIZE:              %"PRIu64"\n", FileSize(ff));
+}
+
 static void LogFilestoreLogCloseMetaFile(const File *ff)
 {
     char filename[PATH_MAX] = "";
@@ -246,39 +345,351 @@ static void LogFilestoreLogCloseMetaFile(const File *ff)
     snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
     FILE *fp = fopen(metafilename, "a");
     if (fp != NULL) {
-        fprintf(fp, "MAGIC:             %s\n",
-                ff->magic ? ff->magic : "<unknown>");
+        LogFilestoreLogPrintMetaClose(fp, ff);
+        fclose(fp);
+    } else {
+        SCLogInfo("opening %s failed: %s", metafilename, strerror(errno));
+    }
+}
 
-        switch (ff->state) {
-            case FILE_STATE_CLOSED:
-                fprintf(fp, "STATE:             CLOSED\n");
-#ifdef HAVE_NSS
-                if (ff->flags & FILE_MD5) {
-                    fprintf(fp, "MD5:               ");
-                    size_t x;
-                    for (x = 0; x < sizeof(ff->md5); x++) {
-                        fprintf(fp, "%02x", ff->md5[x]);
+static FilestoreJob *FilestoreJobNew(uint8_t type, uint32_t file_id,
+        const uint8_t *data, uint32_t len)
+{
+    FilestoreJob *job = SCMalloc(sizeof(FilestoreJob) + len);
+    if (unlikely(job == NULL))
+        return NULL;
+    job->next = NULL;
+    job->file_id = file_id;
+    job->len = len;
+    job->type = type;
+    if (len > 0)
+        memcpy(job->data, data, len);
+    (void)SC_ATOMIC_ADD(filestore_async_memuse, sizeof(FilestoreJob) + len);
+    return job;
+}
+
+static void FilestoreJobFree(FilestoreJob *job)
+{
+    (void)SC_ATOMIC_SUB(filestore_async_memuse, sizeof(FilestoreJob) + job->len);
+    SCFree(job);
+}
+
+static void FilestoreJobQueue(FilestoreJob *job)
+{
+    FilestoreWriter *w = &g_filestore_async.writers[job->file_id %
+        g_filestore_async.writers_cnt];
+
+    SCMutexLock(&w->m);
+    if (w->tail == NULL) {
+        w->head = w->tail = job;
+        SCCondSignal(&w->cond);
+    } else {
+        w->tail->next = job;
+        w->tail = job;
+    }
+    SCMutexUnlock(&w->m);
+}
+
+/** \internal
+ *  \brief queue the meta file contents printed by Print */
+static void FilestoreQueueMeta(uint8_t type, const Packet *p, const File *ff, int ipver)
+{
+    uint8_t buf[FILESTORE_META_MAX];
+    FILE *fp = SCFmemopen(buf, sizeof(buf), "w");
+    if (fp == NULL)
+        return;
+
+    if (type == FILESTORE_JOB_OPEN)
+        LogFilestoreLogPrintMetaOpen(fp, p, ff, ipver);
+    else
+        LogFilestoreLogPrintMetaClose(fp, ff);
+    fflush(fp);
+    long len = ftell(fp);
+    fclose(fp);
+    if (len < 0)
+        len = 0;
+    else if (len > (long)sizeof(buf))
+        len = sizeof(buf);
+
+    FilestoreJob *job = FilestoreJobNew(type, ff->file_id, buf, (uint32_t)len);
+    if (job != NULL)
+        FilestoreJobQueue(job);
+}
+
+/** \internal
+ *  \brief queue file data, or a loss marker if it's over the memcap */
+static void FilestoreQueueData(const File *ff, const uint8_t *data, uint32_t data_len)
+{
+    FilestoreJob *job = NULL;
+
+    if (SC_ATOMIC_GET(filestore_async_memuse) + sizeof(FilestoreJob) + data_len <=
+            g_filestore_async.memcap) {
+        job = FilestoreJobNew(FILESTORE_JOB_DATA, ff->file_id, data, data_len);
+    }
+    if (job == NULL) {
+        (void)SC_ATOMIC_ADD(filestore_async_lost, data_len);
+        job = FilestoreJobNew(FILESTORE_JOB_LOST, ff->file_id, NULL, 0);
+        if (job == NULL)
+            return;
+    }
+    FilestoreJobQueue(job);
+}
+
+static int FilestoreLostIsSet(const FilestoreWriter *w, uint32_t file_id)
+{
+    const FilestoreLostId *l;
+    for (l = w->lost; l != NULL; l = l->next) {
+        if (l->file_id == file_id)
+            return 1;
+    }
+    return 0;
+}
+
+static void FilestoreLostSet(FilestoreWriter *w, uint32_t file_id)
+{
+    if (FilestoreLostIsSet(w, file_id))
+        return;
+    FilestoreLostId *l = SCMalloc(sizeof(*l));
+    if (unlikely(l == NULL))
+        return;
+    l->file_id = file_id;
+    l->next = w->lost;
+    w->lost = l;
+}
+
+/** \retval 1 if the file had lost data */
+static int FilestoreLostRemove(FilestoreWriter *w, uint32_t file_id)
+{
+    FilestoreLostId **pl = &w->lost;
+    while (*pl != NULL) {
+        if ((*pl)->file_id == file_id) {
+            FilestoreLostId *l = *pl;
+            *pl = l->next;
+            SCFree(l);
+            return 1;
+        }
+        pl = &(*pl)->next;
+    }
+    return 0;
+}
+
+static void FilestoreWriteBuf(const char *filename, const char *mode,
+        const uint8_t *buf, uint32_t len)
+{
+    FILE *fp = fopen(filename, mode);
+    if (fp == NULL) {
+        SCLogInfo("opening %s failed: %s", filename, strerror(errno));
+        return;
+    }
+    if (len > 0 && fwrite(buf, len, 1, fp) != 1)
+        SCLogDebug("write to %s failed: %s", filename, strerror(errno));
+    fclose(fp);
+}
+
+/** \internal
+ *  \brief write out a batch of jobs
+ *
+ *  The data file stays open while jobs for the same file follow each
+ *  other, consecutive data chunks are written with a single writev. */
+static void FilestoreWriterRun(FilestoreWriter *w, FilestoreJob *jobs)
+{
+    char filename[PATH_MAX];
+    char metafilename[PATH_MAX];
+    int fd = -1;
+    uint32_t fd_id = 0;
+
+    while (jobs != NULL) {
+        FilestoreJob *job = jobs;
+        FilestoreJob *next = job->next;
+        const uint32_t file_id = job->file_id;
+
+        snprintf(filename, sizeof(filename), "%s/file.%u",
+                g_logfile_base_dir, file_id);
+        snprintf(metafilename, sizeof(metafilename), "%s.meta", filename);
+
+        switch (job->type) {
+            case FILESTORE_JOB_OPEN:
+                if (fd != -1)
+                    close(fd);
+                FilestoreWriteBuf(metafilename, "w+", job->data, job->len);
+                fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+                fd_id = file_id;
+                if (fd == -1)
+                    SCLogDebug("failed to create file %s: %s", filename, strerror(errno));
+                break;
+
+            case FILESTORE_JOB_DATA: {
+                struct iovec iov[FILESTORE_IOV_MAX];
+                int cnt = 0;
+
+                /* collect the chunks of this file that follow */
+                while (next != NULL && next->type == FILESTORE_JOB_DATA &&
+                        next->file_id == file_id && cnt < FILESTORE_IOV_MAX - 1)
+                {
+                    iov[cnt + 1].iov_base = next->data;
+                    iov[cnt + 1].iov_len = next->len;
+                    cnt++;
+                    next = next->next;
+                }
+                iov[0].iov_base = job->data;
+                iov[0].iov_len = job->len;
+                cnt++;
+
+                /* no holes: after a loss, only the meta data is kept */
+                if (!FilestoreLostIsSet(w, file_id)) {
+                    if (fd == -1 || fd_id != file_id) {
+                        if (fd != -1)
+                            close(fd);
+                        fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+                        fd_id = file_id;
+                        if (fd == -1)
+                            SCLogDebug("failed to open file %s: %s", filename, strerror(errno));
                     }
-                    fprintf(fp, "\n");
+                    if (fd != -1 && writev(fd, iov, cnt) == -1)
+                        SCLogDebug("write failed: %s", strerror(errno));
+                }
+
+                /* free all but the first, which is freed below */
+                while (job->next != next) {
+                    FilestoreJob *j = job->next;
+                    job->next = j->next;
+                    FilestoreJobFree(j);
                 }
-#endif
-                break;
-            case FILE_STATE_TRUNCATED:
-                fprintf(fp, "STATE:             TRUNCATED\n");
                 break;
-            case FILE_STATE_ERROR:
-                fprintf(fp, "STATE:             ERROR\n");
+            }
+
+            case FILESTORE_JOB_LOST:
+                FilestoreLostSet(w, file_id);
                 break;
-            default:
-                fprintf(fp, "STATE:             UNKNOWN\n");
+
+            case FILESTORE_JOB_CLOSE:
+                if (fd != -1 && fd_id == file_id) {
+                    close(fd);
+                    fd = -1;
+                }
+                if (FilestoreLostRemove(w, file_id)) {
+                    if (g_filestore_async.overflow == FILESTORE_OVERFLOW_DROP) {
+                        (void)unlink(filename);
+                        (void)unlink(metafilename);
+                        break;
+                    }
+                    FilestoreWriteBuf(metafilename, "a", job->data, job->len);
+                    const char *note = "FILESTORE:         TRUNCATED (write-memcap)\n";
+                    FilestoreWriteBuf(metafilename, "a", (const uint8_t *)note,
+                            (uint32_t)strlen(note));
+                } else {
+                    FilestoreWriteBuf(metafilename, "a", job->data, job->len);
+                }
                 break;
         }
-        fprintf(fp, "SIZE:              %"PRIu64"\n", FileSize(ff));
 
-        fclose(fp);
-    } else {
-        SCLogInfo("opening %s failed: %s", metafilename, strerror(errno));
+        FilestoreJobFree(job);
+        jobs = next;
+    }
+
+    if (fd != -1)
+        close(fd);
+}
+
+static void *FilestoreWriterThread(void *arg)
+{
+    FilestoreWriter *w = (FilestoreWriter *)arg;
+
+    /* block usr2. usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+    SCSetThreadName("FileWriter");
+
+    SCMutexLock(&w->m);
+    while (1) {
+        while (w->head == NULL && !w->stop) {
+            SCCondWait(&w->cond, &w->m);
+        }
+        FilestoreJob *jobs = w->head;
+        w->head = w->tail = NULL;
+        SCMutexUnlock(&w->m);
+
+        /* stopped and all written */
+        if (jobs == NULL)
+            break;
+
+        FilestoreWriterRun(w, jobs);
+        SCMutexLock(&w->m);
     }
+    return NULL;
+}
+
+/** \internal
+ *  \brief stop the writer threads after they wrote out all queued jobs */
+static void FilestoreAsyncDeinit(void)
+{
+    uint32_t u;
+
+    if (g_filestore_async.writers == NULL)
+        return;
+
+    for (u = 0; u < g_filestore_async.writers_cnt; u++) {
+        FilestoreWriter *w = &g_filestore_async.writers[u];
+        SCMutexLock(&w->m);
+        w->stop = 1;
+        SCCondSignal(&w->cond);
+        SCMutexUnlock(&w->m);
+    }
+    for (u = 0; u < g_filestore_async.writers_cnt; u++) {
+        FilestoreWriter *w = &g_filestore_async.writers[u];
+        pthread_join(w->thread, NULL);
+        while (w->lost != NULL)
+            (void)FilestoreLostRemove(w, w->lost->file_id);
+        SCCondDestroy(&w->cond);
+        SCMutexDestroy(&w->m);
+    }
+
+    uint64_t lost = SC_ATOMIC_GET(filestore_async_lost);
+    if (lost > 0) {
+        SCLogInfo("filestore: %"PRIu64" bytes not written, write-memcap "
+                "reached", lost);
+    }
+    SCFree(g_filestore_async.writers);
+    g_filestore_async.writers = NULL;
+    g_filestore_async.writers_cnt = 0;
+}
+
+/** \internal
+ *  \brief start the writer threads
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, files are written by the logging threads
+ */
+static int FilestoreAsyncInit(uint32_t cnt, uint64_t memcap, int overflow)
+{
+    uint32_t u;
+
+    g_filestore_async.writers = SCCalloc(cnt, sizeof(FilestoreWriter));
+    if (g_filestore_async.writers == NULL)
+        return -1;
+    g_filestore_async.memcap = memcap;
+    g_filestore_async.overflow = overflow;
+    SC_ATOMIC_INIT(filestore_async_memuse);
+    SC_ATOMIC_INIT(filestore_async_lost);
+
+    for (u = 0; u < cnt; u++) {
+        FilestoreWriter *w = &g_filestore_async.writers[u];
+        SCMutexInit(&w->m, NULL);
+        SCCondInit(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, FilestoreWriterThread, w) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "failed to create file writer thread");
+            SCCondDestroy(&w->cond);
+            SCMutexDestroy(&w->m);
+            /* stop the ones that did start */
+            g_filestore_async.writers_cnt = u;
+            FilestoreAsyncDeinit();
+            return -1;
+        }
+        g_filestore_async.writers_cnt = u + 1;
+    }
+
+    SCLogInfo("filestore: writing files from %u writer threads, "
+            "write-memcap %"PRIu64, cnt, memcap);
+    return 0;
 }
 
 static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p,
@@ -305,6 +716,18 @@ static int LogFilestoreLogger(ThreadVars *tv, void *thread_data, const Packet *p
 
     SCLogDebug("ff %p, data %p, data_len %u", ff, data, data_len);
 
+    if (g_filestore_async.writers != NULL) {
+        if (flags & OUTPUT_FILEDATA_FLAG_OPEN) {
+            aft->file_cnt++;
+            FilestoreQueueMeta(FILESTORE_JOB_OPEN, p, ff, ipver);
+        }
+        if (data != NULL && data_len > 0)
+            FilestoreQueueData(ff, data, data_len);
+        if (flags & OUTPUT_FILEDATA_FLAG_CLOSE)
+            FilestoreQueueMeta(FILESTORE_JOB_CLOSE, p, ff, ipver);
+        return 0;
+    }
+
     snprintf(filename, sizeof(filename), "%s/file.%u",
             g_logfile_base_dir, ff->file_id);
 
@@ -416,6 +839,8 @@ static void LogFilestoreLogExitPrintStats(ThreadVars *tv, void *data)
  */
 static void LogFilestoreLogDeInitCtx(OutputCtx *output_ctx)
 {
+    FilestoreAsyncDeinit();
+
     LogFileCtx *logfile_ctx = (LogFileCtx *)output_ctx->data;
     LogFileFreeCtx(logfile_ctx);
     SCFree(output_ctx);
@@ -465,17 +890,38 @@ static OutputCtx *LogFilestoreLogInitCtx(ConfNode *conf)
         SCLogInfo("forcing magic lookup for stored files");
     }
 
-    const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
-    if (force_md5 != NULL && ConfValIsTrue(force_md5)) {
-#ifdef HAVE_NSS
-        FileForceMd5Enable();
-        SCLogInfo("forcing md5 calculation for stored files");
-#else
-        SCLogInfo("md5 calculation requires linking against libnss");
-#endif
-    }
+    FileForceHashParseCfg(conf);
     SCLogInfo("storing files in %s", g_logfile_base_dir);
 
+    intmax_t writers = 0;
+    if (ConfGetChildValueInt(conf, "writer-threads", &writers) == 1 &&
+            writers > 0 && g_filestore_async.writers == NULL)
+    {
+        uint64_t memcap = 64 * 1024 * 1024;
+        const char *s_memcap = ConfNodeLookupChildValue(conf, "write-memcap");
+        if (s_memcap != NULL && ParseSizeStringU64(s_memcap, &memcap) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "invalid write-memcap \"%s\"", s_memcap);
+            exit(EXIT_FAILURE);
+        }
+
+        int overflow = FILESTORE_OVERFLOW_TRUNCATE;
+        const char *s_overflow = ConfNodeLookupChildValue(conf, "write-overflow");
+        if (s_overflow != NULL) {
+            if (strcasecmp(s_overflow, "drop") == 0) {
+                overflow = FILESTORE_OVERFLOW_DROP;
+            } else if (strcasecmp(s_overflow, "truncate") != 0) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid write-overflow "
+                        "\"%s\", expected truncate or drop", s_overflow);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (FilestoreAsyncInit((uint32_t)writers, memcap, overflow) < 0) {
+            SCLogWarning(SC_ERR_THREAD_CREATE, "filestore: writing files "
+                    "from the logging threads");
+        }
+    }
+
     SCReturnPtr(output_ctx, "OutputCtx");
 }
 
@@ -49,6 +49,10 @@
 
 #include "source-pcap.h"
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #include "output.h"
 
 #include "queue.h"
@@ -75,6 +79,20 @@
 #define HONOR_PASS_RULES_DISABLED       0
 #define HONOR_PASS_RULES_ENABLED        1
 
+#define LOGMODE_COND_ALL                0
+#define LOGMODE_COND_ALERTS             1
+#define LOGMODE_COND_TAG                2
+
+/** stdio buffer of a pcap file. Each write is a full, aligned buffer
+ *  instead of the st_blksize sized ones libpcap gets by default */
+#define DEFAULT_BUFFER_SIZE             (1024 * 1024)
+#define BUFFER_ALIGN                    4096
+
+#define RING_MIN_SIZE                   (1024 * 1024)
+#define RING_HUGEPAGE_SIZE              (2 * 1024 * 1024)
+/** index buckets of the packet ring, by flow hash */
+#define RING_BUCKETS                    65536
+
 SC_ATOMIC_DECLARE(uint32_t, thread_cnt);
 
 typedef struct PcapFileName_ {
@@ -98,6 +116,9 @@ typedef struct PcapLogProfileData_ {
 typedef struct PcapLogData_ {
     int use_stream_depth;       /**< use stream depth i.e. ignore packets that reach limit */
     int honor_pass_rules;       /**< don't log if pass rules have matched */
+    int log_coalesced;          /**< log GRO/LRO coalesced segments */
+    int conditional;            /**< log all packets, or only those of
+                                 *   alerted flows or tagged packets */
     int is_private;             /**< TRUE if ctx is thread local */
     SCMutex plog_lock;
     uint64_t pkt_cnt;		    /**< total number of packets */
@@ -132,10 +153,60 @@ typedef struct PcapLogData_ {
     int threads;                /**< number of threads (only set in the global) */
     char *filename_parts[MAX_TOKS];
     int filename_part_cnt;
+    uint32_t buffer_size;       /**< stdio buffer size, 0 for the default */
+    char *buffer;               /**< stdio buffer of the current file */
+    uint64_t ring_size;         /**< per thread packet ring, 0 disables */
+    uint32_t ring_max_age;
+    int ring_hugepages;
 } PcapLogData;
 
+/** link to a ring entry, valid as long as the entry with that seq is
+ *  still in the ring */
+typedef struct PcapLogRingLink_ {
+    uint64_t seq;
+    uint64_t off;
+} PcapLogRingLink;
+
+/** packet in the ring, the packet data follows it */
+typedef struct PcapLogRingEntry_ {
+    uint64_t seq;
+    PcapLogRingLink prev;       /**< older entry in the same bucket */
+    const void *flow;
+    uint32_t flow_hash;
+    uint32_t len;               /**< packet data length */
+    uint32_t size;              /**< entry size, padded */
+    uint32_t dumped;            /**< written to the pcap file already */
+    struct timeval ts;
+} PcapLogRingEntry;
+
+/**
+ * Per thread ring of the packets that were not logged in conditional mode.
+ *
+ * When a flow starts to get logged, its packets still in the ring are
+ * dumped first. Entries are laid out back to back and the oldest ones are
+ * overwritten; a per bucket chain through the entries finds those of one
+ * flow without scanning the ring.
+ */
+typedef struct PcapLogRing_ {
+    uint8_t *buf;
+    uint64_t size;
+    uint64_t map_size;          /**< mmap'd size, 0 if not mmap'd */
+    uint64_t head;              /**< offset to write the next entry */
+    uint64_t tail;              /**< offset of the oldest entry */
+    uint64_t wrap_end;          /**< end of the entries before the wrap */
+    uint64_t next_seq;
+    uint64_t tail_seq;          /**< seq of the oldest entry */
+    uint32_t cnt;
+    uint32_t max_age;           /**< seconds, 0 for no limit */
+    PcapLogRingLink *buckets;
+    uint64_t *dump;             /**< scratch list of entries to dump */
+    uint32_t dump_size;
+    uint64_t dumped_pkts;
+} PcapLogRing;
+
 typedef struct PcapLogThreadData_ {
     PcapLogData *pcap_log;
+    PcapLogRing *ring;
 } PcapLogThreadData;
 
 /* global pcap data for when we're using multi mode. At exit we'll
@@ -149,6 +220,7 @@ static TmEcode PcapLogDataDeinit(ThreadVars *, void *);
 static void PcapLogFileDeInitCtx(OutputCtx *);
 static OutputCtx *PcapLogInitCtx(ConfNode *);
 static void PcapLogProfilingDump(PcapLogData *);
+static void PcapLogRegisterTests(void);
 
 void TmModulePcapLogRegister(void)
 {
@@ -156,7 +228,7 @@ void TmModulePcapLogRegister(void)
     tmm_modules[TMM_PCAPLOG].ThreadInit = PcapLogDataInit;
     tmm_modules[TMM_PCAPLOG].Func = PcapLog;
     tmm_modules[TMM_PCAPLOG].ThreadDeinit = PcapLogDataDeinit;
-    tmm_modules[TMM_PCAPLOG].RegisterTests = NULL;
+    tmm_modules[TMM_PCAPLOG].RegisterTests = PcapLogRegisterTests;
 
     OutputRegisterModule(MODULE_NAME, "pcap-log", PcapLogInitCtx);
 
@@ -296,9 +368,24 @@ static int PcapLogOpenHandles(PcapLogData *pl, Packet *p)
     }
 
     if (pl->pcap_dumper == NULL) {
-        if ((pl->pcap_dumper = pcap_dump_open(pl->pcap_dead_handle,
-                        pl->filename)) == NULL) {
+        /* open the file ourselves so the buffer can be set up before the
+         * pcap file header is written */
+        FILE *fp = fopen(pl->filename, "w");
+        if (fp == NULL) {
+            SCLogInfo("Error opening dump file %s: %s", pl->filename,
+                    strerror(errno));
+            return TM_ECODE_FAILED;
+        }
+        if (pl->buffer_size > 0) {
+            if (pl->buffer == NULL)
+                pl->buffer = SCMallocAligned(pl->buffer_size, BUFFER_ALIGN);
+            if (pl->buffer != NULL)
+                setvbuf(fp, pl->buffer, _IOFBF, pl->buffer_size);
+        }
+        if ((pl->pcap_dumper = pcap_dump_fopen(pl->pcap_dead_handle,
+                        fp)) == NULL) {
             SCLogInfo("Error opening dump file %s", pcap_geterr(pl->pcap_dead_handle));
+            fclose(fp);
             return TM_ECODE_FAILED;
         }
     }
@@ -333,6 +420,218 @@ static void PcapLogUnlock(PcapLogData *pl)
     }
 }
 
+static PcapLogRing *PcapLogRingNew(uint64_t size, uint32_t max_age,
+                                   int hugepages)
+{
+    PcapLogRing *r = SCCalloc(1, sizeof(*r));
+    if (unlikely(r == NULL))
+        return NULL;
+
+    r->buckets = SCCalloc(RING_BUCKETS, sizeof(PcapLogRingLink));
+    if (r->buckets == NULL)
+        goto error;
+
+#if HAVE_SYS_MMAN_H
+#ifdef MAP_HUGETLB
+    if (hugepages) {
+        uint64_t map_size = (size + RING_HUGEPAGE_SIZE - 1) &
+            ~((uint64_t)RING_HUGEPAGE_SIZE - 1);
+        void *ptr = mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            r->buf = ptr;
+            r->map_size = r->size = map_size;
+        } else {
+            SCLogInfo("pcap-log: no hugepages for the packet ring (%s), "
+                    "using normal pages", strerror(errno));
+        }
+    }
+#endif
+    if (r->buf == NULL) {
+        void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED) {
+            r->buf = ptr;
+            r->map_size = r->size = size;
+        }
+    }
+#endif
+    if (r->buf == NULL) {
+        r->buf = SCMallocAligned(size, BUFFER_ALIGN);
+        if (r->buf == NULL)
+            goto error;
+        r->size = size;
+    }
+
+    r->max_age = max_age;
+    r->next_seq = 1;
+    r->tail_seq = 1;
+    return r;
+
+error:
+    if (r->buckets != NULL)
+        SCFree(r->buckets);
+    SCFree(r);
+    return NULL;
+}
+
+static void PcapLogRingFree(PcapLogRing *r)
+{
+    if (r == NULL)
+        return;
+#if HAVE_SYS_MMAN_H
+    if (r->map_size > 0)
+        munmap(r->buf, r->map_size);
+    else
+#endif
+        SCFreeAligned(r->buf);
+    if (r->dump != NULL)
+        SCFree(r->dump);
+    SCFree(r->buckets);
+    SCFree(r);
+}
+
+/** \internal
+ *  \brief drop the oldest entry */
+static void PcapLogRingDropTail(PcapLogRing *r)
+{
+    PcapLogRingEntry *e = (PcapLogRingEntry *)(r->buf + r->tail);
+    r->tail += e->size;
+    r->tail_seq = e->seq + 1;
+    if (--r->cnt == 0) {
+        r->head = r->tail = 0;
+    } else if (r->tail == r->wrap_end) {
+        r->tail = 0;
+    }
+}
+
+/**
+ * \brief Store a packet in the ring, overwriting the oldest ones
+ */
+static void PcapLogRingAdd(PcapLogRing *r, const void *flow,
+                           uint32_t flow_hash, const struct timeval *ts,
+                           const uint8_t *data, uint32_t len)
+{
+    const uint64_t size = (sizeof(PcapLogRingEntry) + len + 7) & ~7ULL;
+    if (size > r->size)
+        return;
+
+    if (r->head + size > r->size) {
+        /* entries left between head and the end are older */
+        while (r->cnt > 0 && r->tail >= r->head)
+            PcapLogRingDropTail(r);
+        r->wrap_end = r->head;
+        r->head = 0;
+        if (r->cnt == 0)
+            r->tail = 0;
+    }
+    while (r->cnt > 0 && r->tail >= r->head && r->tail < r->head + size)
+        PcapLogRingDropTail(r);
+
+    PcapLogRingEntry *e = (PcapLogRingEntry *)(r->buf + r->head);
+    PcapLogRingLink *b = &r->buckets[flow_hash % RING_BUCKETS];
+    e->seq = r->next_seq++;
+    e->prev = *b;
+    e->flow = flow;
+    e->flow_hash = flow_hash;
+    e->len = len;
+    e->size = (uint32_t)size;
+    e->dumped = 0;
+    e->ts = *ts;
+    memcpy((uint8_t *)e + sizeof(*e), data, len);
+
+    b->seq = e->seq;
+    b->off = r->head;
+    r->head += size;
+    r->cnt++;
+}
+
+/**
+ * \brief Collect the entries of a flow, oldest first
+ *
+ * They are marked as dumped, so they are only returned once. Packets
+ * older than max_age seconds before 'now' are skipped.
+ *
+ * \retval cnt number of entries, their offsets are in r->dump
+ */
+static uint32_t PcapLogRingCollect(PcapLogRing *r, const void *flow,
+                                   uint32_t flow_hash,
+                                   const struct timeval *now)
+{
+    uint32_t cnt = 0;
+    PcapLogRingLink l = r->buckets[flow_hash % RING_BUCKETS];
+
+    while (l.seq >= r->tail_seq && l.seq < r->next_seq) {
+        PcapLogRingEntry *e = (PcapLogRingEntry *)(r->buf + l.off);
+        if (e->flow == flow && e->flow_hash == flow_hash) {
+            /* the older ones were dumped with this one */
+            if (e->dumped)
+                break;
+            if (r->max_age > 0 && e->ts.tv_sec + r->max_age < now->tv_sec)
+                break;
+
+            if (cnt == r->dump_size) {
+                uint32_t new_size = r->dump_size ? r->dump_size * 2 : 64;
+                uint64_t *ptr = SCRealloc(r->dump, new_size * sizeof(uint64_t));
+                if (ptr == NULL)
+                    break;
+                r->dump = ptr;
+                r->dump_size = new_size;
+            }
+            r->dump[cnt++] = l.off;
+            e->dumped = 1;
+        }
+        l = e->prev;
+    }
+
+    /* chain is newest first */
+    uint32_t i;
+    for (i = 0; i < cnt / 2; i++) {
+        uint64_t tmp = r->dump[i];
+        r->dump[i] = r->dump[cnt - 1 - i];
+        r->dump[cnt - 1 - i] = tmp;
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief write the packets of the flow of p that are in the ring */
+static void PcapLogRingDump(PcapLogRing *r, PcapLogData *pl, const Packet *p)
+{
+    uint32_t cnt = PcapLogRingCollect(r, p->flow, p->flow_hash, &p->ts);
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        const PcapLogRingEntry *e =
+            (const PcapLogRingEntry *)(r->buf + r->dump[i]);
+        struct pcap_pkthdr h;
+        h.ts = e->ts;
+        h.caplen = h.len = e->len;
+        pcap_dump((u_char *)pl->pcap_dumper, &h,
+                (const uint8_t *)e + sizeof(*e));
+        pl->size_current += sizeof(h) + e->len;
+        pl->profile_data_size += sizeof(h) + e->len;
+    }
+    r->dumped_pkts += cnt;
+}
+
+/** \internal
+ *  \brief check if a packet should be logged in conditional mode
+ *
+ *  With "alerts" all packets of a flow are logged from the first alert
+ *  on, packets without a flow only if they alerted themselves. */
+static inline int PcapLogCondition(const PcapLogData *pl, const Packet *p)
+{
+    switch (pl->conditional) {
+        case LOGMODE_COND_ALERTS:
+            return (p->alerts.cnt > 0 ||
+                    (p->flow != NULL && (p->flow->flags & FLOW_HAS_ALERTS)));
+        case LOGMODE_COND_TAG:
+            return (p->flags & PKT_HAS_TAG) ? 1 : 0;
+        default:
+            return 1;
+    }
+}
+
 /**
  * \brief Pcap logging main function
  *
@@ -359,11 +658,21 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
         ((p->flags & PKT_STREAM_NOPCAPLOG) &&
          (pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED)) ||
         (IS_TUNNEL_PKT(p) && !IS_TUNNEL_ROOT_PKT(p)) ||
-        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)))
+        (pl->honor_pass_rules && (p->flags & PKT_NOPACKET_INSPECTION)) ||
+        (!pl->log_coalesced && (p->flags & PKT_COALESCED)))
     {
         return TM_ECODE_OK;
     }
 
+    if (!PcapLogCondition(pl, p)) {
+        /* keep it around in case the flow gets logged later */
+        if (td->ring != NULL && p->flow != NULL) {
+            PcapLogRingAdd(td->ring, p->flow, p->flow_hash, &p->ts,
+                    GET_PKT_DATA(p), GET_PKT_LEN(p));
+        }
+        return TM_ECODE_OK;
+    }
+
     PcapLogLock(pl);
 
     pl->pkt_cnt++;
@@ -408,6 +717,9 @@ static TmEcode PcapLog (ThreadVars *t, Packet *p, void *thread_data, PacketQueue
         }
     }
 
+    if (td->ring != NULL && td->ring->cnt > 0 && p->flow != NULL)
+        PcapLogRingDump(td->ring, pl, p);
+
     PCAPLOG_PROFILE_START;
     pcap_dump((u_char *)pl->pcap_dumper, pl->h, GET_PKT_DATA(p));
     pl->size_current += len;
@@ -449,7 +761,14 @@ static PcapLogData *PcapLogDataCopy(const PcapLogData *pl)
     copy->use_ringbuffer = pl->use_ringbuffer;
     copy->timestamp_format = pl->timestamp_format;
     copy->use_stream_depth = pl->use_stream_depth;
+    copy->honor_pass_rules = pl->honor_pass_rules;
+    copy->log_coalesced = pl->log_coalesced;
+    copy->conditional = pl->conditional;
     copy->size_limit = pl->size_limit;
+    copy->buffer_size = pl->buffer_size;
+    copy->ring_size = pl->ring_size;
+    copy->ring_max_age = pl->ring_max_age;
+    copy->ring_hugepages = pl->ring_hugepages;
 
     TAILQ_INIT(&copy->pcap_file_list);
     SCMutexInit(&copy->plog_lock, NULL);
@@ -487,6 +806,18 @@ static TmEcode PcapLogDataInit(ThreadVars *t, void *initdata, void **data)
         td->pcap_log = pl;
     BUG_ON(td->pcap_log == NULL);
 
+    /* the ring is per thread in all modes */
+    if (pl->ring_size > 0) {
+        td->ring = PcapLogRingNew(pl->ring_size, pl->ring_max_age,
+                pl->ring_hugepages);
+        if (td->ring == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "pcap-log: failed to allocate "
+                    "a packet ring of %"PRIu64" bytes", pl->ring_size);
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     PcapLogLock(td->pcap_log);
 
     /** Use the Ouptut Context (file pointer and mutex) */
@@ -558,6 +889,18 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
             SCLogDebug("PcapLogCloseFile failed");
         }
     }
+    if (td->ring != NULL) {
+        SCLogInfo("pcap-log: %"PRIu64" packets written from the packet "
+                "ring", td->ring->dumped_pkts);
+        PcapLogRingFree(td->ring);
+        td->ring = NULL;
+    }
+
+    /* the buffer of the shared ctx is freed with the output ctx */
+    if (pl->is_private && pl->buffer != NULL) {
+        SCFreeAligned(pl->buffer);
+        pl->buffer = NULL;
+    }
 
     if (pl->mode == LOGMODE_MULTI) {
         SCMutexLock(&g_pcap_data->plog_lock);
@@ -688,6 +1031,7 @@ static OutputCtx *PcapLogInitCtx(ConfNode *conf)
     pl->timestamp_format = TS_FORMAT_SEC;
     pl->use_stream_depth = USE_STREAM_DEPTH_DISABLED;
     pl->honor_pass_rules = HONOR_PASS_RULES_DISABLED;
+    pl->log_coalesced = 1;
 
     TAILQ_INIT(&pl->pcap_file_list);
 
@@ -853,6 +1197,71 @@ static OutputCtx *PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    pl->buffer_size = DEFAULT_BUFFER_SIZE;
+    const char *buffer_size = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        buffer_size = ConfNodeLookupChildValue(conf, "buffer-size");
+    }
+    if (buffer_size != NULL) {
+        if (ParseSizeStringU32(buffer_size, &pl->buffer_size) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap buffer-size specified %s is invalid", buffer_size);
+            exit(EXIT_FAILURE);
+        }
+        /* BUFFER_ALIGN multiples so writes stay aligned */
+        pl->buffer_size -= pl->buffer_size % BUFFER_ALIGN;
+    }
+
+    const char *conditional = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        conditional = ConfNodeLookupChildValue(conf, "conditional");
+    }
+    if (conditional != NULL) {
+        if (strcasecmp(conditional, "alerts") == 0) {
+            pl->conditional = LOGMODE_COND_ALERTS;
+        } else if (strcasecmp(conditional, "tag") == 0) {
+            pl->conditional = LOGMODE_COND_TAG;
+        } else if (strcasecmp(conditional, "all") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap conditional specified %s is invalid must be"
+                " \"all\", \"alerts\" or \"tag\"", conditional);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ConfNode *ring = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        ring = ConfNodeLookupChild(conf, "ring");
+    }
+    if (ring != NULL) {
+        const char *ring_size = ConfNodeLookupChildValue(ring, "size");
+        if (ring_size != NULL &&
+            ParseSizeStringU64(ring_size, &pl->ring_size) < 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap ring size specified %s is invalid", ring_size);
+            exit(EXIT_FAILURE);
+        }
+        if (pl->ring_size > 0 && pl->ring_size < RING_MIN_SIZE) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap ring size less than allowed minimum.");
+            exit(EXIT_FAILURE);
+        }
+        intmax_t max_age = 0;
+        if (ConfGetChildValueInt(ring, "max-age", &max_age) && max_age > 0)
+            pl->ring_max_age = (uint32_t)max_age;
+        (void)ConfGetChildValueBool(ring, "hugepages", &pl->ring_hugepages);
+
+        if (pl->ring_size > 0 && pl->conditional == LOGMODE_COND_ALL) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "log-pcap ring is only "
+                    "used with conditional logging, disabling it");
+            pl->ring_size = 0;
+        }
+        if (pl->ring_size > 0) {
+            SCLogInfo("pcap-log: per thread packet ring of %"PRIu64" bytes",
+                    pl->ring_size);
+        }
+    }
+
     const char *honor_pass_rules = NULL;
     if (conf != NULL) { /* To faciliate unit tests. */
         honor_pass_rules = ConfNodeLookupChildValue(conf, "honor-pass-rules");
@@ -869,6 +1278,22 @@ static OutputCtx *PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    const char *coalesced = NULL;
+    if (conf != NULL) { /* To faciliate unit tests. */
+        coalesced = ConfNodeLookupChildValue(conf, "coalesced");
+    }
+    if (coalesced != NULL) {
+        if (ConfValIsFalse(coalesced)) {
+            pl->log_coalesced = 0;
+        } else if (ConfValIsTrue(coalesced)) {
+            pl->log_coalesced = 1;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                "log-pcap coalesced specified is invalid");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* create the output ctx and send it back */
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
@@ -895,6 +1320,11 @@ static void PcapLogFileDeInitCtx(OutputCtx *output_ctx)
         SCLogDebug("PCAP files left at exit: %s\n", pf->filename);
     }
 
+    if (pl->buffer != NULL) {
+        SCFreeAligned(pl->buffer);
+        pl->buffer = NULL;
+    }
+
     return;
 }
 
@@ -1195,3 +1625,102 @@ void PcapLogProfileSetup(void)
         }
     }
 }
+
+/*
+ * ONLY TESTS BELOW THIS COMMENT
+ */
+
+#ifdef UNITTESTS
+/** \test flow lookup, order and dump once */
+static int PcapLogRingTest01(void)
+{
+    int result = 0;
+    int flows[3];
+    uint8_t data[100];
+    struct timeval ts = { 1000, 0 };
+    uint32_t i;
+
+    PcapLogRing *r = PcapLogRingNew(RING_MIN_SIZE, 0, 0);
+    if (r == NULL)
+        return 0;
+
+    for (i = 0; i < 30; i++) {
+        memset(data, i, sizeof(data));
+        /* flow 0 and 1 share a bucket */
+        PcapLogRingAdd(r, &flows[i % 3], (i % 3 == 2) ? 2 : 1, &ts,
+                data, 10 + i);
+    }
+
+    uint32_t cnt = PcapLogRingCollect(r, &flows[1], 1, &ts);
+    if (cnt != 10)
+        goto end;
+    for (i = 0; i < cnt; i++) {
+        PcapLogRingEntry *e = (PcapLogRingEntry *)(r->buf + r->dump[i]);
+        uint8_t *d = (uint8_t *)e + sizeof(*e);
+        if (e->len != 10 + (i * 3 + 1) || d[0] != i * 3 + 1)
+            goto end;
+    }
+    /* only once */
+    if (PcapLogRingCollect(r, &flows[1], 1, &ts) != 0)
+        goto end;
+    if (PcapLogRingCollect(r, &flows[0], 1, &ts) != 10)
+        goto end;
+    if (PcapLogRingCollect(r, &flows[2], 2, &ts) != 10)
+        goto end;
+
+    result = 1;
+end:
+    PcapLogRingFree(r);
+    return result;
+}
+
+/** \test wrapping drops the oldest packets, max age */
+static int PcapLogRingTest02(void)
+{
+    int result = 0;
+    int flow;
+    static uint8_t data[60000];
+    struct timeval ts = { 1000, 0 };
+    uint32_t i;
+
+    PcapLogRing *r = PcapLogRingNew(RING_MIN_SIZE, 10, 0);
+    if (r == NULL)
+        return 0;
+
+    /* ~60k entries, 1mb ring: only the last 17 fit */
+    for (i = 0; i < 100; i++) {
+        data[0] = (uint8_t)i;
+        ts.tv_sec = 1000 + i;
+        PcapLogRingAdd(r, &flow, 7, &ts, data, sizeof(data));
+    }
+    if (r->cnt != 17)
+        goto end;
+
+    /* with a max age of 10s at now 1099 the packets since 1089 remain */
+    uint32_t cnt = PcapLogRingCollect(r, &flow, 7, &ts);
+    if (cnt != 11)
+        goto end;
+    PcapLogRingEntry *e = (PcapLogRingEntry *)(r->buf + r->dump[0]);
+    if (e->ts.tv_sec != 1089 || ((uint8_t *)e + sizeof(*e))[0] != 89)
+        goto end;
+
+    /* entries larger than the ring are ignored */
+    static uint8_t big[RING_MIN_SIZE];
+    PcapLogRingAdd(r, &flow, 7, &ts, big, sizeof(big));
+    if (r->cnt != 17)
+        goto end;
+
+    result = 1;
+end:
+    PcapLogRingFree(r);
+    return result;
+}
+#endif /* UNITTESTS */
+
+static void PcapLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapLogRingTest01", PcapLogRingTest01);
+    UtRegisterTest("PcapLogRingTest02", PcapLogRingTest02);
+#endif /* UNITTESTS */
+}
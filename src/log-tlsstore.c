@@ -44,6 +44,7 @@
 #include "output.h"
 #include "log-tlslog.h"
 #include "app-layer-ssl.h"
+#include "app-layer-tls-handshake.h"
 #include "app-layer.h"
 #include "app-layer-parser.h"
 #include "util-privs.h"
@@ -58,6 +59,8 @@
 static char tls_logfile_base_dir[PATH_MAX] = "/tmp";
 SC_ATOMIC_DECLARE(unsigned int, cert_id);
 static char logging_dir_not_writable;
+/** size of the per thread cache of stored certificates, 0 to store all */
+static uint32_t tls_store_seen_size = 0;
 
 #define LOGGING_WRITE_ISSUE_LIMIT 6
 
@@ -66,6 +69,10 @@ typedef struct LogTlsStoreLogThread_ {
 
     uint8_t*   enc_buf;
     size_t     enc_buf_len;
+
+    /** certificates stored before by this thread, if skip-seen is on */
+    TlsCertCache *seen;
+    uint32_t   seen_cnt;
 } LogTlsStoreLogThread;
 
 static int CreateFileName(const Packet *p, SSLState *state, char *filename)
@@ -107,6 +114,14 @@ static void LogTlsLogPem(LogTlsStoreLogThread *aft, const Packet *p, SSLState *s
     if ((state->server_connp.cert_input == NULL) || (state->server_connp.cert_input_len == 0))
         SCReturn;
 
+    if (aft->seen != NULL && TlsCertCacheLookup(aft->seen,
+                state->server_connp.cert_input,
+                state->server_connp.cert_input_len) != NULL) {
+        aft->seen_cnt++;
+        state->server_connp.cert_log_flag &= ~SSL_TLS_LOG_PEM;
+        SCReturn;
+    }
+
     CreateFileName(p, state, filename);
     if (strlen(filename) == 0) {
         SCLogWarning(SC_ERR_FOPEN, "Can't create PEM filename");
@@ -217,6 +232,11 @@ static void LogTlsLogPem(LogTlsStoreLogThread *aft, const Packet *p, SSLState *s
         SCReturn;
     }
 
+    if (aft->seen != NULL) {
+        (void)TlsCertCacheAdd(aft->seen, state->server_connp.cert_input,
+                state->server_connp.cert_input_len, NULL, NULL);
+    }
+
     /* Reset the store flag */
     state->server_connp.cert_log_flag &= ~SSL_TLS_LOG_PEM;
     SCReturn;
@@ -306,6 +326,14 @@ static TmEcode LogTlsStoreLogThreadInit(ThreadVars *t, void *initdata, void **da
         return TM_ECODE_FAILED;
     }
 
+    if (tls_store_seen_size > 0) {
+        aft->seen = TlsCertCacheAlloc(tls_store_seen_size);
+        if (aft->seen == NULL) {
+            SCFree(aft);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     struct stat stat_buf;
     if (stat(tls_logfile_base_dir, &stat_buf) != 0) {
         int ret;
@@ -336,6 +364,8 @@ static TmEcode LogTlsStoreLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    TlsCertCacheFree(aft->seen);
+
     /* clear memory */
     memset(aft, 0, sizeof(LogTlsStoreLogThread));
 
@@ -351,6 +381,10 @@ static void LogTlsStoreLogExitPrintStats(ThreadVars *tv, void *data)
     }
 
     SCLogInfo("(%s) certificates extracted %" PRIu32 "", tv->name, aft->tls_cnt);
+    if (aft->seen != NULL) {
+        SCLogInfo("(%s) certificates skipped as stored before %" PRIu32 "",
+                tv->name, aft->seen_cnt);
+    }
 }
 
 /**
@@ -400,6 +434,16 @@ static OutputCtx *LogTlsStoreLogInitCtx(ConfNode *conf)
 
     SCLogInfo("storing certs in %s", tls_logfile_base_dir);
 
+    /* don't store a chain again if this thread stored it before */
+    tls_store_seen_size = 0;
+    if (ConfNodeChildValueIsTrue(conf, "skip-seen")) {
+        tls_store_seen_size = TlsCertCacheGetSize();
+        if (tls_store_seen_size == 0)
+            tls_store_seen_size = TLS_CERT_CACHE_DEFAULT_SIZE;
+        SCLogInfo("not storing certs seen in the last %u stored",
+                tls_store_seen_size);
+    }
+
     /* enable the logger for the app layer */
     AppLayerParserRegisterLogger(IPPROTO_TCP, ALPROTO_TLS);
 
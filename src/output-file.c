@@ -40,6 +40,7 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    MagicThreadCtx *magic;  /**< for force-magic lookups */
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -140,7 +141,10 @@ static TmEcode OutputFileLog(ThreadVars *tv, Packet *p, void *thread_data, Packe
                 int file_logged = 0;
 
                 if (FileForceMagic() && ff->magic == NULL) {
-                    FilemagicGlobalLookup(ff);
+                    if (op_thread_data->magic != NULL)
+                        FilemagicThreadLookup(op_thread_data->magic, ff);
+                    else
+                        FilemagicGlobalLookup(ff);
                 }
 
                 logger = list;
@@ -186,6 +190,11 @@ static TmEcode OutputFileLogThreadInit(ThreadVars *tv, void *initdata, void **da
 
     *data = (void *)td;
 
+    /* no shared libmagic lock on the logging path, the global context
+     * is the fallback if this fails */
+    if (FileForceMagic())
+        td->magic = MagicThreadCtxInit();
+
     SCLogDebug("OutputFileLogThreadInit happy (*data %p)", *data);
 
     OutputFileLogger *logger = list;
@@ -250,6 +259,7 @@ static TmEcode OutputFileLogThreadDeinit(ThreadVars *tv, void *thread_data)
         logger = logger->next;
     }
 
+    MagicThreadCtxFree(op_thread_data->magic);
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
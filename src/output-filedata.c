@@ -41,6 +41,7 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    MagicThreadCtx *magic;  /**< for force-magic lookups */
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -157,7 +158,10 @@ static TmEcode OutputFiledataLog(ThreadVars *tv, Packet *p, void *thread_data, P
         File *ff;
         for (ff = ffc->head; ff != NULL; ff = ff->next) {
             if (FileForceMagic() && ff->magic == NULL) {
-                FilemagicGlobalLookup(ff);
+                if (op_thread_data->magic != NULL)
+                    FilemagicThreadLookup(op_thread_data->magic, ff);
+                else
+                    FilemagicGlobalLookup(ff);
             }
 
             SCLogDebug("ff %p", ff);
@@ -201,23 +205,34 @@ static TmEcode OutputFiledataLog(ThreadVars *tv, Packet *p, void *thread_data, P
             if (ff->state >= FILE_STATE_CLOSED)
                 flags |= OUTPUT_FILEDATA_FLAG_CLOSE;
 
-            /* do the actual logging */
+            /* do the actual logging. If the file buffer is made of
+             * blocks the data is passed on a block at a time, with the
+             * close flag only set for the last part. */
+            const uint64_t file_size = FileSize(ff);
             const uint8_t *data = NULL;
             uint32_t data_len = 0;
-
-            StreamingBufferGetDataAtOffset(ff->sb,
-                    &data, &data_len,
-                    ff->content_stored);
-
-            int file_logged = CallLoggers(tv, store, p, ff, data, data_len, flags);
-            if (file_logged) {
+            uint8_t part_flags;
+            int file_logged;
+            do {
+                StreamingBufferGetBlockAtOffset(ff->sb,
+                        &data, &data_len,
+                        ff->content_stored);
+
+                part_flags = flags;
+                if (data_len > 0 && ff->content_stored + data_len < file_size)
+                    part_flags &= ~OUTPUT_FILEDATA_FLAG_CLOSE;
+
+                file_logged = CallLoggers(tv, store, p, ff, data, data_len, part_flags);
+                if (!file_logged)
+                    break;
                 ff->content_stored += data_len;
+                flags &= ~OUTPUT_FILEDATA_FLAG_OPEN;
+            } while (data_len > 0 && ff->content_stored < file_size);
 
-                /* all done */
-                if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
-                    ff->flags |= FILE_STORED;
-                    break;
-                }
+            /* all done */
+            if (file_logged && (part_flags & OUTPUT_FILEDATA_FLAG_CLOSE)) {
+                ff->flags |= FILE_STORED;
+                break;
             }
         }
 
@@ -295,6 +310,11 @@ static TmEcode OutputFiledataLogThreadInit(ThreadVars *tv, void *initdata, void
 
     *data = (void *)td;
 
+    /* no shared libmagic lock on the logging path, the global context
+     * is the fallback if this fails */
+    if (FileForceMagic())
+        td->magic = MagicThreadCtxInit();
+
     SCLogDebug("OutputFiledataLogThreadInit happy (*data %p)", *data);
 
     OutputFiledataLogger *logger = list;
@@ -418,6 +438,7 @@ static TmEcode OutputFiledataLogThreadDeinit(ThreadVars *tv, void *thread_data)
     }
     SCMutexUnlock(&g_waldo_mutex);
 
+    MagicThreadCtxFree(op_thread_data->magic);
     SCFree(op_thread_data);
     return TM_ECODE_OK;
 }
@@ -0,0 +1,1073 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Output filter expressions, see output-filter.h for the syntax.
+ *
+ * The expression is parsed into a tree of and/or/not nodes with the terms
+ * as leaves. A term has its field's getter, which reads the value straight
+ * from the tx or flow, and values converted for the field at compile time:
+ * lowercased strings, numbers, and sorted lists for a binary search.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "conf-yaml-loader.h"
+#include "debug.h"
+#include "flow.h"
+#include "app-layer-protos.h"
+#include "app-layer-htp.h"
+#include "app-layer-dns-common.h"
+#include "app-layer-ssl.h"
+#include "output-filter.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#define OUTPUT_FILTER_TOKEN_MAX 256
+
+typedef enum {
+    OUTPUT_FILTER_INT,
+    OUTPUT_FILTER_STRING,
+} OutputFilterType;
+
+typedef struct OutputFilterValue_ {
+    uint64_t num;
+    const uint8_t *str;
+    uint32_t str_len;
+} OutputFilterValue;
+
+typedef struct OutputFilterField_ {
+    const char *name;
+    AppProto alproto;           /**< ALPROTO_UNKNOWN for flow fields */
+    OutputFilterType type;
+    /** get the value, returns 0 if the record doesn't have it */
+    int (*Get)(const Flow *f, void *tx, OutputFilterValue *v);
+    /** parse a name for a number, like a dns record type, or NULL */
+    int (*ParseName)(const char *name, uint64_t *num);
+} OutputFilterField;
+
+enum {
+    OUTPUT_FILTER_NODE_AND,
+    OUTPUT_FILTER_NODE_OR,
+    OUTPUT_FILTER_NODE_NOT,
+    OUTPUT_FILTER_NODE_TERM,
+};
+
+enum {
+    OUTPUT_FILTER_OP_EQ,
+    OUTPUT_FILTER_OP_NE,
+    OUTPUT_FILTER_OP_LT,
+    OUTPUT_FILTER_OP_LE,
+    OUTPUT_FILTER_OP_GT,
+    OUTPUT_FILTER_OP_GE,
+    OUTPUT_FILTER_OP_IN,
+};
+
+typedef struct OutputFilterString_ {
+    uint8_t *str;           /**< lowercase */
+    uint32_t len;
+} OutputFilterString;
+
+typedef struct OutputFilterNode_ {
+    int type;
+    int op;
+    struct OutputFilterNode_ *left;     /**< only one for NOT */
+    struct OutputFilterNode_ *right;
+    const OutputFilterField *field;
+    /* value, or the sorted ones of an 'in' list */
+    uint64_t num;
+    OutputFilterString str;
+    uint64_t *nums;
+    OutputFilterString *strs;
+    uint32_t cnt;
+} OutputFilterNode;
+
+struct OutputFilter_ {
+    OutputFilterNode *root;
+    AppProto alproto;
+};
+
+/* field getters */
+
+static int FilterSetBstr(bstr *b, OutputFilterValue *v)
+{
+    if (b == NULL)
+        return 0;
+    v->str = bstr_ptr(b);
+    v->str_len = (uint32_t)bstr_len(b);
+    return 1;
+}
+
+static int FilterSetString(const char *s, OutputFilterValue *v)
+{
+    if (s == NULL)
+        return 0;
+    v->str = (const uint8_t *)s;
+    v->str_len = (uint32_t)strlen(s);
+    return 1;
+}
+
+static int FilterGetFlowBytes(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = f->todstbytecnt + f->tosrcbytecnt;
+    return 1;
+}
+
+static int FilterGetFlowBytesToServer(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = f->todstbytecnt;
+    return 1;
+}
+
+static int FilterGetFlowBytesToClient(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = f->tosrcbytecnt;
+    return 1;
+}
+
+static int FilterGetFlowPkts(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = (uint64_t)f->todstpktcnt + f->tosrcpktcnt;
+    return 1;
+}
+
+static int FilterGetFlowAge(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = (f->lastts.tv_sec > f->startts.tv_sec) ?
+        (uint64_t)(f->lastts.tv_sec - f->startts.tv_sec) : 0;
+    return 1;
+}
+
+static int FilterGetFlowDp(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = f->dp;
+    return 1;
+}
+
+static int FilterGetFlowAppProto(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    if (f->alproto == ALPROTO_UNKNOWN)
+        return 0;
+    return FilterSetString(AppProtoToString(f->alproto), v);
+}
+
+static int FilterGetHttpHostname(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetBstr(((htp_tx_t *)tx)->request_hostname, v);
+}
+
+static int FilterGetHttpUrl(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetBstr(((htp_tx_t *)tx)->request_uri, v);
+}
+
+static int FilterGetHttpMethod(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetBstr(((htp_tx_t *)tx)->request_method, v);
+}
+
+static int FilterGetHttpStatus(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    int status = ((htp_tx_t *)tx)->response_status_number;
+    if (status <= 0)
+        return 0;
+    v->num = (uint64_t)status;
+    return 1;
+}
+
+static int FilterGetHttpUserAgent(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    htp_tx_t *htx = tx;
+    if (htx->request_headers == NULL)
+        return 0;
+    htp_header_t *h = htp_table_get_c(htx->request_headers, "user-agent");
+    return (h != NULL) ? FilterSetBstr(h->value, v) : 0;
+}
+
+static int FilterGetHttpContentType(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    htp_tx_t *htx = tx;
+    if (htx->response_headers == NULL)
+        return 0;
+    htp_header_t *h = htp_table_get_c(htx->response_headers, "content-type");
+    return (h != NULL) ? FilterSetBstr(h->value, v) : 0;
+}
+
+static int FilterGetDnsRrname(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    DNSQueryEntry *query = TAILQ_FIRST(&((DNSTransaction *)tx)->query_list);
+    if (query == NULL)
+        return 0;
+    v->str = (const uint8_t *)query + sizeof(DNSQueryEntry);
+    v->str_len = query->len;
+    return 1;
+}
+
+static int FilterGetDnsRrtype(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    DNSQueryEntry *query = TAILQ_FIRST(&((DNSTransaction *)tx)->query_list);
+    if (query == NULL)
+        return 0;
+    v->num = query->type;
+    return 1;
+}
+
+static int FilterGetDnsRcode(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    DNSTransaction *dns_tx = tx;
+    if (!dns_tx->replied)
+        return 0;
+    v->num = dns_tx->rcode;
+    return 1;
+}
+
+/* the tls 'tx' is the state */
+static int FilterGetTlsSni(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetString(((SSLState *)tx)->client_connp.sni, v);
+}
+
+static int FilterGetTlsSubject(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetString(((SSLState *)tx)->server_connp.cert0_subject, v);
+}
+
+static int FilterGetTlsIssuer(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    return FilterSetString(((SSLState *)tx)->server_connp.cert0_issuerdn, v);
+}
+
+/* names for numbers */
+
+static int FilterParseIpProto(const char *name, uint64_t *num)
+{
+    if (strcasecmp(name, "tcp") == 0)
+        *num = IPPROTO_TCP;
+    else if (strcasecmp(name, "udp") == 0)
+        *num = IPPROTO_UDP;
+    else if (strcasecmp(name, "icmp") == 0)
+        *num = IPPROTO_ICMP;
+    else if (strcasecmp(name, "sctp") == 0)
+        *num = IPPROTO_SCTP;
+    else
+        return -1;
+    return 0;
+}
+
+static int FilterGetFlowProto(const Flow *f, void *tx, OutputFilterValue *v)
+{
+    v->num = f->proto;
+    return 1;
+}
+
+static int FilterParseDnsRrtype(const char *name, uint64_t *num)
+{
+    char str[16];
+    uint32_t type;
+    for (type = 0; type <= UINT16_MAX; type++) {
+        DNSCreateTypeString((uint16_t)type, str, sizeof(str));
+        if (strcasecmp(name, str) == 0) {
+            *num = type;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int FilterParseDnsRcode(const char *name, uint64_t *num)
+{
+    char str[32];
+    uint32_t rcode;
+    for (rcode = 0; rcode <= UINT8_MAX; rcode++) {
+        DNSCreateRcodeString((uint8_t)rcode, str, sizeof(str));
+        if (strcasecmp(name, str) == 0) {
+            *num = rcode;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const OutputFilterField output_filter_fields[] = {
+    { "flow.bytes", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowBytes, NULL },
+    { "flow.bytes_toserver", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowBytesToServer, NULL },
+    { "flow.bytes_toclient", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowBytesToClient, NULL },
+    { "flow.pkts", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowPkts, NULL },
+    { "flow.age", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowAge, NULL },
+    { "flow.dest_port", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowDp, NULL },
+    { "flow.proto", ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, FilterGetFlowProto, FilterParseIpProto },
+    { "flow.app_proto", ALPROTO_UNKNOWN, OUTPUT_FILTER_STRING, FilterGetFlowAppProto, NULL },
+    { "http.hostname", ALPROTO_HTTP, OUTPUT_FILTER_STRING, FilterGetHttpHostname, NULL },
+    { "http.url", ALPROTO_HTTP, OUTPUT_FILTER_STRING, FilterGetHttpUrl, NULL },
+    { "http.method", ALPROTO_HTTP, OUTPUT_FILTER_STRING, FilterGetHttpMethod, NULL },
+    { "http.status", ALPROTO_HTTP, OUTPUT_FILTER_INT, FilterGetHttpStatus, NULL },
+    { "http.user_agent", ALPROTO_HTTP, OUTPUT_FILTER_STRING, FilterGetHttpUserAgent, NULL },
+    { "http.content_type", ALPROTO_HTTP, OUTPUT_FILTER_STRING, FilterGetHttpContentType, NULL },
+    { "dns.rrname", ALPROTO_DNS, OUTPUT_FILTER_STRING, FilterGetDnsRrname, NULL },
+    { "dns.rrtype", ALPROTO_DNS, OUTPUT_FILTER_INT, FilterGetDnsRrtype, FilterParseDnsRrtype },
+    { "dns.rcode", ALPROTO_DNS, OUTPUT_FILTER_INT, FilterGetDnsRcode, FilterParseDnsRcode },
+    { "tls.sni", ALPROTO_TLS, OUTPUT_FILTER_STRING, FilterGetTlsSni, NULL },
+    { "tls.subject", ALPROTO_TLS, OUTPUT_FILTER_STRING, FilterGetTlsSubject, NULL },
+    { "tls.issuerdn", ALPROTO_TLS, OUTPUT_FILTER_STRING, FilterGetTlsIssuer, NULL },
+    { NULL, ALPROTO_UNKNOWN, OUTPUT_FILTER_INT, NULL, NULL },
+};
+
+/* evaluation */
+
+/** \internal \brief compare a value to a lowercase string, without case */
+static int FilterStrCmp(const uint8_t *s, uint32_t len, const OutputFilterString *l)
+{
+    uint32_t n = (len < l->len) ? len : l->len;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        int c = u8_tolower(s[i]);
+        if (c != l->str[i])
+            return c - l->str[i];
+    }
+    if (len == l->len)
+        return 0;
+    return (len < l->len) ? -1 : 1;
+}
+
+static int FilterInStrings(const OutputFilterNode *n, const OutputFilterValue *v)
+{
+    uint32_t lo = 0, hi = n->cnt;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int r = FilterStrCmp(v->str, v->str_len, &n->strs[mid]);
+        if (r == 0)
+            return 1;
+        if (r < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return 0;
+}
+
+static int FilterInNums(const OutputFilterNode *n, uint64_t num)
+{
+    uint32_t lo = 0, hi = n->cnt;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (n->nums[mid] == num)
+            return 1;
+        if (num < n->nums[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return 0;
+}
+
+static int FilterEvalTerm(const OutputFilterNode *n, const Flow *f, void *tx)
+{
+    OutputFilterValue v = { 0, NULL, 0 };
+    if (n->field->Get(f, tx, &v) == 0)
+        return 0;
+
+    if (n->field->type == OUTPUT_FILTER_STRING) {
+        switch (n->op) {
+            case OUTPUT_FILTER_OP_EQ:
+                return FilterStrCmp(v.str, v.str_len, &n->str) == 0;
+            case OUTPUT_FILTER_OP_NE:
+                return FilterStrCmp(v.str, v.str_len, &n->str) != 0;
+            case OUTPUT_FILTER_OP_IN:
+                return FilterInStrings(n, &v);
+        }
+        return 0;
+    }
+
+    switch (n->op) {
+        case OUTPUT_FILTER_OP_EQ:
+            return v.num == n->num;
+        case OUTPUT_FILTER_OP_NE:
+            return v.num != n->num;
+        case OUTPUT_FILTER_OP_LT:
+            return v.num < n->num;
+        case OUTPUT_FILTER_OP_LE:
+            return v.num <= n->num;
+        case OUTPUT_FILTER_OP_GT:
+            return v.num > n->num;
+        case OUTPUT_FILTER_OP_GE:
+            return v.num >= n->num;
+        case OUTPUT_FILTER_OP_IN:
+            return FilterInNums(n, v.num);
+    }
+    return 0;
+}
+
+static int FilterEval(const OutputFilterNode *n, const Flow *f, void *tx)
+{
+    switch (n->type) {
+        case OUTPUT_FILTER_NODE_AND:
+            return FilterEval(n->left, f, tx) && FilterEval(n->right, f, tx);
+        case OUTPUT_FILTER_NODE_OR:
+            return FilterEval(n->left, f, tx) || FilterEval(n->right, f, tx);
+        case OUTPUT_FILTER_NODE_NOT:
+            return !FilterEval(n->left, f, tx);
+        default:
+            return FilterEvalTerm(n, f, tx);
+    }
+}
+
+/**
+ *  \brief check if a record passes the filter
+ *
+ *  \param f flow, locked
+ *  \param tx tx of the filter's protocol, NULL for flow filters
+ *
+ *  \retval 1 log the record
+ *  \retval 0 drop it
+ */
+int OutputFilterMatch(const OutputFilter *filter, const Flow *f, void *tx)
+{
+    return FilterEval(filter->root, f, tx);
+}
+
+/* compiling */
+
+enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_STRING,
+    TOKEN_LIST,         /**< @name */
+    TOKEN_OP,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_LBRACKET,
+    TOKEN_RBRACKET,
+    TOKEN_COMMA,
+    TOKEN_ERROR,
+};
+
+typedef struct OutputFilterParser_ {
+    const char *expr;
+    const char *s;
+    int token;
+    char val[OUTPUT_FILTER_TOKEN_MAX];
+    AppProto alproto;
+} OutputFilterParser;
+
+static int FilterWordChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '.' || c == '_' || c == '-' ||
+        c == ':' || c == '/' || c == '*';
+}
+
+static int FilterNextToken(OutputFilterParser *p)
+{
+    size_t len = 0;
+
+    while (*p->s == ' ' || *p->s == '\t' || *p->s == '\n')
+        p->s++;
+    p->val[0] = '\0';
+
+    char c = *p->s;
+    if (c == '\0')
+        return (p->token = TOKEN_END);
+
+    p->s++;
+    switch (c) {
+        case '(':
+            return (p->token = TOKEN_LPAREN);
+        case ')':
+            return (p->token = TOKEN_RPAREN);
+        case '[':
+            return (p->token = TOKEN_LBRACKET);
+        case ']':
+            return (p->token = TOKEN_RBRACKET);
+        case ',':
+            return (p->token = TOKEN_COMMA);
+        case '=': case '!': case '<': case '>':
+            p->val[len++] = c;
+            if (*p->s == '=')
+                p->val[len++] = *p->s++;
+            p->val[len] = '\0';
+            return (p->token = TOKEN_OP);
+        case '"':
+            while (*p->s != '"') {
+                if (*p->s == '\0' || len + 1 >= sizeof(p->val))
+                    return (p->token = TOKEN_ERROR);
+                p->val[len++] = *p->s++;
+            }
+            p->s++;
+            p->val[len] = '\0';
+            return (p->token = TOKEN_STRING);
+        case '@':
+            while (FilterWordChar(*p->s)) {
+                if (len + 1 >= sizeof(p->val))
+                    return (p->token = TOKEN_ERROR);
+                p->val[len++] = *p->s++;
+            }
+            p->val[len] = '\0';
+            return (p->token = (len > 0) ? TOKEN_LIST : TOKEN_ERROR);
+    }
+
+    if (!FilterWordChar(c))
+        return (p->token = TOKEN_ERROR);
+    p->val[len++] = c;
+    while (FilterWordChar(*p->s)) {
+        if (len + 1 >= sizeof(p->val))
+            return (p->token = TOKEN_ERROR);
+        p->val[len++] = *p->s++;
+    }
+    p->val[len] = '\0';
+    return (p->token = TOKEN_WORD);
+}
+
+static int FilterIsKeyword(const OutputFilterParser *p, const char *kw)
+{
+    return p->token == TOKEN_WORD && strcasecmp(p->val, kw) == 0;
+}
+
+static void FilterError(const OutputFilterParser *p, const char *msg)
+{
+    SCLogError(SC_ERR_INVALID_ARGUMENT, "output filter \"%s\": %s at "
+            "offset %u", p->expr, msg, (uint32_t)(p->s - p->expr));
+}
+
+static void FilterNodeFree(OutputFilterNode *n)
+{
+    if (n == NULL)
+        return;
+    FilterNodeFree(n->left);
+    FilterNodeFree(n->right);
+    if (n->str.str != NULL)
+        SCFree(n->str.str);
+    if (n->strs != NULL) {
+        uint32_t i;
+        for (i = 0; i < n->cnt; i++)
+            SCFree(n->strs[i].str);
+        SCFree(n->strs);
+    }
+    if (n->nums != NULL)
+        SCFree(n->nums);
+    SCFree(n);
+}
+
+static OutputFilterNode *FilterNodeNew(int type)
+{
+    OutputFilterNode *n = SCCalloc(1, sizeof(*n));
+    if (unlikely(n == NULL))
+        return NULL;
+    n->type = type;
+    return n;
+}
+
+/** \internal \brief parse a number with an optional k, m or g suffix */
+static int FilterParseNumber(const char *str, uint64_t *num)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(str, &end, 0);
+    if (errno != 0 || end == str || *str == '-')
+        return -1;
+
+    uint64_t mult = 1;
+    switch (*end) {
+        case '\0':
+            break;
+        case 'k': case 'K':
+            mult = 1024ULL;
+            end++;
+            break;
+        case 'm': case 'M':
+            mult = 1024ULL * 1024;
+            end++;
+            break;
+        case 'g': case 'G':
+            mult = 1024ULL * 1024 * 1024;
+            end++;
+            break;
+        default:
+            return -1;
+    }
+    if (*end != '\0' || (v != 0 && (uint64_t)v > UINT64_MAX / mult))
+        return -1;
+    *num = (uint64_t)v * mult;
+    return 0;
+}
+
+/** \internal \brief convert a value string for the field of term 'n' */
+static int FilterValue(const OutputFilterNode *n, const char *val,
+        uint64_t *num, OutputFilterString *str)
+{
+    if (n->field->type == OUTPUT_FILTER_STRING) {
+        size_t len = strlen(val);
+        str->str = SCMalloc(len + 1);
+        if (unlikely(str->str == NULL))
+            return -1;
+        size_t i;
+        for (i = 0; i < len; i++)
+            str->str[i] = u8_tolower((uint8_t)val[i]);
+        str->str[len] = '\0';
+        str->len = (uint32_t)len;
+        return 0;
+    }
+
+    if (FilterParseNumber(val, num) == 0)
+        return 0;
+    if (n->field->ParseName != NULL && n->field->ParseName(val, num) == 0)
+        return 0;
+    SCLogError(SC_ERR_INVALID_ARGUMENT, "output filter: \"%s\" is not a "
+            "valid value for %s", val, n->field->name);
+    return -1;
+}
+
+static int FilterCompareNums(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int FilterCompareStrings(const void *a, const void *b)
+{
+    const OutputFilterString *x = a;
+    return FilterStrCmp(x->str, x->len, (const OutputFilterString *)b);
+}
+
+/** \internal \brief add a value to the 'in' list of term 'n' */
+static int FilterListAdd(OutputFilterNode *n, const char *val)
+{
+    if (n->field->type == OUTPUT_FILTER_STRING) {
+        OutputFilterString *strs = SCRealloc(n->strs, (n->cnt + 1) * sizeof(*strs));
+        if (unlikely(strs == NULL))
+            return -1;
+        n->strs = strs;
+        if (FilterValue(n, val, NULL, &n->strs[n->cnt]) != 0)
+            return -1;
+    } else {
+        uint64_t *nums = SCRealloc(n->nums, (n->cnt + 1) * sizeof(*nums));
+        if (unlikely(nums == NULL))
+            return -1;
+        n->nums = nums;
+        if (FilterValue(n, val, &n->nums[n->cnt], NULL) != 0)
+            return -1;
+    }
+    n->cnt++;
+    return 0;
+}
+
+/** \internal \brief add the values of the 'filter-lists.<name>' sequence */
+static int FilterListAddConf(OutputFilterParser *p, OutputFilterNode *n)
+{
+    char name[OUTPUT_FILTER_TOKEN_MAX + 16];
+    snprintf(name, sizeof(name), "filter-lists.%s", p->val);
+    ConfNode *list = ConfGetNode(name);
+    if (list == NULL || !list->is_seq) {
+        FilterError(p, "no such list");
+        return -1;
+    }
+
+    ConfNode *item;
+    TAILQ_FOREACH(item, &list->head, next) {
+        if (item->val == NULL)
+            continue;
+        if (FilterListAdd(n, item->val) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int FilterParseList(OutputFilterParser *p, OutputFilterNode *n)
+{
+    if (p->token == TOKEN_LIST) {
+        if (FilterListAddConf(p, n) != 0)
+            return -1;
+        FilterNextToken(p);
+    } else if (p->token == TOKEN_LBRACKET) {
+        FilterNextToken(p);
+        while (p->token == TOKEN_WORD || p->token == TOKEN_STRING) {
+            if (FilterListAdd(n, p->val) != 0)
+                return -1;
+            FilterNextToken(p);
+            if (p->token != TOKEN_COMMA)
+                break;
+            FilterNextToken(p);
+        }
+        if (p->token != TOKEN_RBRACKET) {
+            FilterError(p, "expected ]");
+            return -1;
+        }
+        FilterNextToken(p);
+    } else {
+        FilterError(p, "expected a [list] or @list");
+        return -1;
+    }
+
+    if (n->field->type == OUTPUT_FILTER_STRING)
+        qsort(n->strs, n->cnt, sizeof(*n->strs), FilterCompareStrings);
+    else
+        qsort(n->nums, n->cnt, sizeof(*n->nums), FilterCompareNums);
+    return 0;
+}
+
+static int FilterParseOp(const char *op)
+{
+    if (strcmp(op, "==") == 0 || strcmp(op, "=") == 0)
+        return OUTPUT_FILTER_OP_EQ;
+    if (strcmp(op, "!=") == 0)
+        return OUTPUT_FILTER_OP_NE;
+    if (strcmp(op, "<") == 0)
+        return OUTPUT_FILTER_OP_LT;
+    if (strcmp(op, "<=") == 0)
+        return OUTPUT_FILTER_OP_LE;
+    if (strcmp(op, ">") == 0)
+        return OUTPUT_FILTER_OP_GT;
+    if (strcmp(op, ">=") == 0)
+        return OUTPUT_FILTER_OP_GE;
+    return -1;
+}
+
+static const OutputFilterField *FilterGetField(const OutputFilterParser *p)
+{
+    const OutputFilterField *field;
+    for (field = output_filter_fields; field->name != NULL; field++) {
+        if (strcasecmp(field->name, p->val) != 0)
+            continue;
+        if (field->alproto != ALPROTO_UNKNOWN && field->alproto != p->alproto) {
+            FilterError(p, "field is not available for this output");
+            return NULL;
+        }
+        return field;
+    }
+    FilterError(p, "unknown field");
+    return NULL;
+}
+
+/** \internal \brief term: field op value | field [not] in list */
+static OutputFilterNode *FilterParseTerm(OutputFilterParser *p)
+{
+    if (p->token != TOKEN_WORD) {
+        FilterError(p, "expected a field");
+        return NULL;
+    }
+    const OutputFilterField *field = FilterGetField(p);
+    if (field == NULL)
+        return NULL;
+
+    OutputFilterNode *n = FilterNodeNew(OUTPUT_FILTER_NODE_TERM);
+    if (n == NULL)
+        return NULL;
+    n->field = field;
+
+    FilterNextToken(p);
+    int negated = 0;
+    if (FilterIsKeyword(p, "not")) {
+        negated = 1;
+        FilterNextToken(p);
+        if (!FilterIsKeyword(p, "in")) {
+            FilterError(p, "expected in");
+            goto error;
+        }
+    }
+
+    if (FilterIsKeyword(p, "in")) {
+        n->op = OUTPUT_FILTER_OP_IN;
+        FilterNextToken(p);
+        if (FilterParseList(p, n) != 0)
+            goto error;
+    } else if (p->token == TOKEN_OP) {
+        n->op = FilterParseOp(p->val);
+        if (n->op < 0) {
+            FilterError(p, "unknown operator");
+            goto error;
+        }
+        if (field->type == OUTPUT_FILTER_STRING &&
+            n->op != OUTPUT_FILTER_OP_EQ && n->op != OUTPUT_FILTER_OP_NE) {
+            FilterError(p, "strings only compare with == and !=");
+            goto error;
+        }
+        FilterNextToken(p);
+        if (p->token != TOKEN_WORD && p->token != TOKEN_STRING) {
+            FilterError(p, "expected a value");
+            goto error;
+        }
+        if (FilterValue(n, p->val, &n->num, &n->str) != 0)
+            goto error;
+        FilterNextToken(p);
+    } else {
+        FilterError(p, "expected an operator or in");
+        goto error;
+    }
+
+    if (negated) {
+        OutputFilterNode *not = FilterNodeNew(OUTPUT_FILTER_NODE_NOT);
+        if (not == NULL)
+            goto error;
+        not->left = n;
+        return not;
+    }
+    return n;
+error:
+    FilterNodeFree(n);
+    return NULL;
+}
+
+static OutputFilterNode *FilterParseOr(OutputFilterParser *p);
+
+static OutputFilterNode *FilterParseUnary(OutputFilterParser *p)
+{
+    if (FilterIsKeyword(p, "not")) {
+        FilterNextToken(p);
+        OutputFilterNode *child = FilterParseUnary(p);
+        if (child == NULL)
+            return NULL;
+        OutputFilterNode *n = FilterNodeNew(OUTPUT_FILTER_NODE_NOT);
+        if (n == NULL) {
+            FilterNodeFree(child);
+            return NULL;
+        }
+        n->left = child;
+        return n;
+    }
+    if (p->token == TOKEN_LPAREN) {
+        FilterNextToken(p);
+        OutputFilterNode *n = FilterParseOr(p);
+        if (n == NULL)
+            return NULL;
+        if (p->token != TOKEN_RPAREN) {
+            FilterError(p, "expected )");
+            FilterNodeFree(n);
+            return NULL;
+        }
+        FilterNextToken(p);
+        return n;
+    }
+    return FilterParseTerm(p);
+}
+
+/** \internal \brief parse 'first' (kw next)*, where next binds tighter */
+static OutputFilterNode *FilterParseChain(OutputFilterParser *p, const char *kw,
+        int type, OutputFilterNode *(*Next)(OutputFilterParser *))
+{
+    OutputFilterNode *left = Next(p);
+    if (left == NULL)
+        return NULL;
+
+    while (FilterIsKeyword(p, kw)) {
+        FilterNextToken(p);
+        OutputFilterNode *right = Next(p);
+        if (right == NULL)
+            goto error;
+        OutputFilterNode *n = FilterNodeNew(type);
+        if (n == NULL) {
+            FilterNodeFree(right);
+            goto error;
+        }
+        n->left = left;
+        n->right = right;
+        left = n;
+    }
+    return left;
+error:
+    FilterNodeFree(left);
+    return NULL;
+}
+
+static OutputFilterNode *FilterParseAnd(OutputFilterParser *p)
+{
+    return FilterParseChain(p, "and", OUTPUT_FILTER_NODE_AND, FilterParseUnary);
+}
+
+static OutputFilterNode *FilterParseOr(OutputFilterParser *p)
+{
+    return FilterParseChain(p, "or", OUTPUT_FILTER_NODE_OR, FilterParseAnd);
+}
+
+/**
+ *  \brief compile a filter expression
+ *
+ *  \param alproto protocol of the tx the output logs, ALPROTO_UNKNOWN
+ *                 for a flow output, which can only use the flow fields
+ *
+ *  \retval filter or NULL on error, which is logged
+ */
+OutputFilter *OutputFilterCompile(const char *expr, AppProto alproto)
+{
+    OutputFilterParser p;
+    memset(&p, 0x00, sizeof(p));
+    p.expr = expr;
+    p.s = expr;
+    p.alproto = alproto;
+
+    FilterNextToken(&p);
+    OutputFilterNode *root = FilterParseOr(&p);
+    if (root == NULL)
+        return NULL;
+    if (p.token != TOKEN_END) {
+        FilterError(&p, p.token == TOKEN_ERROR ? "bad token" : "expected and, or or the end");
+        FilterNodeFree(root);
+        return NULL;
+    }
+
+    OutputFilter *filter = SCCalloc(1, sizeof(*filter));
+    if (unlikely(filter == NULL)) {
+        FilterNodeFree(root);
+        return NULL;
+    }
+    filter->root = root;
+    filter->alproto = alproto;
+    return filter;
+}
+
+/**
+ *  \brief compile the 'filter' of an output's config
+ *
+ *  \param conf config of the output, may be NULL
+ *  \param name output name for the log
+ *
+ *  \retval filter or NULL if there is none. Exits on a bad filter.
+ */
+OutputFilter *OutputFilterSetup(ConfNode *conf, const char *name, AppProto alproto)
+{
+    if (conf == NULL)
+        return NULL;
+    const char *expr = ConfNodeLookupChildValue(conf, "filter");
+    if (expr == NULL)
+        return NULL;
+
+    OutputFilter *filter = OutputFilterCompile(expr, alproto);
+    if (filter == NULL) {
+        FatalError(SC_ERR_INVALID_ARGUMENT, "%s: invalid filter \"%s\"",
+                name, expr);
+    }
+    SCLogConfig("%s: only logging records matching \"%s\"", name, expr);
+    return filter;
+}
+
+void OutputFilterFree(OutputFilter *filter)
+{
+    if (filter == NULL)
+        return;
+    FilterNodeFree(filter->root);
+    SCFree(filter);
+}
+
+#ifdef UNITTESTS
+/** \test parsing, precedence and errors */
+static int OutputFilterTest01(void)
+{
+    Flow f;
+    memset(&f, 0x00, sizeof(f));
+    f.proto = IPPROTO_TCP;
+    f.dp = 80;
+    f.todstbytecnt = 1024 * 1024;
+    f.tosrcbytecnt = 1;
+
+    OutputFilter *filter = OutputFilterCompile("flow.bytes > 1M", ALPROTO_UNKNOWN);
+    FAIL_IF_NULL(filter);
+    FAIL_IF_NOT(OutputFilterMatch(filter, &f, NULL));
+    OutputFilterFree(filter);
+
+    /* and binds tighter than or */
+    filter = OutputFilterCompile("flow.dest_port == 53 and flow.proto == udp "
+            "or flow.dest_port in [80, 8080]", ALPROTO_UNKNOWN);
+    FAIL_IF_NULL(filter);
+    FAIL_IF_NOT(OutputFilterMatch(filter, &f, NULL));
+    OutputFilterFree(filter);
+
+    filter = OutputFilterCompile("flow.dest_port == 53 and (flow.proto == udp "
+            "or flow.dest_port in [80, 8080])", ALPROTO_UNKNOWN);
+    FAIL_IF_NULL(filter);
+    FAIL_IF(OutputFilterMatch(filter, &f, NULL));
+    OutputFilterFree(filter);
+
+    filter = OutputFilterCompile("not flow.proto == udp and flow.dest_port not in [22, 443]",
+            ALPROTO_UNKNOWN);
+    FAIL_IF_NULL(filter);
+    FAIL_IF_NOT(OutputFilterMatch(filter, &f, NULL));
+    OutputFilterFree(filter);
+
+    /* no app proto, so the term is false either way */
+    filter = OutputFilterCompile("flow.app_proto != http", ALPROTO_UNKNOWN);
+    FAIL_IF_NULL(filter);
+    FAIL_IF(OutputFilterMatch(filter, &f, NULL));
+    OutputFilterFree(filter);
+
+    FAIL_IF_NOT_NULL(OutputFilterCompile("http.hostname == x", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("flow.bogus == 1", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("flow.bytes > 1X", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("flow.app_proto > http", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("(flow.pkts > 1", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("flow.pkts > 1 flow.pkts < 5", ALPROTO_UNKNOWN));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("flow.pkts in [1, 2", ALPROTO_UNKNOWN));
+    PASS;
+}
+
+/** \test dns fields, named values and lists from the config */
+static int OutputFilterTest02(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString("%YAML 1.1\n---\nfilter-lists:\n  skip: [Example.com, b.org]\n",
+            strlen("%YAML 1.1\n---\nfilter-lists:\n  skip: [Example.com, b.org]\n"));
+
+    Flow f;
+    memset(&f, 0x00, sizeof(f));
+
+    /* a tx with an AAAA query for example.COM */
+    struct {
+        DNSTransaction tx;
+        DNSQueryEntry q;
+        uint8_t name[11];
+    } t;
+    memset(&t, 0x00, sizeof(t));
+    TAILQ_INIT(&t.tx.query_list);
+    t.q.type = DNS_RECORD_TYPE_AAAA;
+    t.q.len = 11;
+    memcpy(t.name, "example.COM", 11);
+    TAILQ_INSERT_TAIL(&t.tx.query_list, &t.q, next);
+
+    OutputFilter *filter = OutputFilterCompile("dns.rrtype in [A, AAAA] and "
+            "dns.rrname not in @skip", ALPROTO_DNS);
+    FAIL_IF_NULL(filter);
+    FAIL_IF(OutputFilterMatch(filter, &f, &t.tx));
+    memcpy(t.name, "example.NET", 11);
+    FAIL_IF_NOT(OutputFilterMatch(filter, &f, &t.tx));
+    t.q.type = DNS_RECORD_TYPE_MX;
+    FAIL_IF(OutputFilterMatch(filter, &f, &t.tx));
+    OutputFilterFree(filter);
+
+    /* no reply yet */
+    filter = OutputFilterCompile("dns.rcode == NOERROR", ALPROTO_DNS);
+    FAIL_IF_NULL(filter);
+    FAIL_IF(OutputFilterMatch(filter, &f, &t.tx));
+    t.tx.replied = 1;
+    FAIL_IF_NOT(OutputFilterMatch(filter, &f, &t.tx));
+    OutputFilterFree(filter);
+
+    FAIL_IF_NOT_NULL(OutputFilterCompile("dns.rrname in @nolist", ALPROTO_DNS));
+    FAIL_IF_NOT_NULL(OutputFilterCompile("dns.rrtype == BOGUS", ALPROTO_DNS));
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void OutputFilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("OutputFilterTest01", OutputFilterTest01);
+    UtRegisterTest("OutputFilterTest02", OutputFilterTest02);
+#endif /* UNITTESTS */
+}
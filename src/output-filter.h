@@ -0,0 +1,53 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Output filters: an expression per logger, compiled at startup and
+ * evaluated against the tx and flow fields before the logger runs, so
+ * records nobody wants aren't built.
+ *
+ *     http.hostname not in @cdn and http.status >= 400
+ *     dns.rrtype in [A, AAAA]
+ *     flow.bytes > 1M or not flow.app_proto == http
+ *
+ * Terms are 'field op value' with op one of == != < <= > >=, or
+ * 'field in list' and 'field not in list'. A list is [a, b, ...] or
+ * @name for the 'filter-lists.name' sequence of the yaml. Terms are
+ * combined with not, and, or and parentheses. Strings compare without
+ * case and only with ==, != and in. Numbers take a k, m or g suffix
+ * for 1024 multiples. A term on a field the record doesn't have is
+ * false, whatever its op.
+ */
+
+#ifndef __OUTPUT_FILTER_H__
+#define __OUTPUT_FILTER_H__
+
+#include "conf.h"
+
+typedef struct OutputFilter_ OutputFilter;
+
+OutputFilter *OutputFilterCompile(const char *expr, AppProto alproto);
+OutputFilter *OutputFilterSetup(ConfNode *conf, const char *name, AppProto alproto);
+void OutputFilterFree(OutputFilter *filter);
+
+int OutputFilterMatch(const OutputFilter *filter, const Flow *f, void *tx);
+
+void OutputFilterRegisterTests(void);
+
+#endif /* __OUTPUT_FILTER_H__ */
@@ -44,6 +44,7 @@ typedef struct OutputLoggerThreadData_ {
  * log module (e.g. http.log) with different output ctx'. */
 typedef struct OutputFlowLogger_ {
     FlowLogger LogFunc;
+    OutputFilter *filter;       /**< flows to log, NULL for all */
     OutputCtx *output_ctx;
     struct OutputFlowLogger_ *next;
     const char *name;
@@ -52,7 +53,8 @@ typedef struct OutputFlowLogger_ {
 
 static OutputFlowLogger *list = NULL;
 
-int OutputRegisterFlowLogger(const char *name, FlowLogger LogFunc, OutputCtx *output_ctx)
+int OutputRegisterFlowLogger(const char *name, FlowLogger LogFunc, OutputCtx *output_ctx,
+        OutputFilter *filter)
 {
     int module_id = TmModuleGetIdByName(name);
     if (module_id < 0)
@@ -64,6 +66,7 @@ int OutputRegisterFlowLogger(const char *name, FlowLogger LogFunc, OutputCtx *ou
     memset(op, 0x00, sizeof(*op));
 
     op->LogFunc = LogFunc;
+    op->filter = filter;
     op->output_ctx = output_ctx;
     op->name = name;
     op->module_id = (TmmId) module_id;
@@ -106,9 +109,11 @@ TmEcode OutputFlowLog(ThreadVars *tv, void *thread_data, Flow *f)
         BUG_ON(logger->LogFunc == NULL);
 
         SCLogDebug("logger %p", logger);
-        //PACKET_PROFILING_TMM_START(p, logger->module_id);
-        logger->LogFunc(tv, store->thread_data, f);
-        //PACKET_PROFILING_TMM_END(p, logger->module_id);
+        if (logger->filter == NULL || OutputFilterMatch(logger->filter, f, NULL)) {
+            //PACKET_PROFILING_TMM_START(p, logger->module_id);
+            logger->LogFunc(tv, store->thread_data, f);
+            //PACKET_PROFILING_TMM_END(p, logger->module_id);
+        }
 
         logger = logger->next;
         store = store->next;
@@ -228,6 +233,7 @@ void OutputFlowShutdown(void)
     OutputFlowLogger *logger = list;
     while (logger) {
         OutputFlowLogger *next_logger = logger->next;
+        OutputFilterFree(logger->filter);
         SCFree(logger);
         logger = next_logger;
     }
@@ -27,6 +27,7 @@
 #define __OUTPUT_FLOW_H__
 
 #include "decode.h"
+#include "output-filter.h"
 
 /** flow logger function pointer type */
 typedef int (*FlowLogger)(ThreadVars *, void *thread_data, Flow *f);
@@ -36,7 +37,8 @@ typedef int (*FlowLogger)(ThreadVars *, void *thread_data, Flow *f);
  */
 //typedef int (*TxLogCondition)(ThreadVars *, const Packet *);
 
-int OutputRegisterFlowLogger(const char *name, FlowLogger LogFunc, OutputCtx *);
+int OutputRegisterFlowLogger(const char *name, FlowLogger LogFunc, OutputCtx *,
+        OutputFilter *filter);
 
 void OutputFlowShutdown(void);
 
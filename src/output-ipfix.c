@@ -0,0 +1,734 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * IPFIX flow exporter, a flow logger.
+ *
+ * Each logging thread, so the flow recycler and the workers that log
+ * forced flows, has its own socket to the collector and so its own
+ * transport session, with its own sequence numbers. Records are batched
+ * into messages of at most 'mtu' bytes. A message is sent when the next
+ * record doesn't fit, when its oldest record is 'flush-interval' seconds
+ * old at the time a new one is added, and on thread exit.
+ *
+ * There is one template per address family. Bytes and packets to the
+ * client are the RFC 5103 reverse elements, so a record is a biflow like
+ * the eve flow records. Over UDP the templates are sent again every
+ * 'template-refresh' seconds, over TCP once per connection.
+ */
+
+#include "suricata-common.h"
+#include "debug.h"
+#include "conf.h"
+#include "flow.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "output.h"
+#include "output-ipfix.h"
+#include "stream-tcp-private.h"
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-unittest.h"
+
+#define IPFIX_VERSION               10
+#define IPFIX_MSG_HDR_LEN           16
+#define IPFIX_SET_HDR_LEN           4
+#define IPFIX_SET_TEMPLATE          2
+#define IPFIX_TEMPLATE_IPV4         256
+#define IPFIX_TEMPLATE_IPV6         257
+/** PEN of the RFC 5103 reverse information elements */
+#define IPFIX_PEN_REVERSE           29305
+#define IPFIX_VARLEN                65535
+
+#define IPFIX_DEFAULT_PORT          4739
+#define IPFIX_DEFAULT_MTU           1400
+#define IPFIX_MIN_MTU               512
+#define IPFIX_MAX_MTU               65535
+#define IPFIX_DEFAULT_REFRESH       600
+#define IPFIX_DEFAULT_FLUSH         1
+/** longest app proto name put in a record */
+#define IPFIX_APP_NAME_MAX          32
+
+/* IANA information elements */
+#define IPFIX_IE_OCTET_DELTA        1
+#define IPFIX_IE_PACKET_DELTA       2
+#define IPFIX_IE_PROTOCOL           4
+#define IPFIX_IE_TCP_FLAGS          6
+#define IPFIX_IE_SRC_PORT           7
+#define IPFIX_IE_SRC_IPV4           8
+#define IPFIX_IE_DST_PORT           11
+#define IPFIX_IE_DST_IPV4           12
+#define IPFIX_IE_SRC_IPV6           27
+#define IPFIX_IE_DST_IPV6           28
+#define IPFIX_IE_VLAN_ID            58
+#define IPFIX_IE_APP_NAME           96
+#define IPFIX_IE_END_REASON         136
+#define IPFIX_IE_START_MS           152
+#define IPFIX_IE_END_MS             153
+
+/* flowEndReason values */
+#define IPFIX_END_IDLE_TIMEOUT      1
+#define IPFIX_END_OF_FLOW           3
+#define IPFIX_END_FORCED            4
+#define IPFIX_END_LACK_OF_RESOURCES 5
+
+typedef struct IpfixField_ {
+    uint16_t id;
+    uint16_t len;
+    uint32_t pen;       /**< 0 for IANA elements */
+} IpfixField;
+
+/** record layout, the address fields follow the family. The encoding in
+ *  IpfixAddFlow must follow the same order. */
+static const IpfixField ipfix_fields[] = {
+    { IPFIX_IE_SRC_IPV4, 4, 0 },
+    { IPFIX_IE_DST_IPV4, 4, 0 },
+    { IPFIX_IE_SRC_PORT, 2, 0 },
+    { IPFIX_IE_DST_PORT, 2, 0 },
+    { IPFIX_IE_PROTOCOL, 1, 0 },
+    { IPFIX_IE_VLAN_ID, 2, 0 },
+    { IPFIX_IE_START_MS, 8, 0 },
+    { IPFIX_IE_END_MS, 8, 0 },
+    { IPFIX_IE_OCTET_DELTA, 8, 0 },
+    { IPFIX_IE_PACKET_DELTA, 8, 0 },
+    { IPFIX_IE_OCTET_DELTA, 8, IPFIX_PEN_REVERSE },
+    { IPFIX_IE_PACKET_DELTA, 8, IPFIX_PEN_REVERSE },
+    { IPFIX_IE_TCP_FLAGS, 1, 0 },
+    { IPFIX_IE_TCP_FLAGS, 1, IPFIX_PEN_REVERSE },
+    { IPFIX_IE_END_REASON, 1, 0 },
+    { IPFIX_IE_APP_NAME, IPFIX_VARLEN, 0 },
+};
+#define IPFIX_FIELDS (sizeof(ipfix_fields) / sizeof(ipfix_fields[0]))
+
+typedef struct IpfixLogCtx_ {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int sock_type;              /**< SOCK_DGRAM or SOCK_STREAM */
+    uint32_t mtu;
+    uint32_t domain;            /**< observation domain id */
+    uint32_t template_refresh;  /**< seconds, udp only */
+    uint32_t flush_interval;    /**< seconds */
+    char collector[128];        /**< for the log */
+} IpfixLogCtx;
+
+typedef struct IpfixLogThread_ {
+    const IpfixLogCtx *ctx;
+    int fd;                     /**< -1 when not connected */
+    uint8_t *buf;               /**< message being built */
+    uint32_t len;               /**< its length, 0 if no message */
+    uint32_t set_offset;        /**< offset of the open data set */
+    uint16_t set_id;            /**< its template, 0 if none is open */
+    uint32_t msg_records;       /**< records in the message */
+    uint32_t seq;               /**< records sent, for the msg header */
+    uint32_t msg_ts;            /**< time of its first record */
+    uint32_t templates_ts;      /**< time the templates were last sent */
+    int templates_due;
+    uint32_t connect_ts;        /**< time of the last connect attempt */
+
+    uint64_t flows;
+    uint64_t messages;
+    uint64_t dropped;           /**< records in messages not sent */
+} IpfixLogThread;
+
+static inline uint8_t *IpfixPut8(uint8_t *p, uint8_t v)
+{
+    *p = v;
+    return p + 1;
+}
+
+static inline uint8_t *IpfixPut16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+    return p + 2;
+}
+
+static inline uint8_t *IpfixPut32(uint8_t *p, uint32_t v)
+{
+    p = IpfixPut16(p, (uint16_t)(v >> 16));
+    return IpfixPut16(p, (uint16_t)v);
+}
+
+static inline uint8_t *IpfixPut64(uint8_t *p, uint64_t v)
+{
+    p = IpfixPut32(p, (uint32_t)(v >> 32));
+    return IpfixPut32(p, (uint32_t)v);
+}
+
+static inline uint64_t IpfixTimeMs(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000 + (uint64_t)tv->tv_usec / 1000;
+}
+
+/** \internal \brief length of the template set with both templates */
+static uint32_t IpfixTemplateSetLen(void)
+{
+    uint32_t len = 4;   /* template id and field count */
+    uint32_t i;
+    for (i = 0; i < IPFIX_FIELDS; i++)
+        len += ipfix_fields[i].pen ? 8 : 4;
+    return IPFIX_SET_HDR_LEN + 2 * len;
+}
+
+static uint8_t *IpfixPutTemplate(uint8_t *p, uint16_t template_id)
+{
+    const int ipv6 = (template_id == IPFIX_TEMPLATE_IPV6);
+    uint32_t i;
+
+    p = IpfixPut16(p, template_id);
+    p = IpfixPut16(p, (uint16_t)IPFIX_FIELDS);
+    for (i = 0; i < IPFIX_FIELDS; i++) {
+        uint16_t id = ipfix_fields[i].id;
+        uint16_t len = ipfix_fields[i].len;
+        if (ipv6 && id == IPFIX_IE_SRC_IPV4) {
+            id = IPFIX_IE_SRC_IPV6;
+            len = 16;
+        } else if (ipv6 && id == IPFIX_IE_DST_IPV4) {
+            id = IPFIX_IE_DST_IPV6;
+            len = 16;
+        }
+        if (ipfix_fields[i].pen) {
+            p = IpfixPut16(p, id | 0x8000);
+            p = IpfixPut16(p, len);
+            p = IpfixPut32(p, ipfix_fields[i].pen);
+        } else {
+            p = IpfixPut16(p, id);
+            p = IpfixPut16(p, len);
+        }
+    }
+    return p;
+}
+
+/** \internal \brief connect, rate limited to an attempt per second */
+static int IpfixConnect(IpfixLogThread *aft, uint32_t now)
+{
+    if (aft->fd >= 0)
+        return 0;
+    if (aft->connect_ts == now)
+        return -1;
+    aft->connect_ts = now;
+
+    int fd = socket(aft->ctx->addr.ss_family, aft->ctx->sock_type, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const struct sockaddr *)&aft->ctx->addr,
+                aft->ctx->addr_len) < 0) {
+        SCLogWarning(SC_ERR_IPFIX_LOG, "ipfix: connecting to %s failed: %s",
+                aft->ctx->collector, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    aft->fd = fd;
+    /* a new tcp session needs the templates */
+    aft->templates_due = 1;
+    return 0;
+}
+
+static void IpfixDisconnect(IpfixLogThread *aft)
+{
+    if (aft->fd >= 0)
+        close(aft->fd);
+    aft->fd = -1;
+    aft->templates_due = 1;
+}
+
+static int IpfixSend(IpfixLogThread *aft)
+{
+    uint32_t off = 0;
+    while (off < aft->len) {
+        ssize_t r = send(aft->fd, aft->buf + off, aft->len - off, MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        /* a datagram goes out whole */
+        if (aft->ctx->sock_type == SOCK_DGRAM)
+            break;
+        off += (uint32_t)r;
+    }
+    return 0;
+}
+
+/** \internal \brief close the open data set */
+static void IpfixCloseSet(IpfixLogThread *aft)
+{
+    if (aft->set_id == 0)
+        return;
+    IpfixPut16(aft->buf + aft->set_offset + 2,
+            (uint16_t)(aft->len - aft->set_offset));
+    aft->set_id = 0;
+}
+
+/** \internal \brief finish and send the message being built */
+static void IpfixFlush(IpfixLogThread *aft)
+{
+    if (aft->len == 0)
+        return;
+    IpfixCloseSet(aft);
+
+    struct timeval now;
+    TimeGetCoarse(&now);
+
+    uint8_t *p = aft->buf;
+    p = IpfixPut16(p, IPFIX_VERSION);
+    p = IpfixPut16(p, (uint16_t)aft->len);
+    p = IpfixPut32(p, (uint32_t)now.tv_sec);
+    p = IpfixPut32(p, aft->seq);
+    (void)IpfixPut32(p, aft->ctx->domain);
+
+    if (IpfixSend(aft) == 0) {
+        aft->seq += aft->msg_records;
+        aft->messages++;
+    } else {
+        SCLogDebug("ipfix: send failed: %s", strerror(errno));
+        if (aft->ctx->sock_type == SOCK_STREAM)
+            IpfixDisconnect(aft);
+        aft->dropped += aft->msg_records;
+    }
+    aft->len = 0;
+    aft->msg_records = 0;
+}
+
+/** \internal \brief start a message, with the templates if they are due */
+static void IpfixStart(IpfixLogThread *aft, uint32_t now)
+{
+    aft->len = IPFIX_MSG_HDR_LEN;
+    aft->msg_ts = now;
+
+    if (aft->ctx->sock_type == SOCK_DGRAM &&
+        now - aft->templates_ts >= aft->ctx->template_refresh)
+        aft->templates_due = 1;
+    if (aft->templates_due) {
+        uint8_t *p = aft->buf + aft->len;
+        p = IpfixPut16(p, IPFIX_SET_TEMPLATE);
+        p = IpfixPut16(p, (uint16_t)IpfixTemplateSetLen());
+        p = IpfixPutTemplate(p, IPFIX_TEMPLATE_IPV4);
+        p = IpfixPutTemplate(p, IPFIX_TEMPLATE_IPV6);
+        aft->len = (uint32_t)(p - aft->buf);
+        aft->templates_due = 0;
+        aft->templates_ts = now;
+    }
+}
+
+static uint8_t IpfixEndReason(const Flow *f)
+{
+    if (f->flow_end_flags & FLOW_END_FLAG_EMERGENCY)
+        return IPFIX_END_LACK_OF_RESOURCES;
+    if (f->flow_end_flags & (FLOW_END_FLAG_FORCED|FLOW_END_FLAG_SHUTDOWN))
+        return IPFIX_END_FORCED;
+    if (f->flow_end_flags & FLOW_END_FLAG_STATE_CLOSED)
+        return IPFIX_END_OF_FLOW;
+    return IPFIX_END_IDLE_TIMEOUT;
+}
+
+/** \internal \brief add the record of a flow to the message */
+static void IpfixAddFlow(IpfixLogThread *aft, const Flow *f, uint32_t now)
+{
+    const int ipv6 = FLOW_IS_IPV6(f);
+    const uint16_t template_id = ipv6 ? IPFIX_TEMPLATE_IPV6 : IPFIX_TEMPLATE_IPV4;
+    const uint32_t addr_len = ipv6 ? 16 : 4;
+
+    const char *app = (f->alproto != ALPROTO_UNKNOWN) ?
+        AppProtoToString(f->alproto) : NULL;
+    size_t app_len = (app != NULL) ? strlen(app) : 0;
+    if (app_len > IPFIX_APP_NAME_MAX)
+        app_len = IPFIX_APP_NAME_MAX;
+
+    /* fixed fields, the large ones, and the app name with its length */
+    const uint32_t rec_len = 2 * addr_len + 2 + 2 + 1 + 2 + 6 * 8 + 3 +
+        1 + (uint32_t)app_len;
+
+    if (aft->len != 0) {
+        uint32_t need = rec_len + (aft->set_id != template_id ? IPFIX_SET_HDR_LEN : 0);
+        if (aft->len + need > aft->ctx->mtu ||
+            now - aft->msg_ts >= aft->ctx->flush_interval)
+            IpfixFlush(aft);
+    }
+    if (aft->len == 0)
+        IpfixStart(aft, now);
+    if (aft->set_id != template_id) {
+        IpfixCloseSet(aft);
+        aft->set_offset = aft->len;
+        aft->set_id = template_id;
+        IpfixPut16(aft->buf + aft->len, template_id);
+        aft->len += IPFIX_SET_HDR_LEN;
+    }
+
+    uint8_t ts_flags = 0, tc_flags = 0;
+    if (f->proto == IPPROTO_TCP && f->protoctx != NULL) {
+        const TcpSession *ssn = f->protoctx;
+        ts_flags = ssn->client.tcp_flags;
+        tc_flags = ssn->server.tcp_flags;
+    }
+
+    uint8_t *p = aft->buf + aft->len;
+    memcpy(p, f->src.addr_data32, addr_len);
+    p += addr_len;
+    memcpy(p, f->dst.addr_data32, addr_len);
+    p += addr_len;
+    p = IpfixPut16(p, f->sp);
+    p = IpfixPut16(p, f->dp);
+    p = IpfixPut8(p, f->proto);
+    p = IpfixPut16(p, f->vlan_id[0]);
+    p = IpfixPut64(p, IpfixTimeMs(&f->startts));
+    p = IpfixPut64(p, IpfixTimeMs(&f->lastts));
+    p = IpfixPut64(p, f->todstbytecnt);
+    p = IpfixPut64(p, f->todstpktcnt);
+    p = IpfixPut64(p, f->tosrcbytecnt);
+    p = IpfixPut64(p, f->tosrcpktcnt);
+    p = IpfixPut8(p, ts_flags);
+    p = IpfixPut8(p, tc_flags);
+    p = IpfixPut8(p, IpfixEndReason(f));
+    p = IpfixPut8(p, (uint8_t)app_len);
+    if (app_len > 0) {
+        memcpy(p, app, app_len);
+        p += app_len;
+    }
+
+    BUG_ON((uint32_t)(p - (aft->buf + aft->len)) != rec_len);
+    aft->len += rec_len;
+    aft->msg_records++;
+}
+
+static int IpfixLogger(ThreadVars *tv, void *thread_data, Flow *f)
+{
+    IpfixLogThread *aft = (IpfixLogThread *)thread_data;
+    struct timeval ts;
+    TimeGetCoarse(&ts);
+    const uint32_t now = (uint32_t)ts.tv_sec;
+
+    aft->flows++;
+    if (IpfixConnect(aft, now) != 0) {
+        aft->dropped++;
+        return TM_ECODE_OK;
+    }
+    IpfixAddFlow(aft, f, now);
+    return TM_ECODE_OK;
+}
+
+static TmEcode IpfixLogThreadInit(ThreadVars *t, void *initdata, void **data)
+{
+    if (initdata == NULL) {
+        SCLogDebug("Error getting context for IpfixLog. \"initdata\" argument NULL");
+        return TM_ECODE_FAILED;
+    }
+    const IpfixLogCtx *ctx = ((OutputCtx *)initdata)->data;
+
+    IpfixLogThread *aft = SCCalloc(1, sizeof(*aft));
+    if (unlikely(aft == NULL))
+        return TM_ECODE_FAILED;
+    aft->buf = SCMalloc(ctx->mtu);
+    if (unlikely(aft->buf == NULL)) {
+        SCFree(aft);
+        return TM_ECODE_FAILED;
+    }
+    aft->ctx = ctx;
+    aft->fd = -1;
+    aft->templates_due = 1;
+
+    *data = (void *)aft;
+    return TM_ECODE_OK;
+}
+
+static TmEcode IpfixLogThreadDeinit(ThreadVars *t, void *data)
+{
+    IpfixLogThread *aft = (IpfixLogThread *)data;
+    if (aft == NULL)
+        return TM_ECODE_OK;
+
+    if (aft->fd >= 0)
+        IpfixFlush(aft);
+    IpfixDisconnect(aft);
+    SCFree(aft->buf);
+    SCFree(aft);
+    return TM_ECODE_OK;
+}
+
+static void IpfixLogExitPrintStats(ThreadVars *tv, void *data)
+{
+    IpfixLogThread *aft = (IpfixLogThread *)data;
+    if (aft == NULL)
+        return;
+
+    SCLogPerf("IPFIX exporter: %"PRIu64" flows, %"PRIu64" messages, "
+            "%"PRIu64" flows dropped", aft->flows, aft->messages, aft->dropped);
+}
+
+static void IpfixLogDeInitCtx(OutputCtx *output_ctx)
+{
+    SCFree(output_ctx->data);
+    SCFree(output_ctx);
+}
+
+static int IpfixGetUint(ConfNode *conf, const char *name, intmax_t dflt,
+        intmax_t min, intmax_t max, uint32_t *val)
+{
+    intmax_t v = dflt;
+    if (ConfNodeLookupChild(conf, name) != NULL &&
+        !ConfGetChildValueInt(conf, name, &v)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "ipfix-log: invalid %s", name);
+        return -1;
+    }
+    if (v < min || v > max) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "ipfix-log: %s must be "
+                "%"PRIdMAX"-%"PRIdMAX, name, min, max);
+        return -1;
+    }
+    *val = (uint32_t)v;
+    return 0;
+}
+
+static OutputCtx *IpfixLogInitCtx(ConfNode *conf)
+{
+    IpfixLogCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+
+    const char *collector = "127.0.0.1";
+    const char *transport = "udp";
+    uint32_t port = IPFIX_DEFAULT_PORT;
+    if (conf != NULL) {
+        const char *s = ConfNodeLookupChildValue(conf, "collector");
+        if (s != NULL)
+            collector = s;
+        s = ConfNodeLookupChildValue(conf, "transport");
+        if (s != NULL)
+            transport = s;
+    }
+    if (strcasecmp(transport, "udp") == 0) {
+        ctx->sock_type = SOCK_DGRAM;
+    } else if (strcasecmp(transport, "tcp") == 0) {
+        ctx->sock_type = SOCK_STREAM;
+    } else {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "ipfix-log: transport must be "
+                "udp or tcp, not \"%s\"", transport);
+        goto error;
+    }
+
+    if (IpfixGetUint(conf, "port", IPFIX_DEFAULT_PORT, 1, 65535, &port) != 0 ||
+        IpfixGetUint(conf, "mtu", IPFIX_DEFAULT_MTU, IPFIX_MIN_MTU,
+            IPFIX_MAX_MTU, &ctx->mtu) != 0 ||
+        IpfixGetUint(conf, "observation-domain", 0, 0, UINT32_MAX,
+            &ctx->domain) != 0 ||
+        IpfixGetUint(conf, "template-refresh", IPFIX_DEFAULT_REFRESH, 1,
+            86400, &ctx->template_refresh) != 0 ||
+        IpfixGetUint(conf, "flush-interval", IPFIX_DEFAULT_FLUSH, 1,
+            3600, &ctx->flush_interval) != 0)
+        goto error;
+
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%u", port);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0x00, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = ctx->sock_type;
+    int r = getaddrinfo(collector, portstr, &hints, &res);
+    if (r != 0 || res == NULL) {
+        SCLogError(SC_ERR_IPFIX_LOG, "ipfix-log: can't resolve collector "
+                "\"%s\": %s", collector, gai_strerror(r));
+        goto error;
+    }
+    memcpy(&ctx->addr, res->ai_addr, res->ai_addrlen);
+    ctx->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    snprintf(ctx->collector, sizeof(ctx->collector), "%s:%u", collector, port);
+
+    OutputCtx *output_ctx = SCCalloc(1, sizeof(*output_ctx));
+    if (unlikely(output_ctx == NULL))
+        goto error;
+    output_ctx->data = ctx;
+    output_ctx->DeInit = IpfixLogDeInitCtx;
+
+    SCLogConfig("ipfix-log: exporting to %s over %s, messages of up to "
+            "%u bytes", ctx->collector, transport, ctx->mtu);
+    return output_ctx;
+error:
+    SCFree(ctx);
+    return NULL;
+}
+
+#ifdef UNITTESTS
+static void IpfixTestFlow(Flow *f, uint32_t n)
+{
+    memset(f, 0x00, sizeof(*f));
+    f->flags |= FLOW_IPV4;
+    f->proto = IPPROTO_UDP;
+    f->src.addr_data32[0] = htonl(0x0a000001);
+    f->dst.addr_data32[0] = htonl(0x0a000002);
+    f->sp = (Port)(1024 + n);
+    f->dp = 53;
+    f->todstbytecnt = 100 + n;
+    f->todstpktcnt = 1;
+    f->flow_end_flags = FLOW_END_FLAG_TIMEOUT;
+}
+
+static uint32_t IpfixTestGet16(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static uint32_t IpfixTestGet32(const uint8_t *p)
+{
+    return (IpfixTestGet16(p) << 16) | IpfixTestGet16(p + 2);
+}
+
+static int IpfixTestSetup(IpfixLogCtx *ctx, IpfixLogThread *aft, int sv[2],
+        uint32_t mtu)
+{
+    memset(ctx, 0x00, sizeof(*ctx));
+    memset(aft, 0x00, sizeof(*aft));
+    ctx->sock_type = SOCK_DGRAM;
+    ctx->mtu = mtu;
+    ctx->domain = 7;
+    ctx->template_refresh = 86400;
+    ctx->flush_interval = 3600;
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) != 0)
+        return -1;
+    aft->ctx = ctx;
+    aft->fd = sv[0];
+    aft->templates_due = 1;
+    aft->buf = SCMalloc(mtu);
+    return (aft->buf != NULL) ? 0 : -1;
+}
+
+/** \test layout of a message with the templates and two records */
+static int IpfixLogTest01(void)
+{
+    IpfixLogCtx ctx;
+    IpfixLogThread aft;
+    int sv[2];
+    Flow f;
+    uint8_t msg[IPFIX_DEFAULT_MTU];
+
+    FAIL_IF(IpfixTestSetup(&ctx, &aft, sv, IPFIX_DEFAULT_MTU) != 0);
+
+    IpfixTestFlow(&f, 0);
+    IpfixAddFlow(&aft, &f, 1000);
+    f.alproto = ALPROTO_DNS;
+    IpfixAddFlow(&aft, &f, 1000);
+    IpfixFlush(&aft);
+
+    ssize_t len = recv(sv[1], msg, sizeof(msg), 0);
+    const uint32_t tlen = IpfixTemplateSetLen();
+    const uint32_t rec_len = 4 + 4 + 2 + 2 + 1 + 2 + 48 + 3 + 1;
+    FAIL_IF(len != (ssize_t)(IPFIX_MSG_HDR_LEN + tlen + IPFIX_SET_HDR_LEN +
+                2 * rec_len + strlen("dns")));
+    FAIL_IF(IpfixTestGet16(msg) != IPFIX_VERSION);
+    FAIL_IF(IpfixTestGet16(msg + 2) != len);
+    FAIL_IF(IpfixTestGet32(msg + 8) != 0);
+    FAIL_IF(IpfixTestGet32(msg + 12) != 7);
+
+    const uint8_t *set = msg + IPFIX_MSG_HDR_LEN;
+    FAIL_IF(IpfixTestGet16(set) != IPFIX_SET_TEMPLATE);
+    FAIL_IF(IpfixTestGet16(set + 2) != tlen);
+    FAIL_IF(IpfixTestGet16(set + 4) != IPFIX_TEMPLATE_IPV4);
+    FAIL_IF(IpfixTestGet16(set + 6) != IPFIX_FIELDS);
+
+    set += tlen;
+    FAIL_IF(IpfixTestGet16(set) != IPFIX_TEMPLATE_IPV4);
+    FAIL_IF(IpfixTestGet16(set + 2) != len - IPFIX_MSG_HDR_LEN - tlen);
+    const uint8_t *rec = set + IPFIX_SET_HDR_LEN;
+    FAIL_IF(IpfixTestGet32(rec) != 0x0a000001);
+    FAIL_IF(IpfixTestGet16(rec + 8) != 1024);
+    FAIL_IF(IpfixTestGet16(rec + 10) != 53);
+    FAIL_IF(rec[12] != IPPROTO_UDP);
+    /* todstbytecnt, after the vlan and the two times */
+    FAIL_IF(IpfixTestGet32(rec + 15 + 16 + 4) != 100);
+    FAIL_IF(rec[rec_len - 2] != IPFIX_END_IDLE_TIMEOUT);
+    FAIL_IF(rec[rec_len - 1] != 0);
+    rec += rec_len;
+    FAIL_IF(rec[rec_len - 1] != 3 || memcmp(rec + rec_len, "dns", 3) != 0);
+
+    /* the next message has no templates and counts the records */
+    IpfixAddFlow(&aft, &f, 1000);
+    IpfixFlush(&aft);
+    len = recv(sv[1], msg, sizeof(msg), 0);
+    FAIL_IF(len != (ssize_t)(IPFIX_MSG_HDR_LEN + IPFIX_SET_HDR_LEN + rec_len + 3));
+    FAIL_IF(IpfixTestGet32(msg + 8) != 2);
+    FAIL_IF(IpfixTestGet16(msg + IPFIX_MSG_HDR_LEN) != IPFIX_TEMPLATE_IPV4);
+
+    SCFree(aft.buf);
+    close(sv[0]);
+    close(sv[1]);
+    PASS;
+}
+
+/** \test records are batched into messages that fit the mtu */
+static int IpfixLogTest02(void)
+{
+    IpfixLogCtx ctx;
+    IpfixLogThread aft;
+    int sv[2];
+    Flow f;
+    uint8_t msg[IPFIX_MIN_MTU + 1];
+    uint32_t i, records = 0, msgs = 0;
+    const uint32_t rec_len = 4 + 4 + 2 + 2 + 1 + 2 + 48 + 3 + 1;
+
+    FAIL_IF(IpfixTestSetup(&ctx, &aft, sv, IPFIX_MIN_MTU) != 0);
+
+    for (i = 0; i < 20; i++) {
+        IpfixTestFlow(&f, i);
+        IpfixAddFlow(&aft, &f, 1000);
+    }
+    IpfixFlush(&aft);
+    FAIL_IF(aft.messages < 3);
+
+    for (msgs = 0; msgs < aft.messages; msgs++) {
+        ssize_t len = recv(sv[1], msg, sizeof(msg), 0);
+        FAIL_IF(len <= 0 || len > IPFIX_MIN_MTU);
+        FAIL_IF(IpfixTestGet32(msg + 8) != records);
+        uint32_t off = IPFIX_MSG_HDR_LEN;
+        if (msgs == 0)
+            off += IpfixTemplateSetLen();
+        uint32_t set_len = IpfixTestGet16(msg + off + 2);
+        FAIL_IF(off + set_len != (uint32_t)len);
+        records += (set_len - IPFIX_SET_HDR_LEN) / rec_len;
+    }
+    FAIL_IF(records != 20);
+
+    SCFree(aft.buf);
+    close(sv[0]);
+    close(sv[1]);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void IpfixLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("IpfixLogTest01", IpfixLogTest01);
+    UtRegisterTest("IpfixLogTest02", IpfixLogTest02);
+#endif /* UNITTESTS */
+}
+
+void TmModuleIpfixLogRegister(void)
+{
+    tmm_modules[TMM_IPFIXLOG].name = "IpfixLog";
+    tmm_modules[TMM_IPFIXLOG].ThreadInit = IpfixLogThreadInit;
+    tmm_modules[TMM_IPFIXLOG].ThreadExitPrintStats = IpfixLogExitPrintStats;
+    tmm_modules[TMM_IPFIXLOG].ThreadDeinit = IpfixLogThreadDeinit;
+    tmm_modules[TMM_IPFIXLOG].RegisterTests = IpfixLogRegisterTests;
+    tmm_modules[TMM_IPFIXLOG].cap_flags = 0;
+    tmm_modules[TMM_IPFIXLOG].flags = TM_FLAG_LOGAPI_TM;
+
+    OutputRegisterFlowModule("IpfixLog", "ipfix-log", IpfixLogInitCtx,
+            IpfixLogger);
+}
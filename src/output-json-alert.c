@@ -87,11 +87,24 @@ typedef struct AlertJsonOutputCtx_ {
     HttpXFFCfg *xff_cfg;
 } AlertJsonOutputCtx;
 
+/** encoded payloads of the packet being logged. Built on first use and
+ *  shared by all its alerts */
+typedef struct AlertJsonPayloadCache_ {
+    int stream_collected;   /**< payload_buffer holds the stream data */
+    json_t *stream_base64;
+    json_t *stream_printable;
+    json_t *payload_base64;
+    json_t *payload_printable;
+    json_t *packet_base64;
+} AlertJsonPayloadCache;
+
 typedef struct JsonAlertLogThread_ {
     /** LogFileCtx has the pointer to the file and a mutex to allow multithreading */
     LogFileCtx* file_ctx;
     MemBuffer *json_buffer;
     MemBuffer *payload_buffer;
+    MemBuffer *encode_buffer;   /**< scratch for base64 and printable */
+    AlertJsonPayloadCache cache;
     AlertJsonOutputCtx* json_output_ctx;
 } JsonAlertLogThread;
 
@@ -105,6 +118,77 @@ static int AlertJsonDumpStreamSegmentCallback(const Packet *p, void *data, uint8
     return 1;
 }
 
+/**
+ * \brief make sure the encode buffer holds 'size' bytes
+ */
+static uint8_t *AlertJsonEncodeBuffer(JsonAlertLogThread *aft, uint32_t size)
+{
+    if (aft->encode_buffer->size < size) {
+        if (MemBufferExpand(&aft->encode_buffer,
+                    size - aft->encode_buffer->size) < 0)
+            return NULL;
+    }
+    return aft->encode_buffer->buffer;
+}
+
+/**
+ * \brief base64 encode into a json string
+ *
+ * The output is ASCII, so the UTF-8 check of json_string() is skipped.
+ */
+static json_t *AlertJsonBase64(JsonAlertLogThread *aft,
+        const uint8_t *data, uint32_t len)
+{
+    unsigned long size = 4 * ((len + 2) / 3) + 1;
+    uint8_t *encoded = AlertJsonEncodeBuffer(aft, size);
+    if (encoded == NULL)
+        return NULL;
+    if (Base64Encode(data, len, encoded, &size) != SC_BASE64_OK)
+        return NULL;
+    return json_string_nocheck((char *)encoded);
+}
+
+static json_t *AlertJsonPrintable(JsonAlertLogThread *aft,
+        const uint8_t *data, uint32_t len)
+{
+    uint8_t *printable = AlertJsonEncodeBuffer(aft, len + 1);
+    if (printable == NULL)
+        return NULL;
+    uint32_t offset = 0;
+    PrintStringsToBuffer(printable, &offset, len + 1, (uint8_t *)data, len);
+    return json_string_nocheck((char *)printable);
+}
+
+/**
+ * \brief add a cached encoding to the alert, encoding it on first use
+ */
+static void AlertJsonSetCached(json_t *js, const char *key, json_t **cached,
+        JsonAlertLogThread *aft, const uint8_t *data, uint32_t len,
+        json_t *(*Encode)(JsonAlertLogThread *, const uint8_t *, uint32_t))
+{
+    if (*cached == NULL) {
+        *cached = Encode(aft, data, len);
+        if (*cached == NULL)
+            return;
+    }
+    json_object_set(js, key, *cached);
+}
+
+static void AlertJsonPayloadCacheReset(AlertJsonPayloadCache *cache)
+{
+    if (cache->stream_base64 != NULL)
+        json_decref(cache->stream_base64);
+    if (cache->stream_printable != NULL)
+        json_decref(cache->stream_printable);
+    if (cache->payload_base64 != NULL)
+        json_decref(cache->payload_base64);
+    if (cache->payload_printable != NULL)
+        json_decref(cache->payload_printable);
+    if (cache->packet_base64 != NULL)
+        json_decref(cache->packet_base64);
+    memset(cache, 0, sizeof(*cache));
+}
+
 static void AlertJsonTls(const Flow *f, json_t *js)
 {
     SSLState *ssl_state = (SSLState *)FlowGetAppState(f);
@@ -269,54 +353,50 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                          (pa->flags & (PACKET_ALERT_FLAG_STATE_MATCH | PACKET_ALERT_FLAG_STREAM_MATCH) ?
                          1 : 0) : 0;
 
-            /* Is this a stream?  If so, pack part of it into the payload field */
+            /* Is this a stream?  If so, pack part of it into the payload
+             * field. It's the same for all alerts of the packet, so it's
+             * collected and encoded only once. */
             if (stream) {
-                uint8_t flag;
+                if (!aft->cache.stream_collected) {
+                    uint8_t flag;
 
-                MemBufferReset(payload);
+                    MemBufferReset(payload);
 
-                if (p->flowflags & FLOW_PKT_TOSERVER) {
-                    flag = FLOW_PKT_TOCLIENT;
-                } else {
-                    flag = FLOW_PKT_TOSERVER;
-                }
+                    if (p->flowflags & FLOW_PKT_TOSERVER) {
+                        flag = FLOW_PKT_TOCLIENT;
+                    } else {
+                        flag = FLOW_PKT_TOSERVER;
+                    }
 
-                StreamSegmentForEach((const Packet *)p, flag,
-                                    AlertJsonDumpStreamSegmentCallback,
-                                    (void *)payload);
+                    StreamSegmentForEach((const Packet *)p, flag,
+                                        AlertJsonDumpStreamSegmentCallback,
+                                        (void *)payload);
+                    aft->cache.stream_collected = 1;
+                }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD_BASE64) {
-                    unsigned long len = json_output_ctx->payload_buffer_size * 2;
-                    uint8_t encoded[len];
-                    Base64Encode(payload->buffer, payload->offset, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    AlertJsonSetCached(js, "payload", &aft->cache.stream_base64,
+                            aft, payload->buffer, payload->offset,
+                            AlertJsonBase64);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
-                    uint8_t printable_buf[payload->offset + 1];
-                    uint32_t offset = 0;
-                    PrintStringsToBuffer(printable_buf, &offset,
-                                     sizeof(printable_buf),
-                                     payload->buffer, payload->offset);
-                    json_object_set_new(js, "payload_printable",
-                                        json_string((char *)printable_buf));
+                    AlertJsonSetCached(js, "payload_printable",
+                            &aft->cache.stream_printable, aft,
+                            payload->buffer, payload->offset,
+                            AlertJsonPrintable);
                 }
             } else {
                 /* This is a single packet and not a stream */
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD_BASE64) {
-                    unsigned long len = p->payload_len * 2 + 1;
-                    uint8_t encoded[len];
-                    Base64Encode(p->payload, p->payload_len, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    AlertJsonSetCached(js, "payload", &aft->cache.payload_base64,
+                            aft, p->payload, p->payload_len, AlertJsonBase64);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
-                    uint8_t printable_buf[p->payload_len + 1];
-                    uint32_t offset = 0;
-                    PrintStringsToBuffer(printable_buf, &offset,
-                                     p->payload_len + 1,
-                                     p->payload, p->payload_len);
-                    json_object_set_new(js, "payload_printable", json_string((char *)printable_buf));
+                    AlertJsonSetCached(js, "payload_printable",
+                            &aft->cache.payload_printable, aft,
+                            p->payload, p->payload_len, AlertJsonPrintable);
                 }
             }
 
@@ -325,10 +405,8 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 
         /* base64-encoded full packet */
         if (json_output_ctx->flags & LOG_JSON_PACKET) {
-            unsigned long len = GET_PKT_LEN(p) * 2;
-            uint8_t encoded_packet[len];
-            Base64Encode((unsigned char*) GET_PKT_DATA(p), GET_PKT_LEN(p), encoded_packet, &len);
-            json_object_set_new(js, "packet", json_string((char *)encoded_packet));
+            AlertJsonSetCached(js, "packet", &aft->cache.packet_base64, aft,
+                    GET_PKT_DATA(p), GET_PKT_LEN(p), AlertJsonBase64);
         }
 
         HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg;
@@ -367,6 +445,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
     }
     json_object_clear(js);
     json_decref(js);
+    AlertJsonPayloadCacheReset(&aft->cache);
 
     return TM_ECODE_OK;
 }
@@ -443,21 +522,94 @@ static int AlertJsonDecoderEvent(ThreadVars *tv, JsonAlertLogThread *aft, const
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief log the summary of an alert aggregation window
+ *
+ *  The record has the tuple of the first alert of the window and the
+ *  time of the last. */
+static void AlertJsonAggregate(JsonAlertLogThread *aft,
+                               const PacketAlertAggregate *agg)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    char proto[16];
+    const Signature *s = agg->s;
+
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return;
+
+    CreateIsoTimeString(&agg->last, timebuf, sizeof(timebuf));
+    json_object_set_new(js, "timestamp", json_string(timebuf));
+    json_object_set_new(js, "event_type", json_string("alert"));
+
+    int af = (agg->src.family == AF_INET6) ? AF_INET6 : AF_INET;
+    PrintInet(af, (const void *)agg->src.addr_data32, srcip, sizeof(srcip));
+    PrintInet(af, (const void *)agg->dst.addr_data32, dstip, sizeof(dstip));
+    if (SCProtoNameValid(agg->proto) == TRUE) {
+        strlcpy(proto, known_proto[agg->proto], sizeof(proto));
+    } else {
+        snprintf(proto, sizeof(proto), "%03" PRIu32, agg->proto);
+    }
+
+    json_object_set_new(js, "src_ip", json_string(srcip));
+    json_object_set_new(js, "dest_ip", json_string(dstip));
+    if (agg->proto == IPPROTO_TCP || agg->proto == IPPROTO_UDP ||
+        agg->proto == IPPROTO_SCTP) {
+        json_object_set_new(js, "src_port", json_integer(agg->sp));
+        json_object_set_new(js, "dest_port", json_integer(agg->dp));
+    }
+    json_object_set_new(js, "proto", json_string(proto));
+
+    json_t *ajs = json_object();
+    if (ajs != NULL) {
+        json_object_set_new(ajs, "gid", json_integer(s->gid));
+        json_object_set_new(ajs, "signature_id", json_integer(s->id));
+        json_object_set_new(ajs, "rev", json_integer(s->rev));
+        json_object_set_new(ajs, "signature",
+                json_string((s->msg) ? s->msg : ""));
+        json_object_set_new(ajs, "category",
+                json_string((s->class_msg) ? s->class_msg : ""));
+        json_object_set_new(ajs, "severity", json_integer(s->prio));
+        json_object_set_new(js, "alert", ajs);
+    }
+
+    json_t *gjs = json_object();
+    if (gjs != NULL) {
+        json_object_set_new(gjs, "count", json_integer(agg->count));
+        CreateIsoTimeString(&agg->first, timebuf, sizeof(timebuf));
+        json_object_set_new(gjs, "first", json_string(timebuf));
+        CreateIsoTimeString(&agg->last, timebuf, sizeof(timebuf));
+        json_object_set_new(gjs, "last", json_string(timebuf));
+        json_object_set_new(js, "aggregate", gjs);
+    }
+
+    MemBufferReset(aft->json_buffer);
+    OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
+    json_decref(js);
+}
+
 static int JsonAlertLogger(ThreadVars *tv, void *thread_data, const Packet *p)
 {
     JsonAlertLogThread *aft = thread_data;
+    int r = 0;
 
     if (PKT_IS_IPV4(p) || PKT_IS_IPV6(p)) {
-        return AlertJson(tv, aft, p);
+        r = AlertJson(tv, aft, p);
     } else if (p->alerts.cnt > 0) {
-        return AlertJsonDecoderEvent(tv, aft, p);
+        r = AlertJsonDecoderEvent(tv, aft, p);
+    }
+
+    uint16_t i;
+    for (i = 0; i < p->alerts.agg_cnt; i++) {
+        AlertJsonAggregate(aft, &p->alerts.agg[i]);
     }
-    return 0;
+    return r;
 }
 
 static int JsonAlertLogCondition(ThreadVars *tv, const Packet *p)
 {
-    return (p->alerts.cnt ? TRUE : FALSE);
+    return ((p->alerts.cnt || p->alerts.agg_cnt) ? TRUE : FALSE);
 }
 
 #define OUTPUT_BUFFER_SIZE 65535
@@ -487,6 +639,16 @@ static TmEcode JsonAlertLogThreadInit(ThreadVars *t, void *initdata, void **data
 
     aft->payload_buffer = MemBufferCreateNew(json_output_ctx->payload_buffer_size);
     if (aft->payload_buffer == NULL) {
+        MemBufferFree(aft->json_buffer);
+        SCFree(aft);
+        return TM_ECODE_FAILED;
+    }
+
+    /* grown on demand to the largest encoding */
+    aft->encode_buffer = MemBufferCreateNew(4 * ((json_output_ctx->payload_buffer_size + 2) / 3) + 1);
+    if (aft->encode_buffer == NULL) {
+        MemBufferFree(aft->json_buffer);
+        MemBufferFree(aft->payload_buffer);
         SCFree(aft);
         return TM_ECODE_FAILED;
     }
@@ -504,6 +666,8 @@ static TmEcode JsonAlertLogThreadDeinit(ThreadVars *t, void *data)
 
     MemBufferFree(aft->json_buffer);
     MemBufferFree(aft->payload_buffer);
+    MemBufferFree(aft->encode_buffer);
+    AlertJsonPayloadCacheReset(&aft->cache);
 
     /* clear memory */
     memset(aft, 0, sizeof(JsonAlertLogThread));
@@ -80,6 +80,20 @@ typedef struct JsonFileLogThread_ {
  *  \internal
  *  \brief Write meta data on a single line json record
  */
+#ifdef HAVE_NSS
+static void JsonFileAddHash(json_t *js, const char *name,
+        const uint8_t *hash, size_t hash_len)
+{
+    size_t x;
+    int i;
+    char s[256];
+    for (i = 0, x = 0; x < hash_len; x++) {
+        i += snprintf(&s[i], 255-i, "%02x", hash[x]);
+    }
+    json_object_set_new(js, name, json_string(s));
+}
+#endif
+
 static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const File *ff)
 {
     json_t *js = CreateJSONHeader((Packet *)p, 0, "fileinfo"); //TODO const
@@ -125,15 +139,12 @@ static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const F
         case FILE_STATE_CLOSED:
             json_object_set_new(fjs, "state", json_string("CLOSED"));
 #ifdef HAVE_NSS
-            if (ff->flags & FILE_MD5) {
-                size_t x;
-                int i;
-                char s[256];
-                for (i = 0, x = 0; x < sizeof(ff->md5); x++) {
-                    i += snprintf(&s[i], 255-i, "%02x", ff->md5[x]);
-                }
-                json_object_set_new(fjs, "md5", json_string(s));
-            }
+            if (ff->flags & FILE_MD5)
+                JsonFileAddHash(fjs, "md5", ff->md5, sizeof(ff->md5));
+            if (ff->flags & FILE_SHA1)
+                JsonFileAddHash(fjs, "sha1", ff->sha1, sizeof(ff->sha1));
+            if (ff->flags & FILE_SHA256)
+                JsonFileAddHash(fjs, "sha256", ff->sha256, sizeof(ff->sha256));
 #endif
             break;
         case FILE_STATE_TRUNCATED:
@@ -270,15 +281,7 @@ OutputCtx *OutputFileLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
             SCLogConfig("forcing magic lookup for logged files");
         }
 
-        const char *force_md5 = ConfNodeLookupChildValue(conf, "force-md5");
-        if (force_md5 != NULL && ConfValIsTrue(force_md5)) {
-#ifdef HAVE_NSS
-            FileForceMd5Enable();
-            SCLogConfig("forcing md5 calculation for logged files");
-#else
-            SCLogInfo("md5 calculation requires linking against libnss");
-#endif
-        }
+        FileForceHashParseCfg(conf);
     }
 
     output_ctx->data = output_file_ctx;
@@ -0,0 +1,226 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Logs modbus transactions in eve. Records are written straight into the
+ * thread's buffer from the tx summary, without building a json tree.
+ */
+
+#include "suricata-common.h"
+#include "debug.h"
+#include "detect.h"
+#include "pkt-var.h"
+#include "conf.h"
+
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+
+#include "util-unittest.h"
+#include "util-buffer.h"
+#include "util-debug.h"
+
+#include "output.h"
+#include "output-json.h"
+#include "util-json-builder.h"
+
+#include "app-layer.h"
+#include "app-layer-parser.h"
+
+#include "app-layer-modbus.h"
+#include "output-json-modbus.h"
+
+#ifdef HAVE_LIBJANSSON
+
+typedef struct LogModbusFileCtx_ {
+    LogFileCtx *file_ctx;
+    uint32_t    flags;
+} LogModbusFileCtx;
+
+typedef struct LogModbusLogThread_ {
+    LogModbusFileCtx   *modbuslog_ctx;
+    uint32_t            count;
+    MemBuffer          *buffer;
+} LogModbusLogThread;
+
+static const char *JsonModbusAccess(uint8_t type)
+{
+    switch (type & MODBUS_TYP_ACCESS_MASK) {
+        case MODBUS_TYP_READ:
+            return "read";
+        case MODBUS_TYP_WRITE:
+            return "write";
+        case MODBUS_TYP_READ | MODBUS_TYP_WRITE:
+            return "read_write";
+        default:
+            return NULL;
+    }
+}
+
+static void JsonModbusLogJSON(JsonBuilder *jb, const ModbusTransaction *tx)
+{
+    const ModbusTxSummary *s = &tx->summary;
+
+    JsonBuilderOpenObject(jb, "modbus");
+    JsonBuilderSetUint(jb, "transaction_id", tx->transactionId);
+    JsonBuilderSetUint(jb, "function", s->function);
+
+    const char *access = JsonModbusAccess(s->type);
+    if (access != NULL)
+        JsonBuilderSetString(jb, "access", access);
+
+    if (s->read_start != 0) {
+        JsonBuilderOpenObject(jb, "read");
+        JsonBuilderSetUint(jb, "address", s->read_start);
+        JsonBuilderSetUint(jb, "quantity", s->read_end - s->read_start + 1);
+        JsonBuilderClose(jb);
+    }
+    if (s->write_start != 0) {
+        JsonBuilderOpenObject(jb, "write");
+        JsonBuilderSetUint(jb, "address", s->write_start);
+        JsonBuilderSetUint(jb, "quantity", s->write_end - s->write_start + 1);
+        if (tx->data_cnt > 0)
+            JsonBuilderSetUint(jb, "value_hash", s->value_hash);
+        JsonBuilderClose(jb);
+    }
+
+    JsonBuilderSetBool(jb, "replied", tx->replied);
+    JsonBuilderClose(jb);
+}
+
+static int JsonModbusLogger(ThreadVars *tv, void *thread_data,
+    const Packet *p, Flow *f, void *state, void *tx, uint64_t tx_id)
+{
+    LogModbusLogThread *thread = thread_data;
+    LogFileCtx *file_ctx = thread->modbuslog_ctx->file_ctx;
+    JsonBuilder jb;
+
+    MemBufferReset(thread->buffer);
+
+    OutputJSONBuilderStart(&jb, file_ctx, &thread->buffer);
+    JsonBuilderHeaderWithTxId(&jb, p, 1, "modbus", tx_id);
+    JsonModbusLogJSON(&jb, (const ModbusTransaction *)tx);
+    OutputJSONBuilderBuffer(&jb, file_ctx);
+
+    thread->count++;
+    return TM_ECODE_OK;
+}
+
+static void OutputModbusLogDeInitCtxSub(OutputCtx *output_ctx)
+{
+    LogModbusFileCtx *modbuslog_ctx = (LogModbusFileCtx *)output_ctx->data;
+    SCFree(modbuslog_ctx);
+    SCFree(output_ctx);
+}
+
+static OutputCtx *OutputModbusLogInitSub(ConfNode *conf,
+    OutputCtx *parent_ctx)
+{
+    AlertJsonThread *ajt = parent_ctx->data;
+
+    LogModbusFileCtx *modbuslog_ctx = SCCalloc(1, sizeof(*modbuslog_ctx));
+    if (unlikely(modbuslog_ctx == NULL)) {
+        return NULL;
+    }
+    modbuslog_ctx->file_ctx = ajt->file_ctx;
+
+    OutputCtx *output_ctx = SCCalloc(1, sizeof(*output_ctx));
+    if (unlikely(output_ctx == NULL)) {
+        SCFree(modbuslog_ctx);
+        return NULL;
+    }
+    output_ctx->data = modbuslog_ctx;
+    output_ctx->DeInit = OutputModbusLogDeInitCtxSub;
+
+    AppLayerParserRegisterLogger(IPPROTO_TCP, ALPROTO_MODBUS);
+
+    return output_ctx;
+}
+
+#define OUTPUT_BUFFER_SIZE 65535
+
+static TmEcode JsonModbusLogThreadInit(ThreadVars *t, void *initdata, void **data)
+{
+    LogModbusLogThread *thread = SCCalloc(1, sizeof(*thread));
+    if (unlikely(thread == NULL)) {
+        return TM_ECODE_FAILED;
+    }
+
+    if (initdata == NULL) {
+        SCLogDebug("Error getting context for EveLogModbus.  \"initdata\" is NULL.");
+        SCFree(thread);
+        return TM_ECODE_FAILED;
+    }
+
+    thread->buffer = MemBufferCreateNew(OUTPUT_BUFFER_SIZE);
+    if (unlikely(thread->buffer == NULL)) {
+        SCFree(thread);
+        return TM_ECODE_FAILED;
+    }
+
+    thread->modbuslog_ctx = ((OutputCtx *)initdata)->data;
+    *data = (void *)thread;
+
+    return TM_ECODE_OK;
+}
+
+static TmEcode JsonModbusLogThreadDeinit(ThreadVars *t, void *data)
+{
+    LogModbusLogThread *thread = (LogModbusLogThread *)data;
+    if (thread == NULL) {
+        return TM_ECODE_OK;
+    }
+    if (thread->buffer != NULL) {
+        MemBufferFree(thread->buffer);
+    }
+    SCFree(thread);
+    return TM_ECODE_OK;
+}
+
+void TmModuleJsonModbusLogRegister(void)
+{
+    tmm_modules[TMM_JSONMODBUSLOG].name = "JsonModbusLog";
+    tmm_modules[TMM_JSONMODBUSLOG].ThreadInit = JsonModbusLogThreadInit;
+    tmm_modules[TMM_JSONMODBUSLOG].ThreadDeinit = JsonModbusLogThreadDeinit;
+    tmm_modules[TMM_JSONMODBUSLOG].RegisterTests = NULL;
+    tmm_modules[TMM_JSONMODBUSLOG].cap_flags = 0;
+    tmm_modules[TMM_JSONMODBUSLOG].flags = TM_FLAG_LOGAPI_TM;
+
+    /* Register as an eve sub-module. */
+    OutputRegisterTxSubModule("eve-log", "JsonModbusLog", "eve-log.modbus",
+        OutputModbusLogInitSub, ALPROTO_MODBUS, JsonModbusLogger);
+}
+
+#else /* No JSON support. */
+
+static TmEcode JsonModbusLogThreadInit(ThreadVars *t, void *initdata,
+    void **data)
+{
+    SCLogInfo("Cannot initialize JSON output for modbus. "
+        "JSON support was disabled during build.");
+    return TM_ECODE_FAILED;
+}
+
+void TmModuleJsonModbusLogRegister(void)
+{
+    tmm_modules[TMM_JSONMODBUSLOG].name = "JsonModbusLog";
+    tmm_modules[TMM_JSONMODBUSLOG].ThreadInit = JsonModbusLogThreadInit;
+}
+
+#endif /* HAVE_LIBJANSSON */
@@ -74,7 +74,7 @@ static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type, int dir)
 
     struct timeval tv;
     memset(&tv, 0x00, sizeof(tv));
-    TimeGet(&tv);
+    TimeGetCoarse(&tv);
 
     CreateIsoTimeString(&tv, timebuf, sizeof(timebuf));
 
@@ -123,6 +123,8 @@ static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type, int dir)
     if (sensor_id >= 0)
         json_object_set_new(js, "sensor_id", json_integer(sensor_id));
 #endif
+    if (f->job_id != 0)
+        json_object_set_new(js, "pcap_job", json_integer(f->job_id));
     if (event_type) {
         json_object_set_new(js, "event_type", json_string(event_type));
     }
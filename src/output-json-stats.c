@@ -46,6 +46,7 @@
 
 #include "output-json.h"
 #include "output-json-stats.h"
+#include "util-latency.h"
 
 #define MODULE_NAME "JsonStatsLog"
 
@@ -168,6 +169,11 @@ json_t *StatsToJSON(const StatsTable *st, uint8_t flags)
         }
         json_object_set_new(js_stats, "threads", threads);
     }
+
+    json_t *js_latency = LatencyToJSON(flags & JSON_STATS_THREADS);
+    if (js_latency != NULL) {
+        json_object_set_new(js_stats, "latency", js_latency);
+    }
     return js_stats;
 }
 
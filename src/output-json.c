@@ -56,7 +56,11 @@
 #include "util-optimize.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-log-kafka.h"
+#include "util-json-builder.h"
+#include "util-msgpack.h"
 #include "util-device.h"
+#include "util-misc.h"
 
 
 #ifndef HAVE_LIBJANSSON
@@ -92,6 +96,66 @@ TmEcode OutputJsonThreadInit(ThreadVars *t, void *initdata, void **data)
     return TM_ECODE_FAILED;
 }
 
+/** \brief start a record for a JsonBuilder based logger
+ *
+ *  Writes the prefix, if any, and opens the top level object. */
+void OutputJSONBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx,
+                            MemBuffer **buffer)
+{
+    if (file_ctx->binary) {
+        JsonBuilderInitMsgPack(jb, buffer);
+        jb->error = (MsgPackRecordStart(buffer) < 0);
+        JsonBuilderOpenObject(jb, NULL);
+        return;
+    }
+
+    JsonBuilderInit(jb, buffer);
+
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+    JsonBuilderOpenObject(jb, NULL);
+}
+
+/** \brief finish a record started with OutputJSONBuilderStart and log it */
+int OutputJSONBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx)
+{
+    if (file_ctx->sensor_name) {
+        JsonBuilderSetString(jb, "host", file_ctx->sensor_name);
+    }
+    JsonBuilderClose(jb);
+
+    if (!JsonBuilderIsValid(jb))
+        return TM_ECODE_OK;
+
+    /* the length prefix is right before the top level object */
+    if (jb->msgpack)
+        MsgPackRecordEnd(*jb->buffer, jb->offset[0] - MSGPACK_RECORD_HDR_LEN);
+
+    LogFileWrite(file_ctx, *jb->buffer);
+    return 0;
+}
+
+void JsonBuilderTcpFlags(uint8_t flags, JsonBuilder *jb)
+{
+    if (flags & TH_SYN)
+        JsonBuilderSetBool(jb, "syn", 1);
+    if (flags & TH_FIN)
+        JsonBuilderSetBool(jb, "fin", 1);
+    if (flags & TH_RST)
+        JsonBuilderSetBool(jb, "rst", 1);
+    if (flags & TH_PUSH)
+        JsonBuilderSetBool(jb, "psh", 1);
+    if (flags & TH_ACK)
+        JsonBuilderSetBool(jb, "ack", 1);
+    if (flags & TH_URG)
+        JsonBuilderSetBool(jb, "urg", 1);
+    if (flags & TH_ECN)
+        JsonBuilderSetBool(jb, "ecn", 1);
+    if (flags & TH_CWR)
+        JsonBuilderSetBool(jb, "cwr", 1);
+}
+
 TmEcode OutputJson (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     return TM_ECODE_OK;
@@ -169,61 +233,78 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
     json_object_set_new(js, "flow_id", json_integer(f->flow_hash));
 }
 
-json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
-                         const char *event_type)
+/** \internal
+ *  \brief addresses, ports and protocol name of the header of a record
+ *
+ *  \param srcip, dstip 46 bytes each
+ *  \param proto 16 bytes
+ */
+static void JsonHeaderTuple(const Packet *p, int direction_sensitive,
+                            char *srcip, char *dstip, Port *sp_out,
+                            Port *dp_out, char *proto)
 {
-    char timebuf[64];
-    char srcip[46], dstip[46];
+    const size_t ipsize = 46;
     Port sp, dp;
 
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
-    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
-
     srcip[0] = '\0';
     dstip[0] = '\0';
     if (direction_sensitive) {
         if ((PKT_IS_TOSERVER(p))) {
             if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, ipsize);
+                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, ipsize);
             } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, ipsize);
+                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, ipsize);
             }
             sp = p->sp;
             dp = p->dp;
         } else {
             if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, ipsize);
+                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, ipsize);
             } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, sizeof(dstip));
+                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, ipsize);
+                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, ipsize);
             }
             sp = p->dp;
             dp = p->sp;
         }
     } else {
         if (PKT_IS_IPV4(p)) {
-            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, ipsize);
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, ipsize);
         } else if (PKT_IS_IPV6(p)) {
-            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, ipsize);
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, ipsize);
         }
         sp = p->sp;
         dp = p->dp;
     }
 
-    char proto[16];
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
+        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], 16);
     } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
+        snprintf(proto, 16, "%03" PRIu32, IP_GET_IPPROTO(p));
     }
+    *sp_out = sp;
+    *dp_out = dp;
+}
+
+json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
+                         const char *event_type)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    char proto[16];
+    Port sp, dp;
+
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+    JsonHeaderTuple(p, direction_sensitive, srcip, dstip, &sp, &dp, proto);
 
     /* time & tx */
     json_object_set_new(js, "timestamp", json_string(timebuf));
@@ -244,6 +325,11 @@ json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
         json_object_set_new(js, "pcap_cnt", json_integer(p->pcap_cnt));
     }
 
+    /* unix socket pcap job */
+    if (p->job_id != 0) {
+        json_object_set_new(js, "pcap_job", json_integer(p->job_id));
+    }
+
     if (event_type) {
         json_object_set_new(js, "event_type", json_string(event_type));
     }
@@ -329,6 +415,64 @@ json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive,
     return js;
 }
 
+/** \brief CreateJSONHeaderWithTxId() for a logger using a JsonBuilder */
+void JsonBuilderHeaderWithTxId(JsonBuilder *jb, const Packet *p,
+                               int direction_sensitive,
+                               const char *event_type, uint64_t tx_id)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    char proto[16];
+    Port sp, dp;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+    JsonHeaderTuple(p, direction_sensitive, srcip, dstip, &sp, &dp, proto);
+
+    JsonBuilderSetString(jb, "timestamp", timebuf);
+    if (p->flow != NULL)
+        JsonBuilderSetUint(jb, "flow_id", p->flow->flow_hash);
+    if (sensor_id >= 0)
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
+    if (p->livedev)
+        JsonBuilderSetString(jb, "in_iface", p->livedev->dev);
+    if (p->pcap_cnt != 0)
+        JsonBuilderSetUint(jb, "pcap_cnt", p->pcap_cnt);
+    if (p->job_id != 0)
+        JsonBuilderSetUint(jb, "pcap_job", p->job_id);
+    if (event_type)
+        JsonBuilderSetString(jb, "event_type", event_type);
+
+    if (p->vlan_idx == 1) {
+        JsonBuilderSetUint(jb, "vlan", VLAN_GET_ID1(p));
+    } else if (p->vlan_idx == 2) {
+        JsonBuilderOpenArray(jb, "vlan");
+        JsonBuilderSetUint(jb, NULL, VLAN_GET_ID1(p));
+        JsonBuilderSetUint(jb, NULL, VLAN_GET_ID2(p));
+        JsonBuilderClose(jb);
+    }
+
+    int ports = (p->proto == IPPROTO_UDP || p->proto == IPPROTO_TCP ||
+                 p->proto == IPPROTO_SCTP);
+    JsonBuilderSetString(jb, "src_ip", srcip);
+    if (ports)
+        JsonBuilderSetUint(jb, "src_port", sp);
+    JsonBuilderSetString(jb, "dest_ip", dstip);
+    if (ports)
+        JsonBuilderSetUint(jb, "dest_port", dp);
+    JsonBuilderSetString(jb, "proto", proto);
+
+    if (p->proto == IPPROTO_ICMP && p->icmpv4h) {
+        JsonBuilderSetUint(jb, "icmp_type", p->icmpv4h->type);
+        JsonBuilderSetUint(jb, "icmp_code", p->icmpv4h->code);
+    } else if (p->proto == IPPROTO_ICMPV6 && p->icmpv6h) {
+        JsonBuilderSetUint(jb, "icmp_type", p->icmpv6h->type);
+        JsonBuilderSetUint(jb, "icmp_code", p->icmpv6h->code);
+    }
+
+    /* tx id for correlation with other events */
+    JsonBuilderSetUint(jb, "tx_id", tx_id);
+}
+
 int OutputJSONMemBufferCallback(const char *str, size_t size, void *data)
 {
     OutputJSONMemBufferWrapper *wrapper = data;
@@ -349,6 +493,17 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
                             json_string(file_ctx->sensor_name));
     }
 
+    if (file_ctx->binary) {
+        uint32_t start = MEMBUFFER_OFFSET(*buffer);
+        if (MsgPackRecordStart(buffer) < 0 ||
+            MsgPackEncodeJson(js, buffer) < 0)
+            return TM_ECODE_OK;
+        MsgPackRecordEnd(*buffer, start);
+
+        LogFileWrite(file_ctx, *buffer);
+        return 0;
+    }
+
     if (file_ctx->prefix) {
         MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
     }
@@ -413,6 +568,32 @@ void OutputJsonExitPrintStats(ThreadVars *tv, void *data)
 
 }
 
+/** \internal
+ *  \brief set up the writer thread if eve-log.async is enabled */
+static void OutputJsonInitAsync(ConfNode *conf, LogFileCtx *file_ctx)
+{
+    const char *async_s = ConfNodeLookupChildValue(conf, "async");
+    /* compressed files are flushed per write, so they need the batches
+     * of the writer thread to compress well */
+    if ((async_s != NULL && ConfValIsTrue(async_s)) ||
+        (async_s == NULL && file_ctx->compress != NULL)) {
+        uint32_t async_size = LOGFILE_ASYNC_BUFFER_SIZE;
+        const char *size_s = ConfNodeLookupChildValue(conf,
+                "async-buffer-size");
+        if (size_s != NULL &&
+            (ParseSizeStringU32(size_s, &async_size) < 0 ||
+             async_size == 0)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                       "Invalid eve-log async-buffer-size: %s", size_s);
+            exit(EXIT_FAILURE);
+        }
+        if (LogFileAsyncInit(file_ctx, async_size) != 0) {
+            SCLogWarning(SC_ERR_INITIALIZATION, "eve-log async "
+                    "writer unavailable, writing synchronously");
+        }
+    }
+}
+
 /**
  * \brief Create a new LogFileCtx for "fast" output style.
  * \param conf The configuration node for this output.
@@ -492,6 +673,14 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
                 SCLogError(SC_ERR_INVALID_ARGUMENT,
                            "redis JSON output option is not compiled");
                 exit(EXIT_FAILURE);
+#endif
+            } else if (strcmp(output_s, "kafka") == 0) {
+#ifdef HAVE_LIBRDKAFKA
+                json_ctx->json_out = LOGFILE_TYPE_KAFKA;
+#else
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "kafka JSON output option is not compiled");
+                exit(EXIT_FAILURE);
 #endif
             } else {
                 SCLogError(SC_ERR_INVALID_ARGUMENT,
@@ -499,6 +688,31 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
                 exit(EXIT_FAILURE);
             }
         }
+        /* the async writer setup depends on the type */
+        json_ctx->file_ctx->type = json_ctx->json_out;
+
+        const char *encoding = ConfNodeLookupChildValue(conf, "encoding");
+        if (encoding != NULL) {
+            if (strcmp(encoding, "msgpack") == 0) {
+                if (json_ctx->json_out == LOGFILE_TYPE_SYSLOG) {
+                    SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log encoding "
+                            "msgpack is not supported for syslog");
+                    exit(EXIT_FAILURE);
+                }
+                if (ConfNodeLookupChildValue(conf, "prefix") != NULL) {
+                    SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log prefix "
+                            "can't be used with encoding msgpack");
+                    exit(EXIT_FAILURE);
+                }
+                json_ctx->file_ctx->binary = 1;
+                SCLogConfig("eve-log: writing length prefixed MessagePack "
+                        "records");
+            } else if (strcmp(encoding, "json") != 0) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT,
+                           "Invalid eve-log encoding: %s", encoding);
+                exit(EXIT_FAILURE);
+            }
+        }
 
         const char *prefix = ConfNodeLookupChildValue(conf, "prefix");
         if (prefix != NULL)
@@ -526,6 +740,8 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
             }
             OutputRegisterFileRotationFlag(&json_ctx->file_ctx->rotation_flag);
 
+            OutputJsonInitAsync(conf, json_ctx->file_ctx);
+
             const char *format_s = ConfNodeLookupChildValue(conf, "format");
             if (format_s != NULL) {
                 if (strcmp(format_s, "indent") == 0) {
@@ -588,6 +804,25 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
                 SCFree(output_ctx);
                 return NULL;
             }
+
+            OutputJsonInitAsync(conf, json_ctx->file_ctx);
+        }
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        else if (json_ctx->json_out == LOGFILE_TYPE_KAFKA) {
+            ConfNode *kafka_node = ConfNodeLookupChild(conf, "kafka");
+            if (!json_ctx->file_ctx->sensor_name) {
+                char hostname[1024];
+                gethostname(hostname, 1023);
+                json_ctx->file_ctx->sensor_name = SCStrdup(hostname);
+            }
+            if (json_ctx->file_ctx->sensor_name  == NULL ||
+                SCConfLogOpenKafka(kafka_node, json_ctx->file_ctx) < 0) {
+                LogFileFreeCtx(json_ctx->file_ctx);
+                SCFree(json_ctx);
+                SCFree(output_ctx);
+                return NULL;
+            }
         }
 #endif
 
@@ -601,7 +836,6 @@ OutputCtx *OutputJsonInitCtx(ConfNode *conf)
             }
         }
 
-        json_ctx->file_ctx->type = json_ctx->json_out;
     }
 
     SCLogDebug("returning output_ctx %p", output_ctx);
@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-json-builder.h"
 
 void TmModuleOutputJsonRegister (void);
 
@@ -45,6 +46,12 @@ json_t *CreateJSONHeader(const Packet *p, int direction_sensative, const char *e
 json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive, const char *event_type, uint64_t tx_id);
 TmEcode OutputJSON(json_t *js, void *data, uint64_t *count);
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer);
+void OutputJSONBuilderStart(JsonBuilder *jb, LogFileCtx *file_ctx, MemBuffer **buffer);
+int OutputJSONBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx);
+void JsonBuilderHeaderWithTxId(JsonBuilder *jb, const Packet *p,
+                               int direction_sensitive,
+                               const char *event_type, uint64_t tx_id);
+void JsonBuilderTcpFlags(uint8_t flags, JsonBuilder *jb);
 OutputCtx *OutputJsonInitCtx(ConfNode *);
 
 enum JsonFormat { COMPACT, INDENT };
@@ -72,18 +72,37 @@
  */
 typedef struct LogLuaMasterCtx_ {
     char path[PATH_MAX]; /**< contains script-dir */
+    int threaded;        /**< lua state per thread */
 } LogLuaMasterCtx;
 
 typedef struct LogLuaCtx_ {
     SCMutex m;
-    lua_State *luastate;
+    lua_State *luastate;    /**< shared state, NULL if threaded */
     int deinit_once;
+    int threaded;
+    int buffer_views;       /**< script asked for buffer views */
+    char path[PATH_MAX];    /**< script, to set up the per thread states */
 } LogLuaCtx;
 
 typedef struct LogLuaThreadCtx_ {
     LogLuaCtx *lua_ctx;
+    /** state used by this thread: its own if threaded, otherwise the
+     *  shared one, which needs the lua_ctx lock */
+    lua_State *luastate;
 } LogLuaThreadCtx;
 
+static inline void LogLuaThreadLock(LogLuaThreadCtx *td)
+{
+    if (!td->lua_ctx->threaded)
+        SCMutexLock(&td->lua_ctx->m);
+}
+
+static inline void LogLuaThreadUnlock(LogLuaThreadCtx *td)
+{
+    if (!td->lua_ctx->threaded)
+        SCMutexUnlock(&td->lua_ctx->m);
+}
+
 /** \internal
  *  \brief TX logger for lua scripts
  *
@@ -98,24 +117,25 @@ static int LuaTxLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow
 
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetTX(td->lua_ctx->luastate, txptr);
-    LuaStateSetFlow(td->lua_ctx->luastate, f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetTX(td->luastate, txptr);
+    LuaStateSetFlow(td->luastate, f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
 
     /* prepare data to pass to script */
-    lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
-    LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
+    lua_getglobal(td->luastate, "log");
+    lua_newtable(td->luastate);
+    LuaPushTableKeyValueInt(td->luastate, "tx_id", (int)(tx_id));
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
+    LuaBufferViewsInvalidate(td->luastate);
 
-    SCMutexUnlock(&td->lua_ctx->m);
+    LogLuaThreadUnlock(td);
     SCReturnInt(0);
 }
 
@@ -142,27 +162,28 @@ static int LuaStreamingLogger(ThreadVars *tv, void *thread_data, const Flow *f,
 
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
+    LuaStateSetThreadVars(td->luastate, tv);
     if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION)
-        LuaStateSetTX(td->lua_ctx->luastate, txptr);
-    LuaStateSetFlow(td->lua_ctx->luastate, (Flow *)f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
-    LuaStateSetStreamingBuffer(td->lua_ctx->luastate, &b);
+        LuaStateSetTX(td->luastate, txptr);
+    LuaStateSetFlow(td->luastate, (Flow *)f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
+    LuaStateSetStreamingBuffer(td->luastate, &b);
 
     /* prepare data to pass to script */
-    lua_getglobal(td->lua_ctx->luastate, "log");
-    lua_newtable(td->lua_ctx->luastate);
+    lua_getglobal(td->luastate, "log");
+    lua_newtable(td->luastate);
 
     if (flags & OUTPUT_STREAMING_FLAG_TRANSACTION)
-        LuaPushTableKeyValueInt(td->lua_ctx->luastate, "tx_id", (int)(tx_id));
+        LuaPushTableKeyValueInt(td->luastate, "tx_id", (int)(tx_id));
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
+    LuaBufferViewsInvalidate(td->luastate);
 
-    SCMutexUnlock(&td->lua_ctx->m);
+    LogLuaThreadUnlock(td);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -198,7 +219,7 @@ static int LuaPacketLoggerAlerts(ThreadVars *tv, void *thread_data, const Packet
     }
 
     /* loop through alerts stored in the packet */
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
     uint16_t cnt;
     for (cnt = 0; cnt < p->alerts.cnt; cnt++) {
         const PacketAlert *pa = &p->alerts.alerts[cnt];
@@ -206,22 +227,23 @@ static int LuaPacketLoggerAlerts(ThreadVars *tv, void *thread_data, const Packet
             continue;
         }
 
-        lua_getglobal(td->lua_ctx->luastate, "log");
+        lua_getglobal(td->luastate, "log");
 
-        LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-        LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-        LuaStateSetFlow(td->lua_ctx->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
-        LuaStateSetPacketAlert(td->lua_ctx->luastate, (PacketAlert *)pa);
+        LuaStateSetThreadVars(td->luastate, tv);
+        LuaStateSetPacket(td->luastate, (Packet *)p);
+        LuaStateSetFlow(td->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
+        LuaStateSetPacketAlert(td->luastate, (PacketAlert *)pa);
 
         /* prepare data to pass to script */
-        //lua_newtable(td->lua_ctx->luastate);
+        //lua_newtable(td->luastate);
 
-        int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+        int retval = lua_pcall(td->luastate, 0, 0, 0);
         if (retval != 0) {
-            SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+            SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
         }
+        LuaBufferViewsInvalidate(td->luastate);
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LogLuaThreadUnlock(td);
 not_supported:
     SCReturnInt(0);
 }
@@ -249,20 +271,21 @@ static int LuaPacketLoggerSsh(ThreadVars *tv, void *thread_data, const Packet *p
     char timebuf[64];
     CreateTimeString(&p->ts, timebuf, sizeof(timebuf));
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetFlow(td->lua_ctx->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetFlow(td->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+    int retval = lua_pcall(td->luastate, 0, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
+    LuaBufferViewsInvalidate(td->luastate);
 
-    SCMutexUnlock(&td->lua_ctx->m);
+    LogLuaThreadUnlock(td);
     FLOWLOCK_WRLOCK(p->flow);
 
     SshState *ssh_state = (SshState *)FlowGetAppState(p->flow);
@@ -344,21 +367,22 @@ static int LuaPacketLogger(ThreadVars *tv, void *thread_data, const Packet *p)
     }
 
     /* loop through alerts stored in the packet */
-    SCMutexLock(&td->lua_ctx->m);
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    LogLuaThreadLock(td);
+    lua_getglobal(td->luastate, "log");
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetFlow(td->lua_ctx->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetFlow(td->luastate, p->flow, /* unlocked */LUA_FLOW_NOT_LOCKED_BY_PARENT);
 
     /* prepare data to pass to script */
-    lua_newtable(td->lua_ctx->luastate);
+    lua_newtable(td->luastate);
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaBufferViewsInvalidate(td->luastate);
+    LogLuaThreadUnlock(td);
 not_supported:
     SCReturnInt(0);
 }
@@ -395,22 +419,23 @@ static int LuaFileLogger(ThreadVars *tv, void *thread_data, const Packet *p, con
     if (p->flow && p->flow->alstate)
         txptr = AppLayerParserGetTx(p->proto, ALPROTO_HTTP, p->flow->alstate, ff->txid);
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetPacket(td->lua_ctx->luastate, (Packet *)p);
-    LuaStateSetTX(td->lua_ctx->luastate, txptr);
-    LuaStateSetFlow(td->lua_ctx->luastate, p->flow, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
-    LuaStateSetFile(td->lua_ctx->luastate, (File *)ff);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetPacket(td->luastate, (Packet *)p);
+    LuaStateSetTX(td->luastate, txptr);
+    LuaStateSetFlow(td->luastate, p->flow, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
+    LuaStateSetFile(td->luastate, (File *)ff);
 
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+    int retval = lua_pcall(td->luastate, 0, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaBufferViewsInvalidate(td->luastate);
+    LogLuaThreadUnlock(td);
     return 0;
 }
 
@@ -428,19 +453,20 @@ static int LuaFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 
     SCLogDebug("f %p", f);
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    LuaStateSetThreadVars(td->lua_ctx->luastate, tv);
-    LuaStateSetFlow(td->lua_ctx->luastate, f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
+    LuaStateSetThreadVars(td->luastate, tv);
+    LuaStateSetFlow(td->luastate, f, /* locked */LUA_FLOW_LOCKED_BY_PARENT);
 
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 0, 0, 0);
+    int retval = lua_pcall(td->luastate, 0, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaBufferViewsInvalidate(td->luastate);
+    LogLuaThreadUnlock(td);
     return 0;
 }
 
@@ -451,11 +477,11 @@ static int LuaStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *s
     SCEnter();
     LogLuaThreadCtx *td = (LogLuaThreadCtx *)thread_data;
 
-    SCMutexLock(&td->lua_ctx->m);
+    LogLuaThreadLock(td);
 
-    lua_State *luastate = td->lua_ctx->luastate;
+    lua_State *luastate = td->luastate;
     /* get the lua function to call */
-    lua_getglobal(td->lua_ctx->luastate, "log");
+    lua_getglobal(td->luastate, "log");
 
     /* create lua array, which is really just a table. The key is an int (1-x),
      * the value another table with named fields: name, tm_name, value, pvalue.
@@ -489,11 +515,12 @@ static int LuaStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *s
         lua_settable(luastate, -3);
     }
 
-    int retval = lua_pcall(td->lua_ctx->luastate, 1, 0, 0);
+    int retval = lua_pcall(td->luastate, 1, 0, 0);
     if (retval != 0) {
-        SCLogInfo("failed to run script: %s", lua_tostring(td->lua_ctx->luastate, -1));
+        SCLogInfo("failed to run script: %s", lua_tostring(td->luastate, -1));
     }
-    SCMutexUnlock(&td->lua_ctx->m);
+    LuaBufferViewsInvalidate(td->luastate);
+    LogLuaThreadUnlock(td);
     return 0;
 
 }
@@ -508,6 +535,7 @@ typedef struct LogLuaScriptOptions_ {
     int http_body;
     int flow;
     int stats;
+    int buffer_views;
 } LogLuaScriptOptions;
 
 /** \brief load and evaluate the script
@@ -622,6 +650,8 @@ static int LuaScriptInit(const char *filename, LogLuaScriptOptions *options) {
             options->tcp_data = 1;
         else if (strcmp(k, "type") == 0 && strcmp(v, "stats") == 0)
             options->stats = 1;
+        else if (strcmp(k, "buffer.view") == 0 && strcmp(v, "true") == 0)
+            options->buffer_views = 1;
         else
             SCLogInfo("unknown key and/or value: k='%s', v='%s'", k, v);
     }
@@ -663,9 +693,11 @@ error:
  *
  *  This loads the script, primes it and then runs the 'setup' function.
  *
+ *  \param buffer_views pass buffers to the script as views, not copies
+ *
  *  \retval state Returns the set up luastate on success, NULL on error
  */
-static lua_State *LuaScriptSetup(const char *filename)
+static lua_State *LuaScriptSetup(const char *filename, int buffer_views)
 {
     lua_State *luastate = luaL_newstate();
     if (luastate == NULL) {
@@ -712,6 +744,7 @@ static lua_State *LuaScriptSetup(const char *filename)
     LuaRegisterTlsFunctions(luastate);
     LuaRegisterSshFunctions(luastate);
     LuaRegisterSmtpFunctions(luastate);
+    LuaRegisterBufferViews(luastate, buffer_views);
 
     if (lua_pcall(luastate, 0, 0, 0) != 0) {
         SCLogError(SC_ERR_LUA_ERROR, "couldn't run script 'setup' function: %s", lua_tostring(luastate, -1));
@@ -758,17 +791,28 @@ static OutputCtx *OutputLuaLogInitSub(ConfNode *conf, OutputCtx *parent_ctx)
     if (parent_ctx && parent_ctx->data) {
         LogLuaMasterCtx *mc = parent_ctx->data;
         dir = mc->path;
+        lua_ctx->threaded = mc->threaded;
     }
 
-    char path[PATH_MAX] = "";
-    snprintf(path, sizeof(path),"%s%s%s", dir, strlen(dir) ? "/" : "", conf->val);
-    SCLogDebug("script full path %s", path);
+    snprintf(lua_ctx->path, sizeof(lua_ctx->path),"%s%s%s", dir, strlen(dir) ? "/" : "", conf->val);
+    SCLogDebug("script full path %s", lua_ctx->path);
 
-    SCMutexLock(&lua_ctx->m);
-    lua_ctx->luastate = LuaScriptSetup(path);
-    SCMutexUnlock(&lua_ctx->m);
-    if (lua_ctx->luastate == NULL)
+    /* the needs of the script were only used to pick its logger, get
+     * the one the states are set up with again */
+    LogLuaScriptOptions opts;
+    memset(&opts, 0x00, sizeof(opts));
+    if (LuaScriptInit(lua_ctx->path, &opts) != 0)
         goto error;
+    lua_ctx->buffer_views = opts.buffer_views;
+
+    /* threaded: each thread sets up its own state in LuaLogThreadInit */
+    if (!lua_ctx->threaded) {
+        SCMutexLock(&lua_ctx->m);
+        lua_ctx->luastate = LuaScriptSetup(lua_ctx->path, lua_ctx->buffer_views);
+        SCMutexUnlock(&lua_ctx->m);
+        if (lua_ctx->luastate == NULL)
+            goto error;
+    }
 
     SCLogDebug("lua_ctx %p", lua_ctx);
 
@@ -828,6 +872,10 @@ static OutputCtx *OutputLuaLogInit(ConfNode *conf)
     }
     LogLuaMasterCtx *master_config = output_ctx->data;
     strlcpy(master_config->path, dir, sizeof(master_config->path));
+    if (ConfNodeChildValueIsTrue(conf, "threaded")) {
+        master_config->threaded = 1;
+        SCLogConfig("lua output: a lua state per thread");
+    }
     TAILQ_INIT(&output_ctx->submodules);
 
     /* check the enables scripts and set them up as submodules */
@@ -926,28 +974,29 @@ error:
 /** \internal
  *  \brief Run the scripts 'deinit' function
  */
-static void OutputLuaLogDoDeinit(LogLuaCtx *lua_ctx)
+static void OutputLuaLogDoDeinit(lua_State *luastate)
 {
-    lua_State *luastate = lua_ctx->luastate;
-
     lua_getglobal(luastate, "deinit");
     if (lua_type(luastate, -1) != LUA_TFUNCTION) {
         SCLogError(SC_ERR_LUA_ERROR, "no deinit function in script");
-        return;
+        goto end;
     }
     //LuaPrintStack(luastate);
 
     if (lua_pcall(luastate, 0, 0, 0) != 0) {
         SCLogError(SC_ERR_LUA_ERROR, "couldn't run script 'deinit' function: %s", lua_tostring(luastate, -1));
-        return;
+        goto end;
     }
+end:
     lua_close(luastate);
 }
 
 /** \internal
  *  \brief Initialize the thread storage for lua
  *
- *  Currently only stores a pointer to the global LogLuaCtx
+ *  Stores a pointer to the global LogLuaCtx. If threaded, the thread
+ *  gets its own lua state, set up from the same script, so the threads
+ *  don't serialize on the lock of the shared state.
  */
 static TmEcode LuaLogThreadInit(ThreadVars *t, void *initdata, void **data)
 {
@@ -965,6 +1014,16 @@ static TmEcode LuaLogThreadInit(ThreadVars *t, void *initdata, void **data)
     LogLuaCtx *lua_ctx = ((OutputCtx *)initdata)->data;
     SCLogDebug("lua_ctx %p", lua_ctx);
     td->lua_ctx = lua_ctx;
+
+    if (lua_ctx->threaded) {
+        td->luastate = LuaScriptSetup(lua_ctx->path, lua_ctx->buffer_views);
+        if (td->luastate == NULL) {
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    } else {
+        td->luastate = lua_ctx->luastate;
+    }
     *data = (void *)td;
     return TM_ECODE_OK;
 }
@@ -972,7 +1031,8 @@ static TmEcode LuaLogThreadInit(ThreadVars *t, void *initdata, void **data)
 /** \internal
  *  \brief Deinit the thread storage for lua
  *
- *  Calls OutputLuaLogDoDeinit if no-one else already did.
+ *  Calls OutputLuaLogDoDeinit for the thread's own state, or for the
+ *  shared state if no-one else already did.
  */
 static TmEcode LuaLogThreadDeinit(ThreadVars *t, void *data)
 {
@@ -981,12 +1041,16 @@ static TmEcode LuaLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
-    SCMutexLock(&td->lua_ctx->m);
-    if (td->lua_ctx->deinit_once == 0) {
-        OutputLuaLogDoDeinit(td->lua_ctx);
-        td->lua_ctx->deinit_once = 1;
+    if (td->lua_ctx->threaded) {
+        OutputLuaLogDoDeinit(td->luastate);
+    } else {
+        SCMutexLock(&td->lua_ctx->m);
+        if (td->lua_ctx->deinit_once == 0) {
+            OutputLuaLogDoDeinit(td->lua_ctx->luastate);
+            td->lua_ctx->deinit_once = 1;
+        }
+        SCMutexUnlock(&td->lua_ctx->m);
     }
-    SCMutexUnlock(&td->lua_ctx->m);
 
     /* clear memory */
     memset(td, 0, sizeof(*td));
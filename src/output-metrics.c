@@ -0,0 +1,476 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * OpenMetrics (Prometheus) stats endpoint
+ *
+ * A management thread serves the stats table in the OpenMetrics text
+ * format over http, on a tcp port or a unix socket. The text is written
+ * straight from the stats table into a buffer that is reused between
+ * scrapes. If no stats loggers are active the table is only built when
+ * it's scraped.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "runmodes.h"
+#include "output-metrics.h"
+#include "util-buffer.h"
+#include "util-debug.h"
+#include "util-privs.h"
+#include "util-signal.h"
+#include "util-unittest.h"
+
+#include <poll.h>
+#include <netdb.h>
+#include <sys/un.h>
+
+#define METRICS_LISTEN_DEFAULT  "127.0.0.1:9187"
+/** a single line of output is never longer than this */
+#define METRICS_LINE_MAX        512
+#define METRICS_BUFFER_SIZE     (64 * 1024)
+#define METRICS_REQUEST_MAX     4096
+
+static int metrics_enabled = -1;
+
+typedef struct MetricsCtx_ {
+    int fd;
+    uint32_t flags;
+    char listen[PATH_MAX];
+    MemBuffer *buffer;
+} MetricsCtx;
+
+static MetricsCtx metrics_ctx = { -1, METRICS_THREADS, "", NULL };
+
+int MetricsEnabled(void)
+{
+    if (metrics_enabled == -1) {
+        if (ConfGetBool("stats.metrics.enabled", &metrics_enabled) != 1)
+            metrics_enabled = 0;
+    }
+    return metrics_enabled;
+}
+
+/** MemBufferWriteString on a MemBuffer ** */
+#define MetricsWrite(buffer, ...) do {                  \
+    MemBuffer *mb_ = *(buffer);                         \
+    MemBufferWriteString(mb_, __VA_ARGS__);             \
+} while (0)
+
+/** \internal
+ *  \brief make sure the buffer has room for at least one more line */
+static int MetricsReserve(MemBuffer **buffer)
+{
+    while (MEMBUFFER_SIZE(*buffer) - MEMBUFFER_OFFSET(*buffer) <= METRICS_LINE_MAX) {
+        uint32_t expand = MEMBUFFER_SIZE(*buffer) > METRICS_LINE_MAX ?
+            MEMBUFFER_SIZE(*buffer) : METRICS_LINE_MAX;
+        if (MemBufferExpand(buffer, expand) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief turn a counter name like 'tcp.reassembly_memuse' into a
+ *         metric name */
+static void MetricsName(char *out, size_t size, const char *name)
+{
+    size_t o = strlcpy(out, "suricata_", size);
+    for ( ; *name != '\0' && o < size - 1; name++, o++) {
+        out[o] = isalnum((unsigned char)*name) ? *name : '_';
+    }
+    out[o] = '\0';
+}
+
+/** \internal
+ *  \brief copy a label value, dropping chars that would need escaping */
+static void MetricsLabel(char *out, size_t size, const char *label)
+{
+    size_t o = 0;
+    for ( ; *label != '\0' && o < size - 1; label++, o++) {
+        out[o] = (*label == '"' || *label == '\\' || *label == '\n') ? '_' : *label;
+    }
+    out[o] = '\0';
+}
+
+/** \brief format the stats table in the OpenMetrics text format
+ *
+ *  \param buffer reset and grown as needed
+ *  \param flags METRICS_THREADS for a series per thread instead of
+ *         the totals
+ *
+ *  \retval 0 ok
+ *  \retval -1 the buffer could not be grown
+ */
+int MetricsFormat(const StatsTable *st, MemBuffer **buffer, uint32_t flags)
+{
+    char name[256];
+    char label[64];
+
+    MemBufferReset(*buffer);
+
+    if (MetricsReserve(buffer) < 0)
+        return -1;
+    MetricsWrite(buffer,
+            "# TYPE suricata_uptime_seconds gauge\n"
+            "suricata_uptime_seconds %"PRIu64"\n",
+            (uint64_t)(st->ts.tv_sec > st->start_time ?
+                st->ts.tv_sec - st->start_time : 0));
+
+    uint32_t c;
+    for (c = 0; c < st->nstats; c++) {
+        const StatsRecord *r = &st->stats[c];
+        if (r->name == NULL)
+            continue;
+
+        MetricsName(name, sizeof(name), r->name);
+
+        if (MetricsReserve(buffer) < 0)
+            return -1;
+        /* counters set to an absolute value are registered like sums,
+         * so only the gauges are typed */
+        MetricsWrite(buffer, "# TYPE %s %s\n", name,
+                r->gauge ? "gauge" : "unknown");
+
+        if (!(flags & METRICS_THREADS) || st->tstats == NULL) {
+            MetricsWrite(buffer, "%s %"PRIu64"\n", name, r->value);
+            continue;
+        }
+
+        uint32_t t;
+        for (t = 0; t < st->ntstats; t++) {
+            const StatsRecord *tr = &st->tstats[t * st->nstats + c];
+            if (tr->name == NULL || tr->tm_name == NULL)
+                continue;
+
+            MetricsLabel(label, sizeof(label), tr->tm_name);
+            if (MetricsReserve(buffer) < 0)
+                return -1;
+            MetricsWrite(buffer, "%s{thread=\"%s\"} %"PRIu64"\n",
+                    name, label, tr->value);
+        }
+    }
+
+    if (MetricsReserve(buffer) < 0)
+        return -1;
+    MetricsWrite(buffer, "# EOF\n");
+    return 0;
+}
+
+static int MetricsFormatCallback(const StatsTable *st, void *data)
+{
+    MetricsCtx *ctx = data;
+    return MetricsFormat(st, &ctx->buffer, ctx->flags);
+}
+
+static int MetricsSend(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief answer a single http request and close the connection */
+static void MetricsHandleClient(MetricsCtx *ctx, int fd)
+{
+    char req[METRICS_REQUEST_MAX];
+    size_t len = 0;
+
+    struct timeval tv = { 1, 0 };
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    while (len < sizeof(req) - 1) {
+        ssize_t r = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (r <= 0)
+            break;
+        len += (size_t)r;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            break;
+    }
+    req[len] = '\0';
+
+    const char *status = "404 Not Found";
+    const char *type = "text/plain";
+    const uint8_t *body = (const uint8_t *)"not found\n";
+    size_t body_len = strlen((const char *)body);
+
+    if (strncmp(req, "GET / ", 6) == 0 || strncmp(req, "GET /metrics ", 13) == 0 ||
+            strncmp(req, "GET /metrics?", 13) == 0) {
+        if (StatsTableRun(MetricsFormatCallback, ctx) == 0) {
+            status = "200 OK";
+            type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+            body = MEMBUFFER_BUFFER(ctx->buffer);
+            body_len = MEMBUFFER_OFFSET(ctx->buffer);
+        } else {
+            status = "503 Service Unavailable";
+            body = (const uint8_t *)"stats not yet synchronized\n";
+            body_len = strlen((const char *)body);
+        }
+    } else if (strncmp(req, "GET ", 4) != 0) {
+        status = "405 Method Not Allowed";
+        body = (const uint8_t *)"method not allowed\n";
+        body_len = strlen((const char *)body);
+    }
+
+    char hdr[256];
+    int hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %"PRIuMAX"\r\n"
+            "Connection: close\r\n\r\n", status, type, (uintmax_t)body_len);
+
+    if (MetricsSend(fd, (const uint8_t *)hdr, (size_t)hlen) == 0)
+        (void)MetricsSend(fd, body, body_len);
+}
+
+/** \internal
+ *  \brief open the listening socket
+ *
+ *  \param listen "addr:port" or the path of a unix socket
+ */
+static int MetricsListen(const char *listen_str)
+{
+    int fd = -1;
+
+    if (listen_str[0] == '/') {
+        struct sockaddr_un un;
+        memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlcpy(un.sun_path, listen_str, sizeof(un.sun_path)) >= sizeof(un.sun_path)) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "metrics: socket path %s too "
+                    "long", listen_str);
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto error;
+        (void)unlink(listen_str);
+        if (bind(fd, (struct sockaddr *)&un, sizeof(un)) < 0)
+            goto error;
+    } else {
+        char host[256];
+        strlcpy(host, listen_str, sizeof(host));
+        char *port = strrchr(host, ':');
+        if (port == NULL) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "metrics: listen \"%s\" is "
+                    "not addr:port or a socket path", listen_str);
+            return -1;
+        }
+        *port++ = '\0';
+        /* [::1]:9187 */
+        char *addr = host;
+        if (addr[0] == '[' && addr[strlen(addr) - 1] == ']') {
+            addr[strlen(addr) - 1] = '\0';
+            addr++;
+        }
+
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        int r = getaddrinfo(addr[0] ? addr : NULL, port, &hints, &res);
+        if (r != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "metrics: invalid listen "
+                    "\"%s\": %s", listen_str, gai_strerror(r));
+            return -1;
+        }
+        fd = socket(res->ai_family, SOCK_STREAM, 0);
+        if (fd < 0) {
+            freeaddrinfo(res);
+            goto error;
+        }
+        int on = 1;
+        (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        r = bind(fd, res->ai_addr, res->ai_addrlen);
+        freeaddrinfo(res);
+        if (r < 0)
+            goto error;
+    }
+
+    if (listen(fd, 8) < 0)
+        goto error;
+    return fd;
+
+error:
+    SCLogError(SC_ERR_SOCKET, "metrics: failed to listen on %s: %s",
+            listen_str, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static void *MetricsThread(void *arg)
+{
+    ThreadVars *tv_local = (ThreadVars *)arg;
+    MetricsCtx *ctx = &metrics_ctx;
+
+    /* block usr2.  usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName(tv_local->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    if (tv_local->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv_local);
+
+    tv_local->cap_flags = 0;
+    SCDropCaps(tv_local);
+
+    TmThreadsSetFlag(tv_local, THV_INIT_DONE);
+    while (!TmThreadsCheckFlag(tv_local, THV_KILL)) {
+        if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
+            TmThreadsSetFlag(tv_local, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv_local);
+            TmThreadsUnsetFlag(tv_local, THV_PAUSED);
+        }
+
+        struct pollfd pfd = { ctx->fd, POLLIN, 0 };
+        int r = poll(&pfd, 1, 1000);
+        if (r <= 0)
+            continue;
+
+        int cfd = accept(ctx->fd, NULL, NULL);
+        if (cfd < 0)
+            continue;
+        MetricsHandleClient(ctx, cfd);
+        close(cfd);
+    }
+
+    TmThreadsSetFlag(tv_local, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv_local, THV_DEINIT);
+
+    close(ctx->fd);
+    ctx->fd = -1;
+    if (ctx->listen[0] == '/')
+        (void)unlink(ctx->listen);
+    MemBufferFree(ctx->buffer);
+    ctx->buffer = NULL;
+
+    TmThreadsSetFlag(tv_local, THV_CLOSED);
+    return NULL;
+}
+
+/** \brief spawn the metrics endpoint thread if enabled
+ *
+ *  Called when the stats threads are spawned.
+ */
+void MetricsSpawnThread(void)
+{
+    MetricsCtx *ctx = &metrics_ctx;
+
+    if (!MetricsEnabled())
+        return;
+
+    char *listen_str = NULL;
+    if (ConfGet("stats.metrics.listen", &listen_str) != 1 || listen_str == NULL)
+        listen_str = METRICS_LISTEN_DEFAULT;
+    strlcpy(ctx->listen, listen_str, sizeof(ctx->listen));
+
+    int threads = 1;
+    if (ConfGetBool("stats.metrics.threads", &threads) == 1 && !threads)
+        ctx->flags &= ~METRICS_THREADS;
+
+    ctx->buffer = MemBufferCreateNew(METRICS_BUFFER_SIZE);
+    if (ctx->buffer == NULL)
+        return;
+
+    ctx->fd = MetricsListen(ctx->listen);
+    if (ctx->fd < 0) {
+        MemBufferFree(ctx->buffer);
+        ctx->buffer = NULL;
+        return;
+    }
+
+    ThreadVars *tv = TmThreadCreateMgmtThread(thread_name_metrics,
+            MetricsThread, 1);
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread failed");
+        exit(EXIT_FAILURE);
+    }
+    if (TmThreadSpawn(tv) != 0) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
+                "MetricsThread");
+        exit(EXIT_FAILURE);
+    }
+    SCLogConfig("metrics: serving OpenMetrics on %s", ctx->listen);
+}
+
+#ifdef UNITTESTS
+static int MetricsTestFormat01(void)
+{
+    StatsRecord stats[2];
+    StatsRecord tstats[4];
+    memset(stats, 0, sizeof(stats));
+    memset(tstats, 0, sizeof(tstats));
+
+    stats[0] = (StatsRecord){ "decoder.pkts", "Total", 30, 0, 0 };
+    stats[1] = (StatsRecord){ "tcp.reassembly_memuse", "Total", 1024, 0, 1 };
+    /* thread 0 has both, thread 1 only the first */
+    tstats[0] = (StatsRecord){ "decoder.pkts", "W#01", 10, 0, 0 };
+    tstats[1] = (StatsRecord){ "tcp.reassembly_memuse", "W#01", 1024, 0, 1 };
+    tstats[2] = (StatsRecord){ "decoder.pkts", "W#02", 20, 0, 0 };
+
+    StatsTable st = { stats, tstats, 2, 2, 100, { 160, 0 } };
+
+    MemBuffer *buffer = MemBufferCreateNew(64);
+    FAIL_IF_NULL(buffer);
+
+    FAIL_IF(MetricsFormat(&st, &buffer, METRICS_THREADS) != 0);
+    const char *out = (const char *)MEMBUFFER_BUFFER(buffer);
+    FAIL_IF(strstr(out, "suricata_uptime_seconds 60\n") == NULL);
+    FAIL_IF(strstr(out, "# TYPE suricata_decoder_pkts unknown\n") == NULL);
+    FAIL_IF(strstr(out, "suricata_decoder_pkts{thread=\"W#01\"} 10\n") == NULL);
+    FAIL_IF(strstr(out, "suricata_decoder_pkts{thread=\"W#02\"} 20\n") == NULL);
+    FAIL_IF(strstr(out, "# TYPE suricata_tcp_reassembly_memuse gauge\n") == NULL);
+    FAIL_IF(strstr(out, "suricata_tcp_reassembly_memuse{thread=\"W#02\"}") != NULL);
+    FAIL_IF(strcmp(out + strlen(out) - 6, "# EOF\n") != 0);
+
+    FAIL_IF(MetricsFormat(&st, &buffer, 0) != 0);
+    out = (const char *)MEMBUFFER_BUFFER(buffer);
+    FAIL_IF(strstr(out, "suricata_decoder_pkts 30\n") == NULL);
+    FAIL_IF(strstr(out, "thread=") != NULL);
+
+    MemBufferFree(buffer);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void MetricsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MetricsTestFormat01", MetricsTestFormat01);
+#endif
+}
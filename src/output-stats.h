@@ -31,6 +31,7 @@ typedef struct StatsRecord_ {
     const char *tm_name;
     uint64_t value;         /**< total value */
     uint64_t pvalue;        /**< prev value (may be higher for memuse counters) */
+    uint8_t gauge;          /**< value isn't a sum of updates: memuse, avg, max */
 } StatsRecord;
 
 typedef struct StatsTable_ {
@@ -48,6 +48,7 @@ typedef struct OutputTxLogger_ {
     AppProto alproto;
     TxLogger LogFunc;
     TxLoggerCondition LogCondition;
+    OutputFilter *filter;       /**< txs to log, NULL for all */
     OutputCtx *output_ctx;
     struct OutputTxLogger_ *next;
     const char *name;
@@ -59,9 +60,15 @@ typedef struct OutputTxLogger_ {
 
 static OutputTxLogger *list = NULL;
 
+/** protocols with a logger that has a LogCondition. Such a condition can
+ *  depend on more than the parser updates, e.g. on detection, so their
+ *  txs are looked at for every packet. */
+static uint8_t tx_logger_conditions[ALPROTO_MAX];
+
 int OutputRegisterTxLogger(const char *name, AppProto alproto, TxLogger LogFunc,
                            OutputCtx *output_ctx, int tc_log_progress,
-                           int ts_log_progress, TxLoggerCondition LogCondition)
+                           int ts_log_progress, TxLoggerCondition LogCondition,
+                           OutputFilter *filter)
 {
     int module_id = TmModuleGetIdByName(name);
     if (module_id < 0)
@@ -81,9 +88,12 @@ int OutputRegisterTxLogger(const char *name, AppProto alproto, TxLogger LogFunc,
     op->alproto = alproto;
     op->LogFunc = LogFunc;
     op->LogCondition = LogCondition;
+    op->filter = filter;
     op->output_ctx = output_ctx;
     op->name = name;
     op->module_id = (TmmId) module_id;
+    if (LogCondition != NULL)
+        tx_logger_conditions[alproto] = 1;
 
     if (tc_log_progress < 0) {
         op->tc_log_progress =
@@ -152,18 +162,36 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data, PacketQ
         goto end;
     }
 
+    /* only walk the txs if the parser touched them since the last pass */
+    const uint8_t disruption =
+        ((FlowGetDisruptionFlags(f, STREAM_TOSERVER) & (STREAM_GAP|STREAM_DEPTH)) >> 4) |
+        (FlowGetDisruptionFlags(f, STREAM_TOCLIENT) & (STREAM_GAP|STREAM_DEPTH));
+    if (!tx_logger_conditions[alproto] &&
+        !AppLayerParserTxLogPending(f->alparser, disruption))
+    {
+        SCLogDebug("no tx updates since the last pass");
+        goto end;
+    }
+    AppLayerParserTxLogUpdate(f->alparser, disruption);
+
     uint64_t total_txs = AppLayerParserGetTxCnt(p->proto, alproto, alstate);
     uint64_t tx_id = AppLayerParserGetTransactionLogId(f->alparser);
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(p->proto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
 
     for (; tx_id < total_txs; tx_id++)
     {
         int logger_not_logged = 0;
 
-        void *tx = AppLayerParserGetTx(p->proto, alproto, alstate, tx_id);
-        if (tx == NULL) {
-            SCLogDebug("tx is NULL not logging");
-            continue;
+        AppLayerGetTxIterTuple ires = IterFunc(p->proto, alproto, alstate,
+                tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL) {
+            SCLogDebug("no more txs to log");
+            break;
         }
+        void *tx = ires.tx_ptr;
+        tx_id = ires.tx_id;
 
         int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
                 tx, FlowGetDisruptionFlags(f, STREAM_TOSERVER));
@@ -217,9 +245,15 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data, PacketQ
                     }
                 }
 
-                PACKET_PROFILING_TMM_START(p, logger->module_id);
-                logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
-                PACKET_PROFILING_TMM_END(p, logger->module_id);
+                /* the tx is ready: a filtered out one counts as logged */
+                if (logger->filter != NULL &&
+                    !OutputFilterMatch(logger->filter, f, tx)) {
+                    SCLogDebug("tx filtered out, not logging");
+                } else {
+                    PACKET_PROFILING_TMM_START(p, logger->module_id);
+                    logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
+                    PACKET_PROFILING_TMM_END(p, logger->module_id);
+                }
 
                 AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
                                           logger->id);
@@ -362,8 +396,10 @@ void OutputTxShutdown(void)
     OutputTxLogger *logger = list;
     while (logger) {
         OutputTxLogger *next_logger = logger->next;
+        OutputFilterFree(logger->filter);
         SCFree(logger);
         logger = next_logger;
     }
     list = NULL;
+    memset(tx_logger_conditions, 0, sizeof(tx_logger_conditions));
 }
@@ -27,6 +27,7 @@
 #define __OUTPUT_TX_H__
 
 #include "decode.h"
+#include "output-filter.h"
 
 /** packet logger function pointer type */
 typedef int (*TxLogger)(ThreadVars *, void *thread_data, const Packet *, Flow *f, void *state, void *tx, uint64_t tx_id);
@@ -38,7 +39,7 @@ typedef int (*TxLoggerCondition)(ThreadVars *, const Packet *, void *state, void
 
 int OutputRegisterTxLogger(const char *name, AppProto alproto, TxLogger LogFunc,
         OutputCtx *, int tc_log_progress, int ts_log_progress,
-        TxLoggerCondition LogCondition);
+        TxLoggerCondition LogCondition, OutputFilter *filter);
 
 void TmModuleTxLoggerRegister (void);
 
@@ -36,17 +36,22 @@
 #include "host.h"
 #include "conf.h"
 #include "detect.h"
+#include "detect-engine-loader.h"
 #include "reputation.h"
 
-/** effective reputation version, atomic as the host
- *  time out code will use it to check if a host's
- *  reputation info is outdated. */
-SC_ATOMIC_DECLARE(uint32_t, srep_eversion);
-/** reputation version set to the host's reputation,
- *  this will be set to 1 before rep files are loaded,
- *  so hosts will always have a minial value of 1 */
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/** reputation version set to the entries, this will be set to 1
+ *  before rep files are loaded, so entries will always have a
+ *  minimal value of 1 */
 static uint32_t srep_version = 0;
 
+/** protects the snapshot reference counts and swapping the snapshot
+ *  of a detect engine on reload */
+static SCMutex srep_lock = SCMUTEX_INITIALIZER;
+
 static uint32_t SRepIncrVersion(void)
 {
     return ++srep_version;
@@ -62,69 +67,131 @@ void SRepResetVersion(void)
     srep_version = 0;
 }
 
-static uint32_t SRepGetEffectiveVersion(void)
+/** target false positive rate of the prefilters, 1 in N */
+#define SREP_BLOOM_FP_ONE_IN    100
+
+/** \internal
+ *  \brief mask an address to its first netmask bits */
+static inline void SRepBloomKey(const uint8_t *addr, int words, uint8_t netmask,
+        uint32_t *key)
 {
-    return SC_ATOMIC_GET(srep_eversion);
+    uint8_t *k = (uint8_t *)key;
+    int bytes = words * 4;
+    int full = netmask / 8;
+
+    memcpy(k, addr, full);
+    memset(k + full, 0, bytes - full);
+    if (netmask % 8)
+        k[full] = addr[full] & (uint8_t)(0xff << (8 - netmask % 8));
 }
 
-static void SRepCIDRFreeUserData(void *data)
+/** \internal
+ *  \brief check the prefilter for an address
+ *
+ *  \retval 0 no host or netblock of any category can match
+ *  \retval 1 maybe listed, do the lookup
+ */
+static int SRepBloomTest(const SRepBloom *b, const uint8_t *addr, int words)
 {
-    if (data != NULL)
-        SCFree(data);
+    uint32_t key[4];
+    uint8_t i;
 
-    return;
+    for (i = 0; i < b->netmasks_cnt; i++) {
+        SRepBloomKey(addr, words, b->netmasks[i], key);
+        if (BloomFilterBlockedTest(b->bf, key, (uint16_t)words, b->netmasks[i]))
+            return 1;
+    }
+    return 0;
 }
 
-static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, int value)
+typedef struct SRepBloomBuildCtx_ {
+    SRepBloom *b;
+    int words;
+    uint32_t entries;
+    uint64_t netmasks[3];   /**< bitmap of the netmasks 0-128 in use */
+} SRepBloomBuildCtx;
+
+static void SRepBloomCount(const uint8_t *stream, uint16_t bitlen,
+        uint8_t netmask, void *user, void *data)
 {
-    SReputation *user_data = NULL;
-    if ((user_data = SCMalloc(sizeof(SReputation))) == NULL) {
-        SCLogError(SC_ERR_FATAL, "Error allocating memory. Exiting");
-        exit(EXIT_FAILURE);
-    }
-    memset(user_data, 0x00, sizeof(SReputation));
+    SRepBloomBuildCtx *bb = (SRepBloomBuildCtx *)data;
+    if (netmask > bb->words * 32)
+        netmask = bb->words * 32;
+    bb->entries++;
+    bb->netmasks[netmask / 64] |= (1ULL << (netmask % 64));
+}
 
-    user_data->version = SRepGetVersion();
-    user_data->rep[cat] = value;
+static void SRepBloomInsert(const uint8_t *stream, uint16_t bitlen,
+        uint8_t netmask, void *user, void *data)
+{
+    SRepBloomBuildCtx *bb = (SRepBloomBuildCtx *)data;
+    uint32_t key[4];
+    if (netmask > bb->words * 32)
+        netmask = bb->words * 32;
+    SRepBloomKey(stream, bb->words, netmask, key);
+    BloomFilterBlockedAdd(bb->b->bf, key, (uint16_t)bb->words, netmask);
+}
 
-    if (strchr(ip, ':') != NULL) {
-        if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
-            cidr_ctx->srepIPV6_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
-            if (cidr_ctx->srepIPV6_tree[cat] == NULL) {
-                SCLogDebug("Error initializing Reputation IPV6 with CIDR module for cat %d", cat);
-                exit(EXIT_FAILURE);
-            }
-            SCLogDebug("Reputation IPV6 with CIDR module for cat %d initialized", cat);
-        }
+/** \internal
+ *  \brief build the prefilter for the radix trees of a family
+ *
+ *  The filter is skipped if too many netmasks are in use, as a miss has
+ *  to test each of them. Trees that have a compiled table (lpm) don't
+ *  need a filter.
+ */
+static void SRepBloomBuild(SRepBloom *b, SCRadixTree **trees, SCLpmIPV4 **lpm,
+        int words)
+{
+    SRepBloomBuildCtx bb;
+    int i;
 
-        SCLogDebug("adding ipv6 host %s", ip);
-        if (SCRadixAddKeyIPV6String(ip, cidr_ctx->srepIPV6_tree[cat], (void *)user_data) == NULL) {
-            SCLogWarning(SC_ERR_INVALID_VALUE,
-                        "failed to add ipv6 host %s", ip);
-        }
+    memset(&bb, 0, sizeof(bb));
+    bb.b = b;
+    bb.words = words;
 
-    } else {
-        if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
-            cidr_ctx->srepIPV4_tree[cat] = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
-            if (cidr_ctx->srepIPV4_tree[cat] == NULL) {
-                SCLogDebug("Error initializing Reputation IPV4 with CIDR module for cat %d", cat);
-                exit(EXIT_FAILURE);
-            }
-            SCLogDebug("Reputation IPV4 with CIDR module for cat %d initialized", cat);
-        }
+    for (i = 0; i < SREP_MAX_CATS; i++) {
+        if (lpm == NULL || lpm[i] == NULL)
+            SCRadixWalk(trees[i], SRepBloomCount, &bb);
+    }
+    if (bb.entries == 0)
+        return;
 
-        SCLogDebug("adding ipv4 host %s", ip);
-        if (SCRadixAddKeyIPV4String(ip, cidr_ctx->srepIPV4_tree[cat], (void *)user_data) == NULL) {
-            SCLogWarning(SC_ERR_INVALID_VALUE,
-                        "failed to add ipv4 host %s", ip);
+    for (i = 0; i <= words * 32; i++) {
+        if (!(bb.netmasks[i / 64] & (1ULL << (i % 64))))
+            continue;
+        if (b->netmasks_cnt == SREP_BLOOM_MAX_NETMASKS) {
+            SCLogPerf("reputation uses more than %d distinct netmasks, "
+                    "not using a prefilter", SREP_BLOOM_MAX_NETMASKS);
+            b->netmasks_cnt = 0;
+            return;
         }
+        b->netmasks[b->netmasks_cnt++] = (uint8_t)i;
+    }
+
+    b->bf = BloomFilterBlockedInit(bb.entries, SREP_BLOOM_FP_ONE_IN);
+    if (b->bf == NULL) {
+        b->netmasks_cnt = 0;
+        return;
+    }
+    for (i = 0; i < SREP_MAX_CATS; i++) {
+        if (lpm == NULL || lpm[i] == NULL)
+            SCRadixWalk(trees[i], SRepBloomInsert, &bb);
     }
 }
 
 static uint8_t SRepCIDRGetIPv4IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv4_addr, uint8_t cat)
 {
     void *user_data = NULL;
-    (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, cidr_ctx->srepIPV4_tree[cat], &user_data);
+    if (cidr_ctx->srepIPV4_lpm[cat] != NULL) {
+        user_data = SCLpmIPV4Lookup(cidr_ctx->srepIPV4_lpm[cat], ipv4_addr);
+    } else {
+        if (cidr_ctx->srepIPV4_tree[cat] == NULL)
+            return 0;
+        if (cidr_ctx->srepIPV4_bloom.bf != NULL &&
+                !SRepBloomTest(&cidr_ctx->srepIPV4_bloom, ipv4_addr, 1))
+            return 0;
+        (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, cidr_ctx->srepIPV4_tree[cat], &user_data);
+    }
     if (user_data == NULL)
         return 0;
 
@@ -135,6 +202,11 @@ static uint8_t SRepCIDRGetIPv4IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv4_addr,
 static uint8_t SRepCIDRGetIPv6IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv6_addr, uint8_t cat)
 {
     void *user_data = NULL;
+    if (cidr_ctx->srepIPV6_tree[cat] == NULL)
+        return 0;
+    if (cidr_ctx->srepIPV6_bloom.bf != NULL &&
+            !SRepBloomTest(&cidr_ctx->srepIPV6_bloom, ipv6_addr, 4))
+        return 0;
     (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, cidr_ctx->srepIPV6_tree[cat], &user_data);
     if (user_data == NULL)
         return 0;
@@ -167,110 +239,664 @@ uint8_t SRepCIDRGetIPRepDst(SRepCIDRTree *cidr_ctx, Packet *p, uint8_t cat, uint
     return rep;
 }
 
-/** \brief Increment effective reputation version after
- *         a rule/reputatio reload is complete. */
-void SRepReloadComplete(void)
+/** entry of a reputation list */
+typedef struct SRepEntry_ {
+    uint8_t addr[16];   /**< network order, masked to the netmask */
+    uint32_t seq;       /**< load order, the last of duplicates wins */
+    uint8_t family;     /**< AF_INET or AF_INET6 */
+    uint8_t netmask;
+    uint8_t cat;
+    uint8_t value;
+} SRepEntry;
+
+/** hosts and netblocks of the reputation files, in the order they were
+ *  loaded. SRepCIDRCompile() sorts and merges them and builds the lookup
+ *  tables in one go, instead of adding them to a tree one by one. */
+typedef struct SRepList_ {
+    SRepEntry *entries;
+    uint32_t cnt;
+    uint32_t size;
+    uint32_t errors;    /**< bad lines or records */
+} SRepList;
+
+/** text files larger than this are parsed in chunks on the detect
+ *  engine build threads */
+#define SREP_CHUNK_SIZE     (4 * 1024 * 1024)
+
+/** values pointed to by the compiled tables and the trees built with
+ *  them: srep_values[v] has all categories set to v, so all entries
+ *  with the same value share it */
+static SReputation srep_values[128];
+static int srep_values_init = 0;
+
+static void SRepValuesInit(void)
 {
-    (void) SC_ATOMIC_ADD(srep_eversion, 1);
-    SCLogDebug("effective Reputation version %u", SRepGetEffectiveVersion());
+    SCMutexLock(&srep_lock);
+    if (!srep_values_init) {
+        int v;
+        for (v = 0; v < 128; v++)
+            memset(srep_values[v].rep, v, sizeof(srep_values[v].rep));
+        srep_values_init = 1;
+    }
+    SCMutexUnlock(&srep_lock);
 }
 
-/** \brief Set effective reputation version after
- *         reputation initialization is complete. */
-void SRepInitComplete(void)
+static void SRepListFree(SRepList *list)
 {
-    (void) SC_ATOMIC_SET(srep_eversion, 1);
-    SCLogDebug("effective Reputation version %u", SRepGetEffectiveVersion());
+    if (list == NULL)
+        return;
+    if (list->entries != NULL)
+        SCFree(list->entries);
+    SCFree(list);
 }
 
-/** \brief Check if a Host is timed out wrt ip rep, meaning a new
- *         version is in place.
- *
- *  We clean up the old version here.
- *
- *  \param h host
- *
- *  \retval 0 not timed out
- *  \retval 1 timed out
- */
-int SRepHostTimedOut(Host *h)
+/** \internal
+ *  \brief make room for 'n' more entries
+ *  \retval 0 ok, -1 out of memory */
+static int SRepListGrow(SRepList *list, uint32_t n)
 {
-    BUG_ON(h == NULL);
+    if (list->size - list->cnt >= n)
+        return 0;
+    if (n > UINT32_MAX - list->cnt)
+        return -1;
 
-    if (h->iprep == NULL)
-        return 1;
+    uint64_t size = list->size ? list->size : 1024;
+    while (size < (uint64_t)list->cnt + n)
+        size *= 2;
+    if (size > UINT32_MAX)
+        size = UINT32_MAX;
+
+    SRepEntry *ptmp = SCRealloc(list->entries, size * sizeof(SRepEntry));
+    if (ptmp == NULL)
+        return -1;
+    list->entries = ptmp;
+    list->size = (uint32_t)size;
+    return 0;
+}
+
+/** \internal
+ *  \brief append the entries of 'src', numbering them in load order */
+static int SRepListAppend(SRepList *list, const SRepList *src)
+{
+    if (SRepListGrow(list, src->cnt) < 0)
+        return -1;
+
+    memcpy(list->entries + list->cnt, src->entries, src->cnt * sizeof(SRepEntry));
+    uint32_t u;
+    for (u = 0; u < src->cnt; u++) {
+        list->entries[list->cnt].seq = list->cnt;
+        list->cnt++;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief clear the bits of an address beyond the netmask */
+static void SRepMaskAddr(uint8_t *addr, int bytes, uint8_t netmask)
+{
+    int full = netmask / 8;
+    if (full >= bytes)
+        return;
+    if (netmask % 8)
+        addr[full++] &= (uint8_t)(0xff << (8 - netmask % 8));
+    memset(addr + full, 0, bytes - full);
+}
 
-    uint32_t eversion = SRepGetEffectiveVersion();
-    SReputation *r = h->iprep;
-    if (r->version < eversion) {
-        SCLogDebug("host %p has reputation version %u, "
-                "effective version is %u", h, r->version, eversion);
+/** \internal
+ *  \brief scan a decimal number of at most 'max'
+ *  \retval ptr past the number, NULL if there is none or it's too large */
+static const char *SRepScanNumber(const char *p, const char *end,
+        uint32_t max, uint32_t *out)
+{
+    const char *start = p;
+    uint32_t v = 0;
 
-        SCFree(h->iprep);
-        h->iprep = NULL;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint32_t)(*p - '0');
+        if (v > max)
+            return NULL;
+        p++;
+    }
+    if (p == start)
+        return NULL;
+    *out = v;
+    return p;
+}
 
-        HostDecrUsecnt(h);
+/** \internal
+ *  \brief scan a dotted quad that spans all of p to end */
+static int SRepScanIPv4(const char *p, const char *end, uint8_t *addr)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        uint32_t v;
+        if (i > 0) {
+            if (p == end || *p != '.')
+                return -1;
+            p++;
+        }
+        p = SRepScanNumber(p, end, 255, &v);
+        if (p == NULL)
+            return -1;
+        addr[i] = (uint8_t)v;
+    }
+    return (p == end) ? 0 : -1;
+}
+
+/** \internal
+ *  \brief scan a "ip[/netmask],cat,value" line, without the newline
+ *
+ *  \retval 0 valid
+ *  \retval 1 header
+ *  \retval -1 boo
+ */
+static int SRepScanLine(const char *p, const char *end, SRepEntry *e)
+{
+    const char *comma = memchr(p, ',', end - p);
+    if (comma == NULL)
+        return -1;
+    if (comma - p == 2 && memcmp(p, "ip", 2) == 0)
         return 1;
+
+    memset(e, 0x00, sizeof(*e));
+    const char *slash = memchr(p, '/', comma - p);
+    const char *addr_end = (slash != NULL) ? slash : comma;
+    uint32_t bits;
+
+    if (memchr(p, ':', addr_end - p) != NULL) {
+        char str[INET6_ADDRSTRLEN];
+        if ((size_t)(addr_end - p) >= sizeof(str))
+            return -1;
+        memcpy(str, p, addr_end - p);
+        str[addr_end - p] = '\0';
+        if (inet_pton(AF_INET6, str, e->addr) != 1)
+            return -1;
+        e->family = AF_INET6;
+        bits = 128;
+    } else {
+        if (SRepScanIPv4(p, addr_end, e->addr) < 0)
+            return -1;
+        e->family = AF_INET;
+        bits = 32;
     }
 
+    uint32_t v = bits;
+    if (slash != NULL && SRepScanNumber(slash + 1, comma, bits, &v) != comma)
+        return -1;
+    e->netmask = (uint8_t)v;
+    SRepMaskAddr(e->addr, bits / 8, e->netmask);
+
+    p = SRepScanNumber(comma + 1, end, SREP_MAX_CATS - 1, &v);
+    if (p == NULL || p == end || *p != ',')
+        return -1;
+    e->cat = (uint8_t)v;
+
+    p = SRepScanNumber(p + 1, end, 127, &v);
+    if (p == NULL || (p < end && *p != ',' && !isspace((unsigned char)*p)))
+        return -1;
+    e->value = (uint8_t)v;
     return 0;
 }
 
-static int SRepCatSplitLine(char *line, uint8_t *cat, char *shortname, size_t shortname_len)
+typedef struct SRepChunk_ {
+    const char *buf;
+    const char *end;
+    SRepList list;
+} SRepChunk;
+
+/** \internal
+ *  \brief parse the lines of a chunk, LoaderFunc for
+ *         DetectLoaderRunTasks() */
+static int SRepParseChunk(void *ctx, int loader_id)
 {
-    size_t line_len = strlen(line);
-    char *ptrs[2] = {NULL,NULL};
-    int i = 0;
-    int idx = 0;
-    char *origline = line;
+    SRepChunk *c = (SRepChunk *)ctx;
+    const char *p = c->buf;
 
-    while (i < (int)line_len) {
-        if (line[i] == ',' || line[i] == '\n' || line[i] == '\0' || i == (int)(line_len - 1)) {
-            line[i] = '\0';
+    while (p < c->end) {
+        const char *eol = memchr(p, '\n', c->end - p);
+        if (eol == NULL)
+            eol = c->end;
 
-            ptrs[idx] = line;
-            idx++;
+        /* ignore comments and empty lines */
+        if (p == eol || *p == '\r' || *p == ' ' || *p == '#' || *p == '\t') {
+            p = eol + 1;
+            continue;
+        }
 
-            line += (i+1);
-            i = 0;
+        SRepEntry e;
+        int r = SRepScanLine(p, eol, &e);
+        if (r == 0) {
+            if (SRepListGrow(&c->list, 1) < 0)
+                return -1;
+            c->list.entries[c->list.cnt++] = e;
+        } else if (r < 0) {
+            const char *q = eol;
+            if (q > p && q[-1] == '\r')
+                q--;
+            SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%.*s\"",
+                    (int)MIN(q - p, 256), p);
+            c->list.errors++;
+        }
+        p = eol + 1;
+    }
+    return 0;
+}
 
-            if (line >= origline + line_len)
-                break;
-            if (strlen(line) == 0)
-                break;
-            if (idx == 2)
-                break;
-        } else {
-            i++;
+/** \internal
+ *  \brief parse a text list in 'chunks_cnt' pieces split at line ends
+ *
+ *  The pieces are parsed on up to 'threads' threads and appended in
+ *  file order. */
+static int SRepParseText(SRepList *list, const char *buf, size_t len,
+        uint32_t chunks_cnt, int threads)
+{
+    SRepChunk *chunks = SCCalloc(chunks_cnt, sizeof(SRepChunk));
+    void **ctxs = SCCalloc(chunks_cnt, sizeof(void *));
+    const char *start = buf;
+    const char *end = buf + len;
+    int r = -1;
+    uint32_t u;
+
+    if (chunks == NULL || ctxs == NULL)
+        goto end;
+
+    for (u = 0; u < chunks_cnt; u++) {
+        const char *stop = end;
+        if (u + 1 < chunks_cnt) {
+            stop = buf + (len / chunks_cnt) * (u + 1);
+            if (stop < start)
+                stop = start;
+            const char *nl = memchr(stop, '\n', end - stop);
+            stop = (nl != NULL) ? nl + 1 : end;
         }
+        chunks[u].buf = start;
+        chunks[u].end = stop;
+        ctxs[u] = &chunks[u];
+        start = stop;
     }
 
-    if (idx != 2) {
+    r = DetectLoaderRunTasks(threads, SRepParseChunk, ctxs, chunks_cnt);
+    for (u = 0; u < chunks_cnt; u++) {
+        if (r == 0 && SRepListAppend(list, &chunks[u].list) < 0)
+            r = -1;
+        list->errors += chunks[u].list.errors;
+        if (chunks[u].list.entries != NULL)
+            SCFree(chunks[u].list.entries);
+    }
+end:
+    if (chunks != NULL)
+        SCFree(chunks);
+    if (ctxs != NULL)
+        SCFree(ctxs);
+    return r;
+}
+
+/** \internal
+ *  \brief add the records of a binary list, see SRepBinHeader */
+static int SRepParseBinary(SRepList *list, const uint8_t *buf, size_t len)
+{
+    SRepBinHeader h;
+    memcpy(&h, buf, sizeof(h));
+    const uint32_t cnt = ntohl(h.cnt);
+
+    if ((len - sizeof(h)) / sizeof(SRepBinRecord) < cnt) {
+        SCLogError(SC_ERR_NO_REPUTATION, "binary reputation list truncated: "
+                "%u records expected", cnt);
         return -1;
     }
+    if (SRepListGrow(list, cnt) < 0)
+        return -1;
 
-    SCLogDebug("%s, %s", ptrs[0], ptrs[1]);
+    const uint8_t *rec = buf + sizeof(h);
+    uint32_t u;
+    for (u = 0; u < cnt; u++, rec += sizeof(SRepBinRecord)) {
+        SRepBinRecord r;
+        memcpy(&r, rec, sizeof(r));
 
-    int c = atoi(ptrs[0]);
-    if (c < 0 || c >= SREP_MAX_CATS) {
+        const uint8_t bits = (r.family == 4) ? 32 : 128;
+        if ((r.family != 4 && r.family != 6) || r.netmask > bits ||
+                r.cat >= SREP_MAX_CATS || r.value > 127) {
+            list->errors++;
+            continue;
+        }
+
+        SRepEntry *e = &list->entries[list->cnt];
+        memset(e, 0x00, sizeof(*e));
+        memcpy(e->addr, r.addr, bits / 8);
+        SRepMaskAddr(e->addr, bits / 8, r.netmask);
+        e->family = (r.family == 4) ? AF_INET : AF_INET6;
+        e->netmask = r.netmask;
+        e->cat = r.cat;
+        e->value = r.value;
+        e->seq = list->cnt++;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief add the entries of a text or binary list to the snapshot
+ *
+ *  \param threads max threads to parse a large text list with
+ *
+ *  \retval 0 ok, bad lines are logged and skipped
+ *  \retval -1 error
+ */
+static int SRepLoadBuffer(SRepCIDRTree *cidr_ctx, const uint8_t *buf,
+        size_t len, int threads)
+{
+    if (cidr_ctx->list == NULL) {
+        cidr_ctx->list = SCCalloc(1, sizeof(SRepList));
+        if (cidr_ctx->list == NULL)
+            return -1;
+    }
+    SRepList *list = cidr_ctx->list;
+    const uint32_t errors = list->errors;
+    int r;
+
+    if (len >= sizeof(SRepBinHeader) &&
+            memcmp(buf, SREP_BIN_MAGIC, sizeof(((SRepBinHeader *)0)->magic)) == 0) {
+        r = SRepParseBinary(list, buf, len);
+    } else {
+        uint32_t chunks = 1;
+        if (threads > 1 && len > SREP_CHUNK_SIZE)
+            chunks = (uint32_t)MIN(len / SREP_CHUNK_SIZE + 1, (size_t)threads * 4);
+        r = SRepParseText(list, (const char *)buf, len, chunks, threads);
+    }
+
+    if (list->errors != errors) {
+        SCLogWarning(SC_ERR_NO_REPUTATION, "%u bad reputation entries skipped",
+                list->errors - errors);
+    }
+    return r;
+}
+
+typedef struct SRepTreeCollectCtx_ {
+    SRepList *list;
+    uint8_t family;
+    uint8_t cat;
+} SRepTreeCollectCtx;
+
+static void SRepTreeCount(const uint8_t *stream, uint16_t bitlen,
+        uint8_t netmask, void *user, void *data)
+{
+    (*(uint32_t *)data)++;
+}
+
+static void SRepTreeCollect(const uint8_t *stream, uint16_t bitlen,
+        uint8_t netmask, void *user, void *data)
+{
+    SRepTreeCollectCtx *tc = (SRepTreeCollectCtx *)data;
+    SRepEntry *e = &tc->list->entries[tc->list->cnt];
+
+    memset(e, 0x00, sizeof(*e));
+    memcpy(e->addr, stream, bitlen / 8);
+    e->family = tc->family;
+    e->netmask = (netmask > bitlen) ? (uint8_t)bitlen : netmask;
+    e->cat = tc->cat;
+    e->value = ((SReputation *)user)->rep[tc->cat];
+    e->seq = tc->list->cnt++;
+}
+
+/** \internal
+ *  \brief move the entries of a tree filled one by one to the list
+ *  \retval 0 ok, -1 out of memory */
+static int SRepTreeToList(SRepList *list, SCRadixTree **tree, uint8_t family,
+        uint8_t cat)
+{
+    uint32_t cnt = 0;
+    SCRadixWalk(*tree, SRepTreeCount, &cnt);
+    if (SRepListGrow(list, cnt) < 0)
         return -1;
+
+    SRepTreeCollectCtx tc = { list, family, cat };
+    SCRadixWalk(*tree, SRepTreeCollect, &tc);
+    SCRadixReleaseRadixTree(*tree);
+    *tree = NULL;
+    return 0;
+}
+
+/** sort by family, category, netblock and then load order */
+static int SRepEntryCompare(const void *a, const void *b)
+{
+    const SRepEntry *ea = a;
+    const SRepEntry *eb = b;
+
+    if (ea->family != eb->family)
+        return ea->family < eb->family ? -1 : 1;
+    if (ea->cat != eb->cat)
+        return ea->cat < eb->cat ? -1 : 1;
+    int r = memcmp(ea->addr, eb->addr, sizeof(ea->addr));
+    if (r != 0)
+        return r;
+    if (ea->netmask != eb->netmask)
+        return ea->netmask < eb->netmask ? -1 : 1;
+    if (ea->seq != eb->seq)
+        return ea->seq < eb->seq ? -1 : 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief build a radix tree of entries of one family and category */
+static SCRadixTree *SRepBuildTree(const SRepEntry *entries, uint32_t cnt)
+{
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    if (tree == NULL)
+        return NULL;
+
+    uint32_t u;
+    for (u = 0; u < cnt; u++) {
+        uint8_t addr[16];
+        SCRadixNode *node;
+
+        memcpy(addr, entries[u].addr, sizeof(addr));
+        if (entries[u].family == AF_INET)
+            node = SCRadixAddKeyIPV4Netblock(addr, tree,
+                    &srep_values[entries[u].value], entries[u].netmask);
+        else
+            node = SCRadixAddKeyIPV6Netblock(addr, tree,
+                    &srep_values[entries[u].value], entries[u].netmask);
+        if (node == NULL) {
+            SCRadixReleaseRadixTree(tree);
+            return NULL;
+        }
     }
+    return tree;
+}
 
-    *cat = (uint8_t)c;
-    strlcpy(shortname, ptrs[1], shortname_len);
+/** \internal
+ *  \brief compile the ipv4 entries of a category into a lookup table */
+static SCLpmIPV4 *SRepBuildLpm(const SRepEntry *entries, uint32_t cnt)
+{
+    SCLpmIPV4Prefix *prefixes = SCMalloc(cnt * sizeof(SCLpmIPV4Prefix));
+    if (unlikely(prefixes == NULL))
+        return NULL;
+
+    uint32_t u;
+    for (u = 0; u < cnt; u++) {
+        const uint8_t *a = entries[u].addr;
+        prefixes[u].ip = ((uint32_t)a[0] << 24) | ((uint32_t)a[1] << 16) |
+                         ((uint32_t)a[2] << 8) | (uint32_t)a[3];
+        prefixes[u].len = entries[u].netmask;
+        prefixes[u].user = &srep_values[entries[u].value];
+    }
+
+    SCLpmIPV4 *lpm = SCLpmIPV4CompileArray(prefixes, cnt);
+    SCFree(prefixes);
+    return lpm;
+}
+
+/** \internal
+ *  \brief turn the loaded entries into lookup tables and build the
+ *         prefilters for what stays in radix trees
+ *
+ *  The entries are sorted and duplicates merged, the last loaded value
+ *  wins. Each ipv4 category is compiled into a table (lpm) in one go,
+ *  ipv6 and ipv4 that failed to compile go into radix trees. Entries
+ *  that were added to the trees directly are merged in as well.
+ *
+ *  The snapshot is final once compiled, on a reload a new SRepCIDRTree
+ *  is built and swapped in with the detect engine.
+ *
+ *  \retval 0 ok
+ *  \retval -1 out of memory
+ */
+static int SRepCIDRCompile(SRepCIDRTree *cidr_ctx)
+{
+    uint64_t memuse = 0;
+    int i;
+
+    SRepValuesInit();
+
+    if (cidr_ctx->list == NULL) {
+        cidr_ctx->list = SCCalloc(1, sizeof(SRepList));
+        if (cidr_ctx->list == NULL)
+            return -1;
+    }
+    SRepList *list = cidr_ctx->list;
+
+    for (i = 0; i < SREP_MAX_CATS; i++) {
+        if ((cidr_ctx->srepIPV4_tree[i] != NULL &&
+                SRepTreeToList(list, &cidr_ctx->srepIPV4_tree[i], AF_INET, i) < 0) ||
+            (cidr_ctx->srepIPV6_tree[i] != NULL &&
+                SRepTreeToList(list, &cidr_ctx->srepIPV6_tree[i], AF_INET6, i) < 0))
+            return -1;
+    }
+
+    SRepEntry *e = list->entries;
+    const uint32_t cnt = list->cnt;
+    uint32_t n = 0;
+    uint32_t u, v;
+
+    if (cnt > 0)
+        qsort(e, cnt, sizeof(SRepEntry), SRepEntryCompare);
+    for (u = 0; u < cnt; u++) {
+        if (n > 0 && e[n - 1].family == e[u].family && e[n - 1].cat == e[u].cat &&
+                e[n - 1].netmask == e[u].netmask &&
+                memcmp(e[n - 1].addr, e[u].addr, sizeof(e[u].addr)) == 0) {
+            e[n - 1] = e[u];
+            continue;
+        }
+        e[n++] = e[u];
+    }
+
+    for (u = 0; u < n; u = v) {
+        for (v = u + 1; v < n && e[v].family == e[u].family && e[v].cat == e[u].cat; v++)
+            ;
+        const uint8_t cat = e[u].cat;
+
+        if (e[u].family == AF_INET) {
+            cidr_ctx->srepIPV4_lpm[cat] = SRepBuildLpm(&e[u], v - u);
+            if (cidr_ctx->srepIPV4_lpm[cat] != NULL) {
+                memuse += SCLpmIPV4MemUse(cidr_ctx->srepIPV4_lpm[cat]);
+                continue;
+            }
+            SCLogPerf("reputation category %d netblocks kept in radix tree", cat);
+        }
+
+        SCRadixTree *tree = SRepBuildTree(&e[u], v - u);
+        if (tree == NULL)
+            return -1;
+        if (e[u].family == AF_INET)
+            cidr_ctx->srepIPV4_tree[cat] = tree;
+        else
+            cidr_ctx->srepIPV6_tree[cat] = tree;
+    }
+
+    if (cnt > 0) {
+        SCLogConfig("reputation: %u hosts and netblocks, %u duplicates "
+                "merged", n, cnt - n);
+    }
+    SRepListFree(list);
+    cidr_ctx->list = NULL;
+
+    if (memuse > 0)
+        SCLogConfig("reputation netblock tables use %"PRIu64" bytes", memuse);
+
+    SRepBloomBuild(&cidr_ctx->srepIPV4_bloom, cidr_ctx->srepIPV4_tree,
+            cidr_ctx->srepIPV4_lpm, 1);
+    SRepBloomBuild(&cidr_ctx->srepIPV6_bloom, cidr_ctx->srepIPV6_tree, NULL, 4);
+    memuse = BloomFilterBlockedMemorySize(cidr_ctx->srepIPV4_bloom.bf) +
+             BloomFilterBlockedMemorySize(cidr_ctx->srepIPV6_bloom.bf);
+    if (memuse > 0)
+        SCLogConfig("reputation prefilters use %"PRIu64" bytes", memuse);
     return 0;
+}
 
+static SRepCIDRTree *SRepCIDRAlloc(void)
+{
+    SRepCIDRTree *cidr_ctx = SCMalloc(sizeof(SRepCIDRTree));
+    if (unlikely(cidr_ctx == NULL))
+        return NULL;
+    memset(cidr_ctx, 0, sizeof(SRepCIDRTree));
+    cidr_ctx->refcnt = 1;
+    return cidr_ctx;
 }
 
-/**
- *  \retval 0 valid
- *  \retval 1 header
- *  \retval -1 boo
+static void SRepCIDRFree(SRepCIDRTree *cidr_ctx)
+{
+    int i;
+    for (i = 0; i < SREP_MAX_CATS; i++) {
+        SCLpmIPV4Free(cidr_ctx->srepIPV4_lpm[i]);
+        if (cidr_ctx->srepIPV4_tree[i] != NULL)
+            SCRadixReleaseRadixTree(cidr_ctx->srepIPV4_tree[i]);
+        if (cidr_ctx->srepIPV6_tree[i] != NULL)
+            SCRadixReleaseRadixTree(cidr_ctx->srepIPV6_tree[i]);
+    }
+    BloomFilterBlockedFree(cidr_ctx->srepIPV4_bloom.bf);
+    BloomFilterBlockedFree(cidr_ctx->srepIPV6_bloom.bf);
+    SRepListFree(cidr_ctx->list);
+    SCFree(cidr_ctx);
+}
+
+/** \internal
+ *  \brief drop a snapshot reference, the last one frees it
+ *
+ *  The free is done outside of srep_lock, nothing can get a new
+ *  reference once the count is 0. */
+static void SRepCIDRRelease(SRepCIDRTree *cidr_ctx)
+{
+    if (cidr_ctx == NULL)
+        return;
+
+    SCMutexLock(&srep_lock);
+    BUG_ON(cidr_ctx->refcnt == 0);
+    uint32_t refcnt = --cidr_ctx->refcnt;
+    SCMutexUnlock(&srep_lock);
+
+    if (refcnt == 0)
+        SRepCIDRFree(cidr_ctx);
+}
+
+/** \brief switch a detect thread to the current snapshot of its engine
+ *
+ *  Called from the iprep keyword when det_ctx->srep doesn't match
+ *  de_ctx->srepCIDR_ctx anymore, so a reload costs each thread one
+ *  lock, not a walk over the host table. The old snapshot is freed by
+ *  the last thread to let go of it.
  */
-static int SRepSplitLine(SRepCIDRTree *cidr_ctx, char *line, Address *ip, uint8_t *cat, uint8_t *value)
+void SRepThreadUpdate(DetectEngineThreadCtx *det_ctx)
+{
+    SRepCIDRTree *old = det_ctx->srep;
+
+    SCMutexLock(&srep_lock);
+    det_ctx->srep = det_ctx->de_ctx->srepCIDR_ctx;
+    if (det_ctx->srep != NULL)
+        det_ctx->srep->refcnt++;
+    SCMutexUnlock(&srep_lock);
+
+    SRepCIDRRelease(old);
+}
+
+void SRepThreadRelease(DetectEngineThreadCtx *det_ctx)
+{
+    SRepCIDRRelease(det_ctx->srep);
+    det_ctx->srep = NULL;
+}
+
+static int SRepCatSplitLine(char *line, uint8_t *cat, char *shortname, size_t shortname_len)
 {
     size_t line_len = strlen(line);
-    char *ptrs[3] = {NULL,NULL,NULL};
+    char *ptrs[2] = {NULL,NULL};
     int i = 0;
     int idx = 0;
     char *origline = line;
@@ -289,49 +915,28 @@ static int SRepSplitLine(SRepCIDRTree *cidr_ctx, char *line, Address *ip, uint8_
                 break;
             if (strlen(line) == 0)
                 break;
-            if (idx == 3)
+            if (idx == 2)
                 break;
         } else {
             i++;
         }
     }
 
-    if (idx != 3) {
+    if (idx != 2) {
         return -1;
     }
 
-    //SCLogInfo("%s, %s, %s", ptrs[0], ptrs[1], ptrs[2]);
-
-    if (strcmp(ptrs[0], "ip") == 0)
-        return 1;
+    SCLogDebug("%s, %s", ptrs[0], ptrs[1]);
 
-    int c = atoi(ptrs[1]);
+    int c = atoi(ptrs[0]);
     if (c < 0 || c >= SREP_MAX_CATS) {
         return -1;
     }
 
-    int v = atoi(ptrs[2]);
-    if (v < 0 || v > 127) {
-        return -1;
-    }
-
-    if (strchr(ptrs[0], '/') != NULL) {
-        SRepCIDRAddNetblock(cidr_ctx, ptrs[0], c, v);
-        return 1;
-    } else {
-        if (inet_pton(AF_INET, ptrs[0], &ip->address) == 1) {
-            ip->family = AF_INET;
-        } else if (inet_pton(AF_INET6, ptrs[0], &ip->address) == 1) {
-            ip->family = AF_INET6;
-        } else {
-            return -1;
-        }
-
-        *cat = c;
-        *value = v;
-    }
-
+    *cat = (uint8_t)c;
+    strlcpy(shortname, ptrs[1], shortname_len);
     return 0;
+
 }
 
 #define SREP_SHORTNAME_LEN 32
@@ -425,9 +1030,71 @@ int SRepLoadCatFileFromFD(FILE *fp)
     return 0;
 }
 
-static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
+/** \internal
+ *  \brief read a list from a stream and add it to the snapshot */
+static int SRepLoadStream(SRepCIDRTree *cidr_ctx, FILE *fp, int threads)
+{
+    uint8_t *buf = NULL;
+    size_t size = 0, len = 0;
+    int r = -1;
+
+    while (1) {
+        if (len == size) {
+            size = size ? size * 2 : 65536;
+            uint8_t *ptmp = SCRealloc(buf, size);
+            if (ptmp == NULL)
+                goto end;
+            buf = ptmp;
+        }
+        size_t n = fread(buf + len, 1, size - len, fp);
+        if (n == 0)
+            break;
+        len += n;
+    }
+    if (ferror(fp))
+        goto end;
+
+    r = SRepLoadBuffer(cidr_ctx, buf, len, threads);
+end:
+    if (buf != NULL)
+        SCFree(buf);
+    return r;
+}
+
+/** \internal
+ *  \brief load a reputation file, mapped into memory if possible
+ *
+ *  \param threads max threads to parse a large text file with
+ */
+static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename, int threads)
 {
     int r = 0;
+#if HAVE_SYS_MMAN_H
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        SCLogError(SC_ERR_OPENING_RULE_FILE, "opening ip rep file %s: %s", filename, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            return 0;
+        }
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            SCLogError(SC_ERR_OPENING_RULE_FILE, "mapping ip rep file %s: %s", filename, strerror(errno));
+            return -1;
+        }
+        r = SRepLoadBuffer(cidr_ctx, map, (size_t)st.st_size, threads);
+        munmap(map, (size_t)st.st_size);
+        return r;
+    }
+    close(fd);
+#endif
+    /* not a regular file or no mmap: read it */
     FILE *fp = fopen(filename, "r");
 
     if (fp == NULL) {
@@ -435,7 +1102,7 @@ static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
         return -1;
     }
 
-    r = SRepLoadFileFromFD(cidr_ctx, fp);
+    r = SRepLoadStream(cidr_ctx, fp, threads);
 
     fclose(fp);
     fp = NULL;
@@ -443,97 +1110,11 @@ static int SRepLoadFile(SRepCIDRTree *cidr_ctx, char *filename)
 
 }
 
+/** \brief add the hosts and netblocks of a text or binary list to a
+ *         snapshot, they are available for lookups once it's compiled */
 int SRepLoadFileFromFD(SRepCIDRTree *cidr_ctx, FILE *fp)
 {
-    char line[8192] = "";
-    Address a;
-    memset(&a, 0x00, sizeof(a));
-    a.family = AF_INET;
-
-    while(fgets(line, (int)sizeof(line), fp) != NULL) {
-        size_t len = strlen(line);
-        if (len == 0)
-            continue;
-
-        /* ignore comments and empty lines */
-        if (line[0] == '\n' || line [0] == '\r' || line[0] == ' ' || line[0] == '#' || line[0] == '\t')
-            continue;
-
-        while (isspace((unsigned char)line[--len]));
-
-        /* Check if we have a trailing newline, and remove it */
-        len = strlen(line);
-        if (len == 0)
-            continue;
-
-        if (line[len - 1] == '\n' || line[len - 1] == '\r') {
-            line[len - 1] = '\0';
-        }
-
-        uint8_t cat = 0, value = 0;
-        int r = SRepSplitLine(cidr_ctx, line, &a, &cat, &value);
-        if (r < 0) {
-            SCLogError(SC_ERR_NO_REPUTATION, "bad line \"%s\"", line);
-        } else if (r == 0) {
-            if (a.family == AF_INET) {
-                char ipstr[16];
-                PrintInet(AF_INET, (const void *)&a.address, ipstr, sizeof(ipstr));
-                SCLogDebug("%s %u %u", ipstr, cat, value);
-            } else {
-                char ipstr[128];
-                PrintInet(AF_INET6, (const void *)&a.address, ipstr, sizeof(ipstr));
-                SCLogDebug("%s %u %u", ipstr, cat, value);
-            }
-
-            Host *h = HostGetHostFromHash(&a);
-            if (h == NULL) {
-                SCLogError(SC_ERR_NO_REPUTATION, "failed to get a host, increase host.memcap");
-                break;
-            } else {
-                //SCLogInfo("host %p", h);
-
-                if (h->iprep == NULL) {
-                    h->iprep = SCMalloc(sizeof(SReputation));
-                    if (h->iprep != NULL) {
-                        memset(h->iprep, 0x00, sizeof(SReputation));
-
-                        HostIncrUsecnt(h);
-                    }
-                }
-                if (h->iprep != NULL) {
-                    SReputation *rep = h->iprep;
-
-                    /* if version is outdated, it's an older entry that we'll
-                     * now replace. */
-                    if (rep->version != SRepGetVersion()) {
-                        memset(rep, 0x00, sizeof(SReputation));
-                    }
-
-                    rep->version = SRepGetVersion();
-                    rep->rep[cat] = value;
-
-                    SCLogDebug("host %p iprep %p setting cat %u to value %u",
-                        h, h->iprep, cat, value);
-#ifdef DEBUG
-                    if (SCLogDebugEnabled()) {
-                        int i;
-                        for (i = 0; i < SREP_MAX_CATS; i++) {
-                            if (rep->rep[i] == 0)
-                                continue;
-
-                            SCLogDebug("--> host %p iprep %p cat %d to value %u",
-                                    h, h->iprep, i, rep->rep[i]);
-                        }
-                    }
-#endif
-                }
-
-                HostRelease(h);
-            }
-        }
-    }
-
-    return 0;
+    return SRepLoadStream(cidr_ctx, fp, 1);
 }
 
 /**
@@ -577,6 +1158,41 @@ static char *SRepCompleteFilePath(char *file)
     return path;
 }
 
+/** \internal
+ *  \brief load the reputation files into a snapshot and compile it
+ *
+ *  \param fatal exit on a failing file if de_ctx has failure_fatal set
+ *
+ *  \retval 0 ok
+ *  \retval -1 one or more files failed to load
+ */
+static int SRepLoadFiles(DetectEngineCtx *de_ctx, SRepCIDRTree *cidr_ctx,
+        ConfNode *files, int fatal)
+{
+    ConfNode *file = NULL;
+    int ret = 0;
+
+    TAILQ_FOREACH(file, &files->head, next) {
+        char *sfile = SRepCompleteFilePath(file->val);
+        if (sfile == NULL)
+            return -1;
+        SCLogInfo("Loading reputation file: %s", sfile);
+
+        if (SRepLoadFile(cidr_ctx, sfile, de_ctx->build_threads) < 0) {
+            if (fatal && de_ctx->failure_fatal == 1) {
+                exit(EXIT_FAILURE);
+            }
+            ret = -1;
+        }
+        SCFree(sfile);
+    }
+    if (SRepCIDRCompile(cidr_ctx) < 0) {
+        SCLogError(SC_ERR_NO_REPUTATION, "failed to compile the reputation data");
+        ret = -1;
+    }
+    return ret;
+}
+
 /** \brief init reputation
  *
  *  \param de_ctx detection engine ctx for tracking iprep version
@@ -590,26 +1206,15 @@ static char *SRepCompleteFilePath(char *file)
 int SRepInit(DetectEngineCtx *de_ctx)
 {
     ConfNode *files;
-    ConfNode *file = NULL;
-    int r = 0;
-    char *sfile = NULL;
     char *filename = NULL;
     int init = 0;
-    int i = 0;
 
-    de_ctx->srepCIDR_ctx = (SRepCIDRTree *)SCMalloc(sizeof(SRepCIDRTree));
+    de_ctx->srepCIDR_ctx = SRepCIDRAlloc();
     if (de_ctx->srepCIDR_ctx == NULL)
         exit(EXIT_FAILURE);
-    memset(de_ctx->srepCIDR_ctx, 0, sizeof(SRepCIDRTree));
     SRepCIDRTree *cidr_ctx = de_ctx->srepCIDR_ctx;
 
-    for (i = 0; i < SREP_MAX_CATS; i++) {
-        cidr_ctx->srepIPV4_tree[i] = NULL;
-        cidr_ctx->srepIPV6_tree[i] = NULL;
-    }
-
     if (SRepGetVersion() == 0) {
-        SC_ATOMIC_INIT(srep_eversion);
         init = 1;
     }
 
@@ -644,50 +1249,59 @@ int SRepInit(DetectEngineCtx *de_ctx)
     de_ctx->srep_version = SRepIncrVersion();
     SCLogDebug("Reputation version %u", de_ctx->srep_version);
 
-    /* ok, let's load signature files from the general config */
-    if (files != NULL) {
-        TAILQ_FOREACH(file, &files->head, next) {
-            sfile = SRepCompleteFilePath(file->val);
-            SCLogInfo("Loading reputation file: %s", sfile);
-
-            r = SRepLoadFile(cidr_ctx, sfile);
-            if (r < 0){
-                if (de_ctx->failure_fatal == 1) {
-                    exit(EXIT_FAILURE);
-                }
-            }
-            SCFree(sfile);
-        }
+    /* ok, let's load reputation files from the general config */
+    (void)SRepLoadFiles(de_ctx, cidr_ctx, files, 1);
+    return 0;
+}
+
+/** \internal
+ *  \brief make cidr_ctx the snapshot of de_ctx, takes over its reference */
+static void SRepSwap(DetectEngineCtx *de_ctx, SRepCIDRTree *cidr_ctx)
+{
+    SCMutexLock(&srep_lock);
+    SRepCIDRTree *old = de_ctx->srepCIDR_ctx;
+    de_ctx->srepCIDR_ctx = cidr_ctx;
+    SCMutexUnlock(&srep_lock);
+
+    /* drop the engine's reference, threads still using it hold their own */
+    SRepCIDRRelease(old);
+}
+
+/** \brief reload the reputation files of a detect engine
+ *
+ *  A new snapshot is built next to the one in use and only swapped in
+ *  if all files loaded. Detect threads pick it up on their next iprep
+ *  lookup, see SRepThreadUpdate(). The categories file is not reloaded.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, the old snapshot stays in place
+ */
+int SRepReload(DetectEngineCtx *de_ctx)
+{
+    ConfNode *files = ConfGetNode("reputation-files");
+    if (files == NULL || SRepGetVersion() == 0) {
+        SCLogError(SC_ERR_NO_REPUTATION, "IP reputation not enabled");
+        return -1;
     }
 
-    /* Set effective rep version.
-     * On live reload we will handle this after de_ctx has been swapped */
-    if (init) {
-        SRepInitComplete();
+    SRepCIDRTree *cidr_ctx = SRepCIDRAlloc();
+    if (cidr_ctx == NULL)
+        return -1;
+
+    if (SRepLoadFiles(de_ctx, cidr_ctx, files, 0) < 0) {
+        SCLogError(SC_ERR_NO_REPUTATION, "reputation reload failed, "
+                "keeping the current reputation data");
+        SRepCIDRFree(cidr_ctx);
+        return -1;
     }
 
-    HostPrintStats();
+    SRepSwap(de_ctx, cidr_ctx);
     return 0;
 }
 
 void SRepDestroy(DetectEngineCtx *de_ctx) {
-    if (de_ctx->srepCIDR_ctx != NULL) {
-        int i;
-        for (i = 0; i < SREP_MAX_CATS; i++) {
-            if (de_ctx->srepCIDR_ctx->srepIPV4_tree[i] != NULL) {
-                SCRadixReleaseRadixTree(de_ctx->srepCIDR_ctx->srepIPV4_tree[i]);
-                de_ctx->srepCIDR_ctx->srepIPV4_tree[i] = NULL;
-            }
-
-            if (de_ctx->srepCIDR_ctx->srepIPV6_tree[i] != NULL) {
-                SCRadixReleaseRadixTree(de_ctx->srepCIDR_ctx->srepIPV6_tree[i]);
-                de_ctx->srepCIDR_ctx->srepIPV6_tree[i] = NULL;
-            }
-        }
-
-        SCFree(de_ctx->srepCIDR_ctx);
-        de_ctx->srepCIDR_ctx = NULL;
-    }
+    SRepCIDRRelease(de_ctx->srepCIDR_ctx);
+    de_ctx->srepCIDR_ctx = NULL;
 }
 
 #ifdef UNITTESTS
@@ -698,6 +1312,129 @@ void SRepDestroy(DetectEngineCtx *de_ctx) {
 #include "stream-tcp.h"
 #include "util-unittest-helper.h"
 
+static void SRepCIDRFreeUserData(void *data)
+{
+    if (data != NULL)
+        SCFree(data);
+
+    return;
+}
+
+/** \internal
+ *  \brief add a netblock to the radix tree of its category directly,
+ *         SRepCIDRCompile() merges it with the loaded entries */
+static int SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, const SRepEntry *e)
+{
+    SCRadixTree **tree = (e->family == AF_INET) ?
+        &cidr_ctx->srepIPV4_tree[e->cat] : &cidr_ctx->srepIPV6_tree[e->cat];
+    if (*tree == NULL) {
+        *tree = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
+        if (*tree == NULL)
+            return -1;
+    }
+
+    SReputation *rep = SCMalloc(sizeof(SReputation));
+    if (unlikely(rep == NULL))
+        return -1;
+    memset(rep, 0x00, sizeof(SReputation));
+    rep->version = SRepGetVersion();
+    rep->rep[e->cat] = e->value;
+
+    uint8_t addr[16];
+    SCRadixNode *node;
+    memcpy(addr, e->addr, sizeof(addr));
+    if (e->family == AF_INET)
+        node = SCRadixAddKeyIPV4Netblock(addr, *tree, (void *)rep, e->netmask);
+    else
+        node = SCRadixAddKeyIPV6Netblock(addr, *tree, (void *)rep, e->netmask);
+    if (node == NULL) {
+        SCFree(rep);
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief add a single address to the radix tree of its category
+ *         directly, the last value added wins
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+static int SRepCIDRAddHost(SRepCIDRTree *cidr_ctx, Address *a, uint8_t cat, uint8_t value)
+{
+    SCRadixTree **tree = (a->family == AF_INET) ?
+        &cidr_ctx->srepIPV4_tree[cat] : &cidr_ctx->srepIPV6_tree[cat];
+    if (*tree == NULL) {
+        *tree = SCRadixCreateRadixTree(SRepCIDRFreeUserData, NULL);
+        if (*tree == NULL)
+            return -1;
+    }
+
+    void *user_data = NULL;
+    if (a->family == AF_INET)
+        (void)SCRadixFindKeyIPV4ExactMatch((uint8_t *)&a->address, *tree, &user_data);
+    else
+        (void)SCRadixFindKeyIPV6ExactMatch((uint8_t *)&a->address, *tree, &user_data);
+
+    /* same host listed again, last value wins */
+    if (user_data != NULL) {
+        SReputation *rep = (SReputation *)user_data;
+        rep->version = SRepGetVersion();
+        rep->rep[cat] = value;
+        return 0;
+    }
+
+    SReputation *rep = SCMalloc(sizeof(SReputation));
+    if (unlikely(rep == NULL))
+        return -1;
+    memset(rep, 0x00, sizeof(SReputation));
+    rep->version = SRepGetVersion();
+    rep->rep[cat] = value;
+
+    SCRadixNode *node;
+    if (a->family == AF_INET)
+        node = SCRadixAddKeyIPV4((uint8_t *)&a->address, *tree, (void *)rep);
+    else
+        node = SCRadixAddKeyIPV6((uint8_t *)&a->address, *tree, (void *)rep);
+    if (node == NULL) {
+        SCFree(rep);
+        return -1;
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief scan a line, adding netblocks to the trees directly
+ *
+ *  \retval 0 valid host, returned in ip, cat and value
+ *  \retval 1 header or netblock
+ *  \retval -1 boo
+ */
+static int SRepSplitLine(SRepCIDRTree *cidr_ctx, char *line, Address *ip, uint8_t *cat, uint8_t *value)
+{
+    char *eol = strchr(line, '\n');
+    SRepEntry e;
+
+    int r = SRepScanLine(line, eol ? eol : line + strlen(line), &e);
+    if (r != 0)
+        return r;
+
+    if (e.netmask != ((e.family == AF_INET) ? 32 : 128)) {
+        if (SRepCIDRAddNetblock(cidr_ctx, &e) < 0)
+            return -1;
+        return 1;
+    }
+
+    memset(ip, 0x00, sizeof(*ip));
+    ip->family = e.family;
+    memcpy(&ip->address, e.addr, sizeof(e.addr));
+    *cat = e.cat;
+    *value = e.value;
+    return 0;
+}
+
+
 static int SRepTest01(void)
 {
     char str[] = "1.2.3.4,1,2";
@@ -909,6 +1646,214 @@ end:
     DetectEngineCtxFree(de_ctx);
     return result;
 }
+
+/** \test a reloaded snapshot is picked up by a thread and the old one is
+ *        only freed once the thread let go of it */
+static int SRepTest08(void)
+{
+    DetectEngineThreadCtx det_ctx;
+    SRepCIDRTree *old = NULL, *new = NULL;
+    char str1[] = "1.2.3.4,1,10";
+    char str2[] = "1.2.3.4,1,20";
+    Address a;
+    uint8_t cat = 0, value = 0;
+    int result = 0;
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return 0;
+    det_ctx.de_ctx = de_ctx;
+    old = de_ctx->srepCIDR_ctx;
+
+    if (SRepSplitLine(old, str1, &a, &cat, &value) != 0 ||
+            SRepCIDRAddHost(old, &a, cat, value) != 0)
+        goto end;
+
+    SRepThreadUpdate(&det_ctx);
+    if (det_ctx.srep != old || old->refcnt != 2)
+        goto end;
+
+    new = SRepCIDRAlloc();
+    if (new == NULL)
+        goto end;
+    if (SRepSplitLine(new, str2, &a, &cat, &value) != 0 ||
+            SRepCIDRAddHost(new, &a, cat, value) != 0) {
+        SRepCIDRFree(new);
+        goto end;
+    }
+    SRepCIDRCompile(new);
+    SRepSwap(de_ctx, new);
+
+    /* the thread still reads the old data */
+    if (old->refcnt != 1 || SRepCIDRGetIPv4IPRep(det_ctx.srep, (uint8_t *)&a.address, 1) != 10)
+        goto end;
+
+    SRepThreadUpdate(&det_ctx);
+    if (det_ctx.srep != new || new->refcnt != 2 ||
+            SRepCIDRGetIPv4IPRep(det_ctx.srep, (uint8_t *)&a.address, 1) != 20)
+        goto end;
+
+    result = 1;
+end:
+    SRepThreadRelease(&det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    return result;
+}
+
+/** \test ipv6 prefilter: listed hosts and netblocks pass, others are
+ *        rejected before the radix lookup */
+static int SRepTest09(void)
+{
+    char str1[] = "2001:db8::1,1,10";
+    char str2[] = "2001:db8:1::/48,2,20";
+    uint8_t addr[16];
+    Address a;
+    uint8_t cat = 0, value = 0;
+    int result = 0;
+    int i, miss = 0;
+
+    SRepCIDRTree *cidr_ctx = SRepCIDRAlloc();
+    if (cidr_ctx == NULL)
+        return 0;
+
+    if (SRepSplitLine(cidr_ctx, str1, &a, &cat, &value) != 0 ||
+            SRepCIDRAddHost(cidr_ctx, &a, cat, value) != 0)
+        goto end;
+    if (SRepSplitLine(cidr_ctx, str2, &a, &cat, &value) != 1)
+        goto end;
+    SRepCIDRCompile(cidr_ctx);
+
+    SRepBloom *b = &cidr_ctx->srepIPV6_bloom;
+    if (b->bf == NULL || b->netmasks_cnt != 2 ||
+            b->netmasks[0] != 48 || b->netmasks[1] != 128)
+        goto end;
+
+    if (inet_pton(AF_INET6, "2001:db8::1", addr) != 1 ||
+            !SRepBloomTest(b, addr, 4) ||
+            SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 1) != 10)
+        goto end;
+    if (inet_pton(AF_INET6, "2001:db8:1:2::3", addr) != 1 ||
+            !SRepBloomTest(b, addr, 4) ||
+            SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 2) != 20)
+        goto end;
+
+    /* unlisted addresses are almost all rejected by the filter */
+    if (inet_pton(AF_INET6, "2001:db8:2::", addr) != 1)
+        goto end;
+    for (i = 0; i < 1000; i++) {
+        addr[14] = (uint8_t)(i >> 8);
+        addr[15] = (uint8_t)i;
+        if (!SRepBloomTest(b, addr, 4))
+            miss++;
+        if (SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 1) != 0 ||
+                SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 2) != 0)
+            goto end;
+    }
+    if (miss < 950)
+        goto end;
+
+    result = 1;
+end:
+    SRepCIDRFree(cidr_ctx);
+    return result;
+}
+/** \test text list: comments, header, duplicates, bad lines and
+ *        netblocks, parsed in chunks on two threads */
+static int SRepTest10(void)
+{
+    const char str[] =
+        "# comment\n"
+        "ip,cat,value\n"
+        "1.2.3.4,1,10\n"
+        "\n"
+        "10.0.0.0/8,1,20\r\n"
+        "10.1.2.3/16,1,30\n"
+        "1.2.3.4,1,11\n"
+        "256.1.1.1,1,1\n"
+        "1.2.3.5,60,1\n"
+        "1.2.3.6,1,128\n"
+        "2001:db8::/32,2,40\n"
+        "2001:db8::1,2,50";
+    uint8_t addr[16];
+    uint32_t chunks;
+
+    for (chunks = 1; chunks <= 8; chunks++) {
+        SRepCIDRTree *cidr_ctx = SRepCIDRAlloc();
+        FAIL_IF_NULL(cidr_ctx);
+        cidr_ctx->list = SCCalloc(1, sizeof(SRepList));
+        FAIL_IF_NULL(cidr_ctx->list);
+
+        FAIL_IF(SRepParseText(cidr_ctx->list, str, strlen(str), chunks, 2) != 0);
+        FAIL_IF(cidr_ctx->list->cnt != 6);
+        FAIL_IF(cidr_ctx->list->errors != 3);
+        FAIL_IF(SRepCIDRCompile(cidr_ctx) != 0);
+        FAIL_IF(cidr_ctx->list != NULL);
+        FAIL_IF(cidr_ctx->srepIPV4_lpm[1] == NULL);
+
+        FAIL_IF(inet_pton(AF_INET, "1.2.3.4", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 1) != 11);
+        FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 2) != 0);
+        FAIL_IF(inet_pton(AF_INET, "10.1.200.1", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 1) != 30);
+        FAIL_IF(inet_pton(AF_INET, "10.2.0.1", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 1) != 20);
+        FAIL_IF(inet_pton(AF_INET, "1.2.3.6", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 1) != 0);
+
+        FAIL_IF(inet_pton(AF_INET6, "2001:db8::1", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 2) != 50);
+        FAIL_IF(inet_pton(AF_INET6, "2001:db8::2", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 2) != 40);
+        FAIL_IF(inet_pton(AF_INET6, "2001:db9::1", addr) != 1);
+        FAIL_IF(SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 2) != 0);
+
+        SRepCIDRFree(cidr_ctx);
+    }
+    PASS;
+}
+
+/** \test binary list */
+static int SRepTest11(void)
+{
+    uint8_t buf[sizeof(SRepBinHeader) + 4 * sizeof(SRepBinRecord)];
+    SRepBinHeader h;
+    SRepBinRecord r[4];
+    uint8_t addr[16];
+
+    memset(&h, 0x00, sizeof(h));
+    memcpy(h.magic, SREP_BIN_MAGIC, sizeof(h.magic));
+    h.cnt = htonl(4);
+    memset(r, 0x00, sizeof(r));
+    FAIL_IF(inet_pton(AF_INET, "192.168.0.0", r[0].addr) != 1);
+    r[0].family = 4; r[0].netmask = 16; r[0].cat = 3; r[0].value = 7;
+    FAIL_IF(inet_pton(AF_INET, "192.168.1.1", r[1].addr) != 1);
+    r[1].family = 4; r[1].netmask = 32; r[1].cat = 3; r[1].value = 8;
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::1", r[2].addr) != 1);
+    r[2].family = 6; r[2].netmask = 128; r[2].cat = 3; r[2].value = 9;
+    /* bad category */
+    r[3].family = 4; r[3].netmask = 32; r[3].cat = SREP_MAX_CATS; r[3].value = 1;
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), r, sizeof(r));
+
+    SRepCIDRTree *cidr_ctx = SRepCIDRAlloc();
+    FAIL_IF_NULL(cidr_ctx);
+    FAIL_IF(SRepLoadBuffer(cidr_ctx, buf, sizeof(buf), 1) != 0);
+    FAIL_IF(cidr_ctx->list->cnt != 3 || cidr_ctx->list->errors != 1);
+    /* truncated */
+    FAIL_IF(SRepLoadBuffer(cidr_ctx, buf, sizeof(buf) - 1, 1) == 0);
+    FAIL_IF(SRepCIDRCompile(cidr_ctx) != 0);
+
+    FAIL_IF(inet_pton(AF_INET, "192.168.2.1", addr) != 1);
+    FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 3) != 7);
+    FAIL_IF(inet_pton(AF_INET, "192.168.1.1", addr) != 1);
+    FAIL_IF(SRepCIDRGetIPv4IPRep(cidr_ctx, addr, 3) != 8);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::1", addr) != 1);
+    FAIL_IF(SRepCIDRGetIPv6IPRep(cidr_ctx, addr, 3) != 9);
+
+    SRepCIDRFree(cidr_ctx);
+    PASS;
+}
 #endif
 
 /** Global trees that hold host reputation for IPV4 and IPV6 hosts */
@@ -2347,6 +3292,10 @@ void SCReputationRegisterTests(void)
     UtRegisterTest("SRepTest05", SRepTest05);
     UtRegisterTest("SRepTest06", SRepTest06);
     UtRegisterTest("SRepTest07", SRepTest07);
+    UtRegisterTest("SRepTest08", SRepTest08);
+    UtRegisterTest("SRepTest09", SRepTest09);
+    UtRegisterTest("SRepTest10", SRepTest10);
+    UtRegisterTest("SRepTest11", SRepTest11);
 #endif /* UNITTESTS */
 }
 
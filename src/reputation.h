@@ -27,12 +27,41 @@
 #define __REPUTATION_H__
 
 #include "host.h"
+#include "util-lpm-ipv4.h"
+#include "util-bloomfilter-blocked.h"
 
 #define SREP_MAX_CATS 60
 
+/** max number of distinct netmasks for the prefilter, each takes a
+ *  filter test on a lookup */
+#define SREP_BLOOM_MAX_NETMASKS 4
+
+/** prefilter of all hosts and netblocks of an address family, over all
+ *  categories. Keys are the address masked to each netmask in use. */
+typedef struct SRepBloom_ {
+    BloomFilterBlocked *bf;     /**< NULL if not used */
+    uint8_t netmasks[SREP_BLOOM_MAX_NETMASKS];
+    uint8_t netmasks_cnt;
+} SRepBloom;
+
+struct SRepList_;
+
 typedef struct SRepCIDRTree_ {
     SCRadixTree *srepIPV4_tree[SREP_MAX_CATS];
     SCRadixTree *srepIPV6_tree[SREP_MAX_CATS];
+    /* compiled from srepIPV4_tree after loading, NULL if not compiled */
+    SCLpmIPV4 *srepIPV4_lpm[SREP_MAX_CATS];
+    /* prefilters in front of the radix trees, the ipv4 one is only built
+     * when a category isn't compiled */
+    SRepBloom srepIPV4_bloom;
+    SRepBloom srepIPV6_bloom;
+    /** entries loaded from the files, turned into the above by
+     *  compiling the snapshot. NULL once compiled. */
+    struct SRepList_ *list;
+    /** references: the detect engine and the detect threads using
+     *  it, protected by the reputation lock. The snapshot is read only
+     *  once loaded, a reload builds a new one. */
+    uint32_t refcnt;
 } SRepCIDRTree;
 
 typedef struct SReputation_ {
@@ -40,11 +69,34 @@ typedef struct SReputation_ {
     uint8_t rep[SREP_MAX_CATS];
 } SReputation;
 
+/** Binary reputation list. A reputation file that starts with the magic
+ *  is read as one SRepBinHeader followed by 'cnt' SRepBinRecord, which
+ *  loads without parsing text. Multi byte fields are in network byte
+ *  order. */
+#define SREP_BIN_MAGIC      "SREPBIN1"
+
+typedef struct SRepBinHeader_ {
+    char magic[8];          /**< SREP_BIN_MAGIC, not terminated */
+    uint32_t cnt;           /**< number of records */
+    uint32_t reserved;
+} SRepBinHeader;
+
+typedef struct SRepBinRecord_ {
+    uint8_t addr[16];       /**< ipv4 uses the first 4 bytes */
+    uint8_t family;         /**< 4 or 6 */
+    uint8_t netmask;        /**< 32 or 128 for a host */
+    uint8_t cat;
+    uint8_t value;
+} SRepBinRecord;
+
+struct DetectEngineThreadCtx_;
+
 uint8_t SRepCatGetByShortname(char *shortname);
 int SRepInit(struct DetectEngineCtx_ *de_ctx);
 void SRepDestroy(struct DetectEngineCtx_ *de_ctx);
-void SRepReloadComplete(void);
-int SRepHostTimedOut(Host *);
+int SRepReload(struct DetectEngineCtx_ *de_ctx);
+void SRepThreadUpdate(struct DetectEngineThreadCtx_ *det_ctx);
+void SRepThreadRelease(struct DetectEngineThreadCtx_ *det_ctx);
 
 /** Reputation numbers (types) that we can use to lookup/update, etc
  *  Please, dont convert this to a enum since we want the same reputation
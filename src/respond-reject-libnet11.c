@@ -29,7 +29,9 @@
  *  \todo Possibly default to port unreachable for UDP traffic this seems
  *        to be the default in flexresp and iptables
  *  \todo implement ipv6 resets
- *  \todo implement pre-alloc resets for speed
+ *
+ *  The libnet contexts are per thread and kept open, one per kind of
+ *  reject, and the headers of the last reject are updated in place.
  */
 
 #include "suricata-common.h"
@@ -78,14 +80,104 @@ typedef struct Libnet11Packet_ {
     size_t len;
 } Libnet11Packet;
 
+enum {
+    REJECT_LIBNET_TCP4,
+    REJECT_LIBNET_ICMP4,
+    REJECT_LIBNET_TCP6,
+    REJECT_LIBNET_ICMP6,
+    REJECT_LIBNET_MAX,
+};
+
+/** a libnet context kept for the lifetime of the thread, one per kind of
+ *  reject so the headers built for the last one are updated in place
+ *  through their ptags instead of being built again */
+typedef struct RejectLibnetCtx_ {
+    libnet_t *c;
+    const char *devname;    /**< device it was opened on, NULL for routed */
+    libnet_ptag_t l4;
+    libnet_ptag_t l3;
+} RejectLibnetCtx;
+
+typedef struct RejectLibnetThread_ {
+    RejectLibnetCtx ctx[REJECT_LIBNET_MAX];
+} RejectLibnetThread;
+
+static const char *RejectLibnetDevName(const Packet *p)
+{
+    if (IS_SURI_HOST_MODE_SNIFFER_ONLY(host_mode) && (p->livedev)) {
+        SCLogDebug("Will emit reject packet on dev %s", p->livedev->dev);
+        return p->livedev->dev;
+    }
+    return NULL;
+}
+
+/** \internal \brief get the context for a kind of reject, it's opened the
+ *         first time, and again if the packet came in on another device */
+static RejectLibnetCtx *RejectLibnetGet(void *data, int kind, const Packet *p)
+{
+    RejectLibnetThread *td = (RejectLibnetThread *)data;
+    if (td == NULL)
+        return NULL;
+    RejectLibnetCtx *ctx = &td->ctx[kind];
+    const char *devname = RejectLibnetDevName(p);
+
+    if (ctx->c != NULL && ctx->devname != devname) {
+        libnet_destroy(ctx->c);
+        memset(ctx, 0x00, sizeof(*ctx));
+    }
+    if (ctx->c == NULL) {
+        char ebuf[LIBNET_ERRBUF_SIZE];
+        const int injection = (kind == REJECT_LIBNET_TCP4 || kind == REJECT_LIBNET_ICMP4) ?
+            LIBNET_RAW4 : LIBNET_RAW6;
+        ctx->c = libnet_init(injection, LIBNET_INIT_CAST devname, ebuf);
+        if (ctx->c == NULL) {
+            SCLogError(SC_ERR_LIBNET_INIT,"libnet_init failed: %s", ebuf);
+            return NULL;
+        }
+        ctx->devname = devname;
+        ctx->l4 = 0;
+        ctx->l3 = 0;
+    }
+    return ctx;
+}
+
+/** \internal \brief drop the headers after a failed build, so the next
+ *         reject builds them from scratch */
+static void RejectLibnetReset(RejectLibnetCtx *ctx)
+{
+    libnet_clear_packet(ctx->c);
+    ctx->l4 = 0;
+    ctx->l3 = 0;
+}
+
+int RejectLibnet11ThreadInit(void **data)
+{
+    RejectLibnetThread *td = SCCalloc(1, sizeof(*td));
+    if (unlikely(td == NULL))
+        return -1;
+    *data = td;
+    return 0;
+}
+
+void RejectLibnet11ThreadDeinit(void *data)
+{
+    RejectLibnetThread *td = (RejectLibnetThread *)data;
+    if (td == NULL)
+        return;
+    int i;
+    for (i = 0; i < REJECT_LIBNET_MAX; i++) {
+        if (td->ctx[i].c != NULL)
+            libnet_destroy(td->ctx[i].c);
+    }
+    SCFree(td);
+}
+
 int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
 {
 
     Libnet11Packet lpacket;
-    libnet_t *c; /* libnet context */
-    char ebuf[LIBNET_ERRBUF_SIZE];
+    RejectLibnetCtx *ctx;
     int result;
-    const char *devname = NULL;
 
     /* fill in struct defaults */
     lpacket.ttl = 0;
@@ -93,18 +185,12 @@ int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
     lpacket.flow = 0;
     lpacket.class = 0;
 
-    if (IS_SURI_HOST_MODE_SNIFFER_ONLY(host_mode) && (p->livedev)) {
-        devname = p->livedev->dev;
-        SCLogDebug("Will emit reject packet on dev %s", devname);
-    }
-    if ((c = libnet_init(LIBNET_RAW4, LIBNET_INIT_CAST devname, ebuf)) == NULL) {
-        SCLogError(SC_ERR_LIBNET_INIT,"libnet_init failed: %s", ebuf);
-        return 1;
-    }
-
     if (p->tcph == NULL)
        return 1;
 
+    if ((ctx = RejectLibnetGet(data, REJECT_LIBNET_TCP4, p)) == NULL)
+        return 1;
+
     /* save payload len */
     lpacket.dsize = p->payload_len;
 
@@ -153,8 +239,8 @@ int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
     /* TODO come up with ttl calc function */
     lpacket.ttl = 64;
 
-    /* build the package */
-    if ((libnet_build_tcp(
+    /* build the package, or update the one of the last reject */
+    if ((ctx->l4 = libnet_build_tcp(
                     lpacket.sp,            /* source port */
                     lpacket.dp,            /* dst port */
                     lpacket.seq,           /* seq number */
@@ -166,14 +252,14 @@ int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
                     LIBNET_TCP_H,          /* header length */
                     NULL,                  /* payload */
                     0,                     /* payload length */
-                    c,                     /* libnet context */
-                    0)) < 0)               /* libnet ptag */
+                    ctx->c,                /* libnet context */
+                    ctx->l4)) < 0)         /* libnet ptag */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_tcp %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_tcp %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    if ((libnet_build_ipv4(
+    if ((ctx->l3 = libnet_build_ipv4(
                     LIBNET_TCP_H + LIBNET_IPV4_H, /* entire packet length */
                     0,                            /* tos */
                     lpacket.id,                   /* ID */
@@ -185,31 +271,29 @@ int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
                     lpacket.dst4,                 /* destination address */
                     NULL,                         /* pointer to packet data (or NULL) */
                     0,                            /* payload length */
-                    c,                            /* libnet context pointer */
-                    0)) < 0)                      /* packet id */
+                    ctx->c,                       /* libnet context pointer */
+                    ctx->l3)) < 0)                /* packet id */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv4 %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv4 %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    result = libnet_write(c);
+    result = libnet_write(ctx->c);
     if (result == -1) {
-        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write failed: %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write failed: %s", libnet_geterror(ctx->c));
     }
+    return 0;
 
-cleanup:
-    libnet_destroy (c);
+error:
+    RejectLibnetReset(ctx);
     return 0;
 }
 
 int RejectSendLibnet11L3IPv4ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
 {
     Libnet11Packet lpacket;
-    libnet_t *c; /* libnet context */
-    char ebuf[LIBNET_ERRBUF_SIZE];
+    RejectLibnetCtx *ctx;
     int result;
-    const char *devname = NULL;
 
     /* fill in struct defaults */
     lpacket.ttl = 0;
@@ -219,13 +303,8 @@ int RejectSendLibnet11L3IPv4ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
 
     lpacket.len = (IPV4_GET_HLEN(p) + p->payload_len);
 
-    if (IS_SURI_HOST_MODE_SNIFFER_ONLY(host_mode) && (p->livedev)) {
-        devname = p->livedev->dev;
-    }
-    if ((c = libnet_init(LIBNET_RAW4, LIBNET_INIT_CAST devname, ebuf)) == NULL) {
-        SCLogError(SC_ERR_LIBNET_INIT,"libnet_inint failed: %s", ebuf);
+    if ((ctx = RejectLibnetGet(data, REJECT_LIBNET_ICMP4, p)) == NULL)
         return 1;
-    }
 
     switch (dir) {
         case REJECT_DIR_SRC:
@@ -245,21 +324,21 @@ int RejectSendLibnet11L3IPv4ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
     /* TODO come up with ttl calc function */
     lpacket.ttl = 64;
 
-    /* build the package */
-    if ((libnet_build_icmpv4_unreach(
+    /* build the package, or update the one of the last reject */
+    if ((ctx->l4 = libnet_build_icmpv4_unreach(
                     ICMP_DEST_UNREACH,        /* type */
                     ICMP_HOST_ANO,            /* code */
                     0,                        /* checksum */
                     (uint8_t *)p->ip4h,       /* payload */
                     lpacket.len,              /* payload length */
-                    c,                        /* libnet context */
-                    0)) < 0)                  /* libnet ptag */
+                    ctx->c,                   /* libnet context */
+                    ctx->l4)) < 0)            /* libnet ptag */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_icmpv4_unreach %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_icmpv4_unreach %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    if ((libnet_build_ipv4(
+    if ((ctx->l3 = libnet_build_ipv4(
                     LIBNET_ICMPV4_H + LIBNET_IPV4_H +
                     lpacket.len,                    /* entire packet length */
                     0,                              /* tos */
@@ -272,21 +351,21 @@ int RejectSendLibnet11L3IPv4ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
                     lpacket.dst4,                   /* destination address */
                     NULL,                           /* pointer to packet data (or NULL) */
                     0,                              /* payload length */
-                    c,                              /* libnet context pointer */
-                    0)) < 0)                        /* packet id */
+                    ctx->c,                         /* libnet context pointer */
+                    ctx->l3)) < 0)                  /* packet id */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv4 %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv4 %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    result = libnet_write(c);
+    result = libnet_write(ctx->c);
     if (result == -1) {
-        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write_raw_ipv4 failed: %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write_raw_ipv4 failed: %s", libnet_geterror(ctx->c));
     }
+    return 0;
 
-cleanup:
-    libnet_destroy (c);
+error:
+    RejectLibnetReset(ctx);
     return 0;
 }
 
@@ -294,10 +373,8 @@ int RejectSendLibnet11L3IPv6TCP(ThreadVars *tv, Packet *p, void *data, int dir)
 {
 
     Libnet11Packet lpacket;
-    libnet_t *c; /* libnet context */
-    char ebuf[LIBNET_ERRBUF_SIZE];
+    RejectLibnetCtx *ctx;
     int result;
-    const char *devname = NULL;
 
     /* fill in struct defaults */
     lpacket.ttl = 0;
@@ -305,17 +382,12 @@ int RejectSendLibnet11L3IPv6TCP(ThreadVars *tv, Packet *p, void *data, int dir)
     lpacket.flow = 0;
     lpacket.class = 0;
 
-    if (IS_SURI_HOST_MODE_SNIFFER_ONLY(host_mode) && (p->livedev)) {
-        devname = p->livedev->dev;
-    }
-    if ((c = libnet_init(LIBNET_RAW6, LIBNET_INIT_CAST devname, ebuf)) == NULL) {
-        SCLogError(SC_ERR_LIBNET_INIT,"libnet_init failed: %s", ebuf);
-        return 1;
-    }
-
     if (p->tcph == NULL)
        return 1;
 
+    if ((ctx = RejectLibnetGet(data, REJECT_LIBNET_TCP6, p)) == NULL)
+        return 1;
+
     /* save payload len */
     lpacket.dsize = p->payload_len;
 
@@ -365,8 +437,8 @@ int RejectSendLibnet11L3IPv6TCP(ThreadVars *tv, Packet *p, void *data, int dir)
     /* TODO come up with ttl calc function */
     lpacket.ttl = 64;
 
-    /* build the package */
-    if ((libnet_build_tcp(
+    /* build the package, or update the one of the last reject */
+    if ((ctx->l4 = libnet_build_tcp(
                     lpacket.sp,            /* source port */
                     lpacket.dp,            /* dst port */
                     lpacket.seq,           /* seq number */
@@ -378,14 +450,14 @@ int RejectSendLibnet11L3IPv6TCP(ThreadVars *tv, Packet *p, void *data, int dir)
                     LIBNET_TCP_H,          /* header length */
                     NULL,                  /* payload */
                     0,                     /* payload length */
-                    c,                     /* libnet context */
-                    0)) < 0)               /* libnet ptag */
+                    ctx->c,                /* libnet context */
+                    ctx->l4)) < 0)         /* libnet ptag */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_tcp %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_tcp %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    if ((libnet_build_ipv6(
+    if ((ctx->l3 = libnet_build_ipv6(
                     lpacket.class,                /* traffic class */
                     lpacket.flow,                 /* Flow label */
                     LIBNET_TCP_H,                 /* payload length */
@@ -395,21 +467,21 @@ int RejectSendLibnet11L3IPv6TCP(ThreadVars *tv, Packet *p, void *data, int dir)
                     lpacket.dst6,                 /* destination address */
                     NULL,                         /* pointer to packet data (or NULL) */
                     0,                            /* payload length */
-                    c,                            /* libnet context pointer */
-                    0)) < 0)                      /* packet id */
+                    ctx->c,                       /* libnet context pointer */
+                    ctx->l3)) < 0)                /* packet id */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv6 %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv6 %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    result = libnet_write(c);
+    result = libnet_write(ctx->c);
     if (result == -1) {
-        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write failed: %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write failed: %s", libnet_geterror(ctx->c));
     }
+    return 0;
 
-cleanup:
-    libnet_destroy (c);
+error:
+    RejectLibnetReset(ctx);
     return 0;
 }
 
@@ -417,10 +489,8 @@ cleanup:
 int RejectSendLibnet11L3IPv6ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
 {
     Libnet11Packet lpacket;
-    libnet_t *c; /* libnet context */
-    char ebuf[LIBNET_ERRBUF_SIZE];
+    RejectLibnetCtx *ctx;
     int result;
-    const char *devname = NULL;
 
     /* fill in struct defaults */
     lpacket.ttl = 0;
@@ -431,13 +501,8 @@ int RejectSendLibnet11L3IPv6ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
 
     lpacket.len = IPV6_GET_PLEN(p) + IPV6_HEADER_LEN;
 
-    if (IS_SURI_HOST_MODE_SNIFFER_ONLY(host_mode) && (p->livedev)) {
-        devname = p->livedev->dev;
-    }
-    if ((c = libnet_init(LIBNET_RAW6, LIBNET_INIT_CAST devname, ebuf)) == NULL) {
-        SCLogError(SC_ERR_LIBNET_INIT,"libnet_inint failed: %s", ebuf);
+    if ((ctx = RejectLibnetGet(data, REJECT_LIBNET_ICMP6, p)) == NULL)
         return 1;
-    }
 
     switch (dir) {
         case REJECT_DIR_SRC:
@@ -457,21 +522,21 @@ int RejectSendLibnet11L3IPv6ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
     /* TODO come up with ttl calc function */
     lpacket.ttl = 64;
 
-    /* build the package */
-    if ((libnet_build_icmpv6_unreach(
+    /* build the package, or update the one of the last reject */
+    if ((ctx->l4 = libnet_build_icmpv6_unreach(
                     ICMP6_DST_UNREACH,        /* type */
                     ICMP6_DST_UNREACH_ADMIN,  /* code */
                     0,                        /* checksum */
                     (uint8_t *)p->ip6h,       /* payload */
                     lpacket.len,              /* payload length */
-                    c,                        /* libnet context */
-                    0)) < 0)                  /* libnet ptag */
+                    ctx->c,                   /* libnet context */
+                    ctx->l4)) < 0)            /* libnet ptag */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_icmpv6_unreach %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_icmpv6_unreach %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    if ((libnet_build_ipv6(
+    if ((ctx->l3 = libnet_build_ipv6(
                     lpacket.class,                            /* traffic class */
                     lpacket.flow,                            /* Flow label */
                     LIBNET_ICMPV6_H + lpacket.len, /* IPv6 payload length */
@@ -481,21 +546,21 @@ int RejectSendLibnet11L3IPv6ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
                     lpacket.dst6,                 /* destination address */
                     NULL,                         /* pointer to packet data (or NULL) */
                     0,                            /* payload length */
-                    c,                            /* libnet context pointer */
-                    0)) < 0)                      /* packet id */
+                    ctx->c,                       /* libnet context pointer */
+                    ctx->l3)) < 0)                /* packet id */
     {
-        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv6 %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_BUILD_FAILED,"libnet_build_ipv6 %s", libnet_geterror(ctx->c));
+        goto error;
     }
 
-    result = libnet_write(c);
+    result = libnet_write(ctx->c);
     if (result == -1) {
-        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write_raw_ipv6 failed: %s", libnet_geterror(c));
-        goto cleanup;
+        SCLogError(SC_ERR_LIBNET_WRITE_FAILED,"libnet_write_raw_ipv6 failed: %s", libnet_geterror(ctx->c));
     }
+    return 0;
 
-cleanup:
-    libnet_destroy (c);
+error:
+    RejectLibnetReset(ctx);
     return 0;
 }
 #else /* HAVE_LIBNET_ICMPV6_UNREACH */
@@ -512,6 +577,16 @@ int RejectSendLibnet11L3IPv6ICMP(ThreadVars *tv, Packet *p, void *data, int dir)
 
 #else
 
+int RejectLibnet11ThreadInit(void **data)
+{
+    *data = NULL;
+    return 0;
+}
+
+void RejectLibnet11ThreadDeinit(void *data)
+{
+}
+
 int RejectSendLibnet11L3IPv4TCP(ThreadVars *tv, Packet *p, void *data, int dir)
 {
     SCLogError(SC_ERR_LIBNET_NOT_ENABLED, "Libnet based rejects are disabled."
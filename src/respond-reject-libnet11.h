@@ -25,6 +25,9 @@
 #ifndef __RESPOND_REJECT_LIBNET11_H__
 #define __RESPOND_REJECT_LIBNET11_H__
 
+int RejectLibnet11ThreadInit(void **data);
+void RejectLibnet11ThreadDeinit(void *data);
+
 int RejectSendLibnet11L3IPv4TCP(ThreadVars *, Packet *, void *,int);
 int RejectSendLibnet11L3IPv4ICMP(ThreadVars *, Packet *, void *,int);
 
@@ -46,12 +46,25 @@ int RejectSendIPv4ICMP(ThreadVars *, Packet *, void *);
 int RejectSendIPv6TCP(ThreadVars *, Packet *, void *);
 int RejectSendIPv6ICMP(ThreadVars *, Packet *, void *);
 
+static TmEcode RespondRejectThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    if (RejectLibnet11ThreadInit(data) != 0)
+        return TM_ECODE_FAILED;
+    return TM_ECODE_OK;
+}
+
+static TmEcode RespondRejectThreadDeinit(ThreadVars *tv, void *data)
+{
+    RejectLibnet11ThreadDeinit(data);
+    return TM_ECODE_OK;
+}
+
 void TmModuleRespondRejectRegister (void)
 {
     tmm_modules[TMM_RESPONDREJECT].name = "RespondReject";
-    tmm_modules[TMM_RESPONDREJECT].ThreadInit = NULL;
+    tmm_modules[TMM_RESPONDREJECT].ThreadInit = RespondRejectThreadInit;
     tmm_modules[TMM_RESPONDREJECT].Func = RespondRejectFunc;
-    tmm_modules[TMM_RESPONDREJECT].ThreadDeinit = NULL;
+    tmm_modules[TMM_RESPONDREJECT].ThreadDeinit = RespondRejectThreadDeinit;
     tmm_modules[TMM_RESPONDREJECT].RegisterTests = NULL;
     tmm_modules[TMM_RESPONDREJECT].cap_flags = 0; /* libnet is not compat with caps */
 }
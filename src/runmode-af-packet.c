@@ -53,6 +53,7 @@
 #include "util-device.h"
 #include "util-runmodes.h"
 #include "util-ioctl.h"
+#include "util-rss.h"
 
 #include "source-af-packet.h"
 
@@ -123,6 +124,7 @@ void *ParseAFPConfig(const char *iface)
     char *bpf_filter = NULL;
     char *out_iface = NULL;
     int cluster_type = PACKET_FANOUT_HASH;
+    int rss_setup = 0;
 
     if (iface == NULL) {
         return NULL;
@@ -148,6 +150,10 @@ void *ParseAFPConfig(const char *iface)
     aconf->out_iface = NULL;
     aconf->copy_mode = AFP_COPY_MODE_NONE;
     aconf->block_timeout = 10;
+    aconf->busy_poll = 0;
+    aconf->spin_budget = 0;
+    aconf->qdisc_bypass = 0;
+    aconf->tx_ring = 0;
     aconf->block_size = getpagesize() << AFP_BLOCK_SIZE_DEFAULT_ORDER;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
@@ -240,6 +246,15 @@ void *ParseAFPConfig(const char *iface)
             }
         }
 
+        if (aconf->flags & AFP_TPACKET_V3) {
+            if (ConfGetChildValueBoolWithDefault(if_root, if_default,
+                        "batch-mode", (int *)&boolval) == 1 && boolval) {
+                SCLogConfig("Enabling batch mode processing on iface %s",
+                        aconf->iface);
+                aconf->flags |= AFP_BATCH_MODE;
+            }
+        }
+
         (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
                                                "use-emergency-flush", (int *)&boolval);
         if (boolval) {
@@ -274,6 +289,31 @@ void *ParseAFPConfig(const char *iface)
         }
     }
 
+    if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+        boolval = 0;
+        (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                               "qdisc-bypass", (int *)&boolval);
+        if (boolval) {
+            SCLogConfig("Bypassing qdisc when sending on iface %s",
+                    aconf->out_iface);
+            aconf->qdisc_bypass = 1;
+        }
+
+        boolval = 0;
+        (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                               "tx-ring", (int *)&boolval);
+        if (boolval) {
+            if (aconf->flags & AFP_TPACKET_V3) {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "tx-ring is not supported "
+                        "with tpacket-v3, sending with send() on iface %s",
+                        aconf->out_iface);
+            } else {
+                SCLogConfig("Using TX ring to send on iface %s", aconf->out_iface);
+                aconf->tx_ring = 1;
+            }
+        }
+    }
+
     if (ConfGetChildValueWithDefault(if_root, if_default, "cluster-id", &tmpclusterid) != 1) {
         aconf->cluster_id = (uint16_t)(cluster_id_auto++);
     } else {
@@ -330,6 +370,13 @@ void *ParseAFPConfig(const char *iface)
         SCLogWarning(SC_ERR_INVALID_CLUSTER_TYPE,"invalid cluster-type %s",tmpctype);
     }
 
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "rss-setup", &rss_setup);
+    if (rss_setup && strcasecmp(RunmodeGetActive(), "workers") != 0) {
+        SCLogWarning(SC_ERR_RUNMODE, "rss-setup is only supported in the "
+                "'workers' runmode, ignoring it for %s", aconf->iface);
+        rss_setup = 0;
+    }
+
     int conf_val = 0;
     ConfGetChildValueBoolWithDefault(if_root, if_default, "rollover", &conf_val);
     if (conf_val) {
@@ -366,12 +413,52 @@ void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                           "coalesced-segments", (int *)&boolval);
+    if (boolval) {
+        if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "coalesced-segments is IDS "
+                    "only, not enabled in copy-mode on iface %s", aconf->iface);
+        } else if (!(aconf->flags & AFP_TPACKET_V3)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "coalesced-segments needs "
+                    "tpacket-v3, not enabled on iface %s", aconf->iface);
+        } else {
+            aconf->coalesced = 1;
+            aconf->coalesced_inspect = 1;
+            (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                    "coalesced-payload-inspection", &aconf->coalesced_inspect);
+            if (aconf->block_size < AFP_COALESCED_BLOCK_SIZE) {
+                aconf->block_size = AFP_COALESCED_BLOCK_SIZE;
+            }
+            SCLogConfig("Accepting GRO/LRO coalesced segments on iface %s "
+                    "(block size %d, payload inspection %s)", aconf->iface,
+                    aconf->block_size, aconf->coalesced_inspect ? "on" : "off");
+        }
+    }
+
     if ((ConfGetChildValueIntWithDefault(if_root, if_default, "block-timeout", &value)) == 1) {
         aconf->block_timeout = value;
     } else {
         aconf->block_timeout = 10;
     }
 
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "busy-poll", &value)) == 1) {
+        if (value < 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "busy-poll must be positive");
+        } else {
+            aconf->busy_poll = value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "poll-spin", &value)) == 1) {
+        if (value < 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "poll-spin must be positive");
+        } else {
+            aconf->spin_budget = value;
+        }
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogConfig("Disabling promiscuous mode on iface %s",
@@ -407,6 +494,17 @@ finalize:
         }
     }
 
+    /* set up the NIC for one queue per worker and use as many threads
+     * as queues it ended up with */
+    if (rss_setup) {
+        int queues = RSSSetupIface(iface, aconf->threads);
+        if (queues > 0) {
+            aconf->threads = queues;
+            SCLogPerf("%d RSS queues set up, so using %d threads", queues,
+                    aconf->threads);
+        }
+    }
+
     /* try to automagically set the proper number of threads */
     if (aconf->threads == 0) {
         /* for cluster_flow use core count */
@@ -452,8 +550,9 @@ finalize:
     int ltype = AFPGetLinkType(iface);
     switch (ltype) {
         case LINKTYPE_ETHERNET:
-            /* af-packet can handle csum offloading */
-            if (GetIfaceOffloading(iface, 0, 1) == 1) {
+            /* af-packet can handle csum offloading, and GRO/LRO if
+             * coalesced segments are accepted */
+            if (!aconf->coalesced && GetIfaceOffloading(iface, 0, 1) == 1) {
                 SCLogWarning(SC_ERR_AFP_CREATE,
                     "Using AF_PACKET with offloading activated leads to capture problems");
             }
@@ -0,0 +1,431 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP runmode
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-af-xdp.h"
+#include "output.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-ioctl.h"
+
+#include "source-af-xdp.h"
+
+static const char *default_mode_workers = NULL;
+
+const char *RunModeAFXDPGetDefaultMode(void)
+{
+    return default_mode_workers;
+}
+
+void RunModeIdsAFXDPRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_AF_XDP, "single",
+            "Single threaded AF_XDP mode",
+            RunModeIdsAFXDPSingle);
+    RunModeRegisterNewRunMode(RUNMODE_AF_XDP, "workers",
+            "Workers AF_XDP mode, each thread does all"
+                    " tasks from acquisition to logging",
+            RunModeIdsAFXDPWorkers);
+    default_mode_workers = "workers";
+    RunModeRegisterNewRunMode(RUNMODE_AF_XDP, "autofp",
+            "Multi threaded AF_XDP mode.  Packets from "
+                    "each flow are assigned to a single detect "
+                    "thread.",
+            RunModeIdsAFXDPAutoFp);
+    return;
+}
+
+#ifdef HAVE_AF_XDP
+
+static void AFXDPDerefConfig(void *conf)
+{
+    AFXDPIfaceConfig *xconf = (AFXDPIfaceConfig *)conf;
+    /* config is used only once but cost of this low. */
+    if (SC_ATOMIC_SUB(xconf->ref, 1) == 0) {
+        SCFree(xconf);
+    }
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * This is thus necessary to or copy the structure before giving it
+ * to thread or to reparse the file for each thread (and thus have
+ * new structure.
+ *
+ * \return a AFXDPIfaceConfig corresponding to the interface name
+ */
+static void *ParseAFXDPConfig(const char *iface)
+{
+    ConfNode *if_root = NULL;
+    ConfNode *if_default = NULL;
+    ConfNode *xdp_node;
+    char *tmpstr = NULL;
+    intmax_t value;
+    int boolval;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    AFXDPIfaceConfig *xconf = SCMalloc(sizeof(*xconf));
+    if (unlikely(xconf == NULL)) {
+        return NULL;
+    }
+    memset(xconf, 0, sizeof(*xconf));
+
+    strlcpy(xconf->iface, iface, sizeof(xconf->iface));
+    xconf->DerefFunc = AFXDPDerefConfig;
+    xconf->promisc = 1;
+    xconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    xconf->copy_mode = AF_XDP_COPY_MODE_NONE;
+    xconf->xdp_mode = AF_XDP_MODE_AUTO;
+    xconf->zero_copy = AF_XDP_ZC_AUTO;
+    xconf->frames = AF_XDP_DEFAULT_FRAMES;
+    xconf->batch = AF_XDP_DEFAULT_BATCH;
+    SC_ATOMIC_INIT(xconf->queue_next);
+    SC_ATOMIC_INIT(xconf->ref);
+
+    if (ConfGet("bpf-filter", &tmpstr) == 1) {
+        if (strlen(tmpstr) > 0) {
+            xconf->bpf_filter = tmpstr;
+            SCLogInfo("Going to use command-line provided bpf filter '%s'",
+                    xconf->bpf_filter);
+        }
+    }
+
+    /* Find initial node */
+    xdp_node = ConfGetNode("af-xdp");
+    if (xdp_node == NULL) {
+        SCLogInfo("Unable to find af-xdp config using default value");
+    } else {
+        if_root = ConfFindDeviceConfig(xdp_node, iface);
+        if_default = ConfFindDeviceConfig(xdp_node, "default");
+    }
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("Unable to find af-xdp config for "
+                "interface \"%s\" or \"default\", using default values",
+                iface);
+        goto finalize;
+
+    /* If there is no setting for current interface use default one as main iface */
+    } else if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") != 0) {
+            xconf->threads = atoi(tmpstr);
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "queue-start", &value) == 1) {
+        if (value < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid queue-start for %s", iface);
+        } else {
+            xconf->queue_start = (int)value;
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "frames", &value) == 1) {
+        /* the fill ring is sized to the number of frames and needs to
+         * be a power of 2 */
+        if (value < 64 || (value & (value - 1)) != 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid frames value for %s, "
+                    "needs to be a power of 2 of at least 64", iface);
+        } else {
+            xconf->frames = (uint32_t)value;
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value) == 1) {
+        if (value <= 0 || value > 1024) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid batch-size for %s", iface);
+        } else {
+            xconf->batch = (uint32_t)value;
+        }
+    }
+
+    /* command line value has precedence */
+    if (xconf->bpf_filter == NULL) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "bpf-filter", &tmpstr) == 1) {
+            if (strlen(tmpstr) > 0) {
+                xconf->bpf_filter = tmpstr;
+                SCLogInfo("Going to use bpf filter %s", xconf->bpf_filter);
+            }
+        }
+    }
+
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", &boolval);
+    if (boolval) {
+        SCLogInfo("Disabling promiscuous mode on iface %s", iface);
+        xconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") == 0) {
+            xconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpstr)) {
+            xconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpstr)) {
+            xconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value for "
+                    "checksum-checks for %s", iface);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") == 0) {
+            xconf->xdp_mode = AF_XDP_MODE_AUTO;
+        } else if (strcmp(tmpstr, "driver") == 0) {
+            xconf->xdp_mode = AF_XDP_MODE_DRV;
+        } else if (strcmp(tmpstr, "skb") == 0) {
+            xconf->xdp_mode = AF_XDP_MODE_SKB;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid xdp-mode "
+                    "(valid are auto, driver, skb)");
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "zero-copy", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") == 0) {
+            xconf->zero_copy = AF_XDP_ZC_AUTO;
+        } else if (ConfValIsTrue(tmpstr)) {
+            xconf->zero_copy = AF_XDP_ZC_ON;
+        } else if (ConfValIsFalse(tmpstr)) {
+            xconf->zero_copy = AF_XDP_ZC_OFF;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid zero-copy value "
+                    "(valid are auto, yes, no)");
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "ips") == 0) {
+            xconf->copy_mode = AF_XDP_COPY_MODE_IPS;
+        } else if (strcmp(tmpstr, "tap") == 0) {
+            xconf->copy_mode = AF_XDP_COPY_MODE_TAP;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid copy-mode "
+                    "(valid are tap, ips)");
+        }
+    }
+
+    if (xconf->copy_mode != AF_XDP_COPY_MODE_NONE) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-iface", &tmpstr) != 1 ||
+            strlen(tmpstr) == 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "copy-mode for %s needs a copy-iface, "
+                    "disabling copy mode", iface);
+            xconf->copy_mode = AF_XDP_COPY_MODE_NONE;
+        } else {
+            strlcpy(xconf->out_iface, tmpstr, sizeof(xconf->out_iface));
+        }
+    }
+
+finalize:
+    if (xconf->threads == 0) {
+        xconf->threads = GetIfaceRSSQueuesNum(iface);
+    }
+    if (xconf->threads <= 0) {
+        xconf->threads = 1;
+    }
+
+    SC_ATOMIC_RESET(xconf->ref);
+    (void) SC_ATOMIC_ADD(xconf->ref, xconf->threads);
+    SCLogPerf("Using %d threads for interface %s", xconf->threads, iface);
+
+    return xconf;
+}
+
+static int AFXDPConfigGetThreadsCount(void *conf)
+{
+    AFXDPIfaceConfig *xconf = (AFXDPIfaceConfig *)conf;
+    return xconf->threads;
+}
+
+int AFXDPRunModeIsIPS(void)
+{
+    int nlive = LiveGetDeviceCount();
+    int ldev;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *xdp_node;
+    int has_ips = 0;
+    int has_ids = 0;
+
+    /* Find initial node */
+    xdp_node = ConfGetNode("af-xdp");
+    if (xdp_node == NULL) {
+        return 0;
+    }
+
+    if_default = ConfNodeLookupKeyValue(xdp_node, "interface", "default");
+
+    for (ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+            return 0;
+        }
+        char *copymodestr = NULL;
+        if_root = ConfNodeLookupKeyValue(xdp_node, "interface", live_dev);
+
+        if (if_root == NULL) {
+            if (if_default == NULL) {
+                SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                return 0;
+            }
+            if_root = if_default;
+        }
+
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1 &&
+            strcmp(copymodestr, "ips") == 0) {
+            has_ips = 1;
+        } else {
+            has_ids = 1;
+        }
+    }
+
+    if (has_ids && has_ips) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "AF_XDP IPS mode used and "
+                "some interfaces are in IDS or TAP mode. Expect bad "
+                "results on those as stream-inline is activated.");
+    }
+
+    return has_ips;
+}
+
+#endif /* HAVE_AF_XDP */
+
+int RunModeIdsAFXDPAutoFp(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureAutoFp(
+                              ParseAFXDPConfig,
+                              AFXDPConfigGetThreadsCount,
+                              "ReceiveAFXDP",
+                              "DecodeAFXDP", thread_name_autofp,
+                              live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPAutoFp initialised");
+#endif /* HAVE_AF_XDP */
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureSingle(
+                                    ParseAFXDPConfig,
+                                    AFXDPConfigGetThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_single,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPSingle initialised");
+#endif /* HAVE_AF_XDP */
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureWorkers(
+                                    ParseAFXDPConfig,
+                                    AFXDPConfigGetThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_workers,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPWorkers initialised");
+#endif /* HAVE_AF_XDP */
+
+    SCReturnInt(0);
+}
@@ -0,0 +1,92 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ *
+ *  Run or list the micro benchmarks
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "runmode-benchmarks.h"
+#include "util-bench.h"
+#include "util-debug.h"
+
+#ifdef BENCHMARKS
+
+#include "decode.h"
+#include "flow-hash.h"
+#include "util-mpm.h"
+#include "util-spm.h"
+#include "util-streaming-buffer.h"
+#include "util-hash-fast.h"
+#include "util-hash-map.h"
+#include "util-time.h"
+#include "util-storage.h"
+
+#ifdef BUILD_HYPERSCAN
+#include "util-mpm-hs.h"
+#endif
+
+#endif /* BENCHMARKS */
+
+/**
+ * Run or list benchmarks
+ *
+ * \param list_benchmarks If set to 1, list benchmarks. Run them if set to 0.
+ * \param regex_arg A regular expression to select benchmarks to run
+ *
+ * This function is terminal and will call exit after being called.
+ */
+void RunBenchmarks(int list_benchmarks, const char *regex_arg)
+{
+#ifdef BENCHMARKS
+    GlobalInits();
+    TimeInit();
+    default_packet_size = DEFAULT_PACKET_SIZE;
+
+    MpmTableSetup();
+    SpmTableSetup();
+    StorageInit();
+    StorageFinalize();
+
+    MpmRegisterBenchmarks();
+    SpmRegisterBenchmarks();
+    FlowHashRegisterBenchmarks();
+    HashFastRegisterBenchmarks();
+    HashMapRegisterBenchmarks();
+    DecodeRegisterBenchmarks();
+    StreamingBufferRegisterBenchmarks();
+
+    uint32_t failed = 0;
+    if (list_benchmarks) {
+        BenchList(regex_arg);
+    } else {
+        failed = BenchRun(regex_arg);
+    }
+    BenchCleanup();
+#ifdef BUILD_HYPERSCAN
+    MpmHSGlobalCleanup();
+#endif
+
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+#else
+    SCLogError(SC_ERR_NOT_SUPPORTED, "Benchmarks are not build-in");
+    exit(EXIT_FAILURE);
+#endif /* BENCHMARKS */
+}
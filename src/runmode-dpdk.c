@@ -0,0 +1,686 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DPDK runmode
+ *
+ * The EAL and all ports are set up from the main thread before the
+ * receive threads are started: a thread writing to a copy-iface needs
+ * that port to be running already.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-dpdk.h"
+#include "output.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-conf.h"
+
+#include "source-dpdk.h"
+
+#ifdef HAVE_DPDK
+#include <rte_eal.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#endif /* HAVE_DPDK */
+
+static const char *default_mode_workers = NULL;
+
+const char *RunModeDPDKGetDefaultMode(void)
+{
+    return default_mode_workers;
+}
+
+void RunModeIdsDPDKRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_DPDK, "single",
+            "Single threaded DPDK mode",
+            RunModeIdsDPDKSingle);
+    RunModeRegisterNewRunMode(RUNMODE_DPDK, "workers",
+            "Workers DPDK mode, each thread does all"
+                    " tasks from acquisition to logging",
+            RunModeIdsDPDKWorkers);
+    default_mode_workers = "workers";
+    RunModeRegisterNewRunMode(RUNMODE_DPDK, "autofp",
+            "Multi threaded DPDK mode.  Packets from "
+                    "each flow are assigned to a single detect "
+                    "thread.",
+            RunModeIdsDPDKAutoFp);
+    return;
+}
+
+#ifdef HAVE_DPDK
+
+#ifndef RTE_ETH_MQ_RX_RSS
+#define RTE_ETH_MQ_RX_RSS   ETH_MQ_RX_RSS
+#define RTE_ETH_MQ_RX_NONE  ETH_MQ_RX_NONE
+#define RTE_ETH_RSS_IP      ETH_RSS_IP
+#define RTE_ETH_RSS_TCP     ETH_RSS_TCP
+#define RTE_ETH_RSS_UDP     ETH_RSS_UDP
+#define RTE_ETH_RSS_SCTP    ETH_RSS_SCTP
+#endif
+
+#define DPDK_EAL_MAX_ARGS   64
+
+extern intmax_t max_pending_packets;
+
+static int dpdk_eal_ready = 0;
+
+static void DPDKDerefConfig(void *conf)
+{
+    DPDKIfaceConfig *dconf = (DPDKIfaceConfig *)conf;
+    /* config is used only once but cost of this low. */
+    if (SC_ATOMIC_SUB(dconf->ref, 1) == 0) {
+        SCFree(dconf);
+    }
+}
+
+static int DPDKEalAddArg(char **argv, int *argc, const char *name, const char *val)
+{
+    char arg[256];
+
+    if (*argc >= DPDK_EAL_MAX_ARGS - 1) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "too many dpdk.eal-params");
+        return -1;
+    }
+    if (val == NULL || strlen(val) == 0 || ConfValIsTrue(val)) {
+        snprintf(arg, sizeof(arg), "--%s", name);
+    } else {
+        snprintf(arg, sizeof(arg), "--%s=%s", name, val);
+    }
+    argv[*argc] = SCStrdup(arg);
+    if (argv[*argc] == NULL)
+        return -1;
+    (*argc)++;
+    return 0;
+}
+
+/**
+ * \brief Initialize the EAL from the dpdk.eal-params map.
+ *
+ * Each entry is passed as --name=value. A list value is passed as
+ * a repeated option, e.g. several 'allow' PCI addresses.
+ */
+static int DPDKEalInit(void)
+{
+    char *argv[DPDK_EAL_MAX_ARGS];
+    int argc = 0;
+    int r = -1;
+
+    if (dpdk_eal_ready)
+        return 0;
+
+    memset(argv, 0, sizeof(argv));
+    argv[argc++] = SCStrdup("suricata");
+    if (argv[0] == NULL)
+        return -1;
+
+    ConfNode *params = ConfGetNode("dpdk.eal-params");
+    if (params != NULL) {
+        ConfNode *param;
+        TAILQ_FOREACH(param, &params->head, next) {
+            if (TAILQ_EMPTY(&param->head)) {
+                if (DPDKEalAddArg(argv, &argc, param->name, param->val) != 0)
+                    goto end;
+            } else {
+                ConfNode *item;
+                TAILQ_FOREACH(item, &param->head, next) {
+                    if (DPDKEalAddArg(argv, &argc, param->name, item->val) != 0)
+                        goto end;
+                }
+            }
+        }
+    }
+
+    /* rte_eal_init reorders the argv array */
+    char *eal_argv[DPDK_EAL_MAX_ARGS];
+    memcpy(eal_argv, argv, sizeof(eal_argv));
+    if (rte_eal_init(argc, eal_argv) < 0) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "EAL initialization failed: %s",
+                   rte_strerror(rte_errno));
+        goto end;
+    }
+    dpdk_eal_ready = 1;
+    r = 0;
+end:
+    for (int i = 0; i < argc; i++) {
+        SCFree(argv[i]);
+    }
+    return r;
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * This is thus necessary to or copy the structure before giving it
+ * to thread or to reparse the file for each thread (and thus have
+ * new structure.
+ *
+ * \return a DPDKIfaceConfig corresponding to the interface name
+ */
+static void *ParseDPDKConfig(const char *iface)
+{
+    ConfNode *if_root = NULL;
+    ConfNode *if_default = NULL;
+    ConfNode *dpdk_node;
+    char *tmpstr = NULL;
+    intmax_t value;
+    int boolval;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    DPDKIfaceConfig *dconf = SCCalloc(1, sizeof(*dconf));
+    if (unlikely(dconf == NULL)) {
+        return NULL;
+    }
+
+    strlcpy(dconf->iface, iface, sizeof(dconf->iface));
+    dconf->DerefFunc = DPDKDerefConfig;
+    dconf->promisc = 1;
+    dconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    dconf->copy_mode = DPDK_COPY_MODE_NONE;
+    dconf->burst = DPDK_DEFAULT_BURST;
+    dconf->rx_desc = DPDK_DEFAULT_RX_DESC;
+    dconf->tx_desc = DPDK_DEFAULT_TX_DESC;
+    dconf->mempool_size = DPDK_DEFAULT_MEMPOOL_SIZE;
+    dconf->mempool_cache = DPDK_DEFAULT_MEMPOOL_CACHE;
+    SC_ATOMIC_INIT(dconf->queue_next);
+    SC_ATOMIC_INIT(dconf->ref);
+
+    if (rte_eth_dev_get_port_by_name(iface, &dconf->port_id) != 0) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s is not a DPDK port, check the "
+                   "EAL allow list and the driver binding", iface);
+        SCFree(dconf);
+        return NULL;
+    }
+
+    if (ConfGet("bpf-filter", &tmpstr) == 1) {
+        if (strlen(tmpstr) > 0) {
+            dconf->bpf_filter = tmpstr;
+            SCLogConfig("Going to use command-line provided bpf filter '%s'",
+                       dconf->bpf_filter);
+        }
+    }
+
+    /* Find initial node */
+    dpdk_node = ConfGetNode("dpdk.interfaces");
+    if (dpdk_node == NULL) {
+        SCLogInfo("unable to find dpdk config using default values");
+        goto finalize;
+    }
+
+    if_root = ConfFindDeviceConfig(dpdk_node, iface);
+    if_default = ConfFindDeviceConfig(dpdk_node, "default");
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("unable to find dpdk config for "
+                  "interface \"%s\" or \"default\", using default values",
+                  iface);
+        goto finalize;
+    }
+
+    /* If there is no setting for current interface use default one as main iface */
+    if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") != 0) {
+            dconf->threads = atoi(tmpstr);
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "burst-size", &value) == 1) {
+        if (value <= 0 || value > DPDK_MAX_BURST) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid burst-size for %s, "
+                    "using default", iface);
+        } else {
+            dconf->burst = (uint16_t)value;
+        }
+    }
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "rx-descriptors", &value) == 1) {
+        if (value <= 0 || value > UINT16_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid rx-descriptors for %s", iface);
+        } else {
+            dconf->rx_desc = (uint16_t)value;
+        }
+    }
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "tx-descriptors", &value) == 1) {
+        if (value <= 0 || value > UINT16_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid tx-descriptors for %s", iface);
+        } else {
+            dconf->tx_desc = (uint16_t)value;
+        }
+    }
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "mempool-size", &value) == 1) {
+        if (value <= 0 || value > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid mempool-size for %s", iface);
+        } else {
+            dconf->mempool_size = (uint32_t)value;
+        }
+    }
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "mempool-cache-size", &value) == 1) {
+        if (value < 0 || value > RTE_MEMPOOL_CACHE_MAX_SIZE) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid mempool-cache-size for %s", iface);
+        } else {
+            dconf->mempool_cache = (uint32_t)value;
+        }
+    }
+
+    /* command line value has precedence */
+    if (dconf->bpf_filter == NULL) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "bpf-filter", &tmpstr) == 1) {
+            if (strlen(tmpstr) > 0) {
+                dconf->bpf_filter = tmpstr;
+                SCLogConfig("Going to use bpf filter %s", dconf->bpf_filter);
+            }
+        }
+    }
+
+    boolval = 1;
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "promisc", &boolval) == 1 &&
+        !boolval) {
+        SCLogConfig("Disabling promiscuous mode on port %s", iface);
+        dconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "auto") == 0) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpstr)) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpstr)) {
+            dconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value for "
+                    "checksum-checks for %s", iface);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &tmpstr) == 1) {
+        if (strcmp(tmpstr, "ips") == 0) {
+            dconf->copy_mode = DPDK_COPY_MODE_IPS;
+        } else if (strcmp(tmpstr, "tap") == 0) {
+            dconf->copy_mode = DPDK_COPY_MODE_TAP;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid copy-mode "
+                    "(valid are tap, ips)");
+        }
+    }
+
+    if (dconf->copy_mode != DPDK_COPY_MODE_NONE) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-iface", &tmpstr) != 1 ||
+            strlen(tmpstr) == 0) {
+            SCLogError(SC_ERR_DPDK_CONFIG, "copy-mode for %s needs a copy-iface, "
+                    "disabling copy mode", iface);
+            dconf->copy_mode = DPDK_COPY_MODE_NONE;
+        } else if (LiveGetDevice(tmpstr) == NULL ||
+                   rte_eth_dev_get_port_by_name(tmpstr, &dconf->out_port_id) != 0) {
+            /* the copy-iface threads set up the tx queues we write to */
+            SCLogError(SC_ERR_DPDK_CONFIG, "copy-iface %s of %s needs to be a "
+                    "DPDK capture interface too, disabling copy mode", tmpstr, iface);
+            dconf->copy_mode = DPDK_COPY_MODE_NONE;
+        } else {
+            strlcpy(dconf->out_iface, tmpstr, sizeof(dconf->out_iface));
+        }
+    }
+
+finalize:
+    if (dconf->threads <= 0) {
+        struct rte_eth_dev_info info;
+        memset(&info, 0, sizeof(info));
+        dconf->threads = UtilCpuGetNumProcessorsOnline();
+        if (rte_eth_dev_info_get(dconf->port_id, &info) == 0 &&
+            info.max_rx_queues < dconf->threads) {
+            dconf->threads = info.max_rx_queues;
+        }
+        if (dconf->threads <= 0)
+            dconf->threads = 1;
+    }
+
+    SC_ATOMIC_RESET(dconf->ref);
+    (void) SC_ATOMIC_ADD(dconf->ref, dconf->threads);
+    SCLogPerf("Using %d threads for interface %s", dconf->threads, iface);
+
+    return dconf;
+}
+
+static int DPDKConfigGetThreadsCount(void *conf)
+{
+    DPDKIfaceConfig *dconf = (DPDKIfaceConfig *)conf;
+    return dconf->threads;
+}
+
+/**
+ * \brief Set up the mempool and the queues of a port and start it.
+ *
+ * Each thread gets a rx queue and a tx queue of its own. In ips
+ * and tap mode the threads of the copy-iface write to the tx queues
+ * of this port, so both interfaces need the same number of threads.
+ */
+static int DPDKPortSetup(DPDKIfaceConfig *dconf)
+{
+    struct rte_eth_dev_info info;
+    struct rte_eth_conf conf;
+    uint16_t nb_rxd = dconf->rx_desc;
+    uint16_t nb_txd = dconf->tx_desc;
+    uint16_t q;
+    int r;
+
+    memset(&info, 0, sizeof(info));
+    r = rte_eth_dev_info_get(dconf->port_id, &info);
+    if (r != 0) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s: unable to get device info: %s",
+                   dconf->iface, rte_strerror(-r));
+        return -1;
+    }
+    if (dconf->threads > info.max_rx_queues || dconf->threads > info.max_tx_queues) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s: %d threads but the port supports %u "
+                   "rx and %u tx queues", dconf->iface, dconf->threads,
+                   info.max_rx_queues, info.max_tx_queues);
+        return -1;
+    }
+
+    /* one mempool per port, on the numa node of the NIC. It needs to
+     * cover the descriptor rings and the packets the engine holds. */
+    uint32_t min_mbufs = dconf->threads * (nb_rxd + nb_txd + dconf->burst) +
+                         (uint32_t)max_pending_packets;
+    if (dconf->mempool_size < min_mbufs) {
+        SCLogWarning(SC_ERR_DPDK_CONFIG, "%s: mempool-size %u too small, "
+                     "using %u", dconf->iface, dconf->mempool_size, min_mbufs);
+        dconf->mempool_size = min_mbufs;
+    }
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    snprintf(pool_name, sizeof(pool_name), "suri-mp-%u", dconf->port_id);
+    int socket_id = rte_eth_dev_socket_id(dconf->port_id);
+    if (socket_id < 0)
+        socket_id = SOCKET_ID_ANY;
+    struct rte_mempool *mp = rte_pktmbuf_pool_create(pool_name,
+            dconf->mempool_size, dconf->mempool_cache, 0,
+            RTE_MBUF_DEFAULT_BUF_SIZE, socket_id);
+    if (mp == NULL) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s: unable to create mempool of %u "
+                   "mbufs: %s", dconf->iface, dconf->mempool_size,
+                   rte_strerror(rte_errno));
+        return -1;
+    }
+
+    memset(&conf, 0, sizeof(conf));
+    if (dconf->threads > 1) {
+        /* symmetric key: both directions of a flow hash to the same queue */
+        static uint8_t rss_key[128];
+        for (uint32_t i = 0; i < sizeof(rss_key); i += 2) {
+            rss_key[i] = 0x6d;
+            rss_key[i + 1] = 0x5a;
+        }
+        conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+        conf.rx_adv_conf.rss_conf.rss_key_len =
+            info.hash_key_size ? info.hash_key_size : 40;
+        conf.rx_adv_conf.rss_conf.rss_hf = (RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP |
+                RTE_ETH_RSS_UDP | RTE_ETH_RSS_SCTP) & info.flow_type_rss_offloads;
+    } else {
+        conf.rxmode.mq_mode = RTE_ETH_MQ_RX_NONE;
+    }
+
+    r = rte_eth_dev_configure(dconf->port_id, dconf->threads, dconf->threads, &conf);
+    if (r != 0) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s: unable to configure port: %s",
+                   dconf->iface, rte_strerror(-r));
+        return -1;
+    }
+    (void)rte_eth_dev_adjust_nb_rx_tx_desc(dconf->port_id, &nb_rxd, &nb_txd);
+
+    for (q = 0; q < dconf->threads; q++) {
+        r = rte_eth_rx_queue_setup(dconf->port_id, q, nb_rxd, socket_id, NULL, mp);
+        if (r != 0) {
+            SCLogError(SC_ERR_DPDK_CONFIG, "%s: rx queue %u setup failed: %s",
+                       dconf->iface, q, rte_strerror(-r));
+            return -1;
+        }
+        r = rte_eth_tx_queue_setup(dconf->port_id, q, nb_txd, socket_id, NULL);
+        if (r != 0) {
+            SCLogError(SC_ERR_DPDK_CONFIG, "%s: tx queue %u setup failed: %s",
+                       dconf->iface, q, rte_strerror(-r));
+            return -1;
+        }
+    }
+
+    if (dconf->promisc) {
+        (void)rte_eth_promiscuous_enable(dconf->port_id);
+    }
+
+    r = rte_eth_dev_start(dconf->port_id);
+    if (r != 0) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "%s: unable to start port: %s",
+                   dconf->iface, rte_strerror(-r));
+        return -1;
+    }
+
+    SCLogPerf("%s: port %u started with %d queues, %u/%u descriptors",
+              dconf->iface, dconf->port_id, dconf->threads, nb_rxd, nb_txd);
+    return 0;
+}
+
+/**
+ * \brief Init the EAL, then set up and start all configured ports.
+ */
+static int DPDKPortsInit(void)
+{
+    int nlive = LiveGetDeviceCount();
+
+    if (DPDKEalInit() != 0)
+        return -1;
+
+    for (int ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL)
+            return -1;
+
+        DPDKIfaceConfig *dconf = ParseDPDKConfig(live_dev);
+        if (dconf == NULL)
+            return -1;
+
+        int r = DPDKPortSetup(dconf);
+        if (r == 0 && dconf->copy_mode != DPDK_COPY_MODE_NONE) {
+            DPDKIfaceConfig *oconf = ParseDPDKConfig(dconf->out_iface);
+            if (oconf == NULL || oconf->threads != dconf->threads) {
+                SCLogError(SC_ERR_DPDK_CONFIG, "%s and its copy-iface %s need "
+                           "the same number of threads", dconf->iface,
+                           dconf->out_iface);
+                r = -1;
+            }
+            if (oconf != NULL)
+                SCFree(oconf);
+        }
+        SCFree(dconf);
+        if (r != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int DPDKRunModeIsIPS(void)
+{
+    ConfNode *dpdk_node = ConfGetNode("dpdk.interfaces");
+    ConfNode *if_default = NULL;
+    int nlive = LiveGetDeviceCount();
+    int has_ips = 0;
+    int has_ids = 0;
+
+    if (dpdk_node == NULL) {
+        return 0;
+    }
+
+    if_default = ConfFindDeviceConfig(dpdk_node, "default");
+
+    for (int ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+            return 0;
+        }
+        char *copymodestr = NULL;
+        ConfNode *if_root = ConfFindDeviceConfig(dpdk_node, live_dev);
+
+        if (if_root == NULL) {
+            if (if_default == NULL) {
+                SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                return 0;
+            }
+            if_root = if_default;
+        }
+
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1 &&
+            strcmp(copymodestr, "ips") == 0) {
+            has_ips = 1;
+        } else {
+            has_ids = 1;
+        }
+    }
+
+    if (has_ids && has_ips) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "DPDK IPS mode used and "
+                "some interfaces are in IDS or TAP mode. Expect bad "
+                "results on those as stream-inline is activated.");
+    }
+
+    return has_ips;
+}
+
+#endif /* HAVE_DPDK */
+
+int RunModeIdsDPDKAutoFp(void)
+{
+    SCEnter();
+
+#ifdef HAVE_DPDK
+    int ret;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    if (DPDKPortsInit() != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to set up DPDK ports");
+        exit(EXIT_FAILURE);
+    }
+
+    ret = RunModeSetLiveCaptureAutoFp(
+                              ParseDPDKConfig,
+                              DPDKConfigGetThreadsCount,
+                              "ReceiveDPDK",
+                              "DecodeDPDK", thread_name_autofp,
+                              NULL);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsDPDKAutoFp initialised");
+#endif /* HAVE_DPDK */
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Single thread version of the DPDK processing.
+ */
+int RunModeIdsDPDKSingle(void)
+{
+    SCEnter();
+
+#ifdef HAVE_DPDK
+    int ret;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    if (DPDKPortsInit() != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to set up DPDK ports");
+        exit(EXIT_FAILURE);
+    }
+
+    ret = RunModeSetLiveCaptureSingle(
+                                    ParseDPDKConfig,
+                                    DPDKConfigGetThreadsCount,
+                                    "ReceiveDPDK",
+                                    "DecodeDPDK", thread_name_single,
+                                    NULL);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsDPDKSingle initialised");
+#endif /* HAVE_DPDK */
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the DPDK processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsDPDKWorkers(void)
+{
+    SCEnter();
+
+#ifdef HAVE_DPDK
+    int ret;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    if (DPDKPortsInit() != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to set up DPDK ports");
+        exit(EXIT_FAILURE);
+    }
+
+    ret = RunModeSetLiveCaptureWorkers(
+                                    ParseDPDKConfig,
+                                    DPDKConfigGetThreadsCount,
+                                    "ReceiveDPDK",
+                                    "DecodeDPDK", thread_name_workers,
+                                    NULL);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsDPDKWorkers initialised");
+#endif /* HAVE_DPDK */
+
+    SCReturnInt(0);
+}
@@ -160,6 +160,13 @@ static int ParseNetmapSettings(NetmapIfaceSettings *ns, const char *iface,
         ns->promisc = 0;
     }
 
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "busy-poll", (int *)&boolval);
+    if (boolval) {
+        SCLogConfig("Busy polling iface %s", ns->iface);
+        ns->busy_poll = 1;
+    }
+
     char *tmpctype;
     if (ConfGetChildValueWithDefault(if_root, if_default,
                 "checksum-checks", &tmpctype) == 1)
@@ -192,13 +199,16 @@ static int ParseNetmapSettings(NetmapIfaceSettings *ns, const char *iface,
 
 finalize:
 
-    if (ns->sw_ring) {
-        /* just one thread per interface supported */
+    if (ns->sw_ring || strpbrk(ns->iface, "{}") != NULL) {
+        /* just one thread per interface supported, a pipe end is
+         * registered as a whole */
         ns->threads = 1;
     } else if (ns->threads == 0) {
         /* As NetmapGetRSSCount is broken on Linux, first run
-         * GetIfaceRSSQueuesNum. If that fails, run NetmapGetRSSCount */
-        ns->threads = GetIfaceRSSQueuesNum(ns->iface);
+         * GetIfaceRSSQueuesNum. If that fails, run NetmapGetRSSCount.
+         * VALE ports and pipes are not kernel interfaces. */
+        if (!NetmapIsVirtualPort(ns->iface))
+            ns->threads = GetIfaceRSSQueuesNum(ns->iface);
         if (ns->threads == 0) {
             ns->threads = NetmapGetRSSCount(ns->iface);
         }
@@ -24,6 +24,7 @@
 
 #include "detect-engine.h"
 #include "source-pcap-file.h"
+#include "runmode-unix-socket.h"
 
 #include "util-debug.h"
 #include "util-time.h"
@@ -68,6 +69,9 @@ int RunModeFilePcapSingle(void)
         SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
         exit(EXIT_FAILURE);
     }
+    /* the unix socket job's copy of the name, so the reader finds its id */
+    if (UnixSocketPcapFileJobCount() > 0)
+        file = (char *)UnixSocketPcapFileJobFilename(0);
 
     RunModeInitialize();
     TimeModeSetOffline();
@@ -154,6 +158,7 @@ int RunModeFilePcapAutoFp(void)
     uint16_t cpu = 0;
     char *queues = NULL;
     int thread;
+    TmModule *tm_module = NULL;
 
     RunModeInitialize();
 
@@ -189,40 +194,57 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
-    snprintf(tname, sizeof(tname), "%s#01", thread_name_autofp);
+    /* with parallel decode the reader only reads and the workers decode,
+     * the reader picks the worker from the raw packet */
+    int parallel_decode = 0;
+    if (ConfGetBool("pcap-file.parallel-decode", &parallel_decode) == 1 &&
+            parallel_decode) {
+        SCLogInfo("pcap-file: decoding in the worker threads");
+    }
 
-    /* create the threads */
-    ThreadVars *tv_receivepcap =
-        TmThreadCreatePacketHandler(tname,
-                                    "packetpool", "packetpool",
-                                    queues, "flow",
-                                    "pktacqloop");
-    SCFree(queues);
+    /* in unix socket mode a run may read several jobs concurrently, one
+     * reader thread per job feeding the same workers */
+    int njobs = UnixSocketPcapFileJobCount();
+    int job;
+    for (job = 0; job < MAX(njobs, 1); job++) {
+        char *rfile = njobs > 0 ? (char *)UnixSocketPcapFileJobFilename(job) : file;
 
-    if (tv_receivepcap == NULL) {
-        SCLogError(SC_ERR_FATAL, "threading setup failed");
-        exit(EXIT_FAILURE);
-    }
-    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, job + 1);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        /* create the threads */
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(tname,
+                                        "packetpool", "packetpool",
+                                        queues, "flow",
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, rfile);
+
+        if (!parallel_decode) {
+            tm_module = TmModuleGetByName("DecodePcapFile");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        }
 
-    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
 
-    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
-        SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
-        exit(EXIT_FAILURE);
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
     }
+    SCFree(queues);
 
     for (thread = 0; thread < thread_max; thread++) {
         snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
@@ -241,6 +263,15 @@ int RunModeFilePcapAutoFp(void)
             exit(EXIT_FAILURE);
         }
 
+        if (parallel_decode) {
+            tm_module = TmModuleGetByName("DecodePcapFile");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+        }
+
         tm_module = TmModuleGetByName("FlowWorker");
         if (tm_module == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
@@ -262,6 +262,34 @@ void *ParsePfringConfig(const char *iface)
     SC_ATOMIC_RESET(pfconf->ref);
     (void) SC_ATOMIC_ADD(pfconf->ref, pfconf->threads);
 
+    int boolval = 0;
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "zc", &boolval) == 1 &&
+            boolval) {
+#ifdef HAVE_PFRING_ZC
+        intmax_t val = 0;
+        pfconf->flags |= PFRING_CONF_FLAGS_ZC;
+        pfconf->zc_burst = PFRING_ZC_BURST_DEFAULT;
+        if (ConfGetChildValueIntWithDefault(if_root, if_default, "zc-burst", &val) == 1) {
+            if (val <= 0 || val > PFRING_ZC_BURST_MAX) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid zc-burst %"PRIdMAX
+                        " for %s, using %d", val, pfconf->iface,
+                        PFRING_ZC_BURST_DEFAULT);
+            } else {
+                pfconf->zc_burst = (int)val;
+            }
+        }
+        if (ConfGetChildValueIntWithDefault(if_root, if_default, "zc-buffers", &val) == 1 &&
+                val > 0) {
+            pfconf->zc_buffers = (int)val;
+        }
+        SCLogInfo("Using PF_RING ZC for %s, burst %d", pfconf->iface,
+                pfconf->zc_burst);
+#else
+        SCLogError(SC_ERR_NO_PF_RING, "PF_RING ZC support not compiled in, "
+                "ignoring zc setting for %s", pfconf->iface);
+#endif
+    }
+
     /* command line value has precedence */
     if (ConfGet("pfring.cluster-id", &tmpclusterid) == 1) {
         pfconf->cluster_id = (uint16_t)atoi(tmpclusterid);
@@ -270,7 +298,8 @@ void *ParsePfringConfig(const char *iface)
                    pfconf->cluster_id);
     } else {
 
-        if (strncmp(pfconf->iface, "zc", 2) == 0) {
+        if (strncmp(pfconf->iface, "zc", 2) == 0 &&
+                !(pfconf->flags & PFRING_CONF_FLAGS_ZC)) {
             SCLogInfo("ZC interface detected, not setting cluster-id for PF_RING (iface %s)",
                     pfconf->iface);
         } else if ((pfconf->threads == 1) && (strncmp(pfconf->iface, "dna", 3) == 0)) {
@@ -333,7 +362,10 @@ void *ParsePfringConfig(const char *iface)
         }
     }
 
-    if (getctype) {
+    if (getctype && (pfconf->flags & PFRING_CONF_FLAGS_ZC)) {
+        SCLogInfo("ZC mode balances with the flow hash, ignoring cluster-type "
+                "(iface %s)", pfconf->iface);
+    } else if (getctype) {
         if (strcmp(tmpctype, "cluster_round_robin") == 0) {
             SCLogInfo("Using round-robin cluster mode for PF_RING (iface %s)",
                     pfconf->iface);
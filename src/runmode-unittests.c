@@ -32,6 +32,7 @@
 #include "detect-engine-proto.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
 #include "detect-engine-sigorder.h"
 #include "detect-engine-payload.h"
 #include "detect-engine-dcepayload.h"
@@ -46,18 +47,27 @@
 #include "detect-engine-hsmd.h"
 #include "detect-engine-hscd.h"
 #include "detect-engine-hua.h"
+#include "detect-engine-http-combined.h"
 #include "detect-engine-hhhd.h"
 #include "detect-engine-hrhhd.h"
 #include "detect-engine-state.h"
 #include "detect-engine-tag.h"
+#include "detect-engine-threshold.h"
 #include "detect-engine-modbus.h"
 #include "detect-engine-filedata-smtp.h"
+#include "detect-engine-analyzer.h"
+#include "detect-engine-memuse.h"
+#include "detect-engine-fp-feedback.h"
+#include "detect-engine-rule-budget.h"
+#include "detect-engine-alert-aggregate.h"
 #include "detect-fast-pattern.h"
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-checkpoint.h"
+#include "app-layer-offload.h"
 #include "pkt-var.h"
 
 #include "host.h"
@@ -70,6 +80,7 @@
 
 #include "app-layer-detect-proto.h"
 #include "app-layer-parser.h"
+#include "app-layer-expectation.h"
 #include "app-layer.h"
 #include "app-layer-smb.h"
 #include "app-layer-dcerpc.h"
@@ -82,6 +93,7 @@
 
 #include "util-action.h"
 #include "util-radix-tree.h"
+#include "util-lpm-ipv4.h"
 #include "util-host-os-info.h"
 #include "util-cidr.h"
 #include "util-unittest-helper.h"
@@ -103,14 +115,29 @@
 #include "util-hash.h"
 #include "util-hashlist.h"
 #include "util-bloomfilter.h"
+#include "util-bloomfilter-blocked.h"
 #include "util-bloomfilter-counting.h"
 #include "util-pool.h"
+#include "util-hugepages.h"
+#include "util-hash-fast.h"
+#include "util-hash-map.h"
+#include "util-rohash.h"
+#include "util-arena.h"
+#include "util-checksum-simd.h"
+#include "util-bytes-simd.h"
+#include "util-crypt.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-offload.h"
+#ifdef __SC_CUDA_SUPPORT__
+#include "util-cuda-handlers.h"
+#endif
 
 #include "util-decode-asn1.h"
 
@@ -121,6 +148,21 @@
 #include "detect-engine-siggroup.h"
 
 #include "util-streaming-buffer.h"
+#include "util-json-builder.h"
+#include "util-msgpack.h"
+#include "util-log-compress.h"
+#include "util-log-kafka.h"
+#include "util-latency.h"
+#include "output-metrics.h"
+#include "util-memcap.h"
+#include "output-filter.h"
+#include "util-lock-stats.h"
+#include "util-rss.h"
+#include "util-load-shed.h"
+#include "util-state-sync.h"
+#include "util-mem-tag.h"
+#include "util-expiry.h"
+#include "util-dedup.h"
 
 #endif /* UNITTESTS */
 
@@ -174,6 +216,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
     SCProtoNameInit();
 
     TagInitCtx();
+    ThresholdInit();
     SCReferenceConfInit();
     SCClassConfInit();
 
@@ -192,6 +235,7 @@ void RunUnittests(int list_unittests, char *regex_arg)
 
     AppLayerHtpEnableRequestBodyCallback();
     AppLayerHtpNeedFileInspection();
+    DCERPCEnableStubData();
 
     UtInitialize();
     UTHRegisterTests();
@@ -204,10 +248,22 @@ void RunUnittests(int list_unittests, char *regex_arg)
     HashListTableRegisterTests();
     BloomFilterRegisterTests();
     BloomFilterCountingRegisterTests();
+    BloomFilterBlockedRegisterTests();
     PoolRegisterTests();
+    HugePagesRegisterTests();
+    HashFastRegisterTests();
+    HashMapRegisterTests();
+    ROHashRegisterTests();
+    TxArenaRegisterTests();
+    ChecksumSimdRegisterTests();
+    BytesSimdRegisterTests();
+    Base64RegisterTests();
     ByteRegisterTests();
     MpmRegisterTests();
+    MpmOffloadRegisterTests();
     FlowBitRegisterTests();
+    FlowCheckpointRegisterTests();
+    AppLayerOffloadRegisterTests();
     HostBitRegisterTests();
     IPPairBitRegisterTests();
     StatsRegisterTests();
@@ -222,6 +278,8 @@ void RunUnittests(int list_unittests, char *regex_arg)
     DecodeTCPRegisterTests();
     DecodeUDPV4RegisterTests();
     DecodeGRERegisterTests();
+    DecodeVXLANRegisterTests();
+    DecodeGeneveRegisterTests();
     DecodeAsn1RegisterTests();
     DecodeMPLSRegisterTests();
     AppLayerProtoDetectUnittestsRegister();
@@ -233,11 +291,13 @@ void RunUnittests(int list_unittests, char *regex_arg)
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
     SCRadixRegisterTests();
+    SCLpmIPV4RegisterTests();
     DefragRegisterTests();
     SigGroupHeadRegisterTests();
     SCHInfoRegisterTests();
     SCRuleVarsRegisterTests();
     AppLayerParserRegisterUnittests();
+    AppLayerExpectationRegisterTests();
     ThreadMacrosRegisterTests();
     UtilSpmSearchRegistertests();
     UtilActionRegisterTests();
@@ -266,17 +326,24 @@ void RunUnittests(int list_unittests, char *regex_arg)
     DetectEngineHttpStatMsgRegisterTests();
     DetectEngineHttpStatCodeRegisterTests();
     DetectEngineHttpUARegisterTests();
+    DetectEngineHttpCombinedRegisterTests();
     DetectEngineHttpHHRegisterTests();
     DetectEngineHttpHRHRegisterTests();
     DetectEngineInspectModbusRegisterTests();
     DetectEngineRegisterTests();
     DetectEngineSMTPFiledataRegisterTests();
+    EngineAnalysisRegisterTests();
+    DetectEngineMemuseRegisterTests();
+    DetectFPFeedbackRegisterTests();
+    DetectRuleBudgetRegisterTests();
+    AlertAggregateRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
     UtilMiscRegisterTests();
     DetectAddressTests();
     DetectProtoTests();
     DetectPortTests();
+    PrefilterRegisterTests();
     SCAtomicRegisterTests();
     MemrchrRegisterTests();
 #ifdef __SC_CUDA_SUPPORT__
@@ -285,6 +352,21 @@ void RunUnittests(int list_unittests, char *regex_arg)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    JsonBuilderRegisterTests();
+    MsgPackRegisterTests();
+    LogCompressRegisterTests();
+    LogKafkaRegisterTests();
+    LatencyRegisterTests();
+    MetricsRegisterTests();
+    MemcapPolicyRegisterTests();
+    OutputFilterRegisterTests();
+    LockStatsRegisterTests();
+    RSSRegisterTests();
+    LoadShedRegisterTests();
+    StateSyncRegisterTests();
+    MemTagRegisterTests();
+    ExpiryRegisterTests();
+    DedupRegisterTests();
 
     if (list_unittests) {
         UtListTests(regex_arg);
@@ -41,15 +41,28 @@
 #include "util-profiling.h"
 
 #include "conf-yaml-loader.h"
+#include "util-atomic.h"
 
 static const char *default_mode = NULL;
 
 int unix_socket_mode_is_running = 0;
 
+/** max pcap jobs read concurrently by one run */
+#define UNIX_PCAP_MAX_JOBS  16
+
 typedef struct PcapFiles_ {
     char *filename;
     char *output_dir;
     int tenant_id;
+    /** may be read by an already running continuous run */
+    int continuous;
+    /** tags the flows and the EVE records of the file */
+    uint32_t job_id;
+    /** files with a higher priority are read first */
+    int priority;
+    /** max number of jobs the file may be read together with,
+     *  0 for no limit other than unix-command.pcap-max-jobs */
+    int concurrency;
     TAILQ_ENTRY(PcapFiles_) next;
 } PcapFiles;
 
@@ -57,6 +70,25 @@ typedef struct PcapCommand_ {
     TAILQ_HEAD(, PcapFiles_) files;
     int running;
     char *currentfile;
+
+    /** current run is continuous: the reader takes the next files
+     *  with the same output dir and tenant without restarting */
+    int continuous;
+    char *output_dir;
+    int tenant_id;
+
+    /** jobs of the current run, each is read by its own reader thread.
+     *  They share the output dir, the tenant and the detect engine, the
+     *  job id keeps their flows apart. */
+    PcapFiles *jobs[UNIX_PCAP_MAX_JOBS];
+    int job_cnt;
+    /** unix-command.pcap-max-jobs */
+    int max_jobs;
+    uint32_t job_id_next;
+
+    /** protects the list and the current run info, the reader thread
+     *  of a continuous run takes files from it */
+    SCMutex lock;
 } PcapCommand;
 
 const char *RunModeUnixSocketGetDefaultMode(void)
@@ -66,9 +98,12 @@ const char *RunModeUnixSocketGetDefaultMode(void)
 
 #ifdef BUILD_UNIX_SOCKET
 
-static int unix_manager_file_task_running = 0;
+/** reader threads of the current run that haven't finished yet */
+SC_ATOMIC_DECLARE(int, unix_manager_file_task_running);
 static int unix_manager_file_task_failed = 0;
 
+static PcapCommand *unix_pcap_cmd = NULL;
+
 /**
  * \brief return list of files in the queue
  *
@@ -95,10 +130,12 @@ static TmEcode UnixSocketPcapFilesList(json_t *cmd, json_t* answer, void *data)
                             json_string("internal error at json object creation"));
         return TM_ECODE_FAILED;
     }
+    SCMutexLock(&this->lock);
     TAILQ_FOREACH(file, &this->files, next) {
         json_array_append_new(jarray, json_string(file->filename));
         i++;
     }
+    SCMutexUnlock(&this->lock);
     json_object_set_new(jdata, "count", json_integer(i));
     json_object_set_new(jdata, "files", jarray);
     json_object_set_new(answer, "message", jdata);
@@ -111,9 +148,11 @@ static TmEcode UnixSocketPcapFilesNumber(json_t *cmd, json_t* answer, void *data
     int i = 0;
     PcapFiles *file;
 
+    SCMutexLock(&this->lock);
     TAILQ_FOREACH(file, &this->files, next) {
         i++;
     }
+    SCMutexUnlock(&this->lock);
     json_object_set_new(answer, "message", json_integer(i));
     return TM_ECODE_OK;
 }
@@ -122,11 +161,13 @@ static TmEcode UnixSocketPcapCurrent(json_t *cmd, json_t* answer, void *data)
 {
     PcapCommand *this = (PcapCommand *) data;
 
+    SCMutexLock(&this->lock);
     if (this->currentfile) {
         json_object_set_new(answer, "message", json_string(this->currentfile));
     } else {
         json_object_set_new(answer, "message", json_string("None"));
     }
+    SCMutexUnlock(&this->lock);
     return TM_ECODE_OK;
 }
 
@@ -146,14 +187,18 @@ static void PcapFilesFree(PcapFiles *cfile)
 /**
  * \brief Add file to file queue
  *
+ * The file is queued after the files of the same or a higher priority.
+ *
  * \param this a UnixCommand:: structure
  * \param filename absolute filename
  * \param output_dir absolute name of directory where log will be put
+ * \param job_id set to the id of the new job
  *
  * \retval 0 in case of error, 1 in case of success
  */
 static TmEcode UnixListAddFile(PcapCommand *this,
-        const char *filename, const char *output_dir, int tenant_id)
+        const char *filename, const char *output_dir, int tenant_id,
+        int continuous, int priority, int concurrency, uint32_t *job_id)
 {
     PcapFiles *cfile = NULL;
     if (filename == NULL || this == NULL)
@@ -183,25 +228,40 @@ static TmEcode UnixListAddFile(PcapCommand *this,
     }
 
     cfile->tenant_id = tenant_id;
-
-    TAILQ_INSERT_TAIL(&this->files, cfile, next);
+    cfile->continuous = continuous;
+    cfile->priority = priority;
+    cfile->concurrency = concurrency;
+
+    SCMutexLock(&this->lock);
+    cfile->job_id = ++this->job_id_next;
+    if (cfile->job_id == 0)
+        cfile->job_id = ++this->job_id_next;
+    *job_id = cfile->job_id;
+
+    PcapFiles *pos;
+    TAILQ_FOREACH(pos, &this->files, next) {
+        if (pos->priority < priority)
+            break;
+    }
+    if (pos != NULL)
+        TAILQ_INSERT_BEFORE(pos, cfile, next);
+    else
+        TAILQ_INSERT_TAIL(&this->files, cfile, next);
+    SCMutexUnlock(&this->lock);
     return TM_ECODE_OK;
 }
 
-/**
- * \brief Command to add a file to treatment list
- *
- * \param cmd the content of command Arguments as a json_t object
- * \param answer the json_t object that has to be used to answer
- * \param data pointer to data defining the context here a PcapCommand::
- */
-TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
+static TmEcode UnixSocketAddPcapFileImpl(json_t *cmd, json_t* answer, void *data,
+        int continuous)
 {
     PcapCommand *this = (PcapCommand *) data;
     int ret;
     const char *filename;
     const char *output_dir;
     int tenant_id = 0;
+    int priority = 0;
+    int concurrency = 0;
+    uint32_t job_id = 0;
 #ifdef OS_WIN32
     struct _stat st;
 #else
@@ -256,19 +316,163 @@ TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
         tenant_id = json_number_value(targ);
     }
 
-    ret = UnixListAddFile(this, filename, output_dir, tenant_id);
+    json_t *parg = json_object_get(cmd, "priority");
+    if (parg != NULL) {
+        if(!json_is_number(parg)) {
+            json_object_set_new(answer, "message", json_string("priority is not a number"));
+            return TM_ECODE_FAILED;
+        }
+        priority = json_number_value(parg);
+    }
+
+    json_t *carg = json_object_get(cmd, "concurrency");
+    if (carg != NULL) {
+        if(!json_is_number(carg) || json_number_value(carg) < 0) {
+            json_object_set_new(answer, "message",
+                    json_string("concurrency is not a positive number"));
+            return TM_ECODE_FAILED;
+        }
+        concurrency = json_number_value(carg);
+    }
+
+    ret = UnixListAddFile(this, filename, output_dir, tenant_id, continuous,
+            priority, concurrency, &job_id);
     switch(ret) {
         case TM_ECODE_FAILED:
             json_object_set_new(answer, "message", json_string("Unable to add file to list"));
             return TM_ECODE_FAILED;
         case TM_ECODE_OK:
-            SCLogInfo("Added file '%s' to list", filename);
+            SCLogInfo("Added file '%s' to list as job %u", filename, job_id);
             json_object_set_new(answer, "message", json_string("Successfully added file to list"));
+            json_object_set_new(answer, "job", json_integer(job_id));
             return TM_ECODE_OK;
     }
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Command to add a file to treatment list
+ *
+ * \param cmd the content of command Arguments as a json_t object
+ * \param answer the json_t object that has to be used to answer
+ * \param data pointer to data defining the context here a PcapCommand::
+ */
+TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
+{
+    return UnixSocketAddPcapFileImpl(cmd, answer, data, 0);
+}
+
+/**
+ * \brief Command to add a file to a continuous run
+ *
+ * Consecutive continuous files with the same output dir and tenant are
+ * read by the same run: threads, flows and the detect engine are kept
+ * between the files. Once the queue is empty the run waits for more
+ * files until 'pcap-interrupt' is issued.
+ *
+ * \param cmd the content of command Arguments as a json_t object
+ * \param answer the json_t object that has to be used to answer
+ * \param data pointer to data defining the context here a PcapCommand::
+ */
+static TmEcode UnixSocketAddPcapFileContinuous(json_t *cmd, json_t* answer, void *data)
+{
+    return UnixSocketAddPcapFileImpl(cmd, answer, data, 1);
+}
+
+/**
+ * \brief Command to end the current continuous run
+ *
+ * The files already queued for it are still read, then the run ends
+ * instead of waiting for more files.
+ */
+static TmEcode UnixSocketPcapInterrupt(json_t *cmd, json_t* answer, void *data)
+{
+    PcapCommand *this = (PcapCommand *) data;
+
+    SCMutexLock(&this->lock);
+    this->continuous = 0;
+    SCMutexUnlock(&this->lock);
+
+    json_object_set_new(answer, "message", json_string("Interrupted"));
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief get the next file of the current continuous run
+ *
+ * Called by the pcap file reader at the end of a file.
+ *
+ * \param filename set to the file to read next, to be freed by the caller
+ *
+ * \retval 1 next file, 0 no file yet, -1 the run is over
+ */
+static int UnixSocketPcapFileNextInt(char **filename)
+{
+    PcapCommand *this = unix_pcap_cmd;
+    int r = -1;
+
+    if (this == NULL)
+        return -1;
+
+    SCMutexLock(&this->lock);
+    if (this->continuous) {
+        PcapFiles *cfile = TAILQ_FIRST(&this->files);
+        if (cfile == NULL) {
+            r = 0;
+        } else if (cfile->continuous && cfile->tenant_id == this->tenant_id &&
+                this->output_dir != NULL && cfile->output_dir != NULL &&
+                strcmp(cfile->output_dir, this->output_dir) == 0) {
+            TAILQ_REMOVE(&this->files, cfile, next);
+            *filename = SCStrdup(cfile->filename);
+            if (*filename != NULL) {
+                if (this->currentfile)
+                    SCFree(this->currentfile);
+                this->currentfile = SCStrdup(cfile->filename);
+                r = 1;
+            }
+            PcapFilesFree(cfile);
+        }
+    }
+    SCMutexUnlock(&this->lock);
+    return r;
+}
+
+/**
+ * \brief put a file of the continuous run back in front of the queue
+ *
+ * Used by the reader if it can't switch to the file in place, the file
+ * is then read by a new run.
+ */
+static void UnixSocketPcapFileRequeueInt(const char *filename)
+{
+    PcapCommand *this = unix_pcap_cmd;
+    PcapFiles *cfile = NULL;
+
+    if (this == NULL)
+        return;
+
+    cfile = SCMalloc(sizeof(PcapFiles));
+    if (unlikely(cfile == NULL))
+        return;
+    memset(cfile, 0, sizeof(PcapFiles));
+
+    SCMutexLock(&this->lock);
+    cfile->filename = SCStrdup(filename);
+    if (this->output_dir != NULL)
+        cfile->output_dir = SCStrdup(this->output_dir);
+    cfile->tenant_id = this->tenant_id;
+    cfile->continuous = 1;
+    cfile->job_id = this->job_cnt > 0 ? this->jobs[0]->job_id : ++this->job_id_next;
+    if (cfile->filename == NULL ||
+            (this->output_dir != NULL && cfile->output_dir == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to requeue file");
+        PcapFilesFree(cfile);
+    } else {
+        TAILQ_INSERT_HEAD(&this->files, cfile, next);
+    }
+    SCMutexUnlock(&this->lock);
+}
+
 /**
  * \brief Handle the file queue
  *
@@ -279,13 +483,18 @@ TmEcode UnixSocketAddPcapFile(json_t *cmd, json_t* answer, void *data)
  * This function also handles the cleaning of the previous
  * running mode.
  *
+ * Files queued behind the first one with the same output dir and
+ * tenant are read by the same run, up to unix-command.pcap-max-jobs
+ * and the concurrency hints of the files. Each is read by its own
+ * reader thread, the pipeline behind them is shared.
+ *
  * \param this a UnixCommand:: structure
  * \retval 0 in case of error, 1 in case of success
  */
 TmEcode UnixSocketPcapFilesCheck(void *data)
 {
     PcapCommand *this = (PcapCommand *) data;
-    if (unix_manager_file_task_running == 1) {
+    if (SC_ATOMIC_GET(unix_manager_file_task_running) > 0) {
         return TM_ECODE_OK;
     }
     if ((unix_manager_file_task_failed == 1) || (this->running == 1)) {
@@ -294,10 +503,17 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
         }
         unix_manager_file_task_failed = 0;
         this->running = 0;
+        SCMutexLock(&this->lock);
         if (this->currentfile) {
             SCFree(this->currentfile);
         }
         this->currentfile = NULL;
+        if (this->output_dir) {
+            SCFree(this->output_dir);
+        }
+        this->output_dir = NULL;
+        this->continuous = 0;
+        SCMutexUnlock(&this->lock);
 
         /* needed by FlowForceReassembly */
         PacketPoolInit();
@@ -336,23 +552,63 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
         SCProfilingDestroy();
 #endif
     }
-    if (!TAILQ_EMPTY(&this->files)) {
-        PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    /* the reader threads are gone, their file names with them */
+    int i;
+    for (i = 0; i < this->job_cnt; i++) {
+        PcapFilesFree(this->jobs[i]);
+        this->jobs[i] = NULL;
+    }
+    this->job_cnt = 0;
+
+    SCMutexLock(&this->lock);
+    PcapFiles *cfile = TAILQ_FIRST(&this->files);
+    if (cfile != NULL) {
         TAILQ_REMOVE(&this->files, cfile, next);
-        SCLogInfo("Starting run for '%s'", cfile->filename);
-        unix_manager_file_task_running = 1;
+        this->jobs[this->job_cnt++] = cfile;
+
+        int max_jobs = this->max_jobs;
+        if (cfile->concurrency > 0 && cfile->concurrency < max_jobs)
+            max_jobs = cfile->concurrency;
+
+        /* continuous runs take their next files themselves */
+        PcapFiles *next = cfile->continuous ? NULL : TAILQ_NEXT(cfile, next);
+        while (next != NULL && this->job_cnt < max_jobs) {
+            PcapFiles *job = next;
+            next = TAILQ_NEXT(job, next);
+
+            if (job->continuous || job->tenant_id != cfile->tenant_id ||
+                    strcmp(job->output_dir, cfile->output_dir) != 0 ||
+                    (job->concurrency > 0 && job->concurrency <= this->job_cnt))
+                continue;
+
+            TAILQ_REMOVE(&this->files, job, next);
+            this->jobs[this->job_cnt++] = job;
+            if (job->concurrency > 0 && job->concurrency < max_jobs)
+                max_jobs = job->concurrency;
+        }
+    }
+    SCMutexUnlock(&this->lock);
+    if (cfile != NULL) {
+        if (this->job_cnt > 1) {
+            SCLogInfo("Starting run for %d jobs, first '%s'", this->job_cnt,
+                    cfile->filename);
+        } else {
+            SCLogInfo("Starting %srun for '%s'", cfile->continuous ? "continuous " : "",
+                    cfile->filename);
+        }
+        for (i = 0; i < this->job_cnt; i++) {
+            SCLogInfo("job %u: '%s'", this->jobs[i]->job_id, this->jobs[i]->filename);
+        }
         this->running = 1;
         if (ConfSet("pcap-file.file", cfile->filename) != 1) {
             SCLogError(SC_ERR_INVALID_ARGUMENTS,
                        "Can not set working file to '%s'", cfile->filename);
-            PcapFilesFree(cfile);
             return TM_ECODE_FAILED;
         }
         if (cfile->output_dir) {
             if (ConfSet("default-log-dir", cfile->output_dir) != 1) {
                 SCLogError(SC_ERR_INVALID_ARGUMENTS,
                            "Can not set output dir to '%s'", cfile->output_dir);
-                PcapFilesFree(cfile);
                 return TM_ECODE_FAILED;
             }
         }
@@ -362,18 +618,25 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
             if (ConfSet("pcap-file.tenant-id", tstr) != 1) {
                 SCLogError(SC_ERR_INVALID_ARGUMENTS,
                            "Can not set working tenant-id to '%s'", tstr);
-                PcapFilesFree(cfile);
                 return TM_ECODE_FAILED;
             }
         } else {
             SCLogInfo("pcap-file.tenant-id not set");
         }
+        SCMutexLock(&this->lock);
         this->currentfile = SCStrdup(cfile->filename);
         if (unlikely(this->currentfile == NULL)) {
+            SCMutexUnlock(&this->lock);
             SCLogError(SC_ERR_MEM_ALLOC, "Failed file name allocation");
             return TM_ECODE_FAILED;
         }
-        PcapFilesFree(cfile);
+        this->continuous = cfile->continuous;
+        this->tenant_id = cfile->tenant_id;
+        if (cfile->output_dir) {
+            this->output_dir = SCStrdup(cfile->output_dir);
+        }
+        SCMutexUnlock(&this->lock);
+        (void) SC_ATOMIC_SET(unix_manager_file_task_running, this->job_cnt);
         StatsInit();
 #ifdef PROFILING
         SCProfilingRulesGlobalInit();
@@ -415,11 +678,11 @@ void UnixSocketPcapFile(TmEcode tm)
 #ifdef BUILD_UNIX_SOCKET
     switch (tm) {
         case TM_ECODE_DONE:
-            unix_manager_file_task_running = 0;
+            (void) SC_ATOMIC_SUB(unix_manager_file_task_running, 1);
             break;
         case TM_ECODE_FAILED:
-            unix_manager_file_task_running = 0;
             unix_manager_file_task_failed = 1;
+            (void) SC_ATOMIC_SUB(unix_manager_file_task_running, 1);
             break;
         case TM_ECODE_OK:
             break;
@@ -427,6 +690,77 @@ void UnixSocketPcapFile(TmEcode tm)
 #endif
 }
 
+/**
+ * \brief get the next file to read in a continuous run
+ *
+ * \retval 1 next file set, 0 wait for more files, -1 end of the run
+ */
+int UnixSocketPcapFileNext(char **filename)
+{
+#ifdef BUILD_UNIX_SOCKET
+    return UnixSocketPcapFileNextInt(filename);
+#else
+    return -1;
+#endif
+}
+
+void UnixSocketPcapFileRequeue(const char *filename)
+{
+#ifdef BUILD_UNIX_SOCKET
+    UnixSocketPcapFileRequeueInt(filename);
+#endif
+}
+
+/**
+ * \brief number of pcap jobs of the current run
+ *
+ * \retval cnt jobs, 0 if not running in unix socket mode
+ */
+int UnixSocketPcapFileJobCount(void)
+{
+#ifdef BUILD_UNIX_SOCKET
+    if (unix_pcap_cmd != NULL)
+        return unix_pcap_cmd->job_cnt;
+#endif
+    return 0;
+}
+
+/**
+ * \brief file of a pcap job of the current run
+ *
+ * The string stays valid until the run is over. It's to be given to
+ * the reader as is, UnixSocketPcapFileJobId() looks the job up by it.
+ */
+const char *UnixSocketPcapFileJobFilename(int idx)
+{
+#ifdef BUILD_UNIX_SOCKET
+    if (unix_pcap_cmd != NULL && idx >= 0 && idx < unix_pcap_cmd->job_cnt)
+        return unix_pcap_cmd->jobs[idx]->filename;
+#endif
+    return NULL;
+}
+
+/**
+ * \brief id of the job of the current run a reader was set up for
+ *
+ * \param filename as returned by UnixSocketPcapFileJobFilename()
+ *
+ * \retval id job id, 0 if the file isn't a job of the current run
+ */
+uint32_t UnixSocketPcapFileJobId(const char *filename)
+{
+#ifdef BUILD_UNIX_SOCKET
+    if (unix_pcap_cmd != NULL) {
+        int i;
+        for (i = 0; i < unix_pcap_cmd->job_cnt; i++) {
+            if (unix_pcap_cmd->jobs[i]->filename == filename)
+                return unix_pcap_cmd->jobs[i]->job_id;
+        }
+    }
+#endif
+    return 0;
+}
+
 #ifdef BUILD_UNIX_SOCKET
 /**
  * \brief Command to add a tenant handler
@@ -810,9 +1144,34 @@ int RunModeUnixSocketSingle(void)
         SCLogError(SC_ERR_MEM_ALLOC, "Can not allocate pcap command");
         return 1;
     }
+    memset(pcapcmd, 0, sizeof(PcapCommand));
     TAILQ_INIT(&pcapcmd->files);
     pcapcmd->running = 0;
     pcapcmd->currentfile = NULL;
+    SCMutexInit(&pcapcmd->lock, NULL);
+    SC_ATOMIC_INIT(unix_manager_file_task_running);
+
+    intmax_t max_jobs = 1;
+    if (ConfGetInt("unix-command.pcap-max-jobs", &max_jobs) == 1) {
+        if (max_jobs < 1 || max_jobs > UNIX_PCAP_MAX_JOBS) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "unix-command.pcap-max-jobs "
+                    "must be between 1 and %d, using 1", UNIX_PCAP_MAX_JOBS);
+            max_jobs = 1;
+        }
+    }
+    /* the single runmode has one thread for everything */
+    char *runmode = NULL;
+    if (max_jobs > 1 && ConfGet("runmode", &runmode) == 1 && runmode != NULL &&
+            strcmp(runmode, "single") == 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "concurrent pcap jobs need the "
+                "autofp runmode, reading one file at a time");
+        max_jobs = 1;
+    }
+    pcapcmd->max_jobs = (int)max_jobs;
+    if (pcapcmd->max_jobs > 1)
+        SCLogConfig("unix socket: reading up to %d pcap jobs concurrently",
+                pcapcmd->max_jobs);
+    unix_pcap_cmd = pcapcmd;
 
     UnixManagerThreadSpawn(1);
 
@@ -822,6 +1181,9 @@ int RunModeUnixSocketSingle(void)
     UnixManagerRegisterCommand("pcap-file-number", UnixSocketPcapFilesNumber, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-file-list", UnixSocketPcapFilesList, pcapcmd, 0);
     UnixManagerRegisterCommand("pcap-current", UnixSocketPcapCurrent, pcapcmd, 0);
+    UnixManagerRegisterCommand("pcap-file-continuous", UnixSocketAddPcapFileContinuous,
+            pcapcmd, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("pcap-interrupt", UnixSocketPcapInterrupt, pcapcmd, 0);
 
     UnixManagerRegisterBackgroundTask(UnixSocketPcapFilesCheck, pcapcmd);
 #endif
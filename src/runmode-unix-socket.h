@@ -30,6 +30,12 @@ const char *RunModeUnixSocketGetDefaultMode(void);
 int RunModeUnixSocketIsActive(void);
 
 void UnixSocketPcapFile(TmEcode tm);
+int UnixSocketPcapFileNext(char **filename);
+void UnixSocketPcapFileRequeue(const char *filename);
+
+int UnixSocketPcapFileJobCount(void);
+const char *UnixSocketPcapFileJobFilename(int idx);
+uint32_t UnixSocketPcapFileJobId(const char *filename);
 
 #ifdef BUILD_UNIX_SOCKET
 TmEcode UnixSocketRegisterTenantHandler(json_t *cmd, json_t* answer, void *data);
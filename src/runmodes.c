@@ -54,6 +54,11 @@
 #ifdef __SC_CUDA_SUPPORT__
 #include "util-cuda-buffer.h"
 #include "util-mpm-ac.h"
+#include "util-mpm-offload.h"
+#endif
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
 #endif
 
 int debuglog_enabled = 0;
@@ -69,6 +74,9 @@ const char *thread_name_unix_socket = "US";
 const char *thread_name_detect_loader = "DL";
 const char *thread_name_counter_stats = "CS";
 const char *thread_name_counter_wakeup = "CW";
+const char *thread_name_metrics = "CX";
+const char *thread_name_state_sync = "SY";
+const char *thread_name_output = "LO";
 
 /**
  * \brief Holds description for a runmode.
@@ -158,6 +166,18 @@ static const char *RunModeTranslateModeToName(int runmode)
             return "NETMAP";
 #else
             return "NETMAP(DISABLED)";
+#endif
+        case RUNMODE_AF_XDP:
+#ifdef HAVE_AF_XDP
+            return "AF_XDP";
+#else
+            return "AF_XDP(DISABLED)";
+#endif
+        case RUNMODE_DPDK:
+#ifdef HAVE_DPDK
+            return "DPDK";
+#else
+            return "DPDK(DISABLED)";
 #endif
         case RUNMODE_UNIX_SOCKET:
             return "UNIX_SOCKET";
@@ -200,6 +220,24 @@ char *RunmodeGetActive(void)
     return active_runmode;
 }
 
+/**
+ * \brief Check if the capture thread handles its packets start to finish
+ *
+ * In the single and workers runmodes a packet has gone through the whole
+ * pipeline and is back in the pool before the capture method reads the
+ * next one, so the capture buffer can be used directly instead of being
+ * copied into the packet.
+ *
+ * \retval 1 if zero copy from a capture buffer is safe, 0 otherwise
+ */
+int RunmodeAllowsZeroCopy(void)
+{
+    if (active_runmode == NULL)
+        return 0;
+    return (strcasecmp(active_runmode, "single") == 0 ||
+            strcasecmp(active_runmode, "workers") == 0);
+}
+
 /**
  * Return the running mode
  *
@@ -231,6 +269,8 @@ void RunModeRegisterRunModes(void)
     RunModeNapatechRegister();
     RunModeIdsAFPRegister();
     RunModeIdsNetmapRegister();
+    RunModeIdsAFXDPRegister();
+    RunModeIdsDPDKRegister();
     RunModeIdsNflogRegister();
     RunModeTileMpipeRegister();
     RunModeUnixSocketRegister();
@@ -336,6 +376,12 @@ void RunModeDispatch(int runmode, const char *custom_mode)
             case RUNMODE_NETMAP:
                 custom_mode = RunModeNetmapGetDefaultMode();
                 break;
+            case RUNMODE_AF_XDP:
+                custom_mode = RunModeAFXDPGetDefaultMode();
+                break;
+            case RUNMODE_DPDK:
+                custom_mode = RunModeDPDKGetDefaultMode();
+                break;
             case RUNMODE_UNIX_SOCKET:
                 custom_mode = RunModeUnixSocketGetDefaultMode();
                 break;
@@ -397,10 +443,7 @@ void RunModeDispatch(int runmode, const char *custom_mode)
     if (local_custom_mode != NULL)
         SCFree(local_custom_mode);
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (PatternMatchDefaultMatcher() == MPM_AC_CUDA)
-        SCACCudaStartDispatcher();
-#endif
+    MpmOffloadStart();
 
     /* Check if the alloted queues have at least 1 reader and writer */
     TmValidateQueueState();
@@ -568,14 +611,24 @@ static void InsertInRunModeOutputs(RunModeOutput *runmode_output)
     }
 }
 
-/** \brief Turn output into thread module */
-static void SetupOutput(const char *name, OutputModule *module, OutputCtx *output_ctx)
+/** \brief Turn output into thread module
+ *  \param conf config of the output, for its 'filter', may be NULL */
+static void SetupOutput(const char *name, OutputModule *module, OutputCtx *output_ctx,
+        ConfNode *conf)
 {
     /* flow logger doesn't run in the packet path */
     if (module->FlowLogFunc) {
-        OutputRegisterFlowLogger(module->name, module->FlowLogFunc, output_ctx);
+        OutputFilter *filter = OutputFilterSetup(conf, module->name, ALPROTO_UNKNOWN);
+        if (OutputRegisterFlowLogger(module->name, module->FlowLogFunc,
+                    output_ctx, filter) != 0)
+            OutputFilterFree(filter);
         return;
     }
+    if (conf != NULL && module->TxLogFunc == NULL &&
+        ConfNodeLookupChild(conf, "filter") != NULL) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "%s: filter is only supported "
+                "for tx and flow outputs, ignoring it", module->name);
+    }
     /* stats logger doesn't run in the packet path */
     if (module->StatsLogFunc) {
         OutputRegisterStatsLogger(module->name, module->StatsLogFunc, output_ctx);
@@ -616,9 +669,11 @@ static void SetupOutput(const char *name, OutputModule *module, OutputCtx *outpu
         }
     } else if (module->TxLogFunc) {
         SCLogDebug("%s is a tx logger", module->name);
-        OutputRegisterTxLogger(module->name, module->alproto,
+        OutputFilter *filter = OutputFilterSetup(conf, module->name, module->alproto);
+        if (OutputRegisterTxLogger(module->name, module->alproto,
                 module->TxLogFunc, output_ctx, module->tc_log_progress,
-                module->ts_log_progress, module->TxLogCondition);
+                module->ts_log_progress, module->TxLogCondition, filter) != 0)
+            OutputFilterFree(filter);
 
         /* need one instance of the tx logger module */
         if (tx_logger_module == NULL) {
@@ -763,7 +818,7 @@ static void RunModeInitializeEveOutput(ConfNode *conf, OutputCtx *parent_ctx)
 
                 AddOutputToFreeList(sub_module, sub_output_ctx);
                 SetupOutput(sub_module->name, sub_module,
-                        sub_output_ctx);
+                        sub_output_ctx, sub_output_config);
             }
         }
 
@@ -807,7 +862,7 @@ static void RunModeInitializeLuaOutput(ConfNode *conf, OutputCtx *parent_ctx)
         }
 
         AddOutputToFreeList(m, sub_output_ctx);
-        SetupOutput(m->name, m, sub_output_ctx);
+        SetupOutput(m->name, m, sub_output_ctx, NULL);
     }
 }
 
@@ -918,7 +973,7 @@ void RunModeInitializeOutputs(void)
                 AddOutputToFreeList(module, output_ctx);
             } else {
                 AddOutputToFreeList(module, output_ctx);
-                SetupOutput(module->name, module, output_ctx);
+                SetupOutput(module->name, module, output_ctx, output_config);
             }
         }
         if (count == 0) {
@@ -956,7 +1011,7 @@ void RunModeInitializeOutputs(void)
                 }
 
                 AddOutputToFreeList(module, output_ctx);
-                SetupOutput(module->name, module, output_ctx);
+                SetupOutput(module->name, module, output_ctx, NULL);
             }
         }
     }
@@ -992,6 +1047,25 @@ void RunModeInitialize(void)
     /* try to get custom cpu mask value if needed */
     if (threading_set_cpu_affinity == TRUE) {
         AffinitySetupLoadFromConfig();
+        AffinitySetupMainThread();
+        AffinityPrintReport();
+    }
+
+    int lock_memory = 0;
+    if (ConfGetBool("threading.lock-memory", &lock_memory) == 1 && lock_memory) {
+#if HAVE_SYS_MMAN_H && defined MCL_FUTURE
+        /* the packet pools, rings and flow tables are allocated after
+         * this, MCL_FUTURE covers them */
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "unable to lock memory: %s",
+                    strerror(errno));
+        } else {
+            SCLogConfig("locked all memory in RAM");
+        }
+#else
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "threading.lock-memory is not "
+                "supported on this platform");
+#endif
     }
     if ((ConfGetFloat("threading.detect-thread-ratio", &threading_detect_ratio)) != 1) {
         if (ConfGetNode("threading.detect-thread-ratio") != NULL)
@@ -36,6 +36,8 @@ enum RunModes {
     RUNMODE_DAG,
     RUNMODE_AFP_DEV,
     RUNMODE_NETMAP,
+    RUNMODE_AF_XDP,
+    RUNMODE_DPDK,
     RUNMODE_TILERA_MPIPE,
     RUNMODE_UNITTEST,
     RUNMODE_NAPATECH,
@@ -52,6 +54,8 @@ enum RunModes {
     RUNMODE_CONF_TEST,
     RUNMODE_LIST_UNITTEST,
     RUNMODE_ENGINE_ANALYSIS,
+    RUNMODE_MICRO_BENCHMARK,
+    RUNMODE_LIST_MICRO_BENCHMARKS,
 #ifdef OS_WIN32
     RUNMODE_INSTALL_SERVICE,
     RUNMODE_REMOVE_SERVICE,
@@ -71,8 +75,12 @@ extern const char *thread_name_unix_socket;
 extern const char *thread_name_detect_loader;
 extern const char *thread_name_counter_stats;
 extern const char *thread_name_counter_wakeup;
+extern const char *thread_name_metrics;
+extern const char *thread_name_state_sync;
+extern const char *thread_name_output;
 
 char *RunmodeGetActive(void);
+int RunmodeAllowsZeroCopy(void);
 const char *RunModeGetMainMode(void);
 
 void RunModeListRunmodes(void);
@@ -103,6 +111,8 @@ int RunModeOutputFiledataEnabled(void);
 #include "runmode-nflog.h"
 #include "runmode-unix-socket.h"
 #include "runmode-netmap.h"
+#include "runmode-af-xdp.h"
+#include "runmode-dpdk.h"
 
 int threading_set_cpu_affinity;
 extern float threading_detect_ratio;
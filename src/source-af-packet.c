@@ -52,22 +52,11 @@
 #include "util-checksum.h"
 #include "util-ioctl.h"
 #include "util-host-info.h"
+#include "util-affinity.h"
 #include "tmqh-packetpool.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
 
-#ifdef __SC_CUDA_SUPPORT__
-
-#include "util-cuda.h"
-#include "util-cuda-buffer.h"
-#include "util-mpm-ac.h"
-#include "util-cuda-handlers.h"
-#include "detect-engine.h"
-#include "detect-engine-mpm.h"
-#include "util-cuda-vars.h"
-
-#endif /* __SC_CUDA_SUPPORT__ */
-
 #ifdef HAVE_AF_PACKET
 
 #if HAVE_SYS_IOCTL_H
@@ -156,6 +145,21 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, void *initdata, void **data)
 #define AFP_DOWN_COUNTER_INTERVAL 40
 
 #define POLL_TIMEOUT 100
+/** max exponent of the backoff from spinning to POLL_TIMEOUT, in ms */
+#define POLL_BACKOFF_MAX_SHIFT 6
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef PACKET_QDISC_BYPASS
+#define PACKET_QDISC_BYPASS 20
+#endif
+
+/** frames queued in the TX ring before the kernel is kicked */
+#define AFP_TX_BATCH 32
+/** offset of the packet data in a TX ring frame */
+#define AFP_TX_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
 
 #ifndef TP_STATUS_USER_BUSY
 /* for new use latest bit available in tp_status */
@@ -166,6 +170,14 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, void *initdata, void **data)
 #define TP_STATUS_VLAN_VALID (1 << 4)
 #endif
 
+#ifndef TP_STATUS_CSUM_VALID
+/* set by the kernel if the NIC validated the checksums (3.16+) */
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
+/** checksum status bits telling us there is no need to validate */
+#define AFP_CSUM_SKIP (TP_STATUS_CSUMNOTREADY|TP_STATUS_CSUM_VALID)
+
 /** protect pfring_set_bpf_filter, as it is not thread safe */
 static SCMutex afpacket_bpf_set_filter_lock = SCMUTEX_INITIALIZER;
 
@@ -216,6 +228,17 @@ typedef struct AFPThreadVars_
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
 
+    /* poll loop counters */
+    uint16_t capture_poll_wakeups;
+    uint16_t capture_poll_timeouts;
+    uint16_t capture_poll_spins;
+    uint16_t capture_coalesced;
+
+    /* coalesced segments: packets larger than this came from GRO/LRO,
+     * 0 if coalesced segments are not accepted */
+    uint32_t coalesced_min;
+    int coalesced_inspect;
+
     /* handle state */
     uint8_t afp_state;
     uint8_t copy_mode;
@@ -239,6 +262,16 @@ typedef struct AFPThreadVars_
     int ring_size;
     int block_size;
     int block_timeout;
+    int busy_poll;
+    int qdisc_bypass;
+    int tx_ring;
+    /* TX ring, behind the RX ring in the mmap'ed area */
+    uint8_t *tx_ring_buf;
+    struct tpacket_req req_tx;
+    /* non blocking polls before backing off, and the current count of
+     * polls without new packets */
+    uint32_t spin_budget;
+    uint32_t idle_polls;
     /* socket buffer size */
     int buffer_size;
     /* Filter */
@@ -264,6 +297,10 @@ typedef struct AFPThreadVars_
     /* IPS output iface */
     char out_iface[AFP_IFACE_NAME_LENGTH];
 
+    /* batch mode: packets of the current block not yet processed */
+    uint32_t batch_cnt;
+    Packet *batch[AFP_BATCH_SIZE];
+
 } AFPThreadVars;
 
 TmEcode ReceiveAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
@@ -335,6 +372,16 @@ void AFPPeerUpdate(AFPThreadVars *ptv)
         return;
     }
     (void)SC_ATOMIC_SET(ptv->mpeer->if_idx, AFPGetIfnumByDev(ptv->socket, ptv->iface, 0));
+    if (ptv->afp_state == AFP_STATE_UP && ptv->tx_ring_buf != NULL) {
+        ptv->mpeer->tx_block_size = ptv->req_tx.tp_block_size;
+        ptv->mpeer->tx_frame_size = ptv->req_tx.tp_frame_size;
+        ptv->mpeer->tx_frames_per_block =
+            ptv->req_tx.tp_block_size / ptv->req_tx.tp_frame_size;
+        ptv->mpeer->tx_frame_nr = ptv->req_tx.tp_frame_nr;
+        ptv->mpeer->tx_offset = 0;
+        ptv->mpeer->tx_pending = 0;
+        ptv->mpeer->tx_ring = ptv->tx_ring_buf;
+    }
     (void)SC_ATOMIC_SET(ptv->mpeer->socket, ptv->socket);
     (void)SC_ATOMIC_SET(ptv->mpeer->state, ptv->afp_state);
 }
@@ -628,9 +675,7 @@ int AFPRead(AFPThreadVars *ptv)
     } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
         if (ptv->livedev->ignore_checksum) {
             p->flags |= PKT_IGNORE_CHECKSUM;
-        } else if (ChecksumAutoModeCheck(ptv->pkts,
-                                          SC_ATOMIC_GET(ptv->livedev->pkts),
-                                          SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+        } else if (ChecksumAutoModeCheckDevice(ptv->pkts, ptv->livedev)) {
             ptv->livedev->ignore_checksum = 1;
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
@@ -649,7 +694,7 @@ int AFPRead(AFPThreadVars *ptv)
 
         aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
 
-        if (aux_checksum && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
+        if (aux_checksum && (aux->tp_status & AFP_CSUM_SKIP)) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
         break;
@@ -662,6 +707,77 @@ int AFPRead(AFPThreadVars *ptv)
     SCReturnInt(AFP_READ_OK);
 }
 
+/**
+ * \brief have the kernel send the frames queued in the TX ring
+ *
+ * Caller needs to hold sock_protect if the peer uses it.
+ */
+static void AFPTxKick(AFPPeer *peer)
+{
+    if (peer->tx_pending == 0)
+        return;
+    if (sendto(SC_ATOMIC_GET(peer->socket), NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+            errno != EAGAIN && errno != ENOBUFS) {
+        SCLogWarning(SC_ERR_SOCKET, "TX ring send failed on %s: %s",
+                peer->iface, strerror(errno));
+    }
+    peer->tx_pending = 0;
+}
+
+/**
+ * \brief send the frames queued in the TX ring of a peer
+ */
+static void AFPTxFlush(AFPPeer *peer)
+{
+    if (peer == NULL || peer->tx_ring == NULL || peer->tx_pending == 0)
+        return;
+    if (peer->flags & AFP_SOCK_PROTECT)
+        SCMutexLock(&peer->sock_protect);
+    AFPTxKick(peer);
+    if (peer->flags & AFP_SOCK_PROTECT)
+        SCMutexUnlock(&peer->sock_protect);
+}
+
+/**
+ * \brief queue a packet in the TX ring of the peer
+ *
+ * Caller needs to hold sock_protect if the peer uses it.
+ *
+ * \retval 0 queued, -1 caller needs to send the packet itself
+ */
+static int AFPTxRingWrite(AFPPeer *peer, Packet *p)
+{
+    unsigned int block = peer->tx_offset / peer->tx_frames_per_block;
+    unsigned int frame = peer->tx_offset % peer->tx_frames_per_block;
+    struct tpacket2_hdr *h = (struct tpacket2_hdr *)(peer->tx_ring +
+            block * peer->tx_block_size + frame * peer->tx_frame_size);
+
+    if (GET_PKT_LEN(p) > peer->tx_frame_size - AFP_TX_DATA_OFFSET)
+        return -1;
+
+    if (h->tp_status != TP_STATUS_AVAILABLE) {
+        /* ring full: let the kernel catch up once */
+        peer->tx_pending = 1;
+        AFPTxKick(peer);
+        if (h->tp_status == TP_STATUS_WRONG_FORMAT) {
+            h->tp_status = TP_STATUS_AVAILABLE;
+        } else if (h->tp_status != TP_STATUS_AVAILABLE) {
+            return -1;
+        }
+    }
+
+    memcpy((uint8_t *)h + AFP_TX_DATA_OFFSET, GET_PKT_DATA(p), GET_PKT_LEN(p));
+    h->tp_len = GET_PKT_LEN(p);
+    /* frame content needs to be visible before the kernel sees the status */
+    __sync_synchronize();
+    h->tp_status = TP_STATUS_SEND_REQUEST;
+
+    peer->tx_offset = (peer->tx_offset + 1) % peer->tx_frame_nr;
+    if (++peer->tx_pending >= AFP_TX_BATCH)
+        AFPTxKick(peer);
+    return 0;
+}
+
 TmEcode AFPWritePacket(Packet *p)
 {
     struct sockaddr_ll socket_address;
@@ -690,6 +806,12 @@ TmEcode AFPWritePacket(Packet *p)
     /* Send packet, locking the socket if necessary */
     if (p->afp_v.peer->flags & AFP_SOCK_PROTECT)
         SCMutexLock(&p->afp_v.peer->sock_protect);
+    if (p->afp_v.peer->tx_ring != NULL &&
+            AFPTxRingWrite(p->afp_v.peer, p) == 0) {
+        if (p->afp_v.peer->flags & AFP_SOCK_PROTECT)
+            SCMutexUnlock(&p->afp_v.peer->sock_protect);
+        return TM_ECODE_OK;
+    }
     socket = SC_ATOMIC_GET(p->afp_v.peer->socket);
     if (sendto(socket, GET_PKT_DATA(p), GET_PKT_LEN(p), 0,
                (struct sockaddr*) &socket_address,
@@ -870,14 +992,12 @@ int AFPReadFromRing(AFPThreadVars *ptv)
         } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
             if (ptv->livedev->ignore_checksum) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
-            } else if (ChecksumAutoModeCheck(ptv->pkts,
-                        SC_ATOMIC_GET(ptv->livedev->pkts),
-                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            } else if (ChecksumAutoModeCheckDevice(ptv->pkts, ptv->livedev)) {
                 ptv->livedev->ignore_checksum = 1;
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         } else {
-            if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
+            if (h.h2->tp_status & AFP_CSUM_SKIP) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
         }
@@ -911,6 +1031,21 @@ next_frame:
     SCReturnInt(AFP_READ_OK);
 }
 
+/** \internal
+ *  \brief flag a GRO/LRO coalesced segment
+ *
+ *  The TCP checksum of a coalesced segment is the one of its first wire
+ *  segment, so it's not validated. Stream reassembly takes the segment
+ *  as a whole, packet payload inspection can be turned off for it.
+ */
+static inline void AFPSetCoalesced(AFPThreadVars *ptv, Packet *p)
+{
+    p->flags |= (PKT_COALESCED|PKT_IGNORE_CHECKSUM);
+    if (!ptv->coalesced_inspect)
+        DecodeSetNoPayloadInspectionFlag(p);
+    StatsIncr(ptv->tv, ptv->capture_coalesced);
+}
+
 #ifdef HAVE_TPACKET_V3
 static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
 {
@@ -963,18 +1098,33 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
         if (ptv->livedev->ignore_checksum) {
             p->flags |= PKT_IGNORE_CHECKSUM;
-        } else if (ChecksumAutoModeCheck(ptv->pkts,
-                    SC_ATOMIC_GET(ptv->livedev->pkts),
-                    SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+        } else if (ChecksumAutoModeCheckDevice(ptv->pkts, ptv->livedev)) {
             ptv->livedev->ignore_checksum = 1;
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     } else {
-        if (ppd->tp_status & TP_STATUS_CSUMNOTREADY) {
+        if (ppd->tp_status & AFP_CSUM_SKIP) {
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
 
+    if (ptv->coalesced_min && ppd->tp_snaplen > ptv->coalesced_min) {
+        AFPSetCoalesced(ptv, p);
+    }
+
+    if (ptv->flags & AFP_BATCH_MODE) {
+        ptv->batch[ptv->batch_cnt++] = p;
+        if (ptv->batch_cnt == AFP_BATCH_SIZE) {
+            uint32_t cnt = ptv->batch_cnt;
+            ptv->batch_cnt = 0;
+            if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot,
+                        ptv->batch, cnt) != TM_ECODE_OK) {
+                SCReturnInt(AFP_FAILURE);
+            }
+        }
+        SCReturnInt(AFP_READ_OK);
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ptv->tv, p);
         SCReturnInt(AFP_FAILURE);
@@ -983,6 +1133,24 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCReturnInt(AFP_READ_OK);
 }
 
+/** \brief process the packets collected in batch mode
+ *
+ *  Needs to be called before the block is returned to the kernel, as
+ *  in zero copy mode the packets point into the block. */
+static inline int AFPFlushBatch(AFPThreadVars *ptv)
+{
+    if (ptv->batch_cnt == 0)
+        return AFP_READ_OK;
+
+    uint32_t cnt = ptv->batch_cnt;
+    ptv->batch_cnt = 0;
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot,
+                ptv->batch, cnt) != TM_ECODE_OK) {
+        return AFP_FAILURE;
+    }
+    return AFP_READ_OK;
+}
+
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
@@ -992,11 +1160,16 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
     for (i = 0; i < num_pkts; ++i) {
         if (unlikely(AFPParsePacketV3(ptv, pbd,
                              (struct tpacket3_hdr *)ppd) == AFP_FAILURE)) {
+            (void)AFPFlushBatch(ptv);
             SCReturnInt(AFP_READ_FAILURE);
         }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
     }
 
+    if (unlikely(AFPFlushBatch(ptv) == AFP_FAILURE)) {
+        SCReturnInt(AFP_READ_FAILURE);
+    }
+
     SCReturnInt(AFP_READ_OK);
 }
 #endif /* HAVE_TPACKET_V3 */
@@ -1297,6 +1470,26 @@ static int AFPTryReopen(AFPThreadVars *ptv)
 /**
  *  \brief Main AF_PACKET reading Loop function
  */
+/**
+ * \brief timeout of the next poll
+ *
+ * While the ring saw packets recently we poll without blocking, then
+ * back off exponentially to the regular POLL_TIMEOUT.
+ */
+static inline int AFPPollTimeout(const AFPThreadVars *ptv)
+{
+    if (ptv->spin_budget == 0)
+        return POLL_TIMEOUT;
+    if (ptv->idle_polls < ptv->spin_budget)
+        return 0;
+
+    uint32_t shift = ptv->idle_polls - ptv->spin_budget;
+    if (shift > POLL_BACKOFF_MAX_SHIFT)
+        return POLL_TIMEOUT;
+    int timeout = 1 << shift;
+    return timeout < POLL_TIMEOUT ? timeout : POLL_TIMEOUT;
+}
+
 TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
 {
     SCEnter();
@@ -1309,6 +1502,8 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
     time_t current_time;
     int (*AFPReadFunc) (AFPThreadVars *);
     uint64_t discarded_pkts = 0;
+    int timeout;
+    uint64_t prev_pkts;
 
     ptv->slot = s->slot_next;
 
@@ -1344,6 +1539,19 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             }
         }
         AFPPeersListReachedInc();
+
+        /* the ring is allocated by the kernel on our node, warn if the
+         * NIC is attached to another one */
+        if (AffinityNumaModeEnabled()) {
+            int nic_node = AffinityGetIfaceNumaNode(ptv->iface);
+            int our_node = AffinityGetCurrentNumaNode();
+            if (nic_node >= 0 && our_node >= 0 && nic_node != our_node) {
+                SCLogWarning(SC_WARN_NUMA_NODE, "%s: capture thread runs on "
+                        "NUMA node %d, but %s is attached to node %d. Consider "
+                        "the worker-cpu-set.", tv->name, our_node, ptv->iface,
+                        nic_node);
+            }
+        }
     }
     if (ptv->afp_state == AFP_STATE_UP) {
         SCLogDebug("Thread %s using socket %d", tv->name, ptv->socket);
@@ -1394,7 +1602,11 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        r = poll(&fds, 1, POLL_TIMEOUT);
+        timeout = AFPPollTimeout(ptv);
+        if (timeout == 0) {
+            StatsIncr(ptv->tv, ptv->capture_poll_spins);
+        }
+        r = poll(&fds, 1, timeout);
 
         if (suricata_ctl_flags != 0) {
             break;
@@ -1421,7 +1633,18 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
                 continue;
             }
         } else if (r > 0) {
+            if (timeout != 0) {
+                StatsIncr(ptv->tv, ptv->capture_poll_wakeups);
+            }
+            prev_pkts = ptv->pkts;
             r = AFPReadFunc(ptv);
+            if (ptv->mpeer != NULL)
+                AFPTxFlush(ptv->mpeer->peer);
+            if (ptv->pkts != prev_pkts) {
+                ptv->idle_polls = 0;
+            } else if (ptv->idle_polls < UINT32_MAX) {
+                ptv->idle_polls++;
+            }
             switch (r) {
                 case AFP_READ_OK:
                     /* Trigger one dump of stats every second */
@@ -1447,8 +1670,15 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
                     break;
             }
         } else if (unlikely(r == 0)) {
-            /* poll timed out, lets see if we need to inject a fake packet  */
-            TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+            if (ptv->idle_polls < UINT32_MAX)
+                ptv->idle_polls++;
+            if (ptv->mpeer != NULL)
+                AFPTxFlush(ptv->mpeer->peer);
+            if (timeout != 0) {
+                StatsIncr(ptv->tv, ptv->capture_poll_timeouts);
+                /* poll timed out, lets see if we need to inject a fake packet  */
+                TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+            }
 
         } else if ((r < 0) && (errno != EINTR)) {
             SCLogError(SC_ERR_AFP_READ, "Error reading data from iface '%s': (%d" PRIu32 ") %s",
@@ -1737,6 +1967,25 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
                     devname);
             return AFP_FATAL_ERROR;
         }
+
+        /* the threads sending to us use the TX ring, same geometry as
+         * the RX ring so it has room for all pending packets */
+        if (ptv->tx_ring) {
+            ptv->req_tx = ptv->req;
+            r = setsockopt(ptv->socket, SOL_PACKET, PACKET_TX_RING,
+                    (void *) &ptv->req_tx, sizeof(ptv->req_tx));
+            if (r < 0) {
+                SCLogWarning(SC_ERR_MEM_ALLOC,
+                        "Unable to allocate TX Ring for iface %s: (%d) %s, "
+                        "sending with send()", devname, errno, strerror(errno));
+                memset(&ptv->req_tx, 0, sizeof(ptv->req_tx));
+            } else {
+                SCLogPerf("AF_PACKET TX Ring params: block_size=%d block_nr=%d "
+                        "frame_size=%d frame_nr=%d",
+                        ptv->req_tx.tp_block_size, ptv->req_tx.tp_block_nr,
+                        ptv->req_tx.tp_frame_size, ptv->req_tx.tp_frame_nr);
+            }
+        }
 #ifdef HAVE_TPACKET_V3
     }
 #endif
@@ -1748,6 +1997,7 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
     } else {
 #endif
         ring_buflen = ptv->req.tp_block_nr * ptv->req.tp_block_size;
+        ring_buflen += ptv->req_tx.tp_block_nr * ptv->req_tx.tp_block_size;
 #ifdef HAVE_TPACKET_V3
     }
 #endif
@@ -1781,6 +2031,10 @@ static int AFPSetupRing(AFPThreadVars *ptv, char *devname)
             goto postmmap_err;
         }
         memset(ptv->ring_v2, 0, ptv->req.tp_frame_nr * sizeof (union thdr *));
+        ptv->tx_ring_buf = NULL;
+        if (ptv->req_tx.tp_frame_nr > 0) {
+            ptv->tx_ring_buf = ring_buf + ptv->req.tp_block_nr * ptv->req.tp_block_size;
+        }
         /* fill the header ring with proper frame ptr*/
         ptv->frame_offset = 0;
         for (i = 0; i < ptv->req.tp_block_nr; ++i) {
@@ -1900,6 +2154,28 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         }
     }
 
+    if (ptv->busy_poll > 0) {
+        if (setsockopt(ptv->socket, SOL_SOCKET, SO_BUSY_POLL,
+                       &ptv->busy_poll, sizeof(ptv->busy_poll)) == -1) {
+            SCLogWarning(SC_ERR_AFP_CREATE,
+                    "Couldn't set busy poll to %d on iface %s, error %s",
+                    ptv->busy_poll, devname, strerror(errno));
+        } else {
+            SCLogPerf("%s: busy polling for %d usec", devname, ptv->busy_poll);
+        }
+    }
+
+    /* in IPS/TAP mode the peer sends from our socket */
+    if (ptv->qdisc_bypass) {
+        int val = 1;
+        if (setsockopt(ptv->socket, SOL_PACKET, PACKET_QDISC_BYPASS,
+                       &val, sizeof(val)) == -1) {
+            SCLogWarning(SC_ERR_AFP_CREATE,
+                    "Couldn't bypass qdisc on iface %s, error %s",
+                    devname, strerror(errno));
+        }
+    }
+
     r = bind(ptv->socket, (struct sockaddr *)&bind_address, sizeof(bind_address));
     if (r < 0) {
         if (verbose) {
@@ -2083,6 +2359,10 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
     ptv->block_size = afpconfig->block_size;
+    ptv->busy_poll = afpconfig->busy_poll;
+    ptv->spin_budget = afpconfig->spin_budget;
+    ptv->qdisc_bypass = afpconfig->qdisc_bypass;
+    ptv->tx_ring = afpconfig->tx_ring;
 
     ptv->promisc = afpconfig->promisc;
     ptv->checksum_mode = afpconfig->checksum_mode;
@@ -2111,6 +2391,21 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
     ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
             ptv->tv);
 #endif
+    ptv->capture_poll_wakeups = StatsRegisterCounter("capture.afpacket.poll_wakeups",
+            ptv->tv);
+    ptv->capture_poll_timeouts = StatsRegisterCounter("capture.afpacket.poll_timeouts",
+            ptv->tv);
+    ptv->capture_poll_spins = StatsRegisterCounter("capture.afpacket.poll_spins",
+            ptv->tv);
+
+    if (afpconfig->coalesced) {
+        int wire_size = GetIfaceMaxPacketSize(ptv->iface);
+        /* with room for two vlan tags */
+        ptv->coalesced_min = (wire_size > 0 ? (uint32_t)wire_size : 1514) + 8;
+        ptv->coalesced_inspect = afpconfig->coalesced_inspect;
+        ptv->capture_coalesced = StatsRegisterCounter("capture.afpacket.coalesced",
+                ptv->tv);
+    }
 
     ptv->copy_mode = afpconfig->copy_mode;
     if (ptv->copy_mode != AFP_COPY_MODE_NONE) {
@@ -2273,11 +2568,6 @@ TmEcode DecodeAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
 
     *data = (void *)dtv;
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
-        SCReturnInt(TM_ECODE_FAILED);
-#endif
-
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -51,12 +51,15 @@
 #define AFP_TPACKET_V3 (1<<4)
 #define AFP_VLAN_DISABLED (1<<5)
 #define AFP_MMAP_LOCKED (1<<6)
+#define AFP_BATCH_MODE (1<<7)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
 #define AFP_COPY_MODE_IPS   2
 
 #define AFP_FILE_MAX_PKTS 256
+/** max number of packets handed to the slots as one vector in batch mode */
+#define AFP_BATCH_SIZE 64
 #define AFP_IFACE_NAME_LENGTH 48
 
 /* In kernel the allocated block size is allocated using the formula
@@ -65,6 +68,10 @@
  * to standard frame size */
 #define AFP_BLOCK_SIZE_DEFAULT_ORDER 3
 
+/* min tpacket_v3 block size when accepting coalesced segments, so that a
+ * 64k segment fits in a block and isn't truncated */
+#define AFP_COALESCED_BLOCK_SIZE (128 * 1024)
+
 typedef struct AFPIfaceConfig_
 {
     char iface[AFP_IFACE_NAME_LENGTH];
@@ -78,6 +85,15 @@ typedef struct AFPIfaceConfig_
     int block_size;
     /* block timeout for tpacket_v3 in milliseconds */
     int block_timeout;
+    /* SO_BUSY_POLL time in microseconds, 0 to disable */
+    int busy_poll;
+    /* non blocking polls of an idle ring before backing off to a
+     * blocking poll, 0 to always block */
+    int spin_budget;
+    /* bypass the qdisc layer when sending in IPS/TAP mode */
+    int qdisc_bypass;
+    /* send through a mmap'ed TX ring in IPS/TAP mode */
+    int tx_ring;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -86,6 +102,10 @@ typedef struct AFPIfaceConfig_
     /* misc use flags including ring mode */
     int flags;
     int copy_mode;
+    /* accept GRO/LRO coalesced TCP segments (IDS only) */
+    int coalesced;
+    /* run packet payload inspection on coalesced segments */
+    int coalesced_inspect;
     ChecksumValidationMode checksum_mode;
     char *bpf_filter;
     char *out_iface;
@@ -109,6 +129,16 @@ typedef struct AFPPeer_ {
     struct AFPPeer_ *peer;
     TAILQ_ENTRY(AFPPeer_) next;
     char iface[AFP_IFACE_NAME_LENGTH];
+
+    /* TX ring of the socket, filled by the threads sending on it and
+     * protected by sock_protect like the socket */
+    uint8_t *tx_ring;
+    unsigned int tx_block_size;
+    unsigned int tx_frame_size;
+    unsigned int tx_frames_per_block;
+    unsigned int tx_frame_nr;
+    unsigned int tx_offset;
+    unsigned int tx_pending;
 } AFPPeer;
 
 /**
@@ -0,0 +1,874 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ *
+ * Each receive thread binds an AF_XDP socket to one queue of the
+ * interface. Frames live in a per thread UMEM area; in the single and
+ * workers runmodes packets point straight into it and the frame goes
+ * back on the fill ring when the packet is released.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "decode.h"
+#include "packet-queue.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queuehandlers.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "tmqh-packetpool.h"
+#include "source-af-xdp.h"
+#include "runmodes.h"
+
+#ifdef HAVE_AF_XDP
+
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <net/if.h>
+
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#if defined HAVE_XDP_XSK_H
+#include <xdp/xsk.h>
+#elif defined HAVE_BPF_XSK_H
+#include <bpf/xsk.h>
+#endif
+
+#endif /* HAVE_AF_XDP */
+
+#include "util-ioctl.h"
+
+#ifndef HAVE_AF_XDP
+
+TmEcode NoAFXDPSupportExit(ThreadVars *, void *, void **);
+
+void TmModuleReceiveAFXDPRegister (void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister (void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_DECODEAFXDP].Func = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+TmEcode NoAFXDPSupportExit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_AF_XDP,"Error creating thread %s: you do not have "
+            "support for AF_XDP enabled, please recompile "
+            "with --enable-af-xdp", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+#else /* We have AF_XDP support */
+
+#define POLL_TIMEOUT 100
+
+#define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
+
+#ifndef IFF_PPROMISC
+#define IFF_PPROMISC IFF_PROMISC
+#endif
+
+#define AF_XDP_FRAME_SIZE   XSK_UMEM__DEFAULT_FRAME_SIZE
+
+enum {
+    AF_XDP_OK,
+    AF_XDP_FAILURE,
+};
+
+enum {
+    AF_XDP_FLAG_ZERO_COPY = 1,
+    /* socket is bound with XDP_ZEROCOPY */
+    AF_XDP_FLAG_DRV_ZERO_COPY = 2,
+};
+
+/**
+ * \brief Module thread local variables.
+ */
+typedef struct AFXDPThreadVars_
+{
+    char iface[AF_XDP_IFACE_NAME_LENGTH];
+    int queue_id;
+
+    /* umem area and its rings */
+    void *umem_area;
+    size_t umem_size;
+    struct xsk_umem *umem;
+    struct xsk_ring_prod fill;
+    struct xsk_ring_cons comp;
+
+    /* capture socket */
+    struct xsk_socket *xsk;
+    struct xsk_ring_cons rx;
+
+    /* output socket for tap and ips mode, shares the umem */
+    struct xsk_socket *out_xsk;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_prod out_fill;
+    struct xsk_ring_cons out_comp;
+    uint32_t tx_pending;
+
+    /* frames owned by us that are not on the fill ring */
+    uint64_t *stash;
+    uint32_t stash_cnt;
+
+    uint32_t frames;
+    uint32_t batch;
+    int flags;
+    struct bpf_program bpf_prog;
+
+    TmSlot *slot;
+    ThreadVars *tv;
+    LiveDevice *livedev;
+
+    /* copy from config */
+    int copy_mode;
+    ChecksumValidationMode checksum_mode;
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t drops;
+    /* kernel side drops as of the last stats read */
+    uint64_t kernel_drops;
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+} AFXDPThreadVars;
+
+static inline void AFXDPFrameRelease(AFXDPThreadVars *xtv, uint64_t addr)
+{
+    /* the stash can hold every frame, so this can't overflow */
+    xtv->stash[xtv->stash_cnt++] = xsk_umem__extract_addr(addr);
+}
+
+/**
+ * \brief Hand the stashed frames back to the kernel.
+ */
+static void AFXDPFillRingRefill(AFXDPThreadVars *xtv)
+{
+    uint32_t idx = 0;
+
+    if (xtv->stash_cnt == 0)
+        return;
+
+    uint32_t n = xsk_prod_nb_free(&xtv->fill, xtv->stash_cnt);
+    if (n > xtv->stash_cnt)
+        n = xtv->stash_cnt;
+    if (n == 0)
+        return;
+
+    n = xsk_ring_prod__reserve(&xtv->fill, n, &idx);
+    for (uint32_t i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&xtv->fill, idx++) =
+            xtv->stash[--xtv->stash_cnt];
+    }
+    xsk_ring_prod__submit(&xtv->fill, n);
+}
+
+/**
+ * \brief Kick the tx queue and reclaim the frames the kernel is done with.
+ */
+static void AFXDPTxComplete(AFXDPThreadVars *xtv)
+{
+    uint32_t idx = 0;
+
+    if (xtv->tx_pending == 0)
+        return;
+
+    if (xsk_ring_prod__needs_wakeup(&xtv->tx)) {
+        if (sendto(xsk_socket__fd(xtv->out_xsk), NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+            errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+            SCLogDebug("tx kick failed: %s", strerror(errno));
+        }
+    }
+
+    uint32_t n = xsk_ring_cons__peek(&xtv->out_comp, xtv->batch, &idx);
+    for (uint32_t i = 0; i < n; i++) {
+        AFXDPFrameRelease(xtv, *xsk_ring_cons__comp_addr(&xtv->out_comp, idx++));
+    }
+    xsk_ring_cons__release(&xtv->out_comp, n);
+    xtv->tx_pending -= n;
+}
+
+/**
+ * \brief Put a frame on the tx ring of the output socket.
+ */
+static void AFXDPWriteFrame(AFXDPThreadVars *xtv, uint64_t addr, uint32_t len)
+{
+    uint32_t idx = 0;
+
+    if (xsk_ring_prod__reserve(&xtv->tx, 1, &idx) != 1) {
+        xtv->drops++;
+        AFXDPFrameRelease(xtv, addr);
+        return;
+    }
+
+    struct xdp_desc *desc = xsk_ring_prod__tx_desc(&xtv->tx, idx);
+    desc->addr = addr;
+    desc->len = len;
+    xsk_ring_prod__submit(&xtv->tx, 1);
+    xtv->tx_pending++;
+}
+
+/**
+ * \brief Packet release routine for zero copy packets.
+ *
+ * Runs in the capture thread as zero copy is only used in runmodes
+ * where the whole pipeline is in one thread.
+ * \param p Packet.
+ */
+static void AFXDPReleasePacket(Packet *p)
+{
+    AFXDPThreadVars *xtv = (AFXDPThreadVars *)p->afxdp_v.xtv;
+
+    /* Need to be in copy mode and need to detect early release
+       where Ethernet header could not be set (and pseudo packet) */
+    if (xtv->copy_mode != AF_XDP_COPY_MODE_NONE && !PKT_IS_PSEUDOPKT(p) &&
+        !(xtv->copy_mode == AF_XDP_COPY_MODE_IPS && PACKET_TEST_ACTION(p, ACTION_DROP))) {
+        AFXDPWriteFrame(xtv, p->afxdp_v.addr, GET_PKT_LEN(p));
+    } else {
+        AFXDPFrameRelease(xtv, p->afxdp_v.addr);
+    }
+
+    PacketFreeOrRelease(p);
+}
+
+static inline void AFXDPDumpCounters(AFXDPThreadVars *xtv)
+{
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+
+    if (getsockopt(xsk_socket__fd(xtv->xsk), SOL_XDP, XDP_STATISTICS,
+                   &stats, &len) == 0) {
+        /* kernel counters are totals since the socket was bound */
+        xtv->drops += stats.rx_dropped - xtv->kernel_drops;
+        xtv->kernel_drops = stats.rx_dropped;
+    }
+
+    StatsAddUI64(xtv->tv, xtv->capture_kernel_packets, xtv->pkts);
+    StatsAddUI64(xtv->tv, xtv->capture_kernel_drops, xtv->drops);
+    (void) SC_ATOMIC_ADD(xtv->livedev->drop, xtv->drops);
+    (void) SC_ATOMIC_ADD(xtv->livedev->pkts, xtv->pkts);
+    xtv->drops = 0;
+    xtv->pkts = 0;
+}
+
+static int AFXDPCheckIface(const char *iface, int promisc)
+{
+    int if_flags = GetIfaceFlags(iface);
+    if (if_flags == -1) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Can not access to interface '%s'",
+                   iface);
+        return -1;
+    }
+    if ((if_flags & IFF_UP) == 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Interface '%s' is down", iface);
+        return -1;
+    }
+    /* if needed, try to set iface in promisc mode */
+    if (promisc && (if_flags & (IFF_PROMISC|IFF_PPROMISC)) == 0) {
+        if_flags |= IFF_PPROMISC;
+        SetIfaceFlags(iface, if_flags);
+    }
+    return 0;
+}
+
+static int AFXDPUmemCreate(AFXDPThreadVars *xtv)
+{
+    struct xsk_umem_config cfg = {
+        .fill_size = xtv->frames,
+        .comp_size = xtv->frames,
+        .frame_size = AF_XDP_FRAME_SIZE,
+        .frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+        .flags = 0,
+    };
+
+    xtv->umem_size = (size_t)xtv->frames * AF_XDP_FRAME_SIZE;
+    xtv->umem_area = mmap(NULL, xtv->umem_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xtv->umem_area == MAP_FAILED) {
+        xtv->umem_area = NULL;
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate %"PRIuMAX" bytes "
+                   "of umem: %s", (uintmax_t)xtv->umem_size, strerror(errno));
+        return -1;
+    }
+
+    int r = xsk_umem__create(&xtv->umem, xtv->umem_area, xtv->umem_size,
+                             &xtv->fill, &xtv->comp, &cfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to create umem: %s",
+                   strerror(-r));
+        munmap(xtv->umem_area, xtv->umem_size);
+        xtv->umem_area = NULL;
+        return -1;
+    }
+
+    xtv->stash = SCMalloc(xtv->frames * sizeof(uint64_t));
+    if (unlikely(xtv->stash == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        return -1;
+    }
+    for (uint32_t i = 0; i < xtv->frames; i++) {
+        xtv->stash[i] = (uint64_t)i * AF_XDP_FRAME_SIZE;
+    }
+    xtv->stash_cnt = xtv->frames;
+    return 0;
+}
+
+static int AFXDPSocketCreate(AFXDPThreadVars *xtv, AFXDPIfaceConfig *xconf)
+{
+    struct xsk_socket_config cfg;
+    int r;
+
+    memset(&cfg, 0, sizeof(cfg));
+    /* in ips mode every rx frame can end up on the tx ring */
+    cfg.rx_size = xtv->frames / 2;
+    cfg.tx_size = xtv->frames / 2;
+    cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
+    if (xconf->xdp_mode == AF_XDP_MODE_DRV)
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+    else if (xconf->xdp_mode == AF_XDP_MODE_SKB)
+        cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+
+    cfg.bind_flags = XDP_USE_NEED_WAKEUP;
+    if (xconf->zero_copy == AF_XDP_ZC_OFF) {
+        cfg.bind_flags |= XDP_COPY;
+    } else {
+        cfg.bind_flags |= XDP_ZEROCOPY;
+    }
+
+    r = xsk_socket__create(&xtv->xsk, xtv->iface, xtv->queue_id, xtv->umem,
+                           &xtv->rx, NULL, &cfg);
+    if (r != 0 && xconf->zero_copy == AF_XDP_ZC_AUTO) {
+        SCLogPerf("%s: queue %d does not support zero copy binding, "
+                  "falling back to copy mode", xtv->iface, xtv->queue_id);
+        cfg.bind_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+        r = xsk_socket__create(&xtv->xsk, xtv->iface, xtv->queue_id, xtv->umem,
+                               &xtv->rx, NULL, &cfg);
+    } else if (r == 0) {
+        xtv->flags |= AF_XDP_FLAG_DRV_ZERO_COPY;
+    }
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to create AF_XDP socket on "
+                   "%s queue %d: %s", xtv->iface, xtv->queue_id, strerror(-r));
+        return -1;
+    }
+
+    if (xtv->copy_mode != AF_XDP_COPY_MODE_NONE) {
+        /* the output socket only transmits */
+        cfg.bind_flags = XDP_USE_NEED_WAKEUP;
+        r = xsk_socket__create_shared(&xtv->out_xsk, xconf->out_iface,
+                                      xtv->queue_id, xtv->umem, NULL, &xtv->tx,
+                                      &xtv->out_fill, &xtv->out_comp, &cfg);
+        if (r != 0) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to create AF_XDP socket on "
+                       "%s queue %d: %s", xconf->out_iface, xtv->queue_id,
+                       strerror(-r));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void AFXDPClose(AFXDPThreadVars *xtv)
+{
+    if (xtv->out_xsk != NULL) {
+        xsk_socket__delete(xtv->out_xsk);
+        xtv->out_xsk = NULL;
+    }
+    if (xtv->xsk != NULL) {
+        xsk_socket__delete(xtv->xsk);
+        xtv->xsk = NULL;
+    }
+    if (xtv->umem != NULL) {
+        (void)xsk_umem__delete(xtv->umem);
+        xtv->umem = NULL;
+    }
+    if (xtv->umem_area != NULL) {
+        munmap(xtv->umem_area, xtv->umem_size);
+        xtv->umem_area = NULL;
+    }
+    if (xtv->stash != NULL) {
+        SCFree(xtv->stash);
+        xtv->stash = NULL;
+    }
+}
+
+/**
+ * \brief Init function for ReceiveAFXDP.
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with AFXDPThreadVars
+ */
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    AFXDPIfaceConfig *xconf = initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    AFXDPThreadVars *xtv = SCMalloc(sizeof(*xtv));
+    if (unlikely(xtv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+    memset(xtv, 0, sizeof(*xtv));
+
+    xtv->tv = tv;
+    strlcpy(xtv->iface, xconf->iface, sizeof(xtv->iface));
+    xtv->checksum_mode = xconf->checksum_mode;
+    xtv->copy_mode = xconf->copy_mode;
+    xtv->frames = xconf->frames;
+    xtv->batch = xconf->batch;
+    xtv->queue_id = xconf->queue_start + (int)(SC_ATOMIC_ADD(xconf->queue_next, 1) - 1);
+
+    xtv->livedev = LiveGetDevice(xconf->iface);
+    if (xtv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error_xtv;
+    }
+
+    /* frames are handed to the next thread by pointer only when the
+     * whole pipeline runs in the capture thread */
+    if (RunmodeAllowsZeroCopy()) {
+        xtv->flags |= AF_XDP_FLAG_ZERO_COPY;
+    } else if (xtv->copy_mode != AF_XDP_COPY_MODE_NONE) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "AF_XDP copy-mode on %s needs the "
+                   "single or workers runmode", xtv->iface);
+        goto error_xtv;
+    }
+
+    if (AFXDPCheckIface(xtv->iface, xconf->promisc) != 0) {
+        goto error_xtv;
+    }
+    if (xtv->copy_mode != AF_XDP_COPY_MODE_NONE &&
+        AFXDPCheckIface(xconf->out_iface, xconf->promisc) != 0) {
+        goto error_xtv;
+    }
+
+    if (AFXDPUmemCreate(xtv) != 0) {
+        goto error_close;
+    }
+    if (AFXDPSocketCreate(xtv, xconf) != 0) {
+        goto error_close;
+    }
+    AFXDPFillRingRefill(xtv);
+
+    SCLogPerf("%s: bound to queue %d (%s binding%s)", xtv->iface, xtv->queue_id,
+              (xtv->flags & AF_XDP_FLAG_DRV_ZERO_COPY) ? "zero copy" : "copy",
+              (xtv->flags & AF_XDP_FLAG_ZERO_COPY) ? ", zero copy packets" : "");
+
+    /* basic counters */
+    xtv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            xtv->tv);
+    xtv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            xtv->tv);
+
+    if (xconf->bpf_filter) {
+        SCLogConfig("Using BPF '%s' on iface '%s'",
+                  xconf->bpf_filter, xtv->iface);
+        if (pcap_compile_nopcap(default_packet_size,  /* snaplen_arg */
+                    LINKTYPE_ETHERNET,    /* linktype_arg */
+                    &xtv->bpf_prog,       /* program */
+                    xconf->bpf_filter,    /* const char *buf */
+                    1,                    /* optimize */
+                    PCAP_NETMASK_UNKNOWN  /* mask */
+                    ) == -1)
+        {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Filter compilation failed.");
+            goto error_close;
+        }
+    }
+
+    *data = (void *)xtv;
+    xconf->DerefFunc(xconf);
+    SCReturnInt(TM_ECODE_OK);
+
+error_close:
+    AFXDPClose(xtv);
+error_xtv:
+    SCFree(xtv);
+error:
+    xconf->DerefFunc(xconf);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ * \brief Read a batch of frames from the rx ring and pass them further.
+ * \param xtv Thread local variables.
+ */
+static int AFXDPRingRead(AFXDPThreadVars *xtv)
+{
+    SCEnter();
+
+    uint32_t idx = 0;
+    uint32_t n = xsk_ring_cons__peek(&xtv->rx, xtv->batch, &idx);
+    if (n == 0) {
+        SCReturnInt(AF_XDP_OK);
+    }
+
+    if (!(xtv->flags & AF_XDP_FLAG_ZERO_COPY)) {
+        PacketPoolWaitForN(n);
+    }
+
+    struct timeval ts;
+    gettimeofday(&ts, NULL);
+
+    int ret = AF_XDP_OK;
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&xtv->rx, idx + i);
+        uint8_t *frame_data = xsk_umem__get_data(xtv->umem_area, desc->addr);
+
+        if (xtv->bpf_prog.bf_len) {
+            struct pcap_pkthdr pkthdr = { {0, 0}, desc->len, desc->len };
+            if (pcap_offline_filter(&xtv->bpf_prog, &pkthdr, frame_data) == 0) {
+                /* rejected by bpf */
+                AFXDPFrameRelease(xtv, desc->addr);
+                continue;
+            }
+        }
+
+        Packet *p = PacketPoolGetPacket();
+        if (unlikely(p == NULL)) {
+            ret = AF_XDP_FAILURE;
+            break;
+        }
+
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+        p->livedev = xtv->livedev;
+        p->datalink = LINKTYPE_ETHERNET;
+        p->ts = ts;
+        xtv->pkts++;
+        xtv->bytes += desc->len;
+
+        /* checksum validation */
+        if (xtv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (xtv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+            if (xtv->livedev->ignore_checksum) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (ChecksumAutoModeCheckDevice(xtv->pkts, xtv->livedev)) {
+                xtv->livedev->ignore_checksum = 1;
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+        }
+
+        if (xtv->flags & AF_XDP_FLAG_ZERO_COPY) {
+            if (PacketSetData(p, frame_data, desc->len) == -1) {
+                AFXDPFrameRelease(xtv, desc->addr);
+                TmqhOutputPacketpool(xtv->tv, p);
+                ret = AF_XDP_FAILURE;
+                i++;
+                break;
+            }
+            p->ReleasePacket = AFXDPReleasePacket;
+            p->afxdp_v.addr = desc->addr;
+            p->afxdp_v.xtv = xtv;
+        } else {
+            int r = PacketCopyData(p, frame_data, desc->len);
+            /* the frame can go back right away */
+            AFXDPFrameRelease(xtv, desc->addr);
+            if (r == -1) {
+                TmqhOutputPacketpool(xtv->tv, p);
+                ret = AF_XDP_FAILURE;
+                i++;
+                break;
+            }
+        }
+
+        SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+                   GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+        if (TmThreadsSlotProcessPkt(xtv->tv, xtv->slot, p) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(xtv->tv, p);
+            ret = AF_XDP_FAILURE;
+            i++;
+            break;
+        }
+    }
+    /* frames not looked at stay on the ring for the next round */
+    xsk_ring_cons__release(&xtv->rx, i);
+
+    SCReturnInt(ret);
+}
+
+/**
+ *  \brief Main AF_XDP reading loop function
+ */
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    TmSlot *s = (TmSlot *)slot;
+    AFXDPThreadVars *xtv = (AFXDPThreadVars *)data;
+    struct pollfd fds;
+
+    xtv->slot = s->slot_next;
+
+    fds.fd = xsk_socket__fd(xtv->xsk);
+    fds.events = POLLIN;
+
+    for(;;) {
+        if (suricata_ctl_flags != 0) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        /* frames released during the last round go back first, the
+         * kernel drops if the fill ring is empty */
+        AFXDPFillRingRefill(xtv);
+
+        int r = poll(&fds, 1, POLL_TIMEOUT);
+
+        if (r < 0) {
+            /* error */
+            if (errno != EINTR)
+                SCLogError(SC_ERR_AF_XDP_READ,
+                           "Error polling AF_XDP from iface '%s': (%d" PRIu32 ") %s",
+                           xtv->iface, errno, strerror(errno));
+            continue;
+        } else if (r == 0) {
+            /* no events, timeout */
+            SCLogDebug("(%s:%d) Poll timeout", xtv->iface, xtv->queue_id);
+
+            AFXDPTxComplete(xtv);
+
+            /* poll timed out, lets see if we need to inject a fake packet  */
+            TmThreadsCaptureInjectPacket(tv, xtv->slot, NULL);
+            continue;
+        }
+
+        if (fds.revents & POLL_EVENTS) {
+            if (fds.revents & POLLERR) {
+                SCLogError(SC_ERR_AF_XDP_READ,
+                           "Error reading data from iface '%s': (%d" PRIu32 ") %s",
+                           xtv->iface, errno, strerror(errno));
+            } else if (fds.revents & POLLNVAL) {
+                SCLogError(SC_ERR_AF_XDP_READ,
+                           "Invalid polling request");
+            }
+            continue;
+        }
+
+        if (likely(fds.revents & POLLIN)) {
+            /* drain the ring in batches, refilling in between */
+            uint32_t rounds = xtv->frames / xtv->batch;
+            while (rounds-- > 0 && xsk_cons_nb_avail(&xtv->rx, 1) > 0) {
+                if (AFXDPRingRead(xtv) != AF_XDP_OK)
+                    break;
+                AFXDPFillRingRefill(xtv);
+                AFXDPTxComplete(xtv);
+            }
+        }
+
+        AFXDPDumpCounters(xtv);
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for xtv
+ */
+static void ReceiveAFXDPThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    AFXDPThreadVars *xtv = (AFXDPThreadVars *)data;
+
+    AFXDPDumpCounters(xtv);
+    SCLogPerf("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 ", bytes %" PRIu64 "",
+              tv->name,
+              StatsGetLocalCounterValue(tv, xtv->capture_kernel_packets),
+              StatsGetLocalCounterValue(tv, xtv->capture_kernel_drops),
+              xtv->bytes);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to AFXDPThreadVars.
+ */
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    AFXDPThreadVars *xtv = (AFXDPThreadVars *)data;
+
+    AFXDPClose(xtv);
+    if (xtv->bpf_prog.bf_insns) {
+        pcap_freecode(&xtv->bpf_prog);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Prepare AF_XDP decode thread.
+ * \param tv Thread local avariables.
+ * \param initdata Thread config.
+ * \param data Pointer to DecodeThreadVars placed here.
+ */
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = NULL;
+
+    dtv = DecodeThreadVarsAlloc(tv);
+
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars for dtv
+ * \param pq pointer to the current PacketQueue
+ * \param postpq
+ */
+static TmEcode DecodeAFXDP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to DecodeThreadVars.
+ */
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Registration Function for ReceiveAFXDP.
+ */
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = ReceiveAFXDPThreadInit;
+    tmm_modules[TMM_RECEIVEAFXDP].Func = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqLoop = ReceiveAFXDPLoop;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = ReceiveAFXDPThreadExitStats;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = ReceiveAFXDPThreadDeinit;
+    tmm_modules[TMM_RECEIVEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = SC_CAP_NET_RAW | SC_CAP_NET_ADMIN;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = DecodeAFXDPThreadInit;
+    tmm_modules[TMM_DECODEAFXDP].Func = DecodeAFXDP;
+    tmm_modules[TMM_DECODEAFXDP].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = DecodeAFXDPThreadDeinit;
+    tmm_modules[TMM_DECODEAFXDP].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+#endif /* HAVE_AF_XDP */
+/* eof */
@@ -0,0 +1,89 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ */
+
+#ifndef __SOURCE_AF_XDP_H__
+#define __SOURCE_AF_XDP_H__
+
+/* copy modes */
+enum {
+    AF_XDP_COPY_MODE_NONE,
+    AF_XDP_COPY_MODE_TAP,
+    AF_XDP_COPY_MODE_IPS,
+};
+
+/* xdp attach modes */
+enum {
+    AF_XDP_MODE_AUTO,
+    AF_XDP_MODE_DRV,
+    AF_XDP_MODE_SKB,
+};
+
+/* zero copy binding */
+enum {
+    AF_XDP_ZC_AUTO,
+    AF_XDP_ZC_ON,
+    AF_XDP_ZC_OFF,
+};
+
+#define AF_XDP_IFACE_NAME_LENGTH    48
+
+#define AF_XDP_DEFAULT_FRAMES       4096
+#define AF_XDP_DEFAULT_BATCH        64
+
+typedef struct AFXDPIfaceConfig_
+{
+    char iface[AF_XDP_IFACE_NAME_LENGTH];
+    char out_iface[AF_XDP_IFACE_NAME_LENGTH];
+
+    int threads;
+    /* first queue id to bind to */
+    int queue_start;
+    int promisc;
+    int copy_mode;
+    int xdp_mode;
+    int zero_copy;
+    /* number of umem frames per queue */
+    uint32_t frames;
+    /* max descriptors handled per ring operation */
+    uint32_t batch;
+    ChecksumValidationMode checksum_mode;
+    char *bpf_filter;
+
+    /* queue id of the next thread */
+    SC_ATOMIC_DECLARE(unsigned int, queue_next);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} AFXDPIfaceConfig;
+
+typedef struct AFXDPPacketVars_
+{
+    /* umem address of the frame holding the packet */
+    uint64_t addr;
+    /* AFXDPThreadVars */
+    void *xtv;
+} AFXDPPacketVars;
+
+void TmModuleReceiveAFXDPRegister (void);
+void TmModuleDecodeAFXDPRegister (void);
+
+#endif /* __SOURCE_AF_XDP_H__ */
@@ -0,0 +1,625 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DPDK poll mode acquisition support
+ *
+ * Each receive thread owns one rx and one tx queue of its port, ports
+ * are set up by the runmode. In the single and workers runmodes the
+ * packet data points into the mbuf, which is freed or transmitted on
+ * the copy-iface when the packet is released.
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "suricata.h"
+#include "decode.h"
+#include "packet-queue.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-queuehandlers.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "tmqh-packetpool.h"
+#include "source-dpdk.h"
+#include "runmodes.h"
+
+#ifdef HAVE_DPDK
+#include <rte_version.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#endif /* HAVE_DPDK */
+
+#ifndef HAVE_DPDK
+
+TmEcode NoDPDKSupportExit(ThreadVars *, void *, void **);
+
+void TmModuleReceiveDPDKRegister (void)
+{
+    tmm_modules[TMM_RECEIVEDPDK].name = "ReceiveDPDK";
+    tmm_modules[TMM_RECEIVEDPDK].ThreadInit = NoDPDKSupportExit;
+    tmm_modules[TMM_RECEIVEDPDK].Func = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadDeinit = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].cap_flags = 0;
+    tmm_modules[TMM_RECEIVEDPDK].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeDPDK.
+ */
+void TmModuleDecodeDPDKRegister (void)
+{
+    tmm_modules[TMM_DECODEDPDK].name = "DecodeDPDK";
+    tmm_modules[TMM_DECODEDPDK].ThreadInit = NoDPDKSupportExit;
+    tmm_modules[TMM_DECODEDPDK].Func = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadDeinit = NULL;
+    tmm_modules[TMM_DECODEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEDPDK].cap_flags = 0;
+    tmm_modules[TMM_DECODEDPDK].flags = TM_FLAG_DECODE_TM;
+}
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+TmEcode NoDPDKSupportExit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_DPDK,"Error creating thread %s: you do not have "
+            "support for DPDK enabled, please recompile "
+            "with --enable-dpdk", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+#else /* We have DPDK support */
+
+/** empty polls before we look at the injection, counters and
+ *  shutdown flags. At 100G this is a few microseconds. */
+#define DPDK_IDLE_POLLS         1024
+/** bursts between port statistics reads */
+#define DPDK_STATS_INTERVAL     8192
+
+enum {
+    DPDK_OK,
+    DPDK_FAILURE,
+};
+
+enum {
+    DPDK_FLAG_ZERO_COPY = 1,
+};
+
+/**
+ * \brief Module thread local variables.
+ */
+typedef struct DPDKThreadVars_
+{
+    char iface[DPDK_IFACE_NAME_LENGTH];
+    uint16_t port_id;
+    uint16_t out_port_id;
+    uint16_t queue_id;
+    uint16_t burst;
+
+    int flags;
+    struct bpf_program bpf_prog;
+
+    /* packets waiting for the tx burst to the copy-iface */
+    struct rte_mbuf *tx_pkts[DPDK_MAX_BURST];
+    uint16_t tx_cnt;
+
+    TmSlot *slot;
+    ThreadVars *tv;
+    LiveDevice *livedev;
+
+    /* copy from config */
+    int copy_mode;
+    ChecksumValidationMode checksum_mode;
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t drops;
+    /* port drops as of the last stats read, queue 0 thread only */
+    uint64_t port_drops;
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+} DPDKThreadVars;
+
+/**
+ * \brief Send the pending packets out on our tx queue of the copy-iface.
+ */
+static void DPDKTxFlush(DPDKThreadVars *dtv)
+{
+    if (dtv->tx_cnt == 0)
+        return;
+
+    uint16_t sent = rte_eth_tx_burst(dtv->out_port_id, dtv->queue_id,
+                                     dtv->tx_pkts, dtv->tx_cnt);
+    if (unlikely(sent < dtv->tx_cnt)) {
+        dtv->drops += dtv->tx_cnt - sent;
+        for (uint16_t i = sent; i < dtv->tx_cnt; i++) {
+            rte_pktmbuf_free(dtv->tx_pkts[i]);
+        }
+    }
+    dtv->tx_cnt = 0;
+}
+
+/**
+ * \brief Packet release routine.
+ *
+ * Runs in the capture thread as mbufs are only attached to packets
+ * in runmodes where the whole pipeline is in one thread.
+ * \param p Packet.
+ */
+static void DPDKReleasePacket(Packet *p)
+{
+    DPDKThreadVars *dtv = (DPDKThreadVars *)p->dpdk_v.dtv;
+    struct rte_mbuf *m = (struct rte_mbuf *)p->dpdk_v.mbuf;
+
+    /* Need to be in copy mode and need to detect early release
+       where Ethernet header could not be set (and pseudo packet) */
+    if (dtv->copy_mode != DPDK_COPY_MODE_NONE && !PKT_IS_PSEUDOPKT(p) &&
+        !(dtv->copy_mode == DPDK_COPY_MODE_IPS && PACKET_TEST_ACTION(p, ACTION_DROP))) {
+        dtv->tx_pkts[dtv->tx_cnt++] = m;
+        if (dtv->tx_cnt == dtv->burst) {
+            DPDKTxFlush(dtv);
+        }
+    } else {
+        rte_pktmbuf_free(m);
+    }
+    p->dpdk_v.mbuf = NULL;
+
+    PacketFreeOrRelease(p);
+}
+
+static inline void DPDKDumpCounters(DPDKThreadVars *dtv, int port_stats)
+{
+    /* rx drops are only counted per port */
+    if (port_stats && dtv->queue_id == 0) {
+        struct rte_eth_stats stats;
+        if (rte_eth_stats_get(dtv->port_id, &stats) == 0) {
+            uint64_t port_drops = stats.imissed + stats.rx_nombuf;
+            dtv->drops += port_drops - dtv->port_drops;
+            dtv->port_drops = port_drops;
+        }
+    }
+
+    StatsAddUI64(dtv->tv, dtv->capture_kernel_packets, dtv->pkts);
+    StatsAddUI64(dtv->tv, dtv->capture_kernel_drops, dtv->drops);
+    (void) SC_ATOMIC_ADD(dtv->livedev->drop, dtv->drops);
+    (void) SC_ATOMIC_ADD(dtv->livedev->pkts, dtv->pkts);
+    dtv->drops = 0;
+    dtv->pkts = 0;
+}
+
+/**
+ * \brief Init function for ReceiveDPDK.
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with DPDKThreadVars
+ */
+static TmEcode ReceiveDPDKThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    DPDKIfaceConfig *dconf = initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    DPDKThreadVars *dtv = SCMalloc(sizeof(*dtv));
+    if (unlikely(dtv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+    memset(dtv, 0, sizeof(*dtv));
+
+    dtv->tv = tv;
+    strlcpy(dtv->iface, dconf->iface, sizeof(dtv->iface));
+    dtv->port_id = dconf->port_id;
+    dtv->out_port_id = dconf->out_port_id;
+    dtv->checksum_mode = dconf->checksum_mode;
+    dtv->copy_mode = dconf->copy_mode;
+    dtv->burst = dconf->burst;
+    dtv->queue_id = (uint16_t)(SC_ATOMIC_ADD(dconf->queue_next, 1) - 1);
+
+    dtv->livedev = LiveGetDevice(dconf->iface);
+    if (dtv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error_dtv;
+    }
+
+    /* mbufs stay attached to the packets only when the whole pipeline
+     * runs in the capture thread */
+    if (RunmodeAllowsZeroCopy()) {
+        dtv->flags |= DPDK_FLAG_ZERO_COPY;
+    } else if (dtv->copy_mode != DPDK_COPY_MODE_NONE) {
+        SCLogError(SC_ERR_DPDK_CONFIG, "DPDK copy-mode on %s needs the "
+                   "single or workers runmode", dtv->iface);
+        goto error_dtv;
+    }
+
+#if RTE_VERSION >= RTE_VERSION_NUM(21, 11, 0, 0)
+    /* gives us a lcore id, so the mempool per lcore cache is used */
+    if (rte_thread_register() != 0) {
+        SCLogWarning(SC_ERR_DPDK_CONFIG, "%s: unable to register thread "
+                     "with the EAL: %s", dtv->iface, rte_strerror(rte_errno));
+    }
+#endif
+
+    /* basic counters */
+    dtv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            dtv->tv);
+    dtv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            dtv->tv);
+
+    if (dconf->bpf_filter) {
+        SCLogConfig("Using BPF '%s' on iface '%s'",
+                  dconf->bpf_filter, dtv->iface);
+        if (pcap_compile_nopcap(default_packet_size,  /* snaplen_arg */
+                    LINKTYPE_ETHERNET,    /* linktype_arg */
+                    &dtv->bpf_prog,       /* program */
+                    dconf->bpf_filter,    /* const char *buf */
+                    1,                    /* optimize */
+                    PCAP_NETMASK_UNKNOWN  /* mask */
+                    ) == -1)
+        {
+            SCLogError(SC_ERR_DPDK_CONFIG, "Filter compilation failed.");
+            goto error_dtv;
+        }
+    }
+
+    SCLogPerf("%s: thread reading port %u queue %u%s", dtv->iface,
+              dtv->port_id, dtv->queue_id,
+              (dtv->flags & DPDK_FLAG_ZERO_COPY) ? " (zero copy)" : "");
+
+    *data = (void *)dtv;
+    dconf->DerefFunc(dconf);
+    SCReturnInt(TM_ECODE_OK);
+
+error_dtv:
+    SCFree(dtv);
+error:
+    dconf->DerefFunc(dconf);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+static int DPDKCopyMbuf(Packet *p, struct rte_mbuf *m)
+{
+    uint32_t offset = 0;
+
+    for (; m != NULL; m = m->next) {
+        if (PacketCopyDataOffset(p, offset, rte_pktmbuf_mtod(m, uint8_t *),
+                                 rte_pktmbuf_data_len(m)) == -1)
+            return -1;
+        offset += rte_pktmbuf_data_len(m);
+    }
+    return 0;
+}
+
+/**
+ * \brief Pass a burst of mbufs further.
+ * \param dtv Thread local variables.
+ */
+static int DPDKProcessBurst(DPDKThreadVars *dtv, struct rte_mbuf **mbufs, uint16_t n)
+{
+    SCEnter();
+
+    struct timeval ts;
+    gettimeofday(&ts, NULL);
+
+    uint16_t i;
+    for (i = 0; i < n; i++) {
+        struct rte_mbuf *m = mbufs[i];
+        uint8_t *data = rte_pktmbuf_mtod(m, uint8_t *);
+        uint32_t len = rte_pktmbuf_pkt_len(m);
+
+        if (i + 1 < n) {
+            rte_prefetch0(rte_pktmbuf_mtod(mbufs[i + 1], void *));
+        }
+
+        if (dtv->bpf_prog.bf_len) {
+            struct pcap_pkthdr pkthdr = { {0, 0}, len, rte_pktmbuf_data_len(m) };
+            if (pcap_offline_filter(&dtv->bpf_prog, &pkthdr, data) == 0) {
+                /* rejected by bpf */
+                rte_pktmbuf_free(m);
+                continue;
+            }
+        }
+
+        Packet *p = PacketPoolGetPacket();
+        if (unlikely(p == NULL)) {
+            break;
+        }
+
+        PKT_SET_SRC(p, PKT_SRC_WIRE);
+        p->livedev = dtv->livedev;
+        p->datalink = LINKTYPE_ETHERNET;
+        p->ts = ts;
+        dtv->pkts++;
+        dtv->bytes += len;
+
+        /* checksum validation */
+        if (dtv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (dtv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+            if (dtv->livedev->ignore_checksum) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (ChecksumAutoModeCheckDevice(dtv->pkts, dtv->livedev)) {
+                dtv->livedev->ignore_checksum = 1;
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+        }
+
+        int r;
+        if (dtv->flags & DPDK_FLAG_ZERO_COPY) {
+            /* chained mbufs are copied, but the mbuf stays with the
+             * packet for the copy-iface */
+            if (m->nb_segs == 1) {
+                r = PacketSetData(p, data, len);
+            } else {
+                r = DPDKCopyMbuf(p, m);
+            }
+            p->ReleasePacket = DPDKReleasePacket;
+            p->dpdk_v.mbuf = m;
+            p->dpdk_v.dtv = dtv;
+        } else {
+            r = DPDKCopyMbuf(p, m);
+            rte_pktmbuf_free(m);
+        }
+        if (r == -1) {
+            TmqhOutputPacketpool(dtv->tv, p);
+            i++;
+            break;
+        }
+
+        SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+                   GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+        if (TmThreadsSlotProcessPkt(dtv->tv, dtv->slot, p) != TM_ECODE_OK) {
+            TmqhOutputPacketpool(dtv->tv, p);
+            i++;
+            break;
+        }
+    }
+
+    if (unlikely(i < n)) {
+        /* out of packets or a failure: the rest of the burst is lost */
+        dtv->drops += n - i;
+        for (; i < n; i++) {
+            rte_pktmbuf_free(mbufs[i]);
+        }
+        SCReturnInt(DPDK_FAILURE);
+    }
+
+    SCReturnInt(DPDK_OK);
+}
+
+/**
+ *  \brief Main DPDK polling loop function
+ */
+static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    TmSlot *s = (TmSlot *)slot;
+    DPDKThreadVars *dtv = (DPDKThreadVars *)data;
+    struct rte_mbuf *mbufs[DPDK_MAX_BURST];
+    uint32_t idle = 0;
+    uint32_t bursts = 0;
+
+    dtv->slot = s->slot_next;
+
+    for(;;) {
+        uint16_t n = rte_eth_rx_burst(dtv->port_id, dtv->queue_id,
+                                      mbufs, dtv->burst);
+        if (n == 0) {
+            DPDKTxFlush(dtv);
+            if (++idle < DPDK_IDLE_POLLS) {
+                rte_pause();
+                continue;
+            }
+            idle = 0;
+
+            if (suricata_ctl_flags != 0) {
+                break;
+            }
+
+            /* no traffic, lets see if we need to inject a fake packet */
+            TmThreadsCaptureInjectPacket(tv, dtv->slot, NULL);
+            DPDKDumpCounters(dtv, 1);
+            StatsSyncCountersIfSignalled(tv);
+            continue;
+        }
+        idle = 0;
+
+        /* make sure we have enough packets in the packet pool, to
+         * prevent us from alloc'ing packets at line rate */
+        if (!(dtv->flags & DPDK_FLAG_ZERO_COPY)) {
+            PacketPoolWaitForN(n);
+        } else {
+            PacketPoolWait();
+        }
+
+        DPDKProcessBurst(dtv, mbufs, n);
+        DPDKTxFlush(dtv);
+
+        if ((++bursts % DPDK_STATS_INTERVAL) == 0) {
+            if (suricata_ctl_flags != 0) {
+                break;
+            }
+            DPDKDumpCounters(dtv, 1);
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    DPDKTxFlush(dtv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into DPDKThreadVars for dtv
+ */
+static void ReceiveDPDKThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    DPDKThreadVars *dtv = (DPDKThreadVars *)data;
+
+    DPDKDumpCounters(dtv, 1);
+    SCLogPerf("(%s) Port: Packets %" PRIu64 ", dropped %" PRIu64 ", bytes %" PRIu64 "",
+              tv->name,
+              StatsGetLocalCounterValue(tv, dtv->capture_kernel_packets),
+              StatsGetLocalCounterValue(tv, dtv->capture_kernel_drops),
+              dtv->bytes);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to DPDKThreadVars.
+ */
+static TmEcode ReceiveDPDKThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    DPDKThreadVars *dtv = (DPDKThreadVars *)data;
+
+    if (dtv->bpf_prog.bf_insns) {
+        pcap_freecode(&dtv->bpf_prog);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Prepare DPDK decode thread.
+ * \param tv Thread local avariables.
+ * \param initdata Thread config.
+ * \param data Pointer to DecodeThreadVars placed here.
+ */
+static TmEcode DecodeDPDKThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = NULL;
+
+    dtv = DecodeThreadVarsAlloc(tv);
+
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars for dtv
+ * \param pq pointer to the current PacketQueue
+ * \param postpq
+ */
+static TmEcode DecodeDPDK(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to DecodeThreadVars.
+ */
+static TmEcode DecodeDPDKThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Registration Function for ReceiveDPDK.
+ */
+void TmModuleReceiveDPDKRegister(void)
+{
+    tmm_modules[TMM_RECEIVEDPDK].name = "ReceiveDPDK";
+    tmm_modules[TMM_RECEIVEDPDK].ThreadInit = ReceiveDPDKThreadInit;
+    tmm_modules[TMM_RECEIVEDPDK].Func = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].PktAcqLoop = ReceiveDPDKLoop;
+    tmm_modules[TMM_RECEIVEDPDK].PktAcqBreakLoop = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadExitPrintStats = ReceiveDPDKThreadExitStats;
+    tmm_modules[TMM_RECEIVEDPDK].ThreadDeinit = ReceiveDPDKThreadDeinit;
+    tmm_modules[TMM_RECEIVEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEDPDK].cap_flags = SC_CAP_NET_RAW;
+    tmm_modules[TMM_RECEIVEDPDK].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeDPDK.
+ */
+void TmModuleDecodeDPDKRegister(void)
+{
+    tmm_modules[TMM_DECODEDPDK].name = "DecodeDPDK";
+    tmm_modules[TMM_DECODEDPDK].ThreadInit = DecodeDPDKThreadInit;
+    tmm_modules[TMM_DECODEDPDK].Func = DecodeDPDK;
+    tmm_modules[TMM_DECODEDPDK].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_DECODEDPDK].ThreadDeinit = DecodeDPDKThreadDeinit;
+    tmm_modules[TMM_DECODEDPDK].RegisterTests = NULL;
+    tmm_modules[TMM_DECODEDPDK].cap_flags = 0;
+    tmm_modules[TMM_DECODEDPDK].flags = TM_FLAG_DECODE_TM;
+}
+
+#endif /* HAVE_DPDK */
+/* eof */
@@ -0,0 +1,80 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * DPDK poll mode acquisition support
+ */
+
+#ifndef __SOURCE_DPDK_H__
+#define __SOURCE_DPDK_H__
+
+/* copy modes */
+enum {
+    DPDK_COPY_MODE_NONE,
+    DPDK_COPY_MODE_TAP,
+    DPDK_COPY_MODE_IPS,
+};
+
+#define DPDK_IFACE_NAME_LENGTH      48
+
+#define DPDK_DEFAULT_MEMPOOL_SIZE   65535
+#define DPDK_DEFAULT_MEMPOOL_CACHE  256
+#define DPDK_DEFAULT_RX_DESC        1024
+#define DPDK_DEFAULT_TX_DESC        1024
+#define DPDK_DEFAULT_BURST          32
+#define DPDK_MAX_BURST              512
+
+typedef struct DPDKIfaceConfig_
+{
+    /* PCI address or vdev name */
+    char iface[DPDK_IFACE_NAME_LENGTH];
+    char out_iface[DPDK_IFACE_NAME_LENGTH];
+    uint16_t port_id;
+    uint16_t out_port_id;
+
+    int threads;
+    int promisc;
+    int copy_mode;
+    /* max packets handled per rx/tx burst */
+    uint16_t burst;
+    uint16_t rx_desc;
+    uint16_t tx_desc;
+    uint32_t mempool_size;
+    uint32_t mempool_cache;
+    ChecksumValidationMode checksum_mode;
+    char *bpf_filter;
+
+    /* rx queue of the next thread */
+    SC_ATOMIC_DECLARE(unsigned int, queue_next);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} DPDKIfaceConfig;
+
+typedef struct DPDKPacketVars_
+{
+    /* struct rte_mbuf holding the packet data */
+    void *mbuf;
+    /* DPDKThreadVars */
+    void *dtv;
+} DPDKPacketVars;
+
+void TmModuleReceiveDPDKRegister (void);
+void TmModuleDecodeDPDKRegister (void);
+
+#endif /* __SOURCE_DPDK_H__ */
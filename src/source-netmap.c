@@ -54,18 +54,6 @@
 #include "source-netmap.h"
 #include "runmodes.h"
 
-#ifdef __SC_CUDA_SUPPORT__
-
-#include "util-cuda.h"
-#include "util-cuda-buffer.h"
-#include "util-mpm-ac.h"
-#include "util-cuda-handlers.h"
-#include "detect-engine.h"
-#include "detect-engine-mpm.h"
-#include "util-cuda-vars.h"
-
-#endif /* __SC_CUDA_SUPPORT__ */
-
 #ifdef HAVE_NETMAP
 
 #if HAVE_SYS_IOCTL_H
@@ -132,6 +120,12 @@ TmEcode NoNetmapSupportExit(ThreadVars *tv, void *initdata, void **data)
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 
 #define POLL_TIMEOUT 100
+/** poll timeout while copied packets wait for a tx sync */
+#define POLL_TIMEOUT_TX_PENDING 1
+
+/** copied packets queued on a tx ring before it is synced */
+#define NETMAP_TX_BATCH 32
+
 
 #if defined(__linux__)
 #define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
@@ -151,8 +145,23 @@ enum {
 
 enum {
     NETMAP_FLAG_ZERO_COPY = 1,
+    NETMAP_FLAG_BUSY_POLL = 2,
+};
+
+/* port types, from the name as nm_open() understands it */
+enum {
+    NETMAP_PORT_NIC,
+    NETMAP_PORT_VALE,   /**< "valeX:port" software switch port */
+    NETMAP_PORT_PIPE,   /**< "name{N" master, "name}N" slave pipe end */
 };
 
+typedef struct NetmapPort_ {
+    char name[IFNAMSIZ];
+    int type;
+    uint32_t reg_flags;
+    uint16_t ringid;
+} NetmapPort;
+
 /**
  * \brief Netmap ring isntance.
  */
@@ -165,6 +174,8 @@ typedef struct NetmapRing
     int dst_ring_to;
     int dst_next_ring;
     SCSpinlock tx_lock;
+    /** copied packets not synced yet, under tx_lock */
+    uint32_t tx_pending;
 } NetmapRing;
 
 /**
@@ -172,7 +183,8 @@ typedef struct NetmapRing
  */
 typedef struct NetmapDevice_
 {
-    char ifname[IFNAMSIZ];
+    char ifname[NETMAP_IFACE_NAME_LENGTH];
+    int port_type;
     void *mem;
     size_t memsize;
     struct netmap_if *nif;
@@ -200,6 +212,9 @@ typedef struct NetmapThreadVars_
     int src_ring_to;
     int thread_idx;
     int flags;
+    /** set when a tx ring of ifdst has copied packets waiting. Packets
+     *  may be released by other threads. */
+    SC_ATOMIC_DECLARE(int, tx_pending);
     struct bpf_program bpf_prog;
 
     /* internal shit */
@@ -266,6 +281,55 @@ error_open:
     return rx_rings;
 }
 
+/**
+ * \brief Parse a netmap port name.
+ *
+ * Besides NICs netmap has VALE switch ports ("vale0:p1") and pipes
+ * ("eth0{1" is the master end of pipe 1 of eth0, "eth0}1" the slave
+ * end). Neither is a kernel interface, and a pipe end is registered on
+ * its parent with a pipe mode instead of a ring.
+ *
+ * \retval 0 ok
+ * \retval -1 invalid name
+ */
+static int NetmapParsePort(const char *ifname, NetmapPort *port)
+{
+    memset(port, 0, sizeof(*port));
+    port->type = NETMAP_PORT_NIC;
+    port->reg_flags = NR_REG_ONE_NIC;
+
+    const char *pipe = strpbrk(ifname, "{}");
+    size_t len = pipe ? (size_t)(pipe - ifname) : strlen(ifname);
+    if (len == 0 || len >= sizeof(port->name))
+        return -1;
+    memcpy(port->name, ifname, len);
+    port->name[len] = '\0';
+
+    if (pipe != NULL) {
+        char *end = NULL;
+        unsigned long id = strtoul(pipe + 1, &end, 10);
+        if (end == pipe + 1 || *end != '\0' || id > NETMAP_RING_MASK)
+            return -1;
+        port->type = NETMAP_PORT_PIPE;
+        port->reg_flags = (*pipe == '{') ? NR_REG_PIPE_MASTER : NR_REG_PIPE_SLAVE;
+        port->ringid = (uint16_t)id;
+    } else if (strncmp(ifname, "vale", 4) == 0 && strchr(ifname, ':') != NULL) {
+        port->type = NETMAP_PORT_VALE;
+    }
+    return 0;
+}
+
+/**
+ * \brief Check if a name is a netmap port that isn't a kernel interface.
+ */
+int NetmapIsVirtualPort(const char *ifname)
+{
+    NetmapPort port;
+    if (NetmapParsePort(ifname, &port) != 0)
+        return 0;
+    return (port.type != NETMAP_PORT_NIC);
+}
+
 /**
  * \brief Open interface in netmap mode.
  * \param ifname Interface name.
@@ -293,8 +357,15 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
         }
     }
 
+    NetmapPort port;
+    if (NetmapParsePort(ifname, &port) != 0) {
+        SCLogError(SC_ERR_NETMAP_CREATE, "Invalid netmap port name '%s'", ifname);
+        goto error;
+    }
+
     /* netmap needs all offloading to be disabled */
-    (void)GetIfaceOffloading(ifname, 1, 1);
+    if (port.type == NETMAP_PORT_NIC)
+        (void)GetIfaceOffloading(ifname, 1, 1);
 
     /* not found, create new record */
     pdev = SCMalloc(sizeof(*pdev));
@@ -306,6 +377,7 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
     memset(pdev, 0, sizeof(*pdev));
     SC_ATOMIC_INIT(pdev->threads_run);
     strlcpy(pdev->ifname, ifname, sizeof(pdev->ifname));
+    pdev->port_type = port.type;
 
     /* open netmap */
     int fd = open("/dev/netmap", O_RDWR);
@@ -316,30 +388,37 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
         goto error_pdev;
     }
 
-    /* check interface is up */
-    int if_flags = GetIfaceFlags(ifname);
-    if (if_flags == -1) {
-        if (verbose) {
-            SCLogError(SC_ERR_NETMAP_CREATE,
-                       "Can not access to interface '%s'",
-                       ifname);
+    /* VALE ports and pipes have no kernel interface to check */
+    if (port.type == NETMAP_PORT_NIC) {
+        /* check interface is up */
+        int if_flags = GetIfaceFlags(ifname);
+        if (if_flags == -1) {
+            if (verbose) {
+                SCLogError(SC_ERR_NETMAP_CREATE,
+                           "Can not access to interface '%s'",
+                           ifname);
+            }
+            goto error_fd;
+        }
+        if ((if_flags & IFF_UP) == 0) {
+            SCLogWarning(SC_ERR_NETMAP_CREATE, "Interface '%s' is down", ifname);
+            goto error_fd;
+        }
+        /* if needed, try to set iface in promisc mode */
+        if (promisc && (if_flags & (IFF_PROMISC|IFF_PPROMISC)) == 0) {
+            if_flags |= IFF_PPROMISC;
+            SetIfaceFlags(ifname, if_flags);
         }
-        goto error_fd;
-    }
-    if ((if_flags & IFF_UP) == 0) {
-        SCLogWarning(SC_ERR_NETMAP_CREATE, "Interface '%s' is down", ifname);
-        goto error_fd;
-    }
-    /* if needed, try to set iface in promisc mode */
-    if (promisc && (if_flags & (IFF_PROMISC|IFF_PPROMISC)) == 0) {
-        if_flags |= IFF_PPROMISC;
-        SetIfaceFlags(ifname, if_flags);
     }
 
     /* query netmap info */
     memset(&nm_req, 0, sizeof(nm_req));
-    strlcpy(nm_req.nr_name, ifname, sizeof(nm_req.nr_name));
+    strlcpy(nm_req.nr_name, port.name, sizeof(nm_req.nr_name));
     nm_req.nr_version = NETMAP_API;
+    if (port.type == NETMAP_PORT_PIPE) {
+        nm_req.nr_flags = port.reg_flags;
+        nm_req.nr_ringid = port.ringid;
+    }
 
     if (ioctl(fd, NIOCGINFO, &nm_req) != 0) {
         if (verbose) {
@@ -354,6 +433,14 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
     pdev->rx_rings_cnt = nm_req.nr_rx_rings;
     pdev->tx_rings_cnt = nm_req.nr_tx_rings;
     pdev->rings_cnt = max(pdev->rx_rings_cnt, pdev->tx_rings_cnt);
+    /* a pipe end is registered as a whole */
+    if (port.type == NETMAP_PORT_PIPE) {
+        pdev->rings_cnt = 1;
+        pdev->rx_rings_cnt = pdev->rx_rings_cnt ? 1 : 0;
+        pdev->tx_rings_cnt = pdev->tx_rings_cnt ? 1 : 0;
+    }
+    /* only NICs have a host (sw) ring */
+    int sw_ring = (port.type == NETMAP_PORT_NIC);
 
     /* hw rings + sw ring */
     pdev->rings = SCMalloc(sizeof(*pdev->rings) * (pdev->rings_cnt + 1));
@@ -367,6 +454,10 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
     int success_cnt = 0;
     for (int i = 0; i <= pdev->rings_cnt; i++) {
         NetmapRing *pring = &pdev->rings[i];
+        pring->fd = -1;
+        if (i == pdev->rings_cnt && !sw_ring)
+            break;
+
         pring->fd = open("/dev/netmap", O_RDWR);
         if (pring->fd == -1) {
             SCLogError(SC_ERR_NETMAP_CREATE,
@@ -375,7 +466,10 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
             break;
         }
 
-        if (i < pdev->rings_cnt) {
+        if (port.type == NETMAP_PORT_PIPE) {
+            nm_req.nr_flags = port.reg_flags;
+            nm_req.nr_ringid = port.ringid | NETMAP_NO_TX_POLL;
+        } else if (i < pdev->rings_cnt) {
             nm_req.nr_flags = NR_REG_ONE_NIC;
             nm_req.nr_ringid = i | NETMAP_NO_TX_POLL;
         } else {
@@ -411,7 +505,7 @@ static int NetmapOpen(char *ifname, int promisc, NetmapDevice **pdevice, int ver
         success_cnt++;
     }
 
-    if (success_cnt != (pdev->rings_cnt + 1)) {
+    if (success_cnt != (pdev->rings_cnt + sw_ring)) {
         for(int i = 0; i < success_cnt; i++) {
             close(pdev->rings[i].fd);
         }
@@ -458,6 +552,8 @@ static int NetmapClose(NetmapDevice *dev)
                 // First close SW ring (https://github.com/luigirizzo/netmap/issues/144)
                 for (int i = pdev->rings_cnt; i >= 0; i--) {
                     NetmapRing *pring = &pdev->rings[i];
+                    if (pring->fd == -1)
+                        continue;
                     close(pring->fd);
                     SCSpinDestroy(&pring->tx_lock);
                 }
@@ -510,10 +606,13 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, void *initdata, void **da
         goto error;
     }
     memset(ntv, 0, sizeof(*ntv));
+    SC_ATOMIC_INIT(ntv->tx_pending);
 
     ntv->tv = tv;
     ntv->checksum_mode = aconf->in.checksum_mode;
     ntv->copy_mode = aconf->in.copy_mode;
+    if (aconf->in.busy_poll)
+        ntv->flags |= NETMAP_FLAG_BUSY_POLL;
 
     ntv->livedev = LiveGetDevice(aconf->iface_name);
     if (ntv->livedev == NULL) {
@@ -525,6 +624,12 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, void *initdata, void **da
         goto error_ntv;
     }
 
+    if (unlikely(aconf->in.sw_ring && ntv->ifsrc->port_type != NETMAP_PORT_NIC)) {
+        SCLogError(SC_ERR_NETMAP_CREATE,
+                   "Input port '%s' has no host ring", aconf->iface_name);
+        goto error_src;
+    }
+
     if (unlikely(!aconf->in.sw_ring && !ntv->ifsrc->rx_rings_cnt)) {
         SCLogError(SC_ERR_NETMAP_CREATE,
                    "Input interface '%s' does not have Rx rings",
@@ -573,6 +678,12 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, void *initdata, void **da
             goto error_src;
         }
 
+        if (unlikely(aconf->out.sw_ring && ntv->ifdst->port_type != NETMAP_PORT_NIC)) {
+            SCLogError(SC_ERR_NETMAP_CREATE,
+                       "Output port '%s' has no host ring", aconf->out.iface);
+            goto error_dst;
+        }
+
         if (unlikely(!aconf->out.sw_ring && !ntv->ifdst->tx_rings_cnt)) {
             SCLogError(SC_ERR_NETMAP_CREATE,
                        "Output interface '%s' does not have Tx rings",
@@ -681,9 +792,16 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
     SCSpinLock(&txring->tx_lock);
 
     if (!nm_ring_space(txring->tx)) {
-        ntv->drops++;
-        SCSpinUnlock(&txring->tx_lock);
-        return TM_ECODE_FAILED;
+        /* reclaim the slots sent since the last sync */
+        if (txring->tx_pending) {
+            ioctl(txring->fd, NIOCTXSYNC, 0);
+            txring->tx_pending = 0;
+        }
+        if (!nm_ring_space(txring->tx)) {
+            ntv->drops++;
+            SCSpinUnlock(&txring->tx_lock);
+            return TM_ECODE_FAILED;
+        }
     }
 
     struct netmap_slot *ts = &txring->tx->slot[txring->tx->cur];
@@ -709,8 +827,16 @@ static TmEcode NetmapWritePacket(NetmapThreadVars *ntv, Packet *p)
     }
 
     txring->tx->head = txring->tx->cur = nm_ring_next(txring->tx, txring->tx->cur);
+    /* zero copy packets are synced by the receive loop after each ring
+     * read. Copied ones may be released by other threads, they are synced
+     * in batches here and the rest by the receive loop. */
     if ((ntv->flags & NETMAP_FLAG_ZERO_COPY) == 0) {
-        ioctl(txring->fd, NIOCTXSYNC, 0);
+        if (++txring->tx_pending >= NETMAP_TX_BATCH) {
+            ioctl(txring->fd, NIOCTXSYNC, 0);
+            txring->tx_pending = 0;
+        } else {
+            SC_ATOMIC_SET(ntv->tx_pending, 1);
+        }
     }
 
     SCSpinUnlock(&txring->tx_lock);
@@ -784,9 +910,7 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
         } else if (ntv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
             if (ntv->livedev->ignore_checksum) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
-            } else if (ChecksumAutoModeCheck(ntv->pkts,
-                        SC_ATOMIC_GET(ntv->livedev->pkts),
-                        SC_ATOMIC_GET(ntv->livedev->invalid_checksums))) {
+            } else if (ChecksumAutoModeCheckDevice(ntv->pkts, ntv->livedev)) {
                 ntv->livedev->ignore_checksum = 1;
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
@@ -832,6 +956,82 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
     SCReturnInt(NETMAP_OK);
 }
 
+/**
+ * \brief Read a ring and, in zero copy mode, send out what was read.
+ * \param ntv Thread local variables.
+ * \param src_ring_id Ring id to read.
+ */
+static void NetmapRingProcess(NetmapThreadVars *ntv, int src_ring_id)
+{
+    NetmapRingRead(ntv, src_ring_id);
+
+    if ((ntv->copy_mode != NETMAP_COPY_MODE_NONE) &&
+        (ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
+
+        NetmapRing *src_ring = &ntv->ifsrc->rings[src_ring_id];
+
+        /* sync dst tx rings */
+        for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
+            NetmapRing *dst_ring = &ntv->ifdst->rings[j];
+            /* if locked, another loop already do sync */
+            if (SCSpinTrylock(&dst_ring->tx_lock) == 0) {
+                ioctl(dst_ring->fd, NIOCTXSYNC, 0);
+                SCSpinUnlock(&dst_ring->tx_lock);
+            }
+        }
+    }
+}
+
+/**
+ * \brief Sync the tx rings holding copied packets short of a batch.
+ * \param ntv Thread local variables.
+ */
+static void NetmapFlushTx(NetmapThreadVars *ntv)
+{
+    if (SC_ATOMIC_GET(ntv->tx_pending) == 0)
+        return;
+    SC_ATOMIC_SET(ntv->tx_pending, 0);
+
+    for (int i = ntv->src_ring_from; i <= ntv->src_ring_to; i++) {
+        NetmapRing *src_ring = &ntv->ifsrc->rings[i];
+        for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
+            NetmapRing *dst_ring = &ntv->ifdst->rings[j];
+            if (SCSpinTrylock(&dst_ring->tx_lock) != 0) {
+                /* in use, try again next round */
+                SC_ATOMIC_SET(ntv->tx_pending, 1);
+                continue;
+            }
+            if (dst_ring->tx_pending) {
+                ioctl(dst_ring->fd, NIOCTXSYNC, 0);
+                dst_ring->tx_pending = 0;
+            }
+            SCSpinUnlock(&dst_ring->tx_lock);
+        }
+    }
+}
+
+/**
+ * \brief Busy-poll the rings instead of sleeping in poll()
+ *
+ * Trades a cpu per thread for the wakeup latency.
+ */
+static void NetmapBusyPoll(ThreadVars *tv, NetmapThreadVars *ntv)
+{
+    int got = 0;
+
+    for (int i = ntv->src_ring_from; i <= ntv->src_ring_to; i++) {
+        NetmapRing *ring = &ntv->ifsrc->rings[i];
+        ioctl(ring->fd, NIOCRXSYNC, 0);
+        if (nm_ring_space(ring->rx)) {
+            NetmapRingProcess(ntv, i);
+            got = 1;
+        }
+    }
+    if (!got) {
+        TmThreadsCaptureInjectPacket(tv, ntv->slot, NULL);
+    }
+}
+
 /**
  *  \brief Main netmap reading loop function
  */
@@ -866,7 +1066,16 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
          * to prevent us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        int r = poll(fds, rings_count, POLL_TIMEOUT);
+        if (ntv->flags & NETMAP_FLAG_BUSY_POLL) {
+            NetmapBusyPoll(tv, ntv);
+            NetmapFlushTx(ntv);
+            NetmapDumpCounters(ntv);
+            StatsSyncCountersIfSignalled(tv);
+            continue;
+        }
+
+        int r = poll(fds, rings_count, SC_ATOMIC_GET(ntv->tx_pending) ?
+                POLL_TIMEOUT_TX_PENDING : POLL_TIMEOUT);
 
         if (r < 0) {
             /* error */
@@ -882,6 +1091,7 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
 
             /* poll timed out, lets see if we need to inject a fake packet  */
             TmThreadsCaptureInjectPacket(tv, ntv->slot, NULL);
+            NetmapFlushTx(ntv);
             continue;
         }
 
@@ -899,26 +1109,10 @@ static TmEcode ReceiveNetmapLoop(ThreadVars *tv, void *data, void *slot)
             }
 
             if (likely(fds[i].revents & POLLIN)) {
-                int src_ring_id = ntv->src_ring_from + i;
-                NetmapRingRead(ntv, src_ring_id);
-
-                if ((ntv->copy_mode != NETMAP_COPY_MODE_NONE) &&
-                    (ntv->flags & NETMAP_FLAG_ZERO_COPY)) {
-
-                    NetmapRing *src_ring = &ntv->ifsrc->rings[src_ring_id];
-
-                    /* sync dst tx rings */
-                    for (int j = src_ring->dst_ring_from; j <= src_ring->dst_ring_to; j++) {
-                        NetmapRing *dst_ring = &ntv->ifdst->rings[j];
-                        /* if locked, another loop already do sync */
-                        if (SCSpinTrylock(&dst_ring->tx_lock) == 0) {
-                            ioctl(dst_ring->fd, NIOCTXSYNC, 0);
-                            SCSpinUnlock(&dst_ring->tx_lock);
-                        }
-                    }
-                }
+                NetmapRingProcess(ntv, ntv->src_ring_from + i);
             }
         }
+        NetmapFlushTx(ntv);
 
         NetmapDumpCounters(ntv);
         StatsSyncCountersIfSignalled(tv);
@@ -993,11 +1187,6 @@ static TmEcode DecodeNetmapThreadInit(ThreadVars *tv, void *initdata, void **dat
 
     *data = (void *)dtv;
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
-        SCReturnInt(TM_ECODE_FAILED);
-#endif
-
     SCReturnInt(TM_ECODE_OK);
 }
 
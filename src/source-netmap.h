@@ -44,6 +44,8 @@ typedef struct NetmapIfaceSettings_
     /* sw ring flag for out_iface */
     int sw_ring;
     int promisc;
+    /* spin on the rings instead of poll() */
+    int busy_poll;
     int copy_mode;
     ChecksumValidationMode checksum_mode;
     char *bpf_filter;
@@ -77,6 +79,7 @@ typedef struct NetmapPacketVars_
 } NetmapPacketVars;
 
 int NetmapGetRSSCount(const char *ifname);
+int NetmapIsVirtualPort(const char *ifname);
 
 void TmModuleReceiveNetmapRegister (void);
 void TmModuleDecodeNetmapRegister (void);
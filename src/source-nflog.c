@@ -190,7 +190,7 @@ static int NFLOGCallback(struct nflog_g_handle *gh, struct nfgenmsg *msg,
     ntv->pkts++;
     ntv->bytes += GET_PKT_LEN(p);
 #endif
-    (void) SC_ATOMIC_ADD(ntv->livedev->pkts, 1);
+    LiveDevAddPkts(ntv->livedev, 1);
 
     if (TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ntv->tv, p);
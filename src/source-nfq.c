@@ -336,32 +336,52 @@ static void NFQVerdictCacheFlush(NFQQueueVars *t)
 #endif
 }
 
+/**
+ * \brief add the verdict of a packet to the batch of its queue
+ *
+ * A batch verdict applies to all the packets up to the last id, so all
+ * the packets in it need the same verdict and mark. If the packet does
+ * not fit the current batch, the batch is sent and a new one started
+ * with the packet.
+ *
+ * \retval 0 verdict cached, -1 caller needs to send the verdict itself
+ */
 static int NFQVerdictCacheAdd(NFQQueueVars *t, Packet *p, uint32_t verdict)
 {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
+    uint32_t mark = 0;
+    int mark_valid = 0;
+
     if (t->verdict_cache.maxlen == 0)
         return -1;
 
-    if (p->flags & PKT_STREAM_MODIFIED || verdict == NF_DROP)
+    /* the modified payload has to be sent with the verdict */
+    if (p->flags & PKT_STREAM_MODIFIED)
         goto flush;
 
-    if (p->flags & PKT_MARK_MODIFIED) {
-        if (!t->verdict_cache.mark_valid) {
-            if (t->verdict_cache.len)
-                goto flush;
-            t->verdict_cache.mark_valid = 1;
-            t->verdict_cache.mark = p->nfq_v.mark;
-        } else if (t->verdict_cache.mark != p->nfq_v.mark) {
-            goto flush;
-        }
-    } else if (t->verdict_cache.mark_valid) {
-        goto flush;
+    if (nfq_config.mode == NFQ_REPEAT_MODE) {
+        mark = (nfq_config.mark & nfq_config.mask) | (p->nfq_v.mark & ~nfq_config.mask);
+        mark_valid = 1;
+    } else if (p->flags & PKT_MARK_MODIFIED) {
+        mark = p->nfq_v.mark;
+        mark_valid = 1;
+    }
+
+    if (t->verdict_cache.len > 0 &&
+            (t->verdict_cache.verdict != verdict ||
+             t->verdict_cache.mark_valid != mark_valid ||
+             (mark_valid && t->verdict_cache.mark != mark))) {
+        NFQVerdictCacheFlush(t);
+        /* flush failed, keep the order by sending ours directly */
+        if (t->verdict_cache.len > 0)
+            return -1;
     }
 
     if (t->verdict_cache.len == 0) {
         t->verdict_cache.verdict = verdict;
-    } else if (t->verdict_cache.verdict != verdict)
-        goto flush;
+        t->verdict_cache.mark_valid = mark_valid;
+        t->verdict_cache.mark = mark;
+    }
 
     /* same verdict, mark not set or identical -> can cache */
     t->verdict_cache.packet_id = p->nfq_v.id;
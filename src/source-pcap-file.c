@@ -37,6 +37,7 @@
 #include "util-error.h"
 #include "util-privs.h"
 #include "tmqh-packetpool.h"
+#include "runmodes.h"
 #include "tm-threads.h"
 #include "util-optimize.h"
 #include "flow-manager.h"
@@ -44,36 +45,90 @@
 #include "runmode-unix-socket.h"
 #include "util-checksum.h"
 #include "util-atomic.h"
-
-#ifdef __SC_CUDA_SUPPORT__
-
-#include "util-cuda.h"
-#include "util-cuda-buffer.h"
-#include "util-mpm-ac.h"
-#include "util-cuda-handlers.h"
-#include "detect-engine.h"
-#include "detect-engine-mpm.h"
-#include "util-cuda-vars.h"
-
-#endif /* __SC_CUDA_SUPPORT__ */
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+#include "util-misc.h"
+#include "util-cpu.h"
+#include "util-conf.h"
+#include "util-path.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 extern int max_pending_packets;
 
+typedef int (*PcapFileDecoderFunc)(ThreadVars *, DecodeThreadVars *, Packet *,
+        u_int8_t *, u_int16_t, PacketQueue *);
+
 typedef struct PcapFileGlobalVars_ {
-    pcap_t *pcap_handle;
-    int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, u_int8_t *, u_int16_t, PacketQueue *);
+    /** decoder for the datalink of the first reader. Concurrent unix
+     *  socket jobs may read files of other datalinks, their packets
+     *  look up the decoder by themselves. */
+    PcapFileDecoderFunc Decoder;
     int datalink;
-    struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
-
 } PcapFileGlobalVars;
 
+/** max packets read per pcap_dispatch call, also the batch size */
+#define PCAP_FILE_BATCH_SIZE 64
+
+/** default size of the savefile read buffer. Large sequential reads
+ *  keep the disks streaming, libpcap reads a record at a time. */
+#define PCAP_FILE_READ_BUFFER_SIZE  (4 * 1024 * 1024)
+
+/** the in memory copy of the file is sized in multiples of this, the
+ *  hugepage size on x86_64 */
+#define PCAP_FILE_BENCHMARK_ALIGN   (2 * 1024 * 1024)
+
+/** record of the in memory copy of the file */
+typedef struct PcapFileReplayRecord_ {
+    struct timeval ts;
+    uint32_t caplen;
+    uint64_t offset;        /**< of the packet data in PcapFileReplay::data */
+} PcapFileReplayRecord;
+
+/** the file loaded into memory for the replay benchmark */
+typedef struct PcapFileReplay_ {
+    char *filename;
+    uint32_t loops;
+
+    uint8_t *data;
+    size_t data_size;       /**< size of the mapping */
+    uint64_t data_len;
+    int hugepages;          /**< mapping is backed by MAP_HUGETLB pages */
+
+    PcapFileReplayRecord *recs;
+    uint32_t cnt;
+    uint32_t size;
+
+    /** added to the timestamps for each loop so that time keeps moving
+     *  forward: the duration of the capture plus a second */
+    uint64_t span_usec;
+
+    /* results */
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t cpu_ns;
+    uint64_t ticks;
+} PcapFileReplay;
+
 typedef struct PcapFileThreadVars_
 {
+    pcap_t *pcap_handle;
+    struct bpf_program filter;
+    int datalink;
+    uint64_t cnt; /** packet counter */
+
+    /** stdio buffer of the savefile, freed after pcap_close */
+    char *read_buf;
+
     uint32_t tenant_id;
+    /** unix socket pcap job, 0 if none */
+    uint32_t job_id;
 
     /* counters */
     uint32_t pkts;
@@ -87,6 +142,21 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /** batch mode: packets read in the current pcap_dispatch call */
+    int batch_mode;
+    uint32_t batch_cnt;
+    Packet *batch[PCAP_FILE_BATCH_SIZE];
+
+    /** use the libpcap buffer as packet data instead of copying it */
+    int zero_copy;
+
+    /** decoding is done by the threads behind the flow queues: pick
+     *  the queue from the raw packet */
+    int predispatch;
+
+    /** replay benchmark, NULL if not active */
+    PcapFileReplay *replay;
 } PcapFileThreadVars;
 
 static PcapFileGlobalVars pcap_g;
@@ -100,6 +170,7 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
 TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
 TmEcode DecodePcapFileThreadDeinit(ThreadVars *tv, void *data);
+static void PcapFileRegisterTests(void);
 
 void TmModuleReceivePcapFileRegister (void)
 {
@@ -110,7 +181,7 @@ void TmModuleReceivePcapFileRegister (void)
     tmm_modules[TMM_RECEIVEPCAPFILE].PktAcqBreakLoop = NULL;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadExitPrintStats = ReceivePcapFileThreadExitStats;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadDeinit = ReceivePcapFileThreadDeinit;
-    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = PcapFileRegisterTests;
     tmm_modules[TMM_RECEIVEPCAPFILE].cap_flags = 0;
     tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
 }
@@ -133,6 +204,179 @@ void PcapFileGlobalInit()
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
 }
 
+/**
+ *  \brief decoder for a datalink
+ *
+ *  \retval decoder or NULL if the datalink is not supported
+ */
+static PcapFileDecoderFunc PcapFileGetDecoder(int datalink)
+{
+    switch (datalink) {
+        case LINKTYPE_LINUX_SLL:
+            return DecodeSll;
+        case LINKTYPE_ETHERNET:
+            return DecodeEthernet;
+        case LINKTYPE_PPP:
+            return DecodePPP;
+        case LINKTYPE_RAW:
+            return DecodeRaw;
+        case LINKTYPE_NULL:
+            return DecodeNull;
+    }
+    return NULL;
+}
+
+static void PcapFileClose(PcapFileThreadVars *ptv)
+{
+    if (ptv->pcap_handle != NULL) {
+        pcap_close(ptv->pcap_handle);
+        ptv->pcap_handle = NULL;
+    }
+    if (ptv->read_buf != NULL) {
+        SCFree(ptv->read_buf);
+        ptv->read_buf = NULL;
+    }
+}
+
+/**
+ *  \brief open the savefile with a large read buffer
+ *
+ *  "-" is stdin, which libpcap handles itself.
+ */
+static pcap_t *PcapFileOpen(PcapFileThreadVars *ptv, const char *filename, char *errbuf)
+{
+    if (strcmp(filename, "-") == 0) {
+        return pcap_open_offline(filename, errbuf);
+    }
+
+    uint64_t bufsize = PCAP_FILE_READ_BUFFER_SIZE;
+    char *conf_val = NULL;
+    if (ConfGet("pcap-file.read-buffer-size", &conf_val) == 1 && conf_val != NULL) {
+        if (ParseSizeStringU64(conf_val, &bufsize) < 0 || bufsize > UINT32_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid pcap-file.read-buffer-size "
+                    "%s, using default", conf_val);
+            bufsize = PCAP_FILE_READ_BUFFER_SIZE;
+        }
+    }
+
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", filename, strerror(errno));
+        return NULL;
+    }
+    if (bufsize > 0) {
+        ptv->read_buf = SCMalloc(bufsize);
+        if (ptv->read_buf != NULL) {
+            (void)setvbuf(fp, ptv->read_buf, _IOFBF, (size_t)bufsize);
+        }
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* let the kernel read ahead more aggressively */
+    (void)posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    pcap_t *handle = pcap_fopen_offline(fp, errbuf);
+    if (handle == NULL) {
+        fclose(fp);
+        if (ptv->read_buf != NULL) {
+            SCFree(ptv->read_buf);
+            ptv->read_buf = NULL;
+        }
+    }
+    return handle;
+}
+
+/**
+ *  \brief flow consistent hash of the raw packet, for dispatching before
+ *         decoding
+ *
+ *  Only the IP address pair is used, so that fragments and reassembled
+ *  packets, and tunneled packets with the same outer addresses, go to
+ *  the same thread as the rest of their flow. The hash is symmetric.
+ *
+ *  
+etval hash or 0 for non IP packets
+ */
+static uint32_t PcapFileDispatchHash(int datalink, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t off = 0;
+    uint16_t proto = 0;
+
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            proto = (pkt[12] << 8) | pkt[13];
+            off = ETHERNET_HEADER_LEN;
+            while ((proto == ETHERNET_TYPE_VLAN || proto == ETHERNET_TYPE_8021AD ||
+                    proto == ETHERNET_TYPE_8021QINQ) && len >= off + 4) {
+                proto = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return 0;
+            proto = (pkt[14] << 8) | pkt[15];
+            off = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_NULL:
+            off = 4;
+            /* fall through */
+        case LINKTYPE_RAW:
+            if (len < off + 1)
+                return 0;
+            if ((pkt[off] >> 4) == 4)
+                proto = ETHERNET_TYPE_IP;
+            else if ((pkt[off] >> 4) == 6)
+                proto = ETHERNET_TYPE_IPV6;
+            break;
+        default:
+            return 0;
+    }
+
+    uint32_t a, b;
+    if (proto == ETHERNET_TYPE_IP) {
+        if (len < off + IPV4_HEADER_LEN)
+            return 0;
+        memcpy(&a, pkt + off + 12, sizeof(a));
+        memcpy(&b, pkt + off + 16, sizeof(b));
+    } else if (proto == ETHERNET_TYPE_IPV6) {
+        if (len < off + IPV6_HEADER_LEN)
+            return 0;
+        uint32_t w[8];
+        memcpy(w, pkt + off + 8, sizeof(w));
+        a = w[0] ^ w[1] ^ w[2] ^ w[3];
+        b = w[4] ^ w[5] ^ w[6] ^ w[7];
+    } else {
+        return 0;
+    }
+
+    uint32_t key[2];
+    if (a < b) {
+        key[0] = a;
+        key[1] = b;
+    } else {
+        key[0] = b;
+        key[1] = a;
+    }
+    return hashword(key, 2, 0);
+}
+
+static inline void PcapFileChecksumSetup(PcapFileThreadVars *ptv, Packet *p)
+{
+    /* We only check for checksum disable */
+    if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ChecksumAutoModeCheck(ptv->pkts, p->pcap_cnt,
+                                  SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
+            pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+}
+
 void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 {
     SCEnter();
@@ -149,40 +393,371 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_sec = h->ts.tv_sec;
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
-    p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->datalink = ptv->datalink;
+    p->pcap_cnt = ++ptv->cnt;
 
     p->pcap_v.tenant_id = ptv->tenant_id;
+    p->job_id = ptv->job_id;
     ptv->pkts++;
     ptv->bytes += h->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (ptv->zero_copy) {
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+            SCReturn;
+        }
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
     }
 
-    /* We only check for checksum disable */
-    if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
-        p->flags |= PKT_IGNORE_CHECKSUM;
-    } else if (pcap_g.checksum_mode == CHECKSUM_VALIDATION_AUTO) {
-        if (ChecksumAutoModeCheck(ptv->pkts, p->pcap_cnt,
-                                  SC_ATOMIC_GET(pcap_g.invalid_checksums))) {
-            pcap_g.checksum_mode = CHECKSUM_VALIDATION_DISABLE;
-            p->flags |= PKT_IGNORE_CHECKSUM;
-        }
+    PcapFileChecksumSetup(ptv, p);
+
+    if (ptv->predispatch) {
+        p->flags |= PKT_WANTS_FLOW;
+        p->flow_hash = PcapFileDispatchHash(ptv->datalink, pkt, h->caplen);
     }
 
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
+    if (ptv->batch_mode) {
+        /* processed after pcap_dispatch returns */
+        ptv->batch[ptv->batch_cnt++] = p;
+        SCReturn;
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(pcap_g.pcap_handle);
+        pcap_breakloop(ptv->pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
+/**
+ *  \brief switch to the next file of a continuous unix socket run
+ *
+ *  Threads, flows and the detect engine are kept, only the savefile is
+ *  replaced. If no file is queued yet we wait for one.
+ *
+ *  \retval 1 next file opened, 0 end of the run
+ */
+static int PcapFileOpenNext(PcapFileThreadVars *ptv)
+{
+    char *filename = NULL;
+    int r;
+
+    PcapFileClose(ptv);
+
+    while (1) {
+        r = UnixSocketPcapFileNext(&filename);
+        if (r < 0) {
+            return 0;
+        } else if (r == 0) {
+            if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))
+                return 0;
+            StatsSyncCountersIfSignalled(ptv->tv);
+            usleep(10000);
+            continue;
+        }
+
+        char errbuf[PCAP_ERRBUF_SIZE] = "";
+        ptv->pcap_handle = PcapFileOpen(ptv, filename, errbuf);
+        if (ptv->pcap_handle == NULL) {
+            SCLogError(SC_ERR_FOPEN, "%s", errbuf);
+            SCFree(filename);
+            continue;
+        }
+
+        /* the decoder is shared with the decode threads, a file with
+         * another link type is read by a new run */
+        if (pcap_datalink(ptv->pcap_handle) != ptv->datalink) {
+            SCLogInfo("datalink of %s differs, starting a new run", filename);
+            PcapFileClose(ptv);
+            UnixSocketPcapFileRequeue(filename);
+            SCFree(filename);
+            return 0;
+        }
+
+        if (ptv->filter.bf_insns != NULL &&
+                pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s",
+                    pcap_geterr(ptv->pcap_handle));
+            PcapFileClose(ptv);
+            SCFree(filename);
+            continue;
+        }
+
+        SCLogInfo("reading pcap file %s", filename);
+        SCFree(filename);
+        return 1;
+    }
+}
+
+static void PcapFileReplayFree(PcapFileReplay *r)
+{
+    if (r == NULL)
+        return;
+    if (r->data != NULL)
+        munmap(r->data, r->data_size);
+    if (r->recs != NULL)
+        SCFree(r->recs);
+    if (r->filename != NULL)
+        SCFree(r->filename);
+    SCFree(r);
+}
+
+/**
+ *  \brief load all records of the savefile into memory for the replay
+ *         benchmark
+ *
+ *  The packet data goes into one anonymous mapping, backed by hugepages
+ *  if the system has them reserved, so that reading the packets costs
+ *  as few TLB misses as possible. The savefile size is an upper bound of
+ *  the packet data. The bpf filter is applied while loading.
+ *
+ *  \retval r loaded file or NULL on error
+ */
+static PcapFileReplay *PcapFileReplayLoad(PcapFileThreadVars *ptv,
+        const char *filename, uint32_t loops)
+{
+    struct stat st;
+    if (strcmp(filename, "-") == 0 || stat(filename, &st) != 0 || st.st_size <= 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "benchmark needs a regular pcap file");
+        return NULL;
+    }
+
+    PcapFileReplay *r = SCMalloc(sizeof(*r));
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->loops = loops;
+    r->filename = SCStrdup(filename);
+    if (unlikely(r->filename == NULL))
+        goto error;
+
+    r->data_size = ((size_t)st.st_size + PCAP_FILE_BENCHMARK_ALIGN - 1) &
+        ~((size_t)PCAP_FILE_BENCHMARK_ALIGN - 1);
+    void *map = MAP_FAILED;
+    int hugepages = 1;
+    (void)ConfGetBool("pcap-file.benchmark.hugepages", &hugepages);
+#ifdef MAP_HUGETLB
+    if (hugepages) {
+        map = mmap(NULL, r->data_size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED)
+            r->hugepages = 1;
+    }
+#endif
+    if (map == MAP_FAILED) {
+        map = mmap(NULL, r->data_size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            SCLogError(SC_ERR_MEM_ALLOC, "mapping %"PRIuMAX" bytes for the "
+                    "benchmark failed: %s", (uintmax_t)r->data_size, strerror(errno));
+            goto error;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugepages)
+            (void)madvise(map, r->data_size, MADV_HUGEPAGE);
+#endif
+    }
+    r->data = map;
+
+    struct pcap_pkthdr *h;
+    const u_char *pkt;
+    int ret;
+    while ((ret = pcap_next_ex(ptv->pcap_handle, &h, &pkt)) == 1) {
+        if (r->data_len + h->caplen > r->data_size) {
+            SCLogError(SC_ERR_MEM_ALLOC, "pcap file data exceeds its file size");
+            goto error;
+        }
+        if (r->cnt == r->size) {
+            uint32_t size = r->size ? r->size * 2 : 65536;
+            PcapFileReplayRecord *recs = SCRealloc(r->recs, size * sizeof(*recs));
+            if (unlikely(recs == NULL))
+                goto error;
+            r->recs = recs;
+            r->size = size;
+        }
+
+        PcapFileReplayRecord *rec = &r->recs[r->cnt++];
+        rec->ts = h->ts;
+        rec->caplen = h->caplen;
+        rec->offset = r->data_len;
+        memcpy(r->data + r->data_len, pkt, h->caplen);
+        r->data_len += h->caplen;
+    }
+    if (ret == -1) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "reading pcap file failed: %s",
+                pcap_geterr(ptv->pcap_handle));
+        goto error;
+    }
+    if (r->cnt == 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap file has no packets to replay");
+        goto error;
+    }
+
+    struct timeval *first = &r->recs[0].ts;
+    struct timeval *last = &r->recs[r->cnt - 1].ts;
+    int64_t usec = ((int64_t)last->tv_sec - first->tv_sec) * 1000000 +
+        ((int64_t)last->tv_usec - first->tv_usec);
+    r->span_usec = (usec > 0 ? (uint64_t)usec : 0) + 1000000;
+
+    SCLogConfig("pcap-file: benchmark loaded %"PRIu32" packets, %"PRIu64" bytes "
+            "(%s), replaying %"PRIu32" times", r->cnt, r->data_len,
+            r->hugepages ? "hugepages" : "regular pages", r->loops);
+    return r;
+
+error:
+    PcapFileReplayFree(r);
+    return NULL;
+}
+
+static inline uint64_t PcapFileTimespecNs(const struct timespec *a, const struct timespec *b)
+{
+    return (uint64_t)(b->tv_sec - a->tv_sec) * 1000000000ULL +
+        (uint64_t)b->tv_nsec - (uint64_t)a->tv_nsec;
+}
+
+/**
+ *  \brief replay the in memory copy of the file at maximum speed
+ *
+ *  All loops deliver the same packets in the same order, only the
+ *  timestamps are moved forward, so runs can be compared. The clock
+ *  is stopped once all packets are back in the pool, which includes
+ *  the processing in the other threads of the autofp runmode.
+ */
+static TmEcode PcapFileReplayLoop(ThreadVars *tv, PcapFileThreadVars *ptv)
+{
+    PcapFileReplay *r = ptv->replay;
+    struct timespec start, end, cpu_start, cpu_end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    uint64_t ticks_start = UtilCpuGetTicks();
+
+    uint32_t loop;
+    for (loop = 0; loop < r->loops; loop++) {
+        uint64_t shift = r->span_usec * loop;
+        uint32_t i;
+        for (i = 0; i < r->cnt; i++) {
+            if ((i % PCAP_FILE_BATCH_SIZE) == 0) {
+                if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL))
+                    goto done;
+                PacketPoolWait();
+                StatsSyncCountersIfSignalled(tv);
+            }
+
+            const PcapFileReplayRecord *rec = &r->recs[i];
+            Packet *p = PacketGetFromQueueOrAlloc();
+            if (unlikely(p == NULL))
+                continue;
+            PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILE);
+
+            PKT_SET_SRC(p, PKT_SRC_WIRE);
+            uint64_t usec = (uint64_t)rec->ts.tv_usec + shift;
+            p->ts.tv_sec = rec->ts.tv_sec + (time_t)(usec / 1000000);
+            p->ts.tv_usec = (suseconds_t)(usec % 1000000);
+            p->datalink = ptv->datalink;
+            p->pcap_cnt = ++ptv->cnt;
+            p->pcap_v.tenant_id = ptv->tenant_id;
+            p->job_id = ptv->job_id;
+            ptv->pkts++;
+            ptv->bytes += rec->caplen;
+
+            /* the mapping outlives the packets in the zero copy runmodes */
+            uint8_t *pkt = r->data + rec->offset;
+            int err = ptv->zero_copy ? PacketSetData(p, pkt, rec->caplen) :
+                PacketCopyData(p, pkt, rec->caplen);
+            if (unlikely(err)) {
+                TmqhOutputPacketpool(ptv->tv, p);
+                PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+                continue;
+            }
+
+            PcapFileChecksumSetup(ptv, p);
+            if (ptv->predispatch) {
+                p->flags |= PKT_WANTS_FLOW;
+                p->flow_hash = PcapFileDispatchHash(ptv->datalink, pkt, rec->caplen);
+            }
+            PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+
+            if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+                SCLogError(SC_ERR_PCAP_DISPATCH, "processing of a replayed packet failed");
+                EngineKill();
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            r->pkts++;
+            r->bytes += rec->caplen;
+        }
+    }
+done:
+    PacketPoolWaitForN(max_pending_packets);
+
+    r->ticks = UtilCpuGetTicks() - ticks_start;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    r->ns = PcapFileTimespecNs(&start, &end);
+    r->cpu_ns = PcapFileTimespecNs(&cpu_start, &cpu_end);
+
+    SCLogInfo("pcap file benchmark done after %"PRIu32" loops", loop);
+    EngineStop();
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ *  \brief write the result of the replay benchmark as a JSON object to
+ *         stdout or pcap-file.benchmark.output
+ *
+ *  cycles_per_packet is the wall clock in cycles, cpu_cycles_per_packet
+ *  the cycles all threads spent together. With packet profiling the
+ *  sampled cycles per stage are added.
+ */
+static void PcapFileReplayReport(const PcapFileReplay *r)
+{
+    FILE *fp = stdout;
+    char *output = NULL;
+    if (ConfGet("pcap-file.benchmark.output", &output) == 1 && output != NULL) {
+        char path[PATH_MAX];
+        if (PathIsAbsolute(output))
+            strlcpy(path, output, sizeof(path));
+        else
+            snprintf(path, sizeof(path), "%s/%s", ConfigGetLogDirectory(), output);
+        fp = fopen(path, "a");
+        if (fp == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+            fp = stdout;
+        }
+    }
+
+    double secs = (double)r->ns / 1000000000.0;
+    double pkts = r->pkts ? (double)r->pkts : 1.0;
+    double ticks_per_ns = r->ns ? (double)r->ticks / (double)r->ns : 0.0;
+
+    fprintf(fp, "{\"file\":\"%s\",\"loops\":%"PRIu32",\"packets\":%"PRIu64","
+            "\"bytes\":%"PRIu64",\"hugepages\":%s,\"seconds\":%.6f,"
+            "\"mpps\":%.4f,\"gbps\":%.4f,\"cycles_per_packet\":%.1f,"
+            "\"cpu_seconds\":%.6f,\"cpu_cycles_per_packet\":%.1f",
+            r->filename, r->loops, r->pkts, r->bytes,
+            r->hugepages ? "true" : "false", secs,
+            secs > 0 ? ((double)r->pkts / secs) / 1000000.0 : 0.0,
+            secs > 0 ? ((double)r->bytes * 8.0 / secs) / 1000000000.0 : 0.0,
+            (double)r->ticks / pkts,
+            (double)r->cpu_ns / 1000000000.0,
+            ((double)r->cpu_ns * ticks_per_ns) / pkts);
+#ifdef PROFILING
+    if (profiling_packets_enabled)
+        SCProfilingBenchmarkStages(fp);
+#endif
+    fprintf(fp, "}\n");
+    fflush(fp);
+    if (fp != stdout)
+        fclose(fp);
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -190,13 +765,20 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
 {
     SCEnter();
 
-    int packet_q_len = 64;
+    int packet_q_len = PCAP_FILE_BATCH_SIZE;
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     int r;
     TmSlot *s = (TmSlot *)slot;
 
     ptv->slot = s->slot_next;
     ptv->cb_result = TM_ECODE_OK;
+    /* without a decoder in our own thread the flow queue handler needs
+     * a flow consistent hash to hand the packets to the decoders */
+    ptv->predispatch = (ptv->slot == NULL);
+
+    if (ptv->replay != NULL) {
+        SCReturnInt(PcapFileReplayLoop(tv, ptv));
+    }
 
     while (1) {
         if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
@@ -208,18 +790,25 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         PacketPoolWait();
 
         /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
+        r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
                           (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (ptv->batch_cnt > 0) {
+            uint32_t cnt = ptv->batch_cnt;
+            ptv->batch_cnt = 0;
+            if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot,
+                        ptv->batch, cnt) != TM_ECODE_OK) {
+                ptv->cb_result = TM_ECODE_FAILED;
+            }
+        }
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
-                       r, pcap_geterr(pcap_g.pcap_handle));
+                       r, pcap_geterr(ptv->pcap_handle));
             if (! RunModeUnixSocketIsActive()) {
                 /* in the error state we just kill the engine */
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -228,8 +817,8 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
             if (! RunModeUnixSocketIsActive()) {
                 EngineStop();
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                if (PcapFileOpenNext(ptv) == 1)
+                    continue;
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -240,8 +829,7 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
                 EngineKill();
                 SCReturnInt(TM_ECODE_FAILED);
             } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
+                PcapFileClose(ptv);
                 UnixSocketPcapFile(TM_ECODE_DONE);
                 SCReturnInt(TM_ECODE_DONE);
             }
@@ -271,6 +859,10 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
+    ptv->job_id = UnixSocketPcapFileJobId((char *)initdata);
+    if (ptv->job_id != 0)
+        SCLogInfo("pcap job %u", ptv->job_id);
+
     intmax_t tenant = 0;
     if (ConfGetInt("pcap-file.tenant-id", &tenant) == 1) {
         if (tenant > 0 && tenant < UINT_MAX) {
@@ -282,8 +874,8 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
     }
 
     char errbuf[PCAP_ERRBUF_SIZE] = "";
-    pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
-    if (pcap_g.pcap_handle == NULL) {
+    ptv->pcap_handle = PcapFileOpen(ptv, (char *)initdata, errbuf);
+    if (ptv->pcap_handle == NULL) {
         SCLogError(SC_ERR_FOPEN, "%s\n", errbuf);
         SCFree(ptv);
         if (! RunModeUnixSocketIsActive()) {
@@ -299,66 +891,95 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
     } else {
         SCLogInfo("using bpf-filter \"%s\"", tmpbpfstring);
 
-        if (pcap_compile(pcap_g.pcap_handle, &pcap_g.filter, tmpbpfstring, 1, 0) < 0) {
+        if (pcap_compile(ptv->pcap_handle, &ptv->filter, tmpbpfstring, 1, 0) < 0) {
             SCLogError(SC_ERR_BPF,"bpf compilation error %s",
-                    pcap_geterr(pcap_g.pcap_handle));
+                    pcap_geterr(ptv->pcap_handle));
+            PcapFileClose(ptv);
             SCFree(ptv);
             return TM_ECODE_FAILED;
         }
 
-        if (pcap_setfilter(pcap_g.pcap_handle, &pcap_g.filter) < 0) {
-            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(pcap_g.pcap_handle));
+        if (pcap_setfilter(ptv->pcap_handle, &ptv->filter) < 0) {
+            SCLogError(SC_ERR_BPF,"could not set bpf filter %s", pcap_geterr(ptv->pcap_handle));
+            pcap_freecode(&ptv->filter);
+            PcapFileClose(ptv);
             SCFree(ptv);
             return TM_ECODE_FAILED;
         }
     }
 
-    pcap_g.datalink = pcap_datalink(pcap_g.pcap_handle);
-    SCLogDebug("datalink %" PRId32 "", pcap_g.datalink);
+    ptv->datalink = pcap_datalink(ptv->pcap_handle);
+    SCLogDebug("datalink %" PRId32 "", ptv->datalink);
 
-    switch (pcap_g.datalink) {
-        case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
-        case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
-        case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
-        case LINKTYPE_RAW:
-            pcap_g.Decoder = DecodeRaw;
-            break;
-        case LINKTYPE_NULL:
-            pcap_g.Decoder = DecodeNull;
-            break;
+    PcapFileDecoderFunc Decoder = PcapFileGetDecoder(ptv->datalink);
+    if (Decoder == NULL) {
+        SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
+                  "(yet) supported in module PcapFile.\n", ptv->datalink);
+        PcapFileClose(ptv);
+        SCFree(ptv);
+        if (! RunModeUnixSocketIsActive()) {
+            SCReturnInt(TM_ECODE_FAILED);
+        } else {
+            UnixSocketPcapFile(TM_ECODE_DONE);
+            SCReturnInt(TM_ECODE_DONE);
+        }
+    }
 
-        default:
-            SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " not "
-                      "(yet) supported in module PcapFile.\n", pcap_g.datalink);
-            SCFree(ptv);
-            if (! RunModeUnixSocketIsActive()) {
-                SCReturnInt(TM_ECODE_FAILED);
-            } else {
-                pcap_close(pcap_g.pcap_handle);
-                pcap_g.pcap_handle = NULL;
-                UnixSocketPcapFile(TM_ECODE_DONE);
-                SCReturnInt(TM_ECODE_DONE);
+    /* the first reader of the run sets up the shared state, the readers
+     * of concurrent unix socket jobs start after it */
+    if (pcap_g.Decoder == NULL) {
+        pcap_g.Decoder = Decoder;
+        pcap_g.datalink = ptv->datalink;
+
+        if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
+            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else {
+            if (strcmp(tmpstring, "auto") == 0) {
+                pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
+            } else if (ConfValIsTrue(tmpstring)){
+                pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+            } else if (ConfValIsFalse(tmpstring)) {
+                pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_DISABLE;
             }
+        }
+        pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
     }
 
-    if (ConfGet("pcap-file.checksum-checks", &tmpstring) != 1) {
-        pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
-    } else {
-        if (strcmp(tmpstring, "auto") == 0) {
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_AUTO;
-        } else if (ConfValIsTrue(tmpstring)){
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_ENABLE;
-        } else if (ConfValIsFalse(tmpstring)) {
-            pcap_g.conf_checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+    int batch_mode = 0;
+    if (ConfGetBool("pcap-file.batch-mode", &batch_mode) == 1 && batch_mode) {
+        SCLogConfig("pcap-file: batch mode enabled");
+        ptv->batch_mode = 1;
+    }
+
+    /* libpcap reads every record of a savefile into the same buffer, so
+     * it can only be used directly if the packet is done with before the
+     * next one is read. Batch mode holds on to the packets. */
+    if (!ptv->batch_mode && RunmodeAllowsZeroCopy()) {
+        ptv->zero_copy = 1;
+        SCLogPerf("pcap-file: zero-copy enabled");
+    }
+
+    intmax_t loops = 0;
+    if (ConfGetInt("pcap-file.benchmark.loops", &loops) == 1 && loops > 0 &&
+            !RunModeUnixSocketIsActive()) {
+        if (loops > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "benchmark loops out of range");
+            PcapFileClose(ptv);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        ptv->replay = PcapFileReplayLoad(ptv, (char *)initdata, (uint32_t)loops);
+        /* the file has been read completely */
+        PcapFileClose(ptv);
+        if (ptv->replay == NULL) {
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
         }
+        /* unlike the libpcap buffer the mapping is never overwritten,
+         * the replay passes the packets on one at a time */
+        if (RunmodeAllowsZeroCopy())
+            ptv->zero_copy = 1;
     }
-    pcap_g.checksum_mode = pcap_g.conf_checksum_mode;
 
     ptv->tv = tv;
     *data = (void *)ptv;
@@ -372,9 +993,9 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
     if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            ptv->cnt < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-        uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+        uint64_t chrate = ptv->cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
         if (chrate < CHECKSUM_INVALID_RATIO)
             SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
@@ -386,6 +1007,8 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
                       chrate);
     }
     SCLogNotice("Pcap-file module read %" PRIu32 " packets, %" PRIu64 " bytes", ptv->pkts, ptv->bytes);
+    if (ptv->replay != NULL)
+        PcapFileReplayReport(ptv->replay);
     return;
 }
 
@@ -394,6 +1017,10 @@ TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data)
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
     if (ptv) {
+        PcapFileClose(ptv);
+        if (ptv->filter.bf_insns != NULL)
+            pcap_freecode(&ptv->filter);
+        PcapFileReplayFree(ptv->replay);
         SCFree(ptv);
     }
     SCReturnInt(TM_ECODE_OK);
@@ -420,8 +1047,15 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
         FlowWakeupFlowManagerThread();
     }
 
+    /* the reader may have set this to pick our queue, decoding sets it
+     * up for real */
+    p->flags &= ~PKT_WANTS_FLOW;
+
     /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+    PcapFileDecoderFunc Decoder = pcap_g.Decoder;
+    if (unlikely(p->datalink != pcap_g.datalink))
+        Decoder = PcapFileGetDecoder(p->datalink);
+    Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
 
 #ifdef DEBUG
     BUG_ON(p->pkt_src != PKT_SRC_WIRE && p->pkt_src != PKT_SRC_FFR);
@@ -443,11 +1077,6 @@ TmEcode DecodePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
 
     DecodeRegisterPerfCounters(dtv, tv);
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
-        SCReturnInt(TM_ECODE_FAILED);
-#endif
-
     *data = (void *)dtv;
 
     SCReturnInt(TM_ECODE_OK);
@@ -465,5 +1094,55 @@ void PcapIncreaseInvalidChecksum()
     (void) SC_ATOMIC_ADD(pcap_g.invalid_checksums, 1);
 }
 
+#ifdef UNITTESTS
+/** \test dispatch hash is symmetric and the same for fragments */
+static int PcapFileDispatchHashTest01(void)
+{
+    uint8_t fwd[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01,
+        0xc0, 0xa8, 0x01, 0x02 };
+    uint8_t rev[sizeof(fwd)];
+    uint8_t frag[sizeof(fwd)];
+    int result = 0;
+
+    memcpy(rev, fwd, sizeof(fwd));
+    memcpy(rev + 26, fwd + 30, 4);
+    memcpy(rev + 30, fwd + 26, 4);
+
+    /* non first fragment of a udp packet, no ports to look at */
+    memcpy(frag, fwd, sizeof(fwd));
+    frag[20] = 0x00;
+    frag[21] = 0x10;
+
+    uint32_t h = PcapFileDispatchHash(LINKTYPE_ETHERNET, fwd, sizeof(fwd));
+    if (h == 0)
+        goto end;
+    if (PcapFileDispatchHash(LINKTYPE_ETHERNET, rev, sizeof(rev)) != h)
+        goto end;
+    if (PcapFileDispatchHash(LINKTYPE_ETHERNET, frag, sizeof(frag)) != h)
+        goto end;
+    /* same packet without the ethernet header */
+    if (PcapFileDispatchHash(LINKTYPE_RAW, fwd + 14, sizeof(fwd) - 14) != h)
+        goto end;
+    /* truncated */
+    if (PcapFileDispatchHash(LINKTYPE_ETHERNET, fwd, 20) != 0)
+        goto end;
+
+    result = 1;
+end:
+    return result;
+}
+#endif /* UNITTESTS */
+
+static void PcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileDispatchHashTest01", PcapFileDispatchHashTest01);
+#endif /* UNITTESTS */
+}
+
 /* eof */
 
@@ -24,6 +24,11 @@
 #ifndef __SOURCE_PCAP_FILE_H__
 #define __SOURCE_PCAP_FILE_H__
 
+/** replays of the file by --benchmark without a count */
+#define PCAP_FILE_BENCHMARK_LOOPS           10
+/** profiling.sample-rate used by --benchmark if not configured */
+#define PCAP_FILE_BENCHMARK_SAMPLE_RATE     1024
+
 void TmModuleReceivePcapFileRegister (void);
 void TmModuleDecodePcapFileRegister (void);
 
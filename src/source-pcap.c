@@ -41,18 +41,7 @@
 #include "util-checksum.h"
 #include "util-ioctl.h"
 #include "tmqh-packetpool.h"
-
-#ifdef __SC_CUDA_SUPPORT__
-
-#include "util-cuda.h"
-#include "util-cuda-buffer.h"
-#include "util-mpm-ac.h"
-#include "util-cuda-handlers.h"
-#include "detect-engine.h"
-#include "detect-engine-mpm.h"
-#include "util-cuda-vars.h"
-
-#endif /* __SC_CUDA_SUPPORT__ */
+#include "runmodes.h"
 
 #define PCAP_STATE_DOWN 0
 #define PCAP_STATE_UP 1
@@ -99,6 +88,9 @@ typedef struct PcapThreadVars_
 
     ChecksumValidationMode checksum_mode;
 
+    /** use the libpcap buffer as packet data instead of copying it */
+    int zero_copy;
+
 #if LIBPCAP_VERSION_MAJOR == 0
     char iface[PCAP_IFACE_NAME_LENGTH];
 #endif
@@ -248,10 +240,15 @@ void PcapCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 
     ptv->pkts++;
     ptv->bytes += h->caplen;
-    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, 1);
+    LiveDevAddPkts(ptv->livedev, 1);
     p->livedev = ptv->livedev;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (ptv->zero_copy) {
+        if (unlikely(PacketSetData(p, pkt, h->caplen))) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            SCReturn;
+        }
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->tv, p);
         SCReturn;
     }
@@ -260,9 +257,7 @@ void PcapCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
         case CHECKSUM_VALIDATION_AUTO:
             if (ptv->livedev->ignore_checksum) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
-            } else if (ChecksumAutoModeCheck(ptv->pkts,
-                        SC_ATOMIC_GET(ptv->livedev->pkts),
-                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            } else if (ChecksumAutoModeCheckDevice(ptv->pkts, ptv->livedev)) {
                 ptv->livedev->ignore_checksum = 1;
                 p->flags |= PKT_IGNORE_CHECKSUM;
             }
@@ -280,7 +275,7 @@ void PcapCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     }
 
     /* Trigger one dump of stats every second */
-    TimeGet(&current_time);
+    TimeGetCoarse(&current_time);
     if (current_time.tv_sec != ptv->last_stats_dump) {
         PcapDumpCounters(ptv);
         ptv->last_stats_dump = current_time.tv_sec;
@@ -393,6 +388,12 @@ TmEcode ReceivePcapThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
+    /* the libpcap buffer is only valid until the callback returns */
+    if (RunmodeAllowsZeroCopy()) {
+        ptv->zero_copy = 1;
+        SCLogPerf("Enabling zero-copy for %s", pcapconfig->iface);
+    }
+
     SCLogInfo("using interface %s", (char *)pcapconfig->iface);
 
     ptv->checksum_mode = pcapconfig->checksum_mode;
@@ -554,6 +555,12 @@ TmEcode ReceivePcapThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
+    /* the libpcap buffer is only valid until the callback returns */
+    if (RunmodeAllowsZeroCopy()) {
+        ptv->zero_copy = 1;
+        SCLogPerf("Enabling zero-copy for %s", pcapconfig->iface);
+    }
+
     SCLogInfo("using interface %s", pcapconfig->iface);
     if (strlen(pcapconfig->iface) > PCAP_IFACE_NAME_LENGTH) {
         SCFree(ptv);
@@ -742,11 +749,6 @@ TmEcode DecodePcapThreadInit(ThreadVars *tv, void *initdata, void **data)
 
     DecodeRegisterPerfCounters(dtv, tv);
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
-        SCReturnInt(TM_ECODE_FAILED);
-#endif
-
     *data = (void *)dtv;
 
     SCReturnInt(TM_ECODE_OK);
@@ -30,6 +30,9 @@
 
 #ifdef HAVE_PFRING
 #include <pfring.h>
+#ifdef HAVE_PFRING_ZC
+#include <pfring_zc.h>
+#endif
 #endif /* HAVE_PFRING */
 
 #include "suricata-common.h"
@@ -49,18 +52,8 @@
 #include "util-host-info.h"
 #include "runmodes.h"
 #include "util-profiling.h"
-
-#ifdef __SC_CUDA_SUPPORT__
-
-#include "util-cuda.h"
-#include "util-cuda-buffer.h"
-#include "util-mpm-ac.h"
-#include "util-cuda-handlers.h"
-#include "detect-engine.h"
-#include "detect-engine-mpm.h"
-#include "util-cuda-vars.h"
-
-#endif /* __SC_CUDA_SUPPORT__ */
+#include "flow-hash.h"
+#include "decode-vxlan.h"
 
 TmEcode ReceivePfringLoop(ThreadVars *tv, void *data, void *slot);
 TmEcode PfringBreakLoop(ThreadVars *tv, void *data);
@@ -131,6 +124,48 @@ typedef enum {
     PFRING_FLAGS_ZERO_COPY = 0x1
 } PfringThreadVarsFlags;
 
+#ifdef HAVE_PFRING_ZC
+/* slots of the device rx ring, queue length between balancer and
+ * threads and buffers the balancer holds */
+#define PFRING_ZC_RX_SLOTS      32768
+#define PFRING_ZC_QUEUE_LEN     8192
+#define PFRING_ZC_PREFETCH      8
+/** sleep when a burst came back empty */
+#define PFRING_ZC_IDLE_USEC     100
+
+/**
+ * \brief ZC cluster of an interface, shared by its receive threads.
+ *
+ * With a single thread the thread reads the device queue directly.
+ * Otherwise a ZC balancer reads the device and distributes the packets
+ * over one queue per thread using the flow hash.
+ */
+typedef struct PfringZcCluster_ {
+    char iface[PFRING_IFACE_NAME_LENGTH];
+    int cluster_id;
+    int threads;
+
+    pfring_zc_cluster *cluster;
+    pfring_zc_queue *device;
+    pfring_zc_queue **queues;       /**< balancer output, one per thread */
+    pfring_zc_buffer_pool *pool;    /**< balancer working set */
+    pfring_zc_worker *balancer;
+
+    /* hash settings, read once at setup */
+    int use_vlan;
+    uint16_t vxlan_port;
+
+    int next_queue;                 /**< next queue to hand to a thread */
+    int refcnt;                     /**< threads attached */
+
+    struct PfringZcCluster_ *next;
+} PfringZcCluster;
+
+/** list of ZC clusters, protected by pfring_zc_lock */
+static PfringZcCluster *pfring_zc_clusters = NULL;
+static SCMutex pfring_zc_lock = SCMUTEX_INITIALIZER;
+#endif /* HAVE_PFRING_ZC */
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -165,6 +200,14 @@ typedef struct PfringThreadVars_
     char *bpf_filter;
 
      ChecksumValidationMode checksum_mode;
+
+#ifdef HAVE_PFRING_ZC
+    /* ZC mode: cluster, queue we read from and the burst handles */
+    PfringZcCluster *zc;
+    pfring_zc_queue *zc_queue;
+    pfring_zc_pkt_buff **zc_pkts;
+    int zc_burst;
+#endif
 } PfringThreadVars;
 
 /**
@@ -201,6 +244,20 @@ void TmModuleDecodePfringRegister (void)
 
 static inline void PfringDumpCounters(PfringThreadVars *ptv)
 {
+#ifdef HAVE_PFRING_ZC
+    if (ptv->zc != NULL) {
+        pfring_zc_stat zc_s;
+        if (likely(pfring_zc_stats(ptv->zc_queue, &zc_s) >= 0)) {
+            uint64_t th_pkts = StatsGetLocalCounterValue(ptv->tv, ptv->capture_kernel_packets);
+            uint64_t th_drops = StatsGetLocalCounterValue(ptv->tv, ptv->capture_kernel_drops);
+            SC_ATOMIC_ADD(ptv->livedev->pkts, zc_s.recv - th_pkts);
+            SC_ATOMIC_ADD(ptv->livedev->drop, zc_s.drop - th_drops);
+            StatsSetUI64(ptv->tv, ptv->capture_kernel_packets, zc_s.recv);
+            StatsSetUI64(ptv->tv, ptv->capture_kernel_drops, zc_s.drop);
+        }
+        return;
+    }
+#endif
     pfring_stat pfring_s;
     if (likely((pfring_stats(ptv->pd, &pfring_s) >= 0))) {
         /* pfring counter is per socket and is not cleared after read.
@@ -216,6 +273,37 @@ static inline void PfringDumpCounters(PfringThreadVars *ptv)
     }
 }
 
+/**
+ * \brief Set PKT_IGNORE_CHECKSUM according to the checksum mode.
+ *
+ * \param rx_direction from the extended header, 1 if the packet was
+ *        received by the card (rxonly mode)
+ */
+static inline void PfringSetChecksumFlags(PfringThreadVars *ptv, Packet *p,
+        int rx_direction)
+{
+    switch (ptv->checksum_mode) {
+        case CHECKSUM_VALIDATION_RXONLY:
+            if (rx_direction == 0) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+            break;
+        case CHECKSUM_VALIDATION_DISABLE:
+            p->flags |= PKT_IGNORE_CHECKSUM;
+            break;
+        case CHECKSUM_VALIDATION_AUTO:
+            if (ptv->livedev->ignore_checksum) {
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if (ChecksumAutoModeCheckDevice(ptv->pkts, ptv->livedev)) {
+                ptv->livedev->ignore_checksum = 1;
+                p->flags |= PKT_IGNORE_CHECKSUM;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 /**
  * \brief Pfring Packet Process function.
  *
@@ -257,31 +345,324 @@ static inline void PfringProcessPacket(void *user, struct pfring_pkthdr *h, Pack
         p->vlanh[0] = NULL;
     }
 
-    switch (ptv->checksum_mode) {
-        case CHECKSUM_VALIDATION_RXONLY:
-            if (h->extended_hdr.rx_direction == 0) {
-                p->flags |= PKT_IGNORE_CHECKSUM;
+    PfringSetChecksumFlags(ptv, p, h->extended_hdr.rx_direction);
+
+    SET_PKT_LEN(p, h->caplen);
+}
+
+#ifdef HAVE_PFRING_ZC
+/**
+ * \brief ZC balancer distribution function
+ *
+ * Hashes the packet the way the flow engine does, looking into GRE and
+ * VXLAN tunnels, so both directions of a flow and all flows inside a
+ * tunnel are spread over the threads by their inner addresses and ports.
+ *
+ * \retval queue index for the packet
+ */
+static int64_t PfringZcBalancerHash(pfring_zc_pkt_buff *pkt,
+        pfring_zc_queue *in_queue, void *user)
+{
+    PfringZcCluster *zc = (PfringZcCluster *)user;
+    const uint8_t *data = pfring_zc_pkt_buff_data(pkt, in_queue);
+
+    pkt->hash = FlowGetHashRaw(data, pkt->len, zc->use_vlan, zc->vxlan_port);
+    return pkt->hash % zc->threads;
+}
+
+static void PfringZcClusterFree(PfringZcCluster *zc)
+{
+    if (zc->balancer != NULL)
+        pfring_zc_kill_worker(zc->balancer);
+    /* destroying the cluster closes the device and the queues */
+    if (zc->cluster != NULL)
+        pfring_zc_destroy_cluster(zc->cluster);
+    if (zc->queues != NULL)
+        SCFree(zc->queues);
+    SCFree(zc);
+}
+
+/**
+ * \brief Set up the ZC cluster for an interface
+ *
+ * Opens the device and, for more than one thread, starts the balancer.
+ * Called with pfring_zc_lock held.
+ */
+static PfringZcCluster *PfringZcClusterCreate(const PfringIfaceConfig *pfconf)
+{
+    char device[PFRING_IFACE_NAME_LENGTH + 3];
+    int vlanbool = 0;
+    int i;
+
+    PfringZcCluster *zc = SCCalloc(1, sizeof(*zc));
+    if (unlikely(zc == NULL))
+        return NULL;
+
+    strlcpy(zc->iface, pfconf->iface, sizeof(zc->iface));
+    zc->cluster_id = pfconf->cluster_id;
+    zc->threads = pfconf->threads;
+    zc->vxlan_port = DecodeVXLANGetPort();
+    zc->use_vlan = 1;
+    if ((ConfGetBool("vlan.use-for-tracking", &vlanbool)) == 1 && vlanbool == 0) {
+        zc->use_vlan = 0;
+    }
+
+    if (strncmp(pfconf->iface, "zc:", 3) == 0) {
+        strlcpy(device, pfconf->iface, sizeof(device));
+    } else {
+        snprintf(device, sizeof(device), "zc:%s", pfconf->iface);
+    }
+
+    uint32_t buffers = (uint32_t)pfconf->zc_buffers;
+    if (buffers == 0) {
+        buffers = PFRING_ZC_RX_SLOTS + PFRING_ZC_PREFETCH +
+            zc->threads * (PFRING_ZC_QUEUE_LEN + pfconf->zc_burst);
+    }
+
+    zc->cluster = pfring_zc_create_cluster(zc->cluster_id, default_packet_size,
+            0, buffers, -1, NULL, 0);
+    if (zc->cluster == NULL) {
+        SCLogError(SC_ERR_PF_RING_OPEN, "pfring_zc_create_cluster failed for "
+                "%s, cluster-id %d, %u buffers: %s", pfconf->iface,
+                zc->cluster_id, buffers, strerror(errno));
+        PfringZcClusterFree(zc);
+        return NULL;
+    }
+
+    zc->device = pfring_zc_open_device(zc->cluster, device, rx_only, 0);
+    if (zc->device == NULL) {
+        SCLogError(SC_ERR_PF_RING_OPEN, "pfring_zc_open_device failed for %s: "
+                "%s. Check if the ZC driver is loaded.", device, strerror(errno));
+        PfringZcClusterFree(zc);
+        return NULL;
+    }
+
+    if (zc->threads > 1) {
+        zc->queues = SCCalloc(zc->threads, sizeof(pfring_zc_queue *));
+        if (unlikely(zc->queues == NULL)) {
+            PfringZcClusterFree(zc);
+            return NULL;
+        }
+        for (i = 0; i < zc->threads; i++) {
+            zc->queues[i] = pfring_zc_create_queue(zc->cluster, PFRING_ZC_QUEUE_LEN);
+            if (zc->queues[i] == NULL) {
+                SCLogError(SC_ERR_PF_RING_OPEN, "pfring_zc_create_queue failed "
+                        "for %s", pfconf->iface);
+                PfringZcClusterFree(zc);
+                return NULL;
             }
+        }
+        zc->pool = pfring_zc_create_buffer_pool(zc->cluster, PFRING_ZC_PREFETCH);
+        if (zc->pool == NULL) {
+            SCLogError(SC_ERR_PF_RING_OPEN, "pfring_zc_create_buffer_pool failed "
+                    "for %s", pfconf->iface);
+            PfringZcClusterFree(zc);
+            return NULL;
+        }
+        zc->balancer = pfring_zc_run_balancer(&zc->device, zc->queues, 1,
+                zc->threads, zc->pool, round_robin_bursts_policy, NULL,
+                PfringZcBalancerHash, (void *)zc, 0, -1);
+        if (zc->balancer == NULL) {
+            SCLogError(SC_ERR_PF_RING_OPEN, "pfring_zc_run_balancer failed "
+                    "for %s", pfconf->iface);
+            PfringZcClusterFree(zc);
+            return NULL;
+        }
+    }
+
+    SCLogPerf("%s: PF_RING ZC cluster %d, %u buffers, %d thread(s)%s",
+            pfconf->iface, zc->cluster_id, buffers, zc->threads,
+            zc->balancer ? ", flow hash balancer" : "");
+    return zc;
+}
+
+/**
+ * \brief Attach a receive thread to the ZC cluster of its interface
+ *
+ * The first thread sets up the cluster. Each thread gets its own queue
+ * and burst of packet handles.
+ */
+static TmEcode PfringZcThreadInit(PfringThreadVars *ptv, const PfringIfaceConfig *pfconf)
+{
+    PfringZcCluster *zc;
+    int i;
+
+    SCMutexLock(&pfring_zc_lock);
+    for (zc = pfring_zc_clusters; zc != NULL; zc = zc->next) {
+        if (strcmp(zc->iface, pfconf->iface) == 0)
             break;
-        case CHECKSUM_VALIDATION_DISABLE:
-            p->flags |= PKT_IGNORE_CHECKSUM;
-            break;
-        case CHECKSUM_VALIDATION_AUTO:
-            if (ptv->livedev->ignore_checksum) {
-                p->flags |= PKT_IGNORE_CHECKSUM;
-            } else if (ChecksumAutoModeCheck(ptv->pkts,
-                        SC_ATOMIC_GET(ptv->livedev->pkts),
-                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
-                ptv->livedev->ignore_checksum = 1;
-                p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+    if (zc == NULL) {
+        zc = PfringZcClusterCreate(pfconf);
+        if (zc == NULL) {
+            SCMutexUnlock(&pfring_zc_lock);
+            return TM_ECODE_FAILED;
+        }
+        zc->next = pfring_zc_clusters;
+        pfring_zc_clusters = zc;
+    }
+    if (zc->next_queue >= zc->threads) {
+        SCMutexUnlock(&pfring_zc_lock);
+        SCLogError(SC_ERR_PF_RING_OPEN, "no ZC queue left for %s", pfconf->iface);
+        return TM_ECODE_FAILED;
+    }
+    ptv->zc_queue = zc->balancer ? zc->queues[zc->next_queue] : zc->device;
+    zc->next_queue++;
+    zc->refcnt++;
+    ptv->zc = zc;
+
+    ptv->zc_burst = pfconf->zc_burst;
+    ptv->zc_pkts = SCCalloc(ptv->zc_burst, sizeof(pfring_zc_pkt_buff *));
+    if (unlikely(ptv->zc_pkts == NULL)) {
+        SCMutexUnlock(&pfring_zc_lock);
+        return TM_ECODE_FAILED;
+    }
+    for (i = 0; i < ptv->zc_burst; i++) {
+        ptv->zc_pkts[i] = pfring_zc_get_packet_handle(zc->cluster);
+        if (ptv->zc_pkts[i] == NULL) {
+            SCMutexUnlock(&pfring_zc_lock);
+            SCLogError(SC_ERR_PF_RING_OPEN, "out of ZC packet handles for %s, "
+                    "increase zc-buffers", pfconf->iface);
+            return TM_ECODE_FAILED;
+        }
+    }
+    SCMutexUnlock(&pfring_zc_lock);
+
+    /* there is no rx direction info in ZC mode */
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_RXONLY) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Can't use rxonly checksum-checks "
+                "in ZC mode, resetting to auto");
+        ptv->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    }
+
+    return TM_ECODE_OK;
+}
+
+/** \brief detach a thread, the last one tears the cluster down */
+static void PfringZcThreadDeinit(PfringThreadVars *ptv)
+{
+    PfringZcCluster *zc = ptv->zc;
+    int i;
+
+    SCMutexLock(&pfring_zc_lock);
+    if (ptv->zc_pkts != NULL) {
+        for (i = 0; i < ptv->zc_burst; i++) {
+            if (ptv->zc_pkts[i] != NULL)
+                pfring_zc_release_packet_handle(zc->cluster, ptv->zc_pkts[i]);
+        }
+        SCFree(ptv->zc_pkts);
+        ptv->zc_pkts = NULL;
+    }
+    if (--zc->refcnt == 0) {
+        PfringZcCluster **pzc = &pfring_zc_clusters;
+        while (*pzc != zc)
+            pzc = &(*pzc)->next;
+        *pzc = zc->next;
+        PfringZcClusterFree(zc);
+    }
+    SCMutexUnlock(&pfring_zc_lock);
+    ptv->zc = NULL;
+    ptv->zc_queue = NULL;
+}
+
+/**
+ * \brief Receive loop for ZC mode
+ *
+ * Packets are read in bursts and handed to the slots as one batch. In
+ * workers mode the packets point into the ZC buffers, which stay valid
+ * until the next burst is read, after the batch has been processed.
+ */
+static TmEcode ReceivePfringZcLoop(ThreadVars *tv, PfringThreadVars *ptv)
+{
+    Packet *batch[PFRING_ZC_BURST_MAX];
+    time_t last_dump = 0;
+    int i;
+
+    while (1) {
+        if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
+            SCReturnInt(TM_ECODE_OK);
+        }
+
+        /* make sure we have at least one packet in the packet pool, to prevent
+         * us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        int n = pfring_zc_recv_pkt_burst(ptv->zc_queue, ptv->zc_pkts,
+                ptv->zc_burst, 0);
+        if (unlikely(n < 0)) {
+            SCLogError(SC_ERR_PF_RING_RECV, "pfring_zc_recv_pkt_burst error %d", n);
+            SCReturnInt(TM_ECODE_FAILED);
+        } else if (n == 0) {
+            TmThreadsCaptureInjectPacket(tv, ptv->slot, NULL);
+            StatsSyncCountersIfSignalled(tv);
+            usleep(PFRING_ZC_IDLE_USEC);
+            continue;
+        }
+
+        struct timeval now = { 0, 0 };
+        uint32_t cnt = 0;
+        for (i = 0; i < n; i++) {
+            pfring_zc_pkt_buff *b = ptv->zc_pkts[i];
+            u_char *data = pfring_zc_pkt_buff_data(b, ptv->zc_queue);
+
+            Packet *p = PacketGetFromQueueOrAlloc();
+            if (unlikely(p == NULL)) {
+                while (cnt > 0)
+                    TmqhOutputPacketpool(tv, batch[--cnt]);
+                SCReturnInt(TM_ECODE_FAILED);
             }
-            break;
-        default:
-            break;
+            PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+            int r;
+            if (ptv->flags & PFRING_FLAGS_ZERO_COPY) {
+                r = PacketSetData(p, data, b->len);
+            } else {
+                r = PacketCopyData(p, data, b->len);
+            }
+            if (unlikely(r == -1)) {
+                TmqhOutputPacketpool(tv, p);
+                continue;
+            }
+
+            ptv->bytes += b->len;
+            ptv->pkts++;
+            p->livedev = ptv->livedev;
+            p->datalink = LINKTYPE_ETHERNET;
+
+            /* only set with hardware timestamping */
+            if (b->ts.tv_sec != 0) {
+                p->ts.tv_sec = b->ts.tv_sec;
+                p->ts.tv_usec = b->ts.tv_nsec / 1000;
+            } else {
+                if (now.tv_sec == 0)
+                    gettimeofday(&now, NULL);
+                p->ts = now;
+            }
+
+            PfringSetChecksumFlags(ptv, p, 1);
+            batch[cnt++] = p;
+        }
+        if (cnt == 0)
+            continue;
+
+        /* the packets may be gone after processing */
+        time_t ts = batch[cnt - 1]->ts.tv_sec;
+
+        if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, batch, cnt) != TM_ECODE_OK) {
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+
+        /* Trigger one dump of stats every second */
+        if (ts != last_dump) {
+            PfringDumpCounters(ptv);
+            last_dump = ts;
+        }
+        StatsSyncCountersIfSignalled(tv);
     }
 
-    SET_PKT_LEN(p, h->caplen);
+    return TM_ECODE_OK;
 }
+#endif /* HAVE_PFRING_ZC */
 
 /**
  * \brief Recieves packets from an interface via libpfring.
@@ -309,6 +690,12 @@ TmEcode ReceivePfringLoop(ThreadVars *tv, void *data, void *slot)
 
     ptv->slot = s->slot_next;
 
+#ifdef HAVE_PFRING_ZC
+    if (ptv->zc != NULL) {
+        return ReceivePfringZcLoop(tv, ptv);
+    }
+#endif
+
     /* we have to enable the ring here as we need to do it after all
      * the threads have called pfring_set_cluster(). */
     int rc = pfring_enable_ring(ptv->pd);
@@ -340,6 +727,10 @@ TmEcode ReceivePfringLoop(ThreadVars *tv, void *data, void *slot)
             buffer_size = 0;
             pkt_buffer = NULL;
         } else {
+            if (PacketReserveDirectData(p, default_packet_size) < 0) {
+                TmqhOutputPacketpool(ptv->tv, p);
+                SCReturnInt(TM_ECODE_FAILED);
+            }
             buffer_size = GET_PKT_DIRECT_MAX_SIZE(p);
             pkt_buffer = GET_PKT_DIRECT_DATA(p);
         }
@@ -407,6 +798,13 @@ TmEcode PfringBreakLoop(ThreadVars *tv, void *data)
 {
     PfringThreadVars *ptv = (PfringThreadVars *)data;
 
+#ifdef HAVE_PFRING_ZC
+    if (ptv->zc != NULL) {
+        pfring_zc_queue_breakloop(ptv->zc_queue);
+        return TM_ECODE_OK;
+    }
+#endif
+
     /* Safety check */
     if (ptv->pd == NULL) {
         return TM_ECODE_FAILED;
@@ -474,6 +872,29 @@ TmEcode ReceivePfringThreadInit(ThreadVars *tv, void *initdata, void **data)
 
     ptv->checksum_mode = pfconf->checksum_mode;
 
+#ifdef HAVE_PFRING_ZC
+    if (pfconf->flags & PFRING_CONF_FLAGS_ZC) {
+        ptv->threads = pfconf->threads;
+        ptv->cluster_id = pfconf->cluster_id;
+        if (PfringZcThreadInit(ptv, pfconf) != TM_ECODE_OK) {
+            if (ptv->zc != NULL)
+                PfringZcThreadDeinit(ptv);
+            pfconf->DerefFunc(pfconf);
+            SCFree(ptv->interface);
+            SCFree(ptv);
+            return TM_ECODE_FAILED;
+        }
+        ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+                ptv->tv);
+        ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+                ptv->tv);
+
+        *data = (void *)ptv;
+        pfconf->DerefFunc(pfconf);
+        return TM_ECODE_OK;
+    }
+#endif
+
     opflag = PF_RING_PROMISC;
 
     /* if suri uses VLAN and if we have a recent kernel, we need
@@ -626,6 +1047,12 @@ TmEcode ReceivePfringThreadDeinit(ThreadVars *tv, void *data)
     PfringThreadVars *ptv = (PfringThreadVars *)data;
     if (ptv->interface)
         SCFree(ptv->interface);
+#ifdef HAVE_PFRING_ZC
+    if (ptv->zc != NULL) {
+        PfringZcThreadDeinit(ptv);
+        return TM_ECODE_OK;
+    }
+#endif
     pfring_remove_from_cluster(ptv->pd);
 
     if (ptv->bpf_filter) {
@@ -700,11 +1127,6 @@ TmEcode DecodePfringThreadInit(ThreadVars *tv, void *initdata, void **data)
 
     *data = (void *)dtv;
 
-#ifdef __SC_CUDA_SUPPORT__
-    if (CudaThreadVarsInit(&dtv->cuda_vars) < 0)
-        SCReturnInt(TM_ECODE_FAILED);
-#endif
-
     return TM_ECODE_OK;
 }
 
@@ -32,9 +32,14 @@
 #endif
 
 typedef enum {
-    PFRING_CONF_FLAGS_CLUSTER = 0x1
+    PFRING_CONF_FLAGS_CLUSTER = 0x1,
+    PFRING_CONF_FLAGS_ZC = 0x2,
 } PfringIfaceConfigFlags;
 
+/** default number of packets read per ZC burst */
+#define PFRING_ZC_BURST_DEFAULT 32
+#define PFRING_ZC_BURST_MAX     256
+
 typedef struct PfringIfaceConfig_
 {
     uint32_t flags;
@@ -50,6 +55,10 @@ typedef struct PfringIfaceConfig_
 
     char *bpf_filter;
 
+    /* ZC mode: packets per burst and cluster buffers (0: auto) */
+    int zc_burst;
+    int zc_buffers;
+
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, ref);
     void (*DerefFunc)(void *);
@@ -27,6 +27,7 @@
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-streaming-buffer.h"
 
 #define STREAMTCP_QUEUE_FLAG_TS     0x01
 #define STREAMTCP_QUEUE_FLAG_WS     0x02
@@ -47,9 +48,15 @@ typedef struct TcpStateQueue_ {
 typedef struct StreamTcpSackRecord_ {
     uint32_t le;    /**< left edge, host order */
     uint32_t re;    /**< right edge, host order */
-    struct StreamTcpSackRecord_ *next;
 } StreamTcpSackRecord;
 
+/** SACK ranges kept in the stream itself, before an array is allocated */
+#define STREAM_SACK_INLINE_RECORDS  4
+
+/** sorted array of SACK ranges of a stream */
+#define STREAM_SACK_RECORDS(stream) \
+    ((stream)->sack_ext != NULL ? (stream)->sack_ext : (stream)->sack_inline)
+
 typedef struct TcpSegment_ {
     uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
@@ -81,12 +88,24 @@ typedef struct TcpStream_ {
     /* reassembly */
     uint32_t ra_app_base_seq;       /**< reassembled seq. We've reassembled up to this point. */
     uint32_t ra_raw_base_seq;       /**< reassembled seq. We've reassembled up to this point. */
+    uint32_t raw_depth;             /**< bytes the rules inspect of the raw
+                                         stream, 0 for all */
 
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
 
-    StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
-    StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
+    StreamingBuffer *sb;            /**< in-order data for the app layer, only
+                                         used with stream.reassembly.streaming-buffer */
+
+    /* SACK ranges, sorted and not overlapping. Use STREAM_SACK_RECORDS
+     * to get to them. */
+    uint16_t sack_cnt;              /**< number of SACK ranges */
+    uint16_t sack_size;             /**< size of sack_ext, 0 if not allocated */
+    StreamTcpSackRecord *sack_ext;  /**< allocated ranges, once the inline
+                                         ones don't suffice */
+    StreamTcpSackRecord sack_inline[STREAM_SACK_INLINE_RECORDS];
+
+    void *mpm_state;                /**< raw stream mpm state, see MpmStreamStateFree() */
 } TcpStream;
 
 /* from /usr/include/netinet/tcp.h */
@@ -169,7 +188,9 @@ enum
 #define STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED 0x0100
 /** Raw reassembly disabled for new segments */
 #define STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED 0x0200
-// vacancy 2x
+/** No rule inspects the raw stream, no stream msgs are made */
+#define STREAMTCP_STREAM_FLAG_RAW_SKIPPED       0x0400
+// vacancy
 /** NOTE: flags field is 12 bits */
 
 
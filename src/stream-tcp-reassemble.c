@@ -40,11 +40,13 @@
 #include "tm-threads.h"
 
 #include "util-pool.h"
+#include "util-pool-depot.h"
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-host-os-info.h"
 #include "util-unittest-helper.h"
 #include "util-byte.h"
+#include "util-mem-tag.h"
 
 #include "stream-tcp.h"
 #include "stream-tcp-private.h"
@@ -62,13 +64,13 @@
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
+#include "util-memcap.h"
 
 #define PSEUDO_PACKET_PAYLOAD_SIZE  65416 /* 64 Kb minus max IP and TCP header */
 
 #ifdef DEBUG
-static SCMutex segment_pool_memuse_mutex;
-static uint64_t segment_pool_memuse = 0;
-static uint64_t segment_pool_memcnt = 0;
+SC_ATOMIC_DECLARE(uint64_t, segment_pool_memuse);
+SC_ATOMIC_DECLARE(uint64_t, segment_pool_memcnt);
 #endif
 
 /* We define several pools with prealloced segments with fixed size
@@ -77,20 +79,29 @@ static uint64_t segment_pool_memcnt = 0;
  * The cost is in memory of course. The number of pools and the properties
  * of the pools are determined by the yaml. */
 static int segment_pool_num = 0;
-static Pool **segment_pool = NULL;
-static SCMutex *segment_pool_mutex = NULL;
+static PoolDepot **segment_pool = NULL;
 static uint16_t *segment_pool_pktsizes = NULL;
 #ifdef DEBUG
-static SCMutex segment_pool_cnt_mutex;
-static uint64_t segment_pool_cnt = 0;
+SC_ATOMIC_DECLARE(uint64_t, segment_pool_cnt);
 #endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
+
+/* Segments are moved between the pools and the per thread magazines
+ * in batches of this size. Segments in the magazines are accounted for
+ * in ra_memuse like the ones in the pools. */
+#define SEGMENT_POOL_BATCH 64
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
 SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
 
+/* reassembly depth while shedding under memcap pressure, 0 if not */
+SC_ATOMIC_DECLARE(uint32_t, ra_shed_depth);
+
+/* depth we shed from if the configured depth is unlimited */
+#define RA_SHED_DEPTH_BASE  (1024 * 1024)
+
 /* prototypes */
 static int HandleSegmentStartsBeforeListSegment(ThreadVars *, TcpReassemblyThreadCtx *,
                                     TcpStream *, TcpSegment *, TcpSegment *, Packet *);
@@ -141,6 +152,28 @@ uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
     return smemuse;
 }
 
+static uint64_t StreamTcpReassembleMemcap(void)
+{
+    return stream_config.reassembly_memcap;
+}
+
+/** \internal
+ *  \brief memcap policy: shrink the depth to 1/4 at degrade and to 1/16
+ *         at critical. Streams past the new depth stop reassembling. */
+static void StreamTcpReassembleShed(int level, int prev)
+{
+    uint32_t base = stream_config.reassembly_depth ?
+        stream_config.reassembly_depth : RA_SHED_DEPTH_BASE;
+    uint32_t depth = 0;
+
+    if (level >= MEMCAP_LEVEL_CRITICAL)
+        depth = MAX(base / 16, 1);
+    else if (level >= MEMCAP_LEVEL_DEGRADE)
+        depth = MAX(base / 4, 1);
+
+    SC_ATOMIC_SET(ra_shed_depth, depth);
+}
+
 /**
  * \brief  Function to Check the reassembly memory usage counter against the
  *         allowed max memory usgae for TCP segments.
@@ -188,17 +221,15 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
     seg->pool_size = size;
     seg->payload_len = seg->pool_size;
 
-    seg->payload = SCMalloc(seg->payload_len);
+    seg->payload = SCMallocTag(MEM_TAG_STREAM, seg->payload_len);
     if (seg->payload == NULL) {
         return 0;
     }
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse += seg->payload_len;
-    segment_pool_memcnt++;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
+    (void) SC_ATOMIC_ADD(segment_pool_memuse, seg->payload_len);
+    (void) SC_ATOMIC_ADD(segment_pool_memcnt, 1);
+    SCLogDebug("segment_pool_memcnt %"PRIu64"", SC_ATOMIC_GET(segment_pool_memcnt));
 #endif
 
     StreamTcpReassembleIncrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
@@ -216,14 +247,12 @@ void TcpSegmentPoolCleanup(void *ptr)
     StreamTcpReassembleDecrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_memuse_mutex);
-    segment_pool_memuse -= seg->pool_size;
-    segment_pool_memcnt--;
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexUnlock(&segment_pool_memuse_mutex);
+    (void) SC_ATOMIC_SUB(segment_pool_memuse, seg->pool_size);
+    (void) SC_ATOMIC_SUB(segment_pool_memcnt, 1);
+    SCLogDebug("segment_pool_memcnt %"PRIu64"", SC_ATOMIC_GET(segment_pool_memcnt));
 #endif
 
-    SCFree(seg->payload);
+    SCFreeTag(MEM_TAG_STREAM, seg->payload);
     return;
 }
 
@@ -241,16 +270,10 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->prev = NULL;
 
     uint16_t idx = segment_pool_idx[seg->pool_size];
-    SCMutexLock(&segment_pool_mutex[idx]);
-    PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
-               idx,segment_pool[idx]->empty_stack_size);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    PoolDepotReturn(segment_pool[idx], (void *) seg);
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_cnt_mutex);
-    segment_pool_cnt--;
-    SCMutexUnlock(&segment_pool_cnt_mutex);
+    (void) SC_ATOMIC_SUB(segment_pool_cnt, 1);
 #endif
 }
 
@@ -277,6 +300,19 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     stream->seg_list_tail = NULL;
 }
 
+/**
+ *  \brief free the app layer StreamingBuffer of this stream
+ *
+ *  \param stream the stream to cleanup
+ */
+void StreamTcpReassembleFreeStreamingBuffer(TcpStream *stream)
+{
+    if (stream->sb != NULL) {
+        StreamingBufferFree(stream->sb);
+        stream->sb = NULL;
+    }
+}
+
 /** \param f locked flow */
 void StreamTcpDisableAppLayer(Flow *f)
 {
@@ -313,10 +349,59 @@ static int SortByPktsize(const void *a, const void *b)
     return s0->pktsize - s1->pktsize;
 }
 
+/* memory handling for the per stream StreamingBuffer, accounted
+ * against the reassembly memcap */
+static void *ReassembleCalloc(size_t n, size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)(n * size)) == 0)
+        return NULL;
+
+    void *ptr = SCCallocTag(MEM_TAG_STREAM, n, size);
+    if (ptr == NULL)
+        return NULL;
+    StreamTcpReassembleIncrMemuse(n * size);
+    return ptr;
+}
+
+static void *ReassembleMalloc(size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)size) == 0)
+        return NULL;
+
+    void *ptr = SCMallocTag(MEM_TAG_STREAM, size);
+    if (ptr == NULL)
+        return NULL;
+    StreamTcpReassembleIncrMemuse(size);
+    return ptr;
+}
+
+static void *ReassembleRealloc(void *optr, size_t orig_size, size_t size)
+{
+    if (size > orig_size) {
+        if (StreamTcpReassembleCheckMemcap((uint32_t)(size - orig_size)) == 0)
+            return NULL;
+    }
+
+    void *nptr = SCReallocTag(MEM_TAG_STREAM, optr, size);
+    if (nptr == NULL)
+        return NULL;
+
+    if (size > orig_size)
+        StreamTcpReassembleIncrMemuse(size - orig_size);
+    else
+        StreamTcpReassembleDecrMemuse(orig_size - size);
+    return nptr;
+}
+
+static void ReassembleFree(void *ptr, size_t size)
+{
+    SCFreeTag(MEM_TAG_STREAM, ptr);
+    StreamTcpReassembleDecrMemuse(size);
+}
+
 int StreamTcpReassemblyConfig(char quiet)
 {
-    Pool **my_segment_pool = NULL;
-    SCMutex *my_segment_lock = NULL;
+    PoolDepot **my_segment_pool = NULL;
     uint16_t *my_segment_pktsizes = NULL;
     SegmentSizes sizes[256];
     memset(&sizes, 0x00, sizeof(sizes));
@@ -403,23 +488,15 @@ int StreamTcpReassemblyConfig(char quiet)
         SCLogDebug("pktsize %u, prealloc %u", sizes[i].pktsize, sizes[i].prealloc);
     }
 
-    my_segment_pool = SCMalloc(npools * sizeof(Pool *));
+    my_segment_pool = SCMalloc(npools * sizeof(PoolDepot *));
     if (my_segment_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
         return -1;
     }
-    my_segment_lock = SCMalloc(npools * sizeof(SCMutex));
-    if (my_segment_lock == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
-
-        SCFree(my_segment_pool);
-        return -1;
-    }
     my_segment_pktsizes = SCMalloc(npools * sizeof(uint16_t));
     if (my_segment_pktsizes == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
 
-        SCFree(my_segment_lock);
         SCFree(my_segment_pool);
         return -1;
     }
@@ -428,15 +505,13 @@ int StreamTcpReassemblyConfig(char quiet)
     for (i = 0; i < npools; i++) {
         my_segment_pktsizes[i] = sizes[i].pktsize;
         my_segment_poolsizes[i] = sizes[i].prealloc;
-        SCMutexInit(&my_segment_lock[i], NULL);
 
         /* setup the pool */
-        SCMutexLock(&my_segment_lock[i]);
-        my_segment_pool[i] = PoolInit(0, my_segment_poolsizes[i], 0,
+        my_segment_pool[i] = PoolDepotInit(SEGMENT_POOL_BATCH, 0,
+                my_segment_poolsizes[i], 0,
                 TcpSegmentPoolAlloc, TcpSegmentPoolInit,
                 (void *) &my_segment_pktsizes[i],
                 TcpSegmentPoolCleanup, NULL);
-        SCMutexUnlock(&my_segment_lock[i]);
 
         if (my_segment_pool[i] == NULL) {
             SCLogError(SC_ERR_INITIALIZATION, "couldn't set up segment pool "
@@ -467,7 +542,6 @@ int StreamTcpReassemblyConfig(char quiet)
     }
     /* set the globals */
     segment_pool = my_segment_pool;
-    segment_pool_mutex = my_segment_lock;
     segment_pool_pktsizes = my_segment_pktsizes;
     segment_pool_num = npools;
 
@@ -499,6 +573,21 @@ int StreamTcpReassemblyConfig(char quiet)
     if (!quiet)
         SCLogConfig("stream.reassembly \"zero-copy-size\": %u", stream_config.zero_copy_size);
 
+    int use_sb = 0;
+    if (ConfGetBool("stream.reassembly.streaming-buffer", &use_sb) == 1 && use_sb) {
+        stream_config.flags |= STREAMTCP_INIT_FLAG_STREAMING_BUFFER;
+    }
+    stream_config.sbcnf.flags = STREAMING_BUFFER_NOFLAGS;
+    stream_config.sbcnf.buf_size = 4096;
+    stream_config.sbcnf.Malloc = ReassembleMalloc;
+    stream_config.sbcnf.Calloc = ReassembleCalloc;
+    stream_config.sbcnf.Realloc = ReassembleRealloc;
+    stream_config.sbcnf.Free = ReassembleFree;
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"streaming-buffer\": %s",
+                stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER ?
+                "enabled" : "disabled");
+
     return 0;
 }
 
@@ -506,16 +595,20 @@ int StreamTcpReassembleInit(char quiet)
 {
     /* init the memcap/use tracker */
     SC_ATOMIC_INIT(ra_memuse);
+    SC_ATOMIC_INIT(ra_shed_depth);
+#ifdef DEBUG
+    SC_ATOMIC_INIT(segment_pool_memuse);
+    SC_ATOMIC_INIT(segment_pool_memcnt);
+    SC_ATOMIC_INIT(segment_pool_cnt);
+#endif
 
     if (StreamTcpReassemblyConfig(quiet) < 0)
         return -1;
-#ifdef DEBUG
-    SCMutexInit(&segment_pool_memuse_mutex, NULL);
-    SCMutexInit(&segment_pool_cnt_mutex, NULL);
-#endif
 
     StatsRegisterGlobalCounter("tcp.reassembly_memuse",
             StreamTcpReassembleMemuseGlobalCounter);
+    MemcapPolicyRegister("stream.reassembly", StreamTcpReassembleMemuseGlobalCounter,
+            StreamTcpReassembleMemcap, StreamTcpReassembleShed);
     return 0;
 }
 
@@ -527,43 +620,39 @@ static uint32_t dbg_app_layer_gap_candidate;
 void StreamTcpReassembleFree(char quiet)
 {
     uint16_t u16 = 0;
+
     for (u16 = 0; u16 < segment_pool_num; u16++) {
-        SCMutexLock(&segment_pool_mutex[u16]);
+        SCMutexLock(&segment_pool[u16]->m);
+        Pool *pool = segment_pool[u16]->pool;
 
         if (quiet == FALSE) {
-            PoolPrintSaturation(segment_pool[u16]);
+            PoolPrintSaturation(pool);
             SCLogDebug("segment_pool[u16]->empty_stack_size %"PRIu32", "
                        "segment_pool[u16]->alloc_stack_size %"PRIu32", alloced "
-                       "%"PRIu32"", segment_pool[u16]->empty_stack_size,
-                       segment_pool[u16]->alloc_stack_size,
-                       segment_pool[u16]->allocated);
+                       "%"PRIu32"", pool->empty_stack_size,
+                       pool->alloc_stack_size, pool->allocated);
 
-            if (segment_pool[u16]->max_outstanding > segment_pool[u16]->allocated) {
+            if (pool->max_outstanding > pool->allocated) {
                 SCLogPerf("TCP segment pool of size %u had a peak use of %u segments, "
                         "more than the prealloc setting of %u", segment_pool_pktsizes[u16],
-                        segment_pool[u16]->max_outstanding, segment_pool[u16]->allocated);
+                        pool->max_outstanding, pool->allocated);
             }
         }
-        PoolFree(segment_pool[u16]);
+        SCMutexUnlock(&segment_pool[u16]->m);
 
-        SCMutexUnlock(&segment_pool_mutex[u16]);
-        SCMutexDestroy(&segment_pool_mutex[u16]);
+        PoolDepotFree(segment_pool[u16]);
     }
     SCFree(segment_pool);
-    SCFree(segment_pool_mutex);
     SCFree(segment_pool_pktsizes);
     segment_pool = NULL;
-    segment_pool_mutex = NULL;
     segment_pool_pktsizes = NULL;
 
     StreamMsgQueuesDeinit(quiet);
 
 #ifdef DEBUG
-    SCLogDebug("segment_pool_cnt %"PRIu64"", segment_pool_cnt);
-    SCLogDebug("segment_pool_memuse %"PRIu64"", segment_pool_memuse);
-    SCLogDebug("segment_pool_memcnt %"PRIu64"", segment_pool_memcnt);
-    SCMutexDestroy(&segment_pool_memuse_mutex);
-    SCMutexDestroy(&segment_pool_cnt_mutex);
+    SCLogDebug("segment_pool_cnt %"PRIu64"", SC_ATOMIC_GET(segment_pool_cnt));
+    SCLogDebug("segment_pool_memuse %"PRIu64"", SC_ATOMIC_GET(segment_pool_memuse));
+    SCLogDebug("segment_pool_memcnt %"PRIu64"", SC_ATOMIC_GET(segment_pool_memcnt));
     SCLogPerf("dbg_app_layer_gap %u", dbg_app_layer_gap);
     SCLogPerf("dbg_app_layer_gap_candidate %u", dbg_app_layer_gap_candidate);
 #endif
@@ -586,6 +675,7 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
 void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
 {
     SCEnter();
+    PoolDepotThreadFlush();
     AppLayerDestroyCtxThread(ra_ctx->app_tctx);
 #ifdef DEBUG
     SCLogDebug("reassembly fast path stats: fp1 %"PRIu64" fp2 %"PRIu64" sp %"PRIu64,
@@ -713,6 +803,39 @@ static inline uint32_t StreamTcpReassembleGetRaBaseSeq(TcpStream *stream)
     }
 }
 
+/**
+ *  \internal
+ *  \brief find the list segment to start the insert walk at
+ *
+ *  The list is sorted and its segments don't overlap, so all segments
+ *  before the first one ending beyond seg->seq would just be skipped by
+ *  the insert walk. Find that segment searching from the end of the list
+ *  closest to seg in sequence space: out of order segments usually fill
+ *  holes near the tail.
+ *
+ *  \retval list_seg segment to start at. Never NULL for a non-empty list.
+ */
+static TcpSegment *ReassembleInsertFindStart(TcpStream *stream, TcpSegment *seg)
+{
+    TcpSegment *list_seg;
+    uint32_t head_dist = seg->seq - stream->seg_list->seq;
+    uint32_t tail_dist = (stream->seg_list_tail->seq +
+            stream->seg_list_tail->payload_len) - seg->seq;
+
+    if (SEQ_LEQ(seg->seq, stream->seg_list->seq) || head_dist <= tail_dist) {
+        list_seg = stream->seg_list;
+        while (list_seg->next != NULL &&
+                SEQ_LEQ((list_seg->seq + list_seg->payload_len), seg->seq))
+            list_seg = list_seg->next;
+    } else {
+        list_seg = stream->seg_list_tail;
+        while (list_seg->prev != NULL &&
+                SEQ_GT((list_seg->prev->seq + list_seg->prev->payload_len), seg->seq))
+            list_seg = list_seg->prev;
+    }
+    return list_seg;
+}
+
 /**
  *  \internal
  *  \brief  Function to handle the insertion newly arrived segment,
@@ -790,6 +913,8 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
         StreamTcpSetOSPolicy(stream, p);
     }
 
+    list_seg = ReassembleInsertFindStart(stream, seg);
+
     for (; list_seg != NULL; list_seg = next_list_seg) {
         next_list_seg = list_seg->next;
 
@@ -1774,9 +1899,14 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpStream *stream,
 {
     SCEnter();
 
+    /* under memcap pressure the policy may have shrunk the depth */
+    uint32_t depth = SC_ATOMIC_GET(ra_shed_depth);
+    if (depth == 0)
+        depth = stream_config.reassembly_depth;
+
     /* if the configured depth value is 0, it means there is no limit on
        reassembly depth. Otherwise carry on my boy ;) */
-    if (stream_config.reassembly_depth == 0) {
+    if (depth == 0) {
         SCReturnUInt(size);
     }
 
@@ -1789,24 +1919,24 @@ static uint32_t StreamTcpReassembleCheckDepth(TcpStream *stream,
      * checking and just reject the rest of the packets including
      * retransmissions. Saves us the hassle of dealing with sequence
      * wraps as well */
-    if (SEQ_GEQ((StreamTcpReassembleGetRaBaseSeq(stream)+1),(stream->isn + stream_config.reassembly_depth))) {
+    if (SEQ_GEQ((StreamTcpReassembleGetRaBaseSeq(stream)+1),(stream->isn + depth))) {
         stream->flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
         SCReturnUInt(0);
     }
 
     SCLogDebug("full Depth not yet reached: %"PRIu32" <= %"PRIu32,
             (StreamTcpReassembleGetRaBaseSeq(stream)+1),
-            (stream->isn + stream_config.reassembly_depth));
+            (stream->isn + depth));
 
-    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + stream_config.reassembly_depth))) {
+    if (SEQ_GEQ(seq, stream->isn) && SEQ_LT(seq, (stream->isn + depth))) {
         /* packet (partly?) fits the depth window */
 
-        if (SEQ_LEQ((seq + size),(stream->isn + stream_config.reassembly_depth))) {
+        if (SEQ_LEQ((seq + size),(stream->isn + depth))) {
             /* complete fit */
             SCReturnUInt(size);
         } else {
             /* partial fit, return only what fits */
-            uint32_t part = (stream->isn + stream_config.reassembly_depth) - seq;
+            uint32_t part = (stream->isn + depth) - seq;
 #if DEBUG
             BUG_ON(part > size);
 #else
@@ -2143,6 +2273,43 @@ static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
         stream->seg_list_tail = seg->prev;
 }
 
+/**
+ *  \internal
+ *  \brief move the raw base up to 'seq' for a stream that skips raw
+ *         reassembly, it's used while the stream has a gap
+ */
+static inline void StreamTcpReassembleRawSkipTo(TcpStream *stream, uint32_t seq)
+{
+    if (SEQ_GT(seq, stream->ra_raw_base_seq + 1))
+        stream->ra_raw_base_seq = seq - 1;
+}
+
+/** \internal \brief stop raw reassembly of a stream, see
+ *         StreamTcpReassembleSkipRaw() */
+static inline void StreamTcpReassembleRawSkipStream(TcpStream *stream)
+{
+    TcpSegment *seg;
+
+    stream->flags |= (STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED|
+                      STREAMTCP_STREAM_FLAG_RAW_SKIPPED);
+    for (seg = stream->seg_list; seg != NULL; seg = seg->next) {
+        seg->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
+    }
+}
+
+/** \internal \brief skip the rest of the stream once raw reassembly is
+ *         past the depth the rules inspect */
+static inline void StreamTcpReassembleRawCheckDepth(TcpStream *stream)
+{
+    if (stream->raw_depth != 0 &&
+        !(stream->flags & STREAMTCP_STREAM_FLAG_RAW_SKIPPED) &&
+        SEQ_GEQ(stream->ra_raw_base_seq, stream->isn + stream->raw_depth))
+    {
+        SCLogDebug("raw depth %u reached", stream->raw_depth);
+        StreamTcpReassembleRawSkipStream(stream);
+    }
+}
+
 /**
  *  \brief Update the stream reassembly upon receiving a data segment
  *
@@ -2170,6 +2337,11 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
 
     if (ssn->flags & STREAMTCP_FLAG_DISABLE_RAW)
         SCReturnInt(0);
+    StreamTcpReassembleRawCheckDepth(stream);
+    if (stream->flags & STREAMTCP_STREAM_FLAG_RAW_SKIPPED) {
+        StreamTcpReassembleRawSkipTo(stream, TCP_GET_SEQ(p) + p->payload_len);
+        SCReturnInt(0);
+    }
     if (stream->seg_list == NULL) {
         SCReturnInt(0);
     }
@@ -2507,6 +2679,41 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
     }
 }
 
+/**
+ *  \brief Stop raw reassembly for a direction nothing inspects
+ *
+ *  Used by detection when the flow's sgh for the direction has no rules
+ *  that inspect the reassembled stream. Unlike
+ *  StreamTcpSetDisableRawReassemblyFlag() the data not yet reassembled
+ *  is not turned into stream msgs. All segments count as raw processed,
+ *  so they're released as soon as the app layer is done with them.
+ *
+ *  \param ssn locked TCP session
+ *  \param direction 0 toserver, 1 toclient
+ */
+void StreamTcpReassembleSkipRaw(TcpSession *ssn, char direction)
+{
+    StreamTcpReassembleRawSkipStream(direction ? &ssn->server : &ssn->client);
+}
+
+/**
+ *  \brief Limit raw reassembly of a direction to the start of the stream
+ *
+ *  Used by detection when the rules of the flow's sgh for the direction
+ *  only inspect the first 'depth' bytes of the stream. Once raw reassembly
+ *  is past them the direction is skipped as with
+ *  StreamTcpReassembleSkipRaw().
+ *
+ *  \param ssn locked TCP session
+ *  \param direction 0 toserver, 1 toclient
+ *  \param depth bytes from the start of the stream, 0 for no limit
+ */
+void StreamTcpReassembleSetRawDepth(TcpSession *ssn, char direction, uint32_t depth)
+{
+    TcpStream *stream = direction ? &ssn->server : &ssn->client;
+    stream->raw_depth = depth;
+}
+
 #ifdef DEBUG
 static uint64_t GetStreamSize(TcpStream *stream)
 {
@@ -2866,6 +3073,183 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     return 1;
 }
 
+/** \internal
+ *  \brief pass the data in the stream's StreamingBuffer to the app layer
+ *
+ *  Until protocol detection is complete the data is kept in the buffer,
+ *  so that it is passed again together with the new data on the next run.
+ *  This replaces the re-walking of the segment list in that phase.
+ */
+static void StreamTcpReassembleAppLayerBufferFlush(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream,
+        Packet *p, uint32_t *data_sent)
+{
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+
+    if (StreamingBufferGetData(stream->sb, &data, &data_len, &offset) == 0 ||
+            data_len == 0)
+        return;
+
+    if (!(ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)) {
+        AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                (uint8_t *)data, data_len,
+                StreamGetAppLayerFlags(ssn, stream, p));
+        AppLayerProfilingStore(ra_ctx->app_tctx, p);
+        *data_sent += data_len;
+
+        if (!(ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED) &&
+                !StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
+            SCLogDebug("no alproto yet, keeping %u bytes", data_len);
+            return;
+        }
+    }
+
+    /* data is consumed */
+    StreamingBufferSlideToOffset(stream->sb, offset + data_len);
+}
+
+/** \internal
+ *  \brief app layer reassembly using the stream's StreamingBuffer
+ *
+ *  In-order data is appended to a single contiguous buffer per stream
+ *  and passed to the app layer in one call per run, instead of in
+ *  fixed size chunks. Segments are flagged as processed as soon as
+ *  their data is in the buffer, so they don't have to be replayed
+ *  while protocol detection is still running. If the buffer is empty
+ *  and a segment is complete and in order it's passed directly, w/o
+ *  copy.
+ *
+ *  ra_app_base_seq tracks the data appended to the buffer.
+ */
+static int StreamTcpReassembleAppLayerBuffer(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpSession *ssn, TcpStream *stream,
+        Packet *p)
+{
+    uint32_t data_sent = 0;
+    uint32_t next_seq = stream->ra_app_base_seq + 1;
+
+    if (stream->sb == NULL) {
+        stream->sb = StreamingBufferInit(&stream_config.sbcnf);
+        if (stream->sb == NULL) {
+            SCLogDebug("no memory for StreamingBuffer, memcap?");
+            SCReturnInt(-1);
+        }
+    }
+
+    TcpSegment *seg = stream->seg_list;
+    while (seg != NULL) {
+        /* if in inline mode, we process all segments regardless of whether
+         * they are ack'd or not. In non-inline, we process only those that
+         * are at least partly ack'd. */
+        if (StreamTcpInlineMode() == 0 && SEQ_GEQ(seg->seq, stream->last_ack))
+            break;
+
+        if (StreamTcpReturnSegmentCheck(p->flow, ssn, stream, seg) == 1) {
+            SCLogDebug("removing segment");
+            TcpSegment *next_seg = seg->next;
+            StreamTcpRemoveSegmentFromStream(stream, seg);
+            StreamTcpSegmentReturntoPool(seg);
+            seg = next_seg;
+            continue;
+        } else if (StreamTcpAppLayerSegmentProcessed(ssn, stream, seg)) {
+            seg = seg->next;
+            continue;
+        }
+
+        /* sequence gap: pass on what we have, then signal the gap */
+        if (unlikely(SEQ_GT(seg->seq, next_seq))) {
+            /* don't conclude it's a gap until we see that the data
+             * that is missing was acked. */
+            if (StreamTcpInlineMode() &&
+                    SEQ_GT(seg->seq, stream->last_ack) && ssn->state != TCP_CLOSED)
+                break;
+
+            StreamTcpReassembleAppLayerBufferFlush(tv, ra_ctx, ssn, stream,
+                    p, &data_sent);
+
+            stream->ra_app_base_seq = seg->seq - 1;
+
+            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                    NULL, 0, StreamGetAppLayerFlags(ssn, stream, p)|STREAM_GAP);
+            AppLayerProfilingStore(ra_ctx->app_tctx, p);
+
+            SCLogDebug("STREAMTCP_STREAM_FLAG_GAP set");
+            stream->flags |= STREAMTCP_STREAM_FLAG_GAP;
+
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEQ_GAP);
+            StatsIncr(tv, ra_ctx->counter_tcp_reass_gap);
+#ifdef DEBUG
+            dbg_app_layer_gap++;
+#endif
+            StreamTcpReassembleFreeStreamingBuffer(stream);
+            SCReturnInt(0);
+        }
+
+        /* get the part of the segment we haven't seen yet, up to
+         * last_ack if not in inline mode */
+        uint32_t seg_end = seg->seq + seg->payload_len;
+        int partial = 0;
+        if (StreamTcpInlineMode() == 0 && SEQ_LT(stream->last_ack, seg_end)) {
+            seg_end = stream->last_ack;
+            partial = 1;
+        }
+        if (SEQ_LEQ(seg_end, next_seq)) {
+            if (!partial)
+                seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+            seg = seg->next;
+            continue;
+        }
+        uint32_t offset = SEQ_LT(seg->seq, next_seq) ? next_seq - seg->seq : 0;
+        uint32_t len = seg_end - (seg->seq + offset);
+
+        if (stream->sb->buf_offset == 0 && offset == 0 && !partial &&
+                StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream)) {
+            /* fast path: nothing buffered and the segment is complete */
+            AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                    seg->payload, seg->payload_len,
+                    StreamGetAppLayerFlags(ssn, stream, p));
+            AppLayerProfilingStore(ra_ctx->app_tctx, p);
+            data_sent += seg->payload_len;
+#ifdef DEBUG
+            ra_ctx->fp1++;
+#endif
+        } else if (StreamingBufferAppendNoTrack(stream->sb,
+                    seg->payload + offset, len) != 0) {
+            SCLogDebug("StreamingBuffer append failed, memcap?");
+            break;
+        }
+
+        next_seq = seg_end;
+        stream->ra_app_base_seq = next_seq - 1;
+        if (!partial)
+            seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+
+        seg = seg->next;
+    }
+
+    StreamTcpReassembleAppLayerBufferFlush(tv, ra_ctx, ssn, stream, p,
+            &data_sent);
+
+    /* if no data was sent to the applayer, we send it a empty 'nudge'
+     * when in inline mode */
+    if (StreamTcpInlineMode() && data_sent == 0 && ssn->state > TCP_ESTABLISHED) {
+        SCLogDebug("sending empty eof message");
+        /* send EOF to app layer */
+        AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
+                NULL, 0, StreamGetAppLayerFlags(ssn, stream, p));
+        AppLayerProfilingStore(ra_ctx->app_tctx, p);
+    }
+
+    /* app layer is done with this stream */
+    if (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)
+        StreamTcpReassembleFreeStreamingBuffer(stream);
+
+    SCLogDebug("stream->ra_app_base_seq %u", stream->ra_app_base_seq);
+    SCReturnInt(0);
+}
+
 /**
  *  \brief Update the stream reassembly upon receiving an ACK packet.
  *
@@ -2974,6 +3358,11 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         SCReturnInt(0);
     }
 
+    if (stream_config.flags & STREAMTCP_INIT_FLAG_STREAMING_BUFFER) {
+        int r = StreamTcpReassembleAppLayerBuffer(tv, ra_ctx, ssn, stream, p);
+        SCReturnInt(r);
+    }
+
     /* stream->ra_app_base_seq remains at stream->isn until protocol is
      * detected. */
     ReassembleData rd;
@@ -3310,6 +3699,12 @@ static int StreamTcpReassembleRaw (TcpReassemblyThreadCtx *ra_ctx,
     if (ssn->flags & STREAMTCP_FLAG_DISABLE_RAW)
         SCReturnInt(0);
 
+    StreamTcpReassembleRawCheckDepth(stream);
+    if (stream->flags & STREAMTCP_STREAM_FLAG_RAW_SKIPPED) {
+        StreamTcpReassembleRawSkipTo(stream, stream->last_ack);
+        SCReturnInt(0);
+    }
+
     if (stream->seg_list == NULL) {
         SCLogDebug("no segments in the list to reassemble");
         SCReturnInt(0);
@@ -3622,20 +4017,11 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
-
-    SCLogDebug("segment_pool[%u]->empty_stack_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_stack_size,
-               idx, segment_pool[idx]->alloc_stack_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    TcpSegment *seg = (TcpSegment *) PoolDepotGet(segment_pool[idx]);
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
-        SCLogDebug("segment_pool[%u]->empty_stack_size %u, "
-                   "alloc %u", idx, segment_pool[idx]->empty_stack_size,
-                   segment_pool[idx]->allocated);
+        SCLogDebug("segment_pool[%u] empty", idx);
         /* Increment the counter to show that we are not able to serve the
            segment request due to memcap limit */
         StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
@@ -3646,9 +4032,7 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     }
 
 #ifdef DEBUG
-    SCMutexLock(&segment_pool_cnt_mutex);
-    segment_pool_cnt++;
-    SCMutexUnlock(&segment_pool_cnt_mutex);
+    (void) SC_ATOMIC_ADD(segment_pool_cnt, 1);
 #endif
 
     return seg;
@@ -7637,6 +8021,169 @@ end:
     return ret;
 }
 
+/** \test no stream msgs once raw reassembly is skipped, and segments
+ *        before and after count as raw processed */
+static int StreamTcpReassembleSkipRawTest01(void)
+{
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Flow f;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTInitInline();
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    FLOW_INITIALIZE(&f);
+
+    uint8_t payload[] = { 'C', 'C', 'C', 'C', 'C' };
+    Packet *p = UTHBuildPacketReal(payload, 5, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL) {
+        printf("couldn't get a packet: ");
+        goto end;
+    }
+    p->tcph->th_seq = htonl(12);
+    p->flow = &f;
+
+    SCMutexLock(&f.m);
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  2, 'A', 5) == -1) {
+        printf("failed to add segment 1: ");
+        goto end;
+    }
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  7, 'B', 5) == -1) {
+        printf("failed to add segment 2: ");
+        goto end;
+    }
+    StreamTcpReassembleSkipRaw(&ssn, 0);
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 12, 'C', 5) == -1) {
+        printf("failed to add segment 3: ");
+        goto end;
+    }
+    ssn.client.next_seq = 17;
+
+    TcpSegment *seg;
+    for (seg = ssn.client.seg_list; seg != NULL; seg = seg->next) {
+        if (!(seg->flags & SEGMENTTCP_FLAG_RAW_PROCESSED)) {
+            printf("segment %u not raw processed: ", seg->seq);
+            goto end;
+        }
+    }
+
+    int r = StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p);
+    if (r < 0) {
+        printf("StreamTcpReassembleInlineRaw failed: ");
+        goto end;
+    }
+    if (UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 0) {
+        printf("expected no stream messages: ");
+        goto end;
+    }
+    if (ssn.client.ra_raw_base_seq != 16) {
+        printf("ra_raw_base_seq %u, expected 16: ", ssn.client.ra_raw_base_seq);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    SCMutexUnlock(&f.m);
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
+/** \test raw reassembly stops once it's past the raw depth */
+static int StreamTcpReassembleSkipRawTest02(void)
+{
+    int ret = 0;
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+    Flow f;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTInitInline();
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+    FLOW_INITIALIZE(&f);
+
+    uint8_t stream_payload[] = "AAAAABBBBB";
+    uint8_t payload[] = { 'B', 'B', 'B', 'B', 'B' };
+    Packet *p = UTHBuildPacketReal(payload, 5, IPPROTO_TCP, "1.1.1.1", "2.2.2.2", 1024, 80);
+    if (p == NULL) {
+        printf("couldn't get a packet: ");
+        goto end;
+    }
+    p->tcph->th_seq = htonl(7);
+    p->flow = &f;
+
+    SCMutexLock(&f.m);
+    StreamTcpReassembleSetRawDepth(&ssn, 0, 10);
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  2, 'A', 5) == -1) {
+        printf("failed to add segment 1: ");
+        goto end;
+    }
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,  7, 'B', 5) == -1) {
+        printf("failed to add segment 2: ");
+        goto end;
+    }
+    ssn.client.next_seq = 12;
+
+    int r = StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p);
+    if (r < 0) {
+        printf("StreamTcpReassembleInlineRaw failed: ");
+        goto end;
+    }
+    if (UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1) {
+        printf("expected a single stream message: ");
+        goto end;
+    }
+    if (UtTestSmsg(ssn.toserver_smsg_head, stream_payload, 10) == 0)
+        goto end;
+
+    /* past the depth now */
+    if (StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client, 12, 'C', 5) == -1) {
+        printf("failed to add segment 3: ");
+        goto end;
+    }
+    ssn.client.next_seq = 17;
+    p->tcph->th_seq = htonl(12);
+
+    r = StreamTcpReassembleInlineRaw(ra_ctx, &ssn, &ssn.client, p);
+    if (r < 0) {
+        printf("StreamTcpReassembleInlineRaw failed: ");
+        goto end;
+    }
+    if (UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1) {
+        printf("expected no new stream messages: ");
+        goto end;
+    }
+    if (!(ssn.client.flags & STREAMTCP_STREAM_FLAG_RAW_SKIPPED) ||
+        !(ssn.client.seg_list_tail->flags & SEGMENTTCP_FLAG_RAW_PROCESSED)) {
+        printf("raw reassembly not skipped: ");
+        goto end;
+    }
+    if (ssn.client.ra_raw_base_seq != 16) {
+        printf("ra_raw_base_seq %u, expected 16: ", ssn.client.ra_raw_base_seq);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    SCMutexUnlock(&f.m);
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p);
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    return ret;
+}
+
 /** \test 3 in order segments, then reassemble, add one more and reassemble again.
  *        test the sliding window reassembly.
  */
@@ -8688,6 +9235,54 @@ end:
     return ret;
 }
 
+/** \test fill the holes of a long list of segments, close to the head
+ *        and close to the tail in turns, and check the list stays sorted
+ *        and complete
+ */
+static int StreamTcpReassembleInsertTest04(void)
+{
+    TcpReassemblyThreadCtx *ra_ctx = NULL;
+    ThreadVars tv;
+    TcpSession ssn;
+
+    memset(&tv, 0x00, sizeof(tv));
+
+    StreamTcpUTInit(&ra_ctx);
+    StreamTcpUTSetupSession(&ssn);
+    StreamTcpUTSetupStream(&ssn.client, 1);
+
+    int i;
+    for (i = 0; i < 50; i++) {
+        FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                    2 + i * 20, 'A', 10) == -1);
+    }
+    for (i = 0; i < 49; i++) {
+        int hole = (i % 2) ? 48 - i / 2 : i / 2;
+        FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                    12 + hole * 20, 'B', 10) == -1);
+    }
+    /* overlap a hole that is already filled, in the middle */
+    FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &ssn.client,
+                497, 'C', 10) == -1);
+
+    uint32_t next_seq = 2;
+    uint32_t cnt = 0;
+    TcpSegment *seg;
+    for (seg = ssn.client.seg_list; seg != NULL; seg = seg->next) {
+        FAIL_IF_NOT(seg->seq == next_seq);
+        FAIL_IF_NOT(seg->next != NULL || seg == ssn.client.seg_list_tail);
+        FAIL_IF_NOT(seg->next == NULL || seg->next->prev == seg);
+        next_seq = seg->seq + seg->payload_len;
+        cnt++;
+    }
+    FAIL_IF_NOT(next_seq == 2 + 49 * 20 + 10);
+    FAIL_IF_NOT(cnt >= 99);
+
+    StreamTcpUTClearSession(&ssn);
+    StreamTcpUTDeinit(ra_ctx);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8790,6 +9385,10 @@ void StreamTcpReassembleRegisterTests(void)
 
     UtRegisterTest("StreamTcpReassembleInlineTest01 -- inline RAW ra",
                    StreamTcpReassembleInlineTest01);
+    UtRegisterTest("StreamTcpReassembleSkipRawTest01 -- skipped RAW ra",
+                   StreamTcpReassembleSkipRawTest01);
+    UtRegisterTest("StreamTcpReassembleSkipRawTest02 -- RAW depth",
+                   StreamTcpReassembleSkipRawTest02);
     UtRegisterTest("StreamTcpReassembleInlineTest02 -- inline RAW ra 2",
                    StreamTcpReassembleInlineTest02);
     UtRegisterTest("StreamTcpReassembleInlineTest03 -- inline RAW ra 3",
@@ -8816,6 +9415,8 @@ void StreamTcpReassembleRegisterTests(void)
                    StreamTcpReassembleInsertTest02);
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap",
                    StreamTcpReassembleInsertTest03);
+    UtRegisterTest("StreamTcpReassembleInsertTest04 -- fill holes",
+                   StreamTcpReassembleInsertTest04);
 
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
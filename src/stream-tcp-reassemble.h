@@ -82,6 +82,8 @@ void StreamTcpCreateTestPacket(uint8_t *, uint8_t, uint8_t, uint8_t);
 
 void StreamTcpSetSessionNoReassemblyFlag (TcpSession *, char );
 void StreamTcpSetDisableRawReassemblyFlag (TcpSession *ssn, char direction);
+void StreamTcpReassembleSkipRaw(TcpSession *ssn, char direction);
+void StreamTcpReassembleSetRawDepth(TcpSession *ssn, char direction, uint32_t depth);
 
 void StreamTcpSetOSPolicy(TcpStream *, Packet *);
 void StreamTcpReassemblePause (TcpSession *, char );
@@ -100,6 +102,7 @@ void StreamTcpPruneSession(Flow *, uint8_t);
 int StreamTcpReassembleDepthReached(Packet *p);
 
 void StreamTcpReassembleIncrMemuse(uint64_t size);
+void StreamTcpReassembleFreeStreamingBuffer(TcpStream *stream);
 void StreamTcpReassembleDecrMemuse(uint64_t size);
 int StreamTcpReassembleCheckMemcap(uint32_t size);
 
@@ -32,35 +32,76 @@
 #ifdef DEBUG
 void StreamTcpSackPrintList(TcpStream *stream)
 {
-    StreamTcpSackRecord *rec = stream->sack_head;
-    for (; rec != NULL; rec = rec->next) {
-        SCLogDebug("record %8u - %8u", rec->le, rec->re);
+    const StreamTcpSackRecord *rec = STREAM_SACK_RECORDS(stream);
+    uint16_t i;
+    for (i = 0; i < stream->sack_cnt; i++) {
+        SCLogDebug("record %8u - %8u", rec[i].le, rec[i].re);
     }
 }
 #endif /* DEBUG */
 
-static StreamTcpSackRecord *StreamTcpSackRecordAlloc(void)
+/**
+ *  \internal
+ *  \brief make room for at least one more range
+ *
+ *  The inline ranges are used first. After that the ranges move to an
+ *  allocated array that is doubled in size when it is full.
+ *
+ *  \retval 0 ok
+ *  \retval -1 memcap or allocation failure
+ */
+static int StreamTcpSackGrow(TcpStream *stream)
 {
-    if (StreamTcpCheckMemcap((uint32_t)sizeof(StreamTcpSackRecord)) == 0)
-        return NULL;
-
-    StreamTcpSackRecord *rec = SCMalloc(sizeof(*rec));
-    if (unlikely(rec == NULL))
-        return NULL;
-
-    StreamTcpIncrMemuse((uint64_t)sizeof(*rec));
-    return rec;
+    uint16_t size = stream->sack_size ? stream->sack_size : STREAM_SACK_INLINE_RECORDS;
+    if (stream->sack_cnt < size)
+        return 0;
+    if (size > UINT16_MAX / 2)
+        return -1;
+
+    uint16_t new_size = size * 2;
+    uint32_t grow = (uint32_t)(new_size - stream->sack_size) * sizeof(StreamTcpSackRecord);
+    if (StreamTcpCheckMemcap(grow) == 0)
+        return -1;
+
+    StreamTcpSackRecord *recs = SCRealloc(stream->sack_ext,
+            new_size * sizeof(StreamTcpSackRecord));
+    if (unlikely(recs == NULL))
+        return -1;
+    if (stream->sack_ext == NULL) {
+        memcpy(recs, stream->sack_inline, sizeof(stream->sack_inline));
+    }
+    stream->sack_ext = recs;
+    stream->sack_size = new_size;
+
+    StreamTcpIncrMemuse((uint64_t)grow);
+    return 0;
 }
 
-static void StreamTcpSackRecordFree(StreamTcpSackRecord *rec)
+/**
+ *  \internal
+ *  \brief find the first range with a right edge at or beyond 'seq'
+ *
+ *  \retval idx index of the range, stream->sack_cnt if there is none
+ */
+static uint16_t StreamTcpSackSearch(const StreamTcpSackRecord *rec,
+        uint16_t cnt, uint32_t seq)
 {
-    SCFree(rec);
-    StreamTcpDecrMemuse((uint64_t)sizeof(*rec));
+    uint16_t lo = 0, hi = cnt;
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (SEQ_LT(rec[mid].re, seq))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 /**
  *  \brief insert a SACK range
  *
+ *  The range is merged with all ranges it overlaps or touches.
+ *
  *  \param le left edge in host order
  *  \param re right edge in host order
  *
@@ -84,156 +125,39 @@ static int StreamTcpSackInsertRange(TcpStream *stream, uint32_t le, uint32_t re)
         SCLogDebug("too far right. discarding");
         goto end;
     }
-    if (stream->sack_head != NULL) {
-        StreamTcpSackRecord *rec;
-
-        for (rec = stream->sack_head; rec != NULL; rec = rec->next) {
-            SCLogDebug("rec %p, le %u, re %u", rec, rec->le, rec->re);
-
-            if (SEQ_LT(le, rec->le)) {
-                SCLogDebug("SEQ_LT(le, rec->le)");
-                if (SEQ_LT(re, rec->le)) {
-                    SCLogDebug("SEQ_LT(re, rec->le)");
-                    // entirely before, prepend
-                    StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                    if (unlikely(stsr == NULL)) {
-                        SCReturnInt(-1);
-                    }
-                    stsr->le = le;
-                    stsr->re = re;
-
-                    stsr->next = stream->sack_head;
-                    stream->sack_head = stsr;
-                    goto end;
-                } else if (SEQ_EQ(re, rec->le)) {
-                    SCLogDebug("SEQ_EQ(re, rec->le)");
-                    // starts before, ends on rec->le, expand
-                    rec->le = le;
-                } else if (SEQ_GT(re, rec->le)) {
-                    SCLogDebug("SEQ_GT(re, rec->le)");
-                    // starts before, ends beyond rec->le
-                    if (SEQ_LEQ(re, rec->re)) {
-                        SCLogDebug("SEQ_LEQ(re, rec->re)");
-                        // ends before rec->re, expand
-                        rec->le = le;
-                    } else { // implied if (re > rec->re)
-                        SCLogDebug("implied if (re > rec->re), le set to %u", rec->re);
-                        le = rec->re;
-                        continue;
-                    }
-                }
-            } else if (SEQ_EQ(le, rec->le)) {
-                SCLogDebug("SEQ_EQ(le, rec->le)");
-                if (SEQ_LEQ(re, rec->re)) {
-                    SCLogDebug("SEQ_LEQ(re, rec->re)");
-                    // new record fully overlapped
-                    SCReturnInt(0);
-                } else { // implied re > rec->re
-                    SCLogDebug("implied re > rec->re");
-                    if (rec->next != NULL) {
-                        if (SEQ_LEQ(re, rec->next->le)) {
-                            rec->re = re;
-                            goto end;
-                        } else {
-                            rec->re = rec->next->le;
-                            le = rec->next->le;
-                            SCLogDebug("le is now %u", le);
-                            continue;
-                        }
-                    } else {
-                        rec->re = re;
-                        goto end;
-                    }
-                }
-            } else { // implied (le > rec->le)
-                SCLogDebug("implied (le > rec->le)");
-                if (SEQ_LT(le, rec->re)) {
-                    SCLogDebug("SEQ_LT(le, rec->re))");
-                    // new record fully overlapped
-                    if (SEQ_GT(re, rec->re)) {
-                        SCLogDebug("SEQ_GT(re, rec->re)");
-
-                        if (rec->next != NULL) {
-                            if (SEQ_LEQ(re, rec->next->le)) {
-                                rec->re = re;
-                                goto end;
-                            } else {
-                                rec->re = rec->next->le;
-                                le = rec->next->le;
-                                continue;
-                            }
-                        } else {
-                            rec->re = re;
-                            goto end;
-                        }
-                    }
-
-                    SCLogDebug("new range fully overlapped");
-                    SCReturnInt(0);
-                } else if (SEQ_EQ(le, rec->re)) {
-                    SCLogDebug("here");
-                    // new record fully overlapped
-                    //int r = StreamTcpSackInsertRange(stream, rec->re+1, re);
-                    //SCReturnInt(r);
-                    le = rec->re;
-                    continue;
-                } else { /* implied le > rec->re */
-                    SCLogDebug("implied le > rec->re");
-                    if (rec->next == NULL) {
-                        SCLogDebug("rec->next == NULL");
-                        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                        if (unlikely(stsr == NULL)) {
-                            SCReturnInt(-1);
-                        }
-                        stsr->le = le;
-                        stsr->re = re;
-                        stsr->next = NULL;
-
-                        stream->sack_tail->next = stsr;
-                        stream->sack_tail = stsr;
-                        goto end;
-                    } else {
-                        SCLogDebug("implied rec->next != NULL");
-                        if (SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_LT(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = re;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                        } else if (SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)) {
-                            SCLogDebug("SEQ_LT(le, rec->next->le) && SEQ_GEQ(re, rec->next->le)");
-                            StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-                            if (unlikely(stsr == NULL)) {
-                                SCReturnInt(-1);
-                            }
-                            stsr->le = le;
-                            stsr->re = rec->next->le;
-                            stsr->next = rec->next;
-                            rec->next = stsr;
-
-                            le = rec->next->le;
-                        }
-                    }
-                }
-            }
-        }
-    } else {
-        SCLogDebug("implied empty list");
-        StreamTcpSackRecord *stsr = StreamTcpSackRecordAlloc();
-        if (unlikely(stsr == NULL)) {
+
+    StreamTcpSackRecord *rec = STREAM_SACK_RECORDS(stream);
+    uint16_t cnt = stream->sack_cnt;
+
+    /* ranges [first, last) overlap or touch the new range */
+    uint16_t first = StreamTcpSackSearch(rec, cnt, le);
+    uint16_t last = first;
+    while (last < cnt && SEQ_LEQ(rec[last].le, re))
+        last++;
+
+    if (first == last) {
+        SCLogDebug("new range at %u", first);
+        if (StreamTcpSackGrow(stream) < 0)
             SCReturnInt(-1);
-        }
-        stsr->le = le;
-        stsr->re = re;
-        stsr->next = NULL;
+        rec = STREAM_SACK_RECORDS(stream);
 
-        stream->sack_head = stsr;
-        stream->sack_tail = stsr;
+        memmove(&rec[first + 1], &rec[first],
+                (cnt - first) * sizeof(StreamTcpSackRecord));
+        rec[first].le = le;
+        rec[first].re = re;
+        stream->sack_cnt++;
+    } else {
+        SCLogDebug("merging ranges %u to %u", first, last - 1);
+        if (SEQ_LT(le, rec[first].le))
+            rec[first].le = le;
+        rec[first].re = SEQ_GT(re, rec[last - 1].re) ? re : rec[last - 1].re;
+
+        uint16_t merged = last - first - 1;
+        if (merged > 0) {
+            memmove(&rec[first + 1], &rec[last],
+                    (cnt - last) * sizeof(StreamTcpSackRecord));
+            stream->sack_cnt -= merged;
+        }
     }
 
     StreamTcpSackPruneList(stream);
@@ -302,32 +226,23 @@ void StreamTcpSackPruneList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-
-    while (rec != NULL) {
-        if (SEQ_LT(rec->re, stream->last_ack)) {
-            SCLogDebug("removing le %u re %u", rec->le, rec->re);
-
-            if (rec->next != NULL) {
-                stream->sack_head = rec->next;
-                StreamTcpSackRecordFree(rec);
-                rec = stream->sack_head;
-                continue;
-            } else {
-                stream->sack_head = NULL;
-                stream->sack_tail = NULL;
-                StreamTcpSackRecordFree(rec);
-                break;
-            }
-        } else if (SEQ_LT(rec->le, stream->last_ack)) {
-            SCLogDebug("adjusting record to le %u re %u", rec->le, rec->re);
-            /* last ack inside this record, update */
-            rec->le = stream->last_ack;
-            break;
-        } else {
-            SCLogDebug("record beyond last_ack, nothing to do. Bailing out.");
-            break;
-        }
+    StreamTcpSackRecord *rec = STREAM_SACK_RECORDS(stream);
+    uint16_t cnt = stream->sack_cnt;
+    uint16_t i = 0;
+
+    while (i < cnt && SEQ_LT(rec[i].re, stream->last_ack)) {
+        SCLogDebug("removing le %u re %u", rec[i].le, rec[i].re);
+        i++;
+    }
+    if (i > 0) {
+        memmove(&rec[0], &rec[i], (cnt - i) * sizeof(StreamTcpSackRecord));
+        cnt -= i;
+        stream->sack_cnt = cnt;
+    }
+    if (cnt > 0 && SEQ_LT(rec[0].le, stream->last_ack)) {
+        /* last ack inside this record, update */
+        rec[0].le = stream->last_ack;
+        SCLogDebug("adjusted record to le %u re %u", rec[0].le, rec[0].re);
     }
 #ifdef DEBUG
     StreamTcpSackPrintList(stream);
@@ -344,17 +259,13 @@ void StreamTcpSackFreeList(TcpStream *stream)
 {
     SCEnter();
 
-    StreamTcpSackRecord *rec = stream->sack_head;
-    StreamTcpSackRecord *next = NULL;
-
-    while (rec != NULL) {
-        next = rec->next;
-        StreamTcpSackRecordFree(rec);
-        rec = next;
+    if (stream->sack_ext != NULL) {
+        SCFree(stream->sack_ext);
+        StreamTcpDecrMemuse((uint64_t)stream->sack_size * sizeof(StreamTcpSackRecord));
+        stream->sack_ext = NULL;
     }
-
-    stream->sack_head = NULL;
-    stream->sack_tail = NULL;
+    stream->sack_size = 0;
+    stream->sack_cnt = 0;
     SCReturn;
 }
 
@@ -383,9 +294,11 @@ static int StreamTcpSackTest01 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 1 ||
+        STREAM_SACK_RECORDS(&stream)[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                STREAM_SACK_RECORDS(&stream)[0].le,
+                STREAM_SACK_RECORDS(&stream)[0].re);
         goto end;
     }
 
@@ -420,9 +333,11 @@ static int StreamTcpSackTest02 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 1 || stream.sack_head->re != 20) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 1 ||
+        STREAM_SACK_RECORDS(&stream)[0].re != 20) {
         printf("list in weird state, head le %u, re %u: ",
-                stream.sack_head->le, stream.sack_head->re);
+                STREAM_SACK_RECORDS(&stream)[0].le,
+                STREAM_SACK_RECORDS(&stream)[0].re);
         goto end;
     }
 
@@ -461,7 +376,7 @@ static int StreamTcpSackTest03 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 5) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 5) {
         goto end;
     }
 
@@ -497,7 +412,7 @@ static int StreamTcpSackTest04 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -533,7 +448,7 @@ static int StreamTcpSackTest05 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -571,7 +486,7 @@ static int StreamTcpSackTest06 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -609,7 +524,7 @@ static int StreamTcpSackTest07 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -656,7 +571,7 @@ static int StreamTcpSackTest08 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -704,7 +619,7 @@ static int StreamTcpSackTest09 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 0) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 0) {
         goto end;
     }
 
@@ -751,7 +666,7 @@ static int StreamTcpSackTest10 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -798,7 +713,7 @@ static int StreamTcpSackTest11 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -845,7 +760,7 @@ static int StreamTcpSackTest12 (void)
     StreamTcpSackPrintList(&stream);
 #endif /* DEBUG */
 
-    if (stream.sack_head->le != 100) {
+    if (STREAM_SACK_RECORDS(&stream)[0].le != 100) {
         goto end;
     }
 
@@ -942,6 +857,52 @@ end:
     SCReturnInt(retval);
 }
 
+/**
+ *  \test   Test spilling from the inline ranges to the allocated array.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+
+static int StreamTcpSackTest15 (void)
+{
+    TcpStream stream;
+    int i;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.window = 2000;
+
+    /* insert in reverse to have every range go to the front */
+    for (i = 9; i >= 0; i--) {
+        StreamTcpSackInsertRange(&stream, 100+(20*i), 110+(20*i));
+    }
+    FAIL_IF_NOT(stream.sack_cnt == 10);
+    FAIL_IF_NULL(stream.sack_ext);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 100);
+    for (i = 0; i < 10; i++) {
+        FAIL_IF_NOT(STREAM_SACK_RECORDS(&stream)[i].le == (uint32_t)(100+(20*i)));
+    }
+
+    /* fill one hole, merging two ranges */
+    StreamTcpSackInsertRange(&stream, 110, 120);
+    FAIL_IF_NOT(stream.sack_cnt == 9);
+    FAIL_IF_NOT(STREAM_SACK_RECORDS(&stream)[0].re == 130);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 110);
+
+    /* cover everything */
+    StreamTcpSackInsertRange(&stream, 50, 400);
+    FAIL_IF_NOT(stream.sack_cnt == 1);
+    FAIL_IF_NOT(StreamTcpSackedSize(&stream) == 350);
+
+    stream.last_ack = 401;
+    StreamTcpSackPruneList(&stream);
+    FAIL_IF_NOT(stream.sack_cnt == 0);
+
+    StreamTcpSackFreeList(&stream);
+    FAIL_IF_NOT_NULL(stream.sack_ext);
+    FAIL_IF_NOT(stream.sack_size == 0);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void StreamTcpSackRegisterTests (void)
@@ -965,5 +926,7 @@ void StreamTcpSackRegisterTests (void)
                    StreamTcpSackTest13);
     UtRegisterTest("StreamTcpSackTest14 -- Insertion out of window",
                    StreamTcpSackTest14);
+    UtRegisterTest("StreamTcpSackTest15 -- Insertion beyond inline ranges",
+                   StreamTcpSackTest15);
 #endif
 }
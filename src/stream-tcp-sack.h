@@ -40,15 +40,15 @@
  */
 static inline uint32_t StreamTcpSackedSize(TcpStream *stream)
 {
-    if (likely(stream->sack_head == NULL)) {
+    if (likely(stream->sack_cnt == 0)) {
         SCReturnUInt(0U);
     } else {
         uint32_t size = 0;
+        const StreamTcpSackRecord *rec = STREAM_SACK_RECORDS(stream);
+        uint16_t i;
 
-        StreamTcpSackRecord *rec = NULL;
-
-        for (rec = stream->sack_head; rec != NULL; rec = rec->next) {
-            size += (rec->re - rec->le);
+        for (i = 0; i < stream->sack_cnt; i++) {
+            size += (rec[i].re - rec[i].le);
         }
 
         SCReturnUInt(size);
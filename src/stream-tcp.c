@@ -34,7 +34,9 @@
 #include "detect.h"
 
 #include "flow.h"
+#include "flow-hash.h"
 #include "flow-util.h"
+#include "flow-checkpoint.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -73,6 +75,7 @@
 #include "util-misc.h"
 #include "util-validate.h"
 #include "util-runmodes.h"
+#include "util-memcap.h"
 
 #include "source-pcap-file.h"
 
@@ -108,7 +111,9 @@ static inline int StreamTcpValidateAck(TcpSession *ssn, TcpStream *, Packet *);
 static PoolThread *ssn_pool = NULL;
 static SCMutex ssn_pool_mutex = SCMUTEX_INITIALIZER; /**< init only, protect initializing and growing pool */
 #ifdef DEBUG
-static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex */
+#ifdef DEBUG
+SC_ATOMIC_DECLARE(uint64_t, ssn_pool_cnt); /**< counts ssns */
+#endif
 #endif
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
@@ -135,6 +140,11 @@ uint64_t StreamTcpMemuseCounter(void)
     return memusecopy;
 }
 
+static uint64_t StreamTcpMemcap(void)
+{
+    return stream_config.memcap;
+}
+
 /**
  *  \brief Check if alloc'ing "size" would mean we're over memcap
  *
@@ -153,6 +163,9 @@ void StreamTcpStreamCleanup(TcpStream *stream)
     if (stream != NULL) {
         StreamTcpSackFreeList(stream);
         StreamTcpReturnStreamSegments(stream);
+        StreamTcpReassembleFreeStreamingBuffer(stream);
+        MpmStreamStateFree(stream->mpm_state);
+        stream->mpm_state = NULL;
     }
 }
 
@@ -228,12 +241,13 @@ void StreamTcpSessionClear(void *ssnptr)
 
     StreamTcpSessionCleanup(ssn);
 
+    /* keep the pool id, the session goes back to its own thread's pool */
+    PoolThreadReserved res = ssn->res;
     memset(ssn, 0, sizeof(TcpSession));
+    ssn->res = res;
     PoolThreadReturn(ssn_pool, ssn);
 #ifdef DEBUG
-    SCMutexLock(&ssn_pool_mutex);
-    ssn_pool_cnt--;
-    SCMutexUnlock(&ssn_pool_mutex);
+    (void)SC_ATOMIC_SUB(ssn_pool_cnt, 1);
 #endif
 
     SCReturn;
@@ -367,6 +381,12 @@ void StreamTcpInitConfig(char quiet)
         SCLogConfig("stream \"async-oneside\": %s", stream_config.async_oneside ? "enabled" : "disabled");
     }
 
+    ConfGetBool("stream.bypass", &stream_config.bypass);
+
+    if (!quiet) {
+        SCLogConfig("stream \"bypass\": %s", stream_config.bypass ? "enabled" : "disabled");
+    }
+
     int csum = 0;
 
     if ((ConfGetBool("stream.checksum-validation", &csum)) == 1) {
@@ -560,7 +580,11 @@ void StreamTcpInitConfig(char quiet)
 
     /* init the memcap/use tracking */
     SC_ATOMIC_INIT(st_memuse);
+#ifdef DEBUG
+    SC_ATOMIC_INIT(ssn_pool_cnt);
+#endif
     StatsRegisterGlobalCounter("tcp.memuse", StreamTcpMemuseCounter);
+    MemcapPolicyRegister("stream", StreamTcpMemuseCounter, StreamTcpMemcap, NULL);
 
     StreamTcpReassembleInit(quiet);
 
@@ -597,7 +621,9 @@ void StreamTcpFreeConfig(char quiet)
     SCMutexUnlock(&ssn_pool_mutex);
     SCMutexDestroy(&ssn_pool_mutex);
 
-    SCLogDebug("ssn_pool_cnt %"PRIu64"", ssn_pool_cnt);
+#ifdef DEBUG
+    SCLogDebug("ssn_pool_cnt %"PRIu64"", SC_ATOMIC_GET(ssn_pool_cnt));
+#endif
 }
 
 /** \brief The function is used to to fetch a TCP session from the
@@ -615,10 +641,8 @@ TcpSession *StreamTcpNewSession (Packet *p, int id)
     if (ssn == NULL) {
         p->flow->protoctx = PoolThreadGetById(ssn_pool, id);
 #ifdef DEBUG
-        SCMutexLock(&ssn_pool_mutex);
         if (p->flow->protoctx != NULL)
-            ssn_pool_cnt++;
-        SCMutexUnlock(&ssn_pool_mutex);
+            (void)SC_ATOMIC_ADD(ssn_pool_cnt, 1);
 #endif
 
         ssn = (TcpSession *)p->flow->protoctx;
@@ -664,6 +688,8 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
         case TCP_TIME_WAIT:
         case TCP_CLOSED:
             SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_CLOSED);
+            /* closed timeout is shorter, have the row rechecked */
+            FBTIMEOUT_RESET_FLOW(p->flow);
             break;
     }
 }
@@ -4435,6 +4461,17 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
 
     TcpSession *ssn = (TcpSession *)p->flow->protoctx;
 
+    /* flow carried over a restart, set up the session it had */
+    if (ssn == NULL && unlikely(FlowCheckpointHasTcp(p->flow))) {
+        ssn = StreamTcpNewSession(p, stt->ssn_pool_id);
+        if (ssn == NULL) {
+            StatsIncr(tv, stt->counter_tcp_ssn_memcap);
+            goto error;
+        }
+        StatsIncr(tv, stt->counter_tcp_sessions);
+        StreamTcpPacketSetState(p, ssn, FlowCheckpointRestoreTcp(p->flow, ssn));
+    }
+
     /* track TCP flags */
     if (ssn != NULL) {
         ssn->tcp_packet_flags |= p->tcph->th_flags;
@@ -4628,6 +4665,15 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         {
             p->flags |= PKT_STREAM_NOPCAPLOG;
         }
+
+        /* nothing left to reassemble in either direction: depth reached
+         * or reassembly disabled by the app layer (e.g. encrypted tls) */
+        if (stream_config.bypass &&
+            (ssn->client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY) &&
+            (ssn->server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY))
+        {
+            PacketBypassCallback(p);
+        }
     }
 
     SCReturnInt(0);
@@ -4685,7 +4731,7 @@ static inline int StreamTcpValidateChecksum(Packet *p)
         ret = 0;
         SCLogDebug("Checksum of received packet %p is invalid",p);
         if (p->livedev) {
-            (void) SC_ATOMIC_ADD(p->livedev->invalid_checksums, 1);
+            LiveDevAddInvalidChecksum(p->livedev);
         } else if (p->pcap_cnt) {
             PcapIncreaseInvalidChecksum();
         }
@@ -5674,6 +5720,7 @@ void StreamTcpPseudoPacketCreateStreamEndPacket(ThreadVars *tv, StreamTcpThread
     StreamTcpPseudoPacketSetupHeader(np,p);
 
     np->tenant_id = p->flow->tenant_id;
+    np->job_id = p->flow->job_id;
 
     np->flowflags = p->flowflags;
 
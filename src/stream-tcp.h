@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that app layer reassembly uses a StreamingBuffer
+   per stream */
+#define STREAMTCP_INIT_FLAG_STREAMING_BUFFER       0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -57,6 +60,8 @@ typedef struct TcpStreamCnf_ {
     uint32_t prealloc_sessions; /**< ssns to prealloc per stream thread */
     int midstream;
     int async_oneside;
+    int bypass;                 /**< bypass flows once both directions
+                                 *   stopped reassembling */
     uint32_t reassembly_depth;  /**< Depth until when we reassemble the stream */
 
     uint16_t reassembly_toserver_chunk_size;
@@ -71,6 +76,9 @@ typedef struct TcpStreamCnf_ {
     uint32_t reassembly_inline_window;
     uint8_t flags;
     uint8_t max_synack_queued;
+
+    /** config for the per stream app layer StreamingBuffer */
+    StreamingBufferConfig sbcnf;
 } TcpStreamCnf;
 
 typedef struct StreamTcpThread_ {
@@ -28,6 +28,7 @@
 #include "threads.h"
 #include "stream.h"
 #include "util-pool.h"
+#include "util-pool-depot.h"
 #include "util-debug.h"
 #include "stream-tcp.h"
 #include "flow-util.h"
@@ -42,8 +43,10 @@ static uint64_t stream_pool_memcnt = 0;
 static uint16_t toserver_min_chunk_len = 2560;
 static uint16_t toclient_min_chunk_len = 2560;
 
-static Pool *stream_msg_pool = NULL;
-static SCMutex stream_msg_pool_mutex = SCMUTEX_INITIALIZER;
+/** msgs moved between the pool and a thread at once */
+#define STREAM_MSG_POOL_BATCH 32
+
+static PoolDepot *stream_msg_pool = NULL;
 
 static void StreamMsgEnqueue (StreamMsgQueue *q, StreamMsg *s)
 {
@@ -99,19 +102,14 @@ static StreamMsg *StreamMsgDequeue (StreamMsgQueue *q)
 /* Used by stream reassembler to get msgs */
 StreamMsg *StreamMsgGetFromPool(void)
 {
-    SCMutexLock(&stream_msg_pool_mutex);
-    StreamMsg *s = (StreamMsg *)PoolGet(stream_msg_pool);
-    SCMutexUnlock(&stream_msg_pool_mutex);
-    return s;
+    return (StreamMsg *)PoolDepotGet(stream_msg_pool);
 }
 
 /* Used by l7inspection to return msgs to pool */
 void StreamMsgReturnToPool(StreamMsg *s)
 {
     SCLogDebug("s %p", s);
-    SCMutexLock(&stream_msg_pool_mutex);
-    PoolReturn(stream_msg_pool, (void *)s);
-    SCMutexUnlock(&stream_msg_pool_mutex);
+    PoolDepotReturn(stream_msg_pool, (void *)s);
 }
 
 /* Used by l7inspection to get msgs with data */
@@ -177,27 +175,25 @@ void StreamMsgQueuesInit(uint32_t prealloc)
 #ifdef DEBUG
     SCMutexInit(&stream_pool_memuse_mutex, NULL);
 #endif
-    SCMutexLock(&stream_msg_pool_mutex);
-    stream_msg_pool = PoolInit(0, prealloc, 0,
+    stream_msg_pool = PoolDepotInit(STREAM_MSG_POOL_BATCH, 0, prealloc, 0,
             StreamMsgPoolAlloc,StreamMsgInit,
             NULL,NULL,StreamMsgPoolFree);
     if (stream_msg_pool == NULL)
         exit(EXIT_FAILURE); /* XXX */
-    SCMutexUnlock(&stream_msg_pool_mutex);
 }
 
 void StreamMsgQueuesDeinit(char quiet)
 {
     if (quiet == FALSE) {
-        if (stream_msg_pool->max_outstanding > stream_msg_pool->allocated)
+        Pool *pool = stream_msg_pool->pool;
+        if (pool->max_outstanding > pool->allocated)
             SCLogInfo("TCP segment chunk pool had a peak use of %u chunks, "
                     "more than the prealloc setting of %u",
-                    stream_msg_pool->max_outstanding, stream_msg_pool->allocated);
+                    pool->max_outstanding, pool->allocated);
     }
 
-    SCMutexLock(&stream_msg_pool_mutex);
-    PoolFree(stream_msg_pool);
-    SCMutexUnlock(&stream_msg_pool_mutex);
+    PoolDepotFree(stream_msg_pool);
+    stream_msg_pool = NULL;
 
 #ifdef DEBUG
     SCMutexDestroy(&stream_pool_memuse_mutex);
@@ -321,6 +321,7 @@ typedef enum PacketProfileDetectId_ {
     PROF_DETECT_MPM_HRHHD,
     PROF_DETECT_MPM_DNSQUERY,
     PROF_DETECT_MPM_TLSSNI,
+    PROF_DETECT_MPM_HTTP,
     PROF_DETECT_IPONLY,
     PROF_DETECT_RULES,
     PROF_DETECT_STATEFUL,
@@ -39,6 +39,8 @@
 
 #include "suricata.h"
 #include "decode.h"
+#include "decode-vxlan.h"
+#include "decode-geneve.h"
 #include "detect.h"
 #include "packet-queue.h"
 #include "threads.h"
@@ -49,6 +51,7 @@
 #include "util-spm.h"
 #include "util-cpu.h"
 #include "util-action.h"
+#include "util-byte.h"
 #include "util-pidfile.h"
 #include "util-ioctl.h"
 #include "util-device.h"
@@ -63,6 +66,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-port.h"
 #include "detect-engine-mpm.h"
+#include "detect-engine-analyzer.h"
 
 #include "tm-queuehandlers.h"
 #include "tm-queues.h"
@@ -82,6 +86,7 @@
 
 #include "output-json-flow.h"
 #include "output-json-netflow.h"
+#include "output-ipfix.h"
 #include "log-droplog.h"
 #include "output-json-drop.h"
 #include "log-httplog.h"
@@ -104,6 +109,7 @@
 #include "output-json.h"
 
 #include "output-json-template.h"
+#include "output-json-modbus.h"
 
 #include "stream-tcp.h"
 
@@ -130,10 +136,13 @@
 #include "respond-reject.h"
 
 #include "flow.h"
+#include "flow-hash.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-checkpoint.h"
+#include "app-layer-offload.h"
 #include "pkt-var.h"
 #include "host-bit.h"
 
@@ -174,9 +183,11 @@
 #include "util-decode-mime.h"
 
 #include "defrag.h"
+#include "defrag-hash.h"
 
 #include "runmodes.h"
 #include "runmode-unittests.h"
+#include "runmode-benchmarks.h"
 
 #include "util-cuda.h"
 #include "util-decode-asn1.h"
@@ -195,16 +206,30 @@
 #include "output-streaming.h"
 
 #include "util-privs.h"
+#include "util-process-group.h"
 
 #include "tmqh-packetpool.h"
 
 #include "util-proto-name.h"
 #ifdef __SC_CUDA_SUPPORT__
 #include "util-cuda-buffer.h"
+#include "util-cuda-handlers.h"
 #include "util-mpm-ac.h"
 #endif
 #include "util-mpm-hs.h"
+#include "util-mpm-cache.h"
+#include "util-mpm-offload.h"
 #include "util-storage.h"
+#include "util-latency.h"
+#include "util-perf-event.h"
+#include "util-memcap.h"
+#include "util-load-shed.h"
+#include "util-dedup.h"
+#include "util-state-sync.h"
+#include "util-mem-tag.h"
+#include "util-crypt.h"
+#include "util-bytes-simd.h"
+#include "util-lock-stats.h"
 #include "host-storage.h"
 
 /*
@@ -530,6 +555,7 @@ void usage(const char *progname)
     printf("\t-i <dev or ip>                       : run in pcap live mode\n");
     printf("\t-F <bpf filter file>                 : bpf filter file\n");
     printf("\t-r <path>                            : run in pcap file/offline mode\n");
+    printf("\t--benchmark[=N]                      : replay the pcap file of -r N times from memory and report the throughput\n");
 #ifdef NFQ
     printf("\t-q <qid>                             : run in inline nfqueue mode\n");
 #endif /* NFQ */
@@ -556,6 +582,10 @@ void usage(const char *progname)
     printf("\t--fatal-unittests                    : enable fatal failure on unittest error\n");
     printf("\t--unittests-coverage                 : display unittest coverage report\n");
 #endif /* UNITTESTS */
+#ifdef BENCHMARKS
+    printf("\t--micro-benchmark[=REGEX]            : run the micro benchmarks matching a regex and exit\n");
+    printf("\t--list-micro-benchmarks              : list micro benchmarks\n");
+#endif /* BENCHMARKS */
     printf("\t--list-app-layer-protos              : list supported app layer protocols\n");
     printf("\t--list-keywords[=all|csv|<kword>]    : list keywords implemented by the engine\n");
 #ifdef __SC_CUDA_SUPPORT__
@@ -583,6 +613,12 @@ void usage(const char *progname)
 #ifdef HAVE_NETMAP
     printf("\t--netmap[=<dev>]                     : run in netmap mode, no value select interfaces from suricata.yaml\n");
 #endif
+#ifdef HAVE_AF_XDP
+    printf("\t--af-xdp[=<dev>]                     : run in AF_XDP mode, no value select interfaces from suricata.yaml\n");
+#endif
+#ifdef HAVE_DPDK
+    printf("\t--dpdk                               : run in DPDK mode, use interfaces from suricata.yaml\n");
+#endif
 #ifdef HAVE_PFRING
     printf("\t--pfring[=<dev>]                     : run in pfring mode, use interfaces from suricata.yaml\n");
     printf("\t--pfring-int <dev>                   : run in pfring mode, use interface <dev>\n");
@@ -639,6 +675,9 @@ void SCPrintBuildInfo(void)
 #ifdef UNITTESTS
     strlcat(features, "UNITTESTS ", sizeof(features));
 #endif
+#ifdef BENCHMARKS
+    strlcat(features, "BENCHMARKS ", sizeof(features));
+#endif
 #ifdef NFQ
     strlcat(features, "NFQ ", sizeof(features));
 #endif
@@ -665,6 +704,12 @@ void SCPrintBuildInfo(void)
 #ifdef HAVE_NETMAP
     strlcat(features, "NETMAP ", sizeof(features));
 #endif
+#ifdef HAVE_AF_XDP
+    strlcat(features, "AF_XDP ", sizeof(features));
+#endif
+#ifdef HAVE_DPDK
+    strlcat(features, "DPDK ", sizeof(features));
+#endif
 #ifdef HAVE_PACKET_FANOUT
     strlcat(features, "HAVE_PACKET_FANOUT ", sizeof(features));
 #endif
@@ -842,6 +887,12 @@ void RegisterAllModules()
     /* netmap */
     TmModuleReceiveNetmapRegister();
     TmModuleDecodeNetmapRegister();
+    /* af-xdp */
+    TmModuleReceiveAFXDPRegister();
+    TmModuleDecodeAFXDPRegister();
+    /* dpdk */
+    TmModuleReceiveDPDKRegister();
+    TmModuleDecodeDPDKRegister();
     /* pfring */
     TmModuleReceivePfringRegister();
     TmModuleDecodePfringRegister();
@@ -905,11 +956,14 @@ void RegisterAllModules()
     /* flow/netflow */
     TmModuleJsonFlowLogRegister();
     TmModuleJsonNetFlowLogRegister();
+    TmModuleIpfixLogRegister();
     /* json stats */
     TmModuleJsonStatsLogRegister();
 
     /* Template JSON logger. */
     TmModuleJsonTemplateLogRegister();
+    /* modbus */
+    TmModuleJsonModbusLogRegister();
 
     /* log api */
     TmModulePacketLoggerRegister();
@@ -1020,6 +1074,39 @@ static TmEcode ParseInterfacesList(int run_mode, char *pcap_dev)
             }
         }
 #endif
+#ifdef HAVE_AF_XDP
+    } else if (run_mode == RUNMODE_AF_XDP) {
+        /* iface has been set on command line */
+        if (strlen(pcap_dev)) {
+            if (ConfSetFinal("af-xdp.live-interface", pcap_dev) != 1) {
+                SCLogError(SC_ERR_INITIALIZATION, "Failed to set af-xdp.live-interface");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        } else {
+            int ret = LiveBuildDeviceList("af-xdp");
+            if (ret == 0) {
+                SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for af-xdp");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+            if (AFXDPRunModeIsIPS()) {
+                SCLogInfo("AF_XDP: Setting IPS mode");
+                EngineModeSetIPS();
+            }
+        }
+#endif
+#ifdef HAVE_DPDK
+    } else if (run_mode == RUNMODE_DPDK) {
+        /* ports are PCI addresses, they only come from the config */
+        int ret = LiveBuildDeviceList("dpdk.interfaces");
+        if (ret == 0) {
+            SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for dpdk");
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        if (DPDKRunModeIsIPS()) {
+            SCLogInfo("DPDK: Setting IPS mode");
+            EngineModeSetIPS();
+        }
+#endif
 #ifdef HAVE_NFLOG
     } else if (run_mode == RUNMODE_NFLOG) {
         int ret = LiveBuildDeviceListCustom("nflog", "group");
@@ -1220,6 +1307,8 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pfring-cluster-type", required_argument, 0, 0},
         {"af-packet", optional_argument, 0, 0},
         {"netmap", optional_argument, 0, 0},
+        {"af-xdp", optional_argument, 0, 0},
+        {"dpdk", 0, 0, 0},
         {"pcap", optional_argument, 0, 0},
         {"simulate-ips", 0, 0 , 0},
         {"afl-rules", required_argument, 0 , 0},
@@ -1265,6 +1354,9 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"disable-detection", 0, 0, 0},
         {"fatal-unittests", 0, 0, 0},
         {"unittests-coverage", 0, &coverage_unittests, 1},
+        {"benchmark", optional_argument, 0, 0},
+        {"micro-benchmark", optional_argument, 0, 0},
+        {"list-micro-benchmarks", optional_argument, 0, 0},
         {"user", required_argument, 0, 0},
         {"group", required_argument, 0, 0},
         {"erf-in", required_argument, 0, 0},
@@ -1367,6 +1459,50 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
 #else
                     SCLogError(SC_ERR_NO_NETMAP, "NETMAP not enabled.");
                     return TM_ECODE_FAILED;
+#endif
+            } else if (strcmp((long_opts[option_index]).name , "af-xdp") == 0){
+#ifdef HAVE_AF_XDP
+                if (suri->run_mode == RUNMODE_UNKNOWN) {
+                    suri->run_mode = RUNMODE_AF_XDP;
+                    if (optarg) {
+                        LiveRegisterDevice(optarg);
+                        memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
+                        strlcpy(suri->pcap_dev, optarg,
+                                ((strlen(optarg) < sizeof(suri->pcap_dev)) ?
+                                 (strlen(optarg) + 1) : sizeof(suri->pcap_dev)));
+                    }
+                } else if (suri->run_mode == RUNMODE_AF_XDP) {
+                    SCLogWarning(SC_WARN_PCAP_MULTI_DEV_EXPERIMENTAL, "using "
+                            "multiple devices to get packets is experimental.");
+                    if (optarg) {
+                        LiveRegisterDevice(optarg);
+                    } else {
+                        SCLogInfo("Multiple af-xdp option without interface on each is useless");
+                        break;
+                    }
+                } else {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                            "has been specified");
+                    usage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+#else
+                    SCLogError(SC_ERR_NO_AF_XDP, "AF_XDP not enabled.");
+                    return TM_ECODE_FAILED;
+#endif
+            } else if (strcmp((long_opts[option_index]).name, "dpdk") == 0) {
+#ifdef HAVE_DPDK
+                if (suri->run_mode == RUNMODE_UNKNOWN) {
+                    suri->run_mode = RUNMODE_DPDK;
+                } else {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                            "has been specified");
+                    usage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+#else
+                SCLogError(SC_ERR_NO_DPDK, "DPDK not enabled.");
+                return TM_ECODE_FAILED;
 #endif
             } else if (strcmp((long_opts[option_index]).name, "nflog") == 0) {
 #ifdef HAVE_NFLOG
@@ -1609,6 +1745,38 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                 g_detect_disabled = suri->disabled_detect = 1;
                 SCLogInfo("detection engine disabled");
             }
+            else if(strcmp((long_opts[option_index]).name, "benchmark") == 0) {
+                char *loops = (optarg != NULL && strlen(optarg) > 0) ?
+                    optarg : xstr(PCAP_FILE_BENCHMARK_LOOPS);
+                int32_t v = 0;
+                if (ByteExtractStringInt32(&v, 10, 0, loops) <= 0 || v <= 0) {
+                    fprintf(stderr, "ERROR: invalid benchmark loop count %s\n", loops);
+                    return TM_ECODE_FAILED;
+                }
+                if (ConfSetFinal("pcap-file.benchmark.loops", loops) != 1) {
+                    fprintf(stderr, "ERROR: Failed to set pcap-file.benchmark.loops\n");
+                    return TM_ECODE_FAILED;
+                }
+                suri->benchmark = 1;
+            }
+            else if(strcmp((long_opts[option_index]).name, "micro-benchmark") == 0 ||
+                    strcmp((long_opts[option_index]).name, "list-micro-benchmarks") == 0) {
+#ifdef BENCHMARKS
+                if (suri->run_mode != RUNMODE_UNKNOWN) {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode has"
+                                                         " been specified");
+                    usage(argv[0]);
+                    return TM_ECODE_FAILED;
+                }
+                suri->run_mode = (strcmp((long_opts[option_index]).name, "micro-benchmark") == 0) ?
+                    RUNMODE_MICRO_BENCHMARK : RUNMODE_LIST_MICRO_BENCHMARKS;
+                if (optarg != NULL && strlen(optarg) > 0)
+                    suri->regex_arg = optarg;
+#else
+                fprintf(stderr, "ERROR: Micro benchmarks not enabled. Make sure to pass --enable-benchmarks to configure when building.\n");
+                return TM_ECODE_FAILED;
+#endif /* BENCHMARKS */
+            }
             else if(strcmp((long_opts[option_index]).name, "fatal-unittests") == 0) {
 #ifdef UNITTESTS
                 unittests_fatal = 1;
@@ -1961,6 +2129,12 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
     if (engine_analysis)
         suri->run_mode = RUNMODE_ENGINE_ANALYSIS;
 
+    if (suri->benchmark && suri->run_mode != RUNMODE_PCAP_FILE) {
+        SCLogError(SC_ERR_INITIALIZATION, "--benchmark needs a pcap file, use -r");
+        usage(argv[0]);
+        return TM_ECODE_FAILED;
+    }
+
     ret = SetBpfString(optind, argv);
     if (ret != TM_ECODE_OK)
         return ret;
@@ -2111,6 +2285,10 @@ int StartInternalRunMode(SCInstance *suri, int argc, char **argv)
             RunUnittests(1, suri->regex_arg);
         case RUNMODE_UNITTEST:
             RunUnittests(0, suri->regex_arg);
+        case RUNMODE_LIST_MICRO_BENCHMARKS:
+            RunBenchmarks(1, suri->regex_arg);
+        case RUNMODE_MICRO_BENCHMARK:
+            RunBenchmarks(0, suri->regex_arg);
 #ifdef OS_WIN32
         case RUNMODE_INSTALL_SERVICE:
             if (SCServiceInstall(argc, argv)) {
@@ -2225,6 +2403,7 @@ static int ConfigGetCaptureValue(SCInstance *suri)
         switch (suri->run_mode) {
             case RUNMODE_PCAP_DEV:
             case RUNMODE_AFP_DEV:
+            case RUNMODE_AF_XDP:
             case RUNMODE_NETMAP:
                 /* in netmap igb0+ has a special meaning, however the
                  * interface really is igb0 */
@@ -2275,12 +2454,23 @@ static int PostConfLoadedSetup(SCInstance *suri)
 {
     char *hostmode = NULL;
 
+    /* before anything allocates tagged memory */
+    MemTagInit();
+
     /* load the pattern matchers */
     MpmTableSetup();
 #ifdef __SC_CUDA_SUPPORT__
     MpmCudaEnvironmentSetup();
 #endif
+    MpmOffloadRegisterBackends();
+    if (MpmOffloadSetup() != 0)
+        exit(EXIT_FAILURE);
     SpmTableSetup();
+    ChecksumSimdSetup();
+    BytesSimdSetup();
+    Base64EncodeSetup();
+    DecodeVXLANConfig();
+    DecodeGeneveConfig();
 
     switch (suri->checksum_validation) {
         case 0:
@@ -2365,6 +2555,15 @@ static int PostConfLoadedSetup(SCInstance *suri)
     CIDRInit();
     SigParsePrepare();
 #ifdef PROFILING
+    if (suri->benchmark) {
+        /* sampled packet profiling provides the per stage cycles of
+         * the benchmark report */
+        char *val = NULL;
+        if (ConfGet("profiling.packets.enabled", &val) != 1)
+            (void)ConfSet("profiling.packets.enabled", "yes");
+        if (ConfGet("profiling.sample-rate", &val) != 1)
+            (void)ConfSet("profiling.sample-rate", xstr(PCAP_FILE_BENCHMARK_SAMPLE_RATE));
+    }
     if (suri->run_mode != RUNMODE_UNIX_SOCKET) {
         SCProfilingRulesGlobalInit();
         SCProfilingKeywordsGlobalInit();
@@ -2379,6 +2578,10 @@ static int PostConfLoadedSetup(SCInstance *suri)
     ThresholdInit();
     HostBitInitCtx();
     IPPairBitInitCtx();
+    if (suri->run_mode != RUNMODE_UNIX_SOCKET) {
+        FlowCheckpointInitCtx();
+        AppLayerOffloadInitCtx();
+    }
 
     if (DetectAddressTestConfVars() < 0) {
         SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY,
@@ -2427,6 +2630,12 @@ static int PostConfLoadedSetup(SCInstance *suri)
 
     HostInitConfig(HOST_VERBOSE);
 
+    if (suri->run_mode != RUNMODE_UNIX_SOCKET) {
+        StatsRegisterGlobalCounter("defrag.memuse", DefragGetMemuse);
+        StatsRegisterGlobalCounter("host.memuse", HostGetMemuse);
+        LockStatsInit();
+    }
+
     if (MagicInit() != 0)
         SCReturnInt(TM_ECODE_FAILED);
 
@@ -2534,6 +2743,7 @@ int main(int argc, char **argv)
         StreamTcpInitConfig(STREAM_VERBOSE);
         IPPairInitConfig(IPPAIR_VERBOSE);
         AppLayerRegisterGlobalCounters();
+        MemTagRegisterGlobalCounters();
     }
 
     DetectEngineCtx *de_ctx = NULL;
@@ -2563,20 +2773,18 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
 
-#ifdef __SC_CUDA_SUPPORT__
-        if (PatternMatchDefaultMatcher() == MPM_AC_CUDA)
-            CudaVarsSetDeCtx(de_ctx);
-#endif /* __SC_CUDA_SUPPORT__ */
-
         if (!de_ctx->minimal) {
             if (LoadSignatures(de_ctx, &suri) != TM_ECODE_OK)
                 exit(EXIT_FAILURE);
             if (suri.run_mode == RUNMODE_ENGINE_ANALYSIS) {
+                if (EngineAnalysisFastPatternProfile(de_ctx) != 0)
+                    exit(EXIT_FAILURE);
                 exit(EXIT_SUCCESS);
             }
         }
 
         DetectEngineAddToMaster(de_ctx);
+        MpmOffloadSetDetectEngine(de_ctx);
     } else {
         /* tell the app layer to consider only the log id */
         RegisterAppLayerGetActiveTxIdFunc(AppLayerTransactionGetActiveLogOnly);
@@ -2586,9 +2794,22 @@ int main(int argc, char **argv)
 
     SCDropMainThreadCaps(suri.userid, suri.groupid);
 
+    /* fork the worker processes, before any thread is started. They share
+     * the detect engine with the master. */
+    if (suri.run_mode != RUNMODE_CONF_TEST && ProcessGroupStart(&suri) == 1) {
+        /* restarted after a reload, catch up with the rules */
+        sigusr2_count = 1;
+    }
+
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         RunModeInitializeOutputs();
         StatsSetupPostConfig();
+        LatencyInit();
+        PerfEventInit();
+        MemcapPolicyInit();
+        LoadShedInit();
+        DedupInit();
+        StateSyncInit();
     }
 
     if (suri.run_mode == RUNMODE_CONF_TEST){
@@ -2597,8 +2818,19 @@ int main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
+    if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
+        FlowCheckpointLoad();
+    }
+
     RunModeDispatch(suri.run_mode, suri.runmode_custom_mode);
 
+    if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
+        if (AppLayerOffloadStart() != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "app-layer offload threads "
+                    "failed to start, parsing inline");
+        }
+    }
+
     /* In Unix socket runmode, Flow manager is started on demand */
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         /* Spawn the unix socket manager thread */
@@ -2611,11 +2843,14 @@ int main(int argc, char **argv)
             UnixManagerRegisterCommand("iface-stat", LiveDeviceIfaceStat, NULL,
                                        UNIX_CMD_TAKE_ARGS);
             UnixManagerRegisterCommand("iface-list", LiveDeviceIfaceList, NULL, 0);
+            UnixManagerRegisterCommand("flow-checkpoint",
+                                       FlowCheckpointUnixCommand, NULL, 0);
 #endif
         }
         /* Spawn the flow manager thread */
         FlowManagerThreadSpawn();
         FlowRecyclerThreadSpawn();
+        StateSyncSpawnThread();
         StatsSpawnThreads();
     }
 
@@ -2628,6 +2863,7 @@ int main(int argc, char **argv)
 
     (void) SC_ATOMIC_CAS(&engine_stage, SURICATA_INIT, SURICATA_RUNTIME);
     PacketPoolPostRunmodes();
+    FlowHashPartitionsPostRunmodes();
 
     /* Un-pause all the paused threads */
     TmThreadContinueThreads();
@@ -2715,6 +2951,9 @@ int main(int argc, char **argv)
     TmThreadDisableReceiveThreads();
 
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
+        /* before the timeout pseudo packets close the sessions */
+        FlowCheckpointShutdown();
+
         /* we need a packet pool for FlowForceReassembly */
         PacketPoolInit();
 
@@ -2735,6 +2974,8 @@ int main(int argc, char **argv)
     /* kill remaining threads */
     TmThreadKillThreads();
 
+    /* workers are gone, let the helpers finish before the flows go */
+    AppLayerOffloadShutdown();
 
     if (suri.run_mode != RUNMODE_UNIX_SOCKET) {
         /* destroy the packet pool for flow reassembly after all
@@ -2742,8 +2983,14 @@ int main(int argc, char **argv)
         PacketPoolDestroy();
 
         StatsReleaseResources();
+        LatencyDestroy();
+        PerfEventDestroy();
+        MemcapPolicyDeinit();
+        LoadShedDeinit();
+        StateSyncDeinit();
         IPPairShutdown();
         FlowShutdown();
+        FlowCheckpointFree();
         StreamTcpFreeConfig(STREAM_VERBOSE);
     }
     HostShutdown();
@@ -2762,6 +3009,9 @@ int main(int argc, char **argv)
 
     AppLayerHtpPrintStats();
 
+    /* packets are gone, drops its engine reference */
+    MpmOffloadShutdown();
+
     /** TODO this can do into it's own func */
     de_ctx = DetectEngineGetCurrent();
     if (de_ctx) {
@@ -2769,10 +3019,13 @@ int main(int argc, char **argv)
         DetectEngineDeReference(&de_ctx);
     }
     DetectEnginePruneFreeList();
+    MpmStoreShareTableFree();
+    MpmCacheDeinit();
 
     AppLayerDeSetup();
 
     TagDestroyCtx();
+    ThresholdShutdown();
 
     LiveDeviceListClean();
     RunModeShutDown();
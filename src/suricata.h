@@ -153,6 +153,7 @@ typedef struct SCInstance_ {
     int offline;
     int verbose;
     int checksum_validation;
+    int benchmark;              /**< pcap replay benchmark, --benchmark */
 
     struct timeval start_time;
 
@@ -91,6 +91,7 @@ static inline void cycle_sleep(int cycles)
     ;
 }
 #define SCCondWait(x,y) cycle_sleep(300)
+#define SCCondTimedwait(x,y,z) ({ cycle_sleep(300); 0; })
 
 /* spinlocks */
 
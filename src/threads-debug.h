@@ -139,6 +139,7 @@
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait SCCondWait_dbg
+#define SCCondTimedwait pthread_cond_timedwait
 
 /* spinlocks */
 
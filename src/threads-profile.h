@@ -89,6 +89,7 @@ extern __thread uint64_t mutex_lock_cnt;
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait(cond, mut) pthread_cond_wait(cond, mut)
+#define SCCondTimedwait(cond, mut, ts) pthread_cond_timedwait(cond, mut, ts)
 
 /* spinlocks */
 
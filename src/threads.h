@@ -138,6 +138,7 @@ enum {
 #define SCCondSignal pthread_cond_signal
 #define SCCondDestroy pthread_cond_destroy
 #define SCCondWait(cond, mut) pthread_cond_wait(cond, mut)
+#define SCCondTimedwait(cond, mut, ts) pthread_cond_timedwait(cond, mut, ts)
 
 /* ctrl mutex */
 #define SCCtrlMutex pthread_mutex_t
@@ -117,6 +117,9 @@ typedef struct ThreadVars_ {
     /** private counter store: counter updates modify this */
     StatsPrivateThreadContext perf_private_ctx;
 
+    /** hardware counters, NULL unless perf-counters are enabled */
+    struct PerfEventThreadCtx_ *perf_event_ctx;
+
     SCCtrlMutex *ctrl_mutex;
     SCCtrlCondT *ctrl_cond;
 
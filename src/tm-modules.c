@@ -252,6 +252,7 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_JSONFILELOG);
         CASE_CODE (TMM_JSONFLOWLOG);
         CASE_CODE (TMM_JSONNETFLOWLOG);
+        CASE_CODE (TMM_IPFIXLOG);
         CASE_CODE (TMM_JSONSMTPLOG);
         CASE_CODE (TMM_JSONSSHLOG);
         CASE_CODE (TMM_JSONSTATSLOG);
@@ -264,8 +265,13 @@ const char * TmModuleTmmIdToString(TmmId id)
         CASE_CODE (TMM_LUALOG);
         CASE_CODE (TMM_LOGSTATSLOG);
         CASE_CODE (TMM_JSONTEMPLATELOG);
+        CASE_CODE (TMM_JSONMODBUSLOG);
         CASE_CODE (TMM_RECEIVENETMAP);
         CASE_CODE (TMM_DECODENETMAP);
+        CASE_CODE (TMM_RECEIVEAFXDP);
+        CASE_CODE (TMM_DECODEAFXDP);
+        CASE_CODE (TMM_RECEIVEDPDK);
+        CASE_CODE (TMM_DECODEDPDK);
         CASE_CODE (TMM_TLSSTORE);
 
         CASE_CODE (TMM_SIZE);
@@ -47,6 +47,10 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
+    /** optional: called once for a vector of packets before Func is
+     *  called for each of them. See TmThreadsSlotProcessPktBatch. */
+    void (*FuncBatch)(ThreadVars *, Packet **, uint32_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** terminates the capture loop in PktAcqLoop */
@@ -67,6 +67,10 @@ typedef enum {
     TMM_DECODEAFP,
     TMM_RECEIVENETMAP,
     TMM_DECODENETMAP,
+    TMM_RECEIVEAFXDP,
+    TMM_DECODEAFXDP,
+    TMM_RECEIVEDPDK,
+    TMM_DECODEDPDK,
     TMM_ALERTPCAPINFO,
     TMM_RECEIVEMPIPE,
     TMM_DECODEMPIPE,
@@ -91,8 +95,10 @@ typedef enum {
     TMM_DECODENFLOG,
     TMM_JSONFLOWLOG,
     TMM_JSONNETFLOWLOG,
+    TMM_IPFIXLOG,
     TMM_LOGSTATSLOG,
     TMM_JSONTEMPLATELOG,
+    TMM_JSONMODBUSLOG,
 
     TMM_FLOWMANAGER,
     TMM_FLOWRECYCLER,
@@ -34,6 +34,7 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
@@ -41,6 +42,7 @@
 #include "util-optimize.h"
 #include "util-profiling.h"
 #include "util-signal.h"
+#include "util-perf-event.h"
 #include "queue.h"
 
 #ifdef PROFILE_LOCKING
@@ -117,15 +119,32 @@ void TmThreadsUnsetFlag(ThreadVars *tv, uint16_t flag)
  *
  * \todo Deal with post_pq for slots beyond the first.
  */
+static TmEcode TmThreadsSlotVarRunUntil(ThreadVars *tv, Packet *p,
+                                        TmSlot *slot, TmSlot *end);
+
 TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
                                           TmSlot *slot)
+{
+    return TmThreadsSlotVarRunUntil(tv, p, slot, NULL);
+}
+
+/** \internal
+ *  \brief run the slots [slot, end) for a packet
+ *
+ *  Extra packets created by the slots (e.g. tunnel packets) are run
+ *  through the full remainder of the chain.
+ */
+static TmEcode TmThreadsSlotVarRunUntil(ThreadVars *tv, Packet *p,
+                                        TmSlot *slot, TmSlot *end)
 {
     TmEcode r;
     TmSlot *s;
     Packet *extra_p;
 
-    for (s = slot; s != NULL; s = s->slot_next) {
+    for (s = slot; s != end; s = s->slot_next) {
         TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
+        PerfEventSample ps;
+        const int perf = PerfEventSampleStart(tv, &ps);
         PACKET_PROFILING_TMM_START(p, s->tm_id);
 
         if (unlikely(s->id == 0)) {
@@ -135,6 +154,8 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
         }
 
         PACKET_PROFILING_TMM_END(p, s->tm_id);
+        if (unlikely(perf))
+            PerfEventSampleMark(tv, &ps, PERF_EVENT_TMM(s->tm_id));
 
         /* handle error */
         if (unlikely(r == TM_ECODE_FAILED)) {
@@ -177,6 +198,80 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief release the packets of a batch after an error */
+static void TmThreadsBatchRelease(ThreadVars *tv, TmSlot *s,
+                                  Packet **pkts, uint32_t cnt)
+{
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        TmqhOutputPacketpool(tv, pkts[i]);
+    }
+    for ( ; s != NULL; s = s->slot_next) {
+        SCMutexLock(&s->slot_post_pq.mutex_q);
+        TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+        SCMutexUnlock(&s->slot_post_pq.mutex_q);
+    }
+    TmThreadsSetFlag(tv, THV_FAILED);
+}
+
+/**
+ *  \brief process a vector of packets
+ *
+ *  The slots up to the first slot with a FuncBatch callback (normally
+ *  decode up to the FlowWorker) are run for each packet first. Then the
+ *  FuncBatch callback is called once for the whole vector, after which
+ *  the rest of the chain runs per packet as in TmThreadsSlotProcessPkt.
+ *  If no slot has a FuncBatch callback this is the same as calling
+ *  TmThreadsSlotProcessPkt for each packet.
+ *
+ *  On error all packets that are still owned by the batch are returned
+ *  to the pool.
+ *
+ *  \param s first slot to run, like for TmThreadsSlotProcessPkt
+ *  \param pkts packet vector
+ *  \param cnt number of packets in pkts
+ */
+TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *s,
+                                     Packet **pkts, uint32_t cnt)
+{
+    TmSlot *bs = NULL;
+    uint32_t i;
+
+    for (bs = s; bs != NULL; bs = bs->slot_next) {
+        if (tmm_modules[bs->tm_id].FuncBatch != NULL)
+            break;
+    }
+
+    if (bs != NULL) {
+        /* stage 1: run the slots before the batch slot for each packet */
+        if (bs != s) {
+            for (i = 0; i < cnt; i++) {
+                if (TmThreadsSlotVarRunUntil(tv, pkts[i], s, bs) == TM_ECODE_FAILED) {
+                    TmThreadsBatchRelease(tv, s, pkts, cnt);
+                    return TM_ECODE_FAILED;
+                }
+            }
+        }
+
+        /* stage 2: let the batch slot prepare the whole vector */
+        tmm_modules[bs->tm_id].FuncBatch(tv, pkts, cnt,
+                SC_ATOMIC_GET(bs->slot_data));
+        s = bs;
+    }
+
+    /* stage 3: rest of the chain per packet */
+    for (i = 0; i < cnt; i++) {
+        if (TmThreadsSlotProcessPkt(tv, s, pkts[i]) != TM_ECODE_OK) {
+            /* pkts[i] is released by TmThreadsSlotProcessPkt */
+            TmThreadsBatchRelease(tv, s, pkts + i + 1, cnt - (i + 1));
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    return TM_ECODE_OK;
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -327,6 +422,7 @@ void *TmThreadsSlotPktAcqLoop(void *td)
         }
     }
 
+    PerfEventThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -451,6 +547,7 @@ void *TmThreadsSlotPktAcqLoopAFL(void *td)
         }
     }
 
+    PerfEventThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -572,6 +669,7 @@ void *TmThreadsSlotVar(void *td)
         }
     }
 
+    PerfEventThreadInit(tv);
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -1126,6 +1224,7 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
                       tv->name, SCGetThreadIdLong());
         }
         TmThreadSetPrio(tv);
+        AffinitySetRealtime(taf, tv->name);
     }
 #endif
 
@@ -1455,6 +1554,15 @@ void TmThreadRemove(ThreadVars *tv, int type)
     return;
 }
 
+/** \internal
+ *  \brief check if there are packets left in the input queue of a
+ *         thread, including the rings of the flow queue handler */
+static int TmThreadInqIsEmpty(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    return (q->len == 0 && TmqhFlowRingsEmpty(tv->inq->id));
+}
+
 /**
  * \brief Kill a thread.
  *
@@ -1474,8 +1582,7 @@ void TmThreadKillThread(ThreadVars *tv)
          * packet acquire by now using TmThreadDisableReceiveThreads()*/
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
-            PacketQueue *q = &trans_q[tv->inq->id];
-            while (q->len != 0) {
+            while (!TmThreadInqIsEmpty(tv)) {
                 usleep(1000);
             }
         }
@@ -1585,8 +1692,7 @@ again:
                  * packet acquire by now using TmThreadDisableReceiveThreads()*/
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                    PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (!TmThreadInqIsEmpty(tv)) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1664,8 +1770,7 @@ again:
              * packet acquire by now using TmThreadDisableReceiveThreads()*/
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
-                PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (!TmThreadInqIsEmpty(tv)) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
@@ -1778,6 +1883,7 @@ void TmThreadFree(ThreadVars *tv)
     SCLogDebug("Freeing thread '%s'.", tv->name);
 
     StatsThreadCleanup(tv);
+    PerfEventThreadDeinit(tv);
 
     TmThreadDeinitMC(tv);
 
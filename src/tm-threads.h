@@ -217,6 +217,9 @@ static inline void TmThreadsCaptureInjectPacket(ThreadVars *tv, TmSlot *slot, Pa
     }
 }
 
+TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *s,
+                                     Packet **pkts, uint32_t cnt);
+
 void TmThreadsListThreads(void);
 int TmThreadsRegisterThread(ThreadVars *tv, const int type);
 void TmThreadsUnregisterThread(const int id);
@@ -25,6 +25,12 @@
  * are sent to the same queue. We support different kind of q handlers.  Have
  * a look at "autofp-scheduler" conf to further undertsand the various q
  * handlers we provide.
+ *
+ * Each producer thread gets its own lockless ring to each of its output
+ * queues. The consumer polls the rings of its queue and the locked queue
+ * that the flow manager and the detect reload code still inject into.
+ * When there is nothing to do it spins for a bit, then sleeps with a
+ * backoff.
  */
 
 #include "suricata.h"
@@ -37,11 +43,46 @@
 #include "tm-queuehandlers.h"
 
 #include "conf.h"
+#include "util-atomic.h"
+#include "util-optimize.h"
 #include "util-unittest.h"
 
+/** max number of producer rings per queue, more writers use the
+ *  locked queue */
+#define TMQH_FLOW_MAX_RINGS     64
+/** consumer hands back ring slots at least this often */
+#define TMQH_FLOW_BATCH         32
+/** polls of an empty queue before the consumer starts sleeping */
+#define TMQH_FLOW_SPINS         512
+/** a pin not used for this many seconds is free to be moved */
+#define TMQH_FLOW_PIN_TIMEOUT   30
+/** min and max sleep of an idle consumer in usec */
+#define TMQH_FLOW_SLEEP_MIN     5
+#define TMQH_FLOW_SLEEP_MAX     200
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TMQH_FLOW_PAUSE() __asm__ __volatile__("pause": : :"memory")
+#else
+#define TMQH_FLOW_PAUSE() cc_barrier()
+#endif
+
+/** per queue list of the rings of its producers */
+typedef struct TmqhFlowInq_ {
+    SC_ATOMIC_DECLARE(unsigned int, rings_cnt);
+    TmqhFlowRing *rings[TMQH_FLOW_MAX_RINGS];
+
+    /* consumer only */
+    TmqhFlowRing *cur;          /**< ring of the packet being processed */
+    unsigned int next;          /**< ring to poll first */
+    unsigned int sleep_usec;    /**< current idle backoff */
+} TmqhFlowInq;
+
+static TmqhFlowInq flow_inqs[256];
+
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
+void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
@@ -60,8 +101,7 @@ void TmqhFlowRegister(void)
             SCLogNotice("using flow hash instead of round robin");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
-            SCLogNotice("using flow hash instead of active packets");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
@@ -87,32 +127,234 @@ void TmqhFlowPrintAutofpHandler(void)
 
     PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhOutputFlowActivePackets, "Active Packets");
 
 #undef PRINT_IF_FUNC
 }
 
-/* same as 'simple' */
-Packet *TmqhInputFlow(ThreadVars *tv)
+static TmqhFlowRing *TmqhFlowRingAlloc(void)
 {
-    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhFlowRing *r = SCMalloc(sizeof(TmqhFlowRing));
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0x00, sizeof(TmqhFlowRing));
+    SC_ATOMIC_INIT(r->tail);
+    SC_ATOMIC_INIT(r->head);
+    SC_ATOMIC_INIT(r->done);
+    return r;
+}
 
-    StatsSyncCountersIfSignalled(tv);
+/** \brief add a packet to the ring, waits while the ring is full */
+static void TmqhFlowRingPut(TmqhFlowRing *r, Packet *p)
+{
+    unsigned int tail = SC_ATOMIC_GET(r->tail);
+
+    while (tail - r->head_cache >= TMQH_FLOW_RING_SIZE) {
+        cc_barrier();
+        r->head_cache = SC_ATOMIC_GET(r->head);
+        if (tail - r->head_cache < TMQH_FLOW_RING_SIZE)
+            break;
+        usleep(TMQH_FLOW_SLEEP_MIN);
+    }
+
+    r->slots[tail & (TMQH_FLOW_RING_SIZE - 1)] = p;
+    /* full barrier: the slot is written before the consumer sees it */
+    (void) SC_ATOMIC_ADD(r->tail, 1);
+}
+
+/** \brief hand the slots we read back to the producer */
+static inline void TmqhFlowRingRelease(TmqhFlowRing *r)
+{
+    unsigned int done = r->read - SC_ATOMIC_GET(r->head);
+    if (done > 0)
+        (void) SC_ATOMIC_ADD(r->head, done);
+}
+
+/** \brief get a packet from the ring
+ *
+ *  The producer's tail is only looked at once all previously seen
+ *  slots are read. Read slots are handed back when those are used up,
+ *  or every TMQH_FLOW_BATCH slots. */
+static Packet *TmqhFlowRingGet(TmqhFlowRing *r)
+{
+    if (r->read == r->tail_cache) {
+        cc_barrier();
+        r->tail_cache = SC_ATOMIC_GET(r->tail);
+        if (r->read == r->tail_cache)
+            return NULL;
+        /* slot contents must not be read before the tail */
+        hw_barrier();
+    }
+
+    Packet *p = r->slots[r->read & (TMQH_FLOW_RING_SIZE - 1)];
+    r->read++;
+
+    if (r->read == r->tail_cache ||
+        r->read - SC_ATOMIC_GET(r->head) >= TMQH_FLOW_BATCH)
+        TmqhFlowRingRelease(r);
+    return p;
+}
+
+static void TmqhFlowRingRegister(uint16_t qid, TmqhFlowRing *r)
+{
+    TmqhFlowInq *inq = &flow_inqs[qid];
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+
+    inq->rings[cnt] = r;
+    /* full barrier: a running consumer sees the ring before the count */
+    (void) SC_ATOMIC_ADD(inq->rings_cnt, 1);
+}
+
+/** \brief remove a ring from its queue and free it
+ *
+ *  \warning only to be called once the consumer is done */
+static void TmqhFlowRingDeregister(uint16_t qid, TmqhFlowRing *r)
+{
+    TmqhFlowInq *inq = &flow_inqs[qid];
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        if (inq->rings[i] == r) {
+            /* consumer is stopped by now */
+            if (inq->cur == r)
+                inq->cur = NULL;
+            inq->rings[i] = inq->rings[cnt - 1];
+            inq->rings[cnt - 1] = NULL;
+            (void) SC_ATOMIC_SUB(inq->rings_cnt, 1);
+            inq->next = 0;
+            break;
+        }
+    }
+    SCFree(r);
+}
+
+/**
+ *  \brief check if the producer rings of a queue are drained
+ *
+ *  \retval 1 empty
+ *  \retval 0 not empty
+ */
+int TmqhFlowRingsEmpty(uint16_t qid)
+{
+    TmqhFlowInq *inq = &flow_inqs[qid];
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        TmqhFlowRing *r = inq->rings[i];
+        if (SC_ATOMIC_GET(r->tail) != SC_ATOMIC_GET(r->head))
+            return 0;
+    }
+    return 1;
+}
 
-    SCMutexLock(&q->mutex_q);
-    if (q->len == 0) {
-        /* if we have no packets in queue, wait... */
-        SCCondWait(&q->cond_q, &q->mutex_q);
+/**
+ *  \brief wait for the consumer of a queue to finish the packets its
+ *         producers put in the rings so far
+ *
+ *  Used to make sure nothing still references data that is about to be
+ *  freed, e.g. the old detect engine on a reload. Packets put in the
+ *  rings after the call aren't waited for. Returns early on shutdown.
+ */
+void TmqhFlowWaitDone(uint16_t qid)
+{
+    TmqhFlowInq *inq = &flow_inqs[qid];
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        TmqhFlowRing *r = inq->rings[i];
+        unsigned int tail = SC_ATOMIC_GET(r->tail);
+
+        while ((int)(SC_ATOMIC_GET(r->done) - tail) < 0) {
+            if (suricata_ctl_flags != 0)
+                return;
+            usleep(100);
+        }
     }
+}
 
+/** \brief number of packets waiting in a queue and its rings */
+static uint32_t TmqhFlowQueueDepth(uint16_t qid)
+{
+    TmqhFlowInq *inq = &flow_inqs[qid];
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+    uint32_t depth = trans_q[qid].len;
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        TmqhFlowRing *r = inq->rings[i];
+        depth += SC_ATOMIC_GET(r->tail) - SC_ATOMIC_GET(r->head);
+    }
+    return depth;
+}
+
+static Packet *TmqhFlowInqGet(TmqhFlowInq *inq, PacketQueue *q)
+{
+    Packet *p;
+
+    /* injected packets first, so busy rings can't starve them */
     if (q->len > 0) {
-        Packet *p = PacketDequeue(q);
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
         SCMutexUnlock(&q->mutex_q);
-        return p;
-    } else {
-        /* return NULL if we have no pkt. Should only happen on signals. */
-        SCMutexUnlock(&q->mutex_q);
-        return NULL;
+        if (p != NULL) {
+            inq->cur = NULL;
+            return p;
+        }
     }
+
+    unsigned int cnt = SC_ATOMIC_GET(inq->rings_cnt);
+    unsigned int i;
+    for (i = 0; i < cnt; i++) {
+        unsigned int idx = (inq->next + i) % cnt;
+        p = TmqhFlowRingGet(inq->rings[idx]);
+        if (p != NULL) {
+            /* stay on this ring while it has packets */
+            inq->next = idx;
+            inq->cur = inq->rings[idx];
+            return p;
+        }
+    }
+    return NULL;
+}
+
+Packet *TmqhInputFlow(ThreadVars *tv)
+{
+    TmqhFlowInq *inq = &flow_inqs[tv->inq->id];
+    PacketQueue *q = &trans_q[tv->inq->id];
+    Packet *p;
+    int spins;
+
+    /* we're called again once the previous packet went through all
+     * our slots */
+    if (inq->cur != NULL) {
+        (void) SC_ATOMIC_ADD(inq->cur->done, 1);
+        inq->cur = NULL;
+    }
+
+    StatsSyncCountersIfSignalled(tv);
+
+    for (spins = 0; spins < TMQH_FLOW_SPINS; spins++) {
+        p = TmqhFlowInqGet(inq, q);
+        if (p != NULL) {
+            inq->sleep_usec = 0;
+            return p;
+        }
+        TMQH_FLOW_PAUSE();
+    }
+
+    /* still idle: sleep, longer each time we come up empty */
+    if (inq->sleep_usec == 0)
+        inq->sleep_usec = TMQH_FLOW_SLEEP_MIN;
+    else if (inq->sleep_usec < TMQH_FLOW_SLEEP_MAX)
+        inq->sleep_usec = MIN(inq->sleep_usec * 2, TMQH_FLOW_SLEEP_MAX);
+    usleep(inq->sleep_usec);
+
+    /* return NULL if we have no pkt, the caller checks the thread
+     * flags and calls us again */
+    return TmqhFlowInqGet(inq, q);
 }
 
 static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
@@ -136,22 +378,46 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
         }
         memset(ctx->queues, 0, ctx->size * sizeof(TmqhFlowMode));
     } else {
-        ctx->size++;
-        ptmp = SCRealloc(ctx->queues, ctx->size * sizeof(TmqhFlowMode));
+        ptmp = SCRealloc(ctx->queues, (ctx->size + 1) * sizeof(TmqhFlowMode));
         if (ptmp == NULL) {
-            SCFree(ctx->queues);
-            ctx->queues = NULL;
             return -1;
         }
         ctx->queues = ptmp;
+        ctx->size++;
 
         memset(ctx->queues + (ctx->size - 1), 0, sizeof(TmqhFlowMode));
     }
     ctx->queues[ctx->size - 1].q = &trans_q[id];
 
+    if (SC_ATOMIC_GET(flow_inqs[id].rings_cnt) < TMQH_FLOW_MAX_RINGS) {
+        TmqhFlowRing *r = TmqhFlowRingAlloc();
+        if (r == NULL)
+            return -1;
+        TmqhFlowRingRegister(id, r);
+        ctx->queues[ctx->size - 1].ring = r;
+    }
+
     return 0;
 }
 
+static void TmqhFlowCtxFree(TmqhFlowCtx *ctx)
+{
+    uint16_t i;
+
+    if (ctx->queues != NULL) {
+        for (i = 0; i < ctx->size; i++) {
+            if (ctx->queues[i].ring != NULL) {
+                TmqhFlowRingDeregister(ctx->queues[i].q - trans_q,
+                        ctx->queues[i].ring);
+            }
+        }
+        SCFree(ctx->queues);
+    }
+    if (ctx->pins != NULL)
+        SCFree(ctx->pins);
+    SCFree(ctx);
+}
+
 /**
  * \brief setup the queue handlers ctx
  *
@@ -199,10 +465,19 @@ void *TmqhOutputFlowSetupCtx(char *queue_str)
     } while (tstr != NULL);
 
     SCFree(str);
+
+    if (tmqh_table[TMQH_FLOW].OutHandler == TmqhOutputFlowActivePackets) {
+        ctx->pins = SCMalloc(TMQH_FLOW_PINS * sizeof(TmqhFlowPin));
+        if (unlikely(ctx->pins == NULL)) {
+            str = NULL;
+            goto error;
+        }
+        memset(ctx->pins, 0x00, TMQH_FLOW_PINS * sizeof(TmqhFlowPin));
+    }
     return (void *)ctx;
 
 error:
-    SCFree(ctx);
+    TmqhFlowCtxFree(ctx);
     if (str != NULL)
         SCFree(str);
     return NULL;
@@ -214,12 +489,24 @@ void TmqhOutputFlowFreeCtx(void *ctx)
 
     SCLogPerf("AutoFP - Total flow handler queues - %" PRIu16,
               fctx->size);
-    SCFree(fctx->queues);
-    SCFree(fctx);
+    TmqhFlowCtxFree(fctx);
 
     return;
 }
 
+static inline void TmqhFlowEnqueue(TmqhFlowMode *m, Packet *p)
+{
+    if (likely(m->ring != NULL)) {
+        TmqhFlowRingPut(m->ring, p);
+    } else {
+        PacketQueue *q = m->q;
+        SCMutexLock(&q->mutex_q);
+        PacketEnqueue(q, p);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+}
+
 void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
     int16_t qid = 0;
@@ -236,11 +523,7 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 
     return;
 }
@@ -271,11 +554,62 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
      * ctx->size will be lesser than 2 ** 31 for sure */
     qid = addr_hash % ctx->size;
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
+
+    return;
+}
+
+/**
+ * \brief select the output queue based on the load of the queues
+ *
+ * A flow hash is pinned to the queue with the fewest packets waiting
+ * when it is first seen, and stays there as long as it sees packets,
+ * so the packets of a flow are not reordered. Pins that were idle for
+ * TMQH_FLOW_PIN_TIMEOUT seconds are free to be moved. Flows sharing a
+ * pin table entry share their queue.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+{
+    uint16_t qid = 0;
+
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+
+    if (p->flags & PKT_WANTS_FLOW) {
+        TmqhFlowPin *pin = &ctx->pins[p->flow_hash & (TMQH_FLOW_PINS - 1)];
+        uint16_t now = (uint16_t)p->ts.tv_sec;
+
+        if (pin->qid != 0 && pin->qid <= ctx->size &&
+            (uint16_t)(now - pin->ts) <= TMQH_FLOW_PIN_TIMEOUT) {
+            qid = pin->qid - 1;
+        } else {
+            /* new flow: least loaded queue, ties rotate */
+            uint32_t min_depth = UINT32_MAX;
+            uint16_t i;
+            for (i = 0; i < ctx->size; i++) {
+                uint16_t idx = (ctx->last + i) % ctx->size;
+                uint32_t depth = TmqhFlowQueueDepth(ctx->queues[idx].q - trans_q);
+                if (depth < min_depth) {
+                    min_depth = depth;
+                    qid = idx;
+                    if (depth == 0)
+                        break;
+                }
+            }
+            ctx->last = (qid + 1) % ctx->size;
+            pin->qid = qid + 1;
+        }
+        pin->ts = now;
+    } else {
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 
     return;
 }
@@ -418,6 +752,155 @@ end:
     return retval;
 }
 
+/** \test packets go through the ring in order, also when the indexes
+ *        wrap, and the ring is removed with the ctx */
+static int TmqhFlowRingTest01(void)
+{
+    static Packet pkts[64];
+    ThreadVars tv;
+    int i, j;
+
+    TmqResetQueues();
+    memset(&tv, 0x00, sizeof(tv));
+    memset(pkts, 0x00, sizeof(pkts));
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF_NULL(fctx->queues[0].ring);
+    uint16_t qid = fctx->queues[0].q - trans_q;
+    FAIL_IF_NOT(SC_ATOMIC_GET(flow_inqs[qid].rings_cnt) == 1);
+
+    tv.inq = TmqGetQueueByName("queue1");
+    FAIL_IF_NULL(tv.inq);
+    tv.outctx = fctx;
+
+    for (i = 0; i < (3 * TMQH_FLOW_RING_SIZE) / 64; i++) {
+        for (j = 0; j < 64; j++) {
+            pkts[j].flags = PKT_WANTS_FLOW;
+            pkts[j].flow_hash = j;
+            TmqhOutputFlowHash(&tv, &pkts[j]);
+        }
+        FAIL_IF(TmqhFlowRingsEmpty(qid));
+        for (j = 0; j < 64; j++) {
+            FAIL_IF_NOT(TmqhInputFlow(&tv) == &pkts[j]);
+        }
+    }
+    FAIL_IF_NOT_NULL(TmqhInputFlow(&tv));
+    FAIL_IF_NOT(TmqhFlowRingsEmpty(qid));
+
+    TmqhOutputFlowFreeCtx(fctx);
+    FAIL_IF_NOT(SC_ATOMIC_GET(flow_inqs[qid].rings_cnt) == 0);
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test a ring packet counts as done once the consumer asks for the
+ *        next one */
+static int TmqhFlowWaitDoneTest01(void)
+{
+    static Packet pkts[2];
+    ThreadVars tv;
+
+    TmqResetQueues();
+    memset(&tv, 0x00, sizeof(tv));
+    memset(pkts, 0x00, sizeof(pkts));
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1");
+    FAIL_IF_NULL(fctx);
+    TmqhFlowRing *r = fctx->queues[0].ring;
+    FAIL_IF_NULL(r);
+    uint16_t qid = fctx->queues[0].q - trans_q;
+
+    tv.inq = TmqGetQueueByName("queue1");
+    FAIL_IF_NULL(tv.inq);
+    tv.outctx = fctx;
+
+    TmqhOutputFlowHash(&tv, &pkts[0]);
+    TmqhOutputFlowHash(&tv, &pkts[1]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r->done) == 0);
+
+    FAIL_IF_NOT(TmqhInputFlow(&tv) == &pkts[0]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r->done) == 0);
+    FAIL_IF_NOT(TmqhInputFlow(&tv) == &pkts[1]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r->done) == 1);
+    FAIL_IF_NOT(TmqhFlowRingsEmpty(qid));
+    FAIL_IF_NOT_NULL(TmqhInputFlow(&tv));
+    FAIL_IF_NOT(SC_ATOMIC_GET(r->done) == 2);
+
+    /* all done, doesn't block */
+    TmqhFlowWaitDone(qid);
+
+    TmqhOutputFlowFreeCtx(fctx);
+    FAIL_IF_NOT_NULL(flow_inqs[qid].cur);
+    TmqResetQueues();
+    PASS;
+}
+
+/** \test active-packets: new flows go to the least loaded queue, known
+ *        flows stay where they are */
+static int TmqhFlowActivePacketsTest01(void)
+{
+    static Packet pkts[3];
+    ThreadVars tv;
+    int i;
+
+    TmqResetQueues();
+    memset(&tv, 0x00, sizeof(tv));
+    memset(pkts, 0x00, sizeof(pkts));
+
+    void (*handler)(ThreadVars *, Packet *) = tmqh_table[TMQH_FLOW].OutHandler;
+    tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
+
+    TmqhFlowCtx *fctx = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx);
+    FAIL_IF_NULL(fctx->pins);
+    tv.outctx = fctx;
+
+    TmqhFlowRing *r0 = fctx->queues[0].ring;
+    TmqhFlowRing *r1 = fctx->queues[1].ring;
+    FAIL_IF_NULL(r0);
+    FAIL_IF_NULL(r1);
+
+    for (i = 0; i < 3; i++) {
+        pkts[i].flags = PKT_WANTS_FLOW;
+        pkts[i].flow_hash = 0x1000 + i;
+        pkts[i].ts.tv_sec = 1000;
+    }
+
+    /* flow 0 lands on the first queue and stays there */
+    for (i = 0; i < 8; i++)
+        TmqhOutputFlowActivePackets(&tv, &pkts[0]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r0->tail) == 8);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r1->tail) == 0);
+
+    /* new flow goes to the idle queue */
+    TmqhOutputFlowActivePackets(&tv, &pkts[1]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r1->tail) == 1);
+
+    /* and so does the next one, the first queue is still busier */
+    TmqhOutputFlowActivePackets(&tv, &pkts[2]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r1->tail) == 2);
+
+    /* known flow keeps its queue */
+    TmqhOutputFlowActivePackets(&tv, &pkts[0]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r0->tail) == 9);
+
+    /* idle pin can move: drain the first queue, then flow 2 comes back
+     * after the timeout */
+    tv.inq = TmqGetQueueByName("queue1");
+    FAIL_IF_NULL(tv.inq);
+    for (i = 0; i < 9; i++)
+        FAIL_IF_NOT(TmqhInputFlow(&tv) == &pkts[0]);
+    pkts[2].ts.tv_sec += TMQH_FLOW_PIN_TIMEOUT + 1;
+    TmqhOutputFlowActivePackets(&tv, &pkts[2]);
+    FAIL_IF_NOT(SC_ATOMIC_GET(r0->tail) == 10);
+
+    tmqh_table[TMQH_FLOW].OutHandler = handler;
+    TmqhOutputFlowFreeCtx(fctx);
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +912,10 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01);
+    UtRegisterTest("TmqhFlowWaitDoneTest01", TmqhFlowWaitDoneTest01);
+    UtRegisterTest("TmqhFlowActivePacketsTest01",
+                   TmqhFlowActivePacketsTest01);
 #endif
 
     return;
@@ -24,10 +24,45 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** slots per ring, power of 2 */
+#define TMQH_FLOW_RING_SIZE     4096
+
+/** \brief Lockless single producer, single consumer packet ring
+ *
+ *  One ring exists for each pair of producer thread and output queue.
+ *  Indexes run freely and are masked on access. The producer and the
+ *  consumer side are kept on separate cache lines. */
+typedef struct TmqhFlowRing_ {
+    /* producer side */
+    SC_ATOMIC_DECLARE(unsigned int, tail);  /**< next slot to write */
+    unsigned int head_cache;                /**< producer's view of head */
+    uint8_t pad0[CLS - 2 * sizeof(unsigned int)];
+
+    /* consumer side */
+    SC_ATOMIC_DECLARE(unsigned int, head);  /**< slots before this are free */
+    unsigned int read;                      /**< next slot to read */
+    unsigned int tail_cache;                /**< consumer's view of tail */
+    SC_ATOMIC_DECLARE(unsigned int, done);  /**< slots fully processed */
+    uint8_t pad1[CLS - 4 * sizeof(unsigned int)];
+
+    Packet *slots[TMQH_FLOW_RING_SIZE];
+} TmqhFlowRing;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    /** ring to the queue, NULL if we fall back to the locked queue */
+    TmqhFlowRing *ring;
 } TmqhFlowMode;
 
+/** entries in the active-packets scheduler's pin table, power of 2 */
+#define TMQH_FLOW_PINS          65536
+
+/** \brief Queue a flow hash is pinned to by the active-packets scheduler */
+typedef struct TmqhFlowPin_ {
+    uint16_t qid;   /**< queue index + 1, 0 if unused */
+    uint16_t ts;    /**< low 16 bits of the last packet's time in seconds */
+} TmqhFlowPin;
+
 /** \brief Ctx for the flow queue handler
  *  \param size number of queues to output to
  *  \param queues array of queue id's this flow handler outputs to */
@@ -36,11 +71,16 @@ typedef struct TmqhFlowCtx_ {
     uint16_t last;
 
     TmqhFlowMode *queues;
+
+    /** active-packets scheduler only: flow hash to queue pins */
+    TmqhFlowPin *pins;
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
+int TmqhFlowRingsEmpty(uint16_t qid);
+void TmqhFlowWaitDone(uint16_t qid);
 
 #endif /* __TMQH_FLOW_H__ */
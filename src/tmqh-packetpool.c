@@ -49,6 +49,8 @@
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-latency.h"
+#include "util-load-shed.h"
 
 /* Number of freed packet to save for one pool before freeing them. */
 #define MAX_PENDING_RETURN_PACKETS 32
@@ -136,28 +138,141 @@ void TmqhPacketpoolRegister (void)
     tmqh_table[TMQH_PACKETPOOL].OutHandler = TmqhOutputPacketpool;
 }
 
+/* Adaptive wait for returned packets: spin first, then yield the cpu,
+ * then sleep on the return stack condition. The sleep is timed so that
+ * we recheck even if a returning thread holds on to our packets. */
+#define PKTPOOL_WAIT_SPINS      1000
+#define PKTPOOL_WAIT_YIELDS     16
+#define PKTPOOL_WAIT_SLEEP_USEC 1000
+
 static int PacketPoolIsEmpty(PktPool *pool)
 {
     /* Check local stack first. */
-    if (pool->head || pool->return_stack.head)
+    if (pool->head || SC_ATOMIC_GET(pool->return_stack.head))
         return 0;
 
     return 1;
 }
 
+/** \internal
+ *  \brief sleep on the return stack until packets are returned to it
+ *         or the timeout expires. */
+static void PacketPoolSleep(PktPool *pool)
+{
+    struct timeval now;
+    struct timespec cond_time;
+
+    gettimeofday(&now, NULL);
+    uint64_t usec = (uint64_t)now.tv_usec + PKTPOOL_WAIT_SLEEP_USEC;
+    cond_time.tv_sec = now.tv_sec + (usec / 1000000);
+    cond_time.tv_nsec = (usec % 1000000) * 1000;
+
+    SCMutexLock(&pool->return_stack.mutex);
+    SC_ATOMIC_ADD(pool->return_stack.sync_now, 1);
+    /* recheck under the lock: returning threads signal under it */
+    if (SC_ATOMIC_GET(pool->return_stack.head) == NULL) {
+        SCCondTimedwait(&pool->return_stack.cond, &pool->return_stack.mutex,
+                &cond_time);
+    }
+    SCMutexUnlock(&pool->return_stack.mutex);
+}
+
+/** \internal
+ *  \brief wait until the return stack is not empty
+ *
+ *  Sets sync_now first so that threads holding pending packets for
+ *  this pool return them right away.
+ */
+static void PacketPoolWaitForReturn(PktPool *pool)
+{
+    uint32_t round = 0;
+
+    LoadShedPoolWait();
+    SC_ATOMIC_ADD(pool->return_stack.sync_now, 1);
+
+    while (SC_ATOMIC_GET(pool->return_stack.head) == NULL) {
+        if (round < PKTPOOL_WAIT_SPINS) {
+            cc_barrier();
+        } else if (round < PKTPOOL_WAIT_SPINS + PKTPOOL_WAIT_YIELDS) {
+            sched_yield();
+        } else {
+            PacketPoolSleep(pool);
+        }
+        round++;
+    }
+}
+
 void PacketPoolWait(void)
 {
     PktPool *my_pool = GetThreadPacketPool();
 
-    if (PacketPoolIsEmpty(my_pool)) {
-        SCMutexLock(&my_pool->return_stack.mutex);
-        SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-        SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-        SCMutexUnlock(&my_pool->return_stack.mutex);
+    if (PacketPoolIsEmpty(my_pool))
+        PacketPoolWaitForReturn(my_pool);
+}
+
+/** \internal
+ *  \brief see if at least n packets are in the local or return stack
+ *
+ *  Only called by the owner, the only thread that removes packets from
+ *  the return stack, so walking it is safe without locking. */
+static int PacketPoolCountN(PktPool *pool, int n)
+{
+    int i = 0;
+
+    /* count packets in our stack */
+    Packet *p = pool->head;
+    while (p != NULL) {
+        if (++i == n)
+            return 1;
+        p = p->next;
     }
 
-    while(PacketPoolIsEmpty(my_pool))
-        cc_barrier();
+    /* continue counting in the return stack */
+    p = SC_ATOMIC_GET(pool->return_stack.head);
+    while (p != NULL) {
+        if (++i == n)
+            return 1;
+        p = p->next;
+    }
+    return 0;
+}
+
+/** \brief check if we have the requested ammount of packets in the pool
+ *
+ *  Non-blocking version of PacketPoolWaitForN().
+ *
+ *  \param n number of packets needed
+ *
+ *  \retval 1 at least n packets available
+ *  \retval 0 not enough packets
+ */
+int PacketPoolHasN(int n)
+{
+    return PacketPoolCountN(GetThreadPacketPool(), n);
+}
+
+/** \internal
+ *  \brief take all packets from the return stack and put them on the
+ *         local stack */
+static void PacketPoolGetReturnedPackets(PktPool *pool)
+{
+    Packet *head;
+
+    /* Only we remove from the return stack, so there is no ABA issue
+     * when swapping the complete list out. */
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack.head);
+        if (head == NULL)
+            return;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, head, NULL) == 0);
+
+    if (pool->head != NULL) {
+        Packet *tail = head;
+        while (tail->next != NULL)
+            tail = tail->next;
+        tail->next = pool->head;
+    }
+    pool->head = head;
 }
 
 /** \brief Wait until we have the requested ammount of packets in the pool
@@ -173,41 +288,17 @@ void PacketPoolWait(void)
 void PacketPoolWaitForN(int n)
 {
     PktPool *my_pool = GetThreadPacketPool();
-    Packet *p = NULL;
 
     while (1) {
-        int i = 0;
-        PacketPoolWait();
-
-        /* count packets in our stack */
-        p = my_pool->head;
-        while (p != NULL) {
-            if (++i == n)
-                return;
+        /* move what was returned so far to the local stack, so that
+         * the wait below only returns on new packets */
+        PacketPoolGetReturnedPackets(my_pool);
 
-            p = p->next;
-        }
-
-        /* continue counting in the return stack */
-        if (my_pool->return_stack.head != NULL) {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            p = my_pool->return_stack.head;
-            while (p != NULL) {
-                if (++i == n) {
-                    SCMutexUnlock(&my_pool->return_stack.mutex);
-                    return;
-                }
-                p = p->next;
-            }
-            SCMutexUnlock(&my_pool->return_stack.mutex);
+        if (PacketPoolCountN(my_pool, n))
+            return;
 
-        /* or signal that we need packets and wait */
-        } else {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-            SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-            SCMutexUnlock(&my_pool->return_stack.mutex);
-        }
+        /* signal that we need packets and wait */
+        PacketPoolWaitForReturn(my_pool);
     }
 }
 
@@ -225,15 +316,6 @@ static void PacketPoolStorePacket(Packet *p)
     PacketPoolReturnPacket(p);
 }
 
-static void PacketPoolGetReturnedPackets(PktPool *pool)
-{
-    SCMutexLock(&pool->return_stack.mutex);
-    /* Move all the packets from the locked return stack to the local stack. */
-    pool->head = pool->return_stack.head;
-    pool->return_stack.head = NULL;
-    SCMutexUnlock(&pool->return_stack.mutex);
-}
-
 /** \brief Get a new packet from the packet pool
  *
  * Only allocates from the thread's local stack, or mallocs new packets.
@@ -278,6 +360,91 @@ Packet *PacketPoolGetPacket(void)
     return NULL;
 }
 
+/** \internal
+ *  \brief push a list of packets onto the return stack of 'pool'
+ *
+ *  Wakes up the owner if it is waiting for packets.
+ */
+static void PacketPoolReturnStackPush(PktPool *pool, Packet *head, Packet *tail)
+{
+    Packet *old;
+    do {
+        old = SC_ATOMIC_GET(pool->return_stack.head);
+        tail->next = old;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, old, head) == 0);
+
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now)) {
+        SCMutexLock(&pool->return_stack.mutex);
+        SC_ATOMIC_RESET(pool->return_stack.sync_now);
+        SCCondSignal(&pool->return_stack.cond);
+        SCMutexUnlock(&pool->return_stack.mutex);
+    }
+}
+
+/** \internal
+ *  \brief return the pending list to its pool and clear the slot */
+static void PacketPoolFlushPending(PktPoolPending *pe)
+{
+    PacketPoolReturnStackPush(pe->pool, pe->head, pe->tail);
+    pe->pool = NULL;
+    pe->head = NULL;
+    pe->tail = NULL;
+    pe->count = 0;
+}
+
+/** \internal
+ *  \brief add packet 'p' to our pending list for 'pool'
+ *
+ *  Lists for pools whose owner is waiting are flushed right away. If
+ *  all slots are in use, the largest list is flushed to make room.
+ */
+static void PacketPoolAddPending(PktPool *my_pool, PktPool *pool, Packet *p)
+{
+    PktPoolPending *slot = NULL;
+    PktPoolPending *empty = NULL;
+    PktPoolPending *largest = NULL;
+    int i;
+
+    for (i = 0; i < PKTPOOL_PENDING_SLOTS; i++) {
+        PktPoolPending *pe = &my_pool->pending[i];
+        if (pe->pool == pool) {
+            slot = pe;
+            continue;
+        }
+        if (pe->pool != NULL && SC_ATOMIC_GET(pe->pool->return_stack.sync_now)) {
+            PacketPoolFlushPending(pe);
+        }
+        if (pe->pool == NULL) {
+            if (empty == NULL)
+                empty = pe;
+        } else if (largest == NULL || pe->count > largest->count) {
+            largest = pe;
+        }
+    }
+
+    if (slot == NULL) {
+        if (empty != NULL) {
+            slot = empty;
+        } else {
+            PacketPoolFlushPending(largest);
+            slot = largest;
+        }
+        slot->pool = pool;
+        slot->tail = p;
+        p->next = NULL;
+    } else {
+        p->next = slot->head;
+    }
+    slot->head = p;
+    slot->count++;
+
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now) ||
+            slot->count > max_pending_return_packets) {
+        /* Return the entire list of pending packets. */
+        PacketPoolFlushPending(slot);
+    }
+}
+
 /** \brief Return packet to Packet pool
  *
  */
@@ -304,42 +471,7 @@ void PacketPoolReturnPacket(Packet *p)
         p->next = my_pool->head;
         my_pool->head = p;
     } else {
-        PktPool *pending_pool = my_pool->pending_pool;
-        if (pending_pool == NULL) {
-            /* No pending packet, so store the current packet. */
-            p->next = NULL;
-            my_pool->pending_pool = pool;
-            my_pool->pending_head = p;
-            my_pool->pending_tail = p;
-            my_pool->pending_count = 1;
-        } else if (pending_pool == pool) {
-            /* Another packet for the pending pool list. */
-            p->next = my_pool->pending_head;
-            my_pool->pending_head = p;
-            my_pool->pending_count++;
-            if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
-                /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
-                /* Clear the list of pending packets to return. */
-                my_pool->pending_pool = NULL;
-                my_pool->pending_head = NULL;
-                my_pool->pending_tail = NULL;
-                my_pool->pending_count = 0;
-            }
-        } else {
-            /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
-            p->next = pool->return_stack.head;
-            pool->return_stack.head = p;
-            SC_ATOMIC_RESET(pool->return_stack.sync_now);
-            SCMutexUnlock(&pool->return_stack.mutex);
-            SCCondSignal(&pool->return_stack.cond);
-        }
+        PacketPoolAddPending(my_pool, pool, p);
     }
 }
 
@@ -359,13 +491,23 @@ void PacketPoolInitEmpty(void)
 
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 }
 
 void PacketPoolInit(void)
 {
     extern intmax_t max_pending_packets;
+    PacketPoolInitWithSize(max_pending_packets);
+}
 
+/** \brief set up the thread's pool with 'size' preallocated packets
+ *
+ *  Used by threads that need a pool of their own size, like the flow
+ *  managers for their pseudo packets.
+ */
+void PacketPoolInitWithSize(intmax_t size)
+{
 #ifndef TLS
     TmqhPacketPoolInit();
 #endif
@@ -380,14 +522,16 @@ void PacketPoolInit(void)
 
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 
-    /* pre allocate packets */
+    /* pre allocate packets. Their data buffers start small and grow
+     * with what the thread copies into them */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
-               (uintmax_t)SIZE_OF_PACKET);
+               (uintmax_t)(sizeof(Packet) + PACKET_POOL_DIRECT_SIZE));
     int i = 0;
-    for (i = 0; i < max_pending_packets; i++) {
-        Packet *p = PacketGetFromAlloc();
+    for (i = 0; i < size; i++) {
+        Packet *p = PacketGetFromAllocWithDataSize(PACKET_POOL_DIRECT_SIZE);
         if (unlikely(p == NULL)) {
             SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet. Exiting...");
             exit(EXIT_FAILURE);
@@ -408,26 +552,32 @@ void PacketPoolDestroy(void)
     BUG_ON(my_pool->destroyed);
 #endif /* DEBUG_VALIDATION */
 
-    if (my_pool && my_pool->pending_pool != NULL) {
-        p = my_pool->pending_head;
+    int i;
+    for (i = 0; my_pool && i < PKTPOOL_PENDING_SLOTS; i++) {
+        PktPoolPending *pe = &my_pool->pending[i];
+        if (pe->pool == NULL)
+            continue;
+
+        p = pe->head;
         while (p) {
             Packet *next_p = p->next;
             PacketFree(p);
             p = next_p;
-            my_pool->pending_count--;
+            pe->count--;
         }
 #ifdef DEBUG_VALIDATION
-        BUG_ON(my_pool->pending_count);
+        BUG_ON(pe->count);
 #endif /* DEBUG_VALIDATION */
-        my_pool->pending_pool = NULL;
-        my_pool->pending_head = NULL;
-        my_pool->pending_tail = NULL;
+        pe->pool = NULL;
+        pe->head = NULL;
+        pe->tail = NULL;
     }
 
     while ((p = PacketPoolGetPacket()) != NULL) {
         PacketFree(p);
     }
 
+    SC_ATOMIC_DESTROY(my_pool->return_stack.head);
     SC_ATOMIC_DESTROY(my_pool->return_stack.sync_now);
 
 #ifdef DEBUG_VALIDATION
@@ -448,6 +598,11 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
     SCEnter();
     SCLogDebug("Packet %p, p->root %p, alloced %s", p, p->root, p->flags & PKT_ALLOC ? "true" : "false");
 
+    if (unlikely(latency_capture_enabled) && p->root == NULL &&
+            !(PKT_IS_PSEUDOPKT(p))) {
+        LatencyCapture(t, p);
+    }
+
     /** \todo make this a callback
      *  Release tcp segments. Done here after alerting can use them. */
     if (p->flow != NULL && p->proto == IPPROTO_TCP) {
@@ -28,29 +28,40 @@
 #include "threads.h"
 #include "util-atomic.h"
 
-    /* Return stack, onto which other threads free packets. */
+    /* Return stack, onto which other threads free packets. Returning
+     * threads push their lists with a CAS, the owner takes the whole stack
+     * at once. The mutex and cond are only used when the owner sleeps. */
 typedef struct PktPoolLockedStack_{
     /* linked list of free packets. */
+    SC_ATOMIC_DECLARE(Packet *, head);
+    /* set by the owner when it is waiting for packets */
+    SC_ATOMIC_DECLARE(int, sync_now);
     SCMutex mutex;
     SCCondT cond;
-    SC_ATOMIC_DECLARE(int, sync_now);
-    Packet *head;
 } __attribute__((aligned(CLS))) PktPoolLockedStack;
 
+/* Number of pools a thread can hold pending returns for at once. */
+#define PKTPOOL_PENDING_SLOTS 8
+
+/* Packets waiting (pending) to be returned to the given Packet Pool.
+ * Accumulate packets for the same pool until a theshold is reached, then
+ * return them all at once. Keep the head and tail to fast insertion of
+ * the entire list onto a return stack.
+ */
+typedef struct PktPoolPending_ {
+    struct PktPool_ *pool;
+    Packet *head;
+    Packet *tail;
+    uint32_t count;
+} PktPoolPending;
+
 typedef struct PktPool_ {
     /* link listed of free packets local to this thread.
      * No mutex is needed.
      */
     Packet *head;
-    /* Packets waiting (pending) to be returned to the given Packet
-     * Pool. Accumulate packets for the same pool until a theshold is
-     * reached, then return them all at once.  Keep the head and tail
-     * to fast insertion of the entire list onto a return stack.
-     */
-    struct PktPool_ *pending_pool;
-    Packet *pending_head;
-    Packet *pending_tail;
-    uint32_t pending_count;
+    /* pending lists, one per pool we're returning packets to */
+    PktPoolPending pending[PKTPOOL_PENDING_SLOTS];
 
 #ifdef DEBUG_VALIDATION
     int initialized;
@@ -74,8 +85,10 @@ void TmqhPacketpoolRegister(void);
 Packet *PacketPoolGetPacket(void);
 void PacketPoolWait(void);
 void PacketPoolWaitForN(int n);
+int PacketPoolHasN(int n);
 void PacketPoolReturnPacket(Packet *p);
 void PacketPoolInit(void);
+void PacketPoolInitWithSize(intmax_t size);
 void PacketPoolInitEmpty(void);
 void PacketPoolDestroy(void);
 void PacketPoolPostRunmodes(void);
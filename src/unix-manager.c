@@ -25,6 +25,8 @@
 #include "suricata.h"
 #include "unix-manager.h"
 #include "detect-engine.h"
+#include "detect-engine-memuse.h"
+#include "detect-engine-rule-budget.h"
 #include "tm-threads.h"
 #include "runmodes.h"
 #include "conf.h"
@@ -34,6 +36,9 @@
 #include "util-signal.h"
 
 #include "util-buffer.h"
+#include "util-profiling.h"
+#include "util-host-os-info.h"
+#include "util-lock-stats.h"
 
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -712,6 +717,57 @@ TmEcode UnixManagerReloadRules(json_t *cmd, json_t *server_msg, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+TmEcode UnixManagerReloadReputation(json_t *cmd, json_t *server_msg, void *data)
+{
+    SCEnter();
+    if (DetectEngineReloadReputation() < 0) {
+        json_object_set_new(server_msg, "message",
+                json_string("reputation reload failed, see log"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_object_set_new(server_msg, "message", json_string("done"));
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode UnixManagerHostOSPolicyAdd(json_t *cmd, json_t *server_msg, void *data)
+{
+    SCEnter();
+
+    json_t *jpolicy = json_object_get(cmd, "policy");
+    json_t *jaddr = json_object_get(cmd, "address");
+    if (!json_is_string(jpolicy) || !json_is_string(jaddr)) {
+        json_object_set_new(server_msg, "message",
+                json_string("policy and address need to be strings"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    if (SCHInfoRuntimeAdd(json_string_value(jpolicy),
+                json_string_value(jaddr)) < 0) {
+        json_object_set_new(server_msg, "message",
+                json_string("invalid policy or address"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_object_set_new(server_msg, "message", json_string("done"));
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode UnixManagerLockStatsCommand(json_t *cmd, json_t *server_msg, void *data)
+{
+    SCEnter();
+
+    json_t *js = LockStatsToJSON();
+    if (js == NULL) {
+        json_object_set_new(server_msg, "message",
+                json_string("lock contention sampling is not enabled"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_object_set_new(server_msg, "message", js);
+    SCReturnInt(TM_ECODE_OK);
+}
+
 TmEcode UnixManagerConfGetCommand(json_t *cmd,
                                   json_t *server_msg, void *data)
 {
@@ -929,7 +985,16 @@ static TmEcode UnixManagerThreadInit(ThreadVars *t, void *initdata, void **data)
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", StatsOutputCounterSocket, NULL, 0);
+    UnixManagerRegisterCommand("lock-stats", UnixManagerLockStatsCommand, NULL, 0);
     UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
+    UnixManagerRegisterCommand("reputation-reload", UnixManagerReloadReputation, NULL, 0);
+    UnixManagerRegisterCommand("host-os-policy-add", UnixManagerHostOSPolicyAdd, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("profiling-rules-start", SCProfilingRulesStartCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("profiling-rules-stop", SCProfilingRulesStopCommand, NULL, 0);
+    UnixManagerRegisterCommand("profiling-rules-dump", SCProfilingRulesDumpCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("detect-memuse", DetectEngineMemuseCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("rule-budget-list", DetectRuleBudgetListCommand, NULL, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("rule-budget-enable", DetectRuleBudgetEnableCommand, NULL, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS);
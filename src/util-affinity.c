@@ -274,10 +274,125 @@ void AffinitySetupLoadFromConfig()
                 exit(EXIT_FAILURE);
             }
         }
+
+        node = ConfNodeLookupChild(affinity->head.tqh_first, "realtime-prio");
+        if (node != NULL) {
+            taf->rt_prio = atoi(node->val);
+            if (taf->rt_prio < 1 || taf->rt_prio > 99) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: realtime-prio must be "
+                        "between 1 and 99", setname);
+                exit(EXIT_FAILURE);
+            }
+            SCLogConfig("Using SCHED_FIFO prio %d for set '%s'",
+                    taf->rt_prio, setname);
+        }
     }
 #endif /* OS_WIN32 and __OpenBSD__ */
 }
 
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined OS_DARWIN
+/**
+ * \brief print a cpu set as a list of ranges, e.g. "0-3,8"
+ */
+static void AffinityCpusetToString(const cpu_set_t *cs, char *str, size_t size)
+{
+    int ncpu = UtilCpuGetNumProcessorsConfigured();
+    int i, start = -1;
+    size_t off = 0;
+
+    str[0] = '\0';
+    for (i = 0; i <= ncpu; i++) {
+        int set = (i < ncpu && CPU_ISSET(i, cs));
+        if (set && start == -1) {
+            start = i;
+        } else if (!set && start != -1) {
+            int r;
+            if (start == i - 1)
+                r = snprintf(str + off, size - off, "%s%d", off ? "," : "", start);
+            else
+                r = snprintf(str + off, size - off, "%s%d-%d", off ? "," : "",
+                        start, i - 1);
+            if (r < 0 || (size_t)r >= size - off)
+                return;
+            off += r;
+            start = -1;
+        }
+    }
+}
+#endif
+
+/**
+ * \brief keep the main thread, and so all the threads it creates that
+ *        don't set their own affinity, on the management cpus
+ *
+ * The management set is the housekeeping set: the flow manager and
+ * recycler, the stats and unix socket threads and the detect loaders
+ * all use it, so none of them preempt the workers.
+ */
+void AffinitySetupMainThread(void)
+{
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined OS_DARWIN
+    cpu_set_t *cs = &thread_affinity[MANAGEMENT_CPU_SET].cpu_set;
+
+    if (CPU_COUNT(cs) == 0)
+        return;
+
+    if (sched_setaffinity(0, sizeof(cpu_set_t), cs) != 0) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "unable to set the affinity of "
+                "the main thread: %s", strerror(errno));
+    }
+#endif
+}
+
+/**
+ * \brief log the cpus and scheduling of each thread family
+ */
+void AffinityPrintReport(void)
+{
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined OS_DARWIN
+    int i;
+    char cpus[256];
+
+    for (i = 0; i < MAX_CPU_SET; i++) {
+        ThreadsAffinityType *taf = &thread_affinity[i];
+        AffinityCpusetToString(&taf->cpu_set, cpus, sizeof(cpus));
+        if (taf->rt_prio > 0) {
+            SCLogConfig("%s: cpus %s, %s, SCHED_FIFO prio %d", taf->name, cpus,
+                    taf->mode_flag == EXCLUSIVE_AFFINITY ? "exclusive" : "balanced",
+                    taf->rt_prio);
+        } else {
+            SCLogConfig("%s: cpus %s, %s", taf->name, cpus,
+                    taf->mode_flag == EXCLUSIVE_AFFINITY ? "exclusive" : "balanced");
+        }
+    }
+#endif
+}
+
+/**
+ * \brief switch the calling thread to SCHED_FIFO if its set asks for it
+ *
+ * \retval 0 ok or not requested, -1 error
+ */
+int AffinitySetRealtime(const ThreadsAffinityType *taf, const char *tname)
+{
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__
+    if (taf->rt_prio <= 0)
+        return 0;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = taf->rt_prio;
+    int r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (r != 0) {
+        SCLogWarning(SC_ERR_THREAD_NICE_PRIO, "unable to set SCHED_FIFO prio "
+                "%d for thread %s: %s", taf->rt_prio, tname, strerror(r));
+        return -1;
+    }
+    SCLogPerf("Thread \"%s\" uses SCHED_FIFO prio %d", tname, taf->rt_prio);
+#endif
+    return 0;
+}
+
 /**
  * \brief Return next cpu to use for a given thread family
  * \retval the cpu to used given by its id
@@ -308,3 +423,115 @@ int AffinityGetNextCPU(ThreadsAffinityType *taf)
 #endif /* OS_WIN32 and __OpenBSD__ */
     return ncpu;
 }
+
+/**
+ * \brief check if 'threading.numa' is enabled
+ *
+ * NUMA mode needs the threads to be pinned, otherwise the node of a
+ * thread is meaningless, so it depends on 'threading.set-cpu-affinity'.
+ *
+ * \retval 1 enabled
+ * \retval 0 disabled
+ */
+int AffinityNumaModeEnabled(void)
+{
+    int numa = 0, affinity = 0;
+    if (ConfGetBool("threading.numa", &numa) != 1 || !numa)
+        return 0;
+    if (ConfGetBool("threading.set-cpu-affinity", &affinity) != 1 || !affinity) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "threading.numa requires "
+                "threading.set-cpu-affinity, ignoring");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief get the number of NUMA nodes of the system
+ * \retval number of nodes, 1 if the system is not NUMA or it's unknown
+ */
+int AffinityGetNumaNodeCount(void)
+{
+    int nodes = 1;
+#if defined(__linux__)
+    FILE *fp = fopen("/sys/devices/system/node/possible", "r");
+    if (fp == NULL)
+        return 1;
+
+    /* format is a cpulist style range, e.g. "0" or "0-1" */
+    int first = 0, last = 0;
+    int r = fscanf(fp, "%d-%d", &first, &last);
+    if (r == 2 && last >= first)
+        nodes = last + 1;
+    fclose(fp);
+#endif
+    return nodes;
+}
+
+/**
+ * \brief get the NUMA node of the cpu the calling thread runs on
+ *
+ * Only stable if the thread has its affinity set to cpus on a single
+ * node.
+ *
+ * \retval node or -1 if unknown
+ */
+int AffinityGetCurrentNumaNode(void)
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return (int)node;
+#endif
+    return -1;
+}
+
+/**
+ * \brief get the NUMA node a network interface is attached to
+ * \retval node or -1 if unknown
+ */
+int AffinityGetIfaceNumaNode(const char *iface)
+{
+    int node = -1;
+#if defined(__linux__)
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", iface);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%d", &node) != 1)
+        node = -1;
+    fclose(fp);
+#endif
+    return node;
+}
+
+/**
+ * \brief prefer the memory of the calling thread to be on 'node'
+ *
+ * Pages are placed when first touched. It's only a preference, if the
+ * node is out of memory others are used.
+ *
+ * \param node NUMA node, -1 to go back to the default policy
+ * \retval 0 ok, -1 not supported or failed
+ */
+int AffinitySetPreferredNumaNode(int node)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    /* MPOL_DEFAULT and MPOL_PREFERRED, numaif.h may not be installed */
+    if (node < 0)
+        return syscall(SYS_set_mempolicy, 0, NULL, 0) == 0 ? 0 : -1;
+    if (node >= (int)(sizeof(unsigned long) * 8) - 1)
+        return -1;
+
+    unsigned long mask = 1UL << node;
+    if (syscall(SYS_set_mempolicy, 1, &mask, (unsigned long)node + 2) != 0) {
+        SCLogDebug("set_mempolicy failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
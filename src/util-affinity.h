@@ -64,6 +64,8 @@ typedef struct ThreadsAffinityType_ {
     const char *name;
     uint8_t mode_flag;
     int prio;
+    /* SCHED_FIFO priority of the threads, 0 for the default scheduler */
+    int rt_prio;
     int nb_threads;
     SCMutex taf_mutex;
     uint16_t lcpu; /* use by exclusive mode */
@@ -85,5 +87,14 @@ void AffinitySetupLoadFromConfig();
 ThreadsAffinityType * GetAffinityTypeFromName(const char *name);
 
 int AffinityGetNextCPU(ThreadsAffinityType *taf);
+void AffinitySetupMainThread(void);
+void AffinityPrintReport(void);
+int AffinitySetRealtime(const ThreadsAffinityType *taf, const char *tname);
+
+int AffinityNumaModeEnabled(void);
+int AffinityGetNumaNodeCount(void);
+int AffinityGetCurrentNumaNode(void);
+int AffinityGetIfaceNumaNode(const char *iface);
+int AffinitySetPreferredNumaNode(int node);
 
 #endif /* __UTIL_AFFINITY_H__ */
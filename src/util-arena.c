@@ -0,0 +1,217 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Tx ordered bump allocator. Blocks are kept in allocation order. As txs
+ * are freed in (roughly) creation order, blocks at the head of the list
+ * run out of live objects first and are handed back as a whole.
+ */
+
+#include "suricata-common.h"
+#include "util-arena.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+#define TX_ARENA_ALIGN          sizeof(void *)
+#define TX_ARENA_ALIGN_SIZE(s)  (((s) + (TX_ARENA_ALIGN - 1)) & ~(TX_ARENA_ALIGN - 1))
+
+/** usable space in a regular block */
+#define TX_ARENA_BLOCK_DATA     (TX_ARENA_BLOCK_SIZE - sizeof(TxArenaBlock))
+
+/** allocations larger than this get a block of their own so they
+ *  don't waste the remainder of a regular block */
+#define TX_ARENA_LARGE          (TX_ARENA_BLOCK_DATA / 4)
+
+static TxArenaBlock *TxArenaBlockAlloc(uint32_t size)
+{
+    TxArenaBlock *b = SCMalloc(sizeof(TxArenaBlock) + size);
+    if (unlikely(b == NULL))
+        return NULL;
+    b->next = NULL;
+    b->max_tx_id = 0;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+static void TxArenaAppend(TxArena *arena, TxArenaBlock *b)
+{
+    if (arena->tail == NULL) {
+        arena->head = arena->tail = b;
+    } else {
+        arena->tail->next = b;
+        arena->tail = b;
+    }
+}
+
+/**
+ *  \brief Get zeroed memory from the arena
+ *
+ *  \param tx_id tag for the allocation. The memory stays valid until
+ *               TxArenaRelease is called with a lowest live id above it.
+ *  \param size size of the allocation
+ *
+ *  \retval ptr to memory or NULL on allocation failure
+ */
+void *TxArenaAlloc(TxArena *arena, uint64_t tx_id, uint32_t size)
+{
+    size = TX_ARENA_ALIGN_SIZE(size);
+
+    TxArenaBlock *b = arena->tail;
+    if (size > TX_ARENA_LARGE) {
+        b = TxArenaBlockAlloc(size);
+        if (b == NULL)
+            return NULL;
+        TxArenaAppend(arena, b);
+    } else if (b == NULL || b->size - b->used < size) {
+        b = TxArenaBlockAlloc(TX_ARENA_BLOCK_DATA);
+        if (b == NULL)
+            return NULL;
+        TxArenaAppend(arena, b);
+    }
+
+    void *ptr = b->data + b->used;
+    b->used += size;
+    if (tx_id > b->max_tx_id)
+        b->max_tx_id = tx_id;
+
+    memset(ptr, 0x00, size);
+    return ptr;
+}
+
+/**
+ *  \brief Hand back the blocks only holding objects of freed txs
+ *
+ *  \param lowest_live_tx_id lowest tag still in use, UINT64_MAX if
+ *                           there are no live txs left
+ */
+void TxArenaRelease(TxArena *arena, uint64_t lowest_live_tx_id)
+{
+    TxArenaBlock *b;
+    while ((b = arena->head) != NULL && b->max_tx_id < lowest_live_tx_id) {
+        /* keep the tail around as the bump block if it's a regular one */
+        if (b == arena->tail && b->size == TX_ARENA_BLOCK_DATA) {
+            b->used = 0;
+            b->max_tx_id = 0;
+            break;
+        }
+        arena->head = b->next;
+        if (arena->head == NULL)
+            arena->tail = NULL;
+        SCFree(b);
+    }
+}
+
+/** \brief free all memory of the arena */
+void TxArenaFree(TxArena *arena)
+{
+    TxArenaBlock *b = arena->head;
+    while (b != NULL) {
+        TxArenaBlock *next = b->next;
+        SCFree(b);
+        b = next;
+    }
+    arena->head = arena->tail = NULL;
+}
+
+#ifdef UNITTESTS
+static int TxArenaBlockCount(TxArena *arena)
+{
+    int cnt = 0;
+    TxArenaBlock *b;
+    for (b = arena->head; b != NULL; b = b->next)
+        cnt++;
+    return cnt;
+}
+
+/** \test blocks are only released once all their txs are gone */
+static int TxArenaTest01(void)
+{
+    TxArena arena = { NULL, NULL };
+
+    /* fill more than one block with tx 1 and 2 objects */
+    uint64_t tx_id;
+    int i;
+    for (tx_id = 1; tx_id <= 2; tx_id++) {
+        for (i = 0; i < (tx_id == 1 ? 128 : 64); i++) {
+            uint8_t *p = TxArenaAlloc(&arena, tx_id, 48);
+            FAIL_IF_NULL(p);
+            FAIL_IF_NOT(((uintptr_t)p % sizeof(void *)) == 0);
+            FAIL_IF_NOT(p[0] == 0 && p[47] == 0);
+            memset(p, 0xff, 48);
+        }
+    }
+    int blocks = TxArenaBlockCount(&arena);
+    FAIL_IF(blocks < 3);
+
+    /* tx 1 still live: nothing can go */
+    TxArenaRelease(&arena, 1);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == blocks);
+
+    /* tx 1 gone: only blocks with tx 1 objects only can go */
+    TxArenaRelease(&arena, 2);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) < blocks);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) >= 1);
+
+    /* all gone: the regular tail is kept for reuse */
+    TxArenaRelease(&arena, UINT64_MAX);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == 1);
+    FAIL_IF_NOT(arena.head->used == 0);
+
+    TxArenaFree(&arena);
+    FAIL_IF_NOT_NULL(arena.head);
+    FAIL_IF_NOT_NULL(arena.tail);
+    PASS;
+}
+
+/** \test large allocations get their own block */
+static int TxArenaTest02(void)
+{
+    TxArena arena = { NULL, NULL };
+
+    void *small = TxArenaAlloc(&arena, 1, 16);
+    FAIL_IF_NULL(small);
+    void *large = TxArenaAlloc(&arena, 2, 0xffff);
+    FAIL_IF_NULL(large);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == 2);
+    FAIL_IF_NOT(arena.tail->size >= 0xffff);
+
+    /* next small allocation can't come from the large block */
+    void *small2 = TxArenaAlloc(&arena, 2, 16);
+    FAIL_IF_NULL(small2);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == 3);
+
+    TxArenaRelease(&arena, 2);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == 2);
+
+    TxArenaRelease(&arena, UINT64_MAX);
+    FAIL_IF_NOT(TxArenaBlockCount(&arena) == 1);
+
+    TxArenaFree(&arena);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void TxArenaRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TxArenaTest01", TxArenaTest01);
+    UtRegisterTest("TxArenaTest02", TxArenaTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,54 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Bump allocator for transaction lifetime objects of an app layer state.
+ *
+ * Allocations are tagged with a tx id that is at least the id of the tx
+ * owning them. There is no free of single objects: once all txs up to an
+ * id are gone, the parser releases the arena up to that id, which hands
+ * back all blocks holding only objects of those txs.
+ */
+
+#ifndef __UTIL_ARENA_H__
+#define __UTIL_ARENA_H__
+
+/** size of a regular arena block, including its header */
+#define TX_ARENA_BLOCK_SIZE     4096
+
+typedef struct TxArenaBlock_ {
+    struct TxArenaBlock_ *next;
+    uint64_t max_tx_id;     /**< highest tx id allocated from this block */
+    uint32_t size;          /**< usable size of data */
+    uint32_t used;
+    uint8_t data[] __attribute__((aligned(sizeof(void *))));
+} TxArenaBlock;
+
+typedef struct TxArena_ {
+    TxArenaBlock *head;     /**< oldest block */
+    TxArenaBlock *tail;     /**< block allocations are bumped from */
+} TxArena;
+
+void *TxArenaAlloc(TxArena *arena, uint64_t tx_id, uint32_t size);
+void TxArenaRelease(TxArena *arena, uint64_t lowest_live_tx_id);
+void TxArenaFree(TxArena *arena);
+
+void TxArenaRegisterTests(void);
+
+#endif /* __UTIL_ARENA_H__ */
@@ -24,12 +24,10 @@
 
 #include "util-base64.h"
 
-/* Constants */
-#define BASE64_TABLE_MAX  122
-
-/* Base64 character to index conversion table */
+/* Base64 character to index conversion table, -1 for characters that
+ * are not part of the alphabet */
 /* Characters are mapped as "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/" */
-static const int b64table[] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+static const int8_t b64table[256] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -41,35 +39,26 @@ static const int b64table[] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
         25, -1, -1, -1, -1, -1, -1, 26, 27, 28,
         29, 30, 31, 32, 33, 34, 35, 36, 37, 38,
         39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
-        49, 50, 51 };
+        49, 50, 51, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1 };
 
-/**
- * \brief Gets a base64-decoded value from an encoded character
- *
- * \param c The encoded character
- *
- * \return The decoded value (0 or above), or -1 if the parameter is invalid
- */
 static inline int GetBase64Value(uint8_t c)
 {
-    int val = -1;
-
-    /* Pull from conversion table */
-    if (c <= BASE64_TABLE_MAX) {
-        val = b64table[(int) c];
-    }
-
-    return val;
+    return b64table[c];
 }
 
-/**
- * \brief Decodes a 4-byte base64-encoded block into a 3-byte ascii-encoded block
- *
- * \param ascii the 3-byte ascii output block
- * \param b64 the 4-byte base64 input block
- *
- * \return none
- */
 static inline void DecodeBase64Block(uint8_t ascii[ASCII_BLOCK], uint8_t b64[B64_BLOCK])
 {
     ascii[0] = (uint8_t) (b64[0] << 2) | (b64[1] >> 4);
@@ -96,8 +85,26 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     uint8_t *dptr = dest;
     uint8_t b64[B64_BLOCK] = { 0,0,0,0 };
 
+    /* Fast path: decode blocks of 4 valid characters without looking at
+     * padding and block state. Stops at the first block with padding, an
+     * invalid character or a NUL, which the loop below then handles. */
+    for (i = 0; i + B64_BLOCK <= len; i += B64_BLOCK) {
+        int v0 = b64table[src[i]];
+        int v1 = b64table[src[i + 1]];
+        int v2 = b64table[src[i + 2]];
+        int v3 = b64table[src[i + 3]];
+        if ((v0 | v1 | v2 | v3) < 0)
+            break;
+
+        dptr[0] = (uint8_t) (v0 << 2) | (v1 >> 4);
+        dptr[1] = (uint8_t) (v1 << 4) | (v2 >> 2);
+        dptr[2] = (uint8_t) (v2 << 6) | (v3);
+        dptr += ASCII_BLOCK;
+        numDecoded += ASCII_BLOCK;
+    }
+
     /* Traverse through each alpha-numeric letter in the source array */
-    for(i = 0; i < len && src[i] != 0; i++) {
+    for(; i < len && src[i] != 0; i++) {
 
         /* Get decimal representation */
         val = GetBase64Value(src[i]);
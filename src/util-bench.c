@@ -0,0 +1,846 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Micro benchmark framework
+ *
+ * Each benchmark is run with a growing op count until it takes at least
+ * benchmark.min-time ms. Results are written as one JSON object per
+ * line to stdout or to benchmark.output, so they can be compared across
+ * builds and machines.
+ *
+ * The payload corpora are generated so runs are reproducible. Real data
+ * can be used instead: benchmark.patterns takes a file with one pattern
+ * per line (|hex| notation allowed), e.g. the fast patterns from
+ * --engine-analysis, benchmark.pcap an ethernet pcap for the decoders.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-bench.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+
+#ifdef BENCHMARKS
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+
+#define MAX_SUBSTRINGS 30
+
+/** default time a benchmark needs to run, in ms */
+#define BENCH_DEFAULT_MIN_TIME  500
+/** max ops per run */
+#define BENCH_MAX_N             1000000000ULL
+
+/** buffers per generated corpus */
+#define BENCH_CORPUS_CNT        256
+/** generated patterns if no pattern file is used */
+#define BENCH_PATTERNS_CNT      2000
+
+typedef struct BenchEntry_ {
+    char *name;
+    BenchFunc Func;
+    const void *data;
+    struct BenchEntry_ *next;
+} BenchEntry;
+
+static BenchEntry *bench_list = NULL;
+static int bench_perf_fd = -1;
+static uint64_t bench_min_ns = BENCH_DEFAULT_MIN_TIME * 1000000ULL;
+
+static BenchCorpus *bench_http = NULL;
+static BenchCorpus *bench_dns = NULL;
+static BenchCorpus *bench_tls = NULL;
+static BenchCorpus *bench_frames = NULL;
+static BenchCorpus *bench_patterns = NULL;
+
+/**
+ * \brief Register a benchmark
+ *
+ * \param name name, copied. Use a module/variant/corpus form so the
+ *             regex can select groups, e.g. "mpm/ac/http"
+ * \param data passed to the function in BenchCtx::data
+ */
+void BenchRegister(const char *name, BenchFunc Func, const void *data)
+{
+    BenchEntry *e = SCMalloc(sizeof(*e));
+    if (unlikely(e == NULL))
+        return;
+    e->name = SCStrdup(name);
+    if (unlikely(e->name == NULL)) {
+        SCFree(e);
+        return;
+    }
+    e->Func = Func;
+    e->data = data;
+    e->next = NULL;
+
+    /* keep the registration order */
+    if (bench_list == NULL) {
+        bench_list = e;
+    } else {
+        BenchEntry *t = bench_list;
+        while (t->next != NULL)
+            t = t->next;
+        t->next = e;
+    }
+}
+
+void BenchTimerStart(BenchCtx *b)
+{
+    if (b->running)
+        return;
+    b->running = 1;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (b->perf_fd >= 0) {
+        ioctl(b->perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(b->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &b->ts);
+    b->ticks_start = UtilCpuGetTicks();
+}
+
+void BenchTimerStop(BenchCtx *b)
+{
+    if (!b->running)
+        return;
+
+    uint64_t ticks = UtilCpuGetTicks();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (b->perf_fd >= 0) {
+        uint64_t v = 0;
+        ioctl(b->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(b->perf_fd, &v, sizeof(v)) == sizeof(v))
+            b->cache_misses += v;
+    }
+#endif
+    b->running = 0;
+    b->ticks += ticks - b->ticks_start;
+    b->ns += (uint64_t)(ts.tv_sec - b->ts.tv_sec) * 1000000000ULL +
+        (ts.tv_nsec - b->ts.tv_nsec);
+}
+
+/** \internal
+ *  \brief open a cache miss counter for this thread
+ *
+ *  Fails if perf_event_paranoid doesn't allow it, in which case the
+ *  misses are reported as null. */
+static int BenchPerfOpen(void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        SCLogInfo("cache miss counter not available: %s", strerror(errno));
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+static pcre *BenchRegex(const char *regex_arg, pcre_extra **study)
+{
+    const char *eb;
+    int eo;
+
+    if (regex_arg == NULL)
+        regex_arg = ".*";
+
+    pcre *re = pcre_compile(regex_arg, 0, &eb, &eo, NULL);
+    if (re == NULL) {
+        SCLogError(SC_ERR_PCRE_COMPILE, "pcre compile of \"%s\" failed at "
+                "offset %d: %s", regex_arg, eo, eb);
+        return NULL;
+    }
+    *study = pcre_study(re, 0, &eb);
+    return re;
+}
+
+static int BenchMatch(pcre *re, pcre_extra *study, const char *name)
+{
+    int ov[MAX_SUBSTRINGS];
+    return (pcre_exec(re, study, name, strlen(name), 0, 0, ov, MAX_SUBSTRINGS) >= 1);
+}
+
+/** \brief List all registered benchmarks matching the regex */
+void BenchList(const char *regex_arg)
+{
+    pcre_extra *study = NULL;
+    pcre *re = BenchRegex(regex_arg, &study);
+    if (re == NULL)
+        return;
+
+    BenchEntry *e;
+    for (e = bench_list; e != NULL; e = e->next) {
+        if (BenchMatch(re, study, e->name))
+            printf("%s\n", e->name);
+    }
+    pcre_free(re);
+    if (study != NULL)
+        pcre_free(study);
+}
+
+static void BenchReport(FILE *out, const BenchEntry *e, const BenchCtx *b)
+{
+    double n = (double)b->n;
+
+    fprintf(out, "{\"name\":\"%s\",\"iterations\":%"PRIu64","
+            "\"ns_per_op\":%.3f,\"cycles_per_op\":%.3f",
+            e->name, b->n, b->ns / n, b->ticks / n);
+    if (b->bytes > 0) {
+        fprintf(out, ",\"bytes_per_op\":%"PRIu64",\"bytes_per_cycle\":%.4f,"
+                "\"mb_per_sec\":%.1f", b->bytes,
+                b->ticks ? (b->bytes * n) / b->ticks : 0.0,
+                b->ns ? (b->bytes * n * 1000.0) / b->ns : 0.0);
+    }
+    if (b->perf_fd >= 0)
+        fprintf(out, ",\"cache_misses_per_op\":%.4f", b->cache_misses / n);
+    else
+        fprintf(out, ",\"cache_misses_per_op\":null");
+    fprintf(out, "}\n");
+    fflush(out);
+}
+
+/** \internal
+ *  \brief run a benchmark until it takes at least the min time
+ *
+ *  \retval 1 ok
+ *  \retval 0 failed */
+static int BenchRunOne(const BenchEntry *e, FILE *out)
+{
+    uint64_t n = 1;
+    BenchCtx b;
+
+    for (;;) {
+        memset(&b, 0, sizeof(b));
+        b.n = n;
+        b.data = e->data;
+        b.perf_fd = bench_perf_fd;
+
+        if (e->Func(&b) != 1) {
+            fprintf(out, "{\"name\":\"%s\",\"failed\":true}\n", e->name);
+            return 0;
+        }
+        BenchTimerStop(&b);
+
+        if (b.ns >= bench_min_ns || n >= BENCH_MAX_N)
+            break;
+
+        /* aim a bit past the min time so the next run is the last */
+        uint64_t next = b.ns ? n * bench_min_ns / b.ns + n / 5 : n * 100;
+        if (next > n * 100)
+            next = n * 100;
+        if (next <= n)
+            next = n + 1;
+        n = MIN(next, BENCH_MAX_N);
+    }
+
+    BenchReport(out, e, &b);
+    return 1;
+}
+
+/** \brief Run all registered benchmarks matching the regex
+ *
+ *  \retval failed number of benchmarks that failed */
+uint32_t BenchRun(const char *regex_arg)
+{
+    uint32_t failed = 0;
+    intmax_t min_time = 0;
+    pcre_extra *study = NULL;
+
+    pcre *re = BenchRegex(regex_arg, &study);
+    if (re == NULL)
+        return 1;
+
+    if (ConfGetInt("benchmark.min-time", &min_time) == 1 && min_time > 0)
+        bench_min_ns = (uint64_t)min_time * 1000000ULL;
+
+    FILE *out = stdout;
+    char *output = NULL;
+    if (ConfGet("benchmark.output", &output) == 1 && output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", output,
+                    strerror(errno));
+            pcre_free(re);
+            if (study != NULL)
+                pcre_free(study);
+            return 1;
+        }
+    }
+
+    bench_perf_fd = BenchPerfOpen();
+
+    BenchEntry *e;
+    for (e = bench_list; e != NULL; e = e->next) {
+        if (BenchMatch(re, study, e->name)) {
+            if (BenchRunOne(e, out) != 1)
+                failed++;
+        }
+    }
+
+    if (bench_perf_fd >= 0) {
+        close(bench_perf_fd);
+        bench_perf_fd = -1;
+    }
+    if (out != stdout)
+        fclose(out);
+    pcre_free(re);
+    if (study != NULL)
+        pcre_free(study);
+    return failed;
+}
+
+/** \brief simple LCG so the corpora are the same on every run */
+uint32_t BenchRandom(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 8);
+}
+
+static BenchCorpus *BenchCorpusAlloc(uint32_t cnt)
+{
+    BenchCorpus *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    c->bufs = SCCalloc(cnt, sizeof(BenchBuffer));
+    if (unlikely(c->bufs == NULL)) {
+        SCFree(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void BenchCorpusFree(BenchCorpus *c)
+{
+    if (c == NULL)
+        return;
+    uint32_t i;
+    for (i = 0; i < c->cnt; i++)
+        SCFree(c->bufs[i].buf);
+    SCFree(c->bufs);
+    SCFree(c);
+}
+
+static int BenchCorpusAdd(BenchCorpus *c, const uint8_t *data, uint32_t len)
+{
+    uint8_t *buf = SCMalloc(len > 0 ? len : 1);
+    if (unlikely(buf == NULL))
+        return -1;
+    memcpy(buf, data, len);
+    c->bufs[c->cnt].buf = buf;
+    c->bufs[c->cnt].len = len;
+    c->cnt++;
+    c->size += len;
+    return 0;
+}
+
+static const char *bench_words[] = {
+    "index", "login", "admin", "images", "search", "api", "user", "static",
+    "content", "update", "download", "cgi-bin", "wp-content", "config",
+    "session", "gate", "panel", "upload", "news", "media", "data", "shop",
+};
+#define BENCH_WORDS (sizeof(bench_words) / sizeof(bench_words[0]))
+
+static const char *BenchWord(uint32_t *state)
+{
+    return bench_words[BenchRandom(state) % BENCH_WORDS];
+}
+
+/** \internal
+ *  \brief HTTP requests and responses with a html body */
+static BenchCorpus *BenchCorpusHttp(void)
+{
+    BenchCorpus *c = BenchCorpusAlloc(BENCH_CORPUS_CNT);
+    if (c == NULL)
+        return NULL;
+
+    uint32_t state = 1;
+    char buf[2048];
+    uint32_t i;
+    for (i = 0; i < BENCH_CORPUS_CNT; i++) {
+        int len;
+        if (i % 2 == 0) {
+            const char *d = BenchWord(&state);
+            len = snprintf(buf, sizeof(buf),
+                    "GET /%s/%s.php?id=%u&q=%s HTTP/1.1\r\n"
+                    "Host: www.%s%u.com\r\n"
+                    "User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64) "
+                    "AppleWebKit/537.36 (KHTML, like Gecko) Chrome/%u.0 "
+                    "Safari/537.36\r\n"
+                    "Accept: text/html,application/xhtml+xml,*/*;q=0.8\r\n"
+                    "Accept-Encoding: gzip, deflate\r\n"
+                    "Cookie: session=%08x%08x\r\n"
+                    "Connection: keep-alive\r\n\r\n",
+                    d, BenchWord(&state), BenchRandom(&state) % 100000,
+                    BenchWord(&state), d, BenchRandom(&state) % 1000,
+                    40 + BenchRandom(&state) % 20,
+                    BenchRandom(&state), BenchRandom(&state));
+        } else {
+            len = snprintf(buf, sizeof(buf),
+                    "HTTP/1.1 200 OK\r\nServer: nginx\r\n"
+                    "Content-Type: text/html; charset=utf-8\r\n"
+                    "Content-Length: 1200\r\n\r\n<html><body><p>");
+            while (len < 1400) {
+                len += snprintf(buf + len, sizeof(buf) - len, "%s %s ",
+                        BenchWord(&state), BenchWord(&state));
+            }
+        }
+        if (BenchCorpusAdd(c, (uint8_t *)buf, (uint32_t)len) < 0)
+            goto error;
+    }
+    return c;
+error:
+    BenchCorpusFree(c);
+    return NULL;
+}
+
+/** \internal
+ *  \brief DNS A queries and responses */
+static BenchCorpus *BenchCorpusDns(void)
+{
+    BenchCorpus *c = BenchCorpusAlloc(BENCH_CORPUS_CNT);
+    if (c == NULL)
+        return NULL;
+
+    uint32_t state = 2;
+    uint8_t buf[512];
+    uint32_t i;
+    for (i = 0; i < BENCH_CORPUS_CNT; i++) {
+        int response = (i % 2);
+        uint32_t len = 0;
+
+        uint16_t id = (uint16_t)BenchRandom(&state);
+        buf[len++] = id >> 8;
+        buf[len++] = id & 0xff;
+        buf[len++] = response ? 0x81 : 0x01;
+        buf[len++] = response ? 0x80 : 0x00;
+        static const uint8_t counts[2][8] = {
+            { 0, 1, 0, 0, 0, 0, 0, 0 }, { 0, 1, 0, 1, 0, 0, 0, 0 },
+        };
+        memcpy(buf + len, counts[response], 8);
+        len += 8;
+
+        /* www.<word><n>.com */
+        char label[64];
+        int l = snprintf(label, sizeof(label), "%s%u", BenchWord(&state),
+                BenchRandom(&state) % 1000);
+        buf[len++] = 3;
+        memcpy(buf + len, "www", 3);
+        len += 3;
+        buf[len++] = (uint8_t)l;
+        memcpy(buf + len, label, l);
+        len += l;
+        buf[len++] = 3;
+        memcpy(buf + len, "com", 3);
+        len += 3;
+        buf[len++] = 0;
+        static const uint8_t type_class[4] = { 0x00, 0x01, 0x00, 0x01 };
+        memcpy(buf + len, type_class, 4);
+        len += 4;
+
+        if (response) {
+            static const uint8_t answer[12] = {
+                0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+                0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+            };
+            memcpy(buf + len, answer, sizeof(answer));
+            len += sizeof(answer);
+            uint32_t ip = BenchRandom(&state);
+            memcpy(buf + len, &ip, 4);
+            len += 4;
+        }
+        if (BenchCorpusAdd(c, buf, len) < 0)
+            goto error;
+    }
+    return c;
+error:
+    BenchCorpusFree(c);
+    return NULL;
+}
+
+/** \internal
+ *  \brief TLS client hellos with SNI and application data records */
+static BenchCorpus *BenchCorpusTls(void)
+{
+    BenchCorpus *c = BenchCorpusAlloc(BENCH_CORPUS_CNT);
+    if (c == NULL)
+        return NULL;
+
+    uint32_t state = 3;
+    uint8_t buf[1500];
+    uint32_t i, j;
+    for (i = 0; i < BENCH_CORPUS_CNT; i++) {
+        uint32_t len = 0;
+        if (i % 2 == 0) {
+            char host[64];
+            int hl = snprintf(host, sizeof(host), "%s.%s%u.com",
+                    BenchWord(&state), BenchWord(&state),
+                    BenchRandom(&state) % 1000);
+
+            /* record and handshake headers, lengths are set below */
+            static const uint8_t hdr[11] = {
+                0x16, 0x03, 0x01, 0x00, 0x00,
+                0x01, 0x00, 0x00, 0x00, 0x03, 0x03,
+            };
+            memcpy(buf, hdr, sizeof(hdr));
+            len = sizeof(hdr);
+            for (j = 0; j < 32; j++)
+                buf[len++] = (uint8_t)BenchRandom(&state);
+            buf[len++] = 0; /* session id */
+            buf[len++] = 0;
+            buf[len++] = 32;
+            for (j = 0; j < 16; j++) {
+                buf[len++] = 0xc0;
+                buf[len++] = (uint8_t)(0x09 + j);
+            }
+            buf[len++] = 1; /* compression */
+            buf[len++] = 0;
+            uint16_t ext_len = 9 + hl;
+            buf[len++] = ext_len >> 8;
+            buf[len++] = ext_len & 0xff;
+            buf[len++] = 0; /* server_name */
+            buf[len++] = 0;
+            buf[len++] = (5 + hl) >> 8;
+            buf[len++] = (5 + hl) & 0xff;
+            buf[len++] = (3 + hl) >> 8;
+            buf[len++] = (3 + hl) & 0xff;
+            buf[len++] = 0;
+            buf[len++] = hl >> 8;
+            buf[len++] = hl & 0xff;
+            memcpy(buf + len, host, hl);
+            len += hl;
+
+            buf[3] = (len - 5) >> 8;
+            buf[4] = (len - 5) & 0xff;
+            buf[7] = (len - 9) >> 8;
+            buf[8] = (len - 9) & 0xff;
+        } else {
+            static const uint8_t hdr[5] = { 0x17, 0x03, 0x03, 0x05, 0x78 };
+            memcpy(buf, hdr, sizeof(hdr));
+            len = sizeof(hdr);
+            while (len < 1400 + sizeof(hdr))
+                buf[len++] = (uint8_t)BenchRandom(&state);
+        }
+        if (BenchCorpusAdd(c, buf, len) < 0)
+            goto error;
+    }
+    return c;
+error:
+    BenchCorpusFree(c);
+    return NULL;
+}
+
+/** \internal
+ *  \brief ethernet frames from benchmark.pcap, or ethernet+ipv4+tcp
+ *         frames carrying the http corpus */
+static BenchCorpus *BenchCorpusFrames(void)
+{
+    char *file = NULL;
+    BenchCorpus *c = NULL;
+
+    if (ConfGet("benchmark.pcap", &file) == 1 && file != NULL) {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        pcap_t *pcap = pcap_open_offline(file, errbuf);
+        if (pcap == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file, errbuf);
+            return NULL;
+        }
+        if (pcap_datalink(pcap) != DLT_EN10MB) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is not an ethernet pcap", file);
+            pcap_close(pcap);
+            return NULL;
+        }
+
+        uint32_t size = 1024;
+        c = BenchCorpusAlloc(size);
+        if (c == NULL) {
+            pcap_close(pcap);
+            return NULL;
+        }
+        struct pcap_pkthdr *h;
+        const u_char *data;
+        while (pcap_next_ex(pcap, &h, &data) == 1) {
+            if (c->cnt == size) {
+                BenchBuffer *bufs = SCRealloc(c->bufs, size * 2 * sizeof(BenchBuffer));
+                if (bufs == NULL)
+                    break;
+                c->bufs = bufs;
+                size *= 2;
+            }
+            if (BenchCorpusAdd(c, data, h->caplen) < 0)
+                break;
+        }
+        pcap_close(pcap);
+        SCLogInfo("loaded %u frames from %s", c->cnt, file);
+        return c;
+    }
+
+    const BenchCorpus *http = BenchCorpusGet("http");
+    if (http == NULL)
+        return NULL;
+    c = BenchCorpusAlloc(http->cnt);
+    if (c == NULL)
+        return NULL;
+
+    uint32_t state = 4;
+    uint8_t buf[1600];
+    uint32_t i;
+    for (i = 0; i < http->cnt; i++) {
+        uint32_t len = BenchBuildFrame(buf, sizeof(buf), IPPROTO_TCP,
+                BenchRandom(&state), BenchRandom(&state),
+                (uint16_t)(1024 + BenchRandom(&state) % 60000), 80,
+                http->bufs[i].buf, http->bufs[i].len);
+        if (len == 0 || BenchCorpusAdd(c, buf, len) < 0) {
+            BenchCorpusFree(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+/**
+ * \brief Build an ethernet+ipv4+tcp or udp frame
+ *
+ * Checksums are left 0, the decoders don't validate them.
+ *
+ * \retval len frame length or 0 if it doesn't fit
+ */
+uint32_t BenchBuildFrame(uint8_t *buf, uint32_t size, uint8_t proto,
+        uint32_t src, uint32_t dst, uint16_t sp, uint16_t dp,
+        const uint8_t *payload, uint32_t plen)
+{
+    uint32_t l4len = (proto == IPPROTO_TCP) ? 20 : 8;
+    if (plen > 1460)
+        plen = 1460;
+    uint32_t len = 14 + 20 + l4len + plen;
+    if (len > size)
+        return 0;
+
+    memset(buf, 0, 14 + 20 + l4len);
+    static const uint8_t eth[14] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+        0x77, 0x88, 0x99, 0xaa, 0x08, 0x00,
+    };
+    memcpy(buf, eth, sizeof(eth));
+
+    uint8_t *ip = buf + 14;
+    uint16_t iplen = htons((uint16_t)(20 + l4len + plen));
+    ip[0] = 0x45;
+    memcpy(ip + 2, &iplen, 2);
+    ip[8] = 64;
+    ip[9] = proto;
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+
+    uint8_t *l4 = ip + 20;
+    uint16_t nsp = htons(sp), ndp = htons(dp);
+    memcpy(l4, &nsp, 2);
+    memcpy(l4 + 2, &ndp, 2);
+    if (proto == IPPROTO_TCP) {
+        l4[12] = 0x50;
+        l4[13] = 0x18; /* PSH|ACK */
+        l4[14] = 0xff;
+        l4[15] = 0xff;
+    } else {
+        uint16_t ulen = htons((uint16_t)(8 + plen));
+        memcpy(l4 + 4, &ulen, 2);
+    }
+
+    memcpy(l4 + l4len, payload, plen);
+    return len;
+}
+
+/** \internal
+ *  \brief decode a pattern line, |xx xx| parts are hex as in rules */
+static uint32_t BenchPatternDecode(const char *line, uint8_t *out, uint32_t size)
+{
+    uint32_t len = 0;
+    int hex = 0;
+    int nibble = -1;
+
+    for (; *line != '\0' && *line != '\n' && *line != '\r'; line++) {
+        if (*line == '|') {
+            hex = !hex;
+            nibble = -1;
+            continue;
+        }
+        if (len == size)
+            break;
+        if (!hex) {
+            out[len++] = (uint8_t)*line;
+            continue;
+        }
+        if (!isxdigit((unsigned char)*line))
+            continue;
+        int v = isdigit((unsigned char)*line) ? *line - '0' :
+            (tolower((unsigned char)*line) - 'a' + 10);
+        if (nibble < 0) {
+            nibble = v;
+        } else {
+            out[len++] = (uint8_t)(nibble << 4 | v);
+            nibble = -1;
+        }
+    }
+    return len;
+}
+
+/** \internal
+ *  \brief patterns from benchmark.patterns, or a generated set of
+ *         common tokens and random strings of 2 to 16 bytes */
+static BenchCorpus *BenchCorpusPatterns(void)
+{
+    char *file = NULL;
+    uint8_t buf[256];
+    BenchCorpus *c = NULL;
+
+    if (ConfGet("benchmark.patterns", &file) == 1 && file != NULL) {
+        FILE *fp = fopen(file, "r");
+        if (fp == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", file,
+                    strerror(errno));
+            return NULL;
+        }
+        uint32_t size = 1024;
+        c = BenchCorpusAlloc(size);
+        if (c == NULL) {
+            fclose(fp);
+            return NULL;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            uint32_t len = BenchPatternDecode(line, buf, sizeof(buf));
+            if (len == 0)
+                continue;
+            if (c->cnt == size) {
+                BenchBuffer *bufs = SCRealloc(c->bufs, size * 2 * sizeof(BenchBuffer));
+                if (bufs == NULL)
+                    break;
+                c->bufs = bufs;
+                size *= 2;
+            }
+            if (BenchCorpusAdd(c, buf, len) < 0)
+                break;
+        }
+        fclose(fp);
+        SCLogInfo("loaded %u patterns from %s", c->cnt, file);
+        return c;
+    }
+
+    c = BenchCorpusAlloc(BENCH_PATTERNS_CNT);
+    if (c == NULL)
+        return NULL;
+
+    static const char *tokens[] = {
+        "User-Agent|3a 20|", "POST", ".php?", "/wp-admin/", "cmd.exe",
+        "|00 00 00 00|", "Content-Type|3a| application/octet-stream",
+        "eval(", "<script", "/etc/passwd", "|16 03 01|", "|01 00 01 00 00|",
+        "MZ", "This program cannot be run in DOS mode", "base64", "union select",
+    };
+    uint32_t state = 5;
+    uint32_t i;
+    for (i = 0; i < BENCH_PATTERNS_CNT; i++) {
+        uint32_t len;
+        if (i < sizeof(tokens) / sizeof(tokens[0])) {
+            len = BenchPatternDecode(tokens[i], buf, sizeof(buf));
+        } else {
+            len = 2 + BenchRandom(&state) % 15;
+            uint32_t j;
+            for (j = 0; j < len; j++)
+                buf[j] = 'a' + BenchRandom(&state) % 26;
+        }
+        if (BenchCorpusAdd(c, buf, len) < 0) {
+            BenchCorpusFree(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+/**
+ * \brief Get a corpus by name: http, dns, tls or frames
+ *
+ * Corpora are built on first use and kept until BenchCleanup().
+ */
+const BenchCorpus *BenchCorpusGet(const char *name)
+{
+    if (strcmp(name, "http") == 0) {
+        if (bench_http == NULL)
+            bench_http = BenchCorpusHttp();
+        return bench_http;
+    } else if (strcmp(name, "dns") == 0) {
+        if (bench_dns == NULL)
+            bench_dns = BenchCorpusDns();
+        return bench_dns;
+    } else if (strcmp(name, "tls") == 0) {
+        if (bench_tls == NULL)
+            bench_tls = BenchCorpusTls();
+        return bench_tls;
+    } else if (strcmp(name, "frames") == 0) {
+        if (bench_frames == NULL)
+            bench_frames = BenchCorpusFrames();
+        return bench_frames;
+    }
+    return NULL;
+}
+
+/** \brief Get the pattern set, one buffer per pattern */
+const BenchCorpus *BenchPatternsGet(void)
+{
+    if (bench_patterns == NULL)
+        bench_patterns = BenchCorpusPatterns();
+    return bench_patterns;
+}
+
+void BenchCleanup(void)
+{
+    BenchCorpusFree(bench_http);
+    BenchCorpusFree(bench_dns);
+    BenchCorpusFree(bench_tls);
+    BenchCorpusFree(bench_frames);
+    BenchCorpusFree(bench_patterns);
+    bench_http = bench_dns = bench_tls = bench_frames = bench_patterns = NULL;
+
+    BenchEntry *e = bench_list;
+    while (e != NULL) {
+        BenchEntry *next = e->next;
+        SCFree(e->name);
+        SCFree(e);
+        e = next;
+    }
+    bench_list = NULL;
+}
+
+#endif /* BENCHMARKS */
@@ -0,0 +1,81 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Micro benchmark framework
+ */
+
+#ifndef __UTIL_BENCH_H__
+#define __UTIL_BENCH_H__
+
+#ifdef BENCHMARKS
+
+/** state of a single run of a benchmark function */
+typedef struct BenchCtx_ {
+    uint64_t n;             /**< number of ops the function must run */
+    uint64_t bytes;         /**< bytes processed per op, 0 if n/a */
+    const void *data;       /**< data passed to BenchRegister() */
+
+    int running;
+    int perf_fd;            /**< cache miss counter or -1 */
+    struct timespec ts;
+    uint64_t ticks_start;
+
+    uint64_t ns;            /**< time spent between start and stop */
+    uint64_t ticks;
+    uint64_t cache_misses;
+} BenchCtx;
+
+/** a benchmark function runs b->n ops between BenchTimerStart() and
+ *  BenchTimerStop(), setup and cleanup go outside of the timer.
+ *
+ *  \retval 1 ok
+ *  \retval 0 setup failed, the benchmark is reported as failed */
+typedef int (*BenchFunc)(BenchCtx *b);
+
+typedef struct BenchBuffer_ {
+    uint8_t *buf;
+    uint32_t len;
+} BenchBuffer;
+
+/** a set of buffers a benchmark runs over */
+typedef struct BenchCorpus_ {
+    BenchBuffer *bufs;
+    uint32_t cnt;
+    uint64_t size;          /**< sum of the buffer lengths */
+} BenchCorpus;
+
+void BenchRegister(const char *name, BenchFunc Func, const void *data);
+void BenchList(const char *regex_arg);
+uint32_t BenchRun(const char *regex_arg);
+void BenchCleanup(void);
+
+void BenchTimerStart(BenchCtx *b);
+void BenchTimerStop(BenchCtx *b);
+
+const BenchCorpus *BenchCorpusGet(const char *name);
+const BenchCorpus *BenchPatternsGet(void);
+uint32_t BenchRandom(uint32_t *state);
+uint32_t BenchBuildFrame(uint8_t *buf, uint32_t size, uint8_t proto,
+        uint32_t src, uint32_t dst, uint16_t sp, uint16_t dp,
+        const uint8_t *payload, uint32_t plen);
+
+#endif /* BENCHMARKS */
+
+#endif /* __UTIL_BENCH_H__ */
@@ -0,0 +1,203 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Blocked bloom filter implementation. The first hash picks a block of
+ * one cache line, the second one the k bits within it.
+ */
+
+#include "suricata-common.h"
+#include "util-bloomfilter-blocked.h"
+#include "util-unittest.h"
+
+/** max bits set per key */
+#define BLOOMBLOCKED_MAX_K  16
+
+/** \internal
+ *  \brief log2 in 1/8 steps, good enough for sizing */
+static uint32_t BloomFilterBlockedLog2x8(uint32_t n)
+{
+    uint32_t l = 0;
+    while ((n >> (l + 1)) != 0)
+        l++;
+    /* linear interpolation of the fraction */
+    uint32_t base = 1U << l;
+    return l * 8 + (uint32_t)(((uint64_t)(n - base) * 8) / base);
+}
+
+/**
+ * \brief Create a filter sized for a number of entries
+ *
+ * An optimal filter needs 1.44 * log2(1/p) bits per entry with log2(1/p)
+ * bits set per key. Blocking all bits of a key in a cache line raises the
+ * false positive rate a bit, so one extra bit per entry is used.
+ *
+ * \param entries number of keys that will be added
+ * \param fp_one_in target false positive rate as 1 in fp_one_in tests
+ *
+ * \retval bf filter or NULL
+ */
+BloomFilterBlocked *BloomFilterBlockedInit(uint32_t entries, uint32_t fp_one_in)
+{
+    if (entries == 0 || fp_one_in < 2)
+        return NULL;
+
+    BloomFilterBlocked *bf = SCMalloc(sizeof(BloomFilterBlocked));
+    if (unlikely(bf == NULL))
+        return NULL;
+    memset(bf, 0, sizeof(BloomFilterBlocked));
+
+    uint32_t log2x8 = BloomFilterBlockedLog2x8(fp_one_in);
+    uint32_t k = (log2x8 + 4) / 8;
+    if (k < 1)
+        k = 1;
+    else if (k > BLOOMBLOCKED_MAX_K)
+        k = BLOOMBLOCKED_MAX_K;
+    bf->k = (uint8_t)k;
+
+    /* 1.44 ~= 23/16 */
+    uint64_t bits = ((uint64_t)entries * log2x8 * 23) / (16 * 8) + entries;
+    uint64_t nblocks = (bits + BLOOMBLOCKED_BLOCK_BITS - 1) / BLOOMBLOCKED_BLOCK_BITS;
+    if (nblocks > UINT32_MAX / BLOOMBLOCKED_BLOCK_WORDS) {
+        SCFree(bf);
+        return NULL;
+    }
+    bf->nblocks = (uint32_t)nblocks;
+
+    size_t size = (size_t)bf->nblocks * BLOOMBLOCKED_BLOCK_WORDS * sizeof(uint64_t);
+    bf->blocks = SCMallocAligned(size, CLS);
+    if (bf->blocks == NULL) {
+        SCFree(bf);
+        return NULL;
+    }
+    memset(bf->blocks, 0, size);
+    return bf;
+}
+
+void BloomFilterBlockedFree(BloomFilterBlocked *bf)
+{
+    if (bf != NULL) {
+        if (bf->blocks != NULL)
+            SCFreeAligned(bf->blocks);
+        SCFree(bf);
+    }
+}
+
+/**
+ * \brief Add a key
+ *
+ * \param key key as 32 bit words
+ * \param len key length in words
+ * \param seed hashed with the key, BloomFilterBlockedTest() needs the same
+ */
+void BloomFilterBlockedAdd(BloomFilterBlocked *bf, const uint32_t *key,
+        uint16_t len, uint32_t seed)
+{
+    uint32_t h1 = seed, h2 = 0;
+    hashword2(key, len, &h1, &h2);
+
+    uint64_t *block = bf->blocks +
+        (((uint64_t)h1 * bf->nblocks) >> 32) * BLOOMBLOCKED_BLOCK_WORDS;
+    const uint32_t delta = (h2 >> 17) | (h2 << 15) | 1;
+    uint8_t i;
+    for (i = 0; i < bf->k; i++) {
+        uint32_t bit = h2 % BLOOMBLOCKED_BLOCK_BITS;
+        block[bit / 64] |= (1ULL << (bit % 64));
+        h2 += delta;
+    }
+}
+
+uint32_t BloomFilterBlockedMemorySize(const BloomFilterBlocked *bf)
+{
+    if (bf == NULL)
+        return 0;
+
+    return (sizeof(BloomFilterBlocked) +
+            bf->nblocks * BLOOMBLOCKED_BLOCK_WORDS * sizeof(uint64_t));
+}
+
+/*
+ * ONLY TESTS BELOW THIS COMMENT
+ */
+
+#ifdef UNITTESTS
+static int BloomFilterBlockedTestInit01(void)
+{
+    BloomFilterBlocked *bf = BloomFilterBlockedInit(1000, 100);
+    if (bf == NULL)
+        return 0;
+
+    /* log2(100) ~ 6.6 bits per key, ~10.5 bits per entry */
+    int result = (bf->k == 7 && bf->nblocks >= 20 && bf->nblocks <= 22);
+
+    BloomFilterBlockedFree(bf);
+    return result;
+}
+
+static int BloomFilterBlockedTestInit02(void)
+{
+    if (BloomFilterBlockedInit(0, 100) != NULL)
+        return 0;
+    if (BloomFilterBlockedInit(100, 1) != NULL)
+        return 0;
+    return 1;
+}
+
+/** \test no false negatives and a false positive rate near the target */
+static int BloomFilterBlockedTestAddTest01(void)
+{
+    int result = 0;
+    uint32_t i, fp = 0;
+    BloomFilterBlocked *bf = BloomFilterBlockedInit(10000, 100);
+    if (bf == NULL)
+        return 0;
+
+    for (i = 0; i < 10000; i++) {
+        uint32_t key = i * 2654435761U;
+        BloomFilterBlockedAdd(bf, &key, 1, 32);
+    }
+    for (i = 0; i < 10000; i++) {
+        uint32_t key = i * 2654435761U;
+        if (!BloomFilterBlockedTest(bf, &key, 1, 32))
+            goto end;
+    }
+    /* same keys with another seed are different keys */
+    for (i = 0; i < 100000; i++) {
+        uint32_t key = i * 2654435761U;
+        if (BloomFilterBlockedTest(bf, &key, 1, 24))
+            fp++;
+    }
+    if (fp > 2000)
+        goto end;
+
+    result = 1;
+end:
+    BloomFilterBlockedFree(bf);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void BloomFilterBlockedRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("BloomFilterBlockedTestInit01", BloomFilterBlockedTestInit01);
+    UtRegisterTest("BloomFilterBlockedTestInit02", BloomFilterBlockedTestInit02);
+    UtRegisterTest("BloomFilterBlockedTestAddTest01", BloomFilterBlockedTestAddTest01);
+#endif /* UNITTESTS */
+}
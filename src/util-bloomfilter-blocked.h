@@ -0,0 +1,78 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Blocked bloom filter: all bits of a key are in a single cache line,
+ * so a test costs at most one cache miss.
+ */
+
+#ifndef __BLOOMFILTERBLOCKED_H__
+#define __BLOOMFILTERBLOCKED_H__
+
+#include "util-hash-lookup3.h"
+
+/** bits per block, one cache line */
+#define BLOOMBLOCKED_BLOCK_BITS     512
+#define BLOOMBLOCKED_BLOCK_WORDS    (BLOOMBLOCKED_BLOCK_BITS / 64)
+
+typedef struct BloomFilterBlocked_ {
+    uint64_t *blocks;
+    uint32_t nblocks;
+    uint8_t k;          /**< bits set per key */
+} BloomFilterBlocked;
+
+BloomFilterBlocked *BloomFilterBlockedInit(uint32_t entries, uint32_t fp_one_in);
+void BloomFilterBlockedFree(BloomFilterBlocked *);
+void BloomFilterBlockedAdd(BloomFilterBlocked *, const uint32_t *, uint16_t, uint32_t);
+uint32_t BloomFilterBlockedMemorySize(const BloomFilterBlocked *);
+
+void BloomFilterBlockedRegisterTests(void);
+
+/** ----- Inline functions ---- */
+
+/**
+ * \brief Test if a key may have been added
+ *
+ * \param key key as 32 bit words
+ * \param len key length in words
+ * \param seed hashed with the key, must match the one used on add
+ *
+ * \retval 0 key was not added
+ * \retval 1 key was added, or a false positive
+ */
+static inline int BloomFilterBlockedTest(const BloomFilterBlocked *bf,
+        const uint32_t *key, uint16_t len, uint32_t seed)
+{
+    uint32_t h1 = seed, h2 = 0;
+    hashword2(key, len, &h1, &h2);
+
+    const uint64_t *block = bf->blocks +
+        (((uint64_t)h1 * bf->nblocks) >> 32) * BLOOMBLOCKED_BLOCK_WORDS;
+    const uint32_t delta = (h2 >> 17) | (h2 << 15) | 1;
+    uint8_t i;
+    for (i = 0; i < bf->k; i++) {
+        uint32_t bit = h2 % BLOOMBLOCKED_BLOCK_BITS;
+        if (!(block[bit / 64] & (1ULL << (bit % 64))))
+            return 0;
+        h2 += delta;
+    }
+    return 1;
+}
+
+#endif /* __BLOOMFILTERBLOCKED_H__ */
@@ -25,6 +25,7 @@
 #include "suricata.h"
 #include "util-debug.h"
 #include "util-buffer.h"
+#include "util-mem-tag.h"
 
 /* 10 mb */
 #define MAX_LIMIT 10485760
@@ -39,7 +40,7 @@ MemBuffer *MemBufferCreateNew(uint32_t size)
 
     uint32_t total_size = size + sizeof(MemBuffer);
 
-    MemBuffer *buffer = SCMalloc(total_size);
+    MemBuffer *buffer = SCMallocTag(MEM_TAG_OUTPUT, total_size);
     if (unlikely(buffer == NULL)) {
         return NULL;
     }
@@ -66,7 +67,7 @@ int MemBufferExpand(MemBuffer **buffer, uint32_t expand_by) {
 
     uint32_t total_size = (*buffer)->size + sizeof(MemBuffer) + expand_by;
 
-    MemBuffer *tbuffer = SCRealloc(*buffer, total_size);
+    MemBuffer *tbuffer = SCReallocTag(MEM_TAG_OUTPUT, *buffer, total_size);
     if (unlikely(tbuffer == NULL)) {
         return -1;
     }
@@ -81,7 +82,7 @@ int MemBufferExpand(MemBuffer **buffer, uint32_t expand_by) {
 
 void MemBufferFree(MemBuffer *buffer)
 {
-    SCFree(buffer);
+    SCFreeTag(MEM_TAG_OUTPUT, buffer);
 
     return;
 }
@@ -71,6 +71,38 @@ char *BytesToString(const uint8_t *bytes, size_t nbytes)
     return string;
 }
 
+/**
+ *  \brief pick the ByteDecode() decoder for a keyword
+ *
+ *  \param string 1 for string data in base
+ *  \param nbytes bytes the keyword extracts
+ */
+uint8_t ByteDecodeSelect(int string, int base, uint16_t nbytes)
+{
+    if (string) {
+        if (nbytes == 0 || nbytes > BYTE_DECODE_STR_MAX)
+            return BYTE_DECODE_STR;
+        if (base == 10)
+            return BYTE_DECODE_STR_DEC;
+        if (base == 16)
+            return BYTE_DECODE_STR_HEX;
+        return BYTE_DECODE_STR;
+    }
+
+    switch (nbytes) {
+        case 1:
+            return BYTE_DECODE_NUM1;
+        case 2:
+            return BYTE_DECODE_NUM2;
+        case 4:
+            return BYTE_DECODE_NUM4;
+        case 8:
+            return BYTE_DECODE_NUM8;
+        default:
+            return BYTE_DECODE_NUM;
+    }
+}
+
 int ByteExtractUint64(uint64_t *res, int e, uint16_t len, const uint8_t *bytes)
 {
     uint64_t i64;
@@ -602,6 +634,47 @@ static int ByteTest16 (void)
 
     return 0;
 }
+
+/** \test the selected decoders agree with the generic extraction */
+static int ByteTest17 (void)
+{
+    const uint8_t bytes[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xf8 };
+    static const char *strs[] = { "1234", "0077x", "ffEe12", "0x1f", " 12",
+        "-5", "abc", "9999999999", "12345678901", "z" };
+    uint64_t a, b;
+    int ra, rb;
+    uint16_t len;
+    int e;
+
+    for (len = 1; len <= 8; len++) {
+        for (e = BYTE_BIG_ENDIAN; e <= BYTE_LITTLE_ENDIAN; e++) {
+            uint8_t decoder = ByteDecodeSelect(0, 0, len);
+            ra = ByteDecode(decoder, e, 0, len, bytes, &a);
+            rb = ByteExtractUint64(&b, e, len, bytes);
+            FAIL_IF(ra != rb || a != b);
+        }
+    }
+
+    int bases[] = { 8, 10, 16 };
+    size_t s, t;
+    for (s = 0; s < sizeof(strs) / sizeof(strs[0]); s++) {
+        for (t = 0; t < 3; t++) {
+            len = strlen(strs[s]);
+            uint8_t decoder = ByteDecodeSelect(1, bases[t], len);
+            a = b = 0;
+            ra = ByteDecode(decoder, BYTE_BIG_ENDIAN, bases[t], len,
+                    (const uint8_t *)strs[s], &a);
+            rb = ByteExtractStringUint64(&b, bases[t], len, strs[s]);
+            FAIL_IF(ra != rb);
+            FAIL_IF(rb > 0 && a != b);
+        }
+    }
+
+    FAIL_IF(ByteDecodeSelect(1, 10, 4) != BYTE_DECODE_STR_DEC);
+    FAIL_IF(ByteDecodeSelect(1, 16, 11) != BYTE_DECODE_STR);
+    FAIL_IF(ByteDecodeSelect(0, 0, 3) != BYTE_DECODE_NUM);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void ByteRegisterTests(void)
@@ -623,6 +696,7 @@ void ByteRegisterTests(void)
     UtRegisterTest("ByteTest14", ByteTest14);
     UtRegisterTest("ByteTest15", ByteTest15);
     UtRegisterTest("ByteTest16", ByteTest16);
+    UtRegisterTest("ByteTest17", ByteTest17);
 #endif /* UNITTESTS */
 }
 
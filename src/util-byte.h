@@ -287,6 +287,117 @@ static inline int ByteExtract(uint64_t *res, int e, uint16_t len, const uint8_t
     return len;
 }
 
+/** decoders for byte_test, byte_jump and byte_extract, picked by
+ *  ByteDecodeSelect() when the keyword is parsed */
+#define BYTE_DECODE_NUM         0   /**< ByteExtract() */
+#define BYTE_DECODE_NUM1        1
+#define BYTE_DECODE_NUM2        2
+#define BYTE_DECODE_NUM4        3
+#define BYTE_DECODE_NUM8        4
+#define BYTE_DECODE_STR         5   /**< ByteExtractString() */
+#define BYTE_DECODE_STR_DEC     6
+#define BYTE_DECODE_STR_HEX     7
+
+/** longest string the dec and hex decoders handle, more digits can
+ *  overflow and go through strtoull() */
+#define BYTE_DECODE_STR_MAX     10
+
+uint8_t ByteDecodeSelect(int string, int base, uint16_t nbytes);
+
+static inline uint64_t ByteDecodeNum(const uint8_t *bytes, uint16_t len, int e)
+{
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (len) {
+        case 2:
+            memcpy(&u16, bytes, sizeof(u16));
+#if __BYTE_ORDER == __BIG_ENDIAN
+            return (e == BYTE_LITTLE_ENDIAN) ? SCByteSwap16(u16) : u16;
+#else
+            return (e == BYTE_LITTLE_ENDIAN) ? u16 : SCByteSwap16(u16);
+#endif
+        case 4:
+            memcpy(&u32, bytes, sizeof(u32));
+#if __BYTE_ORDER == __BIG_ENDIAN
+            return (e == BYTE_LITTLE_ENDIAN) ? SCByteSwap32(u32) : u32;
+#else
+            return (e == BYTE_LITTLE_ENDIAN) ? u32 : SCByteSwap32(u32);
+#endif
+        default:
+            memcpy(&u64, bytes, sizeof(u64));
+#if __BYTE_ORDER == __BIG_ENDIAN
+            return (e == BYTE_LITTLE_ENDIAN) ? SCByteSwap64(u64) : u64;
+#else
+            return (e == BYTE_LITTLE_ENDIAN) ? u64 : SCByteSwap64(u64);
+#endif
+    }
+}
+
+/**
+ *  \brief decode a number from a byte buffer
+ *
+ *  Same results as ByteExtractUint64() and ByteExtractStringUint64(),
+ *  but the common cases skip the copy and strtoull(). Strings with a
+ *  leading sign, whitespace or 0x prefix go the slow way.
+ *
+ *  \param decoder BYTE_DECODE_* from ByteDecodeSelect()
+ *  \param e BYTE_BIG_ENDIAN or BYTE_LITTLE_ENDIAN, for numeric data
+ *
+ *  \retval bytes used, <= 0 if there is no number
+ */
+static inline int ByteDecode(uint8_t decoder, int e, int base, uint16_t nbytes,
+        const uint8_t *bytes, uint64_t *res)
+{
+    uint64_t v = 0;
+    uint16_t i;
+
+    switch (decoder) {
+        case BYTE_DECODE_NUM1:
+            *res = bytes[0];
+            return 1;
+        case BYTE_DECODE_NUM2:
+        case BYTE_DECODE_NUM4:
+        case BYTE_DECODE_NUM8:
+            *res = ByteDecodeNum(bytes, nbytes, e);
+            return nbytes;
+        case BYTE_DECODE_STR_DEC:
+            for (i = 0; i < nbytes; i++) {
+                uint32_t d = (uint32_t)bytes[i] - '0';
+                if (d > 9)
+                    break;
+                v = v * 10 + d;
+            }
+            if (i == 0)
+                break;
+            *res = v;
+            return i;
+        case BYTE_DECODE_STR_HEX:
+            /* "0x" prefix */
+            if (nbytes > 1 && bytes[0] == '0' && (bytes[1] | 0x20) == 'x')
+                break;
+            for (i = 0; i < nbytes; i++) {
+                uint32_t d = (uint32_t)bytes[i] - '0';
+                if (d > 9) {
+                    d = ((uint32_t)bytes[i] | 0x20) - 'a';
+                    if (d > 5)
+                        break;
+                    d += 10;
+                }
+                v = (v << 4) | d;
+            }
+            if (i == 0)
+                break;
+            *res = v;
+            return i;
+        case BYTE_DECODE_STR:
+            break;
+        default:
+            return ByteExtractUint64(res, e, nbytes, bytes);
+    }
+    return ByteExtractStringUint64(res, base, nbytes, (const char *)bytes);
+}
 
 #endif /* __UTIL_BYTE_H__ */
 
@@ -0,0 +1,313 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Case folding, case insensitive compare and multi byte memchr, 16 (SSE2)
+ * or 32 (AVX2) bytes at a time. The bytes that don't fill a vector are
+ * done by the next smaller version. The AVX2 versions are built with a
+ * target attribute and picked at start up if the CPU supports them.
+ */
+
+#include "suricata-common.h"
+#include "util-bytes-simd.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define BYTES_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+static void BytesToLowerSelect(uint8_t *dst, const uint8_t *src, size_t len);
+static int BytesCmpNocaseSelect(const uint8_t *s1, const uint8_t *s2, size_t len);
+static const uint8_t *BytesFindAnySelect(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len);
+
+BytesToLowerFunc g_bytes_tolower = BytesToLowerSelect;
+BytesCmpNocaseFunc g_bytes_cmp_nocase = BytesCmpNocaseSelect;
+BytesFindAnyFunc g_bytes_find_any = BytesFindAnySelect;
+
+static void BytesToLowerGeneric(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        dst[i] = BytesFold(src[i]);
+}
+
+static int BytesCmpNocaseGeneric(const uint8_t *s1, const uint8_t *s2, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (BytesFold(s1[i]) != BytesFold(s2[i]))
+            return 1;
+    }
+    return 0;
+}
+
+static const uint8_t *BytesFindAnyGeneric(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len)
+{
+    size_t i;
+    uint8_t j;
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < set_len; j++) {
+            if (buf[i] == set[j])
+                return buf + i;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__SSE2__)
+/* the signed compares leave the bytes from 0x80 up alone */
+static inline __m128i BytesLower16(__m128i v)
+{
+    __m128i upper = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+            _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static void BytesToLowerSSE2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), BytesLower16(v));
+    }
+    BytesToLowerGeneric(dst + i, src + i, len - i);
+}
+
+static int BytesCmpNocaseSSE2(const uint8_t *s1, const uint8_t *s2, size_t len)
+{
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i a = BytesLower16(_mm_loadu_si128((const __m128i *)(s1 + i)));
+        __m128i b = BytesLower16(_mm_loadu_si128((const __m128i *)(s2 + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+            return 1;
+    }
+    return BytesCmpNocaseGeneric(s1 + i, s2 + i, len - i);
+}
+
+static const uint8_t *BytesFindAnySSE2(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len)
+{
+    __m128i c[BYTES_FIND_ANY_MAX];
+    uint8_t j;
+    for (j = 0; j < set_len; j++)
+        c[j] = _mm_set1_epi8(set[j]);
+
+    size_t i = 0;
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i m = _mm_cmpeq_epi8(v, c[0]);
+        for (j = 1; j < set_len; j++)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c[j]));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+        if (mask != 0)
+            return buf + i + __builtin_ctz(mask);
+    }
+    return BytesFindAnyGeneric(buf + i, len - i, set, set_len);
+}
+#endif /* __SSE2__ */
+
+#ifdef BYTES_SIMD_AVX2
+__attribute__((target("avx2")))
+static inline __m256i BytesLower32(__m256i v)
+{
+    __m256i upper = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static void BytesToLowerAVX2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+    for ( ; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), BytesLower32(v));
+    }
+    BytesToLowerSSE2(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int BytesCmpNocaseAVX2(const uint8_t *s1, const uint8_t *s2, size_t len)
+{
+    size_t i = 0;
+    for ( ; i + 32 <= len; i += 32) {
+        __m256i a = BytesLower32(_mm256_loadu_si256((const __m256i *)(s1 + i)));
+        __m256i b = BytesLower32(_mm256_loadu_si256((const __m256i *)(s2 + i)));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xffffffff)
+            return 1;
+    }
+    return BytesCmpNocaseSSE2(s1 + i, s2 + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *BytesFindAnyAVX2(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len)
+{
+    __m256i c[BYTES_FIND_ANY_MAX];
+    uint8_t j;
+    for (j = 0; j < set_len; j++)
+        c[j] = _mm256_set1_epi8(set[j]);
+
+    size_t i = 0;
+    for ( ; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i m = _mm256_cmpeq_epi8(v, c[0]);
+        for (j = 1; j < set_len; j++)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c[j]));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+        if (mask != 0)
+            return buf + i + __builtin_ctz(mask);
+    }
+    return BytesFindAnySSE2(buf + i, len - i, set, set_len);
+}
+#endif /* BYTES_SIMD_AVX2 */
+
+/**
+ * \internal
+ * \brief initial functions, so that callers running before
+ *        BytesSimdSetup (unittests, tools) get valid ones.
+ */
+static void BytesToLowerSelect(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    BytesSimdSetup();
+    g_bytes_tolower(dst, src, len);
+}
+
+static int BytesCmpNocaseSelect(const uint8_t *s1, const uint8_t *s2, size_t len)
+{
+    BytesSimdSetup();
+    return g_bytes_cmp_nocase(s1, s2, len);
+}
+
+static const uint8_t *BytesFindAnySelect(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len)
+{
+    BytesSimdSetup();
+    return g_bytes_find_any(buf, len, set, set_len);
+}
+
+/**
+ * \brief pick the functions for this CPU
+ */
+void BytesSimdSetup(void)
+{
+#ifdef BYTES_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        SCLogDebug("bytes helpers use avx2");
+        g_bytes_tolower = BytesToLowerAVX2;
+        g_bytes_cmp_nocase = BytesCmpNocaseAVX2;
+        g_bytes_find_any = BytesFindAnyAVX2;
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    SCLogDebug("bytes helpers use sse2");
+    g_bytes_tolower = BytesToLowerSSE2;
+    g_bytes_cmp_nocase = BytesCmpNocaseSSE2;
+    g_bytes_find_any = BytesFindAnySSE2;
+#else
+    SCLogDebug("bytes helpers use the generic versions");
+    g_bytes_tolower = BytesToLowerGeneric;
+    g_bytes_cmp_nocase = BytesCmpNocaseGeneric;
+    g_bytes_find_any = BytesFindAnyGeneric;
+#endif
+}
+
+#ifdef UNITTESTS
+/** \test all versions against the generic ones, for all lengths up to
+ *        and over two AVX2 vectors and all offsets within a vector */
+static int BytesSimdTest01(void)
+{
+    uint8_t src[128 + 32], lower[sizeof(src)], dst[sizeof(src)];
+    uint32_t seed = 1;
+    size_t i;
+
+    BytesSimdSetup();
+
+    for (i = 0; i < sizeof(src); i++) {
+        seed = seed * 1103515245 + 12345;
+        /* mostly letters, some bytes with the top bit set */
+        uint8_t c = (uint8_t)(seed >> 16);
+        src[i] = (c & 0x80) && (c & 0x40) ? c : (uint8_t)('A' + (c % 58));
+    }
+    BytesToLowerGeneric(lower, src, sizeof(src));
+    for (i = 0; i < sizeof(src); i++) {
+        if (src[i] >= 'A' && src[i] <= 'Z')
+            FAIL_IF(lower[i] != src[i] + 0x20);
+        else
+            FAIL_IF(lower[i] != src[i]);
+    }
+
+    size_t off, len;
+    for (off = 0; off < 32; off++) {
+        for (len = 0; off + len <= sizeof(src); len++) {
+            memset(dst, 0, sizeof(dst));
+            BytesToLower(dst, src + off, len);
+            FAIL_IF(memcmp(dst, lower + off, len) != 0);
+            FAIL_IF(len < sizeof(dst) && dst[len] != 0);
+
+            FAIL_IF(BytesCmpNocase(src + off, lower + off, len) != 0);
+            if (len > 0) {
+                memcpy(dst, lower + off, len);
+                dst[len - 1] ^= 0x01;
+                FAIL_IF(BytesCmpNocase(src + off, dst, len) != 1);
+            }
+
+            const uint8_t set[] = { 'z', 'Q', 0xf3 };
+            FAIL_IF(BytesFindAny(src + off, len, set, sizeof(set)) !=
+                    BytesFindAnyGeneric(src + off, len, set, sizeof(set)));
+            FAIL_IF(BytesFindAny(src + off, len, set, 1) !=
+                    BytesFindAnyGeneric(src + off, len, set, 1));
+        }
+    }
+
+    /* in place */
+    memcpy(dst, src, sizeof(src));
+    BytesToLower(dst, dst, sizeof(dst));
+    FAIL_IF(memcmp(dst, lower, sizeof(dst)) != 0);
+
+    /* no hit */
+    memset(dst, 'a', sizeof(dst));
+    const uint8_t crlf[] = { '\r', '\n' };
+    FAIL_IF(BytesFindAny(dst, sizeof(dst), crlf, sizeof(crlf)) != NULL);
+    dst[100] = '\n';
+    FAIL_IF(BytesFindAny(dst, sizeof(dst), crlf, sizeof(crlf)) != dst + 100);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void BytesSimdRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("BytesSimdTest01", BytesSimdTest01);
+#endif /* UNITTESTS */
+}
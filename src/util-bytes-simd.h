@@ -0,0 +1,102 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Case folding, case insensitive compare and multi byte memchr over
+ * buffers, vectorized where the CPU allows. Only ASCII 'A' to 'Z' are
+ * folded.
+ */
+
+#ifndef __UTIL_BYTES_SIMD_H__
+#define __UTIL_BYTES_SIMD_H__
+
+/** buffers shorter than this are handled inline, byte by byte */
+#define BYTES_SIMD_MIN_LEN  16
+/** max number of bytes BytesFindAny() looks for */
+#define BYTES_FIND_ANY_MAX  4
+
+typedef void (*BytesToLowerFunc)(uint8_t *, const uint8_t *, size_t);
+typedef int (*BytesCmpNocaseFunc)(const uint8_t *, const uint8_t *, size_t);
+typedef const uint8_t *(*BytesFindAnyFunc)(const uint8_t *, size_t,
+        const uint8_t *, uint8_t);
+
+/** functions for the CPU we run on */
+extern BytesToLowerFunc g_bytes_tolower;
+extern BytesCmpNocaseFunc g_bytes_cmp_nocase;
+extern BytesFindAnyFunc g_bytes_find_any;
+
+static inline uint8_t BytesFold(uint8_t c)
+{
+    return (c >= 'A' && c <= 'Z') ? (uint8_t)(c | 0x20) : c;
+}
+
+/**
+ * \brief copy 'len' bytes of 'src' to 'dst' in lowercase. 'dst' may be
+ *        'src' to convert in place, but the buffers may not overlap
+ *        otherwise.
+ */
+static inline void BytesToLower(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    if (len < BYTES_SIMD_MIN_LEN) {
+        size_t i;
+        for (i = 0; i < len; i++)
+            dst[i] = BytesFold(src[i]);
+        return;
+    }
+    g_bytes_tolower(dst, src, len);
+}
+
+/**
+ * \brief compare two buffers without case
+ *
+ * \retval 0 equal
+ * \retval 1 not equal
+ */
+static inline int BytesCmpNocase(const void *s1, const void *s2, size_t len)
+{
+    if (len < BYTES_SIMD_MIN_LEN) {
+        const uint8_t *a = s1, *b = s2;
+        size_t i;
+        for (i = 0; i < len; i++) {
+            if (BytesFold(a[i]) != BytesFold(b[i]))
+                return 1;
+        }
+        return 0;
+    }
+    return g_bytes_cmp_nocase(s1, s2, len);
+}
+
+/**
+ * \brief find the first of up to BYTES_FIND_ANY_MAX bytes in a buffer
+ *
+ * \param set the bytes to look for
+ * \param set_len number of bytes in set, 1 to BYTES_FIND_ANY_MAX
+ *
+ * \retval ptr first occurrence of one of the bytes, NULL if none
+ */
+static inline const uint8_t *BytesFindAny(const uint8_t *buf, size_t len,
+        const uint8_t *set, uint8_t set_len)
+{
+    return g_bytes_find_any(buf, len, set, set_len);
+}
+
+void BytesSimdSetup(void);
+void BytesSimdRegisterTests(void);
+
+#endif /* __UTIL_BYTES_SIMD_H__ */
@@ -0,0 +1,259 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * One's complement sum for the packet checksums. The sum is taken over
+ * 16 bit words in memory order, so no byte swapping is needed: the folded
+ * result is in the same byte order as the checksum field.
+ *
+ * The vector versions widen the 16 bit words into 32 bit lanes and add
+ * those up, 8 (SSE2) or 16 (AVX2) words at a time. The lanes are flushed
+ * into a 64 bit sum before they can overflow. The AVX2 version is built
+ * with a target attribute and picked at start up if the CPU supports it.
+ */
+
+#include "suricata-common.h"
+#include "util-checksum-simd.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CHECKSUM_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+/** max vector iterations before the 32 bit lanes are flushed. Each
+ *  iteration adds at most 2 * 0xffff to a lane. */
+#define CHECKSUM_SIMD_FLUSH     16384
+
+static uint64_t ChecksumAddSelect(const uint8_t *buf, uint32_t len);
+
+ChecksumAddFunc g_checksum_add = ChecksumAddSelect;
+
+/**
+ * \internal
+ * \brief plain sum, 32 bits at a time
+ *
+ * Adding 32 bit words gives the same folded result as adding their 16 bit
+ * halves.
+ */
+static uint64_t ChecksumAddGeneric(const uint8_t *buf, uint32_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 8) {
+        uint32_t a, b;
+        memcpy(&a, buf, sizeof(a));
+        memcpy(&b, buf + 4, sizeof(b));
+        sum += a;
+        sum += b;
+        buf += 8;
+        len -= 8;
+    }
+    while (len >= 2) {
+        uint16_t w;
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+        buf += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *buf;
+        sum += pad;
+    }
+    return sum;
+}
+
+#if defined(__SSE2__)
+static inline uint64_t ChecksumSSE2Lanes(__m128i acc)
+{
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static uint64_t ChecksumAddSSE2(const uint8_t *buf, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        __m128i acc = zero;
+        uint32_t n = 0;
+        for ( ; len >= 16 && n < CHECKSUM_SIMD_FLUSH; n++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            buf += 16;
+            len -= 16;
+        }
+        sum += ChecksumSSE2Lanes(acc);
+    }
+    return sum + ChecksumAddGeneric(buf, len);
+}
+#endif /* __SSE2__ */
+
+#ifdef CHECKSUM_SIMD_AVX2
+__attribute__((target("avx2")))
+static uint64_t ChecksumAddAVX2(const uint8_t *buf, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        __m256i acc = zero;
+        uint32_t n = 0;
+        for ( ; len >= 32 && n < CHECKSUM_SIMD_FLUSH; n++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            buf += 32;
+            len -= 32;
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+            lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+    return sum + ChecksumAddSSE2(buf, len);
+}
+#endif /* CHECKSUM_SIMD_AVX2 */
+
+/**
+ * \internal
+ * \brief initial sum function, so that callers running before
+ *        ChecksumSimdSetup (unittests, tools) get a valid one.
+ */
+static uint64_t ChecksumAddSelect(const uint8_t *buf, uint32_t len)
+{
+    ChecksumSimdSetup();
+    return g_checksum_add(buf, len);
+}
+
+/**
+ * \brief pick the sum function for this CPU
+ */
+void ChecksumSimdSetup(void)
+{
+#ifdef CHECKSUM_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        SCLogDebug("checksum uses the avx2 sum");
+        g_checksum_add = ChecksumAddAVX2;
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    SCLogDebug("checksum uses the sse2 sum");
+    g_checksum_add = ChecksumAddSSE2;
+#else
+    SCLogDebug("checksum uses the generic sum");
+    g_checksum_add = ChecksumAddGeneric;
+#endif
+}
+
+/**
+ * \retval 1 if the sum has a vector implementation on this CPU
+ */
+int ChecksumSimdIsVectorized(void)
+{
+    return (g_checksum_add != ChecksumAddSelect &&
+            g_checksum_add != ChecksumAddGeneric);
+}
+
+#ifdef UNITTESTS
+/** reference: the 16 bit word loop the decoders used */
+static uint16_t ChecksumRef(const uint8_t *buf, uint32_t len)
+{
+    uint32_t sum = 0;
+    uint16_t w;
+
+    for ( ; len > 1; len -= 2, buf += 2) {
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+    }
+    if (len == 1) {
+        w = 0;
+        *(uint8_t *)(&w) = *buf;
+        sum += w;
+    }
+    sum = (sum >> 16) + (sum & 0x0000FFFF);
+    sum += (sum >> 16);
+    return (uint16_t)sum;
+}
+
+/** \test all sum functions against the reference, all lengths up to 300
+ *        at all alignments */
+static int ChecksumSimdTest01(void)
+{
+    uint8_t buf[320];
+    uint32_t i, off, len;
+    uint32_t seed = 1;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+
+    ChecksumSimdSetup();
+
+    for (off = 0; off < 16; off++) {
+        for (len = 0; len <= 300; len++) {
+            uint16_t ref = ChecksumRef(buf + off, len);
+            FAIL_IF_NOT(ChecksumFold(ChecksumAddGeneric(buf + off, len)) == ref);
+#if defined(__SSE2__)
+            FAIL_IF_NOT(ChecksumFold(ChecksumAddSSE2(buf + off, len)) == ref);
+#endif
+            FAIL_IF_NOT(ChecksumFold(ChecksumAdd(buf + off, len)) == ref);
+        }
+    }
+    PASS;
+}
+
+/** \test all 0xff data, max sized packet, so the lanes are close to
+ *        overflowing */
+static int ChecksumSimdTest02(void)
+{
+    uint32_t len = 65535;
+    uint8_t *buf = SCMalloc(len);
+    FAIL_IF_NULL(buf);
+    memset(buf, 0xff, len);
+
+    uint16_t ref = ChecksumRef(buf, len);
+    FAIL_IF_NOT(ChecksumFold(ChecksumAddGeneric(buf, len)) == ref);
+    FAIL_IF_NOT(ChecksumFold(ChecksumAdd(buf, len)) == ref);
+
+    SCFree(buf);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void ChecksumSimdRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumSimdTest01", ChecksumSimdTest01);
+    UtRegisterTest("ChecksumSimdTest02", ChecksumSimdTest02);
+#endif /* UNITTESTS */
+}
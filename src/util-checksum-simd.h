@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * One's complement sum over packet data for the TCP, UDP and ICMP
+ * checksums, vectorized where the CPU allows.
+ */
+
+#ifndef __UTIL_CHECKSUM_SIMD_H__
+#define __UTIL_CHECKSUM_SIMD_H__
+
+typedef uint64_t (*ChecksumAddFunc)(const uint8_t *, uint32_t);
+
+/** sum function for the CPU we run on */
+extern ChecksumAddFunc g_checksum_add;
+
+/**
+ * \brief Sum 'len' bytes of 'buf' as 16 bit words in memory order. An odd
+ *        trailing byte is padded with a zero byte.
+ *
+ * \retval sum unfolded sum, to be passed to ChecksumFold once all parts
+ *         of the checksum have been added up
+ */
+static inline uint64_t ChecksumAdd(const uint8_t *buf, uint32_t len)
+{
+    return g_checksum_add(buf, len);
+}
+
+/**
+ * \brief Fold a 64 bit sum into a 16 bit one's complement sum
+ */
+static inline uint16_t ChecksumFold(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+void ChecksumSimdSetup(void);
+int ChecksumSimdIsVectorized(void);
+void ChecksumSimdRegisterTests(void);
+
+#endif /* __UTIL_CHECKSUM_SIMD_H__ */
@@ -26,6 +26,7 @@
 #include "suricata-common.h"
 
 #include "util-checksum.h"
+#include "util-device.h"
 
 int ReCalculateChecksum(Packet *p)
 {
@@ -88,3 +89,18 @@ int ChecksumAutoModeCheck(uint32_t thread_count,
     }
     return 0;
 }
+
+/**
+ *  \brief ChecksumAutoModeCheck() for the counts of a live device
+ *
+ *  Only sums the device's counts when the thread reaches the sample
+ *  count, so it can be called for every packet.
+ */
+int ChecksumAutoModeCheckDevice(uint32_t thread_count,
+        struct LiveDevice_ *dev)
+{
+    if (thread_count != CHECKSUM_SAMPLE_COUNT)
+        return 0;
+    return ChecksumAutoModeCheck(thread_count,
+            LiveDevGetPkts(dev), LiveDevGetInvalidChecksums(dev));
+}
@@ -27,6 +27,9 @@
 int ReCalculateChecksum(Packet *p);
 int ChecksumAutoModeCheck(uint32_t thread_count,
         unsigned int iface_count, unsigned int iface_fail);
+struct LiveDevice_;
+int ChecksumAutoModeCheckDevice(uint32_t thread_count,
+        struct LiveDevice_ *dev);
 
 /* constant linked with detection of interface with
  * invalid checksums */
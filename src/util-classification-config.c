@@ -27,6 +27,7 @@
 #include "detect.h"
 #include "detect-engine.h"
 #include "util-hash.h"
+#include "util-rohash.h"
 
 #include "conf.h"
 #include "util-classification-config.h"
@@ -201,6 +202,10 @@ static void SCClassConfDeInitLocalResources(DetectEngineCtx *de_ctx, FILE *fd)
  */
 void SCClassConfDeInitContext(DetectEngineCtx *de_ctx)
 {
+    if (de_ctx->class_conf_ro != NULL)
+        ROHashMapFree(de_ctx->class_conf_ro);
+    de_ctx->class_conf_ro = NULL;
+
     if (de_ctx->class_conf_ht != NULL)
         HashTableFree(de_ctx->class_conf_ht);
 
@@ -299,6 +304,12 @@ int SCClassConfAddClasstype(char *rawstr, uint8_t index, DetectEngineCtx *de_ctx
 
     /* Check if the Classtype is present in the HashTable.  In case it's present
      * ignore it, as it is a duplicate.  If not present, add it to the table */
+    /* the frozen lookup no longer matches the table */
+    if (de_ctx->class_conf_ro != NULL) {
+        ROHashMapFree(de_ctx->class_conf_ro);
+        de_ctx->class_conf_ro = NULL;
+    }
+
     ct_lookup = HashTableLookup(de_ctx->class_conf_ht, ct_new, 0);
     if (ct_lookup == NULL) {
         if (HashTableAdd(de_ctx->class_conf_ht, ct_new, 0) < 0)
@@ -516,6 +527,42 @@ void SCClassConfClasstypeHashFree(void *ch)
     return;
 }
 
+/**
+ * \brief Sets up the frozen classtype name lookup for the rule parsing.
+ *
+ *        On error the lookups keep using the hash table.
+ */
+static void SCClassConfFreeze(DetectEngineCtx *de_ctx)
+{
+    HashTable *ht = de_ctx->class_conf_ht;
+    uint32_t i;
+
+    if (ht == NULL || de_ctx->class_conf_ro != NULL)
+        return;
+
+    ROHashMap *map = ROHashMapInit();
+    if (map == NULL)
+        return;
+
+    int cnt = 0;
+    for (i = 0; i < ht->array_size; i++) {
+        HashTableBucket *b;
+        for (b = ht->array[i]; b != NULL; b = b->next) {
+            SCClassConfClasstype *ct = b->data;
+            if (ROHashMapQueue(map, ct->classtype, strlen(ct->classtype), ct) != 1)
+                goto error;
+            cnt++;
+        }
+    }
+    if (cnt == 0 || ROHashMapFreeze(map) != 1)
+        goto error;
+
+    de_ctx->class_conf_ro = map;
+    return;
+error:
+    ROHashMapFree(map);
+}
+
 /**
  * \brief Loads the Classtype info from the classification.config file.
  *
@@ -544,6 +591,7 @@ void SCClassConfLoadClassficationConfigFile(DetectEngineCtx *de_ctx, FILE *fd)
 
     SCClassConfParseFile(de_ctx, fd);
     SCClassConfDeInitLocalResources(de_ctx, fd);
+    SCClassConfFreeze(de_ctx);
 
     return;
 }
@@ -568,6 +616,10 @@ SCClassConfClasstype *SCClassConfGetClasstype(const char *ct_name,
         name[s] = tolower((unsigned char)ct_name[s]);
     name[s] = '\0';
 
+    if (de_ctx->class_conf_ro != NULL)
+        return (s <= UINT16_MAX) ?
+            ROHashMapLookup(de_ctx->class_conf_ro, name, (uint16_t)s) : NULL;
+
     SCClassConfClasstype ct_lookup = {0, name, NULL, 0 };
     SCClassConfClasstype *lookup_ct_info = HashTableLookup(de_ctx->class_conf_ht,
                                                            &ct_lookup, 0);
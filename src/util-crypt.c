@@ -29,6 +29,8 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "util-crypt.h"
+#include "util-debug.h"
+#include "util-unittest.h"
 #ifdef HAVE_NSS
 #include <sechash.h>
 #endif
@@ -264,6 +266,105 @@ unsigned char* ComputeSHA1(unsigned char* buff, int bufflen)
 
 static const char *b64codes = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define BASE64_SIMD_SSSE3
+#include <immintrin.h>
+#endif
+
+typedef unsigned long (*Base64EncodeBlocksFunc)(const unsigned char *,
+        unsigned long, unsigned char *);
+
+static unsigned long Base64EncodeBlocksSelect(const unsigned char *in,
+        unsigned long inlen, unsigned char *out);
+
+static Base64EncodeBlocksFunc g_base64_encode_blocks = Base64EncodeBlocksSelect;
+
+/**
+ * \internal
+ * \brief no vector version: leave all the input to the scalar loop
+ */
+static unsigned long Base64EncodeBlocksGeneric(const unsigned char *in,
+        unsigned long inlen, unsigned char *out)
+{
+    return 0;
+}
+
+#ifdef BASE64_SIMD_SSSE3
+/**
+ * \internal
+ * \brief encode 12 bytes into 16 characters per iteration
+ *
+ * The 3 byte groups are spread over 32 bit lanes, the 6 bit indexes are
+ * moved in place with multiplies, then turned into characters by adding
+ * an offset that depends on the index range, looked up with pshufb.
+ * 16 bytes are loaded per 12 used, so it stops 16 bytes before the end.
+ *
+ * \retval consumed number of input bytes encoded, a multiple of 3
+ */
+__attribute__((target("ssse3")))
+static unsigned long Base64EncodeBlocksSSSE3(const unsigned char *in,
+        unsigned long inlen, unsigned char *out)
+{
+    const __m128i shuf = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                      4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    unsigned long consumed = 0;
+
+    while (inlen - consumed >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + consumed));
+        v = _mm_shuffle_epi8(v, shuf);
+
+        __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(t1, t3);
+
+        /* 0..25 -> 13, 26..51 -> 0, 52..63 -> 1..12 */
+        __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        r = _mm_or_si128(r, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        r = _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx);
+
+        _mm_storeu_si128((__m128i *)out, r);
+        out += 16;
+        consumed += 12;
+    }
+    return consumed;
+}
+#endif /* BASE64_SIMD_SSSE3 */
+
+/**
+ * \internal
+ * \brief initial block function, picks the one for this CPU on first use
+ */
+static unsigned long Base64EncodeBlocksSelect(const unsigned char *in,
+        unsigned long inlen, unsigned char *out)
+{
+    Base64EncodeSetup();
+    return g_base64_encode_blocks(in, inlen, out);
+}
+
+/**
+ * \brief pick the base64 encoder for this CPU
+ */
+void Base64EncodeSetup(void)
+{
+#ifdef BASE64_SIMD_SSSE3
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        SCLogDebug("base64 uses the ssse3 encoder");
+        g_base64_encode_blocks = Base64EncodeBlocksSSSE3;
+        return;
+    }
+#endif
+    SCLogDebug("base64 uses the generic encoder");
+    g_base64_encode_blocks = Base64EncodeBlocksGeneric;
+}
+
 int Base64Encode(const unsigned char *in,  unsigned long inlen,
                         unsigned char *out, unsigned long *outlen)
 {
@@ -279,9 +380,11 @@ int Base64Encode(const unsigned char *in,  unsigned long inlen,
       *outlen = len2 + 1;
       return SC_BASE64_OVERFLOW;
    }
-   p = out;
+   i = g_base64_encode_blocks(in, inlen, out);
+   in += i;
+   p = out + (i / 3) * 4;
    leven = 3*(inlen / 3);
-   for (i = 0; i < leven; i += 3) {
+   for (; i < leven; i += 3) {
        *p++ = b64codes[(in[0] >> 2) & 0x3F];
        *p++ = b64codes[(((in[0] & 3) << 4) + (in[1] >> 4)) & 0x3F];
        *p++ = b64codes[(((in[1] & 0xf) << 2) + (in[2] >> 6)) & 0x3F];
@@ -304,3 +407,46 @@ int Base64Encode(const unsigned char *in,  unsigned long inlen,
    *outlen = p - out;
    return SC_BASE64_OK;
 }
+
+#ifdef UNITTESTS
+/** \test vector encoder against the scalar loop, all tail lengths */
+static int Base64EncodeTest01(void)
+{
+    uint8_t in[256];
+    uint8_t simd[352], generic[352];
+    uint32_t i, len;
+
+    for (i = 0; i < sizeof(in); i++)
+        in[i] = (uint8_t)(i * 7 + 13);
+
+    for (len = 0; len <= sizeof(in); len++) {
+        unsigned long slen = sizeof(simd);
+        Base64EncodeSetup();
+        FAIL_IF(Base64Encode(in, len, simd, &slen) != SC_BASE64_OK);
+
+        unsigned long glen = sizeof(generic);
+        g_base64_encode_blocks = Base64EncodeBlocksGeneric;
+        FAIL_IF(Base64Encode(in, len, generic, &glen) != SC_BASE64_OK);
+
+        FAIL_IF(slen != glen);
+        FAIL_IF(slen != 4 * ((len + 2) / 3));
+        FAIL_IF(memcmp(simd, generic, slen + 1) != 0);
+    }
+    Base64EncodeSetup();
+
+    unsigned long olen = sizeof(simd);
+    FAIL_IF(Base64Encode((const uint8_t *)"foobar", 6, simd, &olen) != SC_BASE64_OK);
+    FAIL_IF(strcmp((char *)simd, "Zm9vYmFy") != 0);
+    olen = sizeof(simd);
+    FAIL_IF(Base64Encode((const uint8_t *)"fooba", 5, simd, &olen) != SC_BASE64_OK);
+    FAIL_IF(strcmp((char *)simd, "Zm9vYmE=") != 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void Base64RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("Base64EncodeTest01", Base64EncodeTest01);
+#endif /* UNITTESTS */
+}
@@ -80,5 +80,7 @@ typedef union HashState_ {
 
 unsigned char* ComputeSHA1(unsigned char* buff, int bufflen);
 int Base64Encode(const unsigned char *in,  unsigned long inlen, unsigned char *out, unsigned long *outlen);
+void Base64EncodeSetup(void);
+void Base64RegisterTests(void);
 
 #endif /* UTIL_CRYPT_H_ */
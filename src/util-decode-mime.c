@@ -29,6 +29,7 @@
 #include "util-spm-bs.h"
 #include "util-unittest.h"
 #include "util-memcmp.h"
+#include "util-bytes-simd.h"
 #include "util-print.h"
 
 /* Character constants */
@@ -445,9 +446,7 @@ static MimeDecField * MimeDecFillField(MimeDecEntity *entity, uint8_t *name,
 
     if (nlen > 0) {
         /* convert to lowercase and store */
-        uint32_t u;
-        for (u = 0; u < nlen; u++)
-            name[u] = tolower(name[u]);
+        BytesToLower(name, name, nlen);
 
         field->name = (uint8_t *)name;
         field->name_len = nlen;
@@ -1539,6 +1538,11 @@ static int ProcessBodyLine(const uint8_t *buf, uint32_t len,
     /* Track length */
     entity->body_len += len + 2; /* With CRLF */
 
+    /* Nobody needs the content: don't decode or pass it on */
+    if (state->skip_attachments && (entity->ctnt_flags & CTNT_IS_ATTACHMENT)) {
+        return MIME_DEC_OK;
+    }
+
     /* Process base-64 content if enabled */
     MimeDecConfig *mdcfg = MimeDecGetConfig();
     if (mdcfg != NULL && mdcfg->decode_base64 &&
@@ -2050,10 +2054,17 @@ static int ProcessBodyComplete(MimeDecParseState *state)
     }
 #endif
 
-    /* Invoke pre-processor and callback with remaining data */
-    ret = ProcessDecodedDataChunk(state->data_chunk, state->data_chunk_len, state);
-    if (ret != MIME_DEC_OK) {
-        SCLogDebug("Error: ProcessDecodedDataChunk() function failed");
+    /* Invoke pre-processor and callback with remaining data, unless the
+     * body was skipped */
+    MimeDecEntity *entity = NULL;
+    if (state->stack != NULL && state->stack->top != NULL)
+        entity = (MimeDecEntity *) state->stack->top->data;
+    if (!(state->skip_attachments && entity != NULL &&
+                (entity->ctnt_flags & CTNT_IS_ATTACHMENT))) {
+        ret = ProcessDecodedDataChunk(state->data_chunk, state->data_chunk_len, state);
+        if (ret != MIME_DEC_OK) {
+            SCLogDebug("Error: ProcessDecodedDataChunk() function failed");
+        }
     }
 
     /* Now reset */
@@ -2933,6 +2944,52 @@ static int MimeDecParseFullMsgTest02(void)
     return 1;
 }
 
+/* Test that skipped attachments aren't decoded or passed on */
+static int MimeDecParseSkipAttachmentTest01(void)
+{
+    const char *lines[] = {
+        "From: Sender1",
+        "To: Recipient1",
+        "Content-Type: application/octet-stream",
+        "Content-Disposition: attachment; filename=\"a.bin\"",
+        "Content-Transfer-Encoding: base64",
+        "",
+        "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=",
+        "YWJjZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXo=",
+        NULL };
+    int skip;
+
+    for (skip = 0; skip <= 1; skip++) {
+        uint32_t line_count = 0;
+        int ret = MIME_DEC_OK;
+        int i;
+
+        MimeDecParseState *state = MimeDecInitParser(&line_count,
+                TestDataChunkCallback);
+        FAIL_IF_NULL(state);
+        state->skip_attachments = skip;
+
+        for (i = 0; lines[i] != NULL; i++) {
+            ret |= MimeDecParseLine((uint8_t *)lines[i], strlen(lines[i]), 1, state);
+        }
+        ret |= MimeDecParseComplete(state);
+        FAIL_IF(ret != MIME_DEC_OK);
+
+        MimeDecEntity *msg = state->msg;
+        FAIL_IF_NOT(msg->ctnt_flags & CTNT_IS_ATTACHMENT);
+        /* lengths are tracked either way */
+        FAIL_IF(msg->body_len == 0);
+        if (skip)
+            FAIL_IF(line_count != 0);
+        else
+            FAIL_IF(line_count == 0);
+
+        MimeDecFreeEntity(msg);
+        MimeDecDeInitParser(state);
+    }
+    PASS;
+}
+
 static int MimeBase64DecodeTest01(void)
 {
     int ret = 0;
@@ -2957,6 +3014,27 @@ static int MimeBase64DecodeTest01(void)
     return ret;
 }
 
+/* Test the block fast path hands over to the per character decoding */
+static int MimeBase64DecodeTest02(void)
+{
+    /* padding and an invalid character after the first blocks */
+    const char *base64msg = "QUJDREVGR0g=";
+    uint8_t dst[16];
+
+    uint32_t len = DecodeBase64(dst, (const uint8_t *)base64msg,
+            strlen(base64msg), 1);
+    FAIL_IF(len != 8);
+    FAIL_IF(memcmp(dst, "ABCDEFGH", 8) != 0);
+
+    base64msg = "QUJDREVG*0hJ";
+    len = DecodeBase64(dst, (const uint8_t *)base64msg, strlen(base64msg), 1);
+    FAIL_IF(len != 0);
+    len = DecodeBase64(dst, (const uint8_t *)base64msg, strlen(base64msg), 0);
+    FAIL_IF(len != 6);
+    FAIL_IF(memcmp(dst, "ABCDEF", 6) != 0);
+    PASS;
+}
+
 static int MimeIsExeURLTest01(void)
 {
     int ret = 0;
@@ -3053,7 +3131,10 @@ void MimeDecRegisterTests(void)
     UtRegisterTest("MimeDecParseLineTest02", MimeDecParseLineTest02);
     UtRegisterTest("MimeDecParseFullMsgTest01", MimeDecParseFullMsgTest01);
     UtRegisterTest("MimeDecParseFullMsgTest02", MimeDecParseFullMsgTest02);
+    UtRegisterTest("MimeDecParseSkipAttachmentTest01",
+                   MimeDecParseSkipAttachmentTest01);
     UtRegisterTest("MimeBase64DecodeTest01", MimeBase64DecodeTest01);
+    UtRegisterTest("MimeBase64DecodeTest02", MimeBase64DecodeTest02);
     UtRegisterTest("MimeIsExeURLTest01", MimeIsExeURLTest01);
     UtRegisterTest("MimeIsIpv4HostTest01", MimeIsIpv4HostTest01);
     UtRegisterTest("MimeIsIpv6HostTest01", MimeIsIpv6HostTest01);
@@ -205,6 +205,8 @@ typedef struct MimeDecParseState {
     int body_begin;  /**< Currently at beginning of body */
     int body_end;  /**< Currently at end of body */
     uint8_t current_line_delimiter_len; /**< Length of line delimiter */
+    int skip_attachments;  /**< Don't decode attachment bodies, the caller
+                                doesn't need their content */
     void *data;  /**< Pointer to data specific to the caller */
     int (*DataChunkProcessorFunc) (const uint8_t *chunk, uint32_t len,
             struct MimeDecParseState *state);  /**< Data chunk processing function callback */
@@ -0,0 +1,268 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Duplicate packet suppression
+ *
+ * Packet brokers and redundant SPAN sessions can deliver a packet twice,
+ * e.g. once mirrored on ingress and once on egress. Each flow worker
+ * keeps a short window of the packets it saw, so it can skip the second
+ * copy before flow handling. Copies of a flow go to the same worker, so
+ * the windows don't have to be shared.
+ *
+ * A packet is identified by a hash of its addresses, IP id and fragment
+ * offset, ports, TCP seq/ack/flags, L4 checksum and the start of its
+ * payload. The TTL, the IP checksum and the link layer are left out, as
+ * those differ between the copies taken on both sides of a router.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "util-debug.h"
+#include "util-dedup.h"
+#include "util-hash-fast.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#define DEDUP_WINDOW_DEFAULT        10      /**< msec */
+#define DEDUP_ENTRIES_DEFAULT       65536
+#define DEDUP_ENTRIES_MIN           1024
+#define DEDUP_ENTRIES_MAX           (1 << 24)
+/** bytes of payload that go into the hash */
+#define DEDUP_PAYLOAD_PREFIX        64
+
+int dedup_enabled = 0;
+
+static uint32_t dedup_window_ms = DEDUP_WINDOW_DEFAULT;
+static uint32_t dedup_entries = DEDUP_ENTRIES_DEFAULT;
+static uint32_t dedup_seed = 0;
+
+void DedupInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("dedup.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    if (EngineModeIsIPS()) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "dedup: duplicate packet "
+                "suppression is for IDS mode only, disabled");
+        return;
+    }
+
+    intmax_t v = 0;
+    if (ConfGetInt("dedup.window", &v) == 1) {
+        if (v < 1 || v > 10000) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dedup.window must be "
+                    "between 1 and 10000 msec, using %u",
+                    DEDUP_WINDOW_DEFAULT);
+        } else {
+            dedup_window_ms = (uint32_t)v;
+        }
+    }
+    if (ConfGetInt("dedup.entries", &v) == 1) {
+        if (v < DEDUP_ENTRIES_MIN || v > DEDUP_ENTRIES_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "dedup.entries must be "
+                    "between %u and %u, using %u", DEDUP_ENTRIES_MIN,
+                    DEDUP_ENTRIES_MAX, DEDUP_ENTRIES_DEFAULT);
+        } else {
+            /* round up to a power of 2 */
+            dedup_entries = DEDUP_ENTRIES_MIN;
+            while (dedup_entries < (uint32_t)v)
+                dedup_entries <<= 1;
+        }
+    }
+
+    dedup_seed = HashFastRandomSeed();
+    dedup_enabled = 1;
+    SCLogConfig("dedup: suppressing duplicate packets within %u msec, "
+            "%u entries per thread", dedup_window_ms, dedup_entries);
+}
+
+/**
+ *  \brief set up the window of a flow worker
+ *
+ *  \retval dt window, NULL if disabled or out of memory
+ */
+DedupThread *DedupThreadInit(void)
+{
+    if (!dedup_enabled)
+        return NULL;
+
+    DedupThread *dt = SCCalloc(1, sizeof(*dt));
+    if (unlikely(dt == NULL))
+        return NULL;
+    dt->slots = SCCalloc(dedup_entries, sizeof(DedupSlot));
+    if (unlikely(dt->slots == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "dedup: failed to allocate %u "
+                "entries, duplicates are not suppressed", dedup_entries);
+        SCFree(dt);
+        return NULL;
+    }
+    dt->mask = dedup_entries - 1;
+    dt->window_ms = dedup_window_ms;
+    return dt;
+}
+
+void DedupThreadFree(DedupThread *dt)
+{
+    if (dt == NULL)
+        return;
+    SCFree(dt->slots);
+    SCFree(dt);
+}
+
+/** \internal
+ *  \brief hash the fields the copies of a packet share
+ *
+ *  \retval 0 packet isn't checked for duplicates
+ *  \retval 1 h1 and h2 set
+ */
+static int DedupHashPacket(const Packet *p, uint32_t *h1, uint32_t *h2)
+{
+    uint32_t key[13];
+    uint32_t len = 0;
+
+    if (PKT_IS_IPV4(p)) {
+        key[len++] = ((uint32_t)IPV4_GET_RAW_IPID(p->ip4h) << 16) |
+                     IPV4_GET_RAW_IPOFFSET(p->ip4h);
+        key[len++] = ((uint32_t)IPV4_GET_RAW_IPLEN(p->ip4h) << 16) |
+                     IPV4_GET_RAW_IPPROTO(p->ip4h);
+        key[len++] = p->src.addr_data32[0];
+        key[len++] = p->dst.addr_data32[0];
+    } else if (PKT_IS_IPV6(p)) {
+        key[len++] = IPV6_GET_FLOW(p);
+        key[len++] = ((uint32_t)IPV6_GET_PLEN(p) << 16) | p->proto;
+        if (p->ip6eh.fh_set)
+            key[len++] = IPV6_EXTHDR_GET_FH_ID(p) ^ IPV6_EXTHDR_GET_FH_OFFSET(p);
+        memcpy(&key[len], p->src.addr_data32, 16);
+        len += 4;
+        memcpy(&key[len], p->dst.addr_data32, 16);
+        len += 4;
+    } else {
+        return 0;
+    }
+
+    if (PKT_IS_TCP(p)) {
+        key[len++] = ((uint32_t)p->sp << 16) | p->dp;
+        key[len++] = p->tcph->th_seq;
+        key[len++] = p->tcph->th_ack;
+        key[len++] = ((uint32_t)p->tcph->th_sum << 16) | p->tcph->th_flags;
+    } else if (PKT_IS_UDP(p)) {
+        key[len++] = ((uint32_t)p->sp << 16) | p->dp;
+        key[len++] = ((uint32_t)p->udph->uh_sum << 16) | p->udph->uh_len;
+    }
+
+    *h1 = dedup_seed;
+    *h2 = 0;
+    hashword2(key, len, h1, h2);
+    if (p->payload != NULL && p->payload_len > 0) {
+        hashlittle2(p->payload, MIN(p->payload_len, DEDUP_PAYLOAD_PREFIX),
+                h1, h2);
+    }
+    return 1;
+}
+
+/**
+ *  \brief check if we saw this packet within the window, and remember it
+ *
+ *  \retval 1 duplicate, skip it
+ *  \retval 0 not seen before
+ */
+int DedupPacketIsDuplicate(DedupThread *dt, const Packet *p)
+{
+    uint32_t h1, h2;
+
+    if (PKT_IS_PSEUDOPKT(p) || IS_TUNNEL_PKT(p))
+        return 0;
+    if (!DedupHashPacket(p, &h1, &h2))
+        return 0;
+
+    const uint32_t tag = h2 | 1;
+    const uint32_t now = (uint32_t)((uint64_t)p->ts.tv_sec * 1000 +
+                                    p->ts.tv_usec / 1000);
+    DedupSlot *slot = &dt->slots[h1 & dt->mask];
+
+    /* time going backwards gives a large diff: not a duplicate */
+    if (slot->tag == tag && now - slot->ts_ms <= dt->window_ms)
+        return 1;
+
+    slot->tag = tag;
+    slot->ts_ms = now;
+    return 0;
+}
+
+#ifdef UNITTESTS
+
+static int DedupTest01(void)
+{
+    uint8_t payload[] = "dedup test payload";
+
+    dedup_window_ms = 10;
+    dedup_entries = DEDUP_ENTRIES_MIN;
+    dedup_enabled = 1;
+    DedupThread *dt = DedupThreadInit();
+    dedup_enabled = 0;
+    FAIL_IF_NULL(dt);
+
+    Packet *p = UTHBuildPacketReal(payload, sizeof(payload) - 1, IPPROTO_TCP,
+            "192.168.1.1", "192.168.1.2", 41424, 80);
+    FAIL_IF_NULL(p);
+    p->ts.tv_sec = 1000;
+    p->ts.tv_usec = 0;
+
+    FAIL_IF(DedupPacketIsDuplicate(dt, p));
+    /* the copy from the other side of the router */
+    p->ip4h->ip_ttl--;
+    p->ts.tv_usec = 2000;
+    FAIL_IF_NOT(DedupPacketIsDuplicate(dt, p));
+
+    /* retransmission after the window */
+    p->ts.tv_usec = 50000;
+    FAIL_IF(DedupPacketIsDuplicate(dt, p));
+
+    /* next segment */
+    p->tcph->th_seq = htonl(ntohl(p->tcph->th_seq) + sizeof(payload) - 1);
+    FAIL_IF(DedupPacketIsDuplicate(dt, p));
+    FAIL_IF_NOT(DedupPacketIsDuplicate(dt, p));
+
+    /* other payload, same headers */
+    p->payload[0] = 'D';
+    FAIL_IF(DedupPacketIsDuplicate(dt, p));
+
+    /* pseudo packets are never duplicates */
+    p->flags |= PKT_PSEUDO_STREAM_END;
+    FAIL_IF(DedupPacketIsDuplicate(dt, p));
+
+    UTHFreePacket(p);
+    DedupThreadFree(dt);
+    dedup_entries = DEDUP_ENTRIES_DEFAULT;
+    dedup_window_ms = DEDUP_WINDOW_DEFAULT;
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void DedupRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DedupTest01", DedupTest01);
+#endif /* UNITTESTS */
+}
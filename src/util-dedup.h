@@ -0,0 +1,53 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Suppression of duplicate packets, as delivered by packet brokers and
+ * redundant SPAN sessions.
+ */
+
+#ifndef __UTIL_DEDUP_H__
+#define __UTIL_DEDUP_H__
+
+#include "decode.h"
+
+/** a recently seen packet */
+typedef struct DedupSlot_ {
+    uint32_t tag;       /**< second hash of the packet, never 0 */
+    uint32_t ts_ms;     /**< packet time in msec */
+} DedupSlot;
+
+/** per thread window of recently seen packets. Direct mapped: a packet
+ *  replaces whatever was in its slot, so collisions only cost us a
+ *  missed duplicate. */
+typedef struct DedupThread_ {
+    DedupSlot *slots;
+    uint32_t mask;
+    uint32_t window_ms;
+} DedupThread;
+
+extern int dedup_enabled;
+
+void DedupInit(void);
+DedupThread *DedupThreadInit(void);
+void DedupThreadFree(DedupThread *dt);
+int DedupPacketIsDuplicate(DedupThread *dt, const Packet *p);
+void DedupRegisterTests(void);
+
+#endif /* __UTIL_DEDUP_H__ */
@@ -17,6 +17,7 @@
 
 #include "suricata-common.h"
 #include "conf.h"
+#include "threads.h"
 #include "util-device.h"
 
 #define MAX_DEVNAME 10
@@ -36,6 +37,17 @@ static TAILQ_HEAD(, LiveDevice_) live_devices =
 /** if set to 0 when we don't have real devices */
 static int live_devices_stats = 1;
 
+/** next device id. Ids are not reused, so that a slot in a thread's
+ *  stats array always belongs to the same device. */
+static uint32_t live_devices_next_id = 0;
+/** protects the devices' thread_stats lists */
+static SCMutex live_devices_stats_lock = SCMUTEX_INITIALIZER;
+
+#ifdef TLS
+__thread LiveDeviceThreadStats **livedev_thread_stats = NULL;
+__thread uint32_t livedev_thread_stats_size = 0;
+#endif
+
 static int LiveSafeDeviceName(const char *devname,
                               char *newdevname, size_t destlen);
 
@@ -70,12 +82,79 @@ int LiveRegisterDevice(const char *dev)
     SC_ATOMIC_INIT(pd->drop);
     SC_ATOMIC_INIT(pd->invalid_checksums);
     pd->ignore_checksum = 0;
+    pd->thread_stats = NULL;
+    SCMutexLock(&live_devices_stats_lock);
+    pd->id = live_devices_next_id++;
+    SCMutexUnlock(&live_devices_stats_lock);
     TAILQ_INSERT_TAIL(&live_devices, pd, next);
 
     SCLogDebug("Device \"%s\" registered.", dev);
     return 0;
 }
 
+#ifdef TLS
+/**
+ *  \brief set up the stats of the current thread for a device, on its
+ *         first packet of the device
+ *
+ *  \retval ts stats, NULL if out of memory
+ */
+LiveDeviceThreadStats *LiveDevThreadStatsRegister(LiveDevice *dev)
+{
+    if (dev->id >= livedev_thread_stats_size) {
+        uint32_t size = dev->id + 1;
+        LiveDeviceThreadStats **ptmp = SCRealloc(livedev_thread_stats,
+                size * sizeof(*ptmp));
+        if (unlikely(ptmp == NULL))
+            return NULL;
+        memset(ptmp + livedev_thread_stats_size, 0x00,
+                (size - livedev_thread_stats_size) * sizeof(*ptmp));
+        livedev_thread_stats = ptmp;
+        livedev_thread_stats_size = size;
+    }
+
+    LiveDeviceThreadStats *ts = SCMallocAligned(sizeof(*ts), CLS);
+    if (unlikely(ts == NULL))
+        return NULL;
+    memset(ts, 0x00, sizeof(*ts));
+
+    SCMutexLock(&live_devices_stats_lock);
+    ts->next = dev->thread_stats;
+    dev->thread_stats = ts;
+    SCMutexUnlock(&live_devices_stats_lock);
+
+    livedev_thread_stats[dev->id] = ts;
+    return ts;
+}
+#endif
+
+/** \brief number of packets of a device, over all threads */
+uint64_t LiveDevGetPkts(LiveDevice *dev)
+{
+    uint64_t pkts = SC_ATOMIC_GET(dev->pkts);
+
+    SCMutexLock(&live_devices_stats_lock);
+    const LiveDeviceThreadStats *ts;
+    for (ts = dev->thread_stats; ts != NULL; ts = ts->next)
+        pkts += *(volatile const uint64_t *)&ts->pkts;
+    SCMutexUnlock(&live_devices_stats_lock);
+    return pkts;
+}
+
+/** \brief number of packets with an invalid checksum of a device, over
+ *         all threads */
+uint64_t LiveDevGetInvalidChecksums(LiveDevice *dev)
+{
+    uint64_t cnt = SC_ATOMIC_GET(dev->invalid_checksums);
+
+    SCMutexLock(&live_devices_stats_lock);
+    const LiveDeviceThreadStats *ts;
+    for (ts = dev->thread_stats; ts != NULL; ts = ts->next)
+        cnt += *(volatile const uint64_t *)&ts->invalid_checksums;
+    SCMutexUnlock(&live_devices_stats_lock);
+    return cnt;
+}
+
 /**
  *  \brief Get the number of registered devices
  *
@@ -257,12 +336,20 @@ int LiveDeviceListClean()
 
     TAILQ_FOREACH_SAFE(pd, &live_devices, next, tpd) {
         if (live_devices_stats) {
+            uint64_t pkts = LiveDevGetPkts(pd);
             SCLogNotice("Stats for '%s':  pkts: %" PRIu64", drop: %" PRIu64 " (%.2f%%), invalid chksum: %" PRIu64,
                     pd->dev,
-                    SC_ATOMIC_GET(pd->pkts),
+                    pkts,
                     SC_ATOMIC_GET(pd->drop),
-                    100 * (SC_ATOMIC_GET(pd->drop) * 1.0) / SC_ATOMIC_GET(pd->pkts),
-                    SC_ATOMIC_GET(pd->invalid_checksums));
+                    100 * (SC_ATOMIC_GET(pd->drop) * 1.0) / pkts,
+                    LiveDevGetInvalidChecksums(pd));
+        }
+        TAILQ_REMOVE(&live_devices, pd, next);
+        LiveDeviceThreadStats *ts = pd->thread_stats;
+        while (ts != NULL) {
+            LiveDeviceThreadStats *next = ts->next;
+            SCFreeAligned(ts);
+            ts = next;
         }
         if (pd->dev)
             SCFree(pd->dev);
@@ -301,9 +388,9 @@ TmEcode LiveDeviceIfaceStat(json_t *cmd, json_t *answer, void *data)
                 SCReturnInt(TM_ECODE_FAILED);
             }
             json_object_set_new(jdata, "pkts",
-                                json_integer(SC_ATOMIC_GET(pd->pkts)));
+                                json_integer(LiveDevGetPkts(pd)));
             json_object_set_new(jdata, "invalid-checksums",
-                                json_integer(SC_ATOMIC_GET(pd->invalid_checksums)));
+                                json_integer(LiveDevGetInvalidChecksums(pd)));
             json_object_set_new(jdata, "drop",
                                 json_integer(SC_ATOMIC_GET(pd->drop)));
             json_object_set_new(answer, "message", jdata);
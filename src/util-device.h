@@ -23,17 +23,77 @@
 
 #define MAX_DEVNAME 10
 
+/** per thread counts of a device, on a cache line of their own so that
+ *  the threads reading the same device don't share one. Only written by
+ *  their thread. */
+typedef struct LiveDeviceThreadStats_ {
+    uint64_t pkts;
+    uint64_t invalid_checksums;
+    struct LiveDeviceThreadStats_ *next;
+    uint8_t pad[CLS - 2 * sizeof(uint64_t) - sizeof(void *)];
+} LiveDeviceThreadStats;
+
 /** storage for live device names */
 typedef struct LiveDevice_ {
     char *dev;  /**< the device (e.g. "eth0") */
     char dev_short[MAX_DEVNAME + 1];
     int ignore_checksum;
+    /** counts added in bulk, e.g. from the kernel stats. Use
+     *  LiveDevGetPkts() and LiveDevGetInvalidChecksums() for the totals */
     SC_ATOMIC_DECLARE(uint64_t, pkts);
     SC_ATOMIC_DECLARE(uint64_t, drop);
     SC_ATOMIC_DECLARE(uint64_t, invalid_checksums);
+    uint32_t id;    /**< index in the threads' stats arrays, never reused */
+    /** stats of the threads that counted for the device */
+    LiveDeviceThreadStats *thread_stats;
     TAILQ_ENTRY(LiveDevice_) next;
 } LiveDevice;
 
+#ifdef TLS
+/** this thread's stats, indexed by device id */
+extern __thread LiveDeviceThreadStats **livedev_thread_stats;
+extern __thread uint32_t livedev_thread_stats_size;
+
+LiveDeviceThreadStats *LiveDevThreadStatsRegister(LiveDevice *dev);
+
+/** \brief get this thread's stats for a device, NULL if out of memory */
+static inline LiveDeviceThreadStats *LiveDevThreadStats(LiveDevice *dev)
+{
+    if (likely(dev->id < livedev_thread_stats_size &&
+               livedev_thread_stats[dev->id] != NULL))
+        return livedev_thread_stats[dev->id];
+    return LiveDevThreadStatsRegister(dev);
+}
+#endif
+
+/** \brief count packets of a device, per packet or in small batches */
+static inline void LiveDevAddPkts(LiveDevice *dev, uint64_t n)
+{
+#ifdef TLS
+    LiveDeviceThreadStats *ts = LiveDevThreadStats(dev);
+    if (likely(ts != NULL)) {
+        ts->pkts += n;
+        return;
+    }
+#endif
+    (void) SC_ATOMIC_ADD(dev->pkts, n);
+}
+
+static inline void LiveDevAddInvalidChecksum(LiveDevice *dev)
+{
+#ifdef TLS
+    LiveDeviceThreadStats *ts = LiveDevThreadStats(dev);
+    if (likely(ts != NULL)) {
+        ts->invalid_checksums++;
+        return;
+    }
+#endif
+    (void) SC_ATOMIC_ADD(dev->invalid_checksums, 1);
+}
+
+uint64_t LiveDevGetPkts(LiveDevice *dev);
+uint64_t LiveDevGetInvalidChecksums(LiveDevice *dev);
+
 
 int LiveRegisterDevice(const char *dev);
 int LiveGetDeviceCount(void);
@@ -325,6 +325,22 @@ const char * SCErrorToString(SCError err)
         CASE_CODE (SC_ERR_SMTP_LOG_GENERIC);
         CASE_CODE (SC_ERR_SSH_LOG_GENERIC);
         CASE_CODE (SC_ERR_NIC_OFFLOADING);
+        CASE_CODE (SC_WARN_NUMA_NODE);
+        CASE_CODE (SC_ERR_NO_AF_XDP);
+        CASE_CODE (SC_ERR_AF_XDP_CREATE);
+        CASE_CODE (SC_ERR_AF_XDP_READ);
+        CASE_CODE (SC_ERR_NO_DPDK);
+        CASE_CODE (SC_ERR_DPDK_CONFIG);
+        CASE_CODE (SC_ERR_INVALID_HASH);
+        CASE_CODE (SC_ERR_NO_SHA1_SUPPORT);
+        CASE_CODE (SC_ERR_NO_SHA256_SUPPORT);
+        CASE_CODE (SC_ERR_NO_PERF_EVENT_SUPPORT);
+        CASE_CODE (SC_ERR_MEMCAP_POLICY);
+        CASE_CODE (SC_ERR_IPFIX_LOG);
+        CASE_CODE (SC_ERR_PROCESS_GROUP);
+        CASE_CODE (SC_WARN_RULE_BUDGET);
+        CASE_CODE (SC_ERR_LOAD_SHED);
+        CASE_CODE (SC_ERR_STATE_SYNC);
     }
 
     return "UNKNOWN_ERROR";
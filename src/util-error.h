@@ -315,6 +315,22 @@ typedef enum {
     SC_ERR_SMTP_LOG_GENERIC,
     SC_ERR_SSH_LOG_GENERIC,
     SC_ERR_NIC_OFFLOADING,
+    SC_WARN_NUMA_NODE,
+    SC_ERR_NO_AF_XDP,
+    SC_ERR_AF_XDP_CREATE,
+    SC_ERR_AF_XDP_READ,
+    SC_ERR_NO_DPDK,
+    SC_ERR_DPDK_CONFIG,
+    SC_ERR_INVALID_HASH,
+    SC_ERR_NO_SHA1_SUPPORT,
+    SC_ERR_NO_SHA256_SUPPORT,
+    SC_ERR_NO_PERF_EVENT_SUPPORT,
+    SC_ERR_MEMCAP_POLICY,
+    SC_ERR_IPFIX_LOG,
+    SC_ERR_PROCESS_GROUP,
+    SC_WARN_RULE_BUDGET,
+    SC_ERR_LOAD_SHED,
+    SC_ERR_STATE_SYNC,
 } SCError;
 
 const char *SCErrorToString(SCError);
@@ -0,0 +1,192 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Expiry tracking for hash table rows, see util-expiry.h.
+ */
+
+#include "suricata-common.h"
+#include "util-expiry.h"
+#include "util-unittest.h"
+
+int ExpiryTableInit(ExpiryTable *t, uint32_t rows)
+{
+    memset(t, 0x00, sizeof(*t));
+    if (rows == 0)
+        return -1;
+
+    t->rows = rows;
+    t->blocks = (rows + EXPIRY_BLOCK_ROWS - 1) / EXPIRY_BLOCK_ROWS;
+    t->row_next = SCMalloc(t->rows * sizeof(uint32_t));
+    t->block_next = SCMalloc(t->blocks * sizeof(uint32_t));
+    if (t->row_next == NULL || t->block_next == NULL) {
+        ExpiryTableFree(t);
+        return -1;
+    }
+
+    uint32_t i;
+    for (i = 0; i < t->rows; i++)
+        t->row_next[i] = EXPIRY_NEVER;
+    for (i = 0; i < t->blocks; i++)
+        t->block_next[i] = EXPIRY_NEVER;
+    return 0;
+}
+
+void ExpiryTableFree(ExpiryTable *t)
+{
+    if (t->row_next != NULL)
+        SCFree(t->row_next);
+    if (t->block_next != NULL)
+        SCFree(t->block_next);
+    memset(t, 0x00, sizeof(*t));
+}
+
+uint64_t ExpiryTableMemuse(const ExpiryTable *t)
+{
+    return ((uint64_t)t->rows + t->blocks) * sizeof(uint32_t);
+}
+
+/** \internal
+ *  \brief atomically replace a value, so that an ExpiryArm() racing
+ *         with it is either overwritten before it happens or seen */
+static inline uint32_t ExpiryAtomicSwap(uint32_t *ptr, uint32_t v)
+{
+    uint32_t cur;
+    do {
+        cur = *(volatile uint32_t *)ptr;
+    } while (!SCAtomicCompareAndSwap(ptr, cur, v));
+    return cur;
+}
+
+/**
+ *  \brief run RowTimeout on all rows that are due
+ *
+ *  A row that is armed while we process it is either seen by this pass
+ *  or left due for the next one.
+ *
+ *  \retval cnt number of timed out entries
+ */
+uint32_t ExpiryTimeout(ExpiryTable *t, struct timeval *ts,
+        ExpiryRowTimeoutFunc RowTimeout)
+{
+    const uint32_t now = (uint32_t)ts->tv_sec;
+    uint32_t cnt = 0;
+    uint32_t b;
+
+    for (b = 0; b < t->blocks; b++) {
+        if (*(volatile uint32_t *)&t->block_next[b] > now)
+            continue;
+
+        /* reset before looking at the rows: arms from here on lower it
+         * again, the rows we keep are added back below */
+        (void)ExpiryAtomicSwap(&t->block_next[b], EXPIRY_NEVER);
+
+        uint32_t row = b * EXPIRY_BLOCK_ROWS;
+        const uint32_t end = MIN(row + EXPIRY_BLOCK_ROWS, t->rows);
+        for ( ; row < end; row++) {
+            uint32_t next = *(volatile uint32_t *)&t->row_next[row];
+            if (next == EXPIRY_NEVER)
+                continue;
+            if (next > now) {
+                ExpiryAtomicMin(&t->block_next[b], next);
+                continue;
+            }
+
+            (void)ExpiryAtomicSwap(&t->row_next[row], EXPIRY_NEVER);
+            next = RowTimeout(row, ts, &cnt);
+            if (next != EXPIRY_NEVER)
+                ExpiryArm(t, row, next);
+        }
+    }
+    return cnt;
+}
+
+#ifdef UNITTESTS
+
+static uint32_t expiry_test_when[130];
+static uint32_t expiry_test_checked;
+
+static uint32_t ExpiryTestRowTimeout(uint32_t row, struct timeval *ts,
+        uint32_t *cnt)
+{
+    expiry_test_checked++;
+    if (expiry_test_when[row] <= (uint32_t)ts->tv_sec) {
+        (*cnt)++;
+        expiry_test_when[row] = EXPIRY_NEVER;
+    }
+    return expiry_test_when[row];
+}
+
+static int ExpiryTest01(void)
+{
+    ExpiryTable t;
+    struct timeval ts = { 100, 0 };
+    uint32_t i;
+
+    FAIL_IF(ExpiryTableInit(&t, 130) != 0);
+    FAIL_IF(t.blocks != 3);
+    for (i = 0; i < 130; i++)
+        expiry_test_when[i] = EXPIRY_NEVER;
+
+    /* nothing armed: no rows visited */
+    expiry_test_checked = 0;
+    FAIL_IF(ExpiryTimeout(&t, &ts, ExpiryTestRowTimeout) != 0);
+    FAIL_IF(expiry_test_checked != 0);
+
+    /* new entry in row 3, expiring at 105 */
+    expiry_test_when[3] = 105;
+    ExpiryArm(&t, 3, 0);
+    /* and one in row 129 at 101 */
+    expiry_test_when[129] = 101;
+    ExpiryArm(&t, 129, 0);
+
+    /* first pass looks at both and rearms them */
+    FAIL_IF(ExpiryTimeout(&t, &ts, ExpiryTestRowTimeout) != 0);
+    FAIL_IF(expiry_test_checked != 2);
+    FAIL_IF(t.row_next[3] != 105);
+    FAIL_IF(t.block_next[2] != 101);
+
+    /* not due yet */
+    expiry_test_checked = 0;
+    FAIL_IF(ExpiryTimeout(&t, &ts, ExpiryTestRowTimeout) != 0);
+    FAIL_IF(expiry_test_checked != 0);
+
+    ts.tv_sec = 101;
+    FAIL_IF(ExpiryTimeout(&t, &ts, ExpiryTestRowTimeout) != 1);
+    FAIL_IF(expiry_test_checked != 1);
+    FAIL_IF(t.block_next[2] != EXPIRY_NEVER);
+
+    ts.tv_sec = 200;
+    expiry_test_checked = 0;
+    FAIL_IF(ExpiryTimeout(&t, &ts, ExpiryTestRowTimeout) != 1);
+    FAIL_IF(expiry_test_checked != 1);
+    FAIL_IF(t.block_next[0] != EXPIRY_NEVER);
+
+    ExpiryTableFree(&t);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void ExpiryRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ExpiryTest01", ExpiryTest01);
+#endif /* UNITTESTS */
+}
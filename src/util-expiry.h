@@ -0,0 +1,89 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Expiry tracking for the rows of a hash table.
+ *
+ * Each row has the earliest time (in seconds) at which one of its
+ * entries may time out, and each block of EXPIRY_BLOCK_ROWS rows the
+ * earliest time of its rows. A timeout pass only visits the blocks and
+ * rows that are due, instead of locking every row of the table.
+ *
+ * The times are hints: they may be earlier than needed, never later.
+ * Users arm a row when an entry in it is added or used, and the timeout
+ * callback returns when the row needs to be looked at again.
+ */
+
+#ifndef __UTIL_EXPIRY_H__
+#define __UTIL_EXPIRY_H__
+
+#include "util-atomic.h"
+
+#define EXPIRY_BLOCK_ROWS   64
+/** row has no entries */
+#define EXPIRY_NEVER        UINT32_MAX
+
+typedef struct ExpiryTable_ {
+    uint32_t *row_next;     /**< per row: earliest expiry of its entries */
+    uint32_t *block_next;   /**< per block: earliest row_next */
+    uint32_t rows;
+    uint32_t blocks;
+} ExpiryTable;
+
+/**
+ *  \brief time out the entries of a due hash row
+ *
+ *  \param row the row
+ *  \param ts current time
+ *  \param cnt[out] incremented for each timed out entry
+ *
+ *  \retval next time to check the row again, EXPIRY_NEVER if it's empty
+ */
+typedef uint32_t (*ExpiryRowTimeoutFunc)(uint32_t row, struct timeval *ts,
+        uint32_t *cnt);
+
+static inline void ExpiryAtomicMin(uint32_t *ptr, uint32_t v)
+{
+    uint32_t cur = *(volatile uint32_t *)ptr;
+    while (v < cur) {
+        if (SCAtomicCompareAndSwap(ptr, cur, v))
+            break;
+        cur = *(volatile uint32_t *)ptr;
+    }
+}
+
+/**
+ *  \brief have a row checked once 'when' has passed
+ *
+ *  \param when time in seconds, 0 to check at the next pass
+ */
+static inline void ExpiryArm(ExpiryTable *t, uint32_t row, uint32_t when)
+{
+    ExpiryAtomicMin(&t->row_next[row], when);
+    ExpiryAtomicMin(&t->block_next[row / EXPIRY_BLOCK_ROWS], when);
+}
+
+int ExpiryTableInit(ExpiryTable *t, uint32_t rows);
+void ExpiryTableFree(ExpiryTable *t);
+uint64_t ExpiryTableMemuse(const ExpiryTable *t);
+uint32_t ExpiryTimeout(ExpiryTable *t, struct timeval *ts,
+        ExpiryRowTimeoutFunc RowTimeout);
+void ExpiryRegisterTests(void);
+
+#endif /* __UTIL_EXPIRY_H__ */
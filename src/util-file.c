@@ -35,6 +35,7 @@
 #include "util-print.h"
 #include "app-layer-parser.h"
 #include "util-validate.h"
+#include "detect.h"
 
 /** \brief switch to force filestore on all files
  *         regardless of the rules.
@@ -51,14 +52,37 @@ static int g_file_force_magic = 0;
  */
 static int g_file_force_md5 = 0;
 
+/** \brief switches to force sha1 and sha256 calculation on all files
+ *         regardless of the rules.
+ */
+static int g_file_force_sha1 = 0;
+static int g_file_force_sha256 = 0;
+
+/** \brief hashes used by the rules, FILE_SIG_NEED_* flags. Set when a
+ *         rule using them is loaded, never cleared. Hashes that are
+ *         neither needed nor forced are not calculated. */
+static uint16_t g_file_need_hash = 0;
+
 /** \brief switch to force tracking off all files
  *         regardless of the rules.
  */
 static int g_file_force_tracking = 0;
 
+/** \brief set by the memcap policy: don't hash new files */
+SC_ATOMIC_DECLARE(int, g_file_hash_shed);
+
 /* prototypes */
 static void FileFree(File *);
 
+/** \brief stop or resume hashing of new files under memcap pressure
+ *
+ *  Files already being hashed are completed.
+ */
+void FileHashShed(int shed)
+{
+    SC_ATOMIC_SET(g_file_hash_shed, shed);
+}
+
 void FileForceFilestoreEnable(void)
 {
     g_file_force_filestore = 1;
@@ -89,11 +113,86 @@ int FileForceMd5(void)
     return g_file_force_md5;
 }
 
+void FileForceSha1Enable(void)
+{
+    g_file_force_sha1 = 1;
+}
+
+int FileForceSha1(void)
+{
+    return g_file_force_sha1;
+}
+
+void FileForceSha256Enable(void)
+{
+    g_file_force_sha256 = 1;
+}
+
+int FileForceSha256(void)
+{
+    return g_file_force_sha256;
+}
+
+/** \retval 1 if any of the file hashes is forced */
+int FileForceHash(void)
+{
+    return (g_file_force_md5 || g_file_force_sha1 || g_file_force_sha256);
+}
+
+/**
+ *  \brief Register that loaded rules need a file hash
+ *
+ *  \param flags FILE_SIG_NEED_MD5, FILE_SIG_NEED_SHA1 and/or
+ *               FILE_SIG_NEED_SHA256
+ */
+void FileNeedHashEnable(uint16_t flags)
+{
+    g_file_need_hash |= flags;
+}
+
+/**
+ *  \brief parse the force-md5, force-sha1 and force-sha256 options of
+ *         a file output
+ */
+void FileForceHashParseCfg(ConfNode *conf)
+{
+    static const struct {
+        const char *name;
+        void (*Enable)(void);
+    } hashes[] = {
+        { "md5", FileForceMd5Enable },
+        { "sha1", FileForceSha1Enable },
+        { "sha256", FileForceSha256Enable },
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+        char opt[32];
+        snprintf(opt, sizeof(opt), "force-%s", hashes[i].name);
+
+        const char *force = ConfNodeLookupChildValue(conf, opt);
+        if (force != NULL && ConfValIsTrue(force)) {
+#ifdef HAVE_NSS
+            hashes[i].Enable();
+            SCLogConfig("forcing %s calculation for files", hashes[i].name);
+#else
+            SCLogInfo("%s calculation requires linking against libnss",
+                    hashes[i].name);
+#endif
+        }
+    }
+}
+
 void FileForceTrackingEnable(void)
 {
     g_file_force_tracking = 1;
 }
 
+int FileForceTracking(void)
+{
+    return g_file_force_tracking;
+}
+
 int FileMagicSize(void)
 {
     /** \todo make this size configurable */
@@ -270,6 +369,92 @@ static File *FileAlloc(const uint8_t *name, uint16_t name_len)
     return new;
 }
 
+#ifdef HAVE_NSS
+/** \internal
+ *  \brief set up the hashes this file needs
+ */
+static void FileHashInit(File *ff)
+{
+    if (SC_ATOMIC_GET(g_file_hash_shed))
+        return;
+
+    const int hash = !(ff->flags & FILE_NOMD5);
+
+    if (g_file_force_md5 || (hash && (g_file_need_hash & FILE_SIG_NEED_MD5))) {
+        ff->md5_ctx = HASH_Create(HASH_AlgMD5);
+        if (ff->md5_ctx != NULL)
+            HASH_Begin(ff->md5_ctx);
+    }
+    if (g_file_force_sha1 || (hash && (g_file_need_hash & FILE_SIG_NEED_SHA1))) {
+        ff->sha1_ctx = HASH_Create(HASH_AlgSHA1);
+        if (ff->sha1_ctx != NULL)
+            HASH_Begin(ff->sha1_ctx);
+    }
+    if (g_file_force_sha256 || (hash && (g_file_need_hash & FILE_SIG_NEED_SHA256))) {
+        ff->sha256_ctx = HASH_Create(HASH_AlgSHA256);
+        if (ff->sha256_ctx != NULL)
+            HASH_Begin(ff->sha256_ctx);
+    }
+}
+
+/** \internal
+ *  \brief update all hashes of the file with a chunk
+ *
+ *  \retval 1 if the file is hashed
+ */
+static inline int FileHashUpdate(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    int hashed = 0;
+    if (ff->md5_ctx) {
+        HASH_Update(ff->md5_ctx, data, data_len);
+        hashed = 1;
+    }
+    if (ff->sha1_ctx) {
+        HASH_Update(ff->sha1_ctx, data, data_len);
+        hashed = 1;
+    }
+    if (ff->sha256_ctx) {
+        HASH_Update(ff->sha256_ctx, data, data_len);
+        hashed = 1;
+    }
+    return hashed;
+}
+
+static void FileHashEnd(File *ff)
+{
+    unsigned int len = 0;
+
+    if (ff->md5_ctx) {
+        HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
+        ff->flags |= FILE_MD5;
+    }
+    if (ff->sha1_ctx) {
+        HASH_End(ff->sha1_ctx, ff->sha1, &len, sizeof(ff->sha1));
+        ff->flags |= FILE_SHA1;
+    }
+    if (ff->sha256_ctx) {
+        HASH_End(ff->sha256_ctx, ff->sha256, &len, sizeof(ff->sha256));
+        ff->flags |= FILE_SHA256;
+    }
+}
+
+static void FileHashDestroy(File *ff)
+{
+    if (ff->md5_ctx != NULL) {
+        HASH_Destroy(ff->md5_ctx);
+        ff->md5_ctx = NULL;
+    }
+    if (ff->sha1_ctx != NULL) {
+        HASH_Destroy(ff->sha1_ctx);
+        ff->sha1_ctx = NULL;
+    }
+    if (ff->sha256_ctx != NULL) {
+        HASH_Destroy(ff->sha256_ctx);
+        ff->sha256_ctx = NULL;
+    }
+}
+#endif /* HAVE_NSS */
+
 static void FileFree(File *ff)
 {
     if (ff == NULL)
@@ -287,8 +472,7 @@ static void FileFree(File *ff)
     }
 
 #ifdef HAVE_NSS
-    if (ff->md5_ctx)
-        HASH_Destroy(ff->md5_ctx);
+    FileHashDestroy(ff);
 #endif
     SCFree(ff);
 }
@@ -360,9 +544,7 @@ static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
     StreamingBufferAppendNoTrack(file->sb, data, data_len);
 
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
-    }
+    (void)FileHashUpdate(file, data, data_len);
 #endif
     SCReturnInt(0);
 }
@@ -396,11 +578,8 @@ int FileAppendData(FileContainer *ffc, const uint8_t *data, uint32_t data_len)
 
     if (FileStoreNoStoreCheck(ffc->tail) == 1) {
 #ifdef HAVE_NSS
-        /* no storage but forced md5 */
-        if (ffc->tail->md5_ctx) {
-            if (ffc->tail->md5_ctx)
-                HASH_Update(ffc->tail->md5_ctx, data, data_len);
-
+        /* no storage but forced hashing */
+        if (FileHashUpdate(ffc->tail, data, data_len)) {
             SCReturnInt(0);
         }
 #endif
@@ -477,12 +656,7 @@ File *FileOpenFile(FileContainer *ffc, const StreamingBufferConfig *sbcfg,
     }
 
 #ifdef HAVE_NSS
-    if (!(ff->flags & FILE_NOMD5) || g_file_force_md5) {
-        ff->md5_ctx = HASH_Create(HASH_AlgMD5);
-        if (ff->md5_ctx != NULL) {
-            HASH_Begin(ff->md5_ctx);
-        }
-    }
+    FileHashInit(ff);
 #endif
 
     ff->state = FILE_STATE_OPENED;
@@ -517,9 +691,8 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
     if (data != NULL) {
         if (ff->flags & FILE_NOSTORE) {
 #ifdef HAVE_NSS
-            /* no storage but md5 */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
+            /* no storage but hashing */
+            (void)FileHashUpdate(ff, data, data_len);
 #endif
         } else {
             if (AppendData(ff, data, data_len) != 0) {
@@ -542,11 +715,7 @@ static int FileCloseFilePtr(File *ff, const uint8_t *data,
         SCLogDebug("flowfile state transitioned to FILE_STATE_CLOSED");
 
 #ifdef HAVE_NSS
-        if (ff->md5_ctx) {
-            unsigned int len = 0;
-            HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
-            ff->flags |= FILE_MD5;
-        }
+        FileHashEnd(ff);
 #endif
     }
 
@@ -644,7 +813,7 @@ void FileDisableMagic(Flow *f, uint8_t direction)
 }
 
 /**
- *  \brief disable file md5 calc for this flow
+ *  \brief disable file md5, sha1 and sha256 calc for this flow
  *
  *  \param f *LOCKED* flow
  *  \param direction flow direction
@@ -665,16 +834,24 @@ void FileDisableMd5(Flow *f, uint8_t direction)
     FileContainer *ffc = AppLayerParserGetFiles(f->proto, f->alproto, f->alstate, direction);
     if (ffc != NULL) {
         for (ptr = ffc->head; ptr != NULL; ptr = ptr->next) {
-            SCLogDebug("disabling md5 for file %p from direction %s",
+            SCLogDebug("disabling hashing for file %p from direction %s",
                     ptr, direction == STREAM_TOSERVER ? "toserver":"toclient");
             ptr->flags |= FILE_NOMD5;
 
 #ifdef HAVE_NSS
-            /* destroy any ctx we may have so far */
-            if (ptr->md5_ctx != NULL) {
+            /* destroy any ctx we may have so far, unless forced */
+            if (ptr->md5_ctx != NULL && !g_file_force_md5) {
                 HASH_Destroy(ptr->md5_ctx);
                 ptr->md5_ctx = NULL;
             }
+            if (ptr->sha1_ctx != NULL && !g_file_force_sha1) {
+                HASH_Destroy(ptr->sha1_ctx);
+                ptr->sha1_ctx = NULL;
+            }
+            if (ptr->sha256_ctx != NULL && !g_file_force_sha256) {
+                HASH_Destroy(ptr->sha256_ctx);
+                ptr->sha256_ctx = NULL;
+            }
 #endif
         }
     }
@@ -713,6 +890,28 @@ void FileDisableFilesize(Flow *f, uint8_t direction)
     SCReturn;
 }
 
+/**
+ *  \brief disable file_data inspection for this flow
+ *
+ *  Only flags the flow: parsers use it to decide if they need to produce
+ *  the content of files at all.
+ *
+ *  \param f *LOCKED* flow
+ *  \param direction flow direction
+ */
+void FileDisableFiledata(Flow *f, uint8_t direction)
+{
+    SCEnter();
+
+    DEBUG_ASSERT_FLOW_LOCKED(f);
+
+    if (direction == STREAM_TOSERVER)
+        f->flags |= FLOW_FILE_NO_DATA_TS;
+    else
+        f->flags |= FLOW_FILE_NO_DATA_TC;
+
+    SCReturn;
+}
 
 /**
  *  \brief set no store flag, close file if needed
@@ -731,7 +930,7 @@ void FileDisableStoringForFile(File *ff)
     ff->flags |= FILE_NOSTORE;
 
     if (ff->state == FILE_STATE_OPENED && FileSize(ff) >= (uint64_t)FileMagicSize()) {
-        if (g_file_force_md5 == 0 && g_file_force_tracking == 0) {
+        if (FileForceHash() == 0 && g_file_force_tracking == 0) {
             (void)FileCloseFilePtr(ff, NULL, 0,
                     (FILE_TRUNCATED|FILE_NOSTORE));
         }
@@ -29,11 +29,12 @@
 #include <sechash.h>
 #endif
 
+#include "conf.h"
 #include "util-streaming-buffer.h"
 
 #define FILE_TRUNCATED  0x0001
 #define FILE_NOMAGIC    0x0002
-#define FILE_NOMD5      0x0004
+#define FILE_NOMD5      0x0004 /**< no hashing at all, not just md5 */
 #define FILE_MD5        0x0008
 #define FILE_LOGGED     0x0010
 #define FILE_NOSTORE    0x0020
@@ -41,6 +42,8 @@
 #define FILE_STORED     0x0080
 #define FILE_NOTRACK    0x0100 /**< track size of file */
 #define FILE_USE_DETECT 0x0200 /**< use content_inspected tracker */
+#define FILE_SHA1       0x0400
+#define FILE_SHA256     0x0800
 
 typedef enum FileState_ {
     FILE_STATE_NONE = 0,    /**< no state */
@@ -66,6 +69,10 @@ typedef struct File_ {
 #ifdef HAVE_NSS
     HASHContext *md5_ctx;
     uint8_t md5[MD5_LENGTH];
+    HASHContext *sha1_ctx;
+    uint8_t sha1[SHA1_LENGTH];
+    HASHContext *sha256_ctx;
+    uint8_t sha256[SHA256_LENGTH];
 #endif
     uint64_t content_inspected;     /**< used in pruning if FILE_USE_DETECT
                                      *   flag is set */
@@ -158,6 +165,7 @@ int FileSetTx(File *, uint64_t txid);
 void FileDisableStoring(struct Flow_ *, uint8_t);
 
 void FileDisableFilesize(Flow *f, uint8_t direction);
+void FileDisableFiledata(Flow *f, uint8_t direction);
 
 /**
  *  \brief disable file storing for a transaction
@@ -180,8 +188,17 @@ int FileForceMagic(void);
 void FileDisableMd5(Flow *f, uint8_t);
 void FileForceMd5Enable(void);
 int FileForceMd5(void);
+void FileForceSha1Enable(void);
+int FileForceSha1(void);
+void FileForceSha256Enable(void);
+int FileForceSha256(void);
+int FileForceHash(void);
+void FileForceHashParseCfg(ConfNode *);
+void FileNeedHashEnable(uint16_t);
+void FileHashShed(int shed);
 
 void FileForceTrackingEnable(void);
+int FileForceTracking(void);
 
 void FileStoreAllFiles(FileContainer *);
 void FileStoreAllFilesForTx(FileContainer *, uint64_t);
@@ -0,0 +1,348 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Algorithm selection, seeding, tests and benchmarks for the table hashes.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-random.h"
+#include "util-hash-fast.h"
+#include "util-unittest.h"
+#include "util-bench.h"
+
+static const char *hash_fast_names[HASH_FAST_MAX] = {
+    "lookup3",
+    "crc32c",
+    "mum",
+};
+
+const char *HashFastAlgoName(const int algo)
+{
+    if (algo < 0 || algo >= HASH_FAST_MAX)
+        return "unknown";
+    return hash_fast_names[algo];
+}
+
+static int HashFastAlgoBuiltIn(const int algo)
+{
+    switch (algo) {
+        case HASH_FAST_LOOKUP3:
+            return 1;
+        case HASH_FAST_CRC32C:
+#ifdef HASH_FAST_HAVE_CRC32C
+            return 1;
+#else
+            return 0;
+#endif
+        case HASH_FAST_MUM:
+#ifdef HASH_FAST_HAVE_MUM
+            return 1;
+#else
+            return 0;
+#endif
+    }
+    return 0;
+}
+
+/**
+ *  \brief get the algorithm set by 'hash-algorithm'
+ *
+ *  Each table gets it once at init and keeps it with its seed.
+ *
+ *  \retval algo HashFastAlgo, lookup3 if not set, unknown or not built in
+ */
+int HashFastGetAlgo(void)
+{
+    char *val = NULL;
+    if (ConfGet("hash-algorithm", &val) != 1 || val == NULL)
+        return HASH_FAST_LOOKUP3;
+
+    int algo;
+    for (algo = 0; algo < HASH_FAST_MAX; algo++) {
+        if (strcasecmp(val, hash_fast_names[algo]) == 0)
+            break;
+    }
+    if (algo == HASH_FAST_MAX) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hash-algorithm: unknown "
+                "value \"%s\", using lookup3", val);
+        return HASH_FAST_LOOKUP3;
+    }
+    if (!HashFastAlgoBuiltIn(algo)) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hash-algorithm: \"%s\" not "
+                "supported by this build, using lookup3", val);
+        return HASH_FAST_LOOKUP3;
+    }
+    return algo;
+}
+
+/**
+ *  \brief get a random seed for a hash table
+ *
+ *  Uses the kernel's random source, so the seed can't be guessed from the
+ *  start time. Falls back to rand_r() seeded with the time.
+ */
+uint32_t HashFastRandomSeed(void)
+{
+    uint32_t seed = 0;
+
+    FILE *fp = fopen("/dev/urandom", "r");
+    if (fp != NULL) {
+        size_t r = fread(&seed, sizeof(seed), 1, fp);
+        fclose(fp);
+        if (r == 1)
+            return seed;
+    }
+
+    unsigned int s = RandomTimePreseed() ^ (unsigned int)getpid();
+    seed = (uint32_t)rand_r(&s) << 16;
+    seed ^= (uint32_t)rand_r(&s);
+    return seed;
+}
+
+#if defined(UNITTESTS) || defined(BENCHMARKS)
+/** \internal
+ *  \brief fill a 6 word ipv4 flow key for tuple 'idx' */
+static void HashFastTestKey4(uint32_t *k, uint32_t idx)
+{
+    k[0] = htonl(0x0a000000 | (idx >> 6));
+    k[1] = htonl(0xc0a80001);
+    k[2] = ((uint32_t)(1024 + (idx & 0x3f)) << 16) | 80;
+    k[3] = IPPROTO_TCP;
+    k[4] = 0;
+    k[5] = 0;
+}
+
+/** \internal
+ *  \brief fill a 12 word ipv6 flow key for tuple 'idx' */
+static void HashFastTestKey6(uint32_t *k, uint32_t idx)
+{
+    k[0] = htonl(0x20010db8);
+    k[1] = 0;
+    k[2] = 0;
+    k[3] = htonl(idx >> 6);
+    k[4] = htonl(0x20010db8);
+    k[5] = 0;
+    k[6] = 0;
+    k[7] = htonl(1);
+    k[8] = ((uint32_t)(1024 + (idx & 0x3f)) << 16) | 443;
+    k[9] = IPPROTO_TCP;
+    k[10] = 0;
+    k[11] = 0;
+}
+
+/** \internal
+ *  \brief put 'keys' tuples in 'buckets' buckets
+ *
+ *  \retval max the size of the fullest bucket */
+static uint32_t HashFastDistribution(int algo, int v6, uint32_t seed,
+        uint32_t keys, uint32_t buckets, double *chi2)
+{
+    uint32_t *cnt = SCCalloc(buckets, sizeof(uint32_t));
+    if (cnt == NULL)
+        return UINT32_MAX;
+
+    uint32_t k[12];
+    uint32_t i;
+    for (i = 0; i < keys; i++) {
+        uint32_t h;
+        if (v6) {
+            HashFastTestKey6(k, i);
+            h = HashFastWords(algo, k, 12, seed);
+        } else {
+            HashFastTestKey4(k, i);
+            h = HashFastWords(algo, k, 6, seed);
+        }
+        cnt[h % buckets]++;
+    }
+
+    double expected = (double)keys / buckets;
+    double x = 0;
+    uint32_t max = 0;
+    for (i = 0; i < buckets; i++) {
+        double d = cnt[i] - expected;
+        x += d * d / expected;
+        if (cnt[i] > max)
+            max = cnt[i];
+    }
+    SCFree(cnt);
+    if (chi2 != NULL)
+        *chi2 = x;
+    return max;
+}
+#endif /* UNITTESTS || BENCHMARKS */
+
+#ifdef UNITTESTS
+/** \test every algorithm is stable and depends on the seed and the key */
+static int HashFastTest01(void)
+{
+    uint32_t k[12];
+    int algo;
+
+    for (algo = 0; algo < HASH_FAST_MAX; algo++) {
+        HashFastTestKey6(k, 1);
+        uint32_t h1 = HashFastWords(algo, k, 12, 1234);
+        uint32_t h2 = HashFastWords(algo, k, 12, 1234);
+        uint32_t h3 = HashFastWords(algo, k, 12, 4321);
+        HashFastTestKey6(k, 2);
+        uint32_t h4 = HashFastWords(algo, k, 12, 1234);
+        if (h1 != h2 || h1 == h3 || h1 == h4) {
+            printf("%s: %08x %08x %08x %08x: ", HashFastAlgoName(algo),
+                    h1, h2, h3, h4);
+            return 0;
+        }
+        /* odd length uses the tail */
+        uint32_t h5 = HashFastWords(algo, k, 11, 1234);
+        k[10] = 1;
+        if (h5 == HashFastWords(algo, k, 11, 1234)) {
+            printf("%s: tail word ignored: ", HashFastAlgoName(algo));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** \test sequential tuples spread evenly over the buckets */
+static int HashFastTest02(void)
+{
+    int algo, v6;
+
+    for (algo = 0; algo < HASH_FAST_MAX; algo++) {
+        for (v6 = 0; v6 <= 1; v6++) {
+            double chi2 = 0;
+            /* on average 16 per bucket */
+            uint32_t max = HashFastDistribution(algo, v6, 0x5eed,
+                    65536, 4096, &chi2);
+            if (max > 48 || chi2 > 4096 * 1.5) {
+                printf("%s v6 %d: max %u chi2 %f: ", HashFastAlgoName(algo),
+                        v6, max, chi2);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int HashFastTest03(void)
+{
+    int result = 0;
+    ConfCreateContextBackup();
+    ConfInit();
+
+    if (HashFastGetAlgo() != HASH_FAST_LOOKUP3)
+        goto end;
+    ConfSet("hash-algorithm", "bogus");
+    if (HashFastGetAlgo() != HASH_FAST_LOOKUP3)
+        goto end;
+    ConfSet("hash-algorithm", "crc32c");
+    if (HashFastGetAlgo() != (HashFastAlgoBuiltIn(HASH_FAST_CRC32C) ?
+                HASH_FAST_CRC32C : HASH_FAST_LOOKUP3))
+        goto end;
+    ConfSet("hash-algorithm", "mum");
+    if (HashFastGetAlgo() != (HashFastAlgoBuiltIn(HASH_FAST_MUM) ?
+                HASH_FAST_MUM : HASH_FAST_LOOKUP3))
+        goto end;
+
+    result = 1;
+end:
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return result;
+}
+#endif /* UNITTESTS */
+
+void HashFastRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashFastTest01", HashFastTest01);
+    UtRegisterTest("HashFastTest02", HashFastTest02);
+    UtRegisterTest("HashFastTest03", HashFastTest03);
+#endif /* UNITTESTS */
+}
+
+#ifdef BENCHMARKS
+typedef struct HashFastBench_ {
+    int algo;
+    int v6;
+} HashFastBench;
+
+static HashFastBench hash_fast_benches[HASH_FAST_MAX * 2];
+static volatile uint32_t hash_fast_bench_sink;
+
+/** \internal
+ *  \brief hash flow keys, logs the spread over a 64k bucket table first */
+static int HashFastBenchWords(BenchCtx *b)
+{
+    const HashFastBench *hb = b->data;
+    uint32_t seed = HashFastRandomSeed();
+    uint32_t len = hb->v6 ? 12 : 6;
+
+    double chi2 = 0;
+    uint32_t max = HashFastDistribution(hb->algo, hb->v6, seed,
+            1048576, 65536, &chi2);
+    SCLogInfo("%s/%s: 1M keys in 64k buckets: max %u, chi2 %.1f "
+            "(%.3f of expected)", HashFastAlgoName(hb->algo),
+            hb->v6 ? "ipv6" : "ipv4", max, chi2, chi2 / 65535);
+
+    uint32_t k[12];
+    if (hb->v6)
+        HashFastTestKey6(k, 0);
+    else
+        HashFastTestKey4(k, 0);
+
+    uint32_t sum = 0;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        /* change the source like a new packet would */
+        k[hb->v6 ? 3 : 0] = (uint32_t)n;
+        sum += HashFastWords(hb->algo, k, len, seed);
+    }
+    BenchTimerStop(b);
+
+    /* keep the loop from being optimized out */
+    hash_fast_bench_sink = sum;
+    return 1;
+}
+#endif /* BENCHMARKS */
+
+/** \brief register throughput benchmarks of each built in algorithm for
+ *         ipv4 and ipv6 flow keys */
+void HashFastRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    int algo, v6, cnt = 0;
+    for (algo = 0; algo < HASH_FAST_MAX; algo++) {
+        if (!HashFastAlgoBuiltIn(algo))
+            continue;
+        for (v6 = 0; v6 <= 1; v6++) {
+            HashFastBench *hb = &hash_fast_benches[cnt++];
+            hb->algo = algo;
+            hb->v6 = v6;
+
+            char name[64];
+            snprintf(name, sizeof(name), "hash/%s/%s", HashFastAlgoName(algo),
+                    v6 ? "ipv6" : "ipv4");
+            BenchRegister(name, HashFastBenchWords, hb);
+        }
+    }
+#endif /* BENCHMARKS */
+}
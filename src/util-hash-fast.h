@@ -0,0 +1,137 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Seeded hashes over short keys of 32 bit words, for the flow, host,
+ * ippair and defrag tables.
+ *
+ * - lookup3: Bob Jenkins' hashword(), the default.
+ * - crc32c: the SSE4.2 crc32 instruction, 8 bytes per cycle or so, with a
+ *   murmur3 finalizer for the avalanche. CRC is linear, so the seed does
+ *   not keep others from crafting keys that collide.
+ * - mum: 64 bit multiply and fold of the key and the seed, the mixing of
+ *   wyhash. Needs 128 bit integer support.
+ */
+
+#ifndef __UTIL_HASH_FAST_H__
+#define __UTIL_HASH_FAST_H__
+
+#include "util-hash-lookup3.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+typedef enum HashFastAlgo_ {
+    HASH_FAST_LOOKUP3 = 0,
+    HASH_FAST_CRC32C,
+    HASH_FAST_MUM,
+    HASH_FAST_MAX,
+} HashFastAlgo;
+
+#if defined(__SSE4_2__)
+#define HASH_FAST_HAVE_CRC32C 1
+#endif
+#if defined(__SIZEOF_INT128__)
+#define HASH_FAST_HAVE_MUM 1
+#endif
+
+#define HASH_MUM_P0 0xa0761d6478bd642fULL
+#define HASH_MUM_P1 0xe7037ed1a0b428dbULL
+
+static inline uint32_t HashFastFmix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifdef HASH_FAST_HAVE_CRC32C
+static inline uint32_t HashFastCrc32c(const uint32_t *k, uint32_t len, uint32_t seed)
+{
+    uint64_t crc = seed;
+    uint32_t i = 0;
+    for ( ; i + 2 <= len; i += 2) {
+        uint64_t v;
+        memcpy(&v, &k[i], sizeof(v));
+        crc = _mm_crc32_u64(crc, v);
+    }
+    if (i < len)
+        crc = _mm_crc32_u32((uint32_t)crc, k[i]);
+    return HashFastFmix32((uint32_t)crc);
+}
+#endif
+
+#ifdef HASH_FAST_HAVE_MUM
+static inline uint64_t HashFastMumMix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint32_t HashFastMum(const uint32_t *k, uint32_t len, uint32_t seed)
+{
+    uint64_t h = (uint64_t)seed ^ HASH_MUM_P0;
+    uint32_t i = 0;
+    for ( ; i + 2 <= len; i += 2) {
+        uint64_t v;
+        memcpy(&v, &k[i], sizeof(v));
+        h = HashFastMumMix(v ^ HASH_MUM_P1, h);
+    }
+    if (i < len)
+        h = HashFastMumMix((uint64_t)k[i] ^ HASH_MUM_P1, h);
+    h = HashFastMumMix(h ^ HASH_MUM_P0, (uint64_t)len ^ HASH_MUM_P1);
+    return (uint32_t)(h ^ (h >> 32));
+}
+#endif
+
+/**
+ *  \brief hash 'len' words of 'k'
+ *
+ *  \param algo algorithm from HashFastGetAlgo(), one not built in falls
+ *              back to lookup3
+ */
+static inline uint32_t HashFastWords(const int algo, const uint32_t *k,
+        const uint32_t len, const uint32_t seed)
+{
+    switch (algo) {
+#ifdef HASH_FAST_HAVE_CRC32C
+        case HASH_FAST_CRC32C:
+            return HashFastCrc32c(k, len, seed);
+#endif
+#ifdef HASH_FAST_HAVE_MUM
+        case HASH_FAST_MUM:
+            return HashFastMum(k, len, seed);
+#endif
+        default:
+            return hashword(k, len, seed);
+    }
+}
+
+int HashFastGetAlgo(void);
+const char *HashFastAlgoName(const int algo);
+uint32_t HashFastRandomSeed(void);
+
+void HashFastRegisterTests(void);
+void HashFastRegisterBenchmarks(void);
+
+#endif /* __UTIL_HASH_FAST_H__ */
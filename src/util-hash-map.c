@@ -0,0 +1,288 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Tests and benchmarks for the typed open addressing maps.
+ */
+
+#include "suricata-common.h"
+#include "util-hash.h"
+#include "util-hash-map.h"
+#include "util-unittest.h"
+#include "util-bench.h"
+
+#if defined(UNITTESTS) || defined(BENCHMARKS)
+HASH_MAP_DEFINE(HashMapTestU32, uint32_t, uint32_t, HashMapHashU32, HashMapCompareU32)
+#endif
+
+#ifdef UNITTESTS
+/** \internal \brief a poor hash, all keys start at the last two of the
+ *         16 slots, so their run wraps around the end */
+static inline uint32_t HashMapTestPoorHash(const uint32_t *k)
+{
+    return 14 + (*k & 0x1);
+}
+
+HASH_MAP_DEFINE(HashMapTestBad, uint32_t, uint32_t, HashMapTestPoorHash, HashMapCompareU32)
+
+static int HashMapTest01(void)
+{
+    HashMapTestU32 m;
+    uint32_t k, v;
+    int result = 0;
+
+    if (HashMapTestU32Init(&m, 100) != 0)
+        return 0;
+    if (m.mask + 1 != 256) {
+        printf("%u slots for 100, expected 256: ", m.mask + 1);
+        goto end;
+    }
+
+    for (k = 0; k < 1000; k++) {
+        v = k * 3;
+        if (HashMapTestU32Add(&m, &k, &v) != 0)
+            goto end;
+    }
+    if (m.cnt != 1000 || (m.mask + 1) * 3 < m.cnt * 4) {
+        printf("cnt %u slots %u: ", m.cnt, m.mask + 1);
+        goto end;
+    }
+    for (k = 0; k < 1000; k++) {
+        uint32_t *r = HashMapTestU32Lookup(&m, &k);
+        if (r == NULL || *r != k * 3) {
+            printf("key %u: ", k);
+            goto end;
+        }
+    }
+    k = 1000;
+    if (HashMapTestU32Lookup(&m, &k) != NULL)
+        goto end;
+
+    /* add of an existing key updates it */
+    k = 5;
+    v = 1;
+    if (HashMapTestU32Add(&m, &k, &v) != 0 || m.cnt != 1000 ||
+        *HashMapTestU32Lookup(&m, &k) != 1)
+        goto end;
+
+    result = 1;
+end:
+    HashMapTestU32Free(&m);
+    return result;
+}
+
+/** \test removal from the middle of a collision run keeps the rest
+ *        reachable, also when the run wraps around the end */
+static int HashMapTest02(void)
+{
+    HashMapTestBad m;
+    uint32_t k, v = 0;
+    int result = 0;
+
+    if (HashMapTestBadInit(&m, 0) != 0)
+        return 0;
+
+    for (k = 0; k < 11; k++) {
+        if (HashMapTestBadAdd(&m, &k, &k) != 0)
+            goto end;
+    }
+    k = 15;
+    if (HashMapTestBadAdd(&m, &k, &v) != 0)
+        goto end;
+    if (m.mask + 1 != HASH_MAP_MIN_SIZE)
+        goto end;
+
+    for (k = 0; k < 11; k += 2) {
+        if (HashMapTestBadRemove(&m, &k) != 1) {
+            printf("remove %u: ", k);
+            goto end;
+        }
+        if (HashMapTestBadRemove(&m, &k) != 0)
+            goto end;
+    }
+    for (k = 0; k < 11; k++) {
+        uint32_t *r = HashMapTestBadLookup(&m, &k);
+        if ((k % 2) == 0 && r != NULL) {
+            printf("removed key %u found: ", k);
+            goto end;
+        }
+        if ((k % 2) == 1 && (r == NULL || *r != k)) {
+            printf("key %u lost: ", k);
+            goto end;
+        }
+    }
+    k = 15;
+    if (HashMapTestBadLookup(&m, &k) == NULL)
+        goto end;
+    if (m.cnt != 6)
+        goto end;
+
+    result = 1;
+end:
+    HashMapTestBadFree(&m);
+    return result;
+}
+
+/** \test iteration visits every entry once */
+static int HashMapTest03(void)
+{
+    HashMapTestU32 m;
+    uint32_t k, iter = 0;
+    uint8_t seen[64];
+    int result = 0;
+
+    memset(seen, 0x00, sizeof(seen));
+    memset(&m, 0x00, sizeof(m));
+    /* a zeroed map is empty and usable */
+    if (HashMapTestU32Next(&m, &iter) != NULL)
+        return 0;
+
+    for (k = 0; k < 64; k++) {
+        if (HashMapTestU32Add(&m, &k, &k) != 0)
+            goto end;
+    }
+    HashMapTestU32Entry *e;
+    iter = 0;
+    while ((e = HashMapTestU32Next(&m, &iter)) != NULL) {
+        if (e->key >= 64 || e->val != e->key || seen[e->key]++)
+            goto end;
+    }
+    for (k = 0; k < 64; k++) {
+        if (seen[k] != 1)
+            goto end;
+    }
+
+    result = 1;
+end:
+    HashMapTestU32Free(&m);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void HashMapRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HashMapTest01", HashMapTest01);
+    UtRegisterTest("HashMapTest02", HashMapTest02);
+    UtRegisterTest("HashMapTest03", HashMapTest03);
+#endif /* UNITTESTS */
+}
+
+#ifdef BENCHMARKS
+#define HASH_MAP_BENCH_KEYS 65536
+
+static volatile uint32_t hash_map_bench_sink;
+
+/** \internal \brief spread the bench keys over the 32 bit space */
+static inline uint32_t HashMapBenchKey(uint64_t n)
+{
+    return (uint32_t)((n % HASH_MAP_BENCH_KEYS) * 2654435761U);
+}
+
+static int HashMapBenchLookup(BenchCtx *b)
+{
+    HashMapTestU32 m;
+    uint32_t k, i;
+
+    if (HashMapTestU32Init(&m, HASH_MAP_BENCH_KEYS) != 0)
+        return 0;
+    for (i = 0; i < HASH_MAP_BENCH_KEYS; i++) {
+        k = HashMapBenchKey(i);
+        if (HashMapTestU32Add(&m, &k, &i) != 0) {
+            HashMapTestU32Free(&m);
+            return 0;
+        }
+    }
+
+    uint32_t sum = 0;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        k = HashMapBenchKey(n);
+        uint32_t *v = HashMapTestU32Lookup(&m, &k);
+        if (likely(v != NULL))
+            sum += *v;
+    }
+    BenchTimerStop(b);
+
+    hash_map_bench_sink = sum;
+    HashMapTestU32Free(&m);
+    return 1;
+}
+
+static uint32_t HashMapBenchTableHash(HashTable *ht, void *data, uint16_t len)
+{
+    return HashFastFmix32(*(uint32_t *)data) % ht->array_size;
+}
+
+static char HashMapBenchTableCompare(void *d1, uint16_t l1, void *d2, uint16_t l2)
+{
+    return (*(uint32_t *)d1 == *(uint32_t *)d2);
+}
+
+/** \internal \brief the same lookups through a chained HashTable */
+static int HashMapBenchTableLookup(BenchCtx *b)
+{
+    uint32_t *keys = SCMalloc(HASH_MAP_BENCH_KEYS * sizeof(uint32_t));
+    if (keys == NULL)
+        return 0;
+    HashTable *ht = HashTableInit(HASH_MAP_BENCH_KEYS, HashMapBenchTableHash,
+            HashMapBenchTableCompare, NULL);
+    if (ht == NULL) {
+        SCFree(keys);
+        return 0;
+    }
+    uint32_t i;
+    for (i = 0; i < HASH_MAP_BENCH_KEYS; i++) {
+        keys[i] = HashMapBenchKey(i);
+        if (HashTableAdd(ht, &keys[i], sizeof(uint32_t)) != 0)
+            goto error;
+    }
+
+    uint32_t sum = 0;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        uint32_t k = HashMapBenchKey(n);
+        uint32_t *v = HashTableLookup(ht, &k, sizeof(k));
+        if (likely(v != NULL))
+            sum += *v;
+    }
+    BenchTimerStop(b);
+
+    hash_map_bench_sink = sum;
+    HashTableFree(ht);
+    SCFree(keys);
+    return 1;
+error:
+    HashTableFree(ht);
+    SCFree(keys);
+    return 0;
+}
+#endif /* BENCHMARKS */
+
+/** \brief register lookups of 64k 32 bit keys, in a map and, to compare,
+ *         in a HashTable */
+void HashMapRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    BenchRegister("hashmap/u32/lookup", HashMapBenchLookup, NULL);
+    BenchRegister("hashtable/u32/lookup", HashMapBenchTableLookup, NULL);
+#endif /* BENCHMARKS */
+}
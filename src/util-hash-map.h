@@ -0,0 +1,255 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Typed open addressing hash maps.
+ *
+ * HASH_MAP_DEFINE(Name, key type, value type, Hash, Compare) generates a
+ * map type 'Name' with keys and values stored inline in one array, and
+ * static inline functions to use it, so the compiler can inline the hash
+ * and compare functions:
+ *
+ *     int   NameInit(Name *m, uint32_t size);
+ *     void  NameFree(Name *m);
+ *     val  *NameLookup(const Name *m, const key *k);
+ *     int   NameAdd(Name *m, const key *k, const val *v);
+ *     int   NameRemove(Name *m, const key *k);
+ *     NameEntry *NameNext(const Name *m, uint32_t *iter);
+ *
+ * 'Hash' is uint32_t Hash(const key *) and 'Compare' is
+ * int Compare(const key *, const key *), returning 1 if equal.
+ *
+ * Slots are probed linearly. The full hashes are kept in their own array,
+ * so a probe compares keys only on a hash match. Removal shifts the
+ * following entries back, there are no tombstones. The map grows at 3/4
+ * load. Pointers returned by Lookup and Next are valid until the next Add
+ * or Remove. Maps are not locked.
+ */
+
+#ifndef __UTIL_HASH_MAP_H__
+#define __UTIL_HASH_MAP_H__
+
+#include "util-hash-fast.h"
+
+#define HASH_MAP_MIN_SIZE   16
+
+/** \brief number of slots for 'size' entries below the max load */
+static inline uint32_t HashMapSlots(uint32_t size)
+{
+    uint32_t slots = HASH_MAP_MIN_SIZE;
+    while (slots < 0x80000000U && (uint64_t)size * 4 > (uint64_t)slots * 3)
+        slots <<= 1;
+    return slots;
+}
+
+/** \brief hash a 32 bit key */
+static inline uint32_t HashMapHashU32(const uint32_t *k)
+{
+    return HashFastFmix32(*k);
+}
+
+static inline int HashMapCompareU32(const uint32_t *k1, const uint32_t *k2)
+{
+    return (*k1 == *k2);
+}
+
+/** \brief FNV-1a over a nul terminated string */
+static inline uint32_t HashMapHashString(const char *s, uint32_t seed)
+{
+    uint32_t h = 2166136261U ^ seed;
+    for ( ; *s != '\0'; s++) {
+        h ^= (uint8_t)*s;
+        h *= 16777619U;
+    }
+    return HashFastFmix32(h);
+}
+
+#define HASH_MAP_DEFINE(name, key_type, val_type, HashFunc, CompareFunc)    \
+typedef key_type name##Key;                                                 \
+typedef val_type name##Val;                                                 \
+                                                                            \
+typedef struct name##Entry_ {                                               \
+    name##Key key;                                                          \
+    name##Val val;                                                          \
+} name##Entry;                                                              \
+                                                                            \
+typedef struct name##_ {                                                    \
+    uint32_t *hashes;       /**< 0 for a free slot */                       \
+    name##Entry *entries;                                                   \
+    uint32_t mask;          /**< slots - 1 */                               \
+    uint32_t cnt;                                                           \
+} name;                                                                     \
+                                                                            \
+static inline uint32_t name##Hash(const name##Key *k)                       \
+{                                                                           \
+    uint32_t h = HashFunc(k);                                               \
+    return h ? h : 1;                                                       \
+}                                                                           \
+                                                                            \
+static inline int name##Alloc(name *m, uint32_t slots)                      \
+{                                                                           \
+    m->hashes = SCCalloc(slots, sizeof(uint32_t));                          \
+    if (m->hashes == NULL)                                                  \
+        return -1;                                                          \
+    m->entries = SCMalloc(slots * sizeof(name##Entry));                     \
+    if (m->entries == NULL) {                                               \
+        SCFree(m->hashes);                                                  \
+        m->hashes = NULL;                                                   \
+        return -1;                                                          \
+    }                                                                       \
+    m->mask = slots - 1;                                                    \
+    m->cnt = 0;                                                             \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/** \brief set up an empty map with room for 'size' entries */              \
+static inline int name##Init(name *m, uint32_t size)                        \
+{                                                                           \
+    memset(m, 0x00, sizeof(*m));                                            \
+    return name##Alloc(m, HashMapSlots(size));                              \
+}                                                                           \
+                                                                            \
+/** \brief free the map, not what the keys or values point to */            \
+static inline void name##Free(name *m)                                      \
+{                                                                           \
+    if (m->hashes != NULL)                                                  \
+        SCFree(m->hashes);                                                  \
+    if (m->entries != NULL)                                                 \
+        SCFree(m->entries);                                                 \
+    memset(m, 0x00, sizeof(*m));                                            \
+}                                                                           \
+                                                                            \
+/** \internal \brief slot of 'k' or -1 */                                   \
+static inline int64_t name##Find(const name *m, const name##Key *k,         \
+        const uint32_t h)                                                   \
+{                                                                           \
+    uint32_t i = h & m->mask;                                               \
+    while (m->hashes[i] != 0) {                                             \
+        if (m->hashes[i] == h && CompareFunc(&m->entries[i].key, k))        \
+            return i;                                                       \
+        i = (i + 1) & m->mask;                                              \
+    }                                                                       \
+    return -1;                                                              \
+}                                                                           \
+                                                                            \
+/** \retval val pointer to the value of 'k' or NULL */                      \
+static inline name##Val *name##Lookup(const name *m, const name##Key *k)    \
+{                                                                           \
+    if (m->hashes == NULL)                                                  \
+        return NULL;                                                        \
+    int64_t i = name##Find(m, k, name##Hash(k));                            \
+    return (i >= 0) ? &m->entries[i].val : NULL;                            \
+}                                                                           \
+                                                                            \
+/** \internal \brief put an entry in a free slot, the map has room */       \
+static inline void name##Place(name *m, const uint32_t h,                   \
+        const name##Key *k, const name##Val *v)                             \
+{                                                                           \
+    uint32_t i = h & m->mask;                                               \
+    while (m->hashes[i] != 0)                                               \
+        i = (i + 1) & m->mask;                                              \
+    m->hashes[i] = h;                                                       \
+    m->entries[i].key = *k;                                                 \
+    m->entries[i].val = *v;                                                 \
+    m->cnt++;                                                               \
+}                                                                           \
+                                                                            \
+static inline int name##Grow(name *m)                                       \
+{                                                                           \
+    name old = *m;                                                          \
+    if ((old.mask + 1) >= 0x80000000U)                                      \
+        return -1;                                                          \
+    if (name##Alloc(m, (old.mask + 1) * 2) != 0) {                          \
+        *m = old;                                                           \
+        return -1;                                                          \
+    }                                                                       \
+    uint32_t i;                                                             \
+    for (i = 0; i <= old.mask; i++) {                                       \
+        if (old.hashes[i] != 0)                                             \
+            name##Place(m, old.hashes[i], &old.entries[i].key,              \
+                    &old.entries[i].val);                                   \
+    }                                                                       \
+    SCFree(old.hashes);                                                     \
+    SCFree(old.entries);                                                    \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/** \brief add 'k' or update its value                                      \
+ *  \retval 0 ok                                                            \
+ *  \retval -1 out of memory */                                             \
+static inline int name##Add(name *m, const name##Key *k, const name##Val *v) \
+{                                                                           \
+    if (m->hashes == NULL && name##Alloc(m, HASH_MAP_MIN_SIZE) != 0)        \
+        return -1;                                                          \
+    const uint32_t h = name##Hash(k);                                       \
+    int64_t i = name##Find(m, k, h);                                        \
+    if (i >= 0) {                                                           \
+        m->entries[i].val = *v;                                             \
+        return 0;                                                           \
+    }                                                                       \
+    if ((uint64_t)(m->cnt + 1) * 4 > (uint64_t)(m->mask + 1) * 3 &&         \
+        name##Grow(m) != 0)                                                 \
+        return -1;                                                          \
+    name##Place(m, h, k, v);                                                \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/** \retval 1 removed                                                       \
+ *  \retval 0 not found */                                                  \
+static inline int name##Remove(name *m, const name##Key *k)                 \
+{                                                                           \
+    if (m->hashes == NULL)                                                  \
+        return 0;                                                           \
+    int64_t f = name##Find(m, k, name##Hash(k));                            \
+    if (f < 0)                                                              \
+        return 0;                                                           \
+    uint32_t i = (uint32_t)f;                                               \
+    uint32_t j = (i + 1) & m->mask;                                         \
+    /* move back entries that would no longer be found past the hole */     \
+    while (m->hashes[j] != 0) {                                             \
+        uint32_t home = m->hashes[j] & m->mask;                             \
+        if (((j - home) & m->mask) >= ((j - i) & m->mask)) {                \
+            m->hashes[i] = m->hashes[j];                                    \
+            m->entries[i] = m->entries[j];                                  \
+            i = j;                                                          \
+        }                                                                   \
+        j = (j + 1) & m->mask;                                              \
+    }                                                                       \
+    m->hashes[i] = 0;                                                       \
+    m->cnt--;                                                               \
+    return 1;                                                               \
+}                                                                           \
+                                                                            \
+/** \brief walk the entries, start with '*iter' 0                           \
+ *  \retval e next entry or NULL when done */                               \
+static inline name##Entry *name##Next(const name *m, uint32_t *iter)        \
+{                                                                           \
+    if (m->hashes == NULL)                                                  \
+        return NULL;                                                        \
+    for ( ; *iter <= m->mask; (*iter)++) {                                  \
+        if (m->hashes[*iter] != 0)                                          \
+            return &m->entries[(*iter)++];                                  \
+    }                                                                       \
+    return NULL;                                                            \
+}
+
+void HashMapRegisterTests(void);
+void HashMapRegisterBenchmarks(void);
+
+#endif /* __UTIL_HASH_MAP_H__ */
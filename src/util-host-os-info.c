@@ -29,6 +29,9 @@
 #include "util-debug.h"
 #include "util-ip.h"
 #include "util-radix-tree.h"
+#include "util-lpm-ipv4.h"
+#include "util-atomic.h"
+#include "threads.h"
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
 
@@ -57,8 +60,35 @@ SCEnumCharMap sc_hinfo_os_policy_map[ ] = {
     { NULL,          -1 },
 };
 
-/** Radix tree that holds the host OS information */
+/** Radix tree that holds the host OS information. Once published it's
+ *  owned by the snapshot, a new tree is then only built for an update. */
 static SCRadixTree *sc_hinfo_tree = NULL;
+static uint32_t sc_hinfo_ipv4_cnt = 0;
+static uint32_t sc_hinfo_ipv6_cnt = 0;
+
+/** read only host OS info used by the packet threads. The IPv4 part is
+ *  compiled into an LPM table, a lookup is at most 3 memory reads. */
+typedef struct SCHInfoSnapshot_ {
+    SCRadixTree *tree;
+    SCLpmIPV4 *lpm;
+    uint32_t ipv4_cnt;
+    uint32_t ipv6_cnt;
+    /** replaced snapshots are kept until shutdown, a packet thread may
+     *  still be looking at them */
+    struct SCHInfoSnapshot_ *retired;
+} SCHInfoSnapshot;
+
+SC_ATOMIC_DECLARE(SCHInfoSnapshot *, sc_hinfo_snap);
+
+/** entry added at runtime, kept to rebuild the tree for the next one */
+typedef struct SCHInfoRuntimeEntry_ {
+    char *host_os;
+    char *netblock;
+    struct SCHInfoRuntimeEntry_ *next;
+} SCHInfoRuntimeEntry;
+
+static SCHInfoRuntimeEntry *sc_hinfo_runtime = NULL;
+static SCMutex sc_hinfo_update_lock = SCMUTEX_INITIALIZER;
 
 
 /**
@@ -181,6 +211,7 @@ int SCHInfoAddHostOSInfo(char *host_os, char *host_os_ip_range, int is_ipv4)
             return -1;
         }
 
+        sc_hinfo_ipv4_cnt++;
         if (netmask_str == NULL) {
             SCRadixAddKeyIPV4((uint8_t *)ipv4_addr, sc_hinfo_tree,
                               (void *)user_data);
@@ -207,6 +238,7 @@ int SCHInfoAddHostOSInfo(char *host_os, char *host_os_ip_range, int is_ipv4)
             return -1;
         }
 
+        sc_hinfo_ipv6_cnt++;
         if (netmask_str == NULL) {
             SCRadixAddKeyIPV6((uint8_t *)ipv6_addr, sc_hinfo_tree,
                               (void *)user_data);
@@ -250,7 +282,7 @@ int SCHInfoGetHostOSFlavour(char *ip_addr_str)
 {
     struct in_addr *ipv4_addr = NULL;
     struct in6_addr *ipv6_addr = NULL;
-    void *user_data = NULL;
+    int r;
 
     if (ip_addr_str == NULL || index(ip_addr_str, '/') != NULL)
         return -1;
@@ -261,22 +293,18 @@ int SCHInfoGetHostOSFlavour(char *ip_addr_str)
             return -1;
         }
 
-        (void)SCRadixFindKeyIPV6BestMatch((uint8_t *)ipv6_addr, sc_hinfo_tree, &user_data);
-        if (user_data == NULL)
-            return -1;
-        else
-            return *((int *)user_data);
+        r = SCHInfoGetIPv6HostOSFlavour((uint8_t *)ipv6_addr);
+        SCFree(ipv6_addr);
+        return r;
     } else {
         if ( (ipv4_addr = ValidateIPV4Address(ip_addr_str)) == NULL) {
             SCLogError(SC_ERR_INVALID_IPV4_ADDR, "Invalid IPV4 address");
             return -1;
         }
 
-        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)ipv4_addr, sc_hinfo_tree, &user_data);
-        if (user_data == NULL)
-            return -1;
-        else
-            return *((int *)user_data);
+        r = SCHInfoGetIPv4HostOSFlavour((uint8_t *)ipv4_addr);
+        SCFree(ipv4_addr);
+        return r;
     }
 }
 
@@ -291,7 +319,16 @@ int SCHInfoGetHostOSFlavour(char *ip_addr_str)
 int SCHInfoGetIPv4HostOSFlavour(uint8_t *ipv4_addr)
 {
     void *user_data = NULL;
-    (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, sc_hinfo_tree, &user_data);
+    const SCHInfoSnapshot *snap = SC_ATOMIC_GET(sc_hinfo_snap);
+
+    if (likely(snap != NULL)) {
+        if (snap->lpm != NULL)
+            user_data = SCLpmIPV4Lookup(snap->lpm, ipv4_addr);
+        else if (snap->ipv4_cnt > 0)
+            (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, snap->tree, &user_data);
+    } else {
+        (void)SCRadixFindKeyIPV4BestMatch(ipv4_addr, sc_hinfo_tree, &user_data);
+    }
     if (user_data == NULL)
         return -1;
     else
@@ -309,33 +346,103 @@ int SCHInfoGetIPv4HostOSFlavour(uint8_t *ipv4_addr)
 int SCHInfoGetIPv6HostOSFlavour(uint8_t *ipv6_addr)
 {
     void *user_data = NULL;
-    (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, sc_hinfo_tree, &user_data);
+    const SCHInfoSnapshot *snap = SC_ATOMIC_GET(sc_hinfo_snap);
+
+    if (likely(snap != NULL)) {
+        if (snap->ipv6_cnt > 0)
+            (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, snap->tree, &user_data);
+    } else {
+        (void)SCRadixFindKeyIPV6BestMatch(ipv6_addr, sc_hinfo_tree, &user_data);
+    }
     if (user_data == NULL)
         return -1;
     else
         return *((int *)user_data);
 }
 
+static void SCHInfoSnapshotFree(SCHInfoSnapshot *snap)
+{
+    while (snap != NULL) {
+        SCHInfoSnapshot *retired = snap->retired;
+        SCLpmIPV4Free(snap->lpm);
+        if (snap->tree != NULL)
+            SCRadixReleaseRadixTree(snap->tree);
+        SCFree(snap);
+        snap = retired;
+    }
+}
+
+/**
+ * \brief Make the tree built so far the one the lookups use
+ *
+ * \retval 0 ok
+ * \retval -1 error, the tree is kept for the lookups
+ */
+static int SCHInfoPublish(void)
+{
+    SCHInfoSnapshot *snap = SCMalloc(sizeof(*snap));
+    if (unlikely(snap == NULL))
+        return -1;
+    memset(snap, 0, sizeof(*snap));
+
+    snap->tree = sc_hinfo_tree;
+    snap->ipv4_cnt = sc_hinfo_ipv4_cnt;
+    snap->ipv6_cnt = sc_hinfo_ipv6_cnt;
+    if (snap->tree != NULL && snap->ipv4_cnt > 0) {
+        /* the radix tree stays usable if this fails */
+        snap->lpm = SCLpmIPV4CompileRadix(snap->tree);
+        if (snap->lpm != NULL) {
+            SCLogDebug("host os info: %"PRIu64" bytes of LPM tables",
+                    SCLpmIPV4MemUse(snap->lpm));
+        }
+    }
+
+    SCHInfoSnapshot *old = SC_ATOMIC_GET(sc_hinfo_snap);
+    if (old != NULL) {
+        snap->retired = old;
+    }
+    (void) SC_ATOMIC_SET(sc_hinfo_snap, snap);
+
+    sc_hinfo_tree = NULL;
+    sc_hinfo_ipv4_cnt = 0;
+    sc_hinfo_ipv6_cnt = 0;
+    return 0;
+}
+
 void SCHInfoCleanResources(void)
 {
+    SCHInfoSnapshotFree(SC_ATOMIC_GET(sc_hinfo_snap));
+    (void) SC_ATOMIC_SET(sc_hinfo_snap, NULL);
+
     if (sc_hinfo_tree != NULL) {
         SCRadixReleaseRadixTree(sc_hinfo_tree);
         sc_hinfo_tree = NULL;
     }
+    sc_hinfo_ipv4_cnt = 0;
+    sc_hinfo_ipv6_cnt = 0;
+
+    while (sc_hinfo_runtime != NULL) {
+        SCHInfoRuntimeEntry *e = sc_hinfo_runtime;
+        sc_hinfo_runtime = e->next;
+        SCFree(e->host_os);
+        SCFree(e->netblock);
+        SCFree(e);
+    }
 
     return;
 }
 
 /**
- * \brief Load the host os policy information from the configuration.
+ * \brief add the host os policy config to the tree
  *
- * \initonly (A mem alloc error should cause an exit failure)
+ * \retval 0 ok
+ * \retval -1 bad entry
  */
-void SCHInfoLoadFromConfig(void)
+static int SCHInfoAddFromConfig(void)
 {
     ConfNode *root = ConfGetNode("host-os-policy");
     if (root == NULL)
-        return;
+        return 0;
 
     ConfNode *policy;
     TAILQ_FOREACH(policy, &root->head, next) {
@@ -348,29 +455,126 @@ void SCHInfoLoadFromConfig(void)
                 SCLogError(SC_ERR_INVALID_ARGUMENT,
                     "Failed to add host \"%s\" with policy \"%s\" to host "
                     "info database", host->val, policy->name);
-                exit(EXIT_FAILURE);
+                return -1;
             }
         }
     }
+    return 0;
+}
+
+/**
+ * \brief Load the host os policy information from the configuration.
+ *
+ * \initonly (A mem alloc error should cause an exit failure)
+ */
+void SCHInfoLoadFromConfig(void)
+{
+    if (SCHInfoAddFromConfig() < 0)
+        exit(EXIT_FAILURE);
+
+    /* also without any config, the lookups are then skipped */
+    if (SCHInfoPublish() < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to set up the host info database");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * \brief Add a host os policy while running
+ *
+ * The packet threads keep using the current data until the new one is
+ * complete: a new tree is built from the config, the earlier runtime
+ * additions and the new entry, and swapped in.
+ *
+ * \param host_os policy name as in the host-os-policy config
+ * \param netblock ip, netblock or comma separated list of them
+ *
+ * \retval 0 ok
+ * \retval -1 invalid policy or address, or out of memory
+ */
+int SCHInfoRuntimeAdd(const char *host_os, const char *netblock)
+{
+    int r = -1;
+
+    if (host_os == NULL || netblock == NULL ||
+            SCMapEnumNameToValue(host_os, sc_hinfo_os_policy_map) == -1)
+        return -1;
+
+    SCHInfoRuntimeEntry *entry = SCMalloc(sizeof(*entry));
+    if (unlikely(entry == NULL))
+        return -1;
+    memset(entry, 0, sizeof(*entry));
+    entry->host_os = SCStrdup(host_os);
+    entry->netblock = SCStrdup(netblock);
+    if (entry->host_os == NULL || entry->netblock == NULL)
+        goto error;
+
+    SCMutexLock(&sc_hinfo_update_lock);
+    if (SCHInfoAddFromConfig() < 0)
+        goto unlock;
+    SCHInfoRuntimeEntry *e;
+    for (e = sc_hinfo_runtime; e != NULL; e = e->next) {
+        if (SCHInfoAddHostOSInfo(e->host_os, e->netblock,
+                    index(e->netblock, ':') == NULL) == -1)
+            goto unlock;
+    }
+    if (SCHInfoAddHostOSInfo(entry->host_os, entry->netblock,
+                index(entry->netblock, ':') == NULL) == -1)
+        goto unlock;
+    if (SCHInfoPublish() < 0)
+        goto unlock;
+
+    /* the list is in the order the entries were added */
+    SCHInfoRuntimeEntry **tail = &sc_hinfo_runtime;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = entry;
+    entry = NULL;
+    r = 0;
+
+unlock:
+    if (r < 0 && sc_hinfo_tree != NULL) {
+        SCRadixReleaseRadixTree(sc_hinfo_tree);
+        sc_hinfo_tree = NULL;
+        sc_hinfo_ipv4_cnt = 0;
+        sc_hinfo_ipv6_cnt = 0;
+    }
+    SCMutexUnlock(&sc_hinfo_update_lock);
+error:
+    if (entry != NULL) {
+        if (entry->host_os != NULL)
+            SCFree(entry->host_os);
+        if (entry->netblock != NULL)
+            SCFree(entry->netblock);
+        SCFree(entry);
+    }
+    return r;
 }
 
 /*------------------------------------Unit_Tests------------------------------*/
 
 #ifdef UNITTESTS
 static SCRadixTree *sc_hinfo_tree_backup = NULL;
+static SCHInfoSnapshot *sc_hinfo_snap_backup = NULL;
 
 static void SCHInfoCreateContextBackup(void)
 {
     sc_hinfo_tree_backup = sc_hinfo_tree;
     sc_hinfo_tree = NULL;
+    sc_hinfo_snap_backup = SC_ATOMIC_GET(sc_hinfo_snap);
+    (void) SC_ATOMIC_SET(sc_hinfo_snap, NULL);
 
     return;
 }
 
 static void SCHInfoRestoreContextBackup(void)
 {
+    SCHInfoCleanResources();
+
     sc_hinfo_tree = sc_hinfo_tree_backup;
     sc_hinfo_tree_backup = NULL;
+    (void) SC_ATOMIC_SET(sc_hinfo_snap, sc_hinfo_snap_backup);
+    sc_hinfo_snap_backup = NULL;
 
     return;
 }
@@ -1621,6 +1825,54 @@ host-os-policy:\n\
     return result;
 }
 
+/**
+ * \test Check the published lookups and adding a host at runtime.
+ */
+static int SCHInfoTestLoadFromConfig06(void)
+{
+    char config[] = "\
+%YAML 1.1\n\
+---\n\
+host-os-policy:\n\
+  windows: [10.0.0.0/8]\n\
+  linux: [10.0.0.5/32, \"dead:beef::/32\"]\n\
+\n";
+
+    SCHInfoCreateContextBackup();
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfYamlLoadString(config, strlen(config));
+
+    SCHInfoLoadFromConfig();
+    const SCHInfoSnapshot *snap = SC_ATOMIC_GET(sc_hinfo_snap);
+    FAIL_IF_NULL(snap);
+    FAIL_IF_NULL(snap->lpm);
+    FAIL_IF(snap->ipv4_cnt != 2);
+    FAIL_IF(snap->ipv6_cnt != 1);
+
+    FAIL_IF(SCHInfoGetHostOSFlavour("10.0.0.4") != OS_POLICY_WINDOWS);
+    FAIL_IF(SCHInfoGetHostOSFlavour("10.0.0.5") != OS_POLICY_LINUX);
+    FAIL_IF(SCHInfoGetHostOSFlavour("192.168.1.1") != -1);
+    FAIL_IF(SCHInfoGetHostOSFlavour("dead:beef::1") != OS_POLICY_LINUX);
+
+    FAIL_IF(SCHInfoRuntimeAdd("bamboo", "192.168.1.0/24") != -1);
+    FAIL_IF(SCHInfoRuntimeAdd("bsd", "192.168.1.0/24") != 0);
+    FAIL_IF(SCHInfoRuntimeAdd("solaris", "192.168.1.5") != 0);
+    FAIL_IF(SC_ATOMIC_GET(sc_hinfo_snap) == snap);
+
+    FAIL_IF(SCHInfoGetHostOSFlavour("10.0.0.4") != OS_POLICY_WINDOWS);
+    FAIL_IF(SCHInfoGetHostOSFlavour("192.168.1.1") != OS_POLICY_BSD);
+    FAIL_IF(SCHInfoGetHostOSFlavour("192.168.1.5") != OS_POLICY_SOLARIS);
+    FAIL_IF(SCHInfoGetHostOSFlavour("dead:beef::1") != OS_POLICY_LINUX);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+
+    SCHInfoRestoreContextBackup();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHInfoRegisterTests(void)
@@ -1651,6 +1903,7 @@ void SCHInfoRegisterTests(void)
     UtRegisterTest("SCHInfoTestLoadFromConfig02", SCHInfoTestLoadFromConfig02);
     UtRegisterTest("SCHInfoTestLoadFromConfig03", SCHInfoTestLoadFromConfig03);
     UtRegisterTest("SCHInfoTestLoadFromConfig04", SCHInfoTestLoadFromConfig04);
+    UtRegisterTest("SCHInfoTestLoadFromConfig06", SCHInfoTestLoadFromConfig06);
 #endif /* UNITTESTS */
 
 }
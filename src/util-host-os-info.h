@@ -33,6 +33,7 @@ int SCHInfoGetIPv4HostOSFlavour(uint8_t *);
 int SCHInfoGetIPv6HostOSFlavour(uint8_t *);
 void SCHInfoCleanResources(void);
 void SCHInfoLoadFromConfig(void);
+int SCHInfoRuntimeAdd(const char *, const char *);
 void SCHInfoRegisterTests(void);
 
 #endif /* __UTIL_HOST_OS_INFO_H__ */
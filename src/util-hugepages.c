@@ -0,0 +1,245 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge page backed allocations for large, long lived tables.
+ *
+ * The hash tables of the flow, host, ippair and defrag engines are large
+ * and accessed at random, so with 4k pages most lookups miss the TLB. If
+ * 'hugepages' is enabled these tables are mapped with MAP_HUGETLB, using
+ * the huge pages reserved through vm.nr_hugepages, and if there are none
+ * the mapping is marked for transparent huge pages instead. In NUMA mode
+ * the pages are interleaved over the nodes, as all workers use the tables.
+ *
+ * Memory returned is zeroed and cache line aligned. The callers account
+ * for the size they asked for in their memcaps, as before.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-affinity.h"
+#include "util-hugepages.h"
+#include "util-unittest.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define HUGEPAGE_ALLOC_MALLOC   0
+#define HUGEPAGE_ALLOC_MMAP     1
+
+/** in front of the memory returned, a cache line so the alignment holds */
+typedef struct HugePageHeader_ {
+    size_t map_len;
+    int type;
+} __attribute__((aligned(CLS))) HugePageHeader;
+
+static int g_hugepages_enabled = 0;
+static int g_hugepages_init = 0;
+static SCMutex g_hugepages_lock = SCMUTEX_INITIALIZER;
+
+static int HugePagesEnabled(void)
+{
+    SCMutexLock(&g_hugepages_lock);
+    if (!g_hugepages_init) {
+        g_hugepages_init = 1;
+
+        int enabled = 0;
+        if (ConfGetBool("hugepages", &enabled) == 1 && enabled) {
+#if HAVE_SYS_MMAN_H
+            g_hugepages_enabled = 1;
+            SCLogConfig("using huge pages for the hash tables");
+#else
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hugepages: not supported "
+                    "on this platform");
+#endif
+        }
+    }
+    int r = g_hugepages_enabled;
+    SCMutexUnlock(&g_hugepages_lock);
+    return r;
+}
+
+#if HAVE_SYS_MMAN_H
+/** \internal \brief spread the pages of a mapping over the NUMA nodes */
+static void HugePagesInterleave(void *ptr, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    if (!AffinityNumaModeEnabled())
+        return;
+
+    int nodes = AffinityGetNumaNodeCount();
+    if (nodes <= 1 || nodes > (int)(sizeof(unsigned long) * 8))
+        return;
+
+    unsigned long mask = (nodes == (int)(sizeof(unsigned long) * 8)) ?
+        ~0UL : ((1UL << nodes) - 1);
+    /* MPOL_INTERLEAVE, numaif.h may not be installed */
+    if (syscall(SYS_mbind, ptr, len, 3, &mask, (unsigned long)nodes + 1, 0) != 0) {
+        SCLogDebug("mbind failed: %s", strerror(errno));
+    }
+#endif
+}
+
+/** \internal \brief map a region, trying huge pages first */
+static void *HugePagesMap(size_t len, size_t *map_len)
+{
+    void *ptr = MAP_FAILED;
+    size_t hlen = (len + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    ptr = mmap(NULL, hlen, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        SCLogDebug("mapped %"PRIuMAX" bytes of huge pages", (uintmax_t)hlen);
+        *map_len = hlen;
+        return ptr;
+    }
+    SCLogDebug("no reserved huge pages (%s), asking for transparent ones",
+            strerror(errno));
+#endif
+    ptr = mmap(NULL, hlen, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    (void)madvise(ptr, hlen, MADV_HUGEPAGE);
+#endif
+    *map_len = hlen;
+    return ptr;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/**
+ *  \brief allocate a large, zeroed, cache line aligned region
+ *
+ *  Uses huge pages if enabled and the size is at least HUGEPAGE_SIZE,
+ *  the regular allocator otherwise. Free with HugePagesFree().
+ *
+ *  \retval ptr memory or NULL on error
+ */
+void *HugePagesAlloc(size_t size)
+{
+    HugePageHeader *h = NULL;
+    size_t len = sizeof(HugePageHeader) + size;
+
+#if HAVE_SYS_MMAN_H
+    if (size >= HUGEPAGE_SIZE && HugePagesEnabled()) {
+        size_t map_len = 0;
+        h = HugePagesMap(len, &map_len);
+        if (h != NULL) {
+            HugePagesInterleave(h, map_len);
+            h->map_len = map_len;
+            h->type = HUGEPAGE_ALLOC_MMAP;
+            return (uint8_t *)h + sizeof(*h);
+        }
+        SCLogWarning(SC_ERR_MEM_ALLOC, "mapping %"PRIuMAX" bytes failed: %s, "
+                "using a regular allocation", (uintmax_t)len, strerror(errno));
+    }
+#endif
+
+    h = SCMallocAligned(len, CLS);
+    if (h == NULL)
+        return NULL;
+    memset(h, 0x00, len);
+    h->map_len = len;
+    h->type = HUGEPAGE_ALLOC_MALLOC;
+    return (uint8_t *)h + sizeof(*h);
+}
+
+void HugePagesFree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    HugePageHeader *h = (HugePageHeader *)((uint8_t *)ptr - sizeof(HugePageHeader));
+#if HAVE_SYS_MMAN_H
+    if (h->type == HUGEPAGE_ALLOC_MMAP) {
+        munmap(h, h->map_len);
+        return;
+    }
+#endif
+    SCFreeAligned(h);
+}
+
+/** \brief forget the config, it's read again on the next allocation */
+void HugePagesDeinit(void)
+{
+    SCMutexLock(&g_hugepages_lock);
+    g_hugepages_init = 0;
+    g_hugepages_enabled = 0;
+    SCMutexUnlock(&g_hugepages_lock);
+}
+
+#ifdef UNITTESTS
+static int HugePagesTestAlloc(char *enabled, size_t size)
+{
+    int result = 0;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("hugepages", enabled);
+    HugePagesDeinit();
+
+    uint8_t *ptr = HugePagesAlloc(size);
+    if (ptr == NULL)
+        goto end;
+    if (((uintptr_t)ptr & (CLS - 1)) != 0) {
+        printf("%p not aligned: ", ptr);
+        HugePagesFree(ptr);
+        goto end;
+    }
+    if (ptr[0] != 0 || ptr[size - 1] != 0) {
+        printf("memory not zeroed: ");
+        HugePagesFree(ptr);
+        goto end;
+    }
+    ptr[0] = 1;
+    ptr[size - 1] = 1;
+    HugePagesFree(ptr);
+
+    result = 1;
+end:
+    HugePagesDeinit();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return result;
+}
+
+static int HugePagesTest01(void)
+{
+    return HugePagesTestAlloc("no", 3 * HUGEPAGE_SIZE + 100);
+}
+
+/** \test falls back to normal pages if none are reserved */
+static int HugePagesTest02(void)
+{
+    return HugePagesTestAlloc("yes", 3 * HUGEPAGE_SIZE + 100) &&
+           HugePagesTestAlloc("yes", 1000);
+}
+#endif /* UNITTESTS */
+
+void HugePagesRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HugePagesTest01", HugePagesTest01);
+    UtRegisterTest("HugePagesTest02", HugePagesTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,36 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge page backed allocations for large, long lived tables.
+ */
+
+#ifndef __UTIL_HUGEPAGES_H__
+#define __UTIL_HUGEPAGES_H__
+
+/** allocations smaller than this always use the regular allocator */
+#define HUGEPAGE_SIZE   (2 * 1024 * 1024)
+
+void *HugePagesAlloc(size_t size);
+void HugePagesFree(void *ptr);
+void HugePagesDeinit(void);
+
+void HugePagesRegisterTests(void);
+
+#endif /* __UTIL_HUGEPAGES_H__ */
@@ -265,6 +265,55 @@ static int GetEthtoolValue(const char *dev, int cmd, uint32_t *value)
     return 0;
 }
 
+static int SetEthtoolValue(const char *dev, int cmd, uint32_t value)
+{
+    struct ifreq ifr;
+    int fd;
+    struct ethtool_value ethv;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    (void)strlcpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name));
+
+    ethv.cmd = cmd;
+    ethv.data = value;
+    ifr.ifr_data = (void *) &ethv;
+    if (ioctl(fd, SIOCETHTOOL, (char *)&ifr) < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                  "Failure when trying to set feature via ioctl for '%s': %s (%d)",
+                  dev, strerror(errno), errno);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/**
+ * \brief run the ethtool command in 'data' on 'dev'
+ *
+ * \retval 0 ok, -1 error with errno set
+ */
+static int EthtoolIoctl(const char *dev, void *data)
+{
+    struct ifreq ifr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    (void)strlcpy(ifr.ifr_name, dev, sizeof(ifr.ifr_name));
+    ifr.ifr_data = data;
+
+    int r = ioctl(fd, SIOCETHTOOL, (char *)&ifr);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return r < 0 ? -1 : 0;
+}
+
 static int GetIfaceOffloadingLinux(const char *dev, int csum, int other)
 {
     int ret = 0;
@@ -445,3 +494,181 @@ int GetIfaceRSSQueuesNum(const char *pcap_dev)
     return 0;
 #endif
 }
+
+/**
+ * \brief set the number of RSS queues of 'dev'
+ *
+ * Uses the combined channels if the driver has them, the rx channels
+ * otherwise. The count is capped to what the NIC supports.
+ *
+ * \retval queues the number of queues now in use
+ * \retval -1 error
+ */
+int SetIfaceRSSQueuesNum(const char *dev, int queues)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_SCHANNELS
+    struct ethtool_channels ch;
+    memset(&ch, 0, sizeof(ch));
+    ch.cmd = ETHTOOL_GCHANNELS;
+    if (EthtoolIoctl(dev, &ch) < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to get channels via ioctl for '%s': %s (%d)",
+                dev, strerror(errno), errno);
+        return -1;
+    }
+
+    uint32_t *count = ch.max_combined > 0 ? &ch.combined_count : &ch.rx_count;
+    uint32_t max = ch.max_combined > 0 ? ch.max_combined : ch.max_rx;
+    if (max == 0) {
+        SCLogWarning(SC_ERR_NIC_OFFLOADING, "%s: can't change the number of "
+                "RSS queues", dev);
+        return -1;
+    }
+    if ((uint32_t)queues > max) {
+        SCLogWarning(SC_ERR_NIC_OFFLOADING, "%s: %d RSS queues requested, "
+                "NIC supports %u", dev, queues, max);
+        queues = (int)max;
+    }
+    if (*count == (uint32_t)queues)
+        return queues;
+
+    *count = (uint32_t)queues;
+    ch.cmd = ETHTOOL_SCHANNELS;
+    if (EthtoolIoctl(dev, &ch) < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to set %d channels via ioctl for '%s': %s (%d)",
+                queues, dev, strerror(errno), errno);
+        return -1;
+    }
+    return queues;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * \brief set a symmetric Toeplitz key on 'dev' and spread its RSS
+ *        indirection table evenly over 'queues' queues
+ *
+ * With the 0x6d5a repeating key both directions of a flow hash to the
+ * same value, so they end up on the same queue.
+ *
+ * \retval 0 ok
+ * \retval -1 error or not supported by the NIC
+ */
+int SetIfaceRSSSymmetric(const char *dev, int queues)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_SRSSH
+    struct ethtool_rxfh get;
+    memset(&get, 0, sizeof(get));
+    get.cmd = ETHTOOL_GRSSH;
+    if (EthtoolIoctl(dev, &get) < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to get RSS hash via ioctl for '%s': %s (%d)",
+                dev, strerror(errno), errno);
+        return -1;
+    }
+    if (get.indir_size == 0 || get.key_size == 0 || queues <= 0) {
+        SCLogWarning(SC_ERR_NIC_OFFLOADING, "%s: RSS key or indirection "
+                "table can't be set", dev);
+        return -1;
+    }
+
+    size_t len = sizeof(struct ethtool_rxfh) +
+        get.indir_size * sizeof(uint32_t) + get.key_size;
+    struct ethtool_rxfh *rxfh = SCCalloc(1, len);
+    if (rxfh == NULL)
+        return -1;
+
+    rxfh->cmd = ETHTOOL_SRSSH;
+    rxfh->indir_size = get.indir_size;
+    rxfh->key_size = get.key_size;
+#ifdef ETH_RSS_HASH_TOP
+    rxfh->hfunc = ETH_RSS_HASH_TOP;
+#endif
+    uint32_t i;
+    for (i = 0; i < get.indir_size; i++) {
+        rxfh->rss_config[i] = i % (uint32_t)queues;
+    }
+    uint8_t *key = (uint8_t *)&rxfh->rss_config[get.indir_size];
+    for (i = 0; i < get.key_size; i++) {
+        key[i] = (i & 1) ? 0x5a : 0x6d;
+    }
+
+    int r = EthtoolIoctl(dev, rxfh);
+    if (r < 0) {
+        SCLogWarning(SC_ERR_SYSCALL,
+                "Failure when trying to set RSS hash via ioctl for '%s': %s (%d)",
+                dev, strerror(errno), errno);
+    }
+    SCFree(rxfh);
+    return r;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * \brief disable the flow director's automatic flow steering (ATR)
+ *
+ * ATR moves a flow to the queue of the cpu that last transmitted on it,
+ * which splits flows over queues on a sensor. It's a driver private
+ * flag, "flow-director-atr".
+ *
+ * \retval 1 disabled
+ * \retval 0 not present or already off
+ * \retval -1 error
+ */
+int DisableIfaceFlowDirector(const char *dev)
+{
+#if defined HAVE_LINUX_ETHTOOL_H && defined ETHTOOL_SPFLAGS
+    struct {
+        struct ethtool_sset_info hdr;
+        uint32_t count;
+    } sset;
+    memset(&sset, 0, sizeof(sset));
+    sset.hdr.cmd = ETHTOOL_GSSET_INFO;
+    sset.hdr.sset_mask = 1ULL << ETH_SS_PRIV_FLAGS;
+    if (EthtoolIoctl(dev, &sset) < 0 || sset.hdr.sset_mask == 0 ||
+            sset.count == 0) {
+        return 0;
+    }
+
+    const uint32_t cnt = sset.count;
+    struct ethtool_gstrings *strings = SCCalloc(1,
+            sizeof(struct ethtool_gstrings) + cnt * ETH_GSTRING_LEN);
+    if (strings == NULL)
+        return -1;
+    strings->cmd = ETHTOOL_GSTRINGS;
+    strings->string_set = ETH_SS_PRIV_FLAGS;
+    strings->len = cnt;
+    if (EthtoolIoctl(dev, strings) < 0) {
+        SCFree(strings);
+        return -1;
+    }
+
+    int bit = -1;
+    uint32_t i;
+    for (i = 0; i < cnt && i < 32; i++) {
+        const char *name = (const char *)strings->data + i * ETH_GSTRING_LEN;
+        if (strncmp(name, "flow-director-atr", ETH_GSTRING_LEN) == 0) {
+            bit = (int)i;
+            break;
+        }
+    }
+    SCFree(strings);
+    if (bit == -1)
+        return 0;
+
+    uint32_t flags = 0;
+    if (GetEthtoolValue(dev, ETHTOOL_GPFLAGS, &flags) < 0)
+        return -1;
+    if ((flags & (1U << bit)) == 0)
+        return 0;
+    if (SetEthtoolValue(dev, ETHTOOL_SPFLAGS, flags & ~(1U << bit)) < 0)
+        return -1;
+    return 1;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,486 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer.
+ *
+ * Output matches json_dump with JSON_COMPACT|JSON_ENSURE_ASCII|
+ * JSON_ESCAPE_SLASH: no whitespace, '/' escaped and everything outside
+ * of printable ascii written as \\uXXXX. Bytes that are not valid UTF-8
+ * are written as \\u00XX instead of failing the whole string like
+ * json_string() does.
+ *
+ * In MessagePack mode maps and arrays get a 32 bit header that is filled
+ * in with the member count on close, as the count isn't known up front.
+ * Invalid UTF-8 bytes in strings are stored as U+00XX, like the escapes
+ * of the JSON output.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+#include "util-json-builder.h"
+#include "util-msgpack.h"
+#include "util-unittest.h"
+
+/* JsonBuilder::state flags */
+#define JB_EMPTY    0x01    /**< nothing written yet, so no ',' needed */
+#define JB_ARRAY    0x02    /**< level is an array, not an object */
+
+/* grow the buffer by at least this much */
+#define JSON_BUILDER_EXPAND_BY 4096
+
+/** table of the ascii chars that can be copied as is */
+static const uint8_t json_plain[256] = {
+    /* 0x00 - 0x1f: control chars */
+    0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+    /* ' ' to '/': '"' and '/' need escaping */
+    1,1,0,1,1,1,1,1, 1,1,1,1,1,1,1,0,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    /* '\\' needs escaping */
+    1,1,1,1,1,1,1,1, 1,1,1,1,0,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    /* 0x7f is passed as is by jansson too */
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    /* 0x80 - 0xff: utf-8 */
+};
+
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer)
+{
+    memset(jb, 0x00, sizeof(*jb));
+    jb->buffer = buffer;
+}
+
+/** \brief like JsonBuilderInit, but write MessagePack */
+void JsonBuilderInitMsgPack(JsonBuilder *jb, MemBuffer **buffer)
+{
+    JsonBuilderInit(jb, buffer);
+    jb->msgpack = 1;
+}
+
+/** \internal
+ *  \brief make sure there is room for len bytes plus the terminating 0 */
+static int JsonBuilderReserve(JsonBuilder *jb, uint32_t len)
+{
+    MemBuffer **mb = jb->buffer;
+
+    if (MEMBUFFER_OFFSET(*mb) + len < MEMBUFFER_SIZE(*mb))
+        return 0;
+
+    uint32_t need = MEMBUFFER_OFFSET(*mb) + len + 1 - MEMBUFFER_SIZE(*mb);
+    if (MemBufferExpand(mb, MAX(need, JSON_BUILDER_EXPAND_BY)) < 0) {
+        jb->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void JsonBuilderWrite(JsonBuilder *jb, const char *str,
+                                    uint32_t len)
+{
+    if (JsonBuilderReserve(jb, len) < 0)
+        return;
+
+    MemBuffer *mb = *jb->buffer;
+    memcpy(mb->buffer + mb->offset, str, len);
+    mb->offset += len;
+    mb->buffer[mb->offset] = '\0';
+}
+
+static inline void JsonBuilderWriteChar(JsonBuilder *jb, char c)
+{
+    JsonBuilderWrite(jb, &c, 1);
+}
+
+/** \internal
+ *  \brief decode the utf-8 sequence at str
+ *  \retval len bytes used, 0 if str doesn't start with a valid sequence */
+static uint32_t JsonBuilderDecodeUtf8(const uint8_t *str, uint32_t len,
+                                      uint32_t *cp)
+{
+    uint32_t n, c;
+
+    if (str[0] >= 0xc2 && str[0] <= 0xdf) {
+        n = 2;
+        c = str[0] & 0x1f;
+    } else if (str[0] >= 0xe0 && str[0] <= 0xef) {
+        n = 3;
+        c = str[0] & 0x0f;
+    } else if (str[0] >= 0xf0 && str[0] <= 0xf4) {
+        n = 4;
+        c = str[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (n > len)
+        return 0;
+
+    uint32_t i;
+    for (i = 1; i < n; i++) {
+        if ((str[i] & 0xc0) != 0x80)
+            return 0;
+        c = (c << 6) | (str[i] & 0x3f);
+    }
+
+    /* overlong forms, surrogates and out of range */
+    if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+        (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+        return 0;
+
+    *cp = c;
+    return n;
+}
+
+/** \internal
+ *  \brief write a quoted, escaped string
+ *
+ *  Runs of plain chars are copied in one go, only the chars that need
+ *  escaping are handled one at a time. */
+static void JsonBuilderWriteQuoted(JsonBuilder *jb, const uint8_t *str,
+                                   uint32_t len)
+{
+    char esc[16];
+    uint32_t i = 0;
+
+    JsonBuilderWriteChar(jb, '"');
+    while (i < len) {
+        uint32_t start = i;
+        while (i < len && json_plain[str[i]])
+            i++;
+        if (i > start)
+            JsonBuilderWrite(jb, (const char *)str + start, i - start);
+        if (i == len)
+            break;
+
+        uint8_t c = str[i];
+        switch (c) {
+            case '"':  JsonBuilderWrite(jb, "\\\"", 2); i++; continue;
+            case '\\': JsonBuilderWrite(jb, "\\\\", 2); i++; continue;
+            case '/':  JsonBuilderWrite(jb, "\\/", 2); i++; continue;
+            case '\b': JsonBuilderWrite(jb, "\\b", 2); i++; continue;
+            case '\f': JsonBuilderWrite(jb, "\\f", 2); i++; continue;
+            case '\n': JsonBuilderWrite(jb, "\\n", 2); i++; continue;
+            case '\r': JsonBuilderWrite(jb, "\\r", 2); i++; continue;
+            case '\t': JsonBuilderWrite(jb, "\\t", 2); i++; continue;
+        }
+
+        uint32_t cp = c;
+        uint32_t n = 1;
+        if (c >= 0x80) {
+            n = JsonBuilderDecodeUtf8(str + i, len - i, &cp);
+            if (n == 0) {
+                n = 1;
+                cp = c;
+            }
+        }
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            snprintf(esc, sizeof(esc), "\\u%04X\\u%04X",
+                    0xd800 | (cp >> 10), 0xdc00 | (cp & 0x3ff));
+            JsonBuilderWrite(jb, esc, 12);
+        } else {
+            snprintf(esc, sizeof(esc), "\\u%04X", cp);
+            JsonBuilderWrite(jb, esc, 6);
+        }
+        i += n;
+    }
+    JsonBuilderWriteChar(jb, '"');
+}
+
+/** \internal
+ *  \brief write a MessagePack string
+ *
+ *  Valid UTF-8 is copied as is. Otherwise the invalid bytes are stored
+ *  as the 2 byte sequence of U+00XX, so the length is counted first. */
+static void JsonBuilderMsgPackStr(JsonBuilder *jb, const uint8_t *str,
+                                  uint32_t len)
+{
+    uint8_t hdr[MSGPACK_HDR_MAX];
+    uint32_t outlen = 0;
+    uint32_t i = 0;
+    uint32_t cp;
+
+    while (i < len) {
+        uint32_t n = 1;
+        if (str[i] >= 0x80) {
+            n = JsonBuilderDecodeUtf8(str + i, len - i, &cp);
+            if (n == 0) {
+                outlen += 2;
+                i++;
+                continue;
+            }
+        }
+        outlen += n;
+        i += n;
+    }
+
+    JsonBuilderWrite(jb, (const char *)hdr, MsgPackEncodeStrHeader(hdr, outlen));
+    if (outlen == len) {
+        JsonBuilderWrite(jb, (const char *)str, len);
+        return;
+    }
+
+    i = 0;
+    while (i < len) {
+        uint32_t n = 1;
+        if (str[i] >= 0x80)
+            n = JsonBuilderDecodeUtf8(str + i, len - i, &cp);
+        if (n == 0) {
+            const char u[2] = { (char)(0xc0 | (str[i] >> 6)),
+                                (char)(0x80 | (str[i] & 0x3f)) };
+            JsonBuilderWrite(jb, u, 2);
+            n = 1;
+        } else {
+            JsonBuilderWrite(jb, (const char *)str + i, n);
+        }
+        i += n;
+    }
+}
+
+/** \internal
+ *  \brief write the ',' and key before a new value */
+static void JsonBuilderWriteKey(JsonBuilder *jb, const char *key)
+{
+    if (jb->msgpack) {
+        if (jb->depth > 0)
+            jb->count[jb->depth - 1]++;
+        if (key != NULL)
+            JsonBuilderMsgPackStr(jb, (const uint8_t *)key, strlen(key));
+        return;
+    }
+    if (jb->depth > 0) {
+        if (!(jb->state[jb->depth - 1] & JB_EMPTY))
+            JsonBuilderWriteChar(jb, ',');
+        jb->state[jb->depth - 1] &= ~JB_EMPTY;
+    }
+    if (key != NULL) {
+        JsonBuilderWriteQuoted(jb, (const uint8_t *)key, strlen(key));
+        JsonBuilderWriteChar(jb, ':');
+    }
+}
+
+static void JsonBuilderOpen(JsonBuilder *jb, const char *key, char c)
+{
+    if (jb->depth >= JSON_BUILDER_MAX_DEPTH) {
+        jb->error = 1;
+        return;
+    }
+    JsonBuilderWriteKey(jb, key);
+    jb->state[jb->depth] = JB_EMPTY | (c == '[' ? JB_ARRAY : 0);
+    if (jb->msgpack) {
+        const uint8_t hdr[5] = { c == '[' ? MSGPACK_ARRAY32 : MSGPACK_MAP32,
+                                 0, 0, 0, 0 };
+        jb->offset[jb->depth] = MEMBUFFER_OFFSET(*jb->buffer);
+        jb->count[jb->depth] = 0;
+        JsonBuilderWrite(jb, (const char *)hdr, sizeof(hdr));
+    } else {
+        JsonBuilderWriteChar(jb, c);
+    }
+    jb->depth++;
+}
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, '{');
+}
+
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key)
+{
+    JsonBuilderOpen(jb, key, '[');
+}
+
+/** \brief close the object or array opened last */
+void JsonBuilderClose(JsonBuilder *jb)
+{
+    if (jb->depth == 0) {
+        jb->error = 1;
+        return;
+    }
+    jb->depth--;
+    if (jb->msgpack) {
+        if (!jb->error) {
+            MsgPackPutBE32(MEMBUFFER_BUFFER(*jb->buffer) +
+                    jb->offset[jb->depth] + 1, jb->count[jb->depth]);
+        }
+        return;
+    }
+    JsonBuilderWriteChar(jb, (jb->state[jb->depth] & JB_ARRAY) ? ']' : '}');
+}
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val)
+{
+    JsonBuilderWriteKey(jb, key);
+    if (jb->msgpack)
+        JsonBuilderMsgPackStr(jb, (const uint8_t *)val, strlen(val));
+    else
+        JsonBuilderWriteQuoted(jb, (const uint8_t *)val, strlen(val));
+}
+
+void JsonBuilderSetStringLen(JsonBuilder *jb, const char *key,
+                             const uint8_t *val, uint32_t len)
+{
+    JsonBuilderWriteKey(jb, key);
+    if (jb->msgpack)
+        JsonBuilderMsgPackStr(jb, val, len);
+    else
+        JsonBuilderWriteQuoted(jb, val, len);
+}
+
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    char num[24];
+    int r;
+
+    JsonBuilderWriteKey(jb, key);
+    if (jb->msgpack)
+        r = (int)MsgPackEncodeInt((uint8_t *)num, val);
+    else
+        r = snprintf(num, sizeof(num), "%"PRIi64, val);
+    JsonBuilderWrite(jb, num, (uint32_t)r);
+}
+
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val)
+{
+    char num[24];
+    int r;
+
+    JsonBuilderWriteKey(jb, key);
+    if (jb->msgpack)
+        r = (int)MsgPackEncodeUint((uint8_t *)num, val);
+    else
+        r = snprintf(num, sizeof(num), "%"PRIu64, val);
+    JsonBuilderWrite(jb, num, (uint32_t)r);
+}
+
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val)
+{
+    JsonBuilderWriteKey(jb, key);
+    if (jb->msgpack)
+        JsonBuilderWriteChar(jb, (char)(val ? MSGPACK_TRUE : MSGPACK_FALSE));
+    else if (val)
+        JsonBuilderWrite(jb, "true", 4);
+    else
+        JsonBuilderWrite(jb, "false", 5);
+}
+
+#ifdef UNITTESTS
+
+static int JsonBuilderTest01(void)
+{
+    MemBuffer *mb = MemBufferCreateNew(8);
+    if (mb == NULL)
+        return 0;
+
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &mb);
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetString(&jb, "event_type", "flow");
+    JsonBuilderSetInt(&jb, "age", -1);
+    JsonBuilderOpenObject(&jb, "tcp");
+    JsonBuilderSetBool(&jb, "syn", 1);
+    JsonBuilderOpenArray(&jb, "list");
+    JsonBuilderSetUint(&jb, NULL, 1);
+    JsonBuilderSetString(&jb, NULL, "a}");
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderOpenArray(&jb, "empty");
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+
+    const char *expect = "{\"event_type\":\"flow\",\"age\":-1,"
+        "\"tcp\":{\"syn\":true,\"list\":[1,\"a}\"]},\"empty\":[]}";
+
+    int result = 1;
+    if (!JsonBuilderIsValid(&jb) ||
+        strcmp((char *)MEMBUFFER_BUFFER(mb), expect) != 0) {
+        printf("got \"%s\": ", MEMBUFFER_BUFFER(mb));
+        result = 0;
+    }
+    MemBufferFree(mb);
+    return result;
+}
+
+/** \test escaping */
+static int JsonBuilderTest02(void)
+{
+    MemBuffer *mb = MemBufferCreateNew(64);
+    if (mb == NULL)
+        return 0;
+
+    /* "quote\ / tab nl \x01 e-acute euro g-clef \xff */
+    const uint8_t str[] = "\"q\\ /\t\n\x01" "\xc3\xa9" "\xe2\x82\xac"
+        "\xf0\x9d\x84\x9e" "\xff";
+
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, &mb);
+    JsonBuilderSetStringLen(&jb, NULL, str, sizeof(str) - 1);
+
+    const char *expect = "\"\\\"q\\\\ \\/\\t\\n\\u0001\\u00E9\\u20AC"
+        "\\uD834\\uDD1E\\u00FF\"";
+
+    int result = 1;
+    if (!JsonBuilderIsValid(&jb) ||
+        strcmp((char *)MEMBUFFER_BUFFER(mb), expect) != 0) {
+        printf("got \"%s\": ", MEMBUFFER_BUFFER(mb));
+        result = 0;
+    }
+    MemBufferFree(mb);
+    return result;
+}
+
+/** \test msgpack output */
+static int JsonBuilderTest03(void)
+{
+    MemBuffer *mb = MemBufferCreateNew(8);
+    FAIL_IF_NULL(mb);
+
+    JsonBuilder jb;
+    JsonBuilderInitMsgPack(&jb, &mb);
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderSetUint(&jb, "p", 443);
+    JsonBuilderOpenArray(&jb, "l");
+    JsonBuilderSetBool(&jb, NULL, 0);
+    JsonBuilderSetStringLen(&jb, NULL, (const uint8_t *)"a\xff", 2);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    FAIL_IF_NOT(JsonBuilderIsValid(&jb));
+
+    const uint8_t expect[] = {
+        0xdf, 0x00, 0x00, 0x00, 0x02,
+        0xa1, 'p', 0xcd, 0x01, 0xbb,
+        0xa1, 'l', 0xdd, 0x00, 0x00, 0x00, 0x02,
+        0xc2, 0xa3, 'a', 0xc3, 0xbf };
+    FAIL_IF(MEMBUFFER_OFFSET(mb) != sizeof(expect));
+    FAIL_IF(memcmp(MEMBUFFER_BUFFER(mb), expect, sizeof(expect)) != 0);
+
+    MemBufferFree(mb);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,70 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer. Records are written straight into a MemBuffer
+ * in the same compact, ascii-only form the jansson based output uses,
+ * without building an object tree first.
+ *
+ * The same calls can produce MessagePack instead, see
+ * JsonBuilderInitMsgPack().
+ */
+
+#ifndef __UTIL_JSON_BUILDER_H__
+#define __UTIL_JSON_BUILDER_H__
+
+#include "util-buffer.h"
+
+/** max nesting of objects and arrays */
+#define JSON_BUILDER_MAX_DEPTH 16
+
+typedef struct JsonBuilder_ {
+    MemBuffer **buffer;     /**< buffer to write to & expand as needed */
+    uint8_t depth;
+    uint8_t error;          /**< set if output is incomplete */
+    uint8_t msgpack;        /**< write MessagePack instead of JSON */
+    /** per level JB_* flags */
+    uint8_t state[JSON_BUILDER_MAX_DEPTH];
+    /** msgpack: offset of the header of each level, and its member
+     *  count, written to the header on close */
+    uint32_t offset[JSON_BUILDER_MAX_DEPTH];
+    uint32_t count[JSON_BUILDER_MAX_DEPTH];
+} JsonBuilder;
+
+void JsonBuilderInit(JsonBuilder *jb, MemBuffer **buffer);
+void JsonBuilderInitMsgPack(JsonBuilder *jb, MemBuffer **buffer);
+
+/* key is NULL for array members and the top level object */
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key);
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key);
+void JsonBuilderClose(JsonBuilder *jb);
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val);
+void JsonBuilderSetStringLen(JsonBuilder *jb, const char *key,
+                             const uint8_t *val, uint32_t len);
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val);
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val);
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, int val);
+
+/** \retval 1 if the record is complete and can be written */
+#define JsonBuilderIsValid(jb) ((jb)->error == 0 && (jb)->depth == 0)
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* __UTIL_JSON_BUILDER_H__ */
@@ -0,0 +1,550 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Latency histograms of the packet pipeline and slow packet log
+ *
+ * Each thread that handles packets records the time of the flow worker
+ * stages, the flow lock wait in the flow hash and, in live modes, the
+ * time from capture to the release of the packet into log linear
+ * histograms. The histograms are cumulative and exported through the
+ * stats json. Packets that spend more than the configured threshold in
+ * the flow worker are logged to the slow packet log.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "detect.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "output-json.h"
+#include "app-layer-protos.h"
+#include "util-conf.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-latency.h"
+#include "util-path.h"
+#include "util-unittest.h"
+
+/** default threshold for the slow packet log in usec */
+#define LATENCY_SLOW_THRESHOLD_DEFAULT  10000
+#define LATENCY_SLOW_MAX_PER_SEC        10
+/** sids listed per slow packet */
+#define LATENCY_SLOW_SIDS               8
+
+int latency_enabled = 0;
+int latency_capture_enabled = 0;
+double latency_ns_per_tick = 1.0;
+
+/** list of all thread ctxs, for the export */
+static LatencyThreadCtx *latency_threads = NULL;
+static SCMutex latency_threads_lock = SCMUTEX_INITIALIZER;
+
+#ifdef TLS
+static __thread LatencyThreadCtx *latency_thread_ctx = NULL;
+#else
+static pthread_key_t latency_thread_key;
+#endif
+
+static uint64_t slow_threshold_ns = 0;
+static uint32_t slow_max_per_sec = LATENCY_SLOW_MAX_PER_SEC;
+static FILE *slow_fp = NULL;
+static SCMutex slow_lock = SCMUTEX_INITIALIZER;
+static time_t slow_sec = 0;
+static uint32_t slow_cnt = 0;
+
+static const char *latency_names[LATENCY_TYPE_MAX] = {
+    "capture",
+    "worker",
+    "flow",
+    "stream",
+    "app_layer_udp",
+    "detect",
+    "flow_lock",
+};
+
+uint32_t LatencyBucket(uint64_t ns)
+{
+    if (ns < LATENCY_SUB_BUCKETS)
+        return (uint32_t)ns;
+    if (ns >= (1ULL << LATENCY_MAX_BITS))
+        ns = (1ULL << LATENCY_MAX_BITS) - 1;
+
+    uint32_t mag = 63 - __builtin_clzll(ns);
+    uint32_t shift = mag - LATENCY_SUB_BITS;
+    return (mag - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+        (uint32_t)((ns >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+/** \brief highest value that is counted in a bucket */
+uint64_t LatencyBucketValue(uint32_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    uint32_t shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+/** \param pct percentile, e.g. 99.9 */
+uint64_t LatencyHistogramPercentile(const LatencyHistogram *h, double pct)
+{
+    if (h->cnt == 0)
+        return 0;
+
+    uint64_t want = (uint64_t)(((double)h->cnt * pct) / 100.0 + 0.5);
+    if (want == 0)
+        want = 1;
+
+    uint64_t seen = 0;
+    uint32_t u;
+    for (u = 0; u < LATENCY_BUCKETS; u++) {
+        seen += h->buckets[u];
+        if (seen >= want) {
+            uint64_t v = LatencyBucketValue(u);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void LatencyHistogramMerge(LatencyHistogram *dst, const LatencyHistogram *src)
+{
+    uint32_t u;
+    for (u = 0; u < LATENCY_BUCKETS; u++)
+        dst->buckets[u] += src->buckets[u];
+    dst->cnt += src->cnt;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/** \brief get the latency ctx of the calling thread, alloc on first use
+ *
+ *  \retval ctx or NULL if latency tracking is disabled
+ */
+LatencyThreadCtx *LatencyThreadCtxGet(ThreadVars *tv)
+{
+    if (!latency_enabled)
+        return NULL;
+
+#ifdef TLS
+    LatencyThreadCtx *ctx = latency_thread_ctx;
+#else
+    LatencyThreadCtx *ctx = pthread_getspecific(latency_thread_key);
+#endif
+    if (likely(ctx != NULL))
+        return ctx;
+
+    ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL)) {
+        latency_enabled = 0;
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc latency histograms, "
+                "disabling latency tracking");
+        return NULL;
+    }
+    if (tv != NULL)
+        strlcpy(ctx->name, tv->name, sizeof(ctx->name));
+
+    SCMutexLock(&latency_threads_lock);
+    ctx->next = latency_threads;
+    latency_threads = ctx;
+    SCMutexUnlock(&latency_threads_lock);
+
+#ifdef TLS
+    latency_thread_ctx = ctx;
+#else
+    pthread_setspecific(latency_thread_key, ctx);
+#endif
+    return ctx;
+}
+
+/** \brief record the time from capture to the release of the packet
+ *
+ *  Only used in live modes, as offline the packet time is not the
+ *  capture time.
+ */
+void LatencyCapture(ThreadVars *tv, const Packet *p)
+{
+    LatencyThreadCtx *ctx = LatencyThreadCtxGet(tv);
+    if (ctx == NULL)
+        return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    int64_t usec = (int64_t)(now.tv_sec - p->ts.tv_sec) * 1000000 +
+        (now.tv_usec - p->ts.tv_usec);
+    /* ignore clock jumps and nic timestamps ahead of the system clock */
+    if (usec < 0)
+        return;
+
+    LatencyRecord(ctx, LATENCY_CAPTURE, (uint64_t)usec * 1000);
+}
+
+#ifdef HAVE_LIBJANSSON
+static void LatencySlowPacketLog(const LatencyPacketTimer *t, uint64_t ns,
+        const Packet *p, const DetectEngineThreadCtx *det_ctx)
+{
+    json_t *js = CreateJSONHeader((Packet *)p, 0, "slow_packet");
+    if (unlikely(js == NULL))
+        return;
+
+    json_t *sjs = json_object();
+    if (unlikely(sjs == NULL)) {
+        json_decref(js);
+        return;
+    }
+
+    if (p->flow != NULL && p->flow->alproto != ALPROTO_UNKNOWN) {
+        json_object_set_new(sjs, "app_proto",
+                json_string(AppProtoToString(p->flow->alproto)));
+    }
+    json_object_set_new(sjs, "latency", json_integer(ns));
+
+    json_t *stages = json_object();
+    if (stages != NULL) {
+        int type;
+        for (type = LATENCY_FLOW; type <= LATENCY_DETECT; type++) {
+            json_object_set_new(stages, latency_names[type],
+                    json_integer(t->ns[type]));
+        }
+        json_object_set_new(stages, "flow_lock", json_integer(t->ctx->lock_ns));
+        json_object_set_new(sjs, "stages", stages);
+    }
+
+    /* the detect state is only of this packet if detection ran on it */
+    if (det_ctx != NULL && t->ns[LATENCY_DETECT] != 0 && det_ctx->sgh != NULL) {
+        json_object_set_new(sjs, "sgh_id", json_integer(det_ctx->sgh->id));
+        json_object_set_new(sjs, "inspected", json_integer(det_ctx->match_array_cnt));
+
+        json_t *sids = json_array();
+        if (sids != NULL) {
+            SigIntId i;
+            for (i = 0; i < det_ctx->match_array_cnt && i < LATENCY_SLOW_SIDS; i++) {
+                json_array_append_new(sids, json_integer(det_ctx->match_array[i]->id));
+            }
+            json_object_set_new(sjs, "sids", sids);
+        }
+    }
+    json_object_set_new(js, "slow_packet", sjs);
+
+    char *s = json_dumps(js, JSON_PRESERVE_ORDER|JSON_COMPACT);
+    json_decref(js);
+    if (s == NULL)
+        return;
+
+    SCMutexLock(&slow_lock);
+    if (p->ts.tv_sec != slow_sec) {
+        slow_sec = p->ts.tv_sec;
+        slow_cnt = 0;
+    }
+    if (slow_cnt++ < slow_max_per_sec) {
+        fprintf(slow_fp, "%s\n", s);
+        fflush(slow_fp);
+    }
+    SCMutexUnlock(&slow_lock);
+    free(s);
+}
+#endif /* HAVE_LIBJANSSON */
+
+/** \brief close the timer of a packet in the flow worker */
+void LatencyPacketTimerEnd(LatencyPacketTimer *t, ThreadVars *tv, const Packet *p,
+        DetectEngineThreadCtx *det_ctx)
+{
+    if (t->ctx == NULL)
+        return;
+
+    uint64_t ns = LatencyTicksToNs(UtilCpuGetTicks() - t->start);
+    LatencyRecord(t->ctx, LATENCY_WORKER, ns);
+
+#ifdef HAVE_LIBJANSSON
+    if (slow_fp != NULL && ns >= slow_threshold_ns) {
+        LatencySlowPacketLog(t, ns, p, det_ctx);
+    }
+#endif
+}
+
+#ifdef HAVE_LIBJANSSON
+static json_t *LatencyHistogramToJSON(const LatencyHistogram *h)
+{
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    json_object_set_new(js, "count", json_integer(h->cnt));
+    json_object_set_new(js, "mean", json_integer(h->cnt ? h->sum / h->cnt : 0));
+    json_object_set_new(js, "p50", json_integer(LatencyHistogramPercentile(h, 50.0)));
+    json_object_set_new(js, "p90", json_integer(LatencyHistogramPercentile(h, 90.0)));
+    json_object_set_new(js, "p99", json_integer(LatencyHistogramPercentile(h, 99.0)));
+    json_object_set_new(js, "p99_9", json_integer(LatencyHistogramPercentile(h, 99.9)));
+    json_object_set_new(js, "p99_99", json_integer(LatencyHistogramPercentile(h, 99.99)));
+    json_object_set_new(js, "max", json_integer(h->max));
+    return js;
+}
+
+static json_t *LatencyHistogramsToJSON(const LatencyHistogram *h)
+{
+    json_t *js = json_object();
+    if (unlikely(js == NULL))
+        return NULL;
+
+    int type;
+    for (type = 0; type < LATENCY_TYPE_MAX; type++) {
+        if (h[type].cnt == 0)
+            continue;
+        json_t *t = LatencyHistogramToJSON(&h[type]);
+        if (t != NULL)
+            json_object_set_new(js, latency_names[type], t);
+    }
+    return js;
+}
+
+/** \brief export the histograms, values in ns
+ *
+ *  The histograms are updated by their threads without locking, so
+ *  a snapshot may be off by the packets in flight.
+ *
+ *  \param threads also add the histograms of each thread
+ *  \retval js object or NULL if latency tracking is disabled
+ */
+json_t *LatencyToJSON(int threads)
+{
+    if (!latency_enabled)
+        return NULL;
+
+    LatencyHistogram *total = SCCalloc(LATENCY_TYPE_MAX, sizeof(LatencyHistogram));
+    if (unlikely(total == NULL))
+        return NULL;
+
+    json_t *js = NULL;
+    json_t *tjs = NULL;
+    if (threads) {
+        tjs = json_object();
+        if (unlikely(tjs == NULL))
+            goto end;
+    }
+
+    SCMutexLock(&latency_threads_lock);
+    LatencyThreadCtx *ctx;
+    for (ctx = latency_threads; ctx != NULL; ctx = ctx->next) {
+        int type;
+        for (type = 0; type < LATENCY_TYPE_MAX; type++)
+            LatencyHistogramMerge(&total[type], &ctx->h[type]);
+
+        if (tjs != NULL) {
+            json_t *t = LatencyHistogramsToJSON(ctx->h);
+            if (t != NULL)
+                json_object_set_new(tjs, ctx->name, t);
+        }
+    }
+    SCMutexUnlock(&latency_threads_lock);
+
+    js = LatencyHistogramsToJSON(total);
+    if (js != NULL && tjs != NULL) {
+        json_object_set_new(js, "threads", tjs);
+        tjs = NULL;
+    }
+end:
+    if (tjs != NULL)
+        json_decref(tjs);
+    SCFree(total);
+    return js;
+}
+#endif /* HAVE_LIBJANSSON */
+
+/** \internal
+ *  \brief measure the tick rate against the monotonic clock */
+static void LatencyCalibrate(void)
+{
+    struct timespec ts1, ts2;
+    struct timespec delay = { 0, 10 * 1000 * 1000 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    uint64_t t1 = UtilCpuGetTicks();
+    nanosleep(&delay, NULL);
+    uint64_t t2 = UtilCpuGetTicks();
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+
+    uint64_t ns = (uint64_t)(ts2.tv_sec - ts1.tv_sec) * 1000000000ULL +
+        ts2.tv_nsec - ts1.tv_nsec;
+    if (t2 > t1 && ns > 0)
+        latency_ns_per_tick = (double)ns / (double)(t2 - t1);
+
+    SCLogDebug("latency: %.4f ns per tick", latency_ns_per_tick);
+}
+
+static void LatencySlowLogInit(void)
+{
+#ifdef HAVE_LIBJANSSON
+    int enabled = 1;
+    intmax_t value = 0;
+
+    ConfNode *slow = ConfGetNode("latency.slow-packet");
+    if (slow != NULL && ConfGetChildValueBool(slow, "enabled", &enabled) && !enabled)
+        return;
+
+    slow_threshold_ns = (uint64_t)LATENCY_SLOW_THRESHOLD_DEFAULT * 1000;
+    if (ConfGetInt("latency.slow-packet.threshold", &value) == 1) {
+        if (value <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "latency.slow-packet.threshold "
+                    "must be above 0, using %u", LATENCY_SLOW_THRESHOLD_DEFAULT);
+        } else {
+            slow_threshold_ns = (uint64_t)value * 1000;
+        }
+    }
+    if (ConfGetInt("latency.slow-packet.max-per-second", &value) == 1 && value >= 0) {
+        slow_max_per_sec = (uint32_t)value;
+    }
+
+    char *filename = NULL;
+    if (ConfGet("latency.slow-packet.filename", &filename) != 1)
+        filename = "slow-packets.json";
+
+    char path[PATH_MAX];
+    if (PathIsAbsolute(filename)) {
+        strlcpy(path, filename, sizeof(path));
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", ConfigGetLogDirectory(), filename);
+    }
+
+    slow_fp = fopen(path, "a");
+    if (slow_fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open slow packet log %s: %s",
+                path, strerror(errno));
+        return;
+    }
+    SCLogConfig("latency: logging packets slower than %"PRIu64" usec to %s",
+            slow_threshold_ns / 1000, path);
+#endif
+}
+
+void LatencyInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("latency.enabled", &enabled) != 1 || !enabled)
+        return;
+
+#ifndef TLS
+    if (pthread_key_create(&latency_thread_key, NULL) != 0) {
+        SCLogError(SC_ERR_THREAD_INIT, "failed to create latency thread key");
+        return;
+    }
+#endif
+    LatencyCalibrate();
+
+    /* offline the packet time is the time in the file */
+    if (run_mode != RUNMODE_PCAP_FILE && run_mode != RUNMODE_ERF_FILE) {
+        latency_capture_enabled = 1;
+    }
+
+    LatencySlowLogInit();
+    latency_enabled = 1;
+    SCLogConfig("latency: tracking enabled%s", latency_capture_enabled ?
+            ", including capture to release" : "");
+}
+
+void LatencyDestroy(void)
+{
+    latency_enabled = 0;
+    latency_capture_enabled = 0;
+
+    SCMutexLock(&latency_threads_lock);
+    LatencyThreadCtx *ctx = latency_threads;
+    while (ctx != NULL) {
+        LatencyThreadCtx *next = ctx->next;
+        SCFree(ctx);
+        ctx = next;
+    }
+    latency_threads = NULL;
+    SCMutexUnlock(&latency_threads_lock);
+
+    if (slow_fp != NULL) {
+        fclose(slow_fp);
+        slow_fp = NULL;
+    }
+}
+
+#ifdef UNITTESTS
+static int LatencyTestBucket01(void)
+{
+    uint64_t v;
+
+    /* small values are exact */
+    for (v = 0; v < LATENCY_SUB_BUCKETS * 2; v++) {
+        FAIL_IF(LatencyBucket(v) != v);
+        FAIL_IF(LatencyBucketValue(LatencyBucket(v)) != v);
+    }
+
+    /* larger values are within 1/32th and bucket values are monotonic */
+    uint32_t prev = 0;
+    for (v = 1; v < (1ULL << LATENCY_MAX_BITS); v = v * 3 / 2 + 1) {
+        uint32_t b = LatencyBucket(v);
+        FAIL_IF(b >= LATENCY_BUCKETS);
+        FAIL_IF(b < prev);
+        uint64_t hv = LatencyBucketValue(b);
+        FAIL_IF(hv < v);
+        FAIL_IF(hv - v > v / LATENCY_SUB_BUCKETS);
+        prev = b;
+    }
+
+    /* values past the max are capped */
+    FAIL_IF(LatencyBucket(~0ULL) != LATENCY_BUCKETS - 1);
+    PASS;
+}
+
+static int LatencyTestPercentile01(void)
+{
+    LatencyThreadCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    FAIL_IF_NULL(ctx);
+
+    /* 999 fast packets and 1 slow one */
+    int i;
+    for (i = 0; i < 999; i++)
+        LatencyRecord(ctx, LATENCY_WORKER, 1000);
+    LatencyRecord(ctx, LATENCY_WORKER, 1000000);
+
+    const LatencyHistogram *h = &ctx->h[LATENCY_WORKER];
+    FAIL_IF(h->cnt != 1000);
+    FAIL_IF(h->max != 1000000);
+    uint64_t p50 = LatencyHistogramPercentile(h, 50.0);
+    FAIL_IF(p50 < 1000 || p50 > 1000 + 1000 / LATENCY_SUB_BUCKETS);
+    FAIL_IF(LatencyHistogramPercentile(h, 99.9) > 1000 + 1000 / LATENCY_SUB_BUCKETS);
+    FAIL_IF(LatencyHistogramPercentile(h, 100.0) != 1000000);
+
+    LatencyHistogram empty;
+    memset(&empty, 0, sizeof(empty));
+    FAIL_IF(LatencyHistogramPercentile(&empty, 99.0) != 0);
+
+    SCFree(ctx);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LatencyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LatencyTestBucket01", LatencyTestBucket01);
+    UtRegisterTest("LatencyTestPercentile01", LatencyTestPercentile01);
+#endif
+}
@@ -0,0 +1,132 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Latency histograms of the packet pipeline and slow packet log
+ */
+
+#ifndef __UTIL_LATENCY_H__
+#define __UTIL_LATENCY_H__
+
+#include "util-cpu.h"
+
+/** each power of 2 is split in 2^LATENCY_SUB_BITS linear buckets,
+ *  so a value is off by at most 1/32th (~3%) */
+#define LATENCY_SUB_BITS    5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+/** values (ns) are capped at 2^LATENCY_MAX_BITS, ~18 minutes */
+#define LATENCY_MAX_BITS    40
+#define LATENCY_BUCKETS     ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+enum LatencyType {
+    LATENCY_CAPTURE,    /**< capture timestamp to release of the packet */
+    LATENCY_WORKER,     /**< time spent in the flow worker */
+    LATENCY_FLOW,
+    LATENCY_STREAM,
+    LATENCY_APPLAYERUDP,
+    LATENCY_DETECT,
+    LATENCY_FLOW_LOCK,  /**< wait for the flow lock in the flow hash */
+    LATENCY_TYPE_MAX,
+};
+
+/** log linear (HDR style) histogram of ns values */
+typedef struct LatencyHistogram_ {
+    uint64_t cnt;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+/** histograms of a thread, only updated by the thread itself */
+typedef struct LatencyThreadCtx_ {
+    char name[16];
+    LatencyHistogram h[LATENCY_TYPE_MAX];
+    /** flow lock wait of the current packet, for the slow packet log */
+    uint64_t lock_ns;
+    struct LatencyThreadCtx_ *next;
+} LatencyThreadCtx;
+
+/** stage times of a packet in the flow worker */
+typedef struct LatencyPacketTimer_ {
+    LatencyThreadCtx *ctx;  /**< NULL if the packet isn't timed */
+    uint64_t start;
+    uint64_t mark;
+    uint64_t ns[LATENCY_TYPE_MAX];
+} LatencyPacketTimer;
+
+extern int latency_enabled;
+extern int latency_capture_enabled;
+extern double latency_ns_per_tick;
+
+void LatencyInit(void);
+void LatencyDestroy(void);
+LatencyThreadCtx *LatencyThreadCtxGet(ThreadVars *tv);
+uint32_t LatencyBucket(uint64_t ns);
+uint64_t LatencyBucketValue(uint32_t bucket);
+uint64_t LatencyHistogramPercentile(const LatencyHistogram *h, double pct);
+void LatencyCapture(ThreadVars *tv, const Packet *p);
+void LatencyPacketTimerEnd(LatencyPacketTimer *t, ThreadVars *tv, const Packet *p,
+        DetectEngineThreadCtx *det_ctx);
+#ifdef HAVE_LIBJANSSON
+json_t *LatencyToJSON(int threads);
+#endif
+void LatencyRegisterTests(void);
+
+static inline void LatencyRecord(LatencyThreadCtx *ctx, int type, uint64_t ns)
+{
+    LatencyHistogram *h = &ctx->h[type];
+    h->buckets[LatencyBucket(ns)]++;
+    h->cnt++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+static inline uint64_t LatencyTicksToNs(uint64_t ticks)
+{
+    return (uint64_t)((double)ticks * latency_ns_per_tick);
+}
+
+static inline void LatencyPacketTimerStart(LatencyPacketTimer *t, ThreadVars *tv)
+{
+    t->ctx = LatencyThreadCtxGet(tv);
+    if (t->ctx != NULL) {
+        t->ctx->lock_ns = 0;
+        t->start = t->mark = UtilCpuGetTicks();
+        memset(t->ns, 0, sizeof(t->ns));
+    }
+}
+
+/** \brief close the stage that ran since the previous mark */
+#define LATENCY_TIMER_MARK(t, type) do {                            \
+    if (unlikely((t)->ctx != NULL)) {                               \
+        uint64_t now_ = UtilCpuGetTicks();                          \
+        (t)->ns[(type)] = LatencyTicksToNs(now_ - (t)->mark);       \
+        LatencyRecord((t)->ctx, (type), (t)->ns[(type)]);           \
+        (t)->mark = now_;                                           \
+    }                                                               \
+} while (0)
+
+/** \brief skip the time since the previous mark */
+#define LATENCY_TIMER_SKIP(t) do {                                  \
+    if (unlikely((t)->ctx != NULL))                                 \
+        (t)->mark = UtilCpuGetTicks();                              \
+} while (0)
+
+#endif /* __UTIL_LATENCY_H__ */
@@ -0,0 +1,454 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Overload load shedding
+ *
+ * The capture threads count how often they run out of packets and have
+ * to wait for the workers to return some. The first flow manager checks
+ * the count each pass: if there were 'wait-threshold' or more waits the
+ * level goes up one step, after 'recover-time' seconds without them it
+ * goes down one step. The steps are:
+ *
+ * 1. raw stream inspection is skipped
+ * 2. http request and response body inspection is skipped as well
+ * 3. flows of the low priority class get no detection at all
+ *
+ * The low priority class is a list of addresses, ports and app-layer
+ * protocols from 'load-shed.low-priority'.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threadvars.h"
+#include "flow.h"
+#include "app-layer.h"
+#include "app-layer-protos.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-load-shed.h"
+#include "util-radix-tree.h"
+#include "util-unittest.h"
+
+#define LOAD_SHED_RECOVER_TIME_DEFAULT      10
+#define LOAD_SHED_WAIT_THRESHOLD_DEFAULT    1
+
+int load_shed_enabled = 0;
+SC_ATOMIC_DECL_AND_INIT(int, load_shed_level);
+SC_ATOMIC_DECL_AND_INIT(uint64_t, load_shed_pool_waits);
+
+static uint32_t load_shed_recover_time = LOAD_SHED_RECOVER_TIME_DEFAULT;
+static uint64_t load_shed_wait_threshold = LOAD_SHED_WAIT_THRESHOLD_DEFAULT;
+
+/* controller state, only used by the first flow manager */
+static uint64_t load_shed_waits_seen = 0;
+static time_t load_shed_calm_since = 0;
+
+/* the low priority class */
+static SCRadixTree *load_shed_addrs = NULL;
+static uint8_t load_shed_ports[65536 / 8];
+static int load_shed_have_ports = 0;
+static uint8_t load_shed_alprotos[ALPROTO_MAX];
+static int load_shed_have_alprotos = 0;
+
+static uint16_t load_shed_level_id = 0;
+static uint16_t load_shed_changes_id = 0;
+static uint16_t load_shed_waits_id = 0;
+
+const char *LoadShedLevelToString(int level)
+{
+    switch (level) {
+        case LOAD_SHED_NONE:
+            return "none";
+        case LOAD_SHED_RAW_STREAM:
+            return "raw-stream";
+        case LOAD_SHED_BODY:
+            return "body";
+        case LOAD_SHED_LOW_PRIORITY:
+            return "low-priority";
+    }
+    return "unknown";
+}
+
+static inline int LoadShedPortIsSet(uint16_t port)
+{
+    return (load_shed_ports[port >> 3] & (1 << (port & 7))) != 0;
+}
+
+static int LoadShedAddAddress(const char *str)
+{
+    SCRadixNode *node;
+    if (strchr(str, ':') != NULL)
+        node = SCRadixAddKeyIPV6String(str, load_shed_addrs, NULL);
+    else
+        node = SCRadixAddKeyIPV4String(str, load_shed_addrs, NULL);
+    if (node == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "load-shed: invalid low priority "
+                "address \"%s\"", str);
+        return -1;
+    }
+    return 0;
+}
+
+static int LoadShedAddPort(const char *str)
+{
+    uint16_t port = 0;
+    if (ByteExtractStringUint16(&port, 10, strlen(str), str) <= 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "load-shed: invalid low priority "
+                "port \"%s\"", str);
+        return -1;
+    }
+    load_shed_ports[port >> 3] |= (1 << (port & 7));
+    load_shed_have_ports = 1;
+    return 0;
+}
+
+static int LoadShedAddAppProto(const char *str)
+{
+    AppProto alproto = AppLayerGetProtoByName((char *)str);
+    if (alproto == ALPROTO_UNKNOWN || alproto >= ALPROTO_MAX) {
+        SCLogError(SC_ERR_INVALID_VALUE, "load-shed: unknown low priority "
+                "app-layer protocol \"%s\"", str);
+        return -1;
+    }
+    load_shed_alprotos[alproto] = 1;
+    load_shed_have_alprotos = 1;
+    return 0;
+}
+
+static void LoadShedParseList(const char *name, int (*Add)(const char *))
+{
+    char key[64];
+    snprintf(key, sizeof(key), "load-shed.low-priority.%s", name);
+
+    ConfNode *node = ConfGetNode(key);
+    if (node == NULL)
+        return;
+
+    ConfNode *item;
+    TAILQ_FOREACH(item, &node->head, next) {
+        if (item->val != NULL)
+            (void)Add(item->val);
+    }
+}
+
+static void LoadShedResetClass(void)
+{
+    if (load_shed_addrs != NULL) {
+        SCRadixReleaseRadixTree(load_shed_addrs);
+        load_shed_addrs = NULL;
+    }
+    memset(load_shed_ports, 0, sizeof(load_shed_ports));
+    load_shed_have_ports = 0;
+    memset(load_shed_alprotos, 0, sizeof(load_shed_alprotos));
+    load_shed_have_alprotos = 0;
+}
+
+void LoadShedInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("load-shed.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    intmax_t v = 0;
+    if (ConfGetInt("load-shed.recover-time", &v) == 1) {
+        if (v < 1 || v > 3600) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "load-shed.recover-time "
+                    "must be between 1 and 3600 seconds, using %u",
+                    LOAD_SHED_RECOVER_TIME_DEFAULT);
+        } else {
+            load_shed_recover_time = (uint32_t)v;
+        }
+    }
+    if (ConfGetInt("load-shed.wait-threshold", &v) == 1) {
+        if (v < 1) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "load-shed.wait-threshold "
+                    "must be 1 or more, using %u",
+                    LOAD_SHED_WAIT_THRESHOLD_DEFAULT);
+        } else {
+            load_shed_wait_threshold = (uint64_t)v;
+        }
+    }
+
+    LoadShedResetClass();
+    load_shed_addrs = SCRadixCreateRadixTree(NULL, NULL);
+    if (load_shed_addrs == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "load-shed: failed to allocate the "
+                "address tree, load shedding disabled");
+        return;
+    }
+    LoadShedParseList("addresses", LoadShedAddAddress);
+    LoadShedParseList("ports", LoadShedAddPort);
+    LoadShedParseList("app-protos", LoadShedAddAppProto);
+
+    SC_ATOMIC_SET(load_shed_level, LOAD_SHED_NONE);
+    SC_ATOMIC_SET(load_shed_pool_waits, 0);
+    load_shed_waits_seen = 0;
+    load_shed_calm_since = 0;
+    load_shed_enabled = 1;
+
+    SCLogConfig("load-shed: wait-threshold %"PRIu64", recover-time %us",
+            load_shed_wait_threshold, load_shed_recover_time);
+}
+
+void LoadShedDeinit(void)
+{
+    load_shed_enabled = 0;
+    SC_ATOMIC_SET(load_shed_level, LOAD_SHED_NONE);
+    LoadShedResetClass();
+}
+
+/** \brief register the counters on the thread running the checks */
+void LoadShedRegisterCounters(ThreadVars *tv)
+{
+    if (!load_shed_enabled)
+        return;
+
+    load_shed_level_id = StatsRegisterCounter("load_shed.level", tv);
+    load_shed_changes_id = StatsRegisterCounter("load_shed.level_changes", tv);
+    load_shed_waits_id = StatsRegisterCounter("load_shed.pool_waits", tv);
+}
+
+/** \internal
+ *  \brief next level given the waits since the last pass
+ *
+ *  Up one step per pass with waits, down one step per 'recover-time'
+ *  seconds without them.
+ */
+static int LoadShedNextLevel(int level, uint64_t waits, time_t now)
+{
+    if (waits >= load_shed_wait_threshold) {
+        load_shed_calm_since = now;
+        return level < LOAD_SHED_MAX - 1 ? level + 1 : level;
+    }
+    if (level > LOAD_SHED_NONE &&
+            now - load_shed_calm_since >= (time_t)load_shed_recover_time) {
+        load_shed_calm_since = now;
+        return level - 1;
+    }
+    return level;
+}
+
+/** \brief update the level from the pool waits
+ *
+ *  Called from the first flow manager each pass.
+ */
+void LoadShedCheck(ThreadVars *tv)
+{
+    if (!load_shed_enabled)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    const uint64_t total = SC_ATOMIC_GET(load_shed_pool_waits);
+    const uint64_t waits = total - load_shed_waits_seen;
+    load_shed_waits_seen = total;
+
+    const int prev = SC_ATOMIC_GET(load_shed_level);
+    const int level = LoadShedNextLevel(prev, waits, ts.tv_sec);
+
+    if (tv != NULL && waits > 0)
+        StatsAddUI64(tv, load_shed_waits_id, waits);
+    if (level == prev)
+        return;
+
+    SC_ATOMIC_SET(load_shed_level, level);
+    if (level > prev) {
+        SCLogWarning(SC_ERR_LOAD_SHED, "load-shed: %"PRIu64" packet pool "
+                "waits, level %s -> %s", waits, LoadShedLevelToString(prev),
+                LoadShedLevelToString(level));
+    } else {
+        SCLogNotice("load-shed: no packet pool waits for %us, level %s -> %s",
+                load_shed_recover_time, LoadShedLevelToString(prev),
+                LoadShedLevelToString(level));
+    }
+    if (tv != NULL) {
+        StatsSetUI64(tv, load_shed_level_id, (uint64_t)level);
+        StatsIncr(tv, load_shed_changes_id);
+    }
+}
+
+/**
+ * \brief check if a flow is in the low priority class
+ *
+ * The address and port part is looked up once per flow, the app-layer
+ * protocol once it is known. The result is cached in Flow::load_shed.
+ *
+ * \note the flow must be locked
+ */
+int LoadShedFlowIsLowPriority(Flow *f)
+{
+    if (f->load_shed & LOAD_SHED_FLOW_LOW_PRIORITY)
+        return 1;
+
+    if (!(f->load_shed & LOAD_SHED_FLOW_CHECKED)) {
+        f->load_shed |= LOAD_SHED_FLOW_CHECKED;
+
+        if (load_shed_have_ports &&
+                (LoadShedPortIsSet(f->sp) || LoadShedPortIsSet(f->dp))) {
+            f->load_shed |= LOAD_SHED_FLOW_LOW_PRIORITY;
+            return 1;
+        }
+        if (load_shed_addrs != NULL) {
+            SCRadixNode *node = NULL;
+            if (FLOW_IS_IPV4(f)) {
+                node = SCRadixFindKeyIPV4BestMatch((uint8_t *)&f->src.addr_data32[0],
+                        load_shed_addrs, NULL);
+                if (node == NULL)
+                    node = SCRadixFindKeyIPV4BestMatch((uint8_t *)&f->dst.addr_data32[0],
+                            load_shed_addrs, NULL);
+            } else if (FLOW_IS_IPV6(f)) {
+                node = SCRadixFindKeyIPV6BestMatch((uint8_t *)f->src.addr_data32,
+                        load_shed_addrs, NULL);
+                if (node == NULL)
+                    node = SCRadixFindKeyIPV6BestMatch((uint8_t *)f->dst.addr_data32,
+                            load_shed_addrs, NULL);
+            }
+            if (node != NULL) {
+                f->load_shed |= LOAD_SHED_FLOW_LOW_PRIORITY;
+                return 1;
+            }
+        }
+    }
+
+    if (!(f->load_shed & LOAD_SHED_FLOW_ALPROTO_CHECKED) &&
+            f->alproto != ALPROTO_UNKNOWN) {
+        f->load_shed |= LOAD_SHED_FLOW_ALPROTO_CHECKED;
+        if (load_shed_have_alprotos && f->alproto < ALPROTO_MAX &&
+                load_shed_alprotos[f->alproto]) {
+            f->load_shed |= LOAD_SHED_FLOW_LOW_PRIORITY;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifdef UNITTESTS
+/** \test level steps up per pass with waits and down after recover-time */
+static int LoadShedTest01(void)
+{
+    uint32_t saved_recover = load_shed_recover_time;
+    uint64_t saved_threshold = load_shed_wait_threshold;
+    load_shed_recover_time = 10;
+    load_shed_wait_threshold = 2;
+    load_shed_calm_since = 0;
+
+    int level = LOAD_SHED_NONE;
+    /* below the threshold */
+    level = LoadShedNextLevel(level, 1, 100);
+    FAIL_IF(level != LOAD_SHED_NONE);
+
+    level = LoadShedNextLevel(level, 5, 100);
+    FAIL_IF(level != LOAD_SHED_RAW_STREAM);
+    level = LoadShedNextLevel(level, 5, 101);
+    FAIL_IF(level != LOAD_SHED_BODY);
+    level = LoadShedNextLevel(level, 5, 102);
+    FAIL_IF(level != LOAD_SHED_LOW_PRIORITY);
+    level = LoadShedNextLevel(level, 5, 103);
+    FAIL_IF(level != LOAD_SHED_LOW_PRIORITY);
+
+    /* calm, but not for long enough */
+    level = LoadShedNextLevel(level, 0, 110);
+    FAIL_IF(level != LOAD_SHED_LOW_PRIORITY);
+    level = LoadShedNextLevel(level, 0, 113);
+    FAIL_IF(level != LOAD_SHED_BODY);
+    level = LoadShedNextLevel(level, 0, 120);
+    FAIL_IF(level != LOAD_SHED_BODY);
+    level = LoadShedNextLevel(level, 0, 123);
+    FAIL_IF(level != LOAD_SHED_RAW_STREAM);
+
+    /* new waits restart the calm period */
+    level = LoadShedNextLevel(level, 3, 124);
+    FAIL_IF(level != LOAD_SHED_BODY);
+    level = LoadShedNextLevel(level, 0, 133);
+    FAIL_IF(level != LOAD_SHED_BODY);
+    level = LoadShedNextLevel(level, 0, 134);
+    FAIL_IF(level != LOAD_SHED_RAW_STREAM);
+    level = LoadShedNextLevel(level, 0, 144);
+    FAIL_IF(level != LOAD_SHED_NONE);
+    level = LoadShedNextLevel(level, 0, 200);
+    FAIL_IF(level != LOAD_SHED_NONE);
+
+    load_shed_recover_time = saved_recover;
+    load_shed_wait_threshold = saved_threshold;
+    PASS;
+}
+
+/** \test low priority classification of flows */
+static int LoadShedTest02(void)
+{
+    LoadShedResetClass();
+    load_shed_addrs = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(load_shed_addrs);
+    FAIL_IF(LoadShedAddAddress("192.168.1.0/24") != 0);
+    FAIL_IF(LoadShedAddAddress("2001:db8::/32") != 0);
+    FAIL_IF(LoadShedAddAddress("not-an-address") == 0);
+    FAIL_IF(LoadShedAddPort("123") != 0);
+    FAIL_IF(LoadShedAddPort("70000") == 0);
+
+    Flow f;
+    memset(&f, 0, sizeof(f));
+    f.flags = FLOW_IPV4;
+    f.src.addr_data32[0] = htonl(0x0a000001);   /* 10.0.0.1 */
+    f.dst.addr_data32[0] = htonl(0x0a000002);
+    f.sp = 1024;
+    f.dp = 80;
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 0);
+    FAIL_IF(!(f.load_shed & LOAD_SHED_FLOW_CHECKED));
+
+    /* cached: the address is not looked at again */
+    f.dst.addr_data32[0] = htonl(0xc0a80105);   /* 192.168.1.5 */
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 0);
+    f.load_shed = 0;
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 1);
+
+    memset(&f, 0, sizeof(f));
+    f.flags = FLOW_IPV4;
+    f.sp = 123;
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 1);
+
+    memset(&f, 0, sizeof(f));
+    f.flags = FLOW_IPV6;
+    f.src.addr_data32[0] = htonl(0x20010db8);
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 1);
+
+    /* app-layer protocol, only once it is known */
+    load_shed_alprotos[ALPROTO_TLS] = 1;
+    load_shed_have_alprotos = 1;
+    memset(&f, 0, sizeof(f));
+    f.flags = FLOW_IPV4;
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 0);
+    f.alproto = ALPROTO_TLS;
+    FAIL_IF(LoadShedFlowIsLowPriority(&f) != 1);
+
+    LoadShedResetClass();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LoadShedRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LoadShedTest01", LoadShedTest01);
+    UtRegisterTest("LoadShedTest02", LoadShedTest02);
+#endif
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Overload load shedding: degrade inspection in steps when the capture
+ * threads have to wait for packets.
+ */
+
+#ifndef __UTIL_LOAD_SHED_H__
+#define __UTIL_LOAD_SHED_H__
+
+#include "threadvars.h"
+#include "flow.h"
+#include "util-atomic.h"
+
+enum LoadShedLevel {
+    LOAD_SHED_NONE = 0,
+    LOAD_SHED_RAW_STREAM,       /**< skip raw stream inspection */
+    LOAD_SHED_BODY,             /**< also skip http body inspection */
+    LOAD_SHED_LOW_PRIORITY,     /**< also skip detection for low priority flows */
+    LOAD_SHED_MAX,
+};
+
+/* Flow::load_shed bits, caching the low priority classification */
+#define LOAD_SHED_FLOW_CHECKED          0x01    /**< addresses and ports */
+#define LOAD_SHED_FLOW_ALPROTO_CHECKED  0x02
+#define LOAD_SHED_FLOW_LOW_PRIORITY     0x04
+
+extern int load_shed_enabled;
+SC_ATOMIC_EXTERN(int, load_shed_level);
+SC_ATOMIC_EXTERN(uint64_t, load_shed_pool_waits);
+
+/** \brief current level, LOAD_SHED_NONE if disabled */
+static inline int LoadShedLevel(void)
+{
+    return SC_ATOMIC_GET(load_shed_level);
+}
+
+/** \brief a capture thread ran out of packets and has to wait */
+static inline void LoadShedPoolWait(void)
+{
+    if (unlikely(load_shed_enabled))
+        (void)SC_ATOMIC_ADD(load_shed_pool_waits, 1);
+}
+
+int LoadShedFlowIsLowPriority(Flow *f);
+
+void LoadShedInit(void);
+void LoadShedDeinit(void);
+void LoadShedRegisterCounters(ThreadVars *tv);
+void LoadShedCheck(ThreadVars *tv);
+const char *LoadShedLevelToString(int level);
+void LoadShedRegisterTests(void);
+
+#endif /* __UTIL_LOAD_SHED_H__ */
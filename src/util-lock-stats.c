@@ -0,0 +1,237 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock contention sampling for release builds.
+ *
+ * Unlike the lock profiling of --enable-profiling-locks only contended
+ * acquisitions of the lock sites below are looked at, so it can be left
+ * on in production. Enabled with "stats.lock-contention".
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-lock-stats.h"
+#include "util-unittest.h"
+
+typedef struct LockStatsSiteCounters_ {
+    uint64_t contended;
+    uint64_t wait_us;
+    uint64_t max_wait_us;
+    uint64_t hist[LOCK_STATS_HIST_SIZE];
+} LockStatsSiteCounters;
+
+static const char *lock_stats_site_names[LOCK_SITE_MAX] = {
+    "flow_bucket",
+    "flow",
+    "hash_row",
+    "pool",
+    "logfile",
+};
+
+static int lock_stats_enabled = 0;
+static LockStatsSiteCounters lock_stats[LOCK_SITE_MAX];
+
+static inline uint64_t LockStatsNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static inline int LockStatsHistBucket(uint64_t us)
+{
+    int b = 0;
+    while (us > 0 && b < LOCK_STATS_HIST_SIZE - 1) {
+        b++;
+        us >>= 2;
+    }
+    return b;
+}
+
+static void LockStatsRecord(int site, uint64_t us)
+{
+    LockStatsSiteCounters *c = &lock_stats[site];
+
+    (void)SCAtomicFetchAndAdd(&c->contended, 1);
+    (void)SCAtomicFetchAndAdd(&c->wait_us, us);
+    (void)SCAtomicFetchAndAdd(&c->hist[LockStatsHistBucket(us)], 1);
+
+    uint64_t max = c->max_wait_us;
+    while (us > max) {
+        if (SCAtomicCompareAndSwap(&c->max_wait_us, max, us))
+            break;
+        max = c->max_wait_us;
+    }
+}
+
+/**
+ * \brief slow path of SCMutexLockSite(): the trylock failed
+ */
+void LockStatsMutexWait(SCMutex *m, int site)
+{
+    if (likely(lock_stats_enabled == 0)) {
+        SCMutexLock(m);
+        return;
+    }
+
+    uint64_t start = LockStatsNowUs();
+    SCMutexLock(m);
+    LockStatsRecord(site, LockStatsNowUs() - start);
+}
+
+static inline uint64_t LockStatsGet(uint64_t *v)
+{
+    return SCAtomicFetchAndAdd(v, 0);
+}
+
+#define LOCK_STATS_COUNTER_FUNCS(site, name)                        \
+static uint64_t LockStatsContended_##name(void)                     \
+{                                                                   \
+    return LockStatsGet(&lock_stats[(site)].contended);             \
+}                                                                   \
+static uint64_t LockStatsWaitUs_##name(void)                        \
+{                                                                   \
+    return LockStatsGet(&lock_stats[(site)].wait_us);               \
+}
+
+LOCK_STATS_COUNTER_FUNCS(LOCK_SITE_FLOW_BUCKET, flow_bucket)
+LOCK_STATS_COUNTER_FUNCS(LOCK_SITE_FLOW, flow)
+LOCK_STATS_COUNTER_FUNCS(LOCK_SITE_HASH_ROW, hash_row)
+LOCK_STATS_COUNTER_FUNCS(LOCK_SITE_POOL, pool)
+LOCK_STATS_COUNTER_FUNCS(LOCK_SITE_LOGFILE, logfile)
+
+#define LOCK_STATS_REGISTER(name) do {                                  \
+    StatsRegisterGlobalCounter("locks." #name ".contended",             \
+            LockStatsContended_##name);                                 \
+    StatsRegisterGlobalCounter("locks." #name ".wait_us",               \
+            LockStatsWaitUs_##name);                                    \
+} while (0)
+
+/**
+ * \brief read the config and register the counters
+ */
+void LockStatsInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("stats.lock-contention", &enabled) != 1 || !enabled)
+        return;
+
+    memset(lock_stats, 0, sizeof(lock_stats));
+    lock_stats_enabled = 1;
+
+    LOCK_STATS_REGISTER(flow_bucket);
+    LOCK_STATS_REGISTER(flow);
+    LOCK_STATS_REGISTER(hash_row);
+    LOCK_STATS_REGISTER(pool);
+    LOCK_STATS_REGISTER(logfile);
+
+    SCLogConfig("lock contention sampling enabled");
+}
+
+#ifdef HAVE_LIBJANSSON
+/**
+ * \brief per lock site counters and wait histograms
+ *
+ * \retval js object, or NULL if sampling is disabled
+ */
+json_t *LockStatsToJSON(void)
+{
+    if (lock_stats_enabled == 0)
+        return NULL;
+
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+
+    int s;
+    for (s = 0; s < LOCK_SITE_MAX; s++) {
+        LockStatsSiteCounters *c = &lock_stats[s];
+        json_t *jsite = json_object();
+        json_t *jhist = json_array();
+        if (jsite == NULL || jhist == NULL) {
+            if (jsite != NULL)
+                json_decref(jsite);
+            if (jhist != NULL)
+                json_decref(jhist);
+            json_decref(js);
+            return NULL;
+        }
+
+        json_object_set_new(jsite, "contended",
+                json_integer(LockStatsGet(&c->contended)));
+        json_object_set_new(jsite, "wait_us",
+                json_integer(LockStatsGet(&c->wait_us)));
+        json_object_set_new(jsite, "max_wait_us",
+                json_integer(LockStatsGet(&c->max_wait_us)));
+        int b;
+        for (b = 0; b < LOCK_STATS_HIST_SIZE; b++) {
+            json_array_append_new(jhist,
+                    json_integer(LockStatsGet(&c->hist[b])));
+        }
+        json_object_set_new(jsite, "wait_hist", jhist);
+        json_object_set_new(js, lock_stats_site_names[s], jsite);
+    }
+    return js;
+}
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+
+/** \test histogram buckets and the recorded counters */
+static int LockStatsTest01(void)
+{
+    FAIL_IF(LockStatsHistBucket(0) != 0);
+    FAIL_IF(LockStatsHistBucket(1) != 1);
+    FAIL_IF(LockStatsHistBucket(3) != 1);
+    FAIL_IF(LockStatsHistBucket(4) != 2);
+    FAIL_IF(LockStatsHistBucket(15) != 2);
+    FAIL_IF(LockStatsHistBucket(16) != 3);
+    FAIL_IF(LockStatsHistBucket(UINT64_MAX) != LOCK_STATS_HIST_SIZE - 1);
+
+    memset(lock_stats, 0, sizeof(lock_stats));
+    LockStatsRecord(LOCK_SITE_FLOW, 5);
+    LockStatsRecord(LOCK_SITE_FLOW, 100);
+    FAIL_IF(lock_stats[LOCK_SITE_FLOW].contended != 2);
+    FAIL_IF(lock_stats[LOCK_SITE_FLOW].wait_us != 105);
+    FAIL_IF(lock_stats[LOCK_SITE_FLOW].max_wait_us != 100);
+    FAIL_IF(lock_stats[LOCK_SITE_FLOW].hist[2] != 1);
+    FAIL_IF(lock_stats[LOCK_SITE_FLOW].hist[4] != 1);
+    FAIL_IF(lock_stats[LOCK_SITE_POOL].contended != 0);
+    memset(lock_stats, 0, sizeof(lock_stats));
+
+    /* uncontended: nothing is recorded */
+    SCMutex m = SCMUTEX_INITIALIZER;
+    SCMutexLockSite(&m, LOCK_SITE_LOGFILE);
+    SCMutexUnlock(&m);
+    FAIL_IF(lock_stats[LOCK_SITE_LOGFILE].contended != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void LockStatsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LockStatsTest01", LockStatsTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock contention sampling for release builds.
+ *
+ * The locks of a few hot sites are taken with a trylock first. Only if
+ * that fails, so the lock is contended, the wait is timed and counted
+ * for the site. Uncontended locks cost the same as before.
+ */
+
+#ifndef __UTIL_LOCK_STATS_H__
+#define __UTIL_LOCK_STATS_H__
+
+#include "threads.h"
+
+enum LockStatsSite {
+    LOCK_SITE_FLOW_BUCKET = 0,
+    LOCK_SITE_FLOW,
+    LOCK_SITE_HASH_ROW,     /**< host and ippair hash rows */
+    LOCK_SITE_POOL,
+    LOCK_SITE_LOGFILE,
+
+    LOCK_SITE_MAX,
+};
+
+/** wait histogram buckets: <1us, <4us, <16us, ... 4^(n-1)us and up */
+#define LOCK_STATS_HIST_SIZE    8
+
+void LockStatsMutexWait(SCMutex *m, int site);
+
+/** \brief lock 'm', timing the wait if it is held by another thread */
+#define SCMutexLockSite(m, site) do {           \
+    if (SCMutexTrylock((m)) != 0)               \
+        LockStatsMutexWait((m), (site));        \
+} while (0)
+
+void LockStatsInit(void);
+void LockStatsRegisterTests(void);
+
+#ifdef HAVE_LIBJANSSON
+json_t *LockStatsToJSON(void);
+#endif
+
+#endif /* __UTIL_LOCK_STATS_H__ */
@@ -0,0 +1,506 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming compression of log files.
+ *
+ * A file is one LZ4 or Zstandard frame. Every LogCompressWrite() ends with
+ * a flush, so everything written so far can be decompressed even while the
+ * file is still open, or after a crash. The compression state is kept
+ * between writes, so batches still compress against what came before. Each
+ * write should hold a batch of records, as done by the async writer, as a
+ * flush per record adds a block header per record.
+ */
+
+#include "suricata-common.h"
+#include "util-log-compress.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+struct LogCompress_ {
+    int method;
+    int level;
+    uint8_t *buf;           /**< compressed output */
+    size_t size;
+#ifdef HAVE_LIBLZ4
+    LZ4F_compressionContext_t lz4;
+    LZ4F_preferences_t lz4_prefs;
+#endif
+#ifdef HAVE_LIBZSTD
+    ZSTD_CStream *zstd;
+#endif
+};
+
+/**
+ * \brief Get the method for a "compression" config value
+ *
+ * \retval method or -1 if unknown or not compiled in
+ */
+int LogCompressParseMethod(const char *name)
+{
+    if (name == NULL || strcasecmp(name, "none") == 0 ||
+            strcasecmp(name, "no") == 0)
+        return LOG_COMPRESS_NONE;
+
+    if (strcasecmp(name, "lz4") == 0) {
+#ifdef HAVE_LIBLZ4
+        return LOG_COMPRESS_LZ4;
+#else
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "lz4 compression requested, "
+                "but not compiled in (--enable-lz4)");
+        return -1;
+#endif
+    }
+    if (strcasecmp(name, "zstd") == 0) {
+#ifdef HAVE_LIBZSTD
+        return LOG_COMPRESS_ZSTD;
+#else
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "zstd compression requested, "
+                "but not compiled in (--enable-zstd)");
+        return -1;
+#endif
+    }
+
+    SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid compression \"%s\", "
+            "expected none, lz4 or zstd", name);
+    return -1;
+}
+
+/** \brief file name suffix for a method */
+const char *LogCompressSuffix(int method)
+{
+    switch (method) {
+        case LOG_COMPRESS_LZ4:
+            return ".lz4";
+        case LOG_COMPRESS_ZSTD:
+            return ".zst";
+        default:
+            return "";
+    }
+}
+
+/** \internal
+ *  \brief make sure the output buffer holds at least size bytes */
+static int LogCompressReserve(LogCompress *c, size_t size)
+{
+    if (c->size >= size)
+        return 0;
+
+    uint8_t *ptr = SCRealloc(c->buf, size);
+    if (ptr == NULL)
+        return -1;
+    c->buf = ptr;
+    c->size = size;
+    return 0;
+}
+
+static int LogCompressOut(FILE *fp, const uint8_t *buf, size_t len)
+{
+    if (len > 0 && fwrite(buf, len, 1, fp) != 1)
+        return -1;
+    return 0;
+}
+
+/**
+ * \brief Create a compressor
+ *
+ * \param level compression level, 0 for the library default
+ */
+LogCompress *LogCompressNew(int method, int level)
+{
+    LogCompress *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+    c->method = method;
+    c->level = level;
+
+    switch (method) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4:
+            if (LZ4F_isError(LZ4F_createCompressionContext(&c->lz4,
+                            LZ4F_VERSION)))
+                goto error;
+            /* linked blocks: each flushed block can refer to the ones
+             * before it, which matters with small batches */
+            c->lz4_prefs.frameInfo.blockMode = LZ4F_blockLinked;
+            c->lz4_prefs.frameInfo.contentChecksumFlag =
+                LZ4F_contentChecksumEnabled;
+            c->lz4_prefs.compressionLevel = level;
+            break;
+#endif
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD:
+            c->zstd = ZSTD_createCStream();
+            if (c->zstd == NULL)
+                goto error;
+            if (LogCompressReserve(c, ZSTD_CStreamOutSize()) < 0)
+                goto error;
+            break;
+#endif
+        default:
+            goto error;
+    }
+    return c;
+
+error:
+    LogCompressFree(c);
+    return NULL;
+}
+
+void LogCompressFree(LogCompress *c)
+{
+    if (c == NULL)
+        return;
+#ifdef HAVE_LIBLZ4
+    if (c->lz4 != NULL)
+        LZ4F_freeCompressionContext(c->lz4);
+#endif
+#ifdef HAVE_LIBZSTD
+    if (c->zstd != NULL)
+        ZSTD_freeCStream(c->zstd);
+#endif
+    if (c->buf != NULL)
+        SCFree(c->buf);
+    SCFree(c);
+}
+
+/**
+ * \brief Start a new frame, call after opening a file
+ *
+ * \retval 0 ok, -1 error
+ */
+int LogCompressBegin(LogCompress *c, FILE *fp)
+{
+    switch (c->method) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            if (LogCompressReserve(c, LZ4F_HEADER_SIZE_MAX) < 0)
+                return -1;
+            size_t n = LZ4F_compressBegin(c->lz4, c->buf, c->size,
+                    &c->lz4_prefs);
+            if (LZ4F_isError(n)) {
+                SCLogError(SC_ERR_INVALID_VALUE, "lz4: %s",
+                        LZ4F_getErrorName(n));
+                return -1;
+            }
+            return LogCompressOut(fp, c->buf, n);
+        }
+#endif
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD: {
+            size_t r = ZSTD_initCStream(c->zstd, c->level);
+            if (ZSTD_isError(r)) {
+                SCLogError(SC_ERR_INVALID_VALUE, "zstd: %s",
+                        ZSTD_getErrorName(r));
+                return -1;
+            }
+            return 0;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+/**
+ * \brief Compress data to the file and flush it
+ *
+ * \retval bytes written to the file, -1 on error
+ */
+int LogCompressWrite(LogCompress *c, FILE *fp, const char *data, size_t len)
+{
+    switch (c->method) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            /* the bound covers the update and the flush of what the
+             * context still buffers */
+            if (LogCompressReserve(c, LZ4F_compressBound(len,
+                            &c->lz4_prefs)) < 0)
+                return -1;
+            size_t n = LZ4F_compressUpdate(c->lz4, c->buf, c->size,
+                    data, len, NULL);
+            if (LZ4F_isError(n))
+                return -1;
+            size_t f = LZ4F_flush(c->lz4, c->buf + n, c->size - n, NULL);
+            if (LZ4F_isError(f))
+                return -1;
+            if (LogCompressOut(fp, c->buf, n + f) < 0)
+                return -1;
+            return (int)(n + f);
+        }
+#endif
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD: {
+            ZSTD_inBuffer in = { data, len, 0 };
+            ZSTD_outBuffer out = { c->buf, c->size, 0 };
+            size_t r, written = 0;
+            while (in.pos < in.size) {
+                r = ZSTD_compressStream(c->zstd, &out, &in);
+                if (ZSTD_isError(r))
+                    return -1;
+                if (out.pos == out.size) {
+                    if (LogCompressOut(fp, c->buf, out.pos) < 0)
+                        return -1;
+                    written += out.pos;
+                    out.pos = 0;
+                }
+            }
+            do {
+                r = ZSTD_flushStream(c->zstd, &out);
+                if (ZSTD_isError(r))
+                    return -1;
+                if (LogCompressOut(fp, c->buf, out.pos) < 0)
+                    return -1;
+                written += out.pos;
+                out.pos = 0;
+            } while (r != 0);
+            return (int)written;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+/**
+ * \brief End the frame, call before closing a file
+ *
+ * \retval 0 ok, -1 error
+ */
+int LogCompressEnd(LogCompress *c, FILE *fp)
+{
+    switch (c->method) {
+#ifdef HAVE_LIBLZ4
+        case LOG_COMPRESS_LZ4: {
+            if (LogCompressReserve(c, LZ4F_compressBound(0,
+                            &c->lz4_prefs)) < 0)
+                return -1;
+            size_t n = LZ4F_compressEnd(c->lz4, c->buf, c->size, NULL);
+            if (LZ4F_isError(n))
+                return -1;
+            return LogCompressOut(fp, c->buf, n);
+        }
+#endif
+#ifdef HAVE_LIBZSTD
+        case LOG_COMPRESS_ZSTD: {
+            ZSTD_outBuffer out = { c->buf, c->size, 0 };
+            size_t r;
+            do {
+                r = ZSTD_endStream(c->zstd, &out);
+                if (ZSTD_isError(r))
+                    return -1;
+                if (LogCompressOut(fp, c->buf, out.pos) < 0)
+                    return -1;
+                out.pos = 0;
+            } while (r != 0);
+            return 0;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+/*
+ * ONLY TESTS BELOW THIS COMMENT
+ */
+
+#ifdef UNITTESTS
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+#define LOG_COMPRESS_TEST_RECORDS   1000
+
+/** \internal
+ *  \brief compress records in batches of 10 to a temp file
+ *
+ *  \param flushed set to the size of the file before the frame end
+ *  \retval file with the frame, rewound; NULL on error */
+static FILE *LogCompressTestWrite(int method, uint8_t **data, size_t *len,
+        long *flushed)
+{
+    char rec[128];
+    size_t size = LOG_COMPRESS_TEST_RECORDS * sizeof(rec);
+    uint8_t *buf = SCMalloc(size);
+    if (buf == NULL)
+        return NULL;
+    *len = 0;
+
+    FILE *fp = tmpfile();
+    LogCompress *c = LogCompressNew(method, 0);
+    if (fp == NULL || c == NULL || LogCompressBegin(c, fp) != 0)
+        goto error;
+
+    int i;
+    size_t batch = 0;
+    for (i = 0; i < LOG_COMPRESS_TEST_RECORDS; i++) {
+        int n = snprintf(rec, sizeof(rec), "{\"flow_id\":%d,"
+                "\"event_type\":\"flow\",\"src_port\":%d}\n", i * 7919,
+                1024 + i % 100);
+        memcpy(buf + *len, rec, n);
+        *len += n;
+        if (i % 10 == 9) {
+            if (LogCompressWrite(c, fp, (char *)buf + batch,
+                        *len - batch) <= 0)
+                goto error;
+            batch = *len;
+        }
+    }
+    fflush(fp);
+    *flushed = ftell(fp);
+    if (LogCompressEnd(c, fp) != 0)
+        goto error;
+    LogCompressFree(c);
+    rewind(fp);
+    *data = buf;
+    return fp;
+
+error:
+    if (fp != NULL)
+        fclose(fp);
+    LogCompressFree(c);
+    SCFree(buf);
+    return NULL;
+}
+#endif
+
+#ifdef HAVE_LIBLZ4
+/** \test lz4 round trip, and the flushed part decompresses on its own */
+static int LogCompressTestLz401(void)
+{
+    int result = 0;
+    uint8_t *data = NULL, *in = NULL, *out = NULL;
+    size_t len = 0;
+    long flushed = 0;
+    LZ4F_decompressionContext_t dctx = NULL;
+
+    FILE *fp = LogCompressTestWrite(LOG_COMPRESS_LZ4, &data, &len, &flushed);
+    if (fp == NULL)
+        return 0;
+
+    fseek(fp, 0, SEEK_END);
+    long clen = ftell(fp);
+    rewind(fp);
+    in = SCMalloc(clen);
+    out = SCMalloc(len);
+    if (in == NULL || out == NULL || fread(in, clen, 1, fp) != 1)
+        goto end;
+    /* batches of similar records must actually compress */
+    if (clen >= (long)len / 2)
+        goto end;
+
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+        goto end;
+    /* everything is there before the frame end */
+    size_t olen = len, ilen = flushed;
+    size_t r = LZ4F_decompress(dctx, out, &olen, in, &ilen, NULL);
+    if (LZ4F_isError(r) || olen != len || memcmp(out, data, len) != 0)
+        goto end;
+    /* and the rest is a valid frame end */
+    size_t olen2 = 0;
+    ilen = clen - flushed;
+    r = LZ4F_decompress(dctx, out, &olen2, in + flushed, &ilen, NULL);
+    if (r != 0)
+        goto end;
+
+    result = 1;
+end:
+    if (dctx != NULL)
+        LZ4F_freeDecompressionContext(dctx);
+    if (in != NULL)
+        SCFree(in);
+    if (out != NULL)
+        SCFree(out);
+    SCFree(data);
+    fclose(fp);
+    return result;
+}
+#endif
+
+#ifdef HAVE_LIBZSTD
+/** \test zstd round trip */
+static int LogCompressTestZstd01(void)
+{
+    int result = 0;
+    uint8_t *data = NULL, *in = NULL, *out = NULL;
+    size_t len = 0;
+    long flushed = 0;
+
+    FILE *fp = LogCompressTestWrite(LOG_COMPRESS_ZSTD, &data, &len, &flushed);
+    if (fp == NULL)
+        return 0;
+
+    fseek(fp, 0, SEEK_END);
+    long clen = ftell(fp);
+    rewind(fp);
+    in = SCMalloc(clen);
+    out = SCMalloc(len);
+    if (in == NULL || out == NULL || fread(in, clen, 1, fp) != 1)
+        goto end;
+    if (clen >= (long)len / 2)
+        goto end;
+
+    size_t r = ZSTD_decompress(out, len, in, clen);
+    if (ZSTD_isError(r) || r != len || memcmp(out, data, len) != 0)
+        goto end;
+
+    result = 1;
+end:
+    if (in != NULL)
+        SCFree(in);
+    if (out != NULL)
+        SCFree(out);
+    SCFree(data);
+    fclose(fp);
+    return result;
+}
+#endif
+
+static int LogCompressTestParse01(void)
+{
+    if (LogCompressParseMethod(NULL) != LOG_COMPRESS_NONE)
+        return 0;
+    if (LogCompressParseMethod("none") != LOG_COMPRESS_NONE)
+        return 0;
+    if (LogCompressParseMethod("gzip") != -1)
+        return 0;
+#ifdef HAVE_LIBZSTD
+    if (LogCompressParseMethod("zstd") != LOG_COMPRESS_ZSTD)
+        return 0;
+#endif
+    return 1;
+}
+#endif /* UNITTESTS */
+
+void LogCompressRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogCompressTestParse01", LogCompressTestParse01);
+#ifdef HAVE_LIBLZ4
+    UtRegisterTest("LogCompressTestLz401", LogCompressTestLz401);
+#endif
+#ifdef HAVE_LIBZSTD
+    UtRegisterTest("LogCompressTestZstd01", LogCompressTestZstd01);
+#endif
+#endif /* UNITTESTS */
+}
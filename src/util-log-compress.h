@@ -0,0 +1,46 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming compression of log files.
+ */
+
+#ifndef __UTIL_LOG_COMPRESS_H__
+#define __UTIL_LOG_COMPRESS_H__
+
+enum LogCompressMethod {
+    LOG_COMPRESS_NONE = 0,
+    LOG_COMPRESS_LZ4,
+    LOG_COMPRESS_ZSTD,
+};
+
+typedef struct LogCompress_ LogCompress;
+
+int LogCompressParseMethod(const char *name);
+const char *LogCompressSuffix(int method);
+
+LogCompress *LogCompressNew(int method, int level);
+void LogCompressFree(LogCompress *);
+int LogCompressBegin(LogCompress *, FILE *);
+int LogCompressWrite(LogCompress *, FILE *, const char *, size_t);
+int LogCompressEnd(LogCompress *, FILE *);
+
+void LogCompressRegisterTests(void);
+
+#endif /* __UTIL_LOG_COMPRESS_H__ */
@@ -0,0 +1,429 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Kafka producer backend for file-like outputs.
+ *
+ * Records are handed to the librdkafka producer, which queues, batches,
+ * compresses and sends them from its own threads. The packet threads never
+ * wait for the brokers: when the producer queue is full the record is
+ * dropped and counted. The topic is picked by the event_type of the record
+ * and the flow_id is used as message key, so all records of a flow land in
+ * the same partition.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-atomic.h"
+#include "util-logopenfile.h"
+#include "util-log-kafka.h"
+#include "util-unittest.h"
+
+#if defined(HAVE_LIBRDKAFKA) || defined(UNITTESTS)
+/** \internal
+ *  \brief find the value of a top level field in a compact JSON record
+ *
+ *  Only used to get event_type and flow_id out of records we built
+ *  ourselves, so no full parsing: the first occurance of the key wins.
+ *
+ *  \param name key including the quotes and colon, e.g. "\"flow_id\":"
+ *  \param value set to the start of the value, without quotes for strings
+ *  \param value_len set to the length of the value
+ *
+ *  \retval 1 found, 0 not found
+ */
+static int LogKafkaRecordField(const char *buffer, size_t len,
+        const char *name, const char **value, size_t *value_len)
+{
+    size_t name_len = strlen(name);
+    const char *p = memmem(buffer, len, name, name_len);
+    if (p == NULL)
+        return 0;
+
+    p += name_len;
+    const char *end = buffer + len;
+    if (p < end && *p == '"') {
+        p++;
+        const char *q = memchr(p, '"', end - p);
+        if (q == NULL)
+            return 0;
+        *value = p;
+        *value_len = q - p;
+        return 1;
+    }
+
+    const char *q = p;
+    while (q < end && *q >= '0' && *q <= '9')
+        q++;
+    if (q == p)
+        return 0;
+    *value = p;
+    *value_len = q - p;
+    return 1;
+}
+#endif
+
+#ifdef HAVE_LIBRDKAFKA
+
+#include <librdkafka/rdkafka.h>
+
+/** time to wait for the queue to drain on shutdown */
+#define LOG_KAFKA_FLUSH_TIMEOUT_MS  5000
+
+typedef struct LogKafkaTopic_ {
+    char *event_type;
+    size_t event_type_len;
+    rd_kafka_topic_t *rkt;
+} LogKafkaTopic;
+
+typedef struct LogKafkaCtx_ {
+    rd_kafka_t *rk;
+    rd_kafka_topic_t *default_rkt;  /**< for event types without a mapping */
+    LogKafkaTopic *topics;
+    uint32_t topics_cnt;
+} LogKafkaCtx;
+
+/* shared by all kafka outputs */
+SC_ATOMIC_DECLARE(uint64_t, kafka_produced);
+SC_ATOMIC_DECLARE(uint64_t, kafka_queue_full);
+SC_ATOMIC_DECLARE(uint64_t, kafka_delivery_failed);
+static int kafka_counters_registered = 0;
+
+static uint64_t LogKafkaProducedCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_produced);
+}
+
+static uint64_t LogKafkaQueueFullCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_queue_full);
+}
+
+static uint64_t LogKafkaDeliveryFailedCounter(void)
+{
+    return SC_ATOMIC_GET(kafka_delivery_failed);
+}
+
+/** \internal
+ *  \brief delivery report, called from rd_kafka_poll() and rd_kafka_flush() */
+static void LogKafkaDeliveryReport(rd_kafka_t *rk,
+        const rd_kafka_message_t *msg, void *opaque)
+{
+    if (msg->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        if (SC_ATOMIC_ADD(kafka_delivery_failed, 1) == 1) {
+            SCLogWarning(SC_ERR_SOCKET, "kafka: delivery failed: %s, "
+                    "further failures are only counted",
+                    rd_kafka_err2str(msg->err));
+        }
+    } else {
+        (void)SC_ATOMIC_ADD(kafka_produced, 1);
+    }
+}
+
+/** \internal
+ *  \brief set a librdkafka config option, exit on failure like the other
+ *         output config errors do */
+static void LogKafkaConfSet(rd_kafka_conf_t *conf, const char *name,
+        const char *value)
+{
+    char errstr[512];
+    if (rd_kafka_conf_set(conf, name, value, errstr, sizeof(errstr)) !=
+            RD_KAFKA_CONF_OK) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "kafka: invalid option "
+                "%s: %s: %s", name, value, errstr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void LogKafkaCtxFree(LogKafkaCtx *kafka)
+{
+    uint32_t u;
+    for (u = 0; u < kafka->topics_cnt; u++) {
+        if (kafka->topics[u].rkt != NULL)
+            rd_kafka_topic_destroy(kafka->topics[u].rkt);
+        if (kafka->topics[u].event_type != NULL)
+            SCFree(kafka->topics[u].event_type);
+    }
+    if (kafka->topics != NULL)
+        SCFree(kafka->topics);
+    if (kafka->default_rkt != NULL)
+        rd_kafka_topic_destroy(kafka->default_rkt);
+    if (kafka->rk != NULL)
+        rd_kafka_destroy(kafka->rk);
+    SCFree(kafka);
+}
+
+static void SCLogFileCloseKafka(LogFileCtx *log_ctx)
+{
+    LogKafkaCtx *kafka = log_ctx->kafka;
+    if (kafka == NULL)
+        return;
+
+    if (rd_kafka_flush(kafka->rk, LOG_KAFKA_FLUSH_TIMEOUT_MS) !=
+            RD_KAFKA_RESP_ERR_NO_ERROR) {
+        SCLogWarning(SC_ERR_SOCKET, "kafka: %d records not delivered "
+                "at shutdown", rd_kafka_outq_len(kafka->rk));
+    }
+    SCLogInfo("kafka: %"PRIu64" records delivered, %"PRIu64" dropped on a "
+            "full queue, %"PRIu64" delivery failures",
+            SC_ATOMIC_GET(kafka_produced), SC_ATOMIC_GET(kafka_queue_full),
+            SC_ATOMIC_GET(kafka_delivery_failed));
+
+    LogKafkaCtxFree(kafka);
+    log_ctx->kafka = NULL;
+}
+
+/**
+ * \brief Set up a LogFileCtx to produce to kafka
+ *
+ * \param kafka_node the "kafka" node of the output
+ *
+ * \retval 0 on success, -1 on failure
+ */
+int SCConfLogOpenKafka(ConfNode *kafka_node, LogFileCtx *log_ctx)
+{
+    const char *brokers = NULL;
+    const char *topic = NULL;
+    const char *compression = NULL;
+    const char *val;
+    char errstr[512];
+
+    if (kafka_node) {
+        brokers = ConfNodeLookupChildValue(kafka_node, "brokers");
+        topic = ConfNodeLookupChildValue(kafka_node, "topic");
+        compression = ConfNodeLookupChildValue(kafka_node, "compression");
+    }
+    if (brokers == NULL) {
+        brokers = "127.0.0.1:9092";
+        SCLogInfo("Using default kafka broker (127.0.0.1:9092)");
+    }
+    if (topic == NULL)
+        topic = "suricata";
+    if (compression == NULL)
+        compression = "lz4";
+
+    LogKafkaCtx *kafka = SCMalloc(sizeof(*kafka));
+    if (unlikely(kafka == NULL))
+        return -1;
+    memset(kafka, 0, sizeof(*kafka));
+
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    LogKafkaConfSet(conf, "bootstrap.servers", brokers);
+    LogKafkaConfSet(conf, "compression.codec", compression);
+    /* batching: fill batches up to batch-size records or linger-ms */
+    if ((val = ConfNodeLookupChildValue(kafka_node, "batch-size")) != NULL)
+        LogKafkaConfSet(conf, "batch.num.messages", val);
+    LogKafkaConfSet(conf, "queue.buffering.max.ms",
+            (val = ConfNodeLookupChildValue(kafka_node, "linger-ms")) ? val : "10");
+    if ((val = ConfNodeLookupChildValue(kafka_node, "queue-size")) != NULL)
+        LogKafkaConfSet(conf, "queue.buffering.max.messages", val);
+
+    /* anything else is passed to librdkafka as is */
+    ConfNode *options = ConfNodeLookupChild(kafka_node, "options");
+    if (options != NULL) {
+        ConfNode *opt;
+        TAILQ_FOREACH(opt, &options->head, next) {
+            if (opt->name != NULL && opt->val != NULL)
+                LogKafkaConfSet(conf, opt->name, opt->val);
+        }
+    }
+    rd_kafka_conf_set_dr_msg_cb(conf, LogKafkaDeliveryReport);
+
+    /* rd_kafka_new takes over conf on success only */
+    kafka->rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+    if (kafka->rk == NULL) {
+        SCLogError(SC_ERR_SOCKET, "kafka: failed to create producer: %s",
+                errstr);
+        rd_kafka_conf_destroy(conf);
+        SCFree(kafka);
+        return -1;
+    }
+
+    kafka->default_rkt = rd_kafka_topic_new(kafka->rk, topic, NULL);
+    if (kafka->default_rkt == NULL) {
+        SCLogError(SC_ERR_SOCKET, "kafka: failed to create topic %s: %s",
+                topic, rd_kafka_err2str(rd_kafka_last_error()));
+        goto error;
+    }
+
+    /* event_type -> topic */
+    ConfNode *topics = ConfNodeLookupChild(kafka_node, "topics");
+    if (topics != NULL) {
+        ConfNode *t;
+        uint32_t cnt = 0;
+        TAILQ_FOREACH(t, &topics->head, next) {
+            cnt++;
+        }
+        if (cnt > 0) {
+            kafka->topics = SCMalloc(cnt * sizeof(LogKafkaTopic));
+            if (unlikely(kafka->topics == NULL))
+                goto error;
+            memset(kafka->topics, 0, cnt * sizeof(LogKafkaTopic));
+        }
+        TAILQ_FOREACH(t, &topics->head, next) {
+            if (t->name == NULL || t->val == NULL)
+                continue;
+            LogKafkaTopic *kt = &kafka->topics[kafka->topics_cnt];
+            kt->event_type = SCStrdup(t->name);
+            if (unlikely(kt->event_type == NULL))
+                goto error;
+            kt->event_type_len = strlen(t->name);
+            kafka->topics_cnt++;
+            kt->rkt = rd_kafka_topic_new(kafka->rk, t->val, NULL);
+            if (kt->rkt == NULL) {
+                SCLogError(SC_ERR_SOCKET, "kafka: failed to create topic "
+                        "%s: %s", t->val,
+                        rd_kafka_err2str(rd_kafka_last_error()));
+                goto error;
+            }
+            SCLogInfo("kafka: %s events to topic %s", t->name, t->val);
+        }
+    }
+
+    if (!kafka_counters_registered) {
+        SC_ATOMIC_INIT(kafka_produced);
+        SC_ATOMIC_INIT(kafka_queue_full);
+        SC_ATOMIC_INIT(kafka_delivery_failed);
+        StatsRegisterGlobalCounter("kafka.produced", LogKafkaProducedCounter);
+        StatsRegisterGlobalCounter("kafka.queue_full", LogKafkaQueueFullCounter);
+        StatsRegisterGlobalCounter("kafka.delivery_failed",
+                LogKafkaDeliveryFailedCounter);
+        kafka_counters_registered = 1;
+    }
+
+    SCLogInfo("kafka: producing to %s, topic %s, compression %s",
+            brokers, topic, compression);
+
+    log_ctx->kafka = kafka;
+    log_ctx->Close = SCLogFileCloseKafka;
+    return 0;
+
+error:
+    LogKafkaCtxFree(kafka);
+    return -1;
+}
+
+/**
+ * \brief Hand a record to the producer
+ *
+ * librdkafka is thread safe, so no locking. Never blocks: on a full
+ * producer queue the record is dropped and counted.
+ *
+ * \retval 0 queued, -1 dropped
+ */
+int LogFileWriteKafka(LogFileCtx *log_ctx, const char *buffer, size_t len)
+{
+    LogKafkaCtx *kafka = log_ctx->kafka;
+    if (kafka == NULL)
+        return -1;
+
+    rd_kafka_topic_t *rkt = kafka->default_rkt;
+    const char *v;
+    size_t v_len;
+    if (kafka->topics_cnt > 0 &&
+            LogKafkaRecordField(buffer, len, "\"event_type\":", &v, &v_len)) {
+        uint32_t u;
+        for (u = 0; u < kafka->topics_cnt; u++) {
+            if (kafka->topics[u].event_type_len == v_len &&
+                    memcmp(kafka->topics[u].event_type, v, v_len) == 0) {
+                rkt = kafka->topics[u].rkt;
+                break;
+            }
+        }
+    }
+
+    /* keyed by flow so the partitioner keeps a flow in one partition,
+     * records without a flow are spread randomly */
+    const char *key = NULL;
+    size_t key_len = 0;
+    if (LogKafkaRecordField(buffer, len, "\"flow_id\":", &v, &v_len)) {
+        key = v;
+        key_len = v_len;
+    }
+
+    int r = rd_kafka_produce(rkt, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
+            (void *)buffer, len, key, key_len, NULL);
+    /* serve delivery reports */
+    rd_kafka_poll(kafka->rk, 0);
+    if (r == -1) {
+        if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            if (SC_ATOMIC_ADD(kafka_queue_full, 1) == 1) {
+                SCLogWarning(SC_ERR_SOCKET, "kafka: producer queue full, "
+                        "dropping records");
+            }
+        } else {
+            (void)SC_ATOMIC_ADD(kafka_delivery_failed, 1);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* HAVE_LIBRDKAFKA */
+
+/*
+ * ONLY TESTS BELOW THIS COMMENT
+ */
+
+#ifdef UNITTESTS
+static int LogKafkaRecordFieldTest01(void)
+{
+    const char *rec = "{\"timestamp\":\"2016-01-01T00:00:00.000000+0000\","
+        "\"flow_id\":1234567,\"event_type\":\"alert\",\"src_ip\":\"1.2.3.4\"}";
+    size_t len = strlen(rec);
+    const char *v;
+    size_t v_len;
+
+    if (!LogKafkaRecordField(rec, len, "\"event_type\":", &v, &v_len))
+        return 0;
+    if (v_len != 5 || memcmp(v, "alert", 5) != 0)
+        return 0;
+    if (!LogKafkaRecordField(rec, len, "\"flow_id\":", &v, &v_len))
+        return 0;
+    if (v_len != 7 || memcmp(v, "1234567", 7) != 0)
+        return 0;
+    if (LogKafkaRecordField(rec, len, "\"pcap_cnt\":", &v, &v_len))
+        return 0;
+    return 1;
+}
+
+/** \test truncated records */
+static int LogKafkaRecordFieldTest02(void)
+{
+    const char *rec = "{\"flow_id\":,\"event_type\":\"dns";
+    size_t len = strlen(rec);
+    const char *v;
+    size_t v_len;
+
+    if (LogKafkaRecordField(rec, len, "\"flow_id\":", &v, &v_len))
+        return 0;
+    if (LogKafkaRecordField(rec, len, "\"event_type\":", &v, &v_len))
+        return 0;
+    return 1;
+}
+#endif /* UNITTESTS */
+
+void LogKafkaRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogKafkaRecordFieldTest01", LogKafkaRecordFieldTest01);
+    UtRegisterTest("LogKafkaRecordFieldTest02", LogKafkaRecordFieldTest02);
+#endif /* UNITTESTS */
+}
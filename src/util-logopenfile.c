@@ -33,6 +33,34 @@
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-log-kafka.h"
+#include "util-log-compress.h"
+#include "util-msgpack.h"
+#include "util-signal.h"
+#include "util-misc.h"
+#include "util-lock-stats.h"
+
+/** State of the writer thread of an async LogFileCtx.
+ *
+ *  Workers append their records to 'buffer'. The writer thread swaps it
+ *  with 'write_buffer' and writes all the records in there in one go, so
+ *  the workers only wait for a memcpy instead of a write and flush.
+ *
+ *  For redis the records are nul terminated and sent as one pipeline per
+ *  swap. Workers never wait for redis: if the buffer is full the record
+ *  is dropped. */
+typedef struct LogFileAsync_ {
+    SCMutex m;
+    SCCondT data_cond;      /**< signalled when 'buffer' gets data */
+    SCCondT space_cond;     /**< signalled when 'buffer' was swapped out */
+    MemBuffer *buffer;      /**< records to write, protected by m */
+    MemBuffer *write_buffer;/**< records being written, writer only */
+    int stop;               /**< protected by m */
+    int drop_when_full;     /**< drop records instead of waiting for space */
+    uint64_t dropped;       /**< records dropped on a full buffer, m */
+    uint64_t lost;          /**< records the writer failed to send, writer only */
+    pthread_t thread;
+} LogFileAsync;
 
 const char * redis_push_cmd = "LPUSH";
 const char * redis_publish_cmd = "PUBLISH";
@@ -120,6 +148,125 @@ static int SCLogUnixSocketReconnect(LogFileCtx *log_ctx)
     return log_ctx->fp ? 1 : 0;
 }
 
+/** \brief open the indicated file, logging any errors
+ *  \param path filesystem path to open
+ *  \param append_setting open file with O_APPEND: "yes" or "no"
+ *  \retval FILE* on success
+ *  \retval NULL on error
+ */
+static FILE *
+SCLogOpenFileFp(const char *path, const char *append_setting)
+{
+    FILE *ret = NULL;
+
+    if (ConfValIsTrue(append_setting)) {
+        ret = fopen(path, "a");
+    } else {
+        ret = fopen(path, "w");
+    }
+
+    if (ret == NULL)
+        SCLogError(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
+                   path, strerror(errno));
+    return ret;
+}
+
+/** \internal
+ *  \brief open the regular file of log_ctx, starting a new compressed
+ *         frame if compressing
+ *  \retval 0 on success, -1 on error */
+static int SCLogFileOpenRegular(LogFileCtx *log_ctx, const char *append)
+{
+    log_ctx->fp = SCLogOpenFileFp(log_ctx->filename, append);
+    if (log_ctx->fp == NULL)
+        return -1;
+
+    if (log_ctx->compress != NULL &&
+        LogCompressBegin(log_ctx->compress, log_ctx->fp) != 0) {
+        SCLogError(SC_ERR_FOPEN, "Error starting compression of "
+                   "\"%s\"", log_ctx->filename);
+        fclose(log_ctx->fp);
+        log_ctx->fp = NULL;
+        return -1;
+    }
+
+    struct stat st;
+    log_ctx->size_current = (fstat(fileno(log_ctx->fp), &st) == 0) ?
+        (uint64_t)st.st_size : 0;
+    log_ctx->rotate_time = time(NULL);
+    return 0;
+}
+
+/** \internal
+ *  \brief close a regular file, ending the compressed frame */
+static void SCLogFileCloseRegular(LogFileCtx *log_ctx)
+{
+    if (log_ctx->fp == NULL)
+        return;
+    if (log_ctx->compress != NULL)
+        LogCompressEnd(log_ctx->compress, log_ctx->fp);
+    fclose(log_ctx->fp);
+    log_ctx->fp = NULL;
+}
+
+/** \internal
+ *  \brief move the current file out of the way and start a new one
+ *
+ *  The rotated file gets the time of the rotation inserted before the
+ *  compression suffix, e.g. eve.json.1451606400.lz4. With rotate_max_files
+ *  the oldest file rotated by us is removed. */
+static int SCLogFileRotate(LogFileCtx *log_ctx)
+{
+    char path[PATH_MAX];
+    const char *suffix = LogCompressSuffix(log_ctx->compression);
+    const int base_len = (int)(strlen(log_ctx->filename) - strlen(suffix));
+    const uint64_t now = (uint64_t)time(NULL);
+    int i;
+
+    snprintf(path, sizeof(path), "%.*s.%"PRIu64"%s", base_len,
+             log_ctx->filename, now, suffix);
+    /* more than one rotation per second */
+    for (i = 1; i < 1000 && access(path, F_OK) == 0; i++) {
+        snprintf(path, sizeof(path), "%.*s.%"PRIu64".%d%s", base_len,
+                 log_ctx->filename, now, i, suffix);
+    }
+
+    SCLogFileCloseRegular(log_ctx);
+
+    if (rename(log_ctx->filename, path) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "Error renaming \"%s\" to \"%s\": %s",
+                     log_ctx->filename, path, strerror(errno));
+    } else if (log_ctx->rotate_max_files > 0) {
+        char **slot = &log_ctx->rotated_files[log_ctx->rotated_idx];
+        if (*slot != NULL) {
+            if (remove(*slot) != 0) {
+                SCLogDebug("removing %s failed: %s", *slot, strerror(errno));
+            }
+            SCFree(*slot);
+        }
+        *slot = SCStrdup(path);
+        log_ctx->rotated_idx = (log_ctx->rotated_idx + 1) %
+            log_ctx->rotate_max_files;
+    }
+    SCLogDebug("rotated %s to %s", log_ctx->filename, path);
+
+    return SCLogFileOpenRegular(log_ctx, "yes");
+}
+
+/** \internal
+ *  \brief rotate the file if it's too big or too old */
+static inline void SCLogFileRotateCheck(LogFileCtx *log_ctx)
+{
+    if ((log_ctx->rotate_size > 0 &&
+         log_ctx->size_current >= log_ctx->rotate_size) ||
+        (log_ctx->rotate_interval > 0 &&
+         (uint64_t)(time(NULL) - log_ctx->rotate_time) >=
+            log_ctx->rotate_interval))
+    {
+        SCLogFileRotate(log_ctx);
+    }
+}
+
 /**
  * \brief Write buffer to log file.
  * \retval 0 on failure; otherwise, the return value of fwrite (number of
@@ -138,10 +285,19 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     if (log_ctx->fp == NULL && log_ctx->is_sock)
         SCLogUnixSocketReconnect(log_ctx);
 
-    if (log_ctx->fp) {
+    if (log_ctx->fp && log_ctx->compress != NULL) {
+        int written = LogCompressWrite(log_ctx->compress, log_ctx->fp,
+                                       buffer, buffer_len);
+        fflush(log_ctx->fp);
+        if (written < 0)
+            return 0;
+        log_ctx->size_current += written;
+        ret = 1;
+    } else if (log_ctx->fp) {
         clearerr(log_ctx->fp);
         ret = fwrite(buffer, buffer_len, 1, log_ctx->fp);
         fflush(log_ctx->fp);
+        log_ctx->size_current += buffer_len;
 
         if (ferror(log_ctx->fp) && log_ctx->is_sock) {
             /* Error on Unix socket, maybe needs reconnect */
@@ -152,36 +308,72 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
         }
     }
 
+    if (log_ctx->is_regular)
+        SCLogFileRotateCheck(log_ctx);
+
     return ret;
 }
 
 static void SCLogFileClose(LogFileCtx *log_ctx)
 {
-    if (log_ctx->fp)
+    if (log_ctx->is_regular) {
+        SCLogFileCloseRegular(log_ctx);
+    } else if (log_ctx->fp) {
         fclose(log_ctx->fp);
+    }
 }
 
-/** \brief open the indicated file, logging any errors
- *  \param path filesystem path to open
- *  \param append_setting open file with O_APPEND: "yes" or "no"
- *  \retval FILE* on success
- *  \retval NULL on error
- */
-static FILE *
-SCLogOpenFileFp(const char *path, const char *append_setting)
+/** \internal
+ *  \brief set up compression and rotation of a regular file
+ *
+ *  With compression the suffix of the method is added to the path.
+ *
+ *  \retval 0 on success, -1 on error */
+static int SCConfLogSetupRegular(ConfNode *conf, LogFileCtx *log_ctx,
+                                 char *log_path, size_t log_path_size)
 {
-    FILE *ret = NULL;
+    intmax_t val;
 
-    if (ConfValIsTrue(append_setting)) {
-        ret = fopen(path, "a");
-    } else {
-        ret = fopen(path, "w");
+    const char *compression = ConfNodeLookupChildValue(conf, "compression");
+    log_ctx->compression = LogCompressParseMethod(compression);
+    if (log_ctx->compression < 0)
+        return -1;
+    if (log_ctx->compression != LOG_COMPRESS_NONE) {
+        int level = 0;
+        if (ConfGetChildValueInt(conf, "compression-level", &val))
+            level = (int)val;
+        log_ctx->compress = LogCompressNew(log_ctx->compression, level);
+        if (log_ctx->compress == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Failed to set up %s compression "
+                       "for %s", compression, log_path);
+            return -1;
+        }
+
+        const char *suffix = LogCompressSuffix(log_ctx->compression);
+        size_t len = strlen(log_path);
+        if (len < strlen(suffix) ||
+            strcmp(log_path + len - strlen(suffix), suffix) != 0) {
+            strlcat(log_path, suffix, log_path_size);
+        }
     }
 
-    if (ret == NULL)
-        SCLogError(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
-                   path, strerror(errno));
-    return ret;
+    const char *rotate_size = ConfNodeLookupChildValue(conf, "rotate-size");
+    if (rotate_size != NULL &&
+        ParseSizeStringU64(rotate_size, &log_ctx->rotate_size) < 0) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid rotate-size: %s",
+                   rotate_size);
+        return -1;
+    }
+    if (ConfGetChildValueInt(conf, "rotate-interval", &val) && val > 0)
+        log_ctx->rotate_interval = (uint64_t)val;
+    if (ConfGetChildValueInt(conf, "rotate-max-files", &val) && val > 0) {
+        log_ctx->rotate_max_files = (uint32_t)val;
+        log_ctx->rotated_files = SCCalloc(log_ctx->rotate_max_files,
+                                          sizeof(char *));
+        if (log_ctx->rotated_files == NULL)
+            return -1;
+    }
+    return 0;
 }
 
 /** \brief open the indicated file remotely over PCIe to a host
@@ -269,8 +461,16 @@ SCConfLogOpenGeneric(ConfNode *conf,
         log_ctx->fp = SCLogOpenUnixSocketFp(log_path, SOCK_DGRAM, 1);
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append);
-        if (log_ctx->fp == NULL)
+        if (SCConfLogSetupRegular(conf, log_ctx, log_path,
+                                  sizeof(log_path)) < 0)
+            return -1;
+        log_ctx->filename = SCStrdup(log_path);
+        if (unlikely(log_ctx->filename == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC,
+                "Failed to allocate memory for filename");
+            return -1;
+        }
+        if (SCLogFileOpenRegular(log_ctx, append) < 0)
             return -1; // Error already logged by Open...Fp routine
         log_ctx->is_regular = 1;
         if (rotate) {
@@ -287,7 +487,8 @@ SCConfLogOpenGeneric(ConfNode *conf,
                    "or \"unix_dgram\"",
                    conf->name);
     }
-    log_ctx->filename = SCStrdup(log_path);
+    if (log_ctx->filename == NULL)
+        log_ctx->filename = SCStrdup(log_path);
     if (unlikely(log_ctx->filename == NULL)) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Failed to allocate memory for filename");
@@ -320,13 +521,12 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
         return -1;
     }
 
-    fclose(log_ctx->fp);
+    SCLogFileCloseRegular(log_ctx);
 
     /* Reopen the file. Append is forced in case the file was not
      * moved as part of a rotation process. */
     SCLogDebug("Reopening log file %s.", log_ctx->filename);
-    log_ctx->fp = SCLogOpenFileFp(log_ctx->filename, "yes");
-    if (log_ctx->fp == NULL) {
+    if (SCLogFileOpenRegular(log_ctx, "yes") < 0) {
         return -1; // Already logged by Open..Fp routine.
     }
 
@@ -448,7 +648,10 @@ int SCConfLogReopenRedis(LogFileCtx *log_ctx)
         return -1;
     }
 
-    redisContext *c = redisConnect(log_ctx->redis_setup.server, log_ctx->redis_setup.port);
+    /* don't hang on an unreachable server, this may run on a worker */
+    struct timeval timeout = { 1, 0 };
+    redisContext *c = redisConnectWithTimeout(log_ctx->redis_setup.server,
+            log_ctx->redis_setup.port, timeout);
     if (c != NULL && c->err) {
         if (log_ctx->redis_setup.tried == 0) {
             SCLogError(SC_ERR_SOCKET, "Error connecting to redis server: %s\n", c->errstr);
@@ -465,6 +668,258 @@ int SCConfLogReopenRedis(LogFileCtx *log_ctx)
 
 #endif
 
+#ifdef HAVE_LIBHIREDIS
+/** \internal
+ *  \brief get the record at buf
+ *
+ *  Text records are nul terminated, binary ones length prefixed.
+ *
+ *  \retval size of the record in buf, including terminator or prefix */
+static uint32_t LogFileAsyncRedisRecord(const LogFileCtx *log_ctx,
+        const char *buf, const char **rec, size_t *rec_len)
+{
+    if (log_ctx->binary) {
+        const uint8_t *p = (const uint8_t *)buf;
+        *rec_len = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                   ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+        *rec = buf + MSGPACK_RECORD_HDR_LEN;
+        return MSGPACK_RECORD_HDR_LEN + (uint32_t)*rec_len;
+    }
+    *rec = buf;
+    *rec_len = strlen(buf);
+    return (uint32_t)*rec_len + 1;
+}
+
+/** \internal
+ *  \brief send the records in buf to redis as one pipeline
+ *
+ *  Runs on the writer thread only, which owns the redis connection in
+ *  async mode.
+ */
+static void LogFileAsyncWriteRedis(LogFileCtx *log_ctx, const char *buf,
+                                   uint32_t buf_len)
+{
+    LogFileAsync *async = log_ctx->async;
+    uint32_t cnt = 0;
+    uint32_t offset = 0;
+    const char *rec;
+    size_t rec_len;
+
+    /* records in buf */
+    while (offset < buf_len) {
+        offset += LogFileAsyncRedisRecord(log_ctx, buf + offset, &rec, &rec_len);
+        cnt++;
+    }
+
+    if (log_ctx->redis == NULL) {
+        if (SCConfLogReopenRedis(log_ctx) < 0) {
+            async->lost += cnt;
+            return;
+        }
+        SCLogInfo("Reconnected to redis server");
+    }
+
+    for (offset = 0; offset < buf_len; ) {
+        offset += LogFileAsyncRedisRecord(log_ctx, buf + offset, &rec, &rec_len);
+        redisAppendCommand(log_ctx->redis, "%s %s %b",
+                log_ctx->redis_setup.command,
+                log_ctx->redis_setup.key,
+                rec, rec_len);
+    }
+
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(log_ctx->redis, (void **)&reply) != REDIS_OK) {
+            SCLogInfo("Error when fetching reply: %s (%d), reopening "
+                    "connection to redis server", log_ctx->redis->errstr,
+                    log_ctx->redis->err);
+            async->lost += cnt - i;
+            /* connects on the next batch if this fails */
+            (void)SCConfLogReopenRedis(log_ctx);
+            return;
+        }
+        if (reply->type == REDIS_REPLY_ERROR) {
+            SCLogDebug("Redis error: %s", reply->str);
+            async->lost++;
+        }
+        freeReplyObject(reply);
+    }
+}
+#endif
+
+static void *LogFileAsyncWriter(void *arg)
+{
+    LogFileCtx *log_ctx = (LogFileCtx *)arg;
+    LogFileAsync *async = log_ctx->async;
+
+    /* block usr2. usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+    SCSetThreadName("LogWriter");
+
+    SCMutexLock(&async->m);
+    while (1) {
+        while (MEMBUFFER_OFFSET(async->buffer) == 0 && !async->stop) {
+            SCCondWait(&async->data_cond, &async->m);
+        }
+        if (MEMBUFFER_OFFSET(async->buffer) == 0)
+            break;
+
+        MemBuffer *tmp = async->write_buffer;
+        async->write_buffer = async->buffer;
+        async->buffer = tmp;
+        pthread_cond_broadcast(&async->space_cond);
+        SCMutexUnlock(&async->m);
+
+        SCMutexLockSite(&log_ctx->fp_mutex, LOCK_SITE_LOGFILE);
+#ifdef HAVE_LIBHIREDIS
+        if (log_ctx->type == LOGFILE_TYPE_REDIS) {
+            LogFileAsyncWriteRedis(log_ctx,
+                    (const char *)MEMBUFFER_BUFFER(async->write_buffer),
+                    MEMBUFFER_OFFSET(async->write_buffer));
+        } else
+#endif
+        log_ctx->Write((const char *)MEMBUFFER_BUFFER(async->write_buffer),
+                       MEMBUFFER_OFFSET(async->write_buffer), log_ctx);
+        SCMutexUnlock(&log_ctx->fp_mutex);
+        MemBufferReset(async->write_buffer);
+
+        SCMutexLock(&async->m);
+    }
+    SCMutexUnlock(&async->m);
+    return NULL;
+}
+
+/** \internal
+ *  \brief queue a record for the writer thread
+ *
+ *  Blocks while the queue is full, so the writer sets the pace if it
+ *  can't keep up, like the direct write would. With drop_when_full the
+ *  record is dropped instead.
+ *
+ *  \param nul add a nul byte after the record */
+static int LogFileAsyncWrite(LogFileCtx *log_ctx, const char *buffer,
+                             uint32_t buffer_len, int nul)
+{
+    LogFileAsync *async = log_ctx->async;
+    const uint32_t len = buffer_len + (nul ? 1 : 0);
+
+    SCMutexLock(&async->m);
+    while (MEMBUFFER_OFFSET(async->buffer) + len >
+            MEMBUFFER_SIZE(async->buffer))
+    {
+        if (MEMBUFFER_OFFSET(async->buffer) == 0) {
+            /* record is larger than the buffer */
+            if (MemBufferExpand(&async->buffer, len -
+                        MEMBUFFER_SIZE(async->buffer)) < 0) {
+                SCMutexUnlock(&async->m);
+                return -1;
+            }
+            break;
+        }
+        SCCondSignal(&async->data_cond);
+        if (async->drop_when_full) {
+            if (async->dropped++ == 0) {
+                SCLogWarning(SC_ERR_SOCKET, "%s: output can't keep up, "
+                        "dropping records", log_ctx->filename ?
+                        log_ctx->filename : "redis");
+            }
+            SCMutexUnlock(&async->m);
+            return -1;
+        }
+        SCCondWait(&async->space_cond, &async->m);
+    }
+
+    int was_empty = (MEMBUFFER_OFFSET(async->buffer) == 0);
+    memcpy(MEMBUFFER_BUFFER(async->buffer) + MEMBUFFER_OFFSET(async->buffer),
+           buffer, buffer_len);
+    MEMBUFFER_OFFSET(async->buffer) += buffer_len;
+    if (nul)
+        MEMBUFFER_BUFFER(async->buffer)[MEMBUFFER_OFFSET(async->buffer)++] = '\0';
+    if (was_empty)
+        SCCondSignal(&async->data_cond);
+    SCMutexUnlock(&async->m);
+    return 0;
+}
+
+/** \internal
+ *  \brief stop the writer thread after it wrote out all queued records */
+static void LogFileAsyncDeinit(LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+
+    SCMutexLock(&async->m);
+    async->stop = 1;
+    SCCondSignal(&async->data_cond);
+    SCMutexUnlock(&async->m);
+
+    pthread_join(async->thread, NULL);
+
+    if (async->dropped > 0 || async->lost > 0) {
+        SCLogInfo("%s: %"PRIu64" records dropped on a full buffer, %"PRIu64
+                " failed to write", log_ctx->filename ? log_ctx->filename :
+                "redis", async->dropped, async->lost);
+    }
+
+    SCCondDestroy(&async->data_cond);
+    SCCondDestroy(&async->space_cond);
+    SCMutexDestroy(&async->m);
+    MemBufferFree(async->buffer);
+    MemBufferFree(async->write_buffer);
+    SCFree(async);
+    log_ctx->async = NULL;
+}
+
+/** \brief hand the writes of LogFileWrite() to a dedicated writer thread
+ *
+ *  For the file, unix socket and redis types. The writer thread also does
+ *  the rotation checks and reconnects. Redis records are pipelined per
+ *  batch and dropped rather than blocking the workers when redis can't
+ *  keep up.
+ *
+ *  \param buffer_size size of the record queue
+ *  \retval 0 on success
+ *  \retval -1 on error */
+int LogFileAsyncInit(LogFileCtx *log_ctx, uint32_t buffer_size)
+{
+    LogFileAsync *async = SCCalloc(1, sizeof(*async));
+    if (async == NULL)
+        return -1;
+
+    async->buffer = MemBufferCreateNew(buffer_size);
+    async->write_buffer = MemBufferCreateNew(buffer_size);
+    if (async->buffer == NULL || async->write_buffer == NULL) {
+        if (async->buffer != NULL)
+            MemBufferFree(async->buffer);
+        if (async->write_buffer != NULL)
+            MemBufferFree(async->write_buffer);
+        SCFree(async);
+        return -1;
+    }
+    SCMutexInit(&async->m, NULL);
+    SCCondInit(&async->data_cond, NULL);
+    SCCondInit(&async->space_cond, NULL);
+    async->drop_when_full = (log_ctx->type == LOGFILE_TYPE_REDIS);
+
+    log_ctx->async = async;
+    if (pthread_create(&async->thread, NULL, LogFileAsyncWriter, log_ctx) != 0) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create log writer "
+                "thread for %s", log_ctx->filename);
+        SCCondDestroy(&async->data_cond);
+        SCCondDestroy(&async->space_cond);
+        SCMutexDestroy(&async->m);
+        MemBufferFree(async->buffer);
+        MemBufferFree(async->write_buffer);
+        SCFree(async);
+        log_ctx->async = NULL;
+        return -1;
+    }
+
+    SCLogInfo("writing %s from a writer thread", log_ctx->filename ?
+            log_ctx->filename : "redis");
+    return 0;
+}
+
 /** \brief LogFileNewCtx() Get a new LogFileCtx
  *  \retval LogFileCtx * pointer if succesful, NULL if error
  *  */
@@ -500,6 +955,10 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    if (lf_ctx->async != NULL) {
+        LogFileAsyncDeinit(lf_ctx);
+    }
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
@@ -530,6 +989,17 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
     if (lf_ctx->sensor_name)
         SCFree(lf_ctx->sensor_name);
 
+    if (lf_ctx->compress != NULL)
+        LogCompressFree(lf_ctx->compress);
+    if (lf_ctx->rotated_files != NULL) {
+        uint32_t u;
+        for (u = 0; u < lf_ctx->rotate_max_files; u++) {
+            if (lf_ctx->rotated_files[u] != NULL)
+                SCFree(lf_ctx->rotated_files[u]);
+        }
+        SCFree(lf_ctx->rotated_files);
+    }
+
     OutputUnregisterFileRotationFlag(&lf_ctx->rotation_flag);
 
     SCFree(lf_ctx);
@@ -550,10 +1020,10 @@ static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t s
     }
     /* TODO go async here ? */
     if (file_ctx->redis_setup.batch_size) {
-        redisAppendCommand(file_ctx->redis, "%s %s %s",
+        redisAppendCommand(file_ctx->redis, "%s %s %b",
                 file_ctx->redis_setup.command,
                 file_ctx->redis_setup.key,
-                string);
+                string, string_len);
         if (file_ctx->redis_setup.batch_count == file_ctx->redis_setup.batch_size) {
             redisReply *reply;
             int i;
@@ -592,10 +1062,10 @@ static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t s
             file_ctx->redis_setup.batch_count++;
         }
     } else {
-        redisReply *reply = redisCommand(file_ctx->redis, "%s %s %s",
+        redisReply *reply = redisCommand(file_ctx->redis, "%s %s %b",
                 file_ctx->redis_setup.command,
                 file_ctx->redis_setup.key,
-                string);
+                string, string_len);
 
         switch (reply->type) {
             case REDIS_REPLY_ERROR:
@@ -626,21 +1096,45 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
                file_ctx->type == LOGFILE_TYPE_UNIX_DGRAM ||
                file_ctx->type == LOGFILE_TYPE_UNIX_STREAM)
     {
-        /* append \n for files only */
-        MemBufferWriteString(buffer, "\n");
-        SCMutexLock(&file_ctx->fp_mutex);
+        /* append \n for files only, binary records are length prefixed */
+        if (!file_ctx->binary)
+            MemBufferWriteString(buffer, "\n");
+        if (file_ctx->async != NULL) {
+            return LogFileAsyncWrite(file_ctx,
+                    (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer), 0);
+        }
+        SCMutexLockSite(&file_ctx->fp_mutex, LOCK_SITE_LOGFILE);
         file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
                         MEMBUFFER_OFFSET(buffer), file_ctx);
         SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
-        SCMutexLock(&file_ctx->fp_mutex);
-        LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
-                MEMBUFFER_OFFSET(buffer));
+        if (file_ctx->async != NULL) {
+            return LogFileAsyncWrite(file_ctx,
+                    (const char *)MEMBUFFER_BUFFER(buffer),
+                    MEMBUFFER_OFFSET(buffer), !file_ctx->binary);
+        }
+        /* each record is its own redis value, so no length prefix */
+        const uint32_t skip = file_ctx->binary ? MSGPACK_RECORD_HDR_LEN : 0;
+        SCMutexLockSite(&file_ctx->fp_mutex, LOCK_SITE_LOGFILE);
+        LogFileWriteRedis(file_ctx,
+                (const char *)MEMBUFFER_BUFFER(buffer) + skip,
+                MEMBUFFER_OFFSET(buffer) - skip);
         SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #endif
+#ifdef HAVE_LIBRDKAFKA
+    else if (file_ctx->type == LOGFILE_TYPE_KAFKA) {
+        /* the producer queues and batches, no need for a lock or the
+         * async writer */
+        const uint32_t skip = file_ctx->binary ? MSGPACK_RECORD_HDR_LEN : 0;
+        LogFileWriteKafka(file_ctx,
+                (const char *)MEMBUFFER_BUFFER(buffer) + skip,
+                MEMBUFFER_OFFSET(buffer) - skip);
+    }
+#endif
 
     return 0;
 }
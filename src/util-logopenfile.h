@@ -40,7 +40,8 @@ enum LogFileType { LOGFILE_TYPE_FILE,
                    LOGFILE_TYPE_SYSLOG,
                    LOGFILE_TYPE_UNIX_DGRAM,
                    LOGFILE_TYPE_UNIX_STREAM,
-                   LOGFILE_TYPE_REDIS };
+                   LOGFILE_TYPE_REDIS,
+                   LOGFILE_TYPE_KAFKA };
 
 typedef struct SyslogSetup_ {
     int alert_syslog_level;
@@ -61,6 +62,10 @@ typedef struct RedisSetup_ {
 } RedisSetup;
 #endif
 
+struct LogFileAsync_;
+struct LogKafkaCtx_;
+struct LogCompress_;
+
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
     union {
@@ -68,6 +73,9 @@ typedef struct LogFileCtx_ {
         PcieFile *pcie_fp;
 #ifdef HAVE_LIBHIREDIS
         redisContext *redis;
+#endif
+#ifdef HAVE_LIBRDKAFKA
+        struct LogKafkaCtx_ *kafka;
 #endif
     };
 
@@ -99,6 +107,9 @@ typedef struct LogFileCtx_ {
     int sock_type;
     uint64_t reconn_timer;
 
+    /** records are length prefixed MessagePack instead of text lines */
+    uint8_t binary;
+
     /**< Used by some alert loggers like the unified ones that append
      * the date onto the end of files. */
     char *prefix;
@@ -120,8 +131,28 @@ typedef struct LogFileCtx_ {
 
     /* Flag set when file rotation notification is received. */
     int rotation_flag;
+
+    /** writer thread state if writes are done asynchronously, NULL
+     *  otherwise */
+    struct LogFileAsync_ *async;
+
+    /** streaming compressor of a regular file, NULL if not compressed */
+    struct LogCompress_ *compress;
+    int compression;            /**< LOG_COMPRESS_* */
+
+    /** size and age based rotation of a regular file, 0 disables */
+    uint64_t rotate_size;
+    uint64_t rotate_interval;   /**< seconds */
+    time_t rotate_time;         /**< when the current file was opened */
+    /** rotated files to keep, oldest are removed; 0 keeps all */
+    uint32_t rotate_max_files;
+    uint32_t rotated_idx;
+    char **rotated_files;       /**< ring of rotate_max_files names */
 } LogFileCtx;
 
+/* Default size of the buffer records are queued in for the writer thread */
+#define LOGFILE_ASYNC_BUFFER_SIZE   (1024 * 1024)
+
 /* Min time (msecs) before trying to reconnect a Unix domain socket */
 #define LOGFILE_RECONN_MIN_TIME     500
 
@@ -132,6 +163,7 @@ typedef struct LogFileCtx_ {
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int LogFileAsyncInit(LogFileCtx *file_ctx, uint32_t buffer_size);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogOpenRedis(ConfNode *conf, LogFileCtx *log_ctx);
@@ -0,0 +1,433 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Read only longest prefix match table for IPv4 (DIR-16-8-8).
+ *
+ * The netblocks of a radix tree are expanded into a 64k entry root table
+ * indexed by the first 16 bits of the address. Netblocks longer than /16
+ * get a 256 entry table for the next 8 bits. Netblocks longer than /24
+ * get a compressed node for the last 8 bits: a bitmap marking where the
+ * value changes and one leaf per run, so a lone /32 costs a few leaves
+ * instead of a full table.
+ *
+ * Netblocks up to /24 are added from short to long, so a longer netblock
+ * simply overwrites the entries of the shorter ones it's part of and a
+ * new table starts out as a copy of the entry it replaces. The longer
+ * ones are then expanded per /24 and compressed.
+ */
+
+#include "suricata-common.h"
+#include "util-lpm-ipv4.h"
+#include "util-radix-tree.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+#define LPM_ROOT_SIZE   65536
+
+typedef struct LpmPrefixList_ {
+    SCLpmIPV4Prefix *prefixes;
+    uint32_t cnt;
+    uint32_t size;
+    int error;
+} LpmPrefixList;
+
+static void LpmCollect(const uint8_t *stream, uint16_t bitlen, uint8_t netmask,
+        void *user, void *data)
+{
+    LpmPrefixList *list = (LpmPrefixList *)data;
+
+    if (list->error || bitlen != 32)
+        return;
+    if (netmask > 32)
+        netmask = 32;
+
+    if (list->cnt == list->size) {
+        uint32_t size = list->size ? list->size * 2 : 64;
+        SCLpmIPV4Prefix *ptmp = SCRealloc(list->prefixes, size * sizeof(SCLpmIPV4Prefix));
+        if (ptmp == NULL) {
+            list->error = 1;
+            return;
+        }
+        list->prefixes = ptmp;
+        list->size = size;
+    }
+
+    uint32_t ip = ((uint32_t)stream[0] << 24) | ((uint32_t)stream[1] << 16) |
+                  ((uint32_t)stream[2] << 8) | (uint32_t)stream[3];
+    if (netmask < 32)
+        ip &= netmask ? ~0U << (32 - netmask) : 0;
+
+    SCLpmIPV4Prefix *lp = &list->prefixes[list->cnt++];
+    lp->ip = ip;
+    lp->len = netmask;
+    lp->user = user;
+}
+
+/** sort up to /24 by length, the longer ones by /24 and then length */
+static int LpmPrefixCompare(const void *a, const void *b)
+{
+    const SCLpmIPV4Prefix *pa = a;
+    const SCLpmIPV4Prefix *pb = b;
+    const int la = pa->len > 24;
+    const int lb = pb->len > 24;
+
+    if (la != lb)
+        return la - lb;
+    if (la && (pa->ip >> 8) != (pb->ip >> 8))
+        return (pa->ip >> 8) < (pb->ip >> 8) ? -1 : 1;
+    if (pa->len != pb->len)
+        return pa->len < pb->len ? -1 : 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief grow an array to hold at least one more element
+ *  \retval 0 ok, -1 out of memory */
+static int LpmGrow(void **array, uint32_t *size, uint32_t cnt, size_t elem)
+{
+    if (cnt < *size)
+        return 0;
+
+    uint32_t nsize = *size ? *size * 2 : 64;
+    void *ptmp = SCRealloc(*array, (size_t)nsize * elem);
+    if (ptmp == NULL)
+        return -1;
+    *array = ptmp;
+    *size = nsize;
+    return 0;
+}
+
+/** \internal
+ *  \brief get the 256 entry table of a root entry, adding it if needed
+ *  \retval table index or -1 out of memory */
+static int64_t LpmTable(SCLpmIPV4 *lpm, uint32_t i)
+{
+    uint32_t e = lpm->root[i];
+    if (e & SC_LPM_IPV4_CHILD)
+        return (int64_t)(e & ~SC_LPM_IPV4_CHILD);
+
+    if (LpmGrow((void **)&lpm->tables, &lpm->tables_size, lpm->tables_cnt,
+                256 * sizeof(uint32_t)) < 0)
+        return -1;
+
+    uint32_t c = lpm->tables_cnt++;
+    uint32_t j;
+    for (j = 0; j < 256; j++)
+        lpm->tables[(c << 8) | j] = e;
+    lpm->root[i] = c | SC_LPM_IPV4_CHILD;
+    return (int64_t)c;
+}
+
+static int LpmInsert(SCLpmIPV4 *lpm, const SCLpmIPV4Prefix *lp, uint32_t value)
+{
+    const uint32_t ip = lp->ip;
+    uint32_t i;
+
+    if (lp->len <= 16) {
+        /* entries of longer netblocks are not there yet, so this can't
+         * hit a table */
+        for (i = ip >> 16; i < (ip >> 16) + (1U << (16 - lp->len)); i++) {
+            BUG_ON(lpm->root[i] & SC_LPM_IPV4_CHILD);
+            lpm->root[i] = value;
+        }
+        return 0;
+    }
+
+    int64_t t = LpmTable(lpm, ip >> 16);
+    if (t < 0)
+        return -1;
+    uint32_t *table = &lpm->tables[(uint32_t)t << 8];
+    for (i = (ip >> 8) & 0xff; i < ((ip >> 8) & 0xff) + (1U << (24 - lp->len)); i++)
+        table[i] = value;
+    return 0;
+}
+
+/** \internal
+ *  \brief add a compressed node for the /24 of prefixes[0] holding it and
+ *         all following netblocks in the same /24
+ *  \retval n number of netblocks used or -1 out of memory */
+static int LpmInsertNode(SCLpmIPV4 *lpm, const SCLpmIPV4Prefix *prefixes, uint32_t cnt,
+        uint32_t first_value)
+{
+    const uint32_t net = prefixes[0].ip >> 8;
+    uint32_t entries[256];
+    uint32_t n, i;
+
+    int64_t t = LpmTable(lpm, net >> 8);
+    if (t < 0)
+        return -1;
+    uint32_t *slot = &lpm->tables[((uint32_t)t << 8) | (net & 0xff)];
+    BUG_ON(*slot & SC_LPM_IPV4_CHILD);
+
+    for (i = 0; i < 256; i++)
+        entries[i] = *slot;
+    for (n = 0; n < cnt && (prefixes[n].ip >> 8) == net; n++) {
+        const uint32_t start = prefixes[n].ip & 0xff;
+        for (i = start; i < start + (1U << (32 - prefixes[n].len)); i++)
+            entries[i] = first_value + n;
+    }
+
+    if (LpmGrow((void **)&lpm->nodes, &lpm->nodes_size, lpm->nodes_cnt,
+                sizeof(SCLpmIPV4Node)) < 0)
+        return -1;
+    SCLpmIPV4Node *node = &lpm->nodes[lpm->nodes_cnt];
+    memset(node, 0, sizeof(*node));
+    node->base = lpm->leaves_cnt;
+
+    for (i = 0; i < 256; i++) {
+        if ((i & 63) == 0 && i > 0)
+            node->cnt[i >> 6] = node->cnt[(i >> 6) - 1] +
+                __builtin_popcountll(node->bitmap[(i >> 6) - 1]);
+        if (i > 0 && entries[i] == entries[i - 1])
+            continue;
+        if (LpmGrow((void **)&lpm->leaves, &lpm->leaves_size, lpm->leaves_cnt,
+                    sizeof(uint32_t)) < 0)
+            return -1;
+        lpm->leaves[lpm->leaves_cnt++] = entries[i];
+        node->bitmap[i >> 6] |= 1ULL << (i & 63);
+    }
+
+    *slot = lpm->nodes_cnt++ | SC_LPM_IPV4_CHILD;
+    return (int)n;
+}
+
+/**
+ * \brief Compile an array of IPv4 netblocks into a lookup table
+ *
+ * The table points to the user data of the netblocks, which must stay
+ * around for as long as the table is used.
+ *
+ * \param prefixes netblocks, each address masked to its length and
+ *        listed once. The array is reordered.
+ * \param cnt number of netblocks
+ *
+ * \retval lpm table or NULL if there are no netblocks or on memory errors
+ */
+SCLpmIPV4 *SCLpmIPV4CompileArray(SCLpmIPV4Prefix *prefixes, uint32_t cnt)
+{
+    if (cnt == 0)
+        return NULL;
+
+    qsort(prefixes, cnt, sizeof(SCLpmIPV4Prefix), LpmPrefixCompare);
+
+    SCLpmIPV4 *lpm = SCMalloc(sizeof(SCLpmIPV4));
+    if (unlikely(lpm == NULL))
+        return NULL;
+    memset(lpm, 0, sizeof(*lpm));
+
+    lpm->root = SCMallocAligned(LPM_ROOT_SIZE * sizeof(uint32_t), CLS);
+    lpm->values = SCMalloc(cnt * sizeof(void *));
+    if (lpm->root == NULL || lpm->values == NULL)
+        goto error;
+    memset(lpm->root, 0, LPM_ROOT_SIZE * sizeof(uint32_t));
+
+    uint32_t u;
+    for (u = 0; u < cnt; u++)
+        lpm->values[u] = prefixes[u].user;
+    lpm->values_cnt = cnt;
+
+    /* value of a prefix is its index + 1, 0 is no match */
+    for (u = 0; u < cnt && prefixes[u].len <= 24; u++) {
+        if (LpmInsert(lpm, &prefixes[u], u + 1) < 0)
+            goto error;
+    }
+    while (u < cnt) {
+        int n = LpmInsertNode(lpm, &prefixes[u], cnt - u, u + 1);
+        if (n < 0)
+            goto error;
+        u += n;
+    }
+
+    SCLogDebug("compiled %u netblocks: %u tables, %u nodes, %u leaves",
+            cnt, lpm->tables_cnt, lpm->nodes_cnt, lpm->leaves_cnt);
+    return lpm;
+
+error:
+    SCLpmIPV4Free(lpm);
+    return NULL;
+}
+
+/**
+ * \brief Compile the IPv4 netblocks of a radix tree into a lookup table
+ *
+ * The table points to the user data of the tree, so the tree must stay
+ * around (and unmodified) for as long as the table is used.
+ *
+ * \param tree radix tree with IPv4 keys
+ *
+ * \retval lpm table or NULL if the tree is empty or on memory errors.
+ *             Callers should keep using the radix tree then.
+ */
+SCLpmIPV4 *SCLpmIPV4CompileRadix(SCRadixTree *tree)
+{
+    LpmPrefixList list;
+    memset(&list, 0, sizeof(list));
+
+    SCRadixWalk(tree, LpmCollect, &list);
+    if (list.error || list.cnt == 0) {
+        SCFree(list.prefixes);
+        return NULL;
+    }
+
+    SCLpmIPV4 *lpm = SCLpmIPV4CompileArray(list.prefixes, list.cnt);
+    SCFree(list.prefixes);
+    return lpm;
+}
+
+void SCLpmIPV4Free(SCLpmIPV4 *lpm)
+{
+    if (lpm == NULL)
+        return;
+
+    if (lpm->root != NULL)
+        SCFreeAligned(lpm->root);
+    if (lpm->tables != NULL)
+        SCFree(lpm->tables);
+    if (lpm->nodes != NULL)
+        SCFree(lpm->nodes);
+    if (lpm->leaves != NULL)
+        SCFree(lpm->leaves);
+    if (lpm->values != NULL)
+        SCFree(lpm->values);
+    SCFree(lpm);
+}
+
+uint64_t SCLpmIPV4MemUse(const SCLpmIPV4 *lpm)
+{
+    if (lpm == NULL)
+        return 0;
+    return sizeof(*lpm) + LPM_ROOT_SIZE * sizeof(uint32_t) +
+        (uint64_t)lpm->tables_size * 256 * sizeof(uint32_t) +
+        (uint64_t)lpm->nodes_size * sizeof(SCLpmIPV4Node) +
+        (uint64_t)lpm->leaves_size * sizeof(uint32_t) +
+        (uint64_t)lpm->values_cnt * sizeof(void *);
+}
+
+/*------------------------------------Unit_Tests------------------------------*/
+
+#ifdef UNITTESTS
+
+static int LpmTestAdd(SCRadixTree *tree, const char *str, void *user)
+{
+    return SCRadixAddKeyIPV4String(str, tree, user) != NULL;
+}
+
+static void *LpmTestRadix(SCRadixTree *tree, uint32_t ip)
+{
+    void *user = NULL;
+    uint32_t nip = htonl(ip);
+    (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&nip, tree, &user);
+    return user;
+}
+
+static void *LpmTestLookup(SCLpmIPV4 *lpm, uint32_t ip)
+{
+    uint32_t nip = htonl(ip);
+    return SCLpmIPV4Lookup(lpm, (uint8_t *)&nip);
+}
+
+/** \test nested netblocks of all strides give the same answers as the
+ *        radix tree */
+static int SCLpmIPV4Test01(void)
+{
+    int result = 0;
+    static int users[7];
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    SCLpmIPV4 *lpm = NULL;
+
+    if (!LpmTestAdd(tree, "10.0.0.0/8", &users[0]) ||
+        !LpmTestAdd(tree, "10.1.0.0/16", &users[1]) ||
+        !LpmTestAdd(tree, "10.1.2.0/23", &users[2]) ||
+        !LpmTestAdd(tree, "10.1.2.0/24", &users[3]) ||
+        !LpmTestAdd(tree, "10.1.2.128/25", &users[4]) ||
+        !LpmTestAdd(tree, "10.1.2.3", &users[5]) ||
+        !LpmTestAdd(tree, "192.168.1.1", &users[6]))
+        goto end;
+
+    lpm = SCLpmIPV4CompileRadix(tree);
+    if (lpm == NULL)
+        goto end;
+
+    if (LpmTestLookup(lpm, 0x0a010203) != &users[5] ||   /* 10.1.2.3 */
+        LpmTestLookup(lpm, 0x0a010204) != &users[3] ||   /* 10.1.2.4 */
+        LpmTestLookup(lpm, 0x0a010281) != &users[4] ||   /* 10.1.2.129 */
+        LpmTestLookup(lpm, 0x0a010301) != &users[2] ||   /* 10.1.3.1 */
+        LpmTestLookup(lpm, 0x0a01ff01) != &users[1] ||   /* 10.1.255.1 */
+        LpmTestLookup(lpm, 0x0a020304) != &users[0] ||   /* 10.2.3.4 */
+        LpmTestLookup(lpm, 0xc0a80101) != &users[6] ||   /* 192.168.1.1 */
+        LpmTestLookup(lpm, 0xc0a80102) != NULL ||        /* 192.168.1.2 */
+        LpmTestLookup(lpm, 0x0b000001) != NULL)          /* 11.0.0.1 */
+        goto end;
+
+    /* walk the blocks around the netblocks and compare with the tree */
+    uint32_t ip;
+    for (ip = 0x0a010000; ip < 0x0a010400; ip++) {
+        if (LpmTestLookup(lpm, ip) != LpmTestRadix(tree, ip)) {
+            printf("mismatch for %08x: ", ip);
+            goto end;
+        }
+    }
+
+    result = 1;
+end:
+    SCLpmIPV4Free(lpm);
+    SCRadixReleaseRadixTree(tree);
+    return result;
+}
+
+/** \test empty tree and /0 */
+static int SCLpmIPV4Test02(void)
+{
+    int result = 0;
+    static int users[2];
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    SCLpmIPV4 *lpm = SCLpmIPV4CompileRadix(tree);
+    if (lpm != NULL)
+        goto end;
+
+    if (!LpmTestAdd(tree, "0.0.0.0/0", &users[0]) ||
+        !LpmTestAdd(tree, "1.2.3.4", &users[1]))
+        goto end;
+
+    lpm = SCLpmIPV4CompileRadix(tree);
+    if (lpm == NULL)
+        goto end;
+
+    if (LpmTestLookup(lpm, 0x01020304) != &users[1] ||
+        LpmTestLookup(lpm, 0x01020305) != &users[0] ||
+        LpmTestLookup(lpm, 0xffffffff) != &users[0])
+        goto end;
+
+    result = 1;
+end:
+    SCLpmIPV4Free(lpm);
+    SCRadixReleaseRadixTree(tree);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void SCLpmIPV4RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCLpmIPV4Test01", SCLpmIPV4Test01);
+    UtRegisterTest("SCLpmIPV4Test02", SCLpmIPV4Test02);
+#endif
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Read only longest prefix match table for IPv4, compiled from a radix
+ * tree. Lookups take at most 3 steps (16-8-8 bit strides).
+ */
+
+#ifndef __UTIL_LPM_IPV4_H__
+#define __UTIL_LPM_IPV4_H__
+
+#include "util-radix-tree.h"
+
+/** entry flag: the rest of the entry is a child index, otherwise it's an
+ *  index into values + 1, 0 meaning no match */
+#define SC_LPM_IPV4_CHILD       0x80000000U
+
+/** last 8 bits of a /24 with netblocks longer than /24: leaves holds one
+ *  entry per run of equal entries, bitmap marks where each run starts */
+typedef struct SCLpmIPV4Node_ {
+    uint64_t bitmap[4];
+    uint32_t base;          /**< first leaf of this node */
+    uint8_t cnt[4];         /**< bits set in the words before this one */
+} SCLpmIPV4Node;
+
+typedef struct SCLpmIPV4_ {
+    uint32_t *root;         /**< 65536 entries for the first 16 bits */
+    uint32_t *tables;       /**< 256 entry tables for the next 8 bits */
+    SCLpmIPV4Node *nodes;   /**< compressed nodes for the last 8 bits */
+    uint32_t *leaves;
+    void **values;          /**< user data of the radix tree */
+    uint32_t tables_cnt;
+    uint32_t tables_size;
+    uint32_t nodes_cnt;
+    uint32_t nodes_size;
+    uint32_t leaves_cnt;
+    uint32_t leaves_size;
+    uint32_t values_cnt;
+} SCLpmIPV4;
+
+/** netblock to compile */
+typedef struct SCLpmIPV4Prefix_ {
+    uint32_t ip;        /**< host order, masked */
+    uint8_t len;
+    void *user;
+} SCLpmIPV4Prefix;
+
+SCLpmIPV4 *SCLpmIPV4CompileArray(SCLpmIPV4Prefix *, uint32_t);
+SCLpmIPV4 *SCLpmIPV4CompileRadix(SCRadixTree *);
+void SCLpmIPV4Free(SCLpmIPV4 *);
+uint64_t SCLpmIPV4MemUse(const SCLpmIPV4 *);
+void SCLpmIPV4RegisterTests(void);
+
+/**
+ * \brief Look up the longest prefix match for an address
+ *
+ * \param lpm table
+ * \param addr IPv4 address in network byte order
+ *
+ * \retval user data of the best matching netblock or NULL
+ */
+static inline void *SCLpmIPV4Lookup(const SCLpmIPV4 *lpm, const uint8_t *addr)
+{
+    uint32_t e = lpm->root[(addr[0] << 8) | addr[1]];
+    if (e & SC_LPM_IPV4_CHILD) {
+        e = lpm->tables[((e & ~SC_LPM_IPV4_CHILD) << 8) | addr[2]];
+        if (e & SC_LPM_IPV4_CHILD) {
+            const SCLpmIPV4Node *n = &lpm->nodes[e & ~SC_LPM_IPV4_CHILD];
+            const uint32_t w = addr[3] >> 6;
+            /* bits 0 up to and including this one */
+            const uint64_t mask = (2ULL << (addr[3] & 63)) - 1;
+            e = lpm->leaves[n->base + n->cnt[w] +
+                __builtin_popcountll(n->bitmap[w] & mask) - 1];
+        }
+    }
+    return e ? lpm->values[e - 1] : NULL;
+}
+
+#endif /* __UTIL_LPM_IPV4_H__ */
@@ -208,7 +208,7 @@ static int DnsGetAnswerTable(lua_State *luastate)
         {
             uint8_t *ptr = (uint8_t *)((uint8_t *)answer + sizeof(DNSAnswerEntry));
             lua_pushstring(luastate, "rrname");
-            LuaPushStringBuffer(luastate, ptr, answer->fqdn_len);
+            LuaPushBuffer(luastate, ptr, answer->fqdn_len);
             lua_settable(luastate, -3);
 
             ptr = (uint8_t *)((uint8_t *)answer + sizeof(DNSAnswerEntry) + answer->fqdn_len);
@@ -228,7 +228,7 @@ static int DnsGetAnswerTable(lua_State *luastate)
                 /* not setting 'addr' */
             } else {
                 lua_pushstring(luastate, "addr");
-                LuaPushStringBuffer(luastate, (uint8_t *)ptr, answer->data_len);
+                LuaPushBuffer(luastate, (uint8_t *)ptr, answer->data_len);
                 lua_settable(luastate, -3);
             }
         }
@@ -68,7 +68,7 @@ static int HttpGetRequestHost(lua_State *luastate)
     if (tx->request_hostname == NULL)
         return LuaCallbackError(luastate, "no request hostname");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(tx->request_hostname), bstr_len(tx->request_hostname));
 }
 
@@ -84,7 +84,7 @@ static int HttpGetRequestUriRaw(lua_State *luastate)
     if (tx->request_uri == NULL)
         return LuaCallbackError(luastate, "no request uri");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(tx->request_uri), bstr_len(tx->request_uri));
 }
 
@@ -106,7 +106,7 @@ static int HttpGetRequestUriNormalized(lua_State *luastate)
         bstr_len(htud->request_uri_normalized) == 0)
         return LuaCallbackError(luastate, "no normalized uri");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(htud->request_uri_normalized),
             bstr_len(htud->request_uri_normalized));
 }
@@ -123,7 +123,7 @@ static int HttpGetRequestLine(lua_State *luastate)
     if (tx->request_line == NULL)
         return LuaCallbackError(luastate, "no request_line");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(tx->request_line), bstr_len(tx->request_line));
 }
 
@@ -139,7 +139,7 @@ static int HttpGetResponseLine(lua_State *luastate)
     if (tx->response_line == NULL)
         return LuaCallbackError(luastate, "no response_line");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(tx->response_line), bstr_len(tx->response_line));
 }
 
@@ -166,7 +166,7 @@ static int HttpGetHeader(lua_State *luastate, int dir)
     if (h == NULL || bstr_len(h->value) == 0)
         return LuaCallbackError(luastate, "header not found");
 
-    return LuaPushStringBuffer(luastate,
+    return LuaPushBuffer(luastate,
             bstr_ptr(h->value), bstr_len(h->value));
 }
 
@@ -203,7 +203,7 @@ static int HttpGetRawHeaders(lua_State *luastate, int dir)
     if (raw == NULL || raw_len == 0)
         return LuaCallbackError(luastate, "no raw headers");
 
-    return LuaPushStringBuffer(luastate, raw, raw_len);
+    return LuaPushBuffer(luastate, raw, raw_len);
 }
 
 static int HttpGetRawRequestHeaders(lua_State *luastate)
@@ -289,7 +289,7 @@ static int HttpGetBody(lua_State *luastate, int dir)
         const uint8_t *data = NULL;
         uint32_t data_len = 0;
         StreamingBufferSegmentGetData(body->sb, &chunk->sbseg, &data, &data_len);
-        LuaPushStringBuffer(luastate, data, data_len);
+        LuaPushBuffer(luastate, data, data_len);
 
         lua_settable(luastate, -3);
 
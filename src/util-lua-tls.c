@@ -144,7 +144,7 @@ static int GetSNI(lua_State *luastate, const Flow *f)
     if (ssl_state->client_connp.sni == NULL)
         return LuaCallbackError(luastate, "error: no server name indication");
 
-    return LuaPushStringBuffer(luastate, (uint8_t *)ssl_state->client_connp.sni,
+    return LuaPushBuffer(luastate, (uint8_t *)ssl_state->client_connp.sni,
                                strlen(ssl_state->client_connp.sni));
 }
 
@@ -199,7 +199,7 @@ static int GetCertChain(lua_State *luastate, const Flow *f, int direction)
         lua_settable(luastate, -3);
 
         lua_pushstring(luastate, "data");
-        LuaPushStringBuffer(luastate, cert->cert_data, cert->cert_len);
+        LuaPushBuffer(luastate, cert->cert_data, cert->cert_len);
 
         lua_settable(luastate, -3);
         lua_settable(luastate, -3);
@@ -47,6 +47,7 @@
 #include "util-proto-name.h"
 #include "util-logopenfile.h"
 #include "util-time.h"
+#include "util-spm-bs.h"
 
 #ifdef HAVE_LUA
 
@@ -75,6 +76,8 @@ const char lua_ext_key_pa[] = "suricata:lua:pkt:alert:ptr";
 const char lua_ext_key_file[] = "suricata:lua:file:ptr";
 /* key for streaming buffer pointer */
 const char lua_ext_key_streaming_buffer[] = "suricata:lua:streaming_buffer:ptr";
+/* key for the buffer views state */
+const char lua_ext_key_buffer_views[] = "suricata:lua:buffer_views";
 
 /** \brief get tv pointer from the lua state */
 ThreadVars *LuaStateGetThreadVars(lua_State *luastate)
@@ -273,4 +276,211 @@ int LuaPushStringBuffer(lua_State *luastate, const uint8_t *input, size_t input_
     return 1;
 }
 
+/** metatable of the buffer view userdata */
+#define LUA_BUFFER_VIEW_MT "suricata:buffer_view"
+
+/** per state part of the buffer views, anchored in the registry */
+typedef struct LuaBufferViews_ {
+    uint64_t gen;   /**< bumped when the buffers of a call go away */
+    int enabled;
+} LuaBufferViews;
+
+/** a view of a buffer owned by the engine: no copy, no interning */
+typedef struct LuaBufferView_ {
+    const uint8_t *data;
+    size_t len;
+    uint64_t gen;   /**< LuaBufferViews::gen when pushed */
+    const LuaBufferViews *views;
+} LuaBufferView;
+
+static LuaBufferViews *LuaStateGetBufferViews(lua_State *luastate)
+{
+    lua_pushlightuserdata(luastate, (void *)&lua_ext_key_buffer_views);
+    lua_gettable(luastate, LUA_REGISTRYINDEX);
+    LuaBufferViews *views = lua_touserdata(luastate, -1);
+    lua_pop(luastate, 1);
+    return views;
+}
+
+/** \internal \brief get the view at index 1, error out if the buffer is gone */
+static LuaBufferView *LuaBufferViewCheck(lua_State *luastate)
+{
+    LuaBufferView *v = luaL_checkudata(luastate, 1, LUA_BUFFER_VIEW_MT);
+    if (v->gen != v->views->gen)
+        luaL_error(luastate, "buffer view used after the call it was passed to");
+    return v;
+}
+
+/** \internal \brief offset of a 1 based, maybe negative, start position
+ *         like string.sub counts it */
+static size_t LuaBufferViewStart(lua_Integer pos, size_t len)
+{
+    if (pos < 0)
+        pos += (lua_Integer)len + 1;
+    if (pos < 1)
+        return 0;
+    if ((size_t)pos > len)
+        return len;
+    return (size_t)pos - 1;
+}
+
+/** \internal \brief offset just past a 1 based, maybe negative, end
+ *         position */
+static size_t LuaBufferViewEnd(lua_Integer pos, size_t len)
+{
+    if (pos < 0)
+        pos += (lua_Integer)len + 1;
+    if (pos < 0)
+        return 0;
+    if ((size_t)pos > len)
+        return len;
+    return (size_t)pos;
+}
+
+static int LuaBufferViewLen(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    lua_pushinteger(luastate, (lua_Integer)v->len);
+    return 1;
+}
+
+/** \internal \brief pointer to the data, for ffi.cast("const uint8_t *", ptr) */
+static int LuaBufferViewPtr(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    lua_pushlightuserdata(luastate, (void *)v->data);
+    return 1;
+}
+
+/** \internal \brief view:byte(i [, j]) like string.byte */
+static int LuaBufferViewByte(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    lua_Integer i = luaL_optinteger(luastate, 2, 1);
+    lua_Integer j = luaL_optinteger(luastate, 3, i);
+    size_t start = LuaBufferViewStart(i, v->len);
+    size_t end = LuaBufferViewEnd(j, v->len);
+    if (start >= end)
+        return 0;
+
+    int n = (int)(end - start);
+    luaL_checkstack(luastate, n, "buffer view: too many bytes");
+    size_t u;
+    for (u = start; u < end; u++)
+        lua_pushinteger(luastate, v->data[u]);
+    return n;
+}
+
+/** \internal \brief view:sub(i [, j]) copies just that part into a string */
+static int LuaBufferViewSub(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    lua_Integer i = luaL_optinteger(luastate, 2, 1);
+    lua_Integer j = luaL_optinteger(luastate, 3, -1);
+    size_t start = LuaBufferViewStart(i, v->len);
+    size_t end = LuaBufferViewEnd(j, v->len);
+    if (start >= end) {
+        lua_pushliteral(luastate, "");
+        return 1;
+    }
+    return LuaPushStringBuffer(luastate, v->data + start, end - start);
+}
+
+/** \internal \brief view:find(needle [, init]), plain search
+ *
+ *  \retval start, end 1 based positions of the match, or nil */
+static int LuaBufferViewFind(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    size_t needle_len = 0;
+    const char *needle = luaL_checklstring(luastate, 2, &needle_len);
+    size_t start = LuaBufferViewStart(luaL_optinteger(luastate, 3, 1), v->len);
+
+    if (needle_len == 0 || needle_len > UINT16_MAX ||
+        needle_len > v->len - start || v->len - start > UINT32_MAX) {
+        lua_pushnil(luastate);
+        return 1;
+    }
+
+    const uint8_t *found = BasicSearch(v->data + start, (uint32_t)(v->len - start),
+            (const uint8_t *)needle, (uint16_t)needle_len);
+    if (found == NULL) {
+        lua_pushnil(luastate);
+        return 1;
+    }
+    lua_pushinteger(luastate, (lua_Integer)(found - v->data) + 1);
+    lua_pushinteger(luastate, (lua_Integer)(found - v->data + needle_len));
+    return 2;
+}
+
+/** \internal \brief tostring(view) copies the whole buffer */
+static int LuaBufferViewToString(lua_State *luastate)
+{
+    LuaBufferView *v = LuaBufferViewCheck(luastate);
+    return LuaPushStringBuffer(luastate, v->data, v->len);
+}
+
+/**
+ *  \brief set up buffer views in a lua state
+ *
+ *  With 'enabled' set, LuaPushBuffer pushes a view of a buffer instead
+ *  of a copy of it. A view is a small userdata with len, ptr, byte, sub
+ *  and find methods and the # operator. The data is the engine's, so a
+ *  view is only usable during the call it was passed to or returned in:
+ *  LuaBufferViewsInvalidate ends that, using it after raises an error.
+ */
+void LuaRegisterBufferViews(lua_State *luastate, int enabled)
+{
+    lua_pushlightuserdata(luastate, (void *)&lua_ext_key_buffer_views);
+    LuaBufferViews *views = lua_newuserdata(luastate, sizeof(*views));
+    views->gen = 0;
+    views->enabled = enabled;
+    lua_settable(luastate, LUA_REGISTRYINDEX);
+
+    luaL_newmetatable(luastate, LUA_BUFFER_VIEW_MT);
+    lua_newtable(luastate);
+    lua_pushcfunction(luastate, LuaBufferViewLen);
+    lua_setfield(luastate, -2, "len");
+    lua_pushcfunction(luastate, LuaBufferViewPtr);
+    lua_setfield(luastate, -2, "ptr");
+    lua_pushcfunction(luastate, LuaBufferViewByte);
+    lua_setfield(luastate, -2, "byte");
+    lua_pushcfunction(luastate, LuaBufferViewSub);
+    lua_setfield(luastate, -2, "sub");
+    lua_pushcfunction(luastate, LuaBufferViewFind);
+    lua_setfield(luastate, -2, "find");
+    lua_setfield(luastate, -2, "__index");
+    lua_pushcfunction(luastate, LuaBufferViewLen);
+    lua_setfield(luastate, -2, "__len");
+    lua_pushcfunction(luastate, LuaBufferViewToString);
+    lua_setfield(luastate, -2, "__tostring");
+    lua_pop(luastate, 1);
+}
+
+/** \brief end the views pushed so far, call when their buffers go away */
+void LuaBufferViewsInvalidate(lua_State *luastate)
+{
+    LuaBufferViews *views = LuaStateGetBufferViews(luastate);
+    if (views != NULL)
+        views->gen++;
+}
+
+/** \brief push a view of a buffer if the state has them enabled, a copy
+ *         otherwise */
+int LuaPushBuffer(lua_State *luastate, const uint8_t *input, size_t input_len)
+{
+    LuaBufferViews *views = LuaStateGetBufferViews(luastate);
+    if (views == NULL || !views->enabled)
+        return LuaPushStringBuffer(luastate, input, input_len);
+
+    LuaBufferView *v = lua_newuserdata(luastate, sizeof(*v));
+    v->data = input;
+    v->len = input_len;
+    v->gen = views->gen;
+    v->views = views;
+    luaL_getmetatable(luastate, LUA_BUFFER_VIEW_MT);
+    lua_setmetatable(luastate, -2);
+    return 1;
+}
+
 #endif /* HAVE_LUA */
@@ -90,6 +90,10 @@ void LuaPrintStack(lua_State *state);
 
 int LuaPushStringBuffer(lua_State *luastate, const uint8_t *input, size_t input_len);
 
+void LuaRegisterBufferViews(lua_State *luastate, int enabled);
+void LuaBufferViewsInvalidate(lua_State *luastate);
+int LuaPushBuffer(lua_State *luastate, const uint8_t *input, size_t input_len);
+
 #endif /* HAVE_LUA */
 
 #endif /* __UTIL_LUA_H__ */
@@ -25,37 +25,40 @@
  * Libmagic's API is not thread safe. The data the pointer returned by
  * magic_buffer is overwritten by the next magic_buffer call. This is
  * why we need to lock calls and copy the returned string.
+ *
+ * Threads that do many lookups use a MagicThreadCtx instead: their own
+ * libmagic context and a cache of the results for recently seen file
+ * starts, so the same download doesn't go through libmagic again.
  */
 
 #include "suricata-common.h"
 #include "conf.h"
 
 #include "util-unittest.h"
+#include "util-hash-lookup3.h"
+#include "util-magic.h"
 #include <magic.h>
 
 static magic_t g_magic_ctx = NULL;
 static SCMutex g_magic_lock;
 
 /**
- *  \brief Initialize the "magic" context.
+ *  \brief Open a libmagic context and load the configured magic-file
+ *
+ *  \param verbose log the magic-file that is used
+ *
+ *  \retval ctx context or NULL on error
  */
-int MagicInit(void)
+static magic_t MagicOpenContext(int verbose)
 {
-    BUG_ON(g_magic_ctx != NULL);
-
-    SCEnter();
-
     char *filename = NULL;
     FILE *fd = NULL;
 
-    SCMutexInit(&g_magic_lock, NULL);
-    SCMutexLock(&g_magic_lock);
-
-    g_magic_ctx = magic_open(0);
-    if (g_magic_ctx == NULL) {
+    magic_t ctx = magic_open(0);
+    if (ctx == NULL) {
         SCLogError(SC_ERR_MAGIC_OPEN, "magic_open failed: %s",
-                magic_error(g_magic_ctx));
-        goto error;
+                magic_error(ctx));
+        return NULL;
     }
 
     (void)ConfGet("magic-file", &filename);
@@ -65,11 +68,13 @@ int MagicInit(void)
         if (strlen(filename) == 0) {
             /* set filename to NULL on *nix systems so magic_load uses system
              * default path (see man libmagic) */
-            SCLogConfig("using system default magic-file");
+            if (verbose)
+                SCLogConfig("using system default magic-file");
             filename = NULL;
         }
         else {
-            SCLogConfig("using magic-file %s", filename);
+            if (verbose)
+                SCLogConfig("using magic-file %s", filename);
 
             if ( (fd = fopen(filename, "r")) == NULL) {
                 SCLogWarning(SC_ERR_FOPEN, "Error opening file: \"%s\": %s",
@@ -80,23 +85,39 @@ int MagicInit(void)
         }
     }
 
-    if (magic_load(g_magic_ctx, filename) != 0) {
+    if (magic_load(ctx, filename) != 0) {
         SCLogError(SC_ERR_MAGIC_LOAD, "magic_load failed: %s",
-                magic_error(g_magic_ctx));
+                magic_error(ctx));
         goto error;
     }
 
-    SCMutexUnlock(&g_magic_lock);
-    SCReturnInt(0);
+    return ctx;
 
 error:
-    if (g_magic_ctx != NULL) {
-        magic_close(g_magic_ctx);
-        g_magic_ctx = NULL;
+    magic_close(ctx);
+    return NULL;
+}
+
+/**
+ *  \brief Initialize the "magic" context.
+ */
+int MagicInit(void)
+{
+    BUG_ON(g_magic_ctx != NULL);
+
+    SCEnter();
+
+    SCMutexInit(&g_magic_lock, NULL);
+    SCMutexLock(&g_magic_lock);
+
+    g_magic_ctx = MagicOpenContext(1);
+    if (g_magic_ctx == NULL) {
+        SCMutexUnlock(&g_magic_lock);
+        SCReturnInt(-1);
     }
 
     SCMutexUnlock(&g_magic_lock);
-    SCReturnInt(-1);
+    SCReturnInt(0);
 }
 
 /**
@@ -154,6 +175,100 @@ char *MagicThreadLookup(magic_t *ctx, const uint8_t *buf, uint32_t buflen)
     SCReturnPtr(magic, "const char");
 }
 
+/**
+ *  \brief Set up a per thread magic context
+ *
+ *  \retval mt context or NULL on error
+ */
+MagicThreadCtx *MagicThreadCtxInit(void)
+{
+    MagicThreadCtx *mt = SCMalloc(sizeof(MagicThreadCtx));
+    if (unlikely(mt == NULL))
+        return NULL;
+    memset(mt, 0x00, sizeof(MagicThreadCtx));
+
+    mt->ctx = MagicOpenContext(0);
+    if (mt->ctx == NULL) {
+        SCFree(mt);
+        return NULL;
+    }
+    return mt;
+}
+
+void MagicThreadCtxFree(MagicThreadCtx *mt)
+{
+    if (mt == NULL)
+        return;
+
+    int i;
+    for (i = 0; i < MAGIC_CACHE_SIZE; i++) {
+        if (mt->cache[i].magic != NULL)
+            SCFree(mt->cache[i].magic);
+    }
+    if (mt->ctx != NULL)
+        magic_close(mt->ctx);
+    SCFree(mt);
+}
+
+/**
+ *  \brief Find the magic value for a buffer, using the thread's cache
+ *
+ *  The cache key is a 64 bit hash of the first MAGIC_CACHE_KEY_LEN bytes
+ *  of the buffer, so files that start with the same bytes get the result
+ *  of the first lookup. libmagic's checks are at the start of the file
+ *  in nearly all cases.
+ *
+ *  \param mt thread magic context
+ *  \param buf the buffer
+ *  \param buflen length of the buffer
+ *
+ *  \retval result pointer to null terminated string, to be freed by
+ *          the caller
+ */
+char *MagicThreadCtxLookup(MagicThreadCtx *mt, const uint8_t *buf, uint32_t buflen)
+{
+    if (buf == NULL || buflen == 0)
+        return NULL;
+
+    const uint32_t len = MIN(buflen, MAGIC_CACHE_KEY_LEN);
+    uint32_t pc = 0, pb = len;
+    hashlittle2(buf, len, &pc, &pb);
+    uint64_t key = ((uint64_t)pb << 32) | pc;
+    if (key == 0)
+        key = 1;
+
+    mt->tick++;
+
+    /* unused entries have last_use 0, so they are the oldest */
+    MagicCacheEntry *lru = &mt->cache[0];
+    int i;
+    for (i = 0; i < MAGIC_CACHE_SIZE; i++) {
+        MagicCacheEntry *e = &mt->cache[i];
+        if (e->key == key && e->len == len) {
+            e->last_use = mt->tick;
+            return SCStrdup(e->magic);
+        }
+        if (mt->tick - e->last_use > mt->tick - lru->last_use)
+            lru = e;
+    }
+
+    char *magic = MagicThreadLookup(&mt->ctx, buf, buflen);
+    if (magic == NULL)
+        return NULL;
+
+    char *cached = SCStrdup(magic);
+    if (unlikely(cached == NULL))
+        return magic;
+
+    if (lru->magic != NULL)
+        SCFree(lru->magic);
+    lru->key = key;
+    lru->len = len;
+    lru->last_use = mt->tick;
+    lru->magic = cached;
+    return magic;
+}
+
 void MagicDeinit(void)
 {
     SCMutexLock(&g_magic_lock);
@@ -665,6 +780,67 @@ end:
     return retval;
 }
 
+/** \test thread ctx lookup and result cache */
+int MagicThreadCtxTest01(void)
+{
+    char pdf[] = { 0x25, 'P', 'D', 'F', '-', '1', '.', '3', 0x0d, 0x0a};
+    char *result = NULL;
+    int retval = 0;
+    int i;
+
+    MagicThreadCtx *mt = MagicThreadCtxInit();
+    if (mt == NULL)
+        return 0;
+
+    result = MagicThreadCtxLookup(mt, (uint8_t *)pdf, sizeof(pdf));
+    if (result == NULL || strncmp(result, "PDF document", 12) != 0) {
+        printf("result %p:%s, not \"PDF document\": ", result,result?result:"(null)");
+        goto end;
+    }
+    SCFree(result);
+
+    /* poison the cached result: a hit must return it */
+    MagicCacheEntry *e = NULL;
+    for (i = 0; i < MAGIC_CACHE_SIZE; i++) {
+        if (mt->cache[i].magic != NULL)
+            e = &mt->cache[i];
+    }
+    if (e == NULL) {
+        printf("result not cached: ");
+        goto end;
+    }
+    e->magic[0] = 'X';
+
+    result = MagicThreadCtxLookup(mt, (uint8_t *)pdf, sizeof(pdf));
+    if (result == NULL || strncmp(result, "XDF document", 12) != 0) {
+        printf("result %p:%s, not \"XDF document\": ", result,result?result:"(null)");
+        goto end;
+    }
+    SCFree(result);
+
+    /* fill the cache with other buffers, the pdf entry is evicted */
+    for (i = 0; i < MAGIC_CACHE_SIZE; i++) {
+        uint8_t buf[8] = "text ";
+        buf[5] = (uint8_t)('a' + (i % 26));
+        buf[6] = (uint8_t)('a' + (i / 26));
+        result = MagicThreadCtxLookup(mt, buf, sizeof(buf) - 1);
+        if (result != NULL)
+            SCFree(result);
+    }
+    result = MagicThreadCtxLookup(mt, (uint8_t *)pdf, sizeof(pdf));
+    if (result == NULL || strncmp(result, "PDF document", 12) != 0) {
+        printf("result %p:%s, not \"PDF document\": ", result,result?result:"(null)");
+        goto end;
+    }
+
+    retval = 1;
+end:
+    if (result != NULL)
+        SCFree(result);
+    MagicThreadCtxFree(mt);
+    return retval;
+}
+
 #endif /* UNITTESTS */
 
 
@@ -686,5 +862,6 @@ void MagicRegisterTests(void)
 
     UtRegisterTest("MagicDetectTest10ValgrindError",
                    MagicDetectTest10ValgrindError);
+    UtRegisterTest("MagicThreadCtxTest01", MagicThreadCtxTest01);
 #endif /* UNITTESTS */
 }
@@ -26,10 +26,32 @@
 
 #include <magic.h>
 
+/** number of results cached per thread */
+#define MAGIC_CACHE_SIZE        64
+/** bytes of the buffer the cache key is calculated over */
+#define MAGIC_CACHE_KEY_LEN     4096
+
+typedef struct MagicCacheEntry_ {
+    uint64_t key;           /**< hash of the first bytes, 0: unused */
+    uint32_t len;           /**< bytes hashed */
+    uint32_t last_use;      /**< MagicThreadCtx::tick of the last hit */
+    char *magic;
+} MagicCacheEntry;
+
+/** per thread libmagic context with a small LRU cache of results */
+typedef struct MagicThreadCtx_ {
+    magic_t ctx;
+    uint32_t tick;
+    MagicCacheEntry cache[MAGIC_CACHE_SIZE];
+} MagicThreadCtx;
+
 int MagicInit(void);
 void MagicDeinit(void);
 char *MagicGlobalLookup(const uint8_t *, uint32_t);
 char *MagicThreadLookup(magic_t *, const uint8_t *, uint32_t);
+MagicThreadCtx *MagicThreadCtxInit(void);
+void MagicThreadCtxFree(MagicThreadCtx *);
+char *MagicThreadCtxLookup(MagicThreadCtx *, const uint8_t *, uint32_t);
 void MagicRegisterTests(void);
 
 #endif /* __UTIL_MAGIC_H__ */
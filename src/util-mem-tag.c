@@ -0,0 +1,203 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Subsystem tagged allocations, see util-mem-tag.h.
+ *
+ * Without jemalloc the tags only do the accounting, using the usable
+ * size the libc reports. Without malloc_usable_size() the counters stay
+ * at 0.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-debug.h"
+#include "util-mem-tag.h"
+#include "util-unittest.h"
+
+MemTagStats mem_tag_stats[MEM_TAG_MAX];
+int mem_tag_flags[MEM_TAG_MAX];
+int mem_tag_free_flags[MEM_TAG_MAX];
+
+static const char *mem_tag_names[MEM_TAG_MAX] = {
+    "flow",
+    "stream",
+    "http",
+    "output",
+};
+
+const char *MemTagToString(int tag)
+{
+    if (tag < 0 || tag >= MEM_TAG_MAX)
+        return "unknown";
+    return mem_tag_names[tag];
+}
+
+uint64_t MemTagGetMemuse(int tag)
+{
+    return SCAtomicFetchAndAdd(&mem_tag_stats[tag].memuse, 0);
+}
+
+void MemTagAllocFailed(int tag, size_t size)
+{
+    uintmax_t scmalloc_size_ = (uintmax_t)size;
+    SCLogError(SC_ERR_MEM_ALLOC, "%s memory allocation of %"PRIuMAX" bytes "
+            "failed: %s", MemTagToString(tag), scmalloc_size_, strerror(errno));
+    if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Out of memory. The engine cannot be "
+                "initialized. Exiting...");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t MemTagFlowCounter(void)
+{
+    return MemTagGetMemuse(MEM_TAG_FLOW);
+}
+
+static uint64_t MemTagStreamCounter(void)
+{
+    return MemTagGetMemuse(MEM_TAG_STREAM);
+}
+
+static uint64_t MemTagHttpCounter(void)
+{
+    return MemTagGetMemuse(MEM_TAG_HTTP);
+}
+
+static uint64_t MemTagOutputCounter(void)
+{
+    return MemTagGetMemuse(MEM_TAG_OUTPUT);
+}
+
+void MemTagRegisterGlobalCounters(void)
+{
+    StatsRegisterGlobalCounter("memory.flow", MemTagFlowCounter);
+    StatsRegisterGlobalCounter("memory.stream", MemTagStreamCounter);
+    StatsRegisterGlobalCounter("memory.http", MemTagHttpCounter);
+    StatsRegisterGlobalCounter("memory.output", MemTagOutputCounter);
+}
+
+#ifdef HAVE_JEMALLOC
+/** \retval arena index, or -1 on error */
+static int MemTagArenaCreate(void)
+{
+    unsigned int arena = 0;
+    size_t sz = sizeof(arena);
+
+    /* jemalloc >= 5 */
+    if (mallctl("arenas.create", &arena, &sz, NULL, 0) == 0)
+        return (int)arena;
+    /* jemalloc 4 */
+    sz = sizeof(arena);
+    if (mallctl("arenas.extend", &arena, &sz, NULL, 0) == 0)
+        return (int)arena;
+    return -1;
+}
+#endif
+
+/**
+ * \brief set up the per tag arenas
+ *
+ * Must run once, before the first tagged allocation.
+ */
+void MemTagInit(void)
+{
+#ifdef HAVE_JEMALLOC
+    int arenas = 1;
+    (void)ConfGetBool("memory.arenas", &arenas);
+    if (!arenas) {
+        SCLogConfig("memory: tagged allocations use the default jemalloc arena");
+        return;
+    }
+
+    int tag;
+    for (tag = 0; tag < MEM_TAG_MAX; tag++) {
+        int arena = MemTagArenaCreate();
+        if (arena < 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "creating jemalloc arena for %s "
+                    "failed, using the default arena", MemTagToString(tag));
+            continue;
+        }
+        /* tcache is per thread and not per arena, it would hand the
+         * memory of one tag to another */
+        mem_tag_flags[tag] = MALLOCX_ARENA(arena) | MALLOCX_TCACHE_NONE;
+        mem_tag_free_flags[tag] = MALLOCX_TCACHE_NONE;
+        SCLogDebug("%s: arena %d", MemTagToString(tag), arena);
+    }
+    SCLogConfig("memory: %d jemalloc arenas for tagged allocations",
+            MEM_TAG_MAX);
+#else
+    SCLogDebug("memory: tagged allocations are accounted only");
+#endif
+}
+
+/* UNITTESTS */
+#ifdef UNITTESTS
+
+static int MemTagTest01(void)
+{
+    uint64_t base[MEM_TAG_MAX];
+    int i;
+    for (i = 0; i < MEM_TAG_MAX; i++)
+        base[i] = MemTagGetMemuse(i);
+
+    void *p = SCMallocTag(MEM_TAG_STREAM, 100);
+    FAIL_IF_NULL(p);
+    memset(p, 0xff, 100);
+#if defined(HAVE_JEMALLOC) || defined(HAVE_MALLOC_USABLE_SIZE)
+    FAIL_IF(MemTagGetMemuse(MEM_TAG_STREAM) - base[MEM_TAG_STREAM] < 100);
+#endif
+    FAIL_IF(MemTagGetMemuse(MEM_TAG_FLOW) != base[MEM_TAG_FLOW]);
+
+    p = SCReallocTag(MEM_TAG_STREAM, p, 4000);
+    FAIL_IF_NULL(p);
+#if defined(HAVE_JEMALLOC) || defined(HAVE_MALLOC_USABLE_SIZE)
+    FAIL_IF(MemTagGetMemuse(MEM_TAG_STREAM) - base[MEM_TAG_STREAM] < 4000);
+#endif
+
+    uint8_t *c = SCCallocTag(MEM_TAG_OUTPUT, 16, 8);
+    FAIL_IF_NULL(c);
+    for (i = 0; i < 128; i++)
+        FAIL_IF(c[i] != 0);
+
+    void *a = SCMallocAlignedTag(MEM_TAG_FLOW, 200, CLS);
+    FAIL_IF_NULL(a);
+    FAIL_IF(((uintptr_t)a & (CLS - 1)) != 0);
+
+    SCFreeTag(MEM_TAG_STREAM, p);
+    SCFreeTag(MEM_TAG_OUTPUT, c);
+    SCFreeTag(MEM_TAG_FLOW, a);
+    SCFreeTag(MEM_TAG_FLOW, NULL);
+
+    for (i = 0; i < MEM_TAG_MAX; i++)
+        FAIL_IF(MemTagGetMemuse(i) != base[i]);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MemTagRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemTagTest01", MemTagTest01);
+#endif /* UNITTESTS */
+}
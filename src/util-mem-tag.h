@@ -0,0 +1,169 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Allocations tagged with the subsystem they belong to.
+ *
+ * Memory from SCMallocTag() and friends must be released with
+ * SCFreeTag() using the same tag. Per tag the bytes in use are exported
+ * as memory.<tag> counters. When built with jemalloc each tag gets its
+ * own arena, so long lived flow memory doesn't fragment the pages of
+ * short lived stream and app-layer buffers, and memory a thread frees
+ * that another allocated goes back to the right arena.
+ */
+
+#ifndef __UTIL_MEM_TAG_H__
+#define __UTIL_MEM_TAG_H__
+
+#include "util-atomic.h"
+
+#ifdef HAVE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#elif defined(HAVE_MALLOC_USABLE_SIZE)
+#include <malloc.h>
+#endif
+
+enum MemTag {
+    MEM_TAG_FLOW = 0,
+    MEM_TAG_STREAM,     /**< segments and reassembly buffers */
+    MEM_TAG_HTTP,       /**< libhtp and http parser state */
+    MEM_TAG_OUTPUT,     /**< output buffers */
+    MEM_TAG_MAX,
+};
+
+typedef struct MemTagStats_ {
+    uint64_t memuse;    /**< usable size of the live allocations */
+} __attribute__((aligned(CLS))) MemTagStats;
+
+extern MemTagStats mem_tag_stats[MEM_TAG_MAX];
+/** mallocx flags per tag, selecting its arena. 0 for the default arena */
+extern int mem_tag_flags[MEM_TAG_MAX];
+/** dallocx flags per tag */
+extern int mem_tag_free_flags[MEM_TAG_MAX];
+
+void MemTagAllocFailed(int tag, size_t size);
+
+static inline size_t MemTagUsableSize(void *ptr)
+{
+#ifdef HAVE_JEMALLOC
+    return sallocx(ptr, 0);
+#elif defined(HAVE_MALLOC_USABLE_SIZE)
+    return malloc_usable_size(ptr);
+#else
+    return 0;
+#endif
+}
+
+static inline void MemTagAccount(int tag, void *ptr, int add)
+{
+    size_t size = MemTagUsableSize(ptr);
+    if (add)
+        (void)SCAtomicFetchAndAdd(&mem_tag_stats[tag].memuse, size);
+    else
+        (void)SCAtomicFetchAndSub(&mem_tag_stats[tag].memuse, size);
+}
+
+static inline void *SCMallocTag(int tag, size_t size)
+{
+#ifdef HAVE_JEMALLOC
+    void *ptr = mallocx(size ? size : 1, mem_tag_flags[tag]);
+#else
+    void *ptr = malloc(size);
+#endif
+    if (unlikely(ptr == NULL)) {
+        MemTagAllocFailed(tag, size);
+        return NULL;
+    }
+    MemTagAccount(tag, ptr, 1);
+    return ptr;
+}
+
+static inline void *SCCallocTag(int tag, size_t nmemb, size_t size)
+{
+#ifdef HAVE_JEMALLOC
+    size_t total = nmemb * size;
+    void *ptr = mallocx(total ? total : 1, mem_tag_flags[tag] | MALLOCX_ZERO);
+#else
+    void *ptr = calloc(nmemb, size);
+#endif
+    if (unlikely(ptr == NULL)) {
+        MemTagAllocFailed(tag, nmemb * size);
+        return NULL;
+    }
+    MemTagAccount(tag, ptr, 1);
+    return ptr;
+}
+
+static inline void *SCMallocAlignedTag(int tag, size_t size, size_t align)
+{
+#ifdef HAVE_JEMALLOC
+    void *ptr = mallocx(size ? size : 1, mem_tag_flags[tag] | MALLOCX_ALIGN(align));
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, align, size) != 0)
+        ptr = NULL;
+#endif
+    if (unlikely(ptr == NULL)) {
+        MemTagAllocFailed(tag, size);
+        return NULL;
+    }
+    MemTagAccount(tag, ptr, 1);
+    return ptr;
+}
+
+/** \brief realloc. On failure the old allocation is left as it was */
+static inline void *SCReallocTag(int tag, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return SCMallocTag(tag, size);
+
+    size_t old_size = MemTagUsableSize(ptr);
+#ifdef HAVE_JEMALLOC
+    void *nptr = rallocx(ptr, size ? size : 1, mem_tag_flags[tag]);
+#else
+    void *nptr = realloc(ptr, size);
+#endif
+    if (unlikely(nptr == NULL)) {
+        MemTagAllocFailed(tag, size);
+        return NULL;
+    }
+    (void)SCAtomicFetchAndSub(&mem_tag_stats[tag].memuse, old_size);
+    (void)SCAtomicFetchAndAdd(&mem_tag_stats[tag].memuse, MemTagUsableSize(nptr));
+    return nptr;
+}
+
+static inline void SCFreeTag(int tag, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    MemTagAccount(tag, ptr, 0);
+#ifdef HAVE_JEMALLOC
+    dallocx(ptr, mem_tag_free_flags[tag]);
+#else
+    free(ptr);
+#endif
+}
+
+void MemTagInit(void);
+void MemTagRegisterGlobalCounters(void);
+uint64_t MemTagGetMemuse(int tag);
+const char *MemTagToString(int tag);
+void MemTagRegisterTests(void);
+
+#endif /* __UTIL_MEM_TAG_H__ */
@@ -0,0 +1,363 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap pressure policy
+ *
+ * Subsystems with a memcap register their memuse and memcap getters and
+ * optionally a shedding callback. The flow manager checks the usage each
+ * pass. When it crosses the warning, degrade or critical percentage the
+ * level of the subsystem moves up and its callback is told to shed; it
+ * only moves down again once the usage is 'hysteresis' percent below the
+ * threshold. Every change is logged and counted in the
+ * 'memcap.<name>.level' and 'memcap.<name>.sheds' counters.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threadvars.h"
+#include "util-debug.h"
+#include "util-memcap.h"
+#include "util-unittest.h"
+
+#define MEMCAP_POLICY_MAX           16
+
+#define MEMCAP_WARNING_DEFAULT      80
+#define MEMCAP_DEGRADE_DEFAULT      90
+#define MEMCAP_CRITICAL_DEFAULT     95
+#define MEMCAP_HYSTERESIS_DEFAULT   5
+
+typedef struct MemcapPolicy_ {
+    char name[32];
+    uint64_t (*GetMemuse)(void);
+    uint64_t (*GetMemcap)(void);
+    MemcapShedFunc Shed;
+    int level;
+
+    /* counter names, the counter api keeps the pointers */
+    char level_name[64];
+    char sheds_name[64];
+    uint16_t level_id;
+    uint16_t sheds_id;
+} MemcapPolicy;
+
+static MemcapPolicy memcap_policies[MEMCAP_POLICY_MAX];
+static int memcap_policies_cnt = 0;
+
+static int memcap_policy_enabled = 0;
+
+/** percentages starting each level, [MEMCAP_LEVEL_NORMAL] is unused */
+static uint32_t memcap_thresholds[MEMCAP_LEVEL_MAX] = {
+    0,
+    MEMCAP_WARNING_DEFAULT,
+    MEMCAP_DEGRADE_DEFAULT,
+    MEMCAP_CRITICAL_DEFAULT,
+};
+static uint32_t memcap_hysteresis = MEMCAP_HYSTERESIS_DEFAULT;
+
+const char *MemcapLevelToString(int level)
+{
+    switch (level) {
+        case MEMCAP_LEVEL_NORMAL:
+            return "normal";
+        case MEMCAP_LEVEL_WARNING:
+            return "warning";
+        case MEMCAP_LEVEL_DEGRADE:
+            return "degrade";
+        case MEMCAP_LEVEL_CRITICAL:
+            return "critical";
+    }
+    return "unknown";
+}
+
+/** \brief register a subsystem with the policy
+ *
+ *  Called from the init of the subsystem. Registering the same name
+ *  again updates the callbacks, e.g. when the config is reloaded.
+ *
+ *  \param GetMemuse current memory use in bytes
+ *  \param GetMemcap memcap in bytes, 0 for no memcap
+ *  \param Shed shedding callback or NULL for telemetry only
+ */
+void MemcapPolicyRegister(const char *name, uint64_t (*GetMemuse)(void),
+        uint64_t (*GetMemcap)(void), MemcapShedFunc Shed)
+{
+    MemcapPolicy *p = NULL;
+    int i;
+    for (i = 0; i < memcap_policies_cnt; i++) {
+        if (strcmp(memcap_policies[i].name, name) == 0) {
+            p = &memcap_policies[i];
+            break;
+        }
+    }
+    if (p == NULL) {
+        if (memcap_policies_cnt == MEMCAP_POLICY_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "too many memcap policy "
+                    "registrations, not adding %s", name);
+            return;
+        }
+        p = &memcap_policies[memcap_policies_cnt++];
+        memset(p, 0, sizeof(*p));
+        strlcpy(p->name, name, sizeof(p->name));
+        snprintf(p->level_name, sizeof(p->level_name), "memcap.%s.level", name);
+        snprintf(p->sheds_name, sizeof(p->sheds_name), "memcap.%s.sheds", name);
+    }
+    p->GetMemuse = GetMemuse;
+    p->GetMemcap = GetMemcap;
+    p->Shed = Shed;
+}
+
+static int MemcapPolicyGetPercent(const char *name, uint32_t *value)
+{
+    intmax_t v = 0;
+    char key[64];
+    snprintf(key, sizeof(key), "memcap-policy.%s", name);
+    if (ConfGetInt(key, &v) != 1)
+        return 0;
+    if (v < 0 || v > 100) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s must be a percentage "
+                "between 0 and 100, using %u", key, *value);
+        return -1;
+    }
+    *value = (uint32_t)v;
+    return 0;
+}
+
+void MemcapPolicyInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("memcap-policy.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    uint32_t t[MEMCAP_LEVEL_MAX] = {
+        0,
+        MEMCAP_WARNING_DEFAULT,
+        MEMCAP_DEGRADE_DEFAULT,
+        MEMCAP_CRITICAL_DEFAULT,
+    };
+    uint32_t hysteresis = MEMCAP_HYSTERESIS_DEFAULT;
+
+    MemcapPolicyGetPercent("warning", &t[MEMCAP_LEVEL_WARNING]);
+    MemcapPolicyGetPercent("degrade", &t[MEMCAP_LEVEL_DEGRADE]);
+    MemcapPolicyGetPercent("critical", &t[MEMCAP_LEVEL_CRITICAL]);
+    MemcapPolicyGetPercent("hysteresis", &hysteresis);
+
+    if (!(t[MEMCAP_LEVEL_WARNING] <= t[MEMCAP_LEVEL_DEGRADE] &&
+          t[MEMCAP_LEVEL_DEGRADE] <= t[MEMCAP_LEVEL_CRITICAL])) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "memcap-policy thresholds must "
+                "be warning <= degrade <= critical, using %u/%u/%u",
+                MEMCAP_WARNING_DEFAULT, MEMCAP_DEGRADE_DEFAULT,
+                MEMCAP_CRITICAL_DEFAULT);
+    } else {
+        memcpy(memcap_thresholds, t, sizeof(memcap_thresholds));
+    }
+    memcap_hysteresis = hysteresis;
+
+    memcap_policy_enabled = 1;
+    SCLogConfig("memcap-policy: warning %u%%, degrade %u%%, critical %u%%, "
+            "hysteresis %u%%", memcap_thresholds[MEMCAP_LEVEL_WARNING],
+            memcap_thresholds[MEMCAP_LEVEL_DEGRADE],
+            memcap_thresholds[MEMCAP_LEVEL_CRITICAL], memcap_hysteresis);
+}
+
+/** \brief undo all shedding, e.g. at shutdown */
+void MemcapPolicyDeinit(void)
+{
+    int i;
+    for (i = 0; i < memcap_policies_cnt; i++) {
+        MemcapPolicy *p = &memcap_policies[i];
+        if (p->level != MEMCAP_LEVEL_NORMAL && p->Shed != NULL)
+            p->Shed(MEMCAP_LEVEL_NORMAL, p->level);
+        p->level = MEMCAP_LEVEL_NORMAL;
+    }
+    memcap_policy_enabled = 0;
+}
+
+int MemcapPolicyEnabled(void)
+{
+    return memcap_policy_enabled;
+}
+
+/** \brief register the counters on the thread running the checks */
+void MemcapPolicyRegisterCounters(ThreadVars *tv)
+{
+    if (!memcap_policy_enabled)
+        return;
+
+    int i;
+    for (i = 0; i < memcap_policies_cnt; i++) {
+        MemcapPolicy *p = &memcap_policies[i];
+        p->level_id = StatsRegisterCounter(p->level_name, tv);
+        p->sheds_id = StatsRegisterCounter(p->sheds_name, tv);
+    }
+}
+
+/** \internal
+ *  \brief level for a usage percentage
+ *
+ *  Going up is immediate. Going down requires the usage to be hysteresis
+ *  percent below the threshold of the current level, so we don't flap
+ *  around a threshold.
+ */
+static int MemcapPolicyLevel(uint64_t memuse, uint64_t memcap, int prev)
+{
+    if (memcap == 0)
+        return MEMCAP_LEVEL_NORMAL;
+
+    uint64_t pct = memuse * 100 / memcap;
+    int level = MEMCAP_LEVEL_NORMAL;
+    int l;
+    for (l = MEMCAP_LEVEL_CRITICAL; l > MEMCAP_LEVEL_NORMAL; l--) {
+        if (pct >= memcap_thresholds[l]) {
+            level = l;
+            break;
+        }
+    }
+    if (level >= prev)
+        return level;
+
+    /* stay at the highest level we're not yet hysteresis below */
+    for (l = prev; l > level; l--) {
+        if (pct + memcap_hysteresis >= memcap_thresholds[l])
+            return l;
+    }
+    return level;
+}
+
+/** \brief check usage of all subsystems and apply the policy
+ *
+ *  Called from the first flow manager each pass.
+ */
+void MemcapPolicyCheck(ThreadVars *tv)
+{
+    if (!memcap_policy_enabled)
+        return;
+
+    int i;
+    for (i = 0; i < memcap_policies_cnt; i++) {
+        MemcapPolicy *p = &memcap_policies[i];
+        const uint64_t memuse = p->GetMemuse();
+        const uint64_t memcap = p->GetMemcap();
+        const int level = MemcapPolicyLevel(memuse, memcap, p->level);
+        if (level == p->level)
+            continue;
+
+        const int prev = p->level;
+        p->level = level;
+
+        if (level > prev) {
+            SCLogWarning(SC_ERR_MEMCAP_POLICY, "memcap-policy: %s at %"PRIu64
+                    " of %"PRIu64" bytes, level %s -> %s%s", p->name, memuse,
+                    memcap, MemcapLevelToString(prev), MemcapLevelToString(level),
+                    p->Shed != NULL && level >= MEMCAP_LEVEL_DEGRADE ?
+                    ", shedding" : "");
+        } else {
+            SCLogNotice("memcap-policy: %s at %"PRIu64" of %"PRIu64" bytes, "
+                    "level %s -> %s", p->name, memuse, memcap,
+                    MemcapLevelToString(prev), MemcapLevelToString(level));
+        }
+
+        if (p->Shed != NULL) {
+            p->Shed(level, prev);
+            if (tv != NULL && level > prev)
+                StatsIncr(tv, p->sheds_id);
+        }
+        if (tv != NULL)
+            StatsSetUI64(tv, p->level_id, (uint64_t)level);
+    }
+}
+
+#ifdef UNITTESTS
+static int memcap_test_last = -1;
+static uint64_t memcap_test_use = 0;
+
+static uint64_t MemcapTestMemuse(void)
+{
+    return memcap_test_use;
+}
+
+static uint64_t MemcapTestMemcap(void)
+{
+    return 1000;
+}
+
+static void MemcapTestShed(int level, int prev)
+{
+    memcap_test_last = level;
+}
+
+static int MemcapPolicyTest01(void)
+{
+    int r = 0;
+    int saved_cnt = memcap_policies_cnt;
+    int saved_enabled = memcap_policy_enabled;
+
+    memcap_policy_enabled = 1;
+    MemcapPolicyRegister("unittest", MemcapTestMemuse, MemcapTestMemcap,
+            MemcapTestShed);
+    MemcapPolicy *p = &memcap_policies[memcap_policies_cnt - 1];
+
+    memcap_test_use = 500;
+    MemcapPolicyCheck(NULL);
+    if (p->level != MEMCAP_LEVEL_NORMAL || memcap_test_last != -1)
+        goto end;
+
+    /* straight to critical */
+    memcap_test_use = 960;
+    MemcapPolicyCheck(NULL);
+    if (p->level != MEMCAP_LEVEL_CRITICAL || memcap_test_last != MEMCAP_LEVEL_CRITICAL)
+        goto end;
+
+    /* below critical, but within the hysteresis */
+    memcap_test_use = 920;
+    MemcapPolicyCheck(NULL);
+    if (p->level != MEMCAP_LEVEL_CRITICAL)
+        goto end;
+
+    /* 89%: below critical - hysteresis, still within degrade's */
+    memcap_test_use = 890;
+    MemcapPolicyCheck(NULL);
+    if (p->level != MEMCAP_LEVEL_DEGRADE || memcap_test_last != MEMCAP_LEVEL_DEGRADE)
+        goto end;
+
+    memcap_test_use = 100;
+    MemcapPolicyCheck(NULL);
+    if (p->level != MEMCAP_LEVEL_NORMAL || memcap_test_last != MEMCAP_LEVEL_NORMAL)
+        goto end;
+
+    /* no memcap: never shed */
+    if (MemcapPolicyLevel(1000, 0, MEMCAP_LEVEL_NORMAL) != MEMCAP_LEVEL_NORMAL)
+        goto end;
+
+    r = 1;
+end:
+    memcap_policies_cnt = saved_cnt;
+    memcap_policy_enabled = saved_enabled;
+    return r;
+}
+#endif /* UNITTESTS */
+
+void MemcapPolicyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemcapPolicyTest01", MemcapPolicyTest01);
+#endif
+}
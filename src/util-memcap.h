@@ -0,0 +1,57 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap pressure policy: graduated shedding before memcaps are hit
+ */
+
+#ifndef __UTIL_MEMCAP_H__
+#define __UTIL_MEMCAP_H__
+
+#include "threadvars.h"
+
+enum MemcapLevel {
+    MEMCAP_LEVEL_NORMAL = 0,
+    MEMCAP_LEVEL_WARNING,
+    MEMCAP_LEVEL_DEGRADE,
+    MEMCAP_LEVEL_CRITICAL,
+    MEMCAP_LEVEL_MAX,
+};
+
+/** \brief shedding callback of a subsystem
+ *
+ *  Called from the flow manager when the level of the subsystem changes.
+ *  Must undo its actions when the level drops again.
+ *
+ *  \param level new level
+ *  \param prev previous level
+ */
+typedef void (*MemcapShedFunc)(int level, int prev);
+
+void MemcapPolicyRegister(const char *name, uint64_t (*GetMemuse)(void),
+        uint64_t (*GetMemcap)(void), MemcapShedFunc Shed);
+void MemcapPolicyInit(void);
+void MemcapPolicyDeinit(void);
+int MemcapPolicyEnabled(void);
+void MemcapPolicyRegisterCounters(ThreadVars *tv);
+void MemcapPolicyCheck(ThreadVars *tv);
+const char *MemcapLevelToString(int level);
+void MemcapPolicyRegisterTests(void);
+
+#endif /* __UTIL_MEMCAP_H__ */
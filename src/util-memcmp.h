@@ -484,7 +484,10 @@ static inline int SCMemcmpLowercase(const void *s1, const void *s2, size_t len)
 
 #else
 
-/* No SIMD support, fall back to plain memcmp and a home grown lowercase one */
+/* No SIMD support at build time, fall back to plain memcmp and the run
+ * time selected case insensitive compare */
+
+#include "util-bytes-simd.h"
 
 /* wrapper around memcmp to match the retvals of the SIMD implementations */
 #define SCMemcmp(a,b,c) ({ \
@@ -493,7 +496,8 @@ static inline int SCMemcmpLowercase(const void *s1, const void *s2, size_t len)
 
 static inline int SCMemcmpLowercase(const void *s1, const void *s2, size_t len)
 {
-    return MemcmpLowercase(s1, s2, len);
+    /* s1 is lowercase already, so folding it as well changes nothing */
+    return BytesCmpNocase(s1, s2, len);
 }
 
 #endif /* SIMD */
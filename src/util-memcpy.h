@@ -27,6 +27,8 @@
 #ifndef __UTIL_MEMCPY_H__
 #define __UTIL_MEMCPY_H__
 
+#include "util-bytes-simd.h"
+
 /**
  * \internal
  * \brief Does a memcpy of the input string to lowercase.
@@ -37,11 +39,7 @@
  */
 static inline void memcpy_tolower(uint8_t *d, const uint8_t *s, uint16_t len)
 {
-    uint16_t i;
-    for (i = 0; i < len; i++)
-        d[i] = u8_tolower(s[i]);
-
-    return;
+    BytesToLower(d, s, len);
 }
 
 #endif /* __UTIL_MEMCPY_H__ */
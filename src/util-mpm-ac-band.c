@@ -0,0 +1,1007 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with a reduced alphabet and banded state rows.
+ *
+ * The "ac" state table has a row of 256 entries per state. Here the
+ * bytes are first mapped to classes: every byte used in a (lower cased)
+ * pattern gets its own class, upper case letters share the class of their
+ * lower case version and all bytes no pattern uses share class 0. Rows
+ * then have one entry per class.
+ *
+ * The full DFA is built as "ac" does, after which only the root row is
+ * kept in full. For all other states most transitions are the same as
+ * those of the root, especially for the deep states. A state only keeps
+ * the band between the first and the last class where it differs from the
+ * root; outside the band the root row is used. A lookup stays a single
+ * table access and a compare, no failure links are followed.
+ *
+ * Meant for sites that can't use Hyperscan and are limited by memory.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-mpm-ac-band.h"
+
+void SCACBandInitCtx(MpmCtx *);
+void SCACBandInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCACBandDestroyCtx(MpmCtx *);
+void SCACBandDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCACBandAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                         uint32_t, SigIntId, uint8_t);
+int SCACBandAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                         uint32_t, SigIntId, uint8_t);
+int SCACBandPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCACBandSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                        PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen);
+void SCACBandPrintInfo(MpmCtx *mpm_ctx);
+void SCACBandPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCACBandRegisterTests(void);
+
+/* a placeholder to denote a failure transition in the goto table */
+#define SC_AC_BAND_FAIL (-1)
+
+#define AC_BAND_CASE_MASK   0x80000000
+#define AC_BAND_PID_MASK    0x7FFFFFFF
+
+/* state tables with fewer states use 16 bit transitions */
+#define AC_BAND_U16_MAX_STATES  32767
+
+#define AC_BAND_U16_OUTPUT  0x8000
+#define AC_BAND_U16_STATE   0x7FFF
+#define AC_BAND_U32_OUTPUT  0x80000000
+#define AC_BAND_U32_STATE   0x7FFFFFFF
+
+static inline int SCACBandUseU16(const SCACBandCtx *ctx)
+{
+    return ctx->state_count < AC_BAND_U16_MAX_STATES;
+}
+
+/**
+ * \brief Initialize the ac-band ctx.
+ */
+void SCACBandInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCACBandCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCACBandCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCACBandCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+}
+
+void SCACBandInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+void SCACBandDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    SCACBandPrintSearchStats(mpm_thread_ctx);
+}
+
+static size_t SCACBandTransSize(const SCACBandCtx *ctx)
+{
+    return SCACBandUseU16(ctx) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+/**
+ * \brief Destroy the ac-band ctx.
+ */
+void SCACBandDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+            while (node != NULL) {
+                nnode = node->next;
+                SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = nnode;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+    }
+
+    if (ctx->root != NULL) {
+        SCFree(ctx->root);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->alpha_size * SCACBandTransSize(ctx);
+    }
+    if (ctx->trans != NULL) {
+        SCFree(ctx->trans);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->trans_cnt * SCACBandTransSize(ctx);
+    }
+    if (ctx->rows != NULL) {
+        SCFree(ctx->rows);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->state_count * sizeof(SCACBandRow);
+    }
+
+    if (ctx->output_table != NULL) {
+        uint32_t state;
+        for (state = 0; state < ctx->state_count; state++) {
+            if (ctx->output_table[state].pids != NULL)
+                SCFree(ctx->output_table[state].pids);
+        }
+        SCFree(ctx->output_table);
+    }
+
+    if (ctx->pid_pat_list != NULL) {
+        uint32_t i;
+        for (i = 0; i < (mpm_ctx->max_pat_id + 1); i++) {
+            if (ctx->pid_pat_list[i].cs != NULL)
+                SCFree(ctx->pid_pat_list[i].cs);
+            if (ctx->pid_pat_list[i].sids != NULL)
+                SCFree(ctx->pid_pat_list[i].sids);
+        }
+        SCFree(ctx->pid_pat_list);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCACBandCtx);
+}
+
+/**
+ * \internal
+ * \brief Map the bytes to classes.
+ */
+static void SCACBandBuildAlphabet(SCACBandCtx *ctx, uint32_t pattern_cnt)
+{
+    uint8_t used[256];
+    uint32_t i, u;
+
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < pattern_cnt; i++) {
+        const MpmPattern *p = ctx->parray[i];
+        for (u = 0; u < p->len; u++)
+            used[p->ci[u]] = 1;
+    }
+
+    /* class 0 is every byte not in a pattern */
+    uint16_t cls = 1;
+    memset(ctx->translate, 0, sizeof(ctx->translate));
+    for (u = 0; u < 256; u++) {
+        if (used[u])
+            ctx->translate[u] = (uint8_t)cls++;
+    }
+    /* the buffer isn't lower cased while searching */
+    for (u = 'A'; u <= 'Z'; u++)
+        ctx->translate[u] = ctx->translate[u8_tolower(u)];
+
+    ctx->alpha_size = cls;
+}
+
+/**
+ * \internal
+ * \brief Adds a pid to the output table of a state.
+ */
+static int SCACBandSetOutputState(SCACBandCtx *ctx, uint32_t state, uint32_t pid)
+{
+    SCACBandOutputTable *output_state = &ctx->output_table[state];
+    uint32_t i;
+
+    for (i = 0; i < output_state->no_of_entries; i++) {
+        if (output_state->pids[i] == pid)
+            return 0;
+    }
+
+    void *ptmp = SCRealloc(output_state->pids,
+                           (output_state->no_of_entries + 1) * sizeof(uint32_t));
+    if (ptmp == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        return -1;
+    }
+    output_state->pids = ptmp;
+    output_state->pids[output_state->no_of_entries++] = pid;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Club the output of src into dst.
+ */
+static int SCACBandClubOutputStates(SCACBandCtx *ctx, uint32_t dst, uint32_t src)
+{
+    uint32_t i;
+    for (i = 0; i < ctx->output_table[src].no_of_entries; i++) {
+        if (SCACBandSetOutputState(ctx, dst, ctx->output_table[src].pids[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** goto table while building, one row of alpha_size entries per state */
+typedef struct SCACBandBuild_ {
+    int32_t *go;
+    uint32_t allocated_state_count;
+} SCACBandBuild;
+
+/**
+ * \internal
+ * \brief Add a state to the goto and output tables.
+ *
+ * \retval state id of the new state, -1 on error
+ */
+static int32_t SCACBandInitNewState(SCACBandCtx *ctx, SCACBandBuild *b)
+{
+    const uint32_t alpha = ctx->alpha_size;
+
+    /* Exponentially increase the allocated space when needed. */
+    if (b->allocated_state_count < ctx->state_count + 1) {
+        uint32_t cnt = b->allocated_state_count ? b->allocated_state_count * 2 : 256;
+        if (cnt > AC_BAND_U32_STATE) {
+            SCLogError(SC_ERR_AHO_CORASICK, "too many states");
+            return -1;
+        }
+
+        void *ptmp = SCRealloc(b->go, (size_t)cnt * alpha * sizeof(int32_t));
+        if (ptmp == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            return -1;
+        }
+        b->go = ptmp;
+
+        ptmp = SCRealloc(ctx->output_table, cnt * sizeof(SCACBandOutputTable));
+        if (ptmp == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            return -1;
+        }
+        ctx->output_table = ptmp;
+        memset(ctx->output_table + b->allocated_state_count, 0,
+               (cnt - b->allocated_state_count) * sizeof(SCACBandOutputTable));
+
+        b->allocated_state_count = cnt;
+    }
+
+    int32_t *row = b->go + (size_t)ctx->state_count * alpha;
+    uint32_t c;
+    for (c = 0; c < alpha; c++)
+        row[c] = SC_AC_BAND_FAIL;
+
+    return (int32_t)ctx->state_count++;
+}
+
+/**
+ * \internal
+ * \brief Build the trie of the patterns.
+ */
+static int SCACBandCreateGotoTable(MpmCtx *mpm_ctx, SCACBandBuild *b)
+{
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+    const uint32_t alpha = ctx->alpha_size;
+    uint32_t i;
+
+    if (SCACBandInitNewState(ctx, b) < 0)
+        return -1;
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        const MpmPattern *p = ctx->parray[i];
+        int32_t state = 0;
+        uint16_t u;
+
+        for (u = 0; u < p->len; u++) {
+            const uint8_t c = ctx->translate[p->ci[u]];
+            int32_t next = b->go[(size_t)state * alpha + c];
+            if (next == SC_AC_BAND_FAIL) {
+                next = SCACBandInitNewState(ctx, b);
+                if (next < 0)
+                    return -1;
+                b->go[(size_t)state * alpha + c] = next;
+            }
+            state = next;
+        }
+
+        if (SCACBandSetOutputState(ctx, state, p->id) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Turn the goto table into the DFA.
+ *
+ * States are visited breadth first. The failure state of a state is less
+ * deep, so its row is final by the time it's used to fill in the
+ * transitions the trie doesn't have.
+ */
+static int SCACBandCreateDeltaTable(SCACBandCtx *ctx, SCACBandBuild *b)
+{
+    const uint32_t alpha = ctx->alpha_size;
+    int32_t *go = b->go;
+    int r = -1;
+    uint32_t c;
+
+    uint32_t *queue = SCMalloc(ctx->state_count * sizeof(uint32_t));
+    uint32_t *failure = SCCalloc(ctx->state_count, sizeof(uint32_t));
+    if (queue == NULL || failure == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+        goto end;
+    }
+
+    uint32_t head = 0, tail = 0;
+    for (c = 0; c < alpha; c++) {
+        if (go[c] == SC_AC_BAND_FAIL) {
+            go[c] = 0;
+        } else {
+            failure[go[c]] = 0;
+            queue[tail++] = (uint32_t)go[c];
+        }
+    }
+
+    while (head < tail) {
+        const uint32_t state = queue[head++];
+        int32_t *row = go + (size_t)state * alpha;
+        const int32_t *frow = go + (size_t)failure[state] * alpha;
+
+        for (c = 0; c < alpha; c++) {
+            if (row[c] == SC_AC_BAND_FAIL) {
+                row[c] = frow[c];
+            } else {
+                const uint32_t next = (uint32_t)row[c];
+                failure[next] = (uint32_t)frow[c];
+                if (SCACBandClubOutputStates(ctx, next, failure[next]) < 0)
+                    goto end;
+                queue[tail++] = next;
+            }
+        }
+    }
+    r = 0;
+end:
+    SCFree(queue);
+    SCFree(failure);
+    return r;
+}
+
+/**
+ * \internal
+ * \brief Store the root row in full and the bands of all other rows.
+ */
+static int SCACBandCreateBands(MpmCtx *mpm_ctx, SCACBandBuild *b)
+{
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+    const uint32_t alpha = ctx->alpha_size;
+    const int32_t *go = b->go;
+    const size_t tsize = SCACBandTransSize(ctx);
+    const uint32_t output = SCACBandUseU16(ctx) ? AC_BAND_U16_OUTPUT : AC_BAND_U32_OUTPUT;
+    uint32_t state, c;
+
+    ctx->rows = SCCalloc(ctx->state_count, sizeof(SCACBandRow));
+    if (ctx->rows == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->state_count * sizeof(SCACBandRow);
+
+    /* find the bands */
+    uint32_t trans_cnt = 0;
+    for (state = 1; state < ctx->state_count; state++) {
+        const int32_t *row = go + (size_t)state * alpha;
+        uint32_t lo = alpha, hi = 0;
+        for (c = 0; c < alpha; c++) {
+            if (row[c] != go[c]) {
+                if (lo == alpha)
+                    lo = c;
+                hi = c;
+            }
+        }
+        if (lo == alpha)
+            continue;
+        ctx->rows[state].lo = (uint16_t)lo;
+        ctx->rows[state].width = (uint16_t)(hi - lo + 1);
+        ctx->rows[state].offset = trans_cnt;
+        trans_cnt += hi - lo + 1;
+    }
+
+    ctx->root = SCMalloc(alpha * tsize);
+    if (ctx->root == NULL)
+        goto error;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += alpha * tsize;
+
+    ctx->trans = SCMalloc(MAX(trans_cnt, 1) * tsize);
+    if (ctx->trans == NULL)
+        goto error;
+    ctx->trans_cnt = trans_cnt;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += trans_cnt * tsize;
+
+    /* fill them in, flagging the states with output */
+#define AC_BAND_FILL(type) do {                                             \
+        type *root = ctx->root, *trans = ctx->trans;                        \
+        for (c = 0; c < alpha; c++) {                                       \
+            const uint32_t next = (uint32_t)go[c];                          \
+            root[c] = (type)(next |                                         \
+                (ctx->output_table[next].no_of_entries ? output : 0));      \
+        }                                                                   \
+        for (state = 1; state < ctx->state_count; state++) {                \
+            const SCACBandRow *r = &ctx->rows[state];                       \
+            const int32_t *row = go + (size_t)state * alpha + r->lo;        \
+            for (c = 0; c < r->width; c++) {                                \
+                const uint32_t next = (uint32_t)row[c];                     \
+                trans[r->offset + c] = (type)(next |                        \
+                    (ctx->output_table[next].no_of_entries ? output : 0));  \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+    if (SCACBandUseU16(ctx))
+        AC_BAND_FILL(uint16_t);
+    else
+        AC_BAND_FILL(uint32_t);
+#undef AC_BAND_FILL
+
+    SCLogDebug("ac-band: %u states, %u classes, %u banded transitions "
+            "instead of %"PRIu64, ctx->state_count, alpha, trans_cnt,
+            (uint64_t)ctx->state_count * 256);
+    return 0;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Flag the pids of case sensitive patterns in the output table,
+ *        shrink the output table.
+ */
+static void SCACBandFinalizeOutput(SCACBandCtx *ctx)
+{
+    uint32_t state, k;
+
+    for (state = 0; state < ctx->state_count; state++) {
+        SCACBandOutputTable *o = &ctx->output_table[state];
+        for (k = 0; k < o->no_of_entries; k++) {
+            if (ctx->pid_pat_list[o->pids[k]].cs != NULL)
+                o->pids[k] |= AC_BAND_CASE_MASK;
+        }
+    }
+
+    void *ptmp = SCRealloc(ctx->output_table,
+                           ctx->state_count * sizeof(SCACBandOutputTable));
+    if (ptmp != NULL)
+        ctx->output_table = ptmp;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the tables.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCACBandPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+    SCACBandBuild b = { NULL, 0 };
+    uint32_t i, p = 0;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+    /* alloc the pattern array */
+    ctx->parray = SCCalloc(mpm_ctx->pattern_cnt, sizeof(MpmPattern *));
+    if (ctx->parray == NULL)
+        goto error;
+
+    /* populate it with the patterns in the hash */
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            ctx->parray[p++] = node;
+            node = nnode;
+        }
+    }
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+
+    ctx->pid_pat_list = SCCalloc(mpm_ctx->max_pat_id + 1, sizeof(SCACBandPatternList));
+    if (ctx->pid_pat_list == NULL)
+        goto error;
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmPattern *pat = ctx->parray[i];
+        SCACBandPatternList *pl = &ctx->pid_pat_list[pat->id];
+
+        if (!(pat->flags & MPM_PATTERN_FLAG_NOCASE)) {
+            pl->cs = SCMalloc(pat->len);
+            if (pl->cs == NULL)
+                goto error;
+            memcpy(pl->cs, pat->original_pat, pat->len);
+        }
+        pl->patlen = pat->len;
+
+        /* the pattern list now owns this memory */
+        pl->sids_size = pat->sids_size;
+        pl->sids = pat->sids;
+        pat->sids_size = 0;
+        pat->sids = NULL;
+    }
+
+    SCACBandBuildAlphabet(ctx, mpm_ctx->pattern_cnt);
+
+    if (SCACBandCreateGotoTable(mpm_ctx, &b) < 0 ||
+        SCACBandCreateDeltaTable(ctx, &b) < 0 ||
+        SCACBandCreateBands(mpm_ctx, &b) < 0)
+        goto error;
+
+    SCACBandFinalizeOutput(ctx);
+
+    /* the goto table is not needed anymore */
+    SCFree(b.go);
+    b.go = NULL;
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmFreePattern(mpm_ctx, ctx->parray[i]);
+    }
+    SCFree(ctx->parray);
+    ctx->parray = NULL;
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    return 0;
+
+error:
+    if (b.go != NULL)
+        SCFree(b.go);
+    if (ctx->parray != NULL) {
+        for (i = 0; i < p; i++) {
+            MpmFreePattern(mpm_ctx, ctx->parray[i]);
+        }
+        SCFree(ctx->parray);
+        ctx->parray = NULL;
+    }
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief Add the patterns ending at buf[i] in output state 'state'.
+ */
+static inline uint32_t SCACBandOutput(const SCACBandCtx *ctx, uint32_t state,
+        PatternMatcherQueue *pmq, const uint8_t *buf, int i, uint8_t *bitarray)
+{
+    const SCACBandPatternList *pid_pat_list = ctx->pid_pat_list;
+    const uint32_t no_of_entries = ctx->output_table[state].no_of_entries;
+    const uint32_t *pids = ctx->output_table[state].pids;
+    uint32_t matches = 0;
+    uint32_t k;
+
+    for (k = 0; k < no_of_entries; k++) {
+        const uint32_t pid = pids[k] & AC_BAND_PID_MASK;
+        if (pids[k] & AC_BAND_CASE_MASK) {
+            if (SCMemcmp(pid_pat_list[pid].cs,
+                         buf + i - pid_pat_list[pid].patlen + 1,
+                         pid_pat_list[pid].patlen) != 0) {
+                continue;
+            }
+        }
+        if (!(bitarray[pid / 8] & (1 << (pid % 8)))) {
+            bitarray[pid / 8] |= (1 << (pid % 8));
+            MpmAddSids(pmq, pid_pat_list[pid].sids, pid_pat_list[pid].sids_size);
+        }
+        matches++;
+    }
+    return matches;
+}
+
+/**
+ * \brief The ac-band search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACBandSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                        PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
+{
+    const SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+    const uint8_t *translate = ctx->translate;
+    const SCACBandRow *rows = ctx->rows;
+    uint32_t matches = 0;
+    int i;
+
+    if (ctx->rows == NULL)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    /* outside of the band (off wraps if c < lo) the root row applies */
+    if (SCACBandUseU16(ctx)) {
+        const uint16_t *root = ctx->root, *trans = ctx->trans;
+        uint16_t state = 0;
+        for (i = 0; i < buflen; i++) {
+            const uint32_t c = translate[buf[i]];
+            const SCACBandRow *r = &rows[state & AC_BAND_U16_STATE];
+            const uint32_t off = c - r->lo;
+            state = off < r->width ? trans[r->offset + off] : root[c];
+            if (state & AC_BAND_U16_OUTPUT) {
+                matches += SCACBandOutput(ctx, state & AC_BAND_U16_STATE,
+                        pmq, buf, i, bitarray);
+            }
+        }
+    } else {
+        const uint32_t *root = ctx->root, *trans = ctx->trans;
+        uint32_t state = 0;
+        for (i = 0; i < buflen; i++) {
+            const uint32_t c = translate[buf[i]];
+            const SCACBandRow *r = &rows[state & AC_BAND_U32_STATE];
+            const uint32_t off = c - r->lo;
+            state = off < r->width ? trans[r->offset + off] : root[c];
+            if (state & AC_BAND_U32_OUTPUT) {
+                matches += SCACBandOutput(ctx, state & AC_BAND_U32_STATE,
+                        pmq, buf, i, bitarray);
+            }
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ */
+int SCACBandAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                         uint16_t offset, uint16_t depth, uint32_t pid,
+                         SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ */
+int SCACBandAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                         uint16_t offset, uint16_t depth, uint32_t pid,
+                         SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCACBandPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+void SCACBandPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx->ctx;
+
+    printf("MPM AC Band Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCACBandCtx:   %" PRIuMAX "\n", (uintmax_t)sizeof(SCACBandCtx));
+    printf("  MpmPattern     %" PRIuMAX "\n", (uintmax_t)sizeof(MpmPattern));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Total states in the state table:    %" PRIu32 "\n", ctx->state_count);
+    printf("Alphabet classes:                   %" PRIu32 "\n", ctx->alpha_size);
+    printf("Banded transitions:                 %" PRIu32 " (ac: %" PRIu64 ")\n",
+            ctx->trans_cnt, (uint64_t)ctx->state_count * 256);
+    printf("\n");
+}
+
+/**
+ * \brief Register the ac-band mpm.
+ */
+void MpmACBandRegister(void)
+{
+    mpm_table[MPM_AC_BAND].name = "ac-band";
+    mpm_table[MPM_AC_BAND].InitCtx = SCACBandInitCtx;
+    mpm_table[MPM_AC_BAND].InitThreadCtx = SCACBandInitThreadCtx;
+    mpm_table[MPM_AC_BAND].DestroyCtx = SCACBandDestroyCtx;
+    mpm_table[MPM_AC_BAND].DestroyThreadCtx = SCACBandDestroyThreadCtx;
+    mpm_table[MPM_AC_BAND].AddPattern = SCACBandAddPatternCS;
+    mpm_table[MPM_AC_BAND].AddPatternNocase = SCACBandAddPatternCI;
+    mpm_table[MPM_AC_BAND].Prepare = SCACBandPreparePatterns;
+    mpm_table[MPM_AC_BAND].Search = SCACBandSearch;
+    mpm_table[MPM_AC_BAND].Cleanup = NULL;
+    mpm_table[MPM_AC_BAND].PrintCtx = SCACBandPrintInfo;
+    mpm_table[MPM_AC_BAND].PrintThreadCtx = SCACBandPrintSearchStats;
+    mpm_table[MPM_AC_BAND].RegisterUnittests = SCACBandRegisterTests;
+    mpm_table[MPM_AC_BAND].flags = MPM_FLAG_PREPARE_THREADSAFE;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static uint32_t SCACBandTestSearch(const char *patterns[], int nocase,
+                                   const char *buf, uint32_t *sids_found)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_BAND);
+    SCACBandInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    for (i = 0; patterns[i] != NULL; i++) {
+        if (nocase)
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)patterns[i],
+                    strlen(patterns[i]), 0, 0, i, i, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)patterns[i],
+                    strlen(patterns[i]), 0, 0, i, i, 0);
+    }
+    SCACBandPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCACBandSearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                  (uint8_t *)buf, strlen(buf));
+    *sids_found = pmq.rule_id_array_cnt;
+
+    SCACBandDestroyCtx(&mpm_ctx);
+    SCACBandDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/** \test single pattern, counted per occurrence, added once */
+static int SCACBandTest01(void)
+{
+    const char *pats[] = { "abcd", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCACBandTestSearch(pats, 0, "xxabcdxxxxabcd", &sids) != 2);
+    FAIL_IF(sids != 1);
+    FAIL_IF(SCACBandTestSearch(pats, 0, "abcabcabdabc", &sids) != 0);
+    PASS;
+}
+
+/** \test case sensitive vs nocase */
+static int SCACBandTest02(void)
+{
+    const char *pats[] = { "ABcd", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCACBandTestSearch(pats, 0, "xxabcdxx", &sids) != 0);
+    FAIL_IF(SCACBandTestSearch(pats, 0, "xxABcdxx", &sids) != 1);
+    FAIL_IF(SCACBandTestSearch(pats, 1, "xxabCDxx", &sids) != 1);
+    PASS;
+}
+
+/** \test overlapping patterns and patterns that are suffixes of others,
+ *        so matches come through the failure transitions */
+static int SCACBandTest03(void)
+{
+    const char *pats[] = { "he", "she", "his", "hers", "abcde", "bcd", "c", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCACBandTestSearch(pats, 0, "ushers", &sids) != 3);
+    FAIL_IF(sids != 3);
+    FAIL_IF(SCACBandTestSearch(pats, 0, "xabcdex", &sids) != 3);
+    FAIL_IF(sids != 3);
+    PASS;
+}
+
+/** \test alphabet: unused bytes share class 0, upper case maps to lower */
+static int SCACBandTest04(void)
+{
+    MpmCtx mpm_ctx;
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC_BAND);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"abc", 3, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"\x00\xff", 2, 0, 0, 1, 1, 0);
+    FAIL_IF(SCACBandPreparePatterns(&mpm_ctx) != 0);
+
+    SCACBandCtx *ctx = (SCACBandCtx *)mpm_ctx.ctx;
+    FAIL_IF(ctx->alpha_size != 6);
+    FAIL_IF(ctx->translate['a'] == 0);
+    FAIL_IF(ctx->translate['A'] != ctx->translate['a']);
+    FAIL_IF(ctx->translate[0x00] == 0);
+    FAIL_IF(ctx->translate[0xff] == 0);
+    FAIL_IF(ctx->translate['d'] != 0);
+    FAIL_IF(ctx->translate[0x80] != 0);
+
+    SCACBandDestroyCtx(&mpm_ctx);
+    PASS;
+}
+
+#define AC_BAND_TEST_BLOCK 16
+
+/** \internal
+ *  \brief next random block of bytes for the patterns and the buffer */
+static void SCACBandTestBlock(uint32_t *seed, uint8_t *block)
+{
+    int u;
+    for (u = 0; u < AC_BAND_TEST_BLOCK; u++) {
+        *seed = *seed * 1103515245 + 12345;
+        block[u] = (uint8_t)"abcdefghIJKL\x00\xfe"[(*seed >> 16) % 14];
+    }
+}
+
+/** \internal
+ *  \brief search buf with random patterns of minlen to 16 bytes, the
+ *         same ones for every mpm_type. Every third one is nocase. */
+static int SCACBandTestCompare(uint16_t mpm_type, uint32_t pattern_cnt,
+        uint16_t minlen, const uint8_t *buf, uint16_t buflen,
+        uint32_t *cnt, uint32_t *sids)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t seed = 1234;
+    uint8_t pat[AC_BAND_TEST_BLOCK];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, mpm_type);
+    mpm_table[mpm_type].InitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    for (i = 0; i < pattern_cnt; i++) {
+        SCACBandTestBlock(&seed, pat);
+        uint16_t len = minlen + (i % (AC_BAND_TEST_BLOCK - minlen + 1));
+        if (i % 3 == 0)
+            MpmAddPatternCI(&mpm_ctx, pat, len, 0, 0, i, i, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, pat, len, 0, 0, i, i, 0);
+    }
+    if (mpm_table[mpm_type].Prepare(&mpm_ctx) != 0)
+        return 0;
+
+    *cnt = mpm_table[mpm_type].Search(&mpm_ctx, &mpm_thread_ctx, &pmq, buf, buflen);
+    *sids = pmq.rule_id_array_cnt;
+
+    mpm_table[mpm_type].DestroyCtx(&mpm_ctx);
+    mpm_table[mpm_type].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return 1;
+}
+
+/** \test same matches as ac for random patterns, with 16 and with 32 bit
+ *        transitions */
+static int SCACBandTest05(void)
+{
+    uint8_t buf[4096];
+    uint32_t seed = 1234;
+    uint32_t i;
+
+    /* the blocks the patterns are taken from, so the first ones occur.
+     * Lower case every other block for the nocase patterns. */
+    for (i = 0; i < sizeof(buf) / AC_BAND_TEST_BLOCK; i++) {
+        uint8_t *block = buf + i * AC_BAND_TEST_BLOCK;
+        SCACBandTestBlock(&seed, block);
+        if (i % 2) {
+            int u;
+            for (u = 0; u < AC_BAND_TEST_BLOCK; u++)
+                block[u] = u8_tolower(block[u]);
+        }
+    }
+
+    /* few states, and enough for the 32 bit transitions */
+    const uint32_t pattern_cnts[] = { 50, 3500 };
+    const uint16_t minlens[] = { 1, 10 };
+    for (i = 0; i < 2; i++) {
+        uint32_t ac_cnt = 0, ac_sids = 0, band_cnt = 0, band_sids = 0;
+        FAIL_IF(!SCACBandTestCompare(MPM_AC, pattern_cnts[i], minlens[i],
+                    buf, sizeof(buf), &ac_cnt, &ac_sids));
+        FAIL_IF(!SCACBandTestCompare(MPM_AC_BAND, pattern_cnts[i], minlens[i],
+                    buf, sizeof(buf), &band_cnt, &band_sids));
+        FAIL_IF(ac_cnt == 0);
+        FAIL_IF(ac_cnt != band_cnt);
+        FAIL_IF(ac_sids != band_sids);
+    }
+    PASS;
+}
+
+/** \test through the detection engine */
+static int SCACBandTest06(void)
+{
+    uint8_t *buf = (uint8_t *)"onetwothreefourfivesixseveneightnine";
+    uint16_t buflen = strlen((char *)buf);
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+
+    memset(&th_v, 0, sizeof(th_v));
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    de_ctx->mpm_matcher = MPM_AC_BAND;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(content:\"sixseven\"; sid:1;)");
+    FAIL_IF_NULL(de_ctx->sig_list);
+    de_ctx->sig_list->next = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(content:\"FOUR\"; nocase; sid:2;)");
+    FAIL_IF_NULL(de_ctx->sig_list->next);
+    de_ctx->sig_list->next->next = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(content:\"FOUR\"; sid:3;)");
+    FAIL_IF_NULL(de_ctx->sig_list->next->next);
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    FAIL_IF(PacketAlertCheck(p, 1) != 1);
+    FAIL_IF(PacketAlertCheck(p, 2) != 1);
+    FAIL_IF(PacketAlertCheck(p, 3) != 0);
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePackets(&p, 1);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCACBandRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCACBandTest01", SCACBandTest01);
+    UtRegisterTest("SCACBandTest02", SCACBandTest02);
+    UtRegisterTest("SCACBandTest03", SCACBandTest03);
+    UtRegisterTest("SCACBandTest04", SCACBandTest04);
+    UtRegisterTest("SCACBandTest05", SCACBandTest05);
+    UtRegisterTest("SCACBandTest06", SCACBandTest06);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Aho-Corasick with a reduced alphabet and banded state rows.
+ */
+
+#ifndef __UTIL_MPM_AC_BAND__H__
+#define __UTIL_MPM_AC_BAND__H__
+
+typedef struct SCACBandPatternList_ {
+    uint8_t *cs;
+    uint16_t patlen;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCACBandPatternList;
+
+typedef struct SCACBandOutputTable_ {
+    /* list of pattern ids */
+    uint32_t *pids;
+    /* no of entries we have in pids */
+    uint32_t no_of_entries;
+} SCACBandOutputTable;
+
+/** row of a state: the transitions for the classes lo to lo + width - 1
+ *  are at trans[offset], all others are those of the root state */
+typedef struct SCACBandRow_ {
+    uint16_t lo;
+    uint16_t width;
+    uint32_t offset;
+} SCACBandRow;
+
+typedef struct SCACBandCtx_ {
+    /* pattern arrays.  We need this only during the table creation phase */
+    MpmPattern **parray;
+
+    uint32_t state_count;
+    uint32_t pattern_id_bitarray_size;
+
+    /* byte to class. Bytes no pattern uses are class 0, upper case
+     * letters have the class of their lower case version */
+    uint8_t translate[256];
+    /* number of classes */
+    uint16_t alpha_size;
+
+    /* full row of the root state, alpha_size entries */
+    void *root;
+    /* rows of all states */
+    SCACBandRow *rows;
+    /* the banded transitions: uint16_t if state_count < 32767, uint32_t
+     * otherwise. The top bit flags states with output. */
+    void *trans;
+    uint32_t trans_cnt;
+
+    SCACBandOutputTable *output_table;
+    SCACBandPatternList *pid_pat_list;
+} SCACBandCtx;
+
+void MpmACBandRegister(void);
+
+#endif /* __UTIL_MPM_AC_BAND__H__ */
@@ -107,6 +107,7 @@ void MpmACBSRegister(void)
     mpm_table[MPM_AC_BS].PrintCtx = SCACBSPrintInfo;
     mpm_table[MPM_AC_BS].PrintThreadCtx = SCACBSPrintSearchStats;
     mpm_table[MPM_AC_BS].RegisterUnittests = SCACBSRegisterTests;
+    mpm_table[MPM_AC_BS].flags = MPM_FLAG_PREPARE_THREADSAFE;
 
     return;
 }
@@ -1504,6 +1504,7 @@ void MpmACTileRegister(void)
     mpm_table[MPM_AC_TILE].PrintCtx = SCACTilePrintInfo;
     mpm_table[MPM_AC_TILE].PrintThreadCtx = SCACTilePrintSearchStats;
     mpm_table[MPM_AC_TILE].RegisterUnittests = SCACTileRegisterTests;
+    mpm_table[MPM_AC_TILE].flags = MPM_FLAG_PREPARE_THREADSAFE;
 }
 
 
@@ -67,8 +67,16 @@
 #include "detect-engine-mpm.h"
 #include "util-cuda.h"
 #include "util-cuda-handlers.h"
+#include "util-cuda-buffer.h"
+#include "util-mpm-offload.h"
 #endif /* __SC_CUDA_SUPPORT__ */
 
+#include "util-mpm-cache.h"
+
+#ifdef UNITTESTS
+#include <dirent.h>
+#endif
+
 void SCACInitCtx(MpmCtx *);
 void SCACInitThreadCtx(MpmCtx *, MpmThreadCtx *);
 void SCACDestroyCtx(MpmCtx *);
@@ -749,6 +757,192 @@ static void SCACPrepareStateTable(MpmCtx *mpm_ctx)
     return;
 }
 
+/** \internal
+ *  \brief serialize the prepared tables to the mpm cache
+ *
+ *  Layout: state count, state table, then per state the output pids and
+ *  per pattern id the pattern and its sids. */
+static void SCACCacheStore(const MpmCtx *mpm_ctx)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    MpmCacheBuffer b;
+    uint32_t i;
+    int r = 0;
+
+    memset(&b, 0, sizeof(b));
+    r |= MpmCacheBufferAppend(&b, &ctx->state_count, sizeof(uint32_t));
+    if (ctx->state_count < 32767) {
+        r |= MpmCacheBufferAppend(&b, ctx->state_table_u16,
+                ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256);
+    } else {
+        r |= MpmCacheBufferAppend(&b, ctx->state_table_u32,
+                ctx->state_count * sizeof(SC_AC_STATE_TYPE_U32) * 256);
+    }
+    for (i = 0; r == 0 && i < ctx->state_count; i++) {
+        const SCACOutputTable *ot = &ctx->output_table[i];
+        r |= MpmCacheBufferAppend(&b, &ot->no_of_entries, sizeof(uint32_t));
+        if (ot->no_of_entries > 0)
+            r |= MpmCacheBufferAppend(&b, ot->pids,
+                    ot->no_of_entries * sizeof(uint32_t));
+    }
+    for (i = 0; r == 0 && i < mpm_ctx->max_pat_id + 1; i++) {
+        const SCACPatternList *pl = &ctx->pid_pat_list[i];
+        uint16_t cslen = pl->cs ? pl->patlen : 0;
+        r |= MpmCacheBufferAppend(&b, &cslen, sizeof(uint16_t));
+        if (cslen > 0)
+            r |= MpmCacheBufferAppend(&b, pl->cs, cslen);
+        r |= MpmCacheBufferAppend(&b, &pl->sids_size, sizeof(uint32_t));
+        if (pl->sids_size > 0)
+            r |= MpmCacheBufferAppend(&b, pl->sids,
+                    pl->sids_size * sizeof(SigIntId));
+    }
+
+    if (r == 0)
+        MpmCacheStore(mpm_ctx, &b);
+    MpmCacheBufferFree(&b);
+}
+
+/** \internal
+ *  \brief free what SCACCacheLoad() set up before it failed */
+static void SCACCacheLoadFree(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t i;
+
+    if (ctx->state_table_u16 != NULL) {
+        SCFree(ctx->state_table_u16);
+        ctx->state_table_u16 = NULL;
+    }
+    if (ctx->state_table_u32 != NULL) {
+        SCFree(ctx->state_table_u32);
+        ctx->state_table_u32 = NULL;
+    }
+    if (ctx->output_table != NULL) {
+        for (i = 0; i < ctx->state_count; i++) {
+            if (ctx->output_table[i].pids != NULL)
+                SCFree(ctx->output_table[i].pids);
+        }
+        SCFree(ctx->output_table);
+        ctx->output_table = NULL;
+    }
+    if (ctx->pid_pat_list != NULL) {
+        for (i = 0; i < mpm_ctx->max_pat_id + 1; i++) {
+            if (ctx->pid_pat_list[i].cs != NULL)
+                SCFree(ctx->pid_pat_list[i].cs);
+            if (ctx->pid_pat_list[i].sids != NULL)
+                SCFree(ctx->pid_pat_list[i].sids);
+        }
+        SCFree(ctx->pid_pat_list);
+        ctx->pid_pat_list = NULL;
+    }
+    ctx->state_count = 0;
+}
+
+/** \internal
+ *  \brief set up the tables from the mpm cache instead of building them
+ *
+ *  \retval 0 loaded, the added patterns are freed
+ *  \retval -1 not cached, ctx is unchanged */
+static int SCACCacheLoad(MpmCtx *mpm_ctx)
+{
+    SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    MpmCacheReader r;
+    uint32_t states, pids, i;
+    size_t table_size;
+
+    if (MpmCacheLoad(mpm_ctx, &r) != 0)
+        return -1;
+
+    if (MpmCacheRead(&r, &ctx->state_count, sizeof(uint32_t)) != 0 ||
+        ctx->state_count == 0 ||
+        ctx->state_count > r.len / (sizeof(SC_AC_STATE_TYPE_U16) * 256))
+        goto error;
+
+    if (ctx->state_count < 32767) {
+        table_size = ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256;
+        ctx->state_table_u16 = SCMalloc(table_size);
+        if (ctx->state_table_u16 == NULL ||
+            MpmCacheRead(&r, ctx->state_table_u16, table_size) != 0)
+            goto error;
+    } else {
+        table_size = ctx->state_count * sizeof(SC_AC_STATE_TYPE_U32) * 256;
+        ctx->state_table_u32 = SCMalloc(table_size);
+        if (ctx->state_table_u32 == NULL ||
+            MpmCacheRead(&r, ctx->state_table_u32, table_size) != 0)
+            goto error;
+    }
+
+    ctx->output_table = SCCalloc(ctx->state_count, sizeof(SCACOutputTable));
+    if (ctx->output_table == NULL)
+        goto error;
+    for (states = 0; states < ctx->state_count; states++) {
+        SCACOutputTable *ot = &ctx->output_table[states];
+        if (MpmCacheRead(&r, &ot->no_of_entries, sizeof(uint32_t)) != 0 ||
+            ot->no_of_entries > r.len / sizeof(uint32_t))
+            goto error;
+        if (ot->no_of_entries == 0)
+            continue;
+        ot->pids = SCMalloc(ot->no_of_entries * sizeof(uint32_t));
+        if (ot->pids == NULL ||
+            MpmCacheRead(&r, ot->pids, ot->no_of_entries * sizeof(uint32_t)) != 0)
+            goto error;
+    }
+
+    ctx->pid_pat_list = SCCalloc(mpm_ctx->max_pat_id + 1, sizeof(SCACPatternList));
+    if (ctx->pid_pat_list == NULL)
+        goto error;
+    for (pids = 0; pids < mpm_ctx->max_pat_id + 1; pids++) {
+        SCACPatternList *pl = &ctx->pid_pat_list[pids];
+        uint16_t cslen = 0;
+        if (MpmCacheRead(&r, &cslen, sizeof(uint16_t)) != 0)
+            goto error;
+        if (cslen > 0) {
+            pl->cs = SCMalloc(cslen);
+            if (pl->cs == NULL || MpmCacheRead(&r, pl->cs, cslen) != 0)
+                goto error;
+            pl->patlen = cslen;
+        }
+        if (MpmCacheRead(&r, &pl->sids_size, sizeof(uint32_t)) != 0)
+            goto error;
+        if (pl->sids_size == 0)
+            continue;
+        if (pl->sids_size > r.len / sizeof(SigIntId))
+            goto error;
+        pl->sids = SCMalloc(pl->sids_size * sizeof(SigIntId));
+        if (pl->sids == NULL ||
+            MpmCacheRead(&r, pl->sids, pl->sids_size * sizeof(SigIntId)) != 0)
+            goto error;
+    }
+    if (r.offset != r.len)
+        goto error;
+    MpmCacheClose(&r);
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += table_size;
+
+    /* the patterns are no longer needed, as after a build */
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            if (node->sids != NULL)
+                SCFree(node->sids);
+            MpmFreePattern(mpm_ctx, node);
+            node = nnode;
+        }
+    }
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    return 0;
+
+error:
+    SCACCacheLoadFree(mpm_ctx);
+    MpmCacheClose(&r);
+    return -1;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -763,6 +957,13 @@ int SCACPreparePatterns(MpmCtx *mpm_ctx)
         return 0;
     }
 
+    /* both tables are only needed for cuda, which builds them itself */
+    int use_cache = (mpm_ctx->mpm_type == MPM_AC &&
+                     !construct_both_16_and_32_state_tables &&
+                     MpmCacheEnabled());
+    if (use_cache && SCACCacheLoad(mpm_ctx) == 0)
+        return 0;
+
     /* alloc the pattern array */
     ctx->parray = (MpmPattern **)SCMalloc(mpm_ctx->pattern_cnt *
                                            sizeof(MpmPattern *));
@@ -856,6 +1057,9 @@ int SCACPreparePatterns(MpmCtx *mpm_ctx)
     ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
     SCLogDebug("ctx->pattern_id_bitarray_size %u", ctx->pattern_id_bitarray_size);
 
+    if (use_cache)
+        SCACCacheStore(mpm_ctx);
+
     return 0;
 
 error:
@@ -1216,7 +1420,7 @@ void SCACPrintInfo(MpmCtx *mpm_ctx)
  *       code internally directly references ac and hence it has found its
  *       home in this file, instead of util-mpm.c
  */
-void DetermineCudaStateTableSize(DetectEngineCtx *de_ctx)
+static void DetermineCudaStateTableSize(DetectEngineCtx *de_ctx)
 {
     MpmCtx *mpm_ctx = NULL;
 
@@ -1274,18 +1478,6 @@ void DetermineCudaStateTableSize(DetectEngineCtx *de_ctx)
 
 }
 
-void CudaReleasePacket(Packet *p)
-{
-    if (p->cuda_pkt_vars.cuda_mpm_enabled == 1) {
-        p->cuda_pkt_vars.cuda_mpm_enabled = 0;
-        SCMutexLock(&p->cuda_pkt_vars.cuda_mutex);
-        p->cuda_pkt_vars.cuda_done = 0;
-        SCMutexUnlock(&p->cuda_pkt_vars.cuda_mutex);
-    }
-
-    return;
-}
-
 /* \todos
  * - Use texture memory - Can we fit all the arrays into a 3d texture.
  *   Texture memory definitely offers slightly better performance even
@@ -1483,28 +1675,15 @@ static void *SCACCudaDispatcher(void *arg)
         uint32_t *o_buffer = cb_data->o_buffer;
         uint32_t d_buffer_start_offset = cb_culled_info.d_buffer_start_offset;
         for (uint32_t i = 0; i < no_of_items; i++, i_op_start_offset++) {
-            Packet *p = (Packet *)cb_data->p_buffer[i_op_start_offset];
-
-            SCMutexLock(&p->cuda_pkt_vars.cuda_mutex);
-            if (p->cuda_pkt_vars.cuda_mpm_enabled == 0) {
-                p->cuda_pkt_vars.cuda_done = 0;
-                SCMutexUnlock(&p->cuda_pkt_vars.cuda_mutex);
-                continue;
-            }
-
-            p->cuda_pkt_vars.cuda_gpu_matches =
-                cuda_results_buffer_h[((o_buffer[i_op_start_offset] - d_buffer_start_offset) * 2)];
-            if (p->cuda_pkt_vars.cuda_gpu_matches != 0) {
-                memcpy(p->cuda_pkt_vars.cuda_results,
-                       cuda_results_buffer_h +
-                       ((o_buffer[i_op_start_offset] - d_buffer_start_offset) * 2),
-                       (cuda_results_buffer_h[((o_buffer[i_op_start_offset] -
-                                                d_buffer_start_offset) * 2)] * sizeof(uint32_t)) + 4);
-            }
-
-            p->cuda_pkt_vars.cuda_done = 1;
-            SCMutexUnlock(&p->cuda_pkt_vars.cuda_mutex);
-            SCCondSignal(&p->cuda_pkt_vars.cuda_cond);
+            MpmOffloadJob *job = (MpmOffloadJob *)cb_data->p_buffer[i_op_start_offset];
+            uint32_t *res = cuda_results_buffer_h +
+                ((o_buffer[i_op_start_offset] - d_buffer_start_offset) * 2);
+
+            /* the owner waits for the job, so it's still there */
+            job->matches = res[0];
+            if (res[0] != 0)
+                memcpy(job->results, res, (res[0] * sizeof(uint32_t)) + 4);
+            MpmOffloadJobDone(job, 1);
         }
         if (no_of_items != 0)
             CudaBufferReportCulledConsumption(cb_data, &cb_culled_info);
@@ -1545,32 +1724,20 @@ static void *SCACCudaDispatcher(void *arg)
 #undef BLOCK_SIZE
 }
 
-uint32_t SCACCudaPacketResultsProcessing(Packet *p, const MpmCtx *mpm_ctx,
-                                         PatternMatcherQueue *pmq)
+/** \brief offload Collect(): verify the offsets and states the kernel
+ *         found against the buffer of the job */
+static uint32_t SCACCudaCollect(MpmOffloadJob *job, PatternMatcherQueue *pmq)
 {
     uint32_t u = 0;
 
-    while (!p->cuda_pkt_vars.cuda_done) {
-        SCMutexLock(&p->cuda_pkt_vars.cuda_mutex);
-        if (p->cuda_pkt_vars.cuda_done) {
-            SCMutexUnlock(&p->cuda_pkt_vars.cuda_mutex);
-            break;
-        } else {
-            SCCondWait(&p->cuda_pkt_vars.cuda_cond, &p->cuda_pkt_vars.cuda_mutex);
-            SCMutexUnlock(&p->cuda_pkt_vars.cuda_mutex);
-        }
-    } /* while */
-    p->cuda_pkt_vars.cuda_done = 0;
-    p->cuda_pkt_vars.cuda_mpm_enabled = 0;
-
-    uint32_t cuda_matches = p->cuda_pkt_vars.cuda_gpu_matches;
+    uint32_t cuda_matches = job->matches;
     if (cuda_matches == 0)
         return 0;
 
     uint32_t matches = 0;
-    uint32_t *results = p->cuda_pkt_vars.cuda_results + 1;
-    uint8_t *buf = p->payload;
-    SCACCtx *ctx = mpm_ctx->ctx;
+    const uint32_t *results = (const uint32_t *)job->results + 1;
+    const uint8_t *buf = job->buf;
+    SCACCtx *ctx = job->mpm_ctx->ctx;
     SCACOutputTable *output_table = ctx->output_table;
     SCACPatternList *pid_pat_list = ctx->pid_pat_list;
 
@@ -1621,7 +1788,7 @@ uint32_t SCACCudaPacketResultsProcessing(Packet *p, const MpmCtx *mpm_ctx,
     return matches;
 }
 
-void SCACCudaStartDispatcher(void)
+static void SCACCudaStartDispatcher(void)
 {
     /* create the threads */
     ThreadVars *tv = TmThreadCreate("Cuda_Mpm_AC_Dispatcher",
@@ -1749,6 +1916,145 @@ int MpmCudaBufferDeSetup(void)
     return 0;
 }
 
+/************************** Offload backend ****************************/
+
+static MpmCudaConf *cuda_offload_conf = NULL;
+static CudaBufferData *cuda_offload_cb = NULL;
+
+static int SCACCudaOffloadInit(ConfNode *conf)
+{
+    cuda_offload_conf = CudaHandlerGetCudaProfile("mpm");
+    cuda_offload_cb = CudaHandlerModuleGetData(MPM_AC_CUDA_MODULE_NAME,
+                                               MPM_AC_CUDA_MODULE_CUDA_BUFFER_NAME);
+    if (cuda_offload_conf == NULL || cuda_offload_cb == NULL) {
+        SCLogError(SC_ERR_AC_CUDA_ERROR, "the cuda mpm offload backend "
+                   "needs mpm-algo ac-cuda");
+        return -1;
+    }
+    return 0;
+}
+
+static void SCACCudaOffloadDeInit(void)
+{
+    /* the dispatcher is killed with the other threads, the buffers are
+     * released by MpmCudaBufferDeSetup() */
+    cuda_offload_conf = NULL;
+    cuda_offload_cb = NULL;
+}
+
+static void SCACCudaOffloadPrepareStart(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE)
+        return;
+
+    /* setting it to default.  You've gotta remove it once you fix the state table thing */
+    SCACConstructBoth16and32StateTables();
+
+    CUcontext cuda_context = CudaHandlerModuleGetContext(MPM_AC_CUDA_MODULE_NAME,
+                                                         cuda_offload_conf->device_id);
+    if (cuda_context == 0) {
+        SCLogError(SC_ERR_FATAL, "cuda context is NULL.");
+        exit(EXIT_FAILURE);
+    }
+    int r = SCCudaCtxPushCurrent(cuda_context);
+    if (r < 0) {
+        SCLogError(SC_ERR_FATAL, "context push failed.");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void SCACCudaOffloadPrepareEnd(DetectEngineCtx *de_ctx)
+{
+    if (de_ctx->sgh_mpm_context != ENGINE_SGH_MPM_FACTORY_CONTEXT_SINGLE)
+        return;
+
+    int r = SCCudaCtxPopCurrent(NULL);
+    if (r < 0) {
+        SCLogError(SC_ERR_FATAL, "cuda context pop failure.");
+        exit(EXIT_FAILURE);
+    }
+
+    DetermineCudaStateTableSize(de_ctx);
+}
+
+static int SCACCudaOffloadSupports(const MpmCtx *mpm_ctx)
+{
+    return (mpm_ctx->mpm_type == MPM_AC_CUDA);
+}
+
+/** \brief offload Submit(): copy the buffer into a slice of the cuda
+ *         buffer, the dispatcher picks it up with the next batch */
+static int SCACCudaOffloadSubmit(MpmOffloadJob *job)
+{
+    const MpmCudaConf *conf = cuda_offload_conf;
+
+    if ((conf->data_buffer_size_min_limit != 0 &&
+         job->len < conf->data_buffer_size_min_limit) ||
+        (conf->data_buffer_size_max_limit != 0 &&
+         job->len > conf->data_buffer_size_max_limit))
+        return -1;
+
+    /* the kernel writes a count and up to 2 words per byte */
+    uint32_t results_size = ((job->len * 2) + 1) * sizeof(uint32_t);
+    if (job->results_size < results_size) {
+        void *ptmp = SCRealloc(job->results, results_size);
+        if (ptmp == NULL)
+            return -1;
+        job->results = ptmp;
+        job->results_size = results_size;
+        job->ResultsFree = NULL;
+    }
+
+    SCACCtx *ctx = (SCACCtx *)job->mpm_ctx->ctx;
+#if __WORDSIZE==64
+    CudaBufferSlice *slice = CudaBufferGetSlice(cuda_offload_cb,
+                                                job->len + sizeof(uint64_t) + sizeof(CUdeviceptr),
+                                                (void *)job);
+    if (slice == NULL) {
+        SCLogError(SC_ERR_FATAL, "Error retrieving slice.  Please report "
+                   "this to dev.");
+        return -1;
+    }
+    *((uint64_t *)(slice->buffer + slice->start_offset)) = job->len;
+    *((CUdeviceptr *)(slice->buffer + slice->start_offset + sizeof(uint64_t))) = ctx->state_table_u32_cuda;
+    memcpy(slice->buffer + slice->start_offset + sizeof(uint64_t) + sizeof(CUdeviceptr), job->buf, job->len);
+#else
+    CudaBufferSlice *slice = CudaBufferGetSlice(cuda_offload_cb,
+                                                job->len + sizeof(uint32_t) + sizeof(CUdeviceptr),
+                                                (void *)job);
+    if (slice == NULL) {
+        SCLogError(SC_ERR_FATAL, "Error retrieving slice.  Please report "
+                   "this to dev.");
+        return -1;
+    }
+    *((uint32_t *)(slice->buffer + slice->start_offset)) = job->len;
+    *((CUdeviceptr *)(slice->buffer + slice->start_offset + sizeof(uint32_t))) = ctx->state_table_u32_cuda;
+    memcpy(slice->buffer + slice->start_offset + sizeof(uint32_t) + sizeof(CUdeviceptr), job->buf, job->len);
+#endif
+    SC_ATOMIC_SET(slice->done, 1);
+
+    SCLogDebug("cuda ac buffering job %p, len %"PRIu32" and deviceptr - %"PRIu64,
+               job, job->len, (unsigned long)ctx->state_table_u32_cuda);
+    return 0;
+}
+
+static const MpmOffloadBackend ac_cuda_offload = {
+    .name = "cuda",
+    .Init = SCACCudaOffloadInit,
+    .Start = SCACCudaStartDispatcher,
+    .DeInit = SCACCudaOffloadDeInit,
+    .PrepareStart = SCACCudaOffloadPrepareStart,
+    .PrepareEnd = SCACCudaOffloadPrepareEnd,
+    .Supports = SCACCudaOffloadSupports,
+    .Submit = SCACCudaOffloadSubmit,
+    .Collect = SCACCudaCollect,
+};
+
+void MpmACCudaOffloadRegister(void)
+{
+    MpmOffloadRegisterBackend(&ac_cuda_offload);
+}
+
 #endif /* __SC_CUDA_SUPPORT */
 
 /************************** Mpm Registration ***************************/
@@ -1771,6 +2077,7 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
+    mpm_table[MPM_AC].flags = MPM_FLAG_PREPARE_THREADSAFE;
 
     return;
 }
@@ -2827,6 +3134,97 @@ end:
     return result;
 }
 
+/** \internal
+ *  \brief prepare a ctx with a fixed pattern set and search it
+ *  \retval matched sids */
+static uint32_t SCACTest30Search(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"XYZ", 3, 0, 0, 1, 2, 0);
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"nomatch", 7, 0, 0, 2, 3, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    const char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    SCACSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf, strlen(buf));
+    uint32_t cnt = pmq.rule_id_array_cnt;
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/** \internal
+ *  \brief path of the only file in dir
+ *  \retval number of files */
+static int SCACTest30Files(const char *dir, char *path, size_t size)
+{
+    int cnt = 0;
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -1;
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, size, "%s/%s", dir, de->d_name);
+        cnt++;
+    }
+    closedir(d);
+    return cnt;
+}
+
+/** \test prepared ctx is stored in and loaded from the cache dir, a
+ *        damaged file is rebuilt */
+static int SCACTest30(void)
+{
+    char dir[] = "/tmp/suricata-mpm-cache-XXXXXX";
+    char path[PATH_MAX];
+    struct stat st;
+    FAIL_IF(mkdtemp(dir) == NULL);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("detect.mpm.cache-directory", dir);
+    MpmCacheDeinit();
+
+    /* first run builds and stores */
+    FAIL_IF(SCACTest30Search() != 3);
+    FAIL_IF(SCACTest30Files(dir, path, sizeof(path)) != 1);
+    FAIL_IF(stat(path, &st) != 0);
+    off_t size = st.st_size;
+
+    /* second run loads */
+    FAIL_IF(SCACTest30Search() != 3);
+    FAIL_IF(SCACTest30Files(dir, path, sizeof(path)) != 1);
+
+    /* truncated file is rejected, rebuilt and replaced */
+    FAIL_IF(truncate(path, size / 2) != 0);
+    FAIL_IF(SCACTest30Search() != 3);
+    FAIL_IF(stat(path, &st) != 0);
+    FAIL_IF(st.st_size != size);
+
+    unlink(path);
+    MpmCacheDeinit();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    rmdir(dir);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2862,6 +3260,7 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
 #endif
 
     return;
@@ -0,0 +1,278 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of prepared mpm ctxs.
+ *
+ * An mpm that supports the cache serializes its prepared tables into a
+ * MpmCacheBuffer after building them, and tries MpmCacheLoad() before
+ * building. Files are named after the ctx fingerprint, which covers all
+ * patterns, flags and sids added to the ctx, so a changed ruleset simply
+ * misses. The header repeats the key and carries a checksum of the
+ * payload; anything that doesn't match is rebuilt and overwritten.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-hash-lookup3.h"
+#include "util-mpm-cache.h"
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define MPM_CACHE_MAGIC     0x4d504d43  /* "MPMC" */
+
+typedef struct MpmCacheHeader_ {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t mpm_type;
+    uint64_t fingerprint;
+    uint32_t pattern_cnt;
+    uint32_t max_pat_id;
+    uint16_t minlen;
+    uint16_t maxlen;
+    uint16_t sid_size;
+    uint16_t pad;
+    uint32_t checksum;
+    uint32_t pad2;
+    uint64_t payload_len;
+} MpmCacheHeader;
+
+/** detect.mpm.cache-directory, NULL if the cache is disabled */
+static char *g_mpm_cache_dir = NULL;
+static int g_mpm_cache_init = 0;
+static SCMutex g_mpm_cache_lock = SCMUTEX_INITIALIZER;
+
+int MpmCacheBufferAppend(MpmCacheBuffer *b, const void *data, size_t len)
+{
+    if (b->len + len > b->size) {
+        size_t size = b->size ? b->size : 4096;
+        while (size < b->len + len)
+            size *= 2;
+        uint8_t *ptmp = SCRealloc(b->data, size);
+        if (ptmp == NULL)
+            return -1;
+        b->data = ptmp;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+void MpmCacheBufferFree(MpmCacheBuffer *b)
+{
+    if (b->data != NULL)
+        SCFree(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+/** \retval 0 ok
+ *  \retval -1 file is too short */
+int MpmCacheRead(MpmCacheReader *r, void *dst, size_t len)
+{
+    if (len > r->len - r->offset)
+        return -1;
+    memcpy(dst, r->data + r->offset, len);
+    r->offset += len;
+    return 0;
+}
+
+/** \brief check if the cache is enabled, reading the config on first use */
+int MpmCacheEnabled(void)
+{
+    SCMutexLock(&g_mpm_cache_lock);
+    if (!g_mpm_cache_init) {
+        g_mpm_cache_init = 1;
+
+        char *dir = NULL;
+        struct stat st;
+        if (ConfGet("detect.mpm.cache-directory", &dir) == 1 && dir != NULL &&
+            strlen(dir) > 0)
+        {
+            if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "detect.mpm.cache-directory "
+                        "\"%s\" is not a directory, disabling the cache", dir);
+            } else {
+                g_mpm_cache_dir = SCStrdup(dir);
+                if (g_mpm_cache_dir != NULL) {
+                    SCLogConfig("caching prepared pattern matchers in %s",
+                            g_mpm_cache_dir);
+                }
+            }
+        }
+    }
+    int enabled = (g_mpm_cache_dir != NULL);
+    SCMutexUnlock(&g_mpm_cache_lock);
+    return enabled;
+}
+
+static int MpmCachePath(const MpmCtx *mpm_ctx, char *path, size_t path_size)
+{
+    int r;
+    SCMutexLock(&g_mpm_cache_lock);
+    if (g_mpm_cache_dir == NULL) {
+        SCMutexUnlock(&g_mpm_cache_lock);
+        return -1;
+    }
+    r = snprintf(path, path_size, "%s/%016"PRIx64"-%u-%s.mpm",
+            g_mpm_cache_dir, mpm_ctx->fingerprint, mpm_ctx->pattern_cnt,
+            mpm_table[mpm_ctx->mpm_type].name);
+    SCMutexUnlock(&g_mpm_cache_lock);
+    if (r < 0 || (size_t)r >= path_size)
+        return -1;
+    return 0;
+}
+
+static void MpmCacheHeaderSet(const MpmCtx *mpm_ctx, MpmCacheHeader *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->magic = MPM_CACHE_MAGIC;
+    h->version = MPM_CACHE_VERSION;
+    h->mpm_type = mpm_ctx->mpm_type;
+    h->fingerprint = mpm_ctx->fingerprint;
+    h->pattern_cnt = mpm_ctx->pattern_cnt;
+    h->max_pat_id = mpm_ctx->max_pat_id;
+    h->minlen = mpm_ctx->minlen;
+    h->maxlen = mpm_ctx->maxlen;
+    h->sid_size = sizeof(SigIntId);
+}
+
+/**
+ *  \brief map the cache file of a ctx
+ *
+ *  \param r reader set to the payload on success, release with
+ *           MpmCacheClose()
+ *
+ *  \retval 0 found and valid
+ *  \retval -1 not cached or not usable
+ */
+int MpmCacheLoad(const MpmCtx *mpm_ctx, MpmCacheReader *r)
+{
+    char path[PATH_MAX];
+
+    memset(r, 0, sizeof(*r));
+    if (MpmCachePath(mpm_ctx, path, sizeof(path)) != 0)
+        return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MpmCacheHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    MpmCacheHeader expect, h;
+    MpmCacheHeaderSet(mpm_ctx, &expect);
+    memcpy(&h, map, sizeof(h));
+    const uint8_t *payload = (const uint8_t *)map + sizeof(h);
+
+    expect.payload_len = h.payload_len;
+    expect.checksum = h.checksum;
+    if (memcmp(&h, &expect, sizeof(h)) != 0 ||
+        h.payload_len != (uint64_t)st.st_size - sizeof(h) ||
+        hashlittle(payload, (size_t)h.payload_len, 0) != h.checksum)
+    {
+        SCLogDebug("cache file %s doesn't match the ctx", path);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    r->map = map;
+    r->map_len = (size_t)st.st_size;
+    r->data = payload;
+    r->len = (size_t)h.payload_len;
+    SCLogDebug("loading mpm ctx with %u patterns from %s",
+            mpm_ctx->pattern_cnt, path);
+    return 0;
+}
+
+void MpmCacheClose(MpmCacheReader *r)
+{
+    if (r->map != NULL)
+        munmap(r->map, r->map_len);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ *  \brief write the serialized ctx to its cache file
+ *
+ *  Written to a temp file that is then renamed, so that a concurrent or
+ *  interrupted run never sees a partial file.
+ */
+void MpmCacheStore(const MpmCtx *mpm_ctx, const MpmCacheBuffer *b)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+
+    if (MpmCachePath(mpm_ctx, path, sizeof(path)) != 0)
+        return;
+    int r = snprintf(tmp, sizeof(tmp), "%s.%d.%p.tmp", path, (int)getpid(),
+            (void *)mpm_ctx);
+    if (r < 0 || (size_t)r >= sizeof(tmp))
+        return;
+
+    MpmCacheHeader h;
+    MpmCacheHeaderSet(mpm_ctx, &h);
+    h.payload_len = b->len;
+    h.checksum = hashlittle(b->data, b->len, 0);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open %s: %s", tmp,
+                strerror(errno));
+        return;
+    }
+
+    int ok = (fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              (b->len == 0 || fwrite(b->data, b->len, 1, fp) == 1));
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    if (!ok || rename(tmp, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write %s: %s", path,
+                strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    SCLogDebug("stored mpm ctx with %u patterns in %s", mpm_ctx->pattern_cnt,
+            path);
+}
+
+/** \brief forget the config, it's read again on the next use */
+void MpmCacheDeinit(void)
+{
+    SCMutexLock(&g_mpm_cache_lock);
+    if (g_mpm_cache_dir != NULL) {
+        SCFree(g_mpm_cache_dir);
+        g_mpm_cache_dir = NULL;
+    }
+    g_mpm_cache_init = 0;
+    SCMutexUnlock(&g_mpm_cache_lock);
+}
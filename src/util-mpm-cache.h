@@ -0,0 +1,59 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * On disk cache of prepared mpm ctxs, keyed by the ctx fingerprint.
+ */
+
+#ifndef __UTIL_MPM_CACHE_H__
+#define __UTIL_MPM_CACHE_H__
+
+#include "util-mpm.h"
+
+/** bump when the layout written by any of the mpms changes */
+#define MPM_CACHE_VERSION   1
+
+/** growable buffer an mpm serializes its prepared ctx into */
+typedef struct MpmCacheBuffer_ {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} MpmCacheBuffer;
+
+/** payload of a cache file, memory mapped */
+typedef struct MpmCacheReader_ {
+    const uint8_t *data;
+    size_t len;
+    size_t offset;
+
+    void *map;
+    size_t map_len;
+} MpmCacheReader;
+
+int MpmCacheBufferAppend(MpmCacheBuffer *b, const void *data, size_t len);
+void MpmCacheBufferFree(MpmCacheBuffer *b);
+int MpmCacheRead(MpmCacheReader *r, void *dst, size_t len);
+
+int MpmCacheEnabled(void);
+int MpmCacheLoad(const MpmCtx *mpm_ctx, MpmCacheReader *r);
+void MpmCacheClose(MpmCacheReader *r);
+void MpmCacheStore(const MpmCtx *mpm_ctx, const MpmCacheBuffer *b);
+void MpmCacheDeinit(void);
+
+#endif /* __UTIL_MPM_CACHE_H__ */
@@ -41,11 +41,20 @@
 #include "util-hash.h"
 #include "util-hash-lookup3.h"
 #include "util-hyperscan.h"
+#include "util-misc.h"
+#include "util-atomic.h"
 
 #ifdef BUILD_HYPERSCAN
 
 #include <hs.h>
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef UNITTESTS
+#include <dirent.h>
+#endif
+
 void SCHSInitCtx(MpmCtx *);
 void SCHSInitThreadCtx(MpmCtx *, MpmThreadCtx *);
 void SCHSDestroyCtx(MpmCtx *);
@@ -57,6 +66,13 @@ int SCHSAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCHSPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PatternMatcherQueue *pmq, const uint8_t *buf, const uint16_t buflen);
+uint32_t SCHSSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, void **state, uint32_t seq,
+                          const uint8_t *buf, uint32_t buflen);
+void SCHSStreamStateFree(void *ptr);
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, const uint8_t **bufs,
+                          const uint32_t *lens, uint32_t cnt);
 void SCHSPrintInfo(MpmCtx *mpm_ctx);
 void SCHSPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCHSRegisterTests(void);
@@ -78,6 +94,29 @@ static SCMutex g_scratch_proto_mutex = SCMUTEX_INITIALIZER;
 static HashTable *g_db_table = NULL;
 static SCMutex g_db_table_mutex = SCMUTEX_INITIALIZER;
 
+/**
+ * \internal
+ * Directory compiled databases are stored in and loaded from, NULL if the
+ * on disk cache is disabled. Set up under g_db_table_mutex, read only
+ * afterwards.
+ */
+static char *g_db_cache_dir = NULL;
+static int g_db_cache_init = 0;
+
+/* Unique id handed to each built database, so that a stream state can tell
+ * whether it was opened on the database it's used with. Protected by
+ * g_db_table_mutex. */
+static uint32_t g_db_id = 0;
+
+/** default for hyperscan.stream-memcap */
+#define SCHS_STREAM_MEMCAP_DEFAULT  (64 * 1024 * 1024)
+
+/* memory used by stream mode state and the cap on it. A stream that can't
+ * get state falls back to block mode scanning. */
+static uint64_t g_stream_memcap = SCHS_STREAM_MEMCAP_DEFAULT;
+SC_ATOMIC_DECLARE(uint64_t, g_stream_memuse);
+SC_ATOMIC_DECLARE(uint64_t, g_stream_memcap_cnt);
+
 /**
  * \internal
  * \brief Wraps SCMalloc (which is a macro) so that it can be passed to
@@ -279,6 +318,9 @@ static int SCHSAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
     if (depth != 0) {
         flags |= MPM_PATTERN_FLAG_DEPTH;
     }
+    if (offset != 0 || depth != 0) {
+        mpm_ctx->flags |= MPMCTX_FLAGS_BOUNDED;
+    }
 
     if (patlen == 0) {
         SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "pattern length 0");
@@ -442,6 +484,19 @@ typedef struct PatternDatabase_ {
     hs_database_t *hs_db;
     uint32_t pattern_cnt;
 
+    /* stream mode database, only built for MPMCTX_FLAGS_STREAM ctxs */
+    hs_database_t *hs_stream_db;
+    /* size of a stream opened on hs_stream_db */
+    size_t hs_stream_size;
+    int stream;
+
+    /* vectored mode database, only built for MPMCTX_FLAGS_VECTOR ctxs */
+    hs_database_t *hs_vector_db;
+    int vector;
+
+    /* unique id, set when built */
+    uint32_t id;
+
     /* Reference count: number of MPM contexts using this pattern database. */
     uint32_t ref_cnt;
 } PatternDatabase;
@@ -491,6 +546,8 @@ static uint32_t PatternDatabaseHash(HashTable *ht, void *data, uint16_t len)
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
         hash = SCHSPatternHash(pd->parray[i], hash);
     }
+    hash += pd->stream;
+    hash += pd->vector << 1;
 
     hash %= ht->array_size;
     return hash;
@@ -502,7 +559,8 @@ static char PatternDatabaseCompare(void *data1, uint16_t len1, void *data2,
     const PatternDatabase *pd1 = data1;
     const PatternDatabase *pd2 = data2;
 
-    if (pd1->pattern_cnt != pd2->pattern_cnt) {
+    if (pd1->pattern_cnt != pd2->pattern_cnt || pd1->stream != pd2->stream ||
+        pd1->vector != pd2->vector) {
         return 0;
     }
 
@@ -532,6 +590,8 @@ static void PatternDatabaseFree(PatternDatabase *pd)
     }
 
     hs_free_database(pd->hs_db);
+    hs_free_database(pd->hs_stream_db);
+    hs_free_database(pd->hs_vector_db);
 
     SCFree(pd);
 }
@@ -565,6 +625,268 @@ static PatternDatabase *PatternDatabaseAlloc(uint32_t pattern_cnt)
     return pd;
 }
 
+/**
+ * \internal
+ * \brief Get the cache directory from the config on first use.
+ *
+ * Called with g_db_table_mutex held.
+ */
+static void PatternDatabaseCacheInit(void)
+{
+    if (g_db_cache_init)
+        return;
+    g_db_cache_init = 1;
+
+    char *dir = NULL;
+    if (ConfGet("hyperscan.cache-directory", &dir) != 1 || dir == NULL ||
+            strlen(dir) == 0) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hyperscan.cache-directory "
+                "\"%s\" is not a directory, disabling the cache", dir);
+        return;
+    }
+
+    g_db_cache_dir = SCStrdup(dir);
+    if (g_db_cache_dir != NULL) {
+        SCLogConfig("hyperscan: caching compiled databases in %s",
+                g_db_cache_dir);
+    }
+}
+
+/**
+ * \internal
+ * \brief Get the stream state memcap from the config on first use.
+ *
+ * Called with g_db_table_mutex held.
+ */
+static void SCHSStreamConfigInit(void)
+{
+    static int done = 0;
+    if (done)
+        return;
+    done = 1;
+
+    char *str = NULL;
+    if (ConfGet("hyperscan.stream-memcap", &str) == 1 && str != NULL) {
+        uint64_t memcap = 0;
+        if (ParseSizeStringU64(str, &memcap) < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hyperscan.stream-memcap "
+                    "\"%s\" is invalid, using the default", str);
+        } else {
+            g_stream_memcap = memcap;
+        }
+    }
+    SCLogConfig("hyperscan: stream state memcap %"PRIu64, g_stream_memcap);
+}
+
+/**
+ * \internal
+ * \brief Compile the stream or vectored mode database of a pattern database.
+ *
+ * Offset and depth are left out: in these modes they would be relative to
+ * the start of the stream or of the first buffer, not to the start of the
+ * inspected buffer. As these are prefilter matches, a superset is fine.
+ * In stream mode every match is reported, not just the first, so that the
+ * position of the last one is known.
+ */
+static int PatternDatabaseCompileMode(PatternDatabase *pd, unsigned int mode,
+                                      hs_database_t **db)
+{
+    hs_compile_error_t *compile_err = NULL;
+    SCHSCompileData *cd = SCHSAllocCompileData(pd->pattern_cnt);
+    if (cd == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        const SCHSPattern *p = pd->parray[i];
+
+        cd->ids[i] = i;
+        if (mode == HS_MODE_VECTORED) {
+            cd->flags[i] = HS_FLAG_SINGLEMATCH;
+        }
+        if (p->flags & MPM_PATTERN_FLAG_NOCASE) {
+            cd->flags[i] |= HS_FLAG_CASELESS;
+        }
+        cd->expressions[i] = HSRenderPattern(p->original_pat, p->len);
+    }
+
+    hs_error_t err = hs_compile_ext_multi((const char *const *)cd->expressions,
+            cd->flags, cd->ids, NULL, cd->pattern_cnt, mode, NULL,
+            db, &compile_err);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan %s database",
+                mode == HS_MODE_STREAM ? "stream" : "vectored");
+        if (compile_err) {
+            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        }
+        hs_free_compile_error(compile_err);
+        SCHSFreeCompileData(cd);
+        return -1;
+    }
+    SCHSFreeCompileData(cd);
+    return 0;
+}
+
+static int PatternDatabaseCompileStream(PatternDatabase *pd)
+{
+    if (PatternDatabaseCompileMode(pd, HS_MODE_STREAM, &pd->hs_stream_db) != 0)
+        return -1;
+
+    hs_error_t err = hs_stream_size(pd->hs_stream_db, &pd->hs_stream_size);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "failed to query stream size");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Build the cache file name for a pattern database.
+ *
+ * The name is derived from two independent hashes of the full pattern set
+ * (patterns, flags, offsets, depths and sids) and the pattern count. The
+ * Hyperscan version and platform are part of the serialized data and are
+ * checked on load.
+ */
+static int PatternDatabaseCachePath(const PatternDatabase *pd, char *path,
+                                    size_t path_size)
+{
+    uint32_t h1 = hashword(&pd->pattern_cnt, 1, 0);
+    uint32_t h2 = hashword(&pd->pattern_cnt, 1, 0x9e3779b9);
+
+    for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
+        h1 = SCHSPatternHash(pd->parray[i], h1);
+        h2 = SCHSPatternHash(pd->parray[i], h2);
+    }
+
+    int r = snprintf(path, path_size, "%s/%08x%08x-%u.hs", g_db_cache_dir,
+                     h1, h2, pd->pattern_cnt);
+    if (r < 0 || (size_t)r >= path_size)
+        return -1;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Load a compiled database from the cache.
+ *
+ * The file is memory mapped and deserialized into pd->hs_db.
+ *
+ * \retval 0 loaded
+ * \retval -1 not in the cache or not usable
+ */
+static int PatternDatabaseCacheLoad(PatternDatabase *pd, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hs_error_t err = hs_deserialize_database((const char *)map,
+                                             (size_t)st.st_size, &pd->hs_db);
+    munmap(map, (size_t)st.st_size);
+
+    if (err != HS_SUCCESS) {
+        /* e.g. built by another Hyperscan version, will be replaced */
+        SCLogDebug("cache file %s not usable: %d", path, err);
+        pd->hs_db = NULL;
+        return -1;
+    }
+
+    SCLogDebug("loaded database for %u patterns from %s", pd->pattern_cnt,
+               path);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Store a compiled database in the cache.
+ *
+ * Written to a temp file that is then renamed, so that a concurrent or
+ * interrupted run never sees a partial file.
+ */
+static void PatternDatabaseCacheStore(const PatternDatabase *pd,
+                                      const char *path)
+{
+    char *bytes = NULL;
+    size_t len = 0;
+
+    if (hs_serialize_database(pd->hs_db, &bytes, &len) != HS_SUCCESS) {
+        SCLogDebug("failed to serialize database");
+        return;
+    }
+
+    char tmp[PATH_MAX];
+    int r = snprintf(tmp, sizeof(tmp), "%s.%d.%lu.tmp", path, (int)getpid(),
+                     (unsigned long)SCGetThreadIdLong());
+    if (r < 0 || (size_t)r >= sizeof(tmp)) {
+        SCHSFree(bytes);
+        return;
+    }
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open %s: %s", tmp,
+                     strerror(errno));
+        SCHSFree(bytes);
+        return;
+    }
+
+    size_t written = fwrite(bytes, 1, len, fp);
+    int close_r = fclose(fp);
+    SCHSFree(bytes);
+
+    if (written != len || close_r != 0 || rename(tmp, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write %s: %s", path,
+                     strerror(errno));
+        unlink(tmp);
+        return;
+    }
+
+    SCLogDebug("stored database for %u patterns in %s", pd->pattern_cnt,
+               path);
+}
+
+/**
+ * \internal
+ * \brief Use an already built database with the same patterns as pd.
+ *
+ * On success pd is freed. Must be called with g_db_table_mutex held.
+ *
+ * \retval 1 existing database is used
+ * \retval 0 pd is not in the table yet
+ */
+static int PatternDatabaseReuse(SCHSCtx *ctx, PatternDatabase *pd)
+{
+    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached == NULL)
+        return 0;
+
+    SCLogDebug("Reusing cached database %p with %" PRIu32
+               " patterns (ref_cnt=%" PRIu32 ")",
+               pd_cached->hs_db, pd_cached->pattern_cnt,
+               pd_cached->ref_cnt);
+    pd_cached->ref_cnt++;
+    ctx->pattern_db = pd_cached;
+    PatternDatabaseFree(pd);
+    return 1;
+}
+
 /**
  * \brief Process the patterns added to the mpm, and create the internal tables.
  *
@@ -593,6 +915,8 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     if (pd == NULL) {
         goto error;
     }
+    pd->stream = (mpm_ctx->flags & MPMCTX_FLAGS_STREAM) ? 1 : 0;
+    pd->vector = (mpm_ctx->flags & MPMCTX_FLAGS_VECTOR) ? 1 : 0;
 
     /* populate the pattern array with the patterns in the hash */
     for (uint32_t i = 0, p = 0; i < INIT_HASH_SIZE; i++) {
@@ -609,8 +933,8 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* The table lookup and insertion are serialised, the compile itself
+     * runs unlocked so that several contexts can be built in parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -626,23 +950,28 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
 
     /* Check global hash table to see if we've seen this pattern database
      * before, and reuse the Hyperscan database if so. */
-    PatternDatabase *pd_cached = HashTableLookup(g_db_table, pd, 1);
-
-    if (pd_cached != NULL) {
-        SCLogDebug("Reusing cached database %p with %" PRIu32
-                   " patterns (ref_cnt=%" PRIu32 ")",
-                   pd_cached->hs_db, pd_cached->pattern_cnt,
-                   pd_cached->ref_cnt);
-        pd_cached->ref_cnt++;
-        ctx->pattern_db = pd_cached;
+    if (PatternDatabaseReuse(ctx, pd) == 1) {
         SCMutexUnlock(&g_db_table_mutex);
-        PatternDatabaseFree(pd);
         SCHSFreeCompileData(cd);
         return 0;
     }
 
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
 
+    PatternDatabaseCacheInit();
+    SCHSStreamConfigInit();
+    SCMutexUnlock(&g_db_table_mutex);
+
+    /* Check the on disk cache before compiling. */
+    char cache_path[PATH_MAX] = "";
+    if (g_db_cache_dir != NULL) {
+        if (PatternDatabaseCachePath(pd, cache_path, sizeof(cache_path)) != 0) {
+            cache_path[0] = '\0';
+        } else if (PatternDatabaseCacheLoad(pd, cache_path) == 0) {
+            goto built;
+        }
+    }
+
     for (uint32_t i = 0; i < pd->pattern_cnt; i++) {
         const SCHSPattern *p = pd->parray[i];
 
@@ -688,22 +1017,80 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         goto error;
     }
 
+    if (cache_path[0] != '\0') {
+        PatternDatabaseCacheStore(pd, cache_path);
+    }
+
+built:
+    if (pd->stream && PatternDatabaseCompileStream(pd) != 0) {
+        goto error;
+    }
+    if (pd->vector && PatternDatabaseCompileMode(pd, HS_MODE_VECTORED,
+                &pd->hs_vector_db) != 0) {
+        goto error;
+    }
+
+    SCMutexLock(&g_db_table_mutex);
+
+    /* Another thread may have built the same database while we were
+     * compiling, in which case ours is dropped in favour of it. */
+    if (PatternDatabaseReuse(ctx, pd) == 1) {
+        SCMutexUnlock(&g_db_table_mutex);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
+
     ctx->pattern_db = pd;
+    pd->id = ++g_db_id;
 
     SCMutexLock(&g_scratch_proto_mutex);
     err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
+    if (err == HS_SUCCESS && pd->hs_stream_db != NULL) {
+        err = hs_alloc_scratch(pd->hs_stream_db, &g_scratch_proto);
+    }
+    if (err == HS_SUCCESS && pd->hs_vector_db != NULL) {
+        err = hs_alloc_scratch(pd->hs_vector_db, &g_scratch_proto);
+    }
     SCMutexUnlock(&g_scratch_proto_mutex);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to allocate scratch");
+        ctx->pattern_db = NULL;
+        SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
     err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to query database size");
+        ctx->pattern_db = NULL;
+        SCMutexUnlock(&g_db_table_mutex);
         goto error;
     }
 
+    if (pd->hs_stream_db != NULL) {
+        size_t stream_db_size = 0;
+        err = hs_database_size(pd->hs_stream_db, &stream_db_size);
+        if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "failed to query database size");
+            ctx->pattern_db = NULL;
+            SCMutexUnlock(&g_db_table_mutex);
+            goto error;
+        }
+        ctx->hs_db_size += stream_db_size;
+    }
+
+    if (pd->hs_vector_db != NULL) {
+        size_t vector_db_size = 0;
+        err = hs_database_size(pd->hs_vector_db, &vector_db_size);
+        if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "failed to query database size");
+            ctx->pattern_db = NULL;
+            SCMutexUnlock(&g_db_table_mutex);
+            goto error;
+        }
+        ctx->hs_db_size += vector_db_size;
+    }
+
     mpm_ctx->memory_cnt++;
     mpm_ctx->memory_size += ctx->hs_db_size;
 
@@ -719,7 +1106,6 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     return 0;
 
 error:
-    SCMutexUnlock(&g_db_table_mutex);
     if (pd) {
         PatternDatabaseFree(pd);
     }
@@ -945,6 +1331,282 @@ uint32_t SCHSSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return ret;
 }
 
+/**
+ * \brief The Hyperscan vectored search function.
+ *
+ * The buffers are scanned as one block of the vectored database, so the
+ * scratch is set up once for all of them. Without a vectored database,
+ * i.e. for ctxs not flagged MPMCTX_FLAGS_VECTOR, each buffer is searched
+ * on its own.
+ *
+ * \param bufs Buffers to be searched.
+ * \param lens Buffer lengths.
+ * \param cnt  Number of buffers.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, const uint8_t **bufs,
+                          const uint32_t *lens, uint32_t cnt)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+    const PatternDatabase *pd = ctx->pattern_db;
+
+    if (unlikely(cnt == 0)) {
+        return 0;
+    }
+
+    if (pd->hs_vector_db == NULL) {
+        uint32_t ret = 0;
+        for (uint32_t i = 0; i < cnt; i++) {
+            if (lens[i] >= mpm_ctx->minlen)
+                ret += SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, bufs[i],
+                                  (uint16_t)MIN(lens[i], UINT16_MAX));
+        }
+        return ret;
+    }
+
+    SCHSCallbackCtx cctx = {.ctx = ctx, .pmq = pmq, .match_count = 0};
+
+    hs_scratch_t *scratch = hs_thread_ctx->scratch;
+    BUG_ON(scratch == NULL);
+
+    hs_error_t err = hs_scan_vector(pd->hs_vector_db, (const char * const *)bufs,
+                                    (const unsigned int *)lens, cnt, 0,
+                                    scratch, SCHSMatchEvent, &cctx);
+    if (err != HS_SUCCESS) {
+        SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+        exit(EXIT_FAILURE);
+    }
+
+    return cctx.match_count;
+}
+
+/** max number of patterns a stream state tracks matches of. If more
+ *  distinct patterns match inside one buffer the stream is reset. */
+#define SCHS_STREAM_MAX_MATCHES 64
+
+#define SCHS_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+#define SCHS_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+
+typedef struct SCHSStreamMatch_ {
+    uint32_t pat;       /**< index into the database's parray */
+    uint32_t end_seq;   /**< seq following the last match of the pattern */
+} SCHSStreamMatch;
+
+typedef struct SCHSStreamState_ {
+    uint16_t mpm_type;  /**< MpmStreamState header */
+    uint16_t match_cnt;
+    int valid;          /**< hs stream is in sync with next_seq */
+
+    uint32_t db_id;     /**< id of the database the stream was opened on */
+    hs_stream_t *hs;
+    size_t mem;         /**< memory accounted to g_stream_memuse */
+
+    uint32_t base_seq;  /**< seq of stream offset 0 */
+    uint32_t next_seq;  /**< seq of the next byte to scan */
+    uint32_t track_seq; /**< matches are known from this seq on */
+
+    SCHSStreamMatch matches[SCHS_STREAM_MAX_MATCHES];
+} SCHSStreamState;
+
+typedef struct SCHSStreamCallbackCtx_ {
+    SCHSStreamState *st;
+    int overflow;
+} SCHSStreamCallbackCtx;
+
+/* Hyperscan stream mode match event handler: remember where the last match
+ * of each pattern ended */
+static int SCHSStreamMatchEvent(unsigned int id, unsigned long long from,
+                                unsigned long long to, unsigned int flags,
+                                void *ctx)
+{
+    SCHSStreamCallbackCtx *cctx = ctx;
+    SCHSStreamState *st = cctx->st;
+    const uint32_t end_seq = st->base_seq + (uint32_t)to;
+
+    for (uint16_t i = 0; i < st->match_cnt; i++) {
+        if (st->matches[i].pat == id) {
+            st->matches[i].end_seq = end_seq;
+            return 0;
+        }
+    }
+    if (st->match_cnt == SCHS_STREAM_MAX_MATCHES) {
+        cctx->overflow = 1;
+        return 1; /* stop scanning */
+    }
+    st->matches[st->match_cnt].pat = id;
+    st->matches[st->match_cnt].end_seq = end_seq;
+    st->match_cnt++;
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief (Re)open the hs stream of a state on a database.
+ *
+ * \retval 0 ok
+ * \retval -1 over the memcap or out of memory, state has no stream
+ */
+static int SCHSStreamOpen(SCHSStreamState *st, const PatternDatabase *pd)
+{
+    if (st->hs != NULL) {
+        hs_close_stream(st->hs, NULL, NULL, NULL);
+        st->hs = NULL;
+    }
+    (void)SC_ATOMIC_SUB(g_stream_memuse, st->mem);
+    st->mem = sizeof(*st);
+
+    if (SC_ATOMIC_GET(g_stream_memuse) + st->mem + pd->hs_stream_size >
+            g_stream_memcap) {
+        SC_ATOMIC_ADD(g_stream_memcap_cnt, 1);
+        SC_ATOMIC_ADD(g_stream_memuse, st->mem);
+        return -1;
+    }
+    if (hs_open_stream(pd->hs_stream_db, 0, &st->hs) != HS_SUCCESS) {
+        st->hs = NULL;
+        SC_ATOMIC_ADD(g_stream_memuse, st->mem);
+        return -1;
+    }
+    st->mem += pd->hs_stream_size;
+    SC_ATOMIC_ADD(g_stream_memuse, st->mem);
+
+    st->db_id = pd->id;
+    st->valid = 0;
+    return 0;
+}
+
+/**
+ * \brief The Hyperscan stream mode search function.
+ *
+ * Bytes of the buffer that were scanned in earlier calls are not scanned
+ * again, only the data following them. The hs stream carries the partial
+ * matches, so patterns straddling the old end are found. The state keeps
+ * the end of the last match of each pattern, so that the sids of patterns
+ * matching in the already scanned part of the buffer are still added.
+ *
+ * A buffer that doesn't continue the data seen so far (a gap, or data
+ * before what's tracked) resets the stream. If no stream state can be had,
+ * the buffer is scanned in block mode.
+ *
+ * \param state  Stream state, allocated on first use.
+ * \param seq    Sequence number of the first byte in buf.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCHSSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                          PatternMatcherQueue *pmq, void **state, uint32_t seq,
+                          const uint8_t *buf, uint32_t buflen)
+{
+    SCHSCtx *ctx = (SCHSCtx *)mpm_ctx->ctx;
+    SCHSThreadCtx *hs_thread_ctx = (SCHSThreadCtx *)(mpm_thread_ctx->ctx);
+    const PatternDatabase *pd = ctx->pattern_db;
+    SCHSStreamState *st = *state;
+    uint32_t ret = 0;
+
+    if (unlikely(buflen == 0)) {
+        return 0;
+    }
+    if (pd->hs_stream_db == NULL) {
+        return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+    }
+
+    if (st == NULL) {
+        if (SC_ATOMIC_GET(g_stream_memuse) + sizeof(*st) > g_stream_memcap) {
+            SC_ATOMIC_ADD(g_stream_memcap_cnt, 1);
+            return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+        }
+        st = SCMalloc(sizeof(*st));
+        if (unlikely(st == NULL)) {
+            return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+        }
+        memset(st, 0, sizeof(*st));
+        st->mpm_type = MPM_HS;
+        st->mem = sizeof(*st);
+        SC_ATOMIC_ADD(g_stream_memuse, st->mem);
+        *state = st;
+    }
+
+    if (st->hs == NULL || st->db_id != pd->id) {
+        if (SCHSStreamOpen(st, pd) != 0) {
+            return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+        }
+    }
+
+    const uint32_t end_seq = seq + buflen;
+    if (!st->valid || !SCHS_SEQ_GEQ(seq, st->track_seq) ||
+        !SCHS_SEQ_GEQ(st->next_seq, seq) ||
+        !SCHS_SEQ_LEQ(st->next_seq, end_seq))
+    {
+        if (hs_reset_stream(st->hs, 0, NULL, NULL, NULL) != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "Hyperscan stream reset failed");
+            exit(EXIT_FAILURE);
+        }
+        st->match_cnt = 0;
+        st->base_seq = st->next_seq = st->track_seq = seq;
+        st->valid = 1;
+    }
+
+    /* data before this buffer won't be inspected again, so forget the
+     * patterns that were last seen there */
+    uint16_t keep = 0;
+    for (uint16_t i = 0; i < st->match_cnt; i++) {
+        const SCHSPattern *pat = pd->parray[st->matches[i].pat];
+        if (SCHS_SEQ_GEQ(st->matches[i].end_seq - pat->len, seq)) {
+            st->matches[keep++] = st->matches[i];
+        }
+    }
+    st->match_cnt = keep;
+    st->track_seq = seq;
+
+    if (st->next_seq != end_seq) {
+        SCHSStreamCallbackCtx cctx = { .st = st, .overflow = 0 };
+        const uint32_t skip = st->next_seq - seq;
+
+        BUG_ON(hs_thread_ctx->scratch == NULL);
+        hs_error_t err = hs_scan_stream(st->hs, (const char *)buf + skip,
+                                        buflen - skip, 0,
+                                        hs_thread_ctx->scratch,
+                                        SCHSStreamMatchEvent, &cctx);
+        if (cctx.overflow) {
+            /* too many patterns to track: scan this one in block mode, the
+             * stream restarts on the next buffer */
+            st->valid = 0;
+            return SCHSSearch(mpm_ctx, mpm_thread_ctx, pmq, buf, buflen);
+        } else if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "Hyperscan returned error %d", err);
+            exit(EXIT_FAILURE);
+        }
+        st->next_seq = end_seq;
+    }
+
+    /* what's left all lies inside the buffer */
+    for (uint16_t i = 0; i < st->match_cnt; i++) {
+        const SCHSPattern *pat = pd->parray[st->matches[i].pat];
+        MpmAddSids(pmq, pat->sids, pat->sids_size);
+        ret++;
+    }
+    return ret;
+}
+
+/**
+ * \brief Free a stream state created by SCHSSearchStream.
+ */
+void SCHSStreamStateFree(void *ptr)
+{
+    SCHSStreamState *st = ptr;
+    if (st == NULL)
+        return;
+
+    if (st->hs != NULL) {
+        /* no callback, so no scratch needed and no matches reported */
+        hs_close_stream(st->hs, NULL, NULL, NULL);
+    }
+    (void)SC_ATOMIC_SUB(g_stream_memuse, st->mem);
+    SCFree(st);
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1046,9 +1708,16 @@ void MpmHSRegister(void)
     mpm_table[MPM_HS].Prepare = SCHSPreparePatterns;
     mpm_table[MPM_HS].Search = SCHSSearch;
     mpm_table[MPM_HS].Cleanup = NULL;
+    mpm_table[MPM_HS].SearchStream = SCHSSearchStream;
+    mpm_table[MPM_HS].StreamStateFree = SCHSStreamStateFree;
+    mpm_table[MPM_HS].SearchVector = SCHSSearchVector;
     mpm_table[MPM_HS].PrintCtx = SCHSPrintInfo;
     mpm_table[MPM_HS].PrintThreadCtx = SCHSPrintSearchStats;
     mpm_table[MPM_HS].RegisterUnittests = SCHSRegisterTests;
+    mpm_table[MPM_HS].flags = MPM_FLAG_PREPARE_THREADSAFE;
+
+    SC_ATOMIC_INIT(g_stream_memuse);
+    SC_ATOMIC_INIT(g_stream_memcap_cnt);
 
     /* Set Hyperscan memory allocators */
     SCHSSetAllocators();
@@ -1075,7 +1744,18 @@ void MpmHSGlobalCleanup(void)
         HashTableFree(g_db_table);
         g_db_table = NULL;
     }
+    if (g_db_cache_dir != NULL) {
+        SCFree(g_db_cache_dir);
+        g_db_cache_dir = NULL;
+    }
+    g_db_cache_init = 0;
     SCMutexUnlock(&g_db_table_mutex);
+
+    if (SC_ATOMIC_GET(g_stream_memcap_cnt) > 0) {
+        SCLogPerf("hyperscan: %"PRIu64" times a stream fell back to block "
+                "mode as hyperscan.stream-memcap was reached",
+                SC_ATOMIC_GET(g_stream_memcap_cnt));
+    }
 }
 
 /*************************************Unittests********************************/
@@ -2130,6 +2810,141 @@ end:
     return result;
 }
 
+/** \internal
+ *  \brief prepare a ctx with a fixed pattern set and search it */
+static int SCHSTest30Search(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"XYZ", 3, 0, 0, 1, 0, 0);
+    PmqSetup(&pmq);
+
+    SCHSPreparePatterns(&mpm_ctx);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t cnt = SCHSSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, (uint8_t *)buf,
+                              strlen(buf));
+
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return (int)cnt;
+}
+
+/** \internal
+ *  \brief count the cache files in dir, removing them if 'unlink_files' */
+static int SCHSTest30CountFiles(const char *dir, int unlink_files)
+{
+    int cnt = 0;
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -1;
+
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        cnt++;
+        if (unlink_files) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+    return cnt;
+}
+
+/** \test compiled database is stored in and loaded from the cache dir */
+static int SCHSTest30(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    FAIL_IF(mkdtemp(dir) == NULL);
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("hyperscan.cache-directory", dir);
+    MpmHSGlobalCleanup();
+
+    /* first run compiles and stores */
+    FAIL_IF(SCHSTest30Search() != 2);
+    FAIL_IF(SCHSTest30CountFiles(dir, 0) != 1);
+
+    /* forget the in memory cache, second run loads from disk */
+    MpmHSGlobalCleanup();
+    FAIL_IF(SCHSTest30Search() != 2);
+    FAIL_IF(SCHSTest30CountFiles(dir, 1) != 1);
+
+    MpmHSGlobalCleanup();
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    rmdir(dir);
+    PASS;
+}
+
+/** \test stream mode: straddling match, matches in already scanned data
+ *        are reported while inside the buffer, gap resets */
+static int SCHSTest31(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    void *state = NULL;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_HS);
+    mpm_ctx.flags |= MPMCTX_FLAGS_STREAM;
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    FAIL_IF(SCHSPreparePatterns(&mpm_ctx) != 0);
+    SCHSInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* window grows: "ab" then "abcd" straddling the old end */
+    const char *buf1 = "xxxxab";
+    const char *buf2 = "xxxxabcdyy";
+    FAIL_IF(SCHSSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &state, 100,
+                (uint8_t *)buf1, strlen(buf1)) != 0);
+    FAIL_IF(state == NULL);
+    FAIL_IF(SCHSSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &state, 100,
+                (uint8_t *)buf2, strlen(buf2)) != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    PmqReset(&pmq);
+
+    /* window slides, match is in the already scanned part */
+    const char *buf3 = "abcdyyzz";
+    FAIL_IF(SCHSSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &state, 104,
+                (uint8_t *)buf3, strlen(buf3)) != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    PmqReset(&pmq);
+
+    /* window slides past the match */
+    const char *buf4 = "yzz";
+    FAIL_IF(SCHSSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &state, 109,
+                (uint8_t *)buf4, strlen(buf4)) != 0);
+
+    /* gap: new data is scanned from its start */
+    const char *buf5 = "abcd";
+    FAIL_IF(SCHSSearchStream(&mpm_ctx, &mpm_thread_ctx, &pmq, &state, 200,
+                (uint8_t *)buf5, strlen(buf5)) != 1);
+
+    SCHSStreamStateFree(state);
+    SCHSDestroyCtx(&mpm_ctx);
+    SCHSDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCHSRegisterTests(void)
@@ -2164,6 +2979,8 @@ void SCHSRegisterTests(void)
     UtRegisterTest("SCHSTest27", SCHSTest27);
     UtRegisterTest("SCHSTest28", SCHSTest28);
     UtRegisterTest("SCHSTest29", SCHSTest29);
+    UtRegisterTest("SCHSTest30", SCHSTest30);
+    UtRegisterTest("SCHSTest31", SCHSTest31);
 #endif
 
     return;
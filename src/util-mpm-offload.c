@@ -0,0 +1,815 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous mpm offload.
+ *
+ * A backend takes MpmOffloadJob's, searches them in its own threads or on
+ * a device and marks them done. Two ways of using it:
+ *
+ * - packets: the flow worker submits the payload of a packet as soon as
+ *   its direction is known, against the shared packet mpm ctx of the
+ *   current detect engine. Detect picks up the result, or searches
+ *   inline if the job was for another ctx.
+ * - batches: MpmOffloadSearch() submits a set of buffers (stream msgs,
+ *   body chunks) at once and collects them all, so that the backend
+ *   sees them together.
+ *
+ * With no backend configured all of this falls through to the inline
+ * search.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "decode.h"
+#include "flow.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "util-debug.h"
+#include "util-signal.h"
+#include "util-mpm-offload.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+#ifdef __SC_CUDA_SUPPORT__
+#include "util-mpm-ac.h"
+#endif
+
+#define MPM_OFFLOAD_MAX_BACKENDS    4
+
+static const MpmOffloadBackend *g_backends[MPM_OFFLOAD_MAX_BACKENDS];
+static int g_backends_cnt = 0;
+
+/** active backend, NULL if offload is disabled */
+static const MpmOffloadBackend *g_backend = NULL;
+
+/** packet mpm ctxs of the current detect engine */
+typedef struct MpmOffloadPacketCtxs_ {
+    DetectEngineCtx *de_ctx;    /**< reference held while in use */
+    const MpmCtx *tcp[2];       /**< toserver, toclient */
+    const MpmCtx *udp[2];
+    const MpmCtx *other;
+    /** jobs submitted against these ctxs and not done yet */
+    SC_ATOMIC_DECLARE(uint32_t, pending);
+} MpmOffloadPacketCtxs;
+
+static MpmOffloadPacketCtxs *g_packet_ctxs = NULL;
+static SCRWLock g_packet_ctxs_lock;
+/** unlocked hint for the packet path, g_packet_ctxs is checked under
+ *  the lock */
+static int g_packet_offload = 0;
+
+void MpmOffloadRegisterBackend(const MpmOffloadBackend *backend)
+{
+    BUG_ON(g_backends_cnt >= MPM_OFFLOAD_MAX_BACKENDS);
+    g_backends[g_backends_cnt++] = backend;
+}
+
+static void MpmOffloadCpuRegister(void);
+
+void MpmOffloadRegisterBackends(void)
+{
+    g_backends_cnt = 0;
+    MpmOffloadCpuRegister();
+#ifdef __SC_CUDA_SUPPORT__
+    MpmACCudaOffloadRegister();
+#endif
+}
+
+/**
+ *  \brief pick the backend from the mpm-offload config
+ *
+ *  ac-cuda implies the cuda backend, for compatibility with configs from
+ *  before the offload interface.
+ *
+ *  \retval 0 ok, offload may still be disabled
+ *  \retval -1 unknown backend or its setup failed
+ */
+int MpmOffloadSetup(void)
+{
+    ConfNode *conf = ConfGetNode("mpm-offload");
+    const char *name = NULL;
+
+    SCRWLockInit(&g_packet_ctxs_lock, NULL);
+
+    if (conf != NULL)
+        name = ConfNodeLookupChildValue(conf, "backend");
+#ifdef __SC_CUDA_SUPPORT__
+    if (name == NULL && PatternMatchDefaultMatcher() == MPM_AC_CUDA)
+        name = "cuda";
+#endif
+    if (name == NULL || strcasecmp(name, "none") == 0)
+        return 0;
+
+    int i;
+    for (i = 0; i < g_backends_cnt; i++) {
+        if (strcasecmp(g_backends[i]->name, name) == 0)
+            break;
+    }
+    if (i == g_backends_cnt) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "unknown mpm-offload.backend "
+                "\"%s\"", name);
+        return -1;
+    }
+    if (g_backends[i]->Init(conf) != 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "setting up mpm offload backend "
+                "\"%s\" failed", name);
+        return -1;
+    }
+    g_backend = g_backends[i];
+    SCLogConfig("mpm offload backend: %s", g_backend->name);
+    return 0;
+}
+
+void MpmOffloadStart(void)
+{
+    if (g_backend != NULL && g_backend->Start != NULL)
+        g_backend->Start();
+}
+
+/** \brief drop the packet ctxs and stop the backend. Called once the
+ *         packet threads are gone. */
+void MpmOffloadShutdown(void)
+{
+    if (g_backend == NULL)
+        return;
+
+    MpmOffloadSetDetectEngine(NULL);
+    g_backend->DeInit();
+    g_backend = NULL;
+    SCRWLockDestroy(&g_packet_ctxs_lock);
+}
+
+int MpmOffloadEnabled(void)
+{
+    return (g_backend != NULL);
+}
+
+const MpmOffloadBackend *MpmOffloadGetBackend(void)
+{
+    return g_backend;
+}
+
+void MpmOffloadPrepareStart(DetectEngineCtx *de_ctx)
+{
+    if (g_backend != NULL && g_backend->PrepareStart != NULL)
+        g_backend->PrepareStart(de_ctx);
+}
+
+void MpmOffloadPrepareEnd(DetectEngineCtx *de_ctx)
+{
+    if (g_backend != NULL && g_backend->PrepareEnd != NULL)
+        g_backend->PrepareEnd(de_ctx);
+}
+
+void MpmOffloadJobInit(MpmOffloadJob *job)
+{
+    memset(job, 0, sizeof(*job));
+    job->state = MPM_OFFLOAD_IDLE;
+    SCMutexInit(&job->m, NULL);
+    SCCondInit(&job->cond, NULL);
+}
+
+void MpmOffloadJobDeinit(MpmOffloadJob *job)
+{
+    if (job->results != NULL) {
+        if (job->ResultsFree != NULL)
+            job->ResultsFree(job->results);
+        else
+            SCFree(job->results);
+        job->results = NULL;
+    }
+    SCMutexDestroy(&job->m);
+    SCCondDestroy(&job->cond);
+}
+
+/**
+ *  \brief mark a job done, called by the backend
+ *
+ *  The job may be reused or freed by its owner as soon as the state is
+ *  set, so nothing of it is touched after that.
+ *
+ *  \param ok 1 if the results are valid, 0 to make the owner search
+ *            inline
+ */
+void MpmOffloadJobDone(MpmOffloadJob *job, int ok)
+{
+    MpmOffloadPacketCtxs *pctxs = job->pctxs;
+
+    if (job->Complete != NULL)
+        job->Complete(job, job->data);
+
+    SCMutexLock(&job->m);
+    job->state = ok ? MPM_OFFLOAD_DONE : MPM_OFFLOAD_FAILED;
+    SCCondSignal(&job->cond);
+    SCMutexUnlock(&job->m);
+
+    if (pctxs != NULL)
+        (void)SC_ATOMIC_SUB(pctxs->pending, 1);
+}
+
+/** \brief wait for a submitted job
+ *  \retval state the job ended in, MPM_OFFLOAD_IDLE if it wasn't
+ *          submitted */
+int MpmOffloadJobWait(MpmOffloadJob *job)
+{
+    SCMutexLock(&job->m);
+    while (job->state == MPM_OFFLOAD_PENDING)
+        SCCondWait(&job->cond, &job->m);
+    int state = job->state;
+    SCMutexUnlock(&job->m);
+    return state;
+}
+
+/** \retval 0 queued
+ *  \retval -1 not queued, job is idle again */
+static int MpmOffloadJobSubmit(MpmOffloadJob *job)
+{
+    /* pending before the backend sees it, it may be done before Submit()
+     * returns */
+    SCMutexLock(&job->m);
+    job->state = MPM_OFFLOAD_PENDING;
+    SCMutexUnlock(&job->m);
+
+    if (g_backend->Submit(job) != 0) {
+        SCMutexLock(&job->m);
+        job->state = MPM_OFFLOAD_IDLE;
+        SCMutexUnlock(&job->m);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int MpmOffloadJobEligible(const MpmOffloadJob *job)
+{
+    return (job->mpm_ctx->pattern_cnt > 0 &&
+            job->len >= job->mpm_ctx->minlen &&
+            g_backend->Supports(job->mpm_ctx));
+}
+
+/**
+ *  \brief search a batch of buffers, using the backend where it can
+ *
+ *  All jobs are submitted before the first is waited for. Jobs the
+ *  backend doesn't take or fails are searched inline with mtc. The jobs
+ *  are idle again on return.
+ *
+ *  \retval number of matches
+ */
+uint32_t MpmOffloadSearch(MpmThreadCtx *mtc, PatternMatcherQueue *pmq,
+        MpmOffloadJob **jobs, uint32_t cnt)
+{
+    uint32_t ret = 0;
+    uint32_t submitted = 0;
+    uint32_t i;
+
+    if (g_backend != NULL) {
+        for (i = 0; i < cnt; i++) {
+            jobs[i]->pctxs = NULL;
+            if (MpmOffloadJobEligible(jobs[i]) &&
+                MpmOffloadJobSubmit(jobs[i]) == 0)
+                submitted++;
+        }
+        if (submitted > 0 && g_backend->Flush != NULL)
+            g_backend->Flush();
+    }
+
+    for (i = 0; i < cnt; i++) {
+        MpmOffloadJob *job = jobs[i];
+        const MpmCtx *mpm_ctx = job->mpm_ctx;
+
+        if (submitted > 0) {
+            int state = MpmOffloadJobWait(job);
+            job->state = MPM_OFFLOAD_IDLE;
+            if (state == MPM_OFFLOAD_DONE) {
+                ret += g_backend->Collect(job, pmq);
+                continue;
+            }
+        }
+        if (job->len >= mpm_ctx->minlen) {
+            ret += mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, mtc, pmq,
+                    job->buf, job->len);
+        }
+    }
+    return ret;
+}
+
+/** \retval mpm_ctx the shared packet ctx, NULL if it's per sgh or the
+ *          backend can't do it */
+static const MpmCtx *MpmOffloadPacketCtx(const DetectEngineCtx *de_ctx,
+        int32_t id, int direction)
+{
+    if (id == MPM_CTX_FACTORY_UNIQUE_CONTEXT)
+        return NULL;
+    const MpmCtx *mpm_ctx = MpmFactoryGetMpmCtxForProfile(de_ctx, id, direction);
+    if (mpm_ctx == NULL || mpm_ctx->pattern_cnt == 0 ||
+        !g_backend->Supports(mpm_ctx))
+        return NULL;
+    return mpm_ctx;
+}
+
+/**
+ *  \brief switch packet offload to the packet mpm ctxs of de_ctx
+ *
+ *  Packets can only be submitted before their sgh is known if all sghs
+ *  share one packet ctx per proto and direction, so this is a no-op for
+ *  engines with unique packet ctxs and with multi tenancy. Waits for the
+ *  jobs against the previous engine to finish before releasing it.
+ *
+ *  \param de_ctx new engine, NULL to stop packet offload
+ */
+void MpmOffloadSetDetectEngine(DetectEngineCtx *de_ctx)
+{
+    if (g_backend == NULL)
+        return;
+
+    MpmOffloadPacketCtxs *pctxs = NULL;
+    if (de_ctx != NULL && !DetectEngineMultiTenantEnabled()) {
+        pctxs = SCCalloc(1, sizeof(*pctxs));
+        if (pctxs == NULL) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "no memory for the packet mpm "
+                    "offload, searching packets inline");
+        } else {
+            SC_ATOMIC_INIT(pctxs->pending);
+            pctxs->tcp[0] = MpmOffloadPacketCtx(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_tcp_packet, 0);
+            pctxs->tcp[1] = MpmOffloadPacketCtx(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_tcp_packet, 1);
+            pctxs->udp[0] = MpmOffloadPacketCtx(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_udp_packet, 0);
+            pctxs->udp[1] = MpmOffloadPacketCtx(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_udp_packet, 1);
+            pctxs->other = MpmOffloadPacketCtx(de_ctx,
+                    de_ctx->sgh_mpm_context_proto_other_packet, 0);
+
+            if (pctxs->tcp[0] == NULL && pctxs->tcp[1] == NULL &&
+                pctxs->udp[0] == NULL && pctxs->udp[1] == NULL &&
+                pctxs->other == NULL)
+            {
+                SCLogConfig("packet mpm ctxs are per signature group, "
+                        "not offloading packets");
+                SC_ATOMIC_DESTROY(pctxs->pending);
+                SCFree(pctxs);
+                pctxs = NULL;
+            } else {
+                pctxs->de_ctx = DetectEngineReference(de_ctx);
+            }
+        }
+    }
+
+    SCRWLockWRLock(&g_packet_ctxs_lock);
+    MpmOffloadPacketCtxs *old = g_packet_ctxs;
+    g_packet_ctxs = pctxs;
+    g_packet_offload = (pctxs != NULL);
+    SCRWLockUnlock(&g_packet_ctxs_lock);
+
+    if (old != NULL) {
+        while (SC_ATOMIC_GET(old->pending) > 0)
+            usleep(100);
+        DetectEngineDeReference(&old->de_ctx);
+        SC_ATOMIC_DESTROY(old->pending);
+        SCFree(old);
+    }
+}
+
+/**
+ *  \brief hand the payload of a packet to the backend
+ *
+ *  Called from the flow worker once the direction of the packet is
+ *  known, so the search runs while the stream and app layers are busy
+ *  with the packet.
+ */
+void MpmOffloadPacketSubmit(Packet *p)
+{
+    if (likely(g_packet_offload == 0))
+        return;
+
+    MpmOffloadJob *job = &p->mpm_offload;
+    if (job->state != MPM_OFFLOAD_IDLE)
+        MpmOffloadPacketRelease(p);
+
+    if (p->payload_len == 0 ||
+        (p->flags & (PKT_NOPAYLOAD_INSPECTION|PKT_NOPACKET_INSPECTION)) ||
+        PKT_IS_PSEUDOPKT(p))
+        return;
+
+    SCRWLockRDLock(&g_packet_ctxs_lock);
+    MpmOffloadPacketCtxs *pctxs = g_packet_ctxs;
+    if (pctxs != NULL) {
+        const int dir = (p->flowflags & FLOW_PKT_TOCLIENT) ? 1 : 0;
+        const MpmCtx *mpm_ctx;
+        if (p->proto == IPPROTO_TCP)
+            mpm_ctx = pctxs->tcp[dir];
+        else if (p->proto == IPPROTO_UDP)
+            mpm_ctx = pctxs->udp[dir];
+        else
+            mpm_ctx = pctxs->other;
+
+        if (mpm_ctx != NULL && p->payload_len >= mpm_ctx->minlen) {
+            job->mpm_ctx = mpm_ctx;
+            job->buf = p->payload;
+            job->len = p->payload_len;
+            job->pctxs = pctxs;
+            (void)SC_ATOMIC_ADD(pctxs->pending, 1);
+            if (MpmOffloadJobSubmit(job) == 0) {
+                if (g_backend->Flush != NULL)
+                    g_backend->Flush();
+            } else {
+                (void)SC_ATOMIC_SUB(pctxs->pending, 1);
+                job->pctxs = NULL;
+            }
+        }
+    }
+    SCRWLockUnlock(&g_packet_ctxs_lock);
+}
+
+/**
+ *  \brief get the offloaded results for the packet mpm
+ *
+ *  \retval 1 results for mpm_ctx were added to pmq
+ *  \retval 0 nothing usable, search inline
+ */
+int MpmOffloadPacketResult(Packet *p, const MpmCtx *mpm_ctx,
+        PatternMatcherQueue *pmq, uint32_t *matches)
+{
+    MpmOffloadJob *job = &p->mpm_offload;
+    if (job->state == MPM_OFFLOAD_IDLE)
+        return 0;
+
+    int r = 0;
+    int state = MpmOffloadJobWait(job);
+    if (state == MPM_OFFLOAD_DONE && job->mpm_ctx == mpm_ctx &&
+        job->buf == p->payload && job->len == p->payload_len)
+    {
+        *matches = g_backend->Collect(job, pmq);
+        r = 1;
+    }
+    job->state = MPM_OFFLOAD_IDLE;
+    job->pctxs = NULL;
+    return r;
+}
+
+/** \brief wait for an outstanding job of a packet and drop its results,
+ *         before the packet or its payload goes away */
+void MpmOffloadPacketRelease(Packet *p)
+{
+    MpmOffloadJob *job = &p->mpm_offload;
+    if (job->state == MPM_OFFLOAD_IDLE)
+        return;
+
+    (void)MpmOffloadJobWait(job);
+    job->state = MPM_OFFLOAD_IDLE;
+    job->pctxs = NULL;
+}
+
+/***************************** cpu backend *****************************/
+
+/* Searches on a pool of its own threads. Moves the packet mpm off the
+ * worker threads and exercises the offload paths without a device. */
+
+#define MPM_OFFLOAD_CPU_THREADS_DEFAULT 1
+#define MPM_OFFLOAD_CPU_THREADS_MAX     64
+
+typedef struct MpmOffloadCpu_ {
+    SCMutex m;
+    SCCondT cond;
+    MpmOffloadJob *head;
+    MpmOffloadJob *tail;
+    int stop;
+
+    int threads;
+    int running;
+    pthread_t *tids;
+} MpmOffloadCpu;
+
+static MpmOffloadCpu g_cpu;
+
+static void MpmOffloadCpuResultsFree(void *results)
+{
+    PatternMatcherQueue *pmq = results;
+    PmqFree(pmq);
+    SCFree(pmq);
+}
+
+static void MpmOffloadCpuRun(MpmOffloadJob *job, MpmThreadCtx *mtc,
+        uint8_t *mtc_init)
+{
+    PatternMatcherQueue *res = job->results;
+    if (res == NULL) {
+        res = SCCalloc(1, sizeof(*res));
+        if (res == NULL || PmqSetup(res) != 0) {
+            if (res != NULL)
+                SCFree(res);
+            MpmOffloadJobDone(job, 0);
+            return;
+        }
+        job->results = res;
+        job->results_size = sizeof(*res);
+        job->ResultsFree = MpmOffloadCpuResultsFree;
+    }
+    PmqReset(res);
+
+    const MpmCtx *mpm_ctx = job->mpm_ctx;
+    const uint16_t type = mpm_ctx->mpm_type;
+    if (!mtc_init[type]) {
+        MpmInitThreadCtx(&mtc[type], type);
+        mtc_init[type] = 1;
+    }
+    job->matches = mpm_table[type].Search(mpm_ctx, &mtc[type], res,
+            job->buf, job->len);
+    MpmOffloadJobDone(job, 1);
+}
+
+static void *MpmOffloadCpuThread(void *arg)
+{
+    MpmThreadCtx mtc[MPM_TABLE_SIZE];
+    uint8_t mtc_init[MPM_TABLE_SIZE];
+    memset(mtc, 0, sizeof(mtc));
+    memset(mtc_init, 0, sizeof(mtc_init));
+
+    UtilSignalBlock(SIGUSR2);
+
+    while (1) {
+        SCMutexLock(&g_cpu.m);
+        while (!g_cpu.stop && g_cpu.head == NULL)
+            SCCondWait(&g_cpu.cond, &g_cpu.m);
+        MpmOffloadJob *job = g_cpu.head;
+        if (job == NULL) {
+            SCMutexUnlock(&g_cpu.m);
+            break;
+        }
+        g_cpu.head = job->next;
+        if (g_cpu.head == NULL)
+            g_cpu.tail = NULL;
+        SCMutexUnlock(&g_cpu.m);
+
+        job->next = NULL;
+        MpmOffloadCpuRun(job, mtc, mtc_init);
+    }
+
+    int t;
+    for (t = 0; t < MPM_TABLE_SIZE; t++) {
+        if (mtc_init[t])
+            mpm_table[t].DestroyThreadCtx(NULL, &mtc[t]);
+    }
+    return NULL;
+}
+
+static int MpmOffloadCpuInit(ConfNode *conf)
+{
+    intmax_t threads = MPM_OFFLOAD_CPU_THREADS_DEFAULT;
+    if (conf != NULL) {
+        const char *val = ConfNodeLookupChildValue(conf, "threads");
+        if (val != NULL &&
+            (ConfGetChildValueInt(conf, "threads", &threads) != 1 ||
+             threads < 1 || threads > MPM_OFFLOAD_CPU_THREADS_MAX))
+        {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid mpm-offload.threads "
+                    "\"%s\", must be 1-%d", val, MPM_OFFLOAD_CPU_THREADS_MAX);
+            return -1;
+        }
+    }
+
+    memset(&g_cpu, 0, sizeof(g_cpu));
+    SCMutexInit(&g_cpu.m, NULL);
+    SCCondInit(&g_cpu.cond, NULL);
+    g_cpu.threads = (int)threads;
+    g_cpu.tids = SCCalloc(g_cpu.threads, sizeof(pthread_t));
+    if (g_cpu.tids == NULL)
+        return -1;
+
+    int i;
+    for (i = 0; i < g_cpu.threads; i++) {
+        if (pthread_create(&g_cpu.tids[i], NULL, MpmOffloadCpuThread, NULL) != 0) {
+            SCLogError(SC_ERR_THREAD_CREATE, "creating mpm offload thread "
+                    "failed: %s", strerror(errno));
+            break;
+        }
+        g_cpu.running++;
+    }
+    if (g_cpu.running == 0) {
+        SCFree(g_cpu.tids);
+        g_cpu.tids = NULL;
+        return -1;
+    }
+    SCLogConfig("mpm offload: %d cpu search thread(s)", g_cpu.running);
+    return 0;
+}
+
+static void MpmOffloadCpuDeInit(void)
+{
+    SCMutexLock(&g_cpu.m);
+    g_cpu.stop = 1;
+    pthread_cond_broadcast(&g_cpu.cond);
+    SCMutexUnlock(&g_cpu.m);
+
+    int i;
+    for (i = 0; i < g_cpu.running; i++)
+        pthread_join(g_cpu.tids[i], NULL);
+
+    SCFree(g_cpu.tids);
+    SCMutexDestroy(&g_cpu.m);
+    SCCondDestroy(&g_cpu.cond);
+    memset(&g_cpu, 0, sizeof(g_cpu));
+}
+
+static int MpmOffloadCpuSupports(const MpmCtx *mpm_ctx)
+{
+    /* hyperscan scratch is per thread and per database */
+    return (mpm_ctx->mpm_type != MPM_HS);
+}
+
+static int MpmOffloadCpuSubmit(MpmOffloadJob *job)
+{
+    job->next = NULL;
+
+    SCMutexLock(&g_cpu.m);
+    if (g_cpu.stop) {
+        SCMutexUnlock(&g_cpu.m);
+        return -1;
+    }
+    if (g_cpu.tail != NULL)
+        g_cpu.tail->next = job;
+    else
+        g_cpu.head = job;
+    g_cpu.tail = job;
+    SCCondSignal(&g_cpu.cond);
+    SCMutexUnlock(&g_cpu.m);
+    return 0;
+}
+
+static uint32_t MpmOffloadCpuCollect(MpmOffloadJob *job,
+        PatternMatcherQueue *pmq)
+{
+    PatternMatcherQueue *res = job->results;
+    MpmAddSids(pmq, res->rule_id_array, res->rule_id_array_cnt);
+    return job->matches;
+}
+
+static const MpmOffloadBackend mpm_offload_cpu = {
+    .name = "cpu",
+    .Init = MpmOffloadCpuInit,
+    .DeInit = MpmOffloadCpuDeInit,
+    .Supports = MpmOffloadCpuSupports,
+    .Submit = MpmOffloadCpuSubmit,
+    .Collect = MpmOffloadCpuCollect,
+};
+
+static void MpmOffloadCpuRegister(void)
+{
+    MpmOffloadRegisterBackend(&mpm_offload_cpu);
+}
+
+/****************************** Unittests ******************************/
+
+#ifdef UNITTESTS
+
+static int MpmOffloadTestSetup(MpmCtx *mpm_ctx)
+{
+    memset(mpm_ctx, 0, sizeof(*mpm_ctx));
+    MpmInitCtx(mpm_ctx, MPM_AC);
+    MpmAddPatternCS(mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 1, 0);
+    MpmAddPatternCS(mpm_ctx, (uint8_t *)"wxyz", 4, 0, 0, 1, 2, 0);
+    MpmAddPatternCI(mpm_ctx, (uint8_t *)"offload", 7, 0, 0, 2, 3, 0);
+    if (mpm_table[MPM_AC].Prepare(mpm_ctx) != 0)
+        return -1;
+
+    SCRWLockInit(&g_packet_ctxs_lock, NULL);
+    if (MpmOffloadCpuInit(NULL) != 0)
+        return -1;
+    g_backend = &mpm_offload_cpu;
+    return 0;
+}
+
+static void MpmOffloadTestCleanup(MpmCtx *mpm_ctx)
+{
+    g_backend = NULL;
+    MpmOffloadCpuDeInit();
+    SCRWLockDestroy(&g_packet_ctxs_lock);
+    mpm_table[MPM_AC].DestroyCtx(mpm_ctx);
+}
+
+/** \test a batch gets the same matches as the inline search */
+static int MpmOffloadTest01(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mtc;
+    PatternMatcherQueue pmq, inline_pmq;
+    static const char *bufs[] = { "xxabcdxx", "OFFLOAD", "nothing here",
+        "ab", "wxyz abcd" };
+    MpmOffloadJob jobs[5];
+    MpmOffloadJob *jobp[5];
+    uint32_t i;
+
+    FAIL_IF(MpmOffloadTestSetup(&mpm_ctx) != 0);
+    MpmInitThreadCtx(&mtc, MPM_AC);
+    FAIL_IF(PmqSetup(&pmq) != 0);
+    FAIL_IF(PmqSetup(&inline_pmq) != 0);
+
+    uint32_t expect = 0;
+    for (i = 0; i < 5; i++) {
+        MpmOffloadJobInit(&jobs[i]);
+        jobs[i].mpm_ctx = &mpm_ctx;
+        jobs[i].buf = (const uint8_t *)bufs[i];
+        jobs[i].len = strlen(bufs[i]);
+        jobp[i] = &jobs[i];
+        if (jobs[i].len >= mpm_ctx.minlen) {
+            expect += mpm_table[MPM_AC].Search(&mpm_ctx, &mtc, &inline_pmq,
+                    jobs[i].buf, jobs[i].len);
+        }
+    }
+
+    /* twice, to reuse the results */
+    int round;
+    for (round = 0; round < 2; round++) {
+        PmqReset(&pmq);
+        uint32_t matches = MpmOffloadSearch(&mtc, &pmq, jobp, 5);
+        FAIL_IF(matches != expect);
+        FAIL_IF(matches != 4);
+        FAIL_IF(pmq.rule_id_array_cnt != inline_pmq.rule_id_array_cnt);
+        for (i = 0; i < 5; i++)
+            FAIL_IF(jobs[i].state != MPM_OFFLOAD_IDLE);
+        /* the single, too short job was searched inline */
+        FAIL_IF(jobs[3].results != NULL);
+        FAIL_IF(jobs[0].results == NULL);
+    }
+
+    for (i = 0; i < 5; i++)
+        MpmOffloadJobDeinit(&jobs[i]);
+    PmqFree(&pmq);
+    PmqFree(&inline_pmq);
+    mpm_table[MPM_AC].DestroyThreadCtx(&mpm_ctx, &mtc);
+    MpmOffloadTestCleanup(&mpm_ctx);
+    PASS;
+}
+
+/** \test packet results are only used for the ctx and payload they were
+ *        searched for */
+static int MpmOffloadTest02(void)
+{
+    MpmCtx mpm_ctx, other_ctx;
+    PatternMatcherQueue pmq;
+    uint8_t payload[] = "GET /offload HTTP/1.0";
+    uint32_t matches = 0;
+
+    FAIL_IF(MpmOffloadTestSetup(&mpm_ctx) != 0);
+    memset(&other_ctx, 0, sizeof(other_ctx));
+    FAIL_IF(PmqSetup(&pmq) != 0);
+
+    Packet *p = UTHBuildPacket(payload, sizeof(payload) - 1, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+
+    /* not submitted */
+    FAIL_IF(MpmOffloadPacketResult(p, &mpm_ctx, &pmq, &matches) != 0);
+
+    MpmOffloadJob *job = &p->mpm_offload;
+    job->mpm_ctx = &mpm_ctx;
+    job->buf = p->payload;
+    job->len = p->payload_len;
+    FAIL_IF(MpmOffloadJobSubmit(job) != 0);
+    FAIL_IF(MpmOffloadPacketResult(p, &other_ctx, &pmq, &matches) != 0);
+    FAIL_IF(pmq.rule_id_array_cnt != 0);
+    FAIL_IF(job->state != MPM_OFFLOAD_IDLE);
+
+    FAIL_IF(MpmOffloadJobSubmit(job) != 0);
+    FAIL_IF(MpmOffloadPacketResult(p, &mpm_ctx, &pmq, &matches) != 1);
+    FAIL_IF(matches != 1);
+    FAIL_IF(pmq.rule_id_array_cnt != 1);
+    FAIL_IF(pmq.rule_id_array[0] != 3);
+
+    /* released before recycling */
+    FAIL_IF(MpmOffloadJobSubmit(job) != 0);
+    MpmOffloadPacketRelease(p);
+    FAIL_IF(job->state != MPM_OFFLOAD_IDLE);
+
+    UTHFreePacket(p);
+    PmqFree(&pmq);
+    MpmOffloadTestCleanup(&mpm_ctx);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void MpmOffloadRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MpmOffloadTest01", MpmOffloadTest01);
+    UtRegisterTest("MpmOffloadTest02", MpmOffloadTest02);
+#endif
+}
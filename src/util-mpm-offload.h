@@ -0,0 +1,130 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Asynchronous mpm offload: buffers are handed to a backend (a thread
+ * pool, a gpu, ...) as jobs and their results are collected later.
+ */
+
+#ifndef __UTIL_MPM_OFFLOAD_H__
+#define __UTIL_MPM_OFFLOAD_H__
+
+#include "threads.h"
+#include "conf.h"
+#include "util-mpm.h"
+
+struct DetectEngineCtx_;
+struct Packet_;
+struct MpmOffloadPacketCtxs_;
+
+enum MpmOffloadJobState {
+    MPM_OFFLOAD_IDLE = 0,   /**< not submitted, owned by the caller */
+    MPM_OFFLOAD_PENDING,    /**< owned by the backend */
+    MPM_OFFLOAD_DONE,       /**< results ready for Collect() */
+    MPM_OFFLOAD_FAILED,     /**< backend gave up, search inline */
+};
+
+/** a buffer to search, handed to the offload backend */
+typedef struct MpmOffloadJob_ {
+    const MpmCtx *mpm_ctx;
+    const uint8_t *buf;
+    uint32_t len;
+
+    /** MpmOffloadJobState, protected by m */
+    int state;
+    SCMutex m;
+    SCCondT cond;
+
+    /** optional, called by the backend right before the job is marked
+     *  done or failed. Runs in the backend's thread, must not block. */
+    void (*Complete)(struct MpmOffloadJob_ *job, void *data);
+    void *data;
+
+    /** results in the backend's own format, read by its Collect().
+     *  Kept between jobs, freed by MpmOffloadJobDeinit() */
+    void *results;
+    uint32_t results_size;
+    uint32_t matches;
+    /** set by the backend that allocated results, SCFree() if NULL */
+    void (*ResultsFree)(void *results);
+
+    /** for the backend's queue */
+    struct MpmOffloadJob_ *next;
+
+    /** packet mpm ctxs the job was submitted for, NULL for other jobs */
+    struct MpmOffloadPacketCtxs_ *pctxs;
+} MpmOffloadJob;
+
+/** an offload backend */
+typedef struct MpmOffloadBackend_ {
+    const char *name;
+
+    /** set up from the mpm-offload config node, which may be NULL */
+    int (*Init)(ConfNode *conf);
+    /** optional, called once the threading setup is done */
+    void (*Start)(void);
+    void (*DeInit)(void);
+
+    /** optional, called around the preparation of the mpm ctxs of an
+     *  engine, e.g. to upload the tables to a device */
+    void (*PrepareStart)(struct DetectEngineCtx_ *de_ctx);
+    void (*PrepareEnd)(struct DetectEngineCtx_ *de_ctx);
+
+    /** 1 if the backend can search mpm_ctx */
+    int (*Supports)(const MpmCtx *mpm_ctx);
+    /** queue a job. Must not wait for the search itself. The backend
+     *  calls MpmOffloadJobDone() when it is done with the job.
+     *  \retval 0 queued
+     *  \retval -1 not queued, the caller searches inline */
+    int (*Submit)(MpmOffloadJob *job);
+    /** optional, start on the jobs queued since the last call */
+    void (*Flush)(void);
+    /** add the results of a done job to pmq, in the calling thread
+     *  \retval number of matches */
+    uint32_t (*Collect)(MpmOffloadJob *job, PatternMatcherQueue *pmq);
+} MpmOffloadBackend;
+
+void MpmOffloadRegisterBackend(const MpmOffloadBackend *backend);
+void MpmOffloadRegisterBackends(void);
+int MpmOffloadSetup(void);
+void MpmOffloadStart(void);
+void MpmOffloadShutdown(void);
+int MpmOffloadEnabled(void);
+const MpmOffloadBackend *MpmOffloadGetBackend(void);
+
+void MpmOffloadPrepareStart(struct DetectEngineCtx_ *de_ctx);
+void MpmOffloadPrepareEnd(struct DetectEngineCtx_ *de_ctx);
+
+void MpmOffloadJobInit(MpmOffloadJob *job);
+void MpmOffloadJobDeinit(MpmOffloadJob *job);
+void MpmOffloadJobDone(MpmOffloadJob *job, int ok);
+int MpmOffloadJobWait(MpmOffloadJob *job);
+
+uint32_t MpmOffloadSearch(MpmThreadCtx *mtc, PatternMatcherQueue *pmq,
+        MpmOffloadJob **jobs, uint32_t cnt);
+
+void MpmOffloadSetDetectEngine(struct DetectEngineCtx_ *de_ctx);
+void MpmOffloadPacketSubmit(struct Packet_ *p);
+int MpmOffloadPacketResult(struct Packet_ *p, const MpmCtx *mpm_ctx,
+        PatternMatcherQueue *pmq, uint32_t *matches);
+void MpmOffloadPacketRelease(struct Packet_ *p);
+
+void MpmOffloadRegisterTests(void);
+
+#endif /* __UTIL_MPM_OFFLOAD_H__ */
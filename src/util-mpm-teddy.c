@@ -0,0 +1,568 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy style literal matcher for small pattern sets.
+ *
+ * Patterns are sorted and split over 8 buckets. For each of the first
+ * 1 to 3 bytes of the patterns a mask records which buckets have a pattern
+ * with that byte at that position. A position in the buffer is a candidate
+ * if the masks of the bytes there AND to a non zero value, after which
+ * only the patterns of the buckets left are compared.
+ *
+ * With SSSE3 16 positions are tested at once, using the low and high
+ * nibble of each byte as index into 16 byte tables with pshufb. Without
+ * it, or for the tail of the buffer, exact 256 entry byte tables are used.
+ *
+ * The ctx is a few kb no matter the pattern count, compared to the 1kb per
+ * state of the AC state table. It's not selectable as mpm-algo: the
+ * detection engine picks it for ctxs with few patterns, see
+ * detect.mpm.small-max-patterns.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-mpm-teddy.h"
+#include "util-memcpy.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/**
+ * \brief Initialize the teddy ctx.
+ *
+ * The init hash is only allocated if there isn't one yet, so that a ctx
+ * whose patterns were added to another generic mpm can be switched over.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMalloc(sizeof(SCTeddyCtx));
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    if (mpm_ctx->init_hash == NULL) {
+        mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+        if (mpm_ctx->init_hash == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+    }
+}
+
+/**
+ * \brief Destroy the teddy ctx.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+            while (node != NULL) {
+                nnode = node->next;
+                SCFree(node->sids);
+                MpmFreePattern(mpm_ctx, node);
+                node = nnode;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+    }
+
+    if (ctx->patterns != NULL) {
+        uint32_t i;
+        for (i = 0; i < ctx->pattern_cnt; i++) {
+            SCFree(ctx->patterns[i].pat);
+            SCFree(ctx->patterns[i].sids);
+        }
+        SCFree(ctx->patterns);
+        mpm_ctx->memory_cnt--;
+        mpm_ctx->memory_size -= ctx->pattern_cnt * sizeof(SCTeddyPattern);
+    }
+
+    SCFree(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+}
+
+/** teddy keeps no per thread state */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/* sort on the lowercase leading bytes, so that patterns sharing a prefix
+ * land in the same bucket */
+static int SCTeddyPatternCompare(const void *a, const void *b)
+{
+    const SCTeddyPattern *p1 = a;
+    const SCTeddyPattern *p2 = b;
+    uint16_t len = MIN(p1->len, p2->len);
+    uint16_t i;
+
+    for (i = 0; i < len && i < TEDDY_MAX_FP; i++) {
+        uint8_t c1 = u8_tolower(p1->pat[i]);
+        uint8_t c2 = u8_tolower(p2->pat[i]);
+        if (c1 != c2)
+            return (int)c1 - (int)c2;
+    }
+    return (int)p1->len - (int)p2->len;
+}
+
+static void SCTeddySetMask(SCTeddyCtx *ctx, uint8_t pos, uint8_t c, uint8_t bit)
+{
+    ctx->mask[pos][c] |= bit;
+    ctx->lo[pos][c & 0x0f] |= bit;
+    ctx->hi[pos][c >> 4] |= bit;
+}
+
+/**
+ * \brief Build the buckets and masks from the patterns added to the ctx.
+ *
+ * \retval 0 ok
+ * \retval -1 too many patterns or out of memory
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t i, p = 0;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+    if (mpm_ctx->pattern_cnt > TEDDY_MAX_PATTERNS) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "teddy supports up to %u "
+                "patterns, got %u", TEDDY_MAX_PATTERNS, mpm_ctx->pattern_cnt);
+        return -1;
+    }
+
+    ctx->patterns = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    if (ctx->patterns == NULL)
+        return -1;
+    memset(ctx->patterns, 0, mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern);
+
+    /* take the patterns and their sids out of the hash */
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+
+            SCTeddyPattern *tp = &ctx->patterns[p++];
+            tp->len = node->len;
+            tp->nocase = (node->flags & MPM_PATTERN_FLAG_NOCASE) ? 1 : 0;
+            tp->pat = SCMalloc(node->len);
+            if (tp->pat == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            memcpy(tp->pat, tp->nocase ? node->ci : node->cs, node->len);
+            tp->sids = node->sids;
+            tp->sids_size = node->sids_size;
+
+            node->sids = NULL;
+            node->sids_size = 0;
+            MpmFreePattern(mpm_ctx, node);
+            node = nnode;
+        }
+    }
+    ctx->pattern_cnt = p;
+    BUG_ON(p != mpm_ctx->pattern_cnt);
+
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= (MPM_INIT_HASH_SIZE * sizeof(MpmPattern *));
+
+    qsort(ctx->patterns, ctx->pattern_cnt, sizeof(SCTeddyPattern),
+            SCTeddyPatternCompare);
+
+    ctx->fp_len = MIN(mpm_ctx->minlen, TEDDY_MAX_FP);
+
+    /* spread the sorted patterns evenly over the buckets */
+    uint32_t b;
+    for (b = 0; b <= TEDDY_BUCKETS; b++) {
+        ctx->bucket_start[b] = (uint8_t)((b * ctx->pattern_cnt) / TEDDY_BUCKETS);
+    }
+
+    for (b = 0; b < TEDDY_BUCKETS; b++) {
+        uint8_t bit = (uint8_t)(1 << b);
+        for (i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            const SCTeddyPattern *tp = &ctx->patterns[i];
+            uint8_t pos;
+            for (pos = 0; pos < ctx->fp_len; pos++) {
+                uint8_t c = tp->pat[pos];
+                if (tp->nocase) {
+                    SCTeddySetMask(ctx, pos, u8_tolower(c), bit);
+                    SCTeddySetMask(ctx, pos, toupper(c), bit);
+                } else {
+                    SCTeddySetMask(ctx, pos, c, bit);
+                }
+            }
+        }
+    }
+
+    SCLogDebug("%u patterns, fp_len %u", ctx->pattern_cnt, ctx->fp_len);
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief Compare the patterns of the candidate buckets at a position.
+ *
+ * \param seen bitmap of patterns already reported in this search
+ *
+ * \retval matches number of patterns that matched here
+ */
+static uint32_t SCTeddyVerify(const SCTeddyCtx *ctx, PatternMatcherQueue *pmq,
+                              const uint8_t *buf, uint32_t buflen,
+                              uint32_t pos, uint8_t buckets, uint64_t *seen)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        uint8_t b = (uint8_t)__builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t i;
+        for (i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            const SCTeddyPattern *tp = &ctx->patterns[i];
+            const uint64_t bit = 1ULL << i;
+
+            if ((*seen & bit) || pos + tp->len > buflen)
+                continue;
+
+            int r = tp->nocase ?
+                SCMemcmpLowercase(tp->pat, buf + pos, tp->len) :
+                SCMemcmp(tp->pat, buf + pos, tp->len);
+            if (r == 0) {
+                *seen |= bit;
+                MpmAddSids(pmq, tp->sids, tp->sids_size);
+                matches++;
+            }
+        }
+    }
+    return matches;
+}
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Unused.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint64_t seen = 0;
+    uint32_t i = 0;
+
+    if (ctx->pattern_cnt == 0 || buflen < mpm_ctx->minlen)
+        return 0;
+
+    const uint32_t fp_len = ctx->fp_len;
+    /* last position a fingerprint fits at */
+    const uint32_t last = buflen - fp_len;
+
+#if defined(__SSSE3__)
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[TEDDY_MAX_FP], hi[TEDDY_MAX_FP];
+    uint32_t j;
+    for (j = 0; j < fp_len; j++) {
+        lo[j] = _mm_load_si128((const __m128i *)ctx->lo[j]);
+        hi[j] = _mm_load_si128((const __m128i *)ctx->hi[j]);
+    }
+
+    /* 16 positions at once while all their fingerprint bytes are in buf */
+    for ( ; i + 16 + fp_len - 1 <= buflen; i += 16) {
+        __m128i res = _mm_set1_epi8((char)0xff);
+        for (j = 0; j < fp_len; j++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i + j));
+            __m128i vl = _mm_and_si128(v, nibble);
+            __m128i vh = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+            res = _mm_and_si128(res,
+                    _mm_and_si128(_mm_shuffle_epi8(lo[j], vl),
+                                  _mm_shuffle_epi8(hi[j], vh)));
+        }
+
+        uint32_t nz = ~_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xffff;
+        if (likely(nz == 0))
+            continue;
+
+        uint8_t r[16] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *)r, res);
+        while (nz != 0) {
+            uint32_t k = __builtin_ctz(nz);
+            nz &= nz - 1;
+
+            /* the nibble tables let through combinations no pattern
+             * has, the exact tables weed those out */
+            uint8_t m = r[k] & ctx->mask[0][buf[i + k]];
+            if (fp_len > 1)
+                m &= ctx->mask[1][buf[i + k + 1]];
+            if (fp_len > 2)
+                m &= ctx->mask[2][buf[i + k + 2]];
+            if (m != 0)
+                matches += SCTeddyVerify(ctx, pmq, buf, buflen, i + k, m, &seen);
+        }
+    }
+#endif
+
+    switch (fp_len) {
+        case 1:
+            for ( ; i <= last; i++) {
+                uint8_t m = ctx->mask[0][buf[i]];
+                if (m != 0)
+                    matches += SCTeddyVerify(ctx, pmq, buf, buflen, i, m, &seen);
+            }
+            break;
+        case 2:
+            for ( ; i <= last; i++) {
+                uint8_t m = ctx->mask[0][buf[i]] & ctx->mask[1][buf[i + 1]];
+                if (m != 0)
+                    matches += SCTeddyVerify(ctx, pmq, buf, buflen, i, m, &seen);
+            }
+            break;
+        default:
+            for ( ; i <= last; i++) {
+                uint8_t m = ctx->mask[0][buf[i]] & ctx->mask[1][buf[i + 1]] &
+                            ctx->mask[2][buf[i + 2]];
+                if (m != 0)
+                    matches += SCTeddyVerify(ctx, pmq, buf, buflen, i, m, &seen);
+            }
+            break;
+    }
+
+    return matches;
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    printf("Fingerprint:     %" PRIu32 "\n", ctx->fp_len);
+    printf("\n");
+}
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+    mpm_table[MPM_TEDDY].flags = MPM_FLAG_PREPARE_THREADSAFE|MPM_FLAG_SMALL_ONLY;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+static uint32_t SCTeddyTestSearch(const char *patterns[], int nocase,
+                                  const char *buf, uint32_t *sids_found)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    for (i = 0; patterns[i] != NULL; i++) {
+        if (nocase)
+            MpmAddPatternCI(&mpm_ctx, (uint8_t *)patterns[i],
+                    strlen(patterns[i]), 0, 0, i, i, 0);
+        else
+            MpmAddPatternCS(&mpm_ctx, (uint8_t *)patterns[i],
+                    strlen(patterns[i]), 0, 0, i, i, 0);
+    }
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    *sids_found = pmq.rule_id_array_cnt;
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return cnt;
+}
+
+/** \test single pattern, once despite two occurrences */
+static int SCTeddyTest01(void)
+{
+    const char *pats[] = { "abcd", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "xxabcdxxxxabcd", &sids) != 1);
+    FAIL_IF(sids != 1);
+    PASS;
+}
+
+/** \test case sensitive vs nocase */
+static int SCTeddyTest02(void)
+{
+    const char *pats[] = { "ABcd", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "xxabcdxx", &sids) != 0);
+    FAIL_IF(SCTeddyTestSearch(pats, 1, "xxabCDxx", &sids) != 1);
+    PASS;
+}
+
+/** \test more patterns than buckets, matches in the SIMD part and the
+ *        tail of a long buffer */
+static int SCTeddyTest03(void)
+{
+    const char *pats[] = { "GET", "POST", "HEAD", "PUT", "DELETE", "OPTIONS",
+        "TRACE", "CONNECT", "PATCH", "User-Agent", "Host", "Cookie", NULL };
+    uint32_t sids = 0;
+    const char *buf = "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n"
+                      "Accept: */*\r\nCookie";
+    FAIL_IF(SCTeddyTestSearch(pats, 0, buf, &sids) != 3);
+    FAIL_IF(sids != 3);
+    PASS;
+}
+
+/** \test patterns shorter than the fingerprint of others, at the very end */
+static int SCTeddyTest04(void)
+{
+    const char *pats[] = { "a", "abc", "xyz", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "0123456789012345678901234xyz", &sids) != 1);
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "01234567890123456789012345a", &sids) != 1);
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "ab", &sids) != 1);
+    PASS;
+}
+
+/** \test no match */
+static int SCTeddyTest05(void)
+{
+    const char *pats[] = { "abcd", "efgh", NULL };
+    uint32_t sids = 0;
+    FAIL_IF(SCTeddyTestSearch(pats, 0, "abcabcefgefgaaaaaaaaaaaaaaaaaaa", &sids) != 0);
+    FAIL_IF(sids != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05);
+#endif /* UNITTESTS */
+}
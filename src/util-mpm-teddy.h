@@ -0,0 +1,68 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Teddy style literal matcher for small pattern sets.
+ */
+
+#ifndef __UTIL_MPM_TEDDY__H__
+#define __UTIL_MPM_TEDDY__H__
+
+/** max patterns a teddy ctx can hold */
+#define TEDDY_MAX_PATTERNS      64
+/** number of pattern buckets, one bit each in the masks */
+#define TEDDY_BUCKETS           8
+/** max number of leading pattern bytes used to find candidates */
+#define TEDDY_MAX_FP            3
+
+typedef struct SCTeddyPattern_ {
+    /* pattern, lowercase if nocase */
+    uint8_t *pat;
+    uint16_t len;
+    uint8_t nocase;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* patterns, sorted and grouped by bucket */
+    SCTeddyPattern *patterns;
+    uint32_t pattern_cnt;
+
+    /* patterns of bucket b are patterns[bucket_start[b]] up to
+     * patterns[bucket_start[b + 1]] */
+    uint8_t bucket_start[TEDDY_BUCKETS + 1];
+
+    /* number of leading bytes the masks cover */
+    uint8_t fp_len;
+
+    /* per fingerprint byte the nibble masks for the SIMD path: bit b is set
+     * if a pattern in bucket b has a byte with that low / high nibble */
+    uint8_t lo[TEDDY_MAX_FP][16] __attribute__((aligned(16)));
+    uint8_t hi[TEDDY_MAX_FP][16] __attribute__((aligned(16)));
+
+    /* per fingerprint byte the exact byte masks for the scalar path */
+    uint8_t mask[TEDDY_MAX_FP][256];
+} SCTeddyCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY__H__ */
@@ -31,8 +31,11 @@
 #include "util-mpm-ac.h"
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
+#include "util-mpm-ac-band.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
+#include "util-hash-lookup3.h"
 
 #include "detect-engine.h"
 #include "util-cuda.h"
@@ -41,6 +44,7 @@
 #include "conf-yaml-loader.h"
 #include "queue.h"
 #include "util-unittest.h"
+#include "util-bench.h"
 #ifdef __SC_CUDA_SUPPORT__
 #include "util-cuda-handlers.h"
 #include "detect-engine-mpm.h"
@@ -508,6 +512,44 @@ void MpmInitCtx (MpmCtx *mpm_ctx, uint16_t matcher)
     mpm_table[matcher].InitCtx(mpm_ctx);
 }
 
+/** \brief free a stream state created by a mpm's SearchStream */
+void MpmStreamStateFree(void *state)
+{
+    if (state == NULL)
+        return;
+
+    const MpmStreamState *ms = state;
+    BUG_ON(mpm_table[ms->mpm_type].StreamStateFree == NULL);
+    mpm_table[ms->mpm_type].StreamStateFree(state);
+}
+
+/**
+ *  \brief search several buffers with one mpm ctx
+ *
+ *  Uses the matcher's SearchVector if it has one, otherwise searches each
+ *  buffer of at least minlen bytes on its own.
+ *
+ *  \retval matches match count
+ */
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PatternMatcherQueue *pmq, const uint8_t **bufs, const uint32_t *lens,
+        uint32_t cnt)
+{
+    if (mpm_table[mpm_ctx->mpm_type].SearchVector != NULL)
+        return mpm_table[mpm_ctx->mpm_type].SearchVector(mpm_ctx,
+                mpm_thread_ctx, pmq, bufs, lens, cnt);
+
+    uint32_t ret = 0;
+    uint32_t i;
+    for (i = 0; i < cnt; i++) {
+        if (lens[i] < mpm_ctx->minlen)
+            continue;
+        ret += mpm_table[mpm_ctx->mpm_type].Search(mpm_ctx, mpm_thread_ctx,
+                pmq, bufs[i], (uint16_t)MIN(lens[i], UINT16_MAX));
+    }
+    return ret;
+}
+
 void MpmTableSetup(void)
 {
     memset(mpm_table, 0, sizeof(mpm_table));
@@ -515,6 +557,8 @@ void MpmTableSetup(void)
     MpmACRegister();
     MpmACBSRegister();
     MpmACTileRegister();
+    MpmACBandRegister();
+    MpmTeddyRegister();
 #ifdef BUILD_HYPERSCAN
     MpmHSRegister();
 #endif /* BUILD_HYPERSCAN */
@@ -523,10 +567,35 @@ void MpmTableSetup(void)
 #endif /* __SC_CUDA_SUPPORT__ */
 }
 
+/**
+ * \internal
+ * \brief Fold a pattern into the ctx fingerprint.
+ *
+ * Covers everything the matcher gets to see, in the order it sees it,
+ * so two ctxs with the same fingerprint build the same matcher.
+ */
+static void MpmCtxFingerprintUpdate(MpmCtx *mpm_ctx, const uint8_t *pat,
+                                    uint16_t patlen, uint16_t offset,
+                                    uint16_t depth, uint32_t pid, SigIntId sid,
+                                    uint8_t flags, uint8_t nocase)
+{
+    uint32_t pc = (uint32_t)mpm_ctx->fingerprint;
+    uint32_t pb = (uint32_t)(mpm_ctx->fingerprint >> 32);
+    uint32_t meta[6] = { patlen, offset, depth, pid, (uint32_t)sid,
+                         ((uint32_t)nocase << 8) | flags };
+
+    hashlittle2(meta, sizeof(meta), &pc, &pb);
+    hashlittle2(pat, patlen, &pc, &pb);
+
+    mpm_ctx->fingerprint = ((uint64_t)pb << 32) | pc;
+}
+
 int MpmAddPatternCS(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, SigIntId sid, uint8_t flags)
 {
+    MpmCtxFingerprintUpdate(mpm_ctx, pat, patlen, offset, depth, pid, sid,
+                            flags, 0);
     return mpm_table[mpm_ctx->mpm_type].AddPattern(mpm_ctx, pat, patlen,
                                                    offset, depth,
                                                    pid, sid, flags);
@@ -536,6 +605,8 @@ int MpmAddPatternCI(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
                     uint16_t offset, uint16_t depth,
                     uint32_t pid, SigIntId sid, uint8_t flags)
 {
+    MpmCtxFingerprintUpdate(mpm_ctx, pat, patlen, offset, depth, pid, sid,
+                            flags, 1);
     return mpm_table[mpm_ctx->mpm_type].AddPatternNocase(mpm_ctx, pat, patlen,
                                                          offset, depth,
                                                          pid, sid, flags);
@@ -852,3 +923,97 @@ void MpmRegisterTests(void)
 
 #endif
 }
+
+/***********************************Benchmarks*********************************/
+
+#ifdef BENCHMARKS
+typedef struct MpmBench_ {
+    uint16_t matcher;
+    const char *corpus;
+} MpmBench;
+
+static const char *mpm_bench_corpora[] = { "http", "dns", "tls" };
+#define MPM_BENCH_CORPORA \
+    (sizeof(mpm_bench_corpora) / sizeof(mpm_bench_corpora[0]))
+
+static MpmBench mpm_benches[MPM_TABLE_SIZE * MPM_BENCH_CORPORA];
+
+/** \internal
+ *  \brief search the buffers of a corpus with the full pattern set */
+static int MpmBenchSearch(BenchCtx *b)
+{
+    const MpmBench *mb = b->data;
+    const BenchCorpus *pats = BenchPatternsGet();
+    const BenchCorpus *c = BenchCorpusGet(mb->corpus);
+    if (pats == NULL || c == NULL || c->cnt == 0)
+        return 0;
+
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    memset(&mpm_ctx, 0, sizeof(mpm_ctx));
+    memset(&mpm_thread_ctx, 0, sizeof(mpm_thread_ctx));
+    memset(&pmq, 0, sizeof(pmq));
+
+    MpmInitCtx(&mpm_ctx, mb->matcher);
+    uint32_t i;
+    for (i = 0; i < pats->cnt; i++) {
+        MpmAddPatternCS(&mpm_ctx, pats->bufs[i].buf, (uint16_t)pats->bufs[i].len,
+                0, 0, i, i, 0);
+    }
+    if (mpm_table[mb->matcher].Prepare(&mpm_ctx) != 0) {
+        mpm_table[mb->matcher].DestroyCtx(&mpm_ctx);
+        return 0;
+    }
+    MpmInitThreadCtx(&mpm_thread_ctx, mb->matcher);
+    PmqSetup(&pmq);
+
+    b->bytes = c->size / c->cnt;
+    uint64_t n;
+    uint32_t matches = 0;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        const BenchBuffer *buf = &c->bufs[n % c->cnt];
+        matches += mpm_table[mb->matcher].Search(&mpm_ctx, &mpm_thread_ctx,
+                &pmq, buf->buf, (uint16_t)buf->len);
+        PmqReset(&pmq);
+    }
+    BenchTimerStop(b);
+    SCLogDebug("%u matches", matches);
+
+    mpm_table[mb->matcher].DestroyCtx(&mpm_ctx);
+    mpm_table[mb->matcher].DestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return 1;
+}
+#endif /* BENCHMARKS */
+
+/** \brief register a search benchmark per mpm and corpus */
+void MpmRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    uint32_t cnt = 0;
+    uint16_t m;
+    uint32_t c;
+
+    for (m = 0; m < MPM_TABLE_SIZE; m++) {
+        if (m == MPM_NOTSET || mpm_table[m].name == NULL ||
+            mpm_table[m].Search == NULL)
+            continue;
+#ifdef __SC_CUDA_SUPPORT__
+        /* needs the cuda dispatcher threads */
+        if (m == MPM_AC_CUDA)
+            continue;
+#endif
+        for (c = 0; c < MPM_BENCH_CORPORA; c++) {
+            char name[64];
+            mpm_benches[cnt].matcher = m;
+            mpm_benches[cnt].corpus = mpm_bench_corpora[c];
+            snprintf(name, sizeof(name), "mpm/%s/%s", mpm_table[m].name,
+                    mpm_bench_corpora[c]);
+            BenchRegister(name, MpmBenchSearch, &mpm_benches[cnt]);
+            cnt++;
+        }
+    }
+#endif /* BENCHMARKS */
+}
@@ -38,7 +38,9 @@ enum {
 #endif
     MPM_AC_BS,
     MPM_AC_TILE,
+    MPM_AC_BAND,
     MPM_HS,
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
@@ -102,6 +104,23 @@ typedef struct MpmPattern_ {
     struct MpmPattern_ *next;
 } MpmPattern;
 
+/** ctx enforces pattern offset/depth, so its matches depend on where the
+ *  scanned buffer starts */
+#define MPMCTX_FLAGS_BOUNDED    0x01
+/** ctx is run over reassembled stream data, set up stream mode search if
+ *  the mpm supports it */
+#define MPMCTX_FLAGS_STREAM     0x02
+/** ctx is in the process wide share table of the detect engines */
+#define MPMCTX_FLAGS_SHARED     0x04
+/** ctx is searched with MpmSearchVector(), set up vectored search if the
+ *  mpm supports it */
+#define MPMCTX_FLAGS_VECTOR     0x08
+
+/** header of every mpm's stream state, see MpmTableElmt::SearchStream */
+typedef struct MpmStreamState_ {
+    uint16_t mpm_type;
+} MpmStreamState;
+
 typedef struct MpmCtx_ {
     void *ctx;
     uint16_t mpm_type;
@@ -118,6 +137,9 @@ typedef struct MpmCtx_ {
     uint16_t minlen;
     uint16_t maxlen;
 
+    /* MPMCTX_FLAGS_* */
+    uint32_t flags;
+
     uint32_t memory_cnt;
     uint32_t memory_size;
 
@@ -125,6 +147,13 @@ typedef struct MpmCtx_ {
 
     /* hash used during ctx initialization */
     MpmPattern **init_hash;
+
+    /* hash of all patterns added through MpmAddPatternCS/CI, used to find
+     * an identical ctx in the previous engine on a rule reload */
+    uint64_t fingerprint;
+    /* number of detect engines using this ctx besides the one that built
+     * it. Protected by the mpm store reuse lock. */
+    uint32_t shared_cnt;
 } MpmCtx;
 
 /* if we want to retrieve an unique mpm context from the mpm context factory
@@ -157,6 +186,13 @@ typedef struct MpmCtxFactoryContainer_ {
  *  what is passed through the API */
 #define MPM_PATTERN_CTX_OWNS_ID     0x20
 
+/** Prepare() only touches the ctx it is called for, so different ctxs
+ *  can be prepared concurrently */
+#define MPM_FLAG_PREPARE_THREADSAFE 0x01
+/** only used for ctxs with few patterns, picked by the engine instead
+ *  of through mpm-algo */
+#define MPM_FLAG_SMALL_ONLY         0x02
+
 typedef struct MpmTableElmt_ {
     const char *name;
     void (*InitCtx)(struct MpmCtx_ *);
@@ -180,6 +216,17 @@ typedef struct MpmTableElmt_ {
     int  (*Prepare)(struct MpmCtx_ *);
     uint32_t (*Search)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, const uint8_t *, uint16_t);
     void (*Cleanup)(struct MpmThreadCtx_ *);
+    /** optional stream mode search: only the part of the buffer following
+     *  what was scanned in earlier calls is scanned, with the matcher state
+     *  kept in *state. Matches still inside the buffer are all reported.
+     *
+     *  \param state per stream state, NULL on first call
+     *  \param seq sequence number of the first byte of the buffer */
+    uint32_t (*SearchStream)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, void **state, uint32_t seq, const uint8_t *, uint32_t);
+    void (*StreamStateFree)(void *);
+    /** optional vectored search: the buffers are scanned in one call, as
+     *  if they were one. Matches spanning two buffers may be reported. */
+    uint32_t (*SearchVector)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PatternMatcherQueue *, const uint8_t **, const uint32_t *, uint32_t);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
     void (*RegisterUnittests)(void);
@@ -239,8 +286,13 @@ void PmqFree(PatternMatcherQueue *);
 
 void MpmTableSetup(void);
 void MpmRegisterTests(void);
+void MpmRegisterBenchmarks(void);
 
 void MpmInitCtx(MpmCtx *mpm_ctx, uint16_t matcher);
+void MpmStreamStateFree(void *state);
+uint32_t MpmSearchVector(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PatternMatcherQueue *pmq, const uint8_t **bufs, const uint32_t *lens,
+        uint32_t cnt);
 void MpmInitThreadCtx(MpmThreadCtx *mpm_thread_ctx, uint16_t);
 
 int MpmAddPatternCS(struct MpmCtx_ *mpm_ctx, uint8_t *pat, uint16_t patlen,
@@ -0,0 +1,233 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * MessagePack encoding of EVE records.
+ *
+ * Encodes the jansson objects the loggers build straight into the output
+ * buffer. Numbers are stored in their binary form, so nothing is
+ * formatted as text.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+#include "util-msgpack.h"
+#include "util-unittest.h"
+
+/* grow the buffer by at least this much */
+#define MSGPACK_EXPAND_BY   4096
+
+/* max nesting of objects and arrays */
+#define MSGPACK_MAX_DEPTH   32
+
+/** \internal
+ *  \brief append len bytes, growing the buffer as needed */
+static int MsgPackWrite(MemBuffer **mb, const void *data, uint32_t len)
+{
+    if (MEMBUFFER_OFFSET(*mb) + len >= MEMBUFFER_SIZE(*mb)) {
+        uint32_t need = MEMBUFFER_OFFSET(*mb) + len + 1 - MEMBUFFER_SIZE(*mb);
+        if (MemBufferExpand(mb, MAX(need, MSGPACK_EXPAND_BY)) < 0)
+            return -1;
+    }
+
+    MemBuffer *b = *mb;
+    memcpy(b->buffer + b->offset, data, len);
+    b->offset += len;
+    b->buffer[b->offset] = '\0';
+    return 0;
+}
+
+/** \brief reserve the length prefix of a record
+ *
+ *  \retval 0 ok
+ *  \retval -1 error */
+int MsgPackRecordStart(MemBuffer **buffer)
+{
+    const uint8_t hdr[MSGPACK_RECORD_HDR_LEN] = { 0, 0, 0, 0 };
+    return MsgPackWrite(buffer, hdr, sizeof(hdr));
+}
+
+/** \brief set the length prefix of the record started at 'start' */
+void MsgPackRecordEnd(MemBuffer *buffer, uint32_t start)
+{
+    uint32_t len = MEMBUFFER_OFFSET(buffer) - start - MSGPACK_RECORD_HDR_LEN;
+    MsgPackPutBE32(MEMBUFFER_BUFFER(buffer) + start, len);
+}
+
+#ifdef HAVE_LIBJANSSON
+
+static int MsgPackWriteStr(MemBuffer **mb, const char *str, uint32_t len)
+{
+    uint8_t hdr[MSGPACK_HDR_MAX];
+    uint32_t hlen = MsgPackEncodeStrHeader(hdr, len);
+
+    if (MsgPackWrite(mb, hdr, hlen) < 0)
+        return -1;
+    return MsgPackWrite(mb, str, len);
+}
+
+static int MsgPackEncodeValue(json_t *js, MemBuffer **mb, int depth)
+{
+    uint8_t hdr[MSGPACK_HDR_MAX];
+    uint32_t hlen;
+
+    if (depth > MSGPACK_MAX_DEPTH)
+        return -1;
+
+    switch (json_typeof(js)) {
+        case JSON_OBJECT:
+        {
+            const char *key;
+            json_t *value;
+
+            hlen = MsgPackEncodeMapHeader(hdr, (uint32_t)json_object_size(js));
+            if (MsgPackWrite(mb, hdr, hlen) < 0)
+                return -1;
+            json_object_foreach(js, key, value) {
+                if (MsgPackWriteStr(mb, key, strlen(key)) < 0 ||
+                    MsgPackEncodeValue(value, mb, depth + 1) < 0)
+                    return -1;
+            }
+            return 0;
+        }
+        case JSON_ARRAY:
+        {
+            size_t i;
+
+            hlen = MsgPackEncodeArrayHeader(hdr, (uint32_t)json_array_size(js));
+            if (MsgPackWrite(mb, hdr, hlen) < 0)
+                return -1;
+            for (i = 0; i < json_array_size(js); i++) {
+                if (MsgPackEncodeValue(json_array_get(js, i), mb, depth + 1) < 0)
+                    return -1;
+            }
+            return 0;
+        }
+        case JSON_STRING:
+        {
+            const char *str = json_string_value(js);
+            return MsgPackWriteStr(mb, str, strlen(str));
+        }
+        case JSON_INTEGER:
+            hlen = MsgPackEncodeInt(hdr, (int64_t)json_integer_value(js));
+            break;
+        case JSON_REAL:
+            hlen = MsgPackEncodeDouble(hdr, json_real_value(js));
+            break;
+        case JSON_TRUE:
+            hdr[0] = MSGPACK_TRUE;
+            hlen = 1;
+            break;
+        case JSON_FALSE:
+            hdr[0] = MSGPACK_FALSE;
+            hlen = 1;
+            break;
+        default:
+            hdr[0] = MSGPACK_NIL;
+            hlen = 1;
+            break;
+    }
+    return MsgPackWrite(mb, hdr, hlen);
+}
+
+/** \brief encode a jansson value as MessagePack
+ *
+ *  Keys are written in the object's iteration order, which may differ
+ *  from the insertion order the JSON output preserves.
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, buffer content is incomplete */
+int MsgPackEncodeJson(json_t *js, MemBuffer **buffer)
+{
+    return MsgPackEncodeValue(js, buffer, 0);
+}
+
+#endif /* HAVE_LIBJANSSON */
+
+#ifdef UNITTESTS
+
+/** \test integer encodings at the type boundaries */
+static int MsgPackTest01(void)
+{
+    uint8_t out[MSGPACK_HDR_MAX];
+
+    FAIL_IF_NOT(MsgPackEncodeInt(out, 127) == 1 && out[0] == 0x7f);
+    FAIL_IF_NOT(MsgPackEncodeInt(out, -32) == 1 && out[0] == 0xe0);
+    FAIL_IF_NOT(MsgPackEncodeInt(out, -33) == 2 && out[0] == 0xd0);
+    FAIL_IF_NOT(MsgPackEncodeInt(out, 256) == 3 && out[0] == 0xcd &&
+                out[1] == 0x01 && out[2] == 0x00);
+    FAIL_IF_NOT(MsgPackEncodeInt(out, -40000) == 5 && out[0] == 0xd2);
+    FAIL_IF_NOT(MsgPackEncodeUint(out, 0x100000000ULL) == 9 &&
+                out[0] == 0xcf && out[4] == 0x01 && out[5] == 0x00);
+    FAIL_IF_NOT(MsgPackEncodeStrHeader(out, 31) == 1 && out[0] == 0xbf);
+    FAIL_IF_NOT(MsgPackEncodeStrHeader(out, 32) == 2 && out[0] == 0xd9);
+    FAIL_IF_NOT(MsgPackEncodeMapHeader(out, 16) == 3 && out[0] == 0xde);
+    PASS;
+}
+
+#ifdef HAVE_LIBJANSSON
+/** \test a framed record from a jansson object */
+static int MsgPackTest02(void)
+{
+    MemBuffer *mb = MemBufferCreateNew(8);
+    FAIL_IF_NULL(mb);
+
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_t *a = json_array();
+    FAIL_IF_NULL(a);
+    json_array_append_new(a, json_integer(1));
+    json_array_append_new(a, json_integer(-1));
+    json_array_append_new(a, json_integer(-40));
+    json_array_append_new(a, json_integer(200));
+    json_array_append_new(a, json_integer(70000));
+    json_array_append_new(a, json_string("ab"));
+    json_array_append_new(a, json_true());
+    json_array_append_new(a, json_null());
+    json_object_set_new(js, "k", a);
+
+    FAIL_IF(MsgPackRecordStart(&mb) != 0);
+    FAIL_IF(MsgPackEncodeJson(js, &mb) != 0);
+    MsgPackRecordEnd(mb, 0);
+
+    const uint8_t expect[] = {
+        0x00, 0x00, 0x00, 0x14,
+        0x81, 0xa1, 'k', 0x98, 0x01, 0xff, 0xd0, 0xd8, 0xcc, 0xc8,
+        0xce, 0x00, 0x01, 0x11, 0x70, 0xa2, 'a', 'b', 0xc3, 0xc0 };
+    FAIL_IF(MEMBUFFER_OFFSET(mb) != sizeof(expect));
+    FAIL_IF(memcmp(MEMBUFFER_BUFFER(mb), expect, sizeof(expect)) != 0);
+
+    json_decref(js);
+    MemBufferFree(mb);
+    PASS;
+}
+#endif /* HAVE_LIBJANSSON */
+
+#endif /* UNITTESTS */
+
+void MsgPackRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MsgPackTest01", MsgPackTest01);
+#ifdef HAVE_LIBJANSSON
+    UtRegisterTest("MsgPackTest02", MsgPackTest02);
+#endif
+#endif /* UNITTESTS */
+}
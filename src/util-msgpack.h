@@ -0,0 +1,185 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * MessagePack encoding of EVE records.
+ *
+ * Records are framed by a 4 byte big endian length of the MessagePack
+ * data that follows, so a stream of them can be split without parsing.
+ */
+
+#ifndef __UTIL_MSGPACK_H__
+#define __UTIL_MSGPACK_H__
+
+#include "util-buffer.h"
+
+/** size of the record length prefix */
+#define MSGPACK_RECORD_HDR_LEN  4
+
+/** max bytes the header of a single value takes */
+#define MSGPACK_HDR_MAX         9
+
+#define MSGPACK_NIL     0xc0
+#define MSGPACK_FALSE   0xc2
+#define MSGPACK_TRUE    0xc3
+#define MSGPACK_MAP32   0xdf
+#define MSGPACK_ARRAY32 0xdd
+
+static inline void MsgPackPutBE16(uint8_t *out, uint16_t v)
+{
+    out[0] = (uint8_t)(v >> 8);
+    out[1] = (uint8_t)v;
+}
+
+static inline void MsgPackPutBE32(uint8_t *out, uint32_t v)
+{
+    out[0] = (uint8_t)(v >> 24);
+    out[1] = (uint8_t)(v >> 16);
+    out[2] = (uint8_t)(v >> 8);
+    out[3] = (uint8_t)v;
+}
+
+static inline void MsgPackPutBE64(uint8_t *out, uint64_t v)
+{
+    MsgPackPutBE32(out, (uint32_t)(v >> 32));
+    MsgPackPutBE32(out + 4, (uint32_t)v);
+}
+
+/* The encoders below write the value (or header) to 'out', which needs
+ * room for MSGPACK_HDR_MAX bytes, and return the number of bytes used. */
+
+static inline uint32_t MsgPackEncodeUint(uint8_t *out, uint64_t v)
+{
+    if (v < 0x80) {
+        out[0] = (uint8_t)v;
+        return 1;
+    } else if (v <= 0xff) {
+        out[0] = 0xcc;
+        out[1] = (uint8_t)v;
+        return 2;
+    } else if (v <= 0xffff) {
+        out[0] = 0xcd;
+        MsgPackPutBE16(out + 1, (uint16_t)v);
+        return 3;
+    } else if (v <= 0xffffffffULL) {
+        out[0] = 0xce;
+        MsgPackPutBE32(out + 1, (uint32_t)v);
+        return 5;
+    }
+    out[0] = 0xcf;
+    MsgPackPutBE64(out + 1, v);
+    return 9;
+}
+
+static inline uint32_t MsgPackEncodeInt(uint8_t *out, int64_t v)
+{
+    if (v >= 0) {
+        return MsgPackEncodeUint(out, (uint64_t)v);
+    } else if (v >= -32) {
+        out[0] = (uint8_t)v;
+        return 1;
+    } else if (v >= INT8_MIN) {
+        out[0] = 0xd0;
+        out[1] = (uint8_t)v;
+        return 2;
+    } else if (v >= INT16_MIN) {
+        out[0] = 0xd1;
+        MsgPackPutBE16(out + 1, (uint16_t)v);
+        return 3;
+    } else if (v >= INT32_MIN) {
+        out[0] = 0xd2;
+        MsgPackPutBE32(out + 1, (uint32_t)v);
+        return 5;
+    }
+    out[0] = 0xd3;
+    MsgPackPutBE64(out + 1, (uint64_t)v);
+    return 9;
+}
+
+static inline uint32_t MsgPackEncodeDouble(uint8_t *out, double v)
+{
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    out[0] = 0xcb;
+    MsgPackPutBE64(out + 1, u);
+    return 9;
+}
+
+/** \brief header of a string of 'len' bytes, the bytes follow it */
+static inline uint32_t MsgPackEncodeStrHeader(uint8_t *out, uint32_t len)
+{
+    if (len < 32) {
+        out[0] = 0xa0 | (uint8_t)len;
+        return 1;
+    } else if (len <= 0xff) {
+        out[0] = 0xd9;
+        out[1] = (uint8_t)len;
+        return 2;
+    } else if (len <= 0xffff) {
+        out[0] = 0xda;
+        MsgPackPutBE16(out + 1, (uint16_t)len);
+        return 3;
+    }
+    out[0] = 0xdb;
+    MsgPackPutBE32(out + 1, len);
+    return 5;
+}
+
+/** \brief header of a map of 'n' key/value pairs */
+static inline uint32_t MsgPackEncodeMapHeader(uint8_t *out, uint32_t n)
+{
+    if (n < 16) {
+        out[0] = 0x80 | (uint8_t)n;
+        return 1;
+    } else if (n <= 0xffff) {
+        out[0] = 0xde;
+        MsgPackPutBE16(out + 1, (uint16_t)n);
+        return 3;
+    }
+    out[0] = MSGPACK_MAP32;
+    MsgPackPutBE32(out + 1, n);
+    return 5;
+}
+
+/** \brief header of an array of 'n' values */
+static inline uint32_t MsgPackEncodeArrayHeader(uint8_t *out, uint32_t n)
+{
+    if (n < 16) {
+        out[0] = 0x90 | (uint8_t)n;
+        return 1;
+    } else if (n <= 0xffff) {
+        out[0] = 0xdc;
+        MsgPackPutBE16(out + 1, (uint16_t)n);
+        return 3;
+    }
+    out[0] = MSGPACK_ARRAY32;
+    MsgPackPutBE32(out + 1, n);
+    return 5;
+}
+
+int MsgPackRecordStart(MemBuffer **buffer);
+void MsgPackRecordEnd(MemBuffer *buffer, uint32_t start);
+
+#ifdef HAVE_LIBJANSSON
+int MsgPackEncodeJson(json_t *js, MemBuffer **buffer);
+#endif
+
+void MsgPackRegisterTests(void);
+
+#endif /* __UTIL_MSGPACK_H__ */
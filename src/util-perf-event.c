@@ -0,0 +1,275 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled hardware performance counters per thread module and flow
+ * worker stage
+ *
+ * Each packet thread opens a perf_event group of cycles, instructions,
+ * last level cache misses and branch misses, counting user space only.
+ * One in sample-rate slot runs is measured by reading the group before
+ * and after the slot; the flow worker additionally splits its sampled
+ * runs into its stages. The deltas are added to 'perf.<section>.*'
+ * stats counters of the thread, so they are merged and logged like all
+ * other counters.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tm-modules.h"
+#include "flow-worker.h"
+#include "util-debug.h"
+#include "util-perf-event.h"
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#endif
+
+#define PERF_EVENT_SAMPLE_RATE_DEFAULT  1024
+
+uint32_t perf_event_sample_rate = PERF_EVENT_SAMPLE_RATE_DEFAULT;
+
+static int perf_event_enabled = 0;
+
+/** counter names, alloc'd once as the counter api keeps the pointers */
+static char *perf_event_names[PERF_EVENT_SECTIONS][PERF_EVENT_MAX + 1];
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static const char *perf_event_type_names[PERF_EVENT_MAX + 1] = {
+    "samples",
+    "cycles",
+    "instructions",
+    "llc_misses",
+    "branch_misses",
+};
+
+/** \internal
+ *  \brief name of a section in the counter names, e.g. 'decodepcap'
+ *         or 'flowworker.detect' */
+static void PerfEventSectionName(int section, char *name, size_t size)
+{
+    if (section < TMM_SIZE) {
+        const char *tmm = TmModuleTmmIdToString(section);
+        if (strncmp(tmm, "TMM_", 4) == 0)
+            tmm += 4;
+        size_t i;
+        for (i = 0; i < size - 1 && tmm[i] != '\0'; i++)
+            name[i] = u8_tolower(tmm[i]);
+        name[i] = '\0';
+    } else {
+        snprintf(name, size, "flowworker.%s",
+                ProfileFlowWorkerIdToString(section - TMM_SIZE));
+    }
+}
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+void PerfEventInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("perf-counters.enabled", &enabled) != 1 || !enabled)
+        return;
+
+#ifndef HAVE_LINUX_PERF_EVENT_H
+    SCLogWarning(SC_ERR_NO_PERF_EVENT_SUPPORT, "perf-counters enabled, but "
+            "this build has no perf_event support");
+    return;
+#else
+    intmax_t rate = 0;
+    if (ConfGetInt("perf-counters.sample-rate", &rate) == 1) {
+        if (rate < 1 || rate > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "perf-counters.sample-rate "
+                    "must be 1 or higher, using %u", PERF_EVENT_SAMPLE_RATE_DEFAULT);
+        } else {
+            perf_event_sample_rate = (uint32_t)rate;
+        }
+    }
+
+    int section;
+    for (section = 0; section < PERF_EVENT_SECTIONS; section++) {
+        char sname[64];
+        PerfEventSectionName(section, sname, sizeof(sname));
+
+        int t;
+        for (t = 0; t <= PERF_EVENT_MAX; t++) {
+            char name[128];
+            snprintf(name, sizeof(name), "perf.%s.%s", sname, perf_event_type_names[t]);
+            perf_event_names[section][t] = SCStrdup(name);
+            if (perf_event_names[section][t] == NULL) {
+                PerfEventDestroy();
+                return;
+            }
+        }
+    }
+
+    perf_event_enabled = 1;
+    SCLogConfig("perf-counters: sampling 1 in %u module runs", perf_event_sample_rate);
+#endif
+}
+
+void PerfEventDestroy(void)
+{
+    perf_event_enabled = 0;
+
+    int section, t;
+    for (section = 0; section < PERF_EVENT_SECTIONS; section++) {
+        for (t = 0; t <= PERF_EVENT_MAX; t++) {
+            if (perf_event_names[section][t] != NULL) {
+                SCFree(perf_event_names[section][t]);
+                perf_event_names[section][t] = NULL;
+            }
+        }
+    }
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static int PerfEventOpen(uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/** \internal
+ *  \brief register the counters of a section for this thread */
+static void PerfEventRegisterSection(ThreadVars *tv, PerfEventThreadCtx *ctx, int section)
+{
+    int t;
+    for (t = 0; t <= PERF_EVENT_MAX; t++) {
+        ctx->ids[section][t] = StatsRegisterCounter(perf_event_names[section][t], tv);
+    }
+}
+#endif /* HAVE_LINUX_PERF_EVENT_H */
+
+/** \brief open the counters of the calling thread
+ *
+ *  Called by the packet threads after their slots are set up and before
+ *  StatsSetupPrivate(), as it registers the counters of the thread's
+ *  modules.
+ */
+void PerfEventThreadInit(ThreadVars *tv)
+{
+    if (!perf_event_enabled)
+        return;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    static const uint64_t configs[PERF_EVENT_MAX] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    PerfEventThreadCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (unlikely(ctx == NULL))
+        return;
+
+    int t;
+    for (t = 0; t < PERF_EVENT_MAX; t++) {
+        ctx->fds[t] = PerfEventOpen(configs[t], t == 0 ? -1 : ctx->fds[0]);
+        if (ctx->fds[t] < 0) {
+            SCLogWarning(SC_ERR_NO_PERF_EVENT_SUPPORT, "%s: perf_event_open "
+                    "of %s failed: %s. Check kernel.perf_event_paranoid",
+                    tv->name, perf_event_type_names[t + 1], strerror(errno));
+            while (--t >= 0)
+                close(ctx->fds[t]);
+            SCFree(ctx);
+            return;
+        }
+    }
+    ctx->sample_cnt = perf_event_sample_rate;
+
+    TmSlot *s;
+    for (s = tv->tm_slots; s != NULL; s = s->slot_next) {
+        if (s->tm_id < 0 || s->tm_id >= TMM_SIZE)
+            continue;
+        PerfEventRegisterSection(tv, ctx, PERF_EVENT_TMM(s->tm_id));
+        if (s->tm_id == TMM_FLOWWORKER) {
+            int fw;
+            for (fw = 0; fw < PROFILE_FLOWWORKER_SIZE; fw++)
+                PerfEventRegisterSection(tv, ctx, PERF_EVENT_FW(fw));
+        }
+    }
+
+    tv->perf_event_ctx = ctx;
+#endif
+}
+
+void PerfEventThreadDeinit(ThreadVars *tv)
+{
+    PerfEventThreadCtx *ctx = tv->perf_event_ctx;
+    if (ctx == NULL)
+        return;
+
+    tv->perf_event_ctx = NULL;
+    int t;
+    for (t = PERF_EVENT_MAX - 1; t >= 0; t--)
+        close(ctx->fds[t]);
+    SCFree(ctx);
+}
+
+/** \brief read the current values of the group
+ *
+ *  \retval 0 ok, -1 read failed
+ */
+int PerfEventRead(const PerfEventThreadCtx *ctx, PerfEventSample *s)
+{
+    /* PERF_FORMAT_GROUP: nr, then the values in the order of opening */
+    uint64_t buf[1 + PERF_EVENT_MAX];
+    if (read(ctx->fds[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf) ||
+            buf[0] != PERF_EVENT_MAX)
+        return -1;
+
+    memcpy(s->v, &buf[1], sizeof(s->v));
+    return 0;
+}
+
+/** \brief add the counts since the start or the last mark to a section
+ *
+ *  The sample is updated, so the next section of the same run can be
+ *  marked with it.
+ */
+void PerfEventSampleMark(ThreadVars *tv, PerfEventSample *s, int section)
+{
+    PerfEventThreadCtx *ctx = tv->perf_event_ctx;
+    PerfEventSample now;
+
+    if (ctx == NULL || PerfEventRead(ctx, &now) != 0)
+        return;
+
+    const uint16_t *ids = ctx->ids[section];
+    if (ids[0] != 0) {
+        StatsIncr(tv, ids[0]);
+        int t;
+        for (t = 0; t < PERF_EVENT_MAX; t++) {
+            StatsAddUI64(tv, ids[t + 1], now.v[t] - s->v[t]);
+        }
+    }
+    *s = now;
+}
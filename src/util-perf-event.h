@@ -0,0 +1,81 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled hardware performance counters per thread module and flow
+ * worker stage
+ */
+
+#ifndef __UTIL_PERF_EVENT_H__
+#define __UTIL_PERF_EVENT_H__
+
+#include "tm-threads-common.h"
+#include "flow-worker.h"
+
+enum PerfEventType {
+    PERF_EVENT_CYCLES = 0,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_LLC_MISSES,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_EVENT_MAX,
+};
+
+/** a measured section: a thread module or a flow worker stage */
+#define PERF_EVENT_TMM(tmm_id)      (tmm_id)
+#define PERF_EVENT_FW(fw_id)        (TMM_SIZE + (fw_id))
+#define PERF_EVENT_SECTIONS         (TMM_SIZE + PROFILE_FLOWWORKER_SIZE)
+
+/** counter values at the start of a sample */
+typedef struct PerfEventSample_ {
+    uint64_t v[PERF_EVENT_MAX];
+} PerfEventSample;
+
+typedef struct PerfEventThreadCtx_ {
+    int fds[PERF_EVENT_MAX];        /**< fds[0] is the group leader */
+    uint32_t sample_cnt;            /**< sections until the next sample */
+    /** stats counter ids per section: the samples, then one per event.
+     *  0 if the section doesn't run in this thread. */
+    uint16_t ids[PERF_EVENT_SECTIONS][PERF_EVENT_MAX + 1];
+} PerfEventThreadCtx;
+
+extern uint32_t perf_event_sample_rate;
+
+void PerfEventInit(void);
+void PerfEventDestroy(void);
+void PerfEventThreadInit(ThreadVars *tv);
+void PerfEventThreadDeinit(ThreadVars *tv);
+int PerfEventRead(const PerfEventThreadCtx *ctx, PerfEventSample *s);
+void PerfEventSampleMark(ThreadVars *tv, PerfEventSample *s, int section);
+
+/** \brief decide if this run of a section is sampled, start reading if so
+ *
+ *  \retval 1 sampled, call PerfEventSampleMark() after the section
+ */
+static inline int PerfEventSampleStart(ThreadVars *tv, PerfEventSample *s)
+{
+    PerfEventThreadCtx *ctx = tv->perf_event_ctx;
+    if (likely(ctx == NULL))
+        return 0;
+    if (--ctx->sample_cnt != 0)
+        return 0;
+    ctx->sample_cnt = perf_event_sample_rate;
+    return PerfEventRead(ctx, s) == 0;
+}
+
+#endif /* __UTIL_PERF_EVENT_H__ */
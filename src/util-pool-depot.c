@@ -0,0 +1,414 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \defgroup utilpool Pool
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * Pool depot with per thread magazines
+ */
+
+#include "suricata-common.h"
+#include "threads.h"
+#include "util-pool.h"
+#include "util-pool-depot.h"
+#include "util-lock-stats.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+
+/** all live depots by id. Ids are never reused, so a magazine slot
+ *  always belongs to the same depot, even after it has been freed. */
+static SCMutex depot_registry_lock = SCMUTEX_INITIALIZER;
+static PoolDepot **depot_registry = NULL;
+static uint32_t depot_registry_size = 0;
+
+#ifdef TLS
+typedef struct PoolDepotMagazine_ {
+    PoolDepot *depot;
+    uint32_t cnt;
+    void **objs;        /**< room for 2 * batch + 1 objects */
+} PoolDepotMagazine;
+
+/** this thread's magazines, indexed by depot id */
+static __thread PoolDepotMagazine *depot_mags = NULL;
+static __thread uint32_t depot_mags_num = 0;
+#endif
+
+PoolDepot *PoolDepotInit(uint32_t batch, uint32_t size, uint32_t prealloc_size, uint32_t elt_size, void *(*Alloc)(), int (*Init)(void *, void *), void *InitData, void (*Cleanup)(void *), void (*Free)(void *))
+{
+    PoolDepot *d = SCMalloc(sizeof(*d));
+    if (unlikely(d == NULL))
+        return NULL;
+    memset(d, 0x00, sizeof(*d));
+
+    d->pool = PoolInit(size, prealloc_size, elt_size, Alloc, Init, InitData,
+            Cleanup, Free);
+    if (d->pool == NULL) {
+        SCFree(d);
+        return NULL;
+    }
+    SCMutexInit(&d->m, NULL);
+    d->batch = batch;
+
+    SCMutexLock(&depot_registry_lock);
+    PoolDepot **ptmp = SCRealloc(depot_registry,
+            (depot_registry_size + 1) * sizeof(PoolDepot *));
+    if (ptmp == NULL) {
+        SCMutexUnlock(&depot_registry_lock);
+        SCMutexDestroy(&d->m);
+        PoolFree(d->pool);
+        SCFree(d);
+        return NULL;
+    }
+    depot_registry = ptmp;
+    d->id = depot_registry_size++;
+    depot_registry[d->id] = d;
+    SCMutexUnlock(&depot_registry_lock);
+
+    SCLogDebug("depot %u: batch %u", d->id, d->batch);
+    return d;
+}
+
+#ifdef TLS
+/**
+ *  \internal
+ *  \brief get the calling thread's magazine for the depot, set it up on
+ *         first use
+ *
+ *  \retval m magazine or NULL if the depot is used without them
+ */
+static PoolDepotMagazine *PoolDepotGetMagazine(PoolDepot *d)
+{
+    if (d->batch == 0)
+        return NULL;
+
+    if (unlikely(d->id >= depot_mags_num)) {
+        uint32_t num = d->id + 1;
+        PoolDepotMagazine *ptmp = SCRealloc(depot_mags, num * sizeof(*ptmp));
+        if (ptmp == NULL)
+            return NULL;
+        memset(ptmp + depot_mags_num, 0x00,
+                (num - depot_mags_num) * sizeof(*ptmp));
+        depot_mags = ptmp;
+        depot_mags_num = num;
+    }
+
+    PoolDepotMagazine *m = &depot_mags[d->id];
+    if (unlikely(m->objs == NULL)) {
+        m->objs = SCMalloc((2 * d->batch + 1) * sizeof(void *));
+        if (m->objs == NULL)
+            return NULL;
+        m->depot = d;
+        m->cnt = 0;
+    }
+    return m;
+}
+
+/** \internal \brief hand up to 'n' objects of the magazine to the pool */
+static void PoolDepotDrain(PoolDepot *d, PoolDepotMagazine *m, uint32_t n)
+{
+    SCMutexLockSite(&d->m, LOCK_SITE_POOL);
+    while (n-- > 0 && m->cnt > 0) {
+        PoolReturn(d->pool, m->objs[--m->cnt]);
+    }
+    SCMutexUnlock(&d->m);
+}
+
+/**
+ *  \internal
+ *  \brief refill the magazine and get an object
+ *
+ *  Only objects the pool has ready are moved, so a thread doesn't
+ *  allocate ahead of the pool size. If there are none, a single object
+ *  is gotten from the pool as without a magazine.
+ */
+static void *PoolDepotRefill(PoolDepot *d, PoolDepotMagazine *m)
+{
+    void *data = NULL;
+
+    SCMutexLockSite(&d->m, LOCK_SITE_POOL);
+    if (d->pool->alloc_stack_size == 0) {
+        data = PoolGet(d->pool);
+    } else {
+        while (m->cnt < d->batch && d->pool->alloc_stack_size > 0) {
+            void *obj = PoolGet(d->pool);
+            if (obj == NULL)
+                break;
+            m->objs[m->cnt++] = obj;
+        }
+    }
+    SCMutexUnlock(&d->m);
+
+    if (data == NULL && m->cnt > 0)
+        data = m->objs[--m->cnt];
+    return data;
+}
+#endif /* TLS */
+
+void *PoolDepotGet(PoolDepot *d)
+{
+#ifdef TLS
+    PoolDepotMagazine *m = PoolDepotGetMagazine(d);
+    if (likely(m != NULL)) {
+        if (m->cnt > 0)
+            return m->objs[--m->cnt];
+        return PoolDepotRefill(d, m);
+    }
+#endif
+    SCMutexLockSite(&d->m, LOCK_SITE_POOL);
+    void *data = PoolGet(d->pool);
+    SCMutexUnlock(&d->m);
+    return data;
+}
+
+void PoolDepotReturn(PoolDepot *d, void *data)
+{
+#ifdef TLS
+    PoolDepotMagazine *m = PoolDepotGetMagazine(d);
+    if (likely(m != NULL)) {
+        m->objs[m->cnt++] = data;
+        if (m->cnt > 2 * d->batch)
+            PoolDepotDrain(d, m, d->batch);
+        return;
+    }
+#endif
+    SCMutexLockSite(&d->m, LOCK_SITE_POOL);
+    PoolReturn(d->pool, data);
+    SCMutexUnlock(&d->m);
+}
+
+void PoolDepotThreadFlush(void)
+{
+#ifdef TLS
+    uint32_t i;
+
+    if (depot_mags == NULL)
+        return;
+
+    SCMutexLock(&depot_registry_lock);
+    for (i = 0; i < depot_mags_num; i++) {
+        PoolDepotMagazine *m = &depot_mags[i];
+        if (m->objs == NULL)
+            continue;
+        /* objects of a freed depot can't go anywhere */
+        if (m->cnt > 0 && i < depot_registry_size &&
+            depot_registry[i] == m->depot)
+        {
+            PoolDepotDrain(m->depot, m, m->cnt);
+        }
+        SCFree(m->objs);
+    }
+    SCMutexUnlock(&depot_registry_lock);
+
+    SCFree(depot_mags);
+    depot_mags = NULL;
+    depot_mags_num = 0;
+#endif
+}
+
+void PoolDepotFree(PoolDepot *d)
+{
+    if (d == NULL)
+        return;
+
+    SCMutexLock(&depot_registry_lock);
+    depot_registry[d->id] = NULL;
+    SCMutexUnlock(&depot_registry_lock);
+
+#ifdef TLS
+    if (d->id < depot_mags_num && depot_mags[d->id].objs != NULL) {
+        PoolDepotMagazine *m = &depot_mags[d->id];
+        PoolDepotDrain(d, m, m->cnt);
+        SCFree(m->objs);
+        m->objs = NULL;
+    }
+#endif
+
+    SCMutexLockSite(&d->m, LOCK_SITE_POOL);
+    PoolFree(d->pool);
+    SCMutexUnlock(&d->m);
+    SCMutexDestroy(&d->m);
+    SCFree(d);
+}
+
+#ifdef UNITTESTS
+static void *PoolDepotTestAlloc(void)
+{
+    return SCMalloc(64);
+}
+
+static void PoolDepotTestFree(void *data)
+{
+    SCFree(data);
+}
+
+static int PoolDepotTestGet01(void)
+{
+    int result = 0;
+    PoolDepot *d = PoolDepotInit(4, 0, 10, 0, PoolDepotTestAlloc, NULL, NULL,
+            NULL, PoolDepotTestFree);
+    if (d == NULL)
+        return 0;
+
+    void *data = PoolDepotGet(d);
+    if (data == NULL) {
+        printf("data == NULL: ");
+        goto end;
+    }
+#ifdef TLS
+    /* a batch left the pool */
+    if (d->pool->outstanding != 4) {
+        printf("outstanding %u, expected 4: ", d->pool->outstanding);
+        goto end;
+    }
+#endif
+    PoolDepotReturn(d, data);
+    PoolDepotThreadFlush();
+
+    if (d->pool->outstanding != 0) {
+        printf("outstanding %u after flush: ", d->pool->outstanding);
+        goto end;
+    }
+
+    result = 1;
+end:
+    PoolDepotFree(d);
+    return result;
+}
+
+/** \test magazines don't hold on to more than twice the batch */
+static int PoolDepotTestReturn01(void)
+{
+    int result = 0;
+    void *data[20];
+    int i;
+
+    PoolDepot *d = PoolDepotInit(4, 0, 10, 0, PoolDepotTestAlloc, NULL, NULL,
+            NULL, PoolDepotTestFree);
+    if (d == NULL)
+        return 0;
+
+    for (i = 0; i < 20; i++) {
+        data[i] = PoolDepotGet(d);
+        if (data[i] == NULL) {
+            printf("get %d failed: ", i);
+            goto end;
+        }
+    }
+    if (d->pool->outstanding != 20) {
+        printf("outstanding %u, expected 20: ", d->pool->outstanding);
+        goto end;
+    }
+
+    for (i = 0; i < 20; i++) {
+        PoolDepotReturn(d, data[i]);
+    }
+#ifdef TLS
+    if (d->pool->outstanding > 2 * d->batch) {
+        printf("outstanding %u, expected at most %u: ",
+                d->pool->outstanding, 2 * d->batch);
+        goto end;
+    }
+#else
+    if (d->pool->outstanding != 0) {
+        printf("outstanding %u, expected 0: ", d->pool->outstanding);
+        goto end;
+    }
+#endif
+    PoolDepotThreadFlush();
+    if (d->pool->outstanding != 0) {
+        printf("outstanding %u after flush: ", d->pool->outstanding);
+        goto end;
+    }
+
+    result = 1;
+end:
+    PoolDepotFree(d);
+    return result;
+}
+
+struct PoolDepotTestReturner {
+    PoolDepot *d;
+    void **data;
+    int cnt;
+};
+
+static void *PoolDepotTestReturner(void *arg)
+{
+    struct PoolDepotTestReturner *r = arg;
+    int i;
+    for (i = 0; i < r->cnt; i++) {
+        PoolDepotReturn(r->d, r->data[i]);
+    }
+    PoolDepotThreadFlush();
+    return NULL;
+}
+
+/** \test objects returned by another thread end up in the pool */
+static int PoolDepotTestReturn02(void)
+{
+    int result = 0;
+    void *data[16];
+    int i;
+
+    PoolDepot *d = PoolDepotInit(4, 0, 16, 0, PoolDepotTestAlloc, NULL, NULL,
+            NULL, PoolDepotTestFree);
+    if (d == NULL)
+        return 0;
+
+    for (i = 0; i < 16; i++) {
+        data[i] = PoolDepotGet(d);
+        if (data[i] == NULL)
+            goto end;
+    }
+    PoolDepotThreadFlush();
+
+    struct PoolDepotTestReturner r = { d, data, 16 };
+    pthread_t t;
+    if (pthread_create(&t, NULL, PoolDepotTestReturner, &r) != 0)
+        goto end;
+    pthread_join(t, NULL);
+
+    if (d->pool->outstanding != 0) {
+        printf("outstanding %u, expected 0: ", d->pool->outstanding);
+        goto end;
+    }
+
+    result = 1;
+end:
+    PoolDepotFree(d);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void PoolDepotRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PoolDepotTestGet01", PoolDepotTestGet01);
+    UtRegisterTest("PoolDepotTestReturn01", PoolDepotTestReturn01);
+    UtRegisterTest("PoolDepotTestReturn02", PoolDepotTestReturn02);
+#endif /* UNITTESTS */
+}
+
+/**
+ * @}
+ */
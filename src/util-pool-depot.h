@@ -0,0 +1,75 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \defgroup utilpool Pool
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * A lock protected Pool, the depot, with a per thread magazine of
+ * objects in front of it.
+ *
+ * Gets and returns go to the calling thread's magazine. The depot lock
+ * is only taken to move 'batch' objects between a magazine and the
+ * pool, so objects freed by another thread than the one that got them
+ * flow back in batches too. Objects are not changed by the API, so any
+ * data type can be used.
+ *
+ * Objects in magazines count as outstanding in the pool. Threads call
+ * PoolDepotThreadFlush() before they exit to hand theirs back.
+ */
+
+#ifndef __UTIL_POOL_DEPOT_H__
+#define __UTIL_POOL_DEPOT_H__
+
+#include "util-pool.h"
+
+typedef struct PoolDepot_ {
+    Pool *pool;         /**< protected by m */
+    SCMutex m;
+    uint32_t id;        /**< slot of the depot in the thread magazines */
+    uint32_t batch;     /**< objects moved between magazine and pool at once */
+} PoolDepot;
+
+/** \brief initialize a depot
+ *  \note same as PoolInit() except for "batch"
+ *  \param batch objects moved at once, magazines hold up to twice that
+ *  \retval d depot or NULL on error */
+PoolDepot *PoolDepotInit(uint32_t batch, uint32_t size, uint32_t prealloc_size, uint32_t elt_size, void *(*Alloc)(), int (*Init)(void *, void *), void *InitData, void (*Cleanup)(void *), void (*Free)(void *));
+
+/** \brief destroy the depot
+ *  \note the calling thread's magazine is flushed first, objects in the
+ *        magazines of other threads are left alone */
+void PoolDepotFree(PoolDepot *d);
+
+void *PoolDepotGet(PoolDepot *d);
+void PoolDepotReturn(PoolDepot *d, void *data);
+
+/** \brief hand the objects in all magazines of the calling thread back */
+void PoolDepotThreadFlush(void);
+
+void PoolDepotRegisterTests(void);
+
+#endif /* __UTIL_POOL_DEPOT_H__ */
+
+/**
+ * @}
+ */
@@ -57,18 +57,17 @@ PoolThread *PoolThreadInit(int threads, uint32_t size, uint32_t prealloc_size, u
         SCLogDebug("memory alloc error");
         goto error;
     }
+    memset(pt->array, 0x00, threads * sizeof(PoolThreadElement));
     pt->size = threads;
 
     for (i = 0; i < threads; i++) {
         PoolThreadElement *e = &pt->array[i];
 
-        SCMutexInit(&e->lock, NULL);
-        SCMutexLock(&e->lock);
+        SC_ATOMIC_INIT(e->returned);
 //        SCLogDebug("size %u prealloc_size %u elt_size %u Alloc %p Init %p InitData %p Cleanup %p Free %p",
 //                size, prealloc_size, elt_size,
 //                Alloc, Init, InitData, Cleanup, Free);
         e->pool = PoolInit(size, prealloc_size, elt_size, Alloc, Init, InitData, Cleanup, Free);
-        SCMutexUnlock(&e->lock);
         if (e->pool == NULL) {
             SCLogDebug("error");
             goto error;
@@ -111,10 +110,8 @@ int PoolThreadGrow(PoolThread *pt, uint32_t size, uint32_t prealloc_size, uint32
 
     e = &pt->array[newsize - 1];
     memset(e, 0x00, sizeof(*e));
-    SCMutexInit(&e->lock, NULL);
-    SCMutexLock(&e->lock);
+    SC_ATOMIC_INIT(e->returned);
     e->pool = PoolInit(size, prealloc_size, elt_size, Alloc, Init, InitData, Cleanup, Free);
-    SCMutexUnlock(&e->lock);
     if (e->pool == NULL) {
         SCLogError(SC_ERR_POOL_INIT, "pool grow failed");
         return -1;
@@ -123,6 +120,31 @@ int PoolThreadGrow(PoolThread *pt, uint32_t size, uint32_t prealloc_size, uint32
     return (int)(newsize - 1);
 }
 
+/**
+ *  \internal
+ *  \brief move the data returned by other threads back into the pool
+ */
+static void PoolThreadTakeReturned(PoolThreadElement *e)
+{
+    PoolThreadReserved *list;
+
+    if (SC_ATOMIC_GET(e->returned) == NULL)
+        return;
+
+    /* take the whole list. Other threads only push, so the head we
+     * swap out can't have been removed in the meantime */
+    do {
+        list = SC_ATOMIC_GET(e->returned);
+    } while (SC_ATOMIC_CAS(&e->returned, list, NULL) == 0);
+
+    while (list != NULL) {
+        PoolThreadReserved *next = list->next;
+        list->next = NULL;
+        PoolReturn(e->pool, list);
+        list = next;
+    }
+}
+
 int PoolThreadSize(PoolThread *pt)
 {
     if (pt == NULL)
@@ -140,10 +162,11 @@ void PoolThreadFree(PoolThread *pt)
     if (pt->array != NULL) {
         for (i = 0; i < (int)pt->size; i++) {
             PoolThreadElement *e = &pt->array[i];
-            SCMutexLock(&e->lock);
-            PoolFree(e->pool);
-            SCMutexUnlock(&e->lock);
-            SCMutexDestroy(&e->lock);
+            if (e->pool != NULL) {
+                PoolThreadTakeReturned(e);
+                PoolFree(e->pool);
+            }
+            SC_ATOMIC_DESTROY(e->returned);
         }
         SCFree(pt->array);
     }
@@ -158,12 +181,12 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id)
         return NULL;
 
     PoolThreadElement *e = &pt->array[id];
-    SCMutexLock(&e->lock);
+    PoolThreadTakeReturned(e);
     data = PoolGet(e->pool);
-    SCMutexUnlock(&e->lock);
     if (data) {
         PoolThreadReserved *did = data;
-        *did = id;
+        did->next = NULL;
+        did->id = id;
     }
 
     return data;
@@ -171,17 +194,19 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id)
 
 void PoolThreadReturn(PoolThread *pt, void *data)
 {
-    PoolThreadReserved *id = data;
+    PoolThreadReserved *res = data;
+    PoolThreadReserved *head;
 
-    if (pt == NULL || *id >= pt->size)
+    if (pt == NULL || res->id >= pt->size)
         return;
 
-    SCLogDebug("returning to id %u", *id);
+    SCLogDebug("returning to id %u", res->id);
 
-    PoolThreadElement *e = &pt->array[*id];
-    SCMutexLock(&e->lock);
-    PoolReturn(e->pool, data);
-    SCMutexUnlock(&e->lock);
+    PoolThreadElement *e = &pt->array[res->id];
+    do {
+        head = SC_ATOMIC_GET(e->returned);
+        res->next = head;
+    } while (SC_ATOMIC_CAS(&e->returned, head, res) == 0);
 }
 
 #ifdef UNITTESTS
@@ -216,7 +241,7 @@ void PoolThreadTestFree(void *data)
 static int PoolThreadTestInit01(void)
 {
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
     if (pt == NULL)
         return 0;
 
@@ -229,7 +254,7 @@ static int PoolThreadTestInit02(void)
     int i = 123;
 
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
     if (pt == NULL)
         return 0;
 
@@ -241,7 +266,7 @@ static int PoolThreadTestGet01(void)
 {
     int result = 0;
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
     if (pt == NULL)
         return 0;
 
@@ -252,8 +277,8 @@ static int PoolThreadTestGet01(void)
     }
 
     struct PoolThreadTestData *pdata = data;
-    if (pdata->res != 3) {
-        printf("res != 3, but %d: ", pdata->res);
+    if (pdata->res.id != 3) {
+        printf("res != 3, but %d: ", pdata->res.id);
         goto end;
     }
 
@@ -269,7 +294,7 @@ static int PoolThreadTestGet02(void)
     int result = 0;
 
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
     if (pt == NULL)
         return 0;
 
@@ -280,8 +305,8 @@ static int PoolThreadTestGet02(void)
     }
 
     struct PoolThreadTestData *pdata = data;
-    if (pdata->res != 3) {
-        printf("res != 3, but %d: ", pdata->res);
+    if (pdata->res.id != 3) {
+        printf("res != 3, but %d: ", pdata->res.id);
         goto end;
     }
 
@@ -302,7 +327,7 @@ static int PoolThreadTestReturn01(void)
     int result = 0;
 
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
     if (pt == NULL)
         return 0;
 
@@ -313,8 +338,8 @@ static int PoolThreadTestReturn01(void)
     }
 
     struct PoolThreadTestData *pdata = data;
-    if (pdata->res != 3) {
-        printf("res != 3, but %d: ", pdata->res);
+    if (pdata->res.id != 3) {
+        printf("res != 3, but %d: ", pdata->res.id);
         goto end;
     }
 
@@ -331,7 +356,20 @@ static int PoolThreadTestReturn01(void)
 
     PoolThreadReturn(pt, data);
 
-    if (pt->array[3].pool->outstanding != 0) {
+    /* returned data is only picked up by the next get */
+    if (pt->array[3].pool->outstanding != 1 ||
+        SC_ATOMIC_GET(pt->array[3].returned) != data) {
+        printf("data not on the returned list: ");
+        goto end;
+    }
+
+    if (PoolThreadGetById(pt, 3) != data) {
+        printf("returned data not reused: ");
+        goto end;
+    }
+
+    if (pt->array[3].pool->outstanding != 1 ||
+        SC_ATOMIC_GET(pt->array[3].returned) != NULL) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[3].pool->outstanding);
         goto end;
@@ -344,15 +382,69 @@ end:
     return result;
 }
 
+struct PoolThreadTestReturnCtx {
+    PoolThread *pt;
+    void *data[8];
+};
+
+static void *PoolThreadTestReturner(void *arg)
+{
+    struct PoolThreadTestReturnCtx *ctx = arg;
+    int i;
+    for (i = 0; i < 8; i++)
+        PoolThreadReturn(ctx->pt, ctx->data[i]);
+    return NULL;
+}
+
+/** \test return from another thread */
+static int PoolThreadTestReturn02(void)
+{
+    int i = 123;
+    int j;
+    struct PoolThreadTestReturnCtx ctx;
+    pthread_t t;
+
+    ctx.pt = PoolThreadInit(2, /* threads */
+                            0, 2, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+    FAIL_IF_NULL(ctx.pt);
+
+    for (j = 0; j < 8; j++) {
+        ctx.data[j] = PoolThreadGetById(ctx.pt, 1);
+        FAIL_IF_NULL(ctx.data[j]);
+    }
+    FAIL_IF_NOT(ctx.pt->array[1].pool->outstanding == 8);
+
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+
+    /* pool 0 not affected */
+    void *data = PoolThreadGetById(ctx.pt, 0);
+    FAIL_IF_NULL(data);
+    FAIL_IF_NOT(ctx.pt->array[1].pool->outstanding == 8);
+
+    /* pool 1 picks up everything on its next get */
+    data = PoolThreadGetById(ctx.pt, 1);
+    FAIL_IF_NULL(data);
+    FAIL_IF_NOT(ctx.pt->array[1].pool->outstanding == 1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(ctx.pt->array[1].returned) == NULL);
+
+    struct PoolThreadTestData *pdata = data;
+    FAIL_IF_NOT(pdata->res.id == 1);
+    FAIL_IF_NOT_NULL(pdata->res.next);
+
+    PoolThreadFree(ctx.pt);
+    PASS;
+}
+
 static int PoolThreadTestGrow01(void)
 {
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, NULL, NULL, NULL, NULL);
     if (pt == NULL)
         return 0;
 
     if (PoolThreadGrow(pt,
-                       10, 5, 10, PoolThreadTestAlloc, NULL, NULL, NULL, NULL) < 0) {
+                       10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, NULL, NULL, NULL, NULL) < 0) {
         PoolThreadFree(pt);
         return 0;
     }
@@ -366,12 +458,12 @@ static int PoolThreadTestGrow02(void)
     int i = 123;
 
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
     if (pt == NULL)
         return 0;
 
     if (PoolThreadGrow(pt,
-                       10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL) < 0) {
+                       10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL) < 0) {
         PoolThreadFree(pt);
         return 0;
     }
@@ -386,12 +478,12 @@ static int PoolThreadTestGrow03(void)
     int result = 0;
 
     PoolThread *pt = PoolThreadInit(4, /* threads */
-                                    10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+                                    10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
     if (pt == NULL)
         return 0;
 
     if (PoolThreadGrow(pt,
-                       10, 5, 10, PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL) < 0) {
+                       10, 5, sizeof(struct PoolThreadTestData), PoolThreadTestAlloc, PoolThreadTestInit, &i, PoolThreadTestFree, NULL) < 0) {
         PoolThreadFree(pt);
         return 0;
     }
@@ -403,8 +495,8 @@ static int PoolThreadTestGrow03(void)
     }
 
     struct PoolThreadTestData *pdata = data;
-    if (pdata->res != 4) {
-        printf("res != 5, but %d: ", pdata->res);
+    if (pdata->res.id != 4) {
+        printf("res != 5, but %d: ", pdata->res.id);
         goto end;
     }
 
@@ -421,7 +513,20 @@ static int PoolThreadTestGrow03(void)
 
     PoolThreadReturn(pt, data);
 
-    if (pt->array[4].pool->outstanding != 0) {
+    /* returned data is only picked up by the next get */
+    if (pt->array[4].pool->outstanding != 1 ||
+        SC_ATOMIC_GET(pt->array[4].returned) != data) {
+        printf("data not on the returned list: ");
+        goto end;
+    }
+
+    if (PoolThreadGetById(pt, 4) != data) {
+        printf("returned data not reused: ");
+        goto end;
+    }
+
+    if (pt->array[4].pool->outstanding != 1 ||
+        SC_ATOMIC_GET(pt->array[4].returned) != NULL) {
         printf("pool outstanding count wrong %u: ",
                 pt->array[4].pool->outstanding);
         goto end;
@@ -446,6 +551,7 @@ void PoolThreadRegisterTests(void)
     UtRegisterTest("PoolThreadTestGet02", PoolThreadTestGet02);
 
     UtRegisterTest("PoolThreadTestReturn01", PoolThreadTestReturn01);
+    UtRegisterTest("PoolThreadTestReturn02", PoolThreadTestReturn02);
 
     UtRegisterTest("PoolThreadTestGrow01", PoolThreadTestGrow01);
     UtRegisterTest("PoolThreadTestGrow02", PoolThreadTestGrow02);
@@ -34,14 +34,26 @@
  *
  *  It's purpose is to make sure thread X can return data to a pool
  *  from thread Y.
+ *
+ *  Each pool is only touched by the thread owning it, through
+ *  PoolThreadGetById. Returns from any thread go onto a lock free list
+ *  of the pool, that the owner moves back into the pool on its next get.
  */
 
 #ifndef __UTIL_POOL_THREAD_H__
 #define __UTIL_POOL_THREAD_H__
 
+/** per data item reserved data containing the
+ *  thread pool id */
+typedef struct PoolThreadReserved_ {
+    struct PoolThreadReserved_ *next;   /**< returned list, managed by the API */
+    uint16_t id;
+} PoolThreadReserved;
+
 struct PoolThreadElement_ {
-    SCMutex lock;                   /**< lock, should have low contention */
-    Pool *pool;                     /**< actual pool */
+    Pool *pool;                     /**< actual pool, owner thread only */
+    /** data returned to this pool, waiting for the owner to pick it up */
+    SC_ATOMIC_DECLARE(PoolThreadReserved *, returned);
 };
 // __attribute__((aligned(CLS))); <- VJ: breaks on clang 32bit, segv in PoolThreadTestGrow01
 
@@ -52,10 +64,6 @@ typedef struct PoolThread_ {
     PoolThreadElement *array;       /**< array of elements */
 } PoolThread;
 
-/** per data item reserved data containing the
- *  thread pool id */
-typedef uint16_t PoolThreadReserved;
-
 void PoolThreadRegisterTests(void);
 
 /** \brief initialize a thread pool
@@ -76,14 +84,16 @@ int PoolThreadGrow(PoolThread *pt, uint32_t size, uint32_t prealloc_size, uint32
 void PoolThreadFree(PoolThread *pt);
 
 /** \brief get data from thread pool by thread id
- *  \note wrapper around PoolGet()
+ *  \note wrapper around PoolGet(). Only to be called by the thread
+ *        owning pool 'id'.
  *  \param pt thread pool
  *  \param id thread id
  *  \retval ptr data or NULL */
 void *PoolThreadGetById(PoolThread *pt, uint16_t id);
 
 /** \brief return data to thread pool
- *  \note wrapper around PoolReturn()
+ *  \note lock free, can be called from any thread. The data is handed
+ *        to PoolReturn() by the owner on its next PoolThreadGetById().
  *  \param pt thread pool
  *  \param data memory block to return, with PoolThreadReserved as it's first member */
 void PoolThreadReturn(PoolThread *pt, void *data);
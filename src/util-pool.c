@@ -41,6 +41,7 @@
 #include "suricata-common.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-pool-depot.h"
 #include "util-unittest.h"
 #include "util-debug.h"
 
@@ -728,6 +729,7 @@ void PoolRegisterTests(void)
     UtRegisterTest("PoolTestInit07", PoolTestInit07);
 
     PoolThreadRegisterTests();
+    PoolDepotRegisterTests();
 #endif /* UNITTESTS */
 }
 
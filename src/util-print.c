@@ -219,14 +219,21 @@ void PrintRawDataToBuffer(uint8_t *dst_buf, uint32_t *dst_buf_offset_ptr, uint32
 void PrintStringsToBuffer(uint8_t *dst_buf, uint32_t *dst_buf_offset_ptr, uint32_t dst_buf_size,
                           uint8_t *src_buf, uint32_t src_buf_len)
 {
-    uint32_t ch = 0;
-    for (ch = 0; ch < src_buf_len; ch++) {
-        PrintBufferData((char *)dst_buf, dst_buf_offset_ptr, dst_buf_size,
-                        "%c",
-                        (isprint((uint8_t)src_buf[ch]) ||
-                        src_buf[ch] == '\n' ||
-                        src_buf[ch] == '\r') ? (uint8_t)src_buf[ch] : '.');
+    uint32_t offset = *dst_buf_offset_ptr;
+    if (offset >= dst_buf_size)
+        return;
+
+    /* same result as printing byte by byte: truncated to the buffer,
+     * always terminated */
+    uint32_t len = MIN(src_buf_len, dst_buf_size - 1 - offset);
+    uint8_t *d = dst_buf + offset;
+    uint32_t ch;
+    for (ch = 0; ch < len; ch++) {
+        uint8_t c = src_buf[ch];
+        d[ch] = (isprint(c) || c == '\n' || c == '\r') ? c : '.';
     }
+    d[len] = '\0';
+    *dst_buf_offset_ptr = offset + len;
 
     return;
 }
@@ -0,0 +1,396 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Multi-process mode.
+ *
+ * Once the detect engine is built and before any thread is started, the
+ * process forks 'multi-process.processes' worker processes. The workers
+ * share the engine's pages with the master copy-on-write, and as they
+ * open their AF_PACKET sockets with the configured cluster-id, the kernel
+ * fanout spreads the flows over all of them. Each worker logs to its own
+ * subdirectory of the log dir.
+ *
+ * The master doesn't capture: it forwards the stop, reload (SIGUSR2) and
+ * rotation (SIGHUP) signals to the workers, and restarts a worker that
+ * died from its copy of the engine.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "util-conf.h"
+#include "util-pidfile.h"
+#include "util-process-group.h"
+#include "util-debug.h"
+
+#ifndef OS_WIN32
+
+#include <sys/wait.h>
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+
+#define PROCESS_GROUP_MAX           64
+/** a worker dying sooner than this after its start isn't restarted */
+#define PROCESS_GROUP_MIN_UPTIME    10
+
+typedef struct ProcessGroupWorker_ {
+    pid_t pid;          /**< 0 if not running */
+    time_t started;
+} ProcessGroupWorker;
+
+static struct {
+    int processes;
+    int id;                     /**< 0 in the master, 1..processes in a worker */
+    int reloads;                /**< reloads forwarded so far */
+    pid_t master;
+    ProcessGroupWorker workers[PROCESS_GROUP_MAX + 1];
+    char log_dir[PATH_MAX];
+} pg = { 0, 0, 0, 0, { { 0, 0 } }, "" };
+
+static volatile sig_atomic_t pg_stop_signal = 0;
+static volatile sig_atomic_t pg_reload = 0;
+static volatile sig_atomic_t pg_rotate = 0;
+
+static struct sigaction pg_old_int, pg_old_term, pg_old_usr2, pg_old_hup;
+
+static void ProcessGroupSignalStop(int sig)
+{
+    pg_stop_signal = sig;
+}
+
+static void ProcessGroupSignalReload(int sig)
+{
+    pg_reload = 1;
+}
+
+static void ProcessGroupSignalRotate(int sig)
+{
+    pg_rotate = 1;
+}
+
+/** \brief id of this process, 0 in the master or if not enabled */
+int ProcessGroupId(void)
+{
+    return pg.id;
+}
+
+/** \internal
+ *  \brief warn about fanout modes that don't keep a flow on one socket,
+ *         as with several processes a flow would be split over them */
+static void ProcessGroupCheckFanout(void)
+{
+    ConfNode *afp = ConfGetNode("af-packet");
+    if (afp == NULL)
+        return;
+
+    ConfNode *iface;
+    TAILQ_FOREACH(iface, &afp->head, next) {
+        const char *type = ConfNodeLookupChildValue(iface, "cluster-type");
+        if (type == NULL)
+            continue;
+        if (strcmp(type, "cluster_round_robin") == 0 ||
+            strcmp(type, "cluster_random") == 0 ||
+            strcmp(type, "cluster_rollover") == 0)
+        {
+            const char *name = ConfNodeLookupChildValue(iface, "interface");
+            SCLogWarning(SC_ERR_PROCESS_GROUP, "af-packet interface %s uses "
+                    "%s: flows will be split over the processes",
+                    name ? name : "?", type);
+        }
+    }
+}
+
+/** \internal
+ *  \brief set up a new worker process */
+static void ProcessGroupWorkerSetup(SCInstance *suri, int id)
+{
+    pg.id = id;
+
+    sigaction(SIGINT, &pg_old_int, NULL);
+    sigaction(SIGTERM, &pg_old_term, NULL);
+    sigaction(SIGUSR2, &pg_old_usr2, NULL);
+    sigaction(SIGHUP, &pg_old_hup, NULL);
+
+#ifdef HAVE_SYS_PRCTL_H
+    /* don't outlive the master */
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0) == -1) {
+        SCLogWarning(SC_ERR_PROCESS_GROUP, "worker %d won't stop with the "
+                "master: %s", id, strerror(errno));
+    }
+    if (getppid() != pg.master)
+        exit(EXIT_FAILURE);
+#endif
+
+    /* the pid file is the master's */
+    suri->pid_filename = NULL;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%d", pg.log_dir, id);
+    if (mkdir(dir, S_IRWXU|S_IRGRP|S_IXGRP) != 0 && errno != EEXIST) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "worker %d can't create its log "
+                "directory %s: %s", id, dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (ConfigSetLogDirectory(dir) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "worker %d failed to set its log "
+                "directory", id);
+        exit(EXIT_FAILURE);
+    }
+
+    /* one command socket per worker */
+    int unix_socket = 0;
+    if (ConfGetBool("unix-command.enabled", &unix_socket) == 1 && unix_socket) {
+        char *socketname = NULL;
+        char name[PATH_MAX];
+        if (ConfGet("unix-command.filename", &socketname) != 1)
+            socketname = "suricata-command.socket";
+        snprintf(name, sizeof(name), "%s.%d", socketname, id);
+        ConfSetFinal("unix-command.filename", name);
+    }
+
+    SCLogNotice("worker process %d started, logging to %s", id, dir);
+}
+
+/** \internal
+ *  \brief start worker 'id'
+ *
+ *  \retval 0 in the new worker
+ *  \retval 1 in the master
+ *  \retval -1 fork failed
+ */
+static int ProcessGroupSpawn(SCInstance *suri, int id)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "fork of worker %d failed: %s",
+                id, strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        ProcessGroupWorkerSetup(suri, id);
+        return 0;
+    }
+    pg.workers[id].pid = pid;
+    pg.workers[id].started = time(NULL);
+    SCLogInfo("worker process %d has pid %d", id, (int)pid);
+    return 1;
+}
+
+static void ProcessGroupSignalWorkers(int sig)
+{
+    int i;
+    for (i = 1; i <= pg.processes; i++) {
+        if (pg.workers[i].pid > 0)
+            kill(pg.workers[i].pid, sig);
+    }
+}
+
+static int ProcessGroupRunning(void)
+{
+    int i, cnt = 0;
+    for (i = 1; i <= pg.processes; i++) {
+        if (pg.workers[i].pid > 0)
+            cnt++;
+    }
+    return cnt;
+}
+
+/** \internal
+ *  \brief handle the exit of a worker
+ *
+ *  \retval 1 exited normally
+ *  \retval 0 failed
+ */
+static int ProcessGroupReap(pid_t pid, int status, int *id)
+{
+    int i;
+    for (i = 1; i <= pg.processes; i++) {
+        if (pg.workers[i].pid == pid)
+            break;
+    }
+    if (i > pg.processes)
+        return 1;
+    pg.workers[i].pid = 0;
+    *id = i;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+        SCLogInfo("worker process %d exited", i);
+        return 1;
+    }
+    if (WIFSIGNALED(status)) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "worker process %d was killed by "
+                "signal %d", i, WTERMSIG(status));
+    } else {
+        SCLogError(SC_ERR_PROCESS_GROUP, "worker process %d exited with %d",
+                i, WEXITSTATUS(status));
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief the master's loop, until stopped or all workers are gone
+ *
+ *  \retval 0 in a restarted worker
+ */
+static int ProcessGroupMaster(SCInstance *suri)
+{
+    int failed = 0;
+
+    while (pg_stop_signal == 0 && ProcessGroupRunning() > 0) {
+        if (pg_reload) {
+            pg_reload = 0;
+            pg.reloads++;
+            SCLogNotice("reloading the rules of the workers");
+            ProcessGroupSignalWorkers(SIGUSR2);
+        }
+        if (pg_rotate) {
+            pg_rotate = 0;
+            ProcessGroupSignalWorkers(SIGHUP);
+        }
+
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            int id = 0;
+            if (ProcessGroupReap(pid, status, &id) == 1 || id == 0)
+                continue;
+            if (pg_stop_signal != 0)
+                continue;
+            if (time(NULL) - pg.workers[id].started < PROCESS_GROUP_MIN_UPTIME) {
+                SCLogError(SC_ERR_PROCESS_GROUP, "worker process %d failed "
+                        "right after its start, not restarting it", id);
+                failed = 1;
+                continue;
+            }
+            int r = ProcessGroupSpawn(suri, id);
+            if (r == 0)
+                return 0;
+            if (r < 0)
+                failed = 1;
+        }
+        usleep(100 * 1000);
+    }
+
+    if (pg_stop_signal != 0) {
+        SCLogNotice("stopping the worker processes");
+        ProcessGroupSignalWorkers(pg_stop_signal);
+    }
+    while (ProcessGroupRunning() > 0) {
+        int status = 0;
+        int id = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ProcessGroupReap(pid, status, &id) == 0)
+            failed = 1;
+    }
+
+    SCPidfileRemove(suri->pid_filename);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/**
+ * \brief fork the worker processes if multi-process mode is enabled
+ *
+ * Called once the detect engine is built and before the outputs and
+ * threads are set up. Returns in the workers, and in the master if the
+ * mode isn't used. The master never returns.
+ *
+ * \retval 1 in a worker started after a reload: it has to reload the
+ *         rules too
+ * \retval 0 otherwise
+ */
+int ProcessGroupStart(SCInstance *suri)
+{
+    ConfNode *conf = ConfGetNode("multi-process");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return 0;
+
+    intmax_t processes = 2;
+    if (ConfGetChildValueInt(conf, "processes", &processes) == 1 &&
+        (processes < 1 || processes > PROCESS_GROUP_MAX))
+    {
+        SCLogError(SC_ERR_PROCESS_GROUP, "multi-process.processes must be "
+                "between 1 and %d, running a single process",
+                PROCESS_GROUP_MAX);
+        return 0;
+    }
+    if (suri->run_mode != RUNMODE_AFP_DEV) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "multi-process mode needs the "
+                "af-packet capture, running a single process");
+        return 0;
+    }
+    ProcessGroupCheckFanout();
+
+    pg.processes = (int)processes;
+    pg.master = getpid();
+    strlcpy(pg.log_dir, ConfigGetLogDirectory(), sizeof(pg.log_dir));
+
+    struct sigaction action;
+    memset(&action, 0x00, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = ProcessGroupSignalStop;
+    sigaction(SIGINT, &action, &pg_old_int);
+    sigaction(SIGTERM, &action, &pg_old_term);
+    action.sa_handler = ProcessGroupSignalReload;
+    sigaction(SIGUSR2, &action, &pg_old_usr2);
+    action.sa_handler = ProcessGroupSignalRotate;
+    sigaction(SIGHUP, &action, &pg_old_hup);
+
+    SCLogNotice("starting %d worker processes", pg.processes);
+    int i;
+    for (i = 1; i <= pg.processes; i++) {
+        int r = ProcessGroupSpawn(suri, i);
+        if (r == 0)
+            return 0;
+        if (r < 0) {
+            pg_stop_signal = SIGTERM;
+            break;
+        }
+    }
+
+    ProcessGroupMaster(suri);
+    /* restarted worker */
+    return pg.reloads > 0 ? 1 : 0;
+}
+
+#else /* OS_WIN32 */
+
+int ProcessGroupId(void)
+{
+    return 0;
+}
+
+int ProcessGroupStart(SCInstance *suri)
+{
+    ConfNode *conf = ConfGetNode("multi-process");
+    if (conf != NULL && ConfNodeChildValueIsTrue(conf, "enabled")) {
+        SCLogError(SC_ERR_PROCESS_GROUP, "multi-process mode is not "
+                "supported on this platform");
+    }
+    return 0;
+}
+
+#endif /* OS_WIN32 */
@@ -0,0 +1,31 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Multi-process mode: worker processes forked after the detect engine
+ * was built.
+ */
+
+#ifndef __UTIL_PROCESS_GROUP_H__
+#define __UTIL_PROCESS_GROUP_H__
+
+int ProcessGroupStart(SCInstance *suri);
+int ProcessGroupId(void);
+
+#endif /* __UTIL_PROCESS_GROUP_H__ */
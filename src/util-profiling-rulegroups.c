@@ -287,7 +287,7 @@ SCProfilingSghUpdateCounter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *
         p->checks++;
 
         if (det_ctx->non_mpm_store_cnt > 0) {
-            if (det_ctx->non_mpm_store_ptr == sgh->non_mpm_syn_store_array)
+            if (det_ctx->non_mpm_store_ptr == &sgh->non_mpm_syn_store)
                 p->non_mpm_syn++;
             else
                 p->non_mpm_generic++;
@@ -22,6 +22,12 @@
  * \author Victor Julien <victor@inliniac.net>
  *
  * An API for rule profiling operations.
+ *
+ * Available in all builds. With --enable-profiling it can be enabled
+ * from the start by profiling.rules, otherwise it's started, stopped
+ * and dumped over the unix socket. Each detect thread picks 1 in N of
+ * its packets, or the packets of 1 in N flows, and times all rules
+ * inspected for those.
  */
 
 #include "suricata-common.h"
@@ -35,8 +41,14 @@
 #include "util-byte.h"
 #include "util-profiling.h"
 #include "util-profiling-locks.h"
+#include "util-conf.h"
+#include "util-time.h"
+#include "detect-engine.h"
 
-#ifdef PROFILING
+/** profiling-rules-start: sample 1 in this many packets or flows */
+#define PROFILING_RULES_DEFAULT_SAMPLE_RATE 1000
+/** profiling-rules-dump: rules returned */
+#define PROFILING_RULES_DEFAULT_DUMP_LIMIT  100
 
 /**
  * Extra data for rule profiling.
@@ -55,7 +67,10 @@ typedef struct SCProfileData_ {
 typedef struct SCProfileDetectCtx_ {
     uint32_t size;
     uint32_t id;
-    SCProfileData *data;
+    SCProfileData *data;    /**< merged data of the exited threads */
+    uint32_t gen;           /**< profiling run 'data' belongs to */
+    /** threads that sampled packets, linked by rule_perf_next */
+    DetectEngineThreadCtx *threads;
     pthread_mutex_t data_m;
 } SCProfileDetectCtx;
 
@@ -77,8 +92,16 @@ typedef struct SCProfileSummary_ {
     uint64_t ticks_no_match;
 } SCProfileSummary;
 
-extern int profiling_output_to_file;
+int profiling_output_to_file = 0;
+/** profiling.rules.enabled: profile from the start and dump at exit */
 int profiling_rules_enabled = 0;
+/** packets are being sampled */
+int profiling_rules_active = 0;
+static uint32_t profiling_rules_sample_rate = 1;
+static int profiling_rules_sample_flows = 0;
+/** profiling run, bumped by every start. Threads and contexts reset
+ *  their counters once they see it change. */
+static SC_ATOMIC_DECLARE(uint32_t, profiling_rules_gen);
 static char *profiling_file_name = "";
 static const char *profiling_file_mode = "a";
 #ifdef HAVE_LIBJANSSON
@@ -113,6 +136,12 @@ void SCProfilingRulesGlobalInit(void)
     if (conf != NULL) {
         if (ConfNodeChildValueIsTrue(conf, "enabled")) {
             profiling_rules_enabled = 1;
+            profiling_rules_active = 1;
+
+            intmax_t rate = 0;
+            if (ConfGetInt("profiling.sample-rate", &rate) == 1 &&
+                    rate > 0 && rate <= UINT32_MAX)
+                profiling_rules_sample_rate = (uint32_t)rate;
 
             val = ConfNodeLookupChildValue(conf, "sort");
             if (val != NULL) {
@@ -292,7 +321,8 @@ SCProfileSummarySortByMaxTicks(const void *a, const void *b)
 
 #ifdef HAVE_LIBJANSSON
 
-static void DumpJson(FILE *fp, SCProfileSummary *summary, uint32_t count, uint64_t total_ticks)
+static json_t *BuildJson(SCProfileSummary *summary, uint32_t count, uint64_t total_ticks,
+        uint32_t limit)
 {
     char timebuf[64];
     uint32_t i;
@@ -300,18 +330,18 @@ static void DumpJson(FILE *fp, SCProfileSummary *summary, uint32_t count, uint64
 
     json_t *js = json_object();
     if (js == NULL)
-        return;
+        return NULL;
     json_t *jsa = json_array();
     if (jsa == NULL) {
         json_decref(js);
-        return;
+        return NULL;
     }
 
     gettimeofday(&tval, NULL);
     CreateIsoTimeString(&tval, timebuf, sizeof(timebuf));
     json_object_set_new(js, "timestamp", json_string(timebuf));
 
-    for (i = 0; i < count; i++) {
+    for (i = 0; i < MIN(count, limit); i++) {
         /* Stop dumping when we hit our first rule with 0 checks.  Due
          * to sorting this will be the beginning of all the rules with
          * 0 checks. */
@@ -340,13 +370,23 @@ static void DumpJson(FILE *fp, SCProfileSummary *summary, uint32_t count, uint64
         }
     }
     json_object_set_new(js, "rules", jsa);
+    return js;
+}
+
+static void DumpJson(FILE *fp, SCProfileSummary *summary, uint32_t count, uint64_t total_ticks)
+{
+    json_t *js = BuildJson(summary, count, total_ticks, count);
+    if (js == NULL)
+        return;
 
     char *js_s = json_dumps(js,
             JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
             JSON_ESCAPE_SLASH);
 
-    if (unlikely(js_s == NULL))
+    if (unlikely(js_s == NULL)) {
+        json_decref(js);
         return;
+    }
     fprintf(fp, "%s", js_s);
     free(js_s);
     json_decref(js);
@@ -413,61 +453,98 @@ static void DumpText(FILE *fp, SCProfileSummary *summary, uint32_t count, uint64
     fprintf(fp,"\n");
 }
 
+static void SCProfilingRuleDataAdd(SCProfileData *dst, const SCProfileData *src)
+{
+    dst->checks += src->checks;
+    dst->matches += src->matches;
+    dst->ticks_match += src->ticks_match;
+    dst->ticks_no_match += src->ticks_no_match;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
 /**
- * \brief Dump rule profiling information to file
+ * \brief reset the merged data if it's from an earlier profiling run
  *
- * \param de_ctx The active DetectEngineCtx, used to get at the loaded rules.
+ * \note ctx->data_m must be held
  */
-void
-SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
+static void SCProfilingRuleCtxSync(SCProfileDetectCtx *ctx)
 {
-    uint32_t i;
-    FILE *fp;
-
-    if (rules_ctx == NULL)
-        return;
-
-    if (profiling_output_to_file == 1) {
-        fp = fopen(profiling_file_name, profiling_file_mode);
-
-        if (fp == NULL) {
-            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", profiling_file_name,
-                    strerror(errno));
-            return;
+    uint32_t gen = SC_ATOMIC_GET(profiling_rules_gen);
+    if (ctx->gen != gen) {
+        if (ctx->data != NULL) {
+            uint32_t i;
+            for (i = 0; i < ctx->size; i++) {
+                SCProfileData *d = &ctx->data[i];
+                d->checks = d->matches = d->max = 0;
+                d->ticks_match = d->ticks_no_match = 0;
+            }
         }
-    } else {
-       fp = stdout;
+        ctx->gen = gen;
     }
+}
+
+/**
+ * \brief sorted summary of the merged data and the data of the threads
+ *         that are still running
+ *
+ * The counters of running threads are read while they update them, so
+ * a summary taken at runtime can be off by the rules of a packet.
+ *
+ * \retval summary array of ctx->size entries, or NULL
+ */
+static SCProfileSummary *SCProfilingRuleSummary(SCProfileDetectCtx *rules_ctx,
+        uint64_t *total_ticks_out)
+{
+    uint32_t i;
+    uint32_t count = rules_ctx->size;
+    uint64_t total_ticks = 0;
+
+    if (count == 0 || rules_ctx->data == NULL)
+        return NULL;
 
-    int summary_size = sizeof(SCProfileSummary) * rules_ctx->size;
-    SCProfileSummary *summary = SCMalloc(summary_size);
+    SCProfileData *data = SCCalloc(count, sizeof(SCProfileData));
+    if (unlikely(data == NULL))
+        return NULL;
+    SCProfileSummary *summary = SCCalloc(count, sizeof(SCProfileSummary));
     if (unlikely(summary == NULL)) {
         SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory for profiling summary");
-        return;
+        SCFree(data);
+        return NULL;
     }
 
-    uint32_t count = rules_ctx->size;
-    uint64_t total_ticks = 0;
-
-    SCLogPerf("Dumping profiling data for %u rules.", count);
+    pthread_mutex_lock(&rules_ctx->data_m);
+    SCProfilingRuleCtxSync(rules_ctx);
+    for (i = 0; i < count; i++) {
+        SCProfilingRuleDataAdd(&data[i], &rules_ctx->data[i]);
+    }
+    DetectEngineThreadCtx *t;
+    for (t = rules_ctx->threads; t != NULL; t = t->rule_perf_next) {
+        if (t->rule_perf_gen != rules_ctx->gen)
+            continue;
+        uint32_t n = MIN(count, t->rule_perf_data_size);
+        for (i = 0; i < n; i++) {
+            SCProfilingRuleDataAdd(&data[i], &t->rule_perf_data[i]);
+        }
+    }
+    pthread_mutex_unlock(&rules_ctx->data_m);
 
-    memset(summary, 0, summary_size);
     for (i = 0; i < count; i++) {
         summary[i].sid = rules_ctx->data[i].sid;
         summary[i].rev = rules_ctx->data[i].rev;
         summary[i].gid = rules_ctx->data[i].gid;
 
-        summary[i].ticks = rules_ctx->data[i].ticks_match + rules_ctx->data[i].ticks_no_match;
-        summary[i].checks = rules_ctx->data[i].checks;
+        summary[i].ticks = data[i].ticks_match + data[i].ticks_no_match;
+        summary[i].checks = data[i].checks;
 
         if (summary[i].ticks > 0) {
             summary[i].avgticks = (long double)summary[i].ticks / (long double)summary[i].checks;
         }
 
-        summary[i].matches = rules_ctx->data[i].matches;
-        summary[i].max = rules_ctx->data[i].max;
-        summary[i].ticks_match = rules_ctx->data[i].ticks_match;
-        summary[i].ticks_no_match = rules_ctx->data[i].ticks_no_match;
+        summary[i].matches = data[i].matches;
+        summary[i].max = data[i].max;
+        summary[i].ticks_match = data[i].ticks_match;
+        summary[i].ticks_no_match = data[i].ticks_no_match;
         if (summary[i].ticks_match > 0) {
             summary[i].avgticks_match = (long double)summary[i].ticks_match /
                 (long double)summary[i].matches;
@@ -479,6 +556,7 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
         }
         total_ticks += summary[i].ticks;
     }
+    SCFree(data);
 
     switch (profiling_rules_sort_order) {
         case SC_PROFILING_RULES_SORT_BY_TICKS:
@@ -510,6 +588,45 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
                     SCProfileSummarySortByAvgTicksNoMatch);
             break;
     }
+
+    *total_ticks_out = total_ticks;
+    return summary;
+}
+
+/**
+ * \brief Dump rule profiling information to file
+ *
+ * \param de_ctx The active DetectEngineCtx, used to get at the loaded rules.
+ */
+void
+SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
+{
+    FILE *fp;
+
+    if (rules_ctx == NULL)
+        return;
+
+    uint64_t total_ticks = 0;
+    SCProfileSummary *summary = SCProfilingRuleSummary(rules_ctx, &total_ticks);
+    if (summary == NULL)
+        return;
+
+    if (profiling_output_to_file == 1) {
+        fp = fopen(profiling_file_name, profiling_file_mode);
+
+        if (fp == NULL) {
+            SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", profiling_file_name,
+                    strerror(errno));
+            SCFree(summary);
+            return;
+        }
+    } else {
+       fp = stdout;
+    }
+
+    uint32_t count = rules_ctx->size;
+    SCLogPerf("Dumping profiling data for %u rules.", count);
+
 #ifdef HAVE_LIBJANSSON
     if (profiling_rule_json) {
         DumpJson(fp, summary, count, total_ticks);
@@ -530,7 +647,7 @@ SCProfilingRuleDump(SCProfileDetectCtx *rules_ctx)
  *
  * \retval Returns the ID of the counter on success, 0 on failure.
  */
-static uint16_t
+static uint32_t
 SCProfilingRegisterRuleCounter(SCProfileDetectCtx *ctx)
 {
     ctx->size++;
@@ -545,7 +662,7 @@ SCProfilingRegisterRuleCounter(SCProfileDetectCtx *ctx)
  * \param match Did the rule match?
  */
 void
-SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint16_t id, uint64_t ticks, int match)
+SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint32_t id, uint64_t ticks, int match)
 {
     if (det_ctx != NULL && det_ctx->rule_perf_data != NULL && det_ctx->rule_perf_data_size > id) {
         SCProfileData *p = &det_ctx->rule_perf_data[id];
@@ -561,11 +678,82 @@ SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *det_ctx, uint16_t id, uint64
     }
 }
 
+/**
+ * \brief get the thread ready for the current profiling run
+ *
+ * The counters are allocated the first time the thread samples a
+ * packet, so threads of an engine that is never profiled don't pay for
+ * them. The thread is linked into the context so that a dump at runtime
+ * can include it.
+ *
+ * \retval 0 ok, -1 no rules or out of memory
+ */
+static int SCProfilingRuleThreadPrepare(DetectEngineThreadCtx *det_ctx, uint32_t gen)
+{
+    SCProfileDetectCtx *ctx = det_ctx->de_ctx ? det_ctx->de_ctx->profile_ctx : NULL;
+    if (ctx == NULL || ctx->size == 0)
+        return -1;
+
+    if (det_ctx->rule_perf_data == NULL) {
+        SCProfileData *a = SCCalloc(ctx->size, sizeof(SCProfileData));
+        if (unlikely(a == NULL))
+            return -1;
+
+        pthread_mutex_lock(&ctx->data_m);
+        det_ctx->rule_perf_data = a;
+        det_ctx->rule_perf_data_size = ctx->size;
+        det_ctx->rule_perf_next = ctx->threads;
+        ctx->threads = det_ctx;
+        pthread_mutex_unlock(&ctx->data_m);
+    } else {
+        pthread_mutex_lock(&ctx->data_m);
+        memset(det_ctx->rule_perf_data, 0x00,
+                sizeof(SCProfileData) * det_ctx->rule_perf_data_size);
+        pthread_mutex_unlock(&ctx->data_m);
+    }
+    det_ctx->rule_perf_gen = gen;
+    det_ctx->rule_perf_sample_cnt = 0;
+    return 0;
+}
+
+/**
+ * \brief decide if the rules inspected for this packet are timed
+ *
+ * Only called while profiling is active. In flow mode all packets of
+ * 1 in N flows are picked by flow hash, so the cost of a rule over a
+ * whole session shows.
+ */
+void SCProfilingRuleSample(DetectEngineThreadCtx *det_ctx, Packet *p)
+{
+    uint32_t gen = SC_ATOMIC_GET(profiling_rules_gen);
+    if (unlikely(det_ctx->rule_perf_data == NULL || det_ctx->rule_perf_gen != gen)) {
+        if (SCProfilingRuleThreadPrepare(det_ctx, gen) < 0)
+            return;
+    }
+
+#ifdef PROFILE_LOCKING
+    if (p->profile == NULL)
+        return;
+#else
+    uint32_t rate = profiling_rules_sample_rate;
+    if (rate > 1) {
+        if (profiling_rules_sample_flows) {
+            if (p->flow == NULL || (p->flow_hash % rate) != 0)
+                return;
+        } else if ((++det_ctx->rule_perf_sample_cnt % rate) != 0) {
+            return;
+        }
+    }
+#endif
+    p->flags |= PKT_PROFILE;
+}
+
 SCProfileDetectCtx *SCProfilingRuleInitCtx(void)
 {
     SCProfileDetectCtx *ctx = SCMalloc(sizeof(SCProfileDetectCtx));
     if (ctx != NULL) {
         memset(ctx, 0x00, sizeof(SCProfileDetectCtx));
+        ctx->gen = SC_ATOMIC_GET(profiling_rules_gen);
 
         if (pthread_mutex_init(&ctx->data_m, NULL) != 0) {
             SCLogError(SC_ERR_MUTEX,
@@ -580,7 +768,8 @@ SCProfileDetectCtx *SCProfilingRuleInitCtx(void)
 void SCProfilingRuleDestroyCtx(SCProfileDetectCtx *ctx)
 {
     if (ctx != NULL) {
-        SCProfilingRuleDump(ctx);
+        if (profiling_rules_enabled)
+            SCProfilingRuleDump(ctx);
         if (ctx->data != NULL)
             SCFree(ctx->data);
         pthread_mutex_destroy(&ctx->data_m);
@@ -588,62 +777,48 @@ void SCProfilingRuleDestroyCtx(SCProfileDetectCtx *ctx)
     }
 }
 
-void SCProfilingRuleThreadSetup(SCProfileDetectCtx *ctx, DetectEngineThreadCtx *det_ctx)
-{
-    if (ctx == NULL|| ctx->size == 0)
-        return;
-
-    SCProfileData *a = SCMalloc(sizeof(SCProfileData) * ctx->size);
-    if (a != NULL) {
-        memset(a, 0x00, sizeof(SCProfileData) * ctx->size);
-
-        det_ctx->rule_perf_data = a;
-        det_ctx->rule_perf_data_size = ctx->size;
-    }
-}
-
-static void SCProfilingRuleThreadMerge(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
-{
-    if (de_ctx == NULL || de_ctx->profile_ctx == NULL || de_ctx->profile_ctx->data == NULL ||
-        det_ctx == NULL || det_ctx->rule_perf_data == NULL)
-        return;
-
-    int i;
-    for (i = 0; i < det_ctx->rule_perf_data_size; i++) {
-        de_ctx->profile_ctx->data[i].checks += det_ctx->rule_perf_data[i].checks;
-        de_ctx->profile_ctx->data[i].matches += det_ctx->rule_perf_data[i].matches;
-        de_ctx->profile_ctx->data[i].ticks_match += det_ctx->rule_perf_data[i].ticks_match;
-        de_ctx->profile_ctx->data[i].ticks_no_match += det_ctx->rule_perf_data[i].ticks_no_match;
-        if (det_ctx->rule_perf_data[i].max > de_ctx->profile_ctx->data[i].max)
-            de_ctx->profile_ctx->data[i].max = det_ctx->rule_perf_data[i].max;
-    }
-}
-
 void SCProfilingRuleThreadCleanup(DetectEngineThreadCtx *det_ctx)
 {
     if (det_ctx == NULL || det_ctx->de_ctx == NULL || det_ctx->rule_perf_data == NULL)
         return;
 
-    pthread_mutex_lock(&det_ctx->de_ctx->profile_ctx->data_m);
-    SCProfilingRuleThreadMerge(det_ctx->de_ctx, det_ctx);
-    pthread_mutex_unlock(&det_ctx->de_ctx->profile_ctx->data_m);
+    SCProfileDetectCtx *ctx = det_ctx->de_ctx->profile_ctx;
+    if (ctx != NULL) {
+        pthread_mutex_lock(&ctx->data_m);
+        DetectEngineThreadCtx **t = &ctx->threads;
+        while (*t != NULL && *t != det_ctx)
+            t = &(*t)->rule_perf_next;
+        if (*t != NULL)
+            *t = det_ctx->rule_perf_next;
+
+        SCProfilingRuleCtxSync(ctx);
+        if (ctx->data != NULL && det_ctx->rule_perf_gen == ctx->gen) {
+            uint32_t i;
+            uint32_t n = MIN(ctx->size, det_ctx->rule_perf_data_size);
+            for (i = 0; i < n; i++) {
+                SCProfilingRuleDataAdd(&ctx->data[i], &det_ctx->rule_perf_data[i]);
+            }
+        }
+        pthread_mutex_unlock(&ctx->data_m);
+    }
 
     SCFree(det_ctx->rule_perf_data);
     det_ctx->rule_perf_data = NULL;
     det_ctx->rule_perf_data_size = 0;
+    det_ctx->rule_perf_next = NULL;
 }
 
 /**
  * \brief Register the rule profiling counters.
  *
+ * Done for every detection engine, so that profiling can be started at
+ * runtime.
+ *
  * \param de_ctx The active DetectEngineCtx, used to get at the loaded rules.
  */
 void
 SCProfilingRuleInitCounters(DetectEngineCtx *de_ctx)
 {
-    if (profiling_rules_enabled == 0)
-        return;
-
     de_ctx->profile_ctx = SCProfilingRuleInitCtx();
     BUG_ON(de_ctx->profile_ctx == NULL);
 
@@ -672,5 +847,108 @@ SCProfilingRuleInitCounters(DetectEngineCtx *de_ctx)
     SCLogPerf("Registered %"PRIu32" rule profiling counters.", count);
 }
 
-#endif /* PROFILING */
+#ifdef BUILD_UNIX_SOCKET
+/**
+ * \brief unix socket command to start sampling
+ *
+ * Optional arguments: "rate", profile 1 in rate packets or flows
+ * (default 1000), and "mode", "packets" or "flows". Counters of an
+ * earlier run are reset.
+ */
+TmEcode SCProfilingRulesStartCommand(json_t *cmd, json_t *answer, void *data)
+{
+    json_int_t rate = PROFILING_RULES_DEFAULT_SAMPLE_RATE;
+    int flows = 0;
+
+    json_t *jarg = json_object_get(cmd, "rate");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0 ||
+                json_integer_value(jarg) > UINT32_MAX) {
+            json_object_set_new(answer, "message", json_string("invalid rate"));
+            return TM_ECODE_FAILED;
+        }
+        rate = json_integer_value(jarg);
+    }
+    jarg = json_object_get(cmd, "mode");
+    if (jarg != NULL) {
+        const char *mode = json_is_string(jarg) ? json_string_value(jarg) : "";
+        if (strcmp(mode, "flows") == 0) {
+            flows = 1;
+        } else if (strcmp(mode, "packets") != 0) {
+            json_object_set_new(answer, "message",
+                    json_string("mode must be packets or flows"));
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    /* threads pick up the new settings with the next packet */
+    profiling_rules_active = 0;
+    profiling_rules_sample_rate = (uint32_t)rate;
+    profiling_rules_sample_flows = flows;
+    (void)SC_ATOMIC_ADD(profiling_rules_gen, 1);
+    profiling_rules_active = 1;
+
+    SCLogInfo("rule profiling started, sampling 1 in %"PRIu32" %s",
+            profiling_rules_sample_rate, flows ? "flows" : "packets");
+    json_object_set_new(answer, "message", json_string("rule profiling started"));
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief unix socket command to stop sampling, the counters are kept
+ *        for profiling-rules-dump
+ */
+TmEcode SCProfilingRulesStopCommand(json_t *cmd, json_t *answer, void *data)
+{
+    profiling_rules_active = 0;
+    SCLogInfo("rule profiling stopped");
+    json_object_set_new(answer, "message", json_string("rule profiling stopped"));
+    return TM_ECODE_OK;
+}
 
+/**
+ * \brief unix socket command returning the profile of the active
+ *        detection engine, in the json format of the rules profile
+ *
+ * Optional argument "limit", the number of rules (default 100).
+ */
+TmEcode SCProfilingRulesDumpCommand(json_t *cmd, json_t *answer, void *data)
+{
+    uint32_t limit = PROFILING_RULES_DEFAULT_DUMP_LIMIT;
+    json_t *jarg = json_object_get(cmd, "limit");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) <= 0) {
+            json_object_set_new(answer, "message", json_string("invalid limit"));
+            return TM_ECODE_FAILED;
+        }
+        if (json_integer_value(jarg) < UINT32_MAX)
+            limit = (uint32_t)json_integer_value(jarg);
+    }
+
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    if (de_ctx == NULL || de_ctx->profile_ctx == NULL) {
+        if (de_ctx != NULL)
+            DetectEngineDeReference(&de_ctx);
+        json_object_set_new(answer, "message", json_string("no detection engine"));
+        return TM_ECODE_FAILED;
+    }
+
+    uint64_t total_ticks = 0;
+    uint32_t count = de_ctx->profile_ctx->size;
+    SCProfileSummary *summary = SCProfilingRuleSummary(de_ctx->profile_ctx, &total_ticks);
+    DetectEngineDeReference(&de_ctx);
+    if (summary == NULL) {
+        json_object_set_new(answer, "message", json_string("no rules profiled"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *js = BuildJson(summary, count, total_ticks, limit);
+    SCFree(summary);
+    if (js == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        return TM_ECODE_FAILED;
+    }
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
@@ -31,6 +31,7 @@
 #include "detect.h"
 #include "conf.h"
 #include "flow-worker.h"
+#include "app-layer-protos.h"
 
 #include "tm-threads.h"
 
@@ -97,7 +98,6 @@ struct ProfileProtoRecords packet_profile_flowworker_data[PROFILE_FLOWWORKER_SIZ
 int profiling_packets_enabled = 0;
 int profiling_packets_csv_enabled = 0;
 
-int profiling_output_to_file = 0;
 int profiling_packets_output_to_file = 0;
 char *profiling_file_name;
 char *profiling_packets_file_name;
@@ -1071,6 +1071,94 @@ void SCProfilingAddPacket(Packet *p)
     pthread_mutex_unlock(&packet_profile_lock);
 }
 
+static uint64_t ProfileRecordsSum(const SCProfilePacketData *pd, int size)
+{
+    uint64_t tot = 0;
+    int i;
+    for (i = 0; i < size; i++)
+        tot += pd[i].tot;
+    return tot;
+}
+
+static void ProfileBenchmarkStage(FILE *fp, const char *name, uint64_t tot,
+        uint64_t samples, int *first)
+{
+    if (tot == 0 || name == NULL)
+        return;
+    fprintf(fp, "%s\"%s\":%.1f", *first ? "" : ",", name,
+            (double)tot / (double)samples);
+    *first = 0;
+}
+
+/**
+ *  \brief append the sampled cycles per stage to a JSON object
+ *
+ *  Writes the sampled_packets and stages members for the pcap replay
+ *  benchmark. The cycles of each stage are divided by the number of
+ *  sampled packets, so the stages add up to the cost of a packet.
+ */
+void SCProfilingBenchmarkStages(FILE *fp)
+{
+    pthread_mutex_lock(&packet_profile_lock);
+
+    uint64_t samples = 0;
+    int i;
+    for (i = 0; i < 257; i++)
+        samples += packet_profile_data4[i].cnt + packet_profile_data6[i].cnt;
+    fprintf(fp, ",\"sampled_packets\":%"PRIu64, samples);
+    if (samples == 0)
+        goto end;
+
+    uint64_t receive = 0, decode = 0, output = 0;
+    for (i = 0; i < TMM_SIZE; i++) {
+        if (i == TMM_FLOWWORKER)
+            continue;
+        uint64_t tot = ProfileRecordsSum(packet_profile_tmm_data4[i], 257) +
+            ProfileRecordsSum(packet_profile_tmm_data6[i], 257);
+        if (tmm_modules[i].flags & TM_FLAG_RECEIVE_TM)
+            receive += tot;
+        else if (tmm_modules[i].flags & TM_FLAG_DECODE_TM)
+            decode += tot;
+        else
+            output += tot;
+    }
+
+    uint64_t fw[PROFILE_FLOWWORKER_SIZE];
+    for (i = 0; i < PROFILE_FLOWWORKER_SIZE; i++) {
+        fw[i] = ProfileRecordsSum(packet_profile_flowworker_data[i].records4, 257) +
+            ProfileRecordsSum(packet_profile_flowworker_data[i].records6, 257);
+    }
+    uint64_t total = ProfileRecordsSum(packet_profile_data4, 257) +
+        ProfileRecordsSum(packet_profile_data6, 257);
+
+    int first = 1;
+    fprintf(fp, ",\"stages\":{");
+    ProfileBenchmarkStage(fp, "total", total, samples, &first);
+    ProfileBenchmarkStage(fp, "receive", receive, samples, &first);
+    ProfileBenchmarkStage(fp, "decode", decode, samples, &first);
+    ProfileBenchmarkStage(fp, "flow", fw[PROFILE_FLOWWORKER_FLOW], samples, &first);
+    ProfileBenchmarkStage(fp, "stream", fw[PROFILE_FLOWWORKER_STREAM], samples, &first);
+    ProfileBenchmarkStage(fp, "app-layer-udp", fw[PROFILE_FLOWWORKER_APPLAYERUDP], samples, &first);
+    ProfileBenchmarkStage(fp, "detect", fw[PROFILE_FLOWWORKER_DETECT], samples, &first);
+    ProfileBenchmarkStage(fp, "output", output, samples, &first);
+
+    /* app layer parsing is part of stream and app-layer-udp, split out
+     * per protocol */
+    fprintf(fp, "%s\"app-layer\":{", first ? "" : ",");
+    first = 1;
+    ProfileBenchmarkStage(fp, "proto-detect",
+            ProfileRecordsSum(packet_profile_app_pd_data4, 257) +
+            ProfileRecordsSum(packet_profile_app_pd_data6, 257), samples, &first);
+    for (i = 0; i < ALPROTO_MAX; i++) {
+        ProfileBenchmarkStage(fp, AppProtoToString(i),
+                ProfileRecordsSum(packet_profile_app_data4[i], 257) +
+                ProfileRecordsSum(packet_profile_app_data6[i], 257), samples, &first);
+    }
+    fprintf(fp, "}}");
+end:
+    pthread_mutex_unlock(&packet_profile_lock);
+}
+
 PktProfiling *SCProfilePacketStart(void)
 {
     uint64_t sample = SC_ATOMIC_ADD(samples, 1);
@@ -1081,23 +1169,6 @@ PktProfiling *SCProfilePacketStart(void)
 }
 
 /* see if we want to profile rules for this packet */
-int SCProfileRuleStart(Packet *p)
-{
-#ifdef PROFILE_LOCKING
-    if (p->profile != NULL) {
-        p->flags |= PKT_PROFILE;
-        return 1;
-    }
-#else
-    uint64_t sample = SC_ATOMIC_ADD(samples, 1);
-    if (sample % rate == 0) {
-        p->flags |= PKT_PROFILE;
-        return 1;
-    }
-#endif
-    return 0;
-}
-
 #define CASE_CODE(E)  case E: return #E
 
 /**
@@ -1127,6 +1198,7 @@ const char * PacketProfileDetectIdToString(PacketProfileDetectId id)
         CASE_CODE (PROF_DETECT_MPM_HUAD);
         CASE_CODE (PROF_DETECT_MPM_DNSQUERY);
         CASE_CODE (PROF_DETECT_MPM_TLSSNI);
+        CASE_CODE (PROF_DETECT_MPM_HTTP);
         CASE_CODE (PROF_DETECT_IPONLY);
         CASE_CODE (PROF_DETECT_RULES);
         CASE_CODE (PROF_DETECT_PREFILTER);
@@ -25,40 +25,60 @@
 #ifndef __UTIL_PROFILE_H__
 #define __UTIL_PROFILE_H__
 
-#ifdef PROFILING
-
-#include "util-profiling-locks.h"
 #include "util-cpu.h"
+#include "tm-threads-common.h"
+
+/* Rule profiling is part of every build. It samples 1 in N packets or
+ * flows per detect thread and can be started and stopped at runtime,
+ * so when it's off the only cost is a branch per packet and one per
+ * inspected rule. */
 
 extern int profiling_rules_enabled;
-extern int profiling_packets_enabled;
-extern int profiling_sghs_enabled;
-extern __thread int profiling_rules_entered;
+extern int profiling_rules_active;
 
-void SCProfilingPrintPacketProfile(Packet *);
-void SCProfilingAddPacket(Packet *);
-int SCProfileRuleStart(Packet *p);
+void SCProfilingRuleSample(struct DetectEngineThreadCtx_ *, struct Packet_ *);
+
+/** pick the packets to profile, once per packet before the rules
+ *  are inspected */
+#define RULE_PROFILING_SAMPLE(ctx, p) \
+    if (unlikely(profiling_rules_active)) { \
+        SCProfilingRuleSample((ctx), (p)); \
+    }
 
 #define RULE_PROFILING_START(p) \
     uint64_t profile_rule_start_ = 0; \
-    uint64_t profile_rule_end_ = 0; \
-    if (profiling_rules_enabled && SCProfileRuleStart((p))) { \
-        if (profiling_rules_entered > 0) { \
-            SCLogError(SC_ERR_FATAL, "Re-entered profiling, exiting."); \
-            exit(1); \
-        } \
-        profiling_rules_entered++; \
+    if (unlikely((p)->flags & PKT_PROFILE)) { \
         profile_rule_start_ = UtilCpuGetTicks(); \
     }
 
 #define RULE_PROFILING_END(ctx, r, m, p) \
-    if (profiling_rules_enabled && ((p)->flags & PKT_PROFILE)) { \
-        profile_rule_end_ = UtilCpuGetTicks(); \
+    if (unlikely((p)->flags & PKT_PROFILE)) { \
         SCProfilingRuleUpdateCounter(ctx, r->profiling_id, \
-            profile_rule_end_ - profile_rule_start_, m); \
-        profiling_rules_entered--; \
+            UtilCpuGetTicks() - profile_rule_start_, m); \
     }
 
+void SCProfilingRulesGlobalInit(void);
+void SCProfilingRuleDestroyCtx(struct SCProfileDetectCtx_ *);
+void SCProfilingRuleInitCounters(struct DetectEngineCtx_ *);
+void SCProfilingRuleUpdateCounter(struct DetectEngineThreadCtx_ *, uint32_t, uint64_t, int);
+void SCProfilingRuleThreadCleanup(struct DetectEngineThreadCtx_ *);
+#ifdef BUILD_UNIX_SOCKET
+TmEcode SCProfilingRulesStartCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode SCProfilingRulesStopCommand(json_t *cmd, json_t *answer, void *data);
+TmEcode SCProfilingRulesDumpCommand(json_t *cmd, json_t *answer, void *data);
+#endif
+
+#ifdef PROFILING
+
+#include "util-profiling-locks.h"
+
+extern int profiling_packets_enabled;
+extern int profiling_sghs_enabled;
+extern __thread int profiling_rules_entered;
+
+void SCProfilingPrintPacketProfile(Packet *);
+void SCProfilingAddPacket(Packet *);
+
 extern int profiling_keyword_enabled;
 extern __thread int profiling_keyword_entered;
 
@@ -256,13 +276,6 @@ PktProfiling *SCProfilePacketStart(void);
     }
 
 
-void SCProfilingRulesGlobalInit(void);
-void SCProfilingRuleDestroyCtx(struct SCProfileDetectCtx_ *);
-void SCProfilingRuleInitCounters(DetectEngineCtx *);
-void SCProfilingRuleUpdateCounter(DetectEngineThreadCtx *, uint16_t, uint64_t, int);
-void SCProfilingRuleThreadSetup(struct SCProfileDetectCtx_ *, DetectEngineThreadCtx *);
-void SCProfilingRuleThreadCleanup(DetectEngineThreadCtx *);
-
 void SCProfilingKeywordsGlobalInit(void);
 void SCProfilingKeywordDestroyCtx(DetectEngineCtx *);//struct SCProfileKeywordDetectCtx_ *);
 void SCProfilingKeywordInitCounters(DetectEngineCtx *);
@@ -281,12 +294,10 @@ void SCProfilingInit(void);
 void SCProfilingDestroy(void);
 void SCProfilingRegisterTests(void);
 void SCProfilingDump(void);
+void SCProfilingBenchmarkStages(FILE *fp);
 
 #else
 
-#define RULE_PROFILING_START(p)
-#define RULE_PROFILING_END(a,b,c,p)
-
 #define KEYWORD_PROFILING_SET_LIST(a,b)
 #define KEYWORD_PROFILING_START
 #define KEYWORD_PROFILING_END(a,b,c)
@@ -1657,6 +1657,38 @@ void SCRadixPrintTree(SCRadixTree *tree)
     return;
 }
 
+static void SCRadixWalkSubtree(SCRadixNode *node, SCRadixWalkFunc Func, void *data)
+{
+    if (node == NULL)
+        return;
+
+    if (node->prefix != NULL) {
+        SCRadixUserData *ud = node->prefix->user_data;
+        for ( ; ud != NULL; ud = ud->next) {
+            Func(node->prefix->stream, node->prefix->bitlen, ud->netmask,
+                 ud->user, data);
+        }
+    }
+    SCRadixWalkSubtree(node->left, Func, data);
+    SCRadixWalkSubtree(node->right, Func, data);
+}
+
+/**
+ * \brief Calls Func for each key/netmask stored in the tree, with the key,
+ *        its bitlen, the netmask (255 for non ip keys) and the user data
+ *
+ * \param tree Pointer to the Radix tree
+ * \param Func callback
+ * \param data passed to the callback
+ */
+void SCRadixWalk(SCRadixTree *tree, SCRadixWalkFunc Func, void *data)
+{
+    if (tree == NULL)
+        return;
+
+    SCRadixWalkSubtree(tree->head, Func, data);
+}
+
 /*------------------------------------Unit_Tests------------------------------*/
 
 #ifdef UNITTESTS
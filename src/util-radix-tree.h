@@ -127,6 +127,9 @@ SCRadixNode *SCRadixFindKeyIPV6ExactMatch(uint8_t *, SCRadixTree *, void **);
 SCRadixNode *SCRadixFindKeyIPV6Netblock(uint8_t *, SCRadixTree *, uint8_t, void **);
 SCRadixNode *SCRadixFindKeyIPV6BestMatch(uint8_t *, SCRadixTree *, void **);
 
+typedef void (*SCRadixWalkFunc)(const uint8_t *, uint16_t, uint8_t, void *, void *);
+void SCRadixWalk(SCRadixTree *, SCRadixWalkFunc, void *);
+
 void SCRadixPrintTree(SCRadixTree *);
 void SCRadixPrintNodeInfo(SCRadixNode *, int,  void (*PrintData)(void*));
 
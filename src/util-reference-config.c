@@ -25,6 +25,7 @@
 #include "detect.h"
 #include "detect-engine.h"
 #include "util-hash.h"
+#include "util-rohash.h"
 
 #include "util-reference-config.h"
 #include "conf.h"
@@ -201,6 +202,10 @@ static void SCRConfDeInitLocalResources(DetectEngineCtx *de_ctx, FILE *fd)
  */
 void SCRConfDeInitContext(DetectEngineCtx *de_ctx)
 {
+    if (de_ctx->reference_conf_ro != NULL)
+        ROHashMapFree(de_ctx->reference_conf_ro);
+    de_ctx->reference_conf_ro = NULL;
+
     if (de_ctx->reference_conf_ht != NULL)
         HashTableFree(de_ctx->reference_conf_ht);
 
@@ -282,6 +287,12 @@ static int SCRConfAddReference(char *rawstr, DetectEngineCtx *de_ctx)
 
     /* Check if the Reference is present in the HashTable.  In case it's present
      * ignore it, as it's a duplicate.  If not present, add it to the table */
+    /* the frozen lookup no longer matches the table */
+    if (de_ctx->reference_conf_ro != NULL) {
+        ROHashMapFree(de_ctx->reference_conf_ro);
+        de_ctx->reference_conf_ro = NULL;
+    }
+
     ref_lookup = HashTableLookup(de_ctx->reference_conf_ht, ref_new, 0);
     if (ref_lookup == NULL) {
         if (HashTableAdd(de_ctx->reference_conf_ht, ref_new, 0) < 0) {
@@ -489,6 +500,42 @@ void SCRConfReferenceHashFree(void *data)
     return;
 }
 
+/**
+ * \brief Sets up the frozen reference system lookup for the rule parsing.
+ *
+ *        On error the lookups keep using the hash table.
+ */
+static void SCRConfFreeze(DetectEngineCtx *de_ctx)
+{
+    HashTable *ht = de_ctx->reference_conf_ht;
+    uint32_t i;
+
+    if (ht == NULL || de_ctx->reference_conf_ro != NULL)
+        return;
+
+    ROHashMap *map = ROHashMapInit();
+    if (map == NULL)
+        return;
+
+    int cnt = 0;
+    for (i = 0; i < ht->array_size; i++) {
+        HashTableBucket *b;
+        for (b = ht->array[i]; b != NULL; b = b->next) {
+            SCRConfReference *ref = b->data;
+            if (ROHashMapQueue(map, ref->system, strlen(ref->system), ref) != 1)
+                goto error;
+            cnt++;
+        }
+    }
+    if (cnt == 0 || ROHashMapFreeze(map) != 1)
+        goto error;
+
+    de_ctx->reference_conf_ro = map;
+    return;
+error:
+    ROHashMapFree(map);
+}
+
 /**
  * \brief Loads the Reference info from the reference.config file.
  *
@@ -518,6 +565,7 @@ int SCRConfLoadReferenceConfigFile(DetectEngineCtx *de_ctx, FILE *fd)
 
     SCRConfParseFile(de_ctx, fd);
     SCRConfDeInitLocalResources(de_ctx, fd);
+    SCRConfFreeze(de_ctx);
 
     return 0;
 }
@@ -536,6 +584,18 @@ int SCRConfLoadReferenceConfigFile(DetectEngineCtx *de_ctx, FILE *fd)
 SCRConfReference *SCRConfGetReference(const char *rconf_name,
                                       DetectEngineCtx *de_ctx)
 {
+    if (de_ctx->reference_conf_ro != NULL) {
+        size_t len = strlen(rconf_name);
+        if (len > UINT16_MAX)
+            return NULL;
+        char name[len + 1];
+        size_t s;
+        for (s = 0; s < len; s++)
+            name[s] = tolower((unsigned char)rconf_name[s]);
+        name[s] = '\0';
+        return ROHashMapLookup(de_ctx->reference_conf_ro, name, (uint16_t)len);
+    }
+
     SCRConfReference *ref_conf = SCRConfAllocSCRConfReference(rconf_name, NULL);
     if (ref_conf == NULL)
         return NULL;
@@ -32,6 +32,16 @@
  *
  * \todo maybe add a user ctx to be returned instead, something like a
  *       4/8 byte ptr or simply a flag
+ *
+ * ROHashMap is the keyed variant for data that is frozen once the
+ * detection engine is built: variable length keys map to a pointer.
+ * Freezing builds a perfect hash (hash and displace): keys are put in
+ * buckets by one part of their hash, and per bucket, largest first, a
+ * displacement is searched that puts all its keys in free slots. A
+ * lookup is then a hash, a displacement read and a single key compare.
+ * The frozen table is one allocation that is never written, so it's
+ * shared by the detect threads without locks and stays shared after a
+ * fork.
  */
 
 #include "suricata-common.h"
@@ -39,6 +49,7 @@
 #include "util-unittest.h"
 #include "util-memcmp.h"
 #include "util-hash-lookup3.h"
+#include "util-hash-fast.h"
 #include "queue.h"
 #include "util-rohash.h"
 
@@ -247,3 +258,413 @@ int ROHashInitFinalize(ROHashTable *table)
     table->locked = 1;
     return 1;
 }
+
+/** queued key and value, the key follows */
+typedef struct ROHashMapItem_ {
+    void *value;
+    uint32_t hash;      /**< picks the bucket */
+    uint32_t hash2;     /**< picks the slot with the displacement */
+    uint16_t key_len;
+    TAILQ_ENTRY(ROHashMapItem_) next;
+} ROHashMapItem;
+
+#define ROHASH_MAP_SEEDS        16
+#define ROHASH_MAP_MAX_DISP     65536
+
+/** \internal
+ *  \brief two independent hashes, as with many keys a pair with the same
+ *         32 bit hash is likely, and those would never get apart */
+static inline void ROHashMapHash(const void *key, uint16_t key_len,
+        uint32_t seed, uint32_t *hash, uint32_t *hash2)
+{
+    *hash = hashlittle_safe(key, key_len, seed);
+    *hash2 = hashlittle_safe(key, key_len, seed ^ 0x9e3779b9U);
+}
+
+static inline uint32_t ROHashMapSlotFor(uint32_t hash, uint32_t disp,
+        uint32_t slots)
+{
+    return HashFastFmix32(hash ^ (disp * 0x9e3779b9U)) % slots;
+}
+
+ROHashMap *ROHashMapInit(void)
+{
+    ROHashMap *map = SCMalloc(sizeof(ROHashMap));
+    if (unlikely(map == NULL)) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "failed to alloc memory");
+        return NULL;
+    }
+    memset(map, 0, sizeof(ROHashMap));
+    TAILQ_INIT(&map->head);
+    return map;
+}
+
+void ROHashMapFree(ROHashMap *map)
+{
+    if (map == NULL)
+        return;
+
+    ROHashMapItem *item;
+    while ((item = TAILQ_FIRST(&map->head))) {
+        TAILQ_REMOVE(&map->head, item, next);
+        SCFree(item);
+    }
+    if (map->data != NULL)
+        SCFree(map->data);
+    SCFree(map);
+}
+
+uint32_t ROHashMapMemorySize(const ROHashMap *map)
+{
+    return (uint32_t)sizeof(ROHashMap) + map->data_size;
+}
+
+/** \brief queue a key with its value
+ *
+ *  \note adding a key twice is an error at freeze time
+ *
+ *  \retval 0 error
+ *  \retval 1 ok
+ */
+int ROHashMapQueue(ROHashMap *map, const void *key, uint16_t key_len, void *value)
+{
+    if (map->locked) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "can't add value to locked table");
+        return 0;
+    }
+    if (key_len == 0) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "empty key");
+        return 0;
+    }
+
+    ROHashMapItem *item = SCMalloc(sizeof(ROHashMapItem) + key_len);
+    if (unlikely(item == NULL))
+        return 0;
+    memset(item, 0x00, sizeof(ROHashMapItem));
+    item->value = value;
+    item->key_len = key_len;
+    memcpy((uint8_t *)item + sizeof(ROHashMapItem), key, key_len);
+    TAILQ_INSERT_TAIL(&map->head, item, next);
+    map->items++;
+    return 1;
+}
+
+static inline const uint8_t *ROHashMapItemKey(const ROHashMapItem *item)
+{
+    return (const uint8_t *)item + sizeof(ROHashMapItem);
+}
+
+typedef struct ROHashMapBuild_ {
+    ROHashMapItem **items;      /**< grouped by bucket */
+    uint32_t *bucket_start;     /**< first of the bucket in 'items' */
+    uint32_t *bucket_cnt;
+    uint32_t *order;            /**< buckets, largest first */
+    uint8_t *taken;             /**< per slot */
+    uint32_t *cand;             /**< slots of the bucket being placed */
+} ROHashMapBuild;
+
+static ROHashMapBuild *rohash_map_sort_build = NULL;
+
+static int ROHashMapBucketCompare(const void *a, const void *b)
+{
+    uint32_t ba = *(const uint32_t *)a, bb = *(const uint32_t *)b;
+    uint32_t ca = rohash_map_sort_build->bucket_cnt[ba];
+    uint32_t cb = rohash_map_sort_build->bucket_cnt[bb];
+    if (ca != cb)
+        return (ca > cb) ? -1 : 1;
+    return (ba < bb) ? -1 : (ba > bb);
+}
+
+/** \internal
+ *  \brief find a displacement for every bucket with 'seed'
+ *
+ *  \retval 1 all placed, disp is set
+ *  \retval 0 retry with another seed
+ *  \retval -1 duplicate key
+ */
+static int ROHashMapPlace(ROHashMap *map, ROHashMapBuild *b, uint32_t *disp)
+{
+    uint32_t x;
+    ROHashMapItem *item;
+
+    memset(b->bucket_cnt, 0, map->buckets * sizeof(uint32_t));
+    memset(b->taken, 0, map->slots);
+    memset(disp, 0, map->buckets * sizeof(uint32_t));
+
+    TAILQ_FOREACH(item, &map->head, next) {
+        ROHashMapHash(ROHashMapItemKey(item), item->key_len, map->seed,
+                &item->hash, &item->hash2);
+        b->bucket_cnt[item->hash % map->buckets]++;
+    }
+    uint32_t total = 0;
+    for (x = 0; x < map->buckets; x++) {
+        b->bucket_start[x] = total;
+        total += b->bucket_cnt[x];
+        b->order[x] = x;
+    }
+    /* bucket_cnt is used as fill counter, then restored */
+    memset(b->bucket_cnt, 0, map->buckets * sizeof(uint32_t));
+    TAILQ_FOREACH(item, &map->head, next) {
+        uint32_t bucket = item->hash % map->buckets;
+        b->items[b->bucket_start[bucket] + b->bucket_cnt[bucket]++] = item;
+    }
+
+    /* qsort has no user data argument, init time is single threaded */
+    rohash_map_sort_build = b;
+    qsort(b->order, map->buckets, sizeof(uint32_t), ROHashMapBucketCompare);
+    rohash_map_sort_build = NULL;
+
+    for (x = 0; x < map->buckets; x++) {
+        uint32_t bucket = b->order[x];
+        uint32_t cnt = b->bucket_cnt[bucket];
+        if (cnt == 0)
+            break;
+        ROHashMapItem **bitems = &b->items[b->bucket_start[bucket]];
+
+        uint32_t i, j;
+        for (i = 0; i < cnt; i++) {
+            for (j = i + 1; j < cnt; j++) {
+                if (bitems[i]->hash2 == bitems[j]->hash2 &&
+                    bitems[i]->key_len == bitems[j]->key_len &&
+                    memcmp(ROHashMapItemKey(bitems[i]), ROHashMapItemKey(bitems[j]),
+                        bitems[i]->key_len) == 0)
+                    return -1;
+            }
+        }
+
+        uint32_t d;
+        for (d = 0; d < ROHASH_MAP_MAX_DISP; d++) {
+            for (i = 0; i < cnt; i++) {
+                uint32_t s = ROHashMapSlotFor(bitems[i]->hash2, d, map->slots);
+                if (b->taken[s])
+                    break;
+                /* mark now so keys of the same bucket don't share slots */
+                b->taken[s] = 1;
+                b->cand[i] = s;
+            }
+            if (i == cnt)
+                break;
+            while (i-- > 0)
+                b->taken[b->cand[i]] = 0;
+        }
+        if (d == ROHASH_MAP_MAX_DISP)
+            return 0;
+        disp[bucket] = d;
+    }
+    return 1;
+}
+
+/** \brief build the frozen table from the queued keys
+ *
+ *  \retval 0 error, like a duplicate key
+ *  \retval 1 ok
+ *
+ *  \note after this call nothing can be added to the map anymore.
+ */
+int ROHashMapFreeze(ROHashMap *map)
+{
+    if (map->locked) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "table already locked");
+        return 0;
+    }
+
+    int result = 0;
+    ROHashMapItem *item;
+    uint32_t key_bytes = 0;
+    TAILQ_FOREACH(item, &map->head, next) {
+        key_bytes += item->key_len;
+    }
+
+    /* about four keys per bucket and a load of 0.8 */
+    map->buckets = map->items / 4 + 1;
+    map->slots = map->items + map->items / 4 + 1;
+
+    ROHashMapBuild b;
+    memset(&b, 0, sizeof(b));
+    b.items = SCMalloc((map->items + 1) * sizeof(ROHashMapItem *));
+    b.bucket_start = SCMalloc(map->buckets * sizeof(uint32_t));
+    b.bucket_cnt = SCMalloc(map->buckets * sizeof(uint32_t));
+    b.order = SCMalloc(map->buckets * sizeof(uint32_t));
+    b.taken = SCMalloc(map->slots);
+    b.cand = SCMalloc((map->items + 1) * sizeof(uint32_t));
+
+    map->data_size = map->buckets * sizeof(uint32_t) +
+        map->slots * sizeof(ROHashMapSlot) + key_bytes;
+    map->data = SCMalloc(map->data_size);
+    if (b.items == NULL || b.bucket_start == NULL || b.bucket_cnt == NULL ||
+        b.order == NULL || b.taken == NULL || b.cand == NULL ||
+        map->data == NULL)
+    {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "failed to alloc memory");
+        goto end;
+    }
+    memset(map->data, 0x00, map->data_size);
+    /* slots first, they contain pointers */
+    map->slot = (ROHashMapSlot *)map->data;
+    map->disp = (uint32_t *)((uint8_t *)map->data + map->slots * sizeof(ROHashMapSlot));
+    map->keys = (uint8_t *)(map->disp + map->buckets);
+
+    int placed = 0;
+    int attempt;
+    for (attempt = 0; attempt < ROHASH_MAP_SEEDS && placed == 0; attempt++) {
+        map->seed = 0x5eed + attempt;
+        placed = ROHashMapPlace(map, &b, map->disp);
+    }
+    if (placed == -1) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "duplicate key");
+        goto end;
+    } else if (placed == 0) {
+        SCLogError(SC_ERR_HASH_TABLE_INIT, "no perfect hash found for %u keys",
+                map->items);
+        goto end;
+    }
+
+    uint32_t key_offset = 0;
+    TAILQ_FOREACH(item, &map->head, next) {
+        uint32_t s = ROHashMapSlotFor(item->hash2,
+                map->disp[item->hash % map->buckets], map->slots);
+        ROHashMapSlot *slot = &map->slot[s];
+        slot->value = item->value;
+        slot->key_offset = key_offset;
+        slot->key_len = item->key_len;
+        memcpy(map->keys + key_offset, ROHashMapItemKey(item), item->key_len);
+        key_offset += item->key_len;
+    }
+
+    /* clean up temp items */
+    while ((item = TAILQ_FIRST(&map->head))) {
+        TAILQ_REMOVE(&map->head, item, next);
+        SCFree(item);
+    }
+    map->locked = 1;
+    result = 1;
+end:
+    if (!result && map->data != NULL) {
+        SCFree(map->data);
+        map->data = NULL;
+        map->data_size = 0;
+    }
+    if (b.items != NULL)
+        SCFree(b.items);
+    if (b.bucket_start != NULL)
+        SCFree(b.bucket_start);
+    if (b.bucket_cnt != NULL)
+        SCFree(b.bucket_cnt);
+    if (b.order != NULL)
+        SCFree(b.order);
+    if (b.taken != NULL)
+        SCFree(b.taken);
+    if (b.cand != NULL)
+        SCFree(b.cand);
+    return result;
+}
+
+/**
+ *  \retval NULL not found or map not frozen
+ *  \retval value of the key
+ */
+void *ROHashMapLookup(const ROHashMap *map, const void *key, uint16_t key_len)
+{
+    if (!map->locked || key_len == 0)
+        return NULL;
+
+    uint32_t hash, hash2;
+    ROHashMapHash(key, key_len, map->seed, &hash, &hash2);
+    uint32_t s = ROHashMapSlotFor(hash2, map->disp[hash % map->buckets],
+            map->slots);
+    const ROHashMapSlot *slot = &map->slot[s];
+    if (slot->key_len == key_len &&
+        SCMemcmp(map->keys + slot->key_offset, key, key_len) == 0)
+        return slot->value;
+    return NULL;
+}
+
+#ifdef UNITTESTS
+static int ROHashMapTest01(void)
+{
+    int result = 0;
+    char key[32];
+    int i;
+
+    ROHashMap *map = ROHashMapInit();
+    if (map == NULL)
+        return 0;
+
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        if (ROHashMapQueue(map, key, strlen(key), (void *)(uintptr_t)(i + 1)) != 1)
+            goto end;
+    }
+    /* nothing found before the freeze */
+    if (ROHashMapLookup(map, "key-1", 5) != NULL)
+        goto end;
+    if (ROHashMapFreeze(map) != 1)
+        goto end;
+    if (ROHashMapQueue(map, "late", 4, map) != 0)
+        goto end;
+
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        void *v = ROHashMapLookup(map, key, strlen(key));
+        if (v != (void *)(uintptr_t)(i + 1)) {
+            printf("%s: %p: ", key, v);
+            goto end;
+        }
+    }
+    for (i = 1000; i < 2000; i++) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        if (ROHashMapLookup(map, key, strlen(key)) != NULL) {
+            printf("%s found: ", key);
+            goto end;
+        }
+    }
+    /* prefix of a key */
+    if (ROHashMapLookup(map, "key-1", 4) != NULL)
+        goto end;
+
+    result = 1;
+end:
+    ROHashMapFree(map);
+    return result;
+}
+
+/** \test duplicate keys fail the freeze, a single key works */
+static int ROHashMapTest02(void)
+{
+    int result = 0;
+    ROHashMap *map = ROHashMapInit();
+    if (map == NULL)
+        return 0;
+
+    if (ROHashMapQueue(map, "dup", 3, map) != 1 ||
+        ROHashMapQueue(map, "dup", 3, map) != 1)
+        goto end;
+    if (ROHashMapFreeze(map) != 0)
+        goto end;
+    ROHashMapFree(map);
+
+    map = ROHashMapInit();
+    if (map == NULL)
+        return 0;
+    if (ROHashMapQueue(map, "one", 3, map) != 1)
+        goto end;
+    if (ROHashMapFreeze(map) != 1)
+        goto end;
+    if (ROHashMapLookup(map, "one", 3) != map ||
+        ROHashMapLookup(map, "two", 3) != NULL)
+        goto end;
+
+    result = 1;
+end:
+    ROHashMapFree(map);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void ROHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ROHashMapTest01", ROHashMapTest01);
+    UtRegisterTest("ROHashMapTest02", ROHashMapTest02);
+#endif /* UNITTESTS */
+}
@@ -45,4 +45,40 @@ uint32_t ROHashMemorySize(ROHashTable *table);
 /* run time */
 void *ROHashLookup(ROHashTable *table, void *data, uint16_t size);
 
+/** slot of a frozen ROHashMap */
+typedef struct ROHashMapSlot_ {
+    void *value;
+    uint32_t key_offset;    /**< offset of the key in ROHashMap::keys */
+    uint16_t key_len;       /**< 0 if the slot is unused */
+} ROHashMapSlot;
+
+/** Read only map of byte string keys to pointers. Keys and values are
+ *  queued, then frozen into a single block with a perfect hash, so each
+ *  lookup probes exactly one slot. */
+typedef struct ROHashMap_ {
+    uint8_t locked;
+    uint32_t items;
+    uint32_t seed;
+    uint32_t buckets;       /**< size of 'disp' */
+    uint32_t slots;         /**< size of 'slot' */
+    uint32_t *disp;         /**< displacement per bucket */
+    ROHashMapSlot *slot;
+    uint8_t *keys;
+    void *data;             /**< one allocation holding disp, slot and keys */
+    uint32_t data_size;
+    TAILQ_HEAD(, ROHashMapItem_) head;
+} ROHashMap;
+
+/* init time */
+ROHashMap *ROHashMapInit(void);
+int ROHashMapQueue(ROHashMap *map, const void *key, uint16_t key_len, void *value);
+int ROHashMapFreeze(ROHashMap *map);
+void ROHashMapFree(ROHashMap *map);
+uint32_t ROHashMapMemorySize(const ROHashMap *map);
+
+/* run time */
+void *ROHashMapLookup(const ROHashMap *map, const void *key, uint16_t key_len);
+
+void ROHashRegisterTests(void);
+
 #endif /* __UTIL_ROHASH_H__ */
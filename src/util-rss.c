@@ -0,0 +1,236 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Automatic RSS setup of capture interfaces for the workers runmode.
+ *
+ * In workers mode each thread should see all packets of the flows it
+ * handles. This sets up the NIC so it does: one RSS queue per worker, a
+ * symmetric Toeplitz key so both directions of a flow land on the same
+ * queue, the flow director's flow steering off and the IRQ of each queue
+ * on the cpu of its worker. The resulting mapping is logged at start up.
+ */
+
+#include "suricata-common.h"
+#include "runmodes.h"
+#include "util-affinity.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-ioctl.h"
+#include "util-rss.h"
+#include "util-unittest.h"
+
+/**
+ * \internal
+ * \brief get the irq of a /proc/interrupts line if it is an rx queue
+ *        of 'iface'
+ *
+ * Queue irqs are named after the interface, like "eth0-TxRx-3" or
+ * "i40e-eth0-TxRx-3". The link irq, named just "eth0", and tx only
+ * queues are skipped.
+ *
+ * \retval irq or -1
+ */
+static int RSSParseIrqLine(const char *line, const char *iface)
+{
+    char *end = NULL;
+    long irq = strtol(line, &end, 10);
+    if (end == line || *end != ':' || irq < 0 || irq > INT_MAX)
+        return -1;
+
+    /* the name is the last field */
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1]))
+        len--;
+    size_t start = len;
+    while (start > 0 && !isspace((unsigned char)line[start - 1]))
+        start--;
+    if (start == len)
+        return -1;
+
+    char name[64];
+    if (len - start >= sizeof(name))
+        return -1;
+    memcpy(name, line + start, len - start);
+    name[len - start] = '\0';
+
+    if (strstr(name, "-tx-") != NULL)
+        return -1;
+
+    const size_t ilen = strlen(iface);
+    const char *p = name;
+    while ((p = strstr(p, iface)) != NULL) {
+        if ((p == name || p[-1] == '-') && p[ilen] == '-')
+            return (int)irq;
+        p++;
+    }
+    return -1;
+}
+
+/**
+ * \internal
+ * \brief get the queue irqs of 'iface', in queue order
+ *
+ * \retval cnt number of irqs stored in 'irqs'
+ */
+static int RSSGetIfaceIrqs(const char *iface, int *irqs, int max)
+{
+    FILE *fp = fopen("/proc/interrupts", "r");
+    if (fp == NULL)
+        return 0;
+
+    char line[4096];
+    int cnt = 0;
+    while (cnt < max && fgets(line, sizeof(line), fp) != NULL) {
+        int irq = RSSParseIrqLine(line, iface);
+        if (irq >= 0)
+            irqs[cnt++] = irq;
+    }
+    fclose(fp);
+    return cnt;
+}
+
+static int RSSSetIrqCpu(int irq, int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_SYSCALL, "can't set affinity of irq %d: %s",
+                irq, strerror(errno));
+        return -1;
+    }
+    int r = fprintf(fp, "%d\n", cpu);
+    if (fclose(fp) != 0 || r < 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "can't set affinity of irq %d to "
+                "cpu %d: %s", irq, cpu, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \internal
+ * \brief list the cpus of the worker cpu set
+ *
+ * \retval cnt number of cpus, 0 if no cpu affinity is configured
+ */
+static int RSSGetWorkerCpus(int *cpus, int max)
+{
+    int cnt = 0;
+#if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined OS_DARWIN
+    if (threading_set_cpu_affinity != TRUE)
+        return 0;
+
+    const ThreadsAffinityType *taf = &thread_affinity[WORKER_CPU_SET];
+    const int ncpu = UtilCpuGetNumProcessorsConfigured();
+    int cpu;
+    for (cpu = 0; cpu < ncpu && cnt < max; cpu++) {
+        if (CPU_ISSET(cpu, &taf->cpu_set))
+            cpus[cnt++] = cpu;
+    }
+#endif
+    return cnt;
+}
+
+/**
+ * \brief set up RSS of 'iface' for the workers runmode and log the result
+ *
+ * \param queues queues to use, 0 for one per worker cpu
+ *
+ * \retval queues number of queues in use, so the number of capture
+ *                threads to use
+ * \retval -1 the queue count couldn't be set
+ */
+int RSSSetupIface(const char *iface, int queues)
+{
+    int cpus[RSS_MAX_QUEUES];
+    const int ncpus = RSSGetWorkerCpus(cpus, RSS_MAX_QUEUES);
+
+    if (queues <= 0)
+        queues = ncpus > 0 ? ncpus : (int)UtilCpuGetNumProcessorsOnline();
+    if (queues > RSS_MAX_QUEUES)
+        queues = RSS_MAX_QUEUES;
+
+    queues = SetIfaceRSSQueuesNum(iface, queues);
+    if (queues <= 0) {
+        SCLogWarning(SC_ERR_NIC_OFFLOADING, "%s: RSS setup failed, configure "
+                "the RSS queues and hash manually", iface);
+        return -1;
+    }
+
+    const int symmetric = (SetIfaceRSSSymmetric(iface, queues) == 0);
+    const int fdir = DisableIfaceFlowDirector(iface);
+
+    SCLogConfig("%s: RSS set up with %d queues, %s hash%s", iface, queues,
+            symmetric ? "symmetric" : "unchanged (may be asymmetric)",
+            fdir == 1 ? ", flow director steering disabled" : "");
+    if (!symmetric) {
+        SCLogWarning(SC_ERR_NIC_OFFLOADING, "%s: couldn't set a symmetric "
+                "RSS hash, flows may be split over worker threads", iface);
+    }
+
+    int irqs[RSS_MAX_QUEUES];
+    const int nirqs = RSSGetIfaceIrqs(iface, irqs, RSS_MAX_QUEUES);
+    if (nirqs == 0) {
+        SCLogConfig("%s: no queue irqs found, irq affinity unchanged", iface);
+        return queues;
+    }
+    if (ncpus == 0) {
+        SCLogConfig("%s: no worker cpu affinity configured, irq affinity "
+                "unchanged", iface);
+        return queues;
+    }
+
+    int i;
+    for (i = 0; i < nirqs && i < queues; i++) {
+        const int cpu = cpus[i % ncpus];
+        if (RSSSetIrqCpu(irqs[i], cpu) == 0) {
+            SCLogConfig("%s: queue %d irq %d on cpu %d", iface, i, irqs[i], cpu);
+        }
+    }
+    return queues;
+}
+
+#ifdef UNITTESTS
+
+/** \test queue irq lines of /proc/interrupts */
+static int RSSTest01(void)
+{
+    FAIL_IF(RSSParseIrqLine(" 45:  1  2  IR-PCI-MSI 524289-edge  eth0-TxRx-0\n", "eth0") != 45);
+    FAIL_IF(RSSParseIrqLine("102: 0 0 PCI-MSI-edge i40e-eth1-TxRx-7\n", "eth1") != 102);
+    FAIL_IF(RSSParseIrqLine(" 46:  1  2  IR-PCI-MSI 524289-edge  eth0-rx-1", "eth0") != 46);
+    /* link irq, tx queue, other interfaces */
+    FAIL_IF(RSSParseIrqLine(" 44:  1  2  IR-PCI-MSI 524288-edge  eth0\n", "eth0") != -1);
+    FAIL_IF(RSSParseIrqLine(" 47:  1  2  IR-PCI-MSI 524290-edge  eth0-tx-0\n", "eth0") != -1);
+    FAIL_IF(RSSParseIrqLine(" 48:  1  2  IR-PCI-MSI 524291-edge  eth10-TxRx-0\n", "eth1") != -1);
+    FAIL_IF(RSSParseIrqLine(" 49:  1  2  IR-PCI-MSI 524291-edge  veth1-TxRx-0\n", "eth1") != -1);
+    FAIL_IF(RSSParseIrqLine("NMI:  0  0  Non-maskable interrupts\n", "eth0") != -1);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void RSSRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("RSSTest01", RSSTest01);
+#endif /* UNITTESTS */
+}
@@ -270,6 +270,82 @@ int RunModeSetLiveCaptureAutoFp(ConfigIfaceParserFunc ConfigParser,
     return 0;
 }
 
+/** \internal
+ *  \brief check if the workers hand their packets to output threads,
+ *         see threading.worker-output-threads */
+static int RunModeWorkerOutputThreads(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("threading.worker-output-threads", &enabled) != 1)
+        return 0;
+    return enabled;
+}
+
+/** \internal
+ *  \brief create a worker thread
+ *
+ *  With worker-output-threads the worker sends its packets to the queue
+ *  of its output thread instead of returning them to the pool, and
+ *  doesn't get the outputs itself.
+ */
+static ThreadVars *RunModeCreateWorker(const char *tname)
+{
+    if (!RunModeWorkerOutputThreads()) {
+        return TmThreadCreatePacketHandler(tname,
+                "packetpool", "packetpool",
+                "packetpool", "packetpool",
+                "pktacqloop");
+    }
+
+    char qname[TM_THREAD_NAME_MAX + 8];
+    snprintf(qname, sizeof(qname), "%s-out", tname);
+    return TmThreadCreatePacketHandler(tname,
+            "packetpool", "packetpool",
+            qname, "flow",
+            "pktacqloop");
+}
+
+/** \internal
+ *  \brief add the outputs to a worker, or spawn the output thread
+ *         that runs them for it
+ *
+ *  The output thread reads the worker's queue through its lockless
+ *  ring. The packets it gets still hold their flow reference, so the
+ *  loggers see the flow and its transactions as the worker left them:
+ *  transactions aren't freed before all tx loggers are done with them.
+ *  The packets go back to the pool from the output thread.
+ */
+static void RunModeSetupWorkerOutputs(ThreadVars *tv, const char *tname)
+{
+    if (!RunModeWorkerOutputThreads()) {
+        SetupOutputs(tv);
+        return;
+    }
+
+    char qname[TM_THREAD_NAME_MAX + 8];
+    char oname[TM_THREAD_NAME_MAX];
+    const char *suffix = strpbrk(tname, "#-");
+
+    snprintf(qname, sizeof(qname), "%s-out", tname);
+    snprintf(oname, sizeof(oname), "%s%s", thread_name_output,
+            suffix ? suffix : tname);
+
+    ThreadVars *tv_out = TmThreadCreatePacketHandler(oname,
+            qname, "flow",
+            "packetpool", "packetpool",
+            "varslot");
+    if (tv_out == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
+        exit(EXIT_FAILURE);
+    }
+    SetupOutputs(tv_out);
+
+    if (TmThreadSpawn(tv_out) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
 /**
  */
 static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -301,10 +377,7 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
             snprintf(tname, sizeof(tname), "%s#%02d-%s", thread_name,
                      thread+1, visual_devname);
         }
-        tv = TmThreadCreatePacketHandler(tname,
-                "packetpool", "packetpool",
-                "packetpool", "packetpool",
-                "pktacqloop");
+        tv = RunModeCreateWorker(tname);
         if (tv == NULL) {
             SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -338,14 +411,14 @@ static int RunModeSetLiveCaptureWorkersForDevice(ConfigIfaceThreadsCountFunc Mod
         }
         TmSlotSetFuncAppend(tv, tm_module, NULL);
 
-        SetupOutputs(tv);
-
         TmThreadSetCPU(tv, WORKER_CPU_SET);
 
         if (TmThreadSpawn(tv) != TM_ECODE_OK) {
             SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
             exit(EXIT_FAILURE);
         }
+        /* after the worker: threads are shut down in spawn order */
+        RunModeSetupWorkerOutputs(tv, tname);
     }
 
     return 0;
@@ -593,10 +666,7 @@ int RunModeSetIPSWorker(ConfigIPSParserFunc ConfigParser,
         memset(tname, 0, sizeof(tname));
         snprintf(tname, sizeof(tname), "%s-Q%s", thread_name_workers, cur_queue);
 
-        tv = TmThreadCreatePacketHandler(tname,
-                "packetpool", "packetpool",
-                "packetpool", "packetpool",
-                "pktacqloop");
+        tv = RunModeCreateWorker(tname);
         if (tv == NULL) {
             SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -638,14 +708,13 @@ int RunModeSetIPSWorker(ConfigIPSParserFunc ConfigParser,
         }
         TmSlotSetFuncAppend(tv, tm_module, NULL);
 
-        SetupOutputs(tv);
-
         TmThreadSetCPU(tv, WORKER_CPU_SET);
 
         if (TmThreadSpawn(tv) != TM_ECODE_OK) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
             exit(EXIT_FAILURE);
         }
+        RunModeSetupWorkerOutputs(tv, tname);
     }
 
     return 0;
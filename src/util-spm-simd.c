@@ -0,0 +1,355 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher for the short needles content inspection mostly
+ * deals with. Candidates are positions where both the first and the last
+ * byte of the needle are found, tested 16 (SSE2) or 32 (AVX2) positions at
+ * a time. Only those are compared in full. There are no tables to set up.
+ *
+ * The AVX2 version is built with a target attribute and picked at start
+ * up if the CPU supports it.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-memcmp.h"
+#include "util-spm-simd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SPM_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+typedef struct SpmSimdCtx_ {
+    /* needle, lowercase if nocase */
+    uint8_t *needle;
+    uint16_t needle_len;
+    int nocase;
+} SpmSimdCtx;
+
+typedef uint8_t *(*SpmSimdScanFunc)(const SpmSimdCtx *, const uint8_t *, uint16_t);
+
+/** scan function for the CPU we run on, set at registration */
+static SpmSimdScanFunc g_spm_simd_scan = NULL;
+
+/**
+ * \internal
+ * \brief check a candidate position and the positions after it up to
+ *        'end' the plain way
+ */
+static inline uint8_t *SimdScanScalar(const SpmSimdCtx *sctx,
+                                      const uint8_t *haystack, uint32_t pos,
+                                      uint32_t end)
+{
+    const uint8_t *needle = sctx->needle;
+    const uint16_t len = sctx->needle_len;
+
+    for ( ; pos < end; pos++) {
+        if (sctx->nocase) {
+            if (u8_tolower(haystack[pos]) == needle[0] &&
+                SCMemcmpLowercase(needle, haystack + pos, len) == 0)
+                return (uint8_t *)haystack + pos;
+        } else {
+            if (haystack[pos] == needle[0] &&
+                SCMemcmp(needle, haystack + pos, len) == 0)
+                return (uint8_t *)haystack + pos;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \internal
+ * \brief verify the candidate positions in 'mask', lowest first
+ */
+static inline uint8_t *SimdVerify(const SpmSimdCtx *sctx,
+                                  const uint8_t *haystack, uint32_t pos,
+                                  uint32_t mask)
+{
+    while (mask != 0) {
+        uint32_t k = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        const uint8_t *cand = haystack + pos + k;
+        /* first and last byte already matched */
+        if (sctx->needle_len <= 2)
+            return (uint8_t *)cand;
+        int r = sctx->nocase ?
+            SCMemcmpLowercase(sctx->needle + 1, cand + 1, sctx->needle_len - 2) :
+            SCMemcmp(sctx->needle + 1, cand + 1, sctx->needle_len - 2);
+        if (r == 0)
+            return (uint8_t *)cand;
+    }
+    return NULL;
+}
+
+#if defined(__SSE2__)
+/* lowercase the ascii letters in 'v' */
+static inline __m128i SimdToLower16(__m128i v)
+{
+    /* bytes >= 0x80 are negative in the signed compares and so are never
+     * taken for upper case letters */
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static uint8_t *SimdScanSSE2(const SpmSimdCtx *sctx, const uint8_t *haystack,
+                             uint16_t haystack_len)
+{
+    const uint32_t last = sctx->needle_len - 1;
+    const __m128i first_v = _mm_set1_epi8(sctx->needle[0]);
+    const __m128i last_v = _mm_set1_epi8(sctx->needle[last]);
+    uint32_t pos = 0;
+
+    for ( ; pos + last + 16 <= haystack_len; pos += 16) {
+        __m128i f = _mm_loadu_si128((const __m128i *)(haystack + pos));
+        __m128i l = _mm_loadu_si128((const __m128i *)(haystack + pos + last));
+        if (sctx->nocase) {
+            f = SimdToLower16(f);
+            l = SimdToLower16(l);
+        }
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+                    _mm_cmpeq_epi8(f, first_v), _mm_cmpeq_epi8(l, last_v)));
+        if (mask != 0) {
+            uint8_t *found = SimdVerify(sctx, haystack, pos, mask);
+            if (found != NULL)
+                return found;
+        }
+    }
+
+    return SimdScanScalar(sctx, haystack, pos, haystack_len - last);
+}
+#endif /* __SSE2__ */
+
+#ifdef SPM_SIMD_AVX2
+__attribute__((target("avx2")))
+static inline __m256i SimdToLower32(__m256i v)
+{
+    __m256i upper = _mm256_and_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+            _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static uint8_t *SimdScanAVX2(const SpmSimdCtx *sctx, const uint8_t *haystack,
+                             uint16_t haystack_len)
+{
+    const uint32_t last = sctx->needle_len - 1;
+    const __m256i first_v = _mm256_set1_epi8(sctx->needle[0]);
+    const __m256i last_v = _mm256_set1_epi8(sctx->needle[last]);
+    uint32_t pos = 0;
+
+    for ( ; pos + last + 32 <= haystack_len; pos += 32) {
+        __m256i f = _mm256_loadu_si256((const __m256i *)(haystack + pos));
+        __m256i l = _mm256_loadu_si256((const __m256i *)(haystack + pos + last));
+        if (sctx->nocase) {
+            f = SimdToLower32(f);
+            l = SimdToLower32(l);
+        }
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+                    _mm256_cmpeq_epi8(f, first_v), _mm256_cmpeq_epi8(l, last_v)));
+        if (mask != 0) {
+            uint8_t *found = SimdVerify(sctx, haystack, pos, mask);
+            if (found != NULL)
+                return found;
+        }
+    }
+
+    /* the rest is less than 32 bytes, let the 16 byte version finish */
+    if (pos + last < haystack_len) {
+        uint8_t *found = SimdScanSSE2(sctx, haystack + pos, haystack_len - pos);
+        if (found != NULL)
+            return found;
+    }
+    return NULL;
+}
+#endif /* SPM_SIMD_AVX2 */
+
+static uint8_t *SimdScanGeneric(const SpmSimdCtx *sctx, const uint8_t *haystack,
+                                uint16_t haystack_len)
+{
+    return SimdScanScalar(sctx, haystack, 0,
+                          haystack_len - (sctx->needle_len - 1));
+}
+
+static void SimdDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    SpmSimdCtx *sctx = ctx->ctx;
+    if (sctx != NULL) {
+        if (sctx->needle != NULL) {
+            SCFree(sctx->needle);
+        }
+        SCFree(sctx);
+    }
+
+    SCFree(ctx);
+}
+
+static SpmCtx *SimdInitCtx(const uint8_t *needle, uint16_t needle_len,
+                           int nocase, SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (needle_len == 0) {
+        return NULL;
+    }
+
+    SpmCtx *ctx = SCMalloc(sizeof(SpmCtx));
+    if (ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmCtx.");
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matcher = SPM_SIMD;
+
+    SpmSimdCtx *sctx = SCMalloc(sizeof(SpmSimdCtx));
+    if (sctx == NULL) {
+        SCLogDebug("Unable to alloc SpmSimdCtx.");
+        SCFree(ctx);
+        return NULL;
+    }
+    memset(sctx, 0, sizeof(*sctx));
+
+    sctx->needle = SCMalloc(needle_len);
+    if (sctx->needle == NULL) {
+        SCLogDebug("Unable to alloc string.");
+        SCFree(sctx);
+        SCFree(ctx);
+        return NULL;
+    }
+    memcpy(sctx->needle, needle, needle_len);
+    sctx->needle_len = needle_len;
+    sctx->nocase = nocase ? 1 : 0;
+
+    if (nocase) {
+        uint16_t i;
+        for (i = 0; i < needle_len; i++) {
+            sctx->needle[i] = u8_tolower(sctx->needle[i]);
+        }
+    }
+
+    ctx->ctx = sctx;
+    return ctx;
+}
+
+static uint8_t *SimdScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                         const uint8_t *haystack, uint16_t haystack_len)
+{
+    const SpmSimdCtx *sctx = ctx->ctx;
+
+    if (haystack_len < sctx->needle_len) {
+        return NULL;
+    }
+    return g_spm_simd_scan(sctx, haystack, haystack_len);
+}
+
+static SpmGlobalThreadCtx *SimdInitGlobalThreadCtx(void)
+{
+    SpmGlobalThreadCtx *global_thread_ctx = SCMalloc(sizeof(SpmGlobalThreadCtx));
+    if (global_thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(global_thread_ctx, 0, sizeof(*global_thread_ctx));
+    global_thread_ctx->matcher = SPM_SIMD;
+    return global_thread_ctx;
+}
+
+static void SimdDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (global_thread_ctx == NULL) {
+        return;
+    }
+    SCFree(global_thread_ctx);
+}
+
+static void SimdDestroyThreadCtx(SpmThreadCtx *thread_ctx)
+{
+    if (thread_ctx == NULL) {
+        return;
+    }
+    SCFree(thread_ctx);
+}
+
+static SpmThreadCtx *SimdMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmThreadCtx *thread_ctx = SCMalloc(sizeof(SpmThreadCtx));
+    if (thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(thread_ctx, 0, sizeof(*thread_ctx));
+    thread_ctx->matcher = SPM_SIMD;
+    return thread_ctx;
+}
+
+/**
+ * \brief pick the scan function for this CPU
+ */
+static void SimdSelectScan(void)
+{
+#ifdef SPM_SIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        SCLogDebug("simd spm uses the avx2 scan");
+        g_spm_simd_scan = SimdScanAVX2;
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    SCLogDebug("simd spm uses the sse2 scan");
+    g_spm_simd_scan = SimdScanSSE2;
+#else
+    SCLogDebug("simd spm uses the generic scan");
+    g_spm_simd_scan = SimdScanGeneric;
+#endif
+}
+
+/**
+ * \retval 1 if the matcher has a vector implementation on this CPU
+ */
+int SpmSimdIsVectorized(void)
+{
+    return (g_spm_simd_scan != NULL && g_spm_simd_scan != SimdScanGeneric);
+}
+
+void SpmSimdRegister(void)
+{
+    SimdSelectScan();
+
+    spm_table[SPM_SIMD].name = "simd";
+    spm_table[SPM_SIMD].InitGlobalThreadCtx = SimdInitGlobalThreadCtx;
+    spm_table[SPM_SIMD].DestroyGlobalThreadCtx = SimdDestroyGlobalThreadCtx;
+    spm_table[SPM_SIMD].MakeThreadCtx = SimdMakeThreadCtx;
+    spm_table[SPM_SIMD].DestroyThreadCtx = SimdDestroyThreadCtx;
+    spm_table[SPM_SIMD].InitCtx = SimdInitCtx;
+    spm_table[SPM_SIMD].DestroyCtx = SimdDestroyCtx;
+    spm_table[SPM_SIMD].Scan = SimdScan;
+}
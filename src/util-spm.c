@@ -46,6 +46,7 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "util-unittest.h"
+#include "util-bench.h"
 
 #include "conf.h"
 
@@ -54,6 +55,7 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-spm-hs.h"
+#include "util-spm-simd.h"
 #include "util-clock.h"
 
 /**
@@ -91,7 +93,11 @@ default_matcher:
 #ifdef BUILD_HYPERSCAN
     return SPM_HS;
 #else
-    /* Otherwise, default to Boyer-Moore */
+    /* Otherwise use the vectorized matcher if this CPU has it, it beats
+     * Boyer-Moore for the short needles content inspection deals with */
+    if (SpmSimdIsVectorized())
+        return SPM_SIMD;
+    /* default to Boyer-Moore */
     return SPM_BM;
 #endif
 }
@@ -101,6 +107,7 @@ void SpmTableSetup(void)
     memset(spm_table, 0, sizeof(spm_table));
 
     SpmBMRegister();
+    SpmSimdRegister();
 #ifdef BUILD_HYPERSCAN
     SpmHSRegister();
 #endif
@@ -2535,6 +2542,11 @@ int SpmSearchTest01() {
         {"FOO", 3, "_foofoofoo", 9, 1, 1},
         {"FOO", 3, "foo Foo FOo fOo foO FOO", 23, 0, 20},
         {"foo", 3, "Foo FOo fOo foO FOO foo", 23, 0, 20},
+        /* Only letters fold for nocase */
+        {"@[", 2, "`{@[", 4, 1, 2},
+        {"\xc1", 1, "\xe1\xc1", 2, 1, 1},
+        {"a-z", 3, "0123456789 0123456789 0123456789 A-Z", 36, 1, 33},
+        {"a-z", 3, "0123456789 0123456789 0123456789 A\rZ", 36, 1, SPM_NO_MATCH},
     };
 
     int ret = 1;
@@ -2712,3 +2724,103 @@ void UtilSpmSearchRegistertests(void)
 #endif
 #endif
 }
+
+#ifdef BENCHMARKS
+/** needles per benchmark, taken from the pattern set */
+#define SPM_BENCH_NEEDLES 16
+
+typedef struct SpmBench_ {
+    uint16_t matcher;
+    int nocase;
+    const char *corpus;
+} SpmBench;
+
+static const char *spm_bench_corpora[] = { "http", "dns", "tls" };
+#define SPM_BENCH_CORPORA \
+    (sizeof(spm_bench_corpora) / sizeof(spm_bench_corpora[0]))
+
+static SpmBench spm_benches[SPM_TABLE_SIZE * 2 * SPM_BENCH_CORPORA];
+
+/** \internal
+ *  \brief scan the buffers of a corpus, one needle per buffer */
+static int SpmBenchScan(BenchCtx *b)
+{
+    const SpmBench *sb = b->data;
+    const BenchCorpus *pats = BenchPatternsGet();
+    const BenchCorpus *c = BenchCorpusGet(sb->corpus);
+    if (pats == NULL || c == NULL || c->cnt == 0)
+        return 0;
+
+    SpmCtx *ctxs[SPM_BENCH_NEEDLES];
+    SpmThreadCtx *thread_ctx = NULL;
+    uint32_t nctxs = 0, i;
+    int result = 0;
+
+    SpmGlobalThreadCtx *g_thread_ctx = SpmInitGlobalThreadCtx(sb->matcher);
+    if (g_thread_ctx == NULL)
+        return 0;
+    for (i = 0; i < pats->cnt && nctxs < SPM_BENCH_NEEDLES; i++) {
+        if (pats->bufs[i].len < 2)
+            continue;
+        ctxs[nctxs] = SpmInitCtx(pats->bufs[i].buf, (uint16_t)pats->bufs[i].len,
+                sb->nocase, g_thread_ctx);
+        if (ctxs[nctxs] == NULL)
+            goto end;
+        nctxs++;
+    }
+    if (nctxs == 0)
+        goto end;
+    thread_ctx = SpmMakeThreadCtx(g_thread_ctx);
+    if (thread_ctx == NULL)
+        goto end;
+
+    b->bytes = c->size / c->cnt;
+    uint64_t n;
+    uint32_t found = 0;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        const BenchBuffer *buf = &c->bufs[n % c->cnt];
+        if (SpmScan(ctxs[n % nctxs], thread_ctx, buf->buf, (uint16_t)buf->len) != NULL)
+            found++;
+    }
+    BenchTimerStop(b);
+    SCLogDebug("%u found", found);
+
+    result = 1;
+end:
+    if (thread_ctx != NULL)
+        SpmDestroyThreadCtx(thread_ctx);
+    for (i = 0; i < nctxs; i++)
+        SpmDestroyCtx(ctxs[i]);
+    SpmDestroyGlobalThreadCtx(g_thread_ctx);
+    return result;
+}
+#endif /* BENCHMARKS */
+
+/** \brief register a scan benchmark per spm, case mode and corpus */
+void SpmRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    uint32_t cnt = 0;
+    uint16_t m;
+    uint32_t c;
+    int nocase;
+
+    for (m = 0; m < SPM_TABLE_SIZE; m++) {
+        if (spm_table[m].name == NULL || spm_table[m].InitCtx == NULL)
+            continue;
+        for (nocase = 0; nocase <= 1; nocase++) {
+            for (c = 0; c < SPM_BENCH_CORPORA; c++) {
+                char name[64];
+                spm_benches[cnt].matcher = m;
+                spm_benches[cnt].nocase = nocase;
+                spm_benches[cnt].corpus = spm_bench_corpora[c];
+                snprintf(name, sizeof(name), "spm/%s/%s/%s", spm_table[m].name,
+                        nocase ? "nocase" : "case", spm_bench_corpora[c]);
+                BenchRegister(name, SpmBenchScan, &spm_benches[cnt]);
+                cnt++;
+            }
+        }
+    }
+#endif /* BENCHMARKS */
+}
@@ -31,6 +31,7 @@
 enum {
     SPM_BM, /* Boyer-Moore */
     SPM_HS, /* Hyperscan */
+    SPM_SIMD, /* SSE2/AVX2 first and last byte filter */
     /* Other SPM matchers will go here. */
     SPM_TABLE_SIZE
 };
@@ -121,4 +122,5 @@ uint8_t *BoyerMooreNocaseSearch(const uint8_t *text, uint32_t textlen, uint8_t *
     })
 
 void UtilSpmSearchRegistertests(void);
+void SpmRegisterBenchmarks(void);
 #endif /* __UTIL_SPM_H__ */
@@ -0,0 +1,779 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Replication of hostbits, ippair xbits and threshold counters between
+ * sensors over UDP multicast.
+ *
+ * The detect threads only append to a queue. The state sync thread
+ * swaps the queue out every flush-interval and sends it, packed in
+ * datagrams. It applies the datagrams of the other sensors to the local
+ * host, ippair and threshold tables. The bit names rather than the
+ * indexes are sent, as the indexes depend on the ruleset load order.
+ *
+ * Datagram: header, then records.
+ *   header: magic (4), node id (4), record count (2), reserved (2)
+ *   record: type (1), set/track (1), family (1), name len (1),
+ *           ttl/seconds (4), sid (4), gid (4), address (4 or 16),
+ *           2nd address (ippair only), name
+ * All in network byte order.
+ *
+ * The updates are not authenticated, so the group should only be
+ * reachable from the sensors' management network.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "runmodes.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-threshold.h"
+#include "host.h"
+#include "host-bit.h"
+#include "ippair.h"
+#include "ippair-bit.h"
+#include "util-debug.h"
+#include "util-privs.h"
+#include "util-random.h"
+#include "util-signal.h"
+#include "util-state-sync.h"
+#include "util-time.h"
+#include "util-unittest.h"
+#include "util-var-name.h"
+
+#include <poll.h>
+
+#define STATE_SYNC_MAGIC                0x53535931  /* "SSY1" */
+#define STATE_SYNC_HDR_LEN              12
+#define STATE_SYNC_REC_HDR_LEN          16
+#define STATE_SYNC_DGRAM_MAX            1400
+
+#define STATE_SYNC_DEFAULT_GROUP        "239.255.42.99"
+#define STATE_SYNC_DEFAULT_PORT         4739
+#define STATE_SYNC_DEFAULT_FLUSH_MS     100
+#define STATE_SYNC_DEFAULT_QUEUE_SIZE   65536
+
+int state_sync_flags = 0;
+
+static struct {
+    SCMutex lock;
+    StateSyncRecord *queue;     /**< filled by the detect threads */
+    StateSyncRecord *flushing;  /**< being sent by the sync thread */
+    uint32_t queue_len;
+    uint32_t queue_size;
+
+    uint32_t node_id;
+    uint32_t flush_ms;
+    int ttl;
+    struct sockaddr_in group;
+    struct in_addr iface;
+    int fd;
+
+    uint64_t sent;
+    uint64_t received;
+    uint64_t applied;
+    uint64_t dropped;
+} state_sync;
+
+/** \internal
+ *  \brief queue a record, dropping it if the queue is full */
+static void StateSyncQueue(const StateSyncRecord *rec)
+{
+    SCMutexLock(&state_sync.lock);
+    if (state_sync.queue_len < state_sync.queue_size) {
+        state_sync.queue[state_sync.queue_len++] = *rec;
+        SCMutexUnlock(&state_sync.lock);
+        return;
+    }
+    SCMutexUnlock(&state_sync.lock);
+    (void)SCAtomicFetchAndAdd(&state_sync.dropped, 1);
+}
+
+static int StateSyncSetName(StateSyncRecord *rec, const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > STATE_SYNC_NAME_MAX)
+        return -1;
+    memcpy(rec->name, name, len);
+    rec->name_len = (uint8_t)len;
+    return 0;
+}
+
+static void StateSyncSetAddr(uint32_t *dst, uint8_t *family, const Address *a)
+{
+    *family = (uint8_t)a->family;
+    memcpy(dst, a->addr_data32, sizeof(a->addr_data32));
+}
+
+/**
+ * \brief replicate a host bit change
+ *
+ * \param ttl seconds until the bit expires, when set
+ */
+void StateSyncHostBit(const Address *a, const char *name, int set, uint32_t ttl)
+{
+    StateSyncRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    if (StateSyncSetName(&rec, name) < 0)
+        return;
+    rec.type = STATE_SYNC_TYPE_HOSTBIT;
+    rec.set = set ? 1 : 0;
+    rec.ttl = ttl;
+    StateSyncSetAddr(rec.addr_a, &rec.family, a);
+    StateSyncQueue(&rec);
+}
+
+/**
+ * \brief replicate an ippair bit change
+ */
+void StateSyncIPPairBit(const Address *a, const Address *b, const char *name,
+        int set, uint32_t ttl)
+{
+    if (a->family != b->family)
+        return;
+
+    StateSyncRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    if (StateSyncSetName(&rec, name) < 0)
+        return;
+    rec.type = STATE_SYNC_TYPE_IPPAIRBIT;
+    rec.set = set ? 1 : 0;
+    rec.ttl = ttl;
+    StateSyncSetAddr(rec.addr_a, &rec.family, a);
+    memcpy(rec.addr_b, b->addr_data32, sizeof(rec.addr_b));
+    StateSyncQueue(&rec);
+}
+
+/**
+ * \brief replicate a hit on a by_src/by_dst threshold
+ */
+void StateSyncThresholdHit(const Address *a, uint32_t sid, uint32_t gid,
+        uint32_t seconds, int track)
+{
+    StateSyncRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = STATE_SYNC_TYPE_THRESHOLD;
+    rec.set = (uint8_t)track;
+    rec.ttl = seconds;
+    rec.sid = sid;
+    rec.gid = gid;
+    StateSyncSetAddr(rec.addr_a, &rec.family, a);
+    StateSyncQueue(&rec);
+}
+
+static inline uint32_t StateSyncAddrLen(uint8_t family)
+{
+    return family == AF_INET6 ? 16 : 4;
+}
+
+static inline uint32_t StateSyncRecordLen(const StateSyncRecord *rec)
+{
+    uint32_t alen = StateSyncAddrLen(rec->family);
+    return STATE_SYNC_REC_HDR_LEN + alen +
+        (rec->type == STATE_SYNC_TYPE_IPPAIRBIT ? alen : 0) + rec->name_len;
+}
+
+static inline void StateSyncPut32(uint8_t *p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t StateSyncGet32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+/**
+ * \internal
+ * \brief pack records into a datagram
+ *
+ * \retval cnt number of records packed, the datagram length is in 'len'
+ */
+static uint32_t StateSyncEncode(const StateSyncRecord *recs, uint32_t cnt,
+        uint32_t node_id, uint8_t *buf, uint32_t size, uint32_t *len)
+{
+    uint32_t off = STATE_SYNC_HDR_LEN;
+    uint32_t n = 0;
+
+    while (n < cnt && n < UINT16_MAX) {
+        const StateSyncRecord *rec = &recs[n];
+        const uint32_t rlen = StateSyncRecordLen(rec);
+        if (off + rlen > size)
+            break;
+
+        uint8_t *p = buf + off;
+        p[0] = rec->type;
+        p[1] = rec->set;
+        p[2] = rec->family == AF_INET6 ? 6 : 4;
+        p[3] = rec->name_len;
+        StateSyncPut32(p + 4, rec->ttl);
+        StateSyncPut32(p + 8, rec->sid);
+        StateSyncPut32(p + 12, rec->gid);
+        p += STATE_SYNC_REC_HDR_LEN;
+
+        /* addresses are kept in network order */
+        const uint32_t alen = StateSyncAddrLen(rec->family);
+        memcpy(p, rec->addr_a, alen);
+        p += alen;
+        if (rec->type == STATE_SYNC_TYPE_IPPAIRBIT) {
+            memcpy(p, rec->addr_b, alen);
+            p += alen;
+        }
+        memcpy(p, rec->name, rec->name_len);
+
+        off += rlen;
+        n++;
+    }
+
+    StateSyncPut32(buf, STATE_SYNC_MAGIC);
+    StateSyncPut32(buf + 4, node_id);
+    buf[8] = (uint8_t)(n >> 8);
+    buf[9] = (uint8_t)n;
+    buf[10] = buf[11] = 0;
+    *len = off;
+    return n;
+}
+
+/**
+ * \internal
+ * \brief unpack a datagram
+ *
+ * \retval cnt number of records stored in 'recs'
+ * \retval -1 not a valid datagram
+ */
+static int StateSyncDecode(const uint8_t *buf, uint32_t len,
+        uint32_t *node_id, StateSyncRecord *recs, uint32_t max)
+{
+    if (len < STATE_SYNC_HDR_LEN || StateSyncGet32(buf) != STATE_SYNC_MAGIC)
+        return -1;
+    *node_id = StateSyncGet32(buf + 4);
+    const uint32_t cnt = (uint32_t)buf[8] << 8 | buf[9];
+
+    uint32_t off = STATE_SYNC_HDR_LEN;
+    uint32_t n;
+    for (n = 0; n < cnt && n < max; n++) {
+        if (off + STATE_SYNC_REC_HDR_LEN > len)
+            return -1;
+
+        const uint8_t *p = buf + off;
+        StateSyncRecord *rec = &recs[n];
+        memset(rec, 0, sizeof(*rec));
+        rec->type = p[0];
+        rec->set = p[1];
+        if (p[2] == 4)
+            rec->family = AF_INET;
+        else if (p[2] == 6)
+            rec->family = AF_INET6;
+        else
+            return -1;
+        rec->name_len = p[3];
+        rec->ttl = StateSyncGet32(p + 4);
+        rec->sid = StateSyncGet32(p + 8);
+        rec->gid = StateSyncGet32(p + 12);
+
+        if (rec->type < STATE_SYNC_TYPE_HOSTBIT ||
+                rec->type > STATE_SYNC_TYPE_THRESHOLD ||
+                rec->name_len > STATE_SYNC_NAME_MAX)
+            return -1;
+        const uint32_t rlen = StateSyncRecordLen(rec);
+        if (off + rlen > len)
+            return -1;
+
+        p += STATE_SYNC_REC_HDR_LEN;
+        const uint32_t alen = StateSyncAddrLen(rec->family);
+        memcpy(rec->addr_a, p, alen);
+        p += alen;
+        if (rec->type == STATE_SYNC_TYPE_IPPAIRBIT) {
+            memcpy(rec->addr_b, p, alen);
+            p += alen;
+        }
+        memcpy(rec->name, p, rec->name_len);
+        off += rlen;
+    }
+    return (int)n;
+}
+
+static void StateSyncRecordAddr(const StateSyncRecord *rec, const uint32_t *data,
+        Address *a)
+{
+    memset(a, 0, sizeof(*a));
+    a->family = rec->family;
+    memcpy(a->addr_data32, data, sizeof(a->addr_data32));
+}
+
+/**
+ * \internal
+ * \brief apply the update of a peer to the local tables
+ *
+ * \retval 1 applied, 0 ignored
+ */
+static int StateSyncApply(DetectEngineCtx *de_ctx, const StateSyncRecord *rec,
+        uint32_t now)
+{
+    Address a, b;
+    char name[STATE_SYNC_NAME_MAX + 1];
+    memcpy(name, rec->name, rec->name_len);
+    name[rec->name_len] = '\0';
+
+    StateSyncRecordAddr(rec, rec->addr_a, &a);
+
+    switch (rec->type) {
+        case STATE_SYNC_TYPE_HOSTBIT: {
+            if (!(state_sync_flags & STATE_SYNC_HOSTBITS) || de_ctx == NULL)
+                return 0;
+            /* bits no local rule uses are of no interest */
+            uint16_t idx = VariableNameLookupIdx(de_ctx, name, VAR_TYPE_HOST_BIT);
+            if (idx == 0)
+                return 0;
+
+            Host *h = rec->set ? HostGetHostFromHash(&a) : HostLookupHostFromHash(&a);
+            if (h == NULL)
+                return 0;
+            if (rec->set)
+                HostBitSet(h, idx, now + rec->ttl);
+            else
+                HostBitUnset(h, idx);
+            HostRelease(h);
+            return 1;
+        }
+        case STATE_SYNC_TYPE_IPPAIRBIT: {
+            if (!(state_sync_flags & STATE_SYNC_XBITS) || de_ctx == NULL)
+                return 0;
+            uint16_t idx = VariableNameLookupIdx(de_ctx, name, VAR_TYPE_IPPAIR_BIT);
+            if (idx == 0)
+                return 0;
+
+            StateSyncRecordAddr(rec, rec->addr_b, &b);
+            IPPair *pair = rec->set ? IPPairGetIPPairFromHash(&a, &b) :
+                IPPairLookupIPPairFromHash(&a, &b);
+            if (pair == NULL)
+                return 0;
+            if (rec->set)
+                IPPairBitSet(pair, idx, now + rec->ttl);
+            else
+                IPPairBitUnset(pair, idx);
+            IPPairRelease(pair);
+            return 1;
+        }
+        case STATE_SYNC_TYPE_THRESHOLD:
+            if (!(state_sync_flags & STATE_SYNC_THRESHOLDS))
+                return 0;
+            ThresholdAddRemoteHits(&a, rec->sid, rec->gid, rec->ttl, rec->set,
+                    1, now);
+            return 1;
+    }
+    return 0;
+}
+
+static void StateSyncReceive(void)
+{
+    uint8_t buf[STATE_SYNC_DGRAM_MAX];
+    StateSyncRecord recs[STATE_SYNC_DGRAM_MAX / STATE_SYNC_REC_HDR_LEN];
+
+    DetectEngineCtx *de_ctx = DetectEngineGetCurrent();
+    struct timeval tv;
+    TimeGet(&tv);
+
+    for (;;) {
+        ssize_t r = recv(state_sync.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (r <= 0)
+            break;
+
+        uint32_t node_id = 0;
+        int cnt = StateSyncDecode(buf, (uint32_t)r, &node_id, recs,
+                (uint32_t)(sizeof(recs) / sizeof(recs[0])));
+        if (cnt < 0 || node_id == state_sync.node_id)
+            continue;
+
+        state_sync.received += cnt;
+        int i;
+        for (i = 0; i < cnt; i++) {
+            state_sync.applied += StateSyncApply(de_ctx, &recs[i],
+                    (uint32_t)tv.tv_sec);
+        }
+    }
+
+    if (de_ctx != NULL)
+        DetectEngineDeReference(&de_ctx);
+}
+
+static void StateSyncFlush(void)
+{
+    SCMutexLock(&state_sync.lock);
+    StateSyncRecord *recs = state_sync.queue;
+    uint32_t cnt = state_sync.queue_len;
+    state_sync.queue = state_sync.flushing;
+    state_sync.queue_len = 0;
+    state_sync.flushing = recs;
+    SCMutexUnlock(&state_sync.lock);
+
+    uint8_t buf[STATE_SYNC_DGRAM_MAX];
+    while (cnt > 0) {
+        uint32_t len = 0;
+        uint32_t n = StateSyncEncode(recs, cnt, state_sync.node_id,
+                buf, sizeof(buf), &len);
+        if (n == 0)
+            break;
+        if (sendto(state_sync.fd, buf, len, 0,
+                    (struct sockaddr *)&state_sync.group,
+                    sizeof(state_sync.group)) < 0) {
+            SCLogDebug("state sync send failed: %s", strerror(errno));
+        } else {
+            state_sync.sent += n;
+        }
+        recs += n;
+        cnt -= n;
+    }
+}
+
+static void *StateSyncThread(void *arg)
+{
+    ThreadVars *tv_local = (ThreadVars *)arg;
+
+    /* block usr2.  usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    if (SCSetThreadName(tv_local->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+
+    if (tv_local->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv_local);
+
+    tv_local->cap_flags = 0;
+    SCDropCaps(tv_local);
+
+    TmThreadsSetFlag(tv_local, THV_INIT_DONE);
+    struct timeval last, now;
+    gettimeofday(&last, NULL);
+    while (!TmThreadsCheckFlag(tv_local, THV_KILL)) {
+        if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
+            TmThreadsSetFlag(tv_local, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv_local);
+            TmThreadsUnsetFlag(tv_local, THV_PAUSED);
+        }
+
+        struct pollfd pfd = { state_sync.fd, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)state_sync.flush_ms) > 0)
+            StateSyncReceive();
+
+        gettimeofday(&now, NULL);
+        uint64_t ms = (uint64_t)(now.tv_sec - last.tv_sec) * 1000 +
+            (now.tv_usec - last.tv_usec) / 1000;
+        if (ms >= state_sync.flush_ms) {
+            StateSyncFlush();
+            last = now;
+        }
+    }
+    StateSyncFlush();
+
+    TmThreadsSetFlag(tv_local, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv_local, THV_DEINIT);
+    TmThreadsSetFlag(tv_local, THV_CLOSED);
+    return NULL;
+}
+
+static int StateSyncSocket(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        goto error;
+
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+        goto error;
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = state_sync.group.sin_port;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+        goto error;
+
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr = state_sync.group.sin_addr;
+    mreq.imr_interface = state_sync.iface;
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        goto error;
+
+    unsigned char ttl = (unsigned char)state_sync.ttl;
+    unsigned char loop = 0;
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &state_sync.iface,
+                sizeof(state_sync.iface)) < 0)
+        goto error;
+    return fd;
+
+error:
+    SCLogError(SC_ERR_STATE_SYNC, "state sync socket setup failed: %s",
+            strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static uint64_t StateSyncSent(void)
+{
+    return SCAtomicFetchAndAdd(&state_sync.sent, 0);
+}
+
+static uint64_t StateSyncReceived(void)
+{
+    return SCAtomicFetchAndAdd(&state_sync.received, 0);
+}
+
+static uint64_t StateSyncApplied(void)
+{
+    return SCAtomicFetchAndAdd(&state_sync.applied, 0);
+}
+
+static uint64_t StateSyncDropped(void)
+{
+    return SCAtomicFetchAndAdd(&state_sync.dropped, 0);
+}
+
+/**
+ * \brief read the state-sync config
+ */
+void StateSyncInit(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("state-sync.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    memset(&state_sync, 0, sizeof(state_sync));
+    state_sync.fd = -1;
+    SCMutexInit(&state_sync.lock, NULL);
+
+    int flags = 0;
+    ConfNode *node = ConfGetNode("state-sync.replicate");
+    if (node != NULL) {
+        ConfNode *item;
+        TAILQ_FOREACH(item, &node->head, next) {
+            if (strcasecmp(item->val, "hostbits") == 0)
+                flags |= STATE_SYNC_HOSTBITS;
+            else if (strcasecmp(item->val, "xbits") == 0)
+                flags |= STATE_SYNC_XBITS;
+            else if (strcasecmp(item->val, "thresholds") == 0)
+                flags |= STATE_SYNC_THRESHOLDS;
+            else
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "state-sync.replicate: "
+                        "unknown value '%s'", item->val);
+        }
+    } else {
+        flags = STATE_SYNC_HOSTBITS | STATE_SYNC_XBITS | STATE_SYNC_THRESHOLDS;
+    }
+    if (flags == 0)
+        return;
+
+    char *group = STATE_SYNC_DEFAULT_GROUP;
+    (void)ConfGet("state-sync.group", &group);
+    state_sync.group.sin_family = AF_INET;
+    if (inet_pton(AF_INET, group, &state_sync.group.sin_addr) != 1 ||
+            !IN_MULTICAST(ntohl(state_sync.group.sin_addr.s_addr))) {
+        SCLogError(SC_ERR_STATE_SYNC, "state-sync.group '%s' is not an IPv4 "
+                "multicast address", group);
+        return;
+    }
+
+    intmax_t port = STATE_SYNC_DEFAULT_PORT;
+    if (ConfGetInt("state-sync.port", &port) == 1 && (port <= 0 || port > 65535)) {
+        SCLogError(SC_ERR_STATE_SYNC, "state-sync.port %"PRIdMAX" invalid", port);
+        return;
+    }
+    state_sync.group.sin_port = htons((uint16_t)port);
+
+    char *iface = NULL;
+    state_sync.iface.s_addr = htonl(INADDR_ANY);
+    if (ConfGet("state-sync.interface", &iface) == 1 && iface != NULL &&
+            inet_pton(AF_INET, iface, &state_sync.iface) != 1) {
+        SCLogError(SC_ERR_STATE_SYNC, "state-sync.interface '%s' is not an "
+                "IPv4 address", iface);
+        return;
+    }
+
+    intmax_t ttl = 1;
+    if (ConfGetInt("state-sync.ttl", &ttl) != 1 || ttl < 1 || ttl > 255)
+        ttl = 1;
+    state_sync.ttl = (int)ttl;
+
+    intmax_t flush_ms = STATE_SYNC_DEFAULT_FLUSH_MS;
+    if (ConfGetInt("state-sync.flush-interval", &flush_ms) != 1 ||
+            flush_ms < 1 || flush_ms > 10000)
+        flush_ms = STATE_SYNC_DEFAULT_FLUSH_MS;
+    state_sync.flush_ms = (uint32_t)flush_ms;
+
+    intmax_t queue_size = STATE_SYNC_DEFAULT_QUEUE_SIZE;
+    if (ConfGetInt("state-sync.queue-size", &queue_size) != 1 ||
+            queue_size < 1 || queue_size > (1 << 24))
+        queue_size = STATE_SYNC_DEFAULT_QUEUE_SIZE;
+    state_sync.queue_size = (uint32_t)queue_size;
+
+    state_sync.queue = SCCalloc(state_sync.queue_size, sizeof(StateSyncRecord));
+    state_sync.flushing = SCCalloc(state_sync.queue_size, sizeof(StateSyncRecord));
+    if (state_sync.queue == NULL || state_sync.flushing == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "state sync queue alloc failed");
+        StateSyncDeinit();
+        return;
+    }
+
+    state_sync.fd = StateSyncSocket();
+    if (state_sync.fd < 0) {
+        StateSyncDeinit();
+        return;
+    }
+    state_sync.node_id = RandomTimePreseed() ^ (uint32_t)getpid();
+
+    StatsRegisterGlobalCounter("state_sync.sent", StateSyncSent);
+    StatsRegisterGlobalCounter("state_sync.received", StateSyncReceived);
+    StatsRegisterGlobalCounter("state_sync.applied", StateSyncApplied);
+    StatsRegisterGlobalCounter("state_sync.dropped", StateSyncDropped);
+
+    state_sync_flags = flags;
+    SCLogConfig("state sync: replicating%s%s%s via %s:%u, node id %08x",
+            (flags & STATE_SYNC_HOSTBITS) ? " hostbits" : "",
+            (flags & STATE_SYNC_XBITS) ? " xbits" : "",
+            (flags & STATE_SYNC_THRESHOLDS) ? " thresholds" : "",
+            group, (uint)port, state_sync.node_id);
+}
+
+/**
+ * \brief spawn the state sync thread if enabled
+ */
+void StateSyncSpawnThread(void)
+{
+    if (state_sync_flags == 0)
+        return;
+
+    ThreadVars *tv = TmThreadCreateMgmtThread(thread_name_state_sync,
+            StateSyncThread, 1);
+    if (tv == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread failed");
+        exit(EXIT_FAILURE);
+    }
+    if (TmThreadSpawn(tv) != 0) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
+                "StateSyncThread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void StateSyncDeinit(void)
+{
+    state_sync_flags = 0;
+    if (state_sync.fd >= 0) {
+        close(state_sync.fd);
+        state_sync.fd = -1;
+    }
+    if (state_sync.queue != NULL) {
+        SCFree(state_sync.queue);
+        state_sync.queue = NULL;
+    }
+    if (state_sync.flushing != NULL) {
+        SCFree(state_sync.flushing);
+        state_sync.flushing = NULL;
+    }
+}
+
+#ifdef UNITTESTS
+
+/** \test records survive encoding, a datagram holds what fits */
+static int StateSyncTest01(void)
+{
+    StateSyncRecord recs[3];
+    Address a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.family = AF_INET;
+    a.addr_data32[0] = htonl(0x0a000001);
+    b.family = AF_INET6;
+    b.addr_data32[0] = htonl(0x20010db8);
+    b.addr_data32[3] = htonl(1);
+
+    state_sync.queue_size = 3;
+    state_sync.queue = recs;
+    state_sync.queue_len = 0;
+    SCMutexInit(&state_sync.lock, NULL);
+
+    StateSyncHostBit(&a, "scanner", 1, 300);
+    StateSyncIPPairBit(&b, &b, "pair", 0, 0);
+    StateSyncThresholdHit(&a, 1000, 1, 60, 2);
+    /* queue full */
+    StateSyncHostBit(&a, "scanner", 1, 300);
+    FAIL_IF(state_sync.queue_len != 3);
+    FAIL_IF(state_sync.dropped != 1);
+    /* name too long to be replicated */
+    state_sync.queue_len = 2;
+    StateSyncHostBit(&a, "0123456789012345678901234567890123456789012345678", 1, 1);
+    FAIL_IF(state_sync.queue_len != 2);
+    state_sync.queue_len = 3;
+
+    uint8_t buf[STATE_SYNC_DGRAM_MAX];
+    uint32_t len = 0;
+    FAIL_IF(StateSyncEncode(recs, 3, 0x1234, buf, sizeof(buf), &len) != 3);
+    FAIL_IF(len != STATE_SYNC_HDR_LEN + (16 + 4 + 7) + (16 + 32 + 4) + (16 + 4));
+
+    StateSyncRecord out[3];
+    uint32_t node_id = 0;
+    FAIL_IF(StateSyncDecode(buf, len, &node_id, out, 3) != 3);
+    FAIL_IF(node_id != 0x1234);
+    int i;
+    for (i = 0; i < 3; i++) {
+        FAIL_IF(out[i].type != recs[i].type);
+        FAIL_IF(out[i].set != recs[i].set);
+        FAIL_IF(out[i].family != recs[i].family);
+        FAIL_IF(out[i].ttl != recs[i].ttl);
+        FAIL_IF(out[i].sid != recs[i].sid);
+        FAIL_IF(memcmp(out[i].addr_a, recs[i].addr_a, StateSyncAddrLen(recs[i].family)) != 0);
+        FAIL_IF(out[i].name_len != recs[i].name_len);
+        FAIL_IF(memcmp(out[i].name, recs[i].name, recs[i].name_len) != 0);
+    }
+    FAIL_IF(memcmp(out[1].addr_b, b.addr_data32, 16) != 0);
+
+    /* truncated or damaged datagrams are rejected */
+    FAIL_IF(StateSyncDecode(buf, len - 1, &node_id, out, 3) != -1);
+    buf[STATE_SYNC_HDR_LEN + 2] = 5;
+    FAIL_IF(StateSyncDecode(buf, len, &node_id, out, 3) != -1);
+
+    /* only what fits goes in a datagram */
+    FAIL_IF(StateSyncEncode(recs, 3, 0x1234, buf, STATE_SYNC_HDR_LEN + 30, &len) != 1);
+
+    memset(&state_sync, 0, sizeof(state_sync));
+    state_sync.fd = -1;
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void StateSyncRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StateSyncTest01", StateSyncTest01);
+#endif /* UNITTESTS */
+}
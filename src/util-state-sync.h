@@ -0,0 +1,77 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Replication of hostbits, ippair xbits and threshold counters between
+ * sensors.
+ *
+ * Local updates are queued by the detect threads and sent in batches to
+ * an UDP multicast group by the state sync thread, which also applies
+ * the updates of the other sensors to the local tables. Lookups stay
+ * local, no detect thread ever waits for the network.
+ */
+
+#ifndef __UTIL_STATE_SYNC_H__
+#define __UTIL_STATE_SYNC_H__
+
+#include "decode.h"
+
+/* state_sync_flags: what is replicated */
+#define STATE_SYNC_HOSTBITS     0x01
+#define STATE_SYNC_XBITS        0x02    /**< ippair xbits */
+#define STATE_SYNC_THRESHOLDS   0x04
+
+/** longest bit name that is replicated */
+#define STATE_SYNC_NAME_MAX     48
+
+enum StateSyncType {
+    STATE_SYNC_TYPE_HOSTBIT = 1,
+    STATE_SYNC_TYPE_IPPAIRBIT,
+    STATE_SYNC_TYPE_THRESHOLD,
+};
+
+/** \brief one replicated update */
+typedef struct StateSyncRecord_ {
+    uint8_t type;
+    uint8_t set;        /**< bits: 1 set, 0 unset. thresholds: track */
+    uint8_t family;     /**< AF_INET or AF_INET6 */
+    uint8_t name_len;
+    uint32_t ttl;       /**< bits: expire in sec. thresholds: seconds */
+    uint32_t sid;
+    uint32_t gid;
+    uint32_t addr_a[4];
+    uint32_t addr_b[4]; /**< ippair only */
+    char name[STATE_SYNC_NAME_MAX];
+} StateSyncRecord;
+
+extern int state_sync_flags;
+
+void StateSyncHostBit(const Address *a, const char *name, int set,
+        uint32_t ttl);
+void StateSyncIPPairBit(const Address *a, const Address *b, const char *name,
+        int set, uint32_t ttl);
+void StateSyncThresholdHit(const Address *a, uint32_t sid, uint32_t gid,
+        uint32_t seconds, int track);
+
+void StateSyncInit(void);
+void StateSyncSpawnThread(void);
+void StateSyncDeinit(void);
+void StateSyncRegisterTests(void);
+
+#endif /* __UTIL_STATE_SYNC_H__ */
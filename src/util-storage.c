@@ -31,6 +31,10 @@ typedef struct StorageMapping_ {
     const char *name;
     StorageEnum type; // host, flow, tx, stream, ssn, etc
     unsigned int size;
+    int inline_data;        /**< data is part of the per instance memory */
+    unsigned int offset;    /**< inline: offset of the data from the Storage
+                             *   base, relative to the inline area until
+                             *   StorageFinalize() */
     void *(*Alloc)(unsigned int);
     void (*Free)(void *);
 } StorageMapping;
@@ -44,6 +48,8 @@ typedef struct StorageList_ {
 
 static StorageList *storage_list = NULL;
 static int storage_max_id[STORAGE_MAX];
+/** size of the inline area that follows the pointer array */
+static unsigned int storage_inline_size[STORAGE_MAX];
 static int storage_registraton_closed = 0;
 static StorageMapping **storage_map = NULL;
 
@@ -65,6 +71,7 @@ const char *StoragePrintType(StorageEnum type)
 void StorageInit(void)
 {
     memset(&storage_max_id, 0x00, sizeof(storage_max_id));
+    memset(&storage_inline_size, 0x00, sizeof(storage_inline_size));
     storage_list = NULL;
     storage_map = NULL;
     storage_registraton_closed = 0;
@@ -94,15 +101,8 @@ void StorageCleanup(void)
     storage_list = NULL;
 }
 
-int StorageRegister(const StorageEnum type, const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *))
+static int StorageRegisterMapping(const StorageEnum type, const char *name, const unsigned int size, const int inline_data, void *(*Alloc)(unsigned int), void (*Free)(void *))
 {
-    if (storage_registraton_closed)
-        return -1;
-
-    if (type >= STORAGE_MAX || name == NULL || strlen(name) == 0 ||
-            size == 0 || (size != sizeof(void *) && Alloc == NULL) || Free == NULL)
-        return -1;
-
     StorageList *list = storage_list;
     while (list) {
         if (strcmp(name, list->map.name) == 0 && type == list->map.type) {
@@ -126,6 +126,12 @@ int StorageRegister(const StorageEnum type, const char *name, const unsigned int
     entry->map.size = size;
     entry->map.Alloc = Alloc;
     entry->map.Free = Free;
+    if (inline_data) {
+        entry->map.inline_data = 1;
+        entry->map.offset = storage_inline_size[type];
+        /* keep the next one pointer aligned */
+        storage_inline_size[type] += (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    }
 
     entry->id = storage_max_id[type]++;
     entry->next = storage_list;
@@ -134,6 +140,30 @@ int StorageRegister(const StorageEnum type, const char *name, const unsigned int
     return entry->id;
 }
 
+int StorageRegister(const StorageEnum type, const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *))
+{
+    if (storage_registraton_closed)
+        return -1;
+
+    if (type >= STORAGE_MAX || name == NULL || strlen(name) == 0 ||
+            size == 0 || (size != sizeof(void *) && Alloc == NULL) || Free == NULL)
+        return -1;
+
+    return StorageRegisterMapping(type, name, size, 0, Alloc, Free);
+}
+
+int StorageRegisterInline(const StorageEnum type, const char *name, const unsigned int size, void (*Free)(void *))
+{
+    if (storage_registraton_closed)
+        return -1;
+
+    if (type >= STORAGE_MAX || name == NULL || strlen(name) == 0 ||
+            size == 0 || size > 65536)
+        return -1;
+
+    return StorageRegisterMapping(type, name, size, 1, NULL, Free);
+}
+
 int StorageFinalize(void)
 {
     int count = 0;
@@ -169,6 +199,13 @@ int StorageFinalize(void)
             storage_map[entry->map.type][entry->id].name = entry->map.name;
             storage_map[entry->map.type][entry->id].type = entry->map.type;
             storage_map[entry->map.type][entry->id].size = entry->map.size;
+            storage_map[entry->map.type][entry->id].inline_data = entry->map.inline_data;
+            /* the inline area starts after the pointer array */
+            if (entry->map.inline_data) {
+                storage_map[entry->map.type][entry->id].offset =
+                    storage_max_id[entry->map.type] * sizeof(void *) +
+                    entry->map.offset;
+            }
             storage_map[entry->map.type][entry->id].Alloc = entry->map.Alloc;
             storage_map[entry->map.type][entry->id].Free = entry->map.Free;
         }
@@ -184,8 +221,9 @@ int StorageFinalize(void)
         int j;
         for (j = 0; j < storage_max_id[i]; j++) {
             StorageMapping *m = &storage_map[i][j];
-            SCLogDebug("type \"%s\" name \"%s\" size \"%"PRIuMAX"\"",
-                    StoragePrintType(m->type), m->name, (uintmax_t)m->size);
+            SCLogDebug("type \"%s\" name \"%s\" size \"%"PRIuMAX"\" "
+                    "inline %s offset %u", StoragePrintType(m->type), m->name,
+                    (uintmax_t)m->size, m->inline_data ? "yes" : "no", m->offset);
         }
     }
 #endif
@@ -198,14 +236,46 @@ unsigned int StorageGetCnt(StorageEnum type)
 }
 
 /** \brief get the size of the void array used to store
- *         the pointers
+ *         the pointers, plus the inline storage after it
  *  \retval size size in bytes, can return 0 if not storage is needed
  *
  *  \todo we could return -1 when registration isn't closed yet, however
  *        this will break lots of tests currently, so not doing it now */
 unsigned int StorageGetSize(StorageEnum type)
 {
-    return storage_max_id[type] * sizeof(void *);
+    return storage_max_id[type] * sizeof(void *) + storage_inline_size[type];
+}
+
+int StorageGetOffset(const StorageEnum type, const int id)
+{
+    if (storage_map == NULL || storage_map[type] == NULL ||
+            id < 0 || id >= storage_max_id[type])
+        return -1;
+
+    StorageMapping *map = &storage_map[type][id];
+    if (map->inline_data)
+        return (int)map->offset;
+    return id * sizeof(void *);
+}
+
+/** \internal
+ *  \brief clear an inline storage, calling its Free func on it first */
+static void StorageClearInline(Storage *storage, const StorageMapping *map)
+{
+    void *data = (uint8_t *)storage + map->offset;
+    if (map->Free != NULL)
+        map->Free(data);
+    memset(data, 0x00, map->size);
+}
+
+static void StorageClearAllInline(Storage *storage, const StorageEnum type)
+{
+    int i;
+    for (i = 0; i < storage_max_id[type]; i++) {
+        const StorageMapping *map = &storage_map[type][i];
+        if (map->inline_data)
+            StorageClearInline(storage, map);
+    }
 }
 
 void *StorageGetById(const Storage *storage, const StorageEnum type, const int id)
@@ -239,6 +309,8 @@ void *StorageAllocByIdPrealloc(Storage *storage, StorageEnum type, int id)
     SCLogDebug("storage %p id %d", storage, id);
 
     StorageMapping *map = &storage_map[type][id];
+    if (map->inline_data)
+        return (uint8_t *)storage + map->offset;
     if (storage[id] == NULL && map->Alloc != NULL) {
         storage[id] = map->Alloc(map->size);
         if (storage[id] == NULL) {
@@ -259,13 +331,18 @@ void *StorageAllocById(Storage **storage, StorageEnum type, int id)
     StorageMapping *map = &storage_map[type][id];
     Storage *store = *storage;
     if (store == NULL) {
-        store = SCMalloc(sizeof(void *) * storage_max_id[type]);
+        store = SCMalloc(StorageGetSize(type));
         if (unlikely(store == NULL))
         return NULL;
-        memset(store, 0x00, sizeof(void *) * storage_max_id[type]);
+        memset(store, 0x00, StorageGetSize(type));
     }
     SCLogDebug("store %p", store);
 
+    if (map->inline_data) {
+        *storage = store;
+        return (uint8_t *)store + map->offset;
+    }
+
     if (store[id] == NULL && map->Alloc != NULL) {
         store[id] = map->Alloc(map->size);
         if (store[id] == NULL) {
@@ -293,7 +370,9 @@ void StorageFreeById(Storage *storage, StorageEnum type, int id)
     Storage *store = storage;
     if (store != NULL) {
         SCLogDebug("store %p", store);
-        if (store[id] != NULL) {
+        if (storage_map[type][id].inline_data) {
+            StorageClearInline(store, &storage_map[type][id]);
+        } else if (store[id] != NULL) {
             StorageMapping *map = &storage_map[type][id];
             map->Free(store[id]);
             store[id] = NULL;
@@ -322,6 +401,8 @@ void StorageFreeAll(Storage *storage, StorageEnum type)
             store[i] = NULL;
         }
     }
+    if (storage_inline_size[type] > 0)
+        StorageClearAllInline(store, type);
 }
 
 void StorageFree(Storage **storage, StorageEnum type)
@@ -346,6 +427,8 @@ void StorageFree(Storage **storage, StorageEnum type)
             store[i] = NULL;
         }
     }
+    if (storage_inline_size[type] > 0)
+        StorageClearAllInline(store, type);
     SCFree(*storage);
     *storage = NULL;
 }
@@ -536,10 +619,79 @@ error:
     return 0;
 }
 
+static int storage_test04_free_cnt = 0;
+
+static void StorageTest04Free(void *data)
+{
+    if (*(uint16_t *)data == 1234)
+        storage_test04_free_cnt++;
+}
+
+/** \test inline storage is laid out after the pointers and cleared */
+static int StorageTest04(void)
+{
+    Storage *storage = NULL;
+    storage_test04_free_cnt = 0;
+
+    StorageInit();
+
+    int id1 = StorageRegister(STORAGE_HOST, "ptr", sizeof(void *), NULL, StorageTestFree);
+    int id2 = StorageRegisterInline(STORAGE_HOST, "inline1", 6, StorageTest04Free);
+    int id3 = StorageRegisterInline(STORAGE_HOST, "inline2", 16, NULL);
+    if (id1 < 0 || id2 < 0 || id3 < 0)
+        goto error;
+    if (StorageGetOffset(STORAGE_HOST, id2) != -1) {
+        printf("offset before finalize: ");
+        goto error;
+    }
+
+    if (StorageFinalize() < 0)
+        goto error;
+
+    unsigned int ptrs = 3 * sizeof(void *);
+    if (StorageGetSize(STORAGE_HOST) != ptrs + sizeof(void *) + 16) {
+        printf("size %u: ", StorageGetSize(STORAGE_HOST));
+        goto error;
+    }
+    if (StorageGetOffset(STORAGE_HOST, id1) != (int)(id1 * sizeof(void *)) ||
+        StorageGetOffset(STORAGE_HOST, id2) != (int)ptrs ||
+        StorageGetOffset(STORAGE_HOST, id3) != (int)(ptrs + sizeof(void *)))
+    {
+        printf("offsets %d %d %d: ", StorageGetOffset(STORAGE_HOST, id1),
+                StorageGetOffset(STORAGE_HOST, id2),
+                StorageGetOffset(STORAGE_HOST, id3));
+        goto error;
+    }
+
+    uint16_t *data = StorageAllocById(&storage, STORAGE_HOST, id2);
+    if (data == NULL ||
+        (void *)data != StorageGetByOffset(storage, StorageGetOffset(STORAGE_HOST, id2)))
+    {
+        printf("inline data not at its offset: ");
+        goto error;
+    }
+    *data = 1234;
+
+    StorageFreeAll(storage, STORAGE_HOST);
+    if (storage_test04_free_cnt != 1 || *data != 0) {
+        printf("free cnt %d, data %u: ", storage_test04_free_cnt, *data);
+        goto error;
+    }
+
+    StorageFree(&storage, STORAGE_HOST);
+    StorageCleanup();
+    return 1;
+error:
+    StorageFree(&storage, STORAGE_HOST);
+    StorageCleanup();
+    return 0;
+}
+
 void StorageRegisterTests(void)
 {
     UtRegisterTest("StorageTest01", StorageTest01);
     UtRegisterTest("StorageTest02", StorageTest02);
     UtRegisterTest("StorageTest03", StorageTest03);
+    UtRegisterTest("StorageTest04", StorageTest04);
 }
 #endif
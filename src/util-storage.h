@@ -52,11 +52,36 @@ void StorageCleanup(void);
  *        gives the caller a ptr to store something it alloc'ed itself.
  */
 int StorageRegister(const StorageEnum type, const char *name, const unsigned int size, void *(*Alloc)(unsigned int), void (*Free)(void *));
+/** \brief Register new inline storage
+ *
+ *  The 'size' bytes are laid out in the per instance memory after the
+ *  pointer array, so nothing is allocated per instance and the data starts
+ *  zeroed. Get to it through the offset returned by StorageGetOffset().
+ *
+ *  \param Free optional, called on the data before it is cleared. It must
+ *              not free the data itself.
+ */
+int StorageRegisterInline(const StorageEnum type, const char *name, const unsigned int size, void (*Free)(void *));
 int StorageFinalize(void);
 
 unsigned int StorageGetCnt(const StorageEnum type);
 unsigned int StorageGetSize(const StorageEnum type);
 
+/** \brief get the offset of a storage from the Storage base
+ *
+ *  For inline storage this is where the data is, otherwise where the
+ *  pointer is stored. The offset doesn't change after StorageFinalize(),
+ *  so callers can look it up once.
+ *
+ *  \retval offset or -1 if the id is invalid or registration is open */
+int StorageGetOffset(const StorageEnum type, const int id);
+
+/** \brief get the data at 'offset' from the Storage base */
+static inline void *StorageGetByOffset(Storage *storage, const unsigned int offset)
+{
+    return (uint8_t *)storage + offset;
+}
+
 /** \brief get storage for id */
 void *StorageGetById(const Storage *storage, const StorageEnum type, const int id);
 /** \brief set storage for id */
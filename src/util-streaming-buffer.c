@@ -19,6 +19,7 @@
 #include "util-streaming-buffer.h"
 #include "util-unittest.h"
 #include "util-print.h"
+#include "util-bench.h"
 
 /**
  * \file
@@ -39,6 +40,234 @@
 #define FREE(cfg, ptr, s) \
     (cfg)->Free ? (cfg)->Free((ptr), (s)) : SCFree((ptr))
 
+#define BLOCK_MODE(sb) ((sb)->cfg->block_size > 0)
+
+/**
+ * \internal
+ * \brief get the position of 'rel', relative to stream_offset, in the blocks
+ *
+ * \param avail[out] bytes left in the block from the returned position
+ * \retval ptr or NULL if 'rel' is beyond the blocks
+ */
+static inline uint8_t *BlockPtr(const StreamingBuffer *sb, uint64_t rel,
+                                uint32_t *avail)
+{
+    const uint32_t bs = sb->cfg->block_size;
+    const uint64_t pos = (uint64_t)sb->head_skip + rel;
+    const uint64_t b = pos / bs;
+    if (b >= sb->blocks_cnt)
+        return NULL;
+    const uint32_t o = (uint32_t)(pos % bs);
+    *avail = bs - o;
+    return sb->blocks[b] + o;
+}
+
+/**
+ * \internal
+ * \brief make sure the blocks cover up to 'end', relative to stream_offset
+ *
+ * Only the index is reallocated, the blocks holding data are not touched.
+ *
+ * \retval 0 ok
+ * \retval -1 alloc failure, data already in the buffer is untouched
+ */
+static int BlocksReserve(StreamingBuffer *sb, uint64_t end)
+{
+    const uint32_t bs = sb->cfg->block_size;
+    const uint64_t need = ((uint64_t)sb->head_skip + end + bs - 1) / bs;
+    if (need <= sb->blocks_cnt)
+        return 0;
+    if ((uint64_t)sb->head_skip + end > UINT32_MAX)
+        return -1;
+
+    if (need > sb->blocks_size) {
+        uint32_t size = sb->blocks_size ? sb->blocks_size : 4;
+        while (size < need)
+            size *= 2;
+        uint8_t **ptr = REALLOC(sb->cfg, sb->blocks,
+                sb->blocks_size * sizeof(uint8_t *), size * sizeof(uint8_t *));
+        if (ptr == NULL)
+            return -1;
+        memset(ptr + sb->blocks_size, 0,
+                (size - sb->blocks_size) * sizeof(uint8_t *));
+        sb->blocks = ptr;
+        sb->blocks_size = size;
+    }
+
+    while (sb->blocks_cnt < need) {
+        uint8_t *blk;
+        if (sb->spare != NULL) {
+            blk = sb->spare;
+            sb->spare = NULL;
+            memset(blk, 0, bs);
+        } else {
+            blk = CALLOC(sb->cfg, 1, bs);
+            if (blk == NULL)
+                break;
+        }
+        sb->blocks[sb->blocks_cnt++] = blk;
+    }
+    sb->buf_size = sb->blocks_cnt * bs - sb->head_skip;
+#ifdef DEBUG
+    if (sb->buf_size > sb->buf_size_max) {
+        sb->buf_size_max = sb->buf_size;
+    }
+#endif
+    return (sb->blocks_cnt < need) ? -1 : 0;
+}
+
+/**
+ * \internal
+ * \brief copy data into the blocks at 'rel', relative to stream_offset
+ *
+ * The range must have been reserved with BlocksReserve().
+ */
+static void BlocksWrite(StreamingBuffer *sb, uint64_t rel,
+                        const uint8_t *data, uint32_t data_len)
+{
+    while (data_len > 0) {
+        uint32_t avail = 0;
+        uint8_t *dst = BlockPtr(sb, rel, &avail);
+        BUG_ON(dst == NULL);
+        const uint32_t n = MIN(avail, data_len);
+        memcpy(dst, data, n);
+        data += n;
+        data_len -= n;
+        rel += n;
+    }
+    sb->flat_len = 0;
+}
+
+/**
+ * \internal
+ * \brief move the window forward by 'slide', dropping the blocks that
+ *        are fully before it
+ */
+static void BlocksSlide(StreamingBuffer *sb, uint32_t slide)
+{
+    const uint32_t bs = sb->cfg->block_size;
+
+    sb->stream_offset += slide;
+    sb->buf_offset -= slide;
+    sb->head_skip += slide;
+    sb->flat_len = 0;
+
+    uint32_t drop = sb->head_skip / bs;
+    if (drop > sb->blocks_cnt)
+        drop = sb->blocks_cnt;
+    uint32_t i;
+    for (i = 0; i < drop; i++) {
+        if (sb->spare == NULL)
+            sb->spare = sb->blocks[i];
+        else
+            FREE(sb->cfg, sb->blocks[i], bs);
+    }
+    if (drop > 0) {
+        memmove(sb->blocks, sb->blocks + drop,
+                (sb->blocks_cnt - drop) * sizeof(uint8_t *));
+        sb->blocks_cnt -= drop;
+        sb->head_skip -= drop * bs;
+    }
+    sb->buf_size = sb->blocks_cnt * bs - sb->head_skip;
+    SCLogDebug("slid %u, dropped %u blocks, %u left", slide, drop, sb->blocks_cnt);
+}
+
+/**
+ * \internal
+ * \brief contiguous view of 'len' bytes at 'rel', relative to stream_offset
+ *
+ * Points into the block if the range is in one, otherwise the range is
+ * copied to the scratch buffer of the StreamingBuffer. That copy is a
+ * cache: it stays valid until the buffer is next modified.
+ */
+static const uint8_t *BlocksGetFlat(const StreamingBuffer *csb, uint64_t rel,
+                                    uint32_t len)
+{
+    StreamingBuffer *sb = (StreamingBuffer *)csb;
+    uint32_t avail = 0;
+    uint8_t *ptr = BlockPtr(sb, rel, &avail);
+    if (ptr == NULL)
+        return NULL;
+    if (len <= avail)
+        return ptr;
+
+    if (sb->flat_len == len && sb->flat_offset == sb->stream_offset + rel)
+        return sb->flat;
+
+    if (len > sb->flat_size) {
+        uint8_t *flat = REALLOC(sb->cfg, sb->flat, sb->flat_size, len);
+        if (flat == NULL)
+            return NULL;
+        sb->flat = flat;
+        sb->flat_size = len;
+    }
+
+    uint32_t copied = 0;
+    while (copied < len) {
+        uint8_t *src = BlockPtr(sb, rel + copied, &avail);
+        BUG_ON(src == NULL);
+        const uint32_t n = MIN(avail, len - copied);
+        memcpy(sb->flat + copied, src, n);
+        copied += n;
+    }
+    sb->flat_offset = sb->stream_offset + rel;
+    sb->flat_len = len;
+    return sb->flat;
+}
+
+static void BlocksFree(StreamingBuffer *sb)
+{
+    const uint32_t bs = sb->cfg->block_size;
+    uint32_t i;
+    for (i = 0; i < sb->blocks_cnt; i++) {
+        FREE(sb->cfg, sb->blocks[i], bs);
+    }
+    if (sb->blocks != NULL) {
+        FREE(sb->cfg, sb->blocks, sb->blocks_size * sizeof(uint8_t *));
+        sb->blocks = NULL;
+    }
+    if (sb->spare != NULL) {
+        FREE(sb->cfg, sb->spare, bs);
+        sb->spare = NULL;
+    }
+    if (sb->flat != NULL) {
+        FREE(sb->cfg, sb->flat, sb->flat_size);
+        sb->flat = NULL;
+    }
+    sb->blocks_cnt = sb->blocks_size = 0;
+    sb->flat_size = sb->flat_len = 0;
+    sb->head_skip = 0;
+    sb->buf_size = 0;
+}
+
+/**
+ * \internal
+ * \brief add data at 'rel', relative to stream_offset, in block mode
+ *
+ * \retval 0 ok
+ * \retval -1 alloc failure, data not added
+ */
+static int BlocksInsert(StreamingBuffer *sb, uint64_t rel,
+                        const uint8_t *data, uint32_t data_len)
+{
+    if (rel + data_len > sb->buf_size &&
+            (sb->cfg->flags & STREAMING_BUFFER_AUTOSLIDE) &&
+            sb->buf_offset > sb->cfg->buf_slide) {
+        const uint32_t slide = sb->buf_offset - sb->cfg->buf_slide;
+        if (rel < slide)
+            return -1;
+        BlocksSlide(sb, slide);
+        rel -= slide;
+    }
+    if (BlocksReserve(sb, rel + data_len) != 0)
+        return -1;
+
+    BlocksWrite(sb, rel, data, data_len);
+    if (rel + data_len > sb->buf_offset)
+        sb->buf_offset = (uint32_t)(rel + data_len);
+    return 0;
+}
+
 static inline int InitBuffer(StreamingBuffer *sb)
 {
     sb->buf = CALLOC(sb->cfg, 1, sb->cfg->buf_size);
@@ -56,6 +285,12 @@ StreamingBuffer *StreamingBufferInit(const StreamingBufferConfig *cfg)
         sb->buf_size = cfg->buf_size;
         sb->cfg = cfg;
 
+        /* blocks are added on demand */
+        if (BLOCK_MODE(sb)) {
+            sb->buf_size = 0;
+            return sb;
+        }
+
         if (cfg->buf_size > 0) {
             if (InitBuffer(sb) == 0) {
                 return sb;
@@ -74,7 +309,9 @@ void StreamingBufferClear(StreamingBuffer *sb)
     if (sb != NULL) {
         SCLogDebug("sb->buf_size %u max %u", sb->buf_size, sb->buf_size_max);
 
-        if (sb->buf != NULL) {
+        if (BLOCK_MODE(sb)) {
+            BlocksFree(sb);
+        } else if (sb->buf != NULL) {
             FREE(sb->cfg, sb->buf, sb->buf_size);
             sb->buf = NULL;
         }
@@ -129,26 +366,30 @@ static void GrowToSize(StreamingBuffer *sb, uint32_t size)
     }
 }
 
-static void Grow(StreamingBuffer *sb)
+/** \retval 0 ok
+ *  \retval -1 alloc failure, buffer left untouched */
+static int Grow(StreamingBuffer *sb)
 {
     uint32_t grow = sb->buf_size * 2;
     void *ptr = REALLOC(sb->cfg, sb->buf, sb->buf_size, grow);
-    if (ptr != NULL) {
-        /* for safe printing and general caution, lets memset the
-         * new data to 0 */
-        size_t diff = grow - sb->buf_size;
-        void *new_mem = ((char *)ptr) + sb->buf_size;
-        memset(new_mem, 0, diff);
+    if (ptr == NULL)
+        return -1;
 
-        sb->buf = ptr;
-        sb->buf_size = grow;
-        SCLogDebug("grown buffer to %u", grow);
+    /* for safe printing and general caution, lets memset the
+     * new data to 0 */
+    size_t diff = grow - sb->buf_size;
+    void *new_mem = ((char *)ptr) + sb->buf_size;
+    memset(new_mem, 0, diff);
+
+    sb->buf = ptr;
+    sb->buf_size = grow;
+    SCLogDebug("grown buffer to %u", grow);
 #ifdef DEBUG
-        if (sb->buf_size > sb->buf_size_max) {
-            sb->buf_size_max = sb->buf_size;
-        }
-#endif
+    if (sb->buf_size > sb->buf_size_max) {
+        sb->buf_size_max = sb->buf_size;
     }
+#endif
+    return 0;
 }
 
 /**
@@ -161,6 +402,10 @@ void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
         offset <= sb->stream_offset + sb->buf_offset)
     {
         uint32_t slide = offset - sb->stream_offset;
+        if (BLOCK_MODE(sb)) {
+            BlocksSlide(sb, slide);
+            return;
+        }
         uint32_t size = sb->buf_offset - slide;
         SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
         memmove(sb->buf, sb->buf+slide, size);
@@ -171,6 +416,11 @@ void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
 
 void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide)
 {
+    if (BLOCK_MODE(sb)) {
+        BlocksSlide(sb, slide);
+        return;
+    }
+
     uint32_t size = sb->buf_offset - slide;
     SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
     memmove(sb->buf, sb->buf+slide, size);
@@ -183,6 +433,19 @@ void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide)
 
 StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint8_t *data, uint32_t data_len)
 {
+    if (BLOCK_MODE(sb)) {
+        StreamingBufferSegment *seg = CALLOC(sb->cfg, 1, sizeof(StreamingBufferSegment));
+        if (seg == NULL)
+            return NULL;
+        if (BlocksInsert(sb, sb->buf_offset, data, data_len) != 0) {
+            FREE(sb->cfg, seg, sizeof(StreamingBufferSegment));
+            return NULL;
+        }
+        seg->stream_offset = sb->stream_offset + sb->buf_offset - data_len;
+        seg->segment_len = data_len;
+        return seg;
+    }
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
             return NULL;
@@ -197,7 +460,8 @@ StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb, const uint
                 GrowToSize(sb, data_len);
             } else {
                 while (!DATA_FITS(sb, data_len)) {
-                    Grow(sb);
+                    if (Grow(sb) != 0)
+                        break;
                 }
             }
         }
@@ -220,6 +484,14 @@ void StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
 {
     BUG_ON(seg == NULL);
 
+    if (BLOCK_MODE(sb)) {
+        if (BlocksInsert(sb, sb->buf_offset, data, data_len) != 0)
+            return;
+        seg->stream_offset = sb->stream_offset + sb->buf_offset - data_len;
+        seg->segment_len = data_len;
+        return;
+    }
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
             return;
@@ -232,7 +504,8 @@ void StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
             GrowToSize(sb, data_len);
         } else {
             while (!DATA_FITS(sb, data_len)) {
-                Grow(sb);
+                if (Grow(sb) != 0)
+                    break;
             }
         }
     }
@@ -248,13 +521,19 @@ void StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
 
 /**
  *  \brief add data w/o tracking a segment
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, data couldn't be added
  */
-void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
-                                  const uint8_t *data, uint32_t data_len)
+int StreamingBufferAppendNoTrack(StreamingBuffer *sb,
+                                 const uint8_t *data, uint32_t data_len)
 {
+    if (BLOCK_MODE(sb))
+        return BlocksInsert(sb, sb->buf_offset, data, data_len);
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
-            return;
+            return -1;
     }
 
     if (!DATA_FITS(sb, data_len)) {
@@ -264,16 +543,18 @@ void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
             GrowToSize(sb, data_len);
         } else {
             while (!DATA_FITS(sb, data_len)) {
-                Grow(sb);
+                if (Grow(sb) != 0)
+                    break;
             }
         }
     }
     if (!DATA_FITS(sb, data_len)) {
-        return;
+        return -1;
     }
 
     memcpy(sb->buf + sb->buf_offset, data, data_len);
     sb->buf_offset += data_len;
+    return 0;
 }
 
 #define DATA_FITS_AT_OFFSET(sb, len, offset) \
@@ -291,6 +572,14 @@ void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
     if (offset < sb->stream_offset)
         return;
 
+    if (BLOCK_MODE(sb)) {
+        if (BlocksInsert(sb, offset - sb->stream_offset, data, data_len) != 0)
+            return;
+        seg->stream_offset = offset;
+        seg->segment_len = data_len;
+        return;
+    }
+
     if (sb->buf == NULL) {
         if (InitBuffer(sb) == -1)
             return;
@@ -332,6 +621,24 @@ void StreamingBufferSegmentGetData(const StreamingBuffer *sb,
                                    const StreamingBufferSegment *seg,
                                    const uint8_t **data, uint32_t *data_len)
 {
+    if (BLOCK_MODE(sb)) {
+        uint64_t rel = 0;
+        uint32_t len = 0;
+        if (seg->stream_offset >= sb->stream_offset) {
+            rel = seg->stream_offset - sb->stream_offset;
+            if (rel < sb->buf_size) {
+                len = seg->segment_len;
+                if (rel + len > sb->buf_size)
+                    len = sb->buf_size - rel;
+            }
+        } else if (sb->stream_offset - seg->stream_offset < seg->segment_len) {
+            len = seg->segment_len - (sb->stream_offset - seg->stream_offset);
+        }
+        *data = len ? BlocksGetFlat(sb, rel, len) : NULL;
+        *data_len = *data ? len : 0;
+        return;
+    }
+
     if (seg->stream_offset >= sb->stream_offset) {
         uint64_t offset = seg->stream_offset - sb->stream_offset;
         *data = sb->buf + offset;
@@ -377,7 +684,12 @@ int StreamingBufferGetData(const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t *stream_offset)
 {
-    if (sb != NULL && sb->buf != NULL) {
+    if (sb != NULL && BLOCK_MODE(sb) && sb->blocks_cnt > 0) {
+        *data = BlocksGetFlat(sb, 0, sb->buf_offset);
+        *data_len = *data ? sb->buf_offset : 0;
+        *stream_offset = sb->stream_offset;
+        return (*data != NULL);
+    } else if (sb != NULL && sb->buf != NULL) {
         *data = sb->buf;
         *data_len = sb->buf_offset;
         *stream_offset = sb->stream_offset;
@@ -394,7 +706,15 @@ int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t offset)
 {
-    if (sb != NULL && sb->buf != NULL &&
+    if (sb != NULL && BLOCK_MODE(sb) &&
+            offset >= sb->stream_offset &&
+            offset < (sb->stream_offset + sb->buf_offset))
+    {
+        uint32_t skip = offset - sb->stream_offset;
+        *data = BlocksGetFlat(sb, skip, sb->buf_offset - skip);
+        *data_len = *data ? sb->buf_offset - skip : 0;
+        return (*data != NULL);
+    } else if (sb != NULL && sb->buf != NULL &&
             offset >= sb->stream_offset &&
             offset < (sb->stream_offset + sb->buf_offset))
     {
@@ -409,6 +729,35 @@ int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
     }
 }
 
+/**
+ *  rief get the data at 'offset' without copying it
+ *
+ *  In block mode only the data up to the end of the block is returned,
+ *  so callers that can handle the data in parts should loop over this
+ *  instead of using StreamingBufferGetDataAtOffset().
+ *
+ *  
+etval 1 data returned
+ *  
+etval 0 no data at 'offset'
+ */
+int StreamingBufferGetBlockAtOffset(const StreamingBuffer *sb,
+        const uint8_t **data, uint32_t *data_len,
+        uint64_t offset)
+{
+    if (sb != NULL && BLOCK_MODE(sb) &&
+            offset >= sb->stream_offset &&
+            offset < (sb->stream_offset + sb->buf_offset))
+    {
+        uint32_t skip = offset - sb->stream_offset;
+        uint32_t avail = 0;
+        *data = BlockPtr((StreamingBuffer *)sb, skip, &avail);
+        *data_len = *data ? MIN(avail, sb->buf_offset - skip) : 0;
+        return (*data != NULL);
+    }
+    return StreamingBufferGetDataAtOffset(sb, data, data_len, offset);
+}
+
 /**
  *  \retval 1 data is the same
  *  \retval 0 data is different
@@ -434,7 +783,12 @@ int StreamingBufferCompareRawData(const StreamingBuffer *sb,
 
 void Dump(StreamingBuffer *sb)
 {
-    PrintRawDataFp(stdout, sb->buf, sb->buf_offset);
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+    if (StreamingBufferGetData(sb, &data, &data_len, &offset) && data_len) {
+        PrintRawDataFp(stdout, data, data_len);
+    }
 }
 
 void DumpSegment(StreamingBuffer *sb, StreamingBufferSegment *seg)
@@ -711,6 +1065,111 @@ static int StreamingBufferTest05(void)
     StreamingBufferClear(&sb);
     PASS;
 }
+
+static void *StreamingBufferTestFailRealloc(void *ptr, size_t orig, size_t size)
+{
+    return NULL;
+}
+
+/** \test growing fails: append returns error instead of looping */
+static int StreamingBufferTest06(void)
+{
+    StreamingBufferConfig cfg = { 0, 8, 8, NULL, NULL,
+        StreamingBufferTestFailRealloc, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"ABCDEFGH", 8) != 0);
+    FAIL_IF(sb->buf_offset != 8);
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"01234567", 8) != -1);
+    FAIL_IF(sb->buf_offset != 8);
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test block mode: appends span blocks, sliding drops whole blocks */
+static int StreamingBufferTest07(void)
+{
+    StreamingBufferConfig cfg = { 0, 0, 0, NULL, NULL, NULL, NULL, 8 };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+    FAIL_IF(sb->buf != NULL);
+
+    StreamingBufferSegment seg1, seg2, seg3;
+    StreamingBufferAppend(sb, &seg1, (const uint8_t *)"ABCDEF", 6);
+    StreamingBufferAppend(sb, &seg2, (const uint8_t *)"GHIJKL", 6);
+    StreamingBufferAppend(sb, &seg3, (const uint8_t *)"MNOPQRSTUVWX", 12);
+    FAIL_IF(sb->blocks_cnt != 3);
+    FAIL_IF(sb->buf_offset != 24);
+    FAIL_IF(seg2.stream_offset != 6);
+    FAIL_IF(seg3.stream_offset != 12);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg2, (const uint8_t *)"GHIJKL", 6));
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg3, (const uint8_t *)"MNOPQRSTUVWX", 12));
+    FAIL_IF(!StreamingBufferCompareRawData(sb, (const uint8_t *)"ABCDEFGHIJKLMNOPQRSTUVWX", 24));
+
+    /* the blocks are returned one at a time */
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    FAIL_IF(!StreamingBufferGetBlockAtOffset(sb, &data, &data_len, 4));
+    FAIL_IF(data_len != 4 || memcmp(data, "EFGH", 4) != 0);
+    FAIL_IF(!StreamingBufferGetBlockAtOffset(sb, &data, &data_len, 8));
+    FAIL_IF(data_len != 8 || memcmp(data, "IJKLMNOP", 8) != 0);
+
+    StreamingBufferSlideToOffset(sb, 10);
+    FAIL_IF(sb->stream_offset != 10);
+    FAIL_IF(sb->buf_offset != 14);
+    FAIL_IF(sb->blocks_cnt != 2);
+    FAIL_IF(sb->spare == NULL);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg3, (const uint8_t *)"MNOPQRSTUVWX", 12));
+    FAIL_IF(!StreamingBufferGetDataAtOffset(sb, &data, &data_len, 10));
+    FAIL_IF(data_len != 14 || memcmp(data, "KLMNOPQRSTUVWX", 14) != 0);
+
+    /* the spare block is reused */
+    uint8_t *spare = sb->spare;
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"YZ", 2) != 0);
+    FAIL_IF(sb->spare != NULL);
+    FAIL_IF(sb->blocks[2] != spare);
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"0123", 4) != 0);
+    FAIL_IF(sb->blocks_cnt != 3);
+    FAIL_IF(!StreamingBufferGetDataAtOffset(sb, &data, &data_len, 24));
+    FAIL_IF(data_len != 6 || memcmp(data, "YZ0123", 6) != 0);
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
+/** \test block mode: out of order inserts leave zeroed gaps */
+static int StreamingBufferTest08(void)
+{
+    StreamingBufferConfig cfg = { 0, 0, 0, NULL, NULL, NULL, NULL, 4 };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    StreamingBufferSegment seg1, seg2;
+    StreamingBufferInsertAt(sb, &seg1, (const uint8_t *)"WXYZ", 4, 10);
+    FAIL_IF(seg1.stream_offset != 10);
+    FAIL_IF(sb->buf_offset != 14);
+    StreamingBufferInsertAt(sb, &seg2, (const uint8_t *)"ABCDEFGHIJ", 10, 0);
+    FAIL_IF(sb->buf_offset != 14);
+    FAIL_IF(!StreamingBufferSegmentCompareRawData(sb, &seg1, (const uint8_t *)"WXYZ", 4));
+    FAIL_IF(!StreamingBufferCompareRawData(sb, (const uint8_t *)"ABCDEFGHIJWXYZ", 14));
+
+    StreamingBufferSlide(sb, 6);
+    FAIL_IF(sb->stream_offset != 6);
+    FAIL_IF(sb->blocks_cnt != 3);
+    FAIL_IF(StreamingBufferSegmentIsBeforeWindow(sb, &seg1));
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    FAIL_IF(!StreamingBufferGetDataAtOffset(sb, &data, &data_len, 6));
+    FAIL_IF(data_len != 8 || memcmp(data, "GHIJWXYZ", 8) != 0);
+
+    StreamingBufferClear(sb);
+    FAIL_IF(sb->blocks != NULL);
+    FAIL_IF(sb->blocks_cnt != 0);
+    StreamingBufferFree(sb);
+    PASS;
+}
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -721,5 +1180,57 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest03", StreamingBufferTest03);
     UtRegisterTest("StreamingBufferTest04", StreamingBufferTest04);
     UtRegisterTest("StreamingBufferTest05", StreamingBufferTest05);
+    UtRegisterTest("StreamingBufferTest06", StreamingBufferTest06);
+    UtRegisterTest("StreamingBufferTest07", StreamingBufferTest07);
+    UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
 #endif
 }
+
+#ifdef BENCHMARKS
+static const uint32_t sb_bench_segment_sizes[] = { 64, 536, 1460 };
+
+/** \internal
+ *  \brief append segments, sliding the window like the reassembly does
+ *         when data is consumed */
+static int StreamingBufferBenchAppendSlide(BenchCtx *b)
+{
+    const uint32_t seg_size = *(const uint32_t *)b->data;
+    StreamingBufferConfig cfg = { 0, 4096, 4096, NULL, NULL, NULL, NULL };
+    uint8_t data[1460];
+    memset(data, 'A', sizeof(data));
+
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    if (sb == NULL)
+        return 0;
+
+    b->bytes = seg_size;
+    uint64_t n;
+    BenchTimerStart(b);
+    for (n = 0; n < b->n; n++) {
+        StreamingBufferSegment seg;
+        StreamingBufferAppend(sb, &seg, data, seg_size);
+        /* keep the last 16k once 64k is buffered */
+        if (sb->buf_offset > 65536)
+            StreamingBufferSlideToOffset(sb,
+                    sb->stream_offset + sb->buf_offset - 16384);
+    }
+    BenchTimerStop(b);
+
+    StreamingBufferFree(sb);
+    return 1;
+}
+#endif /* BENCHMARKS */
+
+void StreamingBufferRegisterBenchmarks(void)
+{
+#ifdef BENCHMARKS
+    uint32_t i;
+    for (i = 0; i < sizeof(sb_bench_segment_sizes) / sizeof(sb_bench_segment_sizes[0]); i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "streaming-buffer/append-slide/%"PRIu32,
+                sb_bench_segment_sizes[i]);
+        BenchRegister(name, StreamingBufferBenchAppendSlide,
+                &sb_bench_segment_sizes[i]);
+    }
+#endif /* BENCHMARKS */
+}
@@ -53,6 +53,15 @@
  * +-----------+-----------+
  * | offset    | len       |
  * +-----------+-----------+
+ *
+ * Block mode: with StreamingBufferConfig::block_size set the data is not
+ * kept in a single memory block, but in a chain of fixed size blocks
+ * with a small index. Growing only adds blocks and sliding only drops
+ * them, so data is never copied around. Readers that need the data in
+ * one piece still get it from the StreamingBufferGetData* functions:
+ * if the range spans blocks it's copied into a scratch buffer kept with
+ * the StreamingBuffer. Readers that can handle the data in parts use
+ * StreamingBufferGetBlockAtOffset() to get it block by block w/o copy.
  */
 
 
@@ -70,9 +79,10 @@ typedef struct StreamingBufferConfig_ {
     void *(*Calloc)(size_t n, size_t size);
     void *(*Realloc)(void *ptr, size_t orig_size, size_t size);
     void (*Free)(void *ptr, size_t size);
+    uint32_t block_size;    /**< block mode if non-zero */
 } StreamingBufferConfig;
 
-#define STREAMING_BUFFER_CONFIG_INITIALIZER { 0, 0, 0, NULL, NULL, NULL, NULL, }
+#define STREAMING_BUFFER_CONFIG_INITIALIZER { 0, 0, 0, NULL, NULL, NULL, NULL, 0, }
 
 typedef struct StreamingBuffer_ {
     const StreamingBufferConfig *cfg;
@@ -84,6 +94,18 @@ typedef struct StreamingBuffer_ {
 #ifdef DEBUG
     uint32_t buf_size_max;
 #endif
+
+    /* block mode: buf is unused, buf_size is the space in the blocks
+     * from stream_offset on */
+    uint8_t **blocks;       /**< index, blocks[0] holds stream_offset */
+    uint32_t blocks_cnt;    /**< blocks in use */
+    uint32_t blocks_size;   /**< size of the index */
+    uint32_t head_skip;     /**< position of stream_offset in blocks[0] */
+    uint8_t *spare;         /**< block dropped by a slide, reused next */
+    uint8_t *flat;          /**< copy of a range that spans blocks */
+    uint32_t flat_size;
+    uint32_t flat_len;      /**< 0 if the copy is not valid */
+    uint64_t flat_offset;   /**< stream offset of the copy */
 } StreamingBuffer;
 
 #ifndef DEBUG
@@ -108,7 +130,7 @@ StreamingBufferSegment *StreamingBufferAppendRaw(StreamingBuffer *sb,
         const uint8_t *data, uint32_t data_len);
 void StreamingBufferAppend(StreamingBuffer *sb, StreamingBufferSegment *seg,
         const uint8_t *data, uint32_t data_len);
-void StreamingBufferAppendNoTrack(StreamingBuffer *sb,
+int StreamingBufferAppendNoTrack(StreamingBuffer *sb,
         const uint8_t *data, uint32_t data_len);
 void StreamingBufferInsertAt(StreamingBuffer *sb, StreamingBufferSegment *seg,
                              const uint8_t *data, uint32_t data_len,
@@ -131,10 +153,14 @@ int StreamingBufferGetData(const StreamingBuffer *sb,
 int StreamingBufferGetDataAtOffset (const StreamingBuffer *sb,
         const uint8_t **data, uint32_t *data_len,
         uint64_t offset);
+int StreamingBufferGetBlockAtOffset(const StreamingBuffer *sb,
+        const uint8_t **data, uint32_t *data_len,
+        uint64_t offset);
 
 int StreamingBufferSegmentIsBeforeWindow(const StreamingBuffer *sb,
                                          const StreamingBufferSegment *seg);
 
 void StreamingBufferRegisterTests(void);
+void StreamingBufferRegisterBenchmarks(void);
 
 #endif /* __UTIL_STREAMING_BUFFER_H__ */
@@ -48,6 +48,14 @@
  * is to avoid the problem that T2s time value might already trigger a flow
  * timeout as the flow lastts + 100000s is almost certainly meaning the flow
  * would be considered timed out.
+ *
+ * Coarse time
+ *
+ * TimeGetCoarse is for the callers that work in seconds and call it often,
+ * like the flow loggers. In live mode it reads the coarse realtime clock,
+ * which the vDSO serves without a syscall even where gettimeofday can't.
+ * In offline mode it returns the time the flow manager got at its last
+ * pass, instead of scanning the threads under their lock.
  */
 
 #include "suricata-common.h"
@@ -62,12 +70,18 @@ static struct timeval current_time = { 0, 0 };
 //static SCMutex current_time_mutex = SCMUTEX_INITIALIZER;
 static SCSpinlock current_time_spinlock;
 static char live = TRUE;
+/** offline time for TimeGetCoarse, seconds << 20 | usec, 0 if not set */
+SC_ATOMIC_DECLARE(uint64_t, coarse_time);
+/** id and second of the last time a thread stored, see TimeSetByThread */
+static __thread int thread_time_id = 0;
+static __thread time_t thread_time_sec = 0;
 
 struct tm *SCLocalTime(time_t timep, struct tm *result);
 
 void TimeInit(void)
 {
     SCSpinInit(&current_time_spinlock, 0);
+    SC_ATOMIC_INIT(coarse_time);
 
     /* Initialize Time Zone settings. */
     tzset();
@@ -90,14 +104,37 @@ void TimeModeSetOffline (void)
     SCLogDebug("offline time mode enabled");
 }
 
+/**
+ *  \brief store the time of a packet thread, offline mode only
+ *
+ *  The time is only stored when the second changes, or the time goes
+ *  back, so the thread store lock isn't taken for every packet. The
+ *  management threads work in seconds, so the stored time lagging the
+ *  packets by less than a second doesn't matter to them.
+ */
 void TimeSetByThread(const int thread_id, const struct timeval *tv)
 {
     if (live == TRUE)
         return;
+    if (thread_time_id == thread_id && thread_time_sec == tv->tv_sec)
+        return;
 
+    thread_time_id = thread_id;
+    thread_time_sec = tv->tv_sec;
     TmThreadsSetThreadTimestamp(thread_id, tv);
 }
 
+/** \brief set the offline time returned by TimeGetCoarse, meant for the
+ *         flow manager */
+void TimeSetCoarse(const struct timeval *tv)
+{
+    if (live == TRUE)
+        return;
+
+    SC_ATOMIC_SET(coarse_time,
+            ((uint64_t)tv->tv_sec << 20) | ((uint64_t)tv->tv_usec & 0xfffff));
+}
+
 #ifdef UNITTESTS
 void TimeSet(struct timeval *tv)
 {
@@ -155,6 +192,41 @@ void TimeGet(struct timeval *tv)
                (uintmax_t)tv->tv_sec, (uintmax_t)tv->tv_usec);
 }
 
+/**
+ *  \brief get the time at a resolution of about a clock tick in live
+ *         mode, or of a flow manager pass in offline mode
+ */
+void TimeGetCoarse(struct timeval *tv)
+{
+    if (tv == NULL)
+        return;
+
+    if (live == TRUE) {
+#ifdef CLOCK_REALTIME_COARSE
+        struct timespec ts;
+        if (likely(clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0)) {
+            tv->tv_sec = ts.tv_sec;
+            tv->tv_usec = ts.tv_nsec / 1000;
+            return;
+        }
+#endif
+        gettimeofday(tv, NULL);
+        return;
+    }
+
+    uint64_t t = SC_ATOMIC_GET(coarse_time);
+#ifdef UNITTESTS
+    if (unlikely(RunmodeIsUnittests()))
+        t = 0;
+#endif
+    if (t == 0) {
+        TimeGet(tv);
+        return;
+    }
+    tv->tv_sec = (time_t)(t >> 20);
+    tv->tv_usec = (suseconds_t)(t & 0xfffff);
+}
+
 #ifdef UNITTESTS
 /** \brief increment the time in the engine
  *  \param tv_sec seconds to increment the time with */
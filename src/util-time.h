@@ -39,6 +39,8 @@ void TimeDeinit(void);
 
 void TimeSetByThread(const int thread_id, const struct timeval *tv);
 void TimeGet(struct timeval *);
+void TimeGetCoarse(struct timeval *);
+void TimeSetCoarse(const struct timeval *);
 
 #ifdef UNITTESTS
 void TimeSet(struct timeval *);
@@ -429,6 +429,10 @@ void UTHFreePacket(Packet *p)
         /* TODO: Add more protocols */
     }
 #endif
+    if (p->alerts.alerts != NULL)
+        SCFree(p->alerts.alerts);
+    if (p->alerts.agg != NULL)
+        SCFree(p->alerts.agg);
     SCFree(p);
 }
 
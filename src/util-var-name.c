@@ -25,77 +25,35 @@
 
 #include "suricata-common.h"
 #include "detect.h"
-#include "util-hashlist.h"
+#include "util-hash-map.h"
+#include "util-var-name.h"
 
-/** \brief Name2idx mapping structure for flowbits, flowvars and pktvars. */
-typedef struct VariableName_ {
-    char *name;
+/** \brief key of the name to idx map for flowbits, flowvars and pktvars */
+typedef struct VariableNameKey_ {
+    const char *name;
     uint8_t type; /* flowbit, pktvar, etc */
-    uint8_t flags;
-    uint16_t idx;
-} VariableName;
+} VariableNameKey;
 
-static uint32_t VariableNameHash(HashListTable *ht, void *buf, uint16_t buflen)
+static inline uint32_t VariableNameKeyHash(const VariableNameKey *k)
 {
-     VariableName *fn = (VariableName *)buf;
-     uint32_t hash = strlen(fn->name) + fn->type;
-     uint16_t u;
-
-     for (u = 0; u < buflen; u++) {
-         hash += fn->name[u];
-     }
-
-     return hash;
+    return HashMapHashString(k->name, k->type);
 }
 
-static char VariableNameCompare(void *buf1, uint16_t len1, void *buf2, uint16_t len2)
+static inline int VariableNameKeyCompare(const VariableNameKey *k1,
+        const VariableNameKey *k2)
 {
-    VariableName *fn1 = (VariableName *)buf1;
-    VariableName *fn2 = (VariableName *)buf2;
-
-    if (fn1->type != fn2->type)
-        return 0;
-
-    if (strcmp(fn1->name,fn2->name) == 0)
-        return 1;
-
-    return 0;
+    return (k1->type == k2->type && strcmp(k1->name, k2->name) == 0);
 }
 
-static uint32_t VariableIdxHash(HashListTable *ht, void *buf, uint16_t buflen)
-{
-    VariableName *fn = (VariableName *)buf;
-    uint32_t hash = fn->idx + fn->type;
-    return hash;
-}
-
-static char VariableIdxCompare(void *buf1, uint16_t len1, void *buf2, uint16_t len2)
-{
-    VariableName *fn1 = (VariableName *)buf1;
-    VariableName *fn2 = (VariableName *)buf2;
-
-    if (fn1->type != fn2->type)
-        return 0;
-
-    if (fn1->idx == fn2->idx)
-        return 1;
-
-    return 0;
-}
+/* the names are owned by the name map, the idx map points to them */
+HASH_MAP_DEFINE(VariableNameMap, VariableNameKey, uint16_t,
+        VariableNameKeyHash, VariableNameKeyCompare)
+HASH_MAP_DEFINE(VariableIdxMap, uint32_t, const char *,
+        HashMapHashU32, HashMapCompareU32)
 
-static void VariableNameFree(void *data)
+static inline uint32_t VariableIdxKey(uint16_t idx, enum VarTypes type)
 {
-    VariableName *fn = (VariableName *)data;
-
-    if (fn == NULL)
-        return;
-
-    if (fn->name != NULL) {
-        SCFree(fn->name);
-        fn->name = NULL;
-    }
-
-    SCFree(fn);
+    return ((uint32_t)type << 16) | idx;
 }
 
 /** \brief Initialize the Name idx hash.
@@ -105,24 +63,40 @@ static void VariableNameFree(void *data)
  */
 int VariableNameInitHash(DetectEngineCtx *de_ctx)
 {
-    de_ctx->variable_names = HashListTableInit(4096, VariableNameHash, VariableNameCompare, VariableNameFree);
+    de_ctx->variable_names = SCMalloc(sizeof(VariableNameMap));
     if (de_ctx->variable_names == NULL)
-        return -1;
+        goto error;
+    if (VariableNameMapInit(de_ctx->variable_names, 256) != 0)
+        goto error;
 
-    de_ctx->variable_idxs = HashListTableInit(4096, VariableIdxHash, VariableIdxCompare, NULL);
+    de_ctx->variable_idxs = SCMalloc(sizeof(VariableIdxMap));
     if (de_ctx->variable_idxs == NULL)
-        return -1;
+        goto error;
+    if (VariableIdxMapInit(de_ctx->variable_idxs, 256) != 0)
+        goto error;
 
     de_ctx->variable_names_idx = 0;
     return 0;
+error:
+    VariableNameFreeHash(de_ctx);
+    return -1;
 }
 
 void VariableNameFreeHash(DetectEngineCtx *de_ctx)
 {
     if (de_ctx->variable_names != NULL) {
-        HashListTableFree(de_ctx->variable_names);
-        HashListTableFree(de_ctx->variable_idxs);
+        VariableNameMapEntry *e;
+        uint32_t iter = 0;
+        while ((e = VariableNameMapNext(de_ctx->variable_names, &iter)) != NULL) {
+            SCFree((char *)e->key.name);
+        }
+        VariableNameMapFree(de_ctx->variable_names);
+        SCFree(de_ctx->variable_names);
         de_ctx->variable_names = NULL;
+    }
+    if (de_ctx->variable_idxs != NULL) {
+        VariableIdxMapFree(de_ctx->variable_idxs);
+        SCFree(de_ctx->variable_idxs);
         de_ctx->variable_idxs = NULL;
     }
 
@@ -137,34 +111,45 @@ void VariableNameFreeHash(DetectEngineCtx *de_ctx)
  */
 uint16_t VariableNameGetIdx(DetectEngineCtx *de_ctx, char *name, enum VarTypes type)
 {
-    uint16_t idx = 0;
-
-    VariableName *fn = SCMalloc(sizeof(VariableName));
-    if (unlikely(fn == NULL))
-        goto error;
+    VariableNameKey key = { name, type };
 
-    memset(fn, 0, sizeof(VariableName));
+    /* known names, also the lookups at runtime, don't allocate */
+    uint16_t *lookup_idx = VariableNameMapLookup(de_ctx->variable_names, &key);
+    if (lookup_idx != NULL)
+        return *lookup_idx;
 
-    fn->type = type;
-    fn->name = SCStrdup(name);
-    if (fn->name == NULL)
-        goto error;
-
-    VariableName *lookup_fn = (VariableName *)HashListTableLookup(de_ctx->variable_names, (void *)fn, 0);
-    if (lookup_fn == NULL) {
-        de_ctx->variable_names_idx++;
+    key.name = SCStrdup(name);
+    if (unlikely(key.name == NULL))
+        return 0;
 
-        idx = fn->idx = de_ctx->variable_names_idx;
-        HashListTableAdd(de_ctx->variable_names, (void *)fn, 0);
-        HashListTableAdd(de_ctx->variable_idxs, (void *)fn, 0);
-    } else {
-        idx = lookup_fn->idx;
-        VariableNameFree(fn);
+    uint16_t idx = de_ctx->variable_names_idx + 1;
+    uint32_t idx_key = VariableIdxKey(idx, type);
+    if (VariableNameMapAdd(de_ctx->variable_names, &key, &idx) != 0) {
+        SCFree((char *)key.name);
+        return 0;
     }
-
+    if (VariableIdxMapAdd(de_ctx->variable_idxs, &idx_key, &key.name) != 0) {
+        VariableNameMapRemove(de_ctx->variable_names, &key);
+        SCFree((char *)key.name);
+        return 0;
+    }
+    de_ctx->variable_names_idx = idx;
     return idx;
-error:
-    VariableNameFree(fn);
+}
+
+/** \brief Get the idx of a known name, without adding it.
+ *  \param name nul terminated string with the name
+ *  \param type variable type
+ *  \retval 0 if the name isn't used
+ *  \retval idx the idx
+ */
+uint16_t VariableNameLookupIdx(DetectEngineCtx *de_ctx, const char *name, enum VarTypes type)
+{
+    VariableNameKey key = { name, type };
+
+    uint16_t *lookup_idx = VariableNameMapLookup(de_ctx->variable_names, &key);
+    if (lookup_idx != NULL)
+        return *lookup_idx;
     return 0;
 }
 
@@ -176,29 +161,11 @@ error:
  */
 char *VariableIdxGetName(DetectEngineCtx *de_ctx, uint16_t idx, enum VarTypes type)
 {
-    VariableName *fn = SCMalloc(sizeof(VariableName));
-    if (unlikely(fn == NULL))
-        goto error;
+    uint32_t idx_key = VariableIdxKey(idx, type);
 
-    char *name = NULL;
-    memset(fn, 0, sizeof(VariableName));
+    const char **lookup_name = VariableIdxMapLookup(de_ctx->variable_idxs, &idx_key);
+    if (lookup_name == NULL)
+        return NULL;
 
-    fn->type = type;
-    fn->idx = idx;
-
-    VariableName *lookup_fn = (VariableName *)HashListTableLookup(de_ctx->variable_idxs, (void *)fn, 0);
-    if (lookup_fn != NULL) {
-        name = SCStrdup(lookup_fn->name);
-        if (unlikely(name == NULL))
-            goto error;
-
-        VariableNameFree(fn);
-    } else {
-        goto error;
-    }
-
-    return name;
-error:
-    VariableNameFree(fn);
-    return NULL;
+    return SCStrdup(*lookup_name);
 }
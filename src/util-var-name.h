@@ -28,6 +28,7 @@ int VariableNameInitHash(DetectEngineCtx *);
 void VariableNameFreeHash(DetectEngineCtx *);
 
 uint16_t VariableNameGetIdx(DetectEngineCtx *, char *, enum VarTypes);
+uint16_t VariableNameLookupIdx(DetectEngineCtx *, const char *, enum VarTypes);
 char * VariableIdxGetName(DetectEngineCtx *, uint16_t , enum VarTypes);
 
 #endif